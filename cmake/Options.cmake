@@ -22,16 +22,50 @@ option(TP_USE_CUDA "Enable support for CUDA tensors" OFF)
 # Transports
 option(TP_ENABLE_IBV "Enable InfiniBand transport" ${LINUX})
 option(TP_ENABLE_SHM "Enable shm transport" ${LINUX})
+# Requires the headers of a recent kernel (5.19+) to build, and one (6.0+) to
+# run, hence it's opt-in.
+option(TP_ENABLE_URING "Enable io_uring transport" OFF)
+# Needs the privileges to load BPF programs, and a dedicated interface queue, to
+# run, hence it's opt-in.
+option(TP_ENABLE_XDP "Enable AF_XDP transport" OFF)
+# Needs the headers of libfabric to build (though not the library, which is
+# loaded at runtime), hence it's opt-in.
+option(TP_ENABLE_FABRIC "Enable libfabric transport" OFF)
+# Only useful with a memory region that several hosts map (e.g., a CXL memory
+# pool), hence it's opt-in.
+option(TP_ENABLE_CXL "Enable CXL shared memory transport" OFF)
+# Needs the headers of UCX to build (though not the library, which is loaded at
+# runtime), hence it's opt-in.
+option(TP_ENABLE_UCX "Enable UCX transport" OFF)
 
 # Channels
 option(TP_ENABLE_CMA "Enable cma channel" ${LINUX})
+# The arena is handed over with the same abstract sockets as the shm transport.
+cmake_dependent_option(TP_ENABLE_SHM_POOL "Enable shm_pool channel" ON
+                       "TP_ENABLE_SHM" OFF)
 cmake_dependent_option(TP_ENABLE_CUDA_IPC "Enable CUDA IPC channel" ON
                        "TP_USE_CUDA" OFF)
+cmake_dependent_option(TP_ENABLE_CUDA_GDR "Enable CUDA GPUDirect RDMA channel"
+                       ON "TP_USE_CUDA;TP_ENABLE_IBV" OFF)
 
 # Optional features
 option(TP_BUILD_BENCHMARK "Build benchmarks" OFF)
 option(TP_BUILD_PYTHON "Build python bindings" OFF)
 option(TP_BUILD_TESTING "Build tests" OFF)
+# Requires the sys/sdt.h header of SystemTap.
+option(TP_ENABLE_USDT "Enable USDT probes for bpftrace and perf" OFF)
+# Codecs for the basic channel's optional compression, which need liblz4 and
+# libzstd respectively.
+option(TP_ENABLE_LZ4 "Enable LZ4 compression" OFF)
+option(TP_ENABLE_ZSTD "Enable zstd compression" OFF)
+# Offloads large copies to the Data Streaming Accelerator of recent Intel Xeons,
+# which needs the idxd headers of a 5.6+ kernel and a work queue set up for
+# user space at runtime.
+option(TP_ENABLE_DSA "Enable DSA copy offload" OFF)
+# TP_VLOG statements above this level are compiled out, so that they can't be
+# enabled at runtime through TP_VERBOSE_LOGGING but also cost nothing.
+set(TP_MAX_VERBOSITY_LEVEL 9 CACHE STRING
+    "Highest level of verbose logging that is compiled in (0 to 9)")
 
 # Whether to build a static or shared library
 if(BUILD_SHARED_LIBS)
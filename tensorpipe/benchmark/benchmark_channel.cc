@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <sys/resource.h>
+
+#include <cstring>
+
+#include <atomic>
+#include <functional>
+#include <future>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/channel/channel.h>
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/config.h>
+#include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/listener.h>
+
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/benchmark/cuda_channel_registry.h>
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_buffer.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+// This benchmark sets up a single channel between two processes, outside of
+// any pipe, and measures round trips of tensors of increasing sizes through
+// it. The descriptors produced by the sender are forwarded to the receiver on
+// a separate control connection of the chosen transport, as a pipe would do.
+
+static std::unique_ptr<uint8_t[]> createData(const size_t size) {
+  auto data = std::make_unique<uint8_t[]>(size);
+  // Generate fixed data for validation between peers
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (i >> 8) ^ (i & 0xff);
+  }
+  return data;
+}
+
+class CpuMemory {
+ public:
+  CpuMemory(const Options& /* unused */, size_t size)
+      : ptr_(std::make_unique<uint8_t[]>(size)) {}
+
+  void fill(size_t size) {
+    auto data = createData(size);
+    std::memcpy(ptr_.get(), data.get(), size);
+  }
+
+  CpuBuffer buffer(size_t length) {
+    return CpuBuffer{ptr_.get(), length};
+  }
+
+  void check(size_t length) {
+    TP_DCHECK_EQ(memcmp(ptr_.get(), createData(length).get(), length), 0);
+  }
+
+ private:
+  std::unique_ptr<uint8_t[]> ptr_;
+};
+
+#if TENSORPIPE_SUPPORTS_CUDA
+class CudaMemory {
+ public:
+  CudaMemory(const Options& options, size_t size) {
+    TP_CUDA_CHECK(cudaSetDevice(options.cudaDevice));
+    TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    TP_CUDA_CHECK(cudaMalloc(&ptr_, size));
+  }
+
+  void fill(size_t size) {
+    auto data = createData(size);
+    TP_CUDA_CHECK(cudaMemcpy(ptr_, data.get(), size, cudaMemcpyHostToDevice));
+  }
+
+  CudaBuffer buffer(size_t length) {
+    return CudaBuffer{ptr_, length, stream_};
+  }
+
+  // Copying back to the host would add a synchronization to each round trip.
+  void check(size_t /* unused */) {}
+
+  ~CudaMemory() {
+    TP_CUDA_CHECK(cudaFree(ptr_));
+    TP_CUDA_CHECK(cudaStreamDestroy(stream_));
+  }
+
+ private:
+  void* ptr_{nullptr};
+  cudaStream_t stream_;
+};
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+template <typename TBuffer>
+struct Peer {
+  std::shared_ptr<transport::Connection> controlConnection;
+  std::shared_ptr<channel::Channel<TBuffer>> channel;
+};
+
+static std::vector<size_t> tensorSizes(const Options& options) {
+  std::vector<size_t> sizes;
+  if (options.maxTensorSize == 0) {
+    sizes.push_back(options.tensorSize);
+    return sizes;
+  }
+  for (size_t size = options.tensorSize; size <= options.maxTensorSize;
+       size *= 2) {
+    sizes.push_back(size);
+  }
+  return sizes;
+}
+
+static std::chrono::nanoseconds cpuTime() {
+  struct rusage usage;
+  TP_THROW_SYSTEM_IF(::getrusage(RUSAGE_SELF, &usage) < 0, errno);
+  return std::chrono::seconds(usage.ru_utime.tv_sec) +
+      std::chrono::microseconds(usage.ru_utime.tv_usec) +
+      std::chrono::seconds(usage.ru_stime.tv_sec) +
+      std::chrono::microseconds(usage.ru_stime.tv_usec);
+}
+
+static void printHeader() {
+  fprintf(
+      stderr,
+      "%-15s %-12s %-12s %-9s %-9s %-9s %-12s %-12s\n",
+      "tensor-size",
+      "# ping-pong",
+      "avg (usec)",
+      "p50",
+      "p90",
+      "p99",
+      "MB/s",
+      "CPU ns/B");
+}
+
+static void printMeasurements(
+    Measurements& measurements,
+    size_t size,
+    std::chrono::nanoseconds elapsed,
+    std::chrono::nanoseconds cpu) {
+  measurements.sort();
+  // Each round trip moves the tensor once in each direction.
+  double numBytes = 2.0 * size * measurements.size();
+  fprintf(
+      stderr,
+      "%-15lu %-12lu %-12.3f %-9.3f %-9.3f %-9.3f %-12.3f %-12.3f\n",
+      size,
+      measurements.size(),
+      measurements.sum().count() / (float)measurements.size() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      numBytes / (elapsed.count() / 1e9) / 1e6,
+      cpu.count() / numBytes);
+}
+
+template <typename TBuffer>
+static void sendNonBlock(
+    Peer<TBuffer>& peer,
+    TBuffer buffer,
+    std::function<void()> callback) {
+  peer.channel->send(
+      buffer,
+      [&peer](const Error& error, channel::TDescriptor descriptor) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        auto descriptorHolder =
+            std::make_shared<channel::TDescriptor>(std::move(descriptor));
+        peer.controlConnection->write(
+            descriptorHolder->data(),
+            descriptorHolder->size(),
+            [descriptorHolder](const Error& error) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+            });
+      },
+      [callback{std::move(callback)}](const Error& error) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        callback();
+      });
+}
+
+template <typename TBuffer>
+static void recvNonBlock(
+    Peer<TBuffer>& peer,
+    TBuffer buffer,
+    std::function<void()> callback) {
+  peer.controlConnection->read(
+      [&peer, buffer, callback{std::move(callback)}](
+          const Error& error, const void* ptr, size_t len) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        peer.channel->recv(
+            channel::TDescriptor(static_cast<const char*>(ptr), len),
+            buffer,
+            [callback{std::move(callback)}](const Error& error) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+              callback();
+            });
+      });
+}
+
+template <typename TBuffer, typename TMemory>
+static void serverPongPingNonBlock(
+    Peer<TBuffer>& peer,
+    TMemory& sendMemory,
+    TMemory& recvMemory,
+    const std::vector<size_t>& sizes,
+    size_t sizeIdx,
+    int numRoundTrips,
+    int numRoundTripsLeft,
+    std::promise<void>& doneProm) {
+  size_t size = sizes[sizeIdx];
+  // The references are to objects that outlive the whole benchmark.
+  auto onRecv = [&, size, sizeIdx, numRoundTrips, numRoundTripsLeft]() {
+    recvMemory.check(size);
+    auto onSend = [&, sizeIdx, numRoundTrips, numRoundTripsLeft]() {
+      if (numRoundTripsLeft > 1) {
+        serverPongPingNonBlock(
+            peer,
+            sendMemory,
+            recvMemory,
+            sizes,
+            sizeIdx,
+            numRoundTrips,
+            numRoundTripsLeft - 1,
+            doneProm);
+      } else if (sizeIdx + 1 < sizes.size()) {
+        serverPongPingNonBlock(
+            peer,
+            sendMemory,
+            recvMemory,
+            sizes,
+            sizeIdx + 1,
+            numRoundTrips,
+            numRoundTrips,
+            doneProm);
+      } else {
+        doneProm.set_value();
+      }
+    };
+    sendNonBlock(peer, sendMemory.buffer(size), std::move(onSend));
+  };
+  recvNonBlock(peer, recvMemory.buffer(size), std::move(onRecv));
+}
+
+// The send and the receive of each round trip are issued together, and the
+// round trip is over once both have completed.
+template <typename TBuffer, typename TMemory>
+static void clientPingPongNonBlock(
+    Peer<TBuffer>& peer,
+    TMemory& sendMemory,
+    TMemory& recvMemory,
+    size_t size,
+    int numRoundTripsLeft,
+    std::promise<void>& doneProm,
+    Measurements& measurements) {
+  measurements.markStart();
+  auto numPending = std::make_shared<std::atomic<int>>(2);
+  std::function<void()> onCompletion = [&,
+                                        size,
+                                        numRoundTripsLeft,
+                                        numPending]() {
+    if (--(*numPending) > 0) {
+      return;
+    }
+    measurements.markStop();
+    recvMemory.check(size);
+    if (numRoundTripsLeft > 1) {
+      clientPingPongNonBlock(
+          peer,
+          sendMemory,
+          recvMemory,
+          size,
+          numRoundTripsLeft - 1,
+          doneProm,
+          measurements);
+    } else {
+      doneProm.set_value();
+    }
+  };
+  recvNonBlock(peer, recvMemory.buffer(size), onCompletion);
+  sendNonBlock(peer, sendMemory.buffer(size), onCompletion);
+}
+
+template <typename TBuffer, typename TMemory>
+static void run(
+    const Options& options,
+    std::shared_ptr<channel::Context<TBuffer>> channelContext) {
+  std::vector<size_t> sizes = tensorSizes(options);
+  TMemory sendMemory(options, sizes.back());
+  TMemory recvMemory(options, sizes.back());
+  sendMemory.fill(sizes.back());
+
+  auto transportContext = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
+  validateTransportContext(transportContext);
+
+  // The control connection is established first, and the listener signals
+  // when it has accepted it, so that the two connections can't be mixed up.
+  Peer<TBuffer> peer;
+  std::shared_ptr<transport::Connection> channelConnection;
+  std::shared_ptr<transport::Listener> listener;
+  if (options.mode == "listen") {
+    listener = transportContext->listen(options.address);
+    std::promise<std::shared_ptr<transport::Connection>> controlProm;
+    listener->accept([&](const Error& error,
+                         std::shared_ptr<transport::Connection> connection) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+      controlProm.set_value(std::move(connection));
+    });
+    peer.controlConnection = controlProm.get_future().get();
+
+    uint8_t ready = 0;
+    peer.controlConnection->write(
+        &ready, sizeof(ready), [](const Error& error) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+        });
+
+    std::promise<std::shared_ptr<transport::Connection>> channelProm;
+    listener->accept([&](const Error& error,
+                         std::shared_ptr<transport::Connection> connection) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+      channelProm.set_value(std::move(connection));
+    });
+    channelConnection = channelProm.get_future().get();
+    peer.channel = channelContext->createChannel(
+        std::move(channelConnection), channel::Endpoint::kListen);
+  } else {
+    peer.controlConnection = transportContext->connect(options.address);
+
+    std::promise<void> readyProm;
+    peer.controlConnection->read(
+        [&](const Error& error, const void* /* unused */, size_t /* unused */) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          readyProm.set_value();
+        });
+    readyProm.get_future().get();
+
+    channelConnection = transportContext->connect(options.address);
+    peer.channel = channelContext->createChannel(
+        std::move(channelConnection), channel::Endpoint::kConnect);
+  }
+
+  if (options.mode == "listen") {
+    std::promise<void> doneProm;
+    serverPongPingNonBlock(
+        peer,
+        sendMemory,
+        recvMemory,
+        sizes,
+        /*sizeIdx=*/0,
+        options.numRoundTrips,
+        options.numRoundTrips,
+        doneProm);
+    doneProm.get_future().get();
+  } else {
+    printHeader();
+    for (size_t size : sizes) {
+      Measurements measurements;
+      measurements.reserve(options.numRoundTrips);
+      std::promise<void> doneProm;
+      auto start = Measurements::clock::now();
+      auto cpuStart = cpuTime();
+      clientPingPongNonBlock(
+          peer,
+          sendMemory,
+          recvMemory,
+          size,
+          options.numRoundTrips,
+          doneProm,
+          measurements);
+      doneProm.get_future().get();
+      auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+          Measurements::clock::now() - start);
+      printMeasurements(measurements, size, elapsed, cpuTime() - cpuStart);
+    }
+  }
+
+  peer.channel->close();
+  channelContext->join();
+  peer.controlConnection->close();
+  if (listener) {
+    listener->close();
+  }
+  transportContext->join();
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  std::cout << "mode = " << x.mode << "\n";
+  std::cout << "transport = " << x.transport << "\n";
+  std::cout << "channel = " << x.channel << "\n";
+  std::cout << "address = " << x.address << "\n";
+  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+  std::cout << "tensor_size = " << x.tensorSize << "\n";
+  std::cout << "max_tensor_size = " << x.maxTensorSize << "\n";
+  std::cout << "cuda_device = " << x.cudaDevice << "\n";
+  std::cout << "transport_opts = " << x.transportTunables.str() << "\n";
+  std::cout << "channel_opts = " << x.channelTunables.str() << "\n";
+
+  if (x.channel.empty() || x.tensorSize == 0) {
+    fprintf(
+        stderr, "Missing argument: --channel and --tensor-size must be set\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (x.cudaDevice < 0) {
+    auto channelContext = TensorpipeChannelRegistry().create(
+        x.channel, x.channelTunables);
+    validateChannelContext(channelContext);
+    run<CpuBuffer, CpuMemory>(x, std::move(channelContext));
+  } else {
+#if TENSORPIPE_SUPPORTS_CUDA
+    auto channelContext = TensorpipeCudaChannelRegistry().create(x.channel);
+    validateCudaChannelContext(channelContext);
+    run<CudaBuffer, CudaMemory>(x, std::move(channelContext));
+#else // TENSORPIPE_SUPPORTS_CUDA
+    fprintf(stderr, "Invalid argument: TensorPipe was built without CUDA\n");
+    exit(EXIT_FAILURE);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  }
+
+  return 0;
+}
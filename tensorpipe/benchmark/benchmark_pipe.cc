@@ -8,45 +8,100 @@
 
 #include <cstring>
 
+#include <algorithm>
+#include <functional>
 #include <future>
+#include <random>
+#include <thread>
 
 #include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/cpu_usage.h>
 #include <tensorpipe/benchmark/measurements.h>
 #include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/report.h>
 #include <tensorpipe/benchmark/transport_registry.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/pipe.h>
 
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/benchmark/cuda_channel_registry.h>
+#include <tensorpipe/common/cuda.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
 using namespace tensorpipe;
 using namespace tensorpipe::benchmark;
 
-Measurements measurements;
+#if TENSORPIPE_SUPPORTS_CUDA
+struct CudaDeleter {
+  void operator()(void* ptr) {
+    TP_CUDA_CHECK(cudaFree(ptr));
+  }
+};
+
+using CudaPtr = std::unique_ptr<void, CudaDeleter>;
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
 struct Data {
   size_t numPayloads;
   size_t payloadSize;
   std::vector<std::unique_ptr<uint8_t[]>> expectedPayload;
   std::vector<std::string> expectedPayloadMetadata;
-  std::vector<std::unique_ptr<uint8_t[]>> temporaryPayload;
 
   size_t numTensors;
   size_t tensorSize;
   std::vector<std::unique_ptr<uint8_t[]>> expectedTensor;
   std::vector<std::string> expectedTensorMetadata;
-  std::vector<std::unique_ptr<uint8_t[]>> temporaryTensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+  // When set, tensors are in device memory, and these hold the expected data.
+  bool useCuda{false};
+  bool cudaSync{false};
+  std::vector<CudaPtr> expectedCudaTensor;
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
   std::string expectedMetadata;
 };
 
+// The state of one of the concurrent pipes. Once the pipe is started, it's
+// only accessed from within the callbacks of the pipe, which are all invoked
+// from the loop of its context, hence it needs no locking.
+struct PipeState {
+  std::shared_ptr<Pipe> pipe;
+  // Messages are read one at a time, hence one set of buffers is enough.
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryPayload;
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryTensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+  std::vector<CudaPtr> temporaryCudaTensor;
+  // All the tensors of the pipe, in both directions, are on this stream.
+  cudaStream_t stream{cudaStreamDefault};
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  int numMessages{0};
+  int numReadsLeft{0};
+  int numWritesLeft{0};
+  // Indexed by sequence number, as with a window several are in flight.
+  std::vector<Measurements::clock::time_point> startTimes;
+  Measurements measurements;
+
+  std::promise<void> doneProm;
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  ~PipeState() {
+    if (stream != cudaStreamDefault) {
+      TP_CUDA_CHECK(cudaStreamDestroy(stream));
+    }
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+};
+
 static void printMeasurements(Measurements& measurements, size_t dataLen) {
   measurements.sort();
   fprintf(
       stderr,
       "%-15s %-15s %-12s %-7s %-7s %-7s %-7s\n",
       "chunk-size",
-      "# ping-pong",
+      "# samples",
       "avg (usec)",
       "p50",
       "p75",
@@ -64,6 +119,27 @@ static void printMeasurements(Measurements& measurements, size_t dataLen) {
       measurements.percentile(0.95).count() / 1000.0);
 }
 
+static void printThroughput(
+    size_t numMessages,
+    size_t numBytes,
+    std::chrono::nanoseconds elapsed) {
+  double seconds = elapsed.count() / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-12s %-12s\n",
+      "# messages",
+      "total (MB)",
+      "msgs/s",
+      "GB/s");
+  fprintf(
+      stderr,
+      "%-15lu %-15.3f %-12.0f %-12.3f\n",
+      numMessages,
+      numBytes / 1e6,
+      numMessages / seconds,
+      numBytes / seconds / 1e9);
+}
+
 static std::unique_ptr<uint8_t[]> createData(const int size) {
   auto data = std::make_unique<uint8_t[]>(size);
   // Generate fixed data for validation between peers
@@ -73,14 +149,180 @@ static std::unique_ptr<uint8_t[]> createData(const int size) {
   return data;
 }
 
-static void serverPongPingNonBlock(
-    std::shared_ptr<Pipe> pipe,
-    int& numRoundTrips,
-    std::promise<void>& doneProm,
-    Data& data,
-    Measurements& measurements) {
-  pipe->readDescriptor([pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                           const Error& error, Message&& message) {
+#if TENSORPIPE_SUPPORTS_CUDA
+static CudaPtr createCudaData(int device, const uint8_t* data, size_t size) {
+  TP_CUDA_CHECK(cudaSetDevice(device));
+  void* ptr;
+  TP_CUDA_CHECK(cudaMalloc(&ptr, size));
+  CudaPtr cudaPtr(ptr);
+  if (data != nullptr) {
+    TP_CUDA_CHECK(cudaMemcpy(ptr, data, size, cudaMemcpyHostToDevice));
+  }
+  return cudaPtr;
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+static Data createData(const Options& options) {
+  Data data;
+  data.numPayloads = options.numPayloads;
+  data.payloadSize = options.payloadSize;
+  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
+    data.expectedPayload.push_back(createData(options.payloadSize));
+    data.expectedPayloadMetadata.push_back(
+        std::string(options.metadataSize, 0x42));
+  }
+  data.numTensors = options.numTensors;
+  data.tensorSize = options.tensorSize;
+  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+    data.expectedTensor.push_back(createData(options.tensorSize));
+    data.expectedTensorMetadata.push_back(
+        std::string(options.metadataSize, 0x42));
+  }
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (options.cudaDevice >= 0) {
+    data.useCuda = true;
+    data.cudaSync = options.cudaSync;
+    for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+      data.expectedCudaTensor.push_back(createCudaData(
+          options.cudaDevice,
+          data.expectedTensor[tensorIdx].get(),
+          options.tensorSize));
+    }
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  data.expectedMetadata = std::string(options.metadataSize, 0x42);
+  return data;
+}
+
+static std::unique_ptr<PipeState> createPipeState(
+    const Options& options,
+    int numMessages) {
+  auto state = std::make_unique<PipeState>();
+  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
+    state->temporaryPayload.push_back(
+        std::make_unique<uint8_t[]>(options.payloadSize));
+  }
+  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+    state->temporaryTensor.push_back(
+        std::make_unique<uint8_t[]>(options.tensorSize));
+  }
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (options.cudaDevice >= 0) {
+    for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+      state->temporaryCudaTensor.push_back(createCudaData(
+          options.cudaDevice, /*data=*/nullptr, options.tensorSize));
+    }
+    TP_CUDA_CHECK(
+        cudaStreamCreateWithFlags(&state->stream, cudaStreamNonBlocking));
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  state->numMessages = numMessages;
+  state->startTimes.resize(numMessages);
+  state->measurements.reserve(numMessages);
+  return state;
+}
+
+static size_t messageSize(const Options& options) {
+  return options.metadataSize +
+      options.numPayloads * (options.metadataSize + options.payloadSize) +
+      options.numTensors * (options.metadataSize + options.tensorSize);
+}
+
+// Messages are counted in both directions in ping-pong mode. Each side either
+// sends or receives each of them, hence this is the same for both.
+static size_t numMessages(const Options& options) {
+  return static_cast<size_t>(options.numPipes) * options.numRoundTrips *
+      (options.pattern == "ping-pong" ? 2 : 1);
+}
+
+// The rates of the open-loop sweep, or a single zero for a closed loop.
+static std::vector<double> rates(const Options& options) {
+  std::vector<double> rates;
+  if (options.maxRate == 0) {
+    rates.push_back(options.rate);
+    return rates;
+  }
+  for (double rate = options.rate; rate <= options.maxRate; rate *= 2) {
+    rates.push_back(rate);
+  }
+  return rates;
+}
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>(
+      ContextOptions()
+          .lazyChannelEstablishment(options.lazyChannelEstablishment)
+          .speculativeChannelConnections(
+              options.speculativeChannelConnections));
+  auto transportContext = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+
+  // A CPU channel is still needed without CUDA tensors, but optional with them.
+  if (options.cudaDevice < 0 || !options.channel.empty()) {
+    auto channelContext = TensorpipeChannelRegistry().create(
+        options.channel, options.channelTunables);
+    validateChannelContext(channelContext);
+    context->registerChannel(0, options.channel, channelContext);
+  }
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  if (options.cudaDevice >= 0) {
+    auto cudaChannelContext =
+        TensorpipeCudaChannelRegistry().create(options.cudaChannel);
+    validateCudaChannelContext(cudaChannelContext);
+    context->registerChannel(0, options.cudaChannel, cudaChannelContext);
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  return context;
+}
+
+// The outgoing messages only point to the expected data, which is never
+// modified, hence any number of them can be in flight at once.
+static Message createMessage(const Data& data, const PipeState& state) {
+  Message message;
+  message.metadata = data.expectedMetadata;
+  if (data.payloadSize > 0) {
+    for (size_t payloadIdx = 0; payloadIdx < data.numPayloads; payloadIdx++) {
+      Message::Payload payload;
+      payload.data = data.expectedPayload[payloadIdx].get();
+      payload.length = data.payloadSize;
+      payload.metadata = data.expectedPayloadMetadata[payloadIdx];
+      message.payloads.push_back(std::move(payload));
+    }
+  }
+  if (data.tensorSize > 0) {
+    for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
+      Message::Tensor tensor;
+#if TENSORPIPE_SUPPORTS_CUDA
+      if (data.useCuda) {
+        tensor.buffer = CudaBuffer{
+            data.expectedCudaTensor[tensorIdx].get(),
+            data.tensorSize,
+            state.stream};
+      } else {
+        tensor.buffer =
+            CpuBuffer{data.expectedTensor[tensorIdx].get(), data.tensorSize};
+      }
+#else // TENSORPIPE_SUPPORTS_CUDA
+      tensor.buffer =
+          CpuBuffer{data.expectedTensor[tensorIdx].get(), data.tensorSize};
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      tensor.metadata = data.expectedTensorMetadata[tensorIdx];
+      message.tensors.push_back(std::move(tensor));
+    }
+  }
+  return message;
+}
+
+static void readNonBlock(
+    const Data& data,
+    PipeState& state,
+    std::function<void()> callback) {
+  state.pipe->readDescriptor([&data, &state, callback{std::move(callback)}](
+                                 const Error& error, Message&& message) {
     TP_THROW_ASSERT_IF(error) << error.what();
     TP_DCHECK_EQ(message.metadata, data.expectedMetadata);
     if (data.payloadSize > 0) {
@@ -91,7 +333,7 @@ static void serverPongPingNonBlock(
             data.expectedPayloadMetadata[payloadIdx]);
         TP_DCHECK_EQ(message.payloads[payloadIdx].length, data.payloadSize);
         message.payloads[payloadIdx].data =
-            data.temporaryPayload[payloadIdx].get();
+            state.temporaryPayload[payloadIdx].get();
       }
     } else {
       TP_DCHECK_EQ(message.payloads.size(), 0);
@@ -102,25 +344,47 @@ static void serverPongPingNonBlock(
         TP_DCHECK_EQ(
             message.tensors[tensorIdx].metadata,
             data.expectedTensorMetadata[tensorIdx]);
+#if TENSORPIPE_SUPPORTS_CUDA
+        if (data.useCuda) {
+          TP_DCHECK(
+              message.tensors[tensorIdx].buffer.type == DeviceType::kCuda);
+          TP_DCHECK_EQ(
+              message.tensors[tensorIdx].buffer.cuda.length, data.tensorSize);
+          message.tensors[tensorIdx].buffer = CudaBuffer{
+              state.temporaryCudaTensor[tensorIdx].get(),
+              data.tensorSize,
+              state.stream};
+          continue;
+        }
+#endif // TENSORPIPE_SUPPORTS_CUDA
         TP_DCHECK_EQ(
             message.tensors[tensorIdx].buffer.cpu.length, data.tensorSize);
         message.tensors[tensorIdx].buffer.cpu.ptr =
-            data.temporaryTensor[tensorIdx].get();
+            state.temporaryTensor[tensorIdx].get();
       }
     } else {
       TP_DCHECK_EQ(message.tensors.size(), 0);
     }
-    pipe->read(
+    state.pipe->read(
         std::move(message),
-        [pipe, &numRoundTrips, &doneProm, &data, &measurements](
+        [&data, &state, callback{std::move(callback)}](
             const Error& error, Message&& message) {
           TP_THROW_ASSERT_IF(error) << error.what();
+#if TENSORPIPE_SUPPORTS_CUDA
+          // The data isn't checked, as that would need a copy to the host and
+          // a synchronization even when they weren't requested.
+          if (data.useCuda) {
+            if (data.cudaSync) {
+              TP_CUDA_CHECK(cudaStreamSynchronize(state.stream));
+            }
+            callback();
+            return;
+          }
+#endif // TENSORPIPE_SUPPORTS_CUDA
           if (data.payloadSize > 0) {
             TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
             for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
                  payloadIdx++) {
-              TP_DCHECK_EQ(
-                  message.payloads[payloadIdx].length, data.payloadSize);
               TP_DCHECK_EQ(
                   memcmp(
                       message.payloads[payloadIdx].data,
@@ -128,16 +392,11 @@ static void serverPongPingNonBlock(
                       message.payloads[payloadIdx].length),
                   0);
             }
-          } else {
-            TP_DCHECK_EQ(message.tensors.size(), 0);
           }
           if (data.tensorSize > 0) {
             TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
             for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
                  tensorIdx++) {
-              TP_DCHECK_EQ(
-                  message.tensors[tensorIdx].buffer.cpu.length,
-                  data.tensorSize);
               TP_DCHECK_EQ(
                   memcmp(
                       message.tensors[tensorIdx].buffer.cpu.ptr,
@@ -145,258 +404,422 @@ static void serverPongPingNonBlock(
                       message.tensors[tensorIdx].buffer.cpu.length),
                   0);
             }
-          } else {
-            TP_DCHECK_EQ(message.tensors.size(), 0);
           }
-          pipe->write(
-              std::move(message),
-              [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                  const Error& error, Message&& message) {
-                TP_THROW_ASSERT_IF(error) << error.what();
-                if (--numRoundTrips > 0) {
-                  serverPongPingNonBlock(
-                      pipe, numRoundTrips, doneProm, data, measurements);
-                } else {
-                  doneProm.set_value();
-                }
-              });
+          callback();
         });
   });
 }
 
-// Start with receiving ping
-static void runServer(const Options& options) {
-  std::string addr = options.address;
-  int numRoundTrips = options.numRoundTrips;
+// In ping-pong mode the server echoes each message as soon as it's read. In
+// stream mode it only replies once, with an empty acknowledgement, after it
+// has read all of them.
+static void serverReadNonBlock(
+    const Options& options,
+    const Data& data,
+    PipeState& state) {
+  readNonBlock(data, state, [&options, &data, &state]() {
+    if (options.pattern == "ping-pong") {
+      state.pipe->write(
+          createMessage(data, state),
+          [&state](const Error& error, Message&&) {
+            TP_THROW_ASSERT_IF(error) << error.what();
+            if (--state.numWritesLeft == 0) {
+              state.doneProm.set_value();
+            }
+          });
+    }
+    if (--state.numReadsLeft > 0) {
+      serverReadNonBlock(options, data, state);
+    } else if (options.pattern == "stream") {
+      state.pipe->write(Message(), [&state](const Error& error, Message&&) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        state.doneProm.set_value();
+      });
+    }
+  });
+}
 
-  Data data;
-  data.numPayloads = options.numPayloads;
-  data.payloadSize = options.payloadSize;
-  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
-    data.expectedPayload.push_back(createData(options.payloadSize));
-    data.expectedPayloadMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryPayload.push_back(
-        std::make_unique<uint8_t[]>(options.payloadSize));
-  }
-  data.numTensors = options.numTensors;
-  data.tensorSize = options.tensorSize;
-  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
-    data.expectedTensor.push_back(createData(options.tensorSize));
-    data.expectedTensorMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryTensor.push_back(
-        std::make_unique<uint8_t[]>(options.tensorSize));
+// Serve one step of the sweep, on pipes of its own.
+static void runServerStep(
+    const Options& options,
+    const Data& data,
+    Listener& listener) {
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::vector<std::unique_ptr<PipeState>> states;
+  std::vector<std::future<void>> doneFutures;
+  for (int pipeIdx = 0; pipeIdx < options.numPipes; pipeIdx++) {
+    states.push_back(createPipeState(options, options.numRoundTrips));
+    states.back()->numReadsLeft = options.numRoundTrips;
+    states.back()->numWritesLeft = options.numRoundTrips;
+    doneFutures.push_back(states.back()->doneProm.get_future());
   }
-  data.expectedMetadata = std::string(options.metadataSize, 0x42);
 
-  Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
+  // The accept callbacks are invoked one after the other from the loop.
+  int numPipesAccepted = 0;
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptCallback =
+      [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        if (numPipesAccepted == 0) {
+          cpuUsage.start();
+        }
+        PipeState& state = *states[numPipesAccepted++];
+        state.pipe = std::move(pipe);
+        serverReadNonBlock(options, data, state);
+        if (numPipesAccepted < options.numPipes) {
+          listener.accept(acceptCallback);
+        }
+      };
+  listener.accept(acceptCallback);
 
-  std::shared_ptr<Context> context = std::make_shared<Context>();
-  auto transportContext =
-      TensorpipeTransportRegistry().create(options.transport);
-  validateTransportContext(transportContext);
-  context->registerTransport(0, options.transport, transportContext);
+  for (auto& doneFuture : doneFutures) {
+    doneFuture.get();
+  }
+  cpuUsage.stop();
 
-  auto channelContext = TensorpipeChannelRegistry().create(options.channel);
-  validateChannelContext(channelContext);
-  context->registerChannel(0, options.channel, channelContext);
+  size_t numBytes = numMessages(options) * messageSize(options);
+  cpuUsage.print(numBytes);
 
-  std::promise<std::shared_ptr<Pipe>> pipeProm;
-  std::shared_ptr<Listener> listener = context->listen({addr});
-  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
-    TP_THROW_ASSERT_IF(error) << error.what();
-    pipeProm.set_value(std::move(pipe));
-  });
-  std::shared_ptr<Pipe> pipe = pipeProm.get_future().get();
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("cpu", cpuUsage, numBytes);
+  report.print(options.output, stdout);
+}
 
-  std::promise<void> doneProm;
-  serverPongPingNonBlock(
-      std::move(pipe), numRoundTrips, doneProm, data, measurements);
+static void runServer(const Options& options) {
+  Data data = createData(options);
+  std::shared_ptr<Context> context = createContext(options);
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+
+  // The client connects new pipes for each rate, hence the server only needs
+  // to know how many there are.
+  size_t numSteps = rates(options).size();
+  for (size_t stepIdx = 0; stepIdx < numSteps; stepIdx++) {
+    runServerStep(options, data, *listener);
+  }
 
-  doneProm.get_future().get();
   listener.reset();
   context->join();
 }
 
-static void clientPingPongNonBlock(
-    std::shared_ptr<Pipe> pipe,
-    int& numRoundTrips,
-    std::promise<void>& doneProm,
-    Data& data,
-    Measurements& measurements) {
-  measurements.markStart();
-  Message message;
-  message.metadata = data.expectedMetadata;
-  if (data.payloadSize > 0) {
-    for (size_t payloadIdx = 0; payloadIdx < data.numPayloads; payloadIdx++) {
-      Message::Payload payload;
-      payload.data = data.expectedPayload[payloadIdx].get();
-      payload.length = data.payloadSize;
-      message.payloads.push_back(std::move(payload));
+// With a window of N, the completion of message i (its write when streaming,
+// or its echo in ping-pong mode) is what triggers the write of message i + N.
+// Hence there is no shared counter to race on with the thread that issued the
+// first N writes.
+static void clientWriteNonBlock(
+    const Options& options,
+    const Data& data,
+    PipeState& state,
+    int messageIdx) {
+  state.startTimes[messageIdx] = Measurements::clock::now();
+  state.pipe->write(
+      createMessage(data, state),
+      [&options, &data, &state, messageIdx](const Error& error, Message&&) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        if (options.pattern == "stream") {
+          state.measurements.markStop(state.startTimes[messageIdx]);
+          if (messageIdx + options.window < state.numMessages) {
+            clientWriteNonBlock(
+                options, data, state, messageIdx + options.window);
+          }
+        }
+        if (--state.numWritesLeft == 0 && state.numReadsLeft == 0) {
+          state.doneProm.set_value();
+        }
+      });
+}
+
+static void clientReadNonBlock(
+    const Options& options,
+    const Data& data,
+    PipeState& state,
+    int messageIdx) {
+  readNonBlock(data, state, [&options, &data, &state, messageIdx]() {
+    state.measurements.markStop(state.startTimes[messageIdx]);
+    // In open loop the writes are issued by the timer instead.
+    if (options.rate == 0 && messageIdx + options.window < state.numMessages) {
+      clientWriteNonBlock(options, data, state, messageIdx + options.window);
     }
-  } else {
-    TP_DCHECK_EQ(message.tensors.size(), 0);
-  }
-  if (data.tensorSize > 0) {
-    for (size_t tensorIdx = 0; tensorIdx < data.numTensors; tensorIdx++) {
-      Message::Tensor tensor;
-      tensor.buffer =
-          CpuBuffer{data.expectedTensor[tensorIdx].get(), data.tensorSize};
-      message.tensors.push_back(std::move(tensor));
+    if (--state.numReadsLeft > 0) {
+      clientReadNonBlock(options, data, state, messageIdx + 1);
+    } else if (state.numWritesLeft == 0) {
+      state.doneProm.set_value();
     }
-  } else {
-    TP_DCHECK_EQ(message.tensors.size(), 0);
-  }
-  pipe->write(
-      std::move(message),
-      [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-          const Error& error, Message&& message) {
+  });
+}
+
+static void clientReadAckNonBlock(PipeState& state) {
+  state.pipe->readDescriptor([&state](const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    state.pipe->read(
+        std::move(message), [&state](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          if (--state.numReadsLeft == 0 && state.numWritesLeft == 0) {
+            state.doneProm.set_value();
+          }
+        });
+  });
+}
+
+// In open loop the writes don't wait for the replies, thus they need no window
+// and only have to account for their completion.
+static void clientWriteOpenLoopNonBlock(const Data& data, PipeState& state) {
+  state.pipe->write(
+      createMessage(data, state), [&state](const Error& error, Message&&) {
         TP_THROW_ASSERT_IF(error) << error.what();
-        pipe->readDescriptor(
-            [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                const Error& error, Message&& message) {
-              TP_THROW_ASSERT_IF(error) << error.what();
-              TP_DCHECK_EQ(message.metadata, data.expectedMetadata);
-              if (data.payloadSize > 0) {
-                TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-                for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
-                     payloadIdx++) {
-                  TP_DCHECK_EQ(
-                      message.payloads[payloadIdx].metadata,
-                      data.expectedPayloadMetadata[payloadIdx]);
-                  TP_DCHECK_EQ(
-                      message.payloads[payloadIdx].length, data.payloadSize);
-                  message.payloads[payloadIdx].data =
-                      data.temporaryPayload[payloadIdx].get();
-                }
-              } else {
-                TP_DCHECK_EQ(message.payloads.size(), 0);
-              }
-              if (data.tensorSize > 0) {
-                TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-                for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
-                     tensorIdx++) {
-                  TP_DCHECK_EQ(
-                      message.tensors[tensorIdx].metadata,
-                      data.expectedTensorMetadata[tensorIdx]);
-                  TP_DCHECK_EQ(
-                      message.tensors[tensorIdx].buffer.cpu.length,
-                      data.tensorSize);
-                  message.tensors[tensorIdx].buffer.cpu.ptr =
-                      data.temporaryTensor[tensorIdx].get();
-                }
-              } else {
-                TP_DCHECK_EQ(message.tensors.size(), 0);
-              }
-              pipe->read(
-                  std::move(message),
-                  [pipe, &numRoundTrips, &doneProm, &data, &measurements](
-                      const Error& error, Message&& message) {
-                    measurements.markStop();
-                    TP_THROW_ASSERT_IF(error) << error.what();
-                    if (data.payloadSize > 0) {
-                      TP_DCHECK_EQ(message.payloads.size(), data.numPayloads);
-                      for (size_t payloadIdx = 0; payloadIdx < data.numPayloads;
-                           payloadIdx++) {
-                        TP_DCHECK_EQ(
-                            memcmp(
-                                message.payloads[payloadIdx].data,
-                                data.expectedPayload[payloadIdx].get(),
-                                message.payloads[payloadIdx].length),
-                            0);
-                      }
-                    } else {
-                      TP_DCHECK_EQ(message.payloads.size(), 0);
-                    }
-                    if (data.tensorSize > 0) {
-                      TP_DCHECK_EQ(message.tensors.size(), data.numTensors);
-                      for (size_t tensorIdx = 0; tensorIdx < data.numTensors;
-                           tensorIdx++) {
-                        TP_DCHECK_EQ(
-                            memcmp(
-                                message.tensors[tensorIdx].buffer.cpu.ptr,
-                                data.expectedTensor[tensorIdx].get(),
-                                message.tensors[tensorIdx].buffer.cpu.length),
-                            0);
-                      }
-                    } else {
-                      TP_DCHECK_EQ(message.tensors.size(), 0);
-                    }
-                    if (--numRoundTrips > 0) {
-                      clientPingPongNonBlock(
-                          pipe, numRoundTrips, doneProm, data, measurements);
-                    } else {
-                      printMeasurements(measurements, data.payloadSize);
-                      doneProm.set_value();
-                    }
-                  });
-            });
+        if (--state.numWritesLeft == 0 && state.numReadsLeft == 0) {
+          state.doneProm.set_value();
+        }
       });
 }
 
-// Start with sending ping
-static void runClient(const Options& options) {
-  std::string addr = options.address;
-  int numRoundTrips = options.numRoundTrips;
+// Act as the timer of the open loop: compute upfront when each message of each
+// pipe is meant to be written, and then write them at those times from this
+// thread. The latency is measured from these intended times, rather than from
+// when the writes were actually issued, so that if this thread (or the pipe)
+// falls behind the delay still counts against the messages that were held up.
+// This corrects for what is known as coordinated omission.
+static void runOpenLoop(
+    const Options& options,
+    const Data& data,
+    std::vector<std::unique_ptr<PipeState>>& states,
+    double rate) {
+  struct Write {
+    Measurements::clock::time_point time;
+    PipeState* state;
+  };
 
-  Data data;
-  data.numPayloads = options.numPayloads;
-  data.payloadSize = options.payloadSize;
-  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
-    data.expectedPayload.push_back(createData(options.payloadSize));
-    data.expectedPayloadMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryPayload.push_back(
-        std::make_unique<uint8_t[]>(options.payloadSize));
-  }
-  data.numTensors = options.numTensors;
-  data.tensorSize = options.tensorSize;
-  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
-    data.expectedTensor.push_back(createData(options.tensorSize));
-    data.expectedTensorMetadata.push_back(
-        std::string(options.metadataSize, 0x42));
-    data.temporaryTensor.push_back(
-        std::make_unique<uint8_t[]>(options.tensorSize));
+  std::mt19937_64 rng{std::random_device{}()};
+  std::exponential_distribution<double> poissonInterval(rate);
+  auto nextInterval = [&]() {
+    return options.arrivals == "poisson" ? poissonInterval(rng) : 1.0 / rate;
+  };
+
+  std::vector<Write> writes;
+  auto start = Measurements::clock::now();
+  for (size_t pipeIdx = 0; pipeIdx < states.size(); pipeIdx++) {
+    PipeState& state = *states[pipeIdx];
+    // Stagger the pipes, so that at a constant rate their writes don't all go
+    // out at the same time.
+    double seconds = options.arrivals == "poisson"
+        ? poissonInterval(rng)
+        : pipeIdx / static_cast<double>(states.size()) / rate;
+    for (int messageIdx = 0; messageIdx < state.numMessages; messageIdx++) {
+      state.startTimes[messageIdx] = start +
+          std::chrono::duration_cast<Measurements::clock::duration>(
+              std::chrono::duration<double>(seconds));
+      writes.push_back(Write{state.startTimes[messageIdx], &state});
+      seconds += nextInterval();
+    }
   }
-  data.expectedMetadata = std::string(options.metadataSize, 0x42);
+  std::stable_sort(
+      writes.begin(), writes.end(), [](const Write& a, const Write& b) {
+        return a.time < b.time;
+      });
 
-  Measurements measurements;
-  measurements.reserve(options.numRoundTrips);
+  // The reads don't trigger any write, hence they can be issued first.
+  for (auto& state : states) {
+    clientReadNonBlock(options, data, *state, /*messageIdx=*/0);
+  }
+  for (const Write& write : writes) {
+    std::this_thread::sleep_until(write.time);
+    clientWriteOpenLoopNonBlock(data, *write.state);
+  }
+}
 
-  std::shared_ptr<Context> context = std::make_shared<Context>();
-  auto transportContext =
-      TensorpipeTransportRegistry().create(options.transport);
-  validateTransportContext(transportContext);
-  context->registerTransport(0, options.transport, transportContext);
+static void runClientThread(
+    const Options& options,
+    const Data& data,
+    double rate,
+    int numPipes,
+    std::promise<void>& readyProm,
+    std::shared_future<void> startFuture,
+    std::promise<void>& finishedProm,
+    std::shared_future<void> stopFuture,
+    Measurements& measurements) {
+  std::shared_ptr<Context> context = createContext(options);
 
-  auto channelContext = TensorpipeChannelRegistry().create(options.channel);
-  validateChannelContext(channelContext);
-  context->registerChannel(0, options.channel, channelContext);
+  std::vector<std::unique_ptr<PipeState>> states;
+  for (int pipeIdx = 0; pipeIdx < numPipes; pipeIdx++) {
+    states.push_back(createPipeState(options, options.numRoundTrips));
+    PipeState& state = *states.back();
+    state.pipe = context->connect(options.address);
+    state.numWritesLeft = options.numRoundTrips;
+    state.numReadsLeft =
+        options.pattern == "ping-pong" ? options.numRoundTrips : 1;
+  }
 
-  std::shared_ptr<Pipe> pipe = context->connect(addr);
+  readyProm.set_value();
+  startFuture.wait();
 
-  std::promise<void> doneProm;
-  clientPingPongNonBlock(
-      std::move(pipe), numRoundTrips, doneProm, data, measurements);
+  if (rate > 0) {
+    runOpenLoop(options, data, states, rate);
+  } else {
+    for (auto& state : states) {
+      // Issue the initial writes before the reads, as in ping-pong mode a read
+      // triggers a write, which could otherwise overtake an initial one.
+      for (int messageIdx = 0;
+           messageIdx < std::min(options.window, options.numRoundTrips);
+           messageIdx++) {
+        clientWriteNonBlock(options, data, *state, messageIdx);
+      }
+      if (options.pattern == "ping-pong") {
+        clientReadNonBlock(options, data, *state, /*messageIdx=*/0);
+      } else {
+        clientReadAckNonBlock(*state);
+      }
+    }
+  }
 
-  doneProm.get_future().get();
+  for (auto& state : states) {
+    state->doneProm.get_future().get();
+    measurements.merge(state->measurements);
+  }
+  // Keep the threads of the context alive until the CPU usage is sampled.
+  finishedProm.set_value();
+  stopFuture.wait();
   context->join();
 }
 
+// Run one step of the sweep, on pipes of its own, and report on it.
+static void runClientStep(
+    const Options& options,
+    const Data& data,
+    double rate) {
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::vector<std::promise<void>> readyProms(options.numClientThreads);
+  std::promise<void> startProm;
+  std::shared_future<void> startFuture = startProm.get_future().share();
+  std::vector<std::promise<void>> finishedProms(options.numClientThreads);
+  std::promise<void> stopProm;
+  std::shared_future<void> stopFuture = stopProm.get_future().share();
+  std::vector<Measurements> measurements(options.numClientThreads);
+  std::vector<std::thread> threads;
+  for (int threadIdx = 0; threadIdx < options.numClientThreads; threadIdx++) {
+    // Split the pipes as evenly as possible among the threads.
+    int numPipes = options.numPipes / options.numClientThreads +
+        (threadIdx < options.numPipes % options.numClientThreads ? 1 : 0);
+    threads.emplace_back(
+        runClientThread,
+        std::cref(options),
+        std::cref(data),
+        rate,
+        numPipes,
+        std::ref(readyProms[threadIdx]),
+        startFuture,
+        std::ref(finishedProms[threadIdx]),
+        stopFuture,
+        std::ref(measurements[threadIdx]));
+  }
+
+  for (auto& readyProm : readyProms) {
+    readyProm.get_future().wait();
+  }
+  cpuUsage.start();
+  auto start = Measurements::clock::now();
+  startProm.set_value();
+  for (auto& finishedProm : finishedProms) {
+    finishedProm.get_future().wait();
+  }
+  auto elapsed = Measurements::clock::now() - start;
+  cpuUsage.stop();
+  stopProm.set_value();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (int threadIdx = 1; threadIdx < options.numClientThreads; threadIdx++) {
+    measurements[0].merge(measurements[threadIdx]);
+  }
+  if (rate > 0) {
+    fprintf(
+        stderr,
+        "open loop at %.0f msgs/s per pipe (%s arrivals)\n",
+        rate,
+        options.arrivals.c_str());
+  }
+  printMeasurements(measurements[0], options.payloadSize);
+
+  size_t numMessagesTotal = numMessages(options);
+  size_t numBytes = numMessagesTotal * messageSize(options);
+  auto elapsedNs =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+  printThroughput(numMessagesTotal, numBytes, elapsedNs);
+  cpuUsage.print(numBytes);
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("latency", measurements[0]);
+  double seconds = elapsedNs.count() / 1e9;
+  report.add("throughput", "num_messages", numMessagesTotal);
+  report.add("throughput", "num_bytes", numBytes);
+  report.add("throughput", "msgs_per_sec", numMessagesTotal / seconds);
+  report.add("throughput", "gb_per_sec", numBytes / seconds / 1e9);
+  report.add("cpu", cpuUsage, numBytes);
+  if (rate > 0) {
+    // The rate this step aimed for, whereas the throughput section has the one
+    // it achieved (counting the replies too).
+    report.add("open_loop", "rate", rate);
+  }
+  report.print(options.output, stdout);
+}
+
+// When sweeping rates, each step is printed on its own, and in JSON or CSV it
+// gets a report of its own, hence a line (or a header and a row) per rate.
+static void runClient(const Options& options) {
+  Data data = createData(options);
+  for (double rate : rates(options)) {
+    runClientStep(options, data, rate);
+  }
+}
+
 int main(int argc, char** argv) {
   struct Options x = parseOptions(argc, argv);
-  std::cout << "mode = " << x.mode << "\n";
-  std::cout << "transport = " << x.transport << "\n";
-  std::cout << "channel = " << x.channel << "\n";
-  std::cout << "address = " << x.address << "\n";
-  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
-  std::cout << "num_payloads = " << x.numPayloads << "\n";
-  std::cout << "payload_size = " << x.payloadSize << "\n";
-  std::cout << "num_tensors = " << x.numTensors << "\n";
-  std::cout << "tensor_size = " << x.tensorSize << "\n";
-  std::cout << "metadata_size = " << x.metadataSize << "\n";
+  // Keep stdout clean for the machine-readable formats.
+  if (x.output == "text") {
+    std::cout << "mode = " << x.mode << "\n";
+    std::cout << "transport = " << x.transport << "\n";
+    std::cout << "channel = " << x.channel << "\n";
+    std::cout << "address = " << x.address << "\n";
+    std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+    std::cout << "num_payloads = " << x.numPayloads << "\n";
+    std::cout << "payload_size = " << x.payloadSize << "\n";
+    std::cout << "num_tensors = " << x.numTensors << "\n";
+    std::cout << "tensor_size = " << x.tensorSize << "\n";
+    std::cout << "metadata_size = " << x.metadataSize << "\n";
+    std::cout << "num_pipes = " << x.numPipes << "\n";
+    std::cout << "num_client_threads = " << x.numClientThreads << "\n";
+    std::cout << "window = " << x.window << "\n";
+    std::cout << "pattern = " << x.pattern << "\n";
+    std::cout << "cuda_device = " << x.cudaDevice << "\n";
+    std::cout << "cuda_channel = " << x.cudaChannel << "\n";
+    std::cout << "cuda_sync = " << x.cudaSync << "\n";
+    std::cout << "perf_counters = " << x.perfCounters << "\n";
+    std::cout << "lazy_channel_establishment = " << x.lazyChannelEstablishment
+              << "\n";
+    std::cout << "speculative_channel_connections = "
+              << x.speculativeChannelConnections << "\n";
+    std::cout << "rate = " << x.rate << "\n";
+    std::cout << "max_rate = " << x.maxRate << "\n";
+    std::cout << "arrivals = " << x.arrivals << "\n";
+    std::cout << "transport_opts = " << x.transportTunables.str() << "\n";
+    std::cout << "channel_opts = " << x.channelTunables.str() << "\n";
+  }
+
+  if (x.cudaDevice >= 0) {
+#if TENSORPIPE_SUPPORTS_CUDA
+    if (x.cudaChannel.empty()) {
+      fprintf(stderr, "Missing argument: --cuda-channel must be set\n");
+      exit(EXIT_FAILURE);
+    }
+#else // TENSORPIPE_SUPPORTS_CUDA
+    fprintf(stderr, "Invalid argument: TensorPipe was built without CUDA\n");
+    exit(EXIT_FAILURE);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+  }
 
   if (x.mode == "listen") {
     runServer(x);
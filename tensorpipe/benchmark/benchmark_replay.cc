@@ -0,0 +1,445 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/cpu_usage.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/report.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+#include <tensorpipe/core/traffic_recorder.h>
+
+// Replays the traffic that a context recorded (see the trafficTracePath option
+// of the context) over pipes between the client and the server. Both are given
+// the same trace: the client opens one pipe for each pipe in it and writes each
+// message, with the recorded lengths, at the recorded time (scaled by the
+// replay speed), and the server reads them all. Only the shapes of the messages
+// were recorded, hence they are filled with meaningless data, and all tensors
+// are sent from and to CPU memory, including those that were recorded on GPUs.
+// The number of round trips is ignored, as the trace tells what to send.
+//
+// Each pipe starts with a message that tells the server which pipe of the trace
+// it is, and ends with the server acknowledging that it got all of its
+// messages, after which the client closes it.
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+namespace {
+
+struct Trace {
+  std::vector<TrafficRecord> records;
+  size_t numPipes{0};
+  std::vector<size_t> numMessagesPerPipe;
+  // The largest total length of the payloads and tensors of any message.
+  size_t maxMessageLength{0};
+  size_t maxMetadataLength{0};
+  size_t numBytes{0};
+  size_t numDeviceTensors{0};
+};
+
+// The state of a pipe on the server, which reads one message at a time.
+struct ServerPipeState {
+  std::shared_ptr<Pipe> pipe;
+  std::vector<uint8_t> buffer;
+  size_t numMessagesLeft{0};
+};
+
+} // namespace
+
+static size_t messageLength(const TrafficRecord& record) {
+  size_t length = 0;
+  for (uint64_t payloadLength : record.payloadLengths) {
+    length += payloadLength;
+  }
+  for (const TrafficRecord::Tensor& tensor : record.tensors) {
+    length += tensor.length;
+  }
+  return length;
+}
+
+static Trace loadTrace(const std::string& path) {
+  Trace trace;
+  TrafficTraceReader reader(path);
+  TrafficRecord record;
+  while (reader.next(record)) {
+    trace.numPipes = std::max<size_t>(trace.numPipes, record.pipeIdx + 1);
+    size_t length = messageLength(record);
+    trace.maxMessageLength = std::max(trace.maxMessageLength, length);
+    trace.maxMetadataLength =
+        std::max<size_t>(trace.maxMetadataLength, record.metadataLength);
+    trace.numBytes += length;
+    for (const TrafficRecord::Tensor& tensor : record.tensors) {
+      if (tensor.deviceType != DeviceType::kCpu) {
+        trace.numDeviceTensors++;
+      }
+    }
+    trace.records.push_back(std::move(record));
+  }
+  TP_THROW_ASSERT_IF(trace.records.empty()) << path << " has no messages";
+  trace.numMessagesPerPipe.resize(trace.numPipes);
+  for (const TrafficRecord& record : trace.records) {
+    trace.numMessagesPerPipe[record.pipeIdx]++;
+  }
+  return trace;
+}
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>(
+      ContextOptions()
+          .lazyChannelEstablishment(options.lazyChannelEstablishment)
+          .speculativeChannelConnections(
+              options.speculativeChannelConnections));
+  auto transportContext = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+  auto channelContext = TensorpipeChannelRegistry().create(
+      options.channel, options.channelTunables);
+  validateChannelContext(channelContext);
+  context->registerChannel(0, options.channel, channelContext);
+  return context;
+}
+
+// The payloads and tensors of a message are laid out one after the other in
+// the given buffer, which must be large enough.
+static Message createMessage(
+    const TrafficRecord& record,
+    uint8_t* buffer,
+    const std::string& metadata) {
+  Message message;
+  message.metadata = metadata.substr(0, record.metadataLength);
+  for (uint64_t payloadLength : record.payloadLengths) {
+    Message::Payload payload;
+    payload.data = buffer;
+    payload.length = payloadLength;
+    message.payloads.push_back(std::move(payload));
+    buffer += payloadLength;
+  }
+  for (const TrafficRecord::Tensor& recordTensor : record.tensors) {
+    Message::Tensor tensor;
+    tensor.buffer = CpuBuffer{buffer, recordTensor.length};
+    message.tensors.push_back(std::move(tensor));
+    buffer += recordTensor.length;
+  }
+  return message;
+}
+
+static void printSummary(
+    size_t numMessages,
+    size_t numBytes,
+    std::chrono::nanoseconds elapsed) {
+  double seconds = elapsed.count() / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-12s %-12s %-12s\n",
+      "# messages",
+      "total (MB)",
+      "time (sec)",
+      "msgs/s",
+      "GB/s");
+  fprintf(
+      stderr,
+      "%-15lu %-15.3f %-12.3f %-12.0f %-12.3f\n",
+      numMessages,
+      numBytes / 1e6,
+      seconds,
+      numMessages / seconds,
+      numBytes / seconds / 1e9);
+}
+
+static void printLatencies(const char* name, Measurements& measurements) {
+  measurements.sort();
+  fprintf(
+      stderr,
+      "%-15s %-12.3f %-12.3f %-12.3f %-12.3f %-12.3f\n",
+      name,
+      measurements.mean() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.max().count() / 1000.0);
+}
+
+static void serverReadNonBlock(
+    ServerPipeState& state,
+    std::function<void()> onClosed) {
+  if (state.numMessagesLeft == 0) {
+    state.pipe->write(Message(), [](const Error& error, Message&&) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+    });
+    state.pipe->readDescriptor(
+        [onClosed{std::move(onClosed)}](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(!error) << "Unexpected message";
+          onClosed();
+        });
+    return;
+  }
+  state.pipe->readDescriptor([&state, onClosed{std::move(onClosed)}](
+                                 const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    size_t length = 0;
+    for (const Message::Payload& payload : message.payloads) {
+      length += payload.length;
+    }
+    for (const Message::Tensor& tensor : message.tensors) {
+      length += tensor.buffer.cpu.length;
+    }
+    state.buffer.resize(std::max(state.buffer.size(), length));
+    uint8_t* ptr = state.buffer.data();
+    for (Message::Payload& payload : message.payloads) {
+      payload.data = ptr;
+      ptr += payload.length;
+    }
+    for (Message::Tensor& tensor : message.tensors) {
+      tensor.buffer.cpu.ptr = ptr;
+      ptr += tensor.buffer.cpu.length;
+    }
+    state.pipe->read(
+        std::move(message),
+        [&state, onClosed{std::move(onClosed)}](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          state.numMessagesLeft--;
+          serverReadNonBlock(state, std::move(onClosed));
+        });
+  });
+}
+
+static void serverHelloNonBlock(
+    const Trace& trace,
+    ServerPipeState& state,
+    std::function<void()> onClosed) {
+  state.pipe->readDescriptor(
+      [&trace, &state, onClosed{std::move(onClosed)}](
+          const Error& error, Message&& message) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        size_t pipeIdx = std::stoul(message.metadata);
+        TP_THROW_ASSERT_IF(pipeIdx >= trace.numPipes);
+        state.numMessagesLeft = trace.numMessagesPerPipe[pipeIdx];
+        state.pipe->read(
+            std::move(message),
+            [&state, onClosed{std::move(onClosed)}](
+                const Error& error, Message&&) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+              serverReadNonBlock(state, std::move(onClosed));
+            });
+      });
+}
+
+static void runServer(const Options& options, const Trace& trace) {
+  std::vector<ServerPipeState> states(trace.numPipes);
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t numPipesClosed = 0;
+  auto onClosed = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    numPipesClosed++;
+    cv.notify_all();
+  };
+
+  std::shared_ptr<Context> context = createContext(options);
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+
+  // The accept callbacks are invoked one after the other from the loop.
+  size_t numPipesAccepted = 0;
+  Measurements::clock::time_point start;
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptCallback =
+      [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        if (numPipesAccepted == 0) {
+          start = Measurements::clock::now();
+          cpuUsage.start();
+        }
+        ServerPipeState& state = states[numPipesAccepted++];
+        state.pipe = std::move(pipe);
+        serverHelloNonBlock(trace, state, onClosed);
+        if (numPipesAccepted < trace.numPipes) {
+          listener->accept(acceptCallback);
+        }
+      };
+  listener->accept(acceptCallback);
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() { return numPipesClosed == trace.numPipes; });
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Measurements::clock::now() - start);
+  cpuUsage.stop();
+  listener.reset();
+  context->join();
+
+  printSummary(trace.records.size(), trace.numBytes, elapsed);
+  cpuUsage.print(trace.numBytes);
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("cpu", cpuUsage, trace.numBytes);
+  report.print(options.output, stdout);
+}
+
+static void runClient(const Options& options, const Trace& trace) {
+  // The outgoing messages only point to this data, which is never modified,
+  // hence all of them can share it.
+  std::vector<uint8_t> data(trace.maxMessageLength, 0x42);
+  std::string metadata(trace.maxMetadataLength, 'm');
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::shared_ptr<Context> context = createContext(options);
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  for (size_t pipeIdx = 0; pipeIdx < trace.numPipes; pipeIdx++) {
+    pipes.push_back(context->connect(options.address));
+    Message hello;
+    hello.metadata = std::to_string(pipeIdx);
+    pipes.back()->write(std::move(hello), [](const Error& error, Message&&) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+    });
+  }
+
+  // The write callbacks may run concurrently on the threads of the context.
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t numMessagesWritten = 0;
+  size_t numAcksRead = 0;
+  Measurements writeLatencies;
+  writeLatencies.reserve(trace.records.size());
+  // How late each message was written compared to the time it was due at.
+  Measurements lags;
+  lags.reserve(trace.records.size());
+
+  auto start = Measurements::clock::now();
+  cpuUsage.start();
+  for (const TrafficRecord& record : trace.records) {
+    auto now = Measurements::clock::now();
+    if (options.replaySpeed > 0) {
+      auto dueAt = start +
+          std::chrono::duration_cast<Measurements::clock::duration>(
+                     std::chrono::nanoseconds(static_cast<uint64_t>(
+                         record.timestampNs / options.replaySpeed)));
+      if (dueAt > now) {
+        std::this_thread::sleep_until(dueAt);
+        now = Measurements::clock::now();
+      }
+      lags.add(std::max(now - dueAt, Measurements::clock::duration(0)));
+    }
+    pipes[record.pipeIdx]->write(
+        createMessage(record, data.data(), metadata),
+        [&, writeStart{now}](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          std::unique_lock<std::mutex> lock(mutex);
+          writeLatencies.markStop(writeStart);
+          numMessagesWritten++;
+          cv.notify_all();
+        },
+        record.priorityClass);
+  }
+  for (auto& pipe : pipes) {
+    pipe->readDescriptor([&, pipe](const Error& error, Message&& message) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+      pipe->read(std::move(message), [&](const Error& error, Message&&) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        std::unique_lock<std::mutex> lock(mutex);
+        numAcksRead++;
+        cv.notify_all();
+      });
+    });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&]() {
+      return numMessagesWritten == trace.records.size() &&
+          numAcksRead == trace.numPipes;
+    });
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Measurements::clock::now() - start);
+  cpuUsage.stop();
+
+  for (auto& pipe : pipes) {
+    pipe->close();
+  }
+  context->join();
+
+  printSummary(trace.records.size(), trace.numBytes, elapsed);
+  fprintf(
+      stderr,
+      "%-15s %-12s %-12s %-12s %-12s %-12s\n",
+      "(usec)",
+      "avg",
+      "p50",
+      "p90",
+      "p99",
+      "max");
+  printLatencies("write", writeLatencies);
+  if (lags.size() > 0) {
+    printLatencies("lag", lags);
+  }
+  cpuUsage.print(trace.numBytes);
+
+  double seconds = elapsed.count() / 1e9;
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("write_latency", writeLatencies);
+  if (lags.size() > 0) {
+    report.add("lag", lags);
+  }
+  report.add("throughput", "num_messages", trace.records.size());
+  report.add("throughput", "num_bytes", trace.numBytes);
+  report.add("throughput", "msgs_per_sec", trace.records.size() / seconds);
+  report.add("throughput", "gb_per_sec", trace.numBytes / seconds / 1e9);
+  report.add("cpu", cpuUsage, trace.numBytes);
+  report.print(options.output, stdout);
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  if (x.trafficTrace.empty()) {
+    fprintf(stderr, "Missing argument: --traffic-trace must be set\n");
+    exit(EXIT_FAILURE);
+  }
+  Trace trace = loadTrace(x.trafficTrace);
+
+  // Keep stdout clean for the machine-readable formats.
+  if (x.output == "text") {
+    std::cout << "mode = " << x.mode << "\n";
+    std::cout << "transport = " << x.transport << "\n";
+    std::cout << "channel = " << x.channel << "\n";
+    std::cout << "address = " << x.address << "\n";
+    std::cout << "traffic_trace = " << x.trafficTrace << "\n";
+    std::cout << "replay_speed = " << x.replaySpeed << "\n";
+    std::cout << "num_pipes = " << trace.numPipes << "\n";
+    std::cout << "num_messages = " << trace.records.size() << "\n";
+    std::cout << "num_device_tensors = " << trace.numDeviceTensors << "\n";
+  }
+
+  if (x.mode == "listen") {
+    runServer(x, trace);
+  } else if (x.mode == "connect") {
+    runClient(x, trace);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  return 0;
+}
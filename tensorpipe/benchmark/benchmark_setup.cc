@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <fstream>
+#include <functional>
+#include <mutex>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/report.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+
+// Measures how long it takes to bring pipes up, and what each of them costs
+// once it's up. The client opens --num-pipes pipes, with at most --window of
+// them being set up at once, and times each of them through these phases:
+// - connect: the call to Context::connect, which opens the connection;
+// - establish: until the handshake is complete, i.e., the brochures have been
+//   exchanged and the connections of the channels have been opened (unless
+//   they are established lazily);
+// - first message: a round trip of a message with a small tensor, which with
+//   lazy channel establishment includes connecting the channel.
+// Both sides then report the file descriptors and the memory held per pipe.
+// Only one message is exchanged per pipe, whatever --num-round-trips says.
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+namespace {
+
+// The first message carries a tensor of this size, to involve a channel.
+constexpr size_t kTensorSize = 8;
+
+struct PipeState {
+  std::shared_ptr<Pipe> pipe;
+  Measurements::clock::time_point connectStart;
+  Measurements::clock::time_point connectEnd;
+  Measurements::clock::time_point established;
+  Measurements::clock::time_point firstMessageDone;
+  uint8_t tensor[kTensorSize];
+};
+
+struct Footprint {
+  size_t numFds{0};
+  size_t rssBytes{0};
+};
+
+// Counts the pipes that reached some point, for the threads that wait on them.
+class Counter {
+ public:
+  void increment() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++count_;
+    cv_.notify_all();
+  }
+
+  void waitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return count_ >= count; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t count_{0};
+};
+
+} // namespace
+
+static Footprint measureFootprint() {
+  Footprint footprint;
+
+  DIR* dir = ::opendir("/proc/self/fd");
+  TP_THROW_SYSTEM_IF(dir == nullptr, errno);
+  while (struct dirent* entry = ::readdir(dir)) {
+    if (entry->d_name[0] != '.') {
+      footprint.numFds++;
+    }
+  }
+  ::closedir(dir);
+  // Don't count the one used to list the others.
+  footprint.numFds--;
+
+  // The second field is the resident set size, in pages.
+  std::ifstream statm("/proc/self/statm");
+  size_t numPages = 0;
+  size_t numResidentPages = 0;
+  statm >> numPages >> numResidentPages;
+  footprint.rssBytes = numResidentPages * ::sysconf(_SC_PAGESIZE);
+
+  return footprint;
+}
+
+static std::chrono::nanoseconds since(Measurements::clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Measurements::clock::now() - start);
+}
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>(
+      ContextOptions()
+          .lazyChannelEstablishment(options.lazyChannelEstablishment)
+          .speculativeChannelConnections(
+              options.speculativeChannelConnections));
+  auto transportContext = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+  auto channelContext = TensorpipeChannelRegistry().create(
+      options.channel, options.channelTunables);
+  validateChannelContext(channelContext);
+  context->registerChannel(0, options.channel, channelContext);
+  return context;
+}
+
+static Message createMessage(PipeState& state) {
+  Message message;
+  Message::Tensor tensor;
+  tensor.buffer = CpuBuffer{state.tensor, kTensorSize};
+  message.tensors.push_back(std::move(tensor));
+  return message;
+}
+
+static void printLatencies(const char* phase, Measurements& measurements) {
+  measurements.sort();
+  fprintf(
+      stderr,
+      "%-15s %-12.3f %-12.3f %-12.3f %-12.3f %-12.3f\n",
+      phase,
+      measurements.mean() / 1000.0,
+      measurements.percentile(0.50).count() / 1000.0,
+      measurements.percentile(0.90).count() / 1000.0,
+      measurements.percentile(0.99).count() / 1000.0,
+      measurements.max().count() / 1000.0);
+}
+
+static void printFootprint(
+    const Footprint& before,
+    const Footprint& after,
+    int numPipes) {
+  fprintf(
+      stderr,
+      "%-15s %-15s %-15s %-15s\n",
+      "# pipes",
+      "fds",
+      "fds/pipe",
+      "RSS/pipe (KB)");
+  fprintf(
+      stderr,
+      "%-15d %-15lu %-15.2f %-15.2f\n",
+      numPipes,
+      after.numFds,
+      (static_cast<double>(after.numFds) - before.numFds) / numPipes,
+      (static_cast<double>(after.rssBytes) - before.rssBytes) / numPipes /
+          1024);
+}
+
+static void addFootprint(
+    Report& report,
+    const Footprint& before,
+    const Footprint& after,
+    int numPipes) {
+  report.add("footprint", "num_fds_before", before.numFds);
+  report.add("footprint", "num_fds_after", after.numFds);
+  report.add(
+      "footprint",
+      "fds_per_pipe",
+      (static_cast<double>(after.numFds) - before.numFds) / numPipes);
+  report.add(
+      "footprint",
+      "rss_kb_per_pipe",
+      (static_cast<double>(after.rssBytes) - before.rssBytes) / numPipes /
+          1024);
+}
+
+// Echo the first message, then wait for the client to close the pipe, so that
+// it's still open while the client measures its footprint.
+static void serverPongNonBlock(
+    PipeState& state,
+    Counter& numPongs,
+    Counter& numClosed) {
+  state.pipe->readDescriptor([&state, &numPongs, &numClosed](
+                                 const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    TP_DCHECK_EQ(message.tensors.size(), 1);
+    message.tensors[0].buffer.cpu.ptr = state.tensor;
+    state.pipe->read(
+        std::move(message),
+        [&state, &numPongs, &numClosed](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          state.pipe->write(
+              createMessage(state),
+              [&state, &numPongs, &numClosed](const Error& error, Message&&) {
+                TP_THROW_ASSERT_IF(error) << error.what();
+                numPongs.increment();
+                state.pipe->readDescriptor(
+                    [&numClosed](const Error& error, Message&&) {
+                      TP_THROW_ASSERT_IF(!error) << "Unexpected message";
+                      numClosed.increment();
+                    });
+              });
+        });
+  });
+}
+
+static void runServer(const Options& options) {
+  std::vector<PipeState> states(options.numPipes);
+  Counter numPongs;
+  Counter numClosed;
+
+  std::shared_ptr<Context> context = createContext(options);
+
+  auto listenStart = Measurements::clock::now();
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+  auto listenLatency = since(listenStart);
+
+  Footprint before = measureFootprint();
+
+  // The accept callbacks are invoked one after the other from the loop.
+  int numPipesAccepted = 0;
+  Measurements::clock::time_point firstAccept;
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptCallback =
+      [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        if (numPipesAccepted == 0) {
+          firstAccept = Measurements::clock::now();
+        }
+        PipeState& state = states[numPipesAccepted++];
+        state.pipe = std::move(pipe);
+        serverPongNonBlock(state, numPongs, numClosed);
+        if (numPipesAccepted < options.numPipes) {
+          listener->accept(acceptCallback);
+        }
+      };
+  listener->accept(acceptCallback);
+
+  numPongs.waitFor(options.numPipes);
+  auto acceptDuration = since(firstAccept);
+  Footprint after = measureFootprint();
+
+  numClosed.waitFor(options.numPipes);
+  listener.reset();
+  context->join();
+
+  double acceptSeconds = acceptDuration.count() / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-15s\n",
+      "listen (usec)",
+      "accept (sec)",
+      "pipes/s");
+  fprintf(
+      stderr,
+      "%-15.3f %-15.3f %-15.0f\n",
+      listenLatency.count() / 1000.0,
+      acceptSeconds,
+      options.numPipes / acceptSeconds);
+  printFootprint(before, after, options.numPipes);
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("listen", "latency_us", listenLatency.count() / 1000.0);
+  report.add("accept", "total_sec", acceptSeconds);
+  report.add("accept", "pipes_per_sec", options.numPipes / acceptSeconds);
+  addFootprint(report, before, after, options.numPipes);
+  report.print(options.output, stdout);
+}
+
+static void clientPingNonBlock(
+    PipeState& state,
+    Counter& numDone,
+    std::function<void()> onDone) {
+  state.pipe->waitForEstablishment(
+      [&state, &numDone, onDone{std::move(onDone)}](const Error& error) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        state.established = Measurements::clock::now();
+        state.pipe->write(
+            createMessage(state), [](const Error& error, Message&&) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+            });
+        state.pipe->readDescriptor(
+            [&state, &numDone, onDone{std::move(onDone)}](
+                const Error& error, Message&& message) {
+              TP_THROW_ASSERT_IF(error) << error.what();
+              TP_DCHECK_EQ(message.tensors.size(), 1);
+              message.tensors[0].buffer.cpu.ptr = state.tensor;
+              state.pipe->read(
+                  std::move(message),
+                  [&state, &numDone, onDone{std::move(onDone)}](
+                      const Error& error, Message&&) {
+                    TP_THROW_ASSERT_IF(error) << error.what();
+                    state.firstMessageDone = Measurements::clock::now();
+                    onDone();
+                    numDone.increment();
+                  });
+            });
+      });
+}
+
+static void runClient(const Options& options) {
+  std::vector<PipeState> states(options.numPipes);
+  Counter numDone;
+
+  auto contextStart = Measurements::clock::now();
+  std::shared_ptr<Context> context = createContext(options);
+  auto contextLatency = since(contextStart);
+
+  Footprint before = measureFootprint();
+
+  // Keep at most a window's worth of pipes being set up at once.
+  std::mutex mutex;
+  std::condition_variable cv;
+  int numInFlight = 0;
+  auto onDone = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    --numInFlight;
+    cv.notify_all();
+  };
+
+  auto start = Measurements::clock::now();
+  for (PipeState& state : states) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return numInFlight < options.window; });
+      ++numInFlight;
+    }
+    state.connectStart = Measurements::clock::now();
+    state.pipe = context->connect(options.address);
+    state.connectEnd = Measurements::clock::now();
+    clientPingNonBlock(state, numDone, onDone);
+  }
+  numDone.waitFor(options.numPipes);
+  auto setupDuration = since(start);
+
+  Footprint after = measureFootprint();
+
+  for (PipeState& state : states) {
+    state.pipe->close();
+  }
+  context->join();
+
+  Measurements connectLatencies;
+  Measurements establishLatencies;
+  Measurements firstMessageLatencies;
+  for (const PipeState& state : states) {
+    connectLatencies.add(state.connectEnd - state.connectStart);
+    establishLatencies.add(state.established - state.connectStart);
+    firstMessageLatencies.add(state.firstMessageDone - state.established);
+  }
+
+  double setupSeconds = setupDuration.count() / 1e9;
+  fprintf(
+      stderr,
+      "%-15s %-15s %-15s %-15s\n",
+      "context (usec)",
+      "# pipes",
+      "setup (sec)",
+      "pipes/s");
+  fprintf(
+      stderr,
+      "%-15.3f %-15d %-15.3f %-15.0f\n",
+      contextLatency.count() / 1000.0,
+      options.numPipes,
+      setupSeconds,
+      options.numPipes / setupSeconds);
+  fprintf(
+      stderr,
+      "%-15s %-12s %-12s %-12s %-12s %-12s\n",
+      "phase",
+      "avg (usec)",
+      "p50",
+      "p90",
+      "p99",
+      "max");
+  printLatencies("connect", connectLatencies);
+  printLatencies("establish", establishLatencies);
+  printLatencies("first message", firstMessageLatencies);
+  printFootprint(before, after, options.numPipes);
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("context", "latency_us", contextLatency.count() / 1000.0);
+  report.add("connect", connectLatencies);
+  report.add("establish", establishLatencies);
+  report.add("first_message", firstMessageLatencies);
+  report.add("setup", "total_sec", setupSeconds);
+  report.add("setup", "pipes_per_sec", options.numPipes / setupSeconds);
+  addFootprint(report, before, after, options.numPipes);
+  report.print(options.output, stdout);
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  // Keep stdout clean for the machine-readable formats.
+  if (x.output == "text") {
+    std::cout << "mode = " << x.mode << "\n";
+    std::cout << "transport = " << x.transport << "\n";
+    std::cout << "channel = " << x.channel << "\n";
+    std::cout << "address = " << x.address << "\n";
+    std::cout << "num_pipes = " << x.numPipes << "\n";
+    std::cout << "window = " << x.window << "\n";
+    std::cout << "lazy_channel_establishment = " << x.lazyChannelEstablishment
+              << "\n";
+    std::cout << "speculative_channel_connections = "
+              << x.speculativeChannelConnections << "\n";
+  }
+
+  if (x.mode == "listen") {
+    runServer(x);
+  } else if (x.mode == "connect") {
+    runClient(x);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  return 0;
+}
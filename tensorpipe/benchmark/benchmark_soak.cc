@@ -0,0 +1,622 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <unistd.h>
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#include <tensorpipe/benchmark/channel_registry.h>
+#include <tensorpipe/benchmark/cpu_usage.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/report.h>
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/core/context.h>
+#include <tensorpipe/core/listener.h>
+#include <tensorpipe/core/pipe.h>
+
+// Keeps many pipes busy for a long time, to catch what only shows up at scale
+// or over time (leaks, slowdowns, stalls), and checks the outcome against the
+// limits given with --slo, exiting with a failure if any of them is exceeded.
+//
+// The client opens --num-pipes pipes over --num-client-threads contexts, and
+// keeps --window round trips in flight on each of them for --duration seconds.
+// Each message has --num-payloads payloads of --payload-size bytes and
+// --num-tensors tensors, whose size is picked at random for each message among
+// the powers of two from --tensor-size to --max-tensor-size. The server echoes
+// them, allocating new buffers for each one, and exits once all of its
+// --num-pipes pipes are closed (hence, with several client processes, it must
+// be given the total). The soak.py script runs such a fleet.
+//
+// The first tenth of the run is a warm-up, which isn't measured. Then each
+// side records its CPU usage and how much its resident memory grew, and the
+// client samples the latencies of the round trips. The limits are:
+// - min_msgs_per_sec and min_gb_per_sec, in both directions (client only);
+// - max_p99_us, of the round trips (client only);
+// - max_cpu_cores and max_cpu_ns_per_byte;
+// - max_rss_mb, which is checked against the peak, and max_rss_growth_mb.
+
+using namespace tensorpipe;
+using namespace tensorpipe::benchmark;
+
+namespace {
+
+// Latencies are sampled, so that memory doesn't grow with the duration.
+constexpr size_t kMaxSamplesPerPipe = 10000;
+constexpr std::chrono::seconds kProgressInterval{10};
+
+struct Data {
+  std::vector<std::unique_ptr<uint8_t[]>> payloads;
+  // Large enough for the largest tensor, whatever size was picked.
+  std::vector<std::unique_ptr<uint8_t[]>> tensors;
+  std::vector<size_t> tensorSizes;
+  std::string metadata;
+};
+
+// Once the pipe is started, it's only accessed from within the callbacks of
+// the pipe, which are all invoked from the loop of its context.
+struct PipeState {
+  std::shared_ptr<Pipe> pipe;
+  std::mt19937 rng;
+  // Responses are read one at a time, hence one set of buffers is enough.
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryPayloads;
+  std::vector<std::unique_ptr<uint8_t[]>> temporaryTensors;
+  // The start times of the round trips in flight, which complete in order.
+  std::deque<Measurements::clock::time_point> startTimes;
+  size_t numSamplesSeen{0};
+  std::vector<Measurements::nanoseconds> samples;
+  uint64_t numRoundTrips{0};
+  uint64_t numBytes{0};
+};
+
+// Counts the pipes that reached some point, for the threads that wait on them.
+class Counter {
+ public:
+  void increment() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++count_;
+    cv_.notify_all();
+  }
+
+  void waitFor(size_t count) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [&]() { return count_ >= count; });
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  size_t count_{0};
+};
+
+// What the limits are checked against. Those that a side doesn't measure are
+// left as NaN, and pass.
+struct Results {
+  double msgsPerSec{NAN};
+  double gbPerSec{NAN};
+  double p99Us{NAN};
+  double cpuCores{NAN};
+  double cpuNsPerByte{NAN};
+  double peakRssMb{NAN};
+  double rssGrowthMb{NAN};
+};
+
+} // namespace
+
+// The current and the peak resident set size, in bytes.
+static std::pair<size_t, size_t> measureRss() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  size_t rssKb = 0;
+  size_t peakRssKb = 0;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) {
+      rssKb = std::stoull(line.substr(6));
+    } else if (line.compare(0, 6, "VmHWM:") == 0) {
+      peakRssKb = std::stoull(line.substr(6));
+    }
+  }
+  return {rssKb * 1024, peakRssKb * 1024};
+}
+
+static std::shared_ptr<Context> createContext(const Options& options) {
+  std::shared_ptr<Context> context = std::make_shared<Context>(
+      ContextOptions()
+          .lazyChannelEstablishment(options.lazyChannelEstablishment)
+          .speculativeChannelConnections(
+              options.speculativeChannelConnections));
+  auto transportContext = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
+  validateTransportContext(transportContext);
+  context->registerTransport(0, options.transport, transportContext);
+  auto channelContext = TensorpipeChannelRegistry().create(
+      options.channel, options.channelTunables);
+  validateChannelContext(channelContext);
+  context->registerChannel(0, options.channel, channelContext);
+  return context;
+}
+
+static size_t maxTensorSize(const Options& options) {
+  return std::max(options.tensorSize, options.maxTensorSize);
+}
+
+static Data createData(const Options& options) {
+  Data data;
+  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
+    data.payloads.push_back(std::make_unique<uint8_t[]>(options.payloadSize));
+  }
+  for (size_t size = options.tensorSize; size <= maxTensorSize(options);
+       size *= 2) {
+    data.tensorSizes.push_back(size);
+    if (size == 0) {
+      break;
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+    data.tensors.push_back(std::make_unique<uint8_t[]>(maxTensorSize(options)));
+  }
+  data.metadata = std::string(options.metadataSize, 0x42);
+  return data;
+}
+
+static Message createMessage(
+    const Options& options,
+    const Data& data,
+    PipeState& state,
+    size_t& numBytes) {
+  Message message;
+  message.metadata = data.metadata;
+  numBytes = data.metadata.size();
+  for (size_t payloadIdx = 0; payloadIdx < options.numPayloads; payloadIdx++) {
+    Message::Payload payload;
+    payload.data = data.payloads[payloadIdx].get();
+    payload.length = options.payloadSize;
+    payload.metadata = data.metadata;
+    numBytes += payload.length + payload.metadata.size();
+    message.payloads.push_back(std::move(payload));
+  }
+  size_t tensorSize = data.tensorSizes[state.rng() % data.tensorSizes.size()];
+  for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+    Message::Tensor tensor;
+    tensor.buffer = CpuBuffer{data.tensors[tensorIdx].get(), tensorSize};
+    tensor.metadata = data.metadata;
+    numBytes += tensorSize + tensor.metadata.size();
+    message.tensors.push_back(std::move(tensor));
+  }
+  return message;
+}
+
+// Print and report how the results compare with the limits, and return how
+// many of them were exceeded.
+static int checkSlos(
+    const Options& options,
+    const Results& results,
+    Report& report) {
+  struct Slo {
+    const char* key;
+    double value;
+    bool isMin;
+  };
+  const Slo slos[] = {
+      {"min_msgs_per_sec", results.msgsPerSec, true},
+      {"min_gb_per_sec", results.gbPerSec, true},
+      {"max_p99_us", results.p99Us, false},
+      {"max_cpu_cores", results.cpuCores, false},
+      {"max_cpu_ns_per_byte", results.cpuNsPerByte, false},
+      {"max_rss_mb", results.peakRssMb, false},
+      {"max_rss_growth_mb", results.rssGrowthMb, false},
+  };
+  int numViolations = 0;
+  for (const Slo& slo : slos) {
+    double limit = options.slos.getDouble(slo.key, NAN);
+    if (std::isnan(limit) || std::isnan(slo.value)) {
+      continue;
+    }
+    bool met = slo.isMin ? slo.value >= limit : slo.value <= limit;
+    fprintf(
+        stderr,
+        "SLO %-20s %-12.3f %s %-12.3f %s\n",
+        slo.key,
+        slo.value,
+        slo.isMin ? ">=" : "<=",
+        limit,
+        met ? "ok" : "VIOLATED");
+    report.add("slo", slo.key, limit);
+    report.add("slo", std::string(slo.key) + "_met", met ? 1.0 : 0.0);
+    if (!met) {
+      numViolations++;
+    }
+  }
+  options.slos.checkAllUsed("slo");
+  report.add("slo", "num_violations", numViolations);
+  return numViolations;
+}
+
+static void addMemory(
+    Report& report,
+    Results& results,
+    size_t rssBefore,
+    std::pair<size_t, size_t> rssAfter) {
+  results.peakRssMb = rssAfter.second / 1e6;
+  results.rssGrowthMb =
+      (static_cast<double>(rssAfter.first) - rssBefore) / 1e6;
+  report.add("memory", "rss_mb", rssAfter.first / 1e6);
+  report.add("memory", "peak_rss_mb", results.peakRssMb);
+  report.add("memory", "rss_growth_mb", results.rssGrowthMb);
+}
+
+// Echo each message from buffers allocated for it, which are freed once it's
+// written back, so that the allocator is exercised too. The next message is
+// read while this one is being written, until the client closes the pipe.
+static void serverEchoNonBlock(
+    const std::shared_ptr<Pipe>& pipe,
+    std::atomic<uint64_t>& numBytes,
+    Counter& numClosed) {
+  pipe->readDescriptor([pipe, &numBytes, &numClosed](
+                           const Error& error, Message&& message) {
+    if (error) {
+      numClosed.increment();
+      return;
+    }
+    auto buffers = std::make_shared<std::vector<std::unique_ptr<uint8_t[]>>>();
+    size_t messageSize = message.metadata.size();
+    for (Message::Payload& payload : message.payloads) {
+      buffers->push_back(std::make_unique<uint8_t[]>(payload.length));
+      payload.data = buffers->back().get();
+      messageSize += payload.length + payload.metadata.size();
+    }
+    for (Message::Tensor& tensor : message.tensors) {
+      buffers->push_back(
+          std::make_unique<uint8_t[]>(tensor.buffer.cpu.length));
+      tensor.buffer.cpu.ptr = buffers->back().get();
+      messageSize += tensor.buffer.cpu.length + tensor.metadata.size();
+    }
+    pipe->read(
+        std::move(message),
+        [pipe, buffers, messageSize, &numBytes, &numClosed](
+            const Error& error, Message&& message) {
+          if (error) {
+            numClosed.increment();
+            return;
+          }
+          serverEchoNonBlock(pipe, numBytes, numClosed);
+          pipe->write(
+              std::move(message),
+              [buffers, messageSize, &numBytes](const Error& error, Message&&) {
+                // The client may have closed the pipe in the meantime.
+                if (!error) {
+                  numBytes += 2 * messageSize;
+                }
+              });
+        });
+  });
+}
+
+static int runServer(const Options& options) {
+  std::vector<std::shared_ptr<Pipe>> pipes;
+  Counter numAccepted;
+  Counter numClosed;
+  std::atomic<uint64_t> numBytes{0};
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::shared_ptr<Context> context = createContext(options);
+  std::shared_ptr<Listener> listener = context->listen({options.address});
+  // The driver waits for this before it starts the clients.
+  fprintf(
+      stderr, "Listening on %s\n", listener->url(options.transport).c_str());
+
+  // The accept callbacks are invoked one after the other from the loop.
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptCallback =
+      [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+        TP_THROW_ASSERT_IF(error) << error.what();
+        pipes.push_back(pipe);
+        serverEchoNonBlock(pipe, numBytes, numClosed);
+        if (pipes.size() < static_cast<size_t>(options.numPipes)) {
+          listener->accept(acceptCallback);
+        }
+        numAccepted.increment();
+      };
+  listener->accept(acceptCallback);
+
+  // The clients start their warm-up once all their pipes are up, which is
+  // about when they're all accepted.
+  numAccepted.waitFor(options.numPipes);
+  std::this_thread::sleep_for(
+      std::chrono::duration<double>(options.duration / 10));
+  size_t rssBefore = measureRss().first;
+  uint64_t numBytesBefore = numBytes;
+  cpuUsage.start();
+
+  numClosed.waitFor(options.numPipes);
+  cpuUsage.stop();
+  auto rssAfter = measureRss();
+  size_t numBytesMeasured = numBytes - numBytesBefore;
+  listener.reset();
+  context->join();
+
+  cpuUsage.print(numBytesMeasured);
+
+  Results results;
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("cpu", cpuUsage, numBytesMeasured);
+  results.cpuCores = (cpuUsage.userSeconds() + cpuUsage.systemSeconds()) /
+      cpuUsage.wallSeconds();
+  results.cpuNsPerByte =
+      (cpuUsage.userSeconds() + cpuUsage.systemSeconds()) * 1e9 /
+      numBytesMeasured;
+  addMemory(report, results, rssBefore, rssAfter);
+  int numViolations = checkSlos(options, results, report);
+  report.print(options.output, stdout);
+  return numViolations > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Issue the next round trip, unless the run is over.
+static void clientPingNonBlock(
+    const Options& options,
+    const Data& data,
+    PipeState& state,
+    const std::atomic<bool>& stopping) {
+  if (stopping) {
+    return;
+  }
+  size_t numBytes;
+  Message message = createMessage(options, data, state, numBytes);
+  state.startTimes.push_back(Measurements::clock::now());
+  state.pipe->write(std::move(message), [](const Error& error, Message&&) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+  });
+}
+
+// Read the responses, one after the other, and start a new round trip for each
+// of them, until the run is over and all of them are in.
+static void clientPongNonBlock(
+    const Options& options,
+    const Data& data,
+    PipeState& state,
+    const std::atomic<bool>& measuring,
+    const std::atomic<bool>& stopping,
+    std::atomic<uint64_t>& numRoundTrips,
+    Counter& numDone) {
+  state.pipe->readDescriptor([&](const Error& error, Message&& message) {
+    TP_THROW_ASSERT_IF(error) << error.what();
+    size_t messageSize = message.metadata.size();
+    for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+         payloadIdx++) {
+      Message::Payload& payload = message.payloads[payloadIdx];
+      payload.data = state.temporaryPayloads[payloadIdx].get();
+      messageSize += payload.length + payload.metadata.size();
+    }
+    for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+         tensorIdx++) {
+      Message::Tensor& tensor = message.tensors[tensorIdx];
+      tensor.buffer.cpu.ptr = state.temporaryTensors[tensorIdx].get();
+      messageSize += tensor.buffer.cpu.length + tensor.metadata.size();
+    }
+    state.pipe->read(
+        std::move(message),
+        [&, messageSize](const Error& error, Message&&) {
+          TP_THROW_ASSERT_IF(error) << error.what();
+          auto latency = Measurements::clock::now() - state.startTimes.front();
+          state.startTimes.pop_front();
+          numRoundTrips++;
+          if (measuring && !stopping) {
+            state.numRoundTrips++;
+            state.numBytes += 2 * messageSize;
+            // Reservoir sampling, which keeps each latency with the same
+            // probability, however many there were.
+            size_t sampleIdx = state.numSamplesSeen++;
+            if (sampleIdx >= kMaxSamplesPerPipe) {
+              sampleIdx = state.rng() % state.numSamplesSeen;
+            }
+            if (sampleIdx < state.samples.size()) {
+              state.samples[sampleIdx] = latency;
+            } else if (sampleIdx < kMaxSamplesPerPipe) {
+              state.samples.push_back(latency);
+            }
+          }
+          clientPingNonBlock(options, data, state, stopping);
+          if (state.startTimes.empty()) {
+            numDone.increment();
+            return;
+          }
+          clientPongNonBlock(
+              options,
+              data,
+              state,
+              measuring,
+              stopping,
+              numRoundTrips,
+              numDone);
+        });
+  });
+}
+
+static int runClient(const Options& options) {
+  Data data = createData(options);
+  std::vector<std::unique_ptr<PipeState>> states;
+  std::atomic<bool> measuring{false};
+  std::atomic<bool> stopping{false};
+  std::atomic<uint64_t> numRoundTrips{0};
+  Counter numEstablished;
+  Counter numDone;
+  CpuUsage cpuUsage(options.perfCounters);
+
+  std::vector<std::shared_ptr<Context>> contexts;
+  for (int contextIdx = 0; contextIdx < options.numClientThreads;
+       contextIdx++) {
+    contexts.push_back(createContext(options));
+  }
+
+  // The pipes are spread over the contexts, hence over their loops.
+  std::random_device randomDevice;
+  for (int pipeIdx = 0; pipeIdx < options.numPipes; pipeIdx++) {
+    auto state = std::make_unique<PipeState>();
+    state->rng.seed(randomDevice());
+    for (size_t payloadIdx = 0; payloadIdx < options.numPayloads;
+         payloadIdx++) {
+      state->temporaryPayloads.push_back(
+          std::make_unique<uint8_t[]>(options.payloadSize));
+    }
+    for (size_t tensorIdx = 0; tensorIdx < options.numTensors; tensorIdx++) {
+      state->temporaryTensors.push_back(
+          std::make_unique<uint8_t[]>(maxTensorSize(options)));
+    }
+    state->pipe = contexts[pipeIdx % contexts.size()]->connect(options.address);
+    PipeState* statePtr = state.get();
+    state->pipe->waitForEstablishment([&, statePtr](const Error& error) {
+      TP_THROW_ASSERT_IF(error) << error.what();
+      for (int messageIdx = 0; messageIdx < options.window; messageIdx++) {
+        clientPingNonBlock(options, data, *statePtr, stopping);
+      }
+      clientPongNonBlock(
+          options,
+          data,
+          *statePtr,
+          measuring,
+          stopping,
+          numRoundTrips,
+          numDone);
+      numEstablished.increment();
+    });
+    states.push_back(std::move(state));
+  }
+  numEstablished.waitFor(options.numPipes);
+
+  auto start = Measurements::clock::now();
+  auto duration = std::chrono::duration_cast<Measurements::clock::duration>(
+      std::chrono::duration<double>(options.duration));
+  std::this_thread::sleep_until(start + duration / 10);
+  size_t rssBefore = measureRss().first;
+  cpuUsage.start();
+  measuring = true;
+
+  for (auto next = start + kProgressInterval; next < start + duration;
+       next += kProgressInterval) {
+    std::this_thread::sleep_until(next);
+    fprintf(
+        stderr,
+        "%.0f s: %lu round trips, %.1f MB of RSS\n",
+        std::chrono::duration<double>(next - start).count(),
+        numRoundTrips.load(),
+        measureRss().first / 1e6);
+  }
+  std::this_thread::sleep_until(start + duration);
+  stopping = true;
+  cpuUsage.stop();
+  auto rssAfter = measureRss();
+
+  numDone.waitFor(options.numPipes);
+  for (auto& state : states) {
+    state->pipe->close();
+  }
+  for (auto& context : contexts) {
+    context->join();
+  }
+
+  Measurements measurements;
+  uint64_t numMessages = 0;
+  size_t numBytes = 0;
+  for (const auto& state : states) {
+    for (const auto& sample : state->samples) {
+      measurements.add(sample);
+    }
+    numMessages += 2 * state->numRoundTrips;
+    numBytes += state->numBytes;
+  }
+  TP_THROW_ASSERT_IF(measurements.size() == 0)
+      << "No round trip completed after the warm-up";
+  measurements.sort();
+  double seconds = cpuUsage.wallSeconds();
+
+  Results results;
+  results.msgsPerSec = numMessages / seconds;
+  results.gbPerSec = numBytes / seconds / 1e9;
+  results.p99Us = measurements.percentile(0.99).count() / 1000.0;
+  results.cpuCores = (cpuUsage.userSeconds() + cpuUsage.systemSeconds()) /
+      cpuUsage.wallSeconds();
+  results.cpuNsPerByte =
+      (cpuUsage.userSeconds() + cpuUsage.systemSeconds()) * 1e9 / numBytes;
+
+  fprintf(
+      stderr,
+      "%-15s %-15s %-12s %-12s %-12s %-12s\n",
+      "# messages",
+      "total (MB)",
+      "msgs/s",
+      "GB/s",
+      "p50 (usec)",
+      "p99 (usec)");
+  fprintf(
+      stderr,
+      "%-15lu %-15.3f %-12.0f %-12.3f %-12.3f %-12.3f\n",
+      numMessages,
+      numBytes / 1e6,
+      results.msgsPerSec,
+      results.gbPerSec,
+      measurements.percentile(0.50).count() / 1000.0,
+      results.p99Us);
+  cpuUsage.print(numBytes);
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("throughput", "msgs_per_sec", results.msgsPerSec);
+  report.add("throughput", "gb_per_sec", results.gbPerSec);
+  report.add("latency", measurements);
+  report.add("cpu", cpuUsage, numBytes);
+  addMemory(report, results, rssBefore, rssAfter);
+  int numViolations = checkSlos(options, results, report);
+  report.print(options.output, stdout);
+  return numViolations > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+  struct Options x = parseOptions(argc, argv);
+  if (x.duration <= 0) {
+    fprintf(stderr, "Missing argument: --duration must be set\n");
+    return EXIT_FAILURE;
+  }
+  if (x.numTensors > 0 && x.tensorSize == 0) {
+    fprintf(stderr, "Invalid argument: --tensor-size must be set\n");
+    return EXIT_FAILURE;
+  }
+  // Keep stdout clean for the machine-readable formats.
+  if (x.output == "text") {
+    std::cout << "mode = " << x.mode << "\n";
+    std::cout << "transport = " << x.transport << "\n";
+    std::cout << "channel = " << x.channel << "\n";
+    std::cout << "address = " << x.address << "\n";
+    std::cout << "duration = " << x.duration << "\n";
+    std::cout << "num_pipes = " << x.numPipes << "\n";
+    std::cout << "num_client_threads = " << x.numClientThreads << "\n";
+    std::cout << "window = " << x.window << "\n";
+    std::cout << "slos = " << x.slos.str() << "\n";
+  }
+
+  if (x.mode == "listen") {
+    return runServer(x);
+  } else if (x.mode == "connect") {
+    return runClient(x);
+  } else {
+    // Should never be here
+    TP_THROW_ASSERT() << "unknown mode: " << x.mode;
+  }
+
+  return 0;
+}
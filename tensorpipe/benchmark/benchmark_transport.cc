@@ -10,8 +10,10 @@
 
 #include <future>
 
+#include <tensorpipe/benchmark/cpu_usage.h>
 #include <tensorpipe/benchmark/measurements.h>
 #include <tensorpipe/benchmark/options.h>
+#include <tensorpipe/benchmark/report.h>
 #include <tensorpipe/benchmark/transport_registry.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/transport/connection.h>
@@ -51,6 +53,11 @@ static void printMeasurements(Measurements& measurements, size_t dataLen) {
       measurements.percentile(0.95).count() / 1000.0);
 }
 
+// Both sides send and receive each payload once per round trip.
+static size_t numBytesPerSide(const Options& options) {
+  return 2 * static_cast<size_t>(options.numRoundTrips) * options.payloadSize;
+}
+
 static std::unique_ptr<uint8_t[]> createData(const int size) {
   auto data = std::make_unique<uint8_t[]>(size);
   // Generate fixed data for validation between peers
@@ -99,9 +106,11 @@ static void runServer(const Options& options) {
                options.payloadSize};
   Measurements measurements;
   measurements.reserve(options.numRoundTrips);
+  CpuUsage cpuUsage(options.perfCounters);
 
   std::shared_ptr<transport::Context> context;
-  context = TensorpipeTransportRegistry().create(options.transport);
+  context = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
   validateTransportContext(context);
 
   std::promise<std::shared_ptr<Connection>> connProm;
@@ -113,11 +122,21 @@ static void runServer(const Options& options) {
   std::shared_ptr<Connection> conn = connProm.get_future().get();
 
   std::promise<void> doneProm;
+  cpuUsage.start();
   serverPongPingNonBlock(
       std::move(conn), numRoundTrips, doneProm, data, measurements);
 
   doneProm.get_future().get();
+  cpuUsage.stop();
   context->join();
+
+  cpuUsage.print(numBytesPerSide(options));
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("cpu", cpuUsage, numBytesPerSide(options));
+  report.print(options.output, stdout);
 }
 
 static void clientPingPongNonBlock(
@@ -162,27 +181,45 @@ static void runClient(const Options& options) {
                options.payloadSize};
   Measurements measurements;
   measurements.reserve(options.numRoundTrips);
+  CpuUsage cpuUsage(options.perfCounters);
 
   std::shared_ptr<transport::Context> context;
-  context = TensorpipeTransportRegistry().create(options.transport);
+  context = TensorpipeTransportRegistry().create(
+      options.transport, options.transportTunables);
   validateTransportContext(context);
   std::shared_ptr<Connection> conn = context->connect(addr);
 
   std::promise<void> doneProm;
+  cpuUsage.start();
   clientPingPongNonBlock(
       std::move(conn), numRoundTrips, doneProm, data, measurements);
 
   doneProm.get_future().get();
+  cpuUsage.stop();
   context->join();
+
+  cpuUsage.print(numBytesPerSide(options));
+
+  Report report;
+  report.addHostInfo();
+  report.addOptions(options);
+  report.add("latency", measurements);
+  report.add("cpu", cpuUsage, numBytesPerSide(options));
+  report.print(options.output, stdout);
 }
 
 int main(int argc, char** argv) {
   struct Options x = parseOptions(argc, argv);
-  std::cout << "mode = " << x.mode << "\n";
-  std::cout << "transport = " << x.transport << "\n";
-  std::cout << "address = " << x.address << "\n";
-  std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
-  std::cout << "payload_size = " << x.payloadSize << "\n";
+  // Keep stdout clean for the machine-readable formats.
+  if (x.output == "text") {
+    std::cout << "mode = " << x.mode << "\n";
+    std::cout << "transport = " << x.transport << "\n";
+    std::cout << "address = " << x.address << "\n";
+    std::cout << "num_round_trips = " << x.numRoundTrips << "\n";
+    std::cout << "payload_size = " << x.payloadSize << "\n";
+    std::cout << "perf_counters = " << x.perfCounters << "\n";
+    std::cout << "transport_opts = " << x.transportTunables.str() << "\n";
+  }
 
   if (x.mode == "listen") {
     runServer(x);
@@ -8,16 +8,48 @@
 
 #include <tensorpipe/benchmark/channel_registry.h>
 
+#include <cstdio>
+#include <cstdlib>
+
+#include <tensorpipe/benchmark/transport_registry.h>
+#include <tensorpipe/common/compression.h>
 #include <tensorpipe/tensorpipe.h>
 
 TP_DEFINE_SHARED_REGISTRY(
     TensorpipeChannelRegistry,
-    tensorpipe::channel::CpuContext);
+    tensorpipe::channel::CpuContext,
+    const tensorpipe::benchmark::Tunables&);
+
+using tensorpipe::benchmark::getIbvDeviceOptions;
+using tensorpipe::benchmark::Tunables;
+
+// Each creator takes the settings of the constructor of its channel, by the
+// snake_case version of their names. Their defaults are those of the
+// constructor.
 
 // BASIC
 
-std::shared_ptr<tensorpipe::channel::CpuContext> makeBasicChannel() {
-  return std::make_shared<tensorpipe::channel::basic::Context>();
+std::shared_ptr<tensorpipe::channel::CpuContext> makeBasicChannel(
+    const Tunables& tunables) {
+  tensorpipe::CompressionOptions compression;
+  std::string codecName = tunables.getString("compression_codec", "none");
+  auto codec = tensorpipe::codecFromName(codecName);
+  if (!codec.has_value()) {
+    fprintf(stderr, "Unknown compression codec: %s\n", codecName.c_str());
+    exit(EXIT_FAILURE);
+  }
+  compression.codec = codec.value();
+  compression.level = tunables.getInt("compression_level", compression.level);
+  compression.threshold =
+      tunables.getSize("compression_threshold", compression.threshold);
+  compression.numThreads =
+      tunables.getSize("compression_num_threads", compression.numThreads);
+  auto context = std::make_shared<tensorpipe::channel::basic::Context>(
+      tunables.getSize("chunk_size", 1024 * 1024),
+      tunables.getSize("max_chunks_in_flight", 4),
+      compression);
+  tunables.checkAllUsed("basic");
+  return context;
 }
 
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, basic, makeBasicChannel);
@@ -25,25 +57,88 @@ TP_REGISTER_CREATOR(TensorpipeChannelRegistry, basic, makeBasicChannel);
 // CMA
 
 #if TENSORPIPE_HAS_CMA_CHANNEL
-std::shared_ptr<tensorpipe::channel::CpuContext> makeCmaChannel() {
-  return std::make_shared<tensorpipe::channel::cma::Context>();
+std::shared_ptr<tensorpipe::channel::CpuContext> makeCmaChannel(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::channel::cma::Context>(
+      tunables.getSize("num_threads", 1),
+      tunables.getSize("min_chunk_size", 1024 * 1024),
+      tunables.getBool("receive_by_push", false));
+  tunables.checkAllUsed("cma");
+  return context;
 }
 
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, cma, makeCmaChannel);
 #endif // TENSORPIPE_HAS_CMA_CHANNEL
 
+// SHM_POOL
+
+#if TENSORPIPE_HAS_SHM_POOL_CHANNEL
+std::shared_ptr<tensorpipe::channel::CpuContext> makeShmPoolChannel(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::channel::shm_pool::Context>(
+      tunables.getSize("arena_size", 256 * 1024 * 1024),
+      tunables.getSize("staging_chunk_size", 1024 * 1024),
+      tunables.getSize("num_staging_slots", 4));
+  tunables.checkAllUsed("shm_pool");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeChannelRegistry, shm_pool, makeShmPoolChannel);
+#endif // TENSORPIPE_HAS_SHM_POOL_CHANNEL
+
+// IBV
+
+#if TENSORPIPE_HAS_IBV_CHANNEL
+std::shared_ptr<tensorpipe::channel::CpuContext> makeIbvChannel(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::channel::ibv::Context>(
+      tunables.getSize("registration_cache_capacity", 0),
+      getIbvDeviceOptions(tunables));
+  tunables.checkAllUsed("ibv");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeChannelRegistry, ibv, makeIbvChannel);
+#endif // TENSORPIPE_HAS_IBV_CHANNEL
+
 // MPT
 
-std::shared_ptr<tensorpipe::channel::CpuContext> makeMptChannel() {
-  throw std::runtime_error("mtp channel requires arguments");
+// The lanes are contexts of the lane_transport, with its default settings, and
+// each listens on the lane_address, which the peer must be able to reach.
+std::shared_ptr<tensorpipe::channel::CpuContext> makeMptChannel(
+    const Tunables& tunables) {
+  size_t numLanes = tunables.getSize("num_lanes", 2);
+  std::string laneTransport = tunables.getString("lane_transport", "uv");
+  std::string laneAddress = tunables.getString("lane_address", "127.0.0.1");
+  uint64_t chunkSize = tunables.getSize("chunk_size", 0);
+  tunables.checkAllUsed("mpt");
+
+  std::vector<std::shared_ptr<tensorpipe::transport::Context>> contexts;
+  std::vector<std::shared_ptr<tensorpipe::transport::Listener>> listeners;
+  for (size_t laneIdx = 0; laneIdx < numLanes; laneIdx++) {
+    auto context =
+        TensorpipeTransportRegistry().create(laneTransport, Tunables());
+    tensorpipe::benchmark::validateTransportContext(context);
+    listeners.push_back(context->listen(laneAddress));
+    contexts.push_back(std::move(context));
+  }
+  return std::make_shared<tensorpipe::channel::mpt::Context>(
+      std::move(contexts), std::move(listeners), chunkSize);
 }
 
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, mpt, makeMptChannel);
 
 // XTH
 
-std::shared_ptr<tensorpipe::channel::CpuContext> makeXthChannel() {
-  return std::make_shared<tensorpipe::channel::xth::Context>();
+std::shared_ptr<tensorpipe::channel::CpuContext> makeXthChannel(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::channel::xth::Context>(
+      tunables.getSize("num_threads", 1),
+      tunables.getSize("min_chunk_size", 1024 * 1024),
+      tunables.getBool("non_temporal_stores", false),
+      tunables.getBool("copy_offload", false));
+  tunables.checkAllUsed("xth");
+  return context;
 }
 
 TP_REGISTER_CREATOR(TensorpipeChannelRegistry, xth, makeXthChannel);
@@ -8,9 +8,12 @@
 
 #pragma once
 
+#include <tensorpipe/benchmark/options.h>
 #include <tensorpipe/channel/cpu_context.h>
 #include <tensorpipe/util/registry/registry.h>
 
+// The creators get the settings given with --channel-opt.
 TP_DECLARE_SHARED_REGISTRY(
     TensorpipeChannelRegistry,
-    tensorpipe::channel::CpuContext);
+    tensorpipe::channel::CpuContext,
+    const tensorpipe::benchmark::Tunables&);
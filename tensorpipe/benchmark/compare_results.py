@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+# Copyright (c) Facebook, Inc. and its affiliates.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree.
+
+"""Compare two results of benchmark_pipe, _replay, _setup or _transport.
+
+The results are those printed with --output=json or --output=csv. Latencies are
+compared with Welch's t-test on their means, and are reported as regressions if
+they got slower by more than the threshold with a significance better than
+alpha. Throughputs and costs (CPU per byte, resources per pipe) have a single
+sample per run, hence they are only compared against the threshold. The exit
+status is 1 if any regression is found, so that this can be used as a gate.
+"""
+
+import argparse
+import csv
+import json
+import math
+import sys
+
+# What a section must have to be compared as a latency (lower is better).
+LATENCY_KEYS = ("mean_us", "stddev_us", "count")
+# Values of the throughput section that get better as they increase.
+THROUGHPUT_KEYS = ("msgs_per_sec", "gb_per_sec", "pipes_per_sec")
+# Costs in CPU and memory, which get better as they decrease.
+COST_KEYS = (
+    "ns_per_byte",
+    "cycles_per_byte",
+    "fds_per_pipe",
+    "rss_kb_per_pipe",
+)
+
+
+def load(path):
+    with open(path) as f:
+        if path.endswith(".csv"):
+            rows = list(csv.reader(f))
+            result = {}
+            for column, value in zip(rows[0], rows[1]):
+                section, key = column.split(".", 1)
+                try:
+                    value = float(value)
+                except ValueError:
+                    pass
+                result.setdefault(section, {})[key] = value
+            return result
+        return json.load(f)
+
+
+def welch_p_value(a, b):
+    """Two-sided p-value of the difference of the means of a and b.
+
+    This uses the normal approximation of the t distribution, which is accurate
+    for the thousands of samples that benchmarks usually collect.
+    """
+    var_a = a["stddev_us"] ** 2 / a["count"]
+    var_b = b["stddev_us"] ** 2 / b["count"]
+    if var_a + var_b == 0:
+        return 0.0 if a["mean_us"] != b["mean_us"] else 1.0
+    t = (b["mean_us"] - a["mean_us"]) / math.sqrt(var_a + var_b)
+    return math.erfc(abs(t) / math.sqrt(2))
+
+
+def compare(baseline, candidate, threshold, alpha):
+    regressions = []
+
+    old_config = baseline.get("config", {})
+    new_config = candidate.get("config", {})
+    for key in sorted(set(old_config) | set(new_config)):
+        if old_config.get(key) != new_config.get(key):
+            print(
+                f"warning: config.{key} differs: "
+                f"{old_config.get(key)} vs {new_config.get(key)}",
+                file=sys.stderr,
+            )
+
+    for section, values in candidate.items():
+        if section not in baseline:
+            continue
+        old = baseline[section]
+        if all(key in values and key in old for key in LATENCY_KEYS):
+            change = values["mean_us"] / old["mean_us"] - 1
+            p_value = welch_p_value(old, values)
+            regressed = change > threshold and p_value < alpha
+            print(
+                f"{section:<12} mean_us {old['mean_us']:>12.3f} -> "
+                f"{values['mean_us']:>12.3f} ({change:+.1%}, "
+                f"p={p_value:.2g}){'  REGRESSION' if regressed else ''}"
+            )
+            if regressed:
+                regressions.append(section)
+        for key in THROUGHPUT_KEYS:
+            if key not in values or key not in old:
+                continue
+            change = values[key] / old[key] - 1
+            regressed = change < -threshold
+            print(
+                f"{section:<12} {key} {old[key]:>12.3f} -> "
+                f"{values[key]:>12.3f} ({change:+.1%})"
+                f"{'  REGRESSION' if regressed else ''}"
+            )
+            if regressed:
+                regressions.append(f"{section}.{key}")
+        for key in COST_KEYS:
+            if key not in values or key not in old:
+                continue
+            change = values[key] / old[key] - 1
+            regressed = change > threshold
+            print(
+                f"{section:<12} {key} {old[key]:>12.3f} -> "
+                f"{values[key]:>12.3f} ({change:+.1%})"
+                f"{'  REGRESSION' if regressed else ''}"
+            )
+            if regressed:
+                regressions.append(f"{section}.{key}")
+
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("baseline")
+    parser.add_argument("candidate")
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.05,
+        help="relative change below which differences are ignored",
+    )
+    parser.add_argument(
+        "--alpha",
+        type=float,
+        default=0.01,
+        help="significance level for latency changes",
+    )
+    args = parser.parse_args()
+
+    regressions = compare(
+        load(args.baseline), load(args.candidate), args.threshold, args.alpha
+    )
+    if regressions:
+        print(f"Regressions in: {', '.join(regressions)}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/benchmark/cpu_usage.h>
+
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace benchmark {
+
+namespace {
+
+std::chrono::nanoseconds toNanoseconds(const struct timeval& tv) {
+  return std::chrono::seconds(tv.tv_sec) +
+      std::chrono::microseconds(tv.tv_usec);
+}
+
+double toSeconds(std::chrono::nanoseconds ns) {
+  return ns.count() / 1e9;
+}
+
+// Returns the name and the user plus system time of a thread, or false if it
+// exited in the meantime.
+bool readThreadStat(
+    pid_t tid,
+    std::string& name,
+    std::chrono::nanoseconds& cpuTime) {
+  std::ifstream file("/proc/self/task/" + std::to_string(tid) + "/stat");
+  std::string stat;
+  if (!std::getline(file, stat)) {
+    return false;
+  }
+  // The name is enclosed in parentheses and may itself contain any character,
+  // hence the fields that follow it are found from the last parenthesis.
+  auto nameStart = stat.find('(');
+  auto nameEnd = stat.rfind(')');
+  if (nameStart == std::string::npos || nameEnd == std::string::npos) {
+    return false;
+  }
+  name = stat.substr(nameStart + 1, nameEnd - nameStart - 1);
+
+  // Fields 3 (state) to 15 (stime) in proc(5), of which utime and stime are
+  // the last two.
+  std::istringstream fields(stat.substr(nameEnd + 1));
+  std::string field;
+  for (int idx = 3; idx < 14; idx++) {
+    fields >> field;
+  }
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  if (!(fields >> utime >> stime)) {
+    return false;
+  }
+  static const long ticksPerSecond = ::sysconf(_SC_CLK_TCK);
+  cpuTime = std::chrono::nanoseconds(
+      (utime + stime) * static_cast<uint64_t>(1000000000 / ticksPerSecond));
+  return true;
+}
+
+Fd openPerfCounter(uint64_t config, bool excludeKernel) {
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  // Counting starts when the benchmark does, and covers all the threads of the
+  // process that are spawned from now on.
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = excludeKernel ? 1 : 0;
+  attr.exclude_hv = 1;
+  return Fd(::syscall(
+      SYS_perf_event_open,
+      &attr,
+      /*pid=*/0,
+      /*cpu=*/-1,
+      /*group_fd=*/-1,
+      PERF_FLAG_FD_CLOEXEC));
+}
+
+} // namespace
+
+CpuUsage::CpuUsage(bool usePerfCounters) {
+  if (!usePerfCounters) {
+    return;
+  }
+
+  const std::array<uint64_t, kNumPerfCounters> configs = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES};
+  int error = 0;
+  for (bool excludeKernel : {false, true}) {
+    hasPerfCounters_ = true;
+    perfCountersUserOnly_ = excludeKernel;
+    for (int idx = 0; idx < kNumPerfCounters; idx++) {
+      perfFds_[idx] = openPerfCounter(configs[idx], excludeKernel);
+      if (!perfFds_[idx].hasValue()) {
+        error = errno;
+        hasPerfCounters_ = false;
+        break;
+      }
+    }
+    // Only retry without the kernel if that's what we were denied.
+    if (hasPerfCounters_ || error != EACCES) {
+      break;
+    }
+  }
+  if (!hasPerfCounters_) {
+    fprintf(
+        stderr,
+        "Cannot open performance counters (%s), only reporting CPU time\n",
+        std::strerror(error));
+    for (auto& fd : perfFds_) {
+      fd.reset();
+    }
+  }
+}
+
+CpuUsage::Snapshot CpuUsage::takeSnapshot() {
+  Snapshot snapshot;
+
+  DIR* dir = ::opendir("/proc/self/task");
+  if (dir != nullptr) {
+    while (struct dirent* entry = ::readdir(dir)) {
+      if (entry->d_name[0] == '.') {
+        continue;
+      }
+      pid_t tid = std::atoi(entry->d_name);
+      std::string name;
+      std::chrono::nanoseconds cpuTime;
+      if (readThreadStat(tid, name, cpuTime)) {
+        snapshot.threads.emplace(tid, std::make_pair(name, cpuTime));
+      }
+    }
+    ::closedir(dir);
+  }
+
+  // Unlike the breakdown, this includes the threads that have already exited.
+  struct rusage usage;
+  TP_THROW_SYSTEM_IF(::getrusage(RUSAGE_SELF, &usage) < 0, errno);
+  snapshot.user = toNanoseconds(usage.ru_utime);
+  snapshot.system = toNanoseconds(usage.ru_stime);
+  snapshot.time = std::chrono::steady_clock::now();
+  return snapshot;
+}
+
+void CpuUsage::start() {
+  for (auto& fd : perfFds_) {
+    if (fd.hasValue()) {
+      TP_THROW_SYSTEM_IF(
+          ::ioctl(fd.fd(), PERF_EVENT_IOC_RESET, 0) < 0, errno);
+      TP_THROW_SYSTEM_IF(
+          ::ioctl(fd.fd(), PERF_EVENT_IOC_ENABLE, 0) < 0, errno);
+    }
+  }
+  start_ = takeSnapshot();
+}
+
+void CpuUsage::stop() {
+  stop_ = takeSnapshot();
+  // Reading the counter of the process also sums those of its live threads.
+  for (int idx = 0; idx < kNumPerfCounters; idx++) {
+    Fd& fd = perfFds_[idx];
+    if (fd.hasValue()) {
+      TP_THROW_SYSTEM_IF(
+          ::ioctl(fd.fd(), PERF_EVENT_IOC_DISABLE, 0) < 0, errno);
+      auto err = fd.readFull(&perfCounts_[idx], sizeof(perfCounts_[idx]));
+      TP_THROW_ASSERT_IF(err) << err.what();
+    }
+  }
+
+  threadSeconds_.clear();
+  for (const auto& it : stop_.threads) {
+    std::chrono::nanoseconds cpuTime = it.second.second;
+    auto startIt = start_.threads.find(it.first);
+    if (startIt != start_.threads.end()) {
+      cpuTime -= startIt->second.second;
+    }
+    threadSeconds_[it.second.first] += toSeconds(cpuTime);
+  }
+}
+
+double CpuUsage::wallSeconds() const {
+  return toSeconds(stop_.time - start_.time);
+}
+
+double CpuUsage::userSeconds() const {
+  return toSeconds(stop_.user - start_.user);
+}
+
+double CpuUsage::systemSeconds() const {
+  return toSeconds(stop_.system - start_.system);
+}
+
+void CpuUsage::print(size_t numBytes) const {
+  double cpuSeconds = userSeconds() + systemSeconds();
+  fprintf(
+      stderr,
+      "%-15s %-12s %-12s %-12s %-12s\n",
+      "cpu (sec)",
+      "user",
+      "system",
+      "cores",
+      "ns/B");
+  fprintf(
+      stderr,
+      "%-15.3f %-12.3f %-12.3f %-12.2f %-12.3f\n",
+      cpuSeconds,
+      userSeconds(),
+      systemSeconds(),
+      cpuSeconds / wallSeconds(),
+      cpuSeconds * 1e9 / numBytes);
+  for (const auto& it : threadSeconds_) {
+    fprintf(
+        stderr,
+        "  %-20s %-12.3f %5.1f%%\n",
+        it.first.c_str(),
+        it.second,
+        it.second / wallSeconds() * 100);
+  }
+  if (hasPerfCounters_) {
+    fprintf(
+        stderr,
+        "%-15s %-12s %-12s %-12s %-12s\n",
+        perfCountersUserOnly_ ? "perf (user)" : "perf",
+        "cycles/B",
+        "instr/B",
+        "IPC",
+        "LLC-miss/KB");
+    fprintf(
+        stderr,
+        "%-15s %-12.3f %-12.3f %-12.2f %-12.3f\n",
+        "",
+        static_cast<double>(cycles()) / numBytes,
+        static_cast<double>(instructions()) / numBytes,
+        static_cast<double>(instructions()) / cycles(),
+        static_cast<double>(llcMisses()) * 1024 / numBytes);
+  }
+}
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <tensorpipe/common/fd.h>
+
+namespace tensorpipe {
+namespace benchmark {
+
+// Measures the CPU consumed by this process over an interval, to tell how
+// efficient a transport or channel is and not just how fast: one that reaches
+// a high throughput by busy-polling on a full core per side looks very
+// different here than one that sleeps until there's work to do.
+//
+// It records the user and system time of the whole process, and breaks it down
+// by thread name (the loops of the transports and channels name their threads)
+// using /proc/self/task. If asked to, it also counts cycles, instructions and
+// last-level cache misses with the hardware performance counters.
+class CpuUsage {
+ public:
+  // The performance counters only follow the threads that are spawned after
+  // they are opened, hence this must be constructed before the contexts are.
+  explicit CpuUsage(bool usePerfCounters);
+
+  void start();
+
+  // The breakdown by thread only covers the threads that are still alive at
+  // this point, hence this must be called before the contexts are joined.
+  void stop();
+
+  double wallSeconds() const;
+  double userSeconds() const;
+  double systemSeconds() const;
+
+  // The CPU time of the threads, summed over those with the same name.
+  const std::map<std::string, double>& threadSeconds() const {
+    return threadSeconds_;
+  }
+
+  // Whether the performance counters could be opened. They may not be, for
+  // example in virtual machines or if perf_event_paranoid forbids it.
+  bool hasPerfCounters() const {
+    return hasPerfCounters_;
+  }
+
+  // Whether the performance counters exclude the kernel, which happens when
+  // perf_event_paranoid only allows counting user space.
+  bool perfCountersUserOnly() const {
+    return perfCountersUserOnly_;
+  }
+
+  uint64_t cycles() const {
+    return perfCounts_[kCycles];
+  }
+
+  uint64_t instructions() const {
+    return perfCounts_[kInstructions];
+  }
+
+  uint64_t llcMisses() const {
+    return perfCounts_[kLlcMisses];
+  }
+
+  // Print a summary to stderr, normalizing by the number of bytes that this
+  // side sent and received.
+  void print(size_t numBytes) const;
+
+ private:
+  enum PerfCounter { kCycles, kInstructions, kLlcMisses, kNumPerfCounters };
+
+  struct Snapshot {
+    std::chrono::steady_clock::time_point time;
+    std::chrono::nanoseconds user;
+    std::chrono::nanoseconds system;
+    // The names and the CPU time of the live threads, by thread ID.
+    std::map<pid_t, std::pair<std::string, std::chrono::nanoseconds>> threads;
+  };
+
+  static Snapshot takeSnapshot();
+
+  bool hasPerfCounters_{false};
+  bool perfCountersUserOnly_{false};
+  std::array<Fd, kNumPerfCounters> perfFds_;
+  std::array<uint64_t, kNumPerfCounters> perfCounts_{};
+
+  Snapshot start_;
+  Snapshot stop_;
+  std::map<std::string, double> threadSeconds_;
+};
+
+} // namespace benchmark
+} // namespace tensorpipe
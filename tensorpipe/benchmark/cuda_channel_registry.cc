@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/benchmark/cuda_channel_registry.h>
+
+#include <iostream>
+
+#include <tensorpipe/tensorpipe.h>
+
+TP_DEFINE_SHARED_REGISTRY(
+    TensorpipeCudaChannelRegistry,
+    tensorpipe::channel::CudaContext);
+
+// CUDA_BASIC
+
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaBasicChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+      std::make_shared<tensorpipe::channel::basic::Context>());
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_basic,
+    makeCudaBasicChannel);
+
+// CUDA_IPC
+
+#if TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaIpcChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_ipc::Context>();
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_ipc,
+    makeCudaIpcChannel);
+#endif // TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+
+// CUDA_GDR
+
+#if TENSORPIPE_HAS_CUDA_GDR_CHANNEL
+std::shared_ptr<tensorpipe::channel::CudaContext> makeCudaGdrChannel() {
+  return std::make_shared<tensorpipe::channel::cuda_gdr::Context>();
+}
+
+TP_REGISTER_CREATOR(
+    TensorpipeCudaChannelRegistry,
+    cuda_gdr,
+    makeCudaGdrChannel);
+#endif // TENSORPIPE_HAS_CUDA_GDR_CHANNEL
+
+namespace tensorpipe {
+namespace benchmark {
+
+void validateCudaChannelContext(std::shared_ptr<channel::CudaContext> context) {
+  if (!context) {
+    auto keys = TensorpipeCudaChannelRegistry().keys();
+    std::cout
+        << "The CUDA channel you passed in is not supported. The following CUDA channels are valid: ";
+    for (const auto& key : keys) {
+      std::cout << key << ", ";
+    }
+    std::cout << "\n";
+    exit(EXIT_FAILURE);
+  }
+}
+
+} // namespace benchmark
+} // namespace tensorpipe
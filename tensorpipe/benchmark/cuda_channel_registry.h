@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/util/registry/registry.h>
+
+TP_DECLARE_SHARED_REGISTRY(
+    TensorpipeCudaChannelRegistry,
+    tensorpipe::channel::CudaContext);
+
+namespace tensorpipe {
+namespace benchmark {
+
+void validateCudaChannelContext(std::shared_ptr<channel::CudaContext> context);
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -10,16 +10,17 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <vector>
 
 namespace tensorpipe {
 namespace benchmark {
 
 class Measurements {
+ public:
   using clock = std::chrono::high_resolution_clock;
   using nanoseconds = std::chrono::nanoseconds;
 
- public:
   void markStart() {
     start_ = clock::now();
   }
@@ -28,6 +29,21 @@ class Measurements {
     samples_.push_back(clock::now() - start_);
   }
 
+  // For when several operations are in flight at once, each with its own start.
+  void markStop(clock::time_point start) {
+    samples_.push_back(clock::now() - start);
+  }
+
+  // For when the start and the stop were recorded separately.
+  void add(nanoseconds sample) {
+    samples_.push_back(sample);
+  }
+
+  void merge(const Measurements& other) {
+    samples_.insert(
+        samples_.end(), other.samples_.begin(), other.samples_.end());
+  }
+
   void sort() {
     std::sort(samples_.begin(), samples_.end());
   }
@@ -52,6 +68,29 @@ class Measurements {
     return samples_[static_cast<size_t>(f * samples_.size())];
   }
 
+  double mean() const {
+    return sum().count() / static_cast<double>(samples_.size());
+  }
+
+  double stddev() const {
+    double m = mean();
+    double squares = 0;
+    for (const auto& sample : samples_) {
+      squares += (sample.count() - m) * (sample.count() - m);
+    }
+    return std::sqrt(squares / std::max<size_t>(samples_.size() - 1, 1));
+  }
+
+  // These two require the samples to be sorted.
+
+  nanoseconds min() const {
+    return samples_.front();
+  }
+
+  nanoseconds max() const {
+    return samples_.back();
+  }
+
  private:
   clock::time_point start_;
   std::vector<nanoseconds> samples_;
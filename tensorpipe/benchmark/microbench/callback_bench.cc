@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <functional>
+#include <memory>
+
+#include <benchmark/benchmark.h>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A minimal stand-in for the pipes and connections that use the wrappers.
+class Subject final : public std::enable_shared_from_this<Subject> {
+ public:
+  OnDemandDeferredExecutor loop;
+  LazyCallbackWrapper<Subject> lazyCallbackWrapper{*this, loop};
+  EagerCallbackWrapper<Subject> eagerCallbackWrapper{*this, loop};
+  uint64_t counter{0};
+
+ private:
+  Error error_{Error::kSuccess};
+
+  void setError_(Error error) {
+    if (error_ || !error) {
+      return;
+    }
+    error_ = std::move(error);
+  }
+
+  template <typename T>
+  friend class tensorpipe::LazyCallbackWrapper;
+  template <typename T>
+  friend class tensorpipe::EagerCallbackWrapper;
+};
+
+// The baseline: a callback stored in a std::function and invoked directly, as
+// would happen without any wrapper.
+void BM_CallbackStdFunction(benchmark::State& state) {
+  auto subject = std::make_shared<Subject>();
+
+  for (auto _ : state) {
+    std::function<void(const Error&, uint64_t)> fn =
+        [subject](const Error& /* unused */, uint64_t value) {
+          subject->counter += value;
+        };
+    fn(Error::kSuccess, 1);
+  }
+  benchmark::DoNotOptimize(subject->counter);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CallbackStdFunction);
+
+// Wrapping a callback and invoking it, which includes taking a weak_ptr to the
+// subject, deferring to its loop and locking the weak_ptr again.
+void BM_CallbackLazyWrapper(benchmark::State& state) {
+  auto subject = std::make_shared<Subject>();
+
+  for (auto _ : state) {
+    std::function<void(const Error&, uint64_t)> fn =
+        subject->lazyCallbackWrapper(
+            [](Subject& subject, uint64_t value) { subject.counter += value; });
+    fn(Error::kSuccess, 1);
+  }
+  benchmark::DoNotOptimize(subject->counter);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CallbackLazyWrapper);
+
+// Same as above, with a shared_ptr to the subject being held instead.
+void BM_CallbackEagerWrapper(benchmark::State& state) {
+  auto subject = std::make_shared<Subject>();
+
+  for (auto _ : state) {
+    std::function<void(const Error&, uint64_t)> fn =
+        subject->eagerCallbackWrapper(
+            [](Subject& subject, uint64_t value) { subject.counter += value; });
+    fn(Error::kSuccess, 1);
+  }
+  benchmark::DoNotOptimize(subject->counter);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CallbackEagerWrapper);
+
+} // namespace
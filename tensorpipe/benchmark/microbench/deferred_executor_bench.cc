@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <benchmark/benchmark.h>
+
+#include <tensorpipe/common/deferred_executor.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// An event loop that sleeps on a condition variable until a function is
+// deferred to it, as done by the loops of the uv and shm transports.
+class CondVarLoop final : public EventLoopDeferredExecutor {
+ public:
+  CondVarLoop() {
+    startThread("TP_bench_loop");
+  }
+
+  void join() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+    joinThread();
+  }
+
+ protected:
+  void eventLoop() override {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return closed_ || numWakeups_ > 0; });
+        if (numWakeups_ == 0) {
+          return;
+        }
+        numWakeups_ = 0;
+      }
+      runDeferredFunctionsFromEventLoop();
+    }
+  }
+
+  void wakeupEventLoopToDeferFunction() override {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      numWakeups_++;
+    }
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool closed_{false};
+  uint64_t numWakeups_{0};
+};
+
+// The on-demand executor runs the function inline when no other thread is in
+// the loop, hence this measures the bookkeeping around the function call.
+void BM_OnDemandDeferToLoop(benchmark::State& state) {
+  OnDemandDeferredExecutor loop;
+  uint64_t counter = 0;
+
+  for (auto _ : state) {
+    loop.deferToLoop([&counter]() { ++counter; });
+  }
+  benchmark::DoNotOptimize(counter);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_OnDemandDeferToLoop);
+
+// Time from deferring a function from another thread until it has run on the
+// loop's thread, which includes waking up that thread.
+void BM_EventLoopDeferToLoopLatency(benchmark::State& state) {
+  CondVarLoop loop;
+  std::atomic<uint64_t> counter{0};
+
+  uint64_t expected = 0;
+  for (auto _ : state) {
+    loop.deferToLoop([&counter]() {
+      counter.fetch_add(1, std::memory_order_release);
+    });
+    ++expected;
+    while (counter.load(std::memory_order_acquire) != expected) {
+    }
+  }
+  loop.join();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EventLoopDeferToLoopLatency)->UseRealTime();
+
+// Rate at which functions can be deferred in bulk, when the loop is woken up
+// once for many functions.
+void BM_EventLoopDeferToLoopThroughput(benchmark::State& state) {
+  const int64_t batchSize = state.range(0);
+  CondVarLoop loop;
+  std::atomic<uint64_t> counter{0};
+
+  uint64_t expected = 0;
+  for (auto _ : state) {
+    for (int64_t idx = 0; idx < batchSize; ++idx) {
+      loop.deferToLoop([&counter]() {
+        counter.fetch_add(1, std::memory_order_release);
+      });
+    }
+    expected += batchSize;
+    while (counter.load(std::memory_order_acquire) != expected) {
+    }
+  }
+  loop.join();
+  state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(BM_EventLoopDeferToLoopThroughput)
+    ->RangeMultiplier(8)
+    ->Range(8, 4096)
+    ->UseRealTime();
+
+// Same as above, with the functions held in the thread's batch, and thus
+// handed over with one wakeup per kMaxDeferredBatchSize of them.
+void BM_EventLoopDeferToLoopBatched(benchmark::State& state) {
+  const int64_t batchSize = state.range(0);
+  CondVarLoop loop;
+  std::atomic<uint64_t> counter{0};
+
+  uint64_t expected = 0;
+  for (auto _ : state) {
+    beginDeferredBatch();
+    for (int64_t idx = 0; idx < batchSize; ++idx) {
+      loop.deferToLoop([&counter]() {
+        counter.fetch_add(1, std::memory_order_release);
+      });
+    }
+    endDeferredBatch();
+    expected += batchSize;
+    while (counter.load(std::memory_order_acquire) != expected) {
+    }
+  }
+  loop.join();
+  state.SetItemsProcessed(state.iterations() * batchSize);
+}
+BENCHMARK(BM_EventLoopDeferToLoopBatched)
+    ->RangeMultiplier(8)
+    ->Range(8, 4096)
+    ->UseRealTime();
+
+} // namespace
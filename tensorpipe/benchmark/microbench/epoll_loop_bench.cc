@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+
+#include <benchmark/benchmark.h>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/fd.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// Drains the eventfd it is registered for and counts how often it was called.
+class CountingHandler final : public EpollLoop::EventHandler {
+ public:
+  explicit CountingHandler(int fd) : fd_(fd) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    uint64_t value;
+    auto rv = ::read(fd_, &value, sizeof(value));
+    (void)rv;
+    counter.fetch_add(1, std::memory_order_release);
+  }
+
+  std::atomic<uint64_t> counter{0};
+
+ private:
+  const int fd_;
+};
+
+// Time from making a descriptor readable until its handler has been called by
+// the epoll loop, which includes the loop's thread waking up from epoll_wait
+// and the deferral of the handler to the loop.
+void BM_EpollLoopDispatchLatency(benchmark::State& state) {
+  OnDemandDeferredExecutor deferredExecutor;
+  EpollLoop epollLoop(deferredExecutor);
+  Fd eventFd(::eventfd(0, EFD_NONBLOCK));
+  auto handler = std::make_shared<CountingHandler>(eventFd.fd());
+  deferredExecutor.runInLoop([&]() {
+    epollLoop.registerDescriptor(eventFd.fd(), EPOLLIN, handler);
+  });
+
+  uint64_t expected = 0;
+  for (auto _ : state) {
+    uint64_t one = 1;
+    auto rv = ::write(eventFd.fd(), &one, sizeof(one));
+    benchmark::DoNotOptimize(rv);
+    ++expected;
+    while (handler->counter.load(std::memory_order_acquire) != expected) {
+    }
+  }
+
+  deferredExecutor.runInLoop(
+      [&]() { epollLoop.unregisterDescriptor(eventFd.fd()); });
+  epollLoop.join();
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EpollLoopDispatchLatency)->UseRealTime();
+
+} // namespace
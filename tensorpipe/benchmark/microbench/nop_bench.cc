@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/core/nop_types.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A descriptor resembling those of a typical RPC message: one payload holding
+// the pickled arguments, followed by the given number of CPU tensors that are
+// sent over the basic channel.
+void fillMessageDescriptor(MessageDescriptor& desc, size_t numTensors) {
+  desc.metadata = std::string(16, 'm');
+  desc.payloadDescriptors.resize(1);
+  desc.payloadDescriptors[0].sizeInBytes = 256;
+  desc.payloadDescriptors[0].metadata = std::string(16, 'p');
+  desc.tensorDescriptors.resize(numTensors);
+  for (auto& tensorDesc : desc.tensorDescriptors) {
+    tensorDesc.sizeInBytes = 1 << 20;
+    tensorDesc.metadata = std::string(32, 't');
+    tensorDesc.deviceType = DeviceType::kCpu;
+    tensorDesc.isInline = false;
+    tensorDesc.channelName = "basic";
+    tensorDesc.channelDescriptor = std::string(8, 'c');
+  }
+}
+
+void BM_NopWriteMessageDescriptor(benchmark::State& state) {
+  NopHolder<MessageDescriptor> holder;
+  fillMessageDescriptor(holder.getObject(), state.range(0));
+  std::vector<uint8_t> buffer(holder.getSize());
+
+  for (auto _ : state) {
+    size_t size = holder.getSize();
+    NopWriter writer(buffer.data(), size);
+    nop::Status<void> status = holder.write(writer);
+    benchmark::DoNotOptimize(status);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_NopWriteMessageDescriptor)->RangeMultiplier(4)->Range(0, 256);
+
+void BM_NopReadMessageDescriptor(benchmark::State& state) {
+  NopHolder<MessageDescriptor> source;
+  fillMessageDescriptor(source.getObject(), state.range(0));
+  std::vector<uint8_t> buffer(source.getSize());
+  NopWriter writer(buffer.data(), buffer.size());
+  if (source.write(writer).has_error()) {
+    state.SkipWithError("Failed to serialize the descriptor");
+    return;
+  }
+
+  for (auto _ : state) {
+    NopHolder<MessageDescriptor> holder;
+    NopReader reader(buffer.data(), buffer.size());
+    nop::Status<void> status = holder.read(reader);
+    benchmark::DoNotOptimize(status);
+    benchmark::DoNotOptimize(holder.getObject());
+  }
+  state.SetBytesProcessed(state.iterations() * buffer.size());
+}
+BENCHMARK(BM_NopReadMessageDescriptor)->RangeMultiplier(4)->Range(0, 256);
+
+} // namespace
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <sys/mman.h>
+
+#include <memory>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+#include <tensorpipe/util/ringbuffer/record_ring.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+using namespace tensorpipe::util::ringbuffer;
+
+namespace {
+
+// Holds and owns the memory for the ringbuffer's header and data.
+class RingBufferStorage {
+ public:
+  explicit RingBufferStorage(size_t size) : header_(size) {}
+
+  RingBuffer getRb() {
+    return {&header_, data_.get()};
+  }
+
+ private:
+  RingBufferHeader header_;
+  std::unique_ptr<uint8_t[]> data_ =
+      std::make_unique<uint8_t[]>(header_.kDataPoolByteSize);
+};
+
+constexpr size_t kRingBufferSize = 1 << 22;
+
+// Copy a message in and out of a ringbuffer much larger than the message, so
+// that writes only rarely straddle the end of the data pool.
+void BM_RingBufferWriteRead(benchmark::State& state) {
+  const size_t size = state.range(0);
+  RingBufferStorage storage(kRingBufferSize);
+  RingBuffer rb = storage.getRb();
+  Producer p{rb};
+  Consumer c{rb};
+  std::vector<uint8_t> in(size, 0x42);
+  std::vector<uint8_t> out(size);
+
+  for (auto _ : state) {
+    ssize_t ret = p.write(in.data(), size);
+    benchmark::DoNotOptimize(ret);
+    ret = c.read(out.data(), size);
+    benchmark::DoNotOptimize(ret);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_RingBufferWriteRead)->RangeMultiplier(8)->Range(8, 1 << 20);
+
+// Same as above, but with a ringbuffer as large as the message and with the
+// heads offset by half of it, so that every write and read wraps around.
+void BM_RingBufferWriteReadWrapAround(benchmark::State& state) {
+  const size_t size = state.range(0);
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  Producer p{rb};
+  Consumer c{rb};
+  std::vector<uint8_t> in(size, 0x42);
+  std::vector<uint8_t> out(size);
+
+  if (p.write(in.data(), size / 2) < 0 || c.read(out.data(), size / 2) < 0) {
+    state.SkipWithError("Failed to offset the ringbuffer");
+    return;
+  }
+
+  for (auto _ : state) {
+    ssize_t ret = p.write(in.data(), size);
+    benchmark::DoNotOptimize(ret);
+    ret = c.read(out.data(), size);
+    benchmark::DoNotOptimize(ret);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+BENCHMARK(BM_RingBufferWriteReadWrapAround)
+    ->RangeMultiplier(8)
+    ->Range(8, 1 << 20);
+
+// Produce and consume in place, without copying, to isolate the cost of the
+// transactions and of the head and tail updates.
+void BM_RingBufferReserveCommit(benchmark::State& state) {
+  const size_t size = state.range(0);
+  RingBufferStorage storage(kRingBufferSize);
+  RingBuffer rb = storage.getRb();
+  Producer p{rb};
+  Consumer c{rb};
+
+  for (auto _ : state) {
+    auto reservation = p.reserve(size);
+    benchmark::DoNotOptimize(reservation);
+    ssize_t ret = p.commit();
+    benchmark::DoNotOptimize(ret);
+    auto access = c.peek(size);
+    benchmark::DoNotOptimize(access);
+    ret = c.release();
+    benchmark::DoNotOptimize(ret);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RingBufferReserveCommit)->RangeMultiplier(8)->Range(8, 1 << 20);
+
+// Write a burst of small records and read them back in batches of the given
+// size, to show how much consuming many records per read transaction saves.
+void BM_RecordRingConsumeBatch(benchmark::State& state) {
+  const size_t batchSize = state.range(0);
+  constexpr size_t kNumRecords = 256;
+  constexpr size_t kRecordSize = 32;
+  RingBufferStorage storage(kNumRecords * 64);
+  RingBuffer rb = storage.getRb();
+  RecordWriter w{rb};
+  RecordReader r{rb};
+  std::vector<uint8_t> in(kRecordSize, 0x42);
+  size_t numBytes = 0;
+
+  for (auto _ : state) {
+    for (size_t recordIdx = 0; recordIdx < kNumRecords; recordIdx++) {
+      ssize_t ret = w.write(in.data(), in.size());
+      benchmark::DoNotOptimize(ret);
+    }
+    size_t numRead = 0;
+    while (numRead < kNumRecords) {
+      ssize_t ret = r.consumeBatch(
+          [&](RecordReader::RecordId, const uint8_t* ptr, size_t length) {
+            numBytes += length;
+            benchmark::DoNotOptimize(ptr);
+            return true;
+          },
+          batchSize);
+      numRead += ret;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kNumRecords);
+  benchmark::DoNotOptimize(numBytes);
+}
+BENCHMARK(BM_RecordRingConsumeBatch)->RangeMultiplier(4)->Range(1, 256);
+
+// Stream large messages through a ringbuffer larger than 4GB, as used to stage
+// very large tensors. The data is mapped lazily, hence only the pages that the
+// messages went through are backed, which is all of them for long runs.
+void BM_RingBufferLargeRing(benchmark::State& state) {
+  const size_t size = state.range(0);
+  constexpr size_t kLargeRingBufferSize = 1ull << 33;
+  void* ptr = ::mmap(
+      nullptr,
+      kLargeRingBufferSize,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0);
+  if (ptr == MAP_FAILED) {
+    state.SkipWithError("Failed to map the ringbuffer");
+    return;
+  }
+  RingBufferHeader header(kLargeRingBufferSize);
+  RingBuffer rb(&header, reinterpret_cast<uint8_t*>(ptr));
+  Producer p{rb};
+  Consumer c{rb};
+  std::vector<uint8_t> in(size, 0x42);
+  std::vector<uint8_t> out(size);
+
+  for (auto _ : state) {
+    ssize_t ret = p.write(in.data(), size);
+    benchmark::DoNotOptimize(ret);
+    ret = c.read(out.data(), size);
+    benchmark::DoNotOptimize(ret);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+  ::munmap(ptr, kLargeRingBufferSize);
+}
+BENCHMARK(BM_RingBufferLargeRing)->RangeMultiplier(8)->Range(1 << 20, 1 << 29);
+
+} // namespace
@@ -19,6 +19,161 @@
 namespace tensorpipe {
 namespace benchmark {
 
+bool Tunables::parse(const std::string& keyValue) {
+  size_t pos = keyValue.find('=');
+  if (pos == std::string::npos || pos == 0) {
+    return false;
+  }
+  values_[keyValue.substr(0, pos)] = keyValue.substr(pos + 1);
+  return true;
+}
+
+const std::string* Tunables::find_(const std::string& key) const {
+  used_.insert(key);
+  auto iter = values_.find(key);
+  return iter != values_.end() ? &iter->second : nullptr;
+}
+
+static void invalidTunable(const std::string& key, const std::string& value) {
+  fprintf(
+      stderr, "Invalid value for option %s: %s\n", key.c_str(), value.c_str());
+  exit(EXIT_FAILURE);
+}
+
+std::string Tunables::getString(
+    const std::string& key,
+    std::string defaultValue) const {
+  const std::string* value = find_(key);
+  return value != nullptr ? *value : defaultValue;
+}
+
+int64_t Tunables::getInt(const std::string& key, int64_t defaultValue) const {
+  const std::string* value = find_(key);
+  if (value == nullptr) {
+    return defaultValue;
+  }
+  char* end;
+  int64_t result = strtoll(value->c_str(), &end, /*base=*/0);
+  if (value->empty() || *end != '\0') {
+    invalidTunable(key, *value);
+  }
+  return result;
+}
+
+size_t Tunables::getSize(const std::string& key, size_t defaultValue) const {
+  const std::string* value = find_(key);
+  if (value == nullptr) {
+    return defaultValue;
+  }
+  char* end;
+  unsigned long long result = strtoull(value->c_str(), &end, /*base=*/0);
+  if (value->empty() || (*value)[0] == '-') {
+    invalidTunable(key, *value);
+  }
+  switch (*end) {
+    case 'G':
+      result *= 1024;
+      // fall through
+    case 'M':
+      result *= 1024;
+      // fall through
+    case 'K':
+      result *= 1024;
+      end++;
+      break;
+  }
+  if (*end != '\0') {
+    invalidTunable(key, *value);
+  }
+  return result;
+}
+
+double Tunables::getDouble(const std::string& key, double defaultValue)
+    const {
+  const std::string* value = find_(key);
+  if (value == nullptr) {
+    return defaultValue;
+  }
+  char* end;
+  double result = strtod(value->c_str(), &end);
+  if (value->empty() || *end != '\0') {
+    invalidTunable(key, *value);
+  }
+  return result;
+}
+
+bool Tunables::getBool(const std::string& key, bool defaultValue) const {
+  const std::string* value = find_(key);
+  if (value == nullptr) {
+    return defaultValue;
+  }
+  if (*value == "true" || *value == "1") {
+    return true;
+  }
+  if (*value == "false" || *value == "0") {
+    return false;
+  }
+  invalidTunable(key, *value);
+  return false;
+}
+
+void Tunables::checkAllUsed(const std::string& name) const {
+  bool ok = true;
+  for (const auto& iter : values_) {
+    if (used_.count(iter.first) == 0) {
+      fprintf(
+          stderr,
+          "Unknown option for %s: %s\n",
+          name.c_str(),
+          iter.first.c_str());
+      ok = false;
+    }
+  }
+  if (!ok) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+std::string Tunables::str() const {
+  std::string result;
+  for (const auto& iter : values_) {
+    if (!result.empty()) {
+      result += ",";
+    }
+    result += iter.first + "=" + iter.second;
+  }
+  return result;
+}
+
+BusyPollingPolicy getBusyPollingPolicy(
+    const Tunables& tunables,
+    BusyPollingPolicy policy) {
+  std::string base = tunables.getString("busy_polling", "default");
+  if (base == "adaptive") {
+    policy = BusyPollingPolicy::adaptive();
+  } else if (base != "default") {
+    invalidTunable("busy_polling", base);
+  }
+  policy.spinFor = std::chrono::microseconds(
+      tunables.getInt("spin_for_us", policy.spinFor.count()));
+  policy.yieldFor = std::chrono::microseconds(
+      tunables.getInt("yield_for_us", policy.yieldFor.count()));
+  policy.sleepFor = std::chrono::microseconds(
+      tunables.getInt("sleep_for_us", policy.sleepFor.count()));
+  return policy;
+}
+
+IbvDeviceOptions getIbvDeviceOptions(const Tunables& tunables) {
+  IbvDeviceOptions options;
+  options.deviceName = tunables.getString("device", options.deviceName);
+  options.numaNode = tunables.getInt("numa_node", options.numaNode);
+  options.portNum = tunables.getInt("port", options.portNum);
+  options.globalIdentifierIndex =
+      tunables.getInt("gid_index", options.globalIdentifierIndex);
+  options.onDemandPaging = tunables.getBool("odp", options.onDemandPaging);
+  return options;
+}
+
 void validateTransportContext(std::shared_ptr<transport::Context> context) {
   if (!context) {
     auto keys = TensorpipeTransportRegistry().keys();
@@ -64,6 +219,50 @@ static void usage(int status, const char* argv0) {
   X("--num-tensors=NUM [optional]    Number of tensors of each write/read pair");
   X("--tensor-size=SIZE [optional]   Size of tensor of each write/read pair");
   X("--metadata-size=SIZE [optional] Size of metadata of each write/read pair");
+  X("--num-pipes=NUM [optional]      Number of concurrent pipes");
+  X("--num-client-threads=NUM [optional]");
+  X("                                Number of client threads, each with its");
+  X("                                own context, among which pipes are split");
+  X("--window=NUM [optional]         Number of outstanding writes per pipe");
+  X("--pattern=PATTERN [optional]    Traffic pattern [ping-pong|stream]");
+  X("--max-tensor-size=SIZE [optional]");
+  X("                                Sweep tensor sizes, doubling them from");
+  X("                                --tensor-size up to this one");
+  X("--cuda-device=IDX [optional]    Use CUDA memory on this device");
+  X("--cuda-channel=CHANNEL [optional]");
+  X("                                CUDA channel backend");
+  X("                                [cuda_basic|cuda_ipc|cuda_gdr]");
+  X("--cuda-sync [optional]          Synchronize the stream after each read");
+  X("--output=FORMAT [optional]      Print results on stdout too, in the");
+  X("                                given format [text|json|csv]");
+  X("--perf-counters [optional]      Also count cycles, instructions and");
+  X("                                last-level cache misses");
+  X("--lazy-channel-establishment [optional]");
+  X("                                Connect channels on their first tensor");
+  X("--speculative-channel-connections [optional]");
+  X("                                Connect all channels with the brochure");
+  X("--traffic-trace=PATH [optional] Traffic recorded by a context to replay");
+  X("--replay-speed=FACTOR [optional]");
+  X("                                Speed up the replay by this factor, or");
+  X("                                replay without any delays if zero");
+  X("--rate=MSGS [optional]          Write this many messages per second on");
+  X("                                each pipe regardless of the replies (an");
+  X("                                open loop), and measure the latency from");
+  X("                                when each was meant to be written");
+  X("--max-rate=MSGS [optional]      Sweep rates, doubling them from --rate");
+  X("                                up to this one");
+  X("--arrivals=ARRIVALS [optional]  Spacing of the writes in open loop");
+  X("                                [constant|poisson]");
+  X("--transport-opt=KEY=VALUE [optional]");
+  X("                                Pass a setting to the transport's");
+  X("                                constructor (repeatable)");
+  X("--channel-opt=KEY=VALUE [optional]");
+  X("                                Pass a setting to the channel's");
+  X("                                constructor (repeatable)");
+  X("--duration=SECONDS [optional]   Run for this long, instead of for");
+  X("                                --num-round-trips (soak only)");
+  X("--slo=KEY=VALUE [optional]      Fail if the results don't meet this");
+  X("                                limit (soak only, repeatable)");
 
   exit(status);
 }
@@ -82,8 +281,58 @@ static void validateOptions(Options options, const char* argv0) {
     fprintf(stderr, "Missing argument: --address must be set\n");
     status = EXIT_FAILURE;
   }
-  if (options.numRoundTrips <= 0) {
-    fprintf(stderr, "Missing argument: --num-round-trips must be set\n");
+  if (options.numRoundTrips <= 0 && options.duration <= 0) {
+    fprintf(
+        stderr,
+        "Missing argument: --num-round-trips or --duration must be set\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numPipes <= 0) {
+    fprintf(stderr, "Invalid argument: --num-pipes must be positive\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.numClientThreads <= 0 ||
+      options.numClientThreads > options.numPipes) {
+    fprintf(
+        stderr,
+        "Invalid argument: --num-client-threads must be between 1 and "
+        "--num-pipes\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.replaySpeed < 0) {
+    fprintf(stderr, "Invalid argument: --replay-speed must not be negative\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.window <= 0) {
+    fprintf(stderr, "Invalid argument: --window must be positive\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.rate < 0) {
+    fprintf(stderr, "Invalid argument: --rate must not be negative\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.rate > 0 && options.pattern != "ping-pong") {
+    fprintf(
+        stderr,
+        "Invalid argument: --rate needs the ping-pong pattern, as the latency "
+        "is measured on the replies\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.maxRate != 0 &&
+      (options.rate == 0 || options.maxRate < options.rate)) {
+    fprintf(
+        stderr,
+        "Invalid argument: --max-rate must be at least --rate, which must be "
+        "set\n");
+    status = EXIT_FAILURE;
+  }
+  if (options.maxTensorSize != 0 &&
+      (options.tensorSize == 0 ||
+       options.maxTensorSize < options.tensorSize)) {
+    fprintf(
+        stderr,
+        "Invalid argument: --max-tensor-size must be at least --tensor-size, "
+        "which must be set\n");
     status = EXIT_FAILURE;
   }
   if (status != EXIT_SUCCESS) {
@@ -107,6 +356,27 @@ struct Options parseOptions(int argc, char** argv) {
     NUM_TENSORS,
     TENSOR_SIZE,
     METADATA_SIZE,
+    NUM_PIPES,
+    NUM_CLIENT_THREADS,
+    WINDOW,
+    PATTERN,
+    MAX_TENSOR_SIZE,
+    CUDA_DEVICE,
+    CUDA_CHANNEL,
+    CUDA_SYNC,
+    OUTPUT,
+    PERF_COUNTERS,
+    LAZY_CHANNEL_ESTABLISHMENT,
+    SPECULATIVE_CHANNEL_CONNECTIONS,
+    TRAFFIC_TRACE,
+    REPLAY_SPEED,
+    RATE,
+    MAX_RATE,
+    ARRIVALS,
+    TRANSPORT_OPT,
+    CHANNEL_OPT,
+    DURATION,
+    SLO,
     HELP,
   };
 
@@ -121,6 +391,33 @@ struct Options parseOptions(int argc, char** argv) {
       {"num-tensors", required_argument, &flag, NUM_TENSORS},
       {"tensor-size", required_argument, &flag, TENSOR_SIZE},
       {"metadata-size", required_argument, &flag, METADATA_SIZE},
+      {"num-pipes", required_argument, &flag, NUM_PIPES},
+      {"num-client-threads", required_argument, &flag, NUM_CLIENT_THREADS},
+      {"window", required_argument, &flag, WINDOW},
+      {"pattern", required_argument, &flag, PATTERN},
+      {"max-tensor-size", required_argument, &flag, MAX_TENSOR_SIZE},
+      {"cuda-device", required_argument, &flag, CUDA_DEVICE},
+      {"cuda-channel", required_argument, &flag, CUDA_CHANNEL},
+      {"cuda-sync", no_argument, &flag, CUDA_SYNC},
+      {"output", required_argument, &flag, OUTPUT},
+      {"perf-counters", no_argument, &flag, PERF_COUNTERS},
+      {"lazy-channel-establishment",
+       no_argument,
+       &flag,
+       LAZY_CHANNEL_ESTABLISHMENT},
+      {"speculative-channel-connections",
+       no_argument,
+       &flag,
+       SPECULATIVE_CHANNEL_CONNECTIONS},
+      {"traffic-trace", required_argument, &flag, TRAFFIC_TRACE},
+      {"replay-speed", required_argument, &flag, REPLAY_SPEED},
+      {"rate", required_argument, &flag, RATE},
+      {"max-rate", required_argument, &flag, MAX_RATE},
+      {"arrivals", required_argument, &flag, ARRIVALS},
+      {"transport-opt", required_argument, &flag, TRANSPORT_OPT},
+      {"channel-opt", required_argument, &flag, CHANNEL_OPT},
+      {"duration", required_argument, &flag, DURATION},
+      {"slo", required_argument, &flag, SLO},
       {"help", no_argument, &flag, HELP},
       {nullptr, 0, nullptr, 0}};
 
@@ -169,6 +466,97 @@ struct Options parseOptions(int argc, char** argv) {
       case METADATA_SIZE:
         options.metadataSize = atoi(optarg);
         break;
+      case NUM_PIPES:
+        options.numPipes = atoi(optarg);
+        break;
+      case NUM_CLIENT_THREADS:
+        options.numClientThreads = atoi(optarg);
+        break;
+      case WINDOW:
+        options.window = atoi(optarg);
+        break;
+      case PATTERN:
+        options.pattern = std::string(optarg, strlen(optarg));
+        if (options.pattern != "ping-pong" && options.pattern != "stream") {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --pattern must be [ping-pong|stream]\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case MAX_TENSOR_SIZE:
+        options.maxTensorSize = atoi(optarg);
+        break;
+      case CUDA_DEVICE:
+        options.cudaDevice = atoi(optarg);
+        break;
+      case CUDA_CHANNEL:
+        options.cudaChannel = std::string(optarg, strlen(optarg));
+        break;
+      case CUDA_SYNC:
+        options.cudaSync = true;
+        break;
+      case OUTPUT:
+        options.output = std::string(optarg, strlen(optarg));
+        if (options.output != "text" && options.output != "json" &&
+            options.output != "csv") {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --output must be [text|json|csv]\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case PERF_COUNTERS:
+        options.perfCounters = true;
+        break;
+      case LAZY_CHANNEL_ESTABLISHMENT:
+        options.lazyChannelEstablishment = true;
+        break;
+      case SPECULATIVE_CHANNEL_CONNECTIONS:
+        options.speculativeChannelConnections = true;
+        break;
+      case TRAFFIC_TRACE:
+        options.trafficTrace = std::string(optarg, strlen(optarg));
+        break;
+      case REPLAY_SPEED:
+        options.replaySpeed = atof(optarg);
+        break;
+      case RATE:
+        options.rate = atof(optarg);
+        break;
+      case MAX_RATE:
+        options.maxRate = atof(optarg);
+        break;
+      case ARRIVALS:
+        options.arrivals = std::string(optarg, strlen(optarg));
+        if (options.arrivals != "constant" && options.arrivals != "poisson") {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --arrivals must be [constant|poisson]\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case TRANSPORT_OPT:
+        if (!options.transportTunables.parse(optarg)) {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --transport-opt must be KEY=VALUE\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case CHANNEL_OPT:
+        if (!options.channelTunables.parse(optarg)) {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --channel-opt must be KEY=VALUE\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case DURATION:
+        options.duration = atof(optarg);
+        break;
+      case SLO:
+        if (!options.slos.parse(optarg)) {
+          fprintf(stderr, "Error:\n");
+          fprintf(stderr, "  --slo must be KEY=VALUE\n");
+          exit(EXIT_FAILURE);
+        }
+        break;
       case HELP:
         usage(EXIT_SUCCESS, argv[0]);
         break;
@@ -8,14 +8,58 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
+#include <set>
 #include <string>
 
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/ibv_device_options.h>
 #include <tensorpipe/transport/context.h>
 
 namespace tensorpipe {
 namespace benchmark {
 
+// The settings of the transport or of the channel, given as key=value pairs
+// with --transport-opt and --channel-opt, which the creators of the registries
+// look up to configure the contexts they build. The getters return the default
+// if the key wasn't given, and exit with an error if its value is malformed.
+// Once done, the creators check that no other key was given, so that typos
+// don't go unnoticed.
+class Tunables {
+ public:
+  // Parse a "key=value" pair, overriding any earlier value for that key.
+  // Return false if it's malformed.
+  bool parse(const std::string& keyValue);
+
+  std::string getString(const std::string& key, std::string defaultValue)
+      const;
+
+  int64_t getInt(const std::string& key, int64_t defaultValue) const;
+
+  // Also accepts a K, M or G suffix, for powers of 1024.
+  size_t getSize(const std::string& key, size_t defaultValue) const;
+
+  double getDouble(const std::string& key, double defaultValue) const;
+
+  // Accepts true, false, 1 and 0.
+  bool getBool(const std::string& key, bool defaultValue) const;
+
+  // Exit with an error if any key wasn't looked up by one of the getters. The
+  // name of the transport or channel is used in the message.
+  void checkAllUsed(const std::string& name) const;
+
+  // All the pairs, comma-separated, for the reports.
+  std::string str() const;
+
+ private:
+  std::map<std::string, std::string> values_;
+  mutable std::set<std::string> used_;
+
+  const std::string* find_(const std::string& key) const;
+};
+
 struct Options {
   std::string mode; // server or client
   std::string transport; // shm or uv
@@ -27,10 +71,40 @@ struct Options {
   size_t numTensors{0};
   size_t tensorSize{0};
   size_t metadataSize{0};
+  int numPipes{1};
+  int numClientThreads{1}; // each with its own context
+  int window{1}; // max number of outstanding writes per pipe
+  std::string pattern{"ping-pong"}; // ping-pong or stream
+  size_t maxTensorSize{0}; // sweep sizes by doubling up to this, if set
+  int cudaDevice{-1}; // use CUDA memory on this device, if set
+  std::string cudaChannel; // cuda_basic, cuda_ipc or cuda_gdr
+  bool cudaSync{false}; // synchronize the stream after each read
+  std::string output{"text"}; // text, json or csv
+  bool perfCounters{false}; // also count cycles, instructions and LLC misses
+  bool lazyChannelEstablishment{false};
+  bool speculativeChannelConnections{false};
+  std::string trafficTrace; // recorded by a context, to be replayed
+  double replaySpeed{1.0}; // relative to the recording, or zero for no delays
+  double rate{0}; // messages per second per pipe, if set, in open loop
+  double maxRate{0}; // sweep rates by doubling up to this, if set
+  std::string arrivals{"constant"}; // constant or poisson
+  double duration{0}; // seconds to run for, instead of a number of round trips
+  Tunables transportTunables; // passed to the transport's constructor
+  Tunables channelTunables; // passed to the (CPU) channel's constructor
+  Tunables slos; // the limits that the results must meet (soak only)
 };
 
 struct Options parseOptions(int argc, char** argv);
 
+// The settings shared by several transports and channels. The policy starts
+// from the given one or, with busy_polling=adaptive, from the adaptive one, and
+// spin_for_us, yield_for_us and sleep_for_us override its durations. The
+// device is picked with device, numa_node, port, gid_index and odp.
+BusyPollingPolicy getBusyPollingPolicy(
+    const Tunables& tunables,
+    BusyPollingPolicy policy = BusyPollingPolicy());
+IbvDeviceOptions getIbvDeviceOptions(const Tunables& tunables);
+
 void validateTransportContext(std::shared_ptr<transport::Context> context);
 void validateChannelContext(std::shared_ptr<channel::CpuContext> context);
 
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/benchmark/report.h>
+
+#include <dirent.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace benchmark {
+
+namespace {
+
+std::string readCpuModel() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      auto pos = line.find(':');
+      if (pos != std::string::npos) {
+        return line.substr(line.find_first_not_of(' ', pos + 1));
+      }
+    }
+  }
+  return "unknown";
+}
+
+std::string listDirectory(const std::string& path, const std::string& prefix) {
+  std::string names;
+  DIR* dir = ::opendir(path.c_str());
+  if (dir == nullptr) {
+    return names;
+  }
+  while (struct dirent* entry = ::readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == ".." || name == "lo") {
+      continue;
+    }
+    if (!names.empty()) {
+      names += " ";
+    }
+    names += prefix + name;
+  }
+  ::closedir(dir);
+  return names;
+}
+
+std::string escapeJson(const std::string& value) {
+  std::ostringstream oss;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      oss << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << static_cast<int>(c);
+    } else {
+      oss << c;
+    }
+  }
+  return oss.str();
+}
+
+std::string escapeCsv(const std::string& value) {
+  if (value.find_first_of(",\"\n") == std::string::npos) {
+    return value;
+  }
+  std::string escaped = "\"";
+  for (char c : value) {
+    if (c == '"') {
+      escaped += '"';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+} // namespace
+
+void Report::addHostInfo() {
+  add("host", "cpu", readCpuModel());
+  add("host", "num_cpus", static_cast<double>(::sysconf(_SC_NPROCESSORS_ONLN)));
+  struct utsname name;
+  if (::uname(&name) == 0) {
+    add("host", "kernel", std::string(name.sysname) + " " + name.release);
+    add("host", "hostname", name.nodename);
+  }
+  std::string nics = listDirectory("/sys/class/net", "");
+  std::string ibvDevices = listDirectory("/sys/class/infiniband", "ibv:");
+  if (!nics.empty() && !ibvDevices.empty()) {
+    nics += " ";
+  }
+  add("host", "nics", nics + ibvDevices);
+}
+
+void Report::addOptions(const Options& options) {
+  add("config", "mode", options.mode);
+  add("config", "transport", options.transport);
+  add("config", "channel", options.channel);
+  add("config", "num_round_trips", options.numRoundTrips);
+  add("config", "num_payloads", options.numPayloads);
+  add("config", "payload_size", options.payloadSize);
+  add("config", "num_tensors", options.numTensors);
+  add("config", "tensor_size", options.tensorSize);
+  add("config", "metadata_size", options.metadataSize);
+  add("config", "num_pipes", options.numPipes);
+  add("config", "num_client_threads", options.numClientThreads);
+  add("config", "window", options.window);
+  add("config", "pattern", options.pattern);
+  add("config", "max_tensor_size", options.maxTensorSize);
+  add("config", "cuda_device", options.cudaDevice);
+  add("config", "cuda_channel", options.cudaChannel);
+  add("config", "cuda_sync", options.cudaSync);
+  add("config", "perf_counters", options.perfCounters);
+  add("config",
+      "lazy_channel_establishment",
+      options.lazyChannelEstablishment);
+  add("config",
+      "speculative_channel_connections",
+      options.speculativeChannelConnections);
+  add("config", "traffic_trace", options.trafficTrace);
+  add("config", "replay_speed", options.replaySpeed);
+  add("config", "rate", options.rate);
+  add("config", "max_rate", options.maxRate);
+  add("config", "arrivals", options.arrivals);
+  add("config", "transport_opts", options.transportTunables.str());
+  add("config", "channel_opts", options.channelTunables.str());
+  add("config", "duration", options.duration);
+  add("config", "slos", options.slos.str());
+}
+
+void Report::add(
+    const std::string& section,
+    const std::string& key,
+    std::string value) {
+  entries_.push_back(Entry{section, key, std::move(value), /*isNumber=*/false});
+}
+
+void Report::add(
+    const std::string& section,
+    const std::string& key,
+    double value) {
+  std::ostringstream oss;
+  oss << std::setprecision(10) << value;
+  entries_.push_back(Entry{section, key, oss.str(), /*isNumber=*/true});
+}
+
+void Report::add(const std::string& section, Measurements& measurements) {
+  measurements.sort();
+  add(section, "count", static_cast<double>(measurements.size()));
+  add(section, "mean_us", measurements.mean() / 1000.0);
+  add(section, "stddev_us", measurements.stddev() / 1000.0);
+  add(section, "min_us", measurements.min().count() / 1000.0);
+  for (const auto& p : std::vector<std::pair<const char*, float>>{
+           {"p50_us", 0.50},
+           {"p75_us", 0.75},
+           {"p90_us", 0.90},
+           {"p95_us", 0.95},
+           {"p99_us", 0.99},
+           {"p999_us", 0.999}}) {
+    add(section, p.first, measurements.percentile(p.second).count() / 1000.0);
+  }
+  add(section, "max_us", measurements.max().count() / 1000.0);
+}
+
+void Report::add(
+    const std::string& section,
+    const CpuUsage& usage,
+    size_t numBytes) {
+  double cpuSeconds = usage.userSeconds() + usage.systemSeconds();
+  add(section, "wall_sec", usage.wallSeconds());
+  add(section, "user_sec", usage.userSeconds());
+  add(section, "system_sec", usage.systemSeconds());
+  add(section, "total_sec", cpuSeconds);
+  add(section, "cores", cpuSeconds / usage.wallSeconds());
+  add(section, "ns_per_byte", cpuSeconds * 1e9 / numBytes);
+  if (usage.hasPerfCounters()) {
+    add(section, "perf_user_only", usage.perfCountersUserOnly());
+    add(section, "cycles", static_cast<double>(usage.cycles()));
+    add(section, "instructions", static_cast<double>(usage.instructions()));
+    add(section, "llc_misses", static_cast<double>(usage.llcMisses()));
+    add(section,
+        "cycles_per_byte",
+        static_cast<double>(usage.cycles()) / numBytes);
+    add(section,
+        "instructions_per_byte",
+        static_cast<double>(usage.instructions()) / numBytes);
+  }
+  for (const auto& it : usage.threadSeconds()) {
+    add(section + "_threads", it.first, it.second);
+  }
+}
+
+void Report::printJson(FILE* file) const {
+  // Sections are printed in the order in which they first appeared.
+  std::vector<std::string> sections;
+  for (const Entry& entry : entries_) {
+    if (std::find(sections.begin(), sections.end(), entry.section) ==
+        sections.end()) {
+      sections.push_back(entry.section);
+    }
+  }
+  fprintf(file, "{");
+  for (size_t sectionIdx = 0; sectionIdx < sections.size(); sectionIdx++) {
+    fprintf(
+        file,
+        "%s\n  \"%s\": {",
+        sectionIdx > 0 ? "," : "",
+        escapeJson(sections[sectionIdx]).c_str());
+    bool first = true;
+    for (const Entry& entry : entries_) {
+      if (entry.section != sections[sectionIdx]) {
+        continue;
+      }
+      const char* quote = entry.isNumber ? "" : "\"";
+      fprintf(
+          file,
+          "%s\n    \"%s\": %s%s%s",
+          first ? "" : ",",
+          escapeJson(entry.key).c_str(),
+          quote,
+          entry.isNumber ? entry.value.c_str()
+                         : escapeJson(entry.value).c_str(),
+          quote);
+      first = false;
+    }
+    fprintf(file, "\n  }");
+  }
+  fprintf(file, "\n}\n");
+}
+
+void Report::printCsv(FILE* file) const {
+  for (size_t idx = 0; idx < entries_.size(); idx++) {
+    fprintf(
+        file,
+        "%s%s",
+        idx > 0 ? "," : "",
+        escapeCsv(entries_[idx].section + "." + entries_[idx].key).c_str());
+  }
+  fprintf(file, "\n");
+  for (size_t idx = 0; idx < entries_.size(); idx++) {
+    fprintf(
+        file,
+        "%s%s",
+        idx > 0 ? "," : "",
+        escapeCsv(entries_[idx].value).c_str());
+  }
+  fprintf(file, "\n");
+}
+
+void Report::print(const std::string& format, FILE* file) const {
+  if (format == "json") {
+    printJson(file);
+  } else if (format == "csv") {
+    printCsv(file);
+  } else {
+    TP_DCHECK_EQ(format, "text");
+  }
+}
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/benchmark/cpu_usage.h>
+#include <tensorpipe/benchmark/measurements.h>
+#include <tensorpipe/benchmark/options.h>
+
+namespace tensorpipe {
+namespace benchmark {
+
+// Collects the outcome of a benchmark run, together with the information
+// needed to compare it with other runs, and prints it in a machine-readable
+// format. Entries are grouped in sections (e.g., "host", "config", "latency")
+// which become nested objects in JSON and prefixes of the column names in CSV,
+// where the whole run is a single row under a header.
+class Report {
+ public:
+  // Add the CPU model, the number of CPUs, the kernel, the hostname and the
+  // network interfaces (including InfiniBand devices) of this machine.
+  void addHostInfo();
+
+  // Add all the options, in the "config" section.
+  void addOptions(const Options& options);
+
+  void add(const std::string& section, const std::string& key, std::string);
+
+  void add(const std::string& section, const std::string& key, double);
+
+  // Add the number of samples, their mean, standard deviation, extremes and a
+  // full set of percentiles, all in microseconds. The comparison tool relies
+  // on count, mean and stddev being there to test for significance.
+  void add(const std::string& section, Measurements& measurements);
+
+  // Add the CPU time, also per byte sent and received by this side, and the
+  // performance counters if they were available. The breakdown by thread goes
+  // in its own section, named after this one with a "_threads" suffix.
+  void add(const std::string& section, const CpuUsage& usage, size_t numBytes);
+
+  void printJson(FILE* file) const;
+
+  void printCsv(FILE* file) const;
+
+  // Dispatches on the --output option. Does nothing for "text".
+  void print(const std::string& format, FILE* file) const;
+
+ private:
+  struct Entry {
+    std::string section;
+    std::string key;
+    std::string value;
+    bool isNumber;
+  };
+
+  std::vector<Entry> entries_;
+};
+
+} // namespace benchmark
+} // namespace tensorpipe
@@ -0,0 +1,182 @@
+#!/usr/bin/env python3
+# Copyright (c) Facebook, Inc. and its affiliates.
+# All rights reserved.
+#
+# This source code is licensed under the BSD-style license found in the
+# LICENSE file in the root directory of this source tree.
+
+"""Run benchmark_soak with many client processes, for each transport/channel.
+
+For each combination, this starts one server, waits for it to listen, and then
+starts the client processes, each with its own pipes. The arguments after "--"
+are passed to the server and to the clients (e.g., the message sizes and the
+--slo limits, which each process checks on its own). The reports of all the
+processes are gathered in one JSON file, keyed by combination and process.
+The exit status is 1 if any process failed, which includes exceeding a limit.
+"""
+
+import argparse
+import json
+import os
+import socket
+import subprocess
+import sys
+import threading
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def default_address(transport):
+    if transport == "shm":
+        return f"tensorpipe_soak_{os.getpid()}"
+    return f"127.0.0.1:{free_port()}"
+
+
+def run_combination(args, transport, channel, address, extra_args):
+    common_args = [
+        f"--transport={transport}",
+        f"--channel={channel}",
+        f"--address={address}",
+        f"--duration={args.duration}",
+        "--output=json",
+    ] + extra_args
+    server = subprocess.Popen(
+        [args.benchmark, "--mode=listen"]
+        + common_args
+        + [f"--num-pipes={args.num_processes * args.num_pipes}"],
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        text=True,
+    )
+
+    # Wait for the server to listen, then keep draining its stderr so that it
+    # never blocks on it.
+    listening = False
+    for line in server.stderr:
+        sys.stderr.write(f"[server] {line}")
+        if line.startswith("Listening"):
+            listening = True
+            break
+
+    def drain(name, stream):
+        for line in stream:
+            sys.stderr.write(f"[{name}] {line}")
+
+    threads = [
+        threading.Thread(target=drain, args=("server", server.stderr)),
+    ]
+    clients = []
+    if listening:
+        for idx in range(args.num_processes):
+            client = subprocess.Popen(
+                [args.benchmark, "--mode=connect"]
+                + common_args
+                + [
+                    f"--num-pipes={args.num_pipes}",
+                    f"--num-client-threads={args.num_client_threads}",
+                    f"--window={args.window}",
+                ],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE,
+                text=True,
+            )
+            clients.append(client)
+            threads.append(
+                threading.Thread(
+                    target=drain, args=(f"client {idx}", client.stderr)
+                )
+            )
+    for thread in threads:
+        thread.start()
+
+    results = {}
+    failed = not listening
+    for idx, client in enumerate(clients):
+        stdout = client.stdout.read()
+        if client.wait() != 0:
+            failed = True
+        results[f"client_{idx}"] = json.loads(stdout) if stdout else None
+    if not listening:
+        server.kill()
+    stdout = server.stdout.read()
+    if server.wait() != 0:
+        failed = True
+    results["server"] = json.loads(stdout) if stdout else None
+    for thread in threads:
+        thread.join()
+    return results, failed
+
+
+def summarize(name, results):
+    for process, report in results.items():
+        if report is None:
+            print(f"{name:<20} {process:<10} no report")
+            continue
+        throughput = report.get("throughput", {})
+        latency = report.get("latency", {})
+        print(
+            f"{name:<20} {process:<10} "
+            f"msgs/s {throughput.get('msgs_per_sec', float('nan')):>12.0f} "
+            f"GB/s {throughput.get('gb_per_sec', float('nan')):>8.3f} "
+            f"p99 {latency.get('p99_us', float('nan')):>10.3f} us "
+            f"cores {report['cpu']['cores']:>6.2f} "
+            f"RSS {report['memory']['peak_rss_mb']:>8.1f} MB "
+            f"violations {report['slo']['num_violations']:.0f}"
+        )
+
+
+def main():
+    argv = sys.argv[1:]
+    extra_args = []
+    if "--" in argv:
+        extra_args = argv[argv.index("--") + 1 :]
+        argv = argv[: argv.index("--")]
+
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument(
+        "--benchmark",
+        default=os.path.join(os.path.dirname(__file__), "benchmark_soak"),
+        help="path to the benchmark_soak executable",
+    )
+    parser.add_argument(
+        "--combination",
+        action="append",
+        metavar="TRANSPORT,CHANNEL[,ADDRESS]",
+        help="what to run (repeatable); defaults to uv,basic and shm,basic",
+    )
+    parser.add_argument("--num-processes", type=int, default=4)
+    parser.add_argument("--num-pipes", type=int, default=64, help="per process")
+    parser.add_argument("--num-client-threads", type=int, default=2)
+    parser.add_argument("--window", type=int, default=4)
+    parser.add_argument("--duration", type=float, default=300)
+    parser.add_argument("--report", default="soak_report.json")
+    args = parser.parse_args(argv)
+
+    failed = []
+    report = {}
+    for combination in args.combination or ["uv,basic", "shm,basic"]:
+        parts = combination.split(",")
+        transport, channel = parts[0], parts[1]
+        address = parts[2] if len(parts) > 2 else default_address(transport)
+        name = f"{transport}/{channel}"
+        results, combination_failed = run_combination(
+            args, transport, channel, address, extra_args
+        )
+        report[name] = results
+        summarize(name, results)
+        if combination_failed:
+            failed.append(name)
+
+    with open(args.report, "w") as f:
+        json.dump(report, f, indent=2)
+    if failed:
+        print(f"Failed: {', '.join(failed)}", file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -8,17 +8,47 @@
 
 #include <tensorpipe/benchmark/transport_registry.h>
 
+#include <cstdlib>
+
 #include <tensorpipe/tensorpipe.h>
 
 TP_DEFINE_SHARED_REGISTRY(
     TensorpipeTransportRegistry,
-    tensorpipe::transport::Context);
+    tensorpipe::transport::Context,
+    const tensorpipe::benchmark::Tunables&);
+
+using tensorpipe::benchmark::getBusyPollingPolicy;
+using tensorpipe::benchmark::getIbvDeviceOptions;
+using tensorpipe::benchmark::Tunables;
+
+// Each creator takes the settings of the constructor of its transport, by the
+// snake_case version of their names. Their defaults are those of the
+// constructor.
 
 // IBV
 
 #if TENSORPIPE_HAS_IBV_TRANSPORT
-std::shared_ptr<tensorpipe::transport::Context> makeIbvContext() {
-  return std::make_shared<tensorpipe::transport::ibv::Context>();
+std::shared_ptr<tensorpipe::transport::Context> makeIbvContext(
+    const Tunables& tunables) {
+  using tensorpipe::transport::ibv::Context;
+  tensorpipe::transport::ibv::QueueLimits queueLimits;
+  queueLimits.numPendingRecvReqs =
+      tunables.getInt("num_pending_recv_reqs", queueLimits.numPendingRecvReqs);
+  queueLimits.numPendingWriteReqs = tunables.getInt(
+      "num_pending_write_reqs", queueLimits.numPendingWriteReqs);
+  queueLimits.numPendingAckReqs =
+      tunables.getInt("num_pending_ack_reqs", queueLimits.numPendingAckReqs);
+  auto context = std::make_shared<Context>(
+      getBusyPollingPolicy(tunables),
+      tunables.getSize("inbox_size", Context::kDefaultInboxSize),
+      getIbvDeviceOptions(tunables),
+      queueLimits,
+      tunables.getSize("ring_slab_size", 0),
+      tunables.getSize("rendezvous_threshold", 0),
+      tunables.getBool("use_huge_pages", false),
+      tunables.getSize("num_queue_pairs", 1));
+  tunables.checkAllUsed("ibv");
+  return context;
 }
 
 TP_REGISTER_CREATOR(TensorpipeTransportRegistry, ibv, makeIbvContext);
@@ -27,17 +57,184 @@ TP_REGISTER_CREATOR(TensorpipeTransportRegistry, ibv, makeIbvContext);
 // SHM
 
 #if TENSORPIPE_HAS_SHM_TRANSPORT
-std::shared_ptr<tensorpipe::transport::Context> makeShmContext() {
-  return std::make_shared<tensorpipe::transport::shm::Context>();
+std::shared_ptr<tensorpipe::transport::Context> makeShmContext(
+    const Tunables& tunables) {
+  using tensorpipe::transport::shm::Context;
+  using tensorpipe::transport::shm::ContextOptions;
+  // The settings from the environment (TP_SHM_*) act as the defaults, which
+  // --transport-opt overrides.
+  ContextOptions options = ContextOptions::fromEnvironment();
+  options.policy = getBusyPollingPolicy(tunables, options.policy);
+  options.inboxSize = tunables.getSize("inbox_size", options.inboxSize);
+  options.reactorSize = tunables.getSize("reactor_size", options.reactorSize);
+  options.useHugePages =
+      tunables.getBool("use_huge_pages", options.useHugePages);
+  options.numaNode = tunables.getInt("numa_node", options.numaNode);
+  options.pollEpollFromReactor = tunables.getBool(
+      "poll_epoll_from_reactor", options.pollEpollFromReactor);
+  options.shareThreads =
+      tunables.getBool("share_threads", options.shareThreads);
+  options.sleepOnEventFd =
+      tunables.getBool("sleep_on_event_fd", options.sleepOnEventFd);
+  options.numSpareInboxes =
+      tunables.getSize("num_spare_inboxes", options.numSpareInboxes);
+  options.prefaultRings =
+      tunables.getBool("prefault_rings", options.prefaultRings);
+  options.lockRings = tunables.getBool("lock_rings", options.lockRings);
+  options.copyOffload = tunables.getBool("copy_offload", options.copyOffload);
+  options.coalesceWrites =
+      tunables.getBool("coalesce_writes", options.coalesceWrites);
+  tunables.checkAllUsed("shm");
+  auto context = std::make_shared<Context>(std::move(options));
+  return context;
 }
 
 TP_REGISTER_CREATOR(TensorpipeTransportRegistry, shm, makeShmContext);
 #endif // TENSORPIPE_HAS_SHM_TRANSPORT
 
+// URING
+
+#if TENSORPIPE_HAS_URING_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeUringContext(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::transport::uring::Context>(
+      tunables.getBool("use_sq_poll", false),
+      tunables.getSize("zero_copy_threshold", 0));
+  tunables.checkAllUsed("uring");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, uring, makeUringContext);
+#endif // TENSORPIPE_HAS_URING_TRANSPORT
+
+// XDP
+
+#if TENSORPIPE_HAS_XDP_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeXdpContext(
+    const Tunables& tunables) {
+  using tensorpipe::transport::xdp::Context;
+  // The interface can't be guessed, hence it can also be taken from the
+  // environment.
+  const char* interfaceName = std::getenv("TP_XDP_INTERFACE");
+  auto context = std::make_shared<Context>(
+      tunables.getString(
+          "interface_name", interfaceName != nullptr ? interfaceName : "eth0"),
+      tunables.getInt("queue_id", 0),
+      tunables.getInt("udp_port", Context::kDefaultUdpPort),
+      getBusyPollingPolicy(tunables),
+      tunables.getSize("num_frames", Context::kDefaultNumFrames),
+      tunables.getSize("inbox_size", Context::kDefaultInboxSize));
+  tunables.checkAllUsed("xdp");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, xdp, makeXdpContext);
+#endif // TENSORPIPE_HAS_XDP_TRANSPORT
+
+// FABRIC
+
+#if TENSORPIPE_HAS_FABRIC_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeFabricContext(
+    const Tunables& tunables) {
+  using tensorpipe::transport::fabric::Context;
+  auto context = std::make_shared<Context>(
+      getBusyPollingPolicy(tunables),
+      tunables.getSize("inbox_size", Context::kDefaultInboxSize),
+      tunables.getString("provider", "efa"));
+  tunables.checkAllUsed("fabric");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, fabric, makeFabricContext);
+#endif // TENSORPIPE_HAS_FABRIC_TRANSPORT
+
+// CXL
+
+#if TENSORPIPE_HAS_CXL_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeCxlContext(
+    const Tunables& tunables) {
+  using tensorpipe::transport::cxl::Context;
+  // The two sides must use distinct partitions of the same region, hence these
+  // can't be guessed, and can also be taken from the environment.
+  const char* regionPath = std::getenv("TP_CXL_REGION_PATH");
+  const char* regionSize = std::getenv("TP_CXL_REGION_SIZE");
+  const char* partitionOffset = std::getenv("TP_CXL_PARTITION_OFFSET");
+  const char* partitionSize = std::getenv("TP_CXL_PARTITION_SIZE");
+  auto context = std::make_shared<Context>(
+      tunables.getString(
+          "region_path", regionPath != nullptr ? regionPath : "/dev/dax0.0"),
+      tunables.getSize(
+          "region_size",
+          regionSize != nullptr ? std::stoull(regionSize) : 0),
+      tunables.getSize(
+          "partition_offset",
+          partitionOffset != nullptr ? std::stoull(partitionOffset) : 0),
+      tunables.getSize(
+          "partition_size",
+          partitionSize != nullptr ? std::stoull(partitionSize) : 0),
+      getBusyPollingPolicy(tunables),
+      tunables.getSize("inbox_size", Context::kDefaultInboxSize),
+      tunables.getBool("coherent", false));
+  tunables.checkAllUsed("cxl");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, cxl, makeCxlContext);
+#endif // TENSORPIPE_HAS_CXL_TRANSPORT
+
+// UCX
+
+#if TENSORPIPE_HAS_UCX_TRANSPORT
+std::shared_ptr<tensorpipe::transport::Context> makeUcxContext(
+    const Tunables& tunables) {
+  auto context = std::make_shared<tensorpipe::transport::ucx::Context>(
+      getBusyPollingPolicy(tunables));
+  tunables.checkAllUsed("ucx");
+  return context;
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, ucx, makeUcxContext);
+#endif // TENSORPIPE_HAS_UCX_TRANSPORT
+
 // UV
 
-std::shared_ptr<tensorpipe::transport::Context> makeUvContext() {
-  return std::make_shared<tensorpipe::transport::uv::Context>();
+static std::shared_ptr<tensorpipe::transport::Context> makeUvContextImpl(
+    const Tunables& tunables,
+    bool unixSockets,
+    const std::string& name) {
+  tensorpipe::transport::uv::LowLatencyOptions lowLatency;
+  lowLatency.socketBusyPoll =
+      std::chrono::microseconds(tunables.getInt("socket_busy_poll_us", 0));
+  lowLatency.preferBusyPoll = tunables.getBool("prefer_busy_poll", false);
+  lowLatency.quickAck = tunables.getBool("quick_ack", false);
+  lowLatency.busyPollLoops = tunables.getBool("busy_poll_loops", false);
+  tensorpipe::transport::uv::SocketBufferOptions socketBuffers;
+  socketBuffers.maxBufferSize = tunables.getSize("max_socket_buffer_size", 0);
+  socketBuffers.notSentLowat = tunables.getSize("not_sent_lowat", 0);
+  auto context = std::make_shared<tensorpipe::transport::uv::Context>(
+      tunables.getSize("num_loops", 1),
+      /*loopCpus=*/std::vector<std::vector<int>>(),
+      tunables.getSize("read_ahead_size", 0),
+      lowLatency,
+      unixSockets,
+      /*tlsHandshake=*/nullptr,
+      tunables.getBool("shard_listeners", false),
+      tunables.getSize("zero_copy_receive_threshold", 0),
+      socketBuffers);
+  tunables.checkAllUsed(name);
+  return context;
+}
+
+std::shared_ptr<tensorpipe::transport::Context> makeUvContext(
+    const Tunables& tunables) {
+  return makeUvContextImpl(tunables, /*unixSockets=*/false, "uv");
 }
 
 TP_REGISTER_CREATOR(TensorpipeTransportRegistry, uv, makeUvContext);
+
+std::shared_ptr<tensorpipe::transport::Context> makeUvUnixContext(
+    const Tunables& tunables) {
+  return makeUvContextImpl(tunables, /*unixSockets=*/true, "uv_unix");
+}
+
+TP_REGISTER_CREATOR(TensorpipeTransportRegistry, uv_unix, makeUvUnixContext);
@@ -8,9 +8,12 @@
 
 #pragma once
 
+#include <tensorpipe/benchmark/options.h>
 #include <tensorpipe/transport/context.h>
 #include <tensorpipe/util/registry/registry.h>
 
+// The creators get the settings given with --transport-opt.
 TP_DECLARE_SHARED_REGISTRY(
     TensorpipeTransportRegistry,
-    tensorpipe::transport::Context);
+    tensorpipe::transport::Context,
+    const tensorpipe::benchmark::Tunables&);
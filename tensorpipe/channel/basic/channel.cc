@@ -9,21 +9,61 @@
 #include <tensorpipe/channel/basic/channel.h>
 
 #include <algorithm>
+#include <cstring>
 #include <list>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <vector>
 
 #include <tensorpipe/channel/basic/context_impl.h>
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/compression.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/connection.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace basic {
 
+namespace {
+
+// A range of a buffer that is written, and read, as one buffer on the
+// connection.
+struct Chunk {
+  size_t offset;
+  size_t length;
+};
+
+// Split each segment, of the given lengths, into chunks of at most chunkSize
+// bytes (or not at all if it's zero), skipping empty ones. There is always at
+// least one chunk, so that even an empty buffer gets a write.
+std::vector<Chunk> splitIntoChunks(
+    const std::vector<size_t>& segmentLengths,
+    size_t chunkSize) {
+  std::vector<Chunk> chunks;
+  size_t segmentOffset = 0;
+  for (size_t segmentLength : segmentLengths) {
+    const size_t step = chunkSize > 0 ? chunkSize : segmentLength;
+    for (size_t offset = 0; offset < segmentLength; offset += step) {
+      chunks.push_back(Chunk{
+          segmentOffset + offset, std::min(step, segmentLength - offset)});
+    }
+    segmentOffset += segmentLength;
+  }
+  if (chunks.empty()) {
+    chunks.push_back(Chunk{0, 0});
+  }
+  return chunks;
+}
+
+} // namespace
+
 class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
  public:
   Impl(
@@ -66,6 +106,74 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
 
   void closeFromLoop_();
 
+  // The output of compressing a chunk. If it didn't get any smaller, the
+  // chunk is written as it is instead, which the receiver can tell from the
+  // length of what it reads.
+  struct CompressedChunk {
+    std::unique_ptr<uint8_t[]> data;
+    size_t length{0};
+    bool ready{false};
+  };
+
+  // The chunks of a segmented buffer never span two of the sender's segments,
+  // whereas those that span two of the receiver's are read into a temporary
+  // buffer and then scattered.
+  struct SendOperation {
+    uint64_t sequenceNumber;
+    CpuBuffer buffer;
+    std::vector<Chunk> chunks;
+    size_t numChunks;
+    // The chunks are started (i.e., they count towards the ones in flight, and
+    // those to be compressed are handed to a compression thread) and written
+    // in order, but only those that are ready can be written.
+    size_t numChunksStarted{0};
+    size_t numChunksWritten{0};
+    size_t numChunksCompleted{0};
+    CompressionCodec codec{CompressionCodec::kNone};
+    std::vector<CompressedChunk> compressedChunks;
+    TSendCallback callback;
+  };
+
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    CpuBuffer buffer;
+    std::vector<Chunk> chunks;
+    size_t numChunks;
+    size_t numChunksCompleted{0};
+    CompressionCodec codec{CompressionCodec::kNone};
+    TRecvCallback callback;
+  };
+
+  // Start chunks of the pending send operations, in order, for as long as the
+  // limit on the chunks in flight allows it, and hand those that are ready to
+  // the connection, also in order, as each write must match a read.
+  void writeChunks_();
+
+  void writeChunk_(std::list<SendOperation>::iterator opIter, size_t chunkIdx);
+
+  void compressChunk_(
+      std::list<SendOperation>::iterator opIter,
+      size_t chunkIdx);
+
+  void onChunkCompressed_(
+      std::list<SendOperation>::iterator opIter,
+      size_t chunkIdx,
+      size_t compressedLength);
+
+  void onChunkWritten_(std::list<SendOperation>::iterator opIter);
+
+  void readCompressedChunk_(
+      std::list<RecvOperation>::iterator opIter,
+      size_t chunkIdx);
+
+  void onCompressedChunkRead_(
+      std::list<RecvOperation>::iterator opIter,
+      size_t chunkIdx,
+      std::shared_ptr<uint8_t> frame,
+      size_t frameLength);
+
+  void onChunkRead_(std::list<RecvOperation>::iterator opIter);
+
   void setError_(Error error);
 
   // Helper function to process transport error.
@@ -83,6 +191,17 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
   // Increasing identifier for recv operations.
   uint64_t nextTensorBeingReceived_{0};
 
+  // Send operations whose chunks haven't all been written yet, in the order in
+  // which their chunks are handed to the connection, and the recv operations
+  // whose chunks haven't all been read yet. Lists are used as the callbacks of
+  // the connection refer to their elements through iterators.
+  std::list<SendOperation> sendOperations_;
+  std::list<RecvOperation> recvOperations_;
+
+  // The number of chunk writes of this channel that the connection has yet to
+  // complete, across all send operations.
+  size_t numChunksInFlight_{0};
+
   // An identifier for the channel, composed of the identifier for the context,
   // combined with an increasing sequence number. It will only be used for
   // logging and debugging purposes.
@@ -178,19 +297,199 @@ void Channel::Impl::sendFromLoop_(
     return;
   }
 
-  TP_VLOG(6) << "Channel " << id_ << " is writing payload (#" << sequenceNumber
-             << ")";
+  // Tensors that fit in one chunk are sent with a single write and an empty
+  // descriptor, as they always were. Otherwise the descriptor tells the peer
+  // which chunk size to expect, as each write must be matched by a read. When
+  // the chunks are compressed it's prefixed by the codec, as in "lz4:65536".
+  // Segmented buffers are written one segment at a time, each in chunks, and
+  // the descriptor is followed by the lengths of the segments, as in
+  // "65536/100,200".
+  const size_t chunkSize = context_->getChunkSize();
+  const bool isChunked = chunkSize > 0 && buffer.length > chunkSize;
+  const CompressionOptions& compression = context_->getCompressionOptions();
+  const bool isCompressed = compression.codec != CompressionCodec::kNone &&
+      buffer.length > 0 && buffer.length >= compression.threshold;
+  std::vector<size_t> segmentLengths;
+  for (const CpuSegment& segment : segmentsOfCpuBuffer(buffer)) {
+    segmentLengths.push_back(segment.length);
+  }
+  SendOperation op;
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.chunks = splitIntoChunks(segmentLengths, isChunked ? chunkSize : 0);
+  op.numChunks = op.chunks.size();
+  if (isCompressed) {
+    op.codec = compression.codec;
+    op.compressedChunks.resize(op.numChunks);
+  }
+  op.callback = std::move(callback);
+  std::string descriptor;
+  if (isCompressed) {
+    descriptor = codecName(op.codec) + ":" +
+        std::to_string(isChunked ? chunkSize : buffer.length);
+  } else if (isChunked) {
+    descriptor = std::to_string(chunkSize);
+  }
+  if (isSegmented(buffer)) {
+    descriptor += "/";
+    for (size_t segmentIdx = 0; segmentIdx < segmentLengths.size();
+         segmentIdx++) {
+      descriptor += (segmentIdx > 0 ? "," : "") +
+          std::to_string(segmentLengths[segmentIdx]);
+    }
+  }
+  sendOperations_.push_back(std::move(op));
+
+  writeChunks_();
+
+  descriptorCallback(Error::kSuccess, std::move(descriptor));
+}
+
+void Channel::Impl::writeChunks_() {
+  TP_DCHECK(loop_.inLoop());
+
+  const size_t maxChunksInFlight = context_->getMaxChunksInFlight();
+  for (auto opIter = sendOperations_.begin(); opIter != sendOperations_.end();
+       opIter++) {
+    SendOperation& op = *opIter;
+    if (error_ || numChunksInFlight_ >= maxChunksInFlight) {
+      break;
+    }
+    while (op.numChunksStarted < op.numChunks &&
+           numChunksInFlight_ < maxChunksInFlight) {
+      const size_t chunkIdx = op.numChunksStarted++;
+      numChunksInFlight_++;
+      if (op.codec != CompressionCodec::kNone) {
+        compressChunk_(opIter, chunkIdx);
+      }
+    }
+  }
+
+  for (auto opIter = sendOperations_.begin(); opIter != sendOperations_.end();
+       opIter++) {
+    SendOperation& op = *opIter;
+    while (op.numChunksWritten < op.numChunksStarted) {
+      if (error_ ||
+          (op.codec != CompressionCodec::kNone &&
+           !op.compressedChunks[op.numChunksWritten].ready)) {
+        return;
+      }
+      writeChunk_(opIter, op.numChunksWritten++);
+    }
+    if (op.numChunksWritten < op.numChunks) {
+      return;
+    }
+  }
+}
+
+void Channel::Impl::writeChunk_(
+    std::list<SendOperation>::iterator opIter,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  SendOperation& op = *opIter;
+  const Chunk& range = op.chunks[chunkIdx];
+  const void* ptr =
+      contiguousRangeOfCpuBuffer(op.buffer, range.offset, range.length);
+  size_t length = range.length;
+  if (op.codec != CompressionCodec::kNone) {
+    CompressedChunk& chunk = op.compressedChunks[chunkIdx];
+    if (chunk.length > 0) {
+      ptr = chunk.data.get();
+      length = chunk.length;
+    }
+  }
+  TP_VLOG(6) << "Channel " << id_ << " is writing chunk #" << chunkIdx
+             << " of payload (#" << op.sequenceNumber << ")";
   connection_->write(
-      buffer.ptr,
-      buffer.length,
-      eagerCallbackWrapper_(
-          [sequenceNumber, callback{std::move(callback)}](Impl& impl) {
-            TP_VLOG(6) << "Channel " << impl.id_ << " done writing payload (#"
-                       << sequenceNumber << ")";
-            callback(impl.error_);
-          }));
-
-  descriptorCallback(Error::kSuccess, std::string());
+      ptr,
+      length,
+      eagerCallbackWrapper_([opIter, chunkIdx](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done writing chunk #"
+                   << chunkIdx << " of payload (#" << opIter->sequenceNumber
+                   << ")";
+        impl.numChunksInFlight_--;
+        if (opIter->codec != CompressionCodec::kNone) {
+          opIter->compressedChunks[chunkIdx].data.reset();
+        }
+        impl.onChunkWritten_(opIter);
+      }));
+}
+
+void Channel::Impl::compressChunk_(
+    std::list<SendOperation>::iterator opIter,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  SendOperation& op = *opIter;
+  const Chunk& range = op.chunks[chunkIdx];
+  const void* src =
+      contiguousRangeOfCpuBuffer(op.buffer, range.offset, range.length);
+  const size_t length = range.length;
+  CompressedChunk& chunk = op.compressedChunks[chunkIdx];
+  // The output is only of use if it's smaller than the input.
+  chunk.data = std::make_unique<uint8_t[]>(length);
+  uint8_t* dst = chunk.data.get();
+  const CompressionCodec codec = op.codec;
+  const int level = context_->getCompressionOptions().level;
+  TP_VLOG(6) << "Channel " << id_ << " is compressing chunk #" << chunkIdx
+             << " of payload (#" << op.sequenceNumber << ")";
+  context_->runCompressionTask(
+      [codec,
+       level,
+       src,
+       dst,
+       length,
+       callback{eagerCallbackWrapper_(
+           [opIter, chunkIdx](Impl& impl, size_t compressedLength) {
+             impl.onChunkCompressed_(opIter, chunkIdx, compressedLength);
+           })}]() mutable {
+        const size_t compressedLength =
+            compress(codec, level, src, length, dst, length - 1);
+        callback(Error::kSuccess, compressedLength);
+      });
+}
+
+void Channel::Impl::onChunkCompressed_(
+    std::list<SendOperation>::iterator opIter,
+    size_t chunkIdx,
+    size_t compressedLength) {
+  TP_DCHECK(loop_.inLoop());
+
+  SendOperation& op = *opIter;
+  TP_VLOG(6) << "Channel " << id_ << " done compressing chunk #" << chunkIdx
+             << " of payload (#" << op.sequenceNumber << ") to "
+             << compressedLength << " bytes";
+  CompressedChunk& chunk = op.compressedChunks[chunkIdx];
+  chunk.length = compressedLength;
+  chunk.ready = true;
+  if (compressedLength == 0) {
+    chunk.data.reset();
+  }
+
+  // After an error the chunk won't be written, hence it's done already.
+  if (error_) {
+    numChunksInFlight_--;
+    onChunkWritten_(opIter);
+    return;
+  }
+
+  writeChunks_();
+}
+
+void Channel::Impl::onChunkWritten_(
+    std::list<SendOperation>::iterator opIter) {
+  TP_DCHECK(loop_.inLoop());
+
+  SendOperation& op = *opIter;
+  op.numChunksCompleted++;
+  if (op.numChunksCompleted == op.numChunks) {
+    TSendCallback callback = std::move(op.callback);
+    sendOperations_.erase(opIter);
+    callback(error_);
+  }
+
+  writeChunks_();
 }
 
 // Receive memory region from peer.
@@ -238,20 +537,180 @@ void Channel::Impl::recvFromLoop_(
     return;
   }
 
-  TP_DCHECK_EQ(descriptor, std::string());
+  // An empty descriptor means the payload was sent in a single write.
+  std::vector<size_t> segmentLengths;
+  const size_t slash = descriptor.find('/');
+  if (slash != std::string::npos) {
+    std::istringstream lengths(descriptor.substr(slash + 1));
+    std::string length;
+    while (std::getline(lengths, length, ',')) {
+      segmentLengths.push_back(std::stoull(length));
+    }
+    descriptor = descriptor.substr(0, slash);
+  } else {
+    segmentLengths.push_back(buffer.length);
+  }
+  TP_THROW_ASSERT_IF(
+      std::accumulate(
+          segmentLengths.begin(), segmentLengths.end(), size_t(0)) !=
+      buffer.length)
+      << "Segments in descriptor don't add up to the buffer's length";
+  CompressionCodec codec = CompressionCodec::kNone;
+  size_t chunkSize = 0;
+  if (!descriptor.empty()) {
+    const size_t separator = descriptor.find(':');
+    if (separator != std::string::npos) {
+      optional<CompressionCodec> maybeCodec =
+          codecFromName(descriptor.substr(0, separator));
+      TP_THROW_ASSERT_IF(!maybeCodec.has_value())
+          << "Unknown codec in descriptor " << descriptor;
+      codec = maybeCodec.value();
+      descriptor = descriptor.substr(separator + 1);
+    }
+    chunkSize = std::stoull(descriptor);
+    TP_DCHECK_GT(chunkSize, 0);
+  }
 
-  TP_VLOG(6) << "Channel " << id_ << " is reading payload (#" << sequenceNumber
-             << ")";
+  RecvOperation op;
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.chunks = splitIntoChunks(segmentLengths, chunkSize);
+  op.numChunks = op.chunks.size();
+  op.codec = codec;
+  op.callback = std::move(callback);
+  auto opIter = recvOperations_.insert(recvOperations_.end(), std::move(op));
+
+  // Reads don't occupy the transport, hence they're all posted right away.
+  for (size_t chunkIdx = 0; chunkIdx < opIter->numChunks; chunkIdx++) {
+    if (codec != CompressionCodec::kNone) {
+      readCompressedChunk_(opIter, chunkIdx);
+      continue;
+    }
+    const Chunk& range = opIter->chunks[chunkIdx];
+    void* ptr = contiguousRangeOfCpuBuffer(buffer, range.offset, range.length);
+    TP_VLOG(6) << "Channel " << id_ << " is reading chunk #" << chunkIdx
+               << " of payload (#" << sequenceNumber << ")";
+    auto onRead = eagerCallbackWrapper_(
+        [opIter, chunkIdx](
+            Impl& impl, const void* /* unused */, size_t /* unused */) {
+          TP_VLOG(6) << "Channel " << impl.id_ << " done reading chunk #"
+                     << chunkIdx << " of payload (#" << opIter->sequenceNumber
+                     << ")";
+          impl.onChunkRead_(opIter);
+        });
+    if (ptr != nullptr || range.length == 0) {
+      connection_->read(ptr, range.length, std::move(onRead));
+      continue;
+    }
+    // The chunk spans several of our segments, hence it's scattered from the
+    // transport's buffer, which is only valid during the callback.
+    connection_->read([buffer, range, onRead{std::move(onRead)}](
+                          const Error& error,
+                          const void* ptr,
+                          size_t length) mutable {
+      if (!error) {
+        TP_THROW_ASSERT_IF(length != range.length)
+            << "Expected a chunk of " << range.length << " bytes, got "
+            << length;
+        copyToCpuBuffer(buffer, range.offset, ptr, length);
+      }
+      onRead(error, ptr, length);
+    });
+  }
+}
+
+void Channel::Impl::readCompressedChunk_(
+    std::list<RecvOperation>::iterator opIter,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The length of a compressed chunk isn't known in advance, hence the
+  // transport allocates the buffer, which is only valid during the callback,
+  // whereas the wrapped one could be deferred. Thus it's copied out first.
+  TP_VLOG(6) << "Channel " << id_ << " is reading chunk #" << chunkIdx
+             << " of payload (#" << opIter->sequenceNumber << ")";
   connection_->read(
-      buffer.ptr,
-      buffer.length,
-      eagerCallbackWrapper_(
-          [sequenceNumber, callback{std::move(callback)}](
-              Impl& impl, const void* /* unused */, size_t /* unused */) {
-            TP_VLOG(6) << "Channel " << impl.id_ << " done reading payload (#"
-                       << sequenceNumber << ")";
-            callback(impl.error_);
-          }));
+      [callback{eagerCallbackWrapper_(
+           [opIter, chunkIdx](
+               Impl& impl, std::shared_ptr<uint8_t> frame, size_t length) {
+             impl.onCompressedChunkRead_(
+                 opIter, chunkIdx, std::move(frame), length);
+           })}](const Error& error, const void* ptr, size_t length) mutable {
+        std::shared_ptr<uint8_t> frame;
+        if (!error) {
+          frame = std::shared_ptr<uint8_t>(
+              new uint8_t[length], std::default_delete<uint8_t[]>());
+          std::memcpy(frame.get(), ptr, length);
+        }
+        callback(error, std::move(frame), length);
+      });
+}
+
+void Channel::Impl::onCompressedChunkRead_(
+    std::list<RecvOperation>::iterator opIter,
+    size_t chunkIdx,
+    std::shared_ptr<uint8_t> frame,
+    size_t frameLength) {
+  TP_DCHECK(loop_.inLoop());
+
+  RecvOperation& op = *opIter;
+  TP_VLOG(6) << "Channel " << id_ << " done reading chunk #" << chunkIdx
+             << " of payload (#" << op.sequenceNumber << ")";
+  if (error_) {
+    onChunkRead_(opIter);
+    return;
+  }
+
+  const CpuBuffer buffer = op.buffer;
+  const Chunk range = op.chunks[chunkIdx];
+  const CompressionCodec codec = op.codec;
+  context_->runCompressionTask(
+      [codec,
+       frame{std::move(frame)},
+       frameLength,
+       buffer,
+       range,
+       callback{eagerCallbackWrapper_([opIter](Impl& impl, bool success) {
+         if (!success) {
+           impl.setError_(TP_CREATE_ERROR(
+               DecompressionError, codecName(opIter->codec)));
+         }
+         impl.onChunkRead_(opIter);
+       })}]() mutable {
+        // A chunk that spans several of our segments is decompressed into a
+        // temporary buffer first.
+        const size_t length = range.length;
+        uint8_t* dst = reinterpret_cast<uint8_t*>(
+            contiguousRangeOfCpuBuffer(buffer, range.offset, length));
+        std::unique_ptr<uint8_t[]> staging;
+        if (dst == nullptr) {
+          staging = std::make_unique<uint8_t[]>(length);
+          dst = staging.get();
+        }
+        // A chunk that didn't get any smaller was sent as it is.
+        bool success = true;
+        if (frameLength == length) {
+          std::memcpy(dst, frame.get(), length);
+        } else {
+          success = decompress(codec, frame.get(), frameLength, dst, length);
+        }
+        if (success && staging != nullptr) {
+          copyToCpuBuffer(buffer, range.offset, dst, length);
+        }
+        callback(Error::kSuccess, success);
+      });
+}
+
+void Channel::Impl::onChunkRead_(std::list<RecvOperation>::iterator opIter) {
+  TP_DCHECK(loop_.inLoop());
+
+  RecvOperation& op = *opIter;
+  op.numChunksCompleted++;
+  if (op.numChunksCompleted == op.numChunks) {
+    TRecvCallback callback = std::move(op.callback);
+    recvOperations_.erase(opIter);
+    callback(error_);
+  }
 }
 
 void Channel::Impl::init() {
@@ -314,6 +773,31 @@ void Channel::Impl::handleError_() {
   // Close the connection so that all current operations will be aborted. This
   // will cause their callbacks to be invoked, and only then we'll invoke ours.
   connection_->close();
+
+  // The chunks that weren't handed to the connection yet never will be, hence
+  // the send operations that have none in flight must be completed here. Those
+  // that are still being compressed complete once they're done.
+  for (auto opIter = sendOperations_.begin();
+       opIter != sendOperations_.end();) {
+    SendOperation& op = *opIter;
+    for (size_t chunkIdx = op.numChunksWritten;
+         chunkIdx < op.numChunksStarted;
+         chunkIdx++) {
+      if (op.codec == CompressionCodec::kNone ||
+          op.compressedChunks[chunkIdx].ready) {
+        numChunksInFlight_--;
+        op.numChunksCompleted++;
+      }
+    }
+    op.numChunks = op.numChunksStarted;
+    if (op.numChunksCompleted == op.numChunks) {
+      TSendCallback callback = std::move(op.callback);
+      opIter = sendOperations_.erase(opIter);
+      callback(error_);
+    } else {
+      opIter++;
+    }
+  }
 }
 
 } // namespace basic
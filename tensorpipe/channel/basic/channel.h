@@ -19,7 +19,7 @@ namespace tensorpipe {
 namespace channel {
 namespace basic {
 
-class Channel : public channel::CpuChannel {
+class Channel final : public channel::CpuChannel {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
@@ -10,6 +10,10 @@
 
 #include <algorithm>
 #include <list>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 #include <tensorpipe/channel/basic/channel.h>
 #include <tensorpipe/channel/basic/context_impl.h>
@@ -19,18 +23,81 @@
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/mpmc_queue.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/system.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace basic {
 
+namespace {
+
+// How many tasks can be waiting for the compression threads before the
+// channels that queue more block.
+constexpr size_t kTaskQueueCapacity = 64 * 1024;
+
+// The channel works between any two processes, hence its descriptor is "any",
+// followed by the codecs that this build can decode, if any, and by the one
+// this context compresses with, if any, as in "any;decode=lz4,zstd;encode=lz4".
+std::string generateDomainDescriptor(CompressionCodec codec) {
+  std::ostringstream oss;
+  oss << "any";
+  std::string decoders;
+  for (CompressionCodec decoder :
+       {CompressionCodec::kLz4, CompressionCodec::kZstd}) {
+    if (isCodecAvailable(decoder)) {
+      decoders += (decoders.empty() ? "" : ",") + codecName(decoder);
+    }
+  }
+  if (!decoders.empty()) {
+    oss << ";decode=" << decoders;
+  }
+  if (codec != CompressionCodec::kNone) {
+    oss << ";encode=" << codecName(codec);
+  }
+  return oss.str();
+}
+
+// Returns false if the descriptor doesn't belong to a basic channel.
+bool parseDomainDescriptor(
+    const std::string& descriptor,
+    std::vector<std::string>& decoders,
+    std::string& encoder) {
+  std::istringstream iss(descriptor);
+  std::string field;
+  if (!std::getline(iss, field, ';') || field != "any") {
+    return false;
+  }
+  while (std::getline(iss, field, ';')) {
+    if (field.compare(0, 7, "decode=") == 0) {
+      std::istringstream decodersIss(field.substr(7));
+      std::string decoder;
+      while (std::getline(decodersIss, decoder, ',')) {
+        decoders.push_back(std::move(decoder));
+      }
+    } else if (field.compare(0, 7, "encode=") == 0) {
+      encoder = field.substr(7);
+    }
+  }
+  return true;
+}
+
+} // namespace
+
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  Impl(
+      size_t chunkSize,
+      size_t maxChunksInFlight,
+      CompressionOptions compression);
 
   const std::string& domainDescriptor() const;
 
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const;
+
   std::shared_ptr<channel::CpuChannel> createChannel(
       std::shared_ptr<transport::Connection>,
       Endpoint);
@@ -39,6 +106,14 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter& getClosingEmitter() override;
 
+  size_t getChunkSize() const override;
+
+  size_t getMaxChunksInFlight() const override;
+
+  const CompressionOptions& getCompressionOptions() const override;
+
+  void runCompressionTask(Function<void()> fn) override;
+
   void close();
 
   void join();
@@ -47,6 +122,15 @@ class Context::Impl : public Context::PrivateIface,
 
  private:
   std::string domainDescriptor_;
+  const size_t chunkSize_;
+  const size_t maxChunksInFlight_;
+  const CompressionOptions compression_;
+  // The compression threads are only started once a channel needs them, as
+  // most contexts never compress (or decompress) anything. Guarded by the
+  // mutex, which also orders their start with the context's closing.
+  std::vector<std::thread> threads_;
+  std::mutex threadsMutex_;
+  MpmcQueue<optional<Function<void()>>> tasks_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   ClosingEmitter closingEmitter_;
@@ -60,16 +144,80 @@ class Context::Impl : public Context::PrivateIface,
   // their identifiers based off this context's identifier. They will only be
   // used for logging and debugging.
   std::atomic<uint64_t> channelCounter_{0};
-};
 
-Context::Context() : impl_(std::make_shared<Impl>()) {}
+  void handleCompressionTasks_();
+};
 
-Context::Impl::Impl() : domainDescriptor_("any") {}
+Context::Context(
+    size_t chunkSize,
+    size_t maxChunksInFlight,
+    CompressionOptions compression)
+    : impl_(std::make_shared<Impl>(
+          chunkSize,
+          maxChunksInFlight,
+          std::move(compression))) {}
+
+Context::Impl::Impl(
+    size_t chunkSize,
+    size_t maxChunksInFlight,
+    CompressionOptions compression)
+    : domainDescriptor_(generateDomainDescriptor(compression.codec)),
+      chunkSize_(chunkSize),
+      maxChunksInFlight_(maxChunksInFlight),
+      compression_(std::move(compression)),
+      tasks_(kTaskQueueCapacity) {
+  TP_THROW_ASSERT_IF(maxChunksInFlight == 0)
+      << "At least one chunk must be allowed in flight";
+  TP_THROW_ASSERT_IF(!isCodecAvailable(compression_.codec))
+      << "Codec " << codecName(compression_.codec)
+      << " isn't available in this build";
+}
 
 ClosingEmitter& Context::Impl::getClosingEmitter() {
   return closingEmitter_;
 }
 
+size_t Context::Impl::getChunkSize() const {
+  return chunkSize_;
+}
+
+size_t Context::Impl::getMaxChunksInFlight() const {
+  return maxChunksInFlight_;
+}
+
+const CompressionOptions& Context::Impl::getCompressionOptions() const {
+  return compression_;
+}
+
+void Context::Impl::runCompressionTask(Function<void()> fn) {
+  std::unique_lock<std::mutex> lock(threadsMutex_);
+  // Without threads (because none were asked for, or because the context is
+  // closing and they are stopping) the task runs right away, on the caller's
+  // loop.
+  if (compression_.numThreads == 0 || closed_) {
+    lock.unlock();
+    fn();
+    return;
+  }
+  while (threads_.size() < compression_.numThreads) {
+    threads_.emplace_back(&Impl::handleCompressionTasks_, this);
+  }
+  // Queue it while holding the lock, so that it comes before the sentinels that
+  // stop the threads.
+  tasks_.push(std::move(fn));
+}
+
+void Context::Impl::handleCompressionTasks_() {
+  initCurrentThread("TP_BASIC_codec");
+  while (true) {
+    optional<Function<void()>> task = tasks_.pop();
+    if (!task.has_value()) {
+      break;
+    }
+    task.value()();
+  }
+}
+
 const std::string& Context::domainDescriptor() const {
   return impl_->domainDescriptor();
 }
@@ -78,6 +226,40 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  return impl_->canCommunicateWithRemote(remoteDomainDescriptor);
+}
+
+bool Context::Impl::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  std::vector<std::string> remoteDecoders;
+  std::string remoteEncoder;
+  if (!parseDomainDescriptor(
+          remoteDomainDescriptor, remoteDecoders, remoteEncoder)) {
+    return false;
+  }
+  // Each side must be able to decompress what the other one sends.
+  if (compression_.codec != CompressionCodec::kNone &&
+      std::find(
+          remoteDecoders.begin(),
+          remoteDecoders.end(),
+          codecName(compression_.codec)) == remoteDecoders.end()) {
+    return false;
+  }
+  if (!remoteEncoder.empty()) {
+    optional<CompressionCodec> remoteCodec = codecFromName(remoteEncoder);
+    if (!remoteCodec.has_value() || !isCodecAvailable(remoteCodec.value())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Context::supportsSegmentedBuffers() const {
+  return true;
+}
+
 std::shared_ptr<channel::CpuChannel> Context::createChannel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint) {
@@ -106,6 +288,12 @@ void Context::Impl::close() {
     TP_VLOG(4) << "Channel context " << id_ << " is closing";
 
     closingEmitter_.close();
+    {
+      std::unique_lock<std::mutex> lock(threadsMutex_);
+      for (size_t threadIdx = 0; threadIdx < threads_.size(); threadIdx++) {
+        tasks_.push(nullopt);
+      }
+    }
 
     TP_VLOG(4) << "Channel context " << id_ << " done closing";
   }
@@ -121,7 +309,10 @@ void Context::Impl::join() {
   if (!joined_.exchange(true)) {
     TP_VLOG(4) << "Channel context " << id_ << " is joining";
 
-    // Nothing to do?
+    std::unique_lock<std::mutex> lock(threadsMutex_);
+    for (auto& thread : threads_) {
+      thread.join();
+    }
 
     TP_VLOG(4) << "Channel context " << id_ << " done joining";
   }
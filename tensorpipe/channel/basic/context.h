@@ -12,17 +12,38 @@
 #include <string>
 
 #include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/compression.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace basic {
 
-class Context : public channel::CpuContext {
+class Context final : public channel::CpuContext {
  public:
-  Context();
+  // Tensors larger than chunkSize are sent as a sequence of writes of at most
+  // that size, of which no more than maxChunksInFlight per channel are handed
+  // to the connection at any time, so that a large tensor doesn't monopolize
+  // the transport (its socket or its ring buffer) at the expense of the other
+  // traffic. A chunkSize of zero sends each tensor in a single write.
+  //
+  // If a compression codec is given, tensors above its threshold have each of
+  // their chunks compressed by a pool of worker threads, and written as soon
+  // as it's ready, so that compressing the next chunks overlaps with sending
+  // the previous ones. The codecs each side can decode are advertised in the
+  // domain descriptor, hence the channel is only used between peers that can
+  // decompress each other's chunks.
+  explicit Context(
+      size_t chunkSize = 1024 * 1024,
+      size_t maxChunksInFlight = 4,
+      CompressionOptions compression = CompressionOptions());
 
   const std::string& domainDescriptor() const override;
 
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  bool supportsSegmentedBuffers() const override;
+
   std::shared_ptr<CpuChannel> createChannel(
       std::shared_ptr<transport::Connection>,
       Endpoint) override;
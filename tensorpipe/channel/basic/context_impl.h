@@ -10,6 +10,8 @@
 
 #include <tensorpipe/channel/basic/context.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/compression.h>
+#include <tensorpipe/common/function.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -19,6 +21,16 @@ class Context::PrivateIface {
  public:
   virtual ClosingEmitter& getClosingEmitter() = 0;
 
+  virtual size_t getChunkSize() const = 0;
+
+  virtual size_t getMaxChunksInFlight() const = 0;
+
+  virtual const CompressionOptions& getCompressionOptions() const = 0;
+
+  // Run the given function on one of the compression threads. It must not
+  // throw, and it must hand its result back to the channel's loop itself.
+  virtual void runCompressionTask(Function<void()> fn) = 0;
+
   virtual ~PrivateIface() = default;
 };
 
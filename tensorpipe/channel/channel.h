@@ -8,11 +8,14 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <string>
 
 #include <tensorpipe/channel/context.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 
 // Channels are an out of band mechanism to transfer data between
 // processes. Examples include a direct address space to address space
@@ -45,9 +48,9 @@ namespace tensorpipe {
 namespace channel {
 
 using TDescriptor = std::string;
-using TDescriptorCallback = std::function<void(const Error&, TDescriptor)>;
-using TSendCallback = std::function<void(const Error&)>;
-using TRecvCallback = std::function<void(const Error&)>;
+using TDescriptorCallback = Function<void(const Error&, TDescriptor)>;
+using TSendCallback = Function<void(const Error&)>;
+using TRecvCallback = Function<void(const Error&)>;
 
 // Abstract base class for channel classes.
 template <typename TBuffer>
@@ -65,6 +68,57 @@ class Channel {
       TBuffer buffer,
       TRecvCallback callback) = 0;
 
+  // Send memory region to peer, also giving the channel a share in the
+  // ownership of that memory. Channels that can (e.g., XTH, within a process)
+  // then hand the memory itself over to the receiver, rather than having it
+  // copied. By default the memory is merely kept alive until the send is done.
+  virtual void sendOwned(
+      TBuffer buffer,
+      std::shared_ptr<void> owner,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback) {
+    send(
+        std::move(buffer),
+        std::move(descriptorCallback),
+        [owner{std::move(owner)}, callback{std::move(callback)}](
+            const Error& error) mutable {
+          owner.reset();
+          callback(error);
+        });
+  }
+
+  using TRecvOwnedCallback =
+      Function<void(const Error&, TBuffer, std::shared_ptr<void>)>;
+
+  // Receive memory region from peer into memory that the channel provides,
+  // which is the sender's own one if it was handed over, or otherwise a newly
+  // allocated one. Only the length of the given buffer is used. The callback
+  // gets the buffer that was filled and the owner of its memory. The default
+  // allocates on the heap, hence it only makes sense for CPU buffers.
+  virtual void recvOwned(
+      TDescriptor descriptor,
+      TBuffer buffer,
+      TRecvOwnedCallback callback) {
+    std::shared_ptr<uint8_t> owner(
+        new uint8_t[buffer.length], std::default_delete<uint8_t[]>());
+    buffer.ptr = owner.get();
+    recv(
+        std::move(descriptor),
+        buffer,
+        [buffer, owner{std::move(owner)}, callback{std::move(callback)}](
+            const Error& error) mutable {
+          callback(error, buffer, std::move(owner));
+        });
+  }
+
+  // Tell the channel that the operations issued until the matching call to
+  // endBatch belong together (e.g., they're for the tensors of one message),
+  // and thus that it may coalesce the control messages it exchanges for them.
+  // Batches may be nested. This is only a hint, which channels may ignore.
+  virtual void beginBatch() {}
+
+  virtual void endBatch() {}
+
   // Tell the channel what its identifier is.
   //
   // This is only supposed to be called from the high-level pipe. It will only
@@ -13,9 +13,11 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <deque>
 #include <limits>
 #include <list>
 #include <mutex>
+#include <vector>
 
 #include <nop/serializer.h>
 #include <nop/structure.h>
@@ -38,12 +40,73 @@ namespace cma {
 
 namespace {
 
+struct Segment {
+  uint64_t ptr;
+  uint64_t length;
+  NOP_STRUCTURE(Segment, ptr, length);
+};
+
 struct Descriptor {
   uint32_t pid;
   uint64_t ptr;
-  NOP_STRUCTURE(Descriptor, pid, ptr);
+  // Whether the sender will push the data, once the receiver tells it where
+  // to, rather than the receiver pulling it.
+  bool push;
+  // Set, instead of ptr, if the sender's buffer is segmented.
+  std::vector<Segment> segments;
+  NOP_STRUCTURE(Descriptor, pid, ptr, push, segments);
+};
+
+// All the control messages that flow on the connection, in both directions.
+enum PacketType : uint8_t {
+  // Sent once by each side when the channel starts, with the ptr field set to
+  // whether it wants its peer to push the tensors it sends to it.
+  kHandshake = 0,
+  // The receiver is done pulling a tensor.
+  kPulled = 1,
+  // The receiver tells the sender where to push a tensor.
+  kDestination = 2,
+  // The sender is done pushing a tensor.
+  kPushed = 3,
+};
+
+struct Packet {
+  uint8_t type;
+  uint32_t pid;
+  uint64_t ptr;
+  // Set, instead of ptr, by a kDestination packet if the receiver's buffer is
+  // segmented.
+  std::vector<Segment> segments;
+  NOP_STRUCTURE(Packet, type, pid, ptr, segments);
 };
 
+std::vector<Segment> nopSegmentsOf(const CpuBuffer& buffer) {
+  std::vector<Segment> segments;
+  if (isSegmented(buffer)) {
+    for (const CpuSegment& segment : segmentsOfCpuBuffer(buffer)) {
+      segments.push_back(
+          Segment{reinterpret_cast<uint64_t>(segment.ptr), segment.length});
+    }
+  }
+  return segments;
+}
+
+// The segments of the peer's buffer, which is contiguous if it sent none.
+std::vector<CpuSegment> remoteSegmentsOf(
+    uint64_t ptr,
+    const std::vector<Segment>& segments,
+    size_t length) {
+  if (segments.empty()) {
+    return {CpuSegment{reinterpret_cast<void*>(ptr), length}};
+  }
+  std::vector<CpuSegment> result;
+  for (const Segment& segment : segments) {
+    result.push_back(
+        CpuSegment{reinterpret_cast<void*>(segment.ptr), segment.length});
+  }
+  return result;
+}
+
 } // namespace
 
 class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
@@ -89,6 +152,39 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
 
   void closeFromLoop_();
 
+  void writePacket_(
+      PacketType type,
+      uint32_t pid,
+      uint64_t ptr,
+      std::vector<Segment> segments = {});
+  void readPackets_();
+  void onPacket_(const Packet& packet);
+
+  // The direction of the copies of the tensors we send is chosen by the peer
+  // in its handshake, hence sends are held back until it has arrived.
+  struct SendOperation {
+    uint64_t sequenceNumber;
+    CpuBuffer buffer;
+    TDescriptorCallback descriptorCallback;
+    TSendCallback callback;
+  };
+  bool handshakeReceived_{false};
+  bool peerWantsPush_{false};
+  std::deque<SendOperation> pendingSendOperations_;
+
+  void startSend_(SendOperation op);
+
+  // The sends whose descriptor went out, waiting for the peer to have pulled
+  // them or to tell us where to push them.
+  std::deque<SendOperation> sendOperations_;
+
+  // The receives that the peer is pushing to.
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    TRecvCallback callback;
+  };
+  std::deque<RecvOperation> recvOperations_;
+
   void setError_(Error error);
 
   // Helper function to process transport error.
@@ -150,6 +246,9 @@ void Channel::Impl::init() {
 void Channel::Impl::initFromLoop_() {
   TP_DCHECK(loop_.inLoop());
   closingReceiver_.activate(*this);
+
+  writePacket_(kHandshake, getpid(), context_->receivesByPush() ? 1 : 0);
+  readPackets_();
 }
 
 void Channel::send(
@@ -209,24 +308,33 @@ void Channel::Impl::sendFromLoop_(
     return;
   }
 
-  TP_VLOG(6) << "Channel " << id_ << " is reading notification (#"
-             << sequenceNumber << ")";
-  connection_->read(
-      nullptr,
-      0,
-      eagerCallbackWrapper_(
-          [sequenceNumber, callback{std::move(callback)}](
-              Impl& impl, const void* /* unused */, size_t /* unused */) {
-            TP_VLOG(6) << "Channel " << impl.id_
-                       << " done reading notification (#" << sequenceNumber
-                       << ")";
-            callback(impl.error_);
-          }));
+  SendOperation op{
+      sequenceNumber,
+      buffer,
+      std::move(descriptorCallback),
+      std::move(callback)};
+  if (!handshakeReceived_) {
+    pendingSendOperations_.push_back(std::move(op));
+    return;
+  }
+  startSend_(std::move(op));
+}
+
+void Channel::Impl::startSend_(SendOperation op) {
+  TP_DCHECK(loop_.inLoop());
 
   NopHolder<Descriptor> nopHolder;
   Descriptor& nopDescriptor = nopHolder.getObject();
   nopDescriptor.pid = getpid();
-  nopDescriptor.ptr = reinterpret_cast<uint64_t>(buffer.ptr);
+  nopDescriptor.ptr = reinterpret_cast<uint64_t>(op.buffer.ptr);
+  nopDescriptor.push = peerWantsPush_;
+  nopDescriptor.segments = nopSegmentsOf(op.buffer);
+
+  TDescriptorCallback descriptorCallback = std::move(op.descriptorCallback);
+  TP_VLOG(6) << "Channel " << id_ << " is waiting for the peer to "
+             << (peerWantsPush_ ? "ask for" : "pull") << " the payload (#"
+             << op.sequenceNumber << ")";
+  sendOperations_.push_back(std::move(op));
 
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
@@ -279,35 +387,140 @@ void Channel::Impl::recvFromLoop_(
   NopHolder<Descriptor> nopHolder;
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
+
+  if (nopDescriptor.push) {
+    TP_VLOG(6) << "Channel " << id_ << " is asking the peer to push payload (#"
+               << sequenceNumber << ")";
+    writePacket_(
+        kDestination,
+        getpid(),
+        reinterpret_cast<uint64_t>(buffer.ptr),
+        nopSegmentsOf(buffer));
+    recvOperations_.push_back(
+        RecvOperation{sequenceNumber, std::move(callback)});
+    return;
+  }
+
   pid_t remotePid = nopDescriptor.pid;
-  void* remotePtr = reinterpret_cast<void*>(nopDescriptor.ptr);
 
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
   context_->requestCopy(
       remotePid,
-      remotePtr,
-      buffer.ptr,
-      buffer.length,
+      remoteSegmentsOf(
+          nopDescriptor.ptr, nopDescriptor.segments, buffer.length),
+      segmentsOfCpuBuffer(buffer),
+      /*push=*/false,
       eagerCallbackWrapper_([sequenceNumber,
                              callback{std::move(callback)}](Impl& impl) {
         TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
                    << sequenceNumber << ")";
 
         // Let peer know we've completed the copy.
-        TP_VLOG(6) << "Channel " << impl.id_ << " is writing notification (#"
-                   << sequenceNumber << ")";
-        impl.connection_->write(
-            nullptr, 0, impl.lazyCallbackWrapper_([sequenceNumber](Impl& impl) {
-              TP_VLOG(6) << "Channel " << impl.id_
-                         << " done writing notification (#" << sequenceNumber
-                         << ")";
-            }));
+        if (!impl.error_) {
+          impl.writePacket_(kPulled, 0, 0);
+        }
 
         callback(impl.error_);
       }));
 }
 
+void Channel::Impl::writePacket_(
+    PacketType type,
+    uint32_t pid,
+    uint64_t ptr,
+    std::vector<Segment> segments) {
+  TP_DCHECK(loop_.inLoop());
+  auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
+  Packet& nopPacket = nopPacketHolder->getObject();
+  nopPacket.type = type;
+  nopPacket.pid = pid;
+  nopPacket.ptr = ptr;
+  nopPacket.segments = std::move(segments);
+  TP_VLOG(6) << "Channel " << id_ << " is writing packet of type "
+             << static_cast<int>(type);
+  connection_->write(
+      *nopPacketHolder, lazyCallbackWrapper_([nopPacketHolder](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_ << " done writing packet of type "
+                   << static_cast<int>(nopPacketHolder->getObject().type);
+      }));
+}
+
+void Channel::Impl::readPackets_() {
+  TP_DCHECK(loop_.inLoop());
+  auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
+  connection_->read(
+      *nopPacketHolder, lazyCallbackWrapper_([nopPacketHolder](Impl& impl) {
+        impl.onPacket_(nopPacketHolder->getObject());
+        impl.readPackets_();
+      }));
+}
+
+void Channel::Impl::onPacket_(const Packet& packet) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(6) << "Channel " << id_ << " received packet of type "
+             << static_cast<int>(packet.type);
+
+  switch (packet.type) {
+    case kHandshake: {
+      TP_THROW_ASSERT_IF(handshakeReceived_) << "Duplicate handshake";
+      handshakeReceived_ = true;
+      peerWantsPush_ = packet.ptr != 0;
+      std::deque<SendOperation> ops = std::move(pendingSendOperations_);
+      pendingSendOperations_.clear();
+      for (SendOperation& op : ops) {
+        startSend_(std::move(op));
+      }
+      break;
+    }
+
+    case kPulled: {
+      TP_THROW_ASSERT_IF(sendOperations_.empty()) << "Unexpected notification";
+      SendOperation op = std::move(sendOperations_.front());
+      sendOperations_.pop_front();
+      op.callback(error_);
+      break;
+    }
+
+    case kDestination: {
+      TP_THROW_ASSERT_IF(sendOperations_.empty()) << "Unexpected destination";
+      SendOperation op = std::move(sendOperations_.front());
+      sendOperations_.pop_front();
+      const uint64_t sequenceNumber = op.sequenceNumber;
+      TP_VLOG(6) << "Channel " << id_ << " is pushing payload (#"
+                 << sequenceNumber << ")";
+      context_->requestCopy(
+          packet.pid,
+          remoteSegmentsOf(packet.ptr, packet.segments, op.buffer.length),
+          segmentsOfCpuBuffer(op.buffer),
+          /*push=*/true,
+          eagerCallbackWrapper_(
+              [sequenceNumber, callback{std::move(op.callback)}](Impl& impl) {
+                TP_VLOG(6) << "Channel " << impl.id_
+                           << " done pushing payload (#" << sequenceNumber
+                           << ")";
+                if (!impl.error_) {
+                  impl.writePacket_(kPushed, 0, 0);
+                }
+                callback(impl.error_);
+              }));
+      break;
+    }
+
+    case kPushed: {
+      TP_THROW_ASSERT_IF(recvOperations_.empty()) << "Unexpected notification";
+      RecvOperation op = std::move(recvOperations_.front());
+      recvOperations_.pop_front();
+      op.callback(error_);
+      break;
+    }
+
+    default:
+      TP_THROW_ASSERT() << "Unexpected packet type: "
+                        << static_cast<int>(packet.type);
+  }
+}
+
 void Channel::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -357,6 +570,20 @@ void Channel::Impl::handleError_() {
   TP_VLOG(5) << "Channel " << id_ << " is handling error " << error_.what();
 
   connection_->close();
+
+  for (SendOperation& op : pendingSendOperations_) {
+    op.descriptorCallback(error_, std::string());
+    op.callback(error_);
+  }
+  pendingSendOperations_.clear();
+  for (SendOperation& op : sendOperations_) {
+    op.callback(error_);
+  }
+  sendOperations_.clear();
+  for (RecvOperation& op : recvOperations_) {
+    op.callback(error_);
+  }
+  recvOperations_.clear();
 }
 
 } // namespace cma
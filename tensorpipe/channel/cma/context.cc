@@ -8,25 +8,30 @@
 
 #include <tensorpipe/channel/cma/context.h>
 
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
 #include <algorithm>
-#include <limits>
 #include <list>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include <tensorpipe/channel/cma/channel.h>
 #include <tensorpipe/channel/cma/context_impl.h>
+#include <tensorpipe/channel/copy_chunks.h>
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/mpmc_queue.h>
 #include <tensorpipe/common/optional.h>
-#include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/probes.h>
 #include <tensorpipe/common/system.h>
+#include <tensorpipe/common/trace.h>
 
 namespace tensorpipe {
 namespace channel {
@@ -34,6 +39,10 @@ namespace cma {
 
 namespace {
 
+// How many chunks can be waiting for the copy threads before the channels that
+// request more copies block.
+constexpr size_t kChunkQueueCapacity = 64 * 1024;
+
 std::string generateDomainDescriptor() {
   std::ostringstream oss;
   auto bootID = getBootID();
@@ -63,7 +72,7 @@ std::string generateDomainDescriptor() {
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  Impl(size_t numThreads, size_t minChunkSize, bool receiveByPush);
 
   const std::string& domainDescriptor() const;
 
@@ -75,17 +84,21 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter& getClosingEmitter() override;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  using copy_request_callback_fn = Function<void(const Error&)>;
 
   void requestCopy(
       pid_t remotePid,
-      void* remotePtr,
-      void* localPtr,
-      size_t length,
+      std::vector<CpuSegment> remoteSegments,
+      std::vector<CpuSegment> localSegments,
+      bool push,
       copy_request_callback_fn fn) override;
 
+  bool receivesByPush() const override;
+
   void close();
 
+  void closeFast();
+
   void join();
 
   ~Impl() override = default;
@@ -93,17 +106,49 @@ class Context::Impl : public Context::PrivateIface,
  private:
   struct CopyRequest {
     pid_t remotePid;
-    void* remotePtr;
+    // Whether to write to the remote buffer rather than read from it.
+    bool push;
+    copy_request_callback_fn callback;
+    // The number of chunks of this request that haven't been copied yet.
+    size_t numPendingChunks;
+    // The first error that occurred while copying any of the chunks.
+    Error error{Error::kSuccess};
+  };
+
+  // A slice of a request that is copied by a single thread, and that is
+  // contiguous in both processes.
+  struct CopyChunk {
+    CopyRequest* request;
     void* localPtr;
+    void* remotePtr;
     size_t length;
-    copy_request_callback_fn callback;
   };
 
   std::string domainDescriptor_;
-  std::thread thread_;
-  Queue<optional<CopyRequest>> requests_;
+  const size_t minChunkSize_;
+  const bool receiveByPush_;
+  std::vector<std::thread> threads_;
+  MpmcQueue<optional<CopyChunk>> chunks_;
+
+  // The requests that are in progress, in the order in which they were made.
+  // Their callbacks must be called in that same order, even if the chunks of a
+  // later request complete first, since channels rely on it. A std::list is
+  // used as it keeps pointers to its elements stable. Guarded by the mutex.
+  std::list<CopyRequest> requests_;
+  std::mutex requestsMutex_;
+  // Set while a thread is calling the callbacks of completed requests, so that
+  // no other thread starts doing so concurrently (and out of order).
+  bool callingCallbacks_{false};
+
+  // The copies of all CMA contexts are traced under the same name, as they're
+  // done by worker threads that don't belong to any single pipe.
+  const uint32_t traceScope_{trace::internScope("channel.cma")};
+
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
+  // Set by closeFast, to have the threads drop the chunks still in the queue
+  // rather than finishing them before stopping.
+  std::atomic<bool> dropping_{false};
   ClosingEmitter closingEmitter_;
 
   // This is atomic because it may be accessed from outside the loop.
@@ -120,14 +165,29 @@ class Context::Impl : public Context::PrivateIface,
   std::atomic<uint64_t> channelCounter_{0};
 
   void handleCopyRequests_();
+  void copyChunks_(const std::vector<CopyChunk>& chunks);
+  void onChunkCopied_(CopyRequest& request, Error error);
 };
 
-Context::Context() : impl_(std::make_shared<Context::Impl>()) {}
+Context::Context(size_t numThreads, size_t minChunkSize, bool receiveByPush)
+    : impl_(std::make_shared<Context::Impl>(
+          numThreads,
+          minChunkSize,
+          receiveByPush)) {}
 
-Context::Impl::Impl()
+Context::Impl::Impl(
+    size_t numThreads,
+    size_t minChunkSize,
+    bool receiveByPush)
     : domainDescriptor_(generateDomainDescriptor()),
-      requests_(std::numeric_limits<int>::max()) {
-  thread_ = std::thread(&Impl::handleCopyRequests_, this);
+      minChunkSize_(minChunkSize),
+      receiveByPush_(receiveByPush),
+      chunks_(kChunkQueueCapacity) {
+  TP_THROW_ASSERT_IF(numThreads == 0) << "At least one thread is needed";
+  TP_THROW_ASSERT_IF(minChunkSize == 0) << "Chunks cannot be empty";
+  for (size_t threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+    threads_.emplace_back(&Impl::handleCopyRequests_, this);
+  }
 }
 
 void Context::close() {
@@ -139,12 +199,23 @@ void Context::Impl::close() {
     TP_VLOG(4) << "Channel context " << id_ << " is closing";
 
     closingEmitter_.close();
-    requests_.push(nullopt);
+    for (size_t threadIdx = 0; threadIdx < threads_.size(); threadIdx++) {
+      chunks_.push(nullopt);
+    }
 
     TP_VLOG(4) << "Channel context " << id_ << " done closing";
   }
 }
 
+void Context::closeFast() {
+  impl_->closeFast();
+}
+
+void Context::Impl::closeFast() {
+  dropping_ = true;
+  close();
+}
+
 void Context::join() {
   impl_->join();
 }
@@ -155,7 +226,9 @@ void Context::Impl::join() {
   if (!joined_.exchange(true)) {
     TP_VLOG(4) << "Channel context " << id_ << " is joining";
 
-    thread_.join();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
     // TP_DCHECK(requests_.empty());
 
     TP_VLOG(4) << "Channel context " << id_ << " done joining";
@@ -179,6 +252,10 @@ ClosingEmitter& Context::Impl::getClosingEmitter() {
   return closingEmitter_;
 }
 
+bool Context::Impl::receivesByPush() const {
+  return receiveByPush_;
+}
+
 const std::string& Context::domainDescriptor() const {
   return impl_->domainDescriptor();
 }
@@ -187,6 +264,10 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+bool Context::supportsSegmentedBuffers() const {
+  return true;
+}
+
 std::shared_ptr<channel::CpuChannel> Context::createChannel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint) {
@@ -209,10 +290,10 @@ std::shared_ptr<channel::CpuChannel> Context::Impl::createChannel(
 
 void Context::Impl::requestCopy(
     pid_t remotePid,
-    void* remotePtr,
-    void* localPtr,
-    size_t length,
-    std::function<void(const Error&)> fn) {
+    std::vector<CpuSegment> remoteSegments,
+    std::vector<CpuSegment> localSegments,
+    bool push,
+    Function<void(const Error&)> fn) {
   uint64_t requestId = nextRequestId_++;
   TP_VLOG(4) << "Channel context " << id_ << " received a copy request (#"
              << requestId << ")";
@@ -226,38 +307,222 @@ void Context::Impl::requestCopy(
                << ")";
   };
 
-  requests_.push(
-      CopyRequest{remotePid, remotePtr, localPtr, length, std::move(fn)});
+  size_t length = 0;
+  for (const CpuSegment& segment : localSegments) {
+    length += segment.length;
+  }
+  size_t remoteLength = 0;
+  for (const CpuSegment& segment : remoteSegments) {
+    remoteLength += segment.length;
+  }
+  TP_THROW_ASSERT_IF(length != remoteLength)
+      << "Remote buffer is " << remoteLength << " bytes, local one is "
+      << length;
+
+  // Split the request in chunks, unless it's too small.
+  const size_t chunkSize =
+      cutCopyInChunks(length, threads_.size(), minChunkSize_).chunkSize;
+
+  // The chunks are also cut wherever either side moves on to its next segment,
+  // as each must be contiguous in both processes. Those that come from the same
+  // request are then likely to be copied together, by a single vectored call.
+  std::vector<CopyChunk> chunks;
+  size_t localIdx = 0;
+  size_t localOffset = 0;
+  size_t remoteIdx = 0;
+  size_t remoteOffset = 0;
+  size_t chunkOffset = 0;
+  while (localIdx < localSegments.size() && remoteIdx < remoteSegments.size()) {
+    const CpuSegment& local = localSegments[localIdx];
+    const CpuSegment& remote = remoteSegments[remoteIdx];
+    if (localOffset == local.length) {
+      localIdx++;
+      localOffset = 0;
+      continue;
+    }
+    if (remoteOffset == remote.length) {
+      remoteIdx++;
+      remoteOffset = 0;
+      continue;
+    }
+    const size_t pieceLength = std::min(
+        {local.length - localOffset,
+         remote.length - remoteOffset,
+         chunkSize - chunkOffset});
+    chunks.push_back(CopyChunk{
+        nullptr,
+        reinterpret_cast<uint8_t*>(local.ptr) + localOffset,
+        reinterpret_cast<uint8_t*>(remote.ptr) + remoteOffset,
+        pieceLength});
+    localOffset += pieceLength;
+    remoteOffset += pieceLength;
+    chunkOffset = (chunkOffset + pieceLength) % chunkSize;
+  }
+  if (chunks.empty()) {
+    chunks.push_back(CopyChunk{nullptr, nullptr, nullptr, 0});
+  }
+
+  CopyRequest* request;
+  {
+    std::unique_lock<std::mutex> lock(requestsMutex_);
+    requests_.push_back(
+        CopyRequest{remotePid, push, std::move(fn), chunks.size()});
+    request = &requests_.back();
+  }
+
+  for (CopyChunk& chunk : chunks) {
+    chunk.request = request;
+    chunks_.push(std::move(chunk));
+  }
 }
 
 void Context::Impl::handleCopyRequests_() {
-  setThreadName("TP_CMA_loop");
+  initCurrentThread("TP_CMA_loop");
+  std::vector<CopyChunk> batch;
+  // A chunk that was popped while gathering a batch but that couldn't join it,
+  // and which thus starts the next one (or stops the thread, if null).
+  bool hasLeftover = false;
+  optional<CopyChunk> leftover;
   while (true) {
-    auto maybeRequest = requests_.pop();
-    if (!maybeRequest.has_value()) {
+    optional<CopyChunk> maybeChunk;
+    if (hasLeftover) {
+      maybeChunk = std::move(leftover);
+      hasLeftover = false;
+    } else {
+      maybeChunk = chunks_.pop();
+    }
+    if (!maybeChunk.has_value()) {
       break;
     }
-    CopyRequest request = std::move(maybeRequest).value();
-
-    // Perform copy.
-    struct iovec local {
-      .iov_base = request.localPtr, .iov_len = request.length
-    };
-    struct iovec remote {
-      .iov_base = request.remotePtr, .iov_len = request.length
-    };
-    auto nread =
-        ::process_vm_readv(request.remotePid, &local, 1, &remote, 1, 0);
-    if (nread == -1) {
-      request.callback(TP_CREATE_ERROR(SystemError, "cma", errno));
-    } else if (nread != request.length) {
-      request.callback(TP_CREATE_ERROR(ShortReadError, request.length, nread));
+    batch.clear();
+    batch.push_back(std::move(maybeChunk.value()));
+
+    // Gather the chunks that are queued right after this one and that read
+    // from (or write to) the same process (e.g., the other tensors of the same
+    // message) in a single vectored call. Stop once the batch is as large as a
+    // chunk, so that the chunks of large requests are still spread across
+    // threads.
+    const pid_t remotePid = batch.front().request->remotePid;
+    const bool push = batch.front().request->push;
+    size_t batchLength = batch.front().length;
+    while (batch.size() < IOV_MAX && batchLength < minChunkSize_) {
+      optional<CopyChunk> nextChunk;
+      if (!chunks_.tryPop(nextChunk)) {
+        break;
+      }
+      if (!nextChunk.has_value() ||
+          nextChunk.value().request->remotePid != remotePid ||
+          nextChunk.value().request->push != push) {
+        leftover = std::move(nextChunk);
+        hasLeftover = true;
+        break;
+      }
+      batchLength += nextChunk.value().length;
+      batch.push_back(std::move(nextChunk.value()));
+    }
+
+    if (dropping_) {
+      for (const CopyChunk& chunk : batch) {
+        onChunkCopied_(*chunk.request, TP_CREATE_ERROR(ContextClosedError));
+      }
+      continue;
+    }
+    copyChunks_(batch);
+  }
+}
+
+void Context::Impl::copyChunks_(const std::vector<CopyChunk>& chunks) {
+  const pid_t remotePid = chunks.front().request->remotePid;
+  const bool push = chunks.front().request->push;
+  std::vector<struct iovec> local(chunks.size());
+  std::vector<struct iovec> remote(chunks.size());
+  size_t totalLength = 0;
+  for (size_t chunkIdx = 0; chunkIdx < chunks.size(); chunkIdx++) {
+    const CopyChunk& chunk = chunks[chunkIdx];
+    local[chunkIdx] = {.iov_base = chunk.localPtr, .iov_len = chunk.length};
+    remote[chunkIdx] = {.iov_base = chunk.remotePtr, .iov_len = chunk.length};
+    totalLength += chunk.length;
+  }
+
+  ssize_t nread;
+  {
+    trace::Span span("cma_copy", traceScope_);
+    TP_PROBE(cma_copy_start, remotePid, totalLength);
+    if (push) {
+      nread = ::process_vm_writev(
+          remotePid,
+          local.data(),
+          local.size(),
+          remote.data(),
+          remote.size(),
+          0);
+    } else {
+      nread = ::process_vm_readv(
+          remotePid,
+          local.data(),
+          local.size(),
+          remote.data(),
+          remote.size(),
+          0);
+    }
+    TP_PROBE(cma_copy_end, remotePid, nread);
+  }
+  if (nread == -1 && chunks.size() == 1) {
+    onChunkCopied_(
+        *chunks.front().request, TP_CREATE_ERROR(SystemError, "cma", errno));
+    return;
+  }
+  if (nread != -1 && static_cast<size_t>(nread) == totalLength) {
+    for (const CopyChunk& chunk : chunks) {
+      onChunkCopied_(*chunk.request, Error::kSuccess);
+    }
+    return;
+  }
+  if (chunks.size() == 1) {
+    onChunkCopied_(
+        *chunks.front().request,
+        TP_CREATE_ERROR(ShortReadError, totalLength, nread));
+    return;
+  }
+
+  // A vectored read stops at the first segment that fails, hence the chunks
+  // it fully covered succeeded, and the others are retried one by one to find
+  // out which ones failed and why.
+  size_t covered = nread == -1 ? 0 : nread;
+  for (const CopyChunk& chunk : chunks) {
+    if (covered >= chunk.length) {
+      covered -= chunk.length;
+      onChunkCopied_(*chunk.request, Error::kSuccess);
     } else {
-      request.callback(Error::kSuccess);
+      covered = 0;
+      copyChunks_({chunk});
     }
   }
 }
 
+void Context::Impl::onChunkCopied_(CopyRequest& request, Error error) {
+  std::unique_lock<std::mutex> lock(requestsMutex_);
+  if (error && !request.error) {
+    request.error = std::move(error);
+  }
+  TP_DCHECK_GT(request.numPendingChunks, 0);
+  request.numPendingChunks--;
+
+  if (callingCallbacks_) {
+    // The thread that is calling them will get to this request too.
+    return;
+  }
+  callingCallbacks_ = true;
+  while (!requests_.empty() && requests_.front().numPendingChunks == 0) {
+    CopyRequest completedRequest = std::move(requests_.front());
+    requests_.pop_front();
+    lock.unlock();
+    completedRequest.callback(completedRequest.error);
+    lock.lock();
+  }
+  callingCallbacks_ = false;
+}
+
 } // namespace cma
 } // namespace channel
 } // namespace tensorpipe
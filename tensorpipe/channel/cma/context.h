@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -17,12 +18,25 @@ namespace tensorpipe {
 namespace channel {
 namespace cma {
 
-class Context : public channel::CpuContext {
+class Context final : public channel::CpuContext {
  public:
-  Context();
+  // Copies are performed by a pool of numThreads threads. Copies that are at
+  // least twice as large as minChunkSize are split into chunks (of at least
+  // that size, and no more than one per thread) which are performed in
+  // parallel, whereas smaller copies are handed to a single thread as a whole.
+  // By default the receiver of a tensor pulls it from the sender's memory. If
+  // receiveByPush is set, the channels of this context instead ask their peers
+  // to push the tensors they receive, so that the copies are done (and their
+  // CPU time is spent) in the sending process.
+  explicit Context(
+      size_t numThreads = 1,
+      size_t minChunkSize = 1024 * 1024,
+      bool receiveByPush = false);
 
   const std::string& domainDescriptor() const override;
 
+  bool supportsSegmentedBuffers() const override;
+
   std::shared_ptr<CpuChannel> createChannel(
       std::shared_ptr<transport::Connection>,
       Endpoint) override;
@@ -31,6 +45,8 @@ class Context : public channel::CpuContext {
 
   void close() override;
 
+  void closeFast() override;
+
   void join() override;
 
   ~Context() override;
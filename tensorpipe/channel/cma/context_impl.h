@@ -9,9 +9,11 @@
 #pragma once
 
 #include <functional>
+#include <vector>
 
 #include <tensorpipe/channel/cma/context.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cpu_buffer.h>
 #include <tensorpipe/common/error.h>
 
 namespace tensorpipe {
@@ -22,15 +24,20 @@ class Context::PrivateIface {
  public:
   virtual ClosingEmitter& getClosingEmitter() = 0;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  using copy_request_callback_fn = Function<void(const Error&)>;
 
+  // Copy from the remote buffer into the local one or, if push is set, the
+  // other way around. Each is given as a list of segments, which need not be
+  // split in the same places, but whose lengths must add up to the same total.
   virtual void requestCopy(
       pid_t remotePid,
-      void* remotePtr,
-      void* localPtr,
-      size_t length,
+      std::vector<CpuSegment> remoteSegments,
+      std::vector<CpuSegment> localSegments,
+      bool push,
       copy_request_callback_fn fn) = 0;
 
+  virtual bool receivesByPush() const = 0;
+
   virtual ~PrivateIface() = default;
 };
 
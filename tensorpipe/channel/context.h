@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -48,6 +50,60 @@ class Context {
   //
   virtual const std::string& domainDescriptor() const = 0;
 
+  // Return whether this context can connect to a remote one advertising the
+  // given domain descriptor.
+  //
+  // By default the two descriptors must be identical, but channels whose
+  // domains aren't simply equivalence classes (e.g., because they depend on
+  // which devices each process uses) can override this to inspect them.
+  //
+  virtual bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const {
+    return domainDescriptor() == remoteDomainDescriptor;
+  }
+
+  // Return whether the channels of this context can send and receive CPU
+  // buffers that are made of several segments.
+  //
+  // Those of the others are first copied to (or received into) a contiguous
+  // staging buffer by the pipe.
+  //
+  virtual bool supportsSegmentedBuffers() const {
+    return false;
+  }
+
+  // Return whether the channels of this context can send and receive CUDA
+  // buffers whose rows are strided.
+  //
+  // The pipe only picks those that can for such buffers.
+  //
+  virtual bool supportsStridedBuffers() const {
+    return false;
+  }
+
+  // Do ahead of time the setup that the channels of this context would
+  // otherwise do for each transfer from or to the given buffer (e.g.,
+  // registering it with a device), and keep it for as long as the returned
+  // handle is alive, so that transfers of the buffer, or of a part of it, skip
+  // it. The buffer must not be freed before the handle is released.
+  //
+  // Return null if these channels have nothing to set up.
+  //
+  virtual std::shared_ptr<void> registerBuffer(TBuffer /* unused */) {
+    return nullptr;
+  }
+
+  // Return the current values of the counters that the context keeps, by name,
+  // for monitoring purposes. Those whose name starts with "memory." give how
+  // many bytes of memory the context holds for a given purpose.
+  //
+  // They must be cheap to maintain, as they're always on, and they may be read
+  // from any thread. Contexts that don't keep any return none.
+  //
+  virtual std::map<std::string, uint64_t> getStats() const {
+    return {};
+  }
+
   // Return newly created channel using the specified connection.
   //
   // It is up to the channel to either use this connection for further
@@ -71,6 +127,13 @@ class Context {
   // background.
   virtual void close() = 0;
 
+  // Like close, but the context may drop the work it had queued rather than
+  // finishing it first, failing the operations it belonged to. By default it
+  // just closes, for contexts that have nothing to drop.
+  virtual void closeFast() {
+    close();
+  }
+
   // Wait for all resources to be released and all background activity to stop.
   virtual void join() = 0;
 
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+
+// How the channels that copy with a pool of threads (e.g., cma and xth) cut a
+// copy in chunks, which are then spread among the threads.
+struct CopyChunks {
+  size_t numChunks;
+  size_t chunkSize;
+};
+
+// Cut a copy of the given length in at most maxNumChunks chunks, each of at
+// least minChunkSize bytes, unless the copy is smaller than that, in which case
+// it's a single chunk. All chunks have the same size, except for the last one,
+// which may be shorter, but which is only empty if the copy is.
+inline CopyChunks cutCopyInChunks(
+    size_t length,
+    size_t maxNumChunks,
+    size_t minChunkSize) {
+  TP_DCHECK_GT(minChunkSize, 0);
+  size_t numChunks =
+      std::max<size_t>(std::min(maxNumChunks, length / minChunkSize), 1);
+  const size_t chunkSize = (length + numChunks - 1) / numChunks;
+  // Rounding the size up may leave fewer chunks than asked for (e.g., 5 bytes
+  // in 4 chunks are 3 chunks of 2 bytes), and the extra ones would be past the
+  // end of the copy.
+  if (chunkSize > 0) {
+    numChunks = (length + chunkSize - 1) / chunkSize;
+  }
+  return CopyChunks{numChunks, chunkSize};
+}
+
+} // namespace channel
+} // namespace tensorpipe
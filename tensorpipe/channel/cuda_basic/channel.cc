@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/cuda_basic/channel.h>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <cuda_runtime.h>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/channel/cuda_basic/context_impl.h>
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_host_allocator.h>
+#include <tensorpipe/common/cuda_loop.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_basic {
+
+namespace {
+
+// The descriptors the CPU channel produced for each of the chunks, in order.
+struct Descriptor {
+  std::vector<std::string> chunkDescriptors;
+  NOP_STRUCTURE(Descriptor, chunkDescriptors);
+};
+
+using TChunk = CudaHostAllocator::TChunk;
+
+size_t getNumChunks(size_t length, size_t chunkLength) {
+  return (length + chunkLength - 1) / chunkLength;
+}
+
+} // namespace
+
+class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
+ public:
+  Impl(
+      std::shared_ptr<Context::PrivateIface>,
+      std::shared_ptr<CpuChannel>,
+      std::string);
+
+  // Called by the channel's constructor.
+  void init();
+
+  void send(
+      CudaBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  void recv(TDescriptor descriptor, CudaBuffer buffer, TRecvCallback callback);
+
+  // Tell the channel what its identifier is.
+  void setId(std::string id);
+
+  void close();
+
+ private:
+  OnDemandDeferredExecutor loop_;
+
+  void initFromLoop_();
+
+  // Send memory region to peer.
+  void sendFromLoop_(
+      CudaBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  // Receive memory region from peer.
+  void recvFromLoop_(
+      TDescriptor descriptor,
+      CudaBuffer buffer,
+      TRecvCallback callback);
+
+  void setIdFromLoop_(std::string id);
+
+  void closeFromLoop_();
+
+  void setError_(Error error);
+
+  // Helper function to process transport error.
+  // Shared between read and write callback entry points.
+  void handleError_();
+
+  struct SendOperation {
+    uint64_t sequenceNumber;
+    CudaBuffer buffer;
+    TDescriptorCallback descriptorCallback;
+    TSendCallback callback;
+    size_t numChunks;
+    std::vector<TChunk> chunks;
+    // The chunks are copied out of the GPU in order, as they're all enqueued
+    // on the tensor's stream, and then handed over to the CPU channel.
+    size_t numChunksCopied{0};
+    size_t numChunksSent{0};
+    size_t numChunksCompleted{0};
+    std::vector<std::string> chunkDescriptors;
+    size_t numChunkDescriptors{0};
+    bool descriptorCallbackCalled{false};
+  };
+
+  void onSendChunksAllocated_(
+      uint64_t sequenceNumber,
+      std::vector<TChunk> chunks);
+  void onSendChunkCopied_(uint64_t sequenceNumber, const Error& error);
+
+  // Hand the chunks that are ready over to the CPU channel. All the chunks of
+  // an operation must go before any of the next one, as the peer will post its
+  // CPU recvs in that order.
+  void processSendOperations_();
+
+  void onSendChunkDescriptor_(
+      uint64_t sequenceNumber,
+      size_t chunkIdx,
+      TDescriptor descriptor);
+  void onSendChunkCompleted_(uint64_t sequenceNumber);
+
+  // Remove the operation if both its callbacks have been called.
+  void tryCompleteSendOperation_(std::deque<SendOperation>::iterator iter);
+
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    CudaBuffer buffer;
+    TRecvCallback callback;
+    size_t numChunks;
+    std::vector<std::string> chunkDescriptors;
+    std::vector<TChunk> chunks;
+    bool chunksAllocated{false};
+    bool recvsPosted{false};
+    size_t numChunksReceived{0};
+  };
+
+  void onRecvChunksAllocated_(
+      uint64_t sequenceNumber,
+      std::vector<TChunk> chunks);
+
+  // Post, in order, the CPU recvs of the operations whose chunks have been
+  // allocated, as they must match up with the peer's CPU sends.
+  void processRecvOperations_();
+
+  void onRecvChunkReceived_(uint64_t sequenceNumber, size_t chunkIdx);
+
+  std::deque<SendOperation>::iterator findSendOperation_(
+      uint64_t sequenceNumber);
+  std::deque<RecvOperation>::iterator findRecvOperation_(
+      uint64_t sequenceNumber);
+
+  std::shared_ptr<Context::PrivateIface> context_;
+  std::shared_ptr<CpuChannel> cpuChannel_;
+  const size_t chunkLength_;
+  Error error_{Error::kSuccess};
+
+  ClosingReceiver closingReceiver_;
+
+  // The operations that are still in progress, in the order in which they were
+  // issued. Upon an error they're all failed at once: the chunks that may still
+  // be in use by a copy or by the CPU channel are also held by the callbacks
+  // waiting for them, hence only go back to the pool once those are done.
+  std::deque<SendOperation> sendOperations_;
+  std::deque<RecvOperation> recvOperations_;
+
+  // Increasing identifier for send operations.
+  uint64_t nextTensorBeingSent_{0};
+
+  // Increasing identifier for recv operations.
+  uint64_t nextTensorBeingReceived_{0};
+
+  // An identifier for the channel, composed of the identifier for the context,
+  // combined with an increasing sequence number. It will only be used for
+  // logging and debugging purposes.
+  std::string id_;
+
+  LazyCallbackWrapper<Impl> lazyCallbackWrapper_{*this, this->loop_};
+
+  // For some odd reason it seems we need to use a qualified name here...
+  template <typename T>
+  friend class tensorpipe::LazyCallbackWrapper;
+};
+
+Channel::Channel(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<CpuChannel> cpuChannel,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(cpuChannel),
+          std::move(id))) {
+  impl_->init();
+}
+
+Channel::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<CpuChannel> cpuChannel,
+    std::string id)
+    : context_(std::move(context)),
+      cpuChannel_(std::move(cpuChannel)),
+      chunkLength_(context_->getSendAllocator().getChunkLength()),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Channel::Impl::init() {
+  loop_.deferToLoop([this]() { initFromLoop_(); });
+}
+
+void Channel::Impl::initFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  closingReceiver_.activate(*this);
+  cpuChannel_->setId(id_ + ".cpu");
+}
+
+void Channel::send(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  impl_->send(buffer, std::move(descriptorCallback), std::move(callback));
+}
+
+void Channel::Impl::send(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  loop_.deferToLoop([this,
+                     buffer,
+                     descriptorCallback{std::move(descriptorCallback)},
+                     callback{std::move(callback)}]() mutable {
+    sendFromLoop_(buffer, std::move(descriptorCallback), std::move(callback));
+  });
+}
+
+void Channel::Impl::sendFromLoop_(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingSent_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a send request (#"
+             << sequenceNumber << ")";
+
+  descriptorCallback = [this,
+                        sequenceNumber,
+                        descriptorCallback{std::move(descriptorCallback)}](
+                           const Error& error, TDescriptor descriptor) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a descriptor callback (#"
+               << sequenceNumber << ")";
+    descriptorCallback(error, std::move(descriptor));
+    TP_VLOG(4) << "Channel " << id_ << " done calling a descriptor callback (#"
+               << sequenceNumber << ")";
+  };
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a send callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a send callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    descriptorCallback(error_, std::string());
+    callback(error_);
+    return;
+  }
+
+  const size_t numChunks = getNumChunks(buffer.length, chunkLength_);
+  if (numChunks == 0) {
+    NopHolder<Descriptor> nopHolder;
+    descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+    callback(Error::kSuccess);
+    return;
+  }
+
+  sendOperations_.emplace_back();
+  SendOperation& op = sendOperations_.back();
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.descriptorCallback = std::move(descriptorCallback);
+  op.callback = std::move(callback);
+  op.numChunks = numChunks;
+  op.chunkDescriptors.resize(numChunks);
+
+  TP_VLOG(6) << "Channel " << id_ << " is allocating " << numChunks
+             << " staging chunks (#" << sequenceNumber << ")";
+  context_->getSendAllocator().alloc(
+      numChunks,
+      [impl{shared_from_this()}, sequenceNumber](
+          std::vector<TChunk> chunks) mutable {
+        Impl& implRef = *impl;
+        implRef.loop_.deferToLoop([impl{std::move(impl)},
+                                   sequenceNumber,
+                                   chunks{std::move(chunks)}]() mutable {
+          impl->onSendChunksAllocated_(sequenceNumber, std::move(chunks));
+        });
+      });
+}
+
+void Channel::Impl::onSendChunksAllocated_(
+    uint64_t sequenceNumber,
+    std::vector<TChunk> chunks) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The operation may have been failed in the meantime, in which case the
+  // chunks go straight back to the pool.
+  auto iter = findSendOperation_(sequenceNumber);
+  if (iter == sendOperations_.end()) {
+    return;
+  }
+  SendOperation& op = *iter;
+  TP_VLOG(6) << "Channel " << id_ << " done allocating staging chunks (#"
+             << sequenceNumber << ")";
+  op.chunks = std::move(chunks);
+
+  TP_VLOG(6) << "Channel " << id_ << " is copying payload to host (#"
+             << sequenceNumber << ")";
+  CudaLoop& cudaLoop = context_->getCudaLoop();
+  for (size_t chunkIdx = 0; chunkIdx < op.numChunks; chunkIdx++) {
+    const size_t offset = chunkIdx * chunkLength_;
+    copyCudaBufferRangeAsync(
+        op.buffer,
+        offset,
+        op.chunks[chunkIdx].get(),
+        std::min(op.buffer.length - offset, chunkLength_),
+        /*intoBuffer=*/false,
+        cudaMemcpyDeviceToHost,
+        op.buffer.stream);
+    cudaLoop.addCallback(
+        op.buffer.stream,
+        [impl{shared_from_this()}, sequenceNumber, chunk{op.chunks[chunkIdx]}](
+            const Error& error) {
+          Impl& implRef = *impl;
+          implRef.loop_.deferToLoop(
+              [impl{std::move(impl)}, sequenceNumber, error]() {
+                impl->onSendChunkCopied_(sequenceNumber, error);
+              });
+        });
+  }
+}
+
+void Channel::Impl::onSendChunkCopied_(
+    uint64_t sequenceNumber,
+    const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+
+  setError_(error);
+  auto iter = findSendOperation_(sequenceNumber);
+  if (iter == sendOperations_.end()) {
+    return;
+  }
+  iter->numChunksCopied++;
+  processSendOperations_();
+}
+
+void Channel::Impl::processSendOperations_() {
+  TP_DCHECK(loop_.inLoop());
+
+  for (SendOperation& op : sendOperations_) {
+    while (op.numChunksSent < op.numChunksCopied) {
+      const size_t chunkIdx = op.numChunksSent++;
+      const size_t offset = chunkIdx * chunkLength_;
+      TP_VLOG(6) << "Channel " << id_ << " is sending chunk #" << chunkIdx
+                 << " (#" << op.sequenceNumber << ")";
+      cpuChannel_->send(
+          CpuBuffer{op.chunks[chunkIdx].get(),
+                    std::min(op.buffer.length - offset, chunkLength_)},
+          lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber}, chunkIdx](
+                                   Impl& impl, TDescriptor descriptor) {
+            impl.onSendChunkDescriptor_(
+                sequenceNumber, chunkIdx, std::move(descriptor));
+          }),
+          lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                                chunkIdx,
+                                chunk{op.chunks[chunkIdx]}](Impl& impl) {
+            TP_VLOG(6) << "Channel " << impl.id_ << " done sending chunk #"
+                       << chunkIdx << " (#" << sequenceNumber << ")";
+            impl.onSendChunkCompleted_(sequenceNumber);
+          }));
+    }
+    if (op.numChunksSent < op.numChunks) {
+      break;
+    }
+  }
+}
+
+void Channel::Impl::onSendChunkDescriptor_(
+    uint64_t sequenceNumber,
+    size_t chunkIdx,
+    TDescriptor descriptor) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = findSendOperation_(sequenceNumber);
+  TP_DCHECK(iter != sendOperations_.end());
+  SendOperation& op = *iter;
+  op.chunkDescriptors[chunkIdx] = std::move(descriptor);
+  op.numChunkDescriptors++;
+  if (op.numChunkDescriptors < op.numChunks) {
+    return;
+  }
+
+  NopHolder<Descriptor> nopHolder;
+  nopHolder.getObject().chunkDescriptors = std::move(op.chunkDescriptors);
+  op.descriptorCallbackCalled = true;
+  op.descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+  tryCompleteSendOperation_(iter);
+}
+
+void Channel::Impl::onSendChunkCompleted_(uint64_t sequenceNumber) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = findSendOperation_(sequenceNumber);
+  TP_DCHECK(iter != sendOperations_.end());
+  iter->numChunksCompleted++;
+  tryCompleteSendOperation_(iter);
+}
+
+void Channel::Impl::tryCompleteSendOperation_(
+    std::deque<SendOperation>::iterator iter) {
+  TP_DCHECK(loop_.inLoop());
+
+  // A CPU channel may complete a send before handing out its descriptor.
+  SendOperation& op = *iter;
+  if (!op.descriptorCallbackCalled || op.numChunksCompleted < op.numChunks) {
+    return;
+  }
+  TSendCallback callback = std::move(op.callback);
+  sendOperations_.erase(iter);
+  callback(Error::kSuccess);
+}
+
+// Receive memory region from peer.
+void Channel::recv(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  impl_->recv(std::move(descriptor), buffer, std::move(callback));
+}
+
+void Channel::Impl::recv(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  loop_.deferToLoop([this,
+                     descriptor{std::move(descriptor)},
+                     buffer,
+                     callback{std::move(callback)}]() mutable {
+    recvFromLoop_(std::move(descriptor), buffer, std::move(callback));
+  });
+}
+
+void Channel::Impl::recvFromLoop_(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingReceived_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a recv request (#"
+             << sequenceNumber << ")";
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a recv callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a recv callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    callback(error_);
+    return;
+  }
+
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+  Descriptor& nopDescriptor = nopHolder.getObject();
+
+  const size_t numChunks = getNumChunks(buffer.length, chunkLength_);
+  TP_DCHECK_EQ(nopDescriptor.chunkDescriptors.size(), numChunks);
+  if (numChunks == 0) {
+    callback(Error::kSuccess);
+    return;
+  }
+
+  recvOperations_.emplace_back();
+  RecvOperation& op = recvOperations_.back();
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.callback = std::move(callback);
+  op.numChunks = numChunks;
+  op.chunkDescriptors = std::move(nopDescriptor.chunkDescriptors);
+
+  TP_VLOG(6) << "Channel " << id_ << " is allocating " << numChunks
+             << " staging chunks (#" << sequenceNumber << ")";
+  context_->getRecvAllocator().alloc(
+      numChunks,
+      [impl{shared_from_this()}, sequenceNumber](
+          std::vector<TChunk> chunks) mutable {
+        Impl& implRef = *impl;
+        implRef.loop_.deferToLoop([impl{std::move(impl)},
+                                   sequenceNumber,
+                                   chunks{std::move(chunks)}]() mutable {
+          impl->onRecvChunksAllocated_(sequenceNumber, std::move(chunks));
+        });
+      });
+}
+
+void Channel::Impl::onRecvChunksAllocated_(
+    uint64_t sequenceNumber,
+    std::vector<TChunk> chunks) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The operation may have been failed in the meantime, in which case the
+  // chunks go straight back to the pool.
+  auto iter = findRecvOperation_(sequenceNumber);
+  if (iter == recvOperations_.end()) {
+    return;
+  }
+  TP_VLOG(6) << "Channel " << id_ << " done allocating staging chunks (#"
+             << sequenceNumber << ")";
+  iter->chunks = std::move(chunks);
+  iter->chunksAllocated = true;
+  processRecvOperations_();
+}
+
+void Channel::Impl::processRecvOperations_() {
+  TP_DCHECK(loop_.inLoop());
+
+  for (RecvOperation& op : recvOperations_) {
+    if (!op.chunksAllocated) {
+      break;
+    }
+    if (op.recvsPosted) {
+      continue;
+    }
+    op.recvsPosted = true;
+    for (size_t chunkIdx = 0; chunkIdx < op.numChunks; chunkIdx++) {
+      const size_t offset = chunkIdx * chunkLength_;
+      TP_VLOG(6) << "Channel " << id_ << " is receiving chunk #" << chunkIdx
+                 << " (#" << op.sequenceNumber << ")";
+      cpuChannel_->recv(
+          std::move(op.chunkDescriptors[chunkIdx]),
+          CpuBuffer{op.chunks[chunkIdx].get(),
+                    std::min(op.buffer.length - offset, chunkLength_)},
+          lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber},
+                                chunkIdx,
+                                chunk{op.chunks[chunkIdx]}](Impl& impl) {
+            TP_VLOG(6) << "Channel " << impl.id_ << " done receiving chunk #"
+                       << chunkIdx << " (#" << sequenceNumber << ")";
+            impl.onRecvChunkReceived_(sequenceNumber, chunkIdx);
+          }));
+    }
+  }
+}
+
+void Channel::Impl::onRecvChunkReceived_(
+    uint64_t sequenceNumber,
+    size_t chunkIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = findRecvOperation_(sequenceNumber);
+  TP_DCHECK(iter != recvOperations_.end());
+  RecvOperation& op = *iter;
+
+  // The copy into the tensor is ordered before any work the user enqueues
+  // after the callback, but the chunk must only go back to the pool once the
+  // copy is done. Any failure of the copy will surface on the stream itself.
+  const size_t offset = chunkIdx * chunkLength_;
+  copyCudaBufferRangeAsync(
+      op.buffer,
+      offset,
+      op.chunks[chunkIdx].get(),
+      std::min(op.buffer.length - offset, chunkLength_),
+      /*intoBuffer=*/true,
+      cudaMemcpyHostToDevice,
+      op.buffer.stream);
+  context_->getCudaLoop().addCallback(
+      op.buffer.stream,
+      [chunk{std::move(op.chunks[chunkIdx])}](const Error& /* unused */) {});
+
+  op.numChunksReceived++;
+  if (op.numChunksReceived < op.numChunks) {
+    return;
+  }
+  TRecvCallback callback = std::move(op.callback);
+  recvOperations_.erase(iter);
+  callback(Error::kSuccess);
+}
+
+std::deque<Channel::Impl::SendOperation>::iterator Channel::Impl::
+    findSendOperation_(uint64_t sequenceNumber) {
+  return std::find_if(
+      sendOperations_.begin(),
+      sendOperations_.end(),
+      [&](const SendOperation& op) {
+        return op.sequenceNumber == sequenceNumber;
+      });
+}
+
+std::deque<Channel::Impl::RecvOperation>::iterator Channel::Impl::
+    findRecvOperation_(uint64_t sequenceNumber) {
+  return std::find_if(
+      recvOperations_.begin(),
+      recvOperations_.end(),
+      [&](const RecvOperation& op) {
+        return op.sequenceNumber == sequenceNumber;
+      });
+}
+
+void Channel::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Channel::Impl::setId(std::string id) {
+  loop_.deferToLoop(
+      [this, id{std::move(id)}]() mutable { setIdFromLoop_(std::move(id)); });
+}
+
+void Channel::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  cpuChannel_->setId(id_ + ".cpu");
+}
+
+void Channel::close() {
+  impl_->close();
+}
+
+Channel::~Channel() {
+  close();
+}
+
+void Channel::Impl::close() {
+  loop_.deferToLoop([this]() { closeFromLoop_(); });
+}
+
+void Channel::Impl::closeFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ChannelClosedError));
+}
+
+void Channel::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError_();
+}
+
+void Channel::Impl::handleError_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(5) << "Channel " << id_ << " is handling error " << error_.what();
+
+  cpuChannel_->close();
+
+  std::deque<SendOperation> sendOperations = std::move(sendOperations_);
+  sendOperations_.clear();
+  for (SendOperation& op : sendOperations) {
+    if (!op.descriptorCallbackCalled) {
+      op.descriptorCallback(error_, std::string());
+    }
+    op.callback(error_);
+  }
+
+  std::deque<RecvOperation> recvOperations = std::move(recvOperations_);
+  recvOperations_.clear();
+  for (RecvOperation& op : recvOperations) {
+    op.callback(error_);
+  }
+}
+
+} // namespace cuda_basic
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/cuda_basic/context.h>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/channel/cuda_basic/channel.h>
+#include <tensorpipe/channel/cuda_basic/context_impl.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_basic {
+
+namespace {
+
+// Both sides must cut tensors into chunks of the same length, and be able to
+// use the CPU channel with each other.
+std::string generateDomainDescriptor(
+    size_t chunkLength,
+    const channel::CpuContext& cpuContext) {
+  return "cuda_basic:" + std::to_string(chunkLength) + ":" +
+      cpuContext.domainDescriptor();
+}
+
+bool isCudaAvailable() {
+  int numDevices = 0;
+  return cudaGetDeviceCount(&numDevices) == cudaSuccess && numDevices > 0;
+}
+
+} // namespace
+
+class Context::Impl : public Context::PrivateIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(
+      std::shared_ptr<channel::CpuContext> cpuContext,
+      size_t chunkLength,
+      size_t numChunks);
+
+  bool isViable() const;
+
+  const std::string& domainDescriptor() const;
+
+  std::map<std::string, uint64_t> getStats() const;
+
+  std::shared_ptr<channel::CudaChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint);
+
+  void setId(std::string id);
+
+  ClosingEmitter& getClosingEmitter() override;
+
+  CudaLoop& getCudaLoop() override;
+
+  CudaHostAllocator& getSendAllocator() override;
+
+  CudaHostAllocator& getRecvAllocator() override;
+
+  void close();
+
+  void join();
+
+  ~Impl() override = default;
+
+ private:
+  const std::shared_ptr<channel::CpuContext> cpuContext_;
+  const std::string domainDescriptor_;
+  const bool isCudaAvailable_;
+
+  // The chunks given out by the allocators may be held by the callbacks that
+  // the loop is waiting for, hence the loop must be joined (and thus, being
+  // declared after them, destroyed) first.
+  CudaHostAllocator sendAllocator_;
+  CudaHostAllocator recvAllocator_;
+  CudaLoop cudaLoop_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  ClosingEmitter closingEmitter_;
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the channel's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Sequence numbers for the channels created by this context, used to create
+  // their identifiers based off this context's identifier. They will only be
+  // used for logging and debugging.
+  std::atomic<uint64_t> channelCounter_{0};
+};
+
+Context::Context(
+    std::shared_ptr<channel::CpuContext> cpuContext,
+    size_t chunkLength,
+    size_t numChunks)
+    : impl_(std::make_shared<Context::Impl>(
+          std::move(cpuContext),
+          chunkLength,
+          numChunks)) {}
+
+Context::Impl::Impl(
+    std::shared_ptr<channel::CpuContext> cpuContext,
+    size_t chunkLength,
+    size_t numChunks)
+    : cpuContext_(std::move(cpuContext)),
+      domainDescriptor_(generateDomainDescriptor(chunkLength, *cpuContext_)),
+      isCudaAvailable_(isCudaAvailable()),
+      sendAllocator_(numChunks, chunkLength),
+      recvAllocator_(numChunks, chunkLength) {}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is closing";
+
+    closingEmitter_.close();
+    cpuContext_->close();
+    cudaLoop_.close();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done closing";
+  }
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is joining";
+
+    cpuContext_->join();
+    cudaLoop_.join();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(4) << "Channel context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  cpuContext_->setId(id_ + ".cpu");
+}
+
+ClosingEmitter& Context::Impl::getClosingEmitter() {
+  return closingEmitter_;
+}
+
+CudaLoop& Context::Impl::getCudaLoop() {
+  return cudaLoop_;
+}
+
+CudaHostAllocator& Context::Impl::getSendAllocator() {
+  return sendAllocator_;
+}
+
+CudaHostAllocator& Context::Impl::getRecvAllocator() {
+  return recvAllocator_;
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+bool Context::Impl::isViable() const {
+  return cpuContext_->isViable() && isCudaAvailable_;
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() const {
+  return {
+      {"memory.pinned",
+       sendAllocator_.getNumBytes() + recvAllocator_.getNumBytes()},
+  };
+}
+
+bool Context::supportsStridedBuffers() const {
+  return true;
+}
+
+std::shared_ptr<channel::CudaChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+std::shared_ptr<channel::CudaChannel> Context::Impl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  TP_THROW_ASSERT_IF(joined_);
+  std::string channelId = id_ + ".c" + std::to_string(channelCounter_++);
+  TP_VLOG(4) << "Channel context " << id_ << " is opening channel "
+             << channelId;
+  // The connection is entirely handed over to the CPU channel, as the chunks'
+  // descriptors are all we need to share with the peer.
+  std::shared_ptr<channel::CpuChannel> cpuChannel =
+      cpuContext_->createChannel(std::move(connection), endpoint);
+  return std::make_shared<Channel>(
+      Channel::ConstructorToken(),
+      std::static_pointer_cast<PrivateIface>(shared_from_this()),
+      std::move(cpuChannel),
+      std::move(channelId));
+}
+
+} // namespace cuda_basic
+} // namespace channel
+} // namespace tensorpipe
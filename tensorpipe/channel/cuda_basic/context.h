@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/channel/cuda_context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_basic {
+
+class Channel;
+
+// The length of the pieces tensors are cut into, and how many of them each of
+// the pinned staging pools (one for sending, one for receiving) holds.
+constexpr size_t kDefaultChunkLength = 1024 * 1024;
+constexpr size_t kDefaultNumChunks = 16;
+
+// Transfers CUDA tensors by staging them through pinned host memory, which the
+// given CPU channel then transfers. Tensors are cut into chunks, so that while
+// one of them is being transferred the next one is already being copied out of
+// the GPU on the sender, and the previous one into the GPU on the receiver.
+class Context final : public channel::CudaContext {
+ public:
+  explicit Context(
+      std::shared_ptr<channel::CpuContext> cpuContext,
+      size_t chunkLength = kDefaultChunkLength,
+      size_t numChunks = kDefaultNumChunks);
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool supportsStridedBuffers() const override;
+
+  // Reports the pinned memory of the pools of staging chunks.
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::shared_ptr<CudaChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow channel to see the private interface.
+  friend class Channel;
+};
+
+} // namespace cuda_basic
+} // namespace channel
+} // namespace tensorpipe
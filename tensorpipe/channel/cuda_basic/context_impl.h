@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/channel/cuda_basic/context.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda_host_allocator.h>
+#include <tensorpipe/common/cuda_loop.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_basic {
+
+class Context::PrivateIface {
+ public:
+  virtual ClosingEmitter& getClosingEmitter() = 0;
+
+  virtual CudaLoop& getCudaLoop() = 0;
+
+  // Separate pools for the two directions, as a receiver waiting for chunks
+  // must never have to wait for a sender that's itself waiting for the peer.
+  virtual CudaHostAllocator& getSendAllocator() = 0;
+
+  virtual CudaHostAllocator& getRecvAllocator() = 0;
+
+  virtual ~PrivateIface() = default;
+};
+
+} // namespace cuda_basic
+} // namespace channel
+} // namespace tensorpipe
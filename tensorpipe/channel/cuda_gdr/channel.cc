@@ -0,0 +1,779 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/cuda_gdr/channel.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+#include <cuda_runtime.h>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/channel/cuda_gdr/context_impl.h>
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/channel/ibv/constants.h>
+#include <tensorpipe/channel/ibv/error.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/cuda_host_allocator.h>
+#include <tensorpipe/common/cuda_loop.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/ibv.h>
+#include <tensorpipe/transport/connection.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_gdr {
+
+namespace {
+
+// The memory the peer reads from: either the tensor itself, or the pinned host
+// buffer it was staged into.
+struct Descriptor {
+  uint64_t ptr;
+  uint32_t rkey;
+  NOP_STRUCTURE(Descriptor, ptr, rkey);
+};
+
+} // namespace
+
+class Channel::Impl : public std::enable_shared_from_this<Channel::Impl>,
+                      public IbvEventHandler {
+ public:
+  Impl(
+      std::shared_ptr<Context::PrivateIface>,
+      std::shared_ptr<transport::Connection>,
+      std::string);
+
+  // Called by the channel's constructor.
+  void init();
+
+  void send(
+      CudaBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  void recv(TDescriptor descriptor, CudaBuffer buffer, TRecvCallback callback);
+
+  // Tell the channel what its identifier is.
+  void setId(std::string id);
+
+  void close();
+
+  // Called by the reactor, from its thread.
+  void onReadCompleted() override;
+  void onError(IbvLib::wc_status status, uint64_t wr_id) override;
+
+ private:
+  OnDemandDeferredExecutor loop_;
+
+  void initFromLoop_();
+
+  // Send memory region to peer.
+  void sendFromLoop_(
+      CudaBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  // Receive memory region from peer.
+  void recvFromLoop_(
+      TDescriptor descriptor,
+      CudaBuffer buffer,
+      TRecvCallback callback);
+
+  void setIdFromLoop_(std::string id);
+
+  void closeFromLoop_();
+
+  void setError_(Error error);
+
+  // Helper function to process transport error.
+  // Shared between read and write callback entry points.
+  void handleError_();
+
+  // Called once the peer's setup information has been read.
+  void onPeerSetupInformation_();
+
+  // Run the function within the loop once all the work that is currently
+  // enqueued on the stream has completed, having first put the channel in an
+  // error state if any of that work failed. The CUDA runtime forbids calling
+  // into CUDA from its own threads, hence this goes through the context's CUDA
+  // loop, rather than having any thread wait for the stream.
+  void runWhenStreamIsDone_(cudaStream_t stream, Function<void()> fn);
+
+  struct SendOperation {
+    uint64_t sequenceNumber;
+    CudaBuffer buffer;
+    TDescriptorCallback descriptorCallback;
+    TSendCallback callback;
+    // Only set when staging, holding a copy of the tensor for the peer to read.
+    CudaHostBuffer stagingBuffer;
+    // Whether the tensor is ready to be read, i.e., (a copy of) it has been
+    // fully written by the work that preceded the send on its stream.
+    bool ready{false};
+  };
+
+  // Hand out the descriptors of the send operations at the front of the queue
+  // that are ready, in order, since the peer will notify us in that order.
+  void processSendOperations_();
+
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    CudaBuffer buffer;
+    uint64_t remotePtr;
+    uint32_t remoteKey;
+    TRecvCallback callback;
+    // Only set when staging, where the RDMA reads land before being copied to
+    // the tensor on its stream.
+    CudaHostBuffer stagingBuffer;
+    // The local buffer, registered for the duration of the RDMA reads.
+    IbvRegistrationCache::Handle mr;
+    // Whether the destination can be written to, which for the tensor itself
+    // means that the work that preceded the recv on its stream has completed.
+    bool ready{false};
+    bool readsPosted{false};
+    // The number of RDMA reads for this operation that were handed over to the
+    // reactor and that haven't completed yet.
+    size_t numPendingReads{0};
+  };
+
+  // Post, in order, the RDMA reads of the recv operations that are ready.
+  void postReadsOfReadyRecvOperations_();
+  void postReads_(RecvOperation& op);
+  void onReadCompletedFromLoop_();
+
+  // Complete, in order, the recv operations at the front of the queue whose
+  // RDMA reads are all done, notifying the peer of each of them.
+  void completeRecvOperations_();
+
+  // Once in an error state and with no more RDMA reads in flight, hand the
+  // queue pair over to the reactor for it to be destroyed.
+  void tryCleanup_();
+  void cleanupFromReactor_();
+
+  std::shared_ptr<Context::PrivateIface> context_;
+  std::shared_ptr<transport::Connection> connection_;
+  Error error_{Error::kSuccess};
+
+  ClosingReceiver closingReceiver_;
+
+  enum State {
+    INITIALIZING = 1,
+    ESTABLISHED,
+  };
+  State state_{INITIALIZING};
+
+  IbvQueuePair qp_;
+  IbvSetupInformation ibvSelfInfo_;
+  IbvSetupInformation ibvPeerInfo_;
+
+  // The send operations whose descriptor hasn't been handed out yet, in the
+  // order in which they were issued.
+  std::deque<SendOperation> sendOperations_;
+
+  // The recv operations that haven't completed yet, in the order in which they
+  // were issued. RDMA reads on a queue pair complete in order, and the peer
+  // relies on the notifications arriving in order too.
+  std::deque<RecvOperation> recvOperations_;
+
+  // The total number of RDMA reads that were handed over to the reactor and
+  // that haven't completed, which we need to wait for before we can destroy
+  // the queue pair (a failed read also counts as completed).
+  size_t numReadsInFlight_{0};
+
+  // Increasing identifier for send operations.
+  uint64_t nextTensorBeingSent_{0};
+
+  // Increasing identifier for recv operations.
+  uint64_t nextTensorBeingReceived_{0};
+
+  // An identifier for the channel, composed of the identifier for the context,
+  // combined with an increasing sequence number. It will only be used for
+  // logging and debugging purposes.
+  std::string id_;
+
+  LazyCallbackWrapper<Impl> lazyCallbackWrapper_{*this, this->loop_};
+  EagerCallbackWrapper<Impl> eagerCallbackWrapper_{*this, this->loop_};
+
+  // For some odd reason it seems we need to use a qualified name here...
+  template <typename T>
+  friend class tensorpipe::LazyCallbackWrapper;
+  template <typename T>
+  friend class tensorpipe::EagerCallbackWrapper;
+};
+
+Channel::Channel(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<transport::Connection> connection,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(connection),
+          std::move(id))) {
+  impl_->init();
+}
+
+Channel::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<transport::Connection> connection,
+    std::string id)
+    : context_(std::move(context)),
+      connection_(std::move(connection)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Channel::Impl::init() {
+  loop_.deferToLoop([this]() { initFromLoop_(); });
+}
+
+void Channel::Impl::initFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  closingReceiver_.activate(*this);
+
+  Reactor& reactor = context_->getReactor();
+
+  // Create and init queue pair. Nothing is ever received on it, as the only
+  // operations are RDMA reads issued by the local side of each transfer.
+  {
+    IbvLib::qp_init_attr initAttr;
+    std::memset(&initAttr, 0, sizeof(initAttr));
+    initAttr.qp_type = IbvLib::QPT_RC;
+    initAttr.send_cq = reactor.getIbvCq().get();
+    initAttr.recv_cq = reactor.getIbvCq().get();
+    initAttr.cap.max_send_wr = kNumPendingReadReqs;
+    initAttr.cap.max_send_sge = 1;
+    initAttr.sq_sig_all = 1;
+    qp_ = createIbvQueuePair(reactor.getIbvLib(), reactor.getIbvPd(), initAttr);
+  }
+  transitionIbvQueuePairToInit(
+      reactor.getIbvLib(),
+      qp_,
+      reactor.getIbvAddress(),
+      IbvLib::ACCESS_REMOTE_READ);
+
+  reactor.deferToLoop([impl{shared_from_this()}]() {
+    impl->context_->getReactor().registerQp(impl->qp_->qp_num, impl);
+  });
+
+  ibvSelfInfo_ = makeIbvSetupInformation(reactor.getIbvAddress(), qp_);
+
+  TP_VLOG(6) << "Channel " << id_ << " is writing setup information";
+  connection_->write(
+      &ibvSelfInfo_, sizeof(ibvSelfInfo_), lazyCallbackWrapper_([](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing setup information";
+      }));
+
+  TP_VLOG(6) << "Channel " << id_ << " is reading setup information";
+  connection_->read(
+      &ibvPeerInfo_,
+      sizeof(ibvPeerInfo_),
+      lazyCallbackWrapper_([](Impl& impl,
+                              const void* /* unused */,
+                              size_t /* unused */) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done reading setup information";
+        impl.onPeerSetupInformation_();
+      }));
+}
+
+void Channel::Impl::onPeerSetupInformation_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, INITIALIZING);
+
+  Reactor& reactor = context_->getReactor();
+  transitionIbvQueuePairToReadyToReceive(
+      reactor.getIbvLib(), qp_, reactor.getIbvAddress(), ibvPeerInfo_);
+  transitionIbvQueuePairToReadyToSend(reactor.getIbvLib(), qp_, ibvSelfInfo_);
+
+  // The channel is usable now.
+  state_ = ESTABLISHED;
+  postReadsOfReadyRecvOperations_();
+  completeRecvOperations_();
+}
+
+void Channel::Impl::runWhenStreamIsDone_(
+    cudaStream_t stream,
+    Function<void()> fn) {
+  context_->getCudaLoop().addCallback(
+      stream,
+      [impl{shared_from_this()}, fn{std::move(fn)}](
+          const Error& error) mutable {
+        Impl& implRef = *impl;
+        implRef.loop_.deferToLoop(
+            [impl{std::move(impl)}, fn{std::move(fn)}, error]() {
+              impl->setError_(error);
+              fn();
+            });
+      });
+}
+
+void Channel::send(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  impl_->send(buffer, std::move(descriptorCallback), std::move(callback));
+}
+
+void Channel::Impl::send(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  loop_.deferToLoop([this,
+                     buffer,
+                     descriptorCallback{std::move(descriptorCallback)},
+                     callback{std::move(callback)}]() mutable {
+    sendFromLoop_(buffer, std::move(descriptorCallback), std::move(callback));
+  });
+}
+
+void Channel::Impl::sendFromLoop_(
+    CudaBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingSent_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a send request (#"
+             << sequenceNumber << ")";
+
+  descriptorCallback = [this,
+                        sequenceNumber,
+                        descriptorCallback{std::move(descriptorCallback)}](
+                           const Error& error, TDescriptor descriptor) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a descriptor callback (#"
+               << sequenceNumber << ")";
+    descriptorCallback(error, std::move(descriptor));
+    TP_VLOG(4) << "Channel " << id_ << " done calling a descriptor callback (#"
+               << sequenceNumber << ")";
+  };
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a send callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a send callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    descriptorCallback(error_, std::string());
+    callback(error_);
+    return;
+  }
+
+  sendOperations_.emplace_back();
+  SendOperation& op = sendOperations_.back();
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.descriptorCallback = std::move(descriptorCallback);
+  op.callback = std::move(callback);
+
+  // Registering empty regions isn't allowed, but then there's nothing to read.
+  if (buffer.length == 0) {
+    op.ready = true;
+    processSendOperations_();
+    return;
+  }
+
+  if (context_->useStaging()) {
+    op.stagingBuffer = allocateCudaHostBuffer(buffer.length);
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        op.stagingBuffer.get(),
+        buffer.ptr,
+        buffer.length,
+        cudaMemcpyDeviceToHost,
+        buffer.stream));
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is waiting for the stream (#"
+             << sequenceNumber << ")";
+  runWhenStreamIsDone_(buffer.stream, [this, sequenceNumber]() {
+    TP_VLOG(6) << "Channel " << id_ << " done waiting for the stream (#"
+               << sequenceNumber << ")";
+    auto iter = std::find_if(
+        sendOperations_.begin(),
+        sendOperations_.end(),
+        [&](const SendOperation& op) {
+          return op.sequenceNumber == sequenceNumber;
+        });
+    TP_DCHECK(iter != sendOperations_.end());
+    iter->ready = true;
+    processSendOperations_();
+  });
+}
+
+void Channel::Impl::processSendOperations_() {
+  TP_DCHECK(loop_.inLoop());
+
+  while (!sendOperations_.empty() && sendOperations_.front().ready) {
+    SendOperation op = std::move(sendOperations_.front());
+    sendOperations_.pop_front();
+
+    if (error_) {
+      op.descriptorCallback(error_, std::string());
+      op.callback(error_);
+      continue;
+    }
+
+    void* ptr = op.stagingBuffer ? op.stagingBuffer.get() : op.buffer.ptr;
+    IbvRegistrationCache::Handle mr;
+    if (op.buffer.length > 0) {
+      mr = context_->getRegistrationCache().registerRegion(
+          ptr, op.buffer.length);
+    }
+
+    NopHolder<Descriptor> nopHolder;
+    Descriptor& nopDescriptor = nopHolder.getObject();
+    nopDescriptor.ptr = reinterpret_cast<uint64_t>(ptr);
+    nopDescriptor.rkey = mr ? mr->rkey : 0;
+
+    // The buffer must remain registered until the peer is done reading it.
+    TP_VLOG(6) << "Channel " << id_ << " is reading notification (#"
+               << op.sequenceNumber << ")";
+    connection_->read(
+        nullptr,
+        0,
+        eagerCallbackWrapper_(
+            [sequenceNumber{op.sequenceNumber},
+             mr{std::move(mr)},
+             stagingBuffer{std::move(op.stagingBuffer)},
+             callback{std::move(op.callback)}](
+                Impl& impl,
+                const void* /* unused */,
+                size_t /* unused */) mutable {
+              TP_VLOG(6) << "Channel " << impl.id_
+                         << " done reading notification (#" << sequenceNumber
+                         << ")";
+              mr.reset();
+              stagingBuffer.reset();
+              callback(impl.error_);
+            }));
+
+    op.descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+  }
+}
+
+// Receive memory region from peer.
+void Channel::recv(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  impl_->recv(std::move(descriptor), buffer, std::move(callback));
+}
+
+void Channel::Impl::recv(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  loop_.deferToLoop([this,
+                     descriptor{std::move(descriptor)},
+                     buffer,
+                     callback{std::move(callback)}]() mutable {
+    recvFromLoop_(std::move(descriptor), buffer, std::move(callback));
+  });
+}
+
+void Channel::Impl::recvFromLoop_(
+    TDescriptor descriptor,
+    CudaBuffer buffer,
+    TRecvCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingReceived_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a recv request (#"
+             << sequenceNumber << ")";
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a recv callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a recv callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    callback(error_);
+    return;
+  }
+
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+  Descriptor& nopDescriptor = nopHolder.getObject();
+
+  recvOperations_.emplace_back();
+  RecvOperation& op = recvOperations_.back();
+  op.sequenceNumber = sequenceNumber;
+  op.buffer = buffer;
+  op.remotePtr = nopDescriptor.ptr;
+  op.remoteKey = nopDescriptor.rkey;
+  op.callback = std::move(callback);
+
+  // The staging buffer is ours, hence it can be written to right away, and
+  // the copy out of it will be ordered after the stream's previous work.
+  if (buffer.length == 0) {
+    op.ready = true;
+  } else if (context_->useStaging()) {
+    op.stagingBuffer = allocateCudaHostBuffer(buffer.length);
+    op.ready = true;
+  } else {
+    TP_VLOG(6) << "Channel " << id_ << " is waiting for the stream (#"
+               << sequenceNumber << ")";
+    runWhenStreamIsDone_(buffer.stream, [this, sequenceNumber]() {
+      TP_VLOG(6) << "Channel " << id_ << " done waiting for the stream (#"
+                 << sequenceNumber << ")";
+      auto iter = std::find_if(
+          recvOperations_.begin(),
+          recvOperations_.end(),
+          [&](const RecvOperation& op) {
+            return op.sequenceNumber == sequenceNumber;
+          });
+      // The operation may have been failed in the meantime.
+      if (iter == recvOperations_.end()) {
+        return;
+      }
+      iter->ready = true;
+      postReadsOfReadyRecvOperations_();
+      completeRecvOperations_();
+    });
+  }
+
+  postReadsOfReadyRecvOperations_();
+  completeRecvOperations_();
+}
+
+void Channel::Impl::postReadsOfReadyRecvOperations_() {
+  TP_DCHECK(loop_.inLoop());
+
+  // Before the queue pair is established the reads are deferred until it is.
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+  // Reads complete in the order in which they are posted, which we rely upon
+  // to know which operation they belong to.
+  for (auto& op : recvOperations_) {
+    if (op.readsPosted) {
+      continue;
+    }
+    if (!op.ready) {
+      break;
+    }
+    postReads_(op);
+  }
+}
+
+void Channel::Impl::postReads_(RecvOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  op.readsPosted = true;
+  if (op.buffer.length == 0) {
+    return;
+  }
+
+  Reactor& reactor = context_->getReactor();
+  void* ptr = op.stagingBuffer ? op.stagingBuffer.get() : op.buffer.ptr;
+  op.mr = context_->getRegistrationCache().registerRegion(
+      ptr, op.buffer.length);
+
+  TP_VLOG(6) << "Channel " << id_ << " is reading payload (#"
+             << op.sequenceNumber << ")";
+  for (size_t offset = 0; offset < op.buffer.length; offset += kMaxReadSize) {
+    IbvLib::sge list;
+    list.addr = reinterpret_cast<uint64_t>(ptr) + offset;
+    list.length = std::min(op.buffer.length - offset, kMaxReadSize);
+    list.lkey = op.mr->lkey;
+
+    IbvLib::send_wr wr;
+    std::memset(&wr, 0, sizeof(wr));
+    wr.wr_id = op.sequenceNumber;
+    wr.num_sge = 1;
+    wr.opcode = IbvLib::WR_RDMA_READ;
+    wr.wr.rdma.remote_addr = op.remotePtr + offset;
+    wr.wr.rdma.rkey = op.remoteKey;
+
+    reactor.deferToLoop([impl{shared_from_this()}, wr, list]() mutable {
+      wr.sg_list = &list;
+      impl->context_->getReactor().postRead(impl->qp_, wr);
+    });
+    op.numPendingReads++;
+    numReadsInFlight_++;
+  }
+}
+
+void Channel::Impl::onReadCompleted() {
+  loop_.deferToLoop(
+      [impl{shared_from_this()}]() { impl->onReadCompletedFromLoop_(); });
+}
+
+void Channel::Impl::onError(IbvLib::wc_status status, uint64_t wr_id) {
+  loop_.deferToLoop([impl{shared_from_this()}, status, wr_id]() {
+    TP_VLOG(6) << "Channel " << impl->id_
+               << " got a failed RDMA read (#" << wr_id << ")";
+    impl->setError_(TP_CREATE_ERROR(
+        ibv::IbvError,
+        impl->context_->getReactor().getIbvLib().wc_status_str(status)));
+    impl->onReadCompletedFromLoop_();
+  });
+}
+
+void Channel::Impl::onReadCompletedFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+
+  // Reads complete in the order in which they were posted, hence they belong
+  // to the first operation that still has some pending.
+  auto iter = std::find_if(
+      recvOperations_.begin(),
+      recvOperations_.end(),
+      [](const RecvOperation& op) { return op.numPendingReads > 0; });
+  TP_DCHECK(iter != recvOperations_.end());
+  iter->numPendingReads--;
+  numReadsInFlight_--;
+
+  completeRecvOperations_();
+  tryCleanup_();
+}
+
+void Channel::Impl::completeRecvOperations_() {
+  TP_DCHECK(loop_.inLoop());
+
+  // Unless we're in an error state, operations must wait for their reads to
+  // have been posted, and to have completed.
+  while (!recvOperations_.empty() &&
+         (recvOperations_.front().readsPosted || error_) &&
+         recvOperations_.front().numPendingReads == 0) {
+    RecvOperation op = std::move(recvOperations_.front());
+    recvOperations_.pop_front();
+    op.mr.reset();
+
+    TP_VLOG(6) << "Channel " << id_ << " done reading payload (#"
+               << op.sequenceNumber << ")";
+
+    // Let peer know we've completed the copy.
+    TP_VLOG(6) << "Channel " << id_ << " is writing notification (#"
+               << op.sequenceNumber << ")";
+    connection_->write(
+        nullptr,
+        0,
+        lazyCallbackWrapper_([sequenceNumber{op.sequenceNumber}](Impl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_
+                     << " done writing notification (#" << sequenceNumber
+                     << ")";
+        }));
+
+    // The copy into the tensor is ordered before any work the user enqueues
+    // after the callback, but the staging buffer must outlive it.
+    if (op.stagingBuffer && !error_) {
+      TP_CUDA_CHECK(cudaMemcpyAsync(
+          op.buffer.ptr,
+          op.stagingBuffer.get(),
+          op.buffer.length,
+          cudaMemcpyHostToDevice,
+          op.buffer.stream));
+      runWhenStreamIsDone_(
+          op.buffer.stream,
+          [stagingBuffer{std::move(op.stagingBuffer)}]() mutable {
+            stagingBuffer.reset();
+          });
+    }
+
+    op.callback(error_);
+  }
+}
+
+void Channel::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Channel::Impl::setId(std::string id) {
+  loop_.deferToLoop(
+      [this, id{std::move(id)}]() mutable { setIdFromLoop_(std::move(id)); });
+}
+
+void Channel::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Channel::close() {
+  impl_->close();
+}
+
+Channel::~Channel() {
+  close();
+}
+
+void Channel::Impl::close() {
+  loop_.deferToLoop([this]() { closeFromLoop_(); });
+}
+
+void Channel::Impl::closeFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ChannelClosedError));
+}
+
+void Channel::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError_();
+}
+
+void Channel::Impl::handleError_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(5) << "Channel " << id_ << " is handling error " << error_.what();
+
+  connection_->close();
+
+  // This flushes all the RDMA reads, which will then complete with an error.
+  // Until they do, the buffers of their operations must stay registered.
+  transitionIbvQueuePairToError(context_->getReactor().getIbvLib(), qp_);
+
+  // The send operations that are still waiting for their stream will be failed
+  // once it's done, as until then their staging buffers may still be written.
+  processSendOperations_();
+  completeRecvOperations_();
+  tryCleanup_();
+}
+
+void Channel::Impl::tryCleanup_() {
+  TP_DCHECK(loop_.inLoop());
+  if (error_ && numReadsInFlight_ == 0) {
+    TP_VLOG(5) << "Channel " << id_ << " is ready to clean up";
+    context_->getReactor().deferToLoop(
+        [impl{shared_from_this()}]() { impl->cleanupFromReactor_(); });
+  }
+}
+
+void Channel::Impl::cleanupFromReactor_() {
+  TP_DCHECK(context_->getReactor().inLoop());
+  context_->getReactor().unregisterQp(qp_->qp_num);
+  qp_.reset();
+}
+
+} // namespace cuda_gdr
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/cuda_gdr/context.h>
+
+#include <unistd.h>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/channel/cuda_gdr/channel.h>
+#include <tensorpipe/channel/cuda_gdr/context_impl.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/ibv.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_gdr {
+
+namespace {
+
+// As for the ibv channel, there's no way to tell which InfiniBand subnet the
+// device belongs to, hence we trust users to connect processes that can reach
+// each other.
+const std::string kDomainDescriptor{"cuda_gdr:*"};
+
+// The kernel modules that let InfiniBand devices access GPU memory: the one
+// that ships with the NVIDIA driver, and the older standalone one.
+bool isGpuDirectRdmaAvailable() {
+  return ::access("/sys/module/nvidia_peermem", F_OK) == 0 ||
+      ::access("/sys/kernel/mm/memory_peers/nv_mem/version", F_OK) == 0;
+}
+
+bool isCudaAvailable() {
+  int numDevices = 0;
+  return cudaGetDeviceCount(&numDevices) == cudaSuccess && numDevices > 0;
+}
+
+} // namespace
+
+class Context::Impl : public Context::PrivateIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(IbvDeviceOptions deviceOptions, bool forceStaging);
+
+  bool isViable() const;
+
+  const std::string& domainDescriptor() const;
+
+  std::shared_ptr<void> registerBuffer(CudaBuffer buffer);
+
+  std::shared_ptr<channel::CudaChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint);
+
+  void setId(std::string id);
+
+  ClosingEmitter& getClosingEmitter() override;
+
+  Reactor& getReactor() override;
+
+  CudaLoop& getCudaLoop() override;
+
+  IbvRegistrationCache& getRegistrationCache() override;
+
+  bool useStaging() override;
+
+  void close();
+
+  void join();
+
+  ~Impl() override = default;
+
+ private:
+  Reactor reactor_;
+  // Used without a capacity, hence never caching anything, since nothing tells
+  // us when GPU memory is freed and, in the staged path, the pinned buffers
+  // are allocated for each transfer. Only the buffers pinned by the user, who
+  // vouches for them staying alive, are kept registered.
+  IbvRegistrationCache registrationCache_;
+  CudaLoop cudaLoop_;
+  const bool isCudaAvailable_;
+  const bool useStaging_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  ClosingEmitter closingEmitter_;
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the channel's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Sequence numbers for the channels created by this context, used to create
+  // their identifiers based off this context's identifier. They will only be
+  // used for logging and debugging.
+  std::atomic<uint64_t> channelCounter_{0};
+};
+
+Context::Context(IbvDeviceOptions deviceOptions, bool forceStaging)
+    : impl_(std::make_shared<Context::Impl>(
+          std::move(deviceOptions),
+          forceStaging)) {}
+
+Context::Impl::Impl(IbvDeviceOptions deviceOptions, bool forceStaging)
+    : reactor_(BusyPollingPolicy(), std::move(deviceOptions)),
+      registrationCache_(
+          reactor_.getIbvLib(),
+          reactor_.getIbvPd(),
+          IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_READ,
+          /*capacity=*/0),
+      isCudaAvailable_(isCudaAvailable()),
+      useStaging_(forceStaging || !isGpuDirectRdmaAvailable()) {
+  if (useStaging_) {
+    TP_VLOG(4) << "Channel context " << id_
+               << " will stage tensors through host memory";
+  }
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is closing";
+
+    closingEmitter_.close();
+    reactor_.close();
+    cudaLoop_.close();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done closing";
+  }
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is joining";
+
+    reactor_.join();
+    cudaLoop_.join();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(4) << "Channel context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  reactor_.setId(id_);
+}
+
+ClosingEmitter& Context::Impl::getClosingEmitter() {
+  return closingEmitter_;
+}
+
+Reactor& Context::Impl::getReactor() {
+  return reactor_;
+}
+
+CudaLoop& Context::Impl::getCudaLoop() {
+  return cudaLoop_;
+}
+
+IbvRegistrationCache& Context::Impl::getRegistrationCache() {
+  return registrationCache_;
+}
+
+bool Context::Impl::useStaging() {
+  return useStaging_;
+}
+
+std::shared_ptr<void> Context::registerBuffer(CudaBuffer buffer) {
+  return impl_->registerBuffer(buffer);
+}
+
+std::shared_ptr<void> Context::Impl::registerBuffer(CudaBuffer buffer) {
+  // The staged path registers its own pinned host buffers instead.
+  if (buffer.length == 0 || useStaging_ || !isViable()) {
+    return nullptr;
+  }
+  return std::const_pointer_cast<IbvLib::mr>(
+      registrationCache_.pinRegion(buffer.ptr, buffer.length));
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+bool Context::Impl::isViable() const {
+  return reactor_.isViable() && isCudaAvailable_;
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return kDomainDescriptor;
+}
+
+std::shared_ptr<channel::CudaChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+std::shared_ptr<channel::CudaChannel> Context::Impl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  TP_THROW_ASSERT_IF(joined_);
+  std::string channelId = id_ + ".c" + std::to_string(channelCounter_++);
+  TP_VLOG(4) << "Channel context " << id_ << " is opening channel "
+             << channelId;
+  return std::make_shared<Channel>(
+      Channel::ConstructorToken(),
+      std::static_pointer_cast<PrivateIface>(shared_from_this()),
+      std::move(connection),
+      std::move(channelId));
+}
+
+} // namespace cuda_gdr
+} // namespace channel
+} // namespace tensorpipe
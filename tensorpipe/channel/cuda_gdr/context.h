@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cuda_context.h>
+#include <tensorpipe/common/ibv_device_options.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_gdr {
+
+class Channel;
+
+// Transfers CUDA tensors across machines by having the receiver issue RDMA
+// reads from the sender's GPU memory straight into its own, which requires
+// GPUDirect RDMA (i.e., the nvidia-peermem or nv_peer_mem kernel module). When
+// that isn't available, or if staging is forced, each side instead goes
+// through a pinned host buffer, which it copies the tensor from or into on the
+// tensor's stream.
+class Context final : public channel::CudaContext {
+ public:
+  explicit Context(
+      IbvDeviceOptions deviceOptions = IbvDeviceOptions(),
+      bool forceStaging = false);
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  // Keeps the buffer registered, unless tensors are staged.
+  std::shared_ptr<void> registerBuffer(CudaBuffer buffer) override;
+
+  std::shared_ptr<CudaChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow channel to see the private interface.
+  friend class Channel;
+};
+
+} // namespace cuda_gdr
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/channel/cuda_gdr/context.h>
+#include <tensorpipe/channel/ibv/reactor.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda_loop.h>
+#include <tensorpipe/common/ibv.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace cuda_gdr {
+
+// The reactor of the ibv channel is reused as is, since the transfers consist
+// of the same RDMA reads, only on different memory.
+using channel::ibv::IbvEventHandler;
+using channel::ibv::Reactor;
+
+class Context::PrivateIface {
+ public:
+  virtual ClosingEmitter& getClosingEmitter() = 0;
+
+  virtual Reactor& getReactor() = 0;
+
+  virtual CudaLoop& getCudaLoop() = 0;
+
+  virtual IbvRegistrationCache& getRegistrationCache() = 0;
+
+  // Whether tensors must go through pinned host memory, as the device can't
+  // access GPU memory directly.
+  virtual bool useStaging() = 0;
+
+  virtual ~PrivateIface() = default;
+};
+
+} // namespace cuda_gdr
+} // namespace channel
+} // namespace tensorpipe
@@ -14,7 +14,11 @@
 #include <algorithm>
 #include <limits>
 #include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
+#include <cuda.h>
 #include <cuda_runtime.h>
 
 #include <nop/structure.h>
@@ -24,6 +28,7 @@
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/common/error_macros.h>
@@ -32,52 +37,132 @@
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/connection.h>
 
-#define TP_CUDA_CHECK(a)                                                      \
-  TP_THROW_ASSERT_IF(cudaSuccess != (a))                                      \
-      << __TP_EXPAND_OPD(a) << " " << cudaGetErrorName(cudaPeekAtLastError()) \
-      << " (" << cudaGetErrorString(cudaPeekAtLastError()) << ")"
-
 namespace tensorpipe {
 namespace channel {
 namespace cuda_ipc {
 
 namespace {
 
+// Contiguous copies longer than this are split in chunks of this length, which
+// are spread over the context's copy streams.
+constexpr size_t kCopyChunkLength = 32 * 1024 * 1024;
+
+// A chunk of a VMM allocation, whose file descriptor the receiver fetches from
+// the sender's process.
+struct VmmChunk {
+  // This pointless constructor is needed to work around a bug in GCC 5.5 (and
+  // possibly other versions). It appears to be needed in the nop types that are
+  // used inside std::vectors.
+  VmmChunk(){};
+
+  uint64_t exportId;
+  uint64_t length;
+  int32_t fd;
+  NOP_STRUCTURE(VmmChunk, exportId, length, fd);
+};
+
+// The IPC handle of a pointer is the one of the whole allocation it belongs
+// to, which the receiver maps at an address of its own, hence the offset. The
+// rest identifies the allocation, for the receiver to reuse its mapping. For
+// VMM allocations, the handle is empty and the chunks that the buffer spans
+// are sent instead, with the base address of the first one.
 struct Descriptor {
   std::string handle;
+  uint32_t pid;
+  std::vector<VmmChunk> vmmChunks;
+  uint64_t uniqueId;
+  uint64_t basePtr;
+  uint64_t bufferId;
+  uint64_t offset;
+  // The layout of the sender's buffer, if it's strided (see CudaBuffer).
+  uint64_t pitch;
+  uint64_t width;
+  uint64_t height;
+  // Events are identified by their index in the pool of their creator, and
+  // their handle is only sent along the first time they're used.
+  uint64_t startEvIndex;
   std::string startEvHandle;
-  NOP_STRUCTURE(Descriptor, handle, startEvHandle);
+  NOP_STRUCTURE(
+      Descriptor,
+      handle,
+      pid,
+      vmmChunks,
+      uniqueId,
+      basePtr,
+      bufferId,
+      offset,
+      pitch,
+      width,
+      height,
+      startEvIndex,
+      startEvHandle);
 };
 
 struct Reply {
+  // This pointless constructor is needed to work around a bug in GCC 5.5 (and
+  // possibly other versions). It appears to be needed in the nop types that are
+  // used inside std::vectors.
+  Reply(){};
+
+  uint64_t stopEvIndex;
   std::string stopEvHandle;
-  NOP_STRUCTURE(Reply, stopEvHandle);
+  NOP_STRUCTURE(Reply, stopEvIndex, stopEvHandle);
+};
+
+// The replies to a batch of recv operations (e.g., to all the tensors of a
+// message), in order, which the peer acknowledges all at once.
+struct Replies {
+  std::vector<Reply> replies;
+  NOP_STRUCTURE(Replies, replies);
 };
 
 struct Ack {
-  NOP_STRUCTURE(Ack);
+  uint64_t numOperations;
+  NOP_STRUCTURE(Ack, numOperations);
 };
 
-using Packet = nop::Variant<Reply, Ack>;
+using Packet = nop::Variant<Replies, Ack>;
 
 class CudaEvent {
  public:
-  explicit CudaEvent(int device) {
+  explicit CudaEvent(int device, bool interprocess = true) {
     TP_CUDA_CHECK(cudaSetDevice(device));
     TP_CUDA_CHECK(cudaEventCreateWithFlags(
-        &ev_, cudaEventDisableTiming | cudaEventInterprocess));
+        &ev_,
+        interprocess ? cudaEventDisableTiming | cudaEventInterprocess
+                     : cudaEventDisableTiming));
   }
 
   explicit CudaEvent(cudaIpcEventHandle_t handle) {
     TP_CUDA_CHECK(cudaIpcOpenEventHandle(&ev_, handle));
   }
 
-  void record(cudaStream_t stream) {
-    TP_CUDA_CHECK(cudaEventRecord(ev_, stream));
+  // On a stream that's being captured into a CUDA graph, the record or the wait
+  // of an event shared with the peer must be external, for the graph to perform
+  // it each time it's launched, rather than just ordering the captured work.
+  void record(cudaStream_t stream, bool external = false) {
+    if (!external) {
+      TP_CUDA_CHECK(cudaEventRecord(ev_, stream));
+      return;
+    }
+#if (CUDART_VERSION >= 11010)
+    TP_CUDA_CHECK(
+        cudaEventRecordWithFlags(ev_, stream, cudaEventRecordExternal));
+#else
+    TP_THROW_ASSERT() << "Capturing transfers requires CUDA 11.1 or later";
+#endif
   }
 
-  void wait(cudaStream_t stream) {
-    TP_CUDA_CHECK(cudaStreamWaitEvent(stream, ev_, 0));
+  void wait(cudaStream_t stream, bool external = false) {
+    if (!external) {
+      TP_CUDA_CHECK(cudaStreamWaitEvent(stream, ev_, 0));
+      return;
+    }
+#if (CUDART_VERSION >= 11010)
+    TP_CUDA_CHECK(cudaStreamWaitEvent(stream, ev_, cudaEventWaitExternal));
+#else
+    TP_THROW_ASSERT() << "Capturing transfers requires CUDA 11.1 or later";
+#endif
   }
 
   std::string serializedHandle() {
@@ -95,95 +180,261 @@ class CudaEvent {
   cudaEvent_t ev_;
 };
 
-int cudaDeviceForPointer(const void* ptr) {
-  cudaPointerAttributes attrs;
-  TP_CUDA_CHECK(cudaPointerGetAttributes(&attrs, ptr));
-#if (CUDART_VERSION >= 10000)
-  TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.type);
-#else
-  TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.memoryType);
-#endif
-  return attrs.device;
-}
+// Interprocess events are costly to create, to export and to open, hence each
+// channel keeps the ones it created for reuse, and the peer keeps them open. An
+// event can be recycled once the peer has enqueued its wait on it, as further
+// records don't affect waits that were enqueued before them.
+class CudaEventPool {
+ public:
+  // Return the index of an event of the device that's not in use, creating it
+  // if there's none.
+  size_t acquire(int device) {
+    std::vector<size_t>& freeIndices = freeIndices_[device];
+    if (!freeIndices.empty()) {
+      size_t index = freeIndices.back();
+      freeIndices.pop_back();
+      return index;
+    }
+    entries_.emplace_back();
+    Entry& entry = entries_.back();
+    entry.device = device;
+    entry.event = std::make_unique<CudaEvent>(device);
+    return entries_.size() - 1;
+  }
+
+  CudaEvent& get(size_t index) {
+    return *entries_[index].event;
+  }
+
+  // Return the serialized handle of the event if the peer hasn't seen it yet,
+  // or an empty string otherwise, as the peer already has it open.
+  std::string handleForPeer(size_t index) {
+    Entry& entry = entries_[index];
+    if (entry.handleSent) {
+      return std::string();
+    }
+    entry.handleSent = true;
+    return entry.event->serializedHandle();
+  }
+
+  void release(size_t index) {
+    freeIndices_[entries_[index].device].push_back(index);
+  }
+
+ private:
+  struct Entry {
+    int device;
+    std::unique_ptr<CudaEvent> event;
+    bool handleSent{false};
+  };
+  std::vector<Entry> entries_;
+  std::unordered_map<int, std::vector<size_t>> freeIndices_;
+};
+
+// The copy streams of a device, with the events through which a copy forks
+// from the user's stream onto them and then joins back. The events can be
+// recorded again right after their waits were enqueued, hence one of each per
+// stream is enough for any number of copies.
+struct CopyStreams {
+  const std::vector<cudaStream_t>& streams;
+  CudaEvent forkEv;
+  std::vector<std::unique_ptr<CudaEvent>> joinEvs;
+
+  CopyStreams(int device, const std::vector<cudaStream_t>& streams)
+      : streams(streams), forkEv(device, /*interprocess=*/false) {
+    for (size_t streamIdx = 0; streamIdx < streams.size(); streamIdx++) {
+      joinEvs.push_back(
+          std::make_unique<CudaEvent>(device, /*interprocess=*/false));
+    }
+  }
+};
+
+// The events of the peer's pool that we have opened, by index.
+class PeerCudaEvents {
+ public:
+  CudaEvent& get(size_t index, const std::string& serializedHandle) {
+    if (!serializedHandle.empty()) {
+      if (index >= events_.size()) {
+        events_.resize(index + 1);
+      }
+      events_[index] = std::make_unique<CudaEvent>(
+          *reinterpret_cast<const cudaIpcEventHandle_t*>(
+              serializedHandle.c_str()));
+    }
+    TP_DCHECK(index < events_.size() && events_[index] != nullptr);
+    return *events_[index];
+  }
+
+ private:
+  std::vector<std::unique_ptr<CudaEvent>> events_;
+};
 
+// If the user's stream is being captured into a CUDA graph, only the record and
+// the wait of the events, and the copy, end up in the graph, whereas all the
+// rest is done at capture time. Each launch of the graph then records the same
+// events again, and waits on the same events of the peer, hence they aren't
+// recycled, and the peer must capture the matching operations and launch its
+// graph in lockstep.
 class SendOperation {
  public:
   uint64_t sequenceNumber;
   TSendCallback callback;
+  const size_t startEvIndex;
+  const bool captured;
 
   SendOperation(
       uint64_t sequenceNumber,
       TSendCallback callback,
-      const void* ptr,
-      cudaStream_t stream)
+      CudaBuffer buffer,
+      size_t startEvIndex,
+      CudaEvent& startEv,
+      bool captured)
       : sequenceNumber(sequenceNumber),
         callback(std::move(callback)),
-        ptr_(ptr),
-        stream_(stream),
-        startEv_(cudaDeviceForPointer(ptr)) {
-    startEv_.record(stream_);
+        startEvIndex(startEvIndex),
+        captured(captured),
+        buffer_(buffer) {
+    startEv.record(buffer_.stream, captured);
   }
 
-  Descriptor descriptor() {
+  // The allocation's handle is only exported here if it wasn't beforehand. The
+  // chunks of a VMM allocation are kept alive until the peer is done.
+  Descriptor descriptor(
+      uint64_t uniqueId,
+      std::string startEvHandle,
+      const ExportedIpcMemHandle* exported,
+      std::vector<std::shared_ptr<const ExportedVmmChunk>> vmmChunks) {
+    const CUdeviceptr ptr = reinterpret_cast<CUdeviceptr>(buffer_.ptr);
+    if (!vmmChunks.empty()) {
+      vmmChunks_ = std::move(vmmChunks);
+      Descriptor nopDescriptor;
+      nopDescriptor.pid = ::getpid();
+      for (const auto& chunk : vmmChunks_) {
+        VmmChunk nopChunk;
+        nopChunk.exportId = chunk->exportId;
+        nopChunk.length = chunk->length;
+        nopChunk.fd = chunk->fd.fd();
+        nopDescriptor.vmmChunks.push_back(nopChunk);
+      }
+      nopDescriptor.uniqueId = uniqueId;
+      nopDescriptor.basePtr = vmmChunks_.front()->basePtr;
+      nopDescriptor.bufferId = 0;
+      nopDescriptor.offset = ptr - vmmChunks_.front()->basePtr;
+      nopDescriptor.pitch = buffer_.pitch;
+      nopDescriptor.width = buffer_.width;
+      nopDescriptor.height = buffer_.height;
+      nopDescriptor.startEvIndex = startEvIndex;
+      nopDescriptor.startEvHandle = std::move(startEvHandle);
+      return nopDescriptor;
+    }
+
     cudaIpcMemHandle_t handle;
-    TP_CUDA_CHECK(cudaIpcGetMemHandle(&handle, const_cast<void*>(ptr_)));
+    CUdeviceptr basePtr;
+    unsigned long long bufferId;
+    if (exported != nullptr) {
+      handle = exported->handle;
+      basePtr = exported->basePtr;
+      bufferId = exported->bufferId;
+    } else {
+      TP_CUDA_CHECK(cudaIpcGetMemHandle(&handle, buffer_.ptr));
+      // Buffer IDs are never reused within a process, unlike addresses.
+      TP_CU_CHECK(cuMemGetAddressRange(&basePtr, nullptr, ptr));
+      TP_CU_CHECK(cuPointerGetAttribute(
+          &bufferId, CU_POINTER_ATTRIBUTE_BUFFER_ID, ptr));
+    }
 
     return Descriptor{
         std::string(reinterpret_cast<const char*>(&handle), sizeof(handle)),
-        startEv_.serializedHandle()};
+        /*pid=*/0,
+        /*vmmChunks=*/{},
+        uniqueId,
+        basePtr,
+        bufferId,
+        ptr - basePtr,
+        buffer_.pitch,
+        buffer_.width,
+        buffer_.height,
+        startEvIndex,
+        std::move(startEvHandle)};
   }
 
-  void process(const cudaIpcEventHandle_t& stopEvHandle) {
-    CudaEvent stopEv(stopEvHandle);
-    stopEv.wait(stream_);
+  void process(CudaEvent& stopEv) {
+    stopEv.wait(buffer_.stream, captured);
   }
 
  private:
-  const void* ptr_;
-  cudaStream_t stream_;
-  CudaEvent startEv_;
+  CudaBuffer buffer_;
+  std::vector<std::shared_ptr<const ExportedVmmChunk>> vmmChunks_;
 };
 
 struct RecvOperation {
  public:
   uint64_t sequenceNumber;
+  const size_t stopEvIndex;
+  const bool captured;
 
   RecvOperation(
       uint64_t sequenceNumber,
-      void* ptr,
-      cudaStream_t stream,
-      size_t length)
+      CudaBuffer buffer,
+      size_t stopEvIndex,
+      bool captured)
       : sequenceNumber(sequenceNumber),
-        ptr_(ptr),
-        stream_(stream),
-        length_(length),
-        stopEv_(cudaDeviceForPointer(ptr)) {}
-
-  Reply reply() {
-    return Reply{stopEv_.serializedHandle()};
+        stopEvIndex(stopEvIndex),
+        captured(captured),
+        buffer_(buffer) {}
+
+  Reply reply(std::string stopEvHandle) {
+    Reply nopReply;
+    nopReply.stopEvIndex = stopEvIndex;
+    nopReply.stopEvHandle = std::move(stopEvHandle);
+    return nopReply;
   }
 
+  // Either buffer may be strided, in which case this is a 2D copy. Otherwise,
+  // if given copy streams, a long copy is split in chunks over them, in order,
+  // which lets them run on several copy engines at once. (Not when captured,
+  // as the copy streams are shared with other channels.)
   void process(
-      const cudaIpcEventHandle_t& startEvHandle,
-      const cudaIpcMemHandle_t& remoteHandle) {
-    CudaEvent startEv(startEvHandle);
-    startEv.wait(stream_);
-
-    void* remotePtr;
-    TP_CUDA_CHECK(cudaIpcOpenMemHandle(
-        &remotePtr, remoteHandle, cudaIpcMemLazyEnablePeerAccess));
-    TP_CUDA_CHECK(cudaMemcpyAsync(
-        ptr_, remotePtr, length_, cudaMemcpyDeviceToDevice, stream_));
-    TP_CUDA_CHECK(cudaIpcCloseMemHandle(remotePtr));
-
-    stopEv_.record(stream_);
+      CudaEvent& startEv,
+      CudaEvent& stopEv,
+      CudaBuffer remote,
+      CopyStreams* copyStreams) {
+    startEv.wait(buffer_.stream, captured);
+
+    if (copyStreams == nullptr || captured || isStrided(buffer_) ||
+        isStrided(remote) || buffer_.length <= kCopyChunkLength) {
+      copyCudaBufferAsync(
+          buffer_, remote, cudaMemcpyDeviceToDevice, buffer_.stream);
+    } else {
+      const size_t numChunks =
+          (buffer_.length + kCopyChunkLength - 1) / kCopyChunkLength;
+      const size_t numStreams =
+          std::min(numChunks, copyStreams->streams.size());
+      copyStreams->forkEv.record(buffer_.stream);
+      for (size_t streamIdx = 0; streamIdx < numStreams; streamIdx++) {
+        copyStreams->forkEv.wait(copyStreams->streams[streamIdx]);
+      }
+      for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+        const size_t offset = chunkIdx * kCopyChunkLength;
+        TP_CUDA_CHECK(cudaMemcpyAsync(
+            static_cast<uint8_t*>(buffer_.ptr) + offset,
+            static_cast<uint8_t*>(remote.ptr) + offset,
+            std::min(kCopyChunkLength, buffer_.length - offset),
+            cudaMemcpyDeviceToDevice,
+            copyStreams->streams[chunkIdx % numStreams]));
+      }
+      for (size_t streamIdx = 0; streamIdx < numStreams; streamIdx++) {
+        CudaEvent& joinEv = *copyStreams->joinEvs[streamIdx];
+        joinEv.record(copyStreams->streams[streamIdx]);
+        joinEv.wait(buffer_.stream);
+      }
+    }
+
+    stopEv.record(buffer_.stream, captured);
   }
 
  private:
-  void* ptr_;
-  cudaStream_t stream_;
-  size_t length_;
-  CudaEvent stopEv_;
+  CudaBuffer buffer_;
 };
 
 } // namespace
@@ -205,6 +456,10 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
 
   void recv(TDescriptor descriptor, CudaBuffer buffer, TRecvCallback callback);
 
+  void beginBatch();
+
+  void endBatch();
+
   // Tell the channel what its identifier is.
   void setId(std::string id);
 
@@ -227,9 +482,16 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
       CudaBuffer buffer,
       TRecvCallback callback);
 
+  void beginBatchFromLoop_();
+  void endBatchFromLoop_();
+
+  // Write the replies of the recv operations that were performed since the
+  // last time, unless we're in the middle of a batch.
+  void writeReplies_();
+
   void readPackets_();
-  void onReply_(const Reply& nopReply);
-  void onAck_();
+  void onReplies_(const Replies& nopReplies);
+  void onAck_(const Ack& nopAck);
 
   void closeFromLoop_();
 
@@ -259,6 +521,20 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
   // List of alive recv operations.
   std::list<RecvOperation> recvOperations_;
 
+  // How many batches we're in (as they may be nested), and the replies of the
+  // recv operations that were performed since they began.
+  size_t batchDepth_{0};
+  std::vector<Reply> pendingReplies_;
+
+  // The events we record, which the peer waits on, and the peer's ones, which
+  // we wait on.
+  CudaEventPool eventPool_;
+  PeerCudaEvents peerEvents_;
+
+  // The copy streams of the devices we've received into, and our events on
+  // them, by device.
+  std::unordered_map<int, std::unique_ptr<CopyStreams>> copyStreams_;
+
   // An identifier for the channel, composed of the identifier for the context,
   // combined with an increasing sequence number. It will only be used for
   // logging and debugging purposes.
@@ -358,12 +634,37 @@ void Channel::Impl::sendFromLoop_(
     return;
   }
 
+  const bool captured = isCudaStreamCapturing(buffer.stream);
+  std::unique_ptr<CudaRelaxedCaptureGuard> captureGuard;
+  if (captured) {
+    captureGuard = std::make_unique<CudaRelaxedCaptureGuard>();
+  }
+
+  std::shared_ptr<const ExportedIpcMemHandle> exported =
+      context_->findExportedIpcMemHandle(buffer.ptr);
+  std::vector<std::shared_ptr<const ExportedVmmChunk>> vmmChunks;
+  if (exported == nullptr) {
+    vmmChunks =
+        context_->exportVmmChunks(buffer.ptr, getCudaBufferExtent(buffer));
+  }
+  const size_t startEvIndex = eventPool_.acquire(
+      exported != nullptr ? exported->device
+                          : cudaDeviceForPointer(buffer.ptr));
   sendOperations_.emplace_back(
-      sequenceNumber, std::move(callback), buffer.ptr, buffer.stream);
+      sequenceNumber,
+      std::move(callback),
+      buffer,
+      startEvIndex,
+      eventPool_.get(startEvIndex),
+      captured);
   auto& op = sendOperations_.back();
 
   NopHolder<Descriptor> nopHolder;
-  nopHolder.getObject() = op.descriptor();
+  nopHolder.getObject() = op.descriptor(
+      context_->getUniqueId(),
+      eventPool_.handleForPeer(startEvIndex),
+      exported.get(),
+      std::move(vmmChunks));
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
 
@@ -410,24 +711,63 @@ void Channel::Impl::recvFromLoop_(
     return;
   }
 
-  recvOperations_.emplace_back(
-      sequenceNumber, buffer.ptr, buffer.stream, buffer.length);
+  const bool captured = isCudaStreamCapturing(buffer.stream);
+  std::unique_ptr<CudaRelaxedCaptureGuard> captureGuard;
+  if (captured) {
+    captureGuard = std::make_unique<CudaRelaxedCaptureGuard>();
+  }
+
+  const int device = cudaDeviceForPointer(buffer.ptr);
+  const size_t stopEvIndex = eventPool_.acquire(device);
+  recvOperations_.emplace_back(sequenceNumber, buffer, stopEvIndex, captured);
   auto& op = recvOperations_.back();
 
   NopHolder<Descriptor> nopHolder;
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
-  const cudaIpcEventHandle_t* startEvHandle =
-      reinterpret_cast<const cudaIpcEventHandle_t*>(
-          nopDescriptor.startEvHandle.c_str());
-  const cudaIpcMemHandle_t* remoteHandle =
-      reinterpret_cast<const cudaIpcMemHandle_t*>(nopDescriptor.handle.c_str());
+  CudaEvent& startEv = peerEvents_.get(
+      nopDescriptor.startEvIndex, nopDescriptor.startEvHandle);
+  void* remoteBasePtr;
+  if (!nopDescriptor.vmmChunks.empty()) {
+    std::vector<RemoteVmmChunk> remoteChunks;
+    for (const VmmChunk& nopChunk : nopDescriptor.vmmChunks) {
+      remoteChunks.push_back(
+          RemoteVmmChunk{nopChunk.exportId, nopChunk.length, nopChunk.fd});
+    }
+    remoteBasePtr = context_->mapVmmChunks(
+        nopDescriptor.uniqueId,
+        static_cast<pid_t>(nopDescriptor.pid),
+        nopDescriptor.basePtr,
+        remoteChunks);
+  } else {
+    const cudaIpcMemHandle_t* remoteHandle =
+        reinterpret_cast<const cudaIpcMemHandle_t*>(
+            nopDescriptor.handle.c_str());
+    remoteBasePtr = context_->openIpcMemHandle(
+        nopDescriptor.uniqueId,
+        nopDescriptor.basePtr,
+        nopDescriptor.bufferId,
+        *remoteHandle);
+  }
 
   // Perform copy.
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
 
-  op.process(*startEvHandle, *remoteHandle);
+  CudaBuffer remoteBuffer;
+  remoteBuffer.ptr =
+      static_cast<uint8_t*>(remoteBasePtr) + nopDescriptor.offset;
+  remoteBuffer.length = buffer.length;
+  remoteBuffer.pitch = nopDescriptor.pitch;
+  remoteBuffer.width = nopDescriptor.width;
+  remoteBuffer.height = nopDescriptor.height;
+  std::unique_ptr<CopyStreams>& copyStreams = copyStreams_[device];
+  if (copyStreams == nullptr) {
+    copyStreams = std::make_unique<CopyStreams>(
+        device, context_->getCopyStreams(device));
+  }
+  op.process(
+      startEv, eventPool_.get(stopEvIndex), remoteBuffer, copyStreams.get());
 
   TP_VLOG(6) << "Channel " << id_ << " done copying payload (#"
              << op.sequenceNumber << ")";
@@ -435,19 +775,58 @@ void Channel::Impl::recvFromLoop_(
   callback(error_);
 
   // Let peer know we've completed the copy.
-  TP_VLOG(6) << "Channel " << id_ << " is writing reply notification (#"
-             << op.sequenceNumber << ")";
+  pendingReplies_.push_back(op.reply(eventPool_.handleForPeer(op.stopEvIndex)));
+  writeReplies_();
+}
+
+void Channel::beginBatch() {
+  impl_->beginBatch();
+}
+
+void Channel::Impl::beginBatch() {
+  loop_.deferToLoop([this]() { beginBatchFromLoop_(); });
+}
+
+void Channel::Impl::beginBatchFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  batchDepth_++;
+}
+
+void Channel::endBatch() {
+  impl_->endBatch();
+}
+
+void Channel::Impl::endBatch() {
+  loop_.deferToLoop([this]() { endBatchFromLoop_(); });
+}
+
+void Channel::Impl::endBatchFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_GT(batchDepth_, 0);
+  batchDepth_--;
+  writeReplies_();
+}
+
+void Channel::Impl::writeReplies_() {
+  TP_DCHECK(loop_.inLoop());
+
+  if (error_ || batchDepth_ > 0 || pendingReplies_.empty()) {
+    return;
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is writing " << pendingReplies_.size()
+             << " reply notifications";
   auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
-  nopPacketHolder->getObject() = op.reply();
+  Packet& nopPacket = nopPacketHolder->getObject();
+  nopPacket.Become(nopPacket.index_of<Replies>());
+  nopPacket.get<Replies>()->replies = std::move(pendingReplies_);
+  pendingReplies_.clear();
 
   connection_->write(
-      *nopPacketHolder,
-      lazyCallbackWrapper_(
-          [nopPacketHolder, sequenceNumber{op.sequenceNumber}](Impl& impl) {
-            TP_VLOG(6) << "Channel " << impl.id_
-                       << " done writing reply notification (#"
-                       << sequenceNumber << ")";
-          }));
+      *nopPacketHolder, lazyCallbackWrapper_([nopPacketHolder](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing reply notifications";
+      }));
 }
 
 void Channel::Impl::readPackets_() {
@@ -455,10 +834,10 @@ void Channel::Impl::readPackets_() {
   connection_->read(
       *nopPacketHolder, lazyCallbackWrapper_([nopPacketHolder](Impl& impl) {
         const Packet& nopPacket = nopPacketHolder->getObject();
-        if (nopPacket.is<Reply>()) {
-          impl.onReply_(*nopPacket.get<Reply>());
+        if (nopPacket.is<Replies>()) {
+          impl.onReplies_(*nopPacket.get<Replies>());
         } else if (nopPacket.is<Ack>()) {
-          impl.onAck_();
+          impl.onAck_(*nopPacket.get<Ack>());
         } else {
           TP_THROW_ASSERT() << "Unexpected packet type: " << nopPacket.index();
         }
@@ -467,44 +846,52 @@ void Channel::Impl::readPackets_() {
       }));
 }
 
-void Channel::Impl::onReply_(const Reply& nopReply) {
-  auto& op = sendOperations_.front();
+void Channel::Impl::onReplies_(const Replies& nopReplies) {
+  for (const Reply& nopReply : nopReplies.replies) {
+    SendOperation& op = sendOperations_.front();
 
-  TP_VLOG(6) << "Channel " << id_ << " received reply notification (#"
-             << op.sequenceNumber << ")";
+    TP_VLOG(6) << "Channel " << id_ << " received reply notification (#"
+               << op.sequenceNumber << ")";
 
-  const cudaIpcEventHandle_t* stopEvHandle =
-      reinterpret_cast<const cudaIpcEventHandle_t*>(
-          nopReply.stopEvHandle.c_str());
+    op.process(peerEvents_.get(nopReply.stopEvIndex, nopReply.stopEvHandle));
 
-  op.process(*stopEvHandle);
+    // The peer has enqueued its wait on our event before replying. A captured
+    // one is recorded again by each launch of the graph.
+    if (!op.captured) {
+      eventPool_.release(op.startEvIndex);
+    }
 
-  TP_VLOG(6) << "Channel " << id_ << " is writing ACK notification (#"
-             << op.sequenceNumber << ")";
+    op.callback(error_);
+    sendOperations_.pop_front();
+  }
+
+  TP_VLOG(6) << "Channel " << id_ << " is writing ACK notification for "
+             << nopReplies.replies.size() << " operations";
   auto nopPacketHolder = std::make_shared<NopHolder<Packet>>();
   Packet& nopPacket = nopPacketHolder->getObject();
   nopPacket.Become(nopPacket.index_of<Ack>());
-
-  op.callback(error_);
-  sendOperations_.pop_front();
+  nopPacket.get<Ack>()->numOperations = nopReplies.replies.size();
 
   connection_->write(
-      *nopPacketHolder,
-      lazyCallbackWrapper_(
-          [nopPacketHolder, sequenceNumber{op.sequenceNumber}](Impl& impl) {
-            TP_VLOG(6) << "Channel " << impl.id_
-                       << " done writing ACK notification (#" << sequenceNumber
-                       << ")";
-          }));
+      *nopPacketHolder, lazyCallbackWrapper_([nopPacketHolder](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing ACK notification";
+      }));
 }
 
-void Channel::Impl::onAck_() {
-  auto& op = recvOperations_.front();
+void Channel::Impl::onAck_(const Ack& nopAck) {
+  for (uint64_t opIdx = 0; opIdx < nopAck.numOperations; opIdx++) {
+    RecvOperation& op = recvOperations_.front();
 
-  TP_VLOG(6) << "Channel " << id_ << " received ACK notification (#"
-             << op.sequenceNumber << ")";
+    TP_VLOG(6) << "Channel " << id_ << " received ACK notification (#"
+               << op.sequenceNumber << ")";
 
-  recvOperations_.pop_front();
+    // The peer has enqueued its wait on our event before acknowledging.
+    if (!op.captured) {
+      eventPool_.release(op.stopEvIndex);
+    }
+    recvOperations_.pop_front();
+  }
 }
 
 void Channel::setId(std::string id) {
@@ -562,6 +949,7 @@ void Channel::Impl::handleError_() {
 
   // Callbacks for recv operations are always called inline.
   recvOperations_.clear();
+  pendingReplies_.clear();
 }
 
 } // namespace cuda_ipc
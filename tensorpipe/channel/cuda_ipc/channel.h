@@ -21,7 +21,7 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_ipc {
 
-class Channel : public channel::CudaChannel {
+class Channel final : public channel::CudaChannel {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
@@ -43,6 +43,11 @@ class Channel : public channel::CudaChannel {
   void recv(TDescriptor descriptor, CudaBuffer buffer, TRecvCallback callback)
       override;
 
+  // Coalesce the replies to the recv operations issued in between.
+  void beginBatch() override;
+
+  void endBatch() override;
+
   // Tell the channel what its identifier is.
   void setId(std::string id) override;
 
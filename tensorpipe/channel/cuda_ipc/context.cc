@@ -8,6 +8,7 @@
 
 #include <tensorpipe/channel/cuda_ipc/context.h>
 
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -15,14 +16,22 @@
 #include <algorithm>
 #include <limits>
 #include <list>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/channel/cuda_ipc/channel.h>
 #include <tensorpipe/channel/cuda_ipc/context_impl.h>
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/cuda.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/common/queue.h>
 #include <tensorpipe/common/system.h>
@@ -33,16 +42,151 @@ namespace cuda_ipc {
 
 namespace {
 
-std::string generateDomainDescriptor() {
-  std::ostringstream oss;
+// Opened IPC handles keep the peer's memory alive even after the peer freed it,
+// unless the peer reuses its address for another allocation, hence the least
+// recently used ones are closed beyond this many.
+constexpr size_t kMaxNumOpenedIpcMemHandles = 1024;
+
+// The chunks of VMM allocations that were exported are kept for reuse, which
+// holds on to their memory and to a file descriptor for each of them, hence the
+// least recently used ones are dropped beyond this many. (The peer keeps its
+// mappings, and only needs the file descriptor again if it dropped them too.)
+constexpr size_t kMaxNumExportedVmmChunks = 256;
+
+// Large copies are split in chunks that are issued round-robin over this many
+// streams of the receiving device, for them to use several copy engines.
+constexpr size_t kNumCopyStreams = 4;
+
+// The file descriptors of the chunks are passed through pidfd_getfd (Linux 5.6)
+// as the connection they're sent over may not be able to carry them, which
+// requires the same permissions as ptrace, like the CMA channel does.
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+#ifndef SYS_pidfd_getfd
+#define SYS_pidfd_getfd 438
+#endif
+
+uint64_t generateUniqueId() {
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+// The devices a process can see, identified by their PCI bus ID as their
+// indices differ across processes, and which pairs of them have peer-to-peer
+// access to each other (over NVLink or a PCIe switch) in both directions.
+// Copying between devices that don't is staged by the driver through the host,
+// in which case other channels do a better job.
+struct Topology {
+  std::string bootID;
+  std::vector<std::string> pciBusIds;
+  std::vector<std::vector<bool>> p2pSupport;
+};
+
+Topology getLocalTopology() {
+  Topology topology;
   auto bootID = getBootID();
   TP_THROW_ASSERT_IF(!bootID) << "Unable to read boot_id";
-  oss << bootID.value();
+  topology.bootID = bootID.value();
+
+  int numDevices;
+  TP_CUDA_CHECK(cudaGetDeviceCount(&numDevices));
+  for (int device = 0; device < numDevices; device++) {
+    // A PCI bus ID is of the form [domain]:[bus]:[device].[function].
+    char pciBusId[32];
+    TP_CUDA_CHECK(cudaDeviceGetPCIBusId(pciBusId, sizeof(pciBusId), device));
+    topology.pciBusIds.emplace_back(pciBusId);
+  }
+
+  topology.p2pSupport.resize(numDevices, std::vector<bool>(numDevices, true));
+  for (int srcDevice = 0; srcDevice < numDevices; srcDevice++) {
+    for (int dstDevice = 0; dstDevice < numDevices; dstDevice++) {
+      if (srcDevice == dstDevice) {
+        continue;
+      }
+      int isSupported;
+      TP_CUDA_CHECK(cudaDeviceGetP2PAttribute(
+          &isSupported, cudaDevP2PAttrAccessSupported, srcDevice, dstDevice));
+      if (!isSupported) {
+        topology.p2pSupport[srcDevice][dstDevice] = false;
+        topology.p2pSupport[dstDevice][srcDevice] = false;
+      }
+    }
+  }
+
+  return topology;
+}
+
+std::string generateDomainDescriptor(const Topology& topology) {
+  std::ostringstream oss;
+  oss << topology.bootID << " " << topology.pciBusIds.size();
+  for (const std::string& pciBusId : topology.pciBusIds) {
+    oss << " " << pciBusId;
+  }
+  for (const auto& row : topology.p2pSupport) {
+    oss << " ";
+    for (bool isSupported : row) {
+      oss << (isSupported ? '1' : '0');
+    }
+  }
   return oss.str();
 }
 
+optional<Topology> parseDomainDescriptor(const std::string& domainDescriptor) {
+  Topology topology;
+  std::istringstream iss(domainDescriptor);
+  size_t numDevices;
+  if (!(iss >> topology.bootID >> numDevices)) {
+    return nullopt;
+  }
+  topology.pciBusIds.resize(numDevices);
+  for (std::string& pciBusId : topology.pciBusIds) {
+    if (!(iss >> pciBusId)) {
+      return nullopt;
+    }
+  }
+  topology.p2pSupport.resize(numDevices);
+  for (auto& row : topology.p2pSupport) {
+    std::string flags;
+    if (!(iss >> flags) || flags.size() != numDevices) {
+      return nullopt;
+    }
+    for (char flag : flags) {
+      row.push_back(flag == '1');
+    }
+  }
+  return topology;
+}
+
+// Find out, from the topology of whichever process sees both devices, whether
+// they have peer-to-peer access to each other. If neither sees both, assume
+// they don't.
+bool devicesHaveP2pSupport(
+    const Topology& topology,
+    const Topology& otherTopology,
+    const std::string& pciBusId,
+    const std::string& otherPciBusId) {
+  if (pciBusId == otherPciBusId) {
+    return true;
+  }
+  for (const Topology* t : {&topology, &otherTopology}) {
+    auto begin = t->pciBusIds.cbegin();
+    auto end = t->pciBusIds.cend();
+    auto iter = std::find(begin, end, pciBusId);
+    auto otherIter = std::find(begin, end, otherPciBusId);
+    if (iter != end && otherIter != end) {
+      return t->p2pSupport[iter - begin][otherIter - begin];
+    }
+  }
+  return false;
+}
+
 } // namespace
 
+ExportedVmmChunk::~ExportedVmmChunk() {
+  TP_CU_CHECK(cuMemRelease(handle));
+}
+
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
@@ -50,6 +194,9 @@ class Context::Impl : public Context::PrivateIface,
 
   const std::string& domainDescriptor() const;
 
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const;
+
   std::shared_ptr<channel::CudaChannel> createChannel(
       std::shared_ptr<transport::Connection>,
       Endpoint);
@@ -58,7 +205,32 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter& getClosingEmitter() override;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  uint64_t getUniqueId() override;
+
+  void* openIpcMemHandle(
+      uint64_t peerUniqueId,
+      uint64_t remoteBasePtr,
+      uint64_t remoteBufferId,
+      const cudaIpcMemHandle_t& handle) override;
+
+  std::shared_ptr<void> registerBuffer(CudaBuffer buffer);
+
+  std::shared_ptr<const ExportedIpcMemHandle> findExportedIpcMemHandle(
+      const void* ptr) override;
+
+  std::vector<std::shared_ptr<const ExportedVmmChunk>> exportVmmChunks(
+      const void* ptr,
+      size_t length) override;
+
+  void* mapVmmChunks(
+      uint64_t peerUniqueId,
+      pid_t peerPid,
+      uint64_t remoteBasePtr,
+      const std::vector<RemoteVmmChunk>& chunks) override;
+
+  const std::vector<cudaStream_t>& getCopyStreams(int device) override;
+
+  using copy_request_callback_fn = Function<void(const Error&)>;
 
   void close();
 
@@ -67,7 +239,9 @@ class Context::Impl : public Context::PrivateIface,
   ~Impl() override = default;
 
  private:
+  const Topology topology_;
   std::string domainDescriptor_;
+  const uint64_t uniqueId_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   ClosingEmitter closingEmitter_;
@@ -81,11 +255,72 @@ class Context::Impl : public Context::PrivateIface,
   // their identifiers based off this context's identifier. They will only be
   // used for logging and debugging.
   std::atomic<uint64_t> channelCounter_{0};
+
+  // The peers' allocations that are currently mapped, keyed by the peer's
+  // unique identifier and the allocation's base address there, shared by all
+  // channels as the same allocation can't be opened twice.
+  using TIpcMemHandleKey = std::pair<uint64_t, uint64_t>;
+  struct OpenedIpcMemHandle {
+    uint64_t remoteBufferId;
+    void* ptr;
+    std::list<TIpcMemHandleKey>::iterator lruIter;
+  };
+  std::mutex ipcMemHandlesMutex_;
+  std::map<TIpcMemHandleKey, OpenedIpcMemHandle> openedIpcMemHandles_;
+  // From most to least recently used.
+  std::list<TIpcMemHandleKey> ipcMemHandlesLru_;
+
+  // Must be called while holding the mutex.
+  void closeIpcMemHandle_(
+      std::map<TIpcMemHandleKey, OpenedIpcMemHandle>::iterator iter);
+
+  // Our allocations whose IPC handles were exported through registerBuffer, by
+  // their base address. They're owned by the handles given to the user.
+  std::mutex exportedIpcMemHandlesMutex_;
+  std::map<uintptr_t, std::weak_ptr<const ExportedIpcMemHandle>>
+      exportedIpcMemHandles_;
+
+  // Our chunks of VMM allocations that were exported, by their base address,
+  // from most to least recently used.
+  struct ExportedVmmChunkEntry {
+    std::shared_ptr<const ExportedVmmChunk> chunk;
+    std::list<uintptr_t>::iterator lruIter;
+  };
+  std::mutex exportedVmmChunksMutex_;
+  std::map<uintptr_t, ExportedVmmChunkEntry> exportedVmmChunks_;
+  std::list<uintptr_t> exportedVmmChunksLru_;
+  uint64_t nextVmmExportId_{0};
+
+  // The peers' chunks that are currently mapped, keyed like the IPC handles,
+  // and the pidfds of the peers, through which we get the chunks' file
+  // descriptors.
+  struct MappedVmmChunks {
+    std::vector<uint64_t> exportIds;
+    std::vector<CUmemGenericAllocationHandle> handles;
+    CUdeviceptr ptr;
+    size_t length;
+    std::list<TIpcMemHandleKey>::iterator lruIter;
+  };
+  std::mutex vmmChunksMutex_;
+  std::map<TIpcMemHandleKey, MappedVmmChunks> mappedVmmChunks_;
+  std::list<TIpcMemHandleKey> mappedVmmChunksLru_;
+  std::map<uint64_t, Fd> peerPidFds_;
+
+  // Must be called while holding the mutex.
+  void unmapVmmChunks_(
+      std::map<TIpcMemHandleKey, MappedVmmChunks>::iterator iter);
+
+  // The streams over which large copies are split, by device.
+  std::mutex copyStreamsMutex_;
+  std::map<int, std::vector<cudaStream_t>> copyStreams_;
 };
 
 Context::Context() : impl_(std::make_shared<Context::Impl>()) {}
 
-Context::Impl::Impl() : domainDescriptor_(generateDomainDescriptor()) {}
+Context::Impl::Impl()
+    : topology_(getLocalTopology()),
+      domainDescriptor_(generateDomainDescriptor(topology_)),
+      uniqueId_(generateUniqueId()) {}
 
 void Context::close() {
   impl_->close();
@@ -104,7 +339,36 @@ void Context::join() {
 void Context::Impl::join() {
   close();
 
-  joined_.exchange(true);
+  if (!joined_.exchange(true)) {
+    {
+      std::unique_lock<std::mutex> lock(ipcMemHandlesMutex_);
+      while (!openedIpcMemHandles_.empty()) {
+        closeIpcMemHandle_(openedIpcMemHandles_.begin());
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(vmmChunksMutex_);
+      while (!mappedVmmChunks_.empty()) {
+        unmapVmmChunks_(mappedVmmChunks_.begin());
+      }
+      peerPidFds_.clear();
+    }
+    {
+      std::unique_lock<std::mutex> lock(exportedVmmChunksMutex_);
+      exportedVmmChunks_.clear();
+      exportedVmmChunksLru_.clear();
+    }
+    {
+      // The copies still enqueued on them complete nonetheless.
+      std::unique_lock<std::mutex> lock(copyStreamsMutex_);
+      for (auto& iter : copyStreams_) {
+        for (cudaStream_t stream : iter.second) {
+          TP_CUDA_CHECK(cudaStreamDestroy(stream));
+        }
+      }
+      copyStreams_.clear();
+    }
+  }
 }
 
 Context::~Context() {
@@ -123,6 +387,212 @@ ClosingEmitter& Context::Impl::getClosingEmitter() {
   return closingEmitter_;
 }
 
+uint64_t Context::Impl::getUniqueId() {
+  return uniqueId_;
+}
+
+void* Context::Impl::openIpcMemHandle(
+    uint64_t peerUniqueId,
+    uint64_t remoteBasePtr,
+    uint64_t remoteBufferId,
+    const cudaIpcMemHandle_t& handle) {
+  std::unique_lock<std::mutex> lock(ipcMemHandlesMutex_);
+  TIpcMemHandleKey key(peerUniqueId, remoteBasePtr);
+
+  auto iter = openedIpcMemHandles_.find(key);
+  if (iter != openedIpcMemHandles_.end()) {
+    if (iter->second.remoteBufferId == remoteBufferId) {
+      ipcMemHandlesLru_.splice(
+          ipcMemHandlesLru_.begin(), ipcMemHandlesLru_, iter->second.lruIter);
+      return iter->second.ptr;
+    }
+    // The allocation we had mapped was freed, and its address reused.
+    TP_VLOG(5) << "Channel context " << id_
+               << " is closing the IPC handle of a freed allocation";
+    closeIpcMemHandle_(iter);
+  }
+
+  if (openedIpcMemHandles_.size() >= kMaxNumOpenedIpcMemHandles) {
+    closeIpcMemHandle_(openedIpcMemHandles_.find(ipcMemHandlesLru_.back()));
+  }
+
+  void* ptr;
+  TP_CUDA_CHECK(
+      cudaIpcOpenMemHandle(&ptr, handle, cudaIpcMemLazyEnablePeerAccess));
+  ipcMemHandlesLru_.push_front(key);
+  openedIpcMemHandles_.emplace(
+      key,
+      OpenedIpcMemHandle{remoteBufferId, ptr, ipcMemHandlesLru_.begin()});
+  return ptr;
+}
+
+void Context::Impl::closeIpcMemHandle_(
+    std::map<TIpcMemHandleKey, OpenedIpcMemHandle>::iterator iter) {
+  TP_CUDA_CHECK(cudaIpcCloseMemHandle(iter->second.ptr));
+  ipcMemHandlesLru_.erase(iter->second.lruIter);
+  openedIpcMemHandles_.erase(iter);
+}
+
+std::vector<std::shared_ptr<const ExportedVmmChunk>> Context::Impl::
+    exportVmmChunks(const void* ptr, size_t length) {
+  std::vector<std::shared_ptr<const ExportedVmmChunk>> chunks;
+  std::unique_lock<std::mutex> lock(exportedVmmChunksMutex_);
+  uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+  const uintptr_t end = addr + length;
+  while (addr < end) {
+    CUmemGenericAllocationHandle handle;
+    CUresult result =
+        cuMemRetainAllocationHandle(&handle, reinterpret_cast<void*>(addr));
+    if (result != CUDA_SUCCESS) {
+      // It's a regular allocation, which has an IPC handle instead.
+      TP_THROW_ASSERT_IF(!chunks.empty())
+          << "A buffer spans both VMM and regular allocations";
+      return chunks;
+    }
+    CUdeviceptr basePtr;
+    size_t chunkLength;
+    CUresult rangeResult = cuMemGetAddressRange(
+        &basePtr, &chunkLength, static_cast<CUdeviceptr>(addr));
+    if (rangeResult != CUDA_SUCCESS) {
+      TP_CU_CHECK(cuMemRelease(handle));
+      TP_CU_CHECK(rangeResult);
+    }
+
+    auto iter = exportedVmmChunks_.find(basePtr);
+    if (iter != exportedVmmChunks_.end() &&
+        iter->second.chunk->handle == handle &&
+        iter->second.chunk->length == chunkLength) {
+      // The reference we hold keeps the allocation alive, hence its handle
+      // can't have been reused for another one, and we don't need a second
+      // reference.
+      TP_CU_CHECK(cuMemRelease(handle));
+      exportedVmmChunksLru_.splice(
+          exportedVmmChunksLru_.begin(),
+          exportedVmmChunksLru_,
+          iter->second.lruIter);
+      chunks.push_back(iter->second.chunk);
+    } else {
+      if (iter != exportedVmmChunks_.end()) {
+        // The chunk we had was unmapped, and its address reused. It's only
+        // released once the operations that use it are done.
+        exportedVmmChunksLru_.erase(iter->second.lruIter);
+        exportedVmmChunks_.erase(iter);
+      }
+      auto chunk = std::make_shared<ExportedVmmChunk>();
+      chunk->exportId = nextVmmExportId_++;
+      chunk->basePtr = basePtr;
+      chunk->length = chunkLength;
+      chunk->handle = handle;
+      int fd;
+      result = cuMemExportToShareableHandle(
+          &fd, handle, CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR, 0);
+      TP_THROW_ASSERT_IF(result != CUDA_SUCCESS)
+          << "Couldn't export a VMM allocation (" << getCuErrorName(result)
+          << "), it must be created with the POSIX file descriptor handle type";
+      chunk->fd = Fd(fd);
+
+      if (exportedVmmChunks_.size() >= kMaxNumExportedVmmChunks) {
+        exportedVmmChunks_.erase(exportedVmmChunksLru_.back());
+        exportedVmmChunksLru_.pop_back();
+      }
+      exportedVmmChunksLru_.push_front(basePtr);
+      exportedVmmChunks_.emplace(
+          basePtr, ExportedVmmChunkEntry{chunk, exportedVmmChunksLru_.begin()});
+      chunks.push_back(std::move(chunk));
+    }
+    addr = basePtr + chunkLength;
+  }
+  return chunks;
+}
+
+void* Context::Impl::mapVmmChunks(
+    uint64_t peerUniqueId,
+    pid_t peerPid,
+    uint64_t remoteBasePtr,
+    const std::vector<RemoteVmmChunk>& chunks) {
+  std::unique_lock<std::mutex> lock(vmmChunksMutex_);
+  TIpcMemHandleKey key(peerUniqueId, remoteBasePtr);
+  std::vector<uint64_t> exportIds;
+  size_t length = 0;
+  for (const RemoteVmmChunk& chunk : chunks) {
+    exportIds.push_back(chunk.exportId);
+    length += chunk.length;
+  }
+
+  auto iter = mappedVmmChunks_.find(key);
+  if (iter != mappedVmmChunks_.end()) {
+    if (iter->second.exportIds == exportIds) {
+      mappedVmmChunksLru_.splice(
+          mappedVmmChunksLru_.begin(),
+          mappedVmmChunksLru_,
+          iter->second.lruIter);
+      return reinterpret_cast<void*>(iter->second.ptr);
+    }
+    // The peer remapped that range since, or extended it.
+    TP_VLOG(5) << "Channel context " << id_
+               << " is unmapping the VMM chunks of a freed allocation";
+    unmapVmmChunks_(iter);
+  }
+
+  if (mappedVmmChunks_.size() >= kMaxNumOpenedIpcMemHandles) {
+    unmapVmmChunks_(mappedVmmChunks_.find(mappedVmmChunksLru_.back()));
+  }
+
+  auto pidFdIter = peerPidFds_.find(peerUniqueId);
+  if (pidFdIter == peerPidFds_.end()) {
+    int pidFd = ::syscall(SYS_pidfd_open, peerPid, 0);
+    TP_THROW_SYSTEM_IF(pidFd < 0, errno);
+    pidFdIter = peerPidFds_.emplace(peerUniqueId, Fd(pidFd)).first;
+  }
+
+  MappedVmmChunks mapped;
+  mapped.exportIds = std::move(exportIds);
+  mapped.length = length;
+  TP_CU_CHECK(cuMemAddressReserve(&mapped.ptr, length, 0, 0, 0));
+  size_t offset = 0;
+  for (const RemoteVmmChunk& chunk : chunks) {
+    int fd = ::syscall(SYS_pidfd_getfd, pidFdIter->second.fd(), chunk.fd, 0);
+    TP_THROW_SYSTEM_IF(fd < 0, errno);
+    Fd localFd(fd);
+    CUmemGenericAllocationHandle handle;
+    TP_CU_CHECK(cuMemImportFromShareableHandle(
+        &handle,
+        reinterpret_cast<void*>(static_cast<uintptr_t>(localFd.fd())),
+        CU_MEM_HANDLE_TYPE_POSIX_FILE_DESCRIPTOR));
+    TP_CU_CHECK(cuMemMap(mapped.ptr + offset, chunk.length, 0, handle, 0));
+    mapped.handles.push_back(handle);
+    offset += chunk.length;
+  }
+
+  // Any of our devices may be the one that copies from it.
+  std::vector<CUmemAccessDesc> accessDescs(topology_.pciBusIds.size());
+  for (size_t device = 0; device < accessDescs.size(); device++) {
+    accessDescs[device].location.type = CU_MEM_LOCATION_TYPE_DEVICE;
+    accessDescs[device].location.id = device;
+    accessDescs[device].flags = CU_MEM_ACCESS_FLAGS_PROT_READWRITE;
+  }
+  TP_CU_CHECK(cuMemSetAccess(
+      mapped.ptr, length, accessDescs.data(), accessDescs.size()));
+
+  void* ptr = reinterpret_cast<void*>(mapped.ptr);
+  mappedVmmChunksLru_.push_front(key);
+  mapped.lruIter = mappedVmmChunksLru_.begin();
+  mappedVmmChunks_.emplace(key, std::move(mapped));
+  return ptr;
+}
+
+void Context::Impl::unmapVmmChunks_(
+    std::map<TIpcMemHandleKey, MappedVmmChunks>::iterator iter) {
+  MappedVmmChunks& mapped = iter->second;
+  TP_CU_CHECK(cuMemUnmap(mapped.ptr, mapped.length));
+  for (CUmemGenericAllocationHandle handle : mapped.handles) {
+    TP_CU_CHECK(cuMemRelease(handle));
+  }
+  TP_CU_CHECK(cuMemAddressFree(mapped.ptr, mapped.length));
+  mappedVmmChunksLru_.erase(mapped.lruIter);
+  mappedVmmChunks_.erase(iter);
+}
+
 const std::string& Context::domainDescriptor() const {
   return impl_->domainDescriptor();
 }
@@ -131,6 +601,110 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+bool Context::supportsStridedBuffers() const {
+  return true;
+}
+
+std::shared_ptr<void> Context::registerBuffer(CudaBuffer buffer) {
+  return impl_->registerBuffer(buffer);
+}
+
+std::shared_ptr<void> Context::Impl::registerBuffer(CudaBuffer buffer) {
+  // The chunks of VMM allocations are exported right away, and kept alive (with
+  // their file descriptors) as long as the handle is.
+  std::vector<std::shared_ptr<const ExportedVmmChunk>> chunks =
+      exportVmmChunks(buffer.ptr, getCudaBufferExtent(buffer));
+  if (!chunks.empty()) {
+    return std::make_shared<
+        std::vector<std::shared_ptr<const ExportedVmmChunk>>>(
+        std::move(chunks));
+  }
+
+  auto exported = std::make_shared<ExportedIpcMemHandle>();
+  const CUdeviceptr ptr = reinterpret_cast<CUdeviceptr>(buffer.ptr);
+  CUdeviceptr basePtr;
+  TP_CU_CHECK(cuMemGetAddressRange(&basePtr, &exported->length, ptr));
+  exported->basePtr = basePtr;
+  TP_CU_CHECK(cuPointerGetAttribute(
+      &exported->bufferId, CU_POINTER_ATTRIBUTE_BUFFER_ID, ptr));
+  TP_CUDA_CHECK(cudaIpcGetMemHandle(&exported->handle, buffer.ptr));
+  exported->device = cudaDeviceForPointer(buffer.ptr);
+
+  std::unique_lock<std::mutex> lock(exportedIpcMemHandlesMutex_);
+  auto iter = exportedIpcMemHandles_.find(exported->basePtr);
+  if (iter != exportedIpcMemHandles_.end()) {
+    std::shared_ptr<const ExportedIpcMemHandle> previous = iter->second.lock();
+    if (previous != nullptr && previous->bufferId == exported->bufferId) {
+      return std::const_pointer_cast<ExportedIpcMemHandle>(previous);
+    }
+  }
+  exportedIpcMemHandles_[exported->basePtr] = exported;
+  return exported;
+}
+
+std::shared_ptr<const ExportedIpcMemHandle> Context::Impl::
+    findExportedIpcMemHandle(const void* ptr) {
+  const uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
+  std::unique_lock<std::mutex> lock(exportedIpcMemHandlesMutex_);
+  auto iter = exportedIpcMemHandles_.upper_bound(addr);
+  if (iter == exportedIpcMemHandles_.begin()) {
+    return nullptr;
+  }
+  iter--;
+  std::shared_ptr<const ExportedIpcMemHandle> exported = iter->second.lock();
+  if (exported == nullptr) {
+    exportedIpcMemHandles_.erase(iter);
+    return nullptr;
+  }
+  if (addr >= exported->basePtr + exported->length) {
+    return nullptr;
+  }
+  return exported;
+}
+
+const std::vector<cudaStream_t>& Context::Impl::getCopyStreams(int device) {
+  std::unique_lock<std::mutex> lock(copyStreamsMutex_);
+  std::vector<cudaStream_t>& streams = copyStreams_[device];
+  if (streams.empty()) {
+    TP_CUDA_CHECK(cudaSetDevice(device));
+    for (size_t streamIdx = 0; streamIdx < kNumCopyStreams; streamIdx++) {
+      cudaStream_t stream;
+      TP_CUDA_CHECK(cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking));
+      streams.push_back(stream);
+    }
+  }
+  return streams;
+}
+
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  return impl_->canCommunicateWithRemote(remoteDomainDescriptor);
+}
+
+bool Context::Impl::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  optional<Topology> remoteTopology =
+      parseDomainDescriptor(remoteDomainDescriptor);
+  if (!remoteTopology.has_value() ||
+      remoteTopology->bootID != topology_.bootID) {
+    return false;
+  }
+
+  // Any of our devices may end up exchanging data with any of theirs.
+  for (const std::string& pciBusId : topology_.pciBusIds) {
+    for (const std::string& remotePciBusId : remoteTopology->pciBusIds) {
+      if (!devicesHaveP2pSupport(
+              topology_, *remoteTopology, pciBusId, remotePciBusId)) {
+        TP_VLOG(4) << "Channel context " << id_ << " can't communicate with "
+                   << "the remote one, as devices " << pciBusId << " and "
+                   << remotePciBusId << " lack peer-to-peer access";
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
 std::shared_ptr<channel::CudaChannel> Context::createChannel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint) {
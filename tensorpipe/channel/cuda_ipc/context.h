@@ -17,12 +17,36 @@ namespace tensorpipe {
 namespace channel {
 namespace cuda_ipc {
 
-class Context : public channel::CudaContext {
+// Buffers allocated with cudaMalloc are shared through legacy IPC handles,
+// which the receiver opens for the whole allocation. Those allocated with the
+// virtual memory management API (cuMemCreate and cuMemMap, as by PyTorch's
+// expandable segments), which have no such handle, are instead shared one
+// physical chunk at a time, as file descriptors that the receiver fetches with
+// pidfd_getfd (which requires Linux 5.6 and for the receiver to be allowed to
+// ptrace the sender) and maps contiguously. The allocations must have been
+// created with the POSIX file descriptor handle type. In both cases the
+// receiver keeps its mappings for reuse.
+//
+// Transfers can be captured into CUDA graphs (with CUDA 11.1 or later): if the
+// user's stream is being captured, only the copy and the record and wait of the
+// events end up in the graph, all the rest happening at capture time. Both
+// sides must then capture their matching operations, and launch their graphs
+// in lockstep, each launch transferring the buffers again.
+class Context final : public channel::CudaContext {
  public:
   Context();
 
   const std::string& domainDescriptor() const override;
 
+  bool supportsStridedBuffers() const override;
+
+  // Exports the IPC handle of the buffer's allocation once and for all, or the
+  // file descriptors of its chunks.
+  std::shared_ptr<void> registerBuffer(CudaBuffer buffer) override;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
   std::shared_ptr<CudaChannel> createChannel(
       std::shared_ptr<transport::Connection>,
       Endpoint) override;
@@ -8,17 +8,111 @@
 
 #pragma once
 
+#include <sys/types.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
 #include <tensorpipe/channel/cuda_ipc/context.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/fd.h>
 
 namespace tensorpipe {
 namespace channel {
 namespace cuda_ipc {
 
+// What a sender looks up about the allocation holding a buffer, which it then
+// tells the peer for it to map that allocation.
+struct ExportedIpcMemHandle {
+  cudaIpcMemHandle_t handle;
+  uintptr_t basePtr;
+  size_t length;
+  unsigned long long bufferId;
+  int device;
+};
+
+// One of the physical allocations that back a buffer which was allocated with
+// the virtual memory management API (cuMemCreate and cuMemMap, as done by
+// PyTorch's expandable segments), and which thus has no legacy IPC handle. It's
+// exported as a file descriptor, which the peer duplicates into its process. It
+// holds a reference to the allocation, which it releases when destroyed.
+struct ExportedVmmChunk {
+  // Increasing within a process, it tells the peer whether the chunk mapped at
+  // an address is still the one it mapped before.
+  uint64_t exportId;
+  uintptr_t basePtr;
+  size_t length;
+  CUmemGenericAllocationHandle handle;
+  Fd fd;
+
+  ~ExportedVmmChunk();
+};
+
+// The range that a possibly strided buffer spans.
+inline size_t getCudaBufferExtent(const CudaBuffer& buffer) {
+  if (buffer.pitch == 0) {
+    return buffer.length;
+  }
+  return buffer.pitch * (buffer.height - 1) + buffer.width;
+}
+
+// What the receiver is told about each of them.
+struct RemoteVmmChunk {
+  uint64_t exportId;
+  uint64_t length;
+  int fd;
+};
+
 class Context::PrivateIface {
  public:
   virtual ClosingEmitter& getClosingEmitter() = 0;
 
+  // A random identifier for this context, which peers use to tell apart the
+  // allocations of different processes that happen to be at the same address.
+  virtual uint64_t getUniqueId() = 0;
+
+  // Return the address at which a peer's allocation is mapped, only opening its
+  // IPC handle if it isn't mapped already. The allocation is identified by the
+  // peer's unique identifier and its base address there, and its buffer ID
+  // tells whether it's still the same one or whether it was freed in between.
+  virtual void* openIpcMemHandle(
+      uint64_t peerUniqueId,
+      uint64_t remoteBasePtr,
+      uint64_t remoteBufferId,
+      const cudaIpcMemHandle_t& handle) = 0;
+
+  // Return what was looked up ahead of time about the allocation holding the
+  // given address, if a buffer within it was passed to registerBuffer and its
+  // handle is still alive, or null otherwise.
+  virtual std::shared_ptr<const ExportedIpcMemHandle> findExportedIpcMemHandle(
+      const void* ptr) = 0;
+
+  // Return the chunks that back the given range, in order, exporting those
+  // that weren't already, or none if it wasn't allocated through the virtual
+  // memory management API. The chunks must be kept alive until the peer has
+  // mapped them.
+  virtual std::vector<std::shared_ptr<const ExportedVmmChunk>> exportVmmChunks(
+      const void* ptr,
+      size_t length) = 0;
+
+  // Return the address at which a peer's chunks are mapped, contiguously, only
+  // mapping them if they aren't already. They're identified in the same way as
+  // the allocations of openIpcMemHandle, with the base address of the first
+  // one, and their export IDs tell whether they're still the same ones.
+  virtual void* mapVmmChunks(
+      uint64_t peerUniqueId,
+      pid_t peerPid,
+      uint64_t remoteBasePtr,
+      const std::vector<RemoteVmmChunk>& chunks) = 0;
+
+  // Return the streams of the given device over which large copies are split,
+  // creating them the first time. They're shared by all channels.
+  virtual const std::vector<cudaStream_t>& getCopyStreams(int device) = 0;
+
   virtual ~PrivateIface() = default;
 };
 
@@ -22,5 +22,9 @@ std::string ChannelClosedError::what() const {
   return "channel closed";
 }
 
+std::string DecompressionError::what() const {
+  return "failed to decompress a chunk with " + codec_;
+}
+
 } // namespace channel
 } // namespace tensorpipe
@@ -29,5 +29,15 @@ class ChannelClosedError final : public BaseError {
   std::string what() const override;
 };
 
+class DecompressionError final : public BaseError {
+ public:
+  explicit DecompressionError(std::string codec) : codec_(std::move(codec)) {}
+
+  std::string what() const override;
+
+ private:
+  const std::string codec_;
+};
+
 } // namespace channel
 } // namespace tensorpipe
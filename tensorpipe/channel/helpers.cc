@@ -15,14 +15,24 @@ namespace tensorpipe {
 namespace channel {
 
 TDescriptor saveDescriptor(const AbstractNopHolder& object) {
-  const size_t len = object.getSize();
+  // Serialize straight into the string, sized after the estimate, and trim it.
+  size_t len = estimateNopObjectSize(object);
   TDescriptor out(len, '\0');
   NopWriter writer(
       const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(out.data())), len);
 
   nop::Status<void> status = object.write(writer);
+  if (unlikely(status.error() == nop::ErrorStatus::WriteLimitReached)) {
+    len = object.getSize();
+    out.assign(len, '\0');
+    writer = NopWriter(
+        const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(out.data())),
+        len);
+    status = object.write(writer);
+  }
   TP_THROW_ASSERT_IF(status.has_error())
       << "Error saving descriptor: " << status.GetErrorMessage();
+  out.resize(len - writer.getRemaining());
 
   return out;
 }
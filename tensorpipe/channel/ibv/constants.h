@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace {
+
+// How many RDMA read requests can be pending at the same time across all
+// channels. We need to put a limit on them because they all use the same global
+// completion queue which has a fixed capacity and if it overruns it will enter
+// an unrecoverable error state. This value is also set as the capacity of the
+// send queue of each queue pair.
+constexpr uint32_t kNumPendingReadReqs = 1024;
+
+// The completion queue only ever holds the completions of the RDMA reads, as no
+// receive requests are ever posted.
+constexpr int kCompletionQueueSize = kNumPendingReadReqs;
+
+// How many work completions to poll from the completion queue at each reactor
+// iteration.
+constexpr int kNumPolledWorkCompletions = 32;
+
+// The largest RDMA read we issue. Larger tensors are split into several reads.
+// This is well below the maximum message size of all the devices we know of
+// (usually 2 GiB) while still being large enough that a single outstanding
+// read per queue pair saturates the link.
+constexpr size_t kMaxReadSize = 1024 * 1024 * 1024;
+
+} // namespace
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/context.h>
+
+#include <tensorpipe/channel/ibv/channel.h>
+#include <tensorpipe/channel/ibv/context_impl.h>
+#include <tensorpipe/channel/ibv/reactor.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+namespace {
+
+// We use the same descriptor as the ibv transport: any two processes that both
+// have an InfiniBand device are assumed to be able to reach each other with it.
+const std::string kDomainDescriptor{"ibv:*"};
+
+} // namespace
+
+class Context::Impl : public Context::PrivateIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(size_t registrationCacheCapacity, IbvDeviceOptions deviceOptions);
+
+  void invalidateRegistrations(void* ptr, size_t length);
+
+  bool isViable() const;
+
+  const std::string& domainDescriptor() const;
+
+  std::shared_ptr<void> registerBuffer(CpuBuffer buffer);
+
+  std::map<std::string, uint64_t> getStats();
+
+  std::shared_ptr<channel::CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint);
+
+  void setId(std::string id);
+
+  ClosingEmitter& getClosingEmitter() override;
+
+  Reactor& getReactor() override;
+
+  IbvRegistrationCache& getRegistrationCache() override;
+
+  void close();
+
+  void join();
+
+  ~Impl() override = default;
+
+ private:
+  Reactor reactor_;
+  // Shared by the buffers that are sent and received, as the same ones are
+  // often used for both.
+  IbvRegistrationCache registrationCache_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  ClosingEmitter closingEmitter_;
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the channel's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Sequence numbers for the channels created by this context, used to create
+  // their identifiers based off this context's identifier. They will only be
+  // used for logging and debugging.
+  std::atomic<uint64_t> channelCounter_{0};
+};
+
+Context::Context(
+    size_t registrationCacheCapacity,
+    IbvDeviceOptions deviceOptions)
+    : impl_(std::make_shared<Context::Impl>(
+          registrationCacheCapacity,
+          std::move(deviceOptions))) {}
+
+Context::Impl::Impl(
+    size_t registrationCacheCapacity,
+    IbvDeviceOptions deviceOptions)
+    : reactor_(BusyPollingPolicy(), deviceOptions),
+      registrationCache_(
+          reactor_.getIbvLib(),
+          reactor_.getIbvPd(),
+          IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_READ,
+          registrationCacheCapacity,
+          deviceOptions.onDemandPaging) {}
+
+void Context::invalidateRegistrations(void* ptr, size_t length) {
+  impl_->invalidateRegistrations(ptr, length);
+}
+
+void Context::Impl::invalidateRegistrations(void* ptr, size_t length) {
+  registrationCache_.invalidate(ptr, length);
+}
+
+std::shared_ptr<void> Context::registerBuffer(CpuBuffer buffer) {
+  return impl_->registerBuffer(buffer);
+}
+
+std::shared_ptr<void> Context::Impl::registerBuffer(CpuBuffer buffer) {
+  if (buffer.length == 0 || !isViable()) {
+    return nullptr;
+  }
+  return std::const_pointer_cast<IbvLib::mr>(
+      registrationCache_.pinRegion(buffer.ptr, buffer.length));
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is closing";
+
+    closingEmitter_.close();
+    reactor_.close();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done closing";
+  }
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is joining";
+
+    reactor_.join();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(4) << "Channel context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  reactor_.setId(id_);
+}
+
+ClosingEmitter& Context::Impl::getClosingEmitter() {
+  return closingEmitter_;
+}
+
+Reactor& Context::Impl::getReactor() {
+  return reactor_;
+}
+
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() {
+  return {
+      {"memory.registration_cache", registrationCache_.cachedBytes()},
+  };
+}
+
+IbvRegistrationCache& Context::Impl::getRegistrationCache() {
+  return registrationCache_;
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+bool Context::Impl::isViable() const {
+  return reactor_.isViable();
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return kDomainDescriptor;
+}
+
+std::shared_ptr<channel::CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+std::shared_ptr<channel::CpuChannel> Context::Impl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  TP_THROW_ASSERT_IF(joined_);
+  std::string channelId = id_ + ".c" + std::to_string(channelCounter_++);
+  TP_VLOG(4) << "Channel context " << id_ << " is opening channel "
+             << channelId;
+  return std::make_shared<Channel>(
+      Channel::ConstructorToken(),
+      std::static_pointer_cast<PrivateIface>(shared_from_this()),
+      std::move(connection),
+      std::move(channelId));
+}
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
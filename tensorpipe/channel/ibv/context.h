@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/ibv_device_options.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+// Transfers tensors by having the receiver issue RDMA reads straight from the
+// sender's buffer into its own, both of which are registered with the device
+// for the duration of the transfer, hence without any intermediate copy.
+class Context final : public channel::CpuContext {
+ public:
+  // Up to registrationCacheCapacity bytes of buffers are kept registered after
+  // they've been transferred, so that subsequent transfers from or to them are
+  // faster. If that's enabled, buffers that may have been transferred must be
+  // passed to invalidateRegistrations before they are freed (see the
+  // IbvRegistrationCache for why). The device should be the same as the one
+  // that holds the buffers' memory, or is closest to it.
+  explicit Context(
+      size_t registrationCacheCapacity = 0,
+      IbvDeviceOptions deviceOptions = IbvDeviceOptions());
+
+  void invalidateRegistrations(void* ptr, size_t length);
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  // Keeps the buffer registered, regardless of the cache's capacity.
+  std::shared_ptr<void> registerBuffer(CpuBuffer buffer) override;
+
+  // Reports the registered memory held by the cache.
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow channel to see the private interface.
+  friend class Channel;
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
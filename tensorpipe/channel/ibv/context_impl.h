@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/channel/ibv/context.h>
+#include <tensorpipe/channel/ibv/reactor.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/ibv.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+class Context::PrivateIface {
+ public:
+  virtual ClosingEmitter& getClosingEmitter() = 0;
+
+  virtual Reactor& getReactor() = 0;
+
+  virtual IbvRegistrationCache& getRegistrationCache() = 0;
+
+  virtual ~PrivateIface() = default;
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/error.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+std::string IbvError::what() const {
+  return error_;
+}
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/reactor.h>
+
+#include <array>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+Reactor::Reactor(BusyPollingPolicy policy, IbvDeviceOptions deviceOptions)
+    : BusyPollingLoop(std::move(policy)) {
+  Error error;
+  std::tie(error, ibvLib_) = IbvLib::create();
+  // FIXME Instead of throwing away the error and setting a bool, we should have
+  // a way to set the reactor in an error state, and use that for viability.
+  if (error) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " couldn't open libibverbs: " << error.what();
+    return;
+  }
+  foundIbvLib_ = true;
+  IbvDeviceList deviceList(getIbvLib());
+  int deviceIdx = selectIbvDevice(deviceList, deviceOptions);
+  if (deviceIdx < 0) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " couldn't find a suitable device";
+    return;
+  }
+  IbvContext ctx = createIbvContext(getIbvLib(), deviceList[deviceIdx]);
+  uint8_t portNum = selectIbvPort(getIbvLib(), ctx, deviceOptions);
+  if (portNum == 0) {
+    TP_VLOG(5) << "Channel context " << id_
+               << " couldn't find an active port on "
+               << deviceList[deviceIdx].name;
+    return;
+  }
+  TP_VLOG(5) << "Channel context " << id_ << " is using port "
+             << static_cast<int>(portNum) << " of device "
+             << deviceList[deviceIdx].name;
+  ctx_ = std::move(ctx);
+  pd_ = createIbvProtectionDomain(getIbvLib(), ctx_);
+  cq_ = createIbvCompletionQueue(
+      getIbvLib(),
+      ctx_,
+      kCompletionQueueSize,
+      /*cq_context=*/nullptr,
+      /*channel=*/nullptr,
+      /*comp_vector=*/0);
+
+  addr_ = makeIbvAddress(
+      getIbvLib(), ctx_, portNum, deviceOptions.globalIdentifierIndex);
+
+  startThread("TP_IBV_chan");
+}
+
+bool Reactor::isViable() const {
+  return foundIbvLib_ && const_cast<IbvContext&>(ctx_).get() != nullptr;
+}
+
+void Reactor::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  std::array<IbvLib::wc, kNumPolledWorkCompletions> wcs;
+  auto rv = getIbvLib().poll_cq(cq_.get(), wcs.size(), wcs.data());
+
+  if (rv == 0) {
+    return false;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+
+  for (int wcIdx = 0; wcIdx < rv; wcIdx++) {
+    IbvLib::wc& wc = wcs[wcIdx];
+
+    TP_VLOG(6) << "Channel context " << id_
+               << " got work completion for request " << wc.wr_id << " for QP "
+               << wc.qp_num << " with status "
+               << getIbvLib().wc_status_str(wc.status) << " and opcode "
+               << ibvWorkCompletionOpcodeToStr(wc.opcode)
+               << " (byte length: " << wc.byte_len << ")";
+
+    auto iter = queuePairEventHandler_.find(wc.qp_num);
+    TP_THROW_ASSERT_IF(iter == queuePairEventHandler_.end())
+        << "Got work completion for unknown queue pair " << wc.qp_num;
+
+    // Only RDMA reads are ever posted, hence every completion (including the
+    // failed ones, whose opcode is undefined) gives back one slot.
+    numAvailableReads_++;
+
+    if (wc.status != IbvLib::WC_SUCCESS) {
+      iter->second->onError(wc.status, wc.wr_id);
+      continue;
+    }
+
+    switch (wc.opcode) {
+      case IbvLib::WC_RDMA_READ:
+        iter->second->onReadCompleted();
+        break;
+      default:
+        TP_THROW_ASSERT() << "Unknown opcode: " << wc.opcode;
+    }
+  }
+
+  while (!pendingQpReads_.empty() && numAvailableReads_ > 0) {
+    PendingRead& pendingRead = pendingQpReads_.front();
+    pendingRead.wr.sg_list = &pendingRead.sge;
+    postRead(pendingRead.qp, pendingRead.wr);
+    pendingQpReads_.pop_front();
+  }
+
+  return true;
+}
+
+bool Reactor::readyToClose() {
+  return queuePairEventHandler_.size() == 0;
+}
+
+void Reactor::registerQp(
+    uint32_t qpn,
+    std::shared_ptr<IbvEventHandler> eventHandler) {
+  TP_DCHECK(inLoop());
+  queuePairEventHandler_.emplace(qpn, std::move(eventHandler));
+}
+
+void Reactor::unregisterQp(uint32_t qpn) {
+  TP_DCHECK(inLoop());
+  queuePairEventHandler_.erase(qpn);
+}
+
+void Reactor::postRead(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  TP_DCHECK(inLoop());
+  TP_DCHECK_EQ(wr.num_sge, 1);
+  if (numAvailableReads_ > 0) {
+    IbvLib::send_wr* badWr = nullptr;
+    TP_VLOG(6) << "Channel context " << id_ << " posting RDMA read for QP "
+               << qp->qp_num;
+    TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
+    TP_THROW_ASSERT_IF(badWr != nullptr);
+    numAvailableReads_--;
+  } else {
+    TP_VLOG(6) << "Channel context " << id_
+               << " queueing up RDMA read for QP " << qp->qp_num;
+    pendingQpReads_.push_back(PendingRead{qp, wr, *wr.sg_list});
+  }
+}
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/ibv.h>
+#include <tensorpipe/channel/ibv/constants.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace ibv {
+
+class IbvEventHandler {
+ public:
+  virtual void onReadCompleted() = 0;
+
+  virtual void onError(IbvLib::wc_status status, uint64_t wr_id) = 0;
+
+  virtual ~IbvEventHandler() = default;
+};
+
+// Reactor loop.
+//
+// It owns the InfiniBand device, protection domain and completion queue shared
+// by all the channels of a context, and it polls the latter to notify the
+// channels whose RDMA reads completed. Unlike the one of the ibv transport, it
+// doesn't need a shared receive queue, as the peers never send each other
+// anything over InfiniBand: all the signaling goes over the connection.
+//
+// All methods, except the getters, must be called from within the loop.
+//
+class Reactor final : public BusyPollingLoop {
+ public:
+  explicit Reactor(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      IbvDeviceOptions deviceOptions = IbvDeviceOptions());
+
+  IbvLib& getIbvLib() {
+    return ibvLib_;
+  }
+
+  IbvContext& getIbvContext() {
+    return ctx_;
+  }
+
+  IbvProtectionDomain& getIbvPd() {
+    return pd_;
+  }
+
+  IbvCompletionQueue& getIbvCq() {
+    return cq_;
+  }
+
+  IbvAddress& getIbvAddress() {
+    return addr_;
+  }
+
+  void registerQp(uint32_t qpn, std::shared_ptr<IbvEventHandler> eventHandler);
+
+  void unregisterQp(uint32_t qpn);
+
+  // The work request must have exactly one scatter/gather element, which is
+  // copied, hence the caller doesn't need to keep it alive.
+  void postRead(IbvQueuePair& qp, IbvLib::send_wr& wr);
+
+  bool isViable() const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  // InfiniBand stuff
+  bool foundIbvLib_{false};
+  IbvLib ibvLib_;
+  IbvContext ctx_;
+  IbvProtectionDomain pd_;
+  IbvCompletionQueue cq_;
+  IbvAddress addr_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the channel's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // The registered event handlers for each queue pair.
+  std::unordered_map<uint32_t, std::shared_ptr<IbvEventHandler>>
+      queuePairEventHandler_;
+
+  struct PendingRead {
+    IbvQueuePair& qp;
+    IbvLib::send_wr wr;
+    IbvLib::sge sge;
+  };
+
+  uint32_t numAvailableReads_{kNumPendingReadReqs};
+  std::deque<PendingRead> pendingQpReads_;
+};
+
+} // namespace ibv
+} // namespace channel
+} // namespace tensorpipe
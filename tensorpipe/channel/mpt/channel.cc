@@ -9,11 +9,15 @@
 #include <tensorpipe/channel/mpt/channel.h>
 
 #include <algorithm>
+#include <chrono>
+#include <deque>
 #include <sstream>
+#include <vector>
 
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/channel/mpt/context_impl.h>
+#include <tensorpipe/channel/mpt/lane_balancer.h>
 #include <tensorpipe/channel/mpt/nop_types.h>
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
@@ -29,11 +33,89 @@ namespace mpt {
 
 namespace {
 
+// A contiguous portion of a tensor, which is transferred on a single lane.
+struct Chunk {
+  uint64_t laneIdx;
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Insert "cutpoints" at equally-spaced intervals in the buffer, rounding them
+// down if they don't end up being at an integer position, and assign each of
+// the resulting slices to its own lane.
+std::vector<Chunk> sliceEquallyAcrossLanes(uint64_t length, uint64_t numLanes) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(numLanes);
+  for (uint64_t laneIdx = 0; laneIdx < numLanes; laneIdx++) {
+    uint64_t offsetStart = length * laneIdx / numLanes;
+    uint64_t offsetEnd = length * (laneIdx + 1) / numLanes;
+    chunks.push_back(Chunk{laneIdx, offsetStart, offsetEnd - offsetStart});
+  }
+  return chunks;
+}
+
+// Split the buffer in one slice per lane, each in proportion to its weight, or
+// with the given lengths.
+std::vector<Chunk> sliceProportionallyAcrossLanes(
+    uint64_t length,
+    const std::vector<double>& laneWeights) {
+  double totalWeight = 0;
+  for (double weight : laneWeights) {
+    totalWeight += weight;
+  }
+  std::vector<Chunk> chunks;
+  chunks.reserve(laneWeights.size());
+  double cumulativeWeight = 0;
+  uint64_t offsetStart = 0;
+  for (uint64_t laneIdx = 0; laneIdx < laneWeights.size(); laneIdx++) {
+    cumulativeWeight += laneWeights[laneIdx];
+    uint64_t offsetEnd = laneIdx + 1 == laneWeights.size()
+        ? length
+        : std::min<uint64_t>(length * (cumulativeWeight / totalWeight), length);
+    offsetEnd = std::max(offsetEnd, offsetStart);
+    chunks.push_back(Chunk{laneIdx, offsetStart, offsetEnd - offsetStart});
+    offsetStart = offsetEnd;
+  }
+  return chunks;
+}
+
+std::vector<Chunk> sliceAcrossLanes(const std::vector<uint64_t>& lengths) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(lengths.size());
+  uint64_t offset = 0;
+  for (uint64_t laneIdx = 0; laneIdx < lengths.size(); laneIdx++) {
+    chunks.push_back(Chunk{laneIdx, offset, lengths[laneIdx]});
+    offset += lengths[laneIdx];
+  }
+  return chunks;
+}
+
+// Cut the buffer in chunks of the given size (except for the last one which
+// may be shorter) and assign them to the given lanes. A zero-length buffer
+// still has one (empty) chunk, in order to preserve the pairing of operations.
+std::vector<Chunk> cutInChunks(
+    uint64_t length,
+    uint64_t chunkSize,
+    const std::vector<uint64_t>& chunkLanes) {
+  std::vector<Chunk> chunks;
+  chunks.reserve(chunkLanes.size());
+  for (uint64_t chunkIdx = 0; chunkIdx < chunkLanes.size(); chunkIdx++) {
+    uint64_t offset = chunkIdx * chunkSize;
+    TP_DCHECK(offset < length || (offset == 0 && length == 0));
+    chunks.push_back(Chunk{
+        chunkLanes[chunkIdx], offset, std::min(chunkSize, length - offset)});
+  }
+  TP_DCHECK_EQ(
+      chunks.back().offset + chunks.back().length, static_cast<size_t>(length));
+  return chunks;
+}
+
 // State capturing a single send operation.
 struct SendOperation {
   uint64_t sequenceNumber;
   const void* ptr;
   size_t length;
+  std::vector<Chunk> chunks;
   int64_t numChunksBeingWritten{0};
   TSendCallback callback;
 };
@@ -43,6 +125,7 @@ struct RecvOperation {
   uint64_t sequenceNumber;
   void* ptr;
   size_t length;
+  std::vector<Chunk> chunks;
   int64_t numChunksBeingRead{0};
   TRecvCallback callback;
 };
@@ -56,6 +139,8 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
       std::shared_ptr<transport::Connection> connection,
       Endpoint endpoint,
       uint64_t numLanes,
+      uint64_t chunkSize,
+      std::vector<double> laneWeights,
       std::string id);
 
   // Called by the channel's constructor.
@@ -109,14 +194,20 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
   // operations that were performed in the meantime and queued.
   void startSendingAndReceivingUponEstablishingChannel_();
 
-  // Performs the chunking and the writing of one send operation.
+  // Assigns the chunks of a send operation to the lanes, favoring the ones
+  // that are expected to be done the soonest with what they already have,
+  // and fills in the descriptor that allows the receiver to reproduce that
+  // assignment.
+  void planChunks_(SendOperation& op, Descriptor& nopDescriptor);
+
+  // Performs the writing of the chunks of one send operation.
   void sendOperation_(SendOperation& op);
 
-  // Performs the chunking and the reading of one recv operation.
+  // Performs the reading of the chunks of one recv operation.
   void recvOperation_(RecvOperation& op);
 
   // Called when the write of one chunk of a send operation has been completed.
-  void onWriteOfPayload_(SendOperation& op);
+  void onWriteOfPayload_(SendOperation& op, const Chunk& chunk);
 
   // Called when the read of one chunk of a recv operation has been completed.
   void onReadOfPayload_(RecvOperation& op);
@@ -132,10 +223,16 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
   Endpoint endpoint_;
   State state_{UNINITIALIZED};
   uint64_t numLanes_;
+  const uint64_t chunkSize_;
+  // The relative capacities of the lanes, or empty if they're all the same.
+  const std::vector<double> laneWeights_;
   uint64_t numLanesBeingAccepted_{0};
   std::vector<std::shared_ptr<transport::Connection>> lanes_;
   std::unordered_map<uint64_t, uint64_t> laneRegistrationIds_;
 
+  // Used to balance the load among the lanes, when cutting tensors in chunks.
+  LaneBalancer laneBalancer_;
+
   // Increasing identifier for send operations.
   uint64_t nextTensorBeingSent_{0};
 
@@ -169,12 +266,16 @@ Channel::Channel(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint,
     uint64_t numLanes,
+    uint64_t chunkSize,
+    std::vector<double> laneWeights,
     std::string id)
     : impl_(std::make_shared<Impl>(
           std::move(context),
           std::move(connection),
           endpoint,
           numLanes,
+          chunkSize,
+          std::move(laneWeights),
           std::move(id))) {
   impl_->init();
 }
@@ -184,12 +285,17 @@ Channel::Impl::Impl(
     std::shared_ptr<transport::Connection> connection,
     Endpoint endpoint,
     uint64_t numLanes,
+    uint64_t chunkSize,
+    std::vector<double> laneWeights,
     std::string id)
     : context_(std::move(context)),
       connection_(std::move(connection)),
       endpoint_(endpoint),
       numLanes_(numLanes),
+      chunkSize_(chunkSize),
+      laneWeights_(std::move(laneWeights)),
       lanes_(numLanes_),
+      laneBalancer_(numLanes_, laneWeights_),
       id_(std::move(id)),
       closingReceiver_(context_, context_->getClosingEmitter()) {}
 
@@ -317,11 +423,52 @@ void Channel::Impl::sendFromLoop_(
   op.length = buffer.length;
   op.callback = std::move(callback);
 
+  TDescriptor descriptor;
+  if (chunkSize_ == 0 && laneWeights_.empty()) {
+    op.chunks = sliceEquallyAcrossLanes(op.length, numLanes_);
+  } else if (chunkSize_ == 0) {
+    // The receiver may not have the same weights, hence we tell it the slices.
+    op.chunks = sliceProportionallyAcrossLanes(op.length, laneWeights_);
+    NopHolder<Descriptor> nopHolder;
+    Descriptor& nopDescriptor = nopHolder.getObject();
+    nopDescriptor.chunkSize = 0;
+    for (const Chunk& chunk : op.chunks) {
+      nopDescriptor.sliceLengths.push_back(chunk.length);
+    }
+    descriptor = saveDescriptor(nopHolder);
+  } else {
+    NopHolder<Descriptor> nopHolder;
+    planChunks_(op, nopHolder.getObject());
+    descriptor = saveDescriptor(nopHolder);
+  }
+
   if (state_ == ESTABLISHED) {
     sendOperation_(op);
   }
 
-  descriptorCallback(Error::kSuccess, std::string());
+  descriptorCallback(Error::kSuccess, std::move(descriptor));
+}
+
+void Channel::Impl::planChunks_(SendOperation& op, Descriptor& nopDescriptor) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_GT(chunkSize_, 0);
+
+  // Even if the lanes aren't established yet the assignment can be done now,
+  // as the lanes will be written to in the order in which the chunks were
+  // assigned to them anyways.
+  uint64_t numChunks =
+      std::max<uint64_t>((op.length + chunkSize_ - 1) / chunkSize_, 1);
+  nopDescriptor.chunkSize = chunkSize_;
+  nopDescriptor.chunkLanes.reserve(numChunks);
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  for (uint64_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    uint64_t offset = chunkIdx * chunkSize_;
+    uint64_t length = std::min(chunkSize_, op.length - offset);
+    uint64_t laneIdx = laneBalancer_.assignChunk(length, now);
+    nopDescriptor.chunkLanes.push_back(laneIdx);
+  }
+  op.chunks = cutInChunks(op.length, chunkSize_, nopDescriptor.chunkLanes);
 }
 
 void Channel::recv(
@@ -368,8 +515,6 @@ void Channel::Impl::recvFromLoop_(
     return;
   }
 
-  TP_DCHECK_EQ(descriptor, std::string());
-
   recvOperations_.emplace_back();
   RecvOperation& op = recvOperations_.back();
   op.sequenceNumber = sequenceNumber;
@@ -377,6 +522,25 @@ void Channel::Impl::recvFromLoop_(
   op.length = buffer.length;
   op.callback = std::move(callback);
 
+  // The sender decides how to cut the tensor, hence we just follow its plan.
+  if (descriptor.empty()) {
+    op.chunks = sliceEquallyAcrossLanes(op.length, numLanes_);
+  } else {
+    NopHolder<Descriptor> nopHolder;
+    loadDescriptor(nopHolder, descriptor);
+    const Descriptor& nopDescriptor = nopHolder.getObject();
+    if (nopDescriptor.chunkSize == 0) {
+      TP_DCHECK_EQ(nopDescriptor.sliceLengths.size(), numLanes_);
+      op.chunks = sliceAcrossLanes(nopDescriptor.sliceLengths);
+    } else {
+      for (uint64_t laneIdx : nopDescriptor.chunkLanes) {
+        TP_DCHECK_LT(laneIdx, numLanes_);
+      }
+      op.chunks = cutInChunks(
+          op.length, nopDescriptor.chunkSize, nopDescriptor.chunkLanes);
+    }
+  }
+
   if (state_ == ESTABLISHED) {
     recvOperation_(op);
   }
@@ -468,24 +632,25 @@ void Channel::Impl::sendOperation_(SendOperation& op) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
-  for (uint64_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
-    // Insert "cutpoints" at equally-spaced intervals in the buffer, rounding
-    // them down if they don't end up being at an integer position.
-    uint64_t offsetStart = op.length * laneIdx / lanes_.size();
-    uint64_t offsetEnd = op.length * (laneIdx + 1) / lanes_.size();
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  for (const Chunk& chunk : op.chunks) {
     // As void "has no size" we cannot do pointer arithmetic on it. We need to
     // temporarily convert the pointer to a type that has a size of 1 byte.
-    const void* ptr = reinterpret_cast<const uint8_t*>(op.ptr) + offsetStart;
-    uint64_t length = offsetEnd - offsetStart;
+    const void* ptr = reinterpret_cast<const uint8_t*>(op.ptr) + chunk.offset;
+
+    if (chunkSize_ > 0) {
+      laneBalancer_.onChunkStarted(chunk.laneIdx, chunk.length, now);
+    }
 
     // Write payload.
     TP_VLOG(6) << "Channel " << id_ << " writing payload #" << op.sequenceNumber
-               << " on lane " << laneIdx;
-    lanes_[laneIdx]->write(
-        ptr, length, eagerCallbackWrapper_([&op, laneIdx](Impl& impl) {
+               << " on lane " << chunk.laneIdx;
+    lanes_[chunk.laneIdx]->write(
+        ptr, chunk.length, eagerCallbackWrapper_([&op, &chunk](Impl& impl) {
           TP_VLOG(6) << "Channel " << impl.id_ << " done writing payload #"
-                     << op.sequenceNumber << " on lane " << laneIdx;
-          impl.onWriteOfPayload_(op);
+                     << op.sequenceNumber << " on lane " << chunk.laneIdx;
+          impl.onWriteOfPayload_(op, chunk);
         }));
     ++op.numChunksBeingWritten;
   }
@@ -495,27 +660,22 @@ void Channel::Impl::recvOperation_(RecvOperation& op) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
-  for (uint64_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
-    // Insert "cutpoints" at equally-spaced intervals in the buffer, rounding
-    // them down if they don't end up being at an integer position.
-    uint64_t offsetStart = op.length * laneIdx / lanes_.size();
-    uint64_t offsetEnd = op.length * (laneIdx + 1) / lanes_.size();
+  for (const Chunk& chunk : op.chunks) {
     // As void "has no size" we cannot do pointer arithmetic on it. We need to
     // temporarily convert the pointer to a type that has a size of 1 byte.
-    void* ptr = reinterpret_cast<uint8_t*>(op.ptr) + offsetStart;
-    uint64_t length = offsetEnd - offsetStart;
+    void* ptr = reinterpret_cast<uint8_t*>(op.ptr) + chunk.offset;
 
     // Read payload.
     TP_VLOG(6) << "Channel " << id_ << " reading payload #" << op.sequenceNumber
-               << " on lane " << laneIdx;
-    lanes_[laneIdx]->read(
+               << " on lane " << chunk.laneIdx;
+    lanes_[chunk.laneIdx]->read(
         ptr,
-        length,
+        chunk.length,
         eagerCallbackWrapper_(
-            [&op, laneIdx](
+            [&op, &chunk](
                 Impl& impl, const void* /* unused */, size_t /* unused */) {
               TP_VLOG(6) << "Channel " << impl.id_ << " done reading payload #"
-                         << op.sequenceNumber << " on lane " << laneIdx;
+                         << op.sequenceNumber << " on lane " << chunk.laneIdx;
               impl.onReadOfPayload_(op);
             }));
     ++op.numChunksBeingRead;
@@ -540,19 +700,32 @@ void Channel::Impl::closeFromLoop_() {
   setError_(TP_CREATE_ERROR(ChannelClosedError));
 }
 
-void Channel::Impl::onWriteOfPayload_(SendOperation& op) {
+void Channel::Impl::onWriteOfPayload_(SendOperation& op, const Chunk& chunk) {
   TP_DCHECK(loop_.inLoop());
 
+  if (chunkSize_ > 0) {
+    // Upon errors the chunks are flushed out of order, and their timings are
+    // meaningless anyways.
+    laneBalancer_.onChunkDone(
+        chunk.laneIdx,
+        chunk.length,
+        std::chrono::steady_clock::now(),
+        /*measure=*/!error_);
+  }
+
   --op.numChunksBeingWritten;
   if (op.numChunksBeingWritten > 0) {
     return;
   }
 
-  op.callback(error_);
-
+  // As operations may not use all lanes, a later one could complete before an
+  // earlier one. Hold it back so that they are completed and removed in order.
   TP_DCHECK(!sendOperations_.empty());
-  TP_DCHECK(&op == &sendOperations_.front());
-  sendOperations_.pop_front();
+  while (!sendOperations_.empty() &&
+         sendOperations_.front().numChunksBeingWritten == 0) {
+    sendOperations_.front().callback(error_);
+    sendOperations_.pop_front();
+  }
 }
 
 void Channel::Impl::onReadOfPayload_(RecvOperation& op) {
@@ -564,11 +737,13 @@ void Channel::Impl::onReadOfPayload_(RecvOperation& op) {
     return;
   }
 
-  op.callback(error_);
-
+  // See onWriteOfPayload_ for why operations may complete out of order.
   TP_DCHECK(!recvOperations_.empty());
-  TP_DCHECK(&op == &recvOperations_.front());
-  recvOperations_.pop_front();
+  while (!recvOperations_.empty() &&
+         recvOperations_.front().numChunksBeingRead == 0) {
+    recvOperations_.front().callback(error_);
+    recvOperations_.pop_front();
+  }
 }
 
 void Channel::Impl::setError_(Error error) {
@@ -10,6 +10,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/channel/channel.h>
 #include <tensorpipe/channel/cpu_context.h>
@@ -19,7 +20,7 @@ namespace tensorpipe {
 namespace channel {
 namespace mpt {
 
-class Channel : public channel::CpuChannel {
+class Channel final : public channel::CpuChannel {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
@@ -31,6 +32,8 @@ class Channel : public channel::CpuChannel {
       std::shared_ptr<transport::Connection> connection,
       Endpoint endpoint,
       uint64_t numLanes,
+      uint64_t chunkSize,
+      std::vector<double> laneWeights,
       std::string id);
 
   // Send memory region to peer.
@@ -35,7 +35,9 @@ class Context::Impl : public Context::PrivateIface,
  public:
   Impl(
       std::vector<std::shared_ptr<transport::Context>>,
-      std::vector<std::shared_ptr<transport::Listener>>);
+      std::vector<std::shared_ptr<transport::Listener>>,
+      uint64_t chunkSize,
+      std::vector<double> laneWeights);
 
   // Called by the context's constructor.
   void init();
@@ -98,6 +100,9 @@ class Context::Impl : public Context::PrivateIface,
   std::string domainDescriptor_;
   std::atomic<bool> joined_{false};
   uint64_t numLanes_{0};
+  const uint64_t chunkSize_;
+  // Empty if all lanes have the same weight.
+  std::vector<double> laneWeights_;
   std::vector<std::string> addresses_;
 
   // This is atomic because it may be accessed from outside the loop.
@@ -135,17 +140,40 @@ class Context::Impl : public Context::PrivateIface,
 
 Context::Context(
     std::vector<std::shared_ptr<transport::Context>> contexts,
-    std::vector<std::shared_ptr<transport::Listener>> listeners)
-    : impl_(std::make_shared<Impl>(std::move(contexts), std::move(listeners))) {
+    std::vector<std::shared_ptr<transport::Listener>> listeners,
+    uint64_t chunkSize,
+    std::vector<double> laneWeights)
+    : impl_(std::make_shared<Impl>(
+          std::move(contexts),
+          std::move(listeners),
+          chunkSize,
+          std::move(laneWeights))) {
   impl_->init();
 }
 
 Context::Impl::Impl(
     std::vector<std::shared_ptr<transport::Context>> contexts,
-    std::vector<std::shared_ptr<transport::Listener>> listeners)
-    : contexts_(std::move(contexts)), listeners_(std::move(listeners)) {
+    std::vector<std::shared_ptr<transport::Listener>> listeners,
+    uint64_t chunkSize,
+    std::vector<double> laneWeights)
+    : contexts_(std::move(contexts)),
+      listeners_(std::move(listeners)),
+      chunkSize_(chunkSize),
+      laneWeights_(std::move(laneWeights)) {
   TP_THROW_ASSERT_IF(contexts_.size() != listeners_.size());
   numLanes_ = contexts_.size();
+  if (!laneWeights_.empty()) {
+    TP_THROW_ASSERT_IF(laneWeights_.size() != numLanes_)
+        << "There must be as many lane weights as lanes";
+    for (double weight : laneWeights_) {
+      TP_THROW_ASSERT_IF(!(weight > 0)) << "Lane weights must be positive";
+    }
+    if (std::all_of(laneWeights_.begin(), laneWeights_.end(), [&](double w) {
+          return w == laneWeights_[0];
+        })) {
+      laneWeights_.clear();
+    }
+  }
   // FIXME Escape the contexts' domain descriptors in case they contain a colon?
   // Or put them all in a nop object, that'll do the escaping for us.
   // But is it okay to compare nop objects by equality bitwise?
@@ -204,6 +232,8 @@ std::shared_ptr<channel::CpuChannel> Context::Impl::createChannel(
       std::move(connection),
       endpoint,
       numLanes_,
+      chunkSize_,
+      laneWeights_,
       std::move(channelId));
 }
 
@@ -19,11 +19,35 @@ namespace tensorpipe {
 namespace channel {
 namespace mpt {
 
-class Context : public channel::CpuContext {
+class Context final : public channel::CpuContext {
  public:
+  // If chunkSize is zero, each tensor is split in as many equal slices as there
+  // are lanes, and each slice is sent on its own lane. Otherwise tensors are
+  // cut in chunks of (at most) that size, each of which is sent on the lane
+  // that currently has the fewest bytes in flight. This keeps all lanes busy
+  // even when they have different bandwidths, avoids splitting small tensors in
+  // minuscule slices, and lets the receiver start on the early chunks of large
+  // tensors without waiting for the later ones. Each chunk actually goes to the
+  // lane that is expected to be done with it the soonest, based on the bytes it
+  // has in flight and on its throughput, as measured on the chunks it already
+  // sent. A lane that stalls is thus avoided until it recovers, and the load
+  // follows the lanes' bandwidths when they differ.
+  //
+  // Each lane uses the transport context at its index. Passing distinct ones
+  // (even of the same transport) gives each lane a loop of its own, rather
+  // than having all lanes share one thread. They may also be of different
+  // transports (e.g., an ibv lane alongside some uv ones), or bound to
+  // different NICs, in which case laneWeights should give their relative
+  // capacities (by default, they're all equal). Tensors are then sliced in
+  // proportion to them, and, when cut in chunks, the lanes start off with a
+  // throughput in proportion to them, until it's measured. This way slower
+  // links add their bandwidth to the one of the faster ones, rather than
+  // holding them back. Both ends must have the same lanes, in the same order.
   Context(
       std::vector<std::shared_ptr<transport::Context>>,
-      std::vector<std::shared_ptr<transport::Listener>>);
+      std::vector<std::shared_ptr<transport::Listener>>,
+      uint64_t chunkSize = 0,
+      std::vector<double> laneWeights = {});
 
   const std::string& domainDescriptor() const override;
 
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/mpt/lane_balancer.h>
+
+#include <algorithm>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace mpt {
+
+namespace {
+
+// How much each new measurement of the throughput of a lane weighs against the
+// previous ones, which lets the estimate follow changes in the conditions of
+// the lane without being thrown off by a single outlier.
+constexpr double kThroughputSmoothing = 0.25;
+
+} // namespace
+
+LaneBalancer::LaneBalancer(uint64_t numLanes, std::vector<double> laneWeights)
+    : laneWeights_(std::move(laneWeights)), laneStates_(numLanes) {
+  TP_DCHECK(laneWeights_.empty() || laneWeights_.size() == numLanes);
+}
+
+uint64_t LaneBalancer::assignChunk(uint64_t length, TTimePoint now) {
+  // Lanes that haven't completed any chunk yet are assumed to be as fast, for
+  // their weight, as the fastest one, so that they get a chance to prove
+  // themselves. Until any lane has, we can only go by the bytes in flight (for
+  // each unit of weight).
+  double fastestBytesPerSecondPerWeight = 0;
+  for (uint64_t laneIdx = 0; laneIdx < laneStates_.size(); laneIdx++) {
+    fastestBytesPerSecondPerWeight = std::max(
+        fastestBytesPerSecondPerWeight,
+        laneStates_[laneIdx].bytesPerSecond / laneWeight_(laneIdx));
+  }
+
+  uint64_t bestLaneIdx = 0;
+  double bestCost = 0;
+  for (uint64_t laneIdx = 0; laneIdx < laneStates_.size(); laneIdx++) {
+    const LaneState& lane = laneStates_[laneIdx];
+    double cost = lane.bytesInFlight + length;
+    if (fastestBytesPerSecondPerWeight == 0) {
+      cost /= laneWeight_(laneIdx);
+    } else {
+      double bytesPerSecond = lane.bytesPerSecond > 0
+          ? lane.bytesPerSecond
+          : fastestBytesPerSecondPerWeight * laneWeight_(laneIdx);
+      // A lane that has been stuck on its current chunk for longer than its
+      // throughput would suggest is slower than that, and we back off from it
+      // right away, without waiting for the chunk to complete to find out.
+      if (!lane.chunksStarted.empty()) {
+        const auto& headChunk = lane.chunksStarted.front();
+        const std::chrono::duration<double> elapsed =
+            now - std::max(headChunk.second, lane.lastDone);
+        if (elapsed.count() > 0) {
+          bytesPerSecond =
+              std::min(bytesPerSecond, headChunk.first / elapsed.count());
+        }
+      }
+      cost /= bytesPerSecond;
+    }
+    if (laneIdx == 0 || cost < bestCost) {
+      bestLaneIdx = laneIdx;
+      bestCost = cost;
+    }
+  }
+
+  laneStates_[bestLaneIdx].bytesInFlight += length;
+  return bestLaneIdx;
+}
+
+void LaneBalancer::onChunkStarted(
+    uint64_t laneIdx,
+    uint64_t length,
+    TTimePoint now) {
+  laneStates_[laneIdx].chunksStarted.emplace_back(length, now);
+}
+
+void LaneBalancer::onChunkDone(
+    uint64_t laneIdx,
+    uint64_t length,
+    TTimePoint now,
+    bool measure) {
+  LaneState& lane = laneStates_[laneIdx];
+  TP_DCHECK_GE(lane.bytesInFlight, length);
+  lane.bytesInFlight -= length;
+  if (lane.chunksStarted.empty()) {
+    return;
+  }
+  if (measure) {
+    TP_DCHECK_EQ(lane.chunksStarted.front().first, length);
+    // The chunk only started being written once the previous one was done.
+    const std::chrono::duration<double> elapsed =
+        now - std::max(lane.chunksStarted.front().second, lane.lastDone);
+    if (elapsed.count() > 0 && length > 0) {
+      const double sample = length / elapsed.count();
+      lane.bytesPerSecond = lane.bytesPerSecond > 0
+          ? (1 - kThroughputSmoothing) * lane.bytesPerSecond +
+              kThroughputSmoothing * sample
+          : sample;
+    }
+    lane.lastDone = now;
+  }
+  lane.chunksStarted.pop_front();
+}
+
+double LaneBalancer::getBytesPerSecond(uint64_t laneIdx) const {
+  return laneStates_[laneIdx].bytesPerSecond;
+}
+
+uint64_t LaneBalancer::getBytesInFlight(uint64_t laneIdx) const {
+  return laneStates_[laneIdx].bytesInFlight;
+}
+
+double LaneBalancer::laneWeight_(uint64_t laneIdx) const {
+  return laneWeights_.empty() ? 1.0 : laneWeights_[laneIdx];
+}
+
+} // namespace mpt
+} // namespace channel
+} // namespace tensorpipe
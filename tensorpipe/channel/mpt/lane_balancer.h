@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace tensorpipe {
+namespace channel {
+namespace mpt {
+
+// Keeps track of how each lane of a channel is doing, in order to balance the
+// chunks of the tensors among them. Each chunk goes to the lane that is
+// expected to be done with it the soonest, based on the bytes it has in flight
+// and on its throughput, as measured on the chunks it already wrote.
+class LaneBalancer {
+ public:
+  using TTimePoint = std::chrono::steady_clock::time_point;
+
+  // The weights give the relative capacities of the lanes, or are empty if
+  // they're all the same. Lanes start off with a throughput in proportion to
+  // them, until it's measured.
+  LaneBalancer(uint64_t numLanes, std::vector<double> laneWeights);
+
+  // Returns the lane to which a new chunk of the given length should go, and
+  // counts the chunk as in flight on that lane.
+  uint64_t assignChunk(uint64_t length, TTimePoint now);
+
+  // Called when a chunk that was assigned to the lane is handed to it. The
+  // chunks of a lane must be handed to it in the order they were assigned.
+  void onChunkStarted(uint64_t laneIdx, uint64_t length, TTimePoint now);
+
+  // Called when the lane is done with a chunk, which must be the oldest one it
+  // was handed. Unless measure is false (e.g., upon errors, as the chunks are
+  // then flushed out of order), the time it took is used to update the
+  // throughput of the lane.
+  void onChunkDone(
+      uint64_t laneIdx,
+      uint64_t length,
+      TTimePoint now,
+      bool measure);
+
+  // The measured throughput of the lane, or zero until any of its chunks is
+  // done.
+  double getBytesPerSecond(uint64_t laneIdx) const;
+
+  // The number of bytes that have been assigned to the lane and aren't done.
+  uint64_t getBytesInFlight(uint64_t laneIdx) const;
+
+ private:
+  struct LaneState {
+    uint64_t bytesInFlight{0};
+    // The length of the chunks that were handed to the lane and aren't done,
+    // and when they were handed over. They are done in this order.
+    std::deque<std::pair<uint64_t, TTimePoint>> chunksStarted;
+    TTimePoint lastDone;
+    // A moving average of the throughput of the lane, measured over the time
+    // that each chunk spent at the front of its queue.
+    double bytesPerSecond{0};
+  };
+
+  const std::vector<double> laneWeights_;
+  std::vector<LaneState> laneStates_;
+
+  double laneWeight_(uint64_t laneIdx) const;
+};
+
+} // namespace mpt
+} // namespace channel
+} // namespace tensorpipe
@@ -42,6 +42,18 @@ struct ClientHello {
 
 using Packet = nop::Variant<ServerHello, ClientHello>;
 
+// Sent along with a tensor that is striped in chunks of a fixed size, to tell
+// the receiver which lane each chunk will be written to, or, if the chunk size
+// is zero, that is split in one slice per lane, to tell the length of each of
+// them. Tensors that are split in one equally-sized slice per lane are sent
+// with an empty descriptor.
+struct Descriptor {
+  uint64_t chunkSize;
+  std::vector<uint64_t> chunkLanes;
+  std::vector<uint64_t> sliceLengths;
+  NOP_STRUCTURE(Descriptor, chunkSize, chunkLanes, sliceLengths);
+};
+
 } // namespace mpt
 } // namespace channel
 } // namespace tensorpipe
@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/quantize/channel.h>
+
+#include <cstdint>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace quantize {
+
+namespace {
+
+// Prepended to the inner channel's descriptor, to tell the receiver whether the
+// data it gets is quantized or raw.
+constexpr char kQuantizedTag = 'q';
+constexpr char kRawTag = 'r';
+
+bool isQuantizable(const CpuBuffer& buffer) {
+  return buffer.length % sizeof(float) == 0 &&
+      reinterpret_cast<uintptr_t>(buffer.ptr) % alignof(float) == 0;
+}
+
+} // namespace
+
+Channel::Channel(
+    std::shared_ptr<channel::CpuChannel> inner,
+    QuantizationFormat format,
+    size_t blockSize)
+    : inner_(std::move(inner)), format_(format), blockSize_(blockSize) {}
+
+void Channel::send(
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  if (!isQuantizable(buffer)) {
+    inner_->send(
+        buffer,
+        [descriptorCallback{std::move(descriptorCallback)}](
+            const Error& error, TDescriptor descriptor) mutable {
+          descriptorCallback(error, kRawTag + std::move(descriptor));
+        },
+        std::move(callback));
+    return;
+  }
+
+  const size_t numValues = buffer.length / sizeof(float);
+  const size_t length = quantizedLength(format_, numValues, blockSize_);
+  std::shared_ptr<uint8_t> staging(
+      new uint8_t[length], std::default_delete<uint8_t[]>());
+  tensorpipe::quantize(
+      format_,
+      reinterpret_cast<const float*>(buffer.ptr),
+      numValues,
+      staging.get(),
+      blockSize_);
+  // The source can be reused as soon as it's converted, but the caller is only
+  // told once the inner channel is done, as is the case for all channels.
+  inner_->sendOwned(
+      CpuBuffer{staging.get(), length},
+      staging,
+      [descriptorCallback{std::move(descriptorCallback)}](
+          const Error& error, TDescriptor descriptor) mutable {
+        descriptorCallback(error, kQuantizedTag + std::move(descriptor));
+      },
+      std::move(callback));
+}
+
+void Channel::recv(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  TP_THROW_ASSERT_IF(descriptor.empty()) << "Empty descriptor";
+  const char tag = descriptor[0];
+  descriptor.erase(0, 1);
+  if (tag == kRawTag) {
+    inner_->recv(std::move(descriptor), buffer, std::move(callback));
+    return;
+  }
+  TP_THROW_ASSERT_IF(tag != kQuantizedTag) << "Unknown tag: " << tag;
+  TP_THROW_ASSERT_IF(!isQuantizable(buffer))
+      << "Can't receive quantized data into a buffer of " << buffer.length
+      << " bytes at " << buffer.ptr;
+
+  const size_t numValues = buffer.length / sizeof(float);
+  const size_t length = quantizedLength(format_, numValues, blockSize_);
+  std::shared_ptr<uint8_t> staging(
+      new uint8_t[length], std::default_delete<uint8_t[]>());
+  inner_->recv(
+      std::move(descriptor),
+      CpuBuffer{staging.get(), length},
+      [format{format_},
+       blockSize{blockSize_},
+       buffer,
+       numValues,
+       staging,
+       callback{std::move(callback)}](const Error& error) mutable {
+        if (!error) {
+          tensorpipe::dequantize(
+              format,
+              staging.get(),
+              numValues,
+              reinterpret_cast<float*>(buffer.ptr),
+              blockSize);
+        }
+        staging.reset();
+        callback(error);
+      });
+}
+
+void Channel::beginBatch() {
+  inner_->beginBatch();
+}
+
+void Channel::endBatch() {
+  inner_->endBatch();
+}
+
+void Channel::setId(std::string id) {
+  inner_->setId(std::move(id));
+}
+
+void Channel::close() {
+  inner_->close();
+}
+
+Channel::~Channel() {
+  close();
+}
+
+} // namespace quantize
+} // namespace channel
+} // namespace tensorpipe
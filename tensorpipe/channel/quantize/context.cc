@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/quantize/context.h>
+
+#include <tensorpipe/channel/quantize/channel.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace quantize {
+
+Context::Context(
+    std::shared_ptr<channel::CpuContext> inner,
+    QuantizationFormat format,
+    size_t blockSize)
+    : inner_(std::move(inner)),
+      format_(format),
+      blockSize_(format == QuantizationFormat::kInt8 ? blockSize : 0),
+      prefix_(
+          "quantize:" + quantizationFormatName(format_) + ":" +
+          std::to_string(blockSize_) + ":") {
+  TP_THROW_ASSERT_IF(inner_ == nullptr) << "No inner context";
+  TP_THROW_ASSERT_IF(format_ == QuantizationFormat::kInt8 && blockSize_ == 0)
+      << "The block size must be positive";
+  domainDescriptor_ = prefix_ + inner_->domainDescriptor();
+}
+
+bool Context::isViable() const {
+  return inner_->isViable();
+}
+
+const std::string& Context::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  if (remoteDomainDescriptor.compare(0, prefix_.size(), prefix_) != 0) {
+    return false;
+  }
+  return inner_->canCommunicateWithRemote(
+      remoteDomainDescriptor.substr(prefix_.size()));
+}
+
+std::shared_ptr<CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return std::make_shared<Channel>(
+      inner_->createChannel(std::move(connection), endpoint),
+      format_,
+      blockSize_);
+}
+
+void Context::setId(std::string id) {
+  inner_->setId(std::move(id));
+}
+
+void Context::close() {
+  inner_->close();
+}
+
+void Context::closeFast() {
+  inner_->closeFast();
+}
+
+void Context::join() {
+  inner_->join();
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace quantize
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cpu_context.h>
+#include <tensorpipe/common/quantize.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace quantize {
+
+// A channel that wraps another one, and sends fp32 tensors over it in a lossy
+// format of a quarter (int8) or half (bf16, fp16) of their size, restoring them
+// to fp32 on the receiving side. This suits data that tolerates a reduced
+// precision, such as gradients. Tensors whose length isn't a whole number of
+// fp32 values are sent as they are. The conversion is done by the thread that
+// sends (or completes the receive of) the tensor.
+//
+// As this alters the data, it's meant to be registered with a maximum tensor
+// length of zero, in which case the pipe only sends over it the tensors that
+// ask for it by name (see Message::Tensor::channel). Both sides must use the
+// same format and block size, and compatible inner channels.
+class Context final : public channel::CpuContext {
+ public:
+  static constexpr size_t kDefaultBlockSize = 256;
+
+  // The block size is the number of values per scale of the int8 format.
+  Context(
+      std::shared_ptr<channel::CpuContext> inner,
+      QuantizationFormat format,
+      size_t blockSize = kDefaultBlockSize);
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void closeFast() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  const std::shared_ptr<channel::CpuContext> inner_;
+  const QuantizationFormat format_;
+  const size_t blockSize_;
+  // The format and the block size, followed by the inner channel's descriptor.
+  const std::string prefix_;
+  std::string domainDescriptor_;
+};
+
+} // namespace quantize
+} // namespace channel
+} // namespace tensorpipe
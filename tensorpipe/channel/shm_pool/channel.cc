@@ -0,0 +1,579 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_pool/channel.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/channel/shm_pool/context_impl.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/connection.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_pool {
+
+namespace {
+
+struct Descriptor {
+  std::string arenaAddress;
+  uint64_t offset;
+  // If set, the tensor isn't in the arena, and is instead passed in chunks
+  // through the staging slots of the channel, which start at the offset.
+  bool staged;
+  uint64_t chunkSize;
+  uint64_t numSlots;
+  NOP_STRUCTURE(
+      Descriptor,
+      arenaAddress,
+      offset,
+      staged,
+      chunkSize,
+      numSlots);
+};
+
+size_t numChunksOf(size_t length, size_t chunkSize) {
+  return (length + chunkSize - 1) / chunkSize;
+}
+
+} // namespace
+
+class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
+ public:
+  Impl(
+      std::shared_ptr<Context::PrivateIface>,
+      std::shared_ptr<transport::Connection>,
+      std::string);
+
+  // Called by the channel's constructor.
+  void init();
+
+  void send(
+      CpuBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  void recv(TDescriptor descriptor, CpuBuffer buffer, TRecvCallback callback);
+
+  // Tell the channel what its identifier is.
+  void setId(std::string id);
+
+  void close();
+
+  ~Impl();
+
+ private:
+  OnDemandDeferredExecutor loop_;
+
+  void initFromLoop_();
+
+  // Send memory region to peer.
+  void sendFromLoop_(
+      CpuBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  // Receive memory region from peer.
+  void recvFromLoop_(
+      TDescriptor descriptor,
+      CpuBuffer buffer,
+      TRecvCallback callback);
+
+  void setIdFromLoop_(std::string id);
+
+  void closeFromLoop_();
+
+  void setError_(Error error);
+
+  // Helper function to process transport error.
+  // Shared between read and write callback entry points.
+  void handleError_();
+
+  std::shared_ptr<Context::PrivateIface> context_;
+  std::shared_ptr<transport::Connection> connection_;
+  Error error_{Error::kSuccess};
+
+  ClosingReceiver closingReceiver_;
+
+  // Increasing identifier for send operations.
+  uint64_t nextTensorBeingSent_{0};
+
+  // Increasing identifier for recv operations.
+  uint64_t nextTensorBeingReceived_{0};
+
+  // Tensors that aren't in the arena are copied, one chunk at a time, into a
+  // ring of staging slots in the arena, which is allocated when first needed.
+  // A chunk is staged in the next slot as soon as that is free, and then the
+  // peer is notified. It copies it out and notifies us back, freeing the slot.
+  // Both sides use the slots in the same order, hence no slot indices need to
+  // be exchanged.
+  struct ChunkToStage {
+    const uint8_t* ptr;
+    size_t length;
+  };
+  std::deque<ChunkToStage> chunksToStage_;
+  void* stagingPtr_{nullptr};
+  uint64_t stagingOffset_{0};
+  size_t numFreeSlots_{0};
+  uint64_t nextSlotToStage_{0};
+
+  void stageChunks_();
+
+  // The receiver handles one tensor at a time, so that its notifications go
+  // out in the order in which the sender expects them, even if copying some
+  // tensor requires waiting for the sender to stage its chunks.
+  struct RecvOperation {
+    uint64_t sequenceNumber;
+    Descriptor descriptor;
+    CpuBuffer buffer;
+    TRecvCallback callback;
+  };
+  std::deque<RecvOperation> recvOperations_;
+  uint64_t nextSlotToRead_{0};
+
+  void startRecv_(RecvOperation& op);
+  void onRecvCompleted_();
+  void writeNotification_();
+
+  // An identifier for the channel, composed of the identifier for the context,
+  // combined with an increasing sequence number. It will only be used for
+  // logging and debugging purposes.
+  std::string id_;
+
+  LazyCallbackWrapper<Impl> lazyCallbackWrapper_{*this, this->loop_};
+  EagerCallbackWrapper<Impl> eagerCallbackWrapper_{*this, this->loop_};
+
+  // For some odd reason it seems we need to use a qualified name here...
+  template <typename T>
+  friend class tensorpipe::LazyCallbackWrapper;
+  template <typename T>
+  friend class tensorpipe::EagerCallbackWrapper;
+};
+
+Channel::Channel(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<transport::Connection> connection,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(connection),
+          std::move(id))) {
+  impl_->init();
+}
+
+Channel::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::shared_ptr<transport::Connection> connection,
+    std::string id)
+    : context_(std::move(context)),
+      connection_(std::move(connection)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Channel::Impl::init() {
+  loop_.deferToLoop([this]() { initFromLoop_(); });
+}
+
+void Channel::Impl::initFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  closingReceiver_.activate(*this);
+}
+
+void Channel::send(
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  impl_->send(buffer, std::move(descriptorCallback), std::move(callback));
+}
+
+void Channel::Impl::send(
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  loop_.deferToLoop([this,
+                     buffer,
+                     descriptorCallback{std::move(descriptorCallback)},
+                     callback{std::move(callback)}]() mutable {
+    sendFromLoop_(buffer, std::move(descriptorCallback), std::move(callback));
+  });
+}
+
+void Channel::Impl::sendFromLoop_(
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingSent_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a send request (#"
+             << sequenceNumber << ")";
+
+  descriptorCallback = [this,
+                        sequenceNumber,
+                        descriptorCallback{std::move(descriptorCallback)}](
+                           const Error& error, TDescriptor descriptor) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a descriptor callback (#"
+               << sequenceNumber << ")";
+    descriptorCallback(error, std::move(descriptor));
+    TP_VLOG(4) << "Channel " << id_ << " done calling a descriptor callback (#"
+               << sequenceNumber << ")";
+  };
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a send callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a send callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    descriptorCallback(error_, std::string());
+    callback(error_);
+    return;
+  }
+
+  NopHolder<Descriptor> nopHolder;
+  Descriptor& nopDescriptor = nopHolder.getObject();
+  nopDescriptor.arenaAddress = context_->getArenaAddress();
+
+  optional<uint64_t> offset = context_->findInArena(buffer.ptr, buffer.length);
+  if (offset.has_value()) {
+    nopDescriptor.offset = offset.value();
+    nopDescriptor.staged = false;
+
+    TP_VLOG(6) << "Channel " << id_ << " is reading notification (#"
+               << sequenceNumber << ")";
+    connection_->read(
+        nullptr,
+        0,
+        eagerCallbackWrapper_(
+            [sequenceNumber, callback{std::move(callback)}](
+                Impl& impl, const void* /* unused */, size_t /* unused */) {
+              TP_VLOG(6) << "Channel " << impl.id_
+                         << " done reading notification (#" << sequenceNumber
+                         << ")";
+              callback(impl.error_);
+            }));
+
+    descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+    return;
+  }
+
+  const size_t chunkSize = context_->getStagingChunkSize();
+  const size_t numSlots = context_->getNumStagingSlots();
+  if (stagingPtr_ == nullptr) {
+    stagingPtr_ = context_->allocate(chunkSize * numSlots);
+    if (stagingPtr_ == nullptr) {
+      setError_(TP_CREATE_ERROR(SystemError, "shm_pool arena", ENOMEM));
+      descriptorCallback(error_, std::string());
+      callback(error_);
+      return;
+    }
+    stagingOffset_ =
+        context_->findInArena(stagingPtr_, chunkSize * numSlots).value();
+    numFreeSlots_ = numSlots;
+  }
+  nopDescriptor.offset = stagingOffset_;
+  nopDescriptor.staged = true;
+  nopDescriptor.chunkSize = chunkSize;
+  nopDescriptor.numSlots = numSlots;
+
+  const size_t numChunks = numChunksOf(buffer.length, chunkSize);
+  if (numChunks == 0) {
+    descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+    callback(error_);
+    return;
+  }
+
+  // There's one notification per chunk, and the last one completes the send.
+  // The reads are all queued now, so that they stay in order with the ones of
+  // the other tensors.
+  const uint8_t* ptr = reinterpret_cast<const uint8_t*>(buffer.ptr);
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    const size_t chunkOffset = chunkIdx * chunkSize;
+    chunksToStage_.push_back(ChunkToStage{
+        ptr + chunkOffset, std::min(chunkSize, buffer.length - chunkOffset)});
+    const bool isLast = chunkIdx + 1 == numChunks;
+    connection_->read(
+        nullptr,
+        0,
+        eagerCallbackWrapper_(
+            [sequenceNumber,
+             chunkIdx,
+             callback{isLast ? std::move(callback) : TSendCallback()}](
+                Impl& impl, const void* /* unused */, size_t /* unused */) {
+              TP_VLOG(6) << "Channel " << impl.id_
+                         << " done reading notification for chunk #"
+                         << chunkIdx << " (#" << sequenceNumber << ")";
+              impl.numFreeSlots_++;
+              impl.stageChunks_();
+              if (callback) {
+                callback(impl.error_);
+              }
+            }));
+  }
+  stageChunks_();
+
+  descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
+}
+
+// Receive memory region from peer.
+void Channel::recv(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  impl_->recv(std::move(descriptor), buffer, std::move(callback));
+}
+
+void Channel::Impl::recv(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  loop_.deferToLoop([this,
+                     descriptor{std::move(descriptor)},
+                     buffer,
+                     callback{std::move(callback)}]() mutable {
+    recvFromLoop_(std::move(descriptor), buffer, std::move(callback));
+  });
+}
+
+void Channel::Impl::recvFromLoop_(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t sequenceNumber = nextTensorBeingReceived_++;
+  TP_VLOG(4) << "Channel " << id_ << " received a recv request (#"
+             << sequenceNumber << ")";
+
+  callback = [this, sequenceNumber, callback{std::move(callback)}](
+                 const Error& error) {
+    // There is no requirement for the channel to invoke callbacks in order.
+    TP_VLOG(4) << "Channel " << id_ << " is calling a recv callback (#"
+               << sequenceNumber << ")";
+    callback(error);
+    TP_VLOG(4) << "Channel " << id_ << " done calling a recv callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    callback(error_);
+    return;
+  }
+
+  NopHolder<Descriptor> nopHolder;
+  loadDescriptor(nopHolder, descriptor);
+
+  recvOperations_.push_back(RecvOperation{
+      sequenceNumber,
+      std::move(nopHolder.getObject()),
+      buffer,
+      std::move(callback)});
+  if (recvOperations_.size() == 1) {
+    startRecv_(recvOperations_.front());
+  }
+}
+
+void Channel::Impl::startRecv_(RecvOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (error_) {
+    onRecvCompleted_();
+    return;
+  }
+
+  const uint64_t sequenceNumber = op.sequenceNumber;
+  const Descriptor& descriptor = op.descriptor;
+  if (!descriptor.staged) {
+    TP_VLOG(6) << "Channel " << id_ << " is copying payload (#"
+               << sequenceNumber << ")";
+    context_->requestCopy(
+        descriptor.arenaAddress,
+        descriptor.offset,
+        op.buffer.ptr,
+        op.buffer.length,
+        eagerCallbackWrapper_([sequenceNumber](Impl& impl) {
+          TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
+                     << sequenceNumber << ")";
+          impl.writeNotification_();
+          impl.onRecvCompleted_();
+        }));
+    return;
+  }
+
+  const size_t chunkSize = descriptor.chunkSize;
+  const size_t numChunks = numChunksOf(op.buffer.length, chunkSize);
+  if (numChunks == 0) {
+    onRecvCompleted_();
+    return;
+  }
+
+  uint8_t* ptr = reinterpret_cast<uint8_t*>(op.buffer.ptr);
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    const size_t chunkOffset = chunkIdx * chunkSize;
+    const size_t length = std::min(chunkSize, op.buffer.length - chunkOffset);
+    const bool isLast = chunkIdx + 1 == numChunks;
+    connection_->read(
+        nullptr,
+        0,
+        eagerCallbackWrapper_([sequenceNumber,
+                               chunkIdx,
+                               isLast,
+                               arenaAddress{descriptor.arenaAddress},
+                               offset{descriptor.offset},
+                               numSlots{descriptor.numSlots},
+                               chunkSize,
+                               localPtr{ptr + chunkOffset},
+                               length](
+                                  Impl& impl,
+                                  const void* /* unused */,
+                                  size_t /* unused */) {
+          if (impl.error_) {
+            if (isLast) {
+              impl.onRecvCompleted_();
+            }
+            return;
+          }
+          const uint64_t slotIdx = impl.nextSlotToRead_++ % numSlots;
+          TP_VLOG(6) << "Channel " << impl.id_ << " is copying chunk #"
+                     << chunkIdx << " from slot " << slotIdx << " (#"
+                     << sequenceNumber << ")";
+          impl.context_->requestCopy(
+              arenaAddress,
+              offset + slotIdx * chunkSize,
+              localPtr,
+              length,
+              impl.eagerCallbackWrapper_([isLast](Impl& impl) {
+                impl.writeNotification_();
+                if (isLast) {
+                  impl.onRecvCompleted_();
+                }
+              }));
+        }));
+  }
+}
+
+void Channel::Impl::onRecvCompleted_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(!recvOperations_.empty());
+
+  RecvOperation op = std::move(recvOperations_.front());
+  recvOperations_.pop_front();
+  op.callback(error_);
+  if (!recvOperations_.empty()) {
+    startRecv_(recvOperations_.front());
+  }
+}
+
+void Channel::Impl::writeNotification_() {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  connection_->write(nullptr, 0, lazyCallbackWrapper_([](Impl& /* unused */) {
+                     }));
+}
+
+void Channel::Impl::stageChunks_() {
+  TP_DCHECK(loop_.inLoop());
+
+  const size_t chunkSize = context_->getStagingChunkSize();
+  const size_t numSlots = context_->getNumStagingSlots();
+  while (!error_ && numFreeSlots_ > 0 && !chunksToStage_.empty()) {
+    ChunkToStage chunk = chunksToStage_.front();
+    chunksToStage_.pop_front();
+    numFreeSlots_--;
+    const uint64_t slotIdx = nextSlotToStage_++ % numSlots;
+    context_->requestStaging(
+        chunk.ptr,
+        stagingOffset_ + slotIdx * chunkSize,
+        chunk.length,
+        eagerCallbackWrapper_(
+            [](Impl& impl) { impl.writeNotification_(); }));
+  }
+}
+
+void Channel::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Channel::Impl::setId(std::string id) {
+  loop_.deferToLoop(
+      [this, id{std::move(id)}]() mutable { setIdFromLoop_(std::move(id)); });
+}
+
+void Channel::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Channel::close() {
+  impl_->close();
+}
+
+Channel::~Channel() {
+  close();
+}
+
+Channel::Impl::~Impl() {
+  // This runs once all the callbacks of the context (which hold a reference to
+  // this object) have fired, thus we're done writing to the staging slots.
+  if (stagingPtr_ != nullptr) {
+    context_->deallocate(stagingPtr_);
+  }
+}
+
+void Channel::Impl::close() {
+  loop_.deferToLoop([this]() { closeFromLoop_(); });
+}
+
+void Channel::Impl::closeFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(4) << "Channel " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ChannelClosedError));
+}
+
+void Channel::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError_();
+}
+
+void Channel::Impl::handleError_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(5) << "Channel " << id_ << " is handling error " << error_.what();
+
+  connection_->close();
+}
+
+} // namespace shm_pool
+} // namespace channel
+} // namespace tensorpipe
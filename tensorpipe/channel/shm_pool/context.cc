@@ -0,0 +1,526 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_pool/context.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/channel/helpers.h>
+#include <tensorpipe/channel/shm_pool/channel.h>
+#include <tensorpipe/channel/shm_pool/context_impl.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/transport/shm/sockaddr.h>
+#include <tensorpipe/util/shm/segment.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_pool {
+
+namespace {
+
+// Allocations are aligned to cache lines, so that tensors allocated next to
+// each other don't share any.
+constexpr size_t kAlignment = 64;
+
+std::string generateDomainDescriptor() {
+  std::ostringstream oss;
+  auto bootID = getBootID();
+  TP_THROW_ASSERT_IF(!bootID) << "Unable to read boot_id";
+
+  // The arena is handed over through an abstract UNIX domain socket, and these
+  // are only visible within the same network namespace.
+  struct stat sb;
+  int rv = ::stat("/proc/self/ns/net", &sb);
+  TP_THROW_SYSTEM_IF(rv < 0, errno) << "Unable to stat network namespace";
+
+  oss << "shm_pool:" << bootID.value() << "/" << sb.st_ino;
+  return oss.str();
+}
+
+std::string generateArenaAddress() {
+  static std::atomic<uint64_t> arenaCounter{0};
+  std::ostringstream oss;
+  oss << "tensorpipe_shm_pool_" << ::getpid() << "_" << arenaCounter++;
+  return oss.str();
+}
+
+Error fetchArena(const std::string& address, util::shm::Segment& segment) {
+  Error error;
+  Socket socket;
+  std::tie(error, socket) = Socket::createForFamily(AF_UNIX);
+  if (error) {
+    return error;
+  }
+  error = socket.block(true);
+  if (error) {
+    return error;
+  }
+  error = socket.connect(
+      transport::shm::Sockaddr::createAbstractUnixAddr(address));
+  if (error) {
+    return error;
+  }
+  Fd fd;
+  error = socket.recvFds(fd);
+  if (error) {
+    return error;
+  }
+  segment = util::shm::Segment(
+      std::move(fd), /*perm_write=*/false, util::shm::PageType::Default);
+  return Error::kSuccess;
+}
+
+} // namespace
+
+class Context::Impl : public Context::PrivateIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(size_t arenaSize, size_t stagingChunkSize, size_t numStagingSlots);
+
+  const std::string& domainDescriptor() const;
+
+  std::map<std::string, uint64_t> getStats();
+
+  std::shared_ptr<channel::CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint);
+
+  void setId(std::string id);
+
+  ClosingEmitter& getClosingEmitter() override;
+
+  const std::string& getArenaAddress() const override;
+
+  size_t getStagingChunkSize() const override;
+
+  size_t getNumStagingSlots() const override;
+
+  optional<uint64_t> findInArena(const void* ptr, size_t length)
+      const override;
+
+  void* allocate(size_t length) override;
+
+  void deallocate(void* ptr) override;
+
+  void requestCopy(
+      std::string remoteArenaAddress,
+      uint64_t remoteOffset,
+      void* localPtr,
+      size_t length,
+      copy_request_callback_fn fn) override;
+
+  void requestStaging(
+      const void* localPtr,
+      uint64_t arenaOffset,
+      size_t length,
+      copy_request_callback_fn fn) override;
+
+  void close();
+
+  void join();
+
+  ~Impl() override = default;
+
+ private:
+  // Copies either out of a remote arena or, if the address is empty, from the
+  // source pointer (which is used to stage chunks into the local arena).
+  struct CopyRequest {
+    std::string remoteArenaAddress;
+    uint64_t remoteOffset;
+    void* localPtr;
+    size_t length;
+    copy_request_callback_fn callback;
+    const void* sourcePtr{nullptr};
+  };
+
+  std::string domainDescriptor_;
+
+  util::shm::Segment arena_;
+  uint8_t* arenaPtr_;
+  size_t arenaSize_;
+  const size_t stagingChunkSize_;
+  const size_t numStagingSlots_;
+
+  // The free regions of the arena, by offset, and the length of the allocated
+  // ones, also by offset. Adjacent free regions are always merged. Guarded by
+  // the mutex, as users may allocate from any thread.
+  std::map<uint64_t, size_t> freeRegions_;
+  std::unordered_map<uint64_t, size_t> allocatedRegions_;
+  size_t numAllocatedBytes_{0};
+  std::mutex arenaMutex_;
+
+  // Peers connect to this socket to receive the file descriptor of the arena.
+  std::string arenaAddress_;
+  Socket arenaSocket_;
+  std::thread arenaThread_;
+
+  // The copies (out of the arenas of the peers, and into the staging slots of
+  // our own) are performed, in order, by a single thread, which also maps the
+  // arenas of the peers the first time it needs them. They stay mapped until
+  // this context is joined. Only accessed by that thread.
+  std::thread copyThread_;
+  Queue<optional<CopyRequest>> requests_;
+  std::unordered_map<std::string, util::shm::Segment> remoteArenas_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  ClosingEmitter closingEmitter_;
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the channel's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Sequence numbers for the channels created by this context, used to create
+  // their identifiers based off this context's identifier. They will only be
+  // used for logging and debugging.
+  std::atomic<uint64_t> channelCounter_{0};
+
+  void serveArena_();
+  void handleCopyRequests_();
+};
+
+Context::Context(
+    size_t arenaSize,
+    size_t stagingChunkSize,
+    size_t numStagingSlots)
+    : impl_(std::make_shared<Context::Impl>(
+          arenaSize,
+          stagingChunkSize,
+          numStagingSlots)) {}
+
+Context::Impl::Impl(
+    size_t arenaSize,
+    size_t stagingChunkSize,
+    size_t numStagingSlots)
+    : domainDescriptor_(generateDomainDescriptor()),
+      arena_(arenaSize, /*perm_write=*/true, util::shm::PageType::Default),
+      arenaPtr_(reinterpret_cast<uint8_t*>(arena_.getPtr())),
+      arenaSize_(arenaSize),
+      stagingChunkSize_(stagingChunkSize),
+      numStagingSlots_(numStagingSlots),
+      arenaAddress_(generateArenaAddress()),
+      requests_(std::numeric_limits<int>::max()) {
+  TP_THROW_ASSERT_IF(arenaSize == 0) << "The arena cannot be empty";
+  TP_THROW_ASSERT_IF(stagingChunkSize == 0) << "Chunks cannot be empty";
+  TP_THROW_ASSERT_IF(numStagingSlots == 0) << "At least one slot is needed";
+  freeRegions_.emplace(0, arenaSize_);
+
+  Error error;
+  std::tie(error, arenaSocket_) = Socket::createForFamily(AF_UNIX);
+  TP_THROW_ASSERT_IF(error) << error.what();
+  error = arenaSocket_.block(true);
+  TP_THROW_ASSERT_IF(error) << error.what();
+  error = arenaSocket_.bind(
+      transport::shm::Sockaddr::createAbstractUnixAddr(arenaAddress_));
+  TP_THROW_ASSERT_IF(error) << error.what();
+  error = arenaSocket_.listen(128);
+  TP_THROW_ASSERT_IF(error) << error.what();
+
+  arenaThread_ = std::thread(&Impl::serveArena_, this);
+  copyThread_ = std::thread(&Impl::handleCopyRequests_, this);
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is closing";
+
+    closingEmitter_.close();
+    // This wakes up the thread blocked in accept.
+    ::shutdown(arenaSocket_.fd(), SHUT_RDWR);
+    requests_.push(nullopt);
+
+    TP_VLOG(4) << "Channel context " << id_ << " done closing";
+  }
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(4) << "Channel context " << id_ << " is joining";
+
+    arenaThread_.join();
+    copyThread_.join();
+    remoteArenas_.clear();
+
+    TP_VLOG(4) << "Channel context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(4) << "Channel context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+ClosingEmitter& Context::Impl::getClosingEmitter() {
+  return closingEmitter_;
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() {
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  return {
+      {"memory.arena", arenaSize_},
+      {"memory.arena_allocated", numAllocatedBytes_},
+  };
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+const std::string& Context::Impl::getArenaAddress() const {
+  return arenaAddress_;
+}
+
+size_t Context::Impl::getStagingChunkSize() const {
+  return stagingChunkSize_;
+}
+
+size_t Context::Impl::getNumStagingSlots() const {
+  return numStagingSlots_;
+}
+
+std::shared_ptr<channel::CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return impl_->createChannel(std::move(connection), endpoint);
+}
+
+std::shared_ptr<channel::CpuChannel> Context::Impl::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint /* unused */) {
+  TP_THROW_ASSERT_IF(joined_);
+  std::string channelId = id_ + ".c" + std::to_string(channelCounter_++);
+  TP_VLOG(4) << "Channel context " << id_ << " is opening channel "
+             << channelId;
+  return std::make_shared<Channel>(
+      Channel::ConstructorToken(),
+      std::static_pointer_cast<PrivateIface>(shared_from_this()),
+      std::move(connection),
+      std::move(channelId));
+}
+
+void* Context::allocate(size_t length) {
+  return impl_->allocate(length);
+}
+
+void* Context::Impl::allocate(size_t length) {
+  const size_t alignedLength =
+      (std::max<size_t>(length, 1) + kAlignment - 1) / kAlignment * kAlignment;
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  // First fit, which keeps the lower part of the arena (and thus fewer pages)
+  // in use when only a few tensors are live.
+  for (auto it = freeRegions_.begin(); it != freeRegions_.end(); ++it) {
+    if (it->second < alignedLength) {
+      continue;
+    }
+    const uint64_t offset = it->first;
+    const size_t remaining = it->second - alignedLength;
+    freeRegions_.erase(it);
+    if (remaining > 0) {
+      freeRegions_.emplace(offset + alignedLength, remaining);
+    }
+    allocatedRegions_.emplace(offset, alignedLength);
+    numAllocatedBytes_ += alignedLength;
+    return arenaPtr_ + offset;
+  }
+  return nullptr;
+}
+
+void Context::deallocate(void* ptr) {
+  impl_->deallocate(ptr);
+}
+
+void Context::Impl::deallocate(void* ptr) {
+  const uint64_t offset = reinterpret_cast<uint8_t*>(ptr) - arenaPtr_;
+  std::unique_lock<std::mutex> lock(arenaMutex_);
+  auto allocatedIt = allocatedRegions_.find(offset);
+  TP_THROW_ASSERT_IF(allocatedIt == allocatedRegions_.end())
+      << "Buffer wasn't allocated in the arena";
+  size_t length = allocatedIt->second;
+  allocatedRegions_.erase(allocatedIt);
+  numAllocatedBytes_ -= length;
+
+  uint64_t start = offset;
+  auto nextIt = freeRegions_.lower_bound(offset);
+  if (nextIt != freeRegions_.end() && nextIt->first == offset + length) {
+    length += nextIt->second;
+    nextIt = freeRegions_.erase(nextIt);
+  }
+  if (nextIt != freeRegions_.begin()) {
+    auto prevIt = std::prev(nextIt);
+    if (prevIt->first + prevIt->second == offset) {
+      start = prevIt->first;
+      length += prevIt->second;
+      freeRegions_.erase(prevIt);
+    }
+  }
+  freeRegions_.emplace(start, length);
+}
+
+optional<uint64_t> Context::Impl::findInArena(const void* ptr, size_t length)
+    const {
+  const uint8_t* bytePtr = reinterpret_cast<const uint8_t*>(ptr);
+  if (bytePtr < arenaPtr_ || bytePtr + length > arenaPtr_ + arenaSize_) {
+    return nullopt;
+  }
+  return bytePtr - arenaPtr_;
+}
+
+void Context::Impl::requestCopy(
+    std::string remoteArenaAddress,
+    uint64_t remoteOffset,
+    void* localPtr,
+    size_t length,
+    copy_request_callback_fn fn) {
+  requests_.push(CopyRequest{
+      std::move(remoteArenaAddress),
+      remoteOffset,
+      localPtr,
+      length,
+      std::move(fn)});
+}
+
+void Context::Impl::requestStaging(
+    const void* localPtr,
+    uint64_t arenaOffset,
+    size_t length,
+    copy_request_callback_fn fn) {
+  TP_DCHECK_LE(arenaOffset + length, arenaSize_);
+  requests_.push(CopyRequest{
+      std::string(),
+      0,
+      arenaPtr_ + arenaOffset,
+      length,
+      std::move(fn),
+      localPtr});
+}
+
+void Context::Impl::serveArena_() {
+  initCurrentThread("TP_SHM_POOL_arena");
+  while (true) {
+    Error error;
+    Socket socket;
+    std::tie(error, socket) = arenaSocket_.accept();
+    if (closed_) {
+      break;
+    }
+    if (error) {
+      TP_VLOG(5) << "Channel context " << id_
+                 << " failed to accept a request for the arena: "
+                 << error.what();
+      continue;
+    }
+    error = socket.sendFds(arena_.getFd());
+    if (error) {
+      TP_VLOG(5) << "Channel context " << id_
+                 << " failed to send the arena: " << error.what();
+    }
+  }
+}
+
+void Context::Impl::handleCopyRequests_() {
+  initCurrentThread("TP_SHM_POOL_loop");
+  while (true) {
+    auto maybeRequest = requests_.pop();
+    if (!maybeRequest.has_value()) {
+      break;
+    }
+    CopyRequest request = std::move(maybeRequest.value());
+    if (request.length == 0) {
+      request.callback(Error::kSuccess);
+      continue;
+    }
+    if (request.remoteArenaAddress.empty()) {
+      std::memcpy(request.localPtr, request.sourcePtr, request.length);
+      request.callback(Error::kSuccess);
+      continue;
+    }
+
+    auto iter = remoteArenas_.find(request.remoteArenaAddress);
+    if (iter == remoteArenas_.end()) {
+      util::shm::Segment segment;
+      Error error = fetchArena(request.remoteArenaAddress, segment);
+      if (error) {
+        request.callback(error);
+        continue;
+      }
+      TP_VLOG(5) << "Channel context " << id_ << " mapped the arena at "
+                 << request.remoteArenaAddress;
+      iter = remoteArenas_
+                 .emplace(request.remoteArenaAddress, std::move(segment))
+                 .first;
+    }
+    const util::shm::Segment& segment = iter->second;
+    if (request.remoteOffset + request.length > segment.getSize()) {
+      request.callback(TP_CREATE_ERROR(
+          ShortReadError,
+          request.length,
+          segment.getSize() -
+              std::min<size_t>(request.remoteOffset, segment.getSize())));
+      continue;
+    }
+    std::memcpy(
+        request.localPtr,
+        reinterpret_cast<const uint8_t*>(segment.getPtr()) +
+            request.remoteOffset,
+        request.length);
+    request.callback(Error::kSuccess);
+  }
+}
+
+} // namespace shm_pool
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cpu_context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_pool {
+
+class Context final : public channel::CpuContext {
+ public:
+  // Each context allocates an arena of arenaSize bytes of shared memory, which
+  // its peers on the same machine map into their address space (the file
+  // descriptor is passed over a UNIX domain socket, hence no ptrace permission
+  // is needed). A tensor that was allocated in the arena (see allocate) is sent
+  // by only telling the peer where it is in it, which then copies it straight
+  // into the destination buffer. Other tensors go through a ring of numSlots
+  // staging slots of stagingChunkSize bytes that each channel allocates in the
+  // arena: they're split in chunks, each of which is copied into a slot and
+  // then out of it by the peer, with the copies of the two sides overlapping.
+  explicit Context(
+      size_t arenaSize = 256 * 1024 * 1024,
+      size_t stagingChunkSize = 1024 * 1024,
+      size_t numStagingSlots = 4);
+
+  // Allocate a buffer of the given length in the arena, so that it can be sent
+  // without being copied on this side. Returns nullptr if the arena doesn't
+  // have a large enough free region. The buffer must be released with
+  // deallocate, and not before the send operations that use it have completed.
+  // This can be called from any thread.
+  void* allocate(size_t length);
+
+  void deallocate(void* ptr);
+
+  const std::string& domainDescriptor() const override;
+
+  // Reports the size of the arena, and how much of it is allocated.
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow channel to see the private interface.
+  friend class Channel;
+};
+
+} // namespace shm_pool
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <tensorpipe/channel/shm_pool/context.h>
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace shm_pool {
+
+class Context::PrivateIface {
+ public:
+  virtual ClosingEmitter& getClosingEmitter() = 0;
+
+  // The address at which peers can fetch the file descriptor of the arena.
+  virtual const std::string& getArenaAddress() const = 0;
+
+  // The offset of the buffer within the arena, if it lies entirely in it.
+  virtual optional<uint64_t> findInArena(const void* ptr, size_t length)
+      const = 0;
+
+  virtual void* allocate(size_t length) = 0;
+
+  virtual void deallocate(void* ptr) = 0;
+
+  // The staging slots that each channel uses to send tensors that aren't in
+  // the arena.
+  virtual size_t getStagingChunkSize() const = 0;
+
+  virtual size_t getNumStagingSlots() const = 0;
+
+  using copy_request_callback_fn = Function<void(const Error&)>;
+
+  // Copy out of the arena of a peer, mapping it first if needed.
+  virtual void requestCopy(
+      std::string remoteArenaAddress,
+      uint64_t remoteOffset,
+      void* localPtr,
+      size_t length,
+      copy_request_callback_fn fn) = 0;
+
+  // Copy into this context's arena, on the same thread as the other copies.
+  virtual void requestStaging(
+      const void* localPtr,
+      uint64_t arenaOffset,
+      size_t length,
+      copy_request_callback_fn fn) = 0;
+
+  virtual ~PrivateIface() = default;
+};
+
+} // namespace shm_pool
+} // namespace channel
+} // namespace tensorpipe
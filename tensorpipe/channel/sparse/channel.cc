@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/sparse/channel.h>
+
+#include <cstdint>
+
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/sparse.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace sparse {
+
+namespace {
+
+// The descriptor of the inner channel is prefixed with the format, given by
+// its tag, and, unless dense, with the encoded length and a separator.
+char tagOf(SparseFormat format) {
+  switch (format) {
+    case SparseFormat::kDense:
+      return 'd';
+    case SparseFormat::kBlocks:
+      return 'b';
+    case SparseFormat::kPairs:
+      return 'p';
+  }
+  TP_THROW_ASSERT() << "Unknown sparse format";
+  // Dummy return to make the compiler happy.
+  return 0;
+}
+
+SparseFormat formatOf(char tag) {
+  for (SparseFormat format :
+       {SparseFormat::kDense, SparseFormat::kBlocks, SparseFormat::kPairs}) {
+    if (tagOf(format) == tag) {
+      return format;
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown tag: " << tag;
+  // Dummy return to make the compiler happy.
+  return SparseFormat::kDense;
+}
+
+} // namespace
+
+Channel::Channel(std::shared_ptr<channel::CpuChannel> inner, size_t threshold)
+    : inner_(std::move(inner)), threshold_(threshold) {}
+
+void Channel::send(
+    CpuBuffer buffer,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  SparseEncoding encoding{SparseFormat::kDense, buffer.length};
+  if (buffer.length >= threshold_) {
+    encoding = chooseSparseEncoding(buffer.ptr, buffer.length);
+  }
+  if (encoding.format == SparseFormat::kDense) {
+    inner_->send(
+        buffer,
+        [descriptorCallback{std::move(descriptorCallback)}](
+            const Error& error, TDescriptor descriptor) mutable {
+          descriptorCallback(
+              error, tagOf(SparseFormat::kDense) + std::move(descriptor));
+        },
+        std::move(callback));
+    return;
+  }
+
+  std::shared_ptr<uint8_t> staging(
+      new uint8_t[encoding.length], std::default_delete<uint8_t[]>());
+  sparseEncode(encoding.format, buffer.ptr, buffer.length, staging.get());
+  inner_->sendOwned(
+      CpuBuffer{staging.get(), encoding.length},
+      staging,
+      [prefix{tagOf(encoding.format) + std::to_string(encoding.length) + ":"},
+       descriptorCallback{std::move(descriptorCallback)}](
+          const Error& error, TDescriptor descriptor) mutable {
+        descriptorCallback(error, prefix + std::move(descriptor));
+      },
+      std::move(callback));
+}
+
+void Channel::recv(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvCallback callback) {
+  TP_THROW_ASSERT_IF(descriptor.empty()) << "Empty descriptor";
+  const SparseFormat format = formatOf(descriptor[0]);
+  if (format == SparseFormat::kDense) {
+    // This goes straight into the destination.
+    inner_->recv(descriptor.substr(1), buffer, std::move(callback));
+    return;
+  }
+  const size_t separator = descriptor.find(':');
+  TP_THROW_ASSERT_IF(separator == std::string::npos)
+      << "Malformed descriptor: " << descriptor;
+  const size_t length = std::stoull(descriptor.substr(1, separator - 1));
+
+  std::shared_ptr<uint8_t> staging(
+      new uint8_t[length], std::default_delete<uint8_t[]>());
+  inner_->recv(
+      descriptor.substr(separator + 1),
+      CpuBuffer{staging.get(), length},
+      [format,
+       length,
+       buffer,
+       staging,
+       callback{std::move(callback)}](const Error& error) mutable {
+        if (error) {
+          callback(error);
+          return;
+        }
+        const bool success = sparseDecode(
+            format, staging.get(), length, buffer.ptr, buffer.length);
+        staging.reset();
+        callback(
+            success ? Error::kSuccess
+                    : TP_CREATE_ERROR(DecompressionError, "sparse encoding"));
+      });
+}
+
+void Channel::beginBatch() {
+  inner_->beginBatch();
+}
+
+void Channel::endBatch() {
+  inner_->endBatch();
+}
+
+void Channel::setId(std::string id) {
+  inner_->setId(std::move(id));
+}
+
+void Channel::close() {
+  inner_->close();
+}
+
+Channel::~Channel() {
+  close();
+}
+
+} // namespace sparse
+} // namespace channel
+} // namespace tensorpipe
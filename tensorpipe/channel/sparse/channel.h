@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/channel.h>
+#include <tensorpipe/channel/cpu_context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace sparse {
+
+// Encodes the tensors, and leaves their transfer to the inner channel. The
+// encoded data is owned by the callbacks of the inner channel.
+class Channel final : public channel::CpuChannel {
+ public:
+  Channel(std::shared_ptr<channel::CpuChannel> inner, size_t threshold);
+
+  // Send memory region to peer.
+  void send(
+      CpuBuffer buffer,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback) override;
+
+  // Receive memory region from peer.
+  void recv(TDescriptor descriptor, CpuBuffer buffer, TRecvCallback callback)
+      override;
+
+  void beginBatch() override;
+
+  void endBatch() override;
+
+  // Tell the channel what its identifier is.
+  void setId(std::string id) override;
+
+  void close() override;
+
+  ~Channel() override;
+
+ private:
+  const std::shared_ptr<channel::CpuChannel> inner_;
+  const size_t threshold_;
+};
+
+} // namespace sparse
+} // namespace channel
+} // namespace tensorpipe
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/sparse/context.h>
+
+#include <tensorpipe/channel/sparse/channel.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace sparse {
+
+namespace {
+
+const std::string kDomainDescriptorPrefix = "sparse:";
+
+} // namespace
+
+Context::Context(std::shared_ptr<channel::CpuContext> inner, size_t threshold)
+    : inner_(std::move(inner)), threshold_(threshold) {
+  TP_THROW_ASSERT_IF(inner_ == nullptr) << "No inner context";
+  domainDescriptor_ = kDomainDescriptorPrefix + inner_->domainDescriptor();
+}
+
+bool Context::isViable() const {
+  return inner_->isViable();
+}
+
+const std::string& Context::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  if (remoteDomainDescriptor.compare(
+          0, kDomainDescriptorPrefix.size(), kDomainDescriptorPrefix) != 0) {
+    return false;
+  }
+  return inner_->canCommunicateWithRemote(
+      remoteDomainDescriptor.substr(kDomainDescriptorPrefix.size()));
+}
+
+std::shared_ptr<CpuChannel> Context::createChannel(
+    std::shared_ptr<transport::Connection> connection,
+    Endpoint endpoint) {
+  return std::make_shared<Channel>(
+      inner_->createChannel(std::move(connection), endpoint), threshold_);
+}
+
+void Context::setId(std::string id) {
+  inner_->setId(std::move(id));
+}
+
+void Context::close() {
+  inner_->close();
+}
+
+void Context::closeFast() {
+  inner_->closeFast();
+}
+
+void Context::join() {
+  inner_->join();
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace sparse
+} // namespace channel
+} // namespace tensorpipe
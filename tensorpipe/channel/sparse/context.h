@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/channel/cpu_context.h>
+
+namespace tensorpipe {
+namespace channel {
+namespace sparse {
+
+// A channel that wraps another one (e.g., basic or MPT), and sends tensors that
+// are mostly zeros over it in a sparse encoding (see common/sparse.h) whenever
+// that is shorter. The sender scans and encodes each tensor in the thread that
+// sends it, and the receiver decodes it into the destination buffer once the
+// inner channel has received it. Tensors that aren't sparse enough, or shorter
+// than the threshold, go over the inner channel as they are.
+class Context final : public channel::CpuContext {
+ public:
+  static constexpr size_t kDefaultThreshold = 64 * 1024;
+
+  explicit Context(
+      std::shared_ptr<channel::CpuContext> inner,
+      size_t threshold = kDefaultThreshold);
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  std::shared_ptr<CpuChannel> createChannel(
+      std::shared_ptr<transport::Connection>,
+      Endpoint) override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void closeFast() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  const std::shared_ptr<channel::CpuContext> inner_;
+  const size_t threshold_;
+  std::string domainDescriptor_;
+};
+
+} // namespace sparse
+} // namespace channel
+} // namespace tensorpipe
@@ -8,6 +8,13 @@
 
 #include <tensorpipe/channel/xth/channel.h>
 
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #include <nop/serializer.h>
 #include <nop/structure.h>
 
@@ -28,9 +35,47 @@ namespace {
 
 struct Descriptor {
   uint64_t ptr;
-  NOP_STRUCTURE(Descriptor, ptr);
+  // If non-zero, the sender handed its memory over, and the receiver must take
+  // it from the registry below under this handle.
+  uint64_t handle;
+  NOP_STRUCTURE(Descriptor, ptr, handle);
+};
+
+// The memory that senders handed over, until their receivers take it. This is
+// shared by the whole process, as the two ends of a channel may belong to
+// different contexts.
+class HandedOverMemory {
+ public:
+  uint64_t add(std::shared_ptr<void> owner) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const uint64_t handle = nextHandle_++;
+    owners_.emplace(handle, std::move(owner));
+    return handle;
+  }
+
+  // Return null if there's no such memory (anymore).
+  std::shared_ptr<void> take(uint64_t handle) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto iter = owners_.find(handle);
+    if (iter == owners_.end()) {
+      return nullptr;
+    }
+    std::shared_ptr<void> owner = std::move(iter->second);
+    owners_.erase(iter);
+    return owner;
+  }
+
+ private:
+  std::mutex mutex_;
+  uint64_t nextHandle_{1};
+  std::unordered_map<uint64_t, std::shared_ptr<void>> owners_;
 };
 
+HandedOverMemory& getHandedOverMemory() {
+  static HandedOverMemory memory;
+  return memory;
+}
+
 } // namespace
 
 class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
@@ -50,6 +95,17 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
 
   void recv(TDescriptor descriptor, CpuBuffer buffer, TRecvCallback callback);
 
+  void sendOwned(
+      CpuBuffer buffer,
+      std::shared_ptr<void> owner,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback);
+
+  void recvOwned(
+      TDescriptor descriptor,
+      CpuBuffer buffer,
+      TRecvOwnedCallback callback);
+
   // Tell the channel what its identifier is.
   void setId(std::string id);
 
@@ -60,17 +116,23 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
 
   void initFromLoop_();
 
-  // Send memory region to peer.
+  // Send memory region to peer. If an owner is given, the memory is handed
+  // over rather than copied, when the peer allows for it.
   void sendFromLoop_(
       CpuBuffer buffer,
+      std::shared_ptr<void> owner,
       TDescriptorCallback descriptorCallback,
       TSendCallback callback);
 
-  // Receive memory region from peer.
+  // Receive memory region from peer. If owned, the memory is provided by the
+  // channel, which takes the sender's one if it was handed over.
   void recvFromLoop_(
       TDescriptor descriptor,
       CpuBuffer buffer,
-      TRecvCallback callback);
+      bool owned,
+      TRecvOwnedCallback callback);
+
+  void writeNotification_(uint64_t sequenceNumber);
 
   void setIdFromLoop_(std::string id);
 
@@ -94,6 +156,15 @@ class Channel::Impl : public std::enable_shared_from_this<Channel::Impl> {
   // Increasing identifier for recv operations.
   uint64_t nextTensorBeingReceived_{0};
 
+  // The context may complete copies out of order, as it gives priority to the
+  // small ones, but the peer matches the notifications we send to its send
+  // operations in order. Thus we hold back the copies that complete early until
+  // all the ones before them have completed too.
+  uint64_t nextTensorToComplete_{0};
+  std::map<uint64_t, Function<void()>> earlyCompletedCopies_;
+
+  void onCopyCompleted_(uint64_t sequenceNumber, Function<void()> fn);
+
   // An identifier for the channel, composed of the identifier for the context,
   // combined with an increasing sequence number. It will only be used for
   // logging and debugging purposes.
@@ -150,16 +221,43 @@ void Channel::Impl::send(
     CpuBuffer buffer,
     TDescriptorCallback descriptorCallback,
     TSendCallback callback) {
+  sendOwned(
+      buffer, nullptr, std::move(descriptorCallback), std::move(callback));
+}
+
+void Channel::sendOwned(
+    CpuBuffer buffer,
+    std::shared_ptr<void> owner,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
+  impl_->sendOwned(
+      buffer,
+      std::move(owner),
+      std::move(descriptorCallback),
+      std::move(callback));
+}
+
+void Channel::Impl::sendOwned(
+    CpuBuffer buffer,
+    std::shared_ptr<void> owner,
+    TDescriptorCallback descriptorCallback,
+    TSendCallback callback) {
   loop_.deferToLoop([this,
                      buffer,
+                     owner{std::move(owner)},
                      descriptorCallback{std::move(descriptorCallback)},
                      callback{std::move(callback)}]() mutable {
-    sendFromLoop_(buffer, std::move(descriptorCallback), std::move(callback));
+    sendFromLoop_(
+        buffer,
+        std::move(owner),
+        std::move(descriptorCallback),
+        std::move(callback));
   });
 }
 
 void Channel::Impl::sendFromLoop_(
     CpuBuffer buffer,
+    std::shared_ptr<void> owner,
     TDescriptorCallback descriptorCallback,
     TSendCallback callback) {
   TP_DCHECK(loop_.inLoop());
@@ -195,23 +293,32 @@ void Channel::Impl::sendFromLoop_(
     return;
   }
 
+  // If the peer doesn't take the memory (i.e., if it fails), reclaim it once
+  // the send is over, so that it doesn't stay in the registry.
+  const uint64_t handle =
+      owner != nullptr ? getHandedOverMemory().add(std::move(owner)) : 0;
+
   TP_VLOG(6) << "Channel " << id_ << " is reading notification (#"
              << sequenceNumber << ")";
   connection_->read(
       nullptr,
       0,
       eagerCallbackWrapper_(
-          [sequenceNumber, callback{std::move(callback)}](
+          [sequenceNumber, handle, callback{std::move(callback)}](
               Impl& impl, const void* /* unused */, size_t /* unused */) {
             TP_VLOG(6) << "Channel " << impl.id_
                        << " done reading notification (#" << sequenceNumber
                        << ")";
+            if (handle != 0) {
+              getHandedOverMemory().take(handle);
+            }
             callback(impl.error_);
           }));
 
   NopHolder<Descriptor> nopHolder;
   Descriptor& nopDescriptor = nopHolder.getObject();
   nopDescriptor.ptr = reinterpret_cast<std::uintptr_t>(buffer.ptr);
+  nopDescriptor.handle = handle;
 
   descriptorCallback(Error::kSuccess, saveDescriptor(nopHolder));
 }
@@ -232,14 +339,42 @@ void Channel::Impl::recv(
                      descriptor{std::move(descriptor)},
                      buffer,
                      callback{std::move(callback)}]() mutable {
-    recvFromLoop_(std::move(descriptor), buffer, std::move(callback));
+    recvFromLoop_(
+        std::move(descriptor),
+        buffer,
+        /*owned=*/false,
+        [callback{std::move(callback)}](
+            const Error& error,
+            CpuBuffer /* unused */,
+            std::shared_ptr<void> /* unused */) mutable { callback(error); });
+  });
+}
+
+void Channel::recvOwned(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvOwnedCallback callback) {
+  impl_->recvOwned(std::move(descriptor), buffer, std::move(callback));
+}
+
+void Channel::Impl::recvOwned(
+    TDescriptor descriptor,
+    CpuBuffer buffer,
+    TRecvOwnedCallback callback) {
+  loop_.deferToLoop([this,
+                     descriptor{std::move(descriptor)},
+                     buffer,
+                     callback{std::move(callback)}]() mutable {
+    recvFromLoop_(
+        std::move(descriptor), buffer, /*owned=*/true, std::move(callback));
   });
 }
 
 void Channel::Impl::recvFromLoop_(
     TDescriptor descriptor,
     CpuBuffer buffer,
-    TRecvCallback callback) {
+    bool owned,
+    TRecvOwnedCallback callback) {
   TP_DCHECK(loop_.inLoop());
 
   const uint64_t sequenceNumber = nextTensorBeingReceived_++;
@@ -247,16 +382,23 @@ void Channel::Impl::recvFromLoop_(
              << sequenceNumber << ")";
 
   callback = [this, sequenceNumber, callback{std::move(callback)}](
-                 const Error& error) {
+                 const Error& error,
+                 CpuBuffer buffer,
+                 std::shared_ptr<void> owner) {
     TP_VLOG(4) << "Channel " << id_ << " is calling a recv callback (#"
                << sequenceNumber << ")";
-    callback(error);
+    callback(error, buffer, std::move(owner));
     TP_VLOG(4) << "Channel " << id_ << " done calling a recv callback (#"
                << sequenceNumber << ")";
   };
 
   if (error_) {
-    callback(error_);
+    // There's no copy nor notification for this one, but it still completes
+    // in order, so that it neither overtakes nor holds back the other ones.
+    onCopyCompleted_(
+        sequenceNumber, [this, buffer, callback{std::move(callback)}]() {
+          callback(error_, buffer, nullptr);
+        });
     return;
   }
 
@@ -264,6 +406,47 @@ void Channel::Impl::recvFromLoop_(
   loadDescriptor(nopHolder, descriptor);
   Descriptor& nopDescriptor = nopHolder.getObject();
   void* remotePtr = reinterpret_cast<void*>(nopDescriptor.ptr);
+
+  // The memory handed over by the sender, which we either keep, or hold on to
+  // while copying from it.
+  std::shared_ptr<void> remoteOwner;
+  if (nopDescriptor.handle != 0) {
+    remoteOwner = getHandedOverMemory().take(nopDescriptor.handle);
+    if (remoteOwner == nullptr) {
+      // The sender already reclaimed it, which it only does when failing.
+      setError_(TP_CREATE_ERROR(ChannelClosedError));
+      onCopyCompleted_(
+          sequenceNumber, [this, buffer, callback{std::move(callback)}]() {
+            callback(error_, buffer, nullptr);
+          });
+      return;
+    }
+  }
+
+  if (owned && remoteOwner != nullptr) {
+    TP_VLOG(6) << "Channel " << id_ << " took over payload (#"
+               << sequenceNumber << ")";
+    buffer.ptr = remotePtr;
+    onCopyCompleted_(
+        sequenceNumber,
+        [this,
+         sequenceNumber,
+         buffer,
+         remoteOwner{std::move(remoteOwner)},
+         callback{std::move(callback)}]() mutable {
+          writeNotification_(sequenceNumber);
+          callback(error_, buffer, std::move(remoteOwner));
+        });
+    return;
+  }
+
+  std::shared_ptr<void> owner;
+  if (owned) {
+    owner = std::shared_ptr<uint8_t>(
+        new uint8_t[buffer.length], std::default_delete<uint8_t[]>());
+    buffer.ptr = owner.get();
+  }
+
   TP_VLOG(6) << "Channel " << id_ << " is copying payload (#" << sequenceNumber
              << ")";
   context_->requestCopy(
@@ -271,23 +454,55 @@ void Channel::Impl::recvFromLoop_(
       buffer.ptr,
       buffer.length,
       eagerCallbackWrapper_([sequenceNumber,
-                             callback{std::move(callback)}](Impl& impl) {
+                             buffer,
+                             remoteOwner{std::move(remoteOwner)},
+                             owner{std::move(owner)},
+                             callback{std::move(callback)}](
+                                Impl& impl) mutable {
         TP_VLOG(6) << "Channel " << impl.id_ << " done copying payload (#"
                    << sequenceNumber << ")";
-        // Let peer know we've completed the copy.
-        TP_VLOG(6) << "Channel " << impl.id_ << " is writing notification (#"
-                   << sequenceNumber << ")";
-        impl.connection_->write(
-            nullptr, 0, impl.lazyCallbackWrapper_([sequenceNumber](Impl& impl) {
-              TP_VLOG(6) << "Channel " << impl.id_
-                         << " done writing notification (#" << sequenceNumber
-                         << ")";
-            }));
-
-        callback(impl.error_);
+        remoteOwner.reset();
+        impl.onCopyCompleted_(
+            sequenceNumber,
+            [&impl,
+             sequenceNumber,
+             buffer,
+             owner{std::move(owner)},
+             callback{std::move(callback)}]() mutable {
+              impl.writeNotification_(sequenceNumber);
+              callback(impl.error_, buffer, std::move(owner));
+            });
       }));
 }
 
+void Channel::Impl::writeNotification_(uint64_t sequenceNumber) {
+  TP_DCHECK(loop_.inLoop());
+  // Let peer know we've completed the copy.
+  TP_VLOG(6) << "Channel " << id_ << " is writing notification (#"
+             << sequenceNumber << ")";
+  connection_->write(
+      nullptr, 0, lazyCallbackWrapper_([sequenceNumber](Impl& impl) {
+        TP_VLOG(6) << "Channel " << impl.id_
+                   << " done writing notification (#" << sequenceNumber
+                   << ")";
+      }));
+}
+
+void Channel::Impl::onCopyCompleted_(
+    uint64_t sequenceNumber,
+    Function<void()> fn) {
+  TP_DCHECK(loop_.inLoop());
+  earlyCompletedCopies_.emplace(sequenceNumber, std::move(fn));
+  while (!earlyCompletedCopies_.empty() &&
+         earlyCompletedCopies_.begin()->first == nextTensorToComplete_) {
+    Function<void()> nextFn =
+        std::move(earlyCompletedCopies_.begin()->second);
+    earlyCompletedCopies_.erase(earlyCompletedCopies_.begin());
+    nextTensorToComplete_++;
+    nextFn();
+  }
+}
+
 void Channel::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -19,7 +19,7 @@ namespace tensorpipe {
 namespace channel {
 namespace xth {
 
-class Channel : public channel::CpuChannel {
+class Channel final : public channel::CpuChannel {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
@@ -41,6 +41,19 @@ class Channel : public channel::CpuChannel {
   void recv(TDescriptor descriptor, CpuBuffer buffer, TRecvCallback callback)
       override;
 
+  // Hand the sender's memory over to the receiver, if it also gets it through
+  // recvOwned, instead of copying it.
+  void sendOwned(
+      CpuBuffer buffer,
+      std::shared_ptr<void> owner,
+      TDescriptorCallback descriptorCallback,
+      TSendCallback callback) override;
+
+  void recvOwned(
+      TDescriptor descriptor,
+      CpuBuffer buffer,
+      TRecvOwnedCallback callback) override;
+
   // Tell the channel what its identifier is.
   void setId(std::string id) override;
 
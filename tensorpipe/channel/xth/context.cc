@@ -10,18 +10,26 @@
 
 #include <unistd.h>
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
 #include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
 
+#include <tensorpipe/channel/copy_chunks.h>
 #include <tensorpipe/channel/error.h>
 #include <tensorpipe/channel/helpers.h>
 #include <tensorpipe/channel/xth/channel.h>
 #include <tensorpipe/channel/xth/context_impl.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/copy.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dsa.h>
 #include <tensorpipe/common/error_macros.h>
 #include <tensorpipe/common/optional.h>
-#include <tensorpipe/common/queue.h>
 #include <tensorpipe/common/system.h>
 
 namespace tensorpipe {
@@ -48,7 +56,11 @@ std::string generateDomainDescriptor() {
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  Impl(
+      size_t numThreads,
+      size_t minChunkSize,
+      bool nonTemporalStores,
+      bool copyOffload);
 
   const std::string& domainDescriptor() const;
 
@@ -60,7 +72,7 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter& getClosingEmitter() override;
 
-  using copy_request_callback_fn = std::function<void(const Error&)>;
+  using copy_request_callback_fn = Function<void(const Error&)>;
 
   void requestCopy(
       void* remotePtr,
@@ -70,21 +82,48 @@ class Context::Impl : public Context::PrivateIface,
 
   void close();
 
+  void closeFast();
+
   void join();
 
   ~Impl() override = default;
 
  private:
   struct CopyRequest {
+    copy_request_callback_fn callback;
+    // The number of chunks of this request that haven't been copied yet.
+    std::atomic<size_t> numPendingChunks;
+    // Whether any of its chunks was dropped rather than copied.
+    std::atomic<bool> dropped{false};
+  };
+
+  // A slice of a request that is copied by a single thread.
+  struct CopyChunk {
+    std::shared_ptr<CopyRequest> request;
     void* remotePtr;
     void* localPtr;
     size_t length;
-    copy_request_callback_fn callback;
   };
 
   std::string domainDescriptor_;
-  std::thread thread_;
-  Queue<optional<CopyRequest>> requests_;
+  const size_t minChunkSize_;
+  // Chunks at least this large are copied with non-temporal stores.
+  const size_t nonTemporalThreshold_;
+  // Only set if offloading was requested and a copy engine is available.
+  std::shared_ptr<DsaCopyEngine> copyEngine_;
+  std::vector<std::thread> threads_;
+
+  // The chunks waiting to be copied. Those of requests that weren't split are
+  // in the priority queue, which is always drained first. Guarded by the mutex.
+  std::deque<CopyChunk> priorityChunks_;
+  std::deque<CopyChunk> chunks_;
+  bool stopping_{false};
+  // Set by closeFast, to have the threads drop the chunks still in the queues
+  // rather than finishing them before stopping.
+  bool dropping_{false};
+  std::mutex chunksMutex_;
+  std::condition_variable chunksCv_;
+
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   ClosingEmitter closingEmitter_;
@@ -105,12 +144,36 @@ class Context::Impl : public Context::PrivateIface,
   void handleCopyRequests_();
 };
 
-Context::Context() : impl_(std::make_shared<Context::Impl>()) {}
-
-Context::Impl::Impl()
+Context::Context(
+    size_t numThreads,
+    size_t minChunkSize,
+    bool nonTemporalStores,
+    bool copyOffload)
+    : impl_(std::make_shared<Context::Impl>(
+          numThreads,
+          minChunkSize,
+          nonTemporalStores,
+          copyOffload)) {}
+
+Context::Impl::Impl(
+    size_t numThreads,
+    size_t minChunkSize,
+    bool nonTemporalStores,
+    bool copyOffload)
     : domainDescriptor_(generateDomainDescriptor()),
-      requests_(std::numeric_limits<int>::max()) {
-  thread_ = std::thread(&Impl::handleCopyRequests_, this);
+      minChunkSize_(minChunkSize),
+      nonTemporalThreshold_(
+          nonTemporalStores ? getLastLevelCacheSize()
+                            : std::numeric_limits<size_t>::max()),
+      copyEngine_(copyOffload ? DsaCopyEngine::create() : nullptr) {
+  TP_THROW_ASSERT_IF(numThreads == 0) << "At least one thread is needed";
+  TP_THROW_ASSERT_IF(minChunkSize == 0) << "Chunks cannot be empty";
+  if (copyOffload && copyEngine_ == nullptr) {
+    TP_VLOG(4) << "No copy engine is available, copies will use the CPU";
+  }
+  for (size_t threadIdx = 0; threadIdx < numThreads; threadIdx++) {
+    threads_.emplace_back(&Impl::handleCopyRequests_, this);
+  }
 }
 
 void Context::close() {
@@ -122,12 +185,28 @@ void Context::Impl::close() {
     TP_VLOG(4) << "Channel context " << id_ << " is closing";
 
     closingEmitter_.close();
-    requests_.push(nullopt);
+    {
+      std::unique_lock<std::mutex> lock(chunksMutex_);
+      stopping_ = true;
+    }
+    chunksCv_.notify_all();
 
     TP_VLOG(4) << "Channel context " << id_ << " done closing";
   }
 }
 
+void Context::closeFast() {
+  impl_->closeFast();
+}
+
+void Context::Impl::closeFast() {
+  {
+    std::unique_lock<std::mutex> lock(chunksMutex_);
+    dropping_ = true;
+  }
+  close();
+}
+
 void Context::join() {
   impl_->join();
 }
@@ -138,7 +217,9 @@ void Context::Impl::join() {
   if (!joined_.exchange(true)) {
     TP_VLOG(4) << "Channel context " << id_ << " is joining";
 
-    thread_.join();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
     // TP_DCHECK(requests_.empty());
 
     TP_VLOG(4) << "Channel context " << id_ << " done joining";
@@ -194,7 +275,7 @@ void Context::Impl::requestCopy(
     void* remotePtr,
     void* localPtr,
     size_t length,
-    std::function<void(const Error&)> fn) {
+    Function<void(const Error&)> fn) {
   uint64_t requestId = nextRequestId_++;
   TP_VLOG(4) << "Channel context " << id_ << " received a copy request (#"
              << requestId << ")";
@@ -208,26 +289,76 @@ void Context::Impl::requestCopy(
                << ")";
   };
 
-  requests_.push(CopyRequest{remotePtr, localPtr, length, std::move(fn)});
+  // Split the request in chunks, unless it's too small.
+  const CopyChunks chunks =
+      cutCopyInChunks(length, threads_.size(), minChunkSize_);
+  const size_t numChunks = chunks.numChunks;
+  const size_t chunkSize = chunks.chunkSize;
+
+  auto request = std::make_shared<CopyRequest>();
+  request->callback = std::move(fn);
+  request->numPendingChunks = numChunks;
+
+  {
+    std::unique_lock<std::mutex> lock(chunksMutex_);
+    auto& queue = numChunks == 1 ? priorityChunks_ : chunks_;
+    for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+      const size_t offset = chunkIdx * chunkSize;
+      queue.push_back(CopyChunk{
+          request,
+          reinterpret_cast<uint8_t*>(remotePtr) + offset,
+          reinterpret_cast<uint8_t*>(localPtr) + offset,
+          std::min(chunkSize, length - offset)});
+    }
+  }
+  if (numChunks == 1) {
+    chunksCv_.notify_one();
+  } else {
+    chunksCv_.notify_all();
+  }
 }
 
 void Context::Impl::handleCopyRequests_() {
-  setThreadName("TP_XTH_loop");
+  initCurrentThread("TP_XTH_loop");
   while (true) {
-    auto maybeRequest = requests_.pop();
-    if (!maybeRequest.has_value()) {
-      break;
+    CopyChunk chunk;
+    bool drop;
+    {
+      std::unique_lock<std::mutex> lock(chunksMutex_);
+      chunksCv_.wait(lock, [&]() {
+        return stopping_ || !priorityChunks_.empty() || !chunks_.empty();
+      });
+      // Finish the pending copies before stopping.
+      auto& queue = !priorityChunks_.empty() ? priorityChunks_ : chunks_;
+      if (queue.empty()) {
+        break;
+      }
+      chunk = std::move(queue.front());
+      queue.pop_front();
+      drop = dropping_;
     }
-    CopyRequest request = std::move(maybeRequest).value();
 
     // Don't even call memcpy on a length of 0 to avoid issues with the pointer
     // possibly being null.
-    if (request.length > 0) {
+    if (drop) {
+      chunk.request->dropped = true;
+    } else if (copyEngine_ != nullptr &&
+        chunk.length >= DsaCopyEngine::kMinOffloadLength) {
+      copyEngine_->copy(chunk.localPtr, chunk.remotePtr, chunk.length);
+    } else if (chunk.length >= nonTemporalThreshold_) {
+      copyNonTemporal(chunk.localPtr, chunk.remotePtr, chunk.length);
+    } else if (chunk.length > 0) {
       // Perform copy.
-      std::memcpy(request.localPtr, request.remotePtr, request.length);
+      std::memcpy(chunk.localPtr, chunk.remotePtr, chunk.length);
     }
 
-    request.callback(Error::kSuccess);
+    if (--chunk.request->numPendingChunks == 0) {
+      if (chunk.request->dropped) {
+        chunk.request->callback(TP_CREATE_ERROR(ContextClosedError));
+      } else {
+        chunk.request->callback(Error::kSuccess);
+      }
+    }
   }
 }
 
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <cstddef>
 #include <memory>
 #include <string>
 
@@ -17,9 +18,24 @@ namespace tensorpipe {
 namespace channel {
 namespace xth {
 
-class Context : public channel::CpuContext {
+class Context final : public channel::CpuContext {
  public:
-  Context();
+  // Copies are performed by a pool of numThreads threads. Copies that are at
+  // least twice as large as minChunkSize are split into chunks (of at least
+  // that size, and no more than one per thread) which are performed in
+  // parallel, whereas smaller copies are handed to a single thread as a whole,
+  // and are given priority over the chunks of larger ones so that they don't
+  // get stuck behind them. If nonTemporalStores is set, chunks larger than the
+  // last-level cache are copied with non-temporal stores (where supported), to
+  // avoid evicting the entire cache for data that won't be read back soon.
+  // If copyOffload is set, large chunks are instead handed to a hardware copy
+  // engine (see DsaCopyEngine), if the host has one, with the threads polling
+  // for their completion.
+  explicit Context(
+      size_t numThreads = 1,
+      size_t minChunkSize = 1024 * 1024,
+      bool nonTemporalStores = false,
+      bool copyOffload = false);
 
   const std::string& domainDescriptor() const override;
 
@@ -31,6 +47,8 @@ class Context : public channel::CpuContext {
 
   void close() override;
 
+  void closeFast() override;
+
   void join() override;
 
   ~Context() override;
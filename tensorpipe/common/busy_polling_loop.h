@@ -8,48 +8,253 @@
 
 #pragma once
 
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <ctime>
+#include <limits>
 #include <string>
 #include <thread>
 #include <utility>
 
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/cpu_budget.h>
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/system.h>
 
 namespace tensorpipe {
 
+// A word that a busy-polling loop sets while it's asleep, and which whoever
+// hands it some work must check afterwards in order to find out whether they
+// need to wake it up. It's kept separate so that it may live in shared memory
+// and allow the loop to be woken up by other processes (it's used as a futex,
+// which works across processes as long as it's not flagged as private). A loop
+// may instead sleep in epoll, on an eventfd, which it then flags in the word.
+struct BusyPollingSleepWord {
+  static constexpr uint32_t kAwake = 0;
+  static constexpr uint32_t kAsleep = 1;
+  static constexpr uint32_t kAsleepOnEventFd = 2;
+
+  std::atomic<uint32_t> state{kAwake};
+
+  // To be called after having handed some work to the loop (e.g., having
+  // written to a ringbuffer it polls). It's cheap when the loop is awake, as it
+  // then amounts to reading a cache line that's rarely written to. The eventfd
+  // is the loop's one, if it has any, for when it sleeps on it.
+  void wakeUpIfAsleep(int eventFd = -1) {
+    // Pairs with the fence in BusyPollingLoop::sleep_, to ensure that either
+    // we see that the loop is asleep or the loop sees the work we handed it.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (unlikely(state.load(std::memory_order_relaxed) != kAwake)) {
+      const uint32_t previousState = state.exchange(kAwake);
+      if (previousState == kAsleep) {
+        ::syscall(SYS_futex, &state, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+      } else if (previousState == kAsleepOnEventFd && eventFd >= 0) {
+        // This can only fail if the counter would overflow, in which case the
+        // eventfd is readable anyways.
+        const uint64_t one = 1;
+        const ssize_t rv = ::write(eventFd, &one, sizeof(one));
+        (void)rv;
+      }
+    }
+  }
+};
+
 class BusyPollingLoop : public EventLoopDeferredExecutor {
+ public:
+  // Under a CPU budget (see cpu_budget.h), a policy that never sleeps may be
+  // replaced with one that does, if the budget has no room for another thread
+  // that spins.
+  explicit BusyPollingLoop(BusyPollingPolicy policy = BusyPollingPolicy())
+      : policy_(applyCpuBudget(std::move(policy), spinningPermit_)) {}
+
+  // How many times the loop has polled for work, how many of these found none,
+  // and how many deferred functions are waiting to run. They're meant for
+  // monitoring, and may be read from any thread.
+  uint64_t getNumPolls() const {
+    return numPolls_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumEmptyPolls() const {
+    return numEmptyPolls_.load(std::memory_order_relaxed);
+  }
+
+  int64_t getNumDeferredFunctions() const {
+    return deferredFunctionCount_.load(std::memory_order_relaxed);
+  }
+
  protected:
   virtual bool pollOnce() = 0;
 
   virtual bool readyToClose() = 0;
 
+  // Called when about to go to sleep, right before polling one last time.
+  // Subclasses whose sources of work are able to wake the thread up on their
+  // own (through the sleep word) should arm them here, so that the sleep
+  // doesn't last until the timeout.
+  virtual void prepareToSleep() {}
+
+  const BusyPollingPolicy& getPolicy() const {
+    return policy_;
+  }
+
   void stopBusyPolling() {
     closed_ = true;
-    // No need to wake up the thread, since it is busy-waiting.
+    // The thread may have gone to sleep.
+    sleepWord_->wakeUpIfAsleep(wakeupEventFd_);
+  }
+
+  // Subclasses that are handed work from outside of this process must provide
+  // a sleep word that such other processes can access, and have them check it.
+  // Must be called before the thread is started.
+  void setSleepWord(BusyPollingSleepWord& sleepWord) {
+    sleepWord_ = &sleepWord;
+  }
+
+  // Have the thread sleep in epoll_wait(2) on the given epoll fd, rather than
+  // on the sleep word's futex. The epoll fd must contain the eventfd (which
+  // must be non-blocking), and whoever hands work to the loop must then also
+  // have access to the latter. It may contain other fds, whose events then wake
+  // the loop up directly. Must be called before the thread is started.
+  void setWakeupEventFd(int eventFd, int epollFd) {
+    wakeupEventFd_ = eventFd;
+    wakeupEpollFd_ = epollFd;
+  }
+
+  bool sleepsOnEventFd() const {
+    return wakeupEpollFd_ >= 0;
   }
 
   void eventLoop() override {
+    auto lastActive = std::chrono::steady_clock::now();
     while (!closed_ || !readyToClose()) {
-      if (pollOnce()) {
-        // continue
+      const bool foundWork = pollOnce();
+      increment_(numPolls_);
+      if (foundWork) {
+        lastActive = std::chrono::steady_clock::now();
       } else if (deferredFunctionCount_ > 0) {
         deferredFunctionCount_ -= runDeferredFunctionsFromEventLoop();
+        lastActive = std::chrono::steady_clock::now();
       } else {
-        std::this_thread::yield();
+        increment_(numEmptyPolls_);
+        backOff_(lastActive);
       }
     }
   };
 
   void wakeupEventLoopToDeferFunction() override {
     ++deferredFunctionCount_;
-    // No need to wake up the thread, since it is busy-waiting.
+    sleepWord_->wakeUpIfAsleep(wakeupEventFd_);
+  };
+
+  void wakeupEventLoopToDeferFunctions(size_t numFunctions) override {
+    deferredFunctionCount_ += numFunctions;
+    sleepWord_->wakeUpIfAsleep(wakeupEventFd_);
   };
 
  private:
+  // Held for as long as the loop exists, if its policy never sleeps and the
+  // CPU budget allowed it to keep spinning.
+  SpinningPermit spinningPermit_;
+  const BusyPollingPolicy policy_;
+
   std::atomic<bool> closed_{false};
 
   std::atomic<int64_t> deferredFunctionCount_{0};
+
+  std::atomic<uint64_t> numPolls_{0};
+  std::atomic<uint64_t> numEmptyPolls_{0};
+
+  // The counters are only written by the loop's thread, hence they don't need
+  // an atomic read-modify-write, which would be costly on such a hot path.
+  static void increment_(std::atomic<uint64_t>& counter) {
+    counter.store(
+        counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  BusyPollingSleepWord ownSleepWord_;
+  BusyPollingSleepWord* sleepWord_{&ownSleepWord_};
+
+  int wakeupEventFd_{-1};
+  int wakeupEpollFd_{-1};
+
+  void backOff_(std::chrono::steady_clock::time_point& lastActive) {
+    const auto idleFor = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - lastActive);
+    if (idleFor < policy_.spinFor) {
+      return;
+    }
+    // Careful not to overflow, as yieldFor is often set to the maximum.
+    if (idleFor - policy_.spinFor < policy_.yieldFor) {
+      std::this_thread::yield();
+      return;
+    }
+    sleep_();
+    // Whatever woke us up is likely to be followed by more, hence go back to
+    // spinning for a while.
+    lastActive = std::chrono::steady_clock::now();
+  }
+
+  void sleep_() {
+    sleepWord_->state.store(
+        sleepsOnEventFd() ? BusyPollingSleepWord::kAsleepOnEventFd
+                          : BusyPollingSleepWord::kAsleep);
+    // Pairs with the fence in BusyPollingSleepWord::wakeUpIfAsleep, to ensure
+    // we don't miss work handed to us just before we announced we're asleep.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    prepareToSleep();
+    if (closed_ || deferredFunctionCount_ > 0 || pollOnce()) {
+      sleepWord_->state.store(BusyPollingSleepWord::kAwake);
+      return;
+    }
+    if (sleepsOnEventFd()) {
+      sleepOnEventFd_();
+      sleepWord_->state.store(BusyPollingSleepWord::kAwake);
+      return;
+    }
+    const auto sleepForNs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(policy_.sleepFor)
+            .count();
+    struct timespec timeout;
+    timeout.tv_sec = sleepForNs / 1000000000;
+    timeout.tv_nsec = sleepForNs % 1000000000;
+    // Spurious wakeups, timeouts and a mismatching value (meaning we were
+    // already woken up) are all fine, as we'll just poll again.
+    ::syscall(
+        SYS_futex,
+        &sleepWord_->state,
+        FUTEX_WAIT,
+        BusyPollingSleepWord::kAsleep,
+        &timeout,
+        nullptr,
+        0);
+    sleepWord_->state.store(BusyPollingSleepWord::kAwake);
+  }
+
+  void sleepOnEventFd_() {
+    // Round up, so that a short sleep doesn't turn into a busy loop.
+    const int64_t sleepForUs = policy_.sleepFor.count();
+    const int64_t sleepForMs =
+        sleepForUs / 1000 + (sleepForUs % 1000 != 0 ? 1 : 0);
+    struct epoll_event event;
+    // Interruptions and timeouts are fine, as we'll just poll again.
+    ::epoll_wait(
+        wakeupEpollFd_,
+        &event,
+        /*maxevents=*/1,
+        static_cast<int>(
+            std::min<int64_t>(sleepForMs, std::numeric_limits<int>::max())));
+    // Reset the eventfd, whether or not it was what woke us up. A wakeup that
+    // comes in right after this is just a spurious one for the next sleep.
+    uint64_t count;
+    const ssize_t rv = ::read(wakeupEventFd_, &count, sizeof(count));
+    (void)rv;
+  }
 };
 
 } // namespace tensorpipe
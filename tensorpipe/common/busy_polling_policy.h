@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+
+namespace tensorpipe {
+
+// Controls how the threads of the transports that busy-poll (i.e., shm and
+// ibv) behave when they run out of work. After having last found something to
+// do, the thread keeps polling relentlessly for spinFor, then it keeps polling
+// but yields the CPU between attempts for yieldFor, and then it goes to sleep
+// until someone hands it some work, or until sleepFor has elapsed (after which
+// it polls once more and goes back to sleep if there still is nothing to do).
+//
+// The default values reproduce the historical behavior, where the thread never
+// goes to sleep and thus keeps using a whole core even when idle, in exchange
+// for the lowest possible wakeup latency at all times.
+struct BusyPollingPolicy {
+  std::chrono::microseconds spinFor{0};
+  std::chrono::microseconds yieldFor{std::chrono::microseconds::max()};
+  std::chrono::microseconds sleepFor{std::chrono::milliseconds(10)};
+
+  // Whether the thread ever goes to sleep.
+  bool sleeps() const {
+    return yieldFor != std::chrono::microseconds::max();
+  }
+
+  // A policy that trades a few microseconds of latency on the first message
+  // after a period of inactivity for not burning any CPU while idle.
+  static BusyPollingPolicy adaptive() {
+    BusyPollingPolicy policy;
+    policy.spinFor = std::chrono::microseconds(50);
+    policy.yieldFor = std::chrono::microseconds(1000);
+    return policy;
+  }
+};
+
+} // namespace tensorpipe
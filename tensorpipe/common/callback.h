@@ -20,6 +20,7 @@
 #include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/optional.h>
 
 namespace tensorpipe {
@@ -73,7 +74,7 @@ auto cb_apply(F&& f, T&& t) {
 // unarmed are stashed and will be delayed until a callback is provided again.
 template <typename... Args>
 class RearmableCallback {
-  using TFn = std::function<void(Args...)>;
+  using TFn = Function<void(Args...)>;
   using TStoredArgs = std::tuple<typename std::remove_reference<Args>::type...>;
 
  public:
@@ -119,6 +120,13 @@ class RearmableCallback {
 // (thus allowing the object to be destroyed without the callback having fired)
 // and because in case of error it will deal with it on its own and won't end up
 // invoking the actual callback.
+// The weak_ptr is obtained once, the first time a callback is wrapped, and then
+// each callback copies it, which costs a single atomic increment on the control
+// block of the subject, rather than the three it takes to go through a
+// shared_ptr. Callbacks are only wrapped from within the loop, hence the cached
+// weak_ptr needs no synchronization. They fire on other threads though, thus
+// they still need to lock it to check that the subject (which owns the loop) is
+// alive before deferring to it.
 template <typename TSubject>
 class LazyCallbackWrapper {
  public:
@@ -129,21 +137,29 @@ class LazyCallbackWrapper {
 
   template <typename TBoundFn>
   auto operator()(TBoundFn&& fn) {
-    return runIfAlive(
-        subject_,
-        [this, fn{std::move(fn)}](
-            TSubject& subject, const Error& error, auto&&... args) mutable {
-          this->entryPoint_(
-              subject,
-              std::move(fn),
-              error,
-              std::forward<decltype(args)>(args)...);
-        });
+    TP_DCHECK(loop_.inLoop());
+    if (weak_.expired()) {
+      // In C++17 use weak_from_this().
+      weak_ = subject_.shared_from_this();
+    }
+    return [this, weak{weak_}, fn{std::move(fn)}](
+               const Error& error, auto&&... args) mutable {
+      std::shared_ptr<TSubject> shared = weak.lock();
+      if (shared) {
+        this->entryPoint_(
+            *shared,
+            std::move(fn),
+            error,
+            std::forward<decltype(args)>(args)...);
+      }
+    };
   }
 
  private:
   std::enable_shared_from_this<TSubject>& subject_;
   OnDemandDeferredExecutor& loop_;
+  // Only accessed from within the loop.
+  std::weak_ptr<TSubject> weak_;
 
   template <typename TBoundFn, typename... Args>
   void entryPoint_(
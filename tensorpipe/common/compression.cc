@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/compression.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <tensorpipe/common/defs.h>
+
+#if TENSORPIPE_HAS_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif // TENSORPIPE_HAS_LZ4
+
+#if TENSORPIPE_HAS_ZSTD
+#include <zstd.h>
+#endif // TENSORPIPE_HAS_ZSTD
+
+namespace tensorpipe {
+
+bool isCodecAvailable(CompressionCodec codec) {
+  switch (codec) {
+    case CompressionCodec::kNone:
+      return true;
+    case CompressionCodec::kLz4:
+      return TENSORPIPE_HAS_LZ4;
+    case CompressionCodec::kZstd:
+      return TENSORPIPE_HAS_ZSTD;
+  }
+  return false;
+}
+
+std::string codecName(CompressionCodec codec) {
+  switch (codec) {
+    case CompressionCodec::kNone:
+      return "none";
+    case CompressionCodec::kLz4:
+      return "lz4";
+    case CompressionCodec::kZstd:
+      return "zstd";
+  }
+  TP_THROW_ASSERT() << "Unknown codec";
+  // Dummy return to make the compiler happy.
+  return "";
+}
+
+optional<CompressionCodec> codecFromName(const std::string& name) {
+  for (CompressionCodec codec :
+       {CompressionCodec::kNone,
+        CompressionCodec::kLz4,
+        CompressionCodec::kZstd}) {
+    if (codecName(codec) == name) {
+      return codec;
+    }
+  }
+  return nullopt;
+}
+
+size_t compressBound(CompressionCodec codec, size_t length) {
+  TP_THROW_ASSERT_IF(!isCodecAvailable(codec))
+      << "Codec " << codecName(codec) << " isn't available in this build";
+  switch (codec) {
+    case CompressionCodec::kNone:
+      return length;
+#if TENSORPIPE_HAS_LZ4
+    case CompressionCodec::kLz4:
+      TP_THROW_ASSERT_IF(length > LZ4_MAX_INPUT_SIZE)
+          << "Too large a buffer for LZ4: " << length;
+      return LZ4_compressBound(length);
+#endif // TENSORPIPE_HAS_LZ4
+#if TENSORPIPE_HAS_ZSTD
+    case CompressionCodec::kZstd:
+      return ZSTD_compressBound(length);
+#endif // TENSORPIPE_HAS_ZSTD
+    default:
+      break;
+  }
+  return 0;
+}
+
+size_t compress(
+    CompressionCodec codec,
+    int level,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstCapacity) {
+  switch (codec) {
+#if TENSORPIPE_HAS_LZ4
+    case CompressionCodec::kLz4: {
+      const int capacity = static_cast<int>(std::min<size_t>(
+          dstCapacity, std::numeric_limits<int>::max()));
+      const int ret = level > 1
+          ? LZ4_compress_HC(
+                reinterpret_cast<const char*>(src),
+                reinterpret_cast<char*>(dst),
+                srcLength,
+                capacity,
+                level)
+          : LZ4_compress_default(
+                reinterpret_cast<const char*>(src),
+                reinterpret_cast<char*>(dst),
+                srcLength,
+                capacity);
+      return ret > 0 ? ret : 0;
+    }
+#endif // TENSORPIPE_HAS_LZ4
+#if TENSORPIPE_HAS_ZSTD
+    case CompressionCodec::kZstd: {
+      const size_t ret = ZSTD_compress(
+          dst,
+          dstCapacity,
+          src,
+          srcLength,
+          level != 0 ? level : ZSTD_CLEVEL_DEFAULT);
+      return ZSTD_isError(ret) ? 0 : ret;
+    }
+#endif // TENSORPIPE_HAS_ZSTD
+    default:
+      break;
+  }
+  return 0;
+}
+
+bool decompress(
+    CompressionCodec codec,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstLength) {
+  switch (codec) {
+#if TENSORPIPE_HAS_LZ4
+    case CompressionCodec::kLz4: {
+      const int ret = LZ4_decompress_safe(
+          reinterpret_cast<const char*>(src),
+          reinterpret_cast<char*>(dst),
+          srcLength,
+          dstLength);
+      return ret >= 0 && static_cast<size_t>(ret) == dstLength;
+    }
+#endif // TENSORPIPE_HAS_LZ4
+#if TENSORPIPE_HAS_ZSTD
+    case CompressionCodec::kZstd: {
+      const size_t ret = ZSTD_decompress(dst, dstLength, src, srcLength);
+      return !ZSTD_isError(ret) && ret == dstLength;
+    }
+#endif // TENSORPIPE_HAS_ZSTD
+    default:
+      break;
+  }
+  return false;
+}
+
+} // namespace tensorpipe
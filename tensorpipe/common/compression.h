@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// The codecs are only usable if TensorPipe was built with the corresponding
+// library (see the TP_ENABLE_LZ4 and TP_ENABLE_ZSTD options).
+enum class CompressionCodec {
+  kNone,
+  kLz4,
+  kZstd,
+};
+
+struct CompressionOptions {
+  CompressionCodec codec{CompressionCodec::kNone};
+  // The codec's own scale (LZ4 uses its high-compression mode above 1). Zero
+  // picks the codec's default, which favors speed.
+  int level{0};
+  // Buffers smaller than this are sent as they are, as compressing them isn't
+  // worth the latency.
+  size_t threshold{64 * 1024};
+  // How many threads compress and decompress chunks in parallel.
+  size_t numThreads{4};
+};
+
+bool isCodecAvailable(CompressionCodec codec);
+
+std::string codecName(CompressionCodec codec);
+
+optional<CompressionCodec> codecFromName(const std::string& name);
+
+// The largest size that compressing the given length can produce.
+size_t compressBound(CompressionCodec codec, size_t length);
+
+// Returns the compressed length, or zero if the codec failed (e.g., because the
+// output didn't fit).
+size_t compress(
+    CompressionCodec codec,
+    int level,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstCapacity);
+
+// Returns whether the data decompressed to exactly dstLength bytes.
+bool decompress(
+    CompressionCodec codec,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t dstLength);
+
+} // namespace tensorpipe
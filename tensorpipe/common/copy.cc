@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/copy.h>
+
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace tensorpipe {
+
+namespace {
+
+#if defined(__x86_64__)
+
+// How far ahead of the loads to prefetch the source. It must cover the latency
+// of memory, but not so much that the lines get evicted before they're used.
+constexpr size_t kPrefetchDistance = 512;
+
+// The kernels copy as many 64-byte blocks as they can, to a destination that is
+// aligned to 64 bytes, and return how many bytes they copied.
+
+__attribute__((target("avx512f"))) size_t
+copyBlocksAvx512(uint8_t* d, const uint8_t* s, size_t length) {
+  size_t offset = 0;
+  for (; offset + 64 <= length; offset += 64) {
+    _mm_prefetch(
+        reinterpret_cast<const char*>(s + offset + kPrefetchDistance),
+        _MM_HINT_NTA);
+    __m512i v = _mm512_loadu_si512(s + offset);
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(d + offset), v);
+  }
+  return offset;
+}
+
+__attribute__((target("avx2"))) size_t
+copyBlocksAvx2(uint8_t* d, const uint8_t* s, size_t length) {
+  size_t offset = 0;
+  for (; offset + 64 <= length; offset += 64) {
+    _mm_prefetch(
+        reinterpret_cast<const char*>(s + offset + kPrefetchDistance),
+        _MM_HINT_NTA);
+    __m256i v0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + offset));
+    __m256i v1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + offset + 32));
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(d + offset), v0);
+    _mm256_stream_si256(reinterpret_cast<__m256i*>(d + offset + 32), v1);
+  }
+  return offset;
+}
+
+size_t copyBlocksSse2(uint8_t* d, const uint8_t* s, size_t length) {
+  size_t offset = 0;
+  for (; offset + 64 <= length; offset += 64) {
+    _mm_prefetch(
+        reinterpret_cast<const char*>(s + offset + kPrefetchDistance),
+        _MM_HINT_NTA);
+    const __m128i* src = reinterpret_cast<const __m128i*>(s + offset);
+    __m128i v0 = _mm_loadu_si128(src);
+    __m128i v1 = _mm_loadu_si128(src + 1);
+    __m128i v2 = _mm_loadu_si128(src + 2);
+    __m128i v3 = _mm_loadu_si128(src + 3);
+    __m128i* dst = reinterpret_cast<__m128i*>(d + offset);
+    _mm_stream_si128(dst, v0);
+    _mm_stream_si128(dst + 1, v1);
+    _mm_stream_si128(dst + 2, v2);
+    _mm_stream_si128(dst + 3, v3);
+  }
+  return offset;
+}
+
+using copy_blocks_fn = size_t (*)(uint8_t*, const uint8_t*, size_t);
+
+copy_blocks_fn pickCopyBlocks() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return copyBlocksAvx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return copyBlocksAvx2;
+  }
+  return copyBlocksSse2;
+}
+
+#endif // __x86_64__
+
+} // namespace
+
+size_t getLastLevelCacheSize() {
+  static const size_t size = []() -> size_t {
+    long size = ::sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (size <= 0) {
+      size = ::sysconf(_SC_LEVEL2_CACHE_SIZE);
+    }
+    // If we can't find out, pretend it's infinite, to never bypass it.
+    return size > 0 ? size : std::numeric_limits<size_t>::max();
+  }();
+  return size;
+}
+
+void copyNonTemporal(void* dst, const void* src, size_t length) {
+#if defined(__x86_64__)
+  static const copy_blocks_fn copyBlocks = pickCopyBlocks();
+  uint8_t* d = reinterpret_cast<uint8_t*>(dst);
+  const uint8_t* s = reinterpret_cast<const uint8_t*>(src);
+  // Streaming stores need an aligned destination, and whole cache lines are
+  // the most efficient to write combine.
+  const size_t head =
+      std::min(length, (64 - reinterpret_cast<uintptr_t>(d) % 64) % 64);
+  if (head > 0) {
+    std::memcpy(d, s, head);
+  }
+  const size_t copied = copyBlocks(d + head, s + head, length - head);
+  // Non-temporal stores are weakly ordered, hence we need a fence to make them
+  // visible before we signal that the copy is complete.
+  _mm_sfence();
+  const size_t tail = length - head - copied;
+  if (tail > 0) {
+    std::memcpy(d + head + copied, s + head + copied, tail);
+  }
+#else
+  if (length > 0) {
+    std::memcpy(dst, src, length);
+  }
+#endif
+}
+
+} // namespace tensorpipe
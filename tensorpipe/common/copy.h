@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tensorpipe {
+
+// The size of the last-level cache, or the largest size_t if it's unknown.
+size_t getLastLevelCacheSize();
+
+// Copy like memcpy, but with stores that bypass the cache hierarchy, for
+// destinations that won't be read soon, or that are so large that they'd evict
+// the entire cache anyway. The widest vector instructions that the CPU supports
+// (among AVX-512, AVX2 and SSE2) are picked at runtime, and the source is
+// prefetched ahead. The stores are fenced before returning.
+void copyNonTemporal(void* dst, const void* src, size_t length);
+
+} // namespace tensorpipe
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cpu_budget.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+
+namespace {
+
+optional<double> getCpuBudgetFromEnvironment() {
+  const char* value = std::getenv("TP_CPU_BUDGET");
+  if (value == nullptr) {
+    return nullopt;
+  }
+  const std::string str(value);
+  if (str.empty() || str == "off") {
+    return nullopt;
+  }
+  if (str == "auto") {
+    return getCgroupCpuQuota();
+  }
+  char* end;
+  const double numCpus = std::strtod(value, &end);
+  TP_THROW_ASSERT_IF(*end != '\0' || !(numCpus > 0))
+      << "Invalid value for TP_CPU_BUDGET: " << str;
+  return numCpus;
+}
+
+struct CpuBudget {
+  std::mutex mutex;
+  optional<double> numCpus = getCpuBudgetFromEnvironment();
+  size_t numSpinningThreads{0};
+
+  size_t getMaxSpinningThreads() const {
+    return static_cast<size_t>(std::floor(numCpus.value() / 4));
+  }
+};
+
+CpuBudget& getBudget() {
+  static CpuBudget budget;
+  return budget;
+}
+
+} // namespace
+
+void setCpuBudget(optional<double> numCpus) {
+  TP_THROW_ASSERT_IF(numCpus.has_value() && !(numCpus.value() > 0))
+      << "Invalid CPU budget " << numCpus.value();
+  CpuBudget& budget = getBudget();
+  std::lock_guard<std::mutex> lock(budget.mutex);
+  budget.numCpus = numCpus;
+}
+
+optional<double> getCpuBudget() {
+  CpuBudget& budget = getBudget();
+  std::lock_guard<std::mutex> lock(budget.mutex);
+  return budget.numCpus;
+}
+
+size_t getNumSpinningThreads() {
+  CpuBudget& budget = getBudget();
+  std::lock_guard<std::mutex> lock(budget.mutex);
+  return budget.numSpinningThreads;
+}
+
+SpinningPermit SpinningPermit::tryAcquire() {
+  SpinningPermit permit;
+  CpuBudget& budget = getBudget();
+  std::lock_guard<std::mutex> lock(budget.mutex);
+  if (!budget.numCpus.has_value()) {
+    permit.granted_ = true;
+  } else if (budget.numSpinningThreads < budget.getMaxSpinningThreads()) {
+    budget.numSpinningThreads++;
+    permit.granted_ = true;
+    permit.counted_ = true;
+  }
+  return permit;
+}
+
+SpinningPermit::SpinningPermit(SpinningPermit&& other) noexcept
+    : granted_(other.granted_), counted_(other.counted_) {
+  other.granted_ = false;
+  other.counted_ = false;
+}
+
+SpinningPermit& SpinningPermit::operator=(SpinningPermit&& other) noexcept {
+  if (this != &other) {
+    release_();
+    granted_ = other.granted_;
+    counted_ = other.counted_;
+    other.granted_ = false;
+    other.counted_ = false;
+  }
+  return *this;
+}
+
+SpinningPermit::~SpinningPermit() {
+  release_();
+}
+
+void SpinningPermit::release_() {
+  if (counted_) {
+    // The budget may have been changed or removed since, but the count still
+    // tracks the permits that were handed out.
+    CpuBudget& budget = getBudget();
+    std::lock_guard<std::mutex> lock(budget.mutex);
+    budget.numSpinningThreads--;
+  }
+  granted_ = false;
+  counted_ = false;
+}
+
+BusyPollingPolicy applyCpuBudget(
+    BusyPollingPolicy policy,
+    SpinningPermit& permit) {
+  if (policy.sleeps()) {
+    return policy;
+  }
+  permit = SpinningPermit::tryAcquire();
+  if (permit) {
+    return policy;
+  }
+  // Don't spin for longer than was asked, and with a budget below 2 CPUs don't
+  // spin or yield at all, but go to sleep as soon as there's nothing to do.
+  BusyPollingPolicy throttled = BusyPollingPolicy::adaptive();
+  throttled.spinFor = std::min(throttled.spinFor, policy.spinFor);
+  const optional<double> numCpus = getCpuBudget();
+  if (numCpus.has_value() && numCpus.value() < 2) {
+    throttled.spinFor = std::chrono::microseconds(0);
+    throttled.yieldFor = std::chrono::microseconds(0);
+  }
+  throttled.sleepFor = policy.sleepFor;
+  return throttled;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// A process running in a container limited to a few CPUs (through a CFS quota)
+// can't afford to have a busy-polling thread per reactor, as these would eat
+// into the quota of the threads doing the actual work, and get all of them
+// throttled once it runs out, causing latency cliffs. Under a CPU budget, only
+// a few of the busy-polling threads may spin (i.e., use a policy that never
+// sleeps), in order of creation, and the others back off to a policy that
+// sleeps when idle. Also, the transports that can have their contexts share
+// their threads (e.g., shm) then do so.
+//
+// The budget is the number of CPUs that the process may use. A quarter of it
+// (rounded down) goes to spinning threads: a container with 4 CPUs gets one,
+// and one with less than 4 gets none. With less than 2 CPUs, the threads that
+// don't spin go to sleep as soon as they run out of work, rather than after
+// the brief spin of the adaptive policy.
+//
+// The budget is taken from the TP_CPU_BUDGET environment variable, which can
+// be a number of CPUs, "auto" for the cgroup's quota (if any), or "off" (the
+// default) for no budget.
+
+// Override the budget of the process, or remove it with nullopt. This only
+// affects the threads and contexts created afterwards, hence it should happen
+// before creating any context.
+void setCpuBudget(optional<double> numCpus);
+
+// The number of CPUs of the budget, if there is one.
+optional<double> getCpuBudget();
+
+// How many busy-polling threads are currently allowed to spin, while there is
+// a budget.
+size_t getNumSpinningThreads();
+
+// Held by a busy-polling thread that is allowed to spin, and released when
+// destroyed. Without a budget, permits are always granted.
+class SpinningPermit {
+ public:
+  SpinningPermit() = default;
+
+  // Get a permit if the budget allows for another spinning thread, or an empty
+  // one otherwise.
+  static SpinningPermit tryAcquire();
+
+  SpinningPermit(const SpinningPermit&) = delete;
+  SpinningPermit& operator=(const SpinningPermit&) = delete;
+
+  SpinningPermit(SpinningPermit&& other) noexcept;
+  SpinningPermit& operator=(SpinningPermit&& other) noexcept;
+
+  ~SpinningPermit();
+
+  explicit operator bool() const {
+    return granted_;
+  }
+
+ private:
+  bool granted_{false};
+  // Whether the permit was counted against a budget, and must be given back.
+  bool counted_{false};
+
+  void release_();
+};
+
+// Return the policy a busy-polling thread should use under the budget, taking
+// a permit from it if the given policy never sleeps. The policy is unchanged
+// if it sleeps already, or if the permit was granted.
+BusyPollingPolicy applyCpuBudget(
+    BusyPollingPolicy policy,
+    SpinningPermit& permit);
+
+} // namespace tensorpipe
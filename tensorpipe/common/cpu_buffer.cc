@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cpu_buffer.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// Call fn with the address and length of each piece of the given range of the
+// buffer that is contiguous, in order.
+template <typename TFn>
+void forEachPieceOfRange(
+    const CpuBuffer& buffer,
+    size_t offset,
+    size_t length,
+    TFn fn) {
+  TP_DCHECK_LE(offset + length, buffer.length);
+  if (!isSegmented(buffer)) {
+    fn(reinterpret_cast<uint8_t*>(buffer.ptr) + offset, length);
+    return;
+  }
+  for (size_t segmentIdx = 0; segmentIdx < buffer.numSegments && length > 0;
+       segmentIdx++) {
+    const CpuSegment& segment = buffer.segments[segmentIdx];
+    if (offset >= segment.length) {
+      offset -= segment.length;
+      continue;
+    }
+    const size_t pieceLength = std::min(segment.length - offset, length);
+    fn(reinterpret_cast<uint8_t*>(segment.ptr) + offset, pieceLength);
+    offset = 0;
+    length -= pieceLength;
+  }
+  TP_DCHECK_EQ(length, 0);
+}
+
+} // namespace
+
+std::vector<CpuSegment> segmentsOfCpuBuffer(const CpuBuffer& buffer) {
+  if (!isSegmented(buffer)) {
+    return {CpuSegment{buffer.ptr, buffer.length}};
+  }
+  return std::vector<CpuSegment>(
+      buffer.segments, buffer.segments + buffer.numSegments);
+}
+
+void* contiguousRangeOfCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    size_t length) {
+  void* result = nullptr;
+  size_t numPieces = 0;
+  forEachPieceOfRange(buffer, offset, length, [&](uint8_t* ptr, size_t) {
+    result = ptr;
+    numPieces++;
+  });
+  return numPieces == 1 ? result : nullptr;
+}
+
+void copyFromCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    void* dst,
+    size_t length) {
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  forEachPieceOfRange(
+      buffer, offset, length, [&](uint8_t* ptr, size_t pieceLength) {
+        std::memcpy(out, ptr, pieceLength);
+        out += pieceLength;
+      });
+}
+
+void copyToCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    const void* src,
+    size_t length) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+  forEachPieceOfRange(
+      buffer, offset, length, [&](uint8_t* ptr, size_t pieceLength) {
+        std::memcpy(ptr, in, pieceLength);
+        in += pieceLength;
+      });
+}
+
+void copyCpuBuffer(const CpuBuffer& dst, const CpuBuffer& src) {
+  TP_DCHECK_EQ(dst.length, src.length);
+  size_t offset = 0;
+  forEachPieceOfRange(src, 0, src.length, [&](uint8_t* ptr, size_t length) {
+    copyToCpuBuffer(dst, offset, ptr, length);
+    offset += length;
+  });
+}
+
+} // namespace tensorpipe
@@ -9,12 +9,56 @@
 #pragma once
 
 #include <cstddef>
+#include <vector>
 
 namespace tensorpipe {
 
+struct CpuSegment {
+  void* ptr{nullptr};
+  size_t length{0};
+};
+
 struct CpuBuffer {
   void* ptr{nullptr};
   size_t length{0};
+  // If set, the data isn't contiguous (e.g., a strided slice, or a list of
+  // tensors) and is instead the concatenation of these segments, whose lengths
+  // add up to the one above, and ptr is unused. Like the data, the array must
+  // remain valid until the operation completes. The channels that can't handle
+  // such buffers natively get a contiguous copy instead.
+  const CpuSegment* segments{nullptr};
+  size_t numSegments{0};
 };
 
+inline bool isSegmented(const CpuBuffer& buffer) {
+  return buffer.numSegments > 0;
+}
+
+// The segments of the buffer, or a single one if it's contiguous.
+std::vector<CpuSegment> segmentsOfCpuBuffer(const CpuBuffer& buffer);
+
+// The address of the given range of the buffer if it lies entirely within one
+// segment, or null otherwise.
+void* contiguousRangeOfCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    size_t length);
+
+// Copy the given range of the buffer out to contiguous memory, or into it from
+// contiguous memory, across as many segments as it spans.
+void copyFromCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    void* dst,
+    size_t length);
+
+void copyToCpuBuffer(
+    const CpuBuffer& buffer,
+    size_t offset,
+    const void* src,
+    size_t length);
+
+// Copy all of the source into the destination, which has the same length.
+void copyCpuBuffer(const CpuBuffer& dst, const CpuBuffer& src);
+
 } // namespace tensorpipe
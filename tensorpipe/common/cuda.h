@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sstream>
+#include <string>
+
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error.h>
+
+#define TP_CUDA_CHECK(a)                                                      \
+  TP_THROW_ASSERT_IF(cudaSuccess != (a))                                      \
+      << __TP_EXPAND_OPD(a) << " " << cudaGetErrorName(cudaPeekAtLastError()) \
+      << " (" << cudaGetErrorString(cudaPeekAtLastError()) << ")"
+
+// For the few calls that have no equivalent in the runtime API, and for which
+// the driver library must thus be linked in too.
+#define TP_CU_CHECK(a)                                                     \
+  do {                                                                     \
+    CUresult result = (a);                                                 \
+    TP_THROW_ASSERT_IF(CUDA_SUCCESS != result)                             \
+        << TP_STRINGIFY(a) << " " << ::tensorpipe::getCuErrorName(result); \
+  } while (false)
+
+namespace tensorpipe {
+
+inline const char* getCuErrorName(CUresult result) {
+  const char* name;
+  if (cuGetErrorName(result, &name) != CUDA_SUCCESS) {
+    return "Unknown CUDA driver error";
+  }
+  return name;
+}
+
+// The device that holds the given device memory.
+inline int cudaDeviceForPointer(const void* ptr) {
+  cudaPointerAttributes attrs;
+  TP_CUDA_CHECK(cudaPointerGetAttributes(&attrs, ptr));
+#if (CUDART_VERSION >= 10000)
+  TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.type);
+#else
+  TP_DCHECK_EQ(cudaMemoryTypeDevice, attrs.memoryType);
+#endif
+  return attrs.device;
+}
+
+// Whether the work enqueued on the stream is being captured into a CUDA graph,
+// rather than being executed.
+inline bool isCudaStreamCapturing(cudaStream_t stream) {
+  cudaStreamCaptureStatus status;
+  TP_CUDA_CHECK(cudaStreamIsCapturing(stream, &status));
+  return status != cudaStreamCaptureStatusNone;
+}
+
+// While a stream is captured in the global mode, the calls that could be unsafe
+// (e.g., opening IPC handles, or creating events) are prohibited in all
+// threads. This allows them in the current thread while it's alive, for work
+// that is done on the host at capture time, outside of the graph.
+class CudaRelaxedCaptureGuard {
+ public:
+  CudaRelaxedCaptureGuard() {
+    TP_CUDA_CHECK(cudaThreadExchangeStreamCaptureMode(&mode_));
+  }
+
+  CudaRelaxedCaptureGuard(const CudaRelaxedCaptureGuard&) = delete;
+  CudaRelaxedCaptureGuard& operator=(const CudaRelaxedCaptureGuard&) = delete;
+
+  ~CudaRelaxedCaptureGuard() {
+    TP_CUDA_CHECK(cudaThreadExchangeStreamCaptureMode(&mode_));
+  }
+
+ private:
+  cudaStreamCaptureMode mode_{cudaStreamCaptureModeRelaxed};
+};
+
+// For work that failed asynchronously on a stream, which is reported to the
+// callbacks that were waiting for it rather than thrown.
+class CudaError final : public BaseError {
+ public:
+  explicit CudaError(cudaError_t error) : error_(error) {}
+
+  std::string what() const override {
+    std::ostringstream ss;
+    ss << "CUDA error: " << cudaGetErrorName(error_) << " ("
+       << cudaGetErrorString(error_) << ")";
+    return ss.str();
+  }
+
+ private:
+  const cudaError_t error_;
+};
+
+} // namespace tensorpipe
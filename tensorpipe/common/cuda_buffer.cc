@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cuda_buffer.h>
+
+#include <algorithm>
+#include <cstdint>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+void copyCudaBufferRangeAsync(
+    const CudaBuffer& buffer,
+    size_t offset,
+    void* other,
+    size_t length,
+    bool intoBuffer,
+    cudaMemcpyKind kind,
+    cudaStream_t stream) {
+  TP_DCHECK_LE(offset + length, buffer.length);
+  uint8_t* otherPtr = static_cast<uint8_t*>(other);
+  auto copy1D = [&](uint8_t* bufferPtr, size_t pieceLength) {
+    TP_CUDA_CHECK(cudaMemcpyAsync(
+        intoBuffer ? bufferPtr : otherPtr,
+        intoBuffer ? otherPtr : bufferPtr,
+        pieceLength,
+        kind,
+        stream));
+    otherPtr += pieceLength;
+    length -= pieceLength;
+  };
+
+  if (!isStrided(buffer)) {
+    copy1D(static_cast<uint8_t*>(buffer.ptr) + offset, length);
+    return;
+  }
+
+  TP_DCHECK_EQ(buffer.width * buffer.height, buffer.length);
+  TP_DCHECK_GE(buffer.pitch, buffer.width);
+  const size_t width = buffer.width;
+  const size_t pitch = buffer.pitch;
+  auto rowPtr = [&](size_t rowIdx) {
+    return static_cast<uint8_t*>(buffer.ptr) + rowIdx * pitch;
+  };
+  size_t rowIdx = offset / width;
+  const size_t column = offset % width;
+
+  // The tail of the first row, if the range starts in its middle.
+  if (column > 0 && length > 0) {
+    copy1D(rowPtr(rowIdx) + column, std::min(width - column, length));
+    rowIdx++;
+  }
+
+  // The full rows.
+  const size_t numRows = length / width;
+  if (numRows > 0) {
+    TP_CUDA_CHECK(cudaMemcpy2DAsync(
+        intoBuffer ? rowPtr(rowIdx) : otherPtr,
+        intoBuffer ? pitch : width,
+        intoBuffer ? otherPtr : rowPtr(rowIdx),
+        intoBuffer ? width : pitch,
+        width,
+        numRows,
+        kind,
+        stream));
+    otherPtr += numRows * width;
+    length -= numRows * width;
+    rowIdx += numRows;
+  }
+
+  // The head of the last row, if the range ends in its middle.
+  if (length > 0) {
+    copy1D(rowPtr(rowIdx), length);
+  }
+}
+
+void copyCudaBufferAsync(
+    const CudaBuffer& dst,
+    const CudaBuffer& src,
+    cudaMemcpyKind kind,
+    cudaStream_t stream) {
+  TP_DCHECK_EQ(dst.length, src.length);
+  if (!isStrided(src)) {
+    copyCudaBufferRangeAsync(
+        dst, 0, src.ptr, dst.length, /*intoBuffer=*/true, kind, stream);
+  } else if (!isStrided(dst)) {
+    copyCudaBufferRangeAsync(
+        src, 0, dst.ptr, src.length, /*intoBuffer=*/false, kind, stream);
+  } else if (src.width == dst.width) {
+    TP_CUDA_CHECK(cudaMemcpy2DAsync(
+        dst.ptr,
+        dst.pitch,
+        src.ptr,
+        src.pitch,
+        src.width,
+        src.height,
+        kind,
+        stream));
+  } else {
+    for (size_t rowIdx = 0; rowIdx < src.height; rowIdx++) {
+      copyCudaBufferRangeAsync(
+          dst,
+          rowIdx * src.width,
+          static_cast<uint8_t*>(src.ptr) + rowIdx * src.pitch,
+          src.width,
+          /*intoBuffer=*/true,
+          kind,
+          stream);
+    }
+  }
+}
+
+} // namespace tensorpipe
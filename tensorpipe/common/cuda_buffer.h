@@ -17,7 +17,42 @@ namespace tensorpipe {
 struct CudaBuffer {
   void* ptr{nullptr};
   size_t length{0};
+  // The stream is the only point of synchronization between the user and the
+  // channels: these enqueue their work on it, after whatever the user had put
+  // there already, and are notified of its completion by way of callbacks,
+  // hence they never block a host thread waiting for the device.
   cudaStream_t stream{cudaStreamDefault};
+  // If pitch is set, the data isn't contiguous (e.g., a slice, or a transposed
+  // view, of a larger tensor) and is instead made of height rows of width bytes
+  // each, starting at ptr and pitch bytes apart, for a length of width times
+  // height. Only the channels that support such buffers are picked for them.
+  size_t pitch{0};
+  size_t width{0};
+  size_t height{0};
 };
 
+inline bool isStrided(const CudaBuffer& buffer) {
+  return buffer.pitch > 0;
+}
+
+// Enqueue a copy of the given range of the buffer out to contiguous memory, or
+// into it from contiguous memory, using a 2D copy for the full rows it spans.
+void copyCudaBufferRangeAsync(
+    const CudaBuffer& buffer,
+    size_t offset,
+    void* other,
+    size_t length,
+    bool intoBuffer,
+    cudaMemcpyKind kind,
+    cudaStream_t stream);
+
+// Enqueue a copy of all of the source into the destination, which has the same
+// length. It's a single 2D copy if either is contiguous or if their rows have
+// the same width, and otherwise one per row of the source.
+void copyCudaBufferAsync(
+    const CudaBuffer& dst,
+    const CudaBuffer& src,
+    cudaMemcpyKind kind,
+    cudaStream_t stream);
+
 } // namespace tensorpipe
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cuda_host_allocator.h>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+void CudaHostBufferDeleter::operator()(uint8_t* ptr) {
+  TP_CUDA_CHECK(cudaFreeHost(ptr));
+}
+
+CudaHostBuffer allocateCudaHostBuffer(size_t length) {
+  void* ptr;
+  TP_CUDA_CHECK(cudaMallocHost(&ptr, length));
+  return CudaHostBuffer(static_cast<uint8_t*>(ptr));
+}
+
+CudaHostAllocator::CudaHostAllocator(size_t numChunks, size_t chunkLength)
+    : numChunks_(numChunks), chunkLength_(chunkLength) {
+  TP_THROW_ASSERT_IF(numChunks_ == 0 || chunkLength_ == 0)
+      << "The pool must contain at least one non-empty chunk";
+}
+
+size_t CudaHostAllocator::getChunkLength() const {
+  return chunkLength_;
+}
+
+size_t CudaHostAllocator::getNumBytes() const {
+  return numBytes_.load(std::memory_order_relaxed);
+}
+
+void CudaHostAllocator::alloc(size_t numChunks, TAllocCallback callback) {
+  std::vector<TChunk> chunks;
+
+  if (numChunks > numChunks_) {
+    // The chunks can't outlive the buffer they belong to, and the buffer goes
+    // away once none of them is left.
+    std::shared_ptr<uint8_t> buffer(
+        allocateCudaHostBuffer(numChunks * chunkLength_).release(),
+        CudaHostBufferDeleter());
+    for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+      chunks.emplace_back(buffer, buffer.get() + chunkIdx * chunkLength_);
+    }
+    callback(std::move(chunks));
+    return;
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!buffer_) {
+      buffer_ = allocateCudaHostBuffer(numChunks_ * chunkLength_);
+      numBytes_.store(numChunks_ * chunkLength_, std::memory_order_relaxed);
+      freeChunks_.reserve(numChunks_);
+      for (size_t chunkIdx = 0; chunkIdx < numChunks_; chunkIdx++) {
+        freeChunks_.push_back(buffer_.get() + chunkIdx * chunkLength_);
+      }
+    }
+    // Don't overtake the requests that are already waiting.
+    if (!pendingAllocations_.empty() || freeChunks_.size() < numChunks) {
+      pendingAllocations_.push_back({numChunks, std::move(callback)});
+      return;
+    }
+    chunks = takeFreeChunks_(numChunks);
+  }
+  callback(std::move(chunks));
+}
+
+std::vector<CudaHostAllocator::TChunk> CudaHostAllocator::takeFreeChunks_(
+    size_t numChunks) {
+  TP_DCHECK_LE(numChunks, freeChunks_.size());
+  std::vector<TChunk> chunks;
+  chunks.reserve(numChunks);
+  for (size_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    chunks.emplace_back(
+        freeChunks_.back(), [this](uint8_t* ptr) { returnChunk_(ptr); });
+    freeChunks_.pop_back();
+  }
+  return chunks;
+}
+
+void CudaHostAllocator::returnChunk_(uint8_t* ptr) {
+  std::vector<PendingAllocation> grantedAllocations;
+  std::vector<std::vector<TChunk>> grantedChunks;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    freeChunks_.push_back(ptr);
+    while (!pendingAllocations_.empty() &&
+           pendingAllocations_.front().numChunks <= freeChunks_.size()) {
+      grantedChunks.push_back(
+          takeFreeChunks_(pendingAllocations_.front().numChunks));
+      grantedAllocations.push_back(std::move(pendingAllocations_.front()));
+      pendingAllocations_.pop_front();
+    }
+  }
+  // The callbacks may release chunks in turn, hence the lock can't be held.
+  for (size_t idx = 0; idx < grantedAllocations.size(); idx++) {
+    grantedAllocations[idx].callback(std::move(grantedChunks[idx]));
+  }
+}
+
+CudaHostAllocator::~CudaHostAllocator() {
+  TP_DCHECK(pendingAllocations_.empty());
+  TP_DCHECK_EQ(freeChunks_.size(), buffer_ ? numChunks_ : 0);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+
+struct CudaHostBufferDeleter {
+  void operator()(uint8_t* ptr);
+};
+
+using CudaHostBuffer = std::unique_ptr<uint8_t[], CudaHostBufferDeleter>;
+
+CudaHostBuffer allocateCudaHostBuffer(size_t length);
+
+// A pool of pinned host memory, cut into chunks of equal length, which avoids
+// allocating (and registering with the driver) such memory for each transfer.
+// The memory is allocated the first time it's needed, and then reused.
+//
+// Requests ask for several chunks at once, and are granted all of them or none
+// of them, in the order in which they were made, so that a request waiting for
+// chunks doesn't hold on to some of them, which could lead to deadlocks with
+// other requests that are themselves waiting for those chunks. Requests that
+// need more chunks than the pool has get a dedicated buffer instead.
+class CudaHostAllocator {
+ public:
+  using TChunk = std::shared_ptr<uint8_t>;
+  using TAllocCallback = Function<void(std::vector<TChunk>)>;
+
+  CudaHostAllocator(size_t numChunks, size_t chunkLength);
+
+  size_t getChunkLength() const;
+
+  // The pinned memory of the pool, once it's been allocated (the dedicated
+  // buffers aren't included, as they're only held for one transfer). It may be
+  // read from any thread.
+  size_t getNumBytes() const;
+
+  // The callback is either invoked inline or, if not enough chunks are free,
+  // by whichever thread returns the chunks that allow the request to proceed.
+  // A chunk is returned to the pool when the last reference to it goes away.
+  void alloc(size_t numChunks, TAllocCallback callback);
+
+  // All chunks must have been returned when the allocator is destroyed.
+  ~CudaHostAllocator();
+
+ private:
+  const size_t numChunks_;
+  const size_t chunkLength_;
+
+  std::mutex mutex_;
+  CudaHostBuffer buffer_;
+  std::atomic<size_t> numBytes_{0};
+  std::vector<uint8_t*> freeChunks_;
+
+  struct PendingAllocation {
+    size_t numChunks;
+    TAllocCallback callback;
+  };
+  std::deque<PendingAllocation> pendingAllocations_;
+
+  // Must be called while holding the mutex, and with enough free chunks.
+  std::vector<TChunk> takeFreeChunks_(size_t numChunks);
+
+  void returnChunk_(uint8_t* ptr);
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cuda_loop.h>
+
+#include <memory>
+
+#include <tensorpipe/common/cuda.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+
+namespace tensorpipe {
+
+namespace {
+
+struct CallbackArgs {
+  CudaLoop* loop;
+  CudaLoop::TCallback callback;
+};
+
+} // namespace
+
+CudaLoop::CudaLoop() {
+  startThread("TP_CUDA_callback_loop");
+}
+
+void CudaLoop::addCallback(cudaStream_t stream, TCallback callback) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    numPendingCallbacks_++;
+  }
+  auto args = std::make_unique<CallbackArgs>();
+  args->loop = this;
+  args->callback = std::move(callback);
+  TP_CUDA_CHECK(cudaStreamAddCallback(stream, runCallback_, args.get(), 0));
+  args.release();
+}
+
+void CUDART_CB CudaLoop::runCallback_(
+    cudaStream_t /* unused */,
+    cudaError_t status,
+    void* arg) {
+  std::unique_ptr<CallbackArgs> args(static_cast<CallbackArgs*>(arg));
+  CudaLoop& loop = *args->loop;
+  loop.deferToLoop([&loop, callback{std::move(args->callback)}, status]() {
+    callback(
+        status == cudaSuccess ? Error::kSuccess
+                              : TP_CREATE_ERROR(CudaError, status));
+    std::unique_lock<std::mutex> lock(loop.mutex_);
+    loop.numPendingCallbacks_--;
+  });
+}
+
+void CudaLoop::close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+void CudaLoop::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+CudaLoop::~CudaLoop() {
+  join();
+}
+
+void CudaLoop::eventLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      // Callbacks that fire after the thread is gone would be run inline, i.e.,
+      // on a thread of the CUDA runtime, hence we wait for all of them.
+      cv_.wait(lock, [&]() {
+        return (closed_ && numPendingCallbacks_ == 0) || numWakeups_ > 0;
+      });
+      if (numWakeups_ == 0) {
+        return;
+      }
+      numWakeups_ = 0;
+    }
+    runDeferredFunctionsFromEventLoop();
+  }
+}
+
+void CudaLoop::wakeupEventLoopToDeferFunction() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    numWakeups_++;
+  }
+  cv_.notify_all();
+}
+
+} // namespace tensorpipe
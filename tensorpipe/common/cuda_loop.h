@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include <cuda_runtime.h>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+
+// A thread on which to react to the completion of work enqueued on CUDA
+// streams. The CUDA runtime invokes stream callbacks from its own threads,
+// which aren't allowed to call into CUDA, hence those callbacks are bounced to
+// this loop, where anything (including enqueuing more work) can be done.
+class CudaLoop final : public EventLoopDeferredExecutor {
+ public:
+  using TCallback = Function<void(const Error&)>;
+
+  CudaLoop();
+
+  // Invoke the callback from within the loop once all the work that is
+  // currently enqueued on the stream has completed, with an error if any of
+  // that work failed.
+  void addCallback(cudaStream_t stream, TCallback callback);
+
+  void close();
+
+  // Wait for the callbacks that were added and haven't fired yet, and then for
+  // the thread to terminate.
+  void join();
+
+  ~CudaLoop() override;
+
+ protected:
+  void eventLoop() override;
+
+  void wakeupEventLoopToDeferFunction() override;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool closed_{false};
+  uint64_t numWakeups_{0};
+  uint64_t numPendingCallbacks_{0};
+
+  std::atomic<bool> joined_{false};
+
+  static void CUDART_CB runCallback_(cudaStream_t, cudaError_t, void*);
+};
+
+} // namespace tensorpipe
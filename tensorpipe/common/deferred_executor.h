@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <deque>
 #include <exception>
@@ -17,6 +18,7 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -25,6 +27,84 @@
 
 namespace tensorpipe {
 
+// A move-only counterpart of std::function<void()>, so that tasks can capture
+// move-only objects (e.g., promises or unique_ptrs) without wrapping them in a
+// shared_ptr. The wrapped callable lives in a single heap-allocated node, which
+// also contains the link that lets executors queue it without further
+// allocations.
+class DeferredTask {
+ public:
+  class Node {
+   public:
+    virtual void run() = 0;
+    virtual ~Node() = default;
+
+    // Intrusive link, for use by whoever is currently holding the node.
+    Node* next{nullptr};
+  };
+
+  DeferredTask() = default;
+
+  template <
+      typename F,
+      typename = std::enable_if_t<
+          !std::is_same<std::decay_t<F>, DeferredTask>::value>>
+  /* implicit */ DeferredTask(F&& fn)
+      : node_(std::make_unique<CallableNode<std::decay_t<F>>>(
+            std::forward<F>(fn))) {}
+
+  explicit DeferredTask(std::unique_ptr<Node> node) : node_(std::move(node)) {}
+
+  DeferredTask(DeferredTask&&) = default;
+  DeferredTask& operator=(DeferredTask&&) = default;
+
+  explicit operator bool() const {
+    return node_ != nullptr;
+  }
+
+  void operator()() {
+    node_->run();
+  }
+
+  std::unique_ptr<Node> release() {
+    return std::move(node_);
+  }
+
+ private:
+  template <typename F>
+  class CallableNode final : public Node {
+   public:
+    template <typename G>
+    explicit CallableNode(G&& fn) : fn_(std::forward<G>(fn)) {}
+
+    void run() override {
+      fn_();
+    }
+
+   private:
+    F fn_;
+  };
+
+  std::unique_ptr<Node> node_;
+};
+
+// A thread that hands many tasks to event loops in a row (e.g., a user thread
+// issuing a burst of writes, each of which defers some work to the loop of a
+// transport) can have them held back in a thread-local batch, and handed over
+// to each loop all at once, with a single wakeup, rather than one per task.
+// Batches may be nested, and the tasks are handed over when the outermost one
+// ends, when flushDeferredBatch is called, or when a loop has been deferred
+// kMaxDeferredBatchSize tasks. The order of the tasks of a thread is preserved.
+// While a batch is open, the thread must not wait for any of its tasks to run,
+// except through runInLoop, which flushes the batch. A loop that closes takes
+// the tasks that the batches of all threads are holding back for it, and those
+// deferred to it afterwards aren't held back anymore.
+constexpr size_t kMaxDeferredBatchSize = 64;
+
+inline void beginDeferredBatch();
+inline void endDeferredBatch();
+inline void flushDeferredBatch();
+
 // Dealing with thread-safety using per-object mutexes is prone to deadlocks
 // because of reentrant calls (both "upward", when invoking a callback that
 // calls back into a method of the object, and "downward", when passing a
@@ -37,7 +117,7 @@ namespace tensorpipe {
 // provide.
 class DeferredExecutor {
  public:
-  using TTask = std::function<void()>;
+  using TTask = DeferredTask;
 
   virtual void deferToLoop(TTask fn) = 0;
 
@@ -56,20 +136,21 @@ class DeferredExecutor {
     if (inLoop()) {
       fn();
     } else {
-      // Must use a copyable wrapper around std::promise because
-      // we use it from a std::function which must be copyable.
-      auto promise = std::make_shared<std::promise<void>>();
-      auto future = promise->get_future();
+      std::promise<void> promise;
+      auto future = promise.get_future();
       // Marked as mutable because the fn might hold some state (e.g., the
       // closure of a lambda) which it might want to modify.
-      deferToLoop([promise, fn{std::forward<F>(fn)}]() mutable {
+      deferToLoop([promise{std::move(promise)},
+                   fn{std::forward<F>(fn)}]() mutable {
         try {
           fn();
-          promise->set_value();
+          promise.set_value();
         } catch (...) {
-          promise->set_exception(std::current_exception());
+          promise.set_exception(std::current_exception());
         }
       });
+      // The task may have been held back by this thread's batch.
+      flushDeferredBatch();
       future.get();
     }
   }
@@ -132,25 +213,20 @@ class OnDemandDeferredExecutor : public DeferredExecutor {
 class EventLoopDeferredExecutor : public virtual DeferredExecutor {
  public:
   void deferToLoop(TTask fn) override {
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      if (likely(isThreadConsumingDeferredFunctions_)) {
-        fns_.push_back(std::move(fn));
-        wakeupEventLoopToDeferFunction();
-        return;
-      }
+    TP_DCHECK(static_cast<bool>(fn));
+    DeferredTask::Node* node = fn.release().release();
+    DeferredBatch& batch = DeferredBatch::forCurrentThread();
+    if (unlikely(batch.depth > 0)) {
+      batch.add(*this, node);
+      return;
     }
-    // Must call it without holding the lock, as it could cause a reentrant
-    // call.
-    onDemandLoop_.deferToLoop(std::move(fn));
+    node->next = nullptr;
+    deferNodes_(node, node, 1);
   };
 
   inline bool inLoop() override {
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      if (likely(isThreadConsumingDeferredFunctions_)) {
-        return std::this_thread::get_id() == thread_.get_id();
-      }
+    if (likely(head_.load() != &handedOverMarker_)) {
+      return std::this_thread::get_id() == thread_.get_id();
     }
     return onDemandLoop_.inLoop();
   }
@@ -164,9 +240,15 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // it, and must be implemented by subclasses, which are required to have their
   // event loop call runDeferredFunctionsFromEventLoop as soon as possible. This
   // function is guaranteed to be called once per function deferral (in case
-  // subclasses want to keep count).
+  // subclasses want to keep count), except for the ones deferred in a batch.
   virtual void wakeupEventLoopToDeferFunction() = 0;
 
+  // Called instead of the above for the functions deferred in a batch, once
+  // for all of them. Subclasses that keep count must override it.
+  virtual void wakeupEventLoopToDeferFunctions(size_t /* unused */) {
+    wakeupEventLoopToDeferFunction();
+  }
+
   // Called by subclasses to have the parent class start the thread. We cannot
   // implicitly call this in the parent class's constructor because it could
   // lead to a race condition between the event loop (run by the thread) and the
@@ -191,50 +273,240 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // method also returns the number of functions it executed, in case the
   // subclass is keeping count.
   size_t runDeferredFunctionsFromEventLoop() {
-    decltype(fns_) fns;
-
-    {
-      std::unique_lock<std::mutex> lock(mutex_);
-      std::swap(fns, fns_);
+    // Take all the functions at once, and put them back in the order in which
+    // they were deferred, since they were pushed at the front.
+    DeferredTask::Node* node = head_.exchange(nullptr);
+    DeferredTask::Node* reversed = nullptr;
+    while (node != nullptr) {
+      DeferredTask::Node* next = node->next;
+      node->next = reversed;
+      reversed = node;
+      node = next;
     }
 
-    for (auto& fn : fns) {
-      fn();
+    size_t numFunctions = 0;
+    while (reversed != nullptr) {
+      std::unique_ptr<DeferredTask::Node> current(reversed);
+      reversed = reversed->next;
+      current->run();
+      numFunctions++;
     }
 
-    return fns.size();
+    return numFunctions;
   }
 
  private:
+  // The tasks that a thread held back for each loop, linked, like the stack of
+  // the loop, from the newest to the oldest one, so that they can be pushed to
+  // it all at once.
+  struct DeferredBatch {
+    struct Entry {
+      EventLoopDeferredExecutor* loop;
+      DeferredTask::Node* newest;
+      DeferredTask::Node* oldest;
+      size_t numTasks;
+    };
+
+    // All the batches of the process, so that a loop that closes can take the
+    // entries that any thread still holds for it.
+    struct Registry {
+      std::mutex mutex;
+      std::vector<DeferredBatch*> batches;
+    };
+
+    size_t depth{0};
+    // Guards the entries against a loop taking them, and is held while they
+    // are handed over, so that a loop can't close in the meantime.
+    std::mutex mutex;
+    std::vector<Entry> entries;
+
+    DeferredBatch() {
+      Registry& registry = getRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.batches.push_back(this);
+    }
+
+    ~DeferredBatch() {
+      Registry& registry = getRegistry();
+      std::lock_guard<std::mutex> lock(registry.mutex);
+      registry.batches.erase(std::find(
+          registry.batches.begin(), registry.batches.end(), this));
+    }
+
+    static Registry& getRegistry() {
+      // Leaked, as the batches of some threads may outlive static objects.
+      static Registry* registry = new Registry();
+      return *registry;
+    }
+
+    static DeferredBatch& forCurrentThread() {
+      static thread_local DeferredBatch batch;
+      return batch;
+    }
+
+    // Move the entries of the given loop out of all the batches and onto its
+    // stack, and stop any further task from being held back for it. Each entry
+    // is pushed while the lock of its batch is held, so that the tasks that
+    // the thread of the batch defers afterwards end up after it.
+    static void takeEntriesOfLoop(EventLoopDeferredExecutor& loop) {
+      loop.closing_ = true;
+      Registry& registry = getRegistry();
+      std::lock_guard<std::mutex> registryLock(registry.mutex);
+      for (DeferredBatch* batch : registry.batches) {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        auto iter = batch->findEntry(loop);
+        if (iter != batch->entries.end()) {
+          loop.pushNodes_(iter->newest, iter->oldest);
+          batch->entries.erase(iter);
+        }
+      }
+    }
+
+    std::vector<Entry>::iterator findEntry(EventLoopDeferredExecutor& loop) {
+      return std::find_if(
+          entries.begin(), entries.end(), [&](const Entry& entry) {
+            return entry.loop == &loop;
+          });
+    }
+
+    void add(EventLoopDeferredExecutor& loop, DeferredTask::Node* node) {
+      std::unique_lock<std::mutex> lock(mutex);
+      auto iter = findEntry(loop);
+      if (unlikely(loop.closing_.load())) {
+        // The tasks that are still held back for the loop must go before this
+        // one, hence they're handed over together. Doing so may run them
+        // inline, and they may then defer further tasks, hence the lock is
+        // released first.
+        Entry entry{&loop, node, node, 1};
+        node->next = nullptr;
+        if (iter != entries.end()) {
+          node->next = iter->newest;
+          entry.oldest = iter->oldest;
+          entry.numTasks += iter->numTasks;
+          entries.erase(iter);
+        }
+        lock.unlock();
+        loop.deferNodes_(entry.newest, entry.oldest, entry.numTasks);
+        return;
+      }
+      if (iter == entries.end()) {
+        node->next = nullptr;
+        entries.push_back(Entry{&loop, node, node, 1});
+        return;
+      }
+      node->next = iter->newest;
+      iter->newest = node;
+      if (++iter->numTasks >= kMaxDeferredBatchSize) {
+        Entry entry = *iter;
+        entries.erase(iter);
+        entry.loop->deferNodes_(entry.newest, entry.oldest, entry.numTasks);
+      }
+    }
+
+    void flush() {
+      // As long as the lock is held, the loops of the entries can't take them,
+      // hence they can't have closed, and the tasks won't be run inline.
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const Entry& entry : entries) {
+        entry.loop->deferNodes_(entry.newest, entry.oldest, entry.numTasks);
+      }
+      entries.clear();
+    }
+  };
+
+  friend void beginDeferredBatch();
+  friend void endDeferredBatch();
+  friend void flushDeferredBatch();
+
+  // Push a chain of tasks, linked from the newest to the oldest, to the stack.
+  void deferNodes_(
+      DeferredTask::Node* newest,
+      DeferredTask::Node* oldest,
+      size_t numTasks) {
+    // Tell the thread, should it be about to hand over to the on-demand loop,
+    // that it must wait for us to be done waking it up.
+    numDeferringThreads_++;
+    DeferredTask::Node* head = head_.load();
+    do {
+      if (unlikely(head == &handedOverMarker_)) {
+        numDeferringThreads_--;
+        deferNodesToOnDemandLoop_(newest, oldest);
+        return;
+      }
+      oldest->next = head;
+    } while (!head_.compare_exchange_weak(head, newest));
+    if (numTasks == 1) {
+      wakeupEventLoopToDeferFunction();
+    } else {
+      wakeupEventLoopToDeferFunctions(numTasks);
+    }
+    numDeferringThreads_--;
+  }
+
+  // Push a chain of tasks to the stack without waking up the loop, which is
+  // only for the loop itself to do, before it hands over.
+  void pushNodes_(DeferredTask::Node* newest, DeferredTask::Node* oldest) {
+    DeferredTask::Node* head = head_.load();
+    do {
+      oldest->next = head;
+    } while (!head_.compare_exchange_weak(head, newest));
+  }
+
+  void deferNodesToOnDemandLoop_(
+      DeferredTask::Node* newest,
+      DeferredTask::Node* oldest) {
+    // The oldest one may have been linked to the stack by a failed attempt.
+    std::vector<DeferredTask::Node*> nodes;
+    for (DeferredTask::Node* node = newest;; node = node->next) {
+      nodes.push_back(node);
+      if (node == oldest) {
+        break;
+      }
+    }
+    for (auto iter = nodes.rbegin(); iter != nodes.rend(); ++iter) {
+      onDemandLoop_.deferToLoop(
+          DeferredTask(std::unique_ptr<DeferredTask::Node>(*iter)));
+    }
+  }
+
   void loop_(std::string threadName) {
-    setThreadName(std::move(threadName));
+    initCurrentThread(std::move(threadName));
 
     eventLoop();
 
+    // Other threads may still be holding back tasks for this loop in their
+    // batches, and may not flush them before it's destroyed, hence it takes
+    // them over, and runs them before handing over.
+    DeferredBatch::takeEntriesOfLoop(*this);
+
     // The loop is winding down and "handing over" control to the on demand
     // loop. But it can only do so safely once there are no pending deferred
     // functions, as otherwise those may risk never being executed.
     while (true) {
-      decltype(fns_) fns;
-
-      {
-        std::unique_lock<std::mutex> lock(mutex_);
-        if (fns_.empty()) {
-          isThreadConsumingDeferredFunctions_ = false;
-          break;
-        }
-        std::swap(fns, fns_);
+      DeferredTask::Node* empty = nullptr;
+      if (head_.compare_exchange_strong(empty, &handedOverMarker_)) {
+        break;
       }
+      runDeferredFunctionsFromEventLoop();
+    }
 
-      for (auto& fn : fns) {
-        fn();
-      }
+    // Threads that deferred a function just before the hand over may still be
+    // waking up the loop, and the subclass must stay valid until they're done.
+    while (numDeferringThreads_.load() > 0) {
+      std::this_thread::yield();
     }
   }
 
   std::thread thread_;
 
-  // Whether the thread is still taking care of running the deferred functions
+  class HandedOverMarker final : public DeferredTask::Node {
+   public:
+    void run() override {}
+  };
+
+  // The deferred functions that are still to run, as a lock-free stack to which
+  // any thread can push, and which the loop empties all at once. It's replaced
+  // by the marker below once the thread stops running deferred functions.
   //
   // This is part of what can only be described as a hack. Sometimes, even when
   // using the API as intended, objects try to defer tasks to the loop after
@@ -245,14 +517,32 @@ class EventLoopDeferredExecutor : public virtual DeferredExecutor {
   // those tasks inline. In order to keep ensuring the single-threadedness
   // assumption of our model (which is what we rely on to be safe from race
   // conditions) we use an on-demand loop.
-  bool isThreadConsumingDeferredFunctions_{true};
+  std::atomic<DeferredTask::Node*> head_{nullptr};
+  HandedOverMarker handedOverMarker_;
   OnDemandDeferredExecutor onDemandLoop_;
 
-  // Mutex to guard the deferring and the running of functions.
-  std::mutex mutex_;
+  // How many threads are in the middle of deferring a function.
+  std::atomic<uint64_t> numDeferringThreads_{0};
 
-  // List of deferred functions to run when the loop is ready.
-  std::vector<std::function<void()>> fns_;
+  // Set once the loop has started taking the tasks held back for it by the
+  // batches, after which they don't hold back any more of them.
+  std::atomic<bool> closing_{false};
 };
 
+inline void beginDeferredBatch() {
+  EventLoopDeferredExecutor::DeferredBatch::forCurrentThread().depth++;
+}
+
+inline void endDeferredBatch() {
+  auto& batch = EventLoopDeferredExecutor::DeferredBatch::forCurrentThread();
+  TP_DCHECK_GT(batch.depth, 0);
+  if (--batch.depth == 0) {
+    batch.flush();
+  }
+}
+
+inline void flushDeferredBatch() {
+  EventLoopDeferredExecutor::DeferredBatch::forCurrentThread().flush();
+}
+
 } // namespace tensorpipe
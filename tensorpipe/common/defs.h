@@ -21,6 +21,8 @@
 #include <string>
 #include <system_error>
 
+#include <tensorpipe/config.h>
+
 // Branch hint macros. C++20 will include them as part of language.
 #define likely(x) __builtin_expect((x) ? 1 : 0, 1)
 #define unlikely(x) __builtin_expect((x) ? 1 : 0, 0)
@@ -240,6 +242,10 @@ class LogEntry final {
 // - level 7 is for requests that transports receive from core classes/channels
 // - level 8 is for generic transports stuff
 // - level 9 is for how transports deal with system resources
+//
+// Levels above TENSORPIPE_MAX_VERBOSITY_LEVEL (see TP_MAX_VERBOSITY_LEVEL in
+// CMake) are discarded at compile time, together with their arguments, and
+// can't be enabled at runtime.
 
 inline unsigned long GetTensorPipeVerbosityLevel() {
   char* levelStr = std::getenv("TP_VERBOSE_LOGGING");
@@ -254,7 +260,12 @@ inline unsigned long TensorPipeVerbosityLevel() {
   return level;
 }
 
-#define TP_VLOG(level) TP_LOG_DEBUG_IF(level <= TensorPipeVerbosityLevel())
+// The compile-time check comes first so that, when it fails, the whole
+// statement is dead code and the runtime level is not even loaded.
+#define TP_VLOG(level)                               \
+  if ((level) <= TENSORPIPE_MAX_VERBOSITY_LEVEL &&   \
+      unlikely((level) <= TensorPipeVerbosityLevel())) \
+  TP_LOG_DEBUG()
 
 //
 // Argument checks
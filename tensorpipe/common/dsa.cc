@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/dsa.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/config.h>
+
+#if TENSORPIPE_HAS_DSA
+#include <cpuid.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <immintrin.h>
+#include <linux/idxd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include <tensorpipe/common/fd.h>
+#endif // TENSORPIPE_HAS_DSA
+
+namespace tensorpipe {
+
+#if TENSORPIPE_HAS_DSA
+
+namespace {
+
+constexpr char kSysfsDir[] = "/sys/bus/dsa/devices";
+constexpr char kDevDir[] = "/dev/dsa";
+
+// The portal of a work queue is the page of MMIO space that descriptors are
+// written to.
+constexpr size_t kPortalSize = 0x1000;
+
+// We cap the size of the batches, regardless of what the device supports, to
+// bound the memory that we set aside for the descriptors.
+constexpr size_t kMaxBatchSize = 64;
+
+// The descriptors must be aligned to 64 bytes, and the completion records to
+// 32 bytes, but neither struct is declared as such.
+constexpr size_t kDescriptorAlignment = 64;
+
+std::string readAttribute(const std::string& wqName, const char* attr) {
+  std::ifstream file(std::string(kSysfsDir) + "/" + wqName + "/" + attr);
+  std::string value;
+  std::getline(file, value);
+  return value;
+}
+
+size_t readNumericAttribute(
+    const std::string& wqName,
+    const char* attr,
+    size_t defaultValue) {
+  const std::string value = readAttribute(wqName, attr);
+  if (value.empty()) {
+    return defaultValue;
+  }
+  return std::strtoull(value.c_str(), nullptr, 10);
+}
+
+// MOVDIR64B and ENQCMD are advertised in CPUID leaf 7, sub-leaf 0, in bits 28
+// and 29 of ECX respectively.
+bool cpuHasInstruction(unsigned bit) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return (ecx & (1u << bit)) != 0;
+}
+
+// These are spelled out as bytes as older toolchains don't know them. Both
+// take the portal in RAX and the descriptor in RDX.
+
+// For dedicated work queues, where the submitter must make sure that there is
+// room for the descriptor, or else it is dropped.
+inline void movdir64b(void* portal, const void* desc) {
+  asm volatile(".byte 0x66, 0x0f, 0x38, 0xf8, 0x02"
+               :
+               : "a"(portal), "d"(desc)
+               : "memory");
+}
+
+// For shared work queues, where the device tells whether it accepted the
+// descriptor, and it must be submitted again if it didn't.
+inline bool enqcmd(void* portal, const void* desc) {
+  uint8_t retry;
+  asm volatile(".byte 0xf2, 0x0f, 0x38, 0xf8, 0x02\n\tsetz %0"
+               : "=r"(retry)
+               : "a"(portal), "d"(desc)
+               : "cc", "memory");
+  return retry == 0;
+}
+
+} // namespace
+
+class DsaCopyEngine::Impl {
+ public:
+  Impl(
+      Fd fd,
+      void* portal,
+      bool isShared,
+      size_t maxTransferSize,
+      size_t maxBatchSize,
+      bool blockOnFault);
+
+  void copy(const Copy* copies, size_t numCopies);
+
+  ~Impl();
+
+ private:
+  const Fd fd_;
+  void* const portal_;
+  const bool isShared_;
+  const size_t maxTransferSize_;
+  const size_t maxBatchSize_;
+  const bool blockOnFault_;
+
+  // Only one batch is in flight at a time, which is all a dedicated work queue
+  // with room for a single descriptor allows, and which lets all submitters
+  // share the same descriptors and completion records. The ones of the batch
+  // itself come after those of the copies.
+  std::mutex mutex_;
+  void* memory_{nullptr};
+  dsa_hw_desc* descriptors_;
+  dsa_completion_record* records_;
+
+  void runBatch_(const Copy* pieces, size_t numPieces);
+  void submit_(const dsa_hw_desc& desc);
+};
+
+DsaCopyEngine::Impl::Impl(
+    Fd fd,
+    void* portal,
+    bool isShared,
+    size_t maxTransferSize,
+    size_t maxBatchSize,
+    bool blockOnFault)
+    : fd_(std::move(fd)),
+      portal_(portal),
+      isShared_(isShared),
+      maxTransferSize_(maxTransferSize),
+      maxBatchSize_(maxBatchSize),
+      blockOnFault_(blockOnFault) {
+  const size_t descriptorsSize = (kMaxBatchSize + 1) * sizeof(dsa_hw_desc);
+  const size_t recordsSize =
+      (kMaxBatchSize + 1) * sizeof(dsa_completion_record);
+  int rv = ::posix_memalign(
+      &memory_, kDescriptorAlignment, descriptorsSize + recordsSize);
+  TP_THROW_SYSTEM_IF(rv != 0, rv);
+  descriptors_ = reinterpret_cast<dsa_hw_desc*>(memory_);
+  records_ = reinterpret_cast<dsa_completion_record*>(
+      reinterpret_cast<uint8_t*>(memory_) + descriptorsSize);
+}
+
+DsaCopyEngine::Impl::~Impl() {
+  ::munmap(portal_, kPortalSize);
+  std::free(memory_);
+}
+
+void DsaCopyEngine::Impl::copy(const Copy* copies, size_t numCopies) {
+  std::vector<Copy> pieces;
+  for (size_t copyIdx = 0; copyIdx < numCopies; copyIdx++) {
+    const Copy& copy = copies[copyIdx];
+    if (copy.length < kMinOffloadLength) {
+      // Don't even call memcpy on a length of 0 to avoid issues with the
+      // pointer possibly being null.
+      if (copy.length > 0) {
+        std::memcpy(copy.dst, copy.src, copy.length);
+      }
+      continue;
+    }
+    for (size_t offset = 0; offset < copy.length; offset += maxTransferSize_) {
+      pieces.push_back(Copy{
+          reinterpret_cast<uint8_t*>(copy.dst) + offset,
+          reinterpret_cast<const uint8_t*>(copy.src) + offset,
+          std::min(maxTransferSize_, copy.length - offset)});
+    }
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (size_t offset = 0; offset < pieces.size(); offset += maxBatchSize_) {
+    runBatch_(
+        &pieces[offset], std::min(maxBatchSize_, pieces.size() - offset));
+  }
+}
+
+void DsaCopyEngine::Impl::runBatch_(const Copy* pieces, size_t numPieces) {
+  for (size_t idx = 0; idx < numPieces; idx++) {
+    dsa_hw_desc& desc = descriptors_[idx];
+    dsa_completion_record& record = records_[idx];
+    std::memset(&desc, 0, sizeof(desc));
+    std::memset(&record, 0, sizeof(record));
+    desc.opcode = DSA_OPCODE_MEMMOVE;
+    // The data isn't written to the cache, as these are large copies whose
+    // destination won't all be read back soon (as with non-temporal stores).
+    desc.flags = IDXD_OP_FLAG_CRAV | IDXD_OP_FLAG_RCR |
+        (blockOnFault_ ? IDXD_OP_FLAG_BOF : 0);
+    desc.completion_addr = reinterpret_cast<uintptr_t>(&record);
+    desc.src_addr = reinterpret_cast<uintptr_t>(pieces[idx].src);
+    desc.dst_addr = reinterpret_cast<uintptr_t>(pieces[idx].dst);
+    desc.xfer_size = pieces[idx].length;
+  }
+
+  // A batch must have at least two descriptors.
+  if (numPieces == 1) {
+    submit_(descriptors_[0]);
+    while (records_[0].status == DSA_COMP_NONE) {
+      _mm_pause();
+    }
+  } else {
+    dsa_hw_desc& desc = descriptors_[kMaxBatchSize];
+    dsa_completion_record& record = records_[kMaxBatchSize];
+    std::memset(&desc, 0, sizeof(desc));
+    std::memset(&record, 0, sizeof(record));
+    desc.opcode = DSA_OPCODE_BATCH;
+    desc.flags = IDXD_OP_FLAG_CRAV | IDXD_OP_FLAG_RCR;
+    desc.completion_addr = reinterpret_cast<uintptr_t>(&record);
+    desc.desc_list_addr = reinterpret_cast<uintptr_t>(descriptors_);
+    desc.desc_count = numPieces;
+    submit_(desc);
+    while (record.status == DSA_COMP_NONE) {
+      _mm_pause();
+    }
+  }
+
+  // The device may have failed some of the copies, or stopped midway through
+  // them, or not even started them if the batch as a whole failed, in which
+  // case their completion records were left untouched.
+  for (size_t idx = 0; idx < numPieces; idx++) {
+    const dsa_completion_record& record = records_[idx];
+    const uint8_t status = record.status & DSA_COMP_STATUS_MASK;
+    if (status == DSA_COMP_SUCCESS) {
+      continue;
+    }
+    const size_t done =
+        status == DSA_COMP_PAGE_FAULT_NOBOF ? record.bytes_completed : 0;
+    TP_VLOG(9) << "DSA copy failed with status " << static_cast<int>(status)
+               << " after " << done << " bytes, finishing it on the CPU";
+    std::memcpy(
+        reinterpret_cast<uint8_t*>(pieces[idx].dst) + done,
+        reinterpret_cast<const uint8_t*>(pieces[idx].src) + done,
+        pieces[idx].length - done);
+  }
+}
+
+void DsaCopyEngine::Impl::submit_(const dsa_hw_desc& desc) {
+  // Make sure the device sees the descriptors and the cleared records.
+  _mm_sfence();
+  if (isShared_) {
+    while (!enqcmd(portal_, &desc)) {
+      _mm_pause();
+    }
+  } else {
+    movdir64b(portal_, &desc);
+  }
+}
+
+#else // TENSORPIPE_HAS_DSA
+
+// Never instantiated, as create always fails.
+class DsaCopyEngine::Impl {
+ public:
+  void copy(const Copy* copies, size_t numCopies) {
+    for (size_t copyIdx = 0; copyIdx < numCopies; copyIdx++) {
+      if (copies[copyIdx].length > 0) {
+        std::memcpy(
+            copies[copyIdx].dst, copies[copyIdx].src, copies[copyIdx].length);
+      }
+    }
+  }
+};
+
+#endif // TENSORPIPE_HAS_DSA
+
+std::shared_ptr<DsaCopyEngine> DsaCopyEngine::create(const std::string& path) {
+#if TENSORPIPE_HAS_DSA
+  if (!cpuHasInstruction(/*MOVDIR64B=*/28)) {
+    return nullptr;
+  }
+  const bool hasEnqcmd = cpuHasInstruction(/*ENQCMD=*/29);
+
+  // The work queues go by the same name in sysfs and in /dev.
+  std::vector<std::string> wqNames;
+  if (!path.empty()) {
+    wqNames.push_back(path.substr(path.rfind('/') + 1));
+  } else {
+    DIR* dir = ::opendir(kSysfsDir);
+    if (dir == nullptr) {
+      return nullptr;
+    }
+    while (dirent* entry = ::readdir(dir)) {
+      if (std::strncmp(entry->d_name, "wq", 2) == 0) {
+        wqNames.emplace_back(entry->d_name);
+      }
+    }
+    ::closedir(dir);
+    std::sort(wqNames.begin(), wqNames.end());
+  }
+
+  for (const std::string& wqName : wqNames) {
+    if (readAttribute(wqName, "type") != "user" ||
+        readAttribute(wqName, "state") != "enabled") {
+      continue;
+    }
+    const bool isShared = readAttribute(wqName, "mode") == "shared";
+    if (isShared && !hasEnqcmd) {
+      continue;
+    }
+    const std::string devPath =
+        path.empty() ? std::string(kDevDir) + "/" + wqName : path;
+    Fd fd(::open(devPath.c_str(), O_RDWR));
+    if (!fd.hasValue()) {
+      TP_VLOG(4) << "Couldn't open DSA work queue " << devPath << ": "
+                 << std::strerror(errno);
+      continue;
+    }
+    void* portal = ::mmap(
+        nullptr,
+        kPortalSize,
+        PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE,
+        fd.fd(),
+        0);
+    if (portal == MAP_FAILED) {
+      TP_VLOG(4) << "Couldn't map DSA work queue " << devPath << ": "
+                 << std::strerror(errno);
+      continue;
+    }
+    const size_t maxTransferSize =
+        readNumericAttribute(wqName, "max_transfer_size", 2 * 1024 * 1024);
+    const size_t maxBatchSize = std::min(
+        kMaxBatchSize, readNumericAttribute(wqName, "max_batch_size", 1));
+    const bool blockOnFault = readAttribute(wqName, "block_on_fault") == "1";
+    TP_VLOG(4) << "Using DSA work queue " << devPath << " ("
+               << (isShared ? "shared" : "dedicated") << ")";
+    return std::shared_ptr<DsaCopyEngine>(new DsaCopyEngine(
+        std::make_unique<Impl>(
+            std::move(fd),
+            portal,
+            isShared,
+            std::max<size_t>(maxTransferSize, 1),
+            std::max<size_t>(maxBatchSize, 1),
+            blockOnFault)));
+  }
+#endif // TENSORPIPE_HAS_DSA
+  return nullptr;
+}
+
+DsaCopyEngine::DsaCopyEngine(std::unique_ptr<Impl> impl)
+    : impl_(std::move(impl)) {}
+
+void DsaCopyEngine::copy(const Copy* copies, size_t numCopies) {
+  impl_->copy(copies, numCopies);
+}
+
+DsaCopyEngine::~DsaCopyEngine() = default;
+
+} // namespace tensorpipe
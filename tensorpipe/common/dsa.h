@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace tensorpipe {
+
+// Copies offloaded to a hardware copy engine: the Data Streaming Accelerator
+// of recent Intel Xeons, through one of its work queues that the kernel's idxd
+// driver exposes to user space (e.g., /dev/dsa/wq0.0, which must have been
+// configured as such beforehand, with accel-config). The CPU only writes the
+// descriptors and then polls for their completion, which leaves its memory
+// bandwidth and caches to other work.
+//
+// Copies that are too small to be worth the round trip to the device are done
+// by the CPU, as well as the parts of the others that the device couldn't do,
+// for example because they touched a page that wasn't mapped yet. Hence the
+// result is always the same as with memcpy.
+class DsaCopyEngine {
+ public:
+  // Copies shorter than this are done by the CPU.
+  static constexpr size_t kMinOffloadLength = 64 * 1024;
+
+  struct Copy {
+    void* dst;
+    const void* src;
+    size_t length;
+  };
+
+  // Open the work queue at the given path or, if it's empty, the first one of
+  // the user type that is enabled. Return null if there isn't any (e.g., on
+  // hosts without DSA, or if the support for it wasn't compiled in).
+  static std::shared_ptr<DsaCopyEngine> create(const std::string& path = "");
+
+  // Perform the copies, which must not overlap, and return once they're all
+  // complete. The ones that can be offloaded are submitted together, as one
+  // batch, and the calling thread polls for their completion. It can be called
+  // from several threads at once, in which case they take turns.
+  void copy(const Copy* copies, size_t numCopies);
+
+  void copy(void* dst, const void* src, size_t length) {
+    Copy copy{dst, src, length};
+    this->copy(&copy, 1);
+  }
+
+  ~DsaCopyEngine();
+
+ private:
+  class Impl;
+
+  explicit DsaCopyEngine(std::unique_ptr<Impl> impl);
+
+  std::unique_ptr<Impl> impl_;
+};
+
+} // namespace tensorpipe
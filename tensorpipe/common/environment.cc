@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/environment.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+EnvironmentReader::EnvironmentReader(std::string prefix)
+    : prefix_(std::move(prefix)) {}
+
+std::string EnvironmentReader::getName(const std::string& key) const {
+  std::string name = prefix_;
+  for (char c : key) {
+    name += static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+  }
+  return name;
+}
+
+const char* EnvironmentReader::get(const std::string& key) const {
+  return std::getenv(getName(key).c_str());
+}
+
+void EnvironmentReader::setSize(const std::string& key, size_t& value) const {
+  const char* str = get(key);
+  if (str == nullptr) {
+    return;
+  }
+  // As strtoull skips leading whitespace, and accepts (and negates) values
+  // with a minus sign, anything that doesn't start with a digit is rejected.
+  TP_THROW_ASSERT_IF(!std::isdigit(static_cast<unsigned char>(*str)))
+      << "Invalid value for " << getName(key) << ": " << str;
+  char* end;
+  errno = 0;
+  unsigned long long result = std::strtoull(str, &end, /*base=*/0);
+  TP_THROW_ASSERT_IF(errno == ERANGE)
+      << "Invalid value for " << getName(key) << ": " << str;
+  unsigned long long multiplier = 1;
+  switch (*end) {
+    case 'G':
+      multiplier *= 1024;
+      // fall through
+    case 'M':
+      multiplier *= 1024;
+      // fall through
+    case 'K':
+      multiplier *= 1024;
+      end++;
+      break;
+  }
+  TP_THROW_ASSERT_IF(*end != '\0')
+      << "Invalid value for " << getName(key) << ": " << str;
+  TP_THROW_ASSERT_IF(result > std::numeric_limits<size_t>::max() / multiplier)
+      << "Out of range value for " << getName(key) << ": " << str;
+  value = result * multiplier;
+}
+
+void EnvironmentReader::setInt(
+    const std::string& key,
+    long long& value,
+    long long minValue,
+    long long maxValue) const {
+  const char* str = get(key);
+  if (str == nullptr) {
+    return;
+  }
+  char* end;
+  errno = 0;
+  long long result = std::strtoll(str, &end, /*base=*/0);
+  TP_THROW_ASSERT_IF(*str == '\0' || *end != '\0')
+      << "Invalid value for " << getName(key) << ": " << str;
+  TP_THROW_ASSERT_IF(errno == ERANGE || result < minValue || result > maxValue)
+      << "Out of range value for " << getName(key) << ": " << str;
+  value = result;
+}
+
+void EnvironmentReader::setBool(const std::string& key, bool& value) const {
+  const char* str = get(key);
+  if (str == nullptr) {
+    return;
+  }
+  std::string s(str);
+  if (s == "true" || s == "1") {
+    value = true;
+  } else if (s == "false" || s == "0") {
+    value = false;
+  } else {
+    TP_THROW_ASSERT() << "Invalid value for " << getName(key) << ": " << str;
+  }
+}
+
+void EnvironmentReader::setMicroseconds(
+    const std::string& key,
+    std::chrono::microseconds& value) const {
+  std::chrono::microseconds::rep count = value.count();
+  setInt(key, count);
+  value = std::chrono::microseconds(count);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <string>
+
+namespace tensorpipe {
+
+// Overrides settings with the environment variables named after their keys, in
+// uppercase and with the given prefix (e.g., the inbox_size key is read from
+// TP_SHM_INBOX_SIZE for the TP_SHM_ prefix). Each setter leaves the value alone
+// if its variable isn't set, and throws if the variable is malformed.
+class EnvironmentReader {
+ public:
+  explicit EnvironmentReader(std::string prefix);
+
+  // The name of the variable of the given key.
+  std::string getName(const std::string& key) const;
+
+  // Returns nullptr if the variable of the given key isn't set.
+  const char* get(const std::string& key) const;
+
+  // Sizes are non-negative, in decimal, hex (0x) or octal (0), and accept a K,
+  // M or G suffix.
+  void setSize(const std::string& key, size_t& value) const;
+
+  template <typename T>
+  void setInt(const std::string& key, T& value) const {
+    long long result = value;
+    setInt(
+        key,
+        result,
+        std::numeric_limits<T>::min(),
+        std::numeric_limits<T>::max());
+    value = static_cast<T>(result);
+  }
+
+  // Booleans are given as true, false, 1 or 0.
+  void setBool(const std::string& key, bool& value) const;
+
+  void setMicroseconds(
+      const std::string& key,
+      std::chrono::microseconds& value) const;
+
+ private:
+  const std::string prefix_;
+
+  void setInt(
+      const std::string& key,
+      long long& value,
+      long long minValue,
+      long long maxValue) const;
+};
+
+} // namespace tensorpipe
@@ -10,12 +10,29 @@
 
 #include <sys/eventfd.h>
 
+#include <array>
+
 #include <tensorpipe/common/system.h>
 
 namespace tensorpipe {
 
-EpollLoop::EpollLoop(DeferredExecutor& deferredExecutor)
-    : deferredExecutor_(deferredExecutor) {
+namespace {
+
+// The data of the main epoll fd within the waker one.
+constexpr uint64_t kWakerRecord = 1;
+
+} // namespace
+
+EpollLoop::EpollLoop(
+    DeferredExecutor& deferredExecutor,
+    std::vector<int> cpus,
+    size_t batchSize,
+    bool pollFromLoop)
+    : deferredExecutor_(deferredExecutor),
+      cpus_(std::move(cpus)),
+      pollFromLoop_(pollFromLoop),
+      epollEvents_(batchSize) {
+  TP_THROW_ASSERT_IF(batchSize == 0) << "The batch size must be positive";
   {
     auto rv = ::epoll_create(1);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
@@ -26,18 +43,35 @@ EpollLoop::EpollLoop(DeferredExecutor& deferredExecutor)
     TP_THROW_SYSTEM_IF(rv == -1, errno);
     eventFd_ = Fd(rv);
   }
+  if (pollFromLoop_) {
+    auto rv = ::epoll_create(1);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    wakerEpollFd_ = Fd(rv);
+
+    // Add the main epoll fd disarmed, for armWakeupFromLoop to arm it.
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    ev.data.u64 = kWakerRecord;
+    rv = ::epoll_ctl(wakerEpollFd_.fd(), EPOLL_CTL_ADD, epollFd_.fd(), &ev);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+  }
 
   // Register the eventfd with epoll.
   {
     struct epoll_event ev;
     ev.events = EPOLLIN;
     ev.data.u64 = 0;
-    auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, eventFd_.fd(), &ev);
+    auto rv = ::epoll_ctl(
+        pollFromLoop_ ? wakerEpollFd_.fd() : epollFd_.fd(),
+        EPOLL_CTL_ADD,
+        eventFd_.fd(),
+        &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   }
 
   // Start epoll(2) thread.
-  thread_ = std::thread(&EpollLoop::loop, this);
+  thread_ = std::thread(
+      pollFromLoop_ ? &EpollLoop::wakerLoop : &EpollLoop::loop, this);
 }
 
 void EpollLoop::close() {
@@ -59,7 +93,11 @@ EpollLoop::~EpollLoop() {
 
   // Unregister the eventfd with epoll.
   {
-    auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_DEL, eventFd_.fd(), nullptr);
+    auto rv = ::epoll_ctl(
+        pollFromLoop_ ? wakerEpollFd_.fd() : epollFd_.fd(),
+        EPOLL_CTL_DEL,
+        eventFd_.fd(),
+        nullptr);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   }
 }
@@ -69,28 +107,29 @@ void EpollLoop::registerDescriptor(
     int events,
     std::shared_ptr<EventHandler> h) {
   TP_DCHECK(deferredExecutor_.inLoop());
+  TP_DCHECK_GE(fd, 0);
 
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-
-  uint64_t record = nextRecord_++;
+  if (slots_.size() <= static_cast<size_t>(fd)) {
+    slots_.resize(fd + 1);
+  }
+  Slot& slot = slots_[fd];
+  const bool isNew = slot.handler == nullptr;
+  // Skip generation 0, which would make the record of fd 0 collide with the
+  // one of the eventfd.
+  if (++slot.generation == 0) {
+    slot.generation = 1;
+  }
+  slot.handler = std::move(h);
 
   struct epoll_event ev;
   ev.events = events;
-  ev.data.u64 = record;
-
-  auto fdIter = fdToRecord_.find(fd);
-  if (fdIter == fdToRecord_.end()) {
-    fdToRecord_.emplace(fd, record);
-    recordToHandler_.emplace(record, h);
+  ev.data.u64 = makeRecord(fd, slot.generation);
 
+  if (isNew) {
+    numHandlers_++;
     auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, fd, &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   } else {
-    uint64_t oldRecord = fdIter->second;
-    fdIter->second = record;
-    recordToHandler_.erase(oldRecord);
-    recordToHandler_.emplace(record, h);
-
     auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_MOD, fd, &ev);
     TP_THROW_SYSTEM_IF(rv == -1, errno);
   }
@@ -99,47 +138,76 @@ void EpollLoop::registerDescriptor(
 void EpollLoop::unregisterDescriptor(int fd) {
   TP_DCHECK(deferredExecutor_.inLoop());
 
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-
-  auto fdIter = fdToRecord_.find(fd);
-  TP_DCHECK(fdIter != fdToRecord_.end());
-  uint64_t oldRecord = fdIter->second;
-  fdToRecord_.erase(fdIter);
-  recordToHandler_.erase(oldRecord);
+  TP_DCHECK_LT(static_cast<size_t>(fd), slots_.size());
+  Slot& slot = slots_[fd];
+  TP_DCHECK(slot.handler != nullptr);
+  // Bump the generation so that the pending events of this fd become stale.
+  if (++slot.generation == 0) {
+    slot.generation = 1;
+  }
+  slot.handler.reset();
 
   auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_DEL, fd, nullptr);
   TP_THROW_SYSTEM_IF(rv == -1, errno);
 
   // Maybe we're done and the event loop is waiting for the last handlers to
   // be unregistered before terminating, so just in case we wake it up.
-  if (fdToRecord_.empty()) {
+  if (--numHandlers_ == 0) {
     wakeup();
   }
 }
 
+bool EpollLoop::pollFromLoop() {
+  TP_DCHECK(pollFromLoop_);
+  TP_DCHECK(deferredExecutor_.inLoop());
+  auto nfds = ::epoll_wait(
+      epollFd_.fd(), epollEvents_.data(), epollEvents_.size(), /*timeout=*/0);
+  if (nfds == -1) {
+    TP_THROW_SYSTEM_IF(errno != EINTR, errno);
+    return false;
+  }
+  handleEpollEventsFromLoop(nfds);
+  return nfds > 0;
+}
+
+void EpollLoop::armWakeupFromLoop() {
+  TP_DCHECK(pollFromLoop_);
+  TP_DCHECK(deferredExecutor_.inLoop());
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLONESHOT;
+  ev.data.u64 = kWakerRecord;
+  auto rv =
+      ::epoll_ctl(wakerEpollFd_.fd(), EPOLL_CTL_MOD, epollFd_.fd(), &ev);
+  TP_THROW_SYSTEM_IF(rv == -1, errno);
+}
+
+int EpollLoop::getPollFd() const {
+  TP_DCHECK(pollFromLoop_);
+  return epollFd_.fd();
+}
+
 void EpollLoop::wakeup() {
   // Perform a write to eventfd to wake up epoll_wait(2).
   eventFd_.writeOrThrow<uint64_t>(1);
 }
 
 bool EpollLoop::hasRegisteredHandlers() {
-  std::lock_guard<std::mutex> lock(handlersMutex_);
-  TP_DCHECK_EQ(fdToRecord_.size(), recordToHandler_.size());
-  return !fdToRecord_.empty();
+  return numHandlers_ > 0;
 }
 
 void EpollLoop::loop() {
-  setThreadName("TP_IBV_loop");
+  initCurrentThread("TP_IBV_loop");
+
+  if (!cpus_.empty()) {
+    setThreadAffinity(cpus_);
+  }
 
   // Stop when another thread has asked the loop the close and when all
   // handlers have been unregistered except for the wakeup eventfd one.
   while (!closed_ || hasRegisteredHandlers()) {
-    // Use fixed epoll_event capacity for every call.
-    std::vector<struct epoll_event> epollEvents(kCapacity_);
-
     // Block waiting for something to happen...
-    auto nfds =
-        ::epoll_wait(epollFd_.fd(), epollEvents.data(), epollEvents.size(), -1);
+    auto nfds = ::epoll_wait(
+        epollFd_.fd(), epollEvents_.data(), epollEvents_.size(), -1);
     if (nfds == -1) {
       if (errno == EINTR) {
         continue;
@@ -159,37 +227,61 @@ void EpollLoop::loop() {
           (rv == -1 && errno == EAGAIN) || (rv == sizeof(val) && val > 0));
     }
 
-    // Resize based on actual number of events.
-    epollEvents.resize(nfds);
-
-    // Defer handling to reactor and wait for it to process these events.
+    // Have the reactor process these events, and wait for it, as it uses the
+    // same buffer as the next iteration.
     deferredExecutor_.runInLoop(
-        [this, epollEvents{std::move(epollEvents)}]() mutable {
-          handleEpollEventsFromLoop(std::move(epollEvents));
-        });
+        [this, nfds]() { handleEpollEventsFromLoop(nfds); });
   }
 }
 
-void EpollLoop::handleEpollEventsFromLoop(
-    std::vector<struct epoll_event> epollEvents) {
+void EpollLoop::wakerLoop() {
+  initCurrentThread("TP_IBV_waker");
+
+  if (!cpus_.empty()) {
+    setThreadAffinity(cpus_);
+  }
+
+  while (!closed_ || hasRegisteredHandlers()) {
+    std::array<struct epoll_event, 2> events;
+    auto nfds = ::epoll_wait(wakerEpollFd_.fd(), events.data(), 2, -1);
+    if (nfds == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      TP_THROW_SYSTEM(errno);
+    }
+
+    for (int eventIdx = 0; eventIdx < nfds; eventIdx++) {
+      if (events[eventIdx].data.u64 == kWakerRecord) {
+        // This is a one-shot, which the reactor re-arms before sleeping again.
+        deferredExecutor_.deferToLoop([]() {});
+      } else {
+        uint64_t val;
+        auto rv = eventFd_.read(reinterpret_cast<void*>(&val), sizeof(val));
+        TP_DCHECK(
+            (rv == -1 && errno == EAGAIN) || (rv == sizeof(val) && val > 0));
+      }
+    }
+  }
+}
+
+void EpollLoop::handleEpollEventsFromLoop(int numEvents) {
   TP_DCHECK(deferredExecutor_.inLoop());
 
   // Process events returned by epoll_wait(2).
-  for (const auto& event : epollEvents) {
+  for (int eventIdx = 0; eventIdx < numEvents; eventIdx++) {
+    const struct epoll_event& event = epollEvents_[eventIdx];
     const uint64_t record = event.data.u64;
+    const size_t fd = static_cast<uint32_t>(record);
+    const uint32_t generation = record >> 32;
+    if (fd >= slots_.size() || slots_[fd].generation != generation ||
+        slots_[fd].handler == nullptr) {
+      continue;
+    }
 
     // Make a copy so that if the handler unregisters itself as it runs it will
     // still be kept alive by our copy of the shared_ptr.
-    std::shared_ptr<EventHandler> handler;
-    {
-      std::unique_lock<std::mutex> handlersLock(handlersMutex_);
-      const auto recordIter = recordToHandler_.find(record);
-      if (recordIter == recordToHandler_.end()) {
-        continue;
-      }
-      handler = recordIter->second;
-    }
-
+    std::shared_ptr<EventHandler> handler = slots_[fd].handler;
     handler->handleEventsFromLoop(event.events);
   }
 }
@@ -9,11 +9,10 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <thread>
-#include <unordered_map>
 #include <vector>
 
 #include <sys/epoll.h>
@@ -37,7 +36,21 @@ class EpollLoop final {
     virtual void handleEventsFromLoop(int events) = 0;
   };
 
-  explicit EpollLoop(DeferredExecutor& deferredExecutor);
+  static constexpr size_t kDefaultBatchSize = 64;
+
+  // If cpus isn't empty, the loop's thread will only run on those CPUs. The
+  // batch size is the most events that a single epoll_wait(2) returns.
+  //
+  // If pollFromLoop is set, the events are handled right where they're polled
+  // for, in the deferred executor's thread, through pollFromLoop, which the
+  // executor must call whenever it looks for work (it suits busy-polling
+  // loops). This spares the hop to and from the loop's own thread, which then
+  // only wakes the executor up when it's asleep, see armWakeupFromLoop.
+  explicit EpollLoop(
+      DeferredExecutor& deferredExecutor,
+      std::vector<int> cpus = {},
+      size_t batchSize = kDefaultBatchSize,
+      bool pollFromLoop = false);
 
   // Register file descriptor with event loop.
   //
@@ -60,6 +73,22 @@ class EpollLoop final {
   //
   void unregisterDescriptor(int fd);
 
+  // Handle the events that are ready, without blocking, and return whether
+  // there were any. Only when constructed with pollFromLoop.
+  bool pollFromLoop();
+
+  // Have the loop's thread wake the deferred executor up (by deferring a no-op
+  // to it) the next time an event is ready. To be called right before going to
+  // sleep, and followed by one last poll. Only when constructed with
+  // pollFromLoop.
+  void armWakeupFromLoop();
+
+  // The fd that becomes readable when an event is ready, for a deferred
+  // executor that sleeps in epoll itself (with this fd among those it waits
+  // on) rather than through armWakeupFromLoop. Only when constructed with
+  // pollFromLoop.
+  int getPollFd() const;
+
   void close();
 
   // Tell loop to terminate when no more handlers remain.
@@ -70,22 +99,30 @@ class EpollLoop final {
   static std::string formatEpollEvents(uint32_t events);
 
  private:
-  static constexpr auto kCapacity_ = 64;
-
   // The reactor is used to process events for this loop.
   DeferredExecutor& deferredExecutor_;
 
+  const std::vector<int> cpus_;
+  const bool pollFromLoop_;
+
   // Wake up the event loop.
   void wakeup();
 
   // Main loop function.
   void loop();
 
+  // Main loop function when the events are polled from the deferred executor,
+  // which just waits for them to wake it up.
+  void wakerLoop();
+
   // Check whether some handlers are currently registered.
   bool hasRegisteredHandlers();
 
   Fd epollFd_;
   Fd eventFd_;
+  // When polling from the deferred executor, the loop's thread waits on this
+  // one, which contains the eventfd and (only while armed) the main epoll fd.
+  Fd wakerEpollFd_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   std::thread thread_;
@@ -103,7 +140,8 @@ class EpollLoop final {
   // accompanying Unix domain socket, we know for a fact that the reactor will
   // first react to the write, and then react to the epoll event caused by
   // closing the socket. If we didn't force serialization onto the reactor, we
-  // would not have this guarantee.
+  // would not have this guarantee. (When polling from the reactor, the events
+  // are handled there in the first place.)
   //
   // It's safe to call epoll_ctl from one thread while another thread is blocked
   // on an epoll_wait call. This means that the kernel internally serializes the
@@ -121,20 +159,31 @@ class EpollLoop final {
   // event, the piece of extra data that was provided by the *last* call on
   // epoll_ctl for that fd. This allows us to detect whether epoll_wait had
   // taken into account an update to the set of fds or not. We do so by giving
-  // each update a unique identifier, called "record". Each update to a fd will
-  // associate a new record to it. The handlers are associated to records (and
-  // not to fds), and for each fd we know which handler is the one currently
-  // installed. This way when processing an event we can detect whether the
-  // record for that event is still valid or whether it is stale, in which case
-  // we disregard the event, and wait for it to fire again at the next epoll
-  // iteration, with the up-to-date handler.
-  std::unordered_map<int, uint64_t> fdToRecord_;
-  std::unordered_map<uint64_t, std::shared_ptr<EventHandler>> recordToHandler_;
-  uint64_t nextRecord_{1}; // Reserve record 0 for the eventfd
-  std::mutex handlersMutex_;
-
-  // Deferred to the reactor to handle the events received by epoll_wait(2).
-  void handleEpollEventsFromLoop(std::vector<struct epoll_event> epollEvents);
+  // each fd a slot (at its own index) with a generation, which each update to
+  // the fd bumps, and by tagging the fd's registration with both, which we call
+  // a "record". When processing an event we can thus detect whether its record
+  // is still valid or whether it is stale, in which case we disregard the
+  // event, and wait for it to fire again at the next epoll iteration, with the
+  // up-to-date handler. The slots are only accessed from the reactor, hence
+  // they need no lock, and finding a handler is a mere indexing.
+  struct Slot {
+    uint32_t generation{0};
+    std::shared_ptr<EventHandler> handler;
+  };
+  std::vector<Slot> slots_;
+  // Record 0 (generation 0, which is never used) is reserved for the eventfd.
+  std::atomic<size_t> numHandlers_{0};
+
+  static uint64_t makeRecord(int fd, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) |
+        static_cast<uint32_t>(fd);
+  }
+
+  // The buffer that epoll_wait(2) fills, sized to the batch size.
+  std::vector<struct epoll_event> epollEvents_;
+
+  // Run from the reactor to handle the events received by epoll_wait(2).
+  void handleEpollEventsFromLoop(int numEvents);
 };
 
 } // namespace tensorpipe
@@ -22,6 +22,16 @@ std::string Error::what() const {
   return error_->what();
 }
 
+void Error::acquire_() const noexcept {
+  error_->refCount_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Error::release_() const noexcept {
+  if (error_->refCount_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete error_;
+  }
+}
+
 std::string SystemError::what() const {
   std::ostringstream ss;
   ss << syscall_ << ": " << strerror(error_);
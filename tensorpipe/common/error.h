@@ -8,8 +8,10 @@
 
 #pragma once
 
-#include <memory>
+#include <atomic>
+#include <cstddef>
 #include <string>
+#include <utility>
 
 namespace tensorpipe {
 
@@ -21,6 +23,12 @@ class BaseError {
   // Returns an explanatory string.
   // Like `std::exception` but returns a `std::string`.
   virtual std::string what() const = 0;
+
+ private:
+  // The number of Error instances that refer to this one.
+  mutable std::atomic<size_t> refCount_{0};
+
+  friend class Error;
 };
 
 // Wrapper class for errors.
@@ -32,20 +40,61 @@ class BaseError {
 // information. This implies a heap allocation because it's the
 // easiest way to deal with variable size objects (barring a union of
 // all downstream error classes and a lot of custom code). Instead of
-// passing a shared_ptr around directly, we use this wrapper class to
+// passing a pointer around directly, we use this wrapper class to
 // keep implementation details hidden from calling code.
 //
+// Every completion carries one of these, and almost all of them are
+// successes, hence a success is just a null pointer, which is copied,
+// moved and destroyed inline without touching any reference count. The
+// errors themselves are reference-counted intrusively, and the code
+// that creates them and updates their counts is kept out of line.
+//
 class Error final {
  public:
   // Constant instance that indicates success.
   static const Error kSuccess;
 
   // Default constructor for error that is not an error.
-  Error() {}
+  constexpr Error() noexcept = default;
+
+  // Use TP_CREATE_ERROR instead.
+  template <typename T, typename... Args>
+  __attribute__((noinline, cold)) static Error create(Args&&... args) {
+    Error error;
+    error.error_ = new T(std::forward<Args>(args)...);
+    error.error_->refCount_.store(1, std::memory_order_relaxed);
+    return error;
+  }
+
+  Error(const Error& other) noexcept : error_(other.error_) {
+    if (error_ != nullptr) {
+      acquire_();
+    }
+  }
+
+  Error(Error&& other) noexcept : error_(other.error_) {
+    other.error_ = nullptr;
+  }
+
+  Error& operator=(const Error& other) noexcept {
+    Error(other).swap(*this);
+    return *this;
+  }
+
+  Error& operator=(Error&& other) noexcept {
+    Error(std::move(other)).swap(*this);
+    return *this;
+  }
 
-  explicit Error(std::shared_ptr<BaseError> error) : error_(std::move(error)) {}
+  ~Error() {
+    if (error_ != nullptr) {
+      release_();
+    }
+  }
 
-  virtual ~Error() = default;
+  void swap(Error& other) noexcept {
+    std::swap(error_, other.error_);
+  }
 
   // Converting to boolean means checking if there is an error. This
   // means we don't need to use an `std::optional` and allows for a
@@ -56,19 +105,22 @@ class Error final {
   //   }
   //
   operator bool() const {
-    return static_cast<bool>(error_);
+    return error_ != nullptr;
   }
 
   template <typename T>
   bool isOfType() const {
-    return std::dynamic_pointer_cast<T>(error_) != nullptr;
+    return dynamic_cast<const T*>(error_) != nullptr;
   }
 
   // Like `std::exception` but returns a `std::string`.
   std::string what() const;
 
  private:
-  std::shared_ptr<BaseError> error_;
+  const BaseError* error_{nullptr};
+
+  void acquire_() const noexcept;
+  void release_() const noexcept;
 };
 
 class SystemError final : public BaseError {
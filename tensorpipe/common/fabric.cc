@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/fabric.h>
+
+#include <cstdlib>
+#include <cstring>
+
+namespace tensorpipe {
+
+namespace {
+
+// The oldest version of the API that has all we need.
+constexpr uint32_t kFabricApiVersion = FI_VERSION(1, 10);
+
+} // namespace
+
+std::tuple<int, FabricInfo> getFabricInfo(
+    FabricLib& fabricLib,
+    const std::string& provider) {
+  FabricInfo hints(
+      TP_CHECK_FABRIC_PTR(fabricLib.dupinfo(nullptr)),
+      FabricInfoDeleter{&fabricLib});
+  hints->caps = FI_TAGGED | FI_RMA;
+  // We give an fi_context2 as context to every operation that has one, which
+  // some providers need in order to keep track of it.
+  hints->mode = FI_CONTEXT | FI_CONTEXT2;
+  hints->ep_attr->type = FI_EP_RDM;
+  // These are the requirements of EFA, which the other providers are free to
+  // relax: the buffers of all operations must be registered (which we'd want
+  // anyways), and the remote addresses are virtual addresses, within regions
+  // whose keys the provider picks.
+  hints->domain_attr->mr_mode =
+      FI_MR_LOCAL | FI_MR_VIRT_ADDR | FI_MR_ALLOCATED | FI_MR_PROV_KEY;
+  // Only the reactor's thread ever touches the objects.
+  hints->domain_attr->threading = FI_THREAD_DOMAIN;
+  // The peer only finds out about an RDMA write through a message that the
+  // writer sends once the write completed, hence the data must have landed.
+  hints->tx_attr->op_flags = FI_DELIVERY_COMPLETE;
+  if (!provider.empty()) {
+    // It's freed along with the hints.
+    hints->fabric_attr->prov_name = ::strdup(provider.c_str());
+  }
+
+  struct fi_info* info;
+  int rv = fabricLib.getinfo(
+      kFabricApiVersion,
+      /*node=*/nullptr,
+      /*service=*/nullptr,
+      /*flags=*/0,
+      hints.get(),
+      &info);
+  if (rv == -FI_ENODATA) {
+    return std::make_tuple(0, FabricInfo(nullptr, FabricInfoDeleter{}));
+  }
+  if (rv < 0) {
+    return std::make_tuple(rv, FabricInfo(nullptr, FabricInfoDeleter{}));
+  }
+  return std::make_tuple(0, FabricInfo(info, FabricInfoDeleter{&fabricLib}));
+}
+
+FabricAddress getFabricAddress(FabricEndpoint& ep) {
+  FabricAddress addr;
+  std::memset(&addr, 0, sizeof(addr));
+  size_t length = sizeof(addr.bytes);
+  TP_CHECK_FABRIC_INT(fi_getname(&ep->fid, addr.bytes, &length));
+  addr.length = length;
+  return addr;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/fabric_lib.h>
+
+namespace tensorpipe {
+
+// Error checking macros
+
+// The functions of libfabric return negative error codes, which match those of
+// errno for the common errors.
+#define TP_CHECK_FABRIC_INT(op)      \
+  {                                  \
+    auto rv = op;                    \
+    TP_THROW_SYSTEM_IF(rv < 0, -rv); \
+  }
+
+// The functions that return a pointer only fail if they ran out of memory.
+#define TP_CHECK_FABRIC_PTR(op)                 \
+  [&]() {                                       \
+    auto ptr = op;                              \
+    TP_THROW_SYSTEM_IF(ptr == nullptr, ENOMEM); \
+    return ptr;                                 \
+  }()
+
+// RAII wrappers
+
+struct FabricInfoDeleter {
+  void operator()(struct fi_info* ptr) {
+    fabricLib->freeinfo(ptr);
+  }
+
+  FabricLib* fabricLib;
+};
+
+using FabricInfo = std::unique_ptr<struct fi_info, FabricInfoDeleter>;
+
+// Look up the first endpoint of the given provider (or of any, if empty) that
+// supports reliable unconnected messaging, tagged messages and RDMA writes that
+// only complete once the data reached the target's memory. Return a null info
+// if there's none, and the (negative) error code of libfabric if the lookup
+// failed for another reason.
+std::tuple<int, FabricInfo> getFabricInfo(
+    FabricLib& fabricLib,
+    const std::string& provider);
+
+// All the objects of libfabric are closed the same way.
+template <typename T>
+struct FabricFidDeleter {
+  void operator()(T* ptr) {
+    TP_CHECK_FABRIC_INT(fi_close(&ptr->fid));
+  }
+};
+
+using FabricFabric =
+    std::unique_ptr<struct fid_fabric, FabricFidDeleter<struct fid_fabric>>;
+
+inline FabricFabric createFabricFabric(
+    FabricLib& fabricLib,
+    struct fi_info* info) {
+  struct fid_fabric* ptr;
+  TP_CHECK_FABRIC_INT(fabricLib.fabric(info->fabric_attr, &ptr, nullptr));
+  return FabricFabric(ptr);
+}
+
+using FabricDomain =
+    std::unique_ptr<struct fid_domain, FabricFidDeleter<struct fid_domain>>;
+
+inline FabricDomain createFabricDomain(
+    FabricFabric& fabric,
+    struct fi_info* info) {
+  struct fid_domain* ptr;
+  TP_CHECK_FABRIC_INT(fi_domain(fabric.get(), info, &ptr, nullptr));
+  return FabricDomain(ptr);
+}
+
+using FabricAddressVector =
+    std::unique_ptr<struct fid_av, FabricFidDeleter<struct fid_av>>;
+
+inline FabricAddressVector createFabricAddressVector(FabricDomain& domain) {
+  struct fi_av_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.type = FI_AV_TABLE;
+  struct fid_av* ptr;
+  TP_CHECK_FABRIC_INT(fi_av_open(domain.get(), &attr, &ptr, nullptr));
+  return FabricAddressVector(ptr);
+}
+
+using FabricCompletionQueue =
+    std::unique_ptr<struct fid_cq, FabricFidDeleter<struct fid_cq>>;
+
+// The completion queue has no wait object, as not all providers support one,
+// hence it can only be polled.
+inline FabricCompletionQueue createFabricCompletionQueue(
+    FabricDomain& domain,
+    size_t size) {
+  struct fi_cq_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = size;
+  attr.format = FI_CQ_FORMAT_TAGGED;
+  attr.wait_obj = FI_WAIT_NONE;
+  struct fid_cq* ptr;
+  TP_CHECK_FABRIC_INT(fi_cq_open(domain.get(), &attr, &ptr, nullptr));
+  return FabricCompletionQueue(ptr);
+}
+
+using FabricEndpoint =
+    std::unique_ptr<struct fid_ep, FabricFidDeleter<struct fid_ep>>;
+
+// Create an endpoint that reports both its transmit and its receive
+// completions to the given queue, and enable it.
+inline FabricEndpoint createFabricEndpoint(
+    FabricDomain& domain,
+    struct fi_info* info,
+    FabricAddressVector& av,
+    FabricCompletionQueue& cq) {
+  struct fid_ep* ptr;
+  TP_CHECK_FABRIC_INT(fi_endpoint(domain.get(), info, &ptr, nullptr));
+  FabricEndpoint ep(ptr);
+  TP_CHECK_FABRIC_INT(fi_ep_bind(ep.get(), &av->fid, 0));
+  TP_CHECK_FABRIC_INT(
+      fi_ep_bind(ep.get(), &cq->fid, FI_TRANSMIT | FI_RECV));
+  TP_CHECK_FABRIC_INT(fi_enable(ep.get()));
+  return ep;
+}
+
+using FabricMemoryRegion =
+    std::unique_ptr<struct fid_mr, FabricFidDeleter<struct fid_mr>>;
+
+inline FabricMemoryRegion createFabricMemoryRegion(
+    FabricDomain& domain,
+    void* ptr,
+    size_t length,
+    uint64_t access) {
+  struct fid_mr* mr;
+  TP_CHECK_FABRIC_INT(fi_mr_reg(
+      domain.get(),
+      ptr,
+      length,
+      access,
+      /*offset=*/0,
+      /*requested_key=*/0,
+      /*flags=*/0,
+      &mr,
+      nullptr));
+  return FabricMemoryRegion(mr);
+}
+
+// Helpers
+
+// The name of an endpoint, in the provider's format, which its peers insert in
+// their address vectors in order to reach it.
+struct FabricAddress {
+  static constexpr size_t kMaxLength = 64;
+
+  uint8_t bytes[kMaxLength];
+  uint32_t length;
+};
+
+FabricAddress getFabricAddress(FabricEndpoint& ep);
+
+} // namespace tensorpipe
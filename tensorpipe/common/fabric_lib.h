@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <rdma/fabric.h>
+#include <rdma/fi_cm.h>
+#include <rdma/fi_domain.h>
+#include <rdma/fi_endpoint.h>
+#include <rdma/fi_errno.h>
+#include <rdma/fi_rma.h>
+#include <rdma/fi_tagged.h>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dl.h>
+
+namespace tensorpipe {
+
+// Master list of all symbols we care about from libfabric.
+
+#define TP_FORALL_FABRIC_SYMBOLS(_)                                     \
+  _(dupinfo, struct fi_info*, (const struct fi_info*))                  \
+  _(fabric, int, (struct fi_fabric_attr*, struct fid_fabric**, void*)) \
+  _(freeinfo, void, (struct fi_info*))                                  \
+  _(getinfo,                                                            \
+    int,                                                                \
+    (uint32_t,                                                          \
+     const char*,                                                       \
+     const char*,                                                       \
+     uint64_t,                                                          \
+     const struct fi_info*,                                             \
+     struct fi_info**))                                                 \
+  _(strerror, const char*, (int))
+
+// Wrapper for libfabric.
+//
+// Unlike libibverbs, the ABI of libfabric is defined by its headers, which are
+// thus needed to build (but the library isn't needed to link). Only a handful
+// of functions are exported by the library: all the others, including those on
+// the data path, are defined inline in the headers and call through the tables
+// of operations of the objects, which the providers fill in.
+
+class FabricLib {
+ private:
+  explicit FabricLib(DynamicLibraryHandle dlhandle)
+      : dlhandle_(std::move(dlhandle)) {}
+
+  DynamicLibraryHandle dlhandle_;
+
+#define TP_DECLARE_FIELD(function_name, return_type, args_types) \
+  return_type(*function_name##_ptr_) args_types = nullptr;
+  TP_FORALL_FABRIC_SYMBOLS(TP_DECLARE_FIELD)
+#undef TP_DECLARE_FIELD
+
+ public:
+  FabricLib() = default;
+
+  static std::tuple<Error, FabricLib> create() {
+    Error error;
+    DynamicLibraryHandle dlhandle;
+    // To keep things "neat" and contained, we open in "local" mode (as opposed
+    // to global) so that the libfabric symbols can only be resolved through
+    // this handle and are not exposed (a.k.a., "leaked") to other shared
+    // objects.
+    std::tie(error, dlhandle) =
+        createDynamicLibraryHandle("libfabric.so.1", RTLD_LOCAL | RTLD_LAZY);
+    if (error) {
+      return std::make_tuple(std::move(error), FabricLib());
+    }
+    FabricLib lib(std::move(dlhandle));
+#define TP_LOAD_SYMBOL(function_name, return_type, args_types)              \
+  {                                                                         \
+    void* ptr;                                                              \
+    std::tie(error, ptr) = loadSymbol(lib.dlhandle_, "fi_" #function_name); \
+    if (error) {                                                            \
+      return std::make_tuple(std::move(error), FabricLib());                \
+    }                                                                       \
+    TP_THROW_ASSERT_IF(ptr == nullptr);                                     \
+    lib.function_name##_ptr_ =                                              \
+        reinterpret_cast<decltype(function_name##_ptr_)>(ptr);              \
+  }
+    TP_FORALL_FABRIC_SYMBOLS(TP_LOAD_SYMBOL)
+#undef TP_LOAD_SYMBOL
+    return std::make_tuple(Error::kSuccess, std::move(lib));
+  }
+
+#define TP_FORWARD_CALL(function_name, return_type, args_types)  \
+  template <typename... Args>                                    \
+  auto function_name(Args&&... args) const {                     \
+    return (*function_name##_ptr_)(std::forward<Args>(args)...); \
+  }
+  TP_FORALL_FABRIC_SYMBOLS(TP_FORWARD_CALL)
+#undef TP_FORWARD_CALL
+};
+
+#undef TP_FORALL_FABRIC_SYMBOLS
+
+} // namespace tensorpipe
@@ -60,6 +60,13 @@ class Fd {
     }
   }
 
+  // Give up ownership of the file descriptor, without closing it.
+  int release() {
+    int fd = fd_;
+    fd_ = -1;
+    return fd;
+  }
+
   // Proxy to read(2) with EINTR retry.
   ssize_t read(void* buf, size_t count);
 
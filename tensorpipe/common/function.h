@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace tensorpipe {
+
+constexpr size_t kFunctionDefaultInlineSize = 8 * sizeof(void*);
+
+template <typename Signature, size_t InlineSize = kFunctionDefaultInlineSize>
+class Function;
+
+// A replacement for std::function which, unlike it, is move-only (and thus can
+// hold callables that capture move-only objects) and guarantees that callables
+// of up to InlineSize bytes are stored within the object itself rather than on
+// the heap. Callbacks are passed down and wrapped once for every message and
+// every layer, hence avoiding these allocations matters.
+template <typename R, typename... Args, size_t InlineSize>
+class Function<R(Args...), InlineSize> {
+ public:
+  Function() noexcept = default;
+
+  /* implicit */ Function(std::nullptr_t) noexcept {}
+
+  template <
+      typename F,
+      typename = std::enable_if_t<
+          !std::is_same<std::decay_t<F>, Function>::value &&
+          !std::is_same<std::decay_t<F>, std::nullptr_t>::value>,
+      typename = decltype(std::declval<std::decay_t<F>&>()(
+          std::declval<Args>()...))>
+  /* implicit */ Function(F&& fn) {
+    if (!isNull(fn)) {
+      emplace_<std::decay_t<F>>(std::forward<F>(fn));
+    }
+  }
+
+  Function(Function&& other) noexcept {
+    moveFrom_(other);
+  }
+
+  Function& operator=(Function&& other) noexcept {
+    if (this != &other) {
+      reset_();
+      moveFrom_(other);
+    }
+    return *this;
+  }
+
+  Function& operator=(std::nullptr_t) noexcept {
+    reset_();
+    return *this;
+  }
+
+  Function(const Function&) = delete;
+  Function& operator=(const Function&) = delete;
+
+  ~Function() {
+    reset_();
+  }
+
+  explicit operator bool() const noexcept {
+    return ops_ != nullptr;
+  }
+
+  // Const, like the one of std::function, even though the callable may mutate
+  // its own state.
+  R operator()(Args... args) const {
+    if (ops_ == nullptr) {
+      throw std::bad_function_call();
+    }
+    return ops_->invoke(storage_, std::forward<Args>(args)...);
+  }
+
+ private:
+  struct Ops {
+    R (*invoke)(void* storage, Args&&... args);
+    void (*move)(void* from, void* to) noexcept;
+    void (*destroy)(void* storage) noexcept;
+  };
+
+  template <typename F>
+  static constexpr bool isStoredInline() {
+    return sizeof(F) <= InlineSize &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<F>::value;
+  }
+
+  template <typename F>
+  struct InlineOps {
+    static R invoke(void* storage, Args&&... args) {
+      return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+    }
+
+    static void move(void* from, void* to) noexcept {
+      new (to) F(std::move(*static_cast<F*>(from)));
+      static_cast<F*>(from)->~F();
+    }
+
+    static void destroy(void* storage) noexcept {
+      static_cast<F*>(storage)->~F();
+    }
+
+    static const Ops* ops() {
+      static constexpr Ops ops{&invoke, &move, &destroy};
+      return &ops;
+    }
+  };
+
+  template <typename F>
+  struct HeapOps {
+    static R invoke(void* storage, Args&&... args) {
+      return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+    }
+
+    static void move(void* from, void* to) noexcept {
+      *static_cast<F**>(to) = *static_cast<F**>(from);
+    }
+
+    static void destroy(void* storage) noexcept {
+      delete *static_cast<F**>(storage);
+    }
+
+    static const Ops* ops() {
+      static constexpr Ops ops{&invoke, &move, &destroy};
+      return &ops;
+    }
+  };
+
+  template <typename F>
+  static bool isNull(const F& /* unused */) {
+    return false;
+  }
+
+  template <typename S>
+  static bool isNull(const std::function<S>& fn) {
+    return !fn;
+  }
+
+  template <typename S, size_t N>
+  static bool isNull(const Function<S, N>& fn) {
+    return !fn;
+  }
+
+  template <typename T>
+  static bool isNull(T* ptr) {
+    return ptr == nullptr;
+  }
+
+  template <typename F, typename G>
+  std::enable_if_t<isStoredInline<F>()> emplace_(G&& fn) {
+    new (storage_) F(std::forward<G>(fn));
+    ops_ = InlineOps<F>::ops();
+  }
+
+  template <typename F, typename G>
+  std::enable_if_t<!isStoredInline<F>()> emplace_(G&& fn) {
+    *reinterpret_cast<F**>(storage_) = new F(std::forward<G>(fn));
+    ops_ = HeapOps<F>::ops();
+  }
+
+  void moveFrom_(Function& other) noexcept {
+    if (other.ops_ != nullptr) {
+      other.ops_->move(other.storage_, storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void reset_() noexcept {
+    if (ops_ != nullptr) {
+      ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  static_assert(InlineSize >= sizeof(void*), "Must be able to hold a pointer");
+
+  const Ops* ops_{nullptr};
+  alignas(std::max_align_t) mutable unsigned char storage_[InlineSize];
+};
+
+} // namespace tensorpipe
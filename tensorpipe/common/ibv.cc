@@ -8,8 +8,15 @@
 
 #include <tensorpipe/common/ibv.h>
 
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <iterator>
 
 namespace tensorpipe {
 
@@ -36,6 +43,80 @@ std::string ibvWorkCompletionOpcodeToStr(IbvLib::wc_opcode opcode) {
   }
 }
 
+namespace {
+
+// Return -1 if unknown, as the kernel itself does when the device isn't
+// attached to any specific node.
+int getNumaNodeOfIbvDevice(IbvLib::device& device) {
+  std::ifstream f{std::string(device.ibdev_path) + "/device/numa_node"};
+  int numaNode = -1;
+  if (!(f >> numaNode)) {
+    return -1;
+  }
+  return numaNode;
+}
+
+int getNumaNodeOfCallingThread() {
+  unsigned int cpu;
+  unsigned int numaNode;
+  // Not using the glibc wrapper, as it was only added in version 2.29.
+  auto rv = ::syscall(SYS_getcpu, &cpu, &numaNode, nullptr);
+  if (rv < 0) {
+    return -1;
+  }
+  return numaNode;
+}
+
+} // namespace
+
+int selectIbvDevice(
+    IbvDeviceList& deviceList,
+    const IbvDeviceOptions& options) {
+  if (!options.deviceName.empty()) {
+    for (int deviceIdx = 0; deviceIdx < deviceList.size(); deviceIdx++) {
+      if (options.deviceName == deviceList[deviceIdx].name) {
+        return deviceIdx;
+      }
+    }
+    return -1;
+  }
+
+  if (deviceList.size() == 0) {
+    return -1;
+  }
+  int numaNode = options.numaNode >= 0 ? options.numaNode
+                                       : getNumaNodeOfCallingThread();
+  if (numaNode >= 0) {
+    for (int deviceIdx = 0; deviceIdx < deviceList.size(); deviceIdx++) {
+      if (getNumaNodeOfIbvDevice(deviceList[deviceIdx]) == numaNode) {
+        return deviceIdx;
+      }
+    }
+  }
+  return 0;
+}
+
+uint8_t selectIbvPort(
+    IbvLib& ibvLib,
+    IbvContext& context,
+    const IbvDeviceOptions& options) {
+  if (options.portNum != 0) {
+    return options.portNum;
+  }
+  // Ports are numbered from one, and querying one past the last fails.
+  for (int portNum = 1; portNum <= UINT8_MAX; portNum++) {
+    IbvLib::port_attr portAttr;
+    std::memset(&portAttr, 0, sizeof(portAttr));
+    if (ibvLib.query_port(context.get(), portNum, &portAttr) != 0) {
+      break;
+    }
+    if (portAttr.state == IbvLib::PORT_ACTIVE) {
+      return portNum;
+    }
+  }
+  return 0;
+}
+
 struct IbvAddress makeIbvAddress(
     IbvLib& ibvLib,
     IbvContext& context,
@@ -76,7 +157,8 @@ struct IbvSetupInformation makeIbvSetupInformation(
 void transitionIbvQueuePairToInit(
     IbvLib& ibvLib,
     IbvQueuePair& qp,
-    IbvAddress& selfAddr) {
+    IbvAddress& selfAddr,
+    int accessFlags) {
   IbvLib::qp_attr attr;
   std::memset(&attr, 0, sizeof(attr));
   int attrMask = 0;
@@ -94,8 +176,7 @@ void transitionIbvQueuePairToInit(
   attr.port_num = selfAddr.portNum;
 
   attrMask |= IbvLib::QP_ACCESS_FLAGS;
-  attr.qp_access_flags =
-      IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE;
+  attr.qp_access_flags = accessFlags;
 
   TP_CHECK_IBV_INT(ibvLib.modify_qp(qp.get(), &attr, attrMask));
 }
@@ -178,6 +259,203 @@ void transitionIbvQueuePairToReadyToSend(
   TP_CHECK_IBV_INT(ibvLib.modify_qp(qp.get(), &attr, attrMask));
 }
 
+IbvRegistrationCache::Handle IbvRegistrationCache::registerRegion(
+    void* ptr,
+    size_t length) {
+  TP_DCHECK_GT(length, 0);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t end = begin + length;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (onDemandPaging_ && !triedImplicitOnDemandPaging_) {
+    tryImplicitOnDemandPaging_();
+  }
+  if (implicitEntry_ != nullptr) {
+    return Handle(implicitEntry_, implicitEntry_->mr.get());
+  }
+
+  std::shared_ptr<Entry> pinnedEntry = findPinnedEntry_(begin, end);
+  if (pinnedEntry != nullptr) {
+    return Handle(pinnedEntry, pinnedEntry->mr.get());
+  }
+
+  // Look for a region that covers the requested one, or for those it overlaps.
+  auto firstIter = firstEndingAfter_(begin);
+  auto lastIter = firstIter;
+  while (lastIter != entries_.end() && lastIter->second->begin < end) {
+    if (lastIter->second->begin <= begin && end <= lastIter->second->end) {
+      Entry& entry = *lastIter->second;
+      lru_.splice(lru_.end(), lru_, entry.lruIter);
+      return Handle(lastIter->second, entry.mr.get());
+    }
+    lastIter++;
+  }
+
+  // Replace the overlapping regions with one that covers them all, as the
+  // buffers they stand for are likely parts of the requested one.
+  if (firstIter != lastIter) {
+    begin = std::min(begin, firstIter->second->begin);
+    end = std::max(end, std::prev(lastIter)->second->end);
+    while (firstIter != lastIter) {
+      eraseEntry_(firstIter++);
+    }
+  }
+
+  std::shared_ptr<Entry> entry = createEntry_(begin, end);
+  return Handle(entry, entry->mr.get());
+}
+
+IbvRegistrationCache::Handle IbvRegistrationCache::pinRegion(
+    void* ptr,
+    size_t length) {
+  TP_DCHECK_GT(length, 0);
+  uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t end = begin + length;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  if (onDemandPaging_ && !triedImplicitOnDemandPaging_) {
+    tryImplicitOnDemandPaging_();
+  }
+  if (implicitEntry_ != nullptr) {
+    return Handle(implicitEntry_, implicitEntry_->mr.get());
+  }
+
+  auto entry = std::make_shared<Entry>();
+  entry->begin = begin;
+  entry->end = end;
+  entry->mr = createMemoryRegion_(begin, end);
+  pinnedEntries_.emplace(begin, entry);
+  return Handle(entry, entry->mr.get());
+}
+
+void IbvRegistrationCache::invalidate(void* ptr, size_t length) {
+  uintptr_t begin = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t end = begin + length;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = firstEndingAfter_(begin);
+  while (iter != entries_.end() && iter->second->begin < end) {
+    eraseEntry_(iter++);
+  }
+}
+
+size_t IbvRegistrationCache::cachedBytes() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return cachedBytes_;
+}
+
+void IbvRegistrationCache::tryImplicitOnDemandPaging_() {
+  triedImplicitOnDemandPaging_ = true;
+  IbvLib::mr* mr = ibvLib_->reg_mr(
+      pd_->get(), nullptr, SIZE_MAX, accessFlags_ | IbvLib::ACCESS_ON_DEMAND);
+  if (mr == nullptr) {
+    TP_VLOG(9) << "The device doesn't support implicit On-Demand Paging ("
+               << std::strerror(errno) << ")";
+    return;
+  }
+  implicitEntry_ = std::make_shared<Entry>();
+  implicitEntry_->begin = 0;
+  implicitEntry_->end = UINTPTR_MAX;
+  implicitEntry_->mr = IbvMemoryRegion(mr, IbvMemoryRegionDeleter{ibvLib_});
+}
+
+IbvMemoryRegion IbvRegistrationCache::createMemoryRegion_(
+    uintptr_t begin,
+    uintptr_t end) {
+  const size_t length = end - begin;
+  if (onDemandPaging_) {
+    IbvLib::mr* mr = ibvLib_->reg_mr(
+        pd_->get(),
+        reinterpret_cast<void*>(begin),
+        length,
+        accessFlags_ | IbvLib::ACCESS_ON_DEMAND);
+    if (mr != nullptr) {
+      return IbvMemoryRegion(mr, IbvMemoryRegionDeleter{ibvLib_});
+    }
+    TP_VLOG(9) << "The device doesn't support On-Demand Paging ("
+               << std::strerror(errno) << "), falling back to pinning";
+    onDemandPaging_ = false;
+  }
+  return createIbvMemoryRegion(
+      *ibvLib_, *pd_, reinterpret_cast<void*>(begin), length, accessFlags_);
+}
+
+std::shared_ptr<IbvRegistrationCache::Entry> IbvRegistrationCache::
+    findPinnedEntry_(uintptr_t begin, uintptr_t end) {
+  // There are few of them, hence all those beginning before the range are
+  // checked, and the ones whose handles are all gone are dropped meanwhile.
+  auto iter = pinnedEntries_.begin();
+  while (iter != pinnedEntries_.end() && iter->first <= begin) {
+    std::shared_ptr<Entry> entry = iter->second.lock();
+    if (entry == nullptr) {
+      iter = pinnedEntries_.erase(iter);
+      continue;
+    }
+    if (end <= entry->end) {
+      return entry;
+    }
+    iter++;
+  }
+  return nullptr;
+}
+
+std::shared_ptr<IbvRegistrationCache::Entry> IbvRegistrationCache::
+    createEntry_(uintptr_t begin, uintptr_t end) {
+  const size_t length = end - begin;
+  auto entry = std::make_shared<Entry>();
+  entry->begin = begin;
+  entry->end = end;
+  entry->mr = createMemoryRegion_(begin, end);
+
+  if (length > capacity_) {
+    return entry;
+  }
+
+  // Only evict regions that aren't in use, as evicting the others wouldn't
+  // unpin any memory (and they're likely to be looked up again soon).
+  auto lruIter = lru_.begin();
+  while (cachedBytes_ + length > capacity_ && lruIter != lru_.end()) {
+    if (lruIter->use_count() > 2) {
+      // Referenced by the map, the LRU list and at least one handle.
+      lruIter++;
+      continue;
+    }
+    auto mapIter = entries_.find((*lruIter)->begin);
+    lruIter++;
+    eraseEntry_(mapIter);
+  }
+  if (cachedBytes_ + length > capacity_) {
+    return entry;
+  }
+
+  entry->lruIter = lru_.insert(lru_.end(), entry);
+  entries_.emplace(begin, entry);
+  cachedBytes_ += length;
+  return entry;
+}
+
+void IbvRegistrationCache::eraseEntry_(
+    std::map<uintptr_t, std::shared_ptr<Entry>>::iterator iter) {
+  Entry& entry = *iter->second;
+  cachedBytes_ -= entry.end - entry.begin;
+  lru_.erase(entry.lruIter);
+  // If there are no handles left, this deregisters the region.
+  entries_.erase(iter);
+}
+
+std::map<uintptr_t, std::shared_ptr<IbvRegistrationCache::Entry>>::iterator
+IbvRegistrationCache::firstEndingAfter_(uintptr_t addr) {
+  // As regions are disjoint, only the one that begins last before the address
+  // may contain it.
+  auto iter = entries_.upper_bound(addr);
+  if (iter != entries_.begin() && std::prev(iter)->second->end > addr) {
+    iter--;
+  }
+  return iter;
+}
+
 void transitionIbvQueuePairToError(IbvLib& ibvLib, IbvQueuePair& qp) {
   IbvLib::qp_attr attr;
   std::memset(&attr, 0, sizeof(attr));
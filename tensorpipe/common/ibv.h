@@ -8,9 +8,14 @@
 
 #pragma once
 
+#include <cstdint>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/ibv_device_options.h>
 #include <tensorpipe/common/ibv_lib.h>
 
 namespace tensorpipe {
@@ -72,6 +77,12 @@ class IbvDeviceList {
   int size_;
 };
 
+// Return the index, within the list, of the device that best matches the
+// options, or -1 if there is none (i.e., the list is empty or there's no device
+// with the requested name). If no device is attached to the requested NUMA node
+// the first one is used.
+int selectIbvDevice(IbvDeviceList& deviceList, const IbvDeviceOptions& options);
+
 struct IbvContextDeleter {
   void operator()(IbvLib::context* ptr) {
     TP_CHECK_IBV_INT(ibvLib->close_device(ptr));
@@ -107,6 +118,25 @@ inline IbvProtectionDomain createIbvProtectionDomain(
       IbvProtectionDomainDeleter{&ibvLib});
 }
 
+struct IbvCompletionChannelDeleter {
+  void operator()(IbvLib::comp_channel* ptr) {
+    TP_CHECK_IBV_INT(ibvLib->destroy_comp_channel(ptr));
+  }
+
+  IbvLib* ibvLib;
+};
+
+using IbvCompletionChannel =
+    std::unique_ptr<IbvLib::comp_channel, IbvCompletionChannelDeleter>;
+
+inline IbvCompletionChannel createIbvCompletionChannel(
+    IbvLib& ibvLib,
+    IbvContext& context) {
+  return IbvCompletionChannel(
+      TP_CHECK_IBV_PTR(ibvLib.create_comp_channel(context.get())),
+      IbvCompletionChannelDeleter{&ibvLib});
+}
+
 struct IbvCompletionQueueDeleter {
   void operator()(IbvLib::cq* ptr) {
     TP_CHECK_IBV_INT(ibvLib->destroy_cq(ptr));
@@ -172,6 +202,98 @@ inline IbvMemoryRegion createIbvMemoryRegion(
       IbvMemoryRegionDeleter{&ibvLib});
 }
 
+// A cache of memory regions, keyed by address range, which allows buffers that
+// are transferred repeatedly to be registered only once. A lookup is served by
+// any cached region that covers the requested range. Otherwise a region is
+// registered which also covers the cached ones that overlap the range, which it
+// replaces. The total size of the cached regions is bounded: the least recently
+// used ones that aren't in use are evicted to stay below it (and a region that
+// can't fit is handed out but not cached).
+//
+// A registration pins the physical pages that back the buffer at that time. If
+// the buffer is freed, and its addresses are reused for another one, the cached
+// region would point to the old pages. Hence whoever frees a buffer that may
+// have been registered must first call invalidate (e.g., from a hook of their
+// allocator), which evicts the regions overlapping it. Handles that are still
+// alive keep their region registered until they're released.
+//
+// With On-Demand Paging, the device follows the changes of the page tables,
+// hence the buffers needn't be invalidated (and aren't pinned). If the device
+// supports implicit ODP, a single region covering the whole address space is
+// handed out for all lookups. Otherwise each region is registered with ODP,
+// unless the device refuses it, in which case it falls back to pinning.
+//
+// Buffers that are known to be transferred over and over can also be pinned,
+// which registers them once and for all: they're kept regardless of the
+// capacity and of invalidate, until all the handles to them are released, and
+// lookups they cover are served from them.
+//
+// It's thread-safe. A capacity of zero disables caching altogether.
+class IbvRegistrationCache {
+ public:
+  using Handle = std::shared_ptr<const IbvLib::mr>;
+
+  IbvRegistrationCache(
+      IbvLib& ibvLib,
+      IbvProtectionDomain& pd,
+      int accessFlags,
+      size_t capacity,
+      bool onDemandPaging = false)
+      : ibvLib_(&ibvLib),
+        pd_(&pd),
+        accessFlags_(accessFlags),
+        capacity_(capacity),
+        onDemandPaging_(onDemandPaging) {}
+
+  Handle registerRegion(void* ptr, size_t length);
+
+  Handle pinRegion(void* ptr, size_t length);
+
+  void invalidate(void* ptr, size_t length);
+
+  // The total size of the regions that are currently cached.
+  size_t cachedBytes();
+
+ private:
+  struct Entry {
+    uintptr_t begin;
+    uintptr_t end;
+    IbvMemoryRegion mr;
+    std::list<std::shared_ptr<Entry>>::iterator lruIter;
+  };
+
+  IbvLib* ibvLib_{nullptr};
+  IbvProtectionDomain* pd_{nullptr};
+  int accessFlags_{0};
+  size_t capacity_{0};
+  // Reset if the device turns out not to support it.
+  bool onDemandPaging_{false};
+
+  std::mutex mutex_;
+  // Whether we tried to register the whole address space, which is done upon
+  // the first lookup, as the protection domain may not be set up before.
+  bool triedImplicitOnDemandPaging_{false};
+  std::shared_ptr<Entry> implicitEntry_;
+  // The cached regions, by the address at which they begin. They are disjoint.
+  std::map<uintptr_t, std::shared_ptr<Entry>> entries_;
+  // The cached regions, from the least to the most recently used.
+  std::list<std::shared_ptr<Entry>> lru_;
+  size_t cachedBytes_{0};
+  // The pinned regions, by the address at which they begin. They may overlap,
+  // and they're only referenced weakly, as their handles own them.
+  std::multimap<uintptr_t, std::weak_ptr<Entry>> pinnedEntries_;
+
+  void tryImplicitOnDemandPaging_();
+  IbvMemoryRegion createMemoryRegion_(uintptr_t begin, uintptr_t end);
+  // Returns a pinned region that covers the given range, or null.
+  std::shared_ptr<Entry> findPinnedEntry_(uintptr_t begin, uintptr_t end);
+  std::shared_ptr<Entry> createEntry_(uintptr_t begin, uintptr_t end);
+  void eraseEntry_(std::map<uintptr_t, std::shared_ptr<Entry>>::iterator iter);
+  // Returns the first cached region that ends after the given address.
+  std::map<uintptr_t, std::shared_ptr<Entry>>::iterator firstEndingAfter_(
+      uintptr_t addr);
+};
+
 struct IbvQueuePairDeleter {
   void operator()(IbvLib::qp* ptr) {
     TP_CHECK_IBV_INT(ibvLib->destroy_qp(ptr));
@@ -210,6 +332,13 @@ struct IbvSetupInformation {
   IbvLib::mtu maximumTransmissionUnit;
 };
 
+// Return the requested port if there is one, otherwise the first active port of
+// the device, or zero if none is.
+uint8_t selectIbvPort(
+    IbvLib& ibvLib,
+    IbvContext& context,
+    const IbvDeviceOptions& options);
+
 struct IbvAddress makeIbvAddress(
     IbvLib& ibvLib,
     IbvContext& context,
@@ -220,10 +349,13 @@ struct IbvSetupInformation makeIbvSetupInformation(
     IbvAddress& addr,
     IbvQueuePair& qp);
 
+// The access flags determine which operations the peer can perform on the
+// memory regions of this side.
 void transitionIbvQueuePairToInit(
     IbvLib& ibvLib,
     IbvQueuePair& qp,
-    IbvAddress& selfAddr);
+    IbvAddress& selfAddr,
+    int accessFlags = IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
 
 void transitionIbvQueuePairToReadyToReceive(
     IbvLib& ibvLib,
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace tensorpipe {
+
+// Which device (HCA), port and global identifier a context should use. By
+// default it is the device attached to the NUMA node of the thread creating the
+// context (as hosts with several HCAs usually have one per NUMA node, close to
+// the GPUs and the memory of that node, and crossing the inter-socket link to
+// reach another one costs bandwidth and latency) and its first active port.
+struct IbvDeviceOptions {
+  // The name of the device (e.g., "mlx5_0"), which overrides any NUMA-based
+  // choice, for users that have their own mapping.
+  std::string deviceName;
+  // The NUMA node to find a device for, if no name is given. Negative means the
+  // node of the calling thread.
+  int numaNode{-1};
+  // Zero means the first active one.
+  uint8_t portNum{0};
+  uint8_t globalIdentifierIndex{0};
+  // Register the buffers that are transferred in place with On-Demand Paging,
+  // if the device supports it, rather than pinning them. This is cheaper for
+  // large, short-lived buffers, and doesn't lock them in memory, at the cost
+  // of page faults handled by the device on first access. The whole address
+  // space is registered at once if the device supports implicit ODP.
+  bool onDemandPaging{false};
+};
+
+} // namespace tensorpipe
@@ -19,8 +19,10 @@ namespace tensorpipe {
 
 #define TP_FORALL_IBV_SYMBOLS(_)                                      \
   _(ack_async_event, void, (IbvLib::async_event*))                    \
+  _(ack_cq_events, void, (IbvLib::cq*, unsigned int))                 \
   _(alloc_pd, IbvLib::pd*, (IbvLib::context*))                        \
   _(close_device, int, (IbvLib::context*))                            \
+  _(create_comp_channel, IbvLib::comp_channel*, (IbvLib::context*))   \
   _(create_cq,                                                        \
     IbvLib::cq*,                                                      \
     (IbvLib::context*, int, void*, IbvLib::comp_channel*, int))       \
@@ -28,15 +30,20 @@ namespace tensorpipe {
   _(create_srq, IbvLib::srq*, (IbvLib::pd*, IbvLib::srq_init_attr*))  \
   _(dealloc_pd, int, (IbvLib::pd*))                                   \
   _(dereg_mr, int, (IbvLib::mr*))                                     \
+  _(destroy_comp_channel, int, (IbvLib::comp_channel*))               \
   _(destroy_cq, int, (IbvLib::cq*))                                   \
   _(destroy_qp, int, (IbvLib::qp*))                                   \
   _(destroy_srq, int, (IbvLib::srq*))                                 \
   _(event_type_str, const char*, (IbvLib::event_type))                \
   _(free_device_list, void, (IbvLib::device**))                       \
   _(get_async_event, int, (IbvLib::context*, IbvLib::async_event*))   \
+  _(get_cq_event,                                                     \
+    int,                                                              \
+    (IbvLib::comp_channel*, IbvLib::cq**, void**))                    \
   _(get_device_list, IbvLib::device**, (int*))                        \
   _(modify_qp, int, (IbvLib::qp*, IbvLib::qp_attr*, int))             \
   _(open_device, IbvLib::context*, (IbvLib::device*))                 \
+  _(query_device, int, (IbvLib::context*, IbvLib::device_attr*))      \
   _(query_gid, int, (IbvLib::context*, uint8_t, int, IbvLib::gid*))   \
   _(query_port, int, (IbvLib::context*, uint8_t, IbvLib::port_attr*)) \
   _(reg_mr, IbvLib::mr*, (IbvLib::pd*, void*, size_t, int))           \
@@ -65,6 +72,8 @@ class IbvLib {
     ACCESS_RELAXED_ORDERING = (1 << 20),
   };
 
+  enum atomic_cap { ATOMIC_NONE, ATOMIC_HCA, ATOMIC_GLOB };
+
   enum event_type {
     EVENT_CQ_ERR,
     EVENT_QP_FATAL,
@@ -166,6 +175,14 @@ class IbvLib {
     QPT_DRIVER = 0xff,
   };
 
+  enum send_flags {
+    SEND_FENCE = 1 << 0,
+    SEND_SIGNALED = 1 << 1,
+    SEND_SOLICITED = 1 << 2,
+    SEND_INLINE = 1 << 3,
+    SEND_IP_CSUM = 1 << 4
+  };
+
   enum transport_type {
     TRANSPORT_UNKNOWN = -1,
     TRANSPORT_IB = 0,
@@ -266,6 +283,49 @@ class IbvLib {
 
   // Attributes
 
+  struct device_attr {
+    char fw_ver[64];
+    uint64_t node_guid;
+    uint64_t sys_image_guid;
+    uint64_t max_mr_size;
+    uint64_t page_size_cap;
+    uint32_t vendor_id;
+    uint32_t vendor_part_id;
+    uint32_t hw_ver;
+    int max_qp;
+    int max_qp_wr;
+    unsigned int device_cap_flags;
+    int max_sge;
+    int max_sge_rd;
+    int max_cq;
+    int max_cqe;
+    int max_mr;
+    int max_pd;
+    int max_qp_rd_atom;
+    int max_ee_rd_atom;
+    int max_res_rd_atom;
+    int max_qp_init_rd_atom;
+    int max_ee_init_rd_atom;
+    IbvLib::atomic_cap atomic_cap;
+    int max_ee;
+    int max_rdd;
+    int max_mw;
+    int max_raw_ipv6_qp;
+    int max_raw_ethy_qp;
+    int max_mcast_grp;
+    int max_mcast_qp_attach;
+    int max_total_mcast_qp_attach;
+    int max_ah;
+    int max_fmr;
+    int max_map_per_fmr;
+    int max_srq;
+    int max_srq_wr;
+    int max_srq_sge;
+    uint16_t max_pkeys;
+    uint8_t local_ca_ack_delay;
+    uint8_t phys_port_cnt;
+  };
+
   struct port_attr {
     IbvLib::port_state state;
     IbvLib::mtu max_mtu;
@@ -659,6 +719,15 @@ class IbvLib {
   TP_FORALL_IBV_SYMBOLS(TP_FORWARD_CALL)
 #undef TP_FORWARD_CALL
 
+  // Replace a function with another one, so that tests can run what's built
+  // on top of this library without a device (or even without libibverbs).
+#define TP_DEFINE_OVERRIDE(function_name, return_type, args_types) \
+  void override_##function_name(return_type(*ptr) args_types) {    \
+    function_name##_ptr_ = ptr;                                    \
+  }
+  TP_FORALL_IBV_SYMBOLS(TP_DEFINE_OVERRIDE)
+#undef TP_DEFINE_OVERRIDE
+
   // These functions (which, it would seem, are the ones that are used in the
   // critical control path, and which thus must have the lowest latency and
   // avoid any syscall/kernel overhead) are not exposed as symbols of
@@ -679,6 +748,10 @@ class IbvLib {
       IbvLib::recv_wr** bad_recv_wr) {
     return srq->context->ops.post_srq_recv(srq, recv_wr, bad_recv_wr);
   }
+
+  int req_notify_cq(IbvLib::cq* cq, int solicited_only) {
+    return cq->context->ops.req_notify_cq(cq, solicited_only);
+  }
 };
 
 #undef TP_FORALL_IBV_SYMBOLS
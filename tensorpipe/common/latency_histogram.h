@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace tensorpipe {
+
+// A snapshot of a LatencyHistogram, which can be inspected and combined with
+// others without any synchronization.
+struct LatencyStats {
+  uint64_t count{0};
+  uint64_t sumNanoseconds{0};
+  // As many as the histogram has buckets, or none if nothing was recorded.
+  std::vector<uint64_t> bucketCounts;
+
+  // An upper bound on the given fraction (e.g., 0.99) of the latencies, which
+  // exceeds the exact value by at most the width of its bucket.
+  uint64_t percentileNanoseconds(double fraction) const;
+
+  void merge(const LatencyStats& other);
+};
+
+// A histogram of latencies with fixed memory, which can be recorded into from
+// any thread without locking. As in HDR histograms, the buckets are arranged
+// log-linearly: each power of two is split in a few equal parts, so that the
+// relative error is the same across the whole range, from nanoseconds up to
+// minutes, which is what's needed to analyze tail latencies.
+class LatencyHistogram {
+ public:
+  // Each power of two is split in 2^kSubBucketBits buckets, giving a relative
+  // error of at most 12.5%. Latencies longer than 2^kMaxExponent nanoseconds
+  // (about 18 minutes) all go in the last bucket.
+  static constexpr size_t kSubBucketBits = 3;
+  static constexpr size_t kNumSubBuckets = 1 << kSubBucketBits;
+  static constexpr size_t kMaxExponent = 40;
+  static constexpr size_t kNumBuckets =
+      (kMaxExponent - kSubBucketBits + 2) * kNumSubBuckets;
+
+  void record(std::chrono::nanoseconds latency) {
+    uint64_t ns = latency.count() > 0 ? latency.count() : 0;
+    buckets_[bucketIdx(ns)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sumNanoseconds_.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+  template <typename TDuration>
+  void record(TDuration latency) {
+    record(std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+  }
+
+  // The buckets are read one by one, hence concurrent records may be reflected
+  // only partially, which is fine for monitoring.
+  LatencyStats snapshot() const {
+    LatencyStats stats;
+    stats.count = count_.load(std::memory_order_relaxed);
+    stats.sumNanoseconds = sumNanoseconds_.load(std::memory_order_relaxed);
+    if (stats.count > 0) {
+      stats.bucketCounts.resize(kNumBuckets);
+      for (size_t idx = 0; idx < kNumBuckets; idx++) {
+        stats.bucketCounts[idx] = buckets_[idx].load(std::memory_order_relaxed);
+      }
+    }
+    return stats;
+  }
+
+  static size_t bucketIdx(uint64_t ns) {
+    if (ns < kNumSubBuckets) {
+      return ns;
+    }
+    size_t exponent = 63 - __builtin_clzll(ns);
+    if (exponent > kMaxExponent) {
+      return kNumBuckets - 1;
+    }
+    size_t subBucket =
+        (ns >> (exponent - kSubBucketBits)) & (kNumSubBuckets - 1);
+    return (exponent - kSubBucketBits + 1) * kNumSubBuckets + subBucket;
+  }
+
+  // The largest latency, in nanoseconds, that goes in the given bucket.
+  static uint64_t bucketUpperBound(size_t idx) {
+    if (idx < kNumSubBuckets) {
+      return idx;
+    }
+    if (idx == kNumBuckets - 1) {
+      return UINT64_MAX;
+    }
+    size_t shift = idx / kNumSubBuckets - 1;
+    uint64_t lowerBound =
+        static_cast<uint64_t>(kNumSubBuckets + idx % kNumSubBuckets) << shift;
+    return lowerBound + (static_cast<uint64_t>(1) << shift) - 1;
+  }
+
+ private:
+  std::array<std::atomic<uint64_t>, kNumBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sumNanoseconds_{0};
+};
+
+inline uint64_t LatencyStats::percentileNanoseconds(double fraction) const {
+  if (count == 0) {
+    return 0;
+  }
+  // The rank of the sample, counting from one, that the percentile falls on.
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(fraction * count));
+  uint64_t numSeen = 0;
+  for (size_t idx = 0; idx < bucketCounts.size(); idx++) {
+    numSeen += bucketCounts[idx];
+    if (numSeen >= rank) {
+      return LatencyHistogram::bucketUpperBound(idx);
+    }
+  }
+  return LatencyHistogram::bucketUpperBound(bucketCounts.size() - 1);
+}
+
+inline void LatencyStats::merge(const LatencyStats& other) {
+  count += other.count;
+  sumNanoseconds += other.sumNanoseconds;
+  if (other.bucketCounts.empty()) {
+    return;
+  }
+  if (bucketCounts.empty()) {
+    bucketCounts.resize(other.bucketCounts.size());
+  }
+  for (size_t idx = 0; idx < other.bucketCounts.size(); idx++) {
+    bucketCounts[idx] += other.bucketCounts[idx];
+  }
+}
+
+} // namespace tensorpipe
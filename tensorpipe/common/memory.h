@@ -20,13 +20,29 @@ class MmappedPtr {
  public:
   MmappedPtr() = default;
 
-  MmappedPtr(size_t length, int prot, int flags, int fd) {
+  MmappedPtr(size_t length, int prot, int flags, int fd, off_t offset = 0) {
     void* ptr;
-    ptr = ::mmap(nullptr, length, prot, flags, fd, 0);
+    ptr = ::mmap(nullptr, length, prot, flags, fd, offset);
     TP_THROW_SYSTEM_IF(ptr == MAP_FAILED, errno);
     ptr_ = decltype(ptr_)(reinterpret_cast<uint8_t*>(ptr), Deleter{length});
   }
 
+  // Returns an empty pointer, rather than throwing, if the mapping fails.
+  static MmappedPtr tryCreate(
+      size_t length,
+      int prot,
+      int flags,
+      int fd,
+      off_t offset = 0) {
+    MmappedPtr result;
+    void* ptr = ::mmap(nullptr, length, prot, flags, fd, offset);
+    if (ptr != MAP_FAILED) {
+      result.ptr_ =
+          decltype(ptr_)(reinterpret_cast<uint8_t*>(ptr), Deleter{length});
+    }
+    return result;
+  }
+
   uint8_t* ptr() {
     return ptr_.get();
   }
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A bounded multi-producer multi-consumer FIFO queue, which doesn't take any
+// lock when it's neither empty nor full. Each slot has a sequence number which
+// tells whether it's ready to be written or read for a given lap around the
+// ring, and producers and consumers claim slots by advancing their respective
+// position with a compare-and-swap (this is Dmitry Vyukov's design). When the
+// queue is empty (or full) the blocking pop (or push) spins for a while, and
+// then sleeps on a futex, which the other side only wakes when someone waits.
+template <typename T>
+class MpmcQueue {
+ public:
+  // The capacity is rounded up to a power of two.
+  explicit MpmcQueue(size_t capacity)
+      : mask_(roundUpToPowerOfTwo(capacity) - 1),
+        slots_(new Slot[mask_ + 1]) {
+    for (size_t idx = 0; idx <= mask_; idx++) {
+      slots_[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  MpmcQueue(const MpmcQueue&) = delete;
+  MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+  ~MpmcQueue() {
+    T t;
+    while (tryPop(t)) {
+    }
+  }
+
+  bool tryPush(T& t) {
+    size_t pos = pushPos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[pos & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (pushPos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          new (&slot.storage) T(std::move(t));
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          notify_(popWaiters_);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The slot still holds the item of the previous lap: we're full.
+        return false;
+      } else {
+        pos = pushPos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool tryPop(T& t) {
+    size_t pos = popPos_.load(std::memory_order_relaxed);
+    while (true) {
+      Slot& slot = slots_[pos & mask_];
+      const size_t sequence = slot.sequence.load(std::memory_order_acquire);
+      const intptr_t diff =
+          static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (popPos_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          T* item = reinterpret_cast<T*>(&slot.storage);
+          t = std::move(*item);
+          item->~T();
+          slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          notify_(pushWaiters_);
+          return true;
+        }
+      } else if (diff < 0) {
+        // The slot hasn't been written for this lap yet: we're empty.
+        return false;
+      } else {
+        pos = popPos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void push(T t) {
+    wait_(pushWaiters_, [&]() { return tryPush(t); });
+  }
+
+  T pop() {
+    T t;
+    wait_(popWaiters_, [&]() { return tryPop(t); });
+    return t;
+  }
+
+ private:
+  // How many times to retry before going to sleep.
+  static constexpr int kNumSpins = 1000;
+
+  struct Slot {
+    std::atomic<size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  // The threads waiting on one side of the queue. The epoch is the futex word,
+  // bumped by the other side whenever it makes progress while there are any.
+  struct alignas(64) Waiters {
+    std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> count{0};
+  };
+
+  static size_t roundUpToPowerOfTwo(size_t n) {
+    TP_THROW_ASSERT_IF(n == 0) << "The capacity cannot be zero";
+    size_t result = 1;
+    while (result < n) {
+      result <<= 1;
+    }
+    return result;
+  }
+
+  template <typename TFn>
+  void wait_(Waiters& waiters, TFn&& attempt) {
+    for (int spin = 0; spin < kNumSpins; spin++) {
+      if (attempt()) {
+        return;
+      }
+    }
+    while (true) {
+      const uint32_t epoch = waiters.epoch.load(std::memory_order_acquire);
+      waiters.count.fetch_add(1, std::memory_order_relaxed);
+      // Pairs with the fence in notify_, to ensure that either we see the
+      // progress of the other side, or it sees that we're waiting.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (attempt()) {
+        waiters.count.fetch_sub(1, std::memory_order_relaxed);
+        return;
+      }
+      // A mismatching value means we were woken up in the meantime.
+      ::syscall(
+          SYS_futex,
+          &waiters.epoch,
+          FUTEX_WAIT_PRIVATE,
+          epoch,
+          nullptr,
+          nullptr,
+          0);
+      waiters.count.fetch_sub(1, std::memory_order_relaxed);
+      if (attempt()) {
+        return;
+      }
+    }
+  }
+
+  void notify_(Waiters& waiters) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (unlikely(waiters.count.load(std::memory_order_relaxed) > 0)) {
+      waiters.epoch.fetch_add(1, std::memory_order_release);
+      ::syscall(
+          SYS_futex,
+          &waiters.epoch,
+          FUTEX_WAKE_PRIVATE,
+          1,
+          nullptr,
+          nullptr,
+          0);
+    }
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  alignas(64) std::atomic<size_t> pushPos_{0};
+  alignas(64) std::atomic<size_t> popPos_{0};
+
+  Waiters pushWaiters_;
+  Waiters popWaiters_;
+};
+
+} // namespace tensorpipe
@@ -13,6 +13,9 @@
 #include <nop/utility/buffer_reader.h>
 #include <nop/utility/buffer_writer.h>
 
+#include <memory>
+#include <utility>
+
 #include <tensorpipe/common/defs.h>
 
 namespace tensorpipe {
@@ -80,6 +83,19 @@ class NopReader final {
     return nop::ErrorStatus::None;
   }
 
+  // Gives the next byte without consuming it, to tell apart objects that were
+  // written in different formats.
+  nop::Status<void> Peek(uint8_t* byte) const {
+    if (likely(len1_ > 0)) {
+      *byte = *ptr1_;
+    } else if (likely(len2_ > 0)) {
+      *byte = *ptr2_;
+    } else {
+      return nop::ErrorStatus::ReadLimitReached;
+    }
+    return nop::ErrorStatus::None;
+  }
+
   nop::Status<void> Read(void* begin, void* end) {
     size_t size =
         reinterpret_cast<uint8_t*>(end) - reinterpret_cast<uint8_t*>(begin);
@@ -185,6 +201,10 @@ class NopWriter final {
     return nop::ErrorStatus::None;
   }
 
+  size_t getRemaining() const {
+    return len1_ + len2_;
+  }
+
  private:
   uint8_t* ptr1_ = nullptr;
   size_t len1_ = 0;
@@ -195,10 +215,19 @@ class NopWriter final {
 // The helpers to perform type erasure of the object type: a untemplated base
 // class exposing the methods we need for (de)serialization, and then templated
 // subclasses allowing to create a holder for each concrete libnop type.
+//
+// Computing the exact size of an object takes a pass over it, as long as the
+// one that serializes it. Most objects of a given type (e.g., the descriptors
+// of the messages of a pipe) have similar sizes, hence the holders remember the
+// size of the last object of their type that the current thread serialized, so
+// that the buffer can be sized after it instead, and the size only needs to be
+// computed if that turns out too small.
 
 class AbstractNopHolder {
  public:
   virtual size_t getSize() const = 0;
+  // Zero if this thread hasn't serialized any object of this type yet.
+  virtual size_t getSizeHint() const = 0;
   virtual nop::Status<void> write(NopWriter& writer) const = 0;
   virtual nop::Status<void> read(NopReader& reader) = 0;
   virtual ~AbstractNopHolder() = default;
@@ -219,8 +248,17 @@ class NopHolder : public AbstractNopHolder {
     return nop::Encoding<T>::Size(object_);
   }
 
+  size_t getSizeHint() const override {
+    return lastSize_;
+  }
+
   nop::Status<void> write(NopWriter& writer) const override {
-    return nop::Encoding<T>::Write(object_, &writer);
+    const size_t remainingBefore = writer.getRemaining();
+    nop::Status<void> status = nop::Encoding<T>::Write(object_, &writer);
+    if (likely(status)) {
+      lastSize_ = remainingBefore - writer.getRemaining();
+    }
+    return status;
   }
 
   nop::Status<void> read(NopReader& reader) override {
@@ -229,6 +267,40 @@ class NopHolder : public AbstractNopHolder {
 
  private:
   T object_;
+
+  static thread_local size_t lastSize_;
 };
 
+template <typename T>
+thread_local size_t NopHolder<T>::lastSize_ = 0;
+
+// A length that most likely fits the object: its hint, with some slack, or its
+// exact size if there's no hint.
+inline size_t estimateNopObjectSize(const AbstractNopHolder& object) {
+  const size_t hint = object.getSizeHint();
+  if (hint == 0) {
+    return object.getSize();
+  }
+  return hint + hint / 4 + 64;
+}
+
+// Serializes the object into a newly allocated buffer, sized after the
+// estimate, and returns it together with the length of the data in it.
+inline std::pair<std::unique_ptr<uint8_t[]>, size_t> serializeNopObject(
+    const AbstractNopHolder& object) {
+  size_t capacity = estimateNopObjectSize(object);
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[capacity]);
+  NopWriter writer(buf.get(), capacity);
+  nop::Status<void> status = object.write(writer);
+  if (unlikely(status.error() == nop::ErrorStatus::WriteLimitReached)) {
+    capacity = object.getSize();
+    buf.reset(new uint8_t[capacity]);
+    writer = NopWriter(buf.get(), capacity);
+    status = object.write(writer);
+  }
+  TP_THROW_ASSERT_IF(status.has_error())
+      << "Error writing nop object: " << status.GetErrorMessage();
+  return std::make_pair(std::move(buf), capacity - writer.getRemaining());
+}
+
 } // namespace tensorpipe
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/config.h>
+
+// USDT (user-level statically defined tracing) probes, to which tools such as
+// bpftrace and perf can attach in a running process, e.g.:
+//
+//   bpftrace -e 'usdt:./libtensorpipe.so:tensorpipe:pipe_write_complete {
+//     @[str(arg0)] = count(); }'
+//
+// A probe that nothing is attached to is a single nop instruction, and its
+// arguments are only evaluated into registers. Hence they must be cheap to
+// compute: integers, or pointers to strings that already exist. The probes
+// are only compiled in when building with TP_ENABLE_USDT, which needs the
+// sys/sdt.h header of SystemTap, and otherwise they vanish.
+//
+// The probes are:
+// - pipe_read_enqueue(id, sequence number) when the user calls read on a pipe,
+//   pipe_write_enqueue(id, sequence number, number of bytes) when a write is
+//   admitted (hence not for those dropped past their deadline), and
+//   pipe_{read,write}_complete(id, sequence number, number of bytes, error)
+//   right before the callback of the operation is called;
+// - ring_reserve(size, result) and ring_commit(size) when producing to a ring
+//   buffer in place, and ring_consume(size) when data is consumed from it;
+// - shm_reactor_trigger(token) and shm_reactor_dispatch(token) when a function
+//   is scheduled on and run by the reactor of the shm transport;
+// - ibv_post_send(queue pair, kind, signaled) and ibv_poll(number of work
+//   completions) in the reactor of the ibv transport;
+// - cma_copy_start(remote pid, length) and cma_copy_end(remote pid, result)
+//   around each chunk copied by the CMA channel.
+
+#if TENSORPIPE_HAS_USDT_PROBES
+
+#include <sys/sdt.h>
+
+#define TP_PROBE(...) STAP_PROBEV(tensorpipe, __VA_ARGS__)
+
+#else // TENSORPIPE_HAS_USDT_PROBES
+
+#define TP_PROBE(...) \
+  do {                \
+  } while (false)
+
+#endif // TENSORPIPE_HAS_USDT_PROBES
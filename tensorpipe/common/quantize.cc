@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/quantize.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// The largest magnitude of an int8, which the largest value of a block maps to.
+constexpr float kInt8Max = 127.0f;
+
+uint32_t bitsOf(float value) {
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+float floatOf(uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// The scalar conversions are those of Fabian Giesen's float/half snippets, and
+// they handle infinities, NaNs and subnormals like the vector ones do.
+
+uint16_t floatToBf16(float value) {
+  const uint32_t bits = bitsOf(value);
+  if ((bits & 0x7fffffff) > 0x7f800000) {
+    // Keep NaNs quiet, rather than letting the rounding turn them into infs.
+    return (bits >> 16) | 0x0040;
+  }
+  return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+float bf16ToFloat(uint16_t half) {
+  return floatOf(static_cast<uint32_t>(half) << 16);
+}
+
+uint16_t floatToFp16(float value) {
+  uint32_t bits = bitsOf(value);
+  const uint16_t sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+  if (bits > 0x7f800000) {
+    return sign | 0x7e00;
+  }
+  // Anything from 2^16 up (including infinities) is out of range.
+  if (bits >= 0x47800000) {
+    return sign | 0x7c00;
+  }
+  // Below 2^-14 the result is subnormal: adding 0.5 lines the mantissa up so
+  // that the FPU does the rounding.
+  if (bits < 0x38800000) {
+    return sign | (bitsOf(floatOf(bits) + 0.5f) - 0x3f000000);
+  }
+  // Rebias the exponent and round the mantissa to nearest even.
+  bits += 0xc8000fff + ((bits >> 13) & 1);
+  return sign | (bits >> 13);
+}
+
+float fp16ToFloat(uint16_t half) {
+  constexpr uint32_t kShiftedExponent = 0x7c00 << 13;
+  uint32_t bits = (half & 0x7fff) << 13;
+  const uint32_t exponent = bits & kShiftedExponent;
+  bits += (127 - 15) << 23;
+  if (exponent == kShiftedExponent) {
+    // Infinities and NaNs.
+    bits += (128 - 16) << 23;
+  } else if (exponent == 0) {
+    // Zeros and subnormals, renormalized by the FPU.
+    bits += 1 << 23;
+    bits = bitsOf(floatOf(bits) - floatOf(113 << 23));
+  }
+  return floatOf(bits | (static_cast<uint32_t>(half & 0x8000) << 16));
+}
+
+int8_t floatToInt8(float value) {
+  // The order of the arguments sends NaNs to the lower bound.
+  return static_cast<int8_t>(
+      std::nearbyint(std::min(kInt8Max, std::max(-kInt8Max, value))));
+}
+
+// The vector kernels convert as many whole vectors as they can, and return how
+// many values they converted. The caller converts the rest.
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) size_t
+quantizeBf16Avx2(const float* src, size_t numValues, uint16_t* dst) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i bias = _mm256_set1_epi32(0x7fff);
+  const __m256i quiet = _mm256_set1_epi32(0x0040);
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    const __m256 value = _mm256_loadu_ps(src + idx);
+    const __m256i bits = _mm256_castps_si256(value);
+    const __m256i high = _mm256_srli_epi32(bits, 16);
+    const __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(
+            bits, _mm256_add_epi32(bias, _mm256_and_si256(high, one))),
+        16);
+    const __m256i isNan =
+        _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+    const __m256i result =
+        _mm256_blendv_epi8(rounded, _mm256_or_si256(high, quiet), isNan);
+    // Packing works within each 128-bit lane, hence the halves must then be
+    // gathered in the low lane.
+    const __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(result, result), 0xd8);
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + idx), _mm256_castsi256_si128(packed));
+  }
+  return idx;
+}
+
+__attribute__((target("avx2"))) size_t
+dequantizeBf16Avx2(const uint16_t* src, size_t numValues, float* dst) {
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    const __m256i bits = _mm256_slli_epi32(
+        _mm256_cvtepu16_epi32(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + idx))),
+        16);
+    _mm256_storeu_ps(dst + idx, _mm256_castsi256_ps(bits));
+  }
+  return idx;
+}
+
+__attribute__((target("avx,f16c"))) size_t
+quantizeFp16F16c(const float* src, size_t numValues, uint16_t* dst) {
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(dst + idx),
+        _mm256_cvtps_ph(
+            _mm256_loadu_ps(src + idx), _MM_FROUND_TO_NEAREST_INT));
+  }
+  return idx;
+}
+
+__attribute__((target("avx,f16c"))) size_t
+dequantizeFp16F16c(const uint16_t* src, size_t numValues, float* dst) {
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    _mm256_storeu_ps(
+        dst + idx,
+        _mm256_cvtph_ps(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + idx))));
+  }
+  return idx;
+}
+
+__attribute__((target("avx2"))) float maxAbsAvx2(
+    const float* src,
+    size_t numValues,
+    size_t& numDone) {
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  __m256 maxAbs = _mm256_setzero_ps();
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    // With a NaN as first operand the second one is returned, hence NaNs are
+    // skipped.
+    maxAbs = _mm256_max_ps(
+        _mm256_and_ps(_mm256_loadu_ps(src + idx), absMask), maxAbs);
+  }
+  __m128 half = _mm_max_ps(
+      _mm256_castps256_ps128(maxAbs), _mm256_extractf128_ps(maxAbs, 1));
+  half = _mm_max_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_max_ss(half, _mm_shuffle_ps(half, half, 1));
+  numDone = idx;
+  return _mm_cvtss_f32(half);
+}
+
+__attribute__((target("avx2"))) size_t quantizeInt8Avx2(
+    const float* src,
+    size_t numValues,
+    float inverseScale,
+    int8_t* dst) {
+  const __m256 factor = _mm256_set1_ps(inverseScale);
+  const __m256 upper = _mm256_set1_ps(kInt8Max);
+  const __m256 lower = _mm256_set1_ps(-kInt8Max);
+  const __m256i gather = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    __m256 value = _mm256_mul_ps(_mm256_loadu_ps(src + idx), factor);
+    // As above, NaNs end up at the lower bound.
+    value = _mm256_min_ps(_mm256_max_ps(value, lower), upper);
+    __m256i packed = _mm256_cvtps_epi32(value);
+    packed = _mm256_packs_epi32(packed, packed);
+    packed = _mm256_packs_epi16(packed, packed);
+    // Each lane holds four of the values in its first 32 bits.
+    packed = _mm256_permutevar8x32_epi32(packed, gather);
+    _mm_storel_epi64(
+        reinterpret_cast<__m128i*>(dst + idx), _mm256_castsi256_si128(packed));
+  }
+  return idx;
+}
+
+__attribute__((target("avx2"))) size_t dequantizeInt8Avx2(
+    const int8_t* src,
+    size_t numValues,
+    float scale,
+    float* dst) {
+  const __m256 factor = _mm256_set1_ps(scale);
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    const __m256i value = _mm256_cvtepi8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + idx)));
+    _mm256_storeu_ps(
+        dst + idx, _mm256_mul_ps(_mm256_cvtepi32_ps(value), factor));
+  }
+  return idx;
+}
+
+bool hasAvx2() {
+  static const bool result = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return result;
+}
+
+bool hasF16c() {
+  static const bool result = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  }();
+  return result;
+}
+
+#endif // __x86_64__
+
+void quantizeBf16(const float* src, size_t numValues, uint16_t* dst) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    idx = quantizeBf16Avx2(src, numValues, dst);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = floatToBf16(src[idx]);
+  }
+}
+
+void dequantizeBf16(const uint16_t* src, size_t numValues, float* dst) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    idx = dequantizeBf16Avx2(src, numValues, dst);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = bf16ToFloat(src[idx]);
+  }
+}
+
+void quantizeFp16(const float* src, size_t numValues, uint16_t* dst) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasF16c()) {
+    idx = quantizeFp16F16c(src, numValues, dst);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = floatToFp16(src[idx]);
+  }
+}
+
+void dequantizeFp16(const uint16_t* src, size_t numValues, float* dst) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasF16c()) {
+    idx = dequantizeFp16F16c(src, numValues, dst);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = fp16ToFloat(src[idx]);
+  }
+}
+
+void quantizeInt8Block(const float* src, size_t numValues, uint8_t* dst) {
+  float maxAbs = 0.0f;
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    maxAbs = maxAbsAvx2(src, numValues, idx);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    // As above, the order of the arguments skips NaNs.
+    maxAbs = std::max(maxAbs, std::fabs(src[idx]));
+  }
+  const float scale = maxAbs / kInt8Max;
+  const float inverseScale = scale > 0.0f ? 1.0f / scale : 0.0f;
+  std::memcpy(dst, &scale, sizeof(scale));
+  int8_t* values = reinterpret_cast<int8_t*>(dst + sizeof(scale));
+
+  idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    idx = quantizeInt8Avx2(src, numValues, inverseScale, values);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    values[idx] = floatToInt8(src[idx] * inverseScale);
+  }
+}
+
+void dequantizeInt8Block(const uint8_t* src, size_t numValues, float* dst) {
+  float scale;
+  std::memcpy(&scale, src, sizeof(scale));
+  const int8_t* values = reinterpret_cast<const int8_t*>(src + sizeof(scale));
+
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    idx = dequantizeInt8Avx2(values, numValues, scale, dst);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = values[idx] * scale;
+  }
+}
+
+} // namespace
+
+std::string quantizationFormatName(QuantizationFormat format) {
+  switch (format) {
+    case QuantizationFormat::kBf16:
+      return "bf16";
+    case QuantizationFormat::kFp16:
+      return "fp16";
+    case QuantizationFormat::kInt8:
+      return "int8";
+  }
+  TP_THROW_ASSERT() << "Unknown quantization format";
+  // Dummy return to make the compiler happy.
+  return "";
+}
+
+optional<QuantizationFormat> quantizationFormatFromName(
+    const std::string& name) {
+  for (QuantizationFormat format :
+       {QuantizationFormat::kBf16,
+        QuantizationFormat::kFp16,
+        QuantizationFormat::kInt8}) {
+    if (quantizationFormatName(format) == name) {
+      return format;
+    }
+  }
+  return nullopt;
+}
+
+size_t quantizedLength(
+    QuantizationFormat format,
+    size_t numValues,
+    size_t blockSize) {
+  switch (format) {
+    case QuantizationFormat::kBf16:
+    case QuantizationFormat::kFp16:
+      return numValues * sizeof(uint16_t);
+    case QuantizationFormat::kInt8: {
+      TP_DCHECK_GT(blockSize, 0);
+      const size_t numBlocks = (numValues + blockSize - 1) / blockSize;
+      return numBlocks * sizeof(float) + numValues * sizeof(int8_t);
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown quantization format";
+  // Dummy return to make the compiler happy.
+  return 0;
+}
+
+void quantize(
+    QuantizationFormat format,
+    const float* src,
+    size_t numValues,
+    uint8_t* dst,
+    size_t blockSize) {
+  switch (format) {
+    case QuantizationFormat::kBf16:
+      quantizeBf16(src, numValues, reinterpret_cast<uint16_t*>(dst));
+      return;
+    case QuantizationFormat::kFp16:
+      quantizeFp16(src, numValues, reinterpret_cast<uint16_t*>(dst));
+      return;
+    case QuantizationFormat::kInt8:
+      for (size_t offset = 0; offset < numValues; offset += blockSize) {
+        const size_t length = std::min(blockSize, numValues - offset);
+        quantizeInt8Block(src + offset, length, dst);
+        dst += sizeof(float) + length;
+      }
+      return;
+  }
+}
+
+void dequantize(
+    QuantizationFormat format,
+    const uint8_t* src,
+    size_t numValues,
+    float* dst,
+    size_t blockSize) {
+  switch (format) {
+    case QuantizationFormat::kBf16:
+      dequantizeBf16(reinterpret_cast<const uint16_t*>(src), numValues, dst);
+      return;
+    case QuantizationFormat::kFp16:
+      dequantizeFp16(reinterpret_cast<const uint16_t*>(src), numValues, dst);
+      return;
+    case QuantizationFormat::kInt8:
+      for (size_t offset = 0; offset < numValues; offset += blockSize) {
+        const size_t length = std::min(blockSize, numValues - offset);
+        dequantizeInt8Block(src, length, dst + offset);
+        src += sizeof(float) + length;
+      }
+      return;
+  }
+}
+
+} // namespace tensorpipe
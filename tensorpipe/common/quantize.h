@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <tensorpipe/common/optional.h>
+
+namespace tensorpipe {
+
+// Lossy encodings of fp32 data, for tensors (e.g., gradients) that tolerate a
+// reduced precision. The 16-bit ones round to nearest even. The 8-bit one
+// splits the data in blocks, each of which is stored as a fp32 scale (i.e., its
+// largest magnitude divided by 127) followed by one int8 per value.
+enum class QuantizationFormat {
+  kBf16,
+  kFp16,
+  kInt8,
+};
+
+std::string quantizationFormatName(QuantizationFormat format);
+
+optional<QuantizationFormat> quantizationFormatFromName(
+    const std::string& name);
+
+// The number of bytes that the given number of values take once quantized.
+size_t quantizedLength(
+    QuantizationFormat format,
+    size_t numValues,
+    size_t blockSize);
+
+// These use AVX2 (and F16C for fp16) when the CPU supports them, as detected at
+// runtime, and plain C++ otherwise.
+
+void quantize(
+    QuantizationFormat format,
+    const float* src,
+    size_t numValues,
+    uint8_t* dst,
+    size_t blockSize);
+
+void dequantize(
+    QuantizationFormat format,
+    const uint8_t* src,
+    size_t numValues,
+    float* dst,
+    size_t blockSize);
+
+} // namespace tensorpipe
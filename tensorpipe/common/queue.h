@@ -39,6 +39,20 @@ class Queue {
     return t;
   }
 
+  // Pop the first item only if there is one and it satisfies the predicate,
+  // without waiting. Returns whether it did.
+  template <typename TPred>
+  bool tryPopIf(T& t, TPred&& pred) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (items_.size() == 0 || !pred(items_.front())) {
+      return false;
+    }
+    t = std::move(items_.front());
+    items_.pop_front();
+    cv_.notify_all();
+    return true;
+  }
+
  private:
   std::mutex mutex_;
   std::condition_variable cv_;
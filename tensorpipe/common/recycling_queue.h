@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+// A FIFO queue which, like std::deque, guarantees that references to its
+// elements remain valid until they are removed, but which, unlike it, doesn't
+// release the memory of the elements it removes, and rather reuses them for the
+// ones it adds later. Once it has grown to hold as many elements as are alive
+// at the same time, it thus doesn't perform any more heap allocations. Removed
+// elements are passed to a recycler function, which must bring them back to a
+// pristine state but may preserve the capacity of their members (e.g., by
+// clearing the vectors they contain rather than destroying them).
+template <typename T>
+class RecyclingQueue {
+ public:
+  using recycler_fn = std::function<void(T&)>;
+
+  explicit RecyclingQueue(recycler_fn recycler)
+      : recycler_(std::move(recycler)) {}
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  // How many elements were ever constructed, in use or set aside for reuse.
+  size_t numAllocated() const {
+    return numAllocated_;
+  }
+
+  T& operator[](size_t idx) {
+    TP_DCHECK_LT(idx, size_);
+    return *slots_[(head_ + idx) % slots_.size()];
+  }
+
+  const T& operator[](size_t idx) const {
+    TP_DCHECK_LT(idx, size_);
+    return *slots_[(head_ + idx) % slots_.size()];
+  }
+
+  T& front() {
+    return (*this)[0];
+  }
+
+  T& back() {
+    return (*this)[size_ - 1];
+  }
+
+  T& emplace_back() {
+    if (size_ == slots_.size()) {
+      grow_();
+    }
+    std::unique_ptr<T>& slot = slots_[(head_ + size_) % slots_.size()];
+    if (!slot) {
+      slot = std::make_unique<T>();
+      ++numAllocated_;
+    }
+    ++size_;
+    return *slot;
+  }
+
+  void pop_front() {
+    TP_DCHECK_GT(size_, 0);
+    recycler_(*slots_[head_]);
+    head_ = (head_ + 1) % slots_.size();
+    --size_;
+  }
+
+  void pop_back() {
+    TP_DCHECK_GT(size_, 0);
+    recycler_(back());
+    --size_;
+  }
+
+ private:
+  const recycler_fn recycler_;
+
+  // A circular buffer of the elements that are currently in the queue, which
+  // start at position head_, followed by the ones that are set aside for reuse
+  // (or null pointers, for slots that have never been used).
+  std::vector<std::unique_ptr<T>> slots_;
+  size_t head_{0};
+  size_t size_{0};
+  size_t numAllocated_{0};
+
+  void grow_() {
+    // All slots are in use, hence we can move the head to the beginning and
+    // extend the buffer at the end. Only the pointers are moved, hence any
+    // reference to the elements remains valid.
+    std::rotate(slots_.begin(), slots_.begin() + head_, slots_.end());
+    head_ = 0;
+    slots_.resize(std::max<size_t>(2 * slots_.size(), 1));
+  }
+};
+
+} // namespace tensorpipe
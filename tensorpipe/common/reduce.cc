@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/reduce.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// These mirror what the vector instructions do, which is to return the second
+// operand if either of them is a NaN.
+template <typename T>
+T combine(ReduceOp op, T a, T b) {
+  switch (op) {
+    case ReduceOp::kSum:
+      return a + b;
+    case ReduceOp::kProduct:
+      return a * b;
+    case ReduceOp::kMin:
+      return a < b ? a : b;
+    case ReduceOp::kMax:
+      return a > b ? a : b;
+  }
+  return b;
+}
+
+// The vector kernels combine as many whole vectors as they can, and return how
+// many values they combined. The caller combines the rest.
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx"))) inline __m256
+combinePs(ReduceOp op, __m256 a, __m256 b) {
+  switch (op) {
+    case ReduceOp::kSum:
+      return _mm256_add_ps(a, b);
+    case ReduceOp::kProduct:
+      return _mm256_mul_ps(a, b);
+    case ReduceOp::kMin:
+      return _mm256_min_ps(a, b);
+    case ReduceOp::kMax:
+      return _mm256_max_ps(a, b);
+  }
+  return b;
+}
+
+__attribute__((target("avx"))) inline __m256d
+combinePd(ReduceOp op, __m256d a, __m256d b) {
+  switch (op) {
+    case ReduceOp::kSum:
+      return _mm256_add_pd(a, b);
+    case ReduceOp::kProduct:
+      return _mm256_mul_pd(a, b);
+    case ReduceOp::kMin:
+      return _mm256_min_pd(a, b);
+    case ReduceOp::kMax:
+      return _mm256_max_pd(a, b);
+  }
+  return b;
+}
+
+// Two vectors per iteration, to hide the latency of the operations.
+__attribute__((target("avx"))) size_t
+reduceFloat32Avx(ReduceOp op, float* dst, const float* src, size_t numValues) {
+  size_t idx = 0;
+  for (; idx + 16 <= numValues; idx += 16) {
+    const __m256 a0 = _mm256_loadu_ps(dst + idx);
+    const __m256 a1 = _mm256_loadu_ps(dst + idx + 8);
+    const __m256 b0 = _mm256_loadu_ps(src + idx);
+    const __m256 b1 = _mm256_loadu_ps(src + idx + 8);
+    _mm256_storeu_ps(dst + idx, combinePs(op, a0, b0));
+    _mm256_storeu_ps(dst + idx + 8, combinePs(op, a1, b1));
+  }
+  for (; idx + 8 <= numValues; idx += 8) {
+    _mm256_storeu_ps(
+        dst + idx,
+        combinePs(op, _mm256_loadu_ps(dst + idx), _mm256_loadu_ps(src + idx)));
+  }
+  return idx;
+}
+
+__attribute__((target("avx"))) size_t reduceFloat64Avx(
+    ReduceOp op,
+    double* dst,
+    const double* src,
+    size_t numValues) {
+  size_t idx = 0;
+  for (; idx + 8 <= numValues; idx += 8) {
+    const __m256d a0 = _mm256_loadu_pd(dst + idx);
+    const __m256d a1 = _mm256_loadu_pd(dst + idx + 4);
+    const __m256d b0 = _mm256_loadu_pd(src + idx);
+    const __m256d b1 = _mm256_loadu_pd(src + idx + 4);
+    _mm256_storeu_pd(dst + idx, combinePd(op, a0, b0));
+    _mm256_storeu_pd(dst + idx + 4, combinePd(op, a1, b1));
+  }
+  for (; idx + 4 <= numValues; idx += 4) {
+    _mm256_storeu_pd(
+        dst + idx,
+        combinePd(op, _mm256_loadu_pd(dst + idx), _mm256_loadu_pd(src + idx)));
+  }
+  return idx;
+}
+
+bool hasAvx() {
+  static const bool result = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx");
+  }();
+  return result;
+}
+
+#endif // __x86_64__
+
+void reduceFloat32(
+    ReduceOp op,
+    float* dst,
+    const float* src,
+    size_t numValues) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx()) {
+    idx = reduceFloat32Avx(op, dst, src, numValues);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = combine(op, dst[idx], src[idx]);
+  }
+}
+
+void reduceFloat64(
+    ReduceOp op,
+    double* dst,
+    const double* src,
+    size_t numValues) {
+  size_t idx = 0;
+#if defined(__x86_64__)
+  if (hasAvx()) {
+    idx = reduceFloat64Avx(op, dst, src, numValues);
+  }
+#endif // __x86_64__
+  for (; idx < numValues; idx++) {
+    dst[idx] = combine(op, dst[idx], src[idx]);
+  }
+}
+
+} // namespace
+
+size_t reduceDataTypeSize(ReduceDataType dataType) {
+  switch (dataType) {
+    case ReduceDataType::kFloat32:
+      return sizeof(float);
+    case ReduceDataType::kFloat64:
+      return sizeof(double);
+  }
+  TP_THROW_ASSERT() << "Unknown data type";
+  // Dummy return to make the compiler happy.
+  return 0;
+}
+
+void reduce(
+    ReduceOp op,
+    ReduceDataType dataType,
+    void* dst,
+    const void* src,
+    size_t numValues) {
+  switch (dataType) {
+    case ReduceDataType::kFloat32:
+      reduceFloat32(
+          op,
+          reinterpret_cast<float*>(dst),
+          reinterpret_cast<const float*>(src),
+          numValues);
+      return;
+    case ReduceDataType::kFloat64:
+      reduceFloat64(
+          op,
+          reinterpret_cast<double*>(dst),
+          reinterpret_cast<const double*>(src),
+          numValues);
+      return;
+  }
+  TP_THROW_ASSERT() << "Unknown data type";
+}
+
+} // namespace tensorpipe
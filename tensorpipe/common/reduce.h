@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace tensorpipe {
+
+enum class ReduceOp {
+  kSum,
+  kProduct,
+  kMin,
+  kMax,
+};
+
+enum class ReduceDataType {
+  kFloat32,
+  kFloat64,
+};
+
+size_t reduceDataTypeSize(ReduceDataType dataType);
+
+// Combine each value of src into the one of dst at the same index. This uses
+// AVX when the CPU supports it, as detected at runtime, and plain C++
+// otherwise. For min and max, if either value is a NaN the one of src is kept.
+void reduce(
+    ReduceOp op,
+    ReduceDataType dataType,
+    void* dst,
+    const void* src,
+    size_t numValues);
+
+} // namespace tensorpipe
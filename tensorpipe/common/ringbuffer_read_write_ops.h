@@ -8,14 +8,20 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <memory>
 #include <tuple>
 #include <utility>
 
+#include <tensorpipe/common/copy.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dsa.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/nop.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
@@ -38,7 +44,7 @@ class RingbufferReadOperation {
 
  public:
   using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t len)>;
+      Function<void(const Error& error, const void* ptr, size_t len)>;
   // Read into a user-provided buffer of known length.
   inline RingbufferReadOperation(void* ptr, size_t len, read_callback_fn fn);
   // Read into an auto-allocated buffer, whose length is read from the wire.
@@ -48,8 +54,11 @@ class RingbufferReadOperation {
       AbstractNopHolder* nopObject,
       read_callback_fn fn);
 
-  // Processes a pending read.
-  inline size_t handleRead(util::ringbuffer::Consumer& consumer);
+  // Processes a pending read. Large payloads are copied out of the ringbuffer
+  // by the copy engine, if one is given.
+  inline size_t handleRead(
+      util::ringbuffer::Consumer& consumer,
+      DsaCopyEngine* copyEngine = nullptr);
 
   bool completed() const {
     return (mode_ == READ_PAYLOAD && bytesRead_ == len_);
@@ -71,6 +80,7 @@ class RingbufferReadOperation {
   const bool ptrProvided_;
 
   inline ssize_t readNopObject_(util::ringbuffer::Consumer& consumer);
+  inline ssize_t readInPlace_(util::ringbuffer::Consumer& consumer);
 };
 
 // Writes happen only if the user supplied a memory pointer, the
@@ -87,7 +97,7 @@ class RingbufferWriteOperation {
   };
 
  public:
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = Function<void(const Error& error)>;
   // Write from a user-provided buffer of known length.
   inline RingbufferWriteOperation(
       const void* ptr,
@@ -98,7 +108,20 @@ class RingbufferWriteOperation {
       const AbstractNopHolder* nopObject,
       write_callback_fn fn);
 
-  inline size_t handleWrite(util::ringbuffer::Producer& producer);
+  // At most maxPayloadBytes of the payload are written, which lets the caller
+  // split a large write over several turns. The length and nop objects are
+  // always written in full.
+  inline size_t handleWrite(
+      util::ringbuffer::Producer& producer,
+      size_t maxPayloadBytes = std::numeric_limits<size_t>::max());
+
+  // Like handleWrite, but within a transaction that the caller started, and
+  // will commit, so that several operations can be published at once. The
+  // callback is invoked before the data is published, hence it must not start
+  // any transaction on the same producer.
+  inline size_t handleWriteInTx(
+      util::ringbuffer::Producer& producer,
+      size_t maxPayloadBytes = std::numeric_limits<size_t>::max());
 
   bool completed() const {
     return (mode_ == WRITE_PAYLOAD && bytesWritten_ == len_);
@@ -110,10 +133,17 @@ class RingbufferWriteOperation {
   Mode mode_{WRITE_LENGTH};
   const void* ptr_{nullptr};
   const AbstractNopHolder* nopObject_{nullptr};
+  // For nop objects, it's only known once they're written, unless writing
+  // them in one pass failed.
   size_t len_{0};
+  bool lenKnown_{true};
   size_t bytesWritten_{0};
   write_callback_fn fn_;
 
+  inline size_t writeInTx_(
+      util::ringbuffer::Producer& producer,
+      size_t maxPayloadBytes);
+  inline ssize_t writeNopObjectInOnePass_(util::ringbuffer::Producer& producer);
   inline ssize_t writeNopObject_(util::ringbuffer::Producer& producer);
 };
 
@@ -131,7 +161,9 @@ RingbufferReadOperation::RingbufferReadOperation(
     read_callback_fn fn)
     : nopObject_(nopObject), fn_(std::move(fn)), ptrProvided_(false) {}
 
-size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
+size_t RingbufferReadOperation::handleRead(
+    util::ringbuffer::Consumer& inbox,
+    DsaCopyEngine* copyEngine) {
   ssize_t ret;
   size_t bytesReadNow = 0;
 
@@ -152,21 +184,31 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
       } else if (ptrProvided_) {
         TP_DCHECK_EQ(length, len_);
       } else {
+        // Defer allocating the buffer, as we may not need it.
         len_ = length;
-        buf_ = std::make_unique<uint8_t[]>(len_);
-        ptr_ = buf_.get();
       }
     } else if (unlikely(ret != -ENODATA)) {
       TP_THROW_SYSTEM(-ret);
     }
   }
 
+  // Set if the payload was handed to the callback straight from the inbox.
+  bool calledInPlace = false;
+
   if (mode_ == READ_PAYLOAD) {
     if (nopObject_ != nullptr) {
       ret = readNopObject_(inbox);
+    } else if (!ptrProvided_ && bytesRead_ == 0 && buf_ == nullptr) {
+      ret = readInPlace_(inbox);
+      calledInPlace = (ret > 0 || len_ == 0) && buf_ == nullptr;
     } else {
+      // A payload that doesn't fit in the cache would only evict everything
+      // else from it, and won't be read back soon as a whole anyway.
       ret = inbox.readInTx</*allowPartial=*/true>(
-          reinterpret_cast<uint8_t*>(ptr_) + bytesRead_, len_ - bytesRead_);
+          reinterpret_cast<uint8_t*>(ptr_) + bytesRead_,
+          len_ - bytesRead_,
+          /*nonTemporal=*/len_ >= getLastLevelCacheSize(),
+          copyEngine);
     }
     if (likely(ret >= 0)) {
       bytesRead_ += ret;
@@ -179,13 +221,53 @@ size_t RingbufferReadOperation::handleRead(util::ringbuffer::Consumer& inbox) {
   ret = inbox.commitTx();
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-  if (completed()) {
+  if (completed() && !calledInPlace) {
     fn_(Error::kSuccess, ptr_, len_);
   }
 
   return bytesReadNow;
 }
 
+ssize_t RingbufferReadOperation::readInPlace_(
+    util::ringbuffer::Consumer& inbox) {
+  if (len_ > inbox.getSize()) {
+    // It will never be entirely in the inbox at once, hence we must fall back
+    // to reading it incrementally into a buffer of our own.
+    buf_ = std::make_unique<uint8_t[]>(len_);
+    ptr_ = buf_.get();
+    return inbox.readInTx</*allowPartial=*/true>(ptr_, len_);
+  }
+
+  ssize_t numBuffers;
+  std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      inbox.accessContiguousInTx</*allowPartial=*/false>(len_);
+  if (numBuffers == -ENODATA) {
+    // Wait for the rest of the payload to arrive.
+    return 0;
+  }
+  if (unlikely(numBuffers < 0)) {
+    return numBuffers;
+  }
+
+  if (numBuffers <= 1) {
+    // The whole payload is available and contiguous. Give the callback direct
+    // access to it, which is allowed as the pointer only needs to be valid for
+    // the duration of the callback. We must call it before the transaction
+    // ends, as the space may be reused by the producer right after that.
+    fn_(Error::kSuccess, buffers[0].ptr, len_);
+    return len_;
+  }
+
+  // The payload wraps around the end of the inbox, so it must be stitched back
+  // together in a buffer of our own.
+  buf_ = std::make_unique<uint8_t[]>(len_);
+  ptr_ = buf_.get();
+  std::memcpy(buf_.get(), buffers[0].ptr, buffers[0].len);
+  std::memcpy(buf_.get() + buffers[0].len, buffers[1].ptr, buffers[1].len);
+  return len_;
+}
+
 ssize_t RingbufferReadOperation::readNopObject_(
     util::ringbuffer::Consumer& inbox) {
   TP_THROW_ASSERT_IF(len_ > inbox.getSize());
@@ -223,19 +305,56 @@ RingbufferWriteOperation::RingbufferWriteOperation(
 RingbufferWriteOperation::RingbufferWriteOperation(
     const AbstractNopHolder* nopObject,
     write_callback_fn fn)
-    : nopObject_(nopObject), len_(nopObject_->getSize()), fn_(std::move(fn)) {}
+    : nopObject_(nopObject), lenKnown_(false), fn_(std::move(fn)) {}
 
 size_t RingbufferWriteOperation::handleWrite(
-    util::ringbuffer::Producer& outbox) {
-  ssize_t ret;
-  size_t bytesWrittenNow = 0;
-
+    util::ringbuffer::Producer& outbox,
+    size_t maxPayloadBytes) {
   // Start write transaction. This end of the connection is the only producer
   // for this ringbuffer, and all writes are done from the reactor thread, so
   // there cannot be another transaction already going on. Fail hard in case.
-  ret = outbox.startTx();
+  ssize_t ret = outbox.startTx();
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
+  size_t bytesWrittenNow = writeInTx_(outbox, maxPayloadBytes);
+
+  ret = outbox.commitTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+  if (completed()) {
+    fn_(Error::kSuccess);
+  }
+
+  return bytesWrittenNow;
+}
+
+size_t RingbufferWriteOperation::handleWriteInTx(
+    util::ringbuffer::Producer& outbox,
+    size_t maxPayloadBytes) {
+  size_t bytesWrittenNow = writeInTx_(outbox, maxPayloadBytes);
+
+  if (completed()) {
+    fn_(Error::kSuccess);
+  }
+
+  return bytesWrittenNow;
+}
+
+size_t RingbufferWriteOperation::writeInTx_(
+    util::ringbuffer::Producer& outbox,
+    size_t maxPayloadBytes) {
+  ssize_t ret;
+  size_t bytesWrittenNow = 0;
+
+  if (mode_ == WRITE_LENGTH && !lenKnown_) {
+    ret = writeNopObjectInOnePass_(outbox);
+    if (likely(ret >= 0)) {
+      bytesWrittenNow += ret;
+    } else if (unlikely(ret != -ENOSPC)) {
+      TP_THROW_SYSTEM(-ret);
+    }
+  }
+
   if (mode_ == WRITE_LENGTH) {
     uint32_t length = len_;
     ret = outbox.writeInTx</*allowPartial=*/false>(&length, sizeof(length));
@@ -247,13 +366,14 @@ size_t RingbufferWriteOperation::handleWrite(
     }
   }
 
-  if (mode_ == WRITE_PAYLOAD) {
+  // A nop object written in one pass is already complete.
+  if (mode_ == WRITE_PAYLOAD && !completed()) {
     if (nopObject_ != nullptr) {
       ret = writeNopObject_(outbox);
     } else {
       ret = outbox.writeInTx</*allowPartial=*/true>(
           reinterpret_cast<const uint8_t*>(ptr_) + bytesWritten_,
-          len_ - bytesWritten_);
+          std::min(len_ - bytesWritten_, maxPayloadBytes));
     }
     if (likely(ret >= 0)) {
       bytesWritten_ += ret;
@@ -263,14 +383,52 @@ size_t RingbufferWriteOperation::handleWrite(
     }
   }
 
-  ret = outbox.commitTx();
-  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  return bytesWrittenNow;
+}
 
-  if (completed()) {
-    fn_(Error::kSuccess);
+ssize_t RingbufferWriteOperation::writeNopObjectInOnePass_(
+    util::ringbuffer::Producer& outbox) {
+  // Reserve room for the length and for the estimated size of the object, then
+  // write the object, and only then its length, in the space left for it.
+  const size_t capacity =
+      sizeof(uint32_t) + estimateNopObjectSize(*nopObject_);
+  ssize_t numBuffers;
+  std::array<util::ringbuffer::Producer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      outbox.accessContiguousInTx</*allowPartial=*/false>(capacity);
+  if (numBuffers >= 0) {
+    NopWriter writer(
+        buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
+    uint32_t length = 0;
+    nop::Status<void> status = writer.Write(&length, &length + 1);
+    TP_DCHECK(!status.has_error());
+    status = nopObject_->write(writer);
+    const size_t numUnused = writer.getRemaining();
+    if (likely(status)) {
+      length = capacity - numUnused - sizeof(uint32_t);
+      NopWriter lengthWriter(
+          buffers[0].ptr, buffers[0].len, buffers[1].ptr, buffers[1].len);
+      status = lengthWriter.Write(&length, &length + 1);
+      TP_DCHECK(!status.has_error());
+      ssize_t ret = outbox.releaseInTx(numUnused);
+      TP_DCHECK_EQ(ret, 0);
+      len_ = length;
+      lenKnown_ = true;
+      mode_ = WRITE_PAYLOAD;
+      bytesWritten_ = len_;
+      return capacity - numUnused;
+    }
+    ssize_t ret = outbox.releaseInTx(capacity);
+    TP_DCHECK_EQ(ret, 0);
+    if (status.error() != nop::ErrorStatus::WriteLimitReached) {
+      return -EINVAL;
+    }
   }
-
-  return bytesWrittenNow;
+  // The estimate was either too small or too large to fit right now, hence
+  // wait for the exact size to be available, as for other buffers.
+  len_ = nopObject_->getSize();
+  lenKnown_ = true;
+  return -ENOSPC;
 }
 
 ssize_t RingbufferWriteOperation::writeNopObject_(
@@ -9,10 +9,14 @@
 #include <tensorpipe/common/socket.h>
 
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
+#include <limits>
 
 #include <tensorpipe/common/defs.h>
 
@@ -22,6 +26,159 @@
 
 namespace tensorpipe {
 
+Error setSocketBusyPoll(
+    int socketFd,
+    std::chrono::microseconds duration,
+    bool prefer) {
+#ifdef SO_BUSY_POLL
+  int usecs = static_cast<int>(duration.count());
+  auto rv =
+      ::setsockopt(socketFd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+#ifdef SO_PREFER_BUSY_POLL
+  int preferInt = prefer && usecs > 0 ? 1 : 0;
+  rv = ::setsockopt(
+      socketFd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &preferInt, sizeof(preferInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+#endif // SO_PREFER_BUSY_POLL
+  return Error::kSuccess;
+#else
+  return TP_CREATE_ERROR(SystemError, "setsockopt", ENOPROTOOPT);
+#endif // SO_BUSY_POLL
+}
+
+Error setSocketQuickAck(int socketFd, bool on) {
+  int onInt = on ? 1 : 0;
+  auto rv =
+      ::setsockopt(socketFd, IPPROTO_TCP, TCP_QUICKACK, &onInt, sizeof(onInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  return Error::kSuccess;
+}
+
+Error receiveTcpZeroCopy(
+    int socketFd,
+    void* addr,
+    size_t length,
+    size_t& mappedLength,
+    size_t& skipLength) {
+  // The value and the first fields of struct tcp_zerocopy_receive, in case
+  // <linux/tcp.h> is older (the kernel accepts this prefix of the struct).
+  constexpr int kTcpZeroCopyReceive = 35;
+  struct {
+    uint64_t address;
+    uint32_t length;
+    uint32_t recvSkipHint;
+  } zc{};
+  zc.address = reinterpret_cast<uint64_t>(addr);
+  zc.length = static_cast<uint32_t>(
+      std::min<size_t>(length, std::numeric_limits<uint32_t>::max()));
+  socklen_t zcLen = sizeof(zc);
+  auto rv =
+      ::getsockopt(socketFd, IPPROTO_TCP, kTcpZeroCopyReceive, &zc, &zcLen);
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "getsockopt", errno);
+  }
+  mappedLength = zc.length;
+  skipLength = zc.recvSkipHint;
+  return Error::kSuccess;
+}
+
+Error getSocketRoundTripTimes(
+    int socketFd,
+    uint32_t& rttUs,
+    uint32_t& rcvRttUs) {
+  struct tcp_info info;
+  socklen_t infoLen = sizeof(info);
+  std::memset(&info, 0, sizeof(info));
+  auto rv = ::getsockopt(socketFd, IPPROTO_TCP, TCP_INFO, &info, &infoLen);
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "getsockopt", errno);
+  }
+  rttUs = info.tcpi_rtt;
+  rcvRttUs = info.tcpi_rcv_rtt;
+  return Error::kSuccess;
+}
+
+Error getSocketBufferSizes(int socketFd, size_t& sendSize, size_t& recvSize) {
+  int sendInt;
+  socklen_t sendLen = sizeof(sendInt);
+  auto rv = ::getsockopt(socketFd, SOL_SOCKET, SO_SNDBUF, &sendInt, &sendLen);
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "getsockopt", errno);
+  }
+  int recvInt;
+  socklen_t recvLen = sizeof(recvInt);
+  rv = ::getsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &recvInt, &recvLen);
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "getsockopt", errno);
+  }
+  sendSize = sendInt;
+  recvSize = recvInt;
+  return Error::kSuccess;
+}
+
+Error setSocketBufferSizes(int socketFd, size_t sendSize, size_t recvSize) {
+  int sendInt = static_cast<int>(
+      std::min<size_t>(sendSize, std::numeric_limits<int>::max()));
+  auto rv =
+      ::setsockopt(socketFd, SOL_SOCKET, SO_SNDBUF, &sendInt, sizeof(sendInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  int recvInt = static_cast<int>(
+      std::min<size_t>(recvSize, std::numeric_limits<int>::max()));
+  rv = ::setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &recvInt, sizeof(recvInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  return Error::kSuccess;
+}
+
+Error setSocketNotSentLowat(int socketFd, size_t bytes) {
+  int bytesInt = static_cast<int>(
+      std::min<size_t>(bytes, std::numeric_limits<int>::max()));
+  auto rv = ::setsockopt(
+      socketFd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytesInt, sizeof(bytesInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  return Error::kSuccess;
+}
+
+Error setSocketKernelTls(
+    int socketFd,
+    const std::string& txCryptoInfo,
+    const std::string& rxCryptoInfo) {
+#if defined(TCP_ULP) && defined(SOL_TLS)
+  // These are the values of TLS_TX and TLS_RX, in case <linux/tls.h> is older.
+  constexpr int kTlsTx = 1;
+  constexpr int kTlsRx = 2;
+  auto rv = ::setsockopt(socketFd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  rv = ::setsockopt(
+      socketFd, SOL_TLS, kTlsTx, txCryptoInfo.data(), txCryptoInfo.size());
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  rv = ::setsockopt(
+      socketFd, SOL_TLS, kTlsRx, rxCryptoInfo.data(), rxCryptoInfo.size());
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  return Error::kSuccess;
+#else
+  return TP_CREATE_ERROR(SystemError, "setsockopt", ENOPROTOOPT);
+#endif // TCP_ULP && SOL_TLS
+}
+
 std::tuple<Error, Socket> Socket::createForFamily(sa_family_t ai_family) {
   auto rv = socket(ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
   if (rv == -1) {
@@ -69,6 +226,15 @@ Error Socket::reuseAddr(bool on) {
   return Error::kSuccess;
 }
 
+Error Socket::reusePort(bool on) {
+  int onInt = on ? 1 : 0;
+  auto rv = setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &onInt, sizeof(onInt));
+  if (rv == -1) {
+    return TP_CREATE_ERROR(SystemError, "setsockopt", errno);
+  }
+  return Error::kSuccess;
+}
+
 Error Socket::bind(const Sockaddr& addr) {
   auto rv = ::bind(fd_, addr.addr(), addr.addrlen());
   if (rv == -1) {
@@ -13,6 +13,7 @@
 #include <chrono>
 #include <cstring>
 #include <memory>
+#include <string>
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
@@ -176,6 +177,74 @@ template <typename... Fds>
   return recvFromSocket(socketFd, dummy, dummy, fds...);
 }
 
+// Have reads on the socket that find no data busy-poll the receive queue of the
+// device for up to the given time (SO_BUSY_POLL), instead of waiting for an
+// interrupt, and, if prefer is set and the kernel supports it, keep the
+// device's interrupts masked while the application does so regularly
+// (SO_PREFER_BUSY_POLL). A zero time disables both. Raising the time above the
+// system default (net.core.busy_read) needs CAP_NET_ADMIN.
+[[nodiscard]] Error setSocketBusyPoll(
+    int socketFd,
+    std::chrono::microseconds duration,
+    bool prefer);
+
+// Have the kernel acknowledge incoming data right away, rather than delaying
+// the acknowledgement in the hope of piggybacking it (TCP_QUICKACK). The kernel
+// may revert to delayed acknowledgements on its own, hence this must be set
+// again after each read to be fully effective.
+[[nodiscard]] Error setSocketQuickAck(int socketFd, bool on);
+
+// Have the kernel map the data received on a TCP socket, in whole pages, at the
+// given address (TCP_ZEROCOPY_RECEIVE), which must be page-aligned and within a
+// read-only shared mapping of the socket, rather than copy it. The data that it
+// maps is consumed, and its length is returned in mappedLength. The next
+// skipLength bytes must then be copied (e.g., because they don't fill a page,
+// or aren't aligned) before it can map more.
+[[nodiscard]] Error receiveTcpZeroCopy(
+    int socketFd,
+    void* addr,
+    size_t length,
+    size_t& mappedLength,
+    size_t& skipLength);
+
+// Hand the encryption of a TCP socket over to the kernel (kTLS), once a TLS
+// handshake done in userspace has agreed on the keys. Each crypto info holds
+// the raw bytes of one of the tls12_crypto_info_* structs of <linux/tls.h>
+// (with the key, IV, salt and record sequence number), one for each direction.
+// Afterwards, plain data written to and read from the socket travels in TLS
+// records that the kernel, or a NIC with TLS offload, encrypts and decrypts.
+[[nodiscard]] Error setSocketKernelTls(
+    int socketFd,
+    const std::string& txCryptoInfo,
+    const std::string& rxCryptoInfo);
+
+// Get the round-trip time of a TCP socket, as smoothed by the sender, and the
+// one estimated by the receiver (TCP_INFO), in microseconds. Either is zero
+// until the kernel has a sample for it.
+[[nodiscard]] Error getSocketRoundTripTimes(
+    int socketFd,
+    uint32_t& rttUs,
+    uint32_t& rcvRttUs);
+
+// Get, or set, the sizes of the send and receive buffers of a socket (SO_SNDBUF
+// and SO_RCVBUF). The kernel doubles the sizes it's given, to account for its
+// bookkeeping, and reports the doubled ones. It caps them at net.core.wmem_max
+// and net.core.rmem_max, and stops autotuning them once they're set.
+[[nodiscard]] Error getSocketBufferSizes(
+    int socketFd,
+    size_t& sendSize,
+    size_t& recvSize);
+
+[[nodiscard]] Error setSocketBufferSizes(
+    int socketFd,
+    size_t sendSize,
+    size_t recvSize);
+
+// Limit how many bytes the send buffer of a TCP socket may hold that weren't
+// sent yet (TCP_NOTSENT_LOWAT), past which the socket doesn't report being
+// writable. The rest of the buffer is then left for the data in flight.
+[[nodiscard]] Error setSocketNotSentLowat(int socketFd, size_t bytes);
+
 class Sockaddr {
  public:
   virtual const struct sockaddr* addr() const = 0;
@@ -200,6 +269,11 @@ class Socket final : public Fd {
   // Set (or unset) the SO_REUSEADDR option on the socket.
   [[nodiscard]] Error reuseAddr(bool on);
 
+  // Set (or unset) the SO_REUSEPORT option on the socket, which allows several
+  // sockets to bind to the same address and have the kernel balance the
+  // incoming connections among them.
+  [[nodiscard]] Error reusePort(bool on);
+
   // Bind socket to address.
   [[nodiscard]] Error bind(const Sockaddr& addr);
 
@@ -212,6 +286,18 @@ class Socket final : public Fd {
   // Connect to address.
   [[nodiscard]] Error connect(const Sockaddr& addr);
 
+  // Configure busy polling of the receive queue on reads.
+  [[nodiscard]] Error busyPoll(
+      std::chrono::microseconds duration,
+      bool prefer) {
+    return setSocketBusyPoll(fd_, duration, prefer);
+  }
+
+  // Configure immediate acknowledgements.
+  [[nodiscard]] Error quickAck(bool on) {
+    return setSocketQuickAck(fd_, on);
+  }
+
   // Send file descriptor.
   template <typename... Fds>
   [[nodiscard]] Error sendFds(const Fds&... fds) {
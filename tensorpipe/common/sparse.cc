@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/sparse.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif // __x86_64__
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+namespace {
+
+constexpr size_t kWordSize = sizeof(uint32_t);
+constexpr size_t kWordsPerBlock = kSparseBlockSize / kWordSize;
+constexpr size_t kPairSize = 2 * kWordSize;
+
+static_assert(
+    kWordsPerBlock <= std::numeric_limits<uint32_t>::digits,
+    "The words of a block must fit in a mask");
+
+uint32_t loadWord(const uint8_t* ptr) {
+  uint32_t word;
+  std::memcpy(&word, ptr, kWordSize);
+  return word;
+}
+
+size_t numBlocksOf(size_t length) {
+  return (length + kSparseBlockSize - 1) / kSparseBlockSize;
+}
+
+size_t bitmapLengthOf(size_t length) {
+  return (numBlocksOf(length) + 7) / 8;
+}
+
+bool isBitSet(const uint8_t* bitmap, size_t idx) {
+  return (bitmap[idx / 8] >> (idx % 8)) & 1;
+}
+
+void setBit(uint8_t* bitmap, size_t idx) {
+  bitmap[idx / 8] |= 1 << (idx % 8);
+}
+
+// Return a mask with the bits of the words of the block that aren't zero set.
+uint32_t nonZeroWords(const uint8_t* block) {
+  // Most blocks are expected to be all zeros, which this checks quickly.
+  uint64_t acc = 0;
+  for (size_t offset = 0; offset < kSparseBlockSize; offset += sizeof(acc)) {
+    uint64_t value;
+    std::memcpy(&value, block + offset, sizeof(value));
+    acc |= value;
+  }
+  if (acc == 0) {
+    return 0;
+  }
+  uint32_t mask = 0;
+  for (size_t idx = 0; idx < kWordsPerBlock; idx++) {
+    if (loadWord(block + idx * kWordSize) != 0) {
+      mask |= 1u << idx;
+    }
+  }
+  return mask;
+}
+
+// The same for the last block, if it's shorter. Its trailing bytes, which
+// don't make up a whole word, are accounted for by the highest bit.
+uint32_t nonZeroWordsOfTail(const uint8_t* block, size_t length) {
+  uint32_t mask = 0;
+  size_t idx = 0;
+  for (; (idx + 1) * kWordSize <= length; idx++) {
+    if (loadWord(block + idx * kWordSize) != 0) {
+      mask |= 1u << idx;
+    }
+  }
+  for (size_t offset = idx * kWordSize; offset < length; offset++) {
+    if (block[offset] != 0) {
+      mask |= 1u << idx;
+      break;
+    }
+  }
+  return mask;
+}
+
+// Scan the given whole blocks, returning how many of them aren't all zeros and
+// adding to the count of the words that aren't zero. If a (zeroed) bitmap is
+// given, set in it the bits of the blocks that aren't all zeros.
+
+size_t scanBlocksScalar(
+    const uint8_t* src,
+    size_t numBlocks,
+    uint8_t* bitmap,
+    size_t& numNonZeroWords) {
+  size_t numNonZeroBlocks = 0;
+  for (size_t idx = 0; idx < numBlocks; idx++) {
+    const uint32_t mask = nonZeroWords(src + idx * kSparseBlockSize);
+    if (mask != 0) {
+      numNonZeroBlocks++;
+      numNonZeroWords += __builtin_popcount(mask);
+      if (bitmap != nullptr) {
+        setBit(bitmap, idx);
+      }
+    }
+  }
+  return numNonZeroBlocks;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) size_t scanBlocksAvx2(
+    const uint8_t* src,
+    size_t numBlocks,
+    uint8_t* bitmap,
+    size_t& numNonZeroWords) {
+  static_assert(kSparseBlockSize == 64, "The kernel handles two vectors");
+  const __m256i zero = _mm256_setzero_si256();
+  size_t numNonZeroBlocks = 0;
+  for (size_t idx = 0; idx < numBlocks; idx++) {
+    const uint8_t* block = src + idx * kSparseBlockSize;
+    const __m256i low =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i high =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+    if (_mm256_testz_si256(
+            _mm256_or_si256(low, high), _mm256_or_si256(low, high))) {
+      continue;
+    }
+    // One bit per word that is zero.
+    const uint32_t zeroMask =
+        _mm256_movemask_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(low, zero))) |
+        (_mm256_movemask_ps(
+             _mm256_castsi256_ps(_mm256_cmpeq_epi32(high, zero)))
+         << 8);
+    numNonZeroBlocks++;
+    numNonZeroWords += kWordsPerBlock - __builtin_popcount(zeroMask);
+    if (bitmap != nullptr) {
+      setBit(bitmap, idx);
+    }
+  }
+  return numNonZeroBlocks;
+}
+
+bool hasAvx2() {
+  static const bool result = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }();
+  return result;
+}
+
+#endif // __x86_64__
+
+size_t scanBlocks(
+    const uint8_t* src,
+    size_t numBlocks,
+    uint8_t* bitmap,
+    size_t& numNonZeroWords) {
+#if defined(__x86_64__)
+  if (hasAvx2()) {
+    return scanBlocksAvx2(src, numBlocks, bitmap, numNonZeroWords);
+  }
+#endif // __x86_64__
+  return scanBlocksScalar(src, numBlocks, bitmap, numNonZeroWords);
+}
+
+bool canUsePairs(size_t length) {
+  return length % kWordSize == 0 &&
+      length / kWordSize <=
+      static_cast<size_t>(std::numeric_limits<uint32_t>::max()) + 1;
+}
+
+uint8_t* writePairs(
+    const uint8_t* words,
+    uint32_t mask,
+    size_t firstIdx,
+    uint8_t* dst) {
+  while (mask != 0) {
+    const size_t bit = __builtin_ctz(mask);
+    mask &= mask - 1;
+    const uint32_t idx = static_cast<uint32_t>(firstIdx + bit);
+    std::memcpy(dst, &idx, kWordSize);
+    std::memcpy(dst + kWordSize, words + bit * kWordSize, kWordSize);
+    dst += kPairSize;
+  }
+  return dst;
+}
+
+} // namespace
+
+SparseEncoding chooseSparseEncoding(const void* src, size_t length) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(src);
+  const size_t numWholeBlocks = length / kSparseBlockSize;
+  const size_t tailLength = length % kSparseBlockSize;
+
+  size_t numNonZeroWords = 0;
+  size_t blocksLength = bitmapLengthOf(length) +
+      scanBlocks(bytes, numWholeBlocks, nullptr, numNonZeroWords) *
+          kSparseBlockSize;
+  if (tailLength > 0) {
+    const uint32_t mask = nonZeroWordsOfTail(
+        bytes + numWholeBlocks * kSparseBlockSize, tailLength);
+    if (mask != 0) {
+      blocksLength += tailLength;
+      numNonZeroWords += __builtin_popcount(mask);
+    }
+  }
+
+  SparseEncoding best{SparseFormat::kDense, length};
+  if (blocksLength < best.length) {
+    best = SparseEncoding{SparseFormat::kBlocks, blocksLength};
+  }
+  if (canUsePairs(length) && numNonZeroWords * kPairSize < best.length) {
+    best = SparseEncoding{SparseFormat::kPairs, numNonZeroWords * kPairSize};
+  }
+  return best;
+}
+
+void sparseEncode(
+    SparseFormat format,
+    const void* src,
+    size_t length,
+    void* dst) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+  const size_t numWholeBlocks = length / kSparseBlockSize;
+  const size_t tailLength = length % kSparseBlockSize;
+  const uint8_t* tail = in + numWholeBlocks * kSparseBlockSize;
+
+  switch (format) {
+    case SparseFormat::kDense: {
+      std::memcpy(out, in, length);
+      return;
+    }
+    case SparseFormat::kBlocks: {
+      uint8_t* bitmap = out;
+      const size_t bitmapLength = bitmapLengthOf(length);
+      std::memset(bitmap, 0, bitmapLength);
+      size_t numNonZeroWords = 0;
+      scanBlocks(in, numWholeBlocks, bitmap, numNonZeroWords);
+      if (tailLength > 0 && nonZeroWordsOfTail(tail, tailLength) != 0) {
+        setBit(bitmap, numWholeBlocks);
+      }
+      out += bitmapLength;
+      const size_t numBlocks = numBlocksOf(length);
+      for (size_t idx = 0; idx < numBlocks; idx++) {
+        if (isBitSet(bitmap, idx)) {
+          const size_t offset = idx * kSparseBlockSize;
+          const size_t blockLength =
+              std::min(kSparseBlockSize, length - offset);
+          std::memcpy(out, in + offset, blockLength);
+          out += blockLength;
+        }
+      }
+      return;
+    }
+    case SparseFormat::kPairs: {
+      TP_DCHECK(canUsePairs(length));
+      for (size_t idx = 0; idx < numWholeBlocks; idx++) {
+        const uint8_t* block = in + idx * kSparseBlockSize;
+        out = writePairs(
+            block, nonZeroWords(block), idx * kWordsPerBlock, out);
+      }
+      if (tailLength > 0) {
+        writePairs(
+            tail,
+            nonZeroWordsOfTail(tail, tailLength),
+            numWholeBlocks * kWordsPerBlock,
+            out);
+      }
+      return;
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown sparse format";
+}
+
+bool sparseDecode(
+    SparseFormat format,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t length) {
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+  uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+
+  switch (format) {
+    case SparseFormat::kDense: {
+      if (srcLength != length) {
+        return false;
+      }
+      std::memcpy(out, in, length);
+      return true;
+    }
+    case SparseFormat::kBlocks: {
+      const uint8_t* bitmap = in;
+      const size_t bitmapLength = bitmapLengthOf(length);
+      const size_t numBlocks = numBlocksOf(length);
+      if (srcLength < bitmapLength) {
+        return false;
+      }
+      // Check the length before writing anything.
+      size_t expectedLength = bitmapLength;
+      for (size_t idx = 0; idx < numBlocks; idx++) {
+        if (isBitSet(bitmap, idx)) {
+          expectedLength +=
+              std::min(kSparseBlockSize, length - idx * kSparseBlockSize);
+        }
+      }
+      if (srcLength != expectedLength) {
+        return false;
+      }
+      in += bitmapLength;
+      for (size_t idx = 0; idx < numBlocks; idx++) {
+        const size_t offset = idx * kSparseBlockSize;
+        const size_t blockLength = std::min(kSparseBlockSize, length - offset);
+        if (isBitSet(bitmap, idx)) {
+          std::memcpy(out + offset, in, blockLength);
+          in += blockLength;
+        } else {
+          std::memset(out + offset, 0, blockLength);
+        }
+      }
+      return true;
+    }
+    case SparseFormat::kPairs: {
+      if (!canUsePairs(length) || srcLength % kPairSize != 0) {
+        return false;
+      }
+      const size_t numWords = length / kWordSize;
+      std::memset(out, 0, length);
+      for (size_t offset = 0; offset < srcLength; offset += kPairSize) {
+        const uint32_t idx = loadWord(in + offset);
+        if (idx >= numWords) {
+          return false;
+        }
+        std::memcpy(out + idx * kWordSize, in + offset + kWordSize, kWordSize);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+
+// Lossless encodings of buffers that are mostly zeros (e.g., the gradients of
+// embeddings, in which only a few rows are non-zero).
+enum class SparseFormat : uint8_t {
+  // The buffer as it is.
+  kDense,
+  // A bitmap with one bit per block of kSparseBlockSize bytes (the last one
+  // possibly shorter), set for those that aren't all zeros, followed by the
+  // contents of these blocks only. This suits zeros that come in long runs.
+  kBlocks,
+  // For buffers made of 4-byte words, the uint32 index and the value of each
+  // word that isn't zero. This suits zeros that are scattered.
+  kPairs,
+};
+
+constexpr size_t kSparseBlockSize = 64;
+
+struct SparseEncoding {
+  SparseFormat format;
+  size_t length;
+};
+
+// Scan the buffer to find its shortest encoding, and the length of that.
+SparseEncoding chooseSparseEncoding(const void* src, size_t length);
+
+// Encode the buffer in the given format, into an area of the length that was
+// computed for it by chooseSparseEncoding.
+void sparseEncode(
+    SparseFormat format,
+    const void* src,
+    size_t length,
+    void* dst);
+
+// Decode into a buffer of the given length, which may hold anything before.
+// Return false if the encoded data is malformed.
+bool sparseDecode(
+    SparseFormat format,
+    const void* src,
+    size_t srcLength,
+    void* dst,
+    size_t length);
+
+} // namespace tensorpipe
@@ -16,6 +16,7 @@
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/optional.h>
 
 namespace tensorpipe {
@@ -36,12 +37,17 @@ class StreamReadOperation {
 
  public:
   using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t len)>;
+      Function<void(const Error& error, const void* ptr, size_t len)>;
+  using allocator_fn = Function<std::shared_ptr<char>(size_t len)>;
 
   explicit inline StreamReadOperation(read_callback_fn fn);
 
   inline StreamReadOperation(void* ptr, size_t length, read_callback_fn fn);
 
+  // Have the buffer for the payload, if none was given, come from the given
+  // function (which may return null to decline), rather than from the heap.
+  inline void setAllocatorFromLoop(allocator_fn allocator);
+
   // Called when a buffer is needed to read data from stream.
   inline void allocFromLoop(char** buf, size_t* len);
 
@@ -69,7 +75,8 @@ class StreamReadOperation {
   size_t bytesRead_{0};
 
   // Holds temporary allocation if no length was specified.
-  std::unique_ptr<char[]> buffer_{nullptr};
+  std::shared_ptr<char> buffer_{nullptr};
+  allocator_fn allocator_;
 
   // User callback.
   read_callback_fn fn_;
@@ -84,6 +91,10 @@ StreamReadOperation::StreamReadOperation(
     read_callback_fn fn)
     : ptr_(static_cast<char*>(ptr)), givenLength_(length), fn_(std::move(fn)) {}
 
+void StreamReadOperation::setAllocatorFromLoop(allocator_fn allocator) {
+  allocator_ = std::move(allocator);
+}
+
 void StreamReadOperation::allocFromLoop(char** base, size_t* len) {
   if (mode_ == READ_LENGTH) {
     TP_DCHECK_LT(bytesRead_, sizeof(readLength_));
@@ -109,7 +120,13 @@ void StreamReadOperation::readFromLoop(size_t nread) {
         TP_DCHECK_EQ(readLength_, givenLength_.value());
       } else {
         TP_DCHECK(ptr_ == nullptr);
-        buffer_ = std::make_unique<char[]>(readLength_);
+        if (allocator_) {
+          buffer_ = allocator_(readLength_);
+        }
+        if (buffer_ == nullptr) {
+          buffer_ = std::shared_ptr<char>(
+              new char[readLength_], std::default_delete<char[]>());
+        }
         ptr_ = buffer_.get();
       }
       if (readLength_ == 0) {
@@ -145,7 +162,7 @@ void StreamReadOperation::callbackFromLoop(const Error& error) {
 // must remain valid until the write callback has been called.
 class StreamWriteOperation {
  public:
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = Function<void(const Error& error)>;
 
   inline StreamWriteOperation(
       const void* ptr,
@@ -9,17 +9,30 @@
 #include <tensorpipe/common/system.h>
 
 #ifdef __linux__
+#include <linux/mempolicy.h>
 #include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
 #ifdef __APPLE__
 #include <IOKit/IOKitLib.h>
 #endif
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <array>
+#include <atomic>
 #include <cstring>
+#include <exception>
 #include <fstream>
 #include <iomanip>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <system_error>
@@ -103,4 +116,318 @@ void setThreadName(std::string name) {
 #endif
 }
 
+void setThreadAffinity(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t cpuSet;
+  CPU_ZERO(&cpuSet);
+  for (int cpu : cpus) {
+    TP_THROW_ASSERT_IF(cpu < 0 || cpu >= CPU_SETSIZE) << "Invalid CPU " << cpu;
+    CPU_SET(cpu, &cpuSet);
+  }
+  int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+  TP_THROW_SYSTEM_IF(rv != 0, rv);
+#endif
+}
+
+bool applyThreadSettings(const ThreadSettings& settings) {
+#ifdef __linux__
+  bool success = true;
+  if (!settings.cpus.empty()) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : settings.cpus) {
+      TP_THROW_ASSERT_IF(cpu < 0 || cpu >= CPU_SETSIZE)
+          << "Invalid CPU " << cpu;
+      CPU_SET(cpu, &cpuSet);
+    }
+    int rv = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+    if (rv != 0) {
+      TP_LOG_WARNING() << "Couldn't set the affinity of the thread: "
+                       << std::strerror(rv);
+      success = false;
+    }
+  }
+  if (settings.niceValue.has_value()) {
+    // On Linux the nice value is per-thread, and applies to the given tid.
+    const pid_t tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    if (::setpriority(PRIO_PROCESS, tid, settings.niceValue.value()) != 0) {
+      TP_LOG_WARNING() << "Couldn't set the nice value of the thread: "
+                       << std::strerror(errno);
+      success = false;
+    }
+  }
+  if (settings.fifoPriority.has_value()) {
+    struct sched_param param;
+    param.sched_priority = settings.fifoPriority.value();
+    int rv = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (rv != 0) {
+      TP_LOG_WARNING() << "Couldn't run the thread under SCHED_FIFO: "
+                       << std::strerror(rv);
+      success = false;
+    }
+  }
+  return success;
+#else
+  return false;
+#endif
+}
+
+namespace {
+
+std::mutex threadStartHookMutex;
+std::shared_ptr<ThreadStartHook> threadStartHook;
+
+} // namespace
+
+void setThreadStartHook(ThreadStartHook hook) {
+  std::lock_guard<std::mutex> lock(threadStartHookMutex);
+  threadStartHook =
+      hook ? std::make_shared<ThreadStartHook>(std::move(hook)) : nullptr;
+}
+
+void initCurrentThread(std::string name) {
+  setThreadName(name);
+  std::shared_ptr<ThreadStartHook> hook;
+  {
+    std::lock_guard<std::mutex> lock(threadStartHookMutex);
+    hook = threadStartHook;
+  }
+  if (hook != nullptr) {
+    (*hook)(name);
+  }
+}
+
+optional<int> getNumaNodeOfCurrentCpu() {
+#ifdef __linux__
+  unsigned int cpu;
+  unsigned int node;
+  if (::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+    return static_cast<int>(node);
+  }
+#endif
+  return nullopt;
+}
+
+namespace {
+
+// Parse a list of CPUs as found in sysfs, made of comma-separated ranges (e.g.,
+// "0-11,24-35"), from the given file.
+std::vector<int> readCpuList(const std::string& path) {
+  std::vector<int> cpus;
+  std::ifstream f{path};
+  if (!f.is_open()) {
+    return cpus;
+  }
+  std::string range;
+  while (std::getline(f, range, ',')) {
+    range = removeBlankSpaces(std::move(range));
+    if (range.empty()) {
+      continue;
+    }
+    const size_t dash = range.find('-');
+    const int first = std::stoi(range.substr(0, dash));
+    const int last =
+        dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+} // namespace
+
+std::vector<int> getCpusOfNumaNode(int node) {
+#ifdef __linux__
+  return readCpuList(
+      "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+#else
+  return {};
+#endif
+}
+
+std::vector<int> getCpusOfNetworkInterface(const std::string& iface) {
+#ifdef __linux__
+  return readCpuList("/sys/class/net/" + iface + "/device/local_cpulist");
+#else
+  return {};
+#endif
+}
+
+#ifdef __linux__
+namespace {
+
+// Return the path of the cgroup of this process within the given hierarchy, as
+// listed in /proc/self/cgroup, whose lines are "id:controllers:path" (with an
+// id of 0 and no controllers for cgroup v2).
+optional<std::string> getCgroupPath(const std::string& controller) {
+  std::ifstream f{"/proc/self/cgroup"};
+  if (!f.is_open()) {
+    return nullopt;
+  }
+  std::string line;
+  while (std::getline(f, line)) {
+    const size_t first = line.find(':');
+    const size_t second = line.find(':', first + 1);
+    if (first == std::string::npos || second == std::string::npos) {
+      continue;
+    }
+    std::stringstream controllers(line.substr(first + 1, second - first - 1));
+    std::string name;
+    bool found = controller.empty() && controllers.str().empty();
+    while (!found && std::getline(controllers, name, ',')) {
+      found = name == controller;
+    }
+    if (found) {
+      return line.substr(second + 1);
+    }
+  }
+  return nullopt;
+}
+
+// Look for the file in the cgroup of this process, and then at the root of the
+// mount, as a container usually only sees its own cgroup, mounted as the root.
+std::ifstream openCgroupFile(
+    const std::string& mount,
+    const optional<std::string>& path,
+    const std::string& name) {
+  std::ifstream f;
+  if (path.has_value()) {
+    f.open(mount + path.value() + "/" + name);
+  }
+  if (!f.is_open()) {
+    f.open(mount + "/" + name);
+  }
+  return f;
+}
+
+} // namespace
+#endif
+
+optional<double> getCgroupCpuQuota() {
+#ifdef __linux__
+  // cgroup v2, where cpu.max holds the quota (or "max") and the period.
+  {
+    std::ifstream f =
+        openCgroupFile("/sys/fs/cgroup", getCgroupPath(""), "cpu.max");
+    std::string quota;
+    int64_t period;
+    if (f >> quota >> period) {
+      if (quota == "max" || period <= 0) {
+        return nullopt;
+      }
+      return std::stod(quota) / period;
+    }
+  }
+  // cgroup v1, where the quota is -1 if there's none.
+  const optional<std::string> path = getCgroupPath("cpu");
+  const std::array<std::string, 2> mounts = {
+      "/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"};
+  for (const std::string& mount : mounts) {
+    std::ifstream quotaFile = openCgroupFile(mount, path, "cpu.cfs_quota_us");
+    std::ifstream periodFile =
+        openCgroupFile(mount, path, "cpu.cfs_period_us");
+    int64_t quota;
+    int64_t period;
+    if (quotaFile >> quota && periodFile >> period) {
+      if (quota <= 0 || period <= 0) {
+        return nullopt;
+      }
+      return static_cast<double>(quota) / period;
+    }
+  }
+#endif
+  return nullopt;
+}
+
+bool bindMemoryToNumaNode(void* ptr, size_t length, int node) {
+#ifdef __linux__
+  constexpr size_t kBitsPerWord = 8 * sizeof(unsigned long);
+  if (node < 0) {
+    return false;
+  }
+  std::vector<unsigned long> nodeMask(node / kBitsPerWord + 1, 0);
+  nodeMask[node / kBitsPerWord] = 1UL << (node % kBitsPerWord);
+  // The kernel expects the number of bits of the mask plus one.
+  const unsigned long maxNode = nodeMask.size() * kBitsPerWord + 1;
+  const long rv = ::syscall(
+      SYS_mbind,
+      ptr,
+      length,
+      MPOL_BIND,
+      nodeMask.data(),
+      maxNode,
+      MPOL_MF_MOVE);
+  return rv == 0;
+#else
+  return false;
+#endif
+}
+
+std::shared_ptr<void> mapFileRange(
+    int fd,
+    uint64_t offset,
+    size_t length,
+    bool shared) {
+  if (shared) {
+    struct stat st;
+    TP_THROW_SYSTEM_IF(::fstat(fd, &st) < 0, errno);
+    if (static_cast<uint64_t>(st.st_size) < offset + length) {
+      TP_THROW_SYSTEM_IF(
+          ::ftruncate(fd, static_cast<off_t>(offset + length)) < 0, errno);
+    }
+  }
+  const uint64_t pageSize = ::sysconf(_SC_PAGESIZE);
+  const uint64_t alignedOffset = offset - offset % pageSize;
+  const size_t mappedLength = length + (offset - alignedOffset);
+  void* ptr = ::mmap(
+      nullptr,
+      mappedLength,
+      PROT_READ | PROT_WRITE,
+      shared ? MAP_SHARED : MAP_PRIVATE,
+      fd,
+      static_cast<off_t>(alignedOffset));
+  TP_THROW_SYSTEM_IF(ptr == MAP_FAILED, errno);
+  return std::shared_ptr<void>(
+      static_cast<uint8_t*>(ptr) + (offset - alignedOffset),
+      [ptr, mappedLength](void* /* unused */) {
+        ::munmap(ptr, mappedLength);
+      });
+}
+
+void runInParallel(std::vector<std::function<void()>> fns, size_t numThreads) {
+  std::atomic<size_t> nextFnIdx{0};
+  std::mutex exceptionMutex;
+  std::exception_ptr exception;
+  auto runFns = [&]() {
+    while (true) {
+      const size_t fnIdx = nextFnIdx++;
+      if (fnIdx >= fns.size()) {
+        return;
+      }
+      try {
+        fns[fnIdx]();
+      } catch (...) {
+        std::unique_lock<std::mutex> lock(exceptionMutex);
+        if (!exception) {
+          exception = std::current_exception();
+        }
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t threadIdx = 1; threadIdx < std::min(numThreads, fns.size());
+       threadIdx++) {
+    threads.emplace_back(runFns);
+  }
+  runFns();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
 } // namespace tensorpipe
@@ -11,9 +11,12 @@
 #include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <memory>
 #include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/optional.h>
@@ -90,4 +93,87 @@ optional<std::string> getBootID();
 // Set the name of the current thread, if possible. Use only for debugging.
 void setThreadName(std::string name);
 
+// Restrict the current thread to run only on the given CPUs, if possible.
+void setThreadAffinity(const std::vector<int>& cpus);
+
+// How to schedule a thread, with each field left empty meaning "as inherited".
+struct ThreadSettings {
+  // The CPUs the thread may run on.
+  std::vector<int> cpus;
+  // The nice value of the thread (from -20 to 19, lower is more favorable).
+  optional<int> niceValue;
+  // The priority with which to run the thread under SCHED_FIFO (from 1 to 99),
+  // which usually requires CAP_SYS_NICE or a suitable RLIMIT_RTPRIO.
+  optional<int> fifoPriority;
+};
+
+// Apply the given settings to the current thread. Return whether all of them
+// succeeded, logging a warning for those that failed (e.g., for lack of
+// privileges), as a thread can still do its job with the default ones.
+bool applyThreadSettings(const ThreadSettings& settings);
+
+// A function called on each thread that TensorPipe starts internally (event
+// loops, reactors, epoll loops, copy threads, ...) before it does any work,
+// with the name of that thread, whose prefix tells its role (e.g., TP_UV_loop,
+// TP_SHM_reactor, TP_IBV_loop, TP_CMA_loop). It's meant to set the affinity,
+// nice value and scheduling policy of the thread, which applyThreadSettings can
+// do, but it can also e.g. register the thread with a profiler. It runs before
+// a component applies the CPUs it was explicitly configured with, if any.
+using ThreadStartHook = std::function<void(const std::string& name)>;
+
+// Set the hook for the whole process, which only affects the threads started
+// afterwards, hence it should happen before creating any context. An empty
+// function removes the hook.
+void setThreadStartHook(ThreadStartHook hook);
+
+// Name the current thread and run the thread start hook on it. To be called by
+// TensorPipe's own threads when they start.
+void initCurrentThread(std::string name);
+
+// Return the NUMA node of the CPU the current thread is running on, if known.
+optional<int> getNumaNodeOfCurrentCpu();
+
+// Return the CPUs that belong to the given NUMA node, as listed in sysfs, or
+// none if the node doesn't exist.
+std::vector<int> getCpusOfNumaNode(int node);
+
+// Return the CPUs that are local to the given network interface (i.e., on the
+// same NUMA node as its device), as listed in sysfs, or none if unknown (e.g.,
+// for virtual interfaces). Loops handling that interface's traffic are best run
+// on them, close to where its interrupts are usually steered.
+std::vector<int> getCpusOfNetworkInterface(const std::string& iface);
+
+// Return how many CPUs' worth of time the cgroup of this process may use, as
+// set by its CFS quota (cpu.max in cgroup v2, or cpu.cfs_quota_us over
+// cpu.cfs_period_us in v1), or nothing if there's no quota or it's unknown.
+// Containers are usually limited this way, rather than through their affinity,
+// and exceeding the quota gets all their threads throttled until the period
+// ends.
+optional<double> getCgroupCpuQuota();
+
+// Bind the pages spanning the given range of memory to the given NUMA node,
+// moving those already allocated. For shared memory, the policy is attached to
+// the underlying file, hence it also applies to the mappings of other
+// processes. This is only an optimization, hence failures (e.g., because the
+// kernel lacks NUMA support) are reported but can be ignored.
+bool bindMemoryToNumaNode(void* ptr, size_t length, int node);
+
+// Map the given range of a file, which needn't be aligned to pages, and return
+// a pointer to its start that unmaps it once the last reference is dropped. A
+// private mapping is copy-on-write, whereas the writes to a shared one end up
+// in the file, which is then first extended to cover the range if it's shorter.
+// Throw if the file can't be mapped.
+std::shared_ptr<void> mapFileRange(
+    int fd,
+    uint64_t offset,
+    size_t length,
+    bool shared);
+
+// Run the given functions on up to this many threads at once, the calling one
+// included, and return once all of them are done, rethrowing the first
+// exception that any of them threw. It starts the threads anew, hence it's
+// meant for the teardown of many resources whose destruction blocks in the
+// kernel (e.g., queue pairs and memory regions), not for the data path.
+void runInParallel(std::vector<std::function<void()>> fns, size_t numThreads);
+
 } // namespace tensorpipe
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace tensorpipe {
+
+// A token bucket that bounds the rate at which bytes are sent. It fills up at
+// the given rate, up to the given burst, and sending takes bytes out of it.
+// A transfer larger than the burst is let through when the bucket is full, and
+// it leaves it in debt, which then delays the following ones. It can be used
+// from any thread, and its rate can be changed at any time.
+class TokenBucket {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  // A rate of zero disables the limit. A burst of zero defaults to the amount
+  // of bytes accrued in a tenth of a second.
+  void setRate(double bytesPerSecond, size_t burstBytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    refill(clock::now());
+    const bool wasLimited = bytesPerSecond_ > 0;
+    bytesPerSecond_ = bytesPerSecond > 0 ? bytesPerSecond : 0;
+    burstBytes_ = burstBytes > 0 ? static_cast<double>(burstBytes)
+                                 : bytesPerSecond_ / 10;
+    // A new limit starts full, whereas a changed one keeps what it had (or any
+    // debt), up to the new burst.
+    if (!wasLimited || tokens_ > burstBytes_) {
+      tokens_ = burstBytes_;
+    }
+  }
+
+  bool isLimited() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return bytesPerSecond_ > 0;
+  }
+
+  // How long until the given amount of bytes may be sent, zero meaning now.
+  clock::duration getDelay(size_t numBytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (bytesPerSecond_ == 0) {
+      return clock::duration::zero();
+    }
+    refill(clock::now());
+    const double needed =
+        std::min(static_cast<double>(numBytes), burstBytes_) - tokens_;
+    if (needed <= 0) {
+      return clock::duration::zero();
+    }
+    return std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(needed / bytesPerSecond_));
+  }
+
+  // Take the bytes out of the bucket, even if they aren't all there (in which
+  // case a concurrent sender got there first since getDelay was called).
+  void take(size_t numBytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (bytesPerSecond_ == 0) {
+      return;
+    }
+    refill(clock::now());
+    tokens_ -= static_cast<double>(numBytes);
+  }
+
+ private:
+  std::mutex mutex_;
+  double bytesPerSecond_{0};
+  double burstBytes_{0};
+  double tokens_{0};
+  clock::time_point lastRefill_{clock::now()};
+
+  void refill(clock::time_point now) {
+    const std::chrono::duration<double> elapsed = now - lastRefill_;
+    lastRefill_ = now;
+    tokens_ =
+        std::min(burstBytes_, tokens_ + elapsed.count() * bytesPerSecond_);
+  }
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/trace.h>
+
+#include <unistd.h>
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace tensorpipe {
+namespace trace {
+
+std::atomic<bool> enabled{false};
+
+namespace {
+
+struct Event {
+  const char* name;
+  uint32_t scope;
+  bool isSynchronous;
+  int64_t sequenceNumber;
+  TClock::time_point begin;
+  TClock::time_point end;
+};
+
+// The events recorded by a thread. Only that thread adds to it, but the mutex
+// is still needed for when the events are dumped or discarded, which is rare,
+// hence it's almost never contended.
+struct ThreadBuffer {
+  explicit ThreadBuffer(uint64_t threadIdx) : threadIdx(threadIdx) {}
+
+  const uint64_t threadIdx;
+  std::mutex mutex;
+  size_t capacity{0};
+  std::vector<Event> events;
+  // Where the next event goes once the buffer is full.
+  size_t nextEventIdx{0};
+};
+
+struct Registry {
+  std::mutex mutex;
+  size_t numEventsPerThread{kDefaultNumEventsPerThread};
+  // The buffers outlive their threads, to hold on to their events.
+  std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+  std::vector<std::string> scopeNames;
+  std::unordered_map<std::string, uint32_t> scopeIds;
+};
+
+Registry& getRegistry() {
+  // Leaked, so that it can still be used by threads that outlive main.
+  static Registry* registry = new Registry();
+  return *registry;
+}
+
+ThreadBuffer& getThreadBuffer() {
+  thread_local std::shared_ptr<ThreadBuffer> buffer = []() {
+    Registry& registry = getRegistry();
+    std::unique_lock<std::mutex> lock(registry.mutex);
+    auto buffer = std::make_shared<ThreadBuffer>(registry.buffers.size());
+    buffer->capacity = registry.numEventsPerThread;
+    registry.buffers.push_back(buffer);
+    return buffer;
+  }();
+  return *buffer;
+}
+
+void writeJsonString(std::ostream& os, const std::string& str) {
+  os << '"';
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      os << '\\' << c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      os << ' ';
+    } else {
+      os << c;
+    }
+  }
+  os << '"';
+}
+
+double toMicroseconds(TClock::time_point timePoint) {
+  return std::chrono::duration<double, std::micro>(
+             timePoint.time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+void enable(size_t numEventsPerThread) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  registry.numEventsPerThread = numEventsPerThread;
+  for (const auto& buffer : registry.buffers) {
+    std::unique_lock<std::mutex> bufferLock(buffer->mutex);
+    buffer->capacity = numEventsPerThread;
+    buffer->events.clear();
+    buffer->nextEventIdx = 0;
+  }
+  enabled.store(numEventsPerThread > 0);
+}
+
+void disable() {
+  enabled.store(false);
+}
+
+uint32_t internScope(const std::string& name) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  auto iter = registry.scopeIds.find(name);
+  if (iter != registry.scopeIds.end()) {
+    return iter->second;
+  }
+  uint32_t scope = registry.scopeNames.size();
+  registry.scopeNames.push_back(name);
+  registry.scopeIds.emplace(name, scope);
+  return scope;
+}
+
+void recordSpan(
+    const char* name,
+    uint32_t scope,
+    int64_t sequenceNumber,
+    TClock::time_point begin,
+    TClock::time_point end,
+    bool isSynchronous) {
+  if (!isEnabled()) {
+    return;
+  }
+  ThreadBuffer& buffer = getThreadBuffer();
+  std::unique_lock<std::mutex> lock(buffer.mutex);
+  if (buffer.capacity == 0) {
+    return;
+  }
+  Event event{name, scope, isSynchronous, sequenceNumber, begin, end};
+  if (buffer.events.size() < buffer.capacity) {
+    buffer.events.push_back(event);
+  } else {
+    buffer.events[buffer.nextEventIdx] = event;
+    buffer.nextEventIdx = (buffer.nextEventIdx + 1) % buffer.capacity;
+  }
+}
+
+void dumpChromeTrace(std::ostream& os) {
+  Registry& registry = getRegistry();
+  std::unique_lock<std::mutex> lock(registry.mutex);
+  const pid_t pid = ::getpid();
+  bool first = true;
+  auto writeEvent = [&](const Event& event,
+                        uint64_t threadIdx,
+                        const char* phase,
+                        TClock::time_point timePoint,
+                        bool withArgs) {
+    os << (first ? "\n" : ",\n");
+    first = false;
+    os << "{\"name\":\"" << event.name << "\",\"cat\":\"tensorpipe\""
+       << ",\"ph\":\"" << phase << "\",\"pid\":" << pid
+       << ",\"tid\":" << threadIdx << ",\"ts\":" << toMicroseconds(timePoint);
+    const std::string& scopeName = registry.scopeNames.at(event.scope);
+    if (event.isSynchronous) {
+      os << ",\"dur\":"
+         << toMicroseconds(event.end) - toMicroseconds(event.begin);
+    } else {
+      // Stages of the same operation are grouped together, on a track of the
+      // operation, since they would otherwise overlap the ones of others.
+      os << ",\"id2\":{\"local\":";
+      writeJsonString(
+          os, scopeName + "#" + std::to_string(event.sequenceNumber));
+      os << "}";
+    }
+    if (withArgs) {
+      os << ",\"args\":{\"scope\":";
+      writeJsonString(os, scopeName);
+      os << ",\"sequence_number\":" << event.sequenceNumber << "}";
+    }
+    os << "}";
+  };
+
+  const std::ios::fmtflags flags = os.flags();
+  os << std::fixed;
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (const auto& buffer : registry.buffers) {
+    std::unique_lock<std::mutex> bufferLock(buffer->mutex);
+    // Oldest first, for when the buffer has wrapped around.
+    for (size_t offset = 0; offset < buffer->events.size(); offset++) {
+      const Event& event = buffer->events
+                               [(buffer->nextEventIdx + offset) %
+                                buffer->events.size()];
+      if (event.isSynchronous) {
+        writeEvent(event, buffer->threadIdx, "X", event.begin, true);
+      } else {
+        writeEvent(event, buffer->threadIdx, "b", event.begin, true);
+        writeEvent(event, buffer->threadIdx, "e", event.end, false);
+      }
+    }
+  }
+  os << "\n]}\n";
+  os.flags(flags);
+}
+
+} // namespace trace
+} // namespace tensorpipe
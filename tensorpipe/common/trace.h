@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace tensorpipe {
+namespace trace {
+
+// An optional record of when each stage of the operations of pipes, channels
+// and transports began and ended, meant to find where the time goes when an
+// operation is slow. It's off by default, and then costs a single relaxed load
+// of an atomic per stage. When on, each thread appends the events it records
+// to a ring buffer of its own, hence the oldest ones are eventually dropped.
+//
+// The events can be dumped in the JSON trace event format of Chrome, which the
+// Perfetto UI also loads. They carry the sequence number of the message they
+// belong to, which is the same on both ends of a pipe, so that traces dumped
+// by the processes of the two peers can be correlated.
+
+using TClock = std::chrono::steady_clock;
+
+constexpr size_t kDefaultNumEventsPerThread = 1 << 16;
+
+// Start recording, discarding any events recorded previously.
+void enable(size_t numEventsPerThread = kDefaultNumEventsPerThread);
+
+// Stop recording. The events already recorded are kept, to be dumped.
+void disable();
+
+extern std::atomic<bool> enabled;
+
+inline bool isEnabled() {
+  return enabled.load(std::memory_order_relaxed);
+}
+
+// Return a small identifier for the given name (typically the one of a pipe),
+// to be given to recordSpan, so that the name is only stored once.
+uint32_t internScope(const std::string& name);
+
+// Record a stage, from its beginning to its end, of an operation that may be
+// interleaved with others on the same thread (e.g., the writes of a pipe), or
+// of one that is run synchronously and thus is nested within whatever else the
+// thread is doing at the time. The name must be a string literal. Events that
+// do not belong to a message should give a sequence number of -1.
+void recordSpan(
+    const char* name,
+    uint32_t scope,
+    int64_t sequenceNumber,
+    TClock::time_point begin,
+    TClock::time_point end,
+    bool isSynchronous = false);
+
+// Record a synchronous stage from the construction to the destruction of this
+// object, if tracing is enabled at the time it's constructed.
+class Span {
+ public:
+  Span(const char* name, uint32_t scope, int64_t sequenceNumber = -1)
+      : name_(name), scope_(scope), sequenceNumber_(sequenceNumber) {
+    if (isEnabled()) {
+      active_ = true;
+      begin_ = TClock::now();
+    }
+  }
+
+  Span(const Span&) = delete;
+  Span& operator=(const Span&) = delete;
+
+  ~Span() {
+    if (active_) {
+      recordSpan(
+          name_,
+          scope_,
+          sequenceNumber_,
+          begin_,
+          TClock::now(),
+          /*isSynchronous=*/true);
+    }
+  }
+
+ private:
+  const char* const name_;
+  const uint32_t scope_;
+  const int64_t sequenceNumber_;
+  bool active_{false};
+  TClock::time_point begin_;
+};
+
+// Write all the events that are still held by the buffers of all threads, in
+// the JSON trace event format.
+void dumpChromeTrace(std::ostream& os);
+
+} // namespace trace
+} // namespace tensorpipe
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/ucx.h>
+
+#include <cstring>
+
+namespace tensorpipe {
+
+std::tuple<ucs_status_t, UcxContext> createUcxContext(UcxLib& ucxLib) {
+  ucp_config_t* config;
+  ucs_status_t status = ucxLib.ucp_config_read(
+      /*env_prefix=*/nullptr, /*filename=*/nullptr, &config);
+  if (status != UCS_OK) {
+    return std::make_tuple(status, UcxContext());
+  }
+
+  ucp_params_t params;
+  std::memset(&params, 0, sizeof(params));
+  params.field_mask = UCP_PARAM_FIELD_FEATURES;
+  params.features = UCP_FEATURE_STREAM;
+  ucp_context_h ptr;
+  // This is what the inline ucp_init function of the headers does.
+  status = ucxLib.ucp_init_version(
+      UCP_API_MAJOR, UCP_API_MINOR, &params, config, &ptr);
+  ucxLib.ucp_config_release(config);
+  if (status != UCS_OK) {
+    return std::make_tuple(status, UcxContext());
+  }
+  return std::make_tuple(UCS_OK, UcxContext(ptr, UcxContextDeleter{&ucxLib}));
+}
+
+UcxWorker createUcxWorker(UcxLib& ucxLib, UcxContext& context) {
+  ucp_worker_params_t params;
+  std::memset(&params, 0, sizeof(params));
+  params.field_mask = UCP_WORKER_PARAM_FIELD_THREAD_MODE;
+  params.thread_mode = UCS_THREAD_MODE_SINGLE;
+  ucp_worker_h ptr;
+  TP_CHECK_UCX_STATUS(
+      ucxLib, ucxLib.ucp_worker_create(context.get(), &params, &ptr));
+  return UcxWorker(ptr, UcxWorkerDeleter{&ucxLib});
+}
+
+std::string getUcxWorkerAddress(UcxLib& ucxLib, UcxWorker& worker) {
+  ucp_address_t* address;
+  size_t length;
+  TP_CHECK_UCX_STATUS(
+      ucxLib, ucxLib.ucp_worker_get_address(worker.get(), &address, &length));
+  std::string result(reinterpret_cast<char*>(address), length);
+  ucxLib.ucp_worker_release_address(worker.get(), address);
+  return result;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/ucx_lib.h>
+
+namespace tensorpipe {
+
+// Error checking macros
+
+// The statuses of UCX aren't error codes of the system, hence they can only be
+// reported through their description.
+#define TP_CHECK_UCX_STATUS(ucxLib, op)                       \
+  {                                                           \
+    ucs_status_t status = op;                                 \
+    TP_THROW_ASSERT_IF(status != UCS_OK)                      \
+        << #op << ": " << (ucxLib).ucs_status_string(status); \
+  }
+
+// RAII wrappers
+
+struct UcxContextDeleter {
+  void operator()(struct ucp_context* ptr) {
+    ucxLib->ucp_cleanup(ptr);
+  }
+
+  UcxLib* ucxLib;
+};
+
+using UcxContext = std::unique_ptr<struct ucp_context, UcxContextDeleter>;
+
+// Read the configuration from the environment (i.e., the UCX_* variables, such
+// as UCX_TLS to restrict the transports UCX may pick from) and create a context
+// with support for streams. Return the status of UCX if that failed, e.g., for
+// lack of any usable transport.
+std::tuple<ucs_status_t, UcxContext> createUcxContext(UcxLib& ucxLib);
+
+struct UcxWorkerDeleter {
+  void operator()(struct ucp_worker* ptr) {
+    ucxLib->ucp_worker_destroy(ptr);
+  }
+
+  UcxLib* ucxLib;
+};
+
+using UcxWorker = std::unique_ptr<struct ucp_worker, UcxWorkerDeleter>;
+
+// The worker is only ever used by a single thread at a time.
+UcxWorker createUcxWorker(UcxLib& ucxLib, UcxContext& context);
+
+// Helpers
+
+// The address through which the peers can reach the worker, which is opaque and
+// whose size depends on the transports that UCX found.
+std::string getUcxWorkerAddress(UcxLib& ucxLib, UcxWorker& worker);
+
+} // namespace tensorpipe
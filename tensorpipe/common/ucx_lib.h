@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <ucp/api/ucp.h>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/dl.h>
+
+namespace tensorpipe {
+
+// Master list of all symbols we care about from libucp (and, through it, from
+// libucs, which it depends on).
+
+#define TP_FORALL_UCX_SYMBOLS(_)                                              \
+  _(ucp_cleanup, void, (ucp_context_h))                                       \
+  _(ucp_config_read,                                                          \
+    ucs_status_t,                                                             \
+    (const char*, const char*, ucp_config_t**))                               \
+  _(ucp_config_release, void, (ucp_config_t*))                                \
+  _(ucp_ep_close_nbx,                                                         \
+    ucs_status_ptr_t,                                                         \
+    (ucp_ep_h, const ucp_request_param_t*))                                   \
+  _(ucp_ep_create,                                                            \
+    ucs_status_t,                                                             \
+    (ucp_worker_h, const ucp_ep_params_t*, ucp_ep_h*))                        \
+  _(ucp_init_version,                                                         \
+    ucs_status_t,                                                             \
+    (unsigned,                                                                \
+     unsigned,                                                                \
+     const ucp_params_t*,                                                     \
+     const ucp_config_t*,                                                     \
+     ucp_context_h*))                                                         \
+  _(ucp_request_cancel, void, (ucp_worker_h, void*))                          \
+  _(ucp_request_free, void, (void*))                                          \
+  _(ucp_stream_recv_nbx,                                                      \
+    ucs_status_ptr_t,                                                         \
+    (ucp_ep_h, void*, size_t, size_t*, const ucp_request_param_t*))           \
+  _(ucp_stream_send_nbx,                                                      \
+    ucs_status_ptr_t,                                                         \
+    (ucp_ep_h, const void*, size_t, const ucp_request_param_t*))              \
+  _(ucp_worker_create,                                                        \
+    ucs_status_t,                                                             \
+    (ucp_context_h, const ucp_worker_params_t*, ucp_worker_h*))               \
+  _(ucp_worker_destroy, void, (ucp_worker_h))                                 \
+  _(ucp_worker_get_address,                                                   \
+    ucs_status_t,                                                             \
+    (ucp_worker_h, ucp_address_t**, size_t*))                                 \
+  _(ucp_worker_progress, unsigned, (ucp_worker_h))                            \
+  _(ucp_worker_release_address, void, (ucp_worker_h, ucp_address_t*))         \
+  _(ucs_status_string, const char*, (ucs_status_t))
+
+// Wrapper for libucp.
+//
+// The headers of UCX are needed to build, as they define the structures of the
+// parameters, but the library isn't needed to link, as it's loaded at runtime.
+
+class UcxLib {
+ private:
+  explicit UcxLib(DynamicLibraryHandle dlhandle)
+      : dlhandle_(std::move(dlhandle)) {}
+
+  DynamicLibraryHandle dlhandle_;
+
+#define TP_DECLARE_FIELD(function_name, return_type, args_types) \
+  return_type(*function_name##_ptr_) args_types = nullptr;
+  TP_FORALL_UCX_SYMBOLS(TP_DECLARE_FIELD)
+#undef TP_DECLARE_FIELD
+
+ public:
+  UcxLib() = default;
+
+  static std::tuple<Error, UcxLib> create() {
+    Error error;
+    DynamicLibraryHandle dlhandle;
+    // To keep things "neat" and contained, we open in "local" mode (as opposed
+    // to global) so that the UCX symbols can only be resolved through this
+    // handle and are not exposed (a.k.a., "leaked") to other shared objects.
+    std::tie(error, dlhandle) =
+        createDynamicLibraryHandle("libucp.so.0", RTLD_LOCAL | RTLD_LAZY);
+    if (error) {
+      return std::make_tuple(std::move(error), UcxLib());
+    }
+    UcxLib lib(std::move(dlhandle));
+#define TP_LOAD_SYMBOL(function_name, return_type, args_types)          \
+  {                                                                     \
+    void* ptr;                                                          \
+    std::tie(error, ptr) = loadSymbol(lib.dlhandle_, #function_name);   \
+    if (error) {                                                        \
+      return std::make_tuple(std::move(error), UcxLib());               \
+    }                                                                   \
+    TP_THROW_ASSERT_IF(ptr == nullptr);                                 \
+    lib.function_name##_ptr_ =                                          \
+        reinterpret_cast<decltype(function_name##_ptr_)>(ptr);          \
+  }
+    TP_FORALL_UCX_SYMBOLS(TP_LOAD_SYMBOL)
+#undef TP_LOAD_SYMBOL
+    return std::make_tuple(Error::kSuccess, std::move(lib));
+  }
+
+#define TP_FORWARD_CALL(function_name, return_type, args_types)  \
+  template <typename... Args>                                    \
+  auto function_name(Args&&... args) const {                     \
+    return (*function_name##_ptr_)(std::forward<Args>(args)...); \
+  }
+  TP_FORALL_UCX_SYMBOLS(TP_FORWARD_CALL)
+#undef TP_FORWARD_CALL
+};
+
+#undef TP_FORALL_UCX_SYMBOLS
+
+} // namespace tensorpipe
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/xdp.h>
+
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/socket.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif // AF_XDP
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif // SOL_XDP
+
+namespace tensorpipe {
+
+namespace {
+
+int bpf(enum bpf_cmd cmd, union bpf_attr& attr) {
+  return ::syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+struct bpf_insn makeInsn(
+    uint8_t code,
+    uint8_t dstReg,
+    uint8_t srcReg,
+    int16_t off,
+    int32_t imm) {
+  struct bpf_insn insn;
+  std::memset(&insn, 0, sizeof(insn));
+  insn.code = code;
+  insn.dst_reg = dstReg;
+  insn.src_reg = srcReg;
+  insn.off = off;
+  insn.imm = imm;
+  return insn;
+}
+
+// The instructions of the program, which go to the label at the end (that
+// lets the packet through) as soon as a check fails:
+//
+//   if (data + 42 > data_end) goto pass;
+//   if (eth->h_proto != htons(ETH_P_IP)) goto pass;
+//   if (ip->version != 4 || ip->ihl != 5) goto pass;
+//   if (ip->protocol != IPPROTO_UDP) goto pass;
+//   if (udp->dest != htons(udpPort)) goto pass;
+//   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+// pass:
+//   return XDP_PASS;
+std::vector<struct bpf_insn> makeProgram(int mapFd, uint16_t udpPort) {
+  constexpr uint8_t kLdxW = BPF_LDX | BPF_W | BPF_MEM;
+  constexpr uint8_t kLdxH = BPF_LDX | BPF_H | BPF_MEM;
+  constexpr uint8_t kLdxB = BPF_LDX | BPF_B | BPF_MEM;
+  constexpr uint8_t kMovX = BPF_ALU64 | BPF_MOV | BPF_X;
+  constexpr uint8_t kMovK = BPF_ALU64 | BPF_MOV | BPF_K;
+  constexpr uint8_t kAddK = BPF_ALU64 | BPF_ADD | BPF_K;
+  constexpr uint8_t kJgtX = BPF_JMP | BPF_JGT | BPF_X;
+  constexpr uint8_t kJneK = BPF_JMP | BPF_JNE | BPF_K;
+  // The offsets of the fields of struct xdp_md.
+  constexpr int16_t kData = 0;
+  constexpr int16_t kDataEnd = 4;
+  constexpr int16_t kRxQueueIndex = 16;
+  // The index of the instruction at the pass label.
+  constexpr int16_t kPass = 20;
+
+  std::vector<struct bpf_insn> insns;
+  auto jumpToPass = [&](uint8_t code, uint8_t dstReg, uint8_t srcReg, int imm) {
+    const int16_t off = kPass - static_cast<int16_t>(insns.size()) - 1;
+    insns.push_back(makeInsn(code, dstReg, srcReg, off, imm));
+  };
+  insns.push_back(makeInsn(kMovX, BPF_REG_6, BPF_REG_1, 0, 0));
+  insns.push_back(makeInsn(kLdxW, BPF_REG_2, BPF_REG_6, kData, 0));
+  insns.push_back(makeInsn(kLdxW, BPF_REG_3, BPF_REG_6, kDataEnd, 0));
+  insns.push_back(makeInsn(kMovX, BPF_REG_4, BPF_REG_2, 0, 0));
+  insns.push_back(makeInsn(kAddK, BPF_REG_4, 0, 0, 42));
+  jumpToPass(kJgtX, BPF_REG_4, BPF_REG_3, 0);
+  // The loads are in host byte order, as are the values they're checked
+  // against (which are thus converted from network byte order).
+  insns.push_back(makeInsn(kLdxH, BPF_REG_5, BPF_REG_2, 12, 0));
+  jumpToPass(kJneK, BPF_REG_5, 0, htons(0x0800));
+  insns.push_back(makeInsn(kLdxB, BPF_REG_5, BPF_REG_2, 14, 0));
+  jumpToPass(kJneK, BPF_REG_5, 0, 0x45);
+  insns.push_back(makeInsn(kLdxB, BPF_REG_5, BPF_REG_2, 23, 0));
+  jumpToPass(kJneK, BPF_REG_5, 0, IPPROTO_UDP);
+  insns.push_back(makeInsn(kLdxH, BPF_REG_5, BPF_REG_2, 36, 0));
+  jumpToPass(kJneK, BPF_REG_5, 0, htons(udpPort));
+  insns.push_back(makeInsn(kLdxW, BPF_REG_2, BPF_REG_6, kRxQueueIndex, 0));
+  // Loading a map's file descriptor takes two instructions.
+  insns.push_back(makeInsn(
+      BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, mapFd));
+  insns.push_back(makeInsn(0, 0, 0, 0, 0));
+  insns.push_back(makeInsn(kMovK, BPF_REG_3, 0, 0, XDP_PASS));
+  insns.push_back(
+      makeInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+  insns.push_back(makeInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  TP_DCHECK_EQ(insns.size(), kPass);
+  insns.push_back(makeInsn(kMovK, BPF_REG_0, 0, 0, XDP_PASS));
+  insns.push_back(makeInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  return insns;
+}
+
+Error mapRing(
+    int fd,
+    off_t pageOffset,
+    const struct xdp_ring_offset& offsets,
+    uint32_t size,
+    size_t entrySize,
+    MmappedPtr& map,
+    XdpRing& ring) {
+  map = MmappedPtr::tryCreate(
+      offsets.desc + size * entrySize,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      fd,
+      pageOffset);
+  if (map.ptr() == nullptr) {
+    return TP_CREATE_ERROR(SystemError, "mmap", errno);
+  }
+  ring = XdpRing(map.ptr(), offsets, size);
+  return Error::kSuccess;
+}
+
+} // namespace
+
+std::tuple<Error, XdpInterface> lookUpXdpInterface(const std::string& name) {
+  XdpInterface iface;
+  iface.index = ::if_nametoindex(name.c_str());
+  if (iface.index == 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "if_nametoindex", errno), iface);
+  }
+  Error error;
+  Socket socket;
+  std::tie(error, socket) = Socket::createForFamily(AF_INET);
+  if (error) {
+    return std::make_tuple(std::move(error), iface);
+  }
+  struct ifreq ifr;
+  std::memset(&ifr, 0, sizeof(ifr));
+  std::strncpy(ifr.ifr_name, name.c_str(), IFNAMSIZ - 1);
+  if (::ioctl(socket.fd(), SIOCGIFHWADDR, &ifr) < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "ioctl(SIOCGIFHWADDR)", errno), iface);
+  }
+  std::memcpy(iface.mac, ifr.ifr_hwaddr.sa_data, sizeof(iface.mac));
+  if (::ioctl(socket.fd(), SIOCGIFADDR, &ifr) < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "ioctl(SIOCGIFADDR)", errno), iface);
+  }
+  iface.ipv4 =
+      reinterpret_cast<struct sockaddr_in*>(&ifr.ifr_addr)->sin_addr.s_addr;
+  if (::ioctl(socket.fd(), SIOCGIFMTU, &ifr) < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "ioctl(SIOCGIFMTU)", errno), iface);
+  }
+  iface.mtu = ifr.ifr_mtu;
+  return std::make_tuple(Error::kSuccess, iface);
+}
+
+std::tuple<Error, XdpSocket> XdpSocket::create(
+    int ifindex,
+    uint32_t queueId,
+    uint32_t numFrames,
+    uint32_t frameSize) {
+  TP_THROW_ASSERT_IF(numFrames < 2 || (numFrames & (numFrames - 1)) != 0)
+      << "The number of frames must be a power of two";
+  XdpSocket socket;
+  socket.numFrames_ = numFrames;
+  socket.frameSize_ = frameSize;
+  const uint32_t ringSize = numFrames / 2;
+
+  socket.umem_ = MmappedPtr::tryCreate(
+      static_cast<size_t>(numFrames) * frameSize,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+      /*fd=*/-1);
+  if (socket.umem_.ptr() == nullptr) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "mmap", errno), XdpSocket());
+  }
+
+  int fd = ::socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "socket(AF_XDP)", errno), XdpSocket());
+  }
+  socket.fd_ = Fd(fd);
+
+  struct xdp_umem_reg umemReg;
+  std::memset(&umemReg, 0, sizeof(umemReg));
+  umemReg.addr = reinterpret_cast<uint64_t>(socket.umem_.ptr());
+  umemReg.len = socket.umem_.getLength();
+  umemReg.chunk_size = frameSize;
+  umemReg.headroom = 0;
+  if (::setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &umemReg, sizeof(umemReg)) < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "setsockopt(XDP_UMEM_REG)", errno),
+        XdpSocket());
+  }
+  for (int option : {XDP_UMEM_FILL_RING,
+                     XDP_UMEM_COMPLETION_RING,
+                     XDP_RX_RING,
+                     XDP_TX_RING}) {
+    if (::setsockopt(fd, SOL_XDP, option, &ringSize, sizeof(ringSize)) < 0) {
+      return std::make_tuple(
+          TP_CREATE_ERROR(SystemError, "setsockopt(SOL_XDP)", errno),
+          XdpSocket());
+    }
+  }
+
+  struct xdp_mmap_offsets offsets;
+  socklen_t offsetsLen = sizeof(offsets);
+  if (::getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsLen) < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "getsockopt(XDP_MMAP_OFFSETS)", errno),
+        XdpSocket());
+  }
+  Error error = mapRing(
+      fd,
+      XDP_UMEM_PGOFF_FILL_RING,
+      offsets.fr,
+      ringSize,
+      sizeof(uint64_t),
+      socket.fillMap_,
+      socket.fillRing_);
+  if (!error) {
+    error = mapRing(
+        fd,
+        XDP_UMEM_PGOFF_COMPLETION_RING,
+        offsets.cr,
+        ringSize,
+        sizeof(uint64_t),
+        socket.completionMap_,
+        socket.completionRing_);
+  }
+  if (!error) {
+    error = mapRing(
+        fd,
+        XDP_PGOFF_RX_RING,
+        offsets.rx,
+        ringSize,
+        sizeof(struct xdp_desc),
+        socket.rxMap_,
+        socket.rxRing_);
+  }
+  if (!error) {
+    error = mapRing(
+        fd,
+        XDP_PGOFF_TX_RING,
+        offsets.tx,
+        ringSize,
+        sizeof(struct xdp_desc),
+        socket.txMap_,
+        socket.txRing_);
+  }
+  if (error) {
+    return std::make_tuple(std::move(error), XdpSocket());
+  }
+
+  // Try the fastest mode first, and fall back to the ones that more drivers
+  // (or older kernels) support.
+  struct BindMode {
+    uint16_t flags;
+    bool zeroCopy;
+    bool needWakeup;
+  };
+  const std::array<BindMode, 3> modes{{
+      {XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP, true, true},
+      {XDP_COPY | XDP_USE_NEED_WAKEUP, false, true},
+      {XDP_COPY, false, false},
+  }};
+  int bindErrno = 0;
+  for (const BindMode& mode : modes) {
+    struct sockaddr_xdp addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = queueId;
+    addr.sxdp_flags = mode.flags;
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) ==
+        0) {
+      socket.zeroCopy_ = mode.zeroCopy;
+      socket.needWakeup_ = mode.needWakeup;
+      return std::make_tuple(Error::kSuccess, std::move(socket));
+    }
+    bindErrno = errno;
+  }
+  return std::make_tuple(
+      TP_CREATE_ERROR(SystemError, "bind(AF_XDP)", bindErrno), XdpSocket());
+}
+
+void XdpSocket::wakeUpForFill() {
+  if (!needWakeup_ || fillRing_.needsWakeup()) {
+    // Nothing is actually received, this only kicks the driver.
+    ::recvfrom(fd_.fd(), nullptr, 0, MSG_DONTWAIT, nullptr, nullptr);
+  }
+}
+
+void XdpSocket::wakeUpForTx() {
+  if (!needWakeup_ || txRing_.needsWakeup()) {
+    // It may fail with EAGAIN or EBUSY if the kernel is still busy with the
+    // previous packets, in which case it will get to these ones too.
+    ::sendto(fd_.fd(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+  }
+}
+
+std::tuple<Error, XdpProgram> XdpProgram::attach(
+    int ifindex,
+    uint16_t udpPort,
+    uint32_t maxNumQueues) {
+  XdpProgram program;
+  union bpf_attr attr;
+
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = maxNumQueues;
+  int fd = bpf(BPF_MAP_CREATE, attr);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "bpf(BPF_MAP_CREATE)", errno),
+        XdpProgram());
+  }
+  program.mapFd_ = Fd(fd);
+
+  std::vector<struct bpf_insn> insns = makeProgram(fd, udpPort);
+  static const char kLicense[] = "BSD";
+  std::array<char, 4096> log;
+  log[0] = '\0';
+  std::memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = reinterpret_cast<uint64_t>(insns.data());
+  attr.insn_cnt = insns.size();
+  attr.license = reinterpret_cast<uint64_t>(kLicense);
+  attr.log_buf = reinterpret_cast<uint64_t>(log.data());
+  attr.log_size = log.size();
+  attr.log_level = 1;
+  fd = bpf(BPF_PROG_LOAD, attr);
+  if (fd < 0) {
+    const int loadErrno = errno;
+    TP_VLOG(9) << "The verifier rejected the XDP program: " << log.data();
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "bpf(BPF_PROG_LOAD)", loadErrno),
+        XdpProgram());
+  }
+  program.progFd_ = Fd(fd);
+
+  std::memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = program.progFd_.fd();
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  fd = bpf(BPF_LINK_CREATE, attr);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "bpf(BPF_LINK_CREATE)", errno),
+        XdpProgram());
+  }
+  program.linkFd_ = Fd(fd);
+
+  return std::make_tuple(Error::kSuccess, std::move(program));
+}
+
+Error XdpProgram::registerSocket(uint32_t queueId, const XdpSocket& socket) {
+  const uint32_t fd = socket.fd();
+  union bpf_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.map_fd = mapFd_.fd();
+  attr.key = reinterpret_cast<uint64_t>(&queueId);
+  attr.value = reinterpret_cast<uint64_t>(&fd);
+  attr.flags = BPF_ANY;
+  if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+    return TP_CREATE_ERROR(SystemError, "bpf(BPF_MAP_UPDATE_ELEM)", errno);
+  }
+  return Error::kSuccess;
+}
+
+} // namespace tensorpipe
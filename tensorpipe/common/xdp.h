@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <linux/if_xdp.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/memory.h>
+
+namespace tensorpipe {
+
+// One of the four rings that an AF_XDP socket shares with the kernel: the fill
+// ring, through which the frames of the UMEM are handed to the kernel to
+// receive into, the completion ring, through which the frames that were
+// transmitted come back, and the receive and transmit rings, which hold the
+// descriptors of the packets. Each side only ever advances its own index, and
+// caches the other one's, so that it only reads that contended cache line when
+// it seems to have run out of entries.
+class XdpRing {
+ public:
+  XdpRing() = default;
+
+  XdpRing(uint8_t* map, const struct xdp_ring_offset& offsets, uint32_t size)
+      : producer_(
+            reinterpret_cast<std::atomic<uint32_t>*>(map + offsets.producer)),
+        consumer_(
+            reinterpret_cast<std::atomic<uint32_t>*>(map + offsets.consumer)),
+        flags_(reinterpret_cast<std::atomic<uint32_t>*>(map + offsets.flags)),
+        entries_(map + offsets.desc),
+        mask_(size - 1),
+        size_(size),
+        cachedProducer_(producer_->load(std::memory_order_relaxed)),
+        cachedConsumer_(consumer_->load(std::memory_order_relaxed)) {}
+
+  // On the producer side (the fill and transmit rings), how many entries can
+  // be written, starting at the producer index, before they must be submitted.
+  uint32_t numFree() {
+    uint32_t numFree = size_ - (cachedProducer_ - cachedConsumer_);
+    if (numFree == 0) {
+      cachedConsumer_ = consumer_->load(std::memory_order_acquire);
+      numFree = size_ - (cachedProducer_ - cachedConsumer_);
+    }
+    return numFree;
+  }
+
+  uint32_t producerIndex() const {
+    return cachedProducer_;
+  }
+
+  void submit(uint32_t num) {
+    cachedProducer_ += num;
+    producer_->store(cachedProducer_, std::memory_order_release);
+  }
+
+  // On the consumer side (the completion and receive rings), how many entries
+  // can be read, starting at the consumer index, before they must be released.
+  uint32_t numAvailable() {
+    uint32_t numAvailable = cachedProducer_ - cachedConsumer_;
+    if (numAvailable == 0) {
+      cachedProducer_ = producer_->load(std::memory_order_acquire);
+      numAvailable = cachedProducer_ - cachedConsumer_;
+    }
+    return numAvailable;
+  }
+
+  uint32_t consumerIndex() const {
+    return cachedConsumer_;
+  }
+
+  void release(uint32_t num) {
+    cachedConsumer_ += num;
+    consumer_->store(cachedConsumer_, std::memory_order_release);
+  }
+
+  // The entries of the fill and completion rings are addresses in the UMEM,
+  // whereas those of the receive and transmit rings are packet descriptors.
+  uint64_t& addrAt(uint32_t index) {
+    return reinterpret_cast<uint64_t*>(entries_)[index & mask_];
+  }
+
+  struct xdp_desc& descAt(uint32_t index) {
+    return reinterpret_cast<struct xdp_desc*>(entries_)[index & mask_];
+  }
+
+  // Whether the kernel must be woken up in order to process this ring, which
+  // it always does if the socket wasn't bound with XDP_USE_NEED_WAKEUP.
+  bool needsWakeup() const {
+    return (flags_->load(std::memory_order_relaxed) & XDP_RING_NEED_WAKEUP) !=
+        0;
+  }
+
+ private:
+  std::atomic<uint32_t>* producer_{nullptr};
+  std::atomic<uint32_t>* consumer_{nullptr};
+  std::atomic<uint32_t>* flags_{nullptr};
+  uint8_t* entries_{nullptr};
+  uint32_t mask_{0};
+  uint32_t size_{0};
+  uint32_t cachedProducer_{0};
+  uint32_t cachedConsumer_{0};
+};
+
+// The network interface that an AF_XDP socket is bound to, with the addresses
+// its packets go out from (the IPv4 one in network byte order).
+struct XdpInterface {
+  int index{0};
+  uint8_t mac[6]{};
+  uint32_t ipv4{0};
+  uint32_t mtu{0};
+};
+
+std::tuple<Error, XdpInterface> lookUpXdpInterface(const std::string& name);
+
+// An AF_XDP socket bound to one queue of a network interface, with its UMEM:
+// an area of numFrames frames of frameSize bytes each (both powers of two),
+// which the NIC (or, in copy mode, the kernel) receives packets into and
+// transmits them from. Each of the four rings has room for half of the frames.
+// The socket is bound in zero-copy mode if the driver supports it, and in copy
+// mode otherwise.
+class XdpSocket {
+ public:
+  XdpSocket() = default;
+
+  static std::tuple<Error, XdpSocket> create(
+      int ifindex,
+      uint32_t queueId,
+      uint32_t numFrames,
+      uint32_t frameSize);
+
+  int fd() const {
+    return fd_.fd();
+  }
+
+  uint8_t* frameAt(uint64_t addr) {
+    return umem_.ptr() + addr;
+  }
+
+  uint32_t getNumFrames() const {
+    return numFrames_;
+  }
+
+  uint32_t getFrameSize() const {
+    return frameSize_;
+  }
+
+  bool isZeroCopy() const {
+    return zeroCopy_;
+  }
+
+  XdpRing& getFillRing() {
+    return fillRing_;
+  }
+
+  XdpRing& getCompletionRing() {
+    return completionRing_;
+  }
+
+  XdpRing& getRxRing() {
+    return rxRing_;
+  }
+
+  XdpRing& getTxRing() {
+    return txRing_;
+  }
+
+  // Have the kernel process the frames in the fill ring or the packets in the
+  // transmit ring, in case it needs to be told.
+  void wakeUpForFill();
+  void wakeUpForTx();
+
+ private:
+  Fd fd_;
+  MmappedPtr umem_;
+  MmappedPtr fillMap_;
+  MmappedPtr completionMap_;
+  MmappedPtr rxMap_;
+  MmappedPtr txMap_;
+  XdpRing fillRing_;
+  XdpRing completionRing_;
+  XdpRing rxRing_;
+  XdpRing txRing_;
+  uint32_t numFrames_{0};
+  uint32_t frameSize_{0};
+  bool zeroCopy_{false};
+  bool needWakeup_{false};
+};
+
+// An XDP program, attached to a network interface for as long as this object
+// lives, which hands the IPv4 UDP packets for the given port to the AF_XDP
+// socket registered for the queue they arrived on (if any), and lets all other
+// packets through to the kernel's network stack. Only one program can be
+// attached to an interface at a time. It's attached through a BPF link, which
+// requires Linux 5.9, and in native mode if the driver supports it.
+class XdpProgram {
+ public:
+  XdpProgram() = default;
+
+  static std::tuple<Error, XdpProgram> attach(
+      int ifindex,
+      uint16_t udpPort,
+      uint32_t maxNumQueues);
+
+  Error registerSocket(uint32_t queueId, const XdpSocket& socket);
+
+ private:
+  Fd mapFd_;
+  Fd progFd_;
+  Fd linkFd_;
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+// This header is optional and only does something when compiled as C++20 (or
+// later) with coroutine support: the rest of TensorPipe doesn't depend on it.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <cstdint>
+#include <utility>
+
+#include <tensorpipe/core/error.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+#define TENSORPIPE_HAS_COROUTINES 1
+
+namespace tensorpipe {
+
+// What the callback of a pipe operation would have been given.
+struct PipeResult {
+  Error error;
+  Message message;
+};
+
+// Awaitables that suspend a coroutine until an operation on a pipe completes,
+// for example:
+//
+//   PipeResult result = co_await asyncReadDescriptor(*pipe);
+//
+// The result is stored within the awaitable, and thus within the frame of the
+// coroutine, and the callback given to the pipe only captures a pointer to it,
+// so that it fits in the inline storage of Function and no allocation occurs.
+// The coroutine is resumed directly from within that callback, hence on the
+// thread the callback would have run on (one of the context's loops or, if
+// one was set, the callback executor), and it must therefore not block.
+class PipeAwaitable {
+ public:
+  bool await_ready() const noexcept {
+    return false;
+  }
+
+  PipeResult await_resume() noexcept {
+    return std::move(result_);
+  }
+
+ protected:
+  Function<void(const Error&, Message)> makeCallback_(
+      std::coroutine_handle<> handle) {
+    // Once resumed the coroutine may complete and destroy this object, which
+    // therefore mustn't be accessed after that.
+    return [this, handle](const Error& error, Message message) {
+      result_.error = error;
+      result_.message = std::move(message);
+      handle.resume();
+    };
+  }
+
+  PipeResult result_;
+};
+
+class PipeWriteAwaitable : public PipeAwaitable {
+ public:
+  PipeWriteAwaitable(Pipe& pipe, Message message, uint64_t priorityClass)
+      : pipe_(pipe),
+        message_(std::move(message)),
+        priorityClass_(priorityClass) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    pipe_.write(std::move(message_), makeCallback_(handle), priorityClass_);
+  }
+
+ private:
+  Pipe& pipe_;
+  Message message_;
+  const uint64_t priorityClass_;
+};
+
+class PipeReadDescriptorAwaitable : public PipeAwaitable {
+ public:
+  explicit PipeReadDescriptorAwaitable(Pipe& pipe) : pipe_(pipe) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    pipe_.readDescriptor(makeCallback_(handle));
+  }
+
+ private:
+  Pipe& pipe_;
+};
+
+class PipeReadAwaitable : public PipeAwaitable {
+ public:
+  PipeReadAwaitable(Pipe& pipe, Message message)
+      : pipe_(pipe), message_(std::move(message)) {}
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    pipe_.read(std::move(message_), makeCallback_(handle));
+  }
+
+ private:
+  Pipe& pipe_;
+  Message message_;
+};
+
+inline PipeWriteAwaitable asyncWrite(
+    Pipe& pipe,
+    Message message,
+    uint64_t priorityClass = 0) {
+  return PipeWriteAwaitable(pipe, std::move(message), priorityClass);
+}
+
+inline PipeReadDescriptorAwaitable asyncReadDescriptor(Pipe& pipe) {
+  return PipeReadDescriptorAwaitable(pipe);
+}
+
+inline PipeReadAwaitable asyncRead(Pipe& pipe, Message message) {
+  return PipeReadAwaitable(pipe, std::move(message));
+}
+
+} // namespace tensorpipe
+
+#endif // defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
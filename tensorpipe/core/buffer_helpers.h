@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <tensorpipe/common/defs.h>
 #include <tensorpipe/config.h>
 #include <tensorpipe/core/buffer.h>
 
@@ -64,4 +65,21 @@ void forEachDeviceType(TVisitor visitor) {
 #endif // TENSORPIPE_SUPPORTS_CUDA
 }
 
+template <typename TBuffer>
+TBuffer unwrap(Buffer);
+
+template <>
+inline CpuBuffer unwrap(Buffer b) {
+  TP_DCHECK(DeviceType::kCpu == b.type);
+  return b.cpu;
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+template <>
+inline CudaBuffer unwrap(Buffer b) {
+  TP_DCHECK(DeviceType::kCuda == b.type);
+  return b.cuda;
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
 } // namespace tensorpipe
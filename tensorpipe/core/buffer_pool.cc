@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/buffer_pool.h>
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/core/message.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// The shortest size class.
+constexpr size_t kMinBlockLength = 256;
+
+// The arenas are indexed by NUMA node, modulo this.
+constexpr size_t kMaxNumArenas = 64;
+
+constexpr size_t kHugePageLength = 2 * 1024 * 1024;
+
+size_t roundUpToPowerOfTwo(size_t length) {
+  size_t rounded = kMinBlockLength;
+  while (rounded < length) {
+    rounded <<= 1;
+  }
+  return rounded;
+}
+
+size_t classOfLength(size_t length) {
+  size_t sizeClass = 0;
+  while ((kMinBlockLength << sizeClass) < length) {
+    sizeClass++;
+  }
+  return sizeClass;
+}
+
+struct Block {
+  void* ptr;
+  int node;
+};
+
+} // namespace
+
+class BufferPool::Impl : public std::enable_shared_from_this<BufferPool::Impl> {
+ public:
+  explicit Impl(Options options);
+
+  std::shared_ptr<void> allocate(size_t length);
+
+  void registerWith(const std::shared_ptr<Context>& context);
+
+  ~Impl();
+
+ private:
+  const Options options_;
+  const size_t numClasses_;
+
+  // The free blocks of each class, on one NUMA node.
+  struct Arena {
+    std::mutex mutex;
+    std::vector<std::vector<Block>> freeBlocks;
+  };
+  std::array<Arena, kMaxNumArenas> arenas_;
+
+  // All the memory that was mapped, which is only unmapped when the pool is
+  // destroyed, and the contexts it's registered with.
+  struct Slab {
+    void* ptr;
+    size_t length;
+    std::vector<std::shared_ptr<void>> handles;
+  };
+  std::mutex slabsMutex_;
+  std::vector<Slab> slabs_;
+  std::vector<std::weak_ptr<Context>> contexts_;
+
+  Arena& arenaOfNode_(int node);
+
+  // Map a new slab on the node, registering it with the contexts, and add its
+  // blocks of the given class to the arena, returning one of them.
+  optional<Block> growArena_(size_t sizeClass, int node);
+
+  optional<Block> takeBlock_(size_t sizeClass, int node);
+  void giveBackBlock_(size_t sizeClass, Block block);
+  void giveBackBlocks_(size_t sizeClass, std::vector<Block>& blocks);
+
+  // The free blocks that a thread keeps for itself, by pool and then by class.
+  // As pools may come and go, an entry is only used if its pool is the one
+  // that's alive at that address, and the others are given back to their pool
+  // when the thread exits.
+  struct ThreadCache {
+    struct Entry {
+      std::weak_ptr<Impl> pool;
+      std::vector<std::vector<Block>> freeBlocks;
+    };
+    std::unordered_map<const Impl*, Entry> entries;
+
+    ~ThreadCache();
+  };
+
+  std::vector<Block>& getThreadCachedBlocks_(size_t sizeClass);
+};
+
+namespace {
+
+int currentNode() {
+  optional<int> node = getNumaNodeOfCurrentCpu();
+  return node.has_value() ? node.value() : -1;
+}
+
+} // namespace
+
+BufferPool::Impl::Impl(Options options)
+    : options_(std::move(options)),
+      numClasses_(classOfLength(options_.maxBlockLength) + 1) {
+  TP_THROW_ASSERT_IF(options_.slabLength < kMinBlockLength)
+      << "The slab length must be at least " << kMinBlockLength << " bytes";
+  for (Arena& arena : arenas_) {
+    arena.freeBlocks.resize(numClasses_);
+  }
+}
+
+BufferPool::Impl::ThreadCache::~ThreadCache() {
+  for (auto& iter : entries) {
+    std::shared_ptr<Impl> pool = iter.second.pool.lock();
+    if (pool == nullptr) {
+      continue;
+    }
+    for (size_t sizeClass = 0; sizeClass < iter.second.freeBlocks.size();
+         sizeClass++) {
+      pool->giveBackBlocks_(sizeClass, iter.second.freeBlocks[sizeClass]);
+    }
+  }
+}
+
+std::vector<Block>& BufferPool::Impl::getThreadCachedBlocks_(
+    size_t sizeClass) {
+  thread_local ThreadCache threadCache;
+  std::shared_ptr<Impl> self = shared_from_this();
+  ThreadCache::Entry& entry = threadCache.entries[this];
+  if (entry.pool.lock() != self) {
+    // The memory of a previous pool at the same address is gone.
+    entry.pool = self;
+    entry.freeBlocks.clear();
+    entry.freeBlocks.resize(numClasses_);
+  }
+  return entry.freeBlocks[sizeClass];
+}
+
+BufferPool::Impl::Arena& BufferPool::Impl::arenaOfNode_(int node) {
+  return arenas_[node < 0 ? 0 : node % kMaxNumArenas];
+}
+
+std::shared_ptr<void> BufferPool::Impl::allocate(size_t length) {
+  if (length == 0 || length > options_.maxBlockLength) {
+    return nullptr;
+  }
+  const size_t sizeClass = classOfLength(length);
+  const size_t blockLength = kMinBlockLength << sizeClass;
+  const int node = currentNode();
+  std::shared_ptr<Impl> self = shared_from_this();
+
+  optional<Block> block;
+  if (blockLength <= options_.maxCachedBlockLength) {
+    std::vector<Block>& cached = getThreadCachedBlocks_(sizeClass);
+    // The thread may have moved to another node since it cached them.
+    for (auto iter = cached.rbegin(); iter != cached.rend(); iter++) {
+      if (iter->node == node) {
+        block = *iter;
+        cached.erase(std::next(iter).base());
+        break;
+      }
+    }
+  }
+  if (!block.has_value()) {
+    block = takeBlock_(sizeClass, node);
+  }
+  if (!block.has_value()) {
+    block = growArena_(sizeClass, node);
+  }
+  if (!block.has_value()) {
+    return nullptr;
+  }
+
+  return std::shared_ptr<void>(
+      block->ptr, [self, sizeClass, node{block->node}](void* ptr) {
+        self->giveBackBlock_(sizeClass, Block{ptr, node});
+      });
+}
+
+void BufferPool::Impl::giveBackBlock_(size_t sizeClass, Block block) {
+  if ((kMinBlockLength << sizeClass) <= options_.maxCachedBlockLength &&
+      block.node == currentNode()) {
+    std::vector<Block>& cached = getThreadCachedBlocks_(sizeClass);
+    if (cached.size() < options_.numCachedBlocksPerThread) {
+      cached.push_back(block);
+      return;
+    }
+  }
+  Arena& arena = arenaOfNode_(block.node);
+  std::unique_lock<std::mutex> lock(arena.mutex);
+  arena.freeBlocks[sizeClass].push_back(block);
+}
+
+void BufferPool::Impl::giveBackBlocks_(
+    size_t sizeClass,
+    std::vector<Block>& blocks) {
+  for (const Block& block : blocks) {
+    Arena& arena = arenaOfNode_(block.node);
+    std::unique_lock<std::mutex> lock(arena.mutex);
+    arena.freeBlocks[sizeClass].push_back(block);
+  }
+  blocks.clear();
+}
+
+optional<Block> BufferPool::Impl::takeBlock_(size_t sizeClass, int node) {
+  Arena& arena = arenaOfNode_(node);
+  std::unique_lock<std::mutex> lock(arena.mutex);
+  std::vector<Block>& freeBlocks = arena.freeBlocks[sizeClass];
+  // Arenas are shared by the nodes that are equal modulo their number.
+  for (auto iter = freeBlocks.rbegin(); iter != freeBlocks.rend(); iter++) {
+    if (iter->node == node) {
+      Block block = *iter;
+      freeBlocks.erase(std::next(iter).base());
+      return block;
+    }
+  }
+  return nullopt;
+}
+
+optional<Block> BufferPool::Impl::growArena_(size_t sizeClass, int node) {
+  const size_t blockLength = kMinBlockLength << sizeClass;
+  const size_t slabLength =
+      std::max(roundUpToPowerOfTwo(options_.slabLength), blockLength);
+
+  // Huge pages must often be reserved beforehand, hence they're only an
+  // optimization, like binding to the node.
+  void* ptr = MAP_FAILED;
+  if (options_.useHugePages && slabLength % kHugePageLength == 0) {
+    ptr = ::mmap(
+        nullptr,
+        slabLength,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+        -1,
+        0);
+  }
+  if (ptr == MAP_FAILED) {
+    ptr = ::mmap(
+        nullptr,
+        slabLength,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (ptr == MAP_FAILED) {
+      TP_LOG_WARNING() << "Buffer pool couldn't map " << slabLength
+                       << " bytes: " << ::strerror(errno);
+      return nullopt;
+    }
+#ifdef MADV_HUGEPAGE
+    if (options_.useHugePages) {
+      ::madvise(ptr, slabLength, MADV_HUGEPAGE);
+    }
+#endif
+  }
+  if (node >= 0) {
+    bindMemoryToNumaNode(ptr, slabLength, node);
+  }
+
+  // Registering may be slow, hence it's done outside of the arena's lock.
+  {
+    std::unique_lock<std::mutex> lock(slabsMutex_);
+    Slab slab{ptr, slabLength, {}};
+    for (const auto& weakContext : contexts_) {
+      std::shared_ptr<Context> context = weakContext.lock();
+      if (context != nullptr) {
+        slab.handles.push_back(
+            context->registerBuffer(CpuBuffer{ptr, slabLength}));
+      }
+    }
+    slabs_.push_back(std::move(slab));
+  }
+
+  Arena& arena = arenaOfNode_(node);
+  std::unique_lock<std::mutex> lock(arena.mutex);
+  std::vector<Block>& freeBlocks = arena.freeBlocks[sizeClass];
+  for (size_t offset = slabLength - blockLength; offset > 0;
+       offset -= blockLength) {
+    freeBlocks.push_back(Block{static_cast<uint8_t*>(ptr) + offset, node});
+  }
+  return Block{ptr, node};
+}
+
+void BufferPool::Impl::registerWith(const std::shared_ptr<Context>& context) {
+  std::unique_lock<std::mutex> lock(slabsMutex_);
+  for (Slab& slab : slabs_) {
+    slab.handles.push_back(
+        context->registerBuffer(CpuBuffer{slab.ptr, slab.length}));
+  }
+  contexts_.push_back(context);
+}
+
+BufferPool::Impl::~Impl() {
+  for (Slab& slab : slabs_) {
+    slab.handles.clear();
+    ::munmap(slab.ptr, slab.length);
+  }
+}
+
+BufferPool::BufferPool(Options options)
+    : impl_(std::make_shared<Impl>(std::move(options))) {}
+
+BufferPool::BufferPool() : BufferPool(Options()) {}
+
+std::shared_ptr<void> BufferPool::allocate(size_t length) {
+  return impl_->allocate(length);
+}
+
+ContextOptions::allocator_fn BufferPool::allocator() {
+  return [impl{impl_}](Message& message) {
+    for (const Message::Tensor& tensor : message.tensors) {
+      if (tensor.buffer.type != DeviceType::kCpu) {
+        return false;
+      }
+    }
+    // The blocks are only given to the message once they've all been obtained.
+    std::vector<std::shared_ptr<void>> payloadOwners(message.payloads.size());
+    std::vector<std::shared_ptr<void>> tensorOwners(message.tensors.size());
+    for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+         payloadIdx++) {
+      const Message::Payload& payload = message.payloads[payloadIdx];
+      // Duplicates are given the memory of the payload they duplicate.
+      if (payload.length == 0 || payload.duplicateOf.has_value()) {
+        continue;
+      }
+      payloadOwners[payloadIdx] = impl->allocate(payload.length);
+      if (payloadOwners[payloadIdx] == nullptr) {
+        return false;
+      }
+    }
+    for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+         tensorIdx++) {
+      const Message::Tensor& tensor = message.tensors[tensorIdx];
+      if (tensor.buffer.cpu.length == 0 || tensor.duplicateOf.has_value()) {
+        continue;
+      }
+      tensorOwners[tensorIdx] = impl->allocate(tensor.buffer.cpu.length);
+      if (tensorOwners[tensorIdx] == nullptr) {
+        return false;
+      }
+    }
+    for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+         payloadIdx++) {
+      if (payloadOwners[payloadIdx] != nullptr) {
+        Message::Payload& payload = message.payloads[payloadIdx];
+        payload.data = payloadOwners[payloadIdx].get();
+        payload.owner = std::move(payloadOwners[payloadIdx]);
+      }
+    }
+    for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+         tensorIdx++) {
+      if (tensorOwners[tensorIdx] != nullptr) {
+        Message::Tensor& tensor = message.tensors[tensorIdx];
+        tensor.buffer = CpuBuffer{
+            tensorOwners[tensorIdx].get(), tensor.buffer.cpu.length};
+        tensor.owner = std::move(tensorOwners[tensorIdx]);
+      }
+    }
+    return true;
+  };
+}
+
+void BufferPool::registerWith(const std::shared_ptr<Context>& context) {
+  impl_->registerWith(context);
+}
+
+BufferPool::~BufferPool() = default;
+
+} // namespace tensorpipe
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include <tensorpipe/core/context.h>
+
+namespace tensorpipe {
+
+// A ready-made pool of host memory for the payloads and tensors of incoming
+// messages, which can serve as the allocator of a context, so that receiving no
+// longer allocates once the pool has warmed up. Blocks come in power-of-two
+// size classes, carved out of slabs that are mapped, and bound, on the NUMA
+// node of the thread that needs them (i.e., for the allocator, the pipe's loop,
+// which is also the one that writes the data), and optionally backed by huge
+// pages. Each thread keeps a few free blocks of each small class for itself,
+// and returns the others to the arena of their node. A block is handed out as a
+// shared pointer, which gives it back to the pool once the last reference to it
+// is dropped (e.g., when the user destroys the message that owns it), and which
+// keeps the pool's memory alive until then, even past the pool's destruction.
+class BufferPool final {
+ public:
+  struct Options {
+    // Blocks longer than this aren't pooled, and the allocator leaves the
+    // messages that need them to the user.
+    size_t maxBlockLength{256 * 1024 * 1024};
+    // The memory of the shorter blocks is mapped this much at a time.
+    size_t slabLength{2 * 1024 * 1024};
+    // Back the slabs with huge pages if there are enough free ones, and
+    // otherwise ask for transparent huge pages.
+    bool useHugePages{false};
+    // How many free blocks of each class up to maxCachedBlockLength each thread
+    // keeps for itself.
+    size_t numCachedBlocksPerThread{8};
+    size_t maxCachedBlockLength{1024 * 1024};
+  };
+
+  explicit BufferPool(Options options);
+
+  BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  // Return a block of at least the given length, which owns its memory, or
+  // null if it's longer than the maximum or the memory couldn't be mapped.
+  std::shared_ptr<void> allocate(size_t length);
+
+  // An allocator for ContextOptions, which gives blocks of the pool to all the
+  // payloads and tensors of a message, and their ownership to the message. It
+  // declines the messages that have CUDA tensors or blocks that are too long.
+  ContextOptions::allocator_fn allocator();
+
+  // Have the channels of the context that can (e.g., InfiniBand) register the
+  // pool's memory ahead of time, both the slabs that were already mapped and
+  // those mapped afterwards (see Context::registerBuffer). The pool only holds
+  // a weak reference to the context.
+  void registerWith(const std::shared_ptr<Context>& context);
+
+  ~BufferPool();
+
+ private:
+  class Impl;
+
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/channel_router.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+void ChannelRouter::addChannel(std::string name) {
+  channelNames_.push_back(std::move(name));
+  for (Bucket& bucket : buckets_) {
+    bucket.channelStats.emplace_back();
+  }
+}
+
+bool ChannelRouter::hasChannels() const {
+  return !channelNames_.empty();
+}
+
+const std::string& ChannelRouter::select(
+    size_t length,
+    const std::string& fixedChoice) {
+  TP_DCHECK(hasChannels());
+  Bucket& bucket = bucket_(length);
+  if (bucket.currentChoice.empty()) {
+    bucket.currentChoice = fixedChoice;
+  }
+
+  for (size_t idx = 0; idx < channelNames_.size(); idx++) {
+    ChannelStats& stats = bucket.channelStats[idx];
+    if (stats.numSelected < kNumCalibrationTransfers) {
+      stats.numSelected++;
+      return channelNames_[idx];
+    }
+  }
+
+  if (++bucket.numTransfersSinceProbe >= kProbePeriod &&
+      channelNames_.size() > 1) {
+    bucket.numTransfersSinceProbe = 0;
+    size_t idx = bucket.nextChannelToProbe;
+    bucket.nextChannelToProbe = (idx + 1) % channelNames_.size();
+    if (channelNames_[idx] != bucket.currentChoice) {
+      bucket.channelStats[idx].numSelected++;
+      return channelNames_[idx];
+    }
+  }
+
+  size_t idx = channelIdx_(bucket.currentChoice);
+  bucket.channelStats[idx].numSelected++;
+  return channelNames_[idx];
+}
+
+void ChannelRouter::record(
+    const std::string& name,
+    size_t length,
+    TDuration duration) {
+  size_t bucketIdx = bucketIdx_(length);
+  ChannelStats& stats = buckets_[bucketIdx].channelStats[channelIdx_(name)];
+  double nanoseconds =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+  if (stats.numRecorded == 0) {
+    stats.avgNanoseconds = nanoseconds;
+  } else {
+    stats.avgNanoseconds = kSmoothingFactor * nanoseconds +
+        (1 - kSmoothingFactor) * stats.avgNanoseconds;
+  }
+  stats.numRecorded++;
+  maybeSwitch_(bucketIdx);
+}
+
+std::map<size_t, std::string> ChannelRouter::getRoutingTable() const {
+  std::map<size_t, std::string> table;
+  for (size_t idx = 0; idx < buckets_.size(); idx++) {
+    if (buckets_[idx].currentChoice.empty()) {
+      continue;
+    }
+    size_t maxLength = idx < std::numeric_limits<size_t>::digits
+        ? static_cast<size_t>(1) << idx
+        : std::numeric_limits<size_t>::max();
+    table.emplace(maxLength, buckets_[idx].currentChoice);
+  }
+  return table;
+}
+
+size_t ChannelRouter::channelIdx_(const std::string& name) const {
+  auto iter = std::find(channelNames_.begin(), channelNames_.end(), name);
+  TP_DCHECK(iter != channelNames_.end());
+  return iter - channelNames_.begin();
+}
+
+size_t ChannelRouter::bucketIdx_(size_t length) {
+  // The smallest idx such that length <= 2^idx.
+  size_t idx = 0;
+  while (idx < std::numeric_limits<size_t>::digits &&
+         (static_cast<size_t>(1) << idx) < length) {
+    idx++;
+  }
+  return idx;
+}
+
+ChannelRouter::Bucket& ChannelRouter::bucket_(size_t length) {
+  return buckets_[bucketIdx_(length)];
+}
+
+void ChannelRouter::maybeSwitch_(size_t bucketIdx) {
+  Bucket& bucket = buckets_[bucketIdx];
+  if (bucket.currentChoice.empty()) {
+    return;
+  }
+  size_t currentIdx = channelIdx_(bucket.currentChoice);
+  const ChannelStats& currentStats = bucket.channelStats[currentIdx];
+
+  size_t bestIdx = currentIdx;
+  for (size_t idx = 0; idx < channelNames_.size(); idx++) {
+    const ChannelStats& stats = bucket.channelStats[idx];
+    if (stats.numRecorded == 0) {
+      continue;
+    }
+    const ChannelStats& bestStats = bucket.channelStats[bestIdx];
+    if (bestStats.numRecorded == 0 ||
+        stats.avgNanoseconds < bestStats.avgNanoseconds) {
+      bestIdx = idx;
+    }
+  }
+
+  if (bestIdx == currentIdx) {
+    return;
+  }
+  const ChannelStats& bestStats = bucket.channelStats[bestIdx];
+  if (currentStats.numRecorded > 0 &&
+      bestStats.avgNanoseconds * kHysteresisFactor >=
+          currentStats.avgNanoseconds) {
+    return;
+  }
+  TP_VLOG(2) << "Channel router is switching tensors of up to 2^" << bucketIdx
+             << " bytes from channel " << bucket.currentChoice << " ("
+             << currentStats.avgNanoseconds << "ns) to channel "
+             << channelNames_[bestIdx] << " (" << bestStats.avgNanoseconds
+             << "ns)";
+  bucket.currentChoice = channelNames_[bestIdx];
+}
+
+} // namespace tensorpipe
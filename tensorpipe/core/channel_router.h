@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace tensorpipe {
+
+// Learns, from the transfers of a pipe, which of its channels is the fastest
+// for each range of tensor lengths, rather than relying on static priorities,
+// which depend on the hardware and the configuration of the hosts.
+//
+// Lengths are grouped in power-of-two buckets. In each bucket all channels are
+// first tried a few times, after which the fastest one is used, with another
+// one still being tried once in a while in case conditions change. Switching
+// to a different channel requires it to be significantly faster than the
+// current one, to avoid flip-flopping between channels that perform similarly.
+class ChannelRouter {
+ public:
+  using TDuration = std::chrono::steady_clock::duration;
+
+  // Channels must be added, from the one with the highest priority to the one
+  // with the lowest, before any other method is called.
+  void addChannel(std::string name);
+
+  bool hasChannels() const;
+
+  // Return which channel to send a tensor of the given length over. The fixed
+  // choice is the one that static priorities would have made, and is selected
+  // until measurements show otherwise.
+  const std::string& select(size_t length, const std::string& fixedChoice);
+
+  // Report how long the transfer of a tensor of the given length took.
+  void record(const std::string& name, size_t length, TDuration duration);
+
+  // Return, for the buckets where at least one tensor was sent, the maximum
+  // tensor length of the bucket and the channel that is currently selected.
+  std::map<size_t, std::string> getRoutingTable() const;
+
+ private:
+  // Each channel is tried this many times per bucket before the routing is
+  // decided, and then again once in this many transfers.
+  static constexpr uint64_t kNumCalibrationTransfers = 4;
+  static constexpr uint64_t kProbePeriod = 128;
+  // The weight of a new measurement in the exponential moving average.
+  static constexpr double kSmoothingFactor = 0.25;
+  // How much faster a channel must be in order to replace the current one.
+  static constexpr double kHysteresisFactor = 1.25;
+
+  struct ChannelStats {
+    uint64_t numSelected{0};
+    uint64_t numRecorded{0};
+    double avgNanoseconds{0};
+  };
+
+  struct Bucket {
+    // Empty until the first tensor in the bucket is sent.
+    std::string currentChoice;
+    std::vector<ChannelStats> channelStats;
+    uint64_t numTransfersSinceProbe{0};
+    size_t nextChannelToProbe{0};
+  };
+
+  std::vector<std::string> channelNames_;
+  std::array<Bucket, 65> buckets_;
+
+  size_t channelIdx_(const std::string& name) const;
+  static size_t bucketIdx_(size_t length);
+  Bucket& bucket_(size_t length);
+  void maybeSwitch_(size_t bucketIdx);
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/collectives.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/core/error.h>
+
+namespace tensorpipe {
+
+class Communicator::Impl : public std::enable_shared_from_this<Impl> {
+ public:
+  Impl(
+      size_t rank,
+      std::vector<std::shared_ptr<Pipe>> pipes,
+      size_t chunkLength);
+
+  void init();
+
+  size_t getRank() const {
+    return rank_;
+  }
+
+  size_t getWorldSize() const {
+    return pipes_.size();
+  }
+
+  Error allReduce(
+      CpuBuffer buffer,
+      ReduceDataType dataType,
+      ReduceOp op,
+      CollectiveAlgorithm algorithm);
+
+  Error allGather(CpuBuffer input, CpuBuffer output);
+
+  Error broadcast(CpuBuffer buffer, size_t root);
+
+  void close();
+
+ private:
+  const size_t rank_;
+  const std::vector<std::shared_ptr<Pipe>> pipes_;
+  const size_t chunkLength_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // For each peer, the chunks that arrived and haven't been used yet, and the
+  // error of its pipe, if it failed.
+  std::vector<std::deque<Message>> incomingChunks_;
+  std::vector<Error> pipeErrors_;
+  size_t numPendingWrites_{0};
+  Error writeError_;
+
+  // Once an operation fails, the ranks may not agree anymore on which chunk is
+  // which, hence all the later operations fail too.
+  Error error_;
+
+  void onDescriptor_(size_t peer, const Error& error, Message message);
+  void onChunk_(size_t peer, const Error& error, Message message);
+
+  // The chunks that are sent must remain valid until waitForWrites_ returns.
+  void sendChunk_(size_t peer, uint8_t* ptr, size_t length);
+  void sendChunks_(size_t peer, uint8_t* ptr, size_t length, size_t step);
+  Error receiveChunk_(size_t peer, size_t length, Message& message);
+  Error waitForWrites_();
+
+  // Run the operation and then wait for its writes, even if it failed, as they
+  // refer to the user's buffers.
+  template <typename TFn>
+  Error runOperation_(TFn fn);
+
+  Error ringAllReduce_(
+      uint8_t* data,
+      size_t numValues,
+      ReduceDataType dataType,
+      ReduceOp op);
+  Error treeAllReduce_(
+      uint8_t* data,
+      size_t numValues,
+      ReduceDataType dataType,
+      ReduceOp op);
+  Error treeBroadcast_(uint8_t* data, size_t length, size_t root);
+
+  // The parent (if any) and the children of this rank in the binary tree with
+  // the given root.
+  void getTreeNeighbors_(
+      size_t root,
+      optional<size_t>& parent,
+      std::vector<size_t>& children) const;
+};
+
+Communicator::Impl::Impl(
+    size_t rank,
+    std::vector<std::shared_ptr<Pipe>> pipes,
+    size_t chunkLength)
+    : rank_(rank),
+      pipes_(std::move(pipes)),
+      chunkLength_(chunkLength),
+      incomingChunks_(pipes_.size()),
+      pipeErrors_(pipes_.size()) {
+  TP_THROW_ASSERT_IF(rank_ >= pipes_.size())
+      << "Rank " << rank_ << " is out of range for " << pipes_.size()
+      << " ranks";
+  TP_THROW_ASSERT_IF(chunkLength_ == 0) << "The chunk length can't be zero";
+  for (size_t peer = 0; peer < pipes_.size(); peer++) {
+    TP_THROW_ASSERT_IF(peer != rank_ && pipes_[peer] == nullptr)
+        << "Missing the pipe to rank " << peer;
+  }
+}
+
+void Communicator::Impl::init() {
+  for (size_t peer = 0; peer < pipes_.size(); peer++) {
+    if (peer == rank_) {
+      continue;
+    }
+    pipes_[peer]->readDescriptors(
+        [impl{shared_from_this()}, peer](const Error& error, Message message) {
+          impl->onDescriptor_(peer, error, std::move(message));
+        });
+  }
+}
+
+void Communicator::Impl::onDescriptor_(
+    size_t peer,
+    const Error& error,
+    Message message) {
+  if (error) {
+    onChunk_(peer, error, Message());
+    return;
+  }
+  // The tensors are left with a null pointer for the pipe to allocate them.
+  pipes_[peer]->read(
+      std::move(message),
+      [impl{shared_from_this()}, peer](const Error& error, Message message) {
+        impl->onChunk_(peer, error, std::move(message));
+      });
+}
+
+void Communicator::Impl::onChunk_(
+    size_t peer,
+    const Error& error,
+    Message message) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (error) {
+    if (!pipeErrors_[peer]) {
+      pipeErrors_[peer] = error;
+    }
+  } else {
+    incomingChunks_[peer].push_back(std::move(message));
+  }
+  cv_.notify_all();
+}
+
+void Communicator::Impl::sendChunk_(size_t peer, uint8_t* ptr, size_t length) {
+  Message message;
+  message.tensors.push_back(Message::Tensor{CpuBuffer{ptr, length}});
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    ++numPendingWrites_;
+  }
+  pipes_[peer]->write(
+      std::move(message),
+      [impl{shared_from_this()}](const Error& error, Message /* unused */) {
+        std::unique_lock<std::mutex> lock(impl->mutex_);
+        --impl->numPendingWrites_;
+        if (error && !impl->writeError_) {
+          impl->writeError_ = error;
+        }
+        impl->cv_.notify_all();
+      });
+}
+
+void Communicator::Impl::sendChunks_(
+    size_t peer,
+    uint8_t* ptr,
+    size_t length,
+    size_t step) {
+  for (size_t offset = 0; offset < length; offset += step) {
+    sendChunk_(peer, ptr + offset, std::min(step, length - offset));
+  }
+}
+
+Error Communicator::Impl::receiveChunk_(
+    size_t peer,
+    size_t length,
+    Message& message) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&]() {
+    return !incomingChunks_[peer].empty() || pipeErrors_[peer];
+  });
+  if (incomingChunks_[peer].empty()) {
+    return pipeErrors_[peer];
+  }
+  message = std::move(incomingChunks_[peer].front());
+  incomingChunks_[peer].pop_front();
+  if (message.tensors.size() != 1 ||
+      message.tensors[0].buffer.type != DeviceType::kCpu ||
+      message.tensors[0].buffer.cpu.length != length) {
+    return TP_CREATE_ERROR(
+        LogicError,
+        "rank " + std::to_string(peer) +
+            " sent a chunk that doesn't match the operation");
+  }
+  return Error::kSuccess;
+}
+
+Error Communicator::Impl::waitForWrites_() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [&]() { return numPendingWrites_ == 0; });
+  return writeError_;
+}
+
+template <typename TFn>
+Error Communicator::Impl::runOperation_(TFn fn) {
+  if (error_) {
+    return error_;
+  }
+  Error error = fn();
+  Error writeError = waitForWrites_();
+  if (!error) {
+    error = writeError;
+  }
+  if (error) {
+    error_ = error;
+  }
+  return error;
+}
+
+Error Communicator::Impl::allReduce(
+    CpuBuffer buffer,
+    ReduceDataType dataType,
+    ReduceOp op,
+    CollectiveAlgorithm algorithm) {
+  TP_THROW_ASSERT_IF(isSegmented(buffer))
+      << "Collectives don't support segmented buffers";
+  const size_t valueSize = reduceDataTypeSize(dataType);
+  TP_THROW_ASSERT_IF(buffer.length % valueSize != 0)
+      << "The length of the buffer isn't a multiple of the size of its values";
+  uint8_t* data = reinterpret_cast<uint8_t*>(buffer.ptr);
+  const size_t numValues = buffer.length / valueSize;
+  return runOperation_([&]() {
+    switch (algorithm) {
+      case CollectiveAlgorithm::kRing:
+        return ringAllReduce_(data, numValues, dataType, op);
+      case CollectiveAlgorithm::kTree:
+        return treeAllReduce_(data, numValues, dataType, op);
+    }
+    TP_THROW_ASSERT() << "Unknown algorithm";
+    // Dummy return to make the compiler happy.
+    return Error::kSuccess;
+  });
+}
+
+// The buffer is split in as many segments as there are ranks. In the first
+// phase (a reduce-scatter), each rank sends one segment to the next rank,
+// which reduces it with its own and sends it on, until each rank has the full
+// reduction of one segment. In the second phase (an all-gather), these fully
+// reduced segments travel around the ring in the same way, each rank copying
+// them in place of its own.
+Error Communicator::Impl::ringAllReduce_(
+    uint8_t* data,
+    size_t numValues,
+    ReduceDataType dataType,
+    ReduceOp op) {
+  const size_t worldSize = getWorldSize();
+  if (worldSize == 1) {
+    return Error::kSuccess;
+  }
+  const size_t valueSize = reduceDataTypeSize(dataType);
+  const size_t step = std::max<size_t>(chunkLength_ / valueSize, 1) * valueSize;
+  const size_t next = (rank_ + 1) % worldSize;
+  const size_t prev = (rank_ + worldSize - 1) % worldSize;
+  auto segmentBegin = [&](size_t segment) {
+    return numValues * segment / worldSize * valueSize;
+  };
+  auto segmentEnd = [&](size_t segment) {
+    return numValues * (segment + 1) / worldSize * valueSize;
+  };
+
+  sendChunks_(
+      next,
+      data + segmentBegin(rank_),
+      segmentEnd(rank_) - segmentBegin(rank_),
+      step);
+  for (size_t stepIdx = 0; stepIdx + 1 < worldSize; stepIdx++) {
+    const size_t segment = (rank_ + worldSize - stepIdx - 1) % worldSize;
+    for (size_t offset = segmentBegin(segment); offset < segmentEnd(segment);
+         offset += step) {
+      const size_t length = std::min(step, segmentEnd(segment) - offset);
+      Message message;
+      Error error = receiveChunk_(prev, length, message);
+      if (error) {
+        return error;
+      }
+      reduce(
+          op,
+          dataType,
+          data + offset,
+          message.tensors[0].buffer.cpu.ptr,
+          length / valueSize);
+      // Once it has been reduced, the chunk is for the next step.
+      if (stepIdx + 2 < worldSize) {
+        sendChunk_(next, data + offset, length);
+      }
+    }
+  }
+
+  // The segments that were sent are about to be overwritten.
+  Error error = waitForWrites_();
+  if (error) {
+    return error;
+  }
+
+  const size_t reducedSegment = (rank_ + 1) % worldSize;
+  sendChunks_(
+      next,
+      data + segmentBegin(reducedSegment),
+      segmentEnd(reducedSegment) - segmentBegin(reducedSegment),
+      step);
+  for (size_t stepIdx = 0; stepIdx + 1 < worldSize; stepIdx++) {
+    const size_t segment = (rank_ + worldSize - stepIdx) % worldSize;
+    for (size_t offset = segmentBegin(segment); offset < segmentEnd(segment);
+         offset += step) {
+      const size_t length = std::min(step, segmentEnd(segment) - offset);
+      Message message;
+      Error error = receiveChunk_(prev, length, message);
+      if (error) {
+        return error;
+      }
+      std::memcpy(data + offset, message.tensors[0].buffer.cpu.ptr, length);
+      if (stepIdx + 2 < worldSize) {
+        sendChunk_(next, data + offset, length);
+      }
+    }
+  }
+
+  return Error::kSuccess;
+}
+
+// Each chunk is reduced up the tree towards rank 0 and then broadcast back
+// down it.
+Error Communicator::Impl::treeAllReduce_(
+    uint8_t* data,
+    size_t numValues,
+    ReduceDataType dataType,
+    ReduceOp op) {
+  const size_t valueSize = reduceDataTypeSize(dataType);
+  const size_t length = numValues * valueSize;
+  const size_t step = std::max<size_t>(chunkLength_ / valueSize, 1) * valueSize;
+  optional<size_t> parent;
+  std::vector<size_t> children;
+  getTreeNeighbors_(/*root=*/0, parent, children);
+
+  for (size_t offset = 0; offset < length; offset += step) {
+    const size_t chunkLength = std::min(step, length - offset);
+    for (size_t child : children) {
+      Message message;
+      Error error = receiveChunk_(child, chunkLength, message);
+      if (error) {
+        return error;
+      }
+      reduce(
+          op,
+          dataType,
+          data + offset,
+          message.tensors[0].buffer.cpu.ptr,
+          chunkLength / valueSize);
+    }
+    if (parent.has_value()) {
+      sendChunk_(parent.value(), data + offset, chunkLength);
+    }
+  }
+
+  // The chunks that were sent are about to be overwritten.
+  Error error = waitForWrites_();
+  if (error) {
+    return error;
+  }
+
+  return treeBroadcast_(data, length, /*root=*/0);
+}
+
+Error Communicator::Impl::allGather(CpuBuffer input, CpuBuffer output) {
+  TP_THROW_ASSERT_IF(isSegmented(input) || isSegmented(output))
+      << "Collectives don't support segmented buffers";
+  const size_t worldSize = getWorldSize();
+  const size_t blockLength = input.length;
+  TP_THROW_ASSERT_IF(output.length != blockLength * worldSize)
+      << "The output buffer must be " << worldSize
+      << " times as large as the input one";
+  uint8_t* data = reinterpret_cast<uint8_t*>(output.ptr);
+  if (input.ptr != data + rank_ * blockLength) {
+    std::memcpy(data + rank_ * blockLength, input.ptr, blockLength);
+  }
+  if (worldSize == 1) {
+    return Error::kSuccess;
+  }
+
+  // As in the second phase of the ring all-reduce, each block travels around
+  // the ring, starting from its rank.
+  return runOperation_([&]() {
+    const size_t next = (rank_ + 1) % worldSize;
+    const size_t prev = (rank_ + worldSize - 1) % worldSize;
+    sendChunks_(next, data + rank_ * blockLength, blockLength, chunkLength_);
+    for (size_t stepIdx = 0; stepIdx + 1 < worldSize; stepIdx++) {
+      const size_t block = (rank_ + worldSize - stepIdx - 1) % worldSize;
+      uint8_t* blockData = data + block * blockLength;
+      for (size_t offset = 0; offset < blockLength; offset += chunkLength_) {
+        const size_t length = std::min(chunkLength_, blockLength - offset);
+        Message message;
+        Error error = receiveChunk_(prev, length, message);
+        if (error) {
+          return error;
+        }
+        std::memcpy(
+            blockData + offset, message.tensors[0].buffer.cpu.ptr, length);
+        if (stepIdx + 2 < worldSize) {
+          sendChunk_(next, blockData + offset, length);
+        }
+      }
+    }
+    return Error::kSuccess;
+  });
+}
+
+Error Communicator::Impl::broadcast(CpuBuffer buffer, size_t root) {
+  TP_THROW_ASSERT_IF(isSegmented(buffer))
+      << "Collectives don't support segmented buffers";
+  TP_THROW_ASSERT_IF(root >= getWorldSize())
+      << "Root " << root << " is out of range";
+  uint8_t* data = reinterpret_cast<uint8_t*>(buffer.ptr);
+  return runOperation_(
+      [&]() { return treeBroadcast_(data, buffer.length, root); });
+}
+
+Error Communicator::Impl::treeBroadcast_(
+    uint8_t* data,
+    size_t length,
+    size_t root) {
+  optional<size_t> parent;
+  std::vector<size_t> children;
+  getTreeNeighbors_(root, parent, children);
+
+  for (size_t offset = 0; offset < length; offset += chunkLength_) {
+    const size_t chunkLength = std::min(chunkLength_, length - offset);
+    if (parent.has_value()) {
+      Message message;
+      Error error = receiveChunk_(parent.value(), chunkLength, message);
+      if (error) {
+        return error;
+      }
+      std::memcpy(
+          data + offset, message.tensors[0].buffer.cpu.ptr, chunkLength);
+    }
+    for (size_t child : children) {
+      sendChunk_(child, data + offset, chunkLength);
+    }
+  }
+  return Error::kSuccess;
+}
+
+void Communicator::Impl::getTreeNeighbors_(
+    size_t root,
+    optional<size_t>& parent,
+    std::vector<size_t>& children) const {
+  // The ranks are renumbered so that the root is the first one.
+  const size_t worldSize = getWorldSize();
+  const size_t virtualRank = (rank_ + worldSize - root) % worldSize;
+  if (virtualRank > 0) {
+    parent = ((virtualRank - 1) / 2 + root) % worldSize;
+  }
+  for (size_t virtualChild : {2 * virtualRank + 1, 2 * virtualRank + 2}) {
+    if (virtualChild < worldSize) {
+      children.push_back((virtualChild + root) % worldSize);
+    }
+  }
+}
+
+void Communicator::Impl::close() {
+  for (size_t peer = 0; peer < pipes_.size(); peer++) {
+    if (peer != rank_) {
+      pipes_[peer]->close();
+    }
+  }
+}
+
+Communicator::Communicator(
+    size_t rank,
+    std::vector<std::shared_ptr<Pipe>> pipes,
+    size_t chunkLength)
+    : impl_(std::make_shared<Impl>(rank, std::move(pipes), chunkLength)) {
+  impl_->init();
+}
+
+size_t Communicator::getRank() const {
+  return impl_->getRank();
+}
+
+size_t Communicator::getWorldSize() const {
+  return impl_->getWorldSize();
+}
+
+Error Communicator::allReduce(
+    CpuBuffer buffer,
+    ReduceDataType dataType,
+    ReduceOp op,
+    CollectiveAlgorithm algorithm) {
+  return impl_->allReduce(buffer, dataType, op, algorithm);
+}
+
+Error Communicator::allGather(CpuBuffer input, CpuBuffer output) {
+  return impl_->allGather(input, output);
+}
+
+Error Communicator::broadcast(CpuBuffer buffer, size_t root) {
+  return impl_->broadcast(buffer, root);
+}
+
+void Communicator::close() {
+  impl_->close();
+}
+
+Communicator::~Communicator() {
+  close();
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/cpu_buffer.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/reduce.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+
+enum class CollectiveAlgorithm {
+  // Each rank sends and receives about twice the size of the buffer in total,
+  // in as many steps as there are ranks, which suits large buffers.
+  kRing,
+  // The buffer goes up a binary tree and back down, which takes a logarithmic
+  // number of steps, which suits small buffers.
+  kTree,
+};
+
+// Collective operations among a group of ranks that have a pipe to each other.
+// Every rank must invoke the same operations, in the same order, with buffers
+// of the same size (and the same root, where applicable). The buffers are
+// split in chunks that are sent as tensors, hence over the channels, and that
+// are pipelined: a chunk is forwarded (or reduced) as soon as it arrives, while
+// the next ones are still in flight.
+//
+// The communicator takes the pipes over: it reads all the incoming messages
+// itself, hence nothing else may read from them, and closing the communicator
+// closes the pipes. The operations block until they complete, hence they must
+// not be invoked from within a callback of a pipe. Only CPU buffers are
+// supported.
+class Communicator final {
+ public:
+  static constexpr size_t kDefaultChunkLength = 256 * 1024;
+
+  // The pipes are indexed by rank, and the one of this rank is ignored (and
+  // may be null).
+  Communicator(
+      size_t rank,
+      std::vector<std::shared_ptr<Pipe>> pipes,
+      size_t chunkLength = kDefaultChunkLength);
+
+  Communicator(const Communicator&) = delete;
+  Communicator& operator=(const Communicator&) = delete;
+
+  size_t getRank() const;
+
+  size_t getWorldSize() const;
+
+  // Replace the values of the buffer, on all ranks, with their reduction across
+  // all ranks.
+  Error allReduce(
+      CpuBuffer buffer,
+      ReduceDataType dataType,
+      ReduceOp op,
+      CollectiveAlgorithm algorithm = CollectiveAlgorithm::kRing);
+
+  // Fill the output buffer, which must be as many times larger than the input
+  // one as there are ranks, with the input buffers of all ranks, by rank.
+  Error allGather(CpuBuffer input, CpuBuffer output);
+
+  // Replace the content of the buffer, on all ranks, with that of the root.
+  Error broadcast(CpuBuffer buffer, size_t root);
+
+  void close();
+
+  ~Communicator();
+
+ private:
+  class Impl;
+
+  // Using a shared_ptr allows the callbacks to keep the implementation alive
+  // after the public object is destroyed.
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/completion_queue.h>
+
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/fd.h>
+
+namespace tensorpipe {
+
+class CompletionQueue::Impl {
+ public:
+  void push(Completion completion);
+
+  size_t poll(std::vector<Completion>& completions, size_t maxNumCompletions);
+
+  size_t wait(std::vector<Completion>& completions, size_t maxNumCompletions);
+
+  int getEventFd();
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Completion> completions_;
+  // A copy of the size of the deque, which can be checked without the lock.
+  std::atomic<size_t> numCompletions_{0};
+  // Only created if asked for, and then kept readable while there are
+  // completions, by writing to it when the first one arrives and reading from
+  // it once the last one is taken.
+  Fd eventFd_;
+  bool isEventFdSignaled_{false};
+
+  size_t popLocked_(std::vector<Completion>& completions, size_t maxNum);
+  void updateEventFdLocked_();
+};
+
+CompletionQueue::CompletionQueue() : impl_(std::make_shared<Impl>()) {}
+
+CompletionQueue::callback_fn CompletionQueue::makeCallback(uint64_t tag) {
+  return [impl{impl_}, tag](const Error& error, Message message) {
+    impl->push(Completion{tag, error, std::move(message)});
+  };
+}
+
+size_t CompletionQueue::poll(
+    std::vector<Completion>& completions,
+    size_t maxNumCompletions) {
+  return impl_->poll(completions, maxNumCompletions);
+}
+
+size_t CompletionQueue::wait(
+    std::vector<Completion>& completions,
+    size_t maxNumCompletions) {
+  return impl_->wait(completions, maxNumCompletions);
+}
+
+int CompletionQueue::getEventFd() {
+  return impl_->getEventFd();
+}
+
+CompletionQueue::~CompletionQueue() = default;
+
+void CompletionQueue::Impl::push(Completion completion) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  completions_.push_back(std::move(completion));
+  numCompletions_.store(completions_.size(), std::memory_order_release);
+  updateEventFdLocked_();
+  cv_.notify_all();
+}
+
+size_t CompletionQueue::Impl::poll(
+    std::vector<Completion>& completions,
+    size_t maxNumCompletions) {
+  if (maxNumCompletions == 0 ||
+      numCompletions_.load(std::memory_order_acquire) == 0) {
+    return 0;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  return popLocked_(completions, maxNumCompletions);
+}
+
+size_t CompletionQueue::Impl::wait(
+    std::vector<Completion>& completions,
+    size_t maxNumCompletions) {
+  if (maxNumCompletions == 0) {
+    return 0;
+  }
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (completions_.empty()) {
+    cv_.wait(lock);
+  }
+  return popLocked_(completions, maxNumCompletions);
+}
+
+size_t CompletionQueue::Impl::popLocked_(
+    std::vector<Completion>& completions,
+    size_t maxNum) {
+  const size_t num = std::min(maxNum, completions_.size());
+  for (size_t idx = 0; idx < num; idx++) {
+    completions.push_back(std::move(completions_.front()));
+    completions_.pop_front();
+  }
+  numCompletions_.store(completions_.size(), std::memory_order_release);
+  updateEventFdLocked_();
+  return num;
+}
+
+int CompletionQueue::Impl::getEventFd() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!eventFd_.hasValue()) {
+    int fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    TP_THROW_SYSTEM_IF(fd < 0, errno);
+    eventFd_ = Fd(fd);
+    updateEventFdLocked_();
+  }
+  return eventFd_.fd();
+}
+
+void CompletionQueue::Impl::updateEventFdLocked_() {
+  if (!eventFd_.hasValue()) {
+    return;
+  }
+  uint64_t value = 1;
+  if (!completions_.empty() && !isEventFdSignaled_) {
+    TP_THROW_SYSTEM_IF(eventFd_.write(&value, sizeof(value)) < 0, errno);
+    isEventFdSignaled_ = true;
+  } else if (completions_.empty() && isEventFdSignaled_) {
+    TP_THROW_SYSTEM_IF(eventFd_.read(&value, sizeof(value)) < 0, errno);
+    isEventFdSignaled_ = false;
+  }
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/core/message.h>
+
+namespace tensorpipe {
+
+// A queue into which pipes can deliver the completions of their operations,
+// for the user's own threads to retrieve them in batches, rather than having
+// the pipes' internal loops invoke user code, which delays their other work.
+class CompletionQueue final {
+ public:
+  struct Completion {
+    // The tag given to makeCallback, which tells the operations apart.
+    uint64_t tag;
+    Error error;
+    // The message that would have been passed to the callback.
+    Message message;
+  };
+
+  using callback_fn = Function<void(const Error&, Message)>;
+
+  CompletionQueue();
+
+  // Return a callback to pass to a pipe's readDescriptor, read or write. Once
+  // the operation completes, it appends a completion with the given tag to the
+  // queue. The queue may be destroyed before the callback is invoked.
+  callback_fn makeCallback(uint64_t tag);
+
+  // Move up to the given number of completions, in the order in which they
+  // were appended, to the end of the vector, returning how many were moved.
+  // This never blocks, and doesn't even need a lock if the queue is empty.
+  size_t poll(std::vector<Completion>& completions, size_t maxNumCompletions);
+
+  // Like poll, but if the queue is empty wait until it isn't anymore.
+  size_t wait(std::vector<Completion>& completions, size_t maxNumCompletions);
+
+  // Return a file descriptor (an eventfd, created upon the first call, and
+  // owned by the queue) that is readable for as long as the queue isn't empty,
+  // so that an event loop (e.g., asyncio's) can wait for completions together
+  // with its other events, and then poll all those that arrived meanwhile.
+  int getEventFd();
+
+  ~CompletionQueue();
+
+ private:
+  class Impl;
+
+  // Using a shared_ptr allows the callbacks to keep the implementation alive
+  // after the public object is destroyed.
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace tensorpipe
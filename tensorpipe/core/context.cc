@@ -11,18 +11,30 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/common/queue.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/core/buffer_helpers.h>
 #include <tensorpipe/core/context_impl.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/pipe.h>
+#include <tensorpipe/core/traffic_recorder.h>
 #include <tensorpipe/transport/connection.h>
 
 namespace tensorpipe {
@@ -57,12 +69,17 @@ class Context::Impl : public Context::PrivateIface,
   void registerChannel(
       int64_t,
       std::string,
-      std::shared_ptr<channel::Context<TBuffer>>);
+      std::shared_ptr<channel::Context<TBuffer>>,
+      size_t);
 
   std::shared_ptr<Listener> listen(const std::vector<std::string>&);
 
   std::shared_ptr<Pipe> connect(const std::string&, PipeOptions opts);
 
+  void prewarm(const std::string&, size_t numPipes, PipeOptions opts);
+
+  std::shared_ptr<void> registerBuffer(Buffer buffer);
+
   ClosingEmitter& getClosingEmitter() override;
 
   std::shared_ptr<transport::Context> getTransport(const std::string&) override;
@@ -86,8 +103,82 @@ class Context::Impl : public Context::PrivateIface,
 
   const std::string& getName() override;
 
+  size_t getInlineTensorThreshold() override;
+
+  size_t getTensorPackingThreshold() override;
+
+  bool getEarlyMessageDescriptors() override;
+
+  bool getOutOfOrderCompletion() override;
+
+  size_t getNumPriorityClasses() override;
+
+  size_t getWriteCoalescingLimit() override;
+
+  bool getDescriptorStringInterning() override;
+
+  bool getCompactMessageDescriptors() override;
+
+  bool getDeduplicateBuffers() override;
+
+  bool getChannelAutoTuning() override;
+
+  size_t getPayloadChunkSize() override;
+
+  bool getLazyChannelEstablishment() override;
+
+  bool getSpeculativeChannelConnections() override;
+
+  bool getTransportUpgrade() override;
+
+  const ContextOptions::executor_fn& getCallbackExecutor() override;
+
+  size_t getMaxOutstandingWritesPerPipe() override;
+
+  size_t getMaxOutstandingWriteBytesPerPipe() override;
+
+  size_t getMaxOutstandingWriteBytes() override;
+
+  bool reserveWriteBytes(size_t numBytes, Function<void()> fn) override;
+
+  void releaseWriteBytes(size_t numBytes) override;
+
+  TokenBucket& getWriteRateLimiter() override;
+
+  void waitForWriteRate(
+      TokenBucket::clock::duration delay,
+      Function<void()> fn) override;
+
+  void setWriteRateLimit(double bytesPerSecond, size_t burstBytes);
+
+  const ContextOptions::allocator_fn& getAllocator() override;
+
+  bool reserveAllocatorBytes(size_t numBytes) override;
+
+  void releaseAllocatorBytes(size_t numBytes) override;
+
+  std::shared_ptr<MemoryCounter> getStagingMemory() override;
+
+  std::shared_ptr<MemoryCounter> getOperationMemory() override;
+
+  bool isOverMemorySoftLimit() override;
+
+  void registerPipeCounters(std::shared_ptr<PipeCounters> counters) override;
+
+  void registerPipeStateDumper(
+      std::string id,
+      std::weak_ptr<PipeStateDumper> dumper) override;
+
+  TrafficRecorder* getTrafficRecorder() override;
+
+  ContextStats getStats();
+
+  std::string dumpState(std::chrono::milliseconds timeout);
+
   void close();
 
+  void closeFast();
+
   void join();
 
   ~Impl() override = default;
@@ -114,6 +205,95 @@ class Context::Impl : public Context::PrivateIface,
   // identify the endpoints of a pipe.
   std::string name_;
 
+  // The size up to which CPU tensors are sent over the pipe's connection.
+  const size_t inlineTensorThreshold_;
+
+  // The size up to which CPU tensors are packed into a single transfer.
+  const size_t tensorPackingThreshold_;
+
+  // Whether pipes write the descriptors of the tensors after the one of the
+  // message, rather than within it.
+  const bool earlyMessageDescriptors_;
+
+  // Whether pipes complete each message as soon as it's done.
+  const bool outOfOrderCompletion_;
+
+  // How many instances of each channel pipes open at most.
+  const size_t numPriorityClasses_;
+
+  // Up to how many bytes pipes coalesce into one write.
+  const size_t writeCoalescingLimit_;
+
+  // Whether pipes send repeated descriptor strings by id.
+  const bool descriptorStringInterning_;
+
+  // Whether pipes write simple message descriptors in a fixed layout.
+  const bool compactMessageDescriptors_;
+
+  // Whether pipes send the data of repeated buffers only once.
+  const bool deduplicateBuffers_;
+
+  // Whether pipes pick channels based on their measured speed.
+  const bool channelAutoTuning_;
+
+  // The size of the chunks that pipes split payloads into.
+  const size_t payloadChunkSize_;
+
+  // Whether pipes connect channels only when first used.
+  const bool lazyChannelEstablishment_;
+
+  // Whether pipes connect channels before they're selected.
+  const bool speculativeChannelConnections_;
+
+  // Whether pipes move to a faster transport in the background.
+  const bool transportUpgrade_;
+
+  // A user-provided function that runs the callbacks of pipes and listeners.
+  ContextOptions::executor_fn callbackExecutor_;
+
+  // How many messages, and bytes, each pipe may be writing at once.
+  const size_t maxOutstandingWritesPerPipe_;
+  const size_t maxOutstandingWriteBytesPerPipe_;
+
+  // How many bytes all pipes may be writing at once, how many they are, and the
+  // pipes that are waiting for some of them to be released.
+  const size_t maxOutstandingWriteBytes_;
+  std::mutex writeBytesMutex_;
+  size_t numOutstandingWriteBytes_{0};
+  std::vector<Function<void()>> writeBytesCallbacks_;
+
+  // The bucket bounding the rate at which all pipes write, and the pipes that
+  // are waiting for it to fill up, by when it will have. The thread that wakes
+  // them up is only started once some pipe has to wait.
+  TokenBucket writeRateLimiter_;
+  std::mutex writeRateMutex_;
+  std::condition_variable writeRateCv_;
+  std::multimap<TokenBucket::clock::time_point, Function<void()>>
+      writeRateCallbacks_;
+  std::thread writeRateThread_;
+  bool writeRateThreadDone_{false};
+
+  void writeRateThreadMain_();
+
+  // A user-provided function that allocates the buffers of incoming messages.
+  ContextOptions::allocator_fn allocator_;
+
+  // How many bytes the allocator may have provided for messages that are still
+  // being read, and how many it did.
+  const size_t allocatorMemoryBudget_;
+  std::atomic<size_t> numAllocatorBytes_{0};
+
+  // The memory that the pipes hold for their own use, and the bound on it
+  // together with the allocator's bytes.
+  const std::shared_ptr<MemoryCounter> stagingMemory_{
+      std::make_shared<MemoryCounter>()};
+  const std::shared_ptr<MemoryCounter> operationMemory_{
+      std::make_shared<MemoryCounter>()};
+  const size_t memorySoftLimit_;
+
+  // Only set if the user asked for the traffic to be recorded.
+  std::unique_ptr<TrafficRecorder> trafficRecorder_;
+
   std::unordered_map<std::string, std::shared_ptr<transport::Context>>
       transports_;
 
@@ -129,15 +309,78 @@ class Context::Impl : public Context::PrivateIface,
 
   ClosingEmitter closingEmitter_;
 
+  // The pipes that were opened ahead of time for each URL, and how many of them
+  // there should be.
+  struct PipePool {
+    size_t numPipes{0};
+    PipeOptions opts;
+    std::deque<std::shared_ptr<Pipe>> pipes;
+  };
+  std::mutex pipePoolsMutex_;
+  std::unordered_map<std::string, PipePool> pipePools_;
+
+  // The counters of the pipes. The ones whose pipe is gone are dropped, after
+  // their latencies have been added to the ones of the destroyed pipes.
+  std::mutex pipeCountersMutex_;
+  std::vector<std::shared_ptr<PipeCounters>> pipeCounters_;
+  LatencyStats retiredReadLatency_;
+  LatencyStats retiredChannelSendLatency_;
+  std::map<std::string, LatencyStats> retiredTransportWriteLatency_;
+
+  // Must be called with the mutex held.
+  void retireDestroyedPipeCounters_();
+
+  // The pipes to include in the dumps of the state, which are dropped once
+  // they're gone.
+  std::mutex pipeStateDumpersMutex_;
+  std::vector<std::pair<std::string, std::weak_ptr<PipeStateDumper>>>
+      pipeStateDumpers_;
+
   template <typename TBuffer>
   std::shared_ptr<channel::Context<TBuffer>> getChannel_(const std::string&);
+
+  std::shared_ptr<Pipe> openPipe_(const std::string&, PipeOptions opts);
+
+  // Open the pipes that the pool of the URL is missing, if it has one.
+  void replenishPipePool_(const std::string&);
+
+  void dropPipeFromPool_(const std::string&, const std::shared_ptr<Pipe>&);
+
+  void close_(bool fast);
 };
 
 Context::Context(ContextOptions opts)
     : impl_(std::make_shared<Context::Impl>(std::move(opts))) {}
 
 Context::Impl::Impl(ContextOptions opts)
-    : id_(createContextId()), name_(std::move(opts.name_)) {
+    : id_(createContextId()),
+      name_(std::move(opts.name_)),
+      inlineTensorThreshold_(opts.inlineTensorThreshold_),
+      tensorPackingThreshold_(opts.tensorPackingThreshold_),
+      earlyMessageDescriptors_(opts.earlyMessageDescriptors_),
+      outOfOrderCompletion_(opts.outOfOrderCompletion_),
+      numPriorityClasses_(opts.numPriorityClasses_),
+      writeCoalescingLimit_(opts.writeCoalescingLimit_),
+      descriptorStringInterning_(opts.descriptorStringInterning_),
+      compactMessageDescriptors_(opts.compactMessageDescriptors_),
+      deduplicateBuffers_(opts.deduplicateBuffers_),
+      channelAutoTuning_(opts.channelAutoTuning_),
+      payloadChunkSize_(opts.payloadChunkSize_),
+      lazyChannelEstablishment_(opts.lazyChannelEstablishment_),
+      speculativeChannelConnections_(opts.speculativeChannelConnections_),
+      transportUpgrade_(opts.transportUpgrade_),
+      callbackExecutor_(std::move(opts.callbackExecutor_)),
+      maxOutstandingWritesPerPipe_(opts.maxOutstandingWritesPerPipe_),
+      maxOutstandingWriteBytesPerPipe_(opts.maxOutstandingWriteBytesPerPipe_),
+      maxOutstandingWriteBytes_(opts.maxOutstandingWriteBytes_),
+      allocator_(std::move(opts.allocator_)),
+      allocatorMemoryBudget_(opts.allocatorMemoryBudget_),
+      memorySoftLimit_(opts.memorySoftLimit_) {
+  TP_THROW_ASSERT_IF(numPriorityClasses_ == 0);
+  if (!opts.trafficTracePath_.empty()) {
+    trafficRecorder_ =
+        std::make_unique<TrafficRecorder>(opts.trafficTracePath_);
+  }
   TP_VLOG(1) << "Context " << id_ << " created";
   if (name_ != "") {
     TP_VLOG(1) << "Context " << id_ << " aliased as " << name_;
@@ -179,10 +422,13 @@ template <typename TBuffer>
 void Context::Impl::registerChannel(
     int64_t priority,
     std::string channel,
-    std::shared_ptr<channel::Context<TBuffer>> context) {
+    std::shared_ptr<channel::Context<TBuffer>> context,
+    size_t maxTensorLength) {
   auto& channels = channels_.get<TBuffer>();
   auto& channelsByPriority = channelsByPriority_.get<TBuffer>();
   TP_THROW_ASSERT_IF(channel.empty());
+  TP_THROW_ASSERT_IF(channel.find(kChannelInstanceSeparator) != channel.npos)
+      << "channel " << channel << " contains " << kChannelInstanceSeparator;
   TP_THROW_ASSERT_IF(channels.find(channel) != channels.end())
       << "channel " << channel << " already registered";
   TP_THROW_ASSERT_IF(
@@ -198,22 +444,27 @@ void Context::Impl::registerChannel(
   channels.emplace(channel, context);
   // Reverse the priority, as the pipe will pick the *first* available channel
   // it can find in the ordered map, so higher priorities should come first.
-  channelsByPriority.emplace(-priority, std::make_tuple(channel, context));
+  channelsByPriority.emplace(
+      -priority, std::make_tuple(channel, context, maxTensorLength));
 }
 
 void Context::registerChannel(
     int64_t priority,
     std::string channel,
-    std::shared_ptr<channel::CpuContext> context) {
-  impl_->registerChannel(priority, std::move(channel), std::move(context));
+    std::shared_ptr<channel::CpuContext> context,
+    size_t maxTensorLength) {
+  impl_->registerChannel(
+      priority, std::move(channel), std::move(context), maxTensorLength);
 }
 
 #if TENSORPIPE_SUPPORTS_CUDA
 void Context::registerChannel(
     int64_t priority,
     std::string channel,
-    std::shared_ptr<channel::CudaContext> context) {
-  impl_->registerChannel(priority, std::move(channel), std::move(context));
+    std::shared_ptr<channel::CudaContext> context,
+    size_t maxTensorLength) {
+  impl_->registerChannel(
+      priority, std::move(channel), std::move(context), maxTensorLength);
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
@@ -243,6 +494,114 @@ std::shared_ptr<Pipe> Context::connect(
 std::shared_ptr<Pipe> Context::Impl::connect(
     const std::string& url,
     PipeOptions opts) {
+  std::shared_ptr<Pipe> pipe;
+  bool hasPool = false;
+  {
+    std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+    auto iter = pipePools_.find(url);
+    if (iter != pipePools_.end()) {
+      hasPool = true;
+      PipePool& pool = iter->second;
+      if (!pool.pipes.empty()) {
+        pipe = std::move(pool.pipes.front());
+        pool.pipes.pop_front();
+        TP_VLOG(1) << "Context " << id_
+                   << " is handing out a pipe from the pool for " << url;
+      }
+    }
+  }
+  if (pipe == nullptr) {
+    pipe = openPipe_(url, std::move(opts));
+  }
+  if (hasPool) {
+    replenishPipePool_(url);
+  }
+  return pipe;
+}
+
+void Context::prewarm(
+    const std::string& url,
+    size_t numPipes,
+    PipeOptions opts) {
+  impl_->prewarm(url, numPipes, std::move(opts));
+}
+
+void Context::Impl::prewarm(
+    const std::string& url,
+    size_t numPipes,
+    PipeOptions opts) {
+  TP_VLOG(1) << "Context " << id_ << " is keeping " << numPipes
+             << " pipes ready for " << url;
+  std::vector<std::shared_ptr<Pipe>> excessPipes;
+  {
+    std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+    PipePool& pool = pipePools_[url];
+    pool.numPipes = numPipes;
+    pool.opts = std::move(opts);
+    while (pool.pipes.size() > numPipes) {
+      excessPipes.push_back(std::move(pool.pipes.back()));
+      pool.pipes.pop_back();
+    }
+    if (numPipes == 0) {
+      pipePools_.erase(url);
+    }
+  }
+  for (auto& pipe : excessPipes) {
+    pipe->close();
+  }
+  replenishPipePool_(url);
+}
+
+void Context::Impl::replenishPipePool_(const std::string& url) {
+  std::vector<std::shared_ptr<Pipe>> newPipes;
+  {
+    std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+    auto iter = pipePools_.find(url);
+    if (closed_ || iter == pipePools_.end()) {
+      return;
+    }
+    PipePool& pool = iter->second;
+    while (pool.pipes.size() < pool.numPipes) {
+      std::shared_ptr<Pipe> pipe = openPipe_(url, pool.opts);
+      pool.pipes.push_back(pipe);
+      newPipes.push_back(std::move(pipe));
+    }
+  }
+
+  // This is done outside of the lock as the callback could be invoked inline.
+  std::weak_ptr<Impl> weakImpl = shared_from_this();
+  for (auto& pipe : newPipes) {
+    std::weak_ptr<Pipe> weakPipe = pipe;
+    pipe->waitForEstablishment([weakImpl, url, weakPipe](const Error& error) {
+      std::shared_ptr<Impl> impl = weakImpl.lock();
+      std::shared_ptr<Pipe> pipe = weakPipe.lock();
+      if (error && impl != nullptr && pipe != nullptr) {
+        impl->dropPipeFromPool_(url, pipe);
+      }
+    });
+  }
+}
+
+void Context::Impl::dropPipeFromPool_(
+    const std::string& url,
+    const std::shared_ptr<Pipe>& pipe) {
+  std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+  auto iter = pipePools_.find(url);
+  if (iter == pipePools_.end()) {
+    return;
+  }
+  std::deque<std::shared_ptr<Pipe>>& pipes = iter->second.pipes;
+  auto pipeIter = std::find(pipes.begin(), pipes.end(), pipe);
+  if (pipeIter != pipes.end()) {
+    TP_VLOG(1) << "Context " << id_ << " is dropping a failed pipe from the"
+               << " pool for " << url;
+    pipes.erase(pipeIter);
+  }
+}
+
+std::shared_ptr<Pipe> Context::Impl::openPipe_(
+    const std::string& url,
+    PipeOptions opts) {
   std::string pipeId = id_ + ".p" + std::to_string(pipeCounter_++);
   TP_VLOG(1) << "Context " << id_ << " is opening pipe " << pipeId;
   std::string remoteContextName = std::move(opts.remoteName_);
@@ -315,13 +674,445 @@ const std::string& Context::Impl::getName() {
   return name_;
 }
 
+size_t Context::Impl::getInlineTensorThreshold() {
+  return inlineTensorThreshold_;
+}
+
+size_t Context::Impl::getTensorPackingThreshold() {
+  return tensorPackingThreshold_;
+}
+
+bool Context::Impl::getEarlyMessageDescriptors() {
+  return earlyMessageDescriptors_;
+}
+
+bool Context::Impl::getOutOfOrderCompletion() {
+  return outOfOrderCompletion_;
+}
+
+size_t Context::Impl::getNumPriorityClasses() {
+  return numPriorityClasses_;
+}
+
+size_t Context::Impl::getWriteCoalescingLimit() {
+  return writeCoalescingLimit_;
+}
+
+bool Context::Impl::getDescriptorStringInterning() {
+  return descriptorStringInterning_;
+}
+
+bool Context::Impl::getCompactMessageDescriptors() {
+  return compactMessageDescriptors_;
+}
+
+bool Context::Impl::getDeduplicateBuffers() {
+  return deduplicateBuffers_;
+}
+
+bool Context::Impl::getChannelAutoTuning() {
+  return channelAutoTuning_;
+}
+
+size_t Context::Impl::getPayloadChunkSize() {
+  return payloadChunkSize_;
+}
+
+bool Context::Impl::getLazyChannelEstablishment() {
+  return lazyChannelEstablishment_;
+}
+
+bool Context::Impl::getSpeculativeChannelConnections() {
+  return speculativeChannelConnections_;
+}
+
+bool Context::Impl::getTransportUpgrade() {
+  return transportUpgrade_;
+}
+
+const ContextOptions::executor_fn& Context::Impl::getCallbackExecutor() {
+  return callbackExecutor_;
+}
+
+size_t Context::Impl::getMaxOutstandingWritesPerPipe() {
+  return maxOutstandingWritesPerPipe_;
+}
+
+size_t Context::Impl::getMaxOutstandingWriteBytesPerPipe() {
+  return maxOutstandingWriteBytesPerPipe_;
+}
+
+size_t Context::Impl::getMaxOutstandingWriteBytes() {
+  return maxOutstandingWriteBytes_;
+}
+
+bool Context::Impl::reserveWriteBytes(size_t numBytes, Function<void()> fn) {
+  if (maxOutstandingWriteBytes_ == 0) {
+    return true;
+  }
+  std::unique_lock<std::mutex> lock(writeBytesMutex_);
+  // A write that on its own exceeds the limit must be let through at some
+  // point, hence do so when it's alone.
+  if (numOutstandingWriteBytes_ == 0 ||
+      numOutstandingWriteBytes_ + numBytes <= maxOutstandingWriteBytes_) {
+    numOutstandingWriteBytes_ += numBytes;
+    return true;
+  }
+  writeBytesCallbacks_.push_back(std::move(fn));
+  return false;
+}
+
+void Context::Impl::releaseWriteBytes(size_t numBytes) {
+  if (maxOutstandingWriteBytes_ == 0) {
+    return;
+  }
+  std::vector<Function<void()>> callbacks;
+  {
+    std::unique_lock<std::mutex> lock(writeBytesMutex_);
+    TP_DCHECK_GE(numOutstandingWriteBytes_, numBytes);
+    numOutstandingWriteBytes_ -= numBytes;
+    std::swap(callbacks, writeBytesCallbacks_);
+  }
+  for (auto& fn : callbacks) {
+    fn();
+  }
+}
+
+TokenBucket& Context::Impl::getWriteRateLimiter() {
+  return writeRateLimiter_;
+}
+
+void Context::Impl::waitForWriteRate(
+    TokenBucket::clock::duration delay,
+    Function<void()> fn) {
+  std::unique_lock<std::mutex> lock(writeRateMutex_);
+  if (writeRateThreadDone_) {
+    return;
+  }
+  if (!writeRateThread_.joinable()) {
+    writeRateThread_ = std::thread([this]() { writeRateThreadMain_(); });
+  }
+  writeRateCallbacks_.emplace(
+      TokenBucket::clock::now() + delay, std::move(fn));
+  writeRateCv_.notify_all();
+}
+
+void Context::Impl::writeRateThreadMain_() {
+  setThreadName("TP_rate_limit");
+  std::unique_lock<std::mutex> lock(writeRateMutex_);
+  while (!writeRateThreadDone_) {
+    if (writeRateCallbacks_.empty()) {
+      writeRateCv_.wait(lock);
+      continue;
+    }
+    auto iter = writeRateCallbacks_.begin();
+    if (iter->first > TokenBucket::clock::now()) {
+      writeRateCv_.wait_until(lock, iter->first);
+      continue;
+    }
+    Function<void()> fn = std::move(iter->second);
+    writeRateCallbacks_.erase(iter);
+    lock.unlock();
+    fn();
+    lock.lock();
+  }
+}
+
+void Context::setWriteRateLimit(double bytesPerSecond, size_t burstBytes) {
+  impl_->setWriteRateLimit(bytesPerSecond, burstBytes);
+}
+
+void Context::Impl::setWriteRateLimit(
+    double bytesPerSecond,
+    size_t burstBytes) {
+  writeRateLimiter_.setRate(bytesPerSecond, burstBytes);
+  // The pipes that are waiting may now be able to go earlier than they thought
+  // (or must wait longer, which they'll find out when they retry).
+  std::unique_lock<std::mutex> lock(writeRateMutex_);
+  std::multimap<TokenBucket::clock::time_point, Function<void()>> callbacks;
+  std::swap(callbacks, writeRateCallbacks_);
+  for (auto& iter : callbacks) {
+    writeRateCallbacks_.emplace(
+        TokenBucket::clock::time_point::min(), std::move(iter.second));
+  }
+  writeRateCv_.notify_all();
+}
+
+const ContextOptions::allocator_fn& Context::Impl::getAllocator() {
+  return allocator_;
+}
+
+bool Context::Impl::reserveAllocatorBytes(size_t numBytes) {
+  if (allocatorMemoryBudget_ == 0) {
+    return true;
+  }
+  size_t numAllocatorBytes = numAllocatorBytes_.load();
+  do {
+    if (numAllocatorBytes + numBytes > allocatorMemoryBudget_) {
+      return false;
+    }
+  } while (!numAllocatorBytes_.compare_exchange_weak(
+      numAllocatorBytes, numAllocatorBytes + numBytes));
+  return true;
+}
+
+void Context::Impl::releaseAllocatorBytes(size_t numBytes) {
+  if (allocatorMemoryBudget_ == 0) {
+    return;
+  }
+  TP_DCHECK_GE(numAllocatorBytes_.load(), numBytes);
+  numAllocatorBytes_ -= numBytes;
+}
+
+std::shared_ptr<MemoryCounter> Context::Impl::getStagingMemory() {
+  return stagingMemory_;
+}
+
+std::shared_ptr<MemoryCounter> Context::Impl::getOperationMemory() {
+  return operationMemory_;
+}
+
+bool Context::Impl::isOverMemorySoftLimit() {
+  return memorySoftLimit_ > 0 &&
+      stagingMemory_->getNumBytes() + operationMemory_->getNumBytes() +
+              numAllocatorBytes_.load(std::memory_order_relaxed) >
+          memorySoftLimit_;
+}
+
+void Context::Impl::registerPipeCounters(
+    std::shared_ptr<PipeCounters> counters) {
+  std::unique_lock<std::mutex> lock(pipeCountersMutex_);
+  retireDestroyedPipeCounters_();
+  pipeCounters_.push_back(std::move(counters));
+}
+
+void Context::Impl::registerPipeStateDumper(
+    std::string id,
+    std::weak_ptr<PipeStateDumper> dumper) {
+  std::unique_lock<std::mutex> lock(pipeStateDumpersMutex_);
+  pipeStateDumpers_.erase(
+      std::remove_if(
+          pipeStateDumpers_.begin(),
+          pipeStateDumpers_.end(),
+          [](const std::pair<std::string, std::weak_ptr<PipeStateDumper>>&
+                 entry) { return entry.second.expired(); }),
+      pipeStateDumpers_.end());
+  pipeStateDumpers_.emplace_back(std::move(id), std::move(dumper));
+}
+
+TrafficRecorder* Context::Impl::getTrafficRecorder() {
+  return trafficRecorder_.get();
+}
+
+void Context::Impl::retireDestroyedPipeCounters_() {
+  // Once only the context holds them the pipe can't update them anymore.
+  auto iter = std::partition(
+      pipeCounters_.begin(),
+      pipeCounters_.end(),
+      [](const std::shared_ptr<PipeCounters>& counters) {
+        return counters.use_count() > 1;
+      });
+  for (auto retiredIter = iter; retiredIter != pipeCounters_.end();
+       ++retiredIter) {
+    const PipeCounters& counters = **retiredIter;
+    retiredReadLatency_.merge(counters.readLatency.snapshot());
+    retiredChannelSendLatency_.merge(counters.channelSendLatency.snapshot());
+    retiredTransportWriteLatency_[counters.transport].merge(
+        counters.transportWriteLatency.snapshot());
+  }
+  pipeCounters_.erase(iter, pipeCounters_.end());
+}
+
+std::shared_ptr<void> Context::registerBuffer(Buffer buffer) {
+  return impl_->registerBuffer(buffer);
+}
+
+std::shared_ptr<void> Context::Impl::registerBuffer(Buffer buffer) {
+  auto handles = std::make_shared<std::vector<std::shared_ptr<void>>>();
+  switchOnDeviceType(buffer.type, [&](auto typedBuffer) {
+    using TBuffer = decltype(typedBuffer);
+    for (auto& iter : channels_.get<TBuffer>()) {
+      std::shared_ptr<void> handle =
+          iter.second->registerBuffer(unwrap<TBuffer>(buffer));
+      if (handle != nullptr) {
+        TP_VLOG(3) << "Context " << id_ << " registered a buffer with channel "
+                   << iter.first;
+        handles->push_back(std::move(handle));
+      }
+    }
+  });
+  return handles;
+}
+
+ContextStats Context::getStats() {
+  return impl_->getStats();
+}
+
+ContextStats Context::Impl::getStats() {
+  ContextStats stats;
+  {
+    std::unique_lock<std::mutex> lock(pipeCountersMutex_);
+    retireDestroyedPipeCounters_();
+    stats.readLatency = retiredReadLatency_;
+    stats.channelSendLatency = retiredChannelSendLatency_;
+    stats.transportWriteLatency = retiredTransportWriteLatency_;
+    for (const auto& counters : pipeCounters_) {
+      PipeStats pipeStats;
+      pipeStats.id = counters->id;
+      pipeStats.numMessagesWritten =
+          counters->numMessagesWritten.load(std::memory_order_relaxed);
+      pipeStats.numBytesWritten =
+          counters->numBytesWritten.load(std::memory_order_relaxed);
+      pipeStats.numMessagesRead =
+          counters->numMessagesRead.load(std::memory_order_relaxed);
+      pipeStats.numBytesRead =
+          counters->numBytesRead.load(std::memory_order_relaxed);
+      for (size_t idx = 0; idx < counters->writeStageNames.size(); idx++) {
+        pipeStats.writeStageNanoseconds[counters->writeStageNames[idx]] =
+            counters->writeStageNanoseconds[idx].load(
+                std::memory_order_relaxed);
+      }
+      for (size_t idx = 0; idx < counters->readStageNames.size(); idx++) {
+        pipeStats.readStageNanoseconds[counters->readStageNames[idx]] =
+            counters->readStageNanoseconds[idx].load(std::memory_order_relaxed);
+      }
+      pipeStats.readLatency = counters->readLatency.snapshot();
+      pipeStats.channelSendLatency = counters->channelSendLatency.snapshot();
+      pipeStats.transportWriteLatency =
+          counters->transportWriteLatency.snapshot();
+      pipeStats.memoryBytes["staging"] =
+          counters->stagingMemory->getNumBytes();
+      pipeStats.memoryBytes["operations"] =
+          counters->operationMemory->getNumBytes();
+      stats.readLatency.merge(pipeStats.readLatency);
+      stats.channelSendLatency.merge(pipeStats.channelSendLatency);
+      stats.transportWriteLatency[counters->transport].merge(
+          pipeStats.transportWriteLatency);
+      stats.pipes.push_back(std::move(pipeStats));
+    }
+  }
+  stats.memoryBytes["pipes.staging"] = stagingMemory_->getNumBytes();
+  stats.memoryBytes["pipes.operations"] = operationMemory_->getNumBytes();
+  if (allocatorMemoryBudget_ > 0) {
+    stats.memoryBytes["allocator"] = numAllocatorBytes_.load();
+  }
+  auto addMemoryStats = [&](const std::string& name,
+                            const std::map<std::string, uint64_t>& counters) {
+    const std::string prefix = "memory.";
+    for (const auto& counter : counters) {
+      if (counter.first.compare(0, prefix.size(), prefix) == 0) {
+        stats.memoryBytes[name + "." + counter.first.substr(prefix.size())] +=
+            counter.second;
+      }
+    }
+  };
+  // Transports and channels are all registered before the context is used.
+  for (const auto& iter : transports_) {
+    stats.transports.emplace(iter.first, iter.second->getStats());
+    addMemoryStats(iter.first, stats.transports[iter.first]);
+  }
+  forEachDeviceType([&](auto buffer) {
+    for (const auto& iter : channels_.get<decltype(buffer)>()) {
+      stats.channels.emplace(iter.first, iter.second->getStats());
+      addMemoryStats(iter.first, stats.channels[iter.first]);
+    }
+  });
+  return stats;
+}
+
+std::string Context::dumpState(std::chrono::milliseconds timeout) {
+  return impl_->dumpState(timeout);
+}
+
+std::string Context::Impl::dumpState(std::chrono::milliseconds timeout) {
+  std::vector<std::string> ids;
+  std::vector<std::shared_ptr<PipeStateDumper>> dumpers;
+  {
+    std::unique_lock<std::mutex> lock(pipeStateDumpersMutex_);
+    for (const auto& entry : pipeStateDumpers_) {
+      if (std::shared_ptr<PipeStateDumper> dumper = entry.second.lock()) {
+        ids.push_back(entry.first);
+        dumpers.push_back(std::move(dumper));
+      }
+    }
+  }
+
+  // Ask all the pipes first, so that they describe themselves in parallel, and
+  // then wait for all of them against the same deadline. The promises are
+  // shared with the callbacks, as these may come after we gave up on them.
+  std::vector<std::future<std::string>> futures;
+  for (const auto& dumper : dumpers) {
+    auto promise = std::make_shared<std::promise<std::string>>();
+    futures.push_back(promise->get_future());
+    dumper->dumpState([promise](std::string state) {
+      promise->set_value(std::move(state));
+    });
+  }
+  // Don't hold on to the pipes while waiting, to let them go away meanwhile.
+  dumpers.clear();
+
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::ostringstream oss;
+  oss << "Context " << id_ << " has " << futures.size() << " pipes\n";
+  for (size_t idx = 0; idx < futures.size(); idx++) {
+    if (futures[idx].wait_until(deadline) == std::future_status::ready) {
+      try {
+        oss << futures[idx].get();
+        continue;
+      } catch (const std::future_error& /* unused */) {
+        // The callback was dropped without being called, e.g., as the loop of
+        // the pipe's connection was closed meanwhile.
+      }
+    }
+    oss << "Pipe " << ids[idx] << " didn't answer within " << timeout.count()
+        << "ms (its loop, or its connection's, is busy, blocked, or is the "
+        << "caller's)\n";
+  }
+  return oss.str();
+}
+
+void Context::beginBatch() {
+  beginDeferredBatch();
+}
+
+void Context::flush() {
+  flushDeferredBatch();
+}
+
+void Context::endBatch() {
+  endDeferredBatch();
+}
+
 void Context::close() {
+  flushDeferredBatch();
   impl_->close();
 }
 
 void Context::Impl::close() {
+  close_(/*fast=*/false);
+}
+
+void Context::closeFast() {
+  flushDeferredBatch();
+  impl_->closeFast();
+}
+
+void Context::Impl::closeFast() {
+  close_(/*fast=*/true);
+}
+
+void Context::Impl::close_(bool fast) {
   if (!closed_.exchange(true)) {
-    TP_VLOG(1) << "Context " << id_ << " is closing";
+    TP_VLOG(1) << "Context " << id_ << " is closing"
+               << (fast ? " (fast)" : "");
+
+    // The pooled pipes are closed, like all others, by the closing emitter, and
+    // they're released outside of the lock since that may invoke callbacks.
+    std::unordered_map<std::string, PipePool> pipePools;
+    {
+      std::unique_lock<std::mutex> lock(pipePoolsMutex_);
+      std::swap(pipePools, pipePools_);
+    }
 
     closingEmitter_.close();
 
@@ -330,7 +1121,11 @@ void Context::Impl::close() {
     }
     forEachDeviceType([&](auto buffer) {
       for (auto& iter : channels_.get<decltype(buffer)>()) {
-        iter.second->close();
+        if (fast) {
+          iter.second->closeFast();
+        } else {
+          iter.second->close();
+        }
       }
     });
 
@@ -348,14 +1143,33 @@ void Context::Impl::join() {
   if (!joined_.exchange(true)) {
     TP_VLOG(1) << "Context " << id_ << " is joining";
 
+    {
+      std::unique_lock<std::mutex> lock(writeRateMutex_);
+      writeRateThreadDone_ = true;
+      writeRateCallbacks_.clear();
+      writeRateCv_.notify_all();
+    }
+    if (writeRateThread_.joinable()) {
+      writeRateThread_.join();
+    }
+
+    // Each transport and channel tears its own resources down (e.g., the ibv
+    // ones destroy their queue pairs and deregister their memory), which can
+    // take a while for contexts with many pipes, hence they're all joined at
+    // once rather than one after the other.
+    std::vector<std::function<void()>> joins;
     for (auto& iter : transports_) {
-      iter.second->join();
+      transport::Context* transport = iter.second.get();
+      joins.emplace_back([transport]() { transport->join(); });
     }
     forEachDeviceType([&](auto buffer) {
       for (auto& iter : channels_.get<decltype(buffer)>()) {
-        iter.second->join();
+        auto* channel = iter.second.get();
+        joins.emplace_back([channel]() { channel->join(); });
       }
     });
+    const size_t numJoins = joins.size();
+    runInParallel(std::move(joins), numJoins);
 
     TP_VLOG(1) << "Context " << id_ << " done joining";
   }
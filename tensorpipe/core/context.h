@@ -8,11 +8,19 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/latency_histogram.h>
 #include <tensorpipe/config.h>
+#include <tensorpipe/core/message.h>
 #include <tensorpipe/transport/context.h>
 
 #include <tensorpipe/channel/cpu_context.h>
@@ -36,6 +44,300 @@ class ContextOptions {
     name_ = std::move(name);
     return std::move(*this);
   }
+
+  size_t inlineTensorThreshold_{0};
+
+  // CPU tensors whose size is at most this many bytes are sent over the pipe's
+  // connection, together with the payloads, rather than through a channel.
+  // This avoids the overhead of a channel's round trip, which for very small
+  // tensors dominates the cost of the transfer. Zero disables this.
+  ContextOptions&& inlineTensorThreshold(size_t inlineTensorThreshold) && {
+    inlineTensorThreshold_ = inlineTensorThreshold;
+    return std::move(*this);
+  }
+
+  size_t tensorPackingThreshold_{0};
+
+  // CPU tensors whose size is at most this many bytes, and that aren't inline,
+  // are copied by the pipe into one buffer, which is sent over a channel in a
+  // single operation, and copied out of it into their own buffers on the other
+  // end. For messages with many small tensors, this trades the overhead of a
+  // channel operation (and of its descriptor) per tensor for a copy of each.
+  // Only the messages with at least two such tensors, and that aren't of a
+  // template, are packed. Zero disables this.
+  ContextOptions&& tensorPackingThreshold(size_t tensorPackingThreshold) && {
+    tensorPackingThreshold_ = tensorPackingThreshold;
+    return std::move(*this);
+  }
+
+  bool earlyMessageDescriptors_{false};
+
+  // Have pipes write the descriptor and the payloads of a message as soon as
+  // its tensors have been handed to the channels, without waiting for these to
+  // produce the descriptors of the tensors, which are then written separately
+  // as they become available. This allows the receiver to allocate the message
+  // and read its payloads earlier, at the cost of some more, smaller, writes.
+  ContextOptions&& earlyMessageDescriptors(bool earlyMessageDescriptors) && {
+    earlyMessageDescriptors_ = earlyMessageDescriptors;
+    return std::move(*this);
+  }
+
+  bool outOfOrderCompletion_{false};
+
+  // Have pipes invoke the callback of a read or of a write as soon as all the
+  // payloads and tensors of that message are done, even if earlier messages
+  // aren't, so that a large message doesn't hold back the small ones behind
+  // it. Each message still gets its own callback, which tells them apart. The
+  // readDescriptor callbacks are still invoked in order, and the read calls
+  // must still be made in that same order.
+  ContextOptions&& outOfOrderCompletion(bool outOfOrderCompletion) && {
+    outOfOrderCompletion_ = outOfOrderCompletion;
+    return std::move(*this);
+  }
+
+  size_t numPriorityClasses_{1};
+
+  // Have each pipe open this many instances of each of its channels, one for
+  // each of the priority classes that can be given to Pipe::write, so that the
+  // tensors of messages of a higher class never wait behind the ones of bulk
+  // transfers of a lower class in the channels' lanes, connections and rings.
+  // A pipe will have as many classes as the context on either side allows, and
+  // messages of a class it doesn't have are sent as if they were of its most
+  // urgent one. Combine this with outOfOrderCompletion to also keep their
+  // callbacks from waiting behind the ones of earlier messages.
+  ContextOptions&& numPriorityClasses(size_t numPriorityClasses) && {
+    numPriorityClasses_ = numPriorityClasses;
+    return std::move(*this);
+  }
+
+  size_t writeCoalescingLimit_{0};
+
+  // Have pipes hold back the descriptors and payloads of the messages that are
+  // written while an earlier write of theirs is still in flight on the pipe's
+  // connection, and then hand all of them to the connection at once, as soon
+  // as that earlier write completes or as they add up to this many bytes. This
+  // spares many small messages the cost of a write each, without delaying any
+  // message when the connection is idle. Zero disables this.
+  ContextOptions&& writeCoalescingLimit(size_t writeCoalescingLimit) && {
+    writeCoalescingLimit_ = writeCoalescingLimit;
+    return std::move(*this);
+  }
+
+  bool descriptorStringInterning_{false};
+
+  // Have pipes send each distinct metadata string and channel name of their
+  // message descriptors only once, and then refer to it by a small id, which
+  // makes the descriptors of messages with many tensors smaller and quicker to
+  // serialize and parse. Up to a few thousand strings are kept for each pipe.
+  ContextOptions&& descriptorStringInterning(
+      bool descriptorStringInterning) && {
+    descriptorStringInterning_ = descriptorStringInterning;
+    return std::move(*this);
+  }
+
+  bool compactMessageDescriptors_{false};
+
+  // Have pipes write the descriptors of messages that have no metadata and no
+  // tensors other than inline or duplicate ones in a fixed binary layout,
+  // which is much quicker to write and parse than the general one. This is
+  // only done if the contexts on both sides of a pipe enable it.
+  ContextOptions&& compactMessageDescriptors(
+      bool compactMessageDescriptors) && {
+    compactMessageDescriptors_ = compactMessageDescriptors;
+    return std::move(*this);
+  }
+
+  bool deduplicateBuffers_{false};
+
+  // Have pipes look for payloads, and CPU tensors, of a message that have the
+  // same pointer and length as an earlier one of the same message (e.g., tied
+  // weights), and send their data only once. The receiver then copies it into
+  // the buffers of the duplicates (or, for tensors, may share it). This isn't
+  // done for the messages of a template, whose layout is fixed.
+  ContextOptions&& deduplicateBuffers(bool deduplicateBuffers) && {
+    deduplicateBuffers_ = deduplicateBuffers;
+    return std::move(*this);
+  }
+
+  bool channelAutoTuning_{false};
+
+  // Have each pipe measure how long its channels take to transfer tensors of
+  // different lengths and, for each range of lengths, send tensors over the
+  // fastest one, rather than over the one chosen through the priorities and
+  // maximum tensor lengths given to registerChannel. The first few tensors in
+  // each range are spread across all channels to calibrate them, and some are
+  // still sent over other channels once in a while to keep up with changes.
+  ContextOptions&& channelAutoTuning(bool channelAutoTuning) && {
+    channelAutoTuning_ = channelAutoTuning;
+    return std::move(*this);
+  }
+
+  size_t payloadChunkSize_{0};
+
+  // Have pipes write payloads and inline tensors over their connection in
+  // chunks of this many bytes, rather than in one go, so that the receiver can
+  // find out, through the progress callback of read, how much of each has
+  // arrived, and start to process it while the rest is still in flight. A
+  // pipe uses the smaller of the sizes that its two ends ask for, in both
+  // directions, and it only disables this if neither does (with zero).
+  ContextOptions&& payloadChunkSize(size_t payloadChunkSize) && {
+    payloadChunkSize_ = payloadChunkSize;
+    return std::move(*this);
+  }
+
+  bool lazyChannelEstablishment_{false};
+
+  // Have pipes open the connection of each of their channels only once the
+  // first tensor is sent or received through it, rather than during the
+  // handshake, so that pipes are established in one round trip and don't hold
+  // connections (and their buffers) for the channels, typically the CUDA ones,
+  // that they end up never using. The first tensor of each channel is delayed
+  // by the time it takes to connect it. A pipe does this if either end asks.
+  ContextOptions&& lazyChannelEstablishment(bool lazyChannelEstablishment) && {
+    lazyChannelEstablishment_ = lazyChannelEstablishment;
+    return std::move(*this);
+  }
+
+  bool speculativeChannelConnections_{false};
+
+  // Have outgoing pipes open the connections of their channels right away,
+  // together with the brochure, for all the channels they could use, instead
+  // of waiting for the other end to tell them which ones it picked. The other
+  // end then takes the ones it needs, and the others are closed. This saves a
+  // round trip when establishing a pipe, at the cost of some connections that
+  // may be opened in vain. It has no effect with lazyChannelEstablishment.
+  ContextOptions&& speculativeChannelConnections(
+      bool speculativeChannelConnections) && {
+    speculativeChannelConnections_ = speculativeChannelConnections;
+    return std::move(*this);
+  }
+
+  bool transportUpgrade_{false};
+
+  // Have pipes that would have to move to a faster transport than the one they
+  // were opened on (say, from uv to ibv or shm) start exchanging messages over
+  // the latter right away, and connect the faster one in the background. Each
+  // side switches its writes over in between two messages once it's connected,
+  // and the other side follows. This keeps the slow setup of some transports
+  // off the latency of the first messages. The channels still connect over the
+  // faster transport, hence combine this with lazyChannelEstablishment. A pipe
+  // does this only if both ends ask.
+  ContextOptions&& transportUpgrade(bool transportUpgrade) && {
+    transportUpgrade_ = transportUpgrade;
+    return std::move(*this);
+  }
+
+  using executor_fn = std::function<void(Function<void()>)>;
+  executor_fn callbackExecutor_;
+
+  // The executor, if provided, is handed the invocations of the callbacks that
+  // pipes and listeners were given by the user, which it can then run on any
+  // thread, for example on a thread pool, rather than on the internal threads
+  // where they would otherwise run inline, and where they'd delay the work of
+  // all the other pipes that share these threads. The callbacks may then run
+  // concurrently with each other and in any order. The executor itself is
+  // invoked from the internal threads, hence it must be quick and not block.
+  ContextOptions&& callbackExecutor(executor_fn callbackExecutor) && {
+    callbackExecutor_ = std::move(callbackExecutor);
+    return std::move(*this);
+  }
+
+  size_t maxOutstandingWritesPerPipe_{0};
+
+  // Have each pipe write at most this many messages at once. Further writes are
+  // queued, and admitted in order as earlier ones complete. Producers can hold
+  // off on issuing more through Pipe::waitForWriteCapacity, so that the memory
+  // pinned by pending writes stays bounded. Zero disables this.
+  ContextOptions&& maxOutstandingWritesPerPipe(
+      size_t maxOutstandingWritesPerPipe) && {
+    maxOutstandingWritesPerPipe_ = maxOutstandingWritesPerPipe;
+    return std::move(*this);
+  }
+
+  size_t maxOutstandingWriteBytesPerPipe_{0};
+
+  // Like the above, but it bounds the total length of the payloads and tensors
+  // of the messages that each pipe is writing at once. A message that on its
+  // own exceeds it is still admitted once nothing else is outstanding.
+  ContextOptions&& maxOutstandingWriteBytesPerPipe(
+      size_t maxOutstandingWriteBytesPerPipe) && {
+    maxOutstandingWriteBytesPerPipe_ = maxOutstandingWriteBytesPerPipe;
+    return std::move(*this);
+  }
+
+  size_t maxOutstandingWriteBytes_{0};
+
+  // Like the above, but across all the pipes of the context. A pipe whose next
+  // write doesn't fit waits until some other write of the context completes.
+  ContextOptions&& maxOutstandingWriteBytes(
+      size_t maxOutstandingWriteBytes) && {
+    maxOutstandingWriteBytes_ = maxOutstandingWriteBytes;
+    return std::move(*this);
+  }
+
+  using allocator_fn = std::function<bool(Message&)>;
+  allocator_fn allocator_;
+
+  // The allocator, if provided, is invoked by the pipes as soon as they read
+  // the descriptor of an incoming message, with that message as it would be
+  // passed to the readDescriptor callback. It can set the data pointers of the
+  // payloads and the buffers of the tensors (and return true), in which case
+  // the pipe immediately starts reading into them, without waiting for the user
+  // to call read. The message passed to the readDescriptor callback will then
+  // contain these buffers, and must be passed back unchanged to read, whose
+  // callback still signals that the transfer is complete. If instead it returns
+  // false, nothing changes and the user must allocate the message as usual.
+  // It is called from the pipe's internal thread, hence it must be quick and
+  // not block, and it must be safe to call it concurrently for different pipes.
+  ContextOptions&& allocator(allocator_fn allocator) && {
+    allocator_ = std::move(allocator);
+    return std::move(*this);
+  }
+
+  size_t allocatorMemoryBudget_{0};
+
+  // Bound how many bytes of payloads and tensors the pipes of the context may
+  // have obtained from the allocator for messages whose read callback hasn't
+  // been called yet. Messages that would exceed it are passed to the callback
+  // of readDescriptor without buffers, as if there were no allocator, and the
+  // user can then pull them by calling read whenever it sees fit. As the data
+  // of the tensors is only transferred once read is called (and the channels
+  // that can, like CMA, copy it straight out of the sender's memory), a burst
+  // of messages from many peers can't make the receiver allocate more than the
+  // budget. Zero disables this.
+  ContextOptions&& allocatorMemoryBudget(size_t allocatorMemoryBudget) && {
+    allocatorMemoryBudget_ = allocatorMemoryBudget;
+    return std::move(*this);
+  }
+
+  size_t memorySoftLimit_{0};
+
+  // Softly bound how many bytes of memory the pipes of the context hold for
+  // their own use (the staging buffers of segmented and packed tensors, and
+  // their operations) plus the ones counted against the allocator's budget.
+  // While they're above it, each pipe admits a write only when it has none
+  // outstanding, which slows down the producers (see
+  // Pipe::waitForWriteCapacity) without ever stalling a pipe completely. The
+  // memory of the transports and channels (rings, registered regions, arenas)
+  // is set up front, and thus isn't counted against it, although it's
+  // reported in the stats. Zero disables this.
+  ContextOptions&& memorySoftLimit(size_t memorySoftLimit) && {
+    memorySoftLimit_ = memorySoftLimit;
+    return std::move(*this);
+  }
+
+  std::string trafficTracePath_;
+
+  // Have the context record, to the file at this path, the shape of each
+  // message that its pipes write (the lengths of its metadata, payloads and
+  // tensors, and the device of the latter) and when it was admitted, in the
+  // order in which they go on the wire, without any of the data. Writes that
+  // expire before being admitted aren't recorded. The benchmark_replay tool can
+  // then drive pipes with that same traffic. Empty disables this.
+  ContextOptions&& trafficTracePath(std::string trafficTracePath) && {
+    trafficTracePath_ = std::move(trafficTracePath);
+    return std::move(*this);
+  }
 };
 
 class PipeOptions {
@@ -51,6 +353,52 @@ class PipeOptions {
   }
 };
 
+struct PipeStats {
+  // The identifier of the pipe, as it appears in the logs.
+  std::string id;
+  // The messages whose write or read completed successfully, and the total
+  // length of their payloads and tensors.
+  uint64_t numMessagesWritten{0};
+  uint64_t numBytesWritten{0};
+  uint64_t numMessagesRead{0};
+  uint64_t numBytesRead{0};
+  // How long, in nanoseconds, messages have spent in total in each stage of
+  // being written and read, by name of the stage.
+  std::map<std::string, uint64_t> writeStageNanoseconds;
+  std::map<std::string, uint64_t> readStageNanoseconds;
+  // From having read the descriptor of a message to having received all of its
+  // payloads and tensors.
+  LatencyStats readLatency;
+  // From handing a tensor to a channel to the channel being done sending it.
+  LatencyStats channelSendLatency;
+  // From handing buffers to the connection to the transport having written
+  // them.
+  LatencyStats transportWriteLatency;
+  // The bytes of memory that the pipe holds for its own use, by category: its
+  // "staging" buffers, and its "operations".
+  std::map<std::string, uint64_t> memoryBytes;
+};
+
+struct ContextStats {
+  // One for each pipe of the context that hasn't been destroyed yet.
+  std::vector<PipeStats> pipes;
+  // The counters that each transport and each channel keeps, by their name.
+  std::map<std::string, std::map<std::string, uint64_t>> transports;
+  std::map<std::string, std::map<std::string, uint64_t>> channels;
+  // The bytes of memory that the context holds, by category: the pipes' ones
+  // (prefixed by "pipes."), the ones counted against the allocator's budget
+  // ("allocator", if there's a budget), and those of the transports and
+  // channels (their counters starting with "memory.", prefixed by their name
+  // instead). The transports' rings that are mapped from the peers are
+  // accounted for by the peers.
+  std::map<std::string, uint64_t> memoryBytes;
+  // The latencies of all the pipes, including the ones already destroyed, with
+  // the ones of the transports' writes grouped by name of the transport.
+  LatencyStats readLatency;
+  LatencyStats channelSendLatency;
+  std::map<std::string, LatencyStats> transportWriteLatency;
+};
+
 class Context final {
  public:
   explicit Context(ContextOptions opts = ContextOptions());
@@ -60,16 +408,26 @@ class Context final {
       std::string,
       std::shared_ptr<transport::Context>);
 
+  // Channels are negotiated by every pipe whenever both ends support them, and
+  // each tensor is sent over the one with the highest priority among those
+  // whose maximum tensor length isn't smaller than the tensor's. This allows to
+  // route, say, smaller tensors over a channel with little latency and larger
+  // ones over one with more bandwidth. If no channel is suitable, the one with
+  // the highest priority is used nevertheless. A channel with a maximum tensor
+  // length of zero is never picked this way, but only for the tensors that ask
+  // for it by name (see Message::Tensor::channel).
   void registerChannel(
       int64_t,
       std::string,
-      std::shared_ptr<channel::CpuContext>);
+      std::shared_ptr<channel::CpuContext>,
+      size_t maxTensorLength = std::numeric_limits<size_t>::max());
 
 #if TENSORPIPE_SUPPORTS_CUDA
   void registerChannel(
       int64_t,
       std::string,
-      std::shared_ptr<channel::CudaContext>);
+      std::shared_ptr<channel::CudaContext>,
+      size_t maxTensorLength = std::numeric_limits<size_t>::max());
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
   std::shared_ptr<Listener> listen(const std::vector<std::string>&);
@@ -78,11 +436,90 @@ class Context final {
       const std::string&,
       PipeOptions opts = PipeOptions());
 
+  // Open numPipes pipes to the given URL ahead of time, and keep them in a pool
+  // from which the following calls to connect to that URL take them (oldest
+  // first, and ignoring the options given to them in favor of these ones)
+  // rather than opening new ones, so that the first message on these pipes
+  // doesn't have to wait for the handshake. Each pipe taken from the pool is
+  // replaced in background. Pipes that fail while in the pool are dropped from
+  // it, and are only replaced by the next call to connect, to avoid retrying
+  // endlessly against a peer that's gone. The remote end accepts the pipes as
+  // they're opened, rather than when they're taken from the pool. Calling this
+  // again for the same URL resizes its pool, and a size of zero removes it.
+  void prewarm(
+      const std::string& url,
+      size_t numPipes,
+      PipeOptions opts = PipeOptions());
+
+  // Have each channel of the buffer's device type do ahead of time the setup
+  // it would otherwise do for every transfer from or to that buffer (e.g.,
+  // registering it with an InfiniBand device, or exporting a CUDA IPC handle
+  // for it), and keep it until the returned handle is destroyed. This turns a
+  // per-message cost into a one-time one for the buffers that are reused for
+  // many messages, and covers the tensors whose buffers lie within this one,
+  // without them having to refer to the handle. The buffer must not be freed
+  // while the handle is alive. Channels registered later aren't covered.
+  std::shared_ptr<void> registerBuffer(Buffer buffer);
+
+  // Retrieve the counters of the context's pipes and transports, which are
+  // kept at all times, as they're cheap to maintain. This is meant for
+  // monitoring, as they may have changed by the time this returns.
+  ContextStats getStats();
+
+  // Describe, as human-readable text, what each pipe of the context is waiting
+  // on: the state of its handshake, its read and write operations by state,
+  // how deep its queues are, how many bytes each channel has in flight, how
+  // long the oldest operation has been pending and, for the shm and ibv
+  // transports, how full the rings of its connection are. This is meant for
+  // debugging hangs and slowdowns. Each pipe is asked to describe itself from
+  // its own loop, without stopping the others, and the ones that don't answer
+  // within the timeout (because their loop is stuck, or is the caller's) are
+  // reported as such. This blocks, and isn't async-signal-safe, hence a
+  // signal handler should only wake up a thread that calls it (e.g., one that
+  // waits for the signal with sigwait).
+  std::string dumpState(
+      std::chrono::milliseconds timeout = std::chrono::seconds(1));
+
+  // Bound the rate, in bytes per second, at which all the pipes of the context
+  // together write the payloads and tensors of their messages, with a token
+  // bucket that lets bursts of up to the given amount of bytes through (by
+  // default, a tenth of a second's worth). The limit is applied to the writes
+  // when they're admitted, hence a write that would exceed it stays queued, as
+  // if the pipe had reached its maximum of outstanding writes, and producers
+  // see the backpressure through Pipe::waitForWriteCapacity. It can be changed
+  // at any time, and a rate of zero removes it. Pipes can opt out of it (see
+  // Pipe::setWriteRateLimit), so that latency-critical traffic isn't delayed
+  // by the throttling of bulk transfers.
+  void setWriteRateLimit(double bytesPerSecond, size_t burstBytes = 0);
+
+  // Have the calling thread hold back the work that it hands over to the
+  // threads of the transports and channels (e.g., for the reads and writes it
+  // issues on pipes), and hand it over, with a single wakeup of each of these
+  // threads, at the end of the batch, at each call to flush, or once it held
+  // back a few dozen tasks for one thread. This saves a syscall per operation
+  // when issuing them in bursts. Batches apply to all contexts and may be
+  // nested. While a batch is open, the thread must not block waiting for the
+  // operations it issued (e.g., through the sync methods of the pipes, which
+  // do flush first, or on futures fulfilled by their callbacks) without
+  // flushing. Closing a context flushes the calling thread's batch, but the
+  // batches of other threads must be flushed before then. These must not be
+  // called from within callbacks.
+  void beginBatch();
+  void flush();
+  void endBatch();
+
   // Put the context in a terminal state, in turn closing all of its pipes and
   // listeners, and release its resources. This may be done asynchronously, in
   // background.
   void close();
 
+  // Like close, but without waiting for the work that was already handed to
+  // the channels to complete: the copies they had queued but not started yet
+  // are dropped, and the operations they belonged to fail. Meant for processes
+  // that are shutting down anyway, and that don't want to wait for transfers
+  // whose results they'll never look at.
+  void closeFast();
+
   // Wait for all resources to be released and all background activity to stop.
   void join();
 
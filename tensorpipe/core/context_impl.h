@@ -8,12 +8,16 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/latency_histogram.h>
+#include <tensorpipe/common/token_bucket.h>
 #include <tensorpipe/config.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/transport/context.h>
@@ -27,6 +31,110 @@ namespace tensorpipe {
 
 class Listener;
 class Pipe;
+class TrafficRecorder;
+
+// The instances of a channel that a pipe opens for the priority classes above
+// the lowest one are named after the channel, followed by this separator and
+// by the index of the class.
+constexpr char kChannelInstanceSeparator = '@';
+
+// A count of the bytes of memory held for some purpose, which are added to the
+// count of a parent too (e.g., a pipe's to its context's), and given back to it
+// when this count goes away. It may be updated and read from any thread.
+class MemoryCounter {
+ public:
+  explicit MemoryCounter(std::shared_ptr<MemoryCounter> parent = nullptr)
+      : parent_(std::move(parent)) {}
+
+  MemoryCounter(const MemoryCounter&) = delete;
+  MemoryCounter& operator=(const MemoryCounter&) = delete;
+
+  void add(uint64_t numBytes) {
+    numBytes_.fetch_add(numBytes, std::memory_order_relaxed);
+    if (parent_ != nullptr) {
+      parent_->add(numBytes);
+    }
+  }
+
+  void remove(uint64_t numBytes) {
+    numBytes_.fetch_sub(numBytes, std::memory_order_relaxed);
+    if (parent_ != nullptr) {
+      parent_->remove(numBytes);
+    }
+  }
+
+  uint64_t getNumBytes() const {
+    return numBytes_.load(std::memory_order_relaxed);
+  }
+
+  ~MemoryCounter() {
+    if (parent_ != nullptr) {
+      parent_->remove(getNumBytes());
+    }
+  }
+
+ private:
+  const std::shared_ptr<MemoryCounter> parent_;
+  std::atomic<uint64_t> numBytes_{0};
+};
+
+// The counters that a pipe updates, from its loop, as messages go through it,
+// and that the context may read, from any thread, to report its stats.
+struct PipeCounters {
+  PipeCounters(
+      std::string id,
+      std::string transport,
+      std::vector<std::string> writeStageNames,
+      std::vector<std::string> readStageNames,
+      std::shared_ptr<MemoryCounter> contextStagingMemory,
+      std::shared_ptr<MemoryCounter> contextOperationMemory)
+      : id(std::move(id)),
+        transport(std::move(transport)),
+        writeStageNames(std::move(writeStageNames)),
+        writeStageNanoseconds(this->writeStageNames.size()),
+        readStageNames(std::move(readStageNames)),
+        readStageNanoseconds(this->readStageNames.size()),
+        stagingMemory(
+            std::make_shared<MemoryCounter>(std::move(contextStagingMemory))),
+        operationMemory(std::make_shared<MemoryCounter>(
+            std::move(contextOperationMemory))) {}
+
+  const std::string id;
+  const std::string transport;
+  std::atomic<uint64_t> numMessagesWritten{0};
+  std::atomic<uint64_t> numBytesWritten{0};
+  std::atomic<uint64_t> numMessagesRead{0};
+  std::atomic<uint64_t> numBytesRead{0};
+  const std::vector<std::string> writeStageNames;
+  std::vector<std::atomic<uint64_t>> writeStageNanoseconds;
+  const std::vector<std::string> readStageNames;
+  std::vector<std::atomic<uint64_t>> readStageNanoseconds;
+  // From having read the descriptor of a message to having all of its payloads
+  // and tensors, from calling send on a channel to its callback, and from
+  // handing buffers to the connection to their write completing.
+  LatencyHistogram readLatency;
+  LatencyHistogram channelSendLatency;
+  LatencyHistogram transportWriteLatency;
+  // The memory of the staging buffers, which is counted until they're freed,
+  // even if that's after the pipe is gone (as a channel may hold on to them),
+  // and the one of the operations.
+  const std::shared_ptr<MemoryCounter> stagingMemory;
+  const std::shared_ptr<MemoryCounter> operationMemory;
+};
+
+// What a pipe offers the context so that it can be included in the context's
+// dump of its state, without the context knowing about the pipe's internals.
+class PipeStateDumper {
+ public:
+  using dump_state_callback_fn = Function<void(std::string)>;
+
+  // Describe what the pipe is waiting on. The callback is called from the
+  // pipe's loop (or from the one of its connection), and thus possibly never,
+  // if one of them is blocked, which the caller is expected to deal with.
+  virtual void dumpState(dump_state_callback_fn fn) = 0;
+
+  virtual ~PipeStateDumper() = default;
+};
 
 class Context::PrivateIface {
  public:
@@ -49,10 +157,15 @@ class Context::PrivateIface {
 
   virtual const TOrderedTransports& getOrderedTransports() = 0;
 
+  // For each channel, its name, its context, and the maximum length of the
+  // tensors it should be used for.
   template <typename TBuffer>
   using TOrderedChannels = std::map<
       int64_t,
-      std::tuple<std::string, std::shared_ptr<channel::Context<TBuffer>>>>;
+      std::tuple<
+          std::string,
+          std::shared_ptr<channel::Context<TBuffer>>,
+          size_t>>;
 
   virtual const TOrderedChannels<CpuBuffer>& getOrderedCpuChannels() = 0;
 
@@ -64,6 +177,109 @@ class Context::PrivateIface {
   // by the pipes and listener in order to attach it to logged messages.
   virtual const std::string& getName() = 0;
 
+  // Return the size up to which CPU tensors are sent inline, over the pipe's
+  // connection, rather than through a channel.
+  virtual size_t getInlineTensorThreshold() = 0;
+
+  // Return the size up to which CPU tensors are packed together into a single
+  // transfer over a channel.
+  virtual size_t getTensorPackingThreshold() = 0;
+
+  // Return whether pipes should write message descriptors before the channels
+  // have produced the descriptors of the tensors.
+  virtual bool getEarlyMessageDescriptors() = 0;
+
+  // Return whether pipes may complete reads and writes out of order.
+  virtual bool getOutOfOrderCompletion() = 0;
+
+  // Return how many instances of each channel pipes should open at most.
+  virtual size_t getNumPriorityClasses() = 0;
+
+  // Return up to how many bytes pipes should coalesce into one write.
+  virtual size_t getWriteCoalescingLimit() = 0;
+
+  // Return whether pipes should send repeated descriptor strings by id.
+  virtual bool getDescriptorStringInterning() = 0;
+
+  // Return whether pipes may write simple message descriptors compactly.
+  virtual bool getCompactMessageDescriptors() = 0;
+
+  // Return whether pipes should send the data of repeated buffers only once.
+  virtual bool getDeduplicateBuffers() = 0;
+
+  // Return whether pipes should pick channels based on their measured speed.
+  virtual bool getChannelAutoTuning() = 0;
+
+  // Return the size of the chunks that pipes should split payloads into.
+  virtual size_t getPayloadChunkSize() = 0;
+
+  // Return whether pipes should connect channels only when first used.
+  virtual bool getLazyChannelEstablishment() = 0;
+
+  // Return whether pipes should connect channels before they're selected.
+  virtual bool getSpeculativeChannelConnections() = 0;
+
+  // Return whether pipes should move to a faster transport in the background.
+  virtual bool getTransportUpgrade() = 0;
+
+  // Return the executor given to the context's constructor, which may be
+  // empty. It will be used to invoke the callbacks of pipes and listeners.
+  virtual const ContextOptions::executor_fn& getCallbackExecutor() = 0;
+
+  // Return how many messages, and how many bytes, each pipe may be writing at
+  // once, and how many bytes all pipes together may (zero meaning no limit).
+  virtual size_t getMaxOutstandingWritesPerPipe() = 0;
+  virtual size_t getMaxOutstandingWriteBytesPerPipe() = 0;
+  virtual size_t getMaxOutstandingWriteBytes() = 0;
+
+  // Take the given number of bytes out of the ones that all pipes together may
+  // be writing at once, and give them back. If there aren't enough, reserving
+  // fails and the callback is invoked, once, as soon as some are given back,
+  // from within that call, hence possibly from the loop of another pipe.
+  virtual bool reserveWriteBytes(size_t numBytes, Function<void()> fn) = 0;
+  virtual void releaseWriteBytes(size_t numBytes) = 0;
+
+  // Return the bucket that bounds the rate at which all pipes together write
+  // (see Context::setWriteRateLimit), and have the callback invoked once the
+  // delay has passed, or earlier if the limit changes, from an internal thread
+  // of the context. It is never invoked if the context is joined before.
+  virtual TokenBucket& getWriteRateLimiter() = 0;
+  virtual void waitForWriteRate(
+      TokenBucket::clock::duration delay,
+      Function<void()> fn) = 0;
+
+  // Return the allocator given to the context's constructor, which may be
+  // empty. It will be used by the pipes to allocate incoming messages.
+  virtual const ContextOptions::allocator_fn& getAllocator() = 0;
+
+  // Take the given number of bytes out of the allocator's memory budget, if
+  // there are enough left (or if there is no budget), and give them back.
+  virtual bool reserveAllocatorBytes(size_t numBytes) = 0;
+  virtual void releaseAllocatorBytes(size_t numBytes) = 0;
+
+  // Return the counters of the memory that all pipes hold, which are the
+  // parents of the ones of each pipe, and whether the total is above the soft
+  // limit (see ContextOptions).
+  virtual std::shared_ptr<MemoryCounter> getStagingMemory() = 0;
+  virtual std::shared_ptr<MemoryCounter> getOperationMemory() = 0;
+  virtual bool isOverMemorySoftLimit() = 0;
+
+  // Have the counters of a pipe included in the context's stats. Once the pipe
+  // releases them they're folded into the totals of the context.
+  virtual void registerPipeCounters(
+      std::shared_ptr<PipeCounters> counters) = 0;
+
+  // Have a pipe included in the context's dump of its state for as long as it
+  // is alive, hence it's only referenced weakly. The identifier is used for the
+  // pipes that don't answer.
+  virtual void registerPipeStateDumper(
+      std::string id,
+      std::weak_ptr<PipeStateDumper> dumper) = 0;
+
+  // Return the recorder of the shapes of the written messages, or null if the
+  // context wasn't asked to record them.
+  virtual TrafficRecorder* getTrafficRecorder() = 0;
+
   virtual ~PrivateIface() = default;
 };
 
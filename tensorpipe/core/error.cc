@@ -26,4 +26,16 @@ std::string PipeClosedError::what() const {
   return "pipe closed";
 }
 
+std::string RpcCancelledError::what() const {
+  return "rpc cancelled";
+}
+
+std::string RpcTimeoutError::what() const {
+  return "rpc timed out";
+}
+
+std::string WriteDeadlineExceededError::what() const {
+  return "write deadline exceeded";
+}
+
 } // namespace tensorpipe
@@ -38,4 +38,25 @@ class PipeClosedError final : public BaseError {
   std::string what() const override;
 };
 
+class RpcCancelledError final : public BaseError {
+ public:
+  explicit RpcCancelledError() {}
+
+  std::string what() const override;
+};
+
+class RpcTimeoutError final : public BaseError {
+ public:
+  explicit RpcTimeoutError() {}
+
+  std::string what() const override;
+};
+
+class WriteDeadlineExceededError final : public BaseError {
+ public:
+  explicit WriteDeadlineExceededError() {}
+
+  std::string what() const override;
+};
+
 } // namespace tensorpipe
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <tensorpipe/channel/channel.h>
+#include <tensorpipe/channel/error.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/function.h>
+
+namespace tensorpipe {
+
+// Stands for a channel of a pipe whose connection hasn't been opened yet. The
+// operations it's given are queued until the actual channel is provided, and
+// then handed to it in order. If a function to connect is given, it's invoked
+// the first time the channel is used, from within that call, and it must then
+// return the actual channel. Otherwise, the channel is expected to be provided
+// later through setChannel. All methods must be called from the pipe's loop.
+template <typename TBuffer>
+class LazyChannel final : public channel::Channel<TBuffer> {
+ public:
+  using connect_fn = Function<std::shared_ptr<channel::Channel<TBuffer>>()>;
+
+  explicit LazyChannel(connect_fn fn = nullptr) : connect_(std::move(fn)) {}
+
+  void send(
+      TBuffer buffer,
+      channel::TDescriptorCallback descriptorCallback,
+      channel::TSendCallback callback) override {
+    if (channel_ != nullptr) {
+      channel_->send(
+          std::move(buffer),
+          std::move(descriptorCallback),
+          std::move(callback));
+      return;
+    }
+    Operation op;
+    op.isSend = true;
+    op.buffer = std::move(buffer);
+    op.descriptorCallback = std::move(descriptorCallback);
+    op.callback = std::move(callback);
+    pendingOperations_.push_back(std::move(op));
+    connectIfNeeded_();
+  }
+
+  void sendOwned(
+      TBuffer buffer,
+      std::shared_ptr<void> owner,
+      channel::TDescriptorCallback descriptorCallback,
+      channel::TSendCallback callback) override {
+    if (channel_ != nullptr) {
+      channel_->sendOwned(
+          std::move(buffer),
+          std::move(owner),
+          std::move(descriptorCallback),
+          std::move(callback));
+      return;
+    }
+    Operation op;
+    op.isSend = true;
+    op.buffer = std::move(buffer);
+    op.owner = std::move(owner);
+    op.descriptorCallback = std::move(descriptorCallback);
+    op.callback = std::move(callback);
+    pendingOperations_.push_back(std::move(op));
+    connectIfNeeded_();
+  }
+
+  void recv(
+      channel::TDescriptor descriptor,
+      TBuffer buffer,
+      channel::TRecvCallback callback) override {
+    if (channel_ != nullptr) {
+      channel_->recv(
+          std::move(descriptor), std::move(buffer), std::move(callback));
+      return;
+    }
+    Operation op;
+    op.isSend = false;
+    op.descriptor = std::move(descriptor);
+    op.buffer = std::move(buffer);
+    op.callback = std::move(callback);
+    pendingOperations_.push_back(std::move(op));
+    connectIfNeeded_();
+  }
+
+  void recvOwned(
+      channel::TDescriptor descriptor,
+      TBuffer buffer,
+      typename channel::Channel<TBuffer>::TRecvOwnedCallback callback)
+      override {
+    if (channel_ != nullptr) {
+      channel_->recvOwned(
+          std::move(descriptor), std::move(buffer), std::move(callback));
+      return;
+    }
+    Operation op;
+    op.isSend = false;
+    op.descriptor = std::move(descriptor);
+    op.buffer = std::move(buffer);
+    op.ownedCallback = std::move(callback);
+    pendingOperations_.push_back(std::move(op));
+    connectIfNeeded_();
+  }
+
+  void beginBatch() override {
+    if (channel_ != nullptr) {
+      channel_->beginBatch();
+    }
+  }
+
+  void endBatch() override {
+    if (channel_ != nullptr) {
+      channel_->endBatch();
+    }
+  }
+
+  void setId(std::string id) override {
+    if (channel_ != nullptr) {
+      channel_->setId(id);
+    }
+    id_ = std::move(id);
+  }
+
+  void close() override {
+    closed_ = true;
+    if (channel_ != nullptr) {
+      channel_->close();
+      return;
+    }
+    // The callbacks the pipe gives to channels defer to its loop, hence they
+    // can be invoked from within this call.
+    std::deque<Operation> ops = std::move(pendingOperations_);
+    pendingOperations_.clear();
+    for (Operation& op : ops) {
+      Error error = TP_CREATE_ERROR(channel::ChannelClosedError);
+      if (op.isSend) {
+        op.descriptorCallback(error, channel::TDescriptor());
+      }
+      if (op.ownedCallback) {
+        op.ownedCallback(error, std::move(op.buffer), nullptr);
+      } else {
+        op.callback(error);
+      }
+    }
+  }
+
+  bool isConnected() const {
+    return channel_ != nullptr;
+  }
+
+  void setChannel(std::shared_ptr<channel::Channel<TBuffer>> channel) {
+    TP_DCHECK(channel_ == nullptr);
+    channel_ = std::move(channel);
+    if (!id_.empty()) {
+      channel_->setId(id_);
+    }
+    if (closed_) {
+      channel_->close();
+    }
+    // If closed, the channel fails these operations itself.
+    std::deque<Operation> ops = std::move(pendingOperations_);
+    pendingOperations_.clear();
+    for (Operation& op : ops) {
+      if (op.isSend && op.owner != nullptr) {
+        channel_->sendOwned(
+            std::move(op.buffer),
+            std::move(op.owner),
+            std::move(op.descriptorCallback),
+            std::move(op.callback));
+      } else if (op.isSend) {
+        channel_->send(
+            std::move(op.buffer),
+            std::move(op.descriptorCallback),
+            std::move(op.callback));
+      } else if (op.ownedCallback) {
+        channel_->recvOwned(
+            std::move(op.descriptor),
+            std::move(op.buffer),
+            std::move(op.ownedCallback));
+      } else {
+        channel_->recv(
+            std::move(op.descriptor),
+            std::move(op.buffer),
+            std::move(op.callback));
+      }
+    }
+  }
+
+ private:
+  struct Operation {
+    bool isSend;
+    TBuffer buffer;
+    channel::TDescriptor descriptor;
+    channel::TDescriptorCallback descriptorCallback;
+    Function<void(const Error&)> callback;
+    // Only set for sendOwned and recvOwned, respectively.
+    std::shared_ptr<void> owner;
+    typename channel::Channel<TBuffer>::TRecvOwnedCallback ownedCallback;
+  };
+
+  connect_fn connect_;
+  bool connecting_{false};
+  bool closed_{false};
+  std::string id_;
+  std::shared_ptr<channel::Channel<TBuffer>> channel_;
+  std::deque<Operation> pendingOperations_;
+
+  void connectIfNeeded_() {
+    if (!connect_ || connecting_ || closed_) {
+      return;
+    }
+    connecting_ = true;
+    setChannel(connect_());
+  }
+};
+
+} // namespace tensorpipe
@@ -9,6 +9,7 @@
 #include <tensorpipe/core/listener.h>
 
 #include <deque>
+#include <unordered_map>
 #include <unordered_set>
 
 #include <tensorpipe/common/address.h>
@@ -50,6 +51,11 @@ class Listener::Impl : public Listener::PrivateIface,
   uint64_t registerConnectionRequest(connection_request_callback_fn) override;
   void unregisterConnectionRequest(uint64_t) override;
 
+  void registerSpeculativeConnection(
+      std::string,
+      connection_request_callback_fn) override;
+  void unregisterSpeculativeConnection(std::string) override;
+
   void close();
 
   ~Impl() override = default;
@@ -102,6 +108,18 @@ class Listener::Impl : public Listener::PrivateIface,
   std::unordered_map<uint64_t, connection_request_callback_fn>
       connectionRequestRegistrations_;
 
+  // Speculative connections are opened by the client before the pipe on this
+  // side registers them, hence they may arrive first, in which case they're
+  // kept until the pipe either claims them or abandons them. The tags that are
+  // abandoned before their connection arrives are remembered until it does.
+  std::unordered_map<std::string, connection_request_callback_fn>
+      speculativeConnectionRegistrations_;
+  std::unordered_map<
+      std::string,
+      std::pair<std::string, std::shared_ptr<transport::Connection>>>
+      unclaimedSpeculativeConnections_;
+  std::unordered_set<std::string> abandonedSpeculativeConnections_;
+
   ClosingReceiver closingReceiver_;
 
   //
@@ -120,6 +138,12 @@ class Listener::Impl : public Listener::PrivateIface,
 
   void unregisterConnectionRequestFromLoop_(uint64_t);
 
+  void registerSpeculativeConnectionFromLoop_(
+      std::string,
+      connection_request_callback_fn);
+
+  void unregisterSpeculativeConnectionFromLoop_(std::string);
+
   //
   // Helpers to prepare callbacks from transports
   //
@@ -236,7 +260,15 @@ void Listener::Impl::acceptFromLoop_(accept_callback_fn fn) {
     TP_DCHECK_EQ(sequenceNumber, nextAcceptCallbackToCall_++);
     TP_VLOG(1) << "Listener " << id_ << " is calling an accept callback (#"
                << sequenceNumber << ")";
-    fn(error, std::move(pipe));
+    const ContextOptions::executor_fn& executor =
+        context_->getCallbackExecutor();
+    if (executor) {
+      executor([fn, error, pipe{std::move(pipe)}]() mutable {
+        fn(error, std::move(pipe));
+      });
+    } else {
+      fn(error, std::move(pipe));
+    }
     TP_VLOG(1) << "Listener " << id_ << " done calling an accept callback (#"
                << sequenceNumber << ")";
   };
@@ -344,6 +376,65 @@ void Listener::Impl::unregisterConnectionRequestFromLoop_(
   connectionRequestRegistrations_.erase(registrationId);
 }
 
+void Listener::Impl::registerSpeculativeConnection(
+    std::string tag,
+    connection_request_callback_fn fn) {
+  loop_.deferToLoop([this, tag{std::move(tag)}, fn{std::move(fn)}]() mutable {
+    registerSpeculativeConnectionFromLoop_(std::move(tag), std::move(fn));
+  });
+}
+
+void Listener::Impl::registerSpeculativeConnectionFromLoop_(
+    std::string tag,
+    connection_request_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(1) << "Listener " << id_
+             << " received a speculative connection registration (" << tag
+             << ")";
+
+  if (error_) {
+    fn(error_, std::string(), std::shared_ptr<transport::Connection>());
+    return;
+  }
+
+  auto iter = unclaimedSpeculativeConnections_.find(tag);
+  if (iter != unclaimedSpeculativeConnections_.end()) {
+    std::string transport = std::move(iter->second.first);
+    std::shared_ptr<transport::Connection> connection =
+        std::move(iter->second.second);
+    unclaimedSpeculativeConnections_.erase(iter);
+    fn(Error::kSuccess, std::move(transport), std::move(connection));
+    return;
+  }
+  speculativeConnectionRegistrations_.emplace(std::move(tag), std::move(fn));
+}
+
+void Listener::Impl::unregisterSpeculativeConnection(std::string tag) {
+  loop_.deferToLoop([this, tag{std::move(tag)}]() mutable {
+    unregisterSpeculativeConnectionFromLoop_(std::move(tag));
+  });
+}
+
+void Listener::Impl::unregisterSpeculativeConnectionFromLoop_(std::string tag) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(1) << "Listener " << id_
+             << " received a speculative connection de-registration (" << tag
+             << ")";
+
+  if (speculativeConnectionRegistrations_.erase(tag) > 0) {
+    return;
+  }
+  auto iter = unclaimedSpeculativeConnections_.find(tag);
+  if (iter != unclaimedSpeculativeConnections_.end()) {
+    iter->second.second->close();
+    unclaimedSpeculativeConnections_.erase(iter);
+    return;
+  }
+  if (!error_) {
+    abandonedSpeculativeConnections_.insert(std::move(tag));
+  }
+}
+
 //
 // Error handling
 //
@@ -371,6 +462,16 @@ void Listener::Impl::handleError_() {
     fn(error_, std::string(), std::shared_ptr<transport::Connection>());
   }
   connectionRequestRegistrations_.clear();
+  for (auto& iter : speculativeConnectionRegistrations_) {
+    connection_request_callback_fn fn = std::move(iter.second);
+    fn(error_, std::string(), std::shared_ptr<transport::Connection>());
+  }
+  speculativeConnectionRegistrations_.clear();
+  for (auto& iter : unclaimedSpeculativeConnections_) {
+    iter.second.second->close();
+  }
+  unclaimedSpeculativeConnections_.clear();
+  abandonedSpeculativeConnections_.clear();
 
   for (const auto& listener : listeners_) {
     listener.second->close();
@@ -470,6 +571,21 @@ void Listener::Impl::onConnectionHelloRead_(
       connectionRequestRegistrations_.erase(iter);
       fn(Error::kSuccess, std::move(transport), std::move(connection));
     }
+  } else if (nopPacketIn.is<SpeculativeConnection>()) {
+    const std::string& tag = nopPacketIn.get<SpeculativeConnection>()->tag;
+    TP_VLOG(3) << "Listener " << id_ << " got speculative connection (" << tag
+               << ")";
+    auto iter = speculativeConnectionRegistrations_.find(tag);
+    if (iter != speculativeConnectionRegistrations_.end()) {
+      auto fn = std::move(iter->second);
+      speculativeConnectionRegistrations_.erase(iter);
+      fn(Error::kSuccess, std::move(transport), std::move(connection));
+    } else if (abandonedSpeculativeConnections_.erase(tag) > 0) {
+      connection->close();
+    } else {
+      unclaimedSpeculativeConnections_.emplace(
+          tag, std::make_pair(std::move(transport), std::move(connection)));
+    }
   } else {
     TP_LOG_ERROR() << "packet contained unknown content: "
                    << nopPacketIn.index();
@@ -29,6 +29,15 @@ class Listener::PrivateIface {
 
   virtual void unregisterConnectionRequest(uint64_t) = 0;
 
+  // Hand to the callback the speculative connection with the given tag, which
+  // may arrive before or after this call. Unregistering a tag, also one that
+  // wasn't registered, closes its connection, whenever it arrives.
+  virtual void registerSpeculativeConnection(
+      std::string,
+      connection_request_callback_fn) = 0;
+
+  virtual void unregisterSpeculativeConnection(std::string) = 0;
+
   virtual const std::map<std::string, std::string>& addresses() const = 0;
 
   virtual ~PrivateIface() = default;
@@ -9,9 +9,12 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <tensorpipe/common/optional.h>
 #include <tensorpipe/core/buffer.h>
 
 namespace tensorpipe {
@@ -37,6 +40,13 @@ class Message final {
 
   std::string metadata;
 
+  // A range of a file, starting at the given offset and as long as the payload
+  // or the tensor that refers to it.
+  struct FileRange {
+    int fd{-1};
+    uint64_t offset{0};
+  };
+
   struct Payload {
     void* data{nullptr};
     size_t length{0};
@@ -44,6 +54,26 @@ class Message final {
     // Users may include arbitrary metadata in the following fields.
     // This may contain allocation hints for the receiver, for example.
     std::string metadata;
+
+    // When reading, this is set to the index of an earlier payload if the
+    // sender had the same buffer for both (see the deduplicateBuffers option of
+    // the context). The data is then only transferred once, and copied here,
+    // unless the payload is left with a null pointer, in which case it's given
+    // the memory of that earlier payload, which it then shares.
+    optional<size_t> duplicateOf;
+
+    // When reading, a payload may be left with a null pointer to have the pipe
+    // allocate its memory, which is then owned by this field.
+    std::shared_ptr<void> owner;
+
+    // If set while the data pointer is null, the data lives in this range of a
+    // file, which the pipe maps instead of the user reading it into memory (or
+    // writing it out), so that it goes straight between the page cache and the
+    // transport. When writing, the data is read from the file, and the pipe
+    // sets the data pointer and the owner to a private mapping of it. When
+    // reading, the data is written into the file, which is extended if needed,
+    // through a shared mapping that's then owned by the owner field.
+    optional<FileRange> file;
   };
 
   // Holds the payloads that are transferred over the primary connection.
@@ -55,10 +85,51 @@ class Message final {
     // Users may include arbitrary metadata in the following field.
     // This may contain allocation hints for the receiver, for example.
     std::string metadata;
+
+    // When writing, this may be set to the owner of the memory of a CPU
+    // buffer, to hand that memory over to the receiver: channels that can
+    // (i.e., XTH, within a process) give it the memory itself, rather than a
+    // copy. The pipe takes this share of the ownership away from the message.
+    // When reading, a CPU buffer may be left with a null pointer to have the
+    // pipe provide the memory, which is then the one handed over by the sender
+    // if any, or a newly allocated one otherwise, and is owned by this field.
+    std::shared_ptr<void> owner;
+
+    // When writing, this may be set to the name of a registered channel to
+    // send the tensor over that one, if the pipe has it, rather than over the
+    // one picked by length. This is how channels that alter the data (e.g.,
+    // that quantize it) are opted into, one tensor at a time.
+    std::string channel;
+
+    // When reading, this is set to the index of an earlier tensor if the sender
+    // had the same CPU buffer for both (see the deduplicateBuffers option of
+    // the context). The data is then only transferred once, and copied here,
+    // unless the buffer is left with a null pointer, in which case it's given
+    // the memory of that earlier tensor, which it then shares.
+    optional<size_t> duplicateOf;
+
+    // Like for payloads, a CPU buffer with a null pointer may refer to a range
+    // of a file instead. When writing, the private mapping becomes the owner,
+    // which may thus be handed over to the receiver (see above), and channels
+    // that copy out of the sender's memory (e.g., CMA, or shared memory) do so
+    // straight from the page cache.
+    optional<FileRange> file;
   };
 
   // Holds the tensors that are offered to the side channels.
   std::vector<Tensor> tensors;
+
+  // When writing, this may be set to an identifier that was returned by the
+  // pipe's registerMessageTemplate, in which case the message must have the
+  // metadata and the layout of that template, and the pipe sends only what
+  // changes from one such message to the next, instead of a full descriptor.
+  optional<uint64_t> templateId;
+
+  // When writing, this may be set to a tag of the user's choosing, which is
+  // carried over to the receiver. There, the message is read straight into the
+  // buffers of a read posted for that tag, if any (see Pipe::postRead), rather
+  // than being handed to readDescriptor. When reading, this is set to the tag.
+  optional<uint64_t> tag;
 };
 
 } // namespace tensorpipe
@@ -30,6 +30,14 @@ struct RequestedConnection {
   NOP_STRUCTURE(RequestedConnection, registrationId);
 };
 
+// Opened by the client for a channel together with the brochure, before the
+// server has selected it, and identified by a tag that both sides derive from
+// the brochure's speculation token and the channel's name.
+struct SpeculativeConnection {
+  std::string tag;
+  NOP_STRUCTURE(SpeculativeConnection, tag);
+};
+
 struct TransportAdvertisement {
   std::string domainDescriptor;
   NOP_STRUCTURE(TransportAdvertisement, domainDescriptor);
@@ -46,16 +54,36 @@ struct Brochure {
   std::unordered_map<std::string, ChannelAdvertisement> cpuChannelAdvertisement;
   std::unordered_map<std::string, ChannelAdvertisement>
       cudaChannelAdvertisement;
+  uint64_t numPriorityClasses{1};
+  uint64_t payloadChunkSize{0};
+  bool lazyChannelEstablishment{false};
+  // If non-zero, the client has opened a speculative connection for each
+  // instance of each channel it advertises, over the transport of the pipe.
+  uint64_t speculationToken{0};
+  // Whether the client can read and write compact message descriptors.
+  bool compactMessageDescriptors{false};
+  // Whether the client can keep using the pipe's connection while it connects
+  // the transport that the server picks.
+  bool transportUpgrade{false};
   NOP_STRUCTURE(
       Brochure,
       transportAdvertisement,
       cpuChannelAdvertisement,
-      cudaChannelAdvertisement);
+      cudaChannelAdvertisement,
+      numPriorityClasses,
+      payloadChunkSize,
+      lazyChannelEstablishment,
+      speculationToken,
+      compactMessageDescriptors,
+      transportUpgrade);
 };
 
 struct ChannelSelection {
   uint64_t registrationId;
-  NOP_STRUCTURE(ChannelSelection, registrationId);
+  // Whether the client must use its speculative connection for the channel,
+  // rather than open a new one for the registration.
+  bool useSpeculativeConnection{false};
+  NOP_STRUCTURE(ChannelSelection, registrationId, useSpeculativeConnection);
 };
 
 struct BrochureAnswer {
@@ -64,15 +92,33 @@ struct BrochureAnswer {
   uint64_t registrationId;
   std::unordered_map<std::string, ChannelSelection> cpuChannelSelection;
   std::unordered_map<std::string, ChannelSelection> cudaChannelSelection;
+  // The one that both directions of the pipe will use, picked by the server.
+  uint64_t payloadChunkSize{0};
+  // Whether the client should connect the channels only once they're used.
+  bool lazyChannelEstablishment{false};
+  // Whether both sides write the descriptors that fit it in the fixed layout of
+  // PacketHolder, rather than as a MessageDescriptor.
+  bool compactMessageDescriptors{false};
+  // Whether the client must connect the transport in the background, rather
+  // than replace the pipe's connection with it right away.
+  bool transportUpgrade{false};
   NOP_STRUCTURE(
       BrochureAnswer,
       transport,
       address,
       registrationId,
       cpuChannelSelection,
-      cudaChannelSelection);
+      cudaChannelSelection,
+      payloadChunkSize,
+      lazyChannelEstablishment,
+      compactMessageDescriptors,
+      transportUpgrade);
 };
 
+// The strings of a MessageDescriptor that have an id next to them may be sent
+// only once per pipe. A zero id means the string is sent as is. Otherwise, the
+// first time, the string is sent together with its new id and the receiver
+// remembers it, and from then on only the id is sent, with an empty string.
 struct MessageDescriptor {
   struct PayloadDescriptor {
     // This pointless constructor is needed to work around a bug in GCC 5.5 (and
@@ -82,7 +128,16 @@ struct MessageDescriptor {
 
     int64_t sizeInBytes;
     std::string metadata;
-    NOP_STRUCTURE(PayloadDescriptor, sizeInBytes, metadata);
+    uint64_t metadataId;
+    // The index of an earlier payload that the sender had the same buffer for,
+    // in which case the data isn't sent again, or -1.
+    int64_t duplicateOf;
+    NOP_STRUCTURE(
+        PayloadDescriptor,
+        sizeInBytes,
+        metadata,
+        metadataId,
+        duplicateOf);
   };
 
   struct TensorDescriptor {
@@ -93,27 +148,108 @@ struct MessageDescriptor {
 
     int64_t sizeInBytes;
     std::string metadata;
+    uint64_t metadataId;
 
     DeviceType deviceType;
+    // Small CPU tensors may be sent over the connection, right after the
+    // payloads, rather than through a channel. In that case the channel name
+    // and descriptor are empty.
+    bool isInline;
+    // Or, if not inline, they may be packed together (see below), in which
+    // case the channel name and descriptor are empty too.
+    bool isPacked;
     std::string channelName;
+    uint64_t channelNameId;
     std::string channelDescriptor;
+    // The index of an earlier tensor that the sender had the same buffer for,
+    // in which case the data isn't sent again (the tensor isn't inline, and its
+    // channel name and descriptor are empty), or -1.
+    int64_t duplicateOf;
     NOP_STRUCTURE(
         TensorDescriptor,
         sizeInBytes,
         metadata,
+        metadataId,
         deviceType,
+        isInline,
+        isPacked,
         channelName,
-        channelDescriptor);
+        channelNameId,
+        channelDescriptor,
+        duplicateOf);
   };
 
   std::string metadata;
+  uint64_t metadataId;
   std::vector<PayloadDescriptor> payloadDescriptors;
   std::vector<TensorDescriptor> tensorDescriptors;
+  // The total length of the packed tensors, which are laid out one after the
+  // other, in order, in a single buffer sent over this channel. Zero if none.
+  int64_t packLength;
+  std::string packChannelName;
+  std::string packChannelDescriptor;
+  // Whether the channel descriptors of the tensors are left empty and instead
+  // follow the payloads and inline tensors, one TensorChannelDescriptor for
+  // the pack, if any, and then one for each tensor that isn't inline, packed
+  // or a duplicate, in order.
+  bool channelDescriptorsFollow;
+  // Whether the receiver should remember this descriptor, for the messages that
+  // will later refer to it by this id, through a TemplatedMessageDescriptor.
+  bool definesTemplate;
+  uint64_t templateId;
+  // The tag that the sender gave the message, if any.
+  bool hasTag;
+  uint64_t tag;
   NOP_STRUCTURE(
       MessageDescriptor,
       metadata,
+      metadataId,
       payloadDescriptors,
-      tensorDescriptors);
+      tensorDescriptors,
+      packLength,
+      packChannelName,
+      packChannelDescriptor,
+      channelDescriptorsFollow,
+      definesTemplate,
+      templateId,
+      hasTag,
+      tag);
+};
+
+// Stands for the MessageDescriptor that defined the template, with only the
+// fields that may change from one message to the next being sent again.
+struct TemplatedMessageDescriptor {
+  uint64_t templateId;
+  bool channelDescriptorsFollow;
+  // Empty if the tensors go over the same channels as when the template was
+  // defined, otherwise the name of each one's channel (empty if inline).
+  std::vector<std::string> channelNames;
+  // The ones of the tensors that aren't inline, unless they follow.
+  std::vector<std::string> channelDescriptors;
+  bool hasTag;
+  uint64_t tag;
+  NOP_STRUCTURE(
+      TemplatedMessageDescriptor,
+      templateId,
+      channelDescriptorsFollow,
+      channelNames,
+      channelDescriptors,
+      hasTag,
+      tag);
+};
+
+// Written by a pipe that upgrades its transport, first on the new connection
+// once it's accepted, to tell the client that it can be used, and then by each
+// side on the previous connection in place of a message descriptor, after
+// which all it writes goes on the new one.
+struct TransportUpgrade {
+  std::string transport;
+  NOP_STRUCTURE(TransportUpgrade, transport);
+};
+
+struct TensorChannelDescriptor {
+  std::string channelDescriptor;
+  NOP_STRUCTURE(TensorChannelDescriptor, channelDescriptor);
 };
 
 using Packet = nop::Variant<
@@ -121,6 +257,10 @@ using Packet = nop::Variant<
     RequestedConnection,
     Brochure,
     BrochureAnswer,
-    MessageDescriptor>;
+    MessageDescriptor,
+    TensorChannelDescriptor,
+    TemplatedMessageDescriptor,
+    SpeculativeConnection,
+    TransportUpgrade>;
 
 } // namespace tensorpipe
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/packet_holder.h>
+
+#include <endian.h>
+
+#include <nop/base/encoding_byte.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// Every packet written by libnop starts with the encoding byte of its variant.
+constexpr uint8_t kCompactLayoutMagic = 0xa5;
+static_assert(
+    kCompactLayoutMagic != static_cast<uint8_t>(nop::EncodingByte::Variant),
+    "The compact layout must be told apart from the variant");
+
+constexpr uint8_t kChannelDescriptorsFollowFlag = 1 << 0;
+
+struct CompactHeader {
+  uint8_t magic;
+  uint8_t flags;
+  uint16_t reserved1;
+  uint32_t numPayloads;
+  uint32_t numTensors;
+  uint32_t reserved2;
+};
+
+// One per payload and then one per tensor. A tensor that isn't a duplicate is
+// inline, as the others don't fit the compact layout.
+struct CompactEntry {
+  int64_t sizeInBytes;
+  int64_t duplicateOf;
+};
+
+static_assert(sizeof(CompactHeader) == 16, "");
+static_assert(sizeof(CompactEntry) == 16, "");
+
+nop::Status<void> writeEntry(
+    NopWriter& writer,
+    int64_t sizeInBytes,
+    int64_t duplicateOf) {
+  CompactEntry entry;
+  entry.sizeInBytes = htole64(sizeInBytes);
+  entry.duplicateOf = htole64(duplicateOf);
+  return writer.Write(&entry, &entry + 1);
+}
+
+CompactEntry readEntry(NopReader& reader) {
+  CompactEntry entry;
+  nop::Status<void> status = reader.Read(&entry, &entry + 1);
+  TP_DCHECK(!status.has_error());
+  entry.sizeInBytes = le64toh(entry.sizeInBytes);
+  entry.duplicateOf = le64toh(entry.duplicateOf);
+  return entry;
+}
+
+} // namespace
+
+bool PacketHolder::fitsCompactLayout(
+    const MessageDescriptor& nopMessageDescriptor) {
+  if (!nopMessageDescriptor.metadata.empty() ||
+      nopMessageDescriptor.metadataId != 0 ||
+      nopMessageDescriptor.packLength != 0 ||
+      nopMessageDescriptor.definesTemplate || nopMessageDescriptor.hasTag) {
+    return false;
+  }
+  for (const auto& nopPayloadDescriptor :
+       nopMessageDescriptor.payloadDescriptors) {
+    if (!nopPayloadDescriptor.metadata.empty() ||
+        nopPayloadDescriptor.metadataId != 0) {
+      return false;
+    }
+  }
+  for (const auto& nopTensorDescriptor :
+       nopMessageDescriptor.tensorDescriptors) {
+    const bool isDuplicate = nopTensorDescriptor.duplicateOf >= 0;
+    if (!nopTensorDescriptor.metadata.empty() ||
+        nopTensorDescriptor.metadataId != 0 ||
+        nopTensorDescriptor.deviceType != DeviceType::kCpu ||
+        nopTensorDescriptor.isInline == isDuplicate ||
+        nopTensorDescriptor.isPacked ||
+        !nopTensorDescriptor.channelName.empty() ||
+        nopTensorDescriptor.channelNameId != 0 ||
+        !nopTensorDescriptor.channelDescriptor.empty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PacketHolder::isWrittenInCompactLayout_() const {
+  const Packet& nopPacket = nopHolder_.getObject();
+  return useCompactLayout_ &&
+      nopPacket.index() == nopPacket.index_of<MessageDescriptor>() &&
+      fitsCompactLayout(*nopPacket.get<MessageDescriptor>());
+}
+
+size_t PacketHolder::getSize() const {
+  if (isWrittenInCompactLayout_()) {
+    const MessageDescriptor& nopMessageDescriptor =
+        *nopHolder_.getObject().get<MessageDescriptor>();
+    return sizeof(CompactHeader) +
+        sizeof(CompactEntry) *
+        (nopMessageDescriptor.payloadDescriptors.size() +
+         nopMessageDescriptor.tensorDescriptors.size());
+  }
+  return nopHolder_.getSize();
+}
+
+size_t PacketHolder::getSizeHint() const {
+  // The size of the compact layout is as quick to compute as the hint.
+  if (isWrittenInCompactLayout_()) {
+    return getSize();
+  }
+  return nopHolder_.getSizeHint();
+}
+
+nop::Status<void> PacketHolder::write(NopWriter& writer) const {
+  if (isWrittenInCompactLayout_()) {
+    return writeCompactLayout_(writer);
+  }
+  return nopHolder_.write(writer);
+}
+
+nop::Status<void> PacketHolder::read(NopReader& reader) {
+  uint8_t firstByte;
+  nop::Status<void> status = reader.Peek(&firstByte);
+  if (status.has_error()) {
+    return status;
+  }
+  if (firstByte == kCompactLayoutMagic) {
+    return readCompactLayout_(reader);
+  }
+  return nopHolder_.read(reader);
+}
+
+nop::Status<void> PacketHolder::writeCompactLayout_(NopWriter& writer) const {
+  const MessageDescriptor& nopMessageDescriptor =
+      *nopHolder_.getObject().get<MessageDescriptor>();
+
+  CompactHeader header;
+  header.magic = kCompactLayoutMagic;
+  header.flags = nopMessageDescriptor.channelDescriptorsFollow
+      ? kChannelDescriptorsFollowFlag
+      : 0;
+  header.reserved1 = 0;
+  header.numPayloads =
+      htole32(nopMessageDescriptor.payloadDescriptors.size());
+  header.numTensors = htole32(nopMessageDescriptor.tensorDescriptors.size());
+  header.reserved2 = 0;
+  nop::Status<void> status = writer.Write(&header, &header + 1);
+  if (status.has_error()) {
+    return status;
+  }
+
+  for (const auto& nopPayloadDescriptor :
+       nopMessageDescriptor.payloadDescriptors) {
+    status = writeEntry(
+        writer,
+        nopPayloadDescriptor.sizeInBytes,
+        nopPayloadDescriptor.duplicateOf);
+    if (status.has_error()) {
+      return status;
+    }
+  }
+  for (const auto& nopTensorDescriptor :
+       nopMessageDescriptor.tensorDescriptors) {
+    status = writeEntry(
+        writer,
+        nopTensorDescriptor.sizeInBytes,
+        nopTensorDescriptor.duplicateOf);
+    if (status.has_error()) {
+      return status;
+    }
+  }
+  return nop::ErrorStatus::None;
+}
+
+nop::Status<void> PacketHolder::readCompactLayout_(NopReader& reader) {
+  CompactHeader header;
+  nop::Status<void> status = reader.Ensure(sizeof(header));
+  if (status.has_error()) {
+    return status;
+  }
+  status = reader.Read(&header, &header + 1);
+  TP_DCHECK(!status.has_error());
+  const size_t numPayloads = le32toh(header.numPayloads);
+  const size_t numTensors = le32toh(header.numTensors);
+  status = reader.Ensure(sizeof(CompactEntry) * (numPayloads + numTensors));
+  if (status.has_error()) {
+    return status;
+  }
+
+  // The holder may be reused, hence every field must be set.
+  Packet& nopPacket = nopHolder_.getObject();
+  nopPacket.Become(nopPacket.index_of<MessageDescriptor>());
+  MessageDescriptor& nopMessageDescriptor = *nopPacket.get<MessageDescriptor>();
+  nopMessageDescriptor.metadata.clear();
+  nopMessageDescriptor.metadataId = 0;
+  nopMessageDescriptor.packLength = 0;
+  nopMessageDescriptor.packChannelName.clear();
+  nopMessageDescriptor.packChannelDescriptor.clear();
+  nopMessageDescriptor.channelDescriptorsFollow =
+      (header.flags & kChannelDescriptorsFollowFlag) != 0;
+  nopMessageDescriptor.definesTemplate = false;
+  nopMessageDescriptor.templateId = 0;
+  nopMessageDescriptor.hasTag = false;
+  nopMessageDescriptor.tag = 0;
+
+  nopMessageDescriptor.payloadDescriptors.resize(numPayloads);
+  for (auto& nopPayloadDescriptor : nopMessageDescriptor.payloadDescriptors) {
+    const CompactEntry entry = readEntry(reader);
+    nopPayloadDescriptor.sizeInBytes = entry.sizeInBytes;
+    nopPayloadDescriptor.metadata.clear();
+    nopPayloadDescriptor.metadataId = 0;
+    nopPayloadDescriptor.duplicateOf = entry.duplicateOf;
+  }
+
+  nopMessageDescriptor.tensorDescriptors.resize(numTensors);
+  for (auto& nopTensorDescriptor : nopMessageDescriptor.tensorDescriptors) {
+    const CompactEntry entry = readEntry(reader);
+    nopTensorDescriptor.sizeInBytes = entry.sizeInBytes;
+    nopTensorDescriptor.metadata.clear();
+    nopTensorDescriptor.metadataId = 0;
+    nopTensorDescriptor.deviceType = DeviceType::kCpu;
+    nopTensorDescriptor.isInline = entry.duplicateOf < 0;
+    nopTensorDescriptor.isPacked = false;
+    nopTensorDescriptor.channelName.clear();
+    nopTensorDescriptor.channelNameId = 0;
+    nopTensorDescriptor.channelDescriptor.clear();
+    nopTensorDescriptor.duplicateOf = entry.duplicateOf;
+  }
+
+  return nop::ErrorStatus::None;
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/core/nop_types.h>
+
+namespace tensorpipe {
+
+// A holder for the packets of a pipe that, once the peers agreed to it, writes
+// the descriptors of the most common messages (payloads and CPU tensors that
+// are inline or duplicates, without any metadata, tag, channel or template) in
+// a fixed layout of little-endian integers instead of going through the libnop
+// variant. That takes a handful of stores to write and of loads to read. The
+// other packets are written as usual, and the reader tells the two apart from
+// their first byte, hence it accepts both regardless of what was agreed.
+class PacketHolder final : public AbstractNopHolder {
+ public:
+  Packet& getObject() {
+    return nopHolder_.getObject();
+  }
+
+  const Packet& getObject() const {
+    return nopHolder_.getObject();
+  }
+
+  // Allow the packet to be written in the fixed layout, if it fits it.
+  void setUseCompactLayout(bool useCompactLayout) {
+    useCompactLayout_ = useCompactLayout;
+  }
+
+  size_t getSize() const override;
+  size_t getSizeHint() const override;
+  nop::Status<void> write(NopWriter& writer) const override;
+  nop::Status<void> read(NopReader& reader) override;
+
+  // Whether the message descriptor can be written in the fixed layout.
+  static bool fitsCompactLayout(const MessageDescriptor& nopMessageDescriptor);
+
+ private:
+  NopHolder<Packet> nopHolder_;
+  bool useCompactLayout_{false};
+
+  bool isWrittenInCompactLayout_() const;
+  nop::Status<void> writeCompactLayout_(NopWriter& writer) const;
+  nop::Status<void> readCompactLayout_(NopReader& reader);
+};
+
+} // namespace tensorpipe
@@ -9,22 +9,41 @@
 #include <tensorpipe/core/pipe.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <map>
 #include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <tensorpipe/channel/channel.h>
 #include <tensorpipe/common/address.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/deferred_executor.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/probes.h>
+#include <tensorpipe/common/recycling_queue.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/common/token_bucket.h>
+#include <tensorpipe/common/trace.h>
 #include <tensorpipe/core/buffer_helpers.h>
+#include <tensorpipe/core/channel_router.h>
 #include <tensorpipe/core/context_impl.h>
 #include <tensorpipe/core/error.h>
+#include <tensorpipe/core/lazy_channel.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/listener_impl.h>
 #include <tensorpipe/core/nop_types.h>
+#include <tensorpipe/core/packet_holder.h>
+#include <tensorpipe/core/traffic_recorder.h>
 #include <tensorpipe/transport/connection.h>
 
 namespace tensorpipe {
@@ -43,65 +62,184 @@ struct ReadOperation {
     FINISHED
   };
   State state{UNINITIALIZED};
+  // When the operation entered its current state, to account for the time it
+  // spends in each of them, and when it was started, to report its age.
+  std::chrono::steady_clock::time_point stateEnteredAt;
+  std::chrono::steady_clock::time_point startedAt;
   bool doneReadingDescriptor{false};
+  std::chrono::steady_clock::time_point descriptorReadAt;
   bool doneGettingAllocation{false};
+  // Whether the buffers were provided by the context's allocator, in which case
+  // the payloads and tensors can be read before the user calls read.
+  bool allocatedByPipe{false};
+  // How many bytes of the allocator's memory budget the buffers account for.
+  size_t numAllocatorBytes{0};
+  // Whether the descriptors of the tensors follow the payloads on the
+  // connection, rather than being contained in the message descriptor.
+  bool channelDescriptorsFollow{false};
   int64_t numPayloadsBeingRead{0};
   int64_t numTensorsBeingReceived{0};
 
-  // Callbacks.
-  Pipe::read_descriptor_callback_fn readDescriptorCallback;
+  // Callbacks. The one of readDescriptor isn't tied to an operation, as each
+  // is handed the next message that isn't matched to a posted read.
   Pipe::read_callback_fn readCallback;
+  Pipe::read_progress_callback_fn readProgressCallback;
+  // Whether the operation was started by the pipe itself on behalf of a call to
+  // readDescriptors, whose callback it then uses instead of its own.
+  bool isMultishot{false};
+  // Whether the message isn't handed to the user by readDescriptor, and thus
+  // won't be given to read, as it was matched to a posted read, or as the pipe
+  // failed before any readDescriptor callback was left for it.
+  bool isHiddenFromUser{false};
 
   // Metadata found in the descriptor read from the connection.
   struct Payload {
     ssize_t length{-1};
+    // The index of the earlier payload whose data this one is a copy of.
+    int64_t duplicateOf{-1};
   };
   std::vector<Payload> payloads;
   struct Tensor {
     DeviceType type;
     ssize_t length{-1};
+    bool isInline{false};
     std::string channelName;
     channel::TDescriptor descriptor;
+    // Whether the tensor is copied out of the pack once that is received.
+    bool isPacked{false};
+    // The index of the earlier tensor whose data this one is a copy of.
+    int64_t duplicateOf{-1};
+    // A segmented destination that the tensor can't be received into directly
+    // (because it's inline, or its channel doesn't support it) is swapped for
+    // this contiguous one, into which it's received, and then scattered.
+    std::shared_ptr<uint8_t> stagingBuffer;
+    CpuBuffer segmentedBuffer;
   };
   std::vector<Tensor> tensors;
+  // The packed tensors, one after the other, which are received together into
+  // this buffer. A length of zero means there's no pack.
+  Tensor pack;
+  std::shared_ptr<uint8_t> packBuffer;
 
   // Buffers allocated by the user.
   Message message;
 };
 
+// The names of the states of the operations, as they appear in the stats and,
+// with a prefix, in the traces.
+const char* const kReadStageTraceNames[] = {
+    "read.uninitialized",
+    "read.reading_descriptor",
+    "read.asking_for_allocation",
+    "read.reading_payloads_and_receiving_tensors",
+    "read.finished"};
+
+std::vector<std::string> readStageNames() {
+  return {
+      "uninitialized",
+      "reading_descriptor",
+      "asking_for_allocation",
+      "reading_payloads_and_receiving_tensors",
+      "finished"};
+}
+
+// Allocate a staging buffer, whose memory is counted until it's freed, which
+// may only happen after the pipe is gone if a channel holds on to it.
+std::shared_ptr<uint8_t> allocateStagingBuffer(
+    std::shared_ptr<MemoryCounter> counter,
+    size_t length) {
+  counter->add(length);
+  return std::shared_ptr<uint8_t>(
+      new uint8_t[length],
+      [counter{std::move(counter)}, length](uint8_t* ptr) {
+        delete[] ptr;
+        counter->remove(length);
+      });
+}
+
+// Bring a finished ReadOperation back to its initial state so that it can be
+// reused for a later message, holding on to the memory of its vectors.
+void recycleReadOperation(ReadOperation& op) {
+  std::vector<ReadOperation::Payload> payloads = std::move(op.payloads);
+  std::vector<ReadOperation::Tensor> tensors = std::move(op.tensors);
+  payloads.clear();
+  tensors.clear();
+  op = ReadOperation();
+  op.payloads = std::move(payloads);
+  op.tensors = std::move(tensors);
+}
+
 // Copy the payload and tensors sizes, the tensor descriptors, etc. from the
 // message descriptor that is contained in the nop object to the ReadOperation.
-void parseDescriptorOfMessage(ReadOperation& op, const Packet& nopPacketIn) {
+// The strings are moved out of the nop object, rather than copied, as it isn't
+// needed afterwards, so that each of them is only allocated once, when decoded.
+void parseDescriptorOfMessage(
+    ReadOperation& op,
+    MessageDescriptor& nopMessageDescriptor) {
   Message& message = op.message;
 
-  TP_DCHECK_EQ(nopPacketIn.index(), nopPacketIn.index_of<MessageDescriptor>());
-  const MessageDescriptor& nopMessageDescriptor =
-      *nopPacketIn.get<MessageDescriptor>();
-
-  message.metadata = nopMessageDescriptor.metadata;
-  for (const auto& nopPayloadDescriptor :
-       nopMessageDescriptor.payloadDescriptors) {
+  message.metadata = std::move(nopMessageDescriptor.metadata);
+  if (nopMessageDescriptor.hasTag) {
+    message.tag = nopMessageDescriptor.tag;
+  }
+  op.channelDescriptorsFollow = nopMessageDescriptor.channelDescriptorsFollow;
+  message.payloads.reserve(nopMessageDescriptor.payloadDescriptors.size());
+  op.payloads.reserve(nopMessageDescriptor.payloadDescriptors.size());
+  for (auto& nopPayloadDescriptor : nopMessageDescriptor.payloadDescriptors) {
     Message::Payload payload;
     ReadOperation::Payload payloadBeingAllocated;
     payload.length = nopPayloadDescriptor.sizeInBytes;
     payloadBeingAllocated.length = payload.length;
-    payload.metadata = nopPayloadDescriptor.metadata;
+    payloadBeingAllocated.duplicateOf = nopPayloadDescriptor.duplicateOf;
+    payload.metadata = std::move(nopPayloadDescriptor.metadata);
+    if (nopPayloadDescriptor.duplicateOf >= 0) {
+      const size_t sourceIdx = nopPayloadDescriptor.duplicateOf;
+      TP_THROW_ASSERT_IF(
+          sourceIdx >= message.payloads.size() ||
+          message.payloads[sourceIdx].length != payload.length);
+      payload.duplicateOf = sourceIdx;
+    }
     message.payloads.push_back(std::move(payload));
     op.payloads.push_back(std::move(payloadBeingAllocated));
   }
 
-  for (const auto& nopTensorDescriptor :
-       nopMessageDescriptor.tensorDescriptors) {
+  op.pack.type = DeviceType::kCpu;
+  op.pack.length = nopMessageDescriptor.packLength;
+  op.pack.channelName = std::move(nopMessageDescriptor.packChannelName);
+  op.pack.descriptor = std::move(nopMessageDescriptor.packChannelDescriptor);
+  int64_t packedLength = 0;
+
+  message.tensors.reserve(nopMessageDescriptor.tensorDescriptors.size());
+  op.tensors.reserve(nopMessageDescriptor.tensorDescriptors.size());
+  for (auto& nopTensorDescriptor : nopMessageDescriptor.tensorDescriptors) {
     ReadOperation::Tensor tensorBeingAllocated;
     tensorBeingAllocated.length = nopTensorDescriptor.sizeInBytes;
-    tensorBeingAllocated.channelName = nopTensorDescriptor.channelName;
-    // FIXME If the nop object wasn't const we could move the string out...
-    tensorBeingAllocated.descriptor = nopTensorDescriptor.channelDescriptor;
+    tensorBeingAllocated.isInline = nopTensorDescriptor.isInline;
+    tensorBeingAllocated.isPacked = nopTensorDescriptor.isPacked;
+    if (nopTensorDescriptor.isPacked) {
+      TP_THROW_ASSERT_IF(nopTensorDescriptor.deviceType != DeviceType::kCpu);
+      packedLength += nopTensorDescriptor.sizeInBytes;
+    }
+    tensorBeingAllocated.channelName =
+        std::move(nopTensorDescriptor.channelName);
+    tensorBeingAllocated.descriptor =
+        std::move(nopTensorDescriptor.channelDescriptor);
+    tensorBeingAllocated.duplicateOf = nopTensorDescriptor.duplicateOf;
 
     message.tensors.emplace_back();
     Message::Tensor& tensor = message.tensors.back();
     op.tensors.push_back(std::move(tensorBeingAllocated));
-    tensor.metadata = nopTensorDescriptor.metadata;
+    tensor.metadata = std::move(nopTensorDescriptor.metadata);
+    if (nopTensorDescriptor.duplicateOf >= 0) {
+      // Only earlier CPU tensors of the same length can be duplicated.
+      const size_t sourceIdx = nopTensorDescriptor.duplicateOf;
+      TP_THROW_ASSERT_IF(
+          nopTensorDescriptor.deviceType != DeviceType::kCpu ||
+          sourceIdx + 1 >= message.tensors.size() ||
+          message.tensors[sourceIdx].buffer.type != DeviceType::kCpu ||
+          op.tensors[sourceIdx].length != op.tensors.back().length);
+      tensor.duplicateOf = sourceIdx;
+    }
     switch (nopTensorDescriptor.deviceType) {
       case DeviceType::kCpu: {
         CpuBuffer buffer;
@@ -121,6 +259,41 @@ void parseDescriptorOfMessage(ReadOperation& op, const Packet& nopPacketIn) {
         TP_THROW_ASSERT() << "Unexpected device type.";
     };
   }
+  TP_THROW_ASSERT_IF(packedLength != std::max<int64_t>(op.pack.length, 0));
+}
+
+// Fill in a ReadOperation based on the descriptor that defined a template and
+// on the fields that changed since then for the message at hand.
+void parseTemplatedDescriptorOfMessage(
+    ReadOperation& op,
+    const MessageDescriptor& nopTemplate,
+    TemplatedMessageDescriptor& nopTemplatedMessageDescriptor) {
+  MessageDescriptor nopMessageDescriptor = nopTemplate;
+  nopMessageDescriptor.hasTag = nopTemplatedMessageDescriptor.hasTag;
+  nopMessageDescriptor.tag = nopTemplatedMessageDescriptor.tag;
+  parseDescriptorOfMessage(op, nopMessageDescriptor);
+
+  std::vector<std::string>& channelNames =
+      nopTemplatedMessageDescriptor.channelNames;
+  std::vector<std::string>& channelDescriptors =
+      nopTemplatedMessageDescriptor.channelDescriptors;
+  op.channelDescriptorsFollow =
+      nopTemplatedMessageDescriptor.channelDescriptorsFollow;
+  TP_THROW_ASSERT_IF(
+      !channelNames.empty() && channelNames.size() != op.tensors.size());
+  size_t channelDescriptorIdx = 0;
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    ReadOperation::Tensor& tensor = op.tensors[tensorIdx];
+    if (!channelNames.empty()) {
+      tensor.channelName = std::move(channelNames[tensorIdx]);
+      tensor.isInline = tensor.channelName.empty();
+    }
+    if (!tensor.isInline && !op.channelDescriptorsFollow) {
+      TP_THROW_ASSERT_IF(channelDescriptorIdx >= channelDescriptors.size());
+      tensor.descriptor = std::move(channelDescriptors[channelDescriptorIdx++]);
+    }
+  }
+  TP_THROW_ASSERT_IF(channelDescriptorIdx != channelDescriptors.size());
 }
 
 // Raise an error if the number or sizes of the payloads and the tensors in
@@ -160,20 +333,188 @@ void checkAllocationCompatibility(
   }
 }
 
+// The inline and packed tensors come as bytes on the connection, or in the
+// pack, hence they can only be received into CPU memory. The sender picks them
+// without knowing where the receiver wants them, thus a buffer on another
+// device isn't a logical error of the receiver, and it fails the read (and the
+// pipe, as the bytes of the tensor can't be skipped) rather than throwing.
+Error checkDevicesOfTensorsWithoutChannel(
+    const ReadOperation& op,
+    const Message& message) {
+  for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+       tensorIdx++) {
+    const ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
+    if ((tensorBeingAllocated.isInline || tensorBeingAllocated.isPacked) &&
+        message.tensors[tensorIdx].buffer.type != DeviceType::kCpu) {
+      return TP_CREATE_ERROR(
+          LogicError,
+          "tensor #" + std::to_string(op.sequenceNumber) + "." +
+              std::to_string(tensorIdx) +
+              " was sent without a channel, hence it must be received into " +
+              "CPU memory");
+    }
+  }
+  return Error::kSuccess;
+}
+
+// Raise an error if the buffers of the payloads and the tensors in the message
+// aren't the ones that were provided by the allocator of the context.
+void checkPreallocatedBuffers(
+    const Message& preallocatedMessage,
+    const Message& message) {
+  size_t numPayloads = message.payloads.size();
+  TP_DCHECK_EQ(numPayloads, preallocatedMessage.payloads.size());
+  for (size_t payloadIdx = 0; payloadIdx < numPayloads; payloadIdx++) {
+    TP_THROW_ASSERT_IF(
+        message.payloads[payloadIdx].data !=
+        preallocatedMessage.payloads[payloadIdx].data);
+  }
+  size_t numTensors = message.tensors.size();
+  TP_DCHECK_EQ(numTensors, preallocatedMessage.tensors.size());
+  for (size_t tensorIdx = 0; tensorIdx < numTensors; tensorIdx++) {
+    const Buffer& buffer = message.tensors[tensorIdx].buffer;
+    const Buffer& preallocatedBuffer =
+        preallocatedMessage.tensors[tensorIdx].buffer;
+    TP_THROW_ASSERT_IF(buffer.type != preallocatedBuffer.type);
+    switch (buffer.type) {
+      case DeviceType::kCpu:
+        TP_THROW_ASSERT_IF(buffer.cpu.ptr != preallocatedBuffer.cpu.ptr);
+        break;
+#if TENSORPIPE_SUPPORTS_CUDA
+      case DeviceType::kCuda:
+        TP_THROW_ASSERT_IF(buffer.cuda.ptr != preallocatedBuffer.cuda.ptr);
+        break;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      default:
+        TP_THROW_ASSERT() << "Unexpected device type.";
+    }
+  }
+}
+
+// Map the ranges of files that the payloads and the CPU tensors without memory
+// refer to, privately to send them, or shared to receive into them. This is
+// done in the user's thread, before handing the message over to the loop, as
+// a file that can't be mapped is the user's error.
+void mapFileRangesOfMessage(Message& message, bool forReading) {
+  for (Message::Payload& payload : message.payloads) {
+    if (payload.file.has_value() && payload.data == nullptr &&
+        payload.length > 0) {
+      payload.owner = mapFileRange(
+          payload.file->fd, payload.file->offset, payload.length, forReading);
+      payload.data = payload.owner.get();
+    }
+  }
+  for (Message::Tensor& tensor : message.tensors) {
+    if (tensor.file.has_value() && tensor.buffer.type == DeviceType::kCpu &&
+        !isSegmented(tensor.buffer.cpu) && tensor.buffer.cpu.ptr == nullptr &&
+        tensor.buffer.cpu.length > 0) {
+      tensor.owner = mapFileRange(
+          tensor.file->fd,
+          tensor.file->offset,
+          tensor.buffer.cpu.length,
+          forReading);
+      tensor.buffer.cpu.ptr = tensor.owner.get();
+    }
+  }
+}
+
+// Messages aren't copyable, as they usually hold the only reference to some
+// buffers, but when those were allocated by the pipe it needs to keep a copy.
+Message copyMessage(const Message& message) {
+  Message copy;
+  copy.metadata = message.metadata;
+  copy.payloads = message.payloads;
+  copy.tensors = message.tensors;
+  return copy;
+}
+
+// Give back the segmented destinations of the tensors that were received into
+// a staging buffer, having first scattered their data into them if it's valid.
+void restoreSegmentedTensorsOfMessage(ReadOperation& op, bool copyData) {
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
+    if (tensorBeingAllocated.stagingBuffer == nullptr) {
+      continue;
+    }
+    const CpuBuffer& buffer = tensorBeingAllocated.segmentedBuffer;
+    if (copyData) {
+      copyToCpuBuffer(
+          buffer, 0, tensorBeingAllocated.stagingBuffer.get(), buffer.length);
+    }
+    op.message.tensors[tensorIdx].buffer = Buffer(buffer);
+    tensorBeingAllocated.stagingBuffer.reset();
+  }
+}
+
+// Fill in the payloads and tensors whose data the sender didn't send again, as
+// it had the same buffer for an earlier one, from the data of that one.
+void fillInDuplicatesOfMessage(ReadOperation& op) {
+  Message& message = op.message;
+  for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+       payloadIdx++) {
+    const int64_t sourceIdx = op.payloads[payloadIdx].duplicateOf;
+    if (sourceIdx < 0) {
+      continue;
+    }
+    Message::Payload& payload = message.payloads[payloadIdx];
+    const Message::Payload& source = message.payloads[sourceIdx];
+    if (payload.data == nullptr) {
+      payload.data = source.data;
+      payload.owner = source.owner;
+    } else if (payload.data != source.data) {
+      std::memcpy(payload.data, source.data, payload.length);
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < message.tensors.size(); tensorIdx++) {
+    const int64_t sourceIdx = op.tensors[tensorIdx].duplicateOf;
+    if (sourceIdx < 0) {
+      continue;
+    }
+    Message::Tensor& tensor = message.tensors[tensorIdx];
+    const Message::Tensor& source = message.tensors[sourceIdx];
+    TP_DCHECK(tensor.buffer.type == DeviceType::kCpu);
+    if (!isSegmented(tensor.buffer.cpu) && tensor.buffer.cpu.ptr == nullptr) {
+      tensor.buffer = source.buffer;
+      tensor.owner = source.owner;
+    } else if (
+        isSegmented(tensor.buffer.cpu) || isSegmented(source.buffer.cpu) ||
+        tensor.buffer.cpu.ptr != source.buffer.cpu.ptr) {
+      copyCpuBuffer(tensor.buffer.cpu, source.buffer.cpu);
+    }
+  }
+}
+
 struct WriteOperation {
   int64_t sequenceNumber{-1};
+  // The class given to write, which picks the instances of the channels that
+  // the tensors are sent over.
+  uint64_t priorityClass{0};
+  // Past which the operation is dropped if it wasn't admitted yet.
+  std::chrono::steady_clock::time_point deadline{
+      std::chrono::steady_clock::time_point::max()};
 
   // Progress indicators.
   enum State {
     UNINITIALIZED,
+    ADMITTED,
     SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
     WRITING_PAYLOADS_AND_SENDING_TENSORS,
     FINISHED
   };
   State state{UNINITIALIZED};
+  std::chrono::steady_clock::time_point stateEnteredAt;
+  std::chrono::steady_clock::time_point startedAt;
+  // The total length of the payloads and tensors, counted against the limits on
+  // outstanding writes, and whether it's currently reserved out of them.
+  size_t numBytes{0};
+  bool hasReservedCapacity{false};
   int64_t numPayloadsBeingWritten{0};
   int64_t numTensorDescriptorsBeingCollected{0};
   int64_t numTensorsBeingSent{0};
+  // Whether the descriptor of the message is written without waiting for the
+  // ones of the tensors, which follow it, in order, as they become available.
+  bool channelDescriptorsFollow{false};
+  size_t nextTensorDescriptorToWrite{0};
 
   // Callbacks.
   Pipe::write_callback_fn writeCallback;
@@ -181,27 +522,157 @@ struct WriteOperation {
   // Buffers provided by the user.
   Message message;
 
+  struct Payload {
+    // The index of an earlier payload with the same buffer, in which case this
+    // one isn't written.
+    int64_t duplicateOf{-1};
+  };
+  std::vector<Payload> payloads;
+
   // Tensor descriptors collected from the channels.
   struct Tensor {
     DeviceType type;
     std::string channelName;
     channel::TDescriptor descriptor;
+    bool hasDescriptor{false};
+    // Whether the tensor is written over the connection after the payloads.
+    bool isInline{false};
+    // Whether the tensor is copied into the pack, rather than sent on its own.
+    bool isPacked{false};
+    // The index of an earlier tensor with the same buffer, in which case this
+    // one isn't sent at all.
+    int64_t duplicateOf{-1};
   };
   std::vector<Tensor> tensors;
+  // The packed tensors, sent together as a single buffer over a channel, and
+  // their total length (zero if there are none).
+  Tensor pack;
+  size_t packLength{0};
+  bool isPackDescriptorWritten{false};
+};
+
+// Stands for the pack in the place of the index of a tensor.
+constexpr int64_t kPackIdx = -1;
+
+const char* const kWriteStageTraceNames[] = {
+    "write.uninitialized",
+    "write.admitted",
+    "write.sending_tensors_and_collecting_descriptors",
+    "write.writing_payloads_and_sending_tensors",
+    "write.finished"};
+
+std::vector<std::string> writeStageNames() {
+  return {
+      "uninitialized",
+      "admitted",
+      "sending_tensors_and_collecting_descriptors",
+      "writing_payloads_and_sending_tensors",
+      "finished"};
+}
+
+// Bring a finished WriteOperation back to its initial state so that it can be
+// reused for a later message, holding on to the memory of its vectors.
+void recycleWriteOperation(WriteOperation& op) {
+  std::vector<WriteOperation::Payload> payloads = std::move(op.payloads);
+  std::vector<WriteOperation::Tensor> tensors = std::move(op.tensors);
+  payloads.clear();
+  tensors.clear();
+  op = WriteOperation();
+  op.payloads = std::move(payloads);
+  op.tensors = std::move(tensors);
+}
+
+// Hand what was given to write over to another operation. Operations that
+// weren't admitted yet hold nothing else, hence they can be reordered this way.
+void moveWriteRequest(WriteOperation& to, WriteOperation& from) {
+  to.priorityClass = from.priorityClass;
+  to.deadline = from.deadline;
+  to.stateEnteredAt = from.stateEnteredAt;
+  to.startedAt = from.startedAt;
+  to.numBytes = from.numBytes;
+  to.writeCallback = std::move(from.writeCallback);
+  to.message = std::move(from.message);
+}
+
+// What a pipe remembers of a template registered by the user on the sending
+// side, where it's enough to check that the messages comply with it.
+struct MessageTemplate {
+  std::vector<size_t> payloadLengths;
+  std::vector<size_t> tensorLengths;
+  // Whether the descriptor of a message of this template was sent to the peer,
+  // and which channels the tensors went over then (empty for inline ones).
+  bool isDefinedOnPeer{false};
+  std::vector<std::string> channelNames;
 };
 
+size_t getTensorLength(const Message::Tensor& tensor) {
+  switch (tensor.buffer.type) {
+    case DeviceType::kCpu:
+      return tensor.buffer.cpu.length;
+#if TENSORPIPE_SUPPORTS_CUDA
+    case DeviceType::kCuda:
+      return tensor.buffer.cuda.length;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    default:
+      TP_THROW_ASSERT() << "Unexpected device type.";
+  }
+}
+
+MessageTemplate makeTemplateForMessage(const Message& message) {
+  MessageTemplate messageTemplate;
+  for (const Message::Payload& payload : message.payloads) {
+    messageTemplate.payloadLengths.push_back(payload.length);
+  }
+  for (const Message::Tensor& tensor : message.tensors) {
+    messageTemplate.tensorLengths.push_back(getTensorLength(tensor));
+  }
+  return messageTemplate;
+}
+
+// Raise an error if the number or sizes of the payloads and the tensors in
+// the message do not match the ones of its template.
+void checkTemplateCompatibility(
+    const MessageTemplate& messageTemplate,
+    const Message& message) {
+  size_t numPayloads = message.payloads.size();
+  TP_THROW_ASSERT_IF(numPayloads != messageTemplate.payloadLengths.size());
+  for (size_t payloadIdx = 0; payloadIdx < numPayloads; payloadIdx++) {
+    TP_THROW_ASSERT_IF(
+        message.payloads[payloadIdx].length !=
+        messageTemplate.payloadLengths[payloadIdx]);
+  }
+  size_t numTensors = message.tensors.size();
+  TP_THROW_ASSERT_IF(numTensors != messageTemplate.tensorLengths.size());
+  for (size_t tensorIdx = 0; tensorIdx < numTensors; tensorIdx++) {
+    TP_THROW_ASSERT_IF(
+        getTensorLength(message.tensors[tensorIdx]) !=
+        messageTemplate.tensorLengths[tensorIdx]);
+  }
+}
+
 // Produce a nop object containing a message descriptor using the information
 // contained in the WriteOperation: number and sizes of payloads and tensors,
 // tensor descriptors, ...
-std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
+std::shared_ptr<PacketHolder> makeDescriptorForMessage(
     const WriteOperation& op) {
-  auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+  auto nopHolderOut = std::make_shared<PacketHolder>();
   Packet& nopPacketOut = nopHolderOut->getObject();
   nopPacketOut.Become(nopPacketOut.index_of<MessageDescriptor>());
   MessageDescriptor& nopMessageDescriptor =
       *nopPacketOut.get<MessageDescriptor>();
 
   nopMessageDescriptor.metadata = op.message.metadata;
+  nopMessageDescriptor.metadataId = 0;
+  nopMessageDescriptor.channelDescriptorsFollow = op.channelDescriptorsFollow;
+  nopMessageDescriptor.definesTemplate = false;
+  nopMessageDescriptor.templateId = 0;
+  nopMessageDescriptor.hasTag = op.message.tag.has_value();
+  nopMessageDescriptor.tag = op.message.tag.value_or(0);
+  nopMessageDescriptor.packLength = op.packLength;
+  nopMessageDescriptor.packChannelName = op.pack.channelName;
+  if (!op.channelDescriptorsFollow) {
+    nopMessageDescriptor.packChannelDescriptor = op.pack.descriptor;
+  }
 
   for (int payloadIdx = 0; payloadIdx < op.message.payloads.size();
        ++payloadIdx) {
@@ -211,6 +682,8 @@ std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
         nopMessageDescriptor.payloadDescriptors.back();
     nopPayloadDescriptor.sizeInBytes = payload.length;
     nopPayloadDescriptor.metadata = payload.metadata;
+    nopPayloadDescriptor.metadataId = 0;
+    nopPayloadDescriptor.duplicateOf = op.payloads[payloadIdx].duplicateOf;
   }
 
   TP_DCHECK_EQ(op.message.tensors.size(), op.tensors.size());
@@ -221,9 +694,16 @@ std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
     MessageDescriptor::TensorDescriptor& nopTensorDescriptor =
         nopMessageDescriptor.tensorDescriptors.back();
     nopTensorDescriptor.metadata = tensor.metadata;
+    nopTensorDescriptor.metadataId = 0;
+    nopTensorDescriptor.isInline = otherTensor.isInline;
+    nopTensorDescriptor.isPacked = otherTensor.isPacked;
     nopTensorDescriptor.channelName = otherTensor.channelName;
-    // FIXME In principle we could move here.
-    nopTensorDescriptor.channelDescriptor = otherTensor.descriptor;
+    nopTensorDescriptor.channelNameId = 0;
+    nopTensorDescriptor.duplicateOf = otherTensor.duplicateOf;
+    if (!op.channelDescriptorsFollow) {
+      // FIXME In principle we could move here.
+      nopTensorDescriptor.channelDescriptor = otherTensor.descriptor;
+    }
 
     nopTensorDescriptor.deviceType = tensor.buffer.type;
     switch (tensor.buffer.type) {
@@ -243,6 +723,63 @@ std::shared_ptr<NopHolder<Packet>> makeDescriptorForMessage(
   return nopHolderOut;
 }
 
+// Produce a nop object that refers to a template the peer already knows of,
+// holding only the fields of the message that are allowed to differ from it.
+std::shared_ptr<PacketHolder> makeTemplatedDescriptorForMessage(
+    const WriteOperation& op,
+    const MessageTemplate& messageTemplate) {
+  auto nopHolderOut = std::make_shared<PacketHolder>();
+  Packet& nopPacketOut = nopHolderOut->getObject();
+  nopPacketOut.Become(nopPacketOut.index_of<TemplatedMessageDescriptor>());
+  TemplatedMessageDescriptor& nopTemplatedMessageDescriptor =
+      *nopPacketOut.get<TemplatedMessageDescriptor>();
+
+  nopTemplatedMessageDescriptor.templateId = op.message.templateId.value();
+  nopTemplatedMessageDescriptor.channelDescriptorsFollow =
+      op.channelDescriptorsFollow;
+  nopTemplatedMessageDescriptor.hasTag = op.message.tag.has_value();
+  nopTemplatedMessageDescriptor.tag = op.message.tag.value_or(0);
+  TP_DCHECK_EQ(op.tensors.size(), messageTemplate.channelNames.size());
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); ++tensorIdx) {
+    if (op.tensors[tensorIdx].channelName !=
+        messageTemplate.channelNames[tensorIdx]) {
+      for (const WriteOperation::Tensor& tensor : op.tensors) {
+        nopTemplatedMessageDescriptor.channelNames.push_back(
+            tensor.channelName);
+      }
+      break;
+    }
+  }
+  if (!op.channelDescriptorsFollow) {
+    for (const WriteOperation::Tensor& tensor : op.tensors) {
+      if (!tensor.isInline) {
+        // FIXME In principle we could move here.
+        nopTemplatedMessageDescriptor.channelDescriptors.push_back(
+            tensor.descriptor);
+      }
+    }
+  }
+
+  return nopHolderOut;
+}
+
+// The name of the instance of a channel that carries the tensors of the given
+// priority class, which for the lowest class is the channel's own one.
+std::string channelInstanceName(
+    const std::string& channelName,
+    uint64_t priorityClass) {
+  if (priorityClass == 0) {
+    return channelName;
+  }
+  return channelName + kChannelInstanceSeparator +
+      std::to_string(priorityClass);
+}
+
+// The name of the channel of which the given instance is one.
+std::string baseChannelName(const std::string& instanceName) {
+  return instanceName.substr(0, instanceName.find(kChannelInstanceSeparator));
+}
+
 template <typename TBuffer>
 std::unordered_map<std::string, ChannelAdvertisement>& getChannelAdvertisement(
     Brochure& nopBrochure);
@@ -315,26 +852,48 @@ const std::unordered_map<std::string, ChannelSelection>& getChannelSelection<
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
+// The tag of the speculative connection that the client opens for the given
+// instance of a channel, which the server derives in the same way.
 template <typename TBuffer>
-TBuffer unwrap(Buffer);
+std::string speculativeConnectionTag(
+    uint64_t speculationToken,
+    const std::string& instanceName);
 
 template <>
-CpuBuffer unwrap(Buffer b) {
-  TP_DCHECK(DeviceType::kCpu == b.type);
-  return b.cpu;
+std::string speculativeConnectionTag<CpuBuffer>(
+    uint64_t speculationToken,
+    const std::string& instanceName) {
+  return std::to_string(speculationToken) + ".cpu." + instanceName;
 }
 
 #if TENSORPIPE_SUPPORTS_CUDA
 template <>
-CudaBuffer unwrap(Buffer b) {
-  TP_DCHECK(DeviceType::kCuda == b.type);
-  return b.cuda;
+std::string speculativeConnectionTag<CudaBuffer>(
+    uint64_t speculationToken,
+    const std::string& instanceName) {
+  return std::to_string(speculationToken) + ".cuda." + instanceName;
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
+// How many times to check the flag before starting to yield between checks.
+constexpr int kNumBusyWaitSpins = 1000;
+
+// Wait, without ever going to sleep, for the flag to be set by a callback, so
+// that the calling thread picks up the completion as soon as it happens.
+void busyWaitUntil(const std::atomic<bool>& done) {
+  // The work that leads to the callback may be held in the thread's batch.
+  flushDeferredBatch();
+  for (int spin = 0; !done.load(std::memory_order_acquire); spin++) {
+    if (spin >= kNumBusyWaitSpins) {
+      std::this_thread::yield();
+    }
+  }
+}
+
 } // namespace
 
-class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
+class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl>,
+                   public PipeStateDumper {
  public:
   Impl(
       std::shared_ptr<Context::PrivateIface> context,
@@ -354,23 +913,95 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   void init();
 
   void readDescriptor(read_descriptor_callback_fn);
-  void read(Message, read_callback_fn);
-  void write(Message, write_callback_fn);
+
+  void readDescriptors(read_descriptor_callback_fn, size_t prefetchDepth);
+  void read(Message, read_callback_fn, read_progress_callback_fn);
+  void postRead(uint64_t tag, Message, read_callback_fn);
+  void write(
+      Message,
+      write_callback_fn,
+      uint64_t priorityClass,
+      std::chrono::steady_clock::time_point deadline);
+
+  Error readDescriptorSync(Message&);
+  Error readSync(Message&);
+  Error writeAndWait(Message&, uint64_t priorityClass);
+
+  void waitForWriteCapacity(write_capacity_callback_fn);
+  WriteStats getWriteStats();
+
+  void setWriteWeight(uint32_t weight);
+
+  void setWriteRateLimit(double bytesPerSecond, size_t burstBytes);
+
+  void exemptFromContextWriteRateLimit(bool exempt);
+
+  void waitForEstablishment(establishment_callback_fn);
 
   const std::string& getRemoteName();
 
+  std::map<size_t, std::string> getChannelRoutingTable(DeviceType type);
+
+  uint64_t registerMessageTemplate(const Message& message);
+
+  // Implementation of PipeStateDumper.
+  void dumpState(dump_state_callback_fn fn) override;
+
   void close();
 
  private:
+  // Each pipe has its own executor, which borrows the threads that call into it
+  // (the user's, or the transports' and channels' loops), hence pipes already
+  // progress in parallel with each other, up to the number of those threads.
   OnDemandDeferredExecutor loop_;
 
   void initFromLoop_();
 
   void readDescriptorFromLoop_(read_descriptor_callback_fn);
 
-  void readFromLoop_(Message, read_callback_fn);
+  void readDescriptorsFromLoop_(read_descriptor_callback_fn, size_t);
+
+  // Start another operation on behalf of the callback of readDescriptors.
+  void startMultishotReadOperation_();
+
+  void readFromLoop_(Message, read_callback_fn, read_progress_callback_fn);
+
+  void postReadFromLoop_(uint64_t tag, Message, read_callback_fn);
+
+  // Give the operation the buffers and the callback of a read posted for the
+  // tag of its message, if any, and return whether it did.
+  bool matchPostedRead_(ReadOperation& op);
+
+  // Allocate, or stage, the buffers of the tensors that need it, once the
+  // operation has been given its message.
+  void prepareBuffersOfMessage_(ReadOperation& op);
+
+  // Resume the operations once one that may be waiting for a readDescriptor
+  // callback or a posted read could have got one.
+  void advanceFirstReadOperationWithoutAllocation_();
 
-  void writeFromLoop_(Message, write_callback_fn);
+  void writeFromLoop_(
+      Message,
+      write_callback_fn,
+      uint64_t priorityClass,
+      std::chrono::steady_clock::time_point deadline);
+
+  void waitForWriteCapacityFromLoop_(write_capacity_callback_fn);
+
+  void setWriteWeightFromLoop_(uint32_t weight);
+
+  void setWriteRateLimitFromLoop_(double bytesPerSecond, size_t burstBytes);
+
+  void exemptFromContextWriteRateLimitFromLoop_(bool exempt);
+
+  // Keep track of a connection that the pipe set up, for itself or for one of
+  // its channels, and give it the write weight.
+  void registerConnection_(
+      const std::shared_ptr<transport::Connection>& connection);
+
+  void waitForEstablishmentFromLoop_(establishment_callback_fn);
+
+  std::string dumpStateFromLoop_();
 
   void closeFromLoop_();
 
@@ -385,8 +1016,63 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
 
   State state_{INITIALIZING};
 
+  // The settings of the context that the pipe consults for each operation.
+  // They are fixed for the lifetime of the context, hence they are fetched
+  // through its PrivateIface once, when the pipe is created, and then read as
+  // plain fields instead of through a virtual call each time.
+  struct Settings {
+    explicit Settings(Context::PrivateIface& context)
+        : callbackExecutor(context.getCallbackExecutor()),
+          trafficRecorder(context.getTrafficRecorder()),
+          outOfOrderCompletion(context.getOutOfOrderCompletion()),
+          maxOutstandingWritesPerPipe(
+              context.getMaxOutstandingWritesPerPipe()),
+          maxOutstandingWriteBytesPerPipe(
+              context.getMaxOutstandingWriteBytesPerPipe()),
+          numPriorityClasses(context.getNumPriorityClasses()),
+          inlineTensorThreshold(context.getInlineTensorThreshold()),
+          tensorPackingThreshold(context.getTensorPackingThreshold()),
+          earlyMessageDescriptors(context.getEarlyMessageDescriptors()),
+          deduplicateBuffers(context.getDeduplicateBuffers()),
+          descriptorStringInterning(context.getDescriptorStringInterning()),
+          writeCoalescingLimit(context.getWriteCoalescingLimit()),
+          channelAutoTuning(context.getChannelAutoTuning()),
+          maxOutstandingWriteBytes(context.getMaxOutstandingWriteBytes()),
+          allocator(context.getAllocator()) {}
+
+    // The context, which owns them, outlives the pipe.
+    const ContextOptions::executor_fn& callbackExecutor;
+    TrafficRecorder* const trafficRecorder;
+    const bool outOfOrderCompletion;
+    const size_t maxOutstandingWritesPerPipe;
+    const size_t maxOutstandingWriteBytesPerPipe;
+    const size_t numPriorityClasses;
+    const size_t inlineTensorThreshold;
+    const size_t tensorPackingThreshold;
+    const bool earlyMessageDescriptors;
+    const bool deduplicateBuffers;
+    const bool descriptorStringInterning;
+    const size_t writeCoalescingLimit;
+    const bool channelAutoTuning;
+    const size_t maxOutstandingWriteBytes;
+    const ContextOptions::allocator_fn& allocator;
+  };
+
   std::shared_ptr<Context::PrivateIface> context_;
   std::shared_ptr<Listener::PrivateIface> listener_;
+  const Settings settings_;
+
+  // The counters reported in the stats of the context.
+  std::shared_ptr<PipeCounters> counters_;
+
+  // When the pipe was created, to trace how long the handshake takes, and the
+  // identifier of the pipe in the traces, only interned once it's needed.
+  const std::chrono::steady_clock::time_point createdAt_{
+      std::chrono::steady_clock::now()};
+  optional<uint32_t> traceScope_;
+
+  // The index of the pipe in the traffic recorded by the context, if any.
+  uint64_t trafficPipeIdx_{0};
 
   // An identifier for the pipe, composed of the identifier for the context or
   // listener, combined with an increasing sequence number. It will only be used
@@ -401,11 +1087,55 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   std::string transport_;
   std::shared_ptr<transport::Connection> connection_;
 
+  // The connection that the peer's packets are read from, which only differs
+  // from the one above while the pipe upgrades its transport, between the
+  // times at which each side switches its writes over to the new connection.
+  std::shared_ptr<transport::Connection> readConnection_;
+
+  // When the pipe upgrades its transport (see ContextOptions), the one that it
+  // moves to and its connection, until both directions are on it, and whether
+  // the latter is ready to be written to. The previous connection is kept open,
+  // but idle, until the pipe closes, as this side can't tell when the peer is
+  // done reading from it.
+  std::string upgradedTransport_;
+  std::shared_ptr<transport::Connection> upgradedConnection_;
+  bool isUpgradedConnectionReady_{false};
+  std::shared_ptr<transport::Connection> previousConnection_;
+
+  // The last write whose descriptor was handed to the connection, as the
+  // writes can only switch connection once the ones of its tensors follow.
+  int64_t lastWriteWithDescriptor_{-1};
+
+  // The weight given to setWriteWeight, and all the connections it applies to,
+  // which are only referenced weakly as most of them belong to the channels.
+  uint32_t writeWeight_{1};
+  std::vector<std::weak_ptr<transport::Connection>> connections_;
+
   template <typename TBuffer>
   using TChannelMap = std::
       unordered_map<std::string, std::shared_ptr<channel::Channel<TBuffer>>>;
   TP_DEVICE_FIELD(TChannelMap<CpuBuffer>, TChannelMap<CudaBuffer>) channels_;
 
+  // Whether the channels are only connected once they're used, in which case
+  // the server doesn't wait for them to be connected to become established,
+  // and keeps the ones that the client hasn't connected yet in here too.
+  bool lazyChannelEstablishment_{false};
+  template <typename TBuffer>
+  using TLazyChannelMap = std::
+      unordered_map<std::string, std::shared_ptr<LazyChannel<TBuffer>>>;
+  TP_DEVICE_FIELD(TLazyChannelMap<CpuBuffer>, TLazyChannelMap<CudaBuffer>)
+  lazyChannels_;
+
+  // The address of the server, which the client connects the channels to, and
+  // its transport, which is the one the server picked even if the pipe hasn't
+  // upgraded to it yet.
+  std::string channelAddress_;
+  std::string channelTransport_;
+
+  // Only used if channel auto-tuning is enabled. They are set up with all the
+  // available channels when the first tensor is sent.
+  TP_DEVICE_FIELD(ChannelRouter, ChannelRouter) channelRouters_;
+
   // The server will set this up when it tell the client to switch to a
   // different connection or to open some channels.
   optional<uint64_t> registrationId_;
@@ -414,20 +1144,103 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   TP_DEVICE_FIELD(TChannelRegistrationMap, TChannelRegistrationMap)
   channelRegistrationIds_;
 
+  // If speculative channel connections are used, the client opens one for each
+  // instance of each of its channels, and keeps them here until the brochure
+  // answer says which ones to use, while the server keeps here the tags of the
+  // ones it still waits for.
+  uint64_t speculationToken_{0};
+  using TConnectionMap =
+      std::unordered_map<std::string, std::shared_ptr<transport::Connection>>;
+  TP_DEVICE_FIELD(TConnectionMap, TConnectionMap) speculativeConnections_;
+  using TTagMap = std::unordered_map<std::string, std::string>;
+  TP_DEVICE_FIELD(TTagMap, TTagMap) speculativeChannelTags_;
+
   ClosingReceiver closingReceiver_;
 
-  std::deque<ReadOperation> readOperations_;
-  std::deque<WriteOperation> writeOperations_;
+  // Operations are recycled rather than freed once finished, so that in steady
+  // state no allocations are needed for the operations themselves.
+  RecyclingQueue<ReadOperation> readOperations_{recycleReadOperation};
+  RecyclingQueue<WriteOperation> writeOperations_{recycleWriteOperation};
+  // The memory of the operations' objects that was last counted.
+  uint64_t numOperationBytes_{0};
+
+  // Count the memory of any operation that was just constructed, rather than
+  // taken from the ones set aside for reuse.
+  void accountForOperations_();
+
+  // The size of the chunks in which both ends of the pipe write payloads and
+  // inline tensors, agreed upon during the handshake (zero meaning in one go).
+  size_t payloadChunkSize_{0};
+
+  // Whether both ends of the pipe may write the descriptors of simple messages
+  // in a fixed layout, agreed upon during the handshake.
+  bool compactMessageDescriptors_{false};
 
   // A sequence number for the calls to read and write.
   uint64_t nextMessageBeingRead_{0};
   uint64_t nextMessageBeingWritten_{0};
 
+  // The templates registered by the user, indexed by their id, and the ones
+  // registered on the remote side, as their defining descriptors arrive.
+  std::vector<MessageTemplate> messageTemplates_;
+  std::unordered_map<uint64_t, MessageDescriptor> remoteMessageTemplates_;
+
+  // The strings that were given an id on the way out, and the ones that the
+  // peer gave an id to, indexed by that id minus one.
+  std::unordered_map<std::string, uint64_t> internedStrings_;
+  std::vector<std::string> remoteInternedStrings_;
+
+  // When coalescing writes, the frames that are held back while an earlier
+  // batch is in flight on the connection, together with the operation that
+  // each group of them belongs to, and the serialized nop objects among them.
+  std::vector<transport::Connection::WriteBuffer> coalescedBuffers_;
+  std::vector<WriteOperation*> coalescedOps_;
+  std::vector<std::unique_ptr<uint8_t[]>> coalescedObjects_;
+  size_t numCoalescedBytes_{0};
+  uint64_t numCoalescedWritesInFlight_{0};
+
   // A sequence number for the invocations of the callbacks of read and write.
   uint64_t nextReadDescriptorCallbackToCall_{0};
+
+  // The callbacks given to readDescriptor, which are handed the messages that
+  // aren't matched to a posted read, in order.
+  std::deque<read_descriptor_callback_fn> readDescriptorCallbacks_;
+
+  // The reads posted for each tag, waiting for their message, in order.
+  struct PostedRead {
+    Message message;
+    read_callback_fn callback;
+  };
+  std::unordered_map<uint64_t, std::deque<PostedRead>> postedReads_;
+
+  // The callback given to readDescriptors, if any, and how many operations are
+  // started on its behalf whose descriptor hasn't been handed to it yet.
+  std::shared_ptr<read_descriptor_callback_fn> multishotReadDescriptorCallback_;
+  size_t numMultishotReadOperationsPending_{0};
   uint64_t nextReadCallbackToCall_{0};
   uint64_t nextWriteCallbackToCall_{0};
 
+  // The writes that were admitted and are still in progress (see the limits in
+  // the context's options), and the first of the ones that weren't admitted.
+  size_t numOutstandingWrites_{0};
+  size_t numOutstandingWriteBytes_{0};
+  int64_t nextWriteToAdmit_{0};
+  // How many of the writes that weren't admitted have a deadline, as there's
+  // no need to look for the earliest one, or for expired ones, if none does.
+  size_t numQueuedWritesWithDeadline_{0};
+  // Whether the context will let us know when some of the bytes that all pipes
+  // share are given back, after we failed to reserve them.
+  bool isWaitingForContextWriteBytes_{false};
+  // The bucket bounding the rate at which this pipe writes, whether the one of
+  // the context applies too, and whether the context will let us know when the
+  // buckets should have filled up enough for the next write to be admitted.
+  TokenBucket writeRateLimiter_;
+  bool isExemptFromContextWriteRateLimit_{false};
+  bool isWaitingForWriteRate_{false};
+  std::vector<write_capacity_callback_fn> writeCapacityCallbacks_;
+
+  std::vector<establishment_callback_fn> establishmentCallbacks_;
+
   // When reading, we first read the descriptor, then signal this to the user,
   // and only once the user has allocated the memory we read the payloads. These
   // members store where we are in this loop, i.e., whether the next buffer we
@@ -437,6 +1250,10 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   ConnectionState connectionState_{AWAITING_DESCRIPTOR};
   int64_t messageBeingReadFromConnection_{0};
 
+  // As only one descriptor is read from the connection at a time, they can all
+  // be decoded into the same nop object, rather than allocating one for each.
+  PacketHolder nopHolderForDescriptors_;
+
   // When reading, each message will be presented to the user in order for some
   // memory to be allocated for its payloads and tensors (this happens by
   // calling the readDescriptor callback and waiting for a read call). Under
@@ -464,6 +1281,16 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
   void callReadDescriptorCallback_(ReadOperation& op);
   void callReadCallback_(ReadOperation& op);
   void callWriteCallback_(WriteOperation& op);
+  void callWriteCapacityCallbacksIfReady_();
+  void callEstablishmentCallbacksIfReady_();
+
+  // Run the callback with the current error, inline or on the executor that
+  // was given to the context, if any.
+  void invokeUserCallback_(Function<void(const Error&, Message)>, Message);
+  void invokeUserCallback_(
+      Function<void(const Error&, Message)>,
+      Message,
+      const Error&);
 
   //
   // Error handling
@@ -471,6 +1298,10 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
 
   void setError_(Error error);
 
+  // Set the error because of the given operation, and have it finish with it
+  // (once it has its callback), which may destroy it.
+  void failReadOperation_(ReadOperation& op, Error error);
+
   void handleError_();
 
   //
@@ -482,44 +1313,104 @@ class Pipe::Impl : public std::enable_shared_from_this<Pipe::Impl> {
 
   void advanceReadOperation_(ReadOperation& op);
   void advanceWriteOperation_(WriteOperation& op);
+  void advanceWriteOperationsAwaitingAdmission_();
 
   bool advanceOneReadOperation_(ReadOperation& op);
   bool advanceOneWriteOperation_(WriteOperation& op);
 
+  // Drop the writes that are waiting to be admitted and whose deadline passed,
+  // and put the one with the earliest deadline in the place of the given one,
+  // which is the next to be admitted. Return whether there's still a write in
+  // that place.
+  bool scheduleNextWriteToAdmit_(WriteOperation& op);
+
   void readDescriptorOfMessage_(ReadOperation&);
+  void readDescriptorFromConnection_(ReadOperation&);
   void readPayloadsAndReceiveTensorsOfMessage(ReadOperation&);
+  void receiveTensorOfMessage_(ReadOperation&, size_t);
+  void receivePackOfMessage_(ReadOperation&);
+  void readChunksOfPayloadsOfMessage_(ReadOperation&);
+  bool reserveCapacityForWrite_(WriteOperation&);
+  bool reserveContextWriteBytes_(WriteOperation&);
+  bool hasWriteRateFor_(WriteOperation&);
+  void releaseCapacityOfWrite_(WriteOperation&);
+  void admitWrite_(WriteOperation&);
   void sendTensorsOfMessage_(WriteOperation&);
+  void sendPackOfMessage_(WriteOperation&);
+
+  // Let the channels know that the tensors sent or received in between belong
+  // to the same message, so that they can coalesce their control messages.
+  void beginBatchOnChannels_();
+  void endBatchOnChannels_();
   void writeDescriptorAndPayloadsOfMessage_(WriteOperation&);
+  void writeTensorDescriptorsOfMessage_(WriteOperation&);
+
+  // Swap the strings of an outgoing descriptor for their ids where possible,
+  // and restore them in an incoming one, in the same order on both sides.
+  void internStringsOfDescriptor_(MessageDescriptor&);
+  void internString_(std::string&, uint64_t&);
+  void resolveStringsOfDescriptor_(MessageDescriptor&);
+  void resolveString_(std::string&, uint64_t);
+
+  // Queue a nop object, followed by some buffers, to be written as part of
+  // the next batch, calling onWriteOfPayload_ for the operation once done.
+  void coalesceWrite_(
+      WriteOperation&,
+      const AbstractNopHolder&,
+      std::vector<transport::Connection::WriteBuffer>);
+  void flushCoalescedWrites_();
+  void openSpeculativeConnections_();
   void onReadWhileServerWaitingForBrochure_(const Packet&);
   void onReadWhileClientWaitingForBrochureAnswer_(const Packet&);
   void onAcceptWhileServerWaitingForConnection_(
       std::string,
       std::shared_ptr<transport::Connection>);
+  void onAcceptOfUpgradedConnection_(
+      std::string,
+      std::shared_ptr<transport::Connection>);
+  void onReadOfTransportUpgrade_();
+  void switchWritesToUpgradedConnectionIfReady_();
   template <typename TBuffer>
   void onAcceptWhileServerWaitingForChannel_(
       std::string,
       std::string,
       std::shared_ptr<transport::Connection>);
-  void onReadOfMessageDescriptor_(ReadOperation&, const Packet&);
+  template <typename TBuffer>
+  std::shared_ptr<channel::Channel<TBuffer>> connectChannel_(
+      const std::string&,
+      uint64_t);
+  void onReadOfMessageDescriptor_(ReadOperation&, Packet&);
   void onDescriptorOfTensor_(WriteOperation&, int64_t, channel::TDescriptor);
   void onReadOfPayload_(ReadOperation&);
   void onRecvOfTensor_(ReadOperation&);
   void onWriteOfPayload_(WriteOperation&);
+  void recordTransportWrite_(
+      std::chrono::steady_clock::time_point startTime,
+      int64_t sequenceNumber);
+  uint32_t getTraceScope_();
   void onSendOfTensor_(WriteOperation&);
 
   ReadOperation* findReadOperation(int64_t sequenceNumber);
   WriteOperation* findWriteOperation(int64_t sequenceNumber);
 
   template <typename TBuffer>
-  const std::map<
-      int64_t,
-      std::tuple<std::string, std::shared_ptr<channel::Context<TBuffer>>>>&
+  const Context::PrivateIface::TOrderedChannels<TBuffer>&
   getOrderedChannels_();
 
   template <typename TBuffer>
   std::shared_ptr<channel::Context<TBuffer>> getChannelContext_(
       const std::string& channelName);
 
+  // Return the instance of the channel to send a tensor of the given length
+  // over, which is the one it asks for by name if the pipe has it. A strided
+  // tensor only goes over a channel that supports those.
+  template <typename TBuffer>
+  std::string selectChannel_(
+      size_t length,
+      const std::string& requestedChannel,
+      uint64_t priorityClass,
+      bool isStrided);
+
   bool pendingRegistrations_();
 
   template <typename T>
@@ -571,13 +1462,29 @@ Pipe::Impl::Impl(
     const std::string& url)
     : state_(CLIENT_ABOUT_TO_SEND_HELLO_AND_BROCHURE),
       context_(std::move(context)),
+      settings_(*context_),
       id_(std::move(id)),
       remoteName_(std::move(remoteName)),
       closingReceiver_(context_, context_->getClosingEmitter()) {
   std::string address;
   std::tie(transport_, address) = splitSchemeOfURL(url);
+  channelAddress_ = address;
+  channelTransport_ = transport_;
   connection_ = context_->getTransport(transport_)->connect(std::move(address));
   connection_->setId(id_ + ".tr_" + transport_);
+  registerConnection_(connection_);
+  readConnection_ = connection_;
+  counters_ = std::make_shared<PipeCounters>(
+      id_,
+      transport_,
+      writeStageNames(),
+      readStageNames(),
+      context_->getStagingMemory(),
+      context_->getOperationMemory());
+  context_->registerPipeCounters(counters_);
+  if (TrafficRecorder* recorder = settings_.trafficRecorder) {
+    trafficPipeIdx_ = recorder->registerPipe();
+  }
 }
 
 Pipe::Impl::Impl(
@@ -590,33 +1497,131 @@ Pipe::Impl::Impl(
     : state_(SERVER_WAITING_FOR_BROCHURE),
       context_(std::move(context)),
       listener_(std::move(listener)),
+      settings_(*context_),
       id_(std::move(id)),
       remoteName_(std::move(remoteName)),
       transport_(std::move(transport)),
       connection_(std::move(connection)),
       closingReceiver_(context_, context_->getClosingEmitter()) {
   connection_->setId(id_ + ".tr_" + transport_);
+  registerConnection_(connection_);
+  readConnection_ = connection_;
+  counters_ = std::make_shared<PipeCounters>(
+      id_,
+      transport_,
+      writeStageNames(),
+      readStageNames(),
+      context_->getStagingMemory(),
+      context_->getOperationMemory());
+  context_->registerPipeCounters(counters_);
+  if (TrafficRecorder* recorder = settings_.trafficRecorder) {
+    trafficPipeIdx_ = recorder->registerPipe();
+  }
 }
 
 template <>
-const std::map<
-    int64_t,
-    std::tuple<std::string, std::shared_ptr<channel::Context<CpuBuffer>>>>&
+const Context::PrivateIface::TOrderedChannels<CpuBuffer>&
 Pipe::Impl::getOrderedChannels_() {
   return context_->getOrderedCpuChannels();
 }
 
 #if TENSORPIPE_SUPPORTS_CUDA
 template <>
-const std::map<
-    int64_t,
-    std::tuple<std::string, std::shared_ptr<channel::Context<CudaBuffer>>>>&
+const Context::PrivateIface::TOrderedChannels<CudaBuffer>&
 Pipe::Impl::getOrderedChannels_() {
   return context_->getOrderedCudaChannels();
 }
 #endif // TENSORPIPE_SUPPORTS_CUDA
 
+template <>
+std::shared_ptr<channel::Context<CpuBuffer>> Pipe::Impl::getChannelContext_(
+    const std::string& channelName) {
+  return context_->getCpuChannel(channelName);
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+template <>
+std::shared_ptr<channel::Context<CudaBuffer>> Pipe::Impl::getChannelContext_(
+    const std::string& channelName) {
+  return context_->getCudaChannel(channelName);
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+template <typename TBuffer>
+std::string Pipe::Impl::selectChannel_(
+    size_t length,
+    const std::string& requestedChannel,
+    uint64_t priorityClass,
+    bool isStrided) {
+  auto& orderedChannels = this->getOrderedChannels_<TBuffer>();
+  auto& availableChannels = channels_.get<TBuffer>();
+  const std::string* selectedChannelName = nullptr;
+  // A tensor asking for a channel the pipe doesn't have goes by length.
+  bool isRequested = false;
+  if (!requestedChannel.empty()) {
+    for (const auto& channelContextIter : orderedChannels) {
+      const std::string& channelName = std::get<0>(channelContextIter.second);
+      if (channelName == requestedChannel &&
+          availableChannels.count(channelName) > 0 &&
+          (!isStrided ||
+           std::get<1>(channelContextIter.second)->supportsStridedBuffers())) {
+        selectedChannelName = &channelName;
+        isRequested = true;
+        break;
+      }
+    }
+  }
+  for (const auto& channelContextIter : orderedChannels) {
+    if (isRequested) {
+      break;
+    }
+    const std::string& channelName = std::get<0>(channelContextIter.second);
+    // Those with a maximum length of zero are only used when requested.
+    if (availableChannels.count(channelName) == 0 ||
+        std::get<2>(channelContextIter.second) == 0) {
+      continue;
+    }
+    if (isStrided &&
+        !std::get<1>(channelContextIter.second)->supportsStridedBuffers()) {
+      continue;
+    }
+    // Fall back to the first available channel if none is suitable.
+    if (selectedChannelName == nullptr) {
+      selectedChannelName = &channelName;
+    }
+    if (length <= std::get<2>(channelContextIter.second)) {
+      selectedChannelName = &channelName;
+      break;
+    }
+  }
+  TP_THROW_ASSERT_IF(selectedChannelName == nullptr)
+      << "Could not find channel" << (isStrided ? " for strided tensor" : "");
+  // The router knows nothing of strides, hence it's left out for those.
+  if (settings_.channelAutoTuning && !isRequested && !isStrided) {
+    auto& router = channelRouters_.get<TBuffer>();
+    if (!router.hasChannels()) {
+      for (const auto& channelContextIter : orderedChannels) {
+        const std::string& channelName = std::get<0>(channelContextIter.second);
+        if (availableChannels.count(channelName) > 0 &&
+            std::get<2>(channelContextIter.second) > 0) {
+          router.addChannel(channelName);
+        }
+      }
+    }
+    selectedChannelName = &router.select(length, *selectedChannelName);
+  }
+  // Messages of a class that this pipe doesn't have go with its top one.
+  for (;; --priorityClass) {
+    std::string channelName =
+        channelInstanceName(*selectedChannelName, priorityClass);
+    if (availableChannels.count(channelName) > 0) {
+      return channelName;
+    }
+  }
+}
+
 void Pipe::Impl::init() {
+  context_->registerPipeStateDumper(id_, shared_from_this());
   loop_.deferToLoop([this]() { initFromLoop_(); });
 }
 
@@ -666,12 +1671,30 @@ void Pipe::Impl::initFromLoop_() {
             channelContext.domainDescriptor();
       }
     });
+    nopBrochure.numPriorityClasses = settings_.numPriorityClasses;
+    nopBrochure.payloadChunkSize = context_->getPayloadChunkSize();
+    nopBrochure.lazyChannelEstablishment =
+        context_->getLazyChannelEstablishment();
+    nopBrochure.compactMessageDescriptors =
+        context_->getCompactMessageDescriptors();
+    nopBrochure.transportUpgrade = context_->getTransportUpgrade();
+    if (context_->getSpeculativeChannelConnections() &&
+        !context_->getLazyChannelEstablishment()) {
+      std::random_device rd;
+      do {
+        speculationToken_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+      } while (speculationToken_ == 0);
+      nopBrochure.speculationToken = speculationToken_;
+    }
     TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (brochure)";
     connection_->write(
         *nopHolderOut2, lazyCallbackWrapper_([nopHolderOut2](Impl& impl) {
           TP_VLOG(3) << "Pipe " << impl.id_
                      << " done writing nop object (brochure)";
         }));
+    if (speculationToken_ != 0) {
+      openSpeculativeConnections_();
+    }
     state_ = CLIENT_WAITING_FOR_BROCHURE_ANSWER;
     auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
     TP_VLOG(3) << "Pipe " << id_ << " is reading nop object (brochure answer)";
@@ -703,6 +1726,36 @@ const std::string& Pipe::Impl::getRemoteName() {
   return remoteName_;
 }
 
+std::map<size_t, std::string> Pipe::getChannelRoutingTable(DeviceType type) {
+  return impl_->getChannelRoutingTable(type);
+}
+
+std::map<size_t, std::string> Pipe::Impl::getChannelRoutingTable(
+    DeviceType type) {
+  std::map<size_t, std::string> table;
+  loop_.runInLoop([&]() {
+    table = switchOnDeviceType(type, [&](auto buffer) {
+      return channelRouters_.get<decltype(buffer)>().getRoutingTable();
+    });
+  });
+  return table;
+}
+
+uint64_t Pipe::registerMessageTemplate(const Message& message) {
+  return impl_->registerMessageTemplate(message);
+}
+
+uint64_t Pipe::Impl::registerMessageTemplate(const Message& message) {
+  uint64_t templateId;
+  loop_.runInLoop([&]() {
+    templateId = messageTemplates_.size();
+    messageTemplates_.push_back(makeTemplateForMessage(message));
+    TP_VLOG(1) << "Pipe " << id_ << " registered message template #"
+               << templateId;
+  });
+  return templateId;
+}
+
 Pipe::~Pipe() {
   close();
 }
@@ -738,74 +1791,154 @@ void Pipe::Impl::readDescriptor(read_descriptor_callback_fn fn) {
 void Pipe::Impl::readDescriptorFromLoop_(read_descriptor_callback_fn fn) {
   TP_DCHECK(loop_.inLoop());
 
+  TP_THROW_ASSERT_IF(multishotReadDescriptorCallback_)
+      << "readDescriptor can't be called after readDescriptors";
+
   readOperations_.emplace_back();
   ReadOperation& op = readOperations_.back();
+  accountForOperations_();
   op.sequenceNumber = nextMessageBeingRead_++;
+  op.stateEnteredAt = std::chrono::steady_clock::now();
+  op.startedAt = op.stateEnteredAt;
 
   TP_VLOG(1) << "Pipe " << id_ << " received a readDescriptor request (#"
              << op.sequenceNumber << ")";
+  TP_PROBE(pipe_read_enqueue, id_.c_str(), op.sequenceNumber);
 
-  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
-    TP_DCHECK_EQ(sequenceNumber, nextReadDescriptorCallbackToCall_++);
-    TP_VLOG(1) << "Pipe " << id_ << " is calling a readDescriptor callback (#"
-               << sequenceNumber << ")";
-    fn(error, std::move(message));
-    TP_VLOG(1) << "Pipe " << id_ << " done calling a readDescriptor callback (#"
-               << sequenceNumber << ")";
-  };
-
-  op.readDescriptorCallback = std::move(fn);
+  readDescriptorCallbacks_.push_back(std::move(fn));
 
-  advanceReadOperation_(op);
+  // An earlier operation may have found a message that wasn't matched to any
+  // posted read and that was waiting for this callback.
+  advanceFirstReadOperationWithoutAllocation_();
 }
 
-void Pipe::read(Message message, read_callback_fn fn) {
-  impl_->read(std::move(message), std::move(fn));
+void Pipe::readDescriptors(
+    read_descriptor_callback_fn fn,
+    size_t prefetchDepth) {
+  impl_->readDescriptors(std::move(fn), prefetchDepth);
 }
 
-void Pipe::Impl::read(Message message, read_callback_fn fn) {
-  // Messages aren't copyable and thus if a lambda captures them it cannot be
-  // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
-  auto sharedMessage = std::make_shared<Message>(std::move(message));
-  loop_.deferToLoop([this,
-                     sharedMessage{std::move(sharedMessage)},
-                     fn{std::move(fn)}]() mutable {
-    readFromLoop_(std::move(*sharedMessage), std::move(fn));
+void Pipe::Impl::readDescriptors(
+    read_descriptor_callback_fn fn,
+    size_t prefetchDepth) {
+  loop_.deferToLoop([this, fn{std::move(fn)}, prefetchDepth]() mutable {
+    readDescriptorsFromLoop_(std::move(fn), prefetchDepth);
   });
 }
 
-void Pipe::Impl::readFromLoop_(Message message, read_callback_fn fn) {
+void Pipe::Impl::readDescriptorsFromLoop_(
+    read_descriptor_callback_fn fn,
+    size_t prefetchDepth) {
   TP_DCHECK(loop_.inLoop());
 
-  // This is such a bad logical error on the user's side that it doesn't deserve
-  // to pass through the channel for "expected errors" (i.e., the callback).
-  // This check fails when there is no message for which we are expecting an
-  // allocation.
-  TP_THROW_ASSERT_IF(
-      nextMessageGettingAllocation_ == nextMessageAskingForAllocation_);
-
+  TP_THROW_ASSERT_IF(multishotReadDescriptorCallback_)
+      << "readDescriptors can only be called once";
+  TP_THROW_ASSERT_IF(!fn);
+  TP_THROW_ASSERT_IF(prefetchDepth == 0);
+  TP_VLOG(1) << "Pipe " << id_ << " received a readDescriptors request (with "
+             << "a prefetch depth of " << prefetchDepth << ")";
+
+  multishotReadDescriptorCallback_ =
+      std::make_shared<read_descriptor_callback_fn>(std::move(fn));
+  for (size_t idx = 0; idx < prefetchDepth; idx++) {
+    startMultishotReadOperation_();
+  }
+}
+
+void Pipe::Impl::startMultishotReadOperation_() {
+  TP_DCHECK(loop_.inLoop());
+
+  readOperations_.emplace_back();
+  ReadOperation& op = readOperations_.back();
+  accountForOperations_();
+  op.sequenceNumber = nextMessageBeingRead_++;
+  op.stateEnteredAt = std::chrono::steady_clock::now();
+  op.startedAt = op.stateEnteredAt;
+  op.isMultishot = true;
+  ++numMultishotReadOperationsPending_;
+
+  TP_VLOG(1) << "Pipe " << id_ << " started a readDescriptor operation (#"
+             << op.sequenceNumber << ") for readDescriptors";
+
+  advanceReadOperation_(op);
+}
+
+void Pipe::read(Message message, read_callback_fn fn) {
+  impl_->read(std::move(message), std::move(fn), nullptr);
+}
+
+void Pipe::read(
+    Message message,
+    read_callback_fn fn,
+    read_progress_callback_fn progressFn) {
+  impl_->read(std::move(message), std::move(fn), std::move(progressFn));
+}
+
+void Pipe::Impl::read(
+    Message message,
+    read_callback_fn fn,
+    read_progress_callback_fn progressFn) {
+  mapFileRangesOfMessage(message, /*forReading=*/true);
+  // Messages aren't copyable and thus if a lambda captures them it cannot be
+  // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
+  auto sharedMessage = std::make_shared<Message>(std::move(message));
+  loop_.deferToLoop([this,
+                     sharedMessage{std::move(sharedMessage)},
+                     fn{std::move(fn)},
+                     progressFn{std::move(progressFn)}]() mutable {
+    readFromLoop_(
+        std::move(*sharedMessage), std::move(fn), std::move(progressFn));
+  });
+}
+
+void Pipe::Impl::readFromLoop_(
+    Message message,
+    read_callback_fn fn,
+    read_progress_callback_fn progressFn) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The messages that were matched to posted reads aren't for the user to read.
+  while (nextMessageGettingAllocation_ < nextMessageAskingForAllocation_) {
+    ReadOperation* opPtr = findReadOperation(nextMessageGettingAllocation_);
+    if (opPtr != nullptr && !opPtr->isHiddenFromUser) {
+      break;
+    }
+    ++nextMessageGettingAllocation_;
+  }
+
+  // This is such a bad logical error on the user's side that it doesn't deserve
+  // to pass through the channel for "expected errors" (i.e., the callback).
+  // This check fails when there is no message for which we are expecting an
+  // allocation.
+  TP_THROW_ASSERT_IF(
+      nextMessageGettingAllocation_ == nextMessageAskingForAllocation_);
+
   ReadOperation* opPtr = findReadOperation(nextMessageGettingAllocation_);
   TP_DCHECK(opPtr != nullptr);
   ++nextMessageGettingAllocation_;
   ReadOperation& op = *opPtr;
 
   checkAllocationCompatibility(op, message);
-
-  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
-    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
-    TP_VLOG(1) << "Pipe " << id_ << " is calling a read callback (#"
-               << sequenceNumber << ")";
-    fn(error, std::move(message));
-    TP_VLOG(1) << "Pipe " << id_ << " done calling a read callback (#"
-               << sequenceNumber << ")";
-  };
-
-  TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+  Error error = checkDevicesOfTensorsWithoutChannel(op, message);
+
+  if (op.allocatedByPipe) {
+    // The payloads and tensors may already be being read.
+    TP_DCHECK(
+        op.state == ReadOperation::ASKING_FOR_ALLOCATION ||
+        op.state == ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
+    checkPreallocatedBuffers(op.message, message);
+  } else {
+    TP_DCHECK_EQ(op.state, ReadOperation::ASKING_FOR_ALLOCATION);
+  }
   op.message = std::move(message);
   op.readCallback = std::move(fn);
+  op.readProgressCallback = std::move(progressFn);
   op.doneGettingAllocation = true;
+  if (error) {
+    failReadOperation_(op, std::move(error));
+    return;
+  }
+  prepareBuffersOfMessage_(op);
 
   TP_VLOG(1) << "Pipe " << id_ << " received a read request (#"
              << op.sequenceNumber << ", containing "
@@ -815,6 +1948,209 @@ void Pipe::Impl::readFromLoop_(Message message, read_callback_fn fn) {
   advanceReadOperation_(op);
 }
 
+void Pipe::postRead(uint64_t tag, Message message, read_callback_fn fn) {
+  impl_->postRead(tag, std::move(message), std::move(fn));
+}
+
+void Pipe::Impl::postRead(
+    uint64_t tag,
+    Message message,
+    read_callback_fn fn) {
+  mapFileRangesOfMessage(message, /*forReading=*/true);
+  // Messages aren't copyable and thus if a lambda captures them it cannot be
+  // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
+  auto sharedMessage = std::make_shared<Message>(std::move(message));
+  loop_.deferToLoop([this,
+                     tag,
+                     sharedMessage{std::move(sharedMessage)},
+                     fn{std::move(fn)}]() mutable {
+    postReadFromLoop_(tag, std::move(*sharedMessage), std::move(fn));
+  });
+}
+
+void Pipe::Impl::postReadFromLoop_(
+    uint64_t tag,
+    Message message,
+    read_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+
+  TP_VLOG(1) << "Pipe " << id_ << " received a read posted for tag " << tag;
+
+  if (error_) {
+    invokeUserCallback_(std::move(fn), std::move(message));
+    return;
+  }
+
+  postedReads_[tag].push_back(PostedRead{std::move(message), std::move(fn)});
+
+  // The message may already have arrived, and be waiting for readDescriptor.
+  ReadOperation* opPtr = findReadOperation(nextMessageAskingForAllocation_);
+  if (opPtr != nullptr && opPtr->state == ReadOperation::READING_DESCRIPTOR &&
+      opPtr->doneReadingDescriptor && matchPostedRead_(*opPtr)) {
+    Error error = checkDevicesOfTensorsWithoutChannel(*opPtr, opPtr->message);
+    if (error) {
+      failReadOperation_(*opPtr, std::move(error));
+    }
+  }
+
+  // Have the pipe read one more message, unless it keeps doing so anyway for
+  // readDescriptors. There is then one operation for each readDescriptor
+  // callback and each posted read, hence each message that the operations
+  // find has something waiting for it, be it the one it was matched to or not.
+  if (!multishotReadDescriptorCallback_) {
+    readOperations_.emplace_back();
+    ReadOperation& op = readOperations_.back();
+    accountForOperations_();
+    op.sequenceNumber = nextMessageBeingRead_++;
+    op.stateEnteredAt = std::chrono::steady_clock::now();
+    op.startedAt = op.stateEnteredAt;
+    TP_VLOG(1) << "Pipe " << id_ << " started a readDescriptor operation (#"
+               << op.sequenceNumber << ") for a posted read";
+    TP_PROBE(pipe_read_enqueue, id_.c_str(), op.sequenceNumber);
+  }
+
+  advanceFirstReadOperationWithoutAllocation_();
+}
+
+bool Pipe::Impl::matchPostedRead_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(op.doneReadingDescriptor);
+
+  if (!op.message.tag.has_value()) {
+    return false;
+  }
+  auto iter = postedReads_.find(op.message.tag.value());
+  if (iter == postedReads_.end()) {
+    return false;
+  }
+  PostedRead postedRead = std::move(iter->second.front());
+  iter->second.pop_front();
+  if (iter->second.empty()) {
+    postedReads_.erase(iter);
+  }
+
+  TP_VLOG(2) << "Pipe " << id_ << " matched message #" << op.sequenceNumber
+             << " to a read posted for tag " << op.message.tag.value();
+  checkAllocationCompatibility(op, postedRead.message);
+
+  // What the user would have learned from readDescriptor.
+  Message& message = postedRead.message;
+  message.metadata = std::move(op.message.metadata);
+  message.tag = op.message.tag;
+  for (size_t payloadIdx = 0; payloadIdx < message.payloads.size();
+       payloadIdx++) {
+    Message::Payload& payload = message.payloads[payloadIdx];
+    Message::Payload& payloadOfDescriptor = op.message.payloads[payloadIdx];
+    payload.metadata = std::move(payloadOfDescriptor.metadata);
+    payload.duplicateOf = payloadOfDescriptor.duplicateOf;
+  }
+  for (size_t tensorIdx = 0; tensorIdx < message.tensors.size();
+       tensorIdx++) {
+    Message::Tensor& tensor = message.tensors[tensorIdx];
+    Message::Tensor& tensorOfDescriptor = op.message.tensors[tensorIdx];
+    tensor.metadata = std::move(tensorOfDescriptor.metadata);
+    tensor.duplicateOf = tensorOfDescriptor.duplicateOf;
+  }
+
+  op.message = std::move(message);
+  op.readCallback = std::move(postedRead.callback);
+  op.doneGettingAllocation = true;
+  op.isHiddenFromUser = true;
+  prepareBuffersOfMessage_(op);
+  return true;
+}
+
+void Pipe::Impl::advanceFirstReadOperationWithoutAllocation_() {
+  TP_DCHECK(loop_.inLoop());
+
+  // The operations that haven't asked for an allocation yet are the last ones,
+  // and only the first of them can be waiting for anything but the others.
+  ReadOperation* opPtr = findReadOperation(nextMessageAskingForAllocation_);
+  if (opPtr != nullptr) {
+    advanceReadOperation_(*opPtr);
+  }
+}
+
+void Pipe::Impl::prepareBuffersOfMessage_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The payloads that the user left for the pipe to allocate get memory now,
+  // except for duplicates, which share that of their source once read.
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    Message::Payload& payload = op.message.payloads[payloadIdx];
+    if (op.payloads[payloadIdx].duplicateOf < 0 && payload.data == nullptr &&
+        payload.length > 0) {
+      std::shared_ptr<uint8_t> owner(
+          new uint8_t[payload.length], std::default_delete<uint8_t[]>());
+      payload.data = owner.get();
+      payload.owner = std::move(owner);
+    }
+  }
+
+  // The CPU tensors that the user left for the pipe to allocate get memory
+  // now if they're inline or packed, and otherwise from their channel when
+  // received.
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    Message::Tensor& tensor = op.message.tensors[tensorIdx];
+    if ((op.tensors[tensorIdx].isInline || op.tensors[tensorIdx].isPacked) &&
+        tensor.buffer.type == DeviceType::kCpu &&
+        !isSegmented(tensor.buffer.cpu) && tensor.buffer.cpu.ptr == nullptr) {
+      std::shared_ptr<uint8_t> owner(
+          new uint8_t[tensor.buffer.cpu.length],
+          std::default_delete<uint8_t[]>());
+      tensor.buffer.cpu.ptr = owner.get();
+      tensor.owner = std::move(owner);
+    }
+  }
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  // Strided CUDA tensors can't be staged, as that would take a device buffer.
+  // Those without a channel fail the read instead.
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    const Message::Tensor& tensor = op.message.tensors[tensorIdx];
+    if (tensor.buffer.type != DeviceType::kCuda ||
+        !isStrided(tensor.buffer.cuda) || op.tensors[tensorIdx].isInline ||
+        op.tensors[tensorIdx].isPacked) {
+      continue;
+    }
+    const std::string& channelName = op.tensors[tensorIdx].channelName;
+    TP_THROW_ASSERT_IF(!getChannelContext_<CudaBuffer>(
+                            baseChannelName(channelName))
+                            ->supportsStridedBuffers())
+        << "Tensor #" << op.sequenceNumber << "." << tensorIdx
+        << " has a strided destination but comes over channel " << channelName
+        << ", which doesn't support those";
+  }
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+  // The packed tensors are scattered into their segments directly, whereas
+  // the others are staged unless their channel can handle segments itself.
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    Message::Tensor& tensor = op.message.tensors[tensorIdx];
+    ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
+    if (tensor.buffer.type != DeviceType::kCpu ||
+        !isSegmented(tensor.buffer.cpu) || tensorBeingAllocated.isPacked ||
+        tensorBeingAllocated.duplicateOf >= 0) {
+      continue;
+    }
+    if (!tensorBeingAllocated.isInline &&
+        getChannelContext_<CpuBuffer>(
+            baseChannelName(tensorBeingAllocated.channelName))
+            ->supportsSegmentedBuffers()) {
+      continue;
+    }
+    const size_t length = tensor.buffer.cpu.length;
+    tensorBeingAllocated.segmentedBuffer = tensor.buffer.cpu;
+    tensorBeingAllocated.stagingBuffer =
+        allocateStagingBuffer(counters_->stagingMemory, length);
+    tensor.buffer = CpuBuffer{tensorBeingAllocated.stagingBuffer.get(), length};
+  }
+}
+
 void Pipe::Impl::readPayloadsAndReceiveTensorsOfMessage(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
@@ -828,86 +2164,412 @@ void Pipe::Impl::readPayloadsAndReceiveTensorsOfMessage(ReadOperation& op) {
 
   TP_DCHECK_EQ(connectionState_, AWAITING_PAYLOADS);
   TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
-  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
-       payloadIdx++) {
-    Message::Payload& payload = op.message.payloads[payloadIdx];
-    TP_VLOG(3) << "Pipe " << id_ << " is reading payload #" << op.sequenceNumber
-               << "." << payloadIdx;
-    connection_->read(
-        payload.data,
-        payload.length,
-        eagerCallbackWrapper_(
-            [&op, payloadIdx](
-                Impl& impl, const void* /* unused */, size_t /* unused */) {
-              TP_VLOG(3) << "Pipe " << impl.id_ << " done reading payload #"
-                         << op.sequenceNumber << "." << payloadIdx;
-              impl.onReadOfPayload_(op);
-            }));
-    ++op.numPayloadsBeingRead;
+  if (payloadChunkSize_ > 0) {
+    readChunksOfPayloadsOfMessage_(op);
+  } else {
+    // The inline tensors follow the payloads on the connection. We read all of
+    // them at once, with a single callback, as that's what they are from the
+    // connection's point of view.
+    std::vector<transport::Connection::ReadBuffer> buffers;
+    buffers.reserve(op.message.payloads.size() + op.message.tensors.size());
+    for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+         payloadIdx++) {
+      if (op.payloads[payloadIdx].duplicateOf < 0) {
+        Message::Payload& payload = op.message.payloads[payloadIdx];
+        buffers.push_back({payload.data, payload.length});
+      }
+    }
+    for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+         tensorIdx++) {
+      if (op.tensors[tensorIdx].isInline) {
+        Message::Tensor& tensor = op.message.tensors[tensorIdx];
+        TP_DCHECK(tensor.buffer.type == DeviceType::kCpu);
+        buffers.push_back({tensor.buffer.cpu.ptr, tensor.buffer.cpu.length});
+      }
+    }
+    if (!buffers.empty()) {
+      TP_VLOG(3) << "Pipe " << id_ << " is reading " << buffers.size()
+                 << " payloads and inline tensors of message #"
+                 << op.sequenceNumber;
+      readConnection_->readv(
+          std::move(buffers), eagerCallbackWrapper_([&op](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done reading payloads and inline tensors of "
+                       << "message #" << op.sequenceNumber;
+            impl.onReadOfPayload_(op);
+          }));
+      ++op.numPayloadsBeingRead;
+    }
+  }
+
+  // The descriptors of the tensors, if they weren't in the message descriptor,
+  // come next, and each tensor can be received once its own is read.
+  if (op.channelDescriptorsFollow) {
+    if (op.pack.length > 0) {
+      auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
+      TP_VLOG(3) << "Pipe " << id_
+                 << " is reading nop object (pack descriptor #"
+                 << op.sequenceNumber << ")";
+      readConnection_->read(
+          *nopHolderIn, eagerCallbackWrapper_([&op, nopHolderIn](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done reading nop object (pack descriptor #"
+                       << op.sequenceNumber << ")";
+            if (impl.error_) {
+              impl.onRecvOfTensor_(op);
+              return;
+            }
+            Packet& nopPacketIn = nopHolderIn->getObject();
+            TP_DCHECK_EQ(
+                nopPacketIn.index(),
+                nopPacketIn.index_of<TensorChannelDescriptor>());
+            op.pack.descriptor = std::move(
+                nopPacketIn.get<TensorChannelDescriptor>()->channelDescriptor);
+            impl.receivePackOfMessage_(op);
+          }));
+      ++op.numTensorsBeingReceived;
+    }
+    for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+         tensorIdx++) {
+      if (op.tensors[tensorIdx].isInline || op.tensors[tensorIdx].isPacked ||
+          op.tensors[tensorIdx].duplicateOf >= 0) {
+        continue;
+      }
+      auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
+      TP_VLOG(3) << "Pipe " << id_
+                 << " is reading nop object (tensor descriptor #"
+                 << op.sequenceNumber << "." << tensorIdx << ")";
+      readConnection_->read(
+          *nopHolderIn,
+          eagerCallbackWrapper_([&op, tensorIdx, nopHolderIn](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done reading nop object (tensor descriptor #"
+                       << op.sequenceNumber << "." << tensorIdx << ")";
+            if (impl.error_) {
+              impl.onRecvOfTensor_(op);
+              return;
+            }
+            Packet& nopPacketIn = nopHolderIn->getObject();
+            TP_DCHECK_EQ(
+                nopPacketIn.index(),
+                nopPacketIn.index_of<TensorChannelDescriptor>());
+            op.tensors[tensorIdx].descriptor = std::move(
+                nopPacketIn.get<TensorChannelDescriptor>()->channelDescriptor);
+            impl.receiveTensorOfMessage_(op, tensorIdx);
+          }));
+      ++op.numTensorsBeingReceived;
+    }
   }
   connectionState_ = AWAITING_DESCRIPTOR;
   ++messageBeingReadFromConnection_;
 
+  if (op.channelDescriptorsFollow) {
+    return;
+  }
+
+  beginBatchOnChannels_();
+  if (op.pack.length > 0) {
+    receivePackOfMessage_(op);
+    ++op.numTensorsBeingReceived;
+  }
   for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
        tensorIdx++) {
-    Message::Tensor& tensor = op.message.tensors[tensorIdx];
-    switchOnDeviceType(
-        op.message.tensors[tensorIdx].buffer.type, [&](auto buffer) {
-          ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
-          std::shared_ptr<channel::Channel<decltype(buffer)>> channel =
-              channels_.get<decltype(buffer)>().at(
-                  tensorBeingAllocated.channelName);
-          TP_VLOG(3) << "Pipe " << id_ << " is receiving tensor #"
-                     << op.sequenceNumber << "." << tensorIdx;
-
-          channel->recv(
-              std::move(tensorBeingAllocated.descriptor),
-              unwrap<decltype(buffer)>(tensor.buffer),
-              eagerCallbackWrapper_([&op, tensorIdx](Impl& impl) {
-                TP_VLOG(3) << "Pipe " << impl.id_ << " done receiving tensor #"
-                           << op.sequenceNumber << "." << tensorIdx;
-                impl.onRecvOfTensor_(op);
+    if (op.tensors[tensorIdx].isInline || op.tensors[tensorIdx].isPacked ||
+        op.tensors[tensorIdx].duplicateOf >= 0) {
+      continue;
+    }
+    receiveTensorOfMessage_(op, tensorIdx);
+    ++op.numTensorsBeingReceived;
+  }
+  endBatchOnChannels_();
+}
+
+void Pipe::Impl::receivePackOfMessage_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  std::shared_ptr<channel::CpuChannel> channel =
+      channels_.get<CpuBuffer>().at(op.pack.channelName);
+  TP_VLOG(3) << "Pipe " << id_
+             << " is receiving the packed tensors of message #"
+             << op.sequenceNumber;
+
+  const size_t length = op.pack.length;
+  op.packBuffer = allocateStagingBuffer(counters_->stagingMemory, length);
+  channel->recv(
+      std::move(op.pack.descriptor),
+      CpuBuffer{op.packBuffer.get(), length},
+      eagerCallbackWrapper_([&op](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done receiving the packed tensors of message #"
+                   << op.sequenceNumber;
+        size_t offset = 0;
+        for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+          if (impl.error_ || !op.tensors[tensorIdx].isPacked) {
+            continue;
+          }
+          const CpuBuffer& buffer = op.message.tensors[tensorIdx].buffer.cpu;
+          copyToCpuBuffer(
+              buffer, 0, op.packBuffer.get() + offset, buffer.length);
+          offset += buffer.length;
+          if (op.readProgressCallback) {
+            op.readProgressCallback(
+                ReadProgress{ReadProgress::kTensor, tensorIdx, buffer.length});
+          }
+        }
+        op.packBuffer.reset();
+        impl.onRecvOfTensor_(op);
+      }));
+}
+
+void Pipe::Impl::receiveTensorOfMessage_(ReadOperation& op, size_t tensorIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  Message::Tensor& tensor = op.message.tensors[tensorIdx];
+  switchOnDeviceType(tensor.buffer.type, [&](auto buffer) {
+    ReadOperation::Tensor& tensorBeingAllocated = op.tensors[tensorIdx];
+    std::shared_ptr<channel::Channel<decltype(buffer)>> channel =
+        channels_.get<decltype(buffer)>().at(tensorBeingAllocated.channelName);
+    TP_VLOG(3) << "Pipe " << id_ << " is receiving tensor #"
+               << op.sequenceNumber << "." << tensorIdx;
+
+    const auto startTime = std::chrono::steady_clock::now();
+    auto onRecv = [&op, tensorIdx, startTime](Impl& impl) {
+      TP_VLOG(3) << "Pipe " << impl.id_ << " done receiving tensor #"
+                 << op.sequenceNumber << "." << tensorIdx;
+      if (!impl.error_ && trace::isEnabled()) {
+        trace::recordSpan(
+            "channel_recv",
+            impl.getTraceScope_(),
+            op.sequenceNumber,
+            startTime,
+            std::chrono::steady_clock::now());
+      }
+      if (!impl.error_ && op.readProgressCallback) {
+        op.readProgressCallback(ReadProgress{
+            ReadProgress::kTensor,
+            tensorIdx,
+            static_cast<size_t>(op.tensors[tensorIdx].length)});
+      }
+      impl.onRecvOfTensor_(op);
+    };
+    if (tensor.buffer.type == DeviceType::kCpu &&
+        !isSegmented(tensor.buffer.cpu) && tensor.buffer.cpu.ptr == nullptr) {
+      using TBuffer = decltype(buffer);
+      channel->recvOwned(
+          std::move(tensorBeingAllocated.descriptor),
+          unwrap<TBuffer>(tensor.buffer),
+          eagerCallbackWrapper_(
+              [&op, tensorIdx, onRecv{std::move(onRecv)}](
+                  Impl& impl, TBuffer buffer, std::shared_ptr<void> owner) {
+                Message::Tensor& tensor = op.message.tensors[tensorIdx];
+                tensor.buffer = buffer;
+                tensor.owner = std::move(owner);
+                onRecv(impl);
               }));
-          ++op.numTensorsBeingReceived;
-        });
+    } else {
+      channel->recv(
+          std::move(tensorBeingAllocated.descriptor),
+          unwrap<decltype(buffer)>(tensor.buffer),
+          eagerCallbackWrapper_(std::move(onRecv)));
+    }
+  });
+}
+
+void Pipe::Impl::readChunksOfPayloadsOfMessage_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  // Each chunk is a separate buffer on the connection, and is read with its
+  // own callback, so that the user can be told about it as soon as it's in.
+  auto readChunks = [&](ReadProgress::Kind kind,
+                        size_t index,
+                        void* ptr,
+                        size_t length) {
+    for (size_t offset = 0; offset < length; offset += payloadChunkSize_) {
+      const size_t chunkLength = std::min(payloadChunkSize_, length - offset);
+      const size_t end = offset + chunkLength;
+      readConnection_->read(
+          reinterpret_cast<uint8_t*>(ptr) + offset,
+          chunkLength,
+          eagerCallbackWrapper_(
+              [&op, kind, index, end](
+                  Impl& impl, const void* /* unused */, size_t /* unused */) {
+                if (!impl.error_ && op.readProgressCallback) {
+                  op.readProgressCallback(ReadProgress{kind, index, end});
+                }
+                impl.onReadOfPayload_(op);
+              }));
+      ++op.numPayloadsBeingRead;
+    }
+  };
+
+  TP_VLOG(3) << "Pipe " << id_ << " is reading payloads and inline tensors of "
+             << "message #" << op.sequenceNumber << " in chunks of "
+             << payloadChunkSize_ << " bytes";
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    if (op.payloads[payloadIdx].duplicateOf >= 0) {
+      continue;
+    }
+    Message::Payload& payload = op.message.payloads[payloadIdx];
+    readChunks(
+        ReadProgress::kPayload, payloadIdx, payload.data, payload.length);
+  }
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    if (op.tensors[tensorIdx].isInline) {
+      Message::Tensor& tensor = op.message.tensors[tensorIdx];
+      TP_DCHECK(tensor.buffer.type == DeviceType::kCpu);
+      readChunks(
+          ReadProgress::kTensor,
+          tensorIdx,
+          tensor.buffer.cpu.ptr,
+          tensor.buffer.cpu.length);
+    }
   }
 }
 
-void Pipe::write(Message message, write_callback_fn fn) {
-  impl_->write(std::move(message), std::move(fn));
+void Pipe::Impl::beginBatchOnChannels_() {
+  TP_DCHECK(loop_.inLoop());
+  forEachDeviceType([&](auto buffer) {
+    for (auto& channelIter : channels_.get<decltype(buffer)>()) {
+      channelIter.second->beginBatch();
+    }
+  });
+}
+
+void Pipe::Impl::endBatchOnChannels_() {
+  TP_DCHECK(loop_.inLoop());
+  forEachDeviceType([&](auto buffer) {
+    for (auto& channelIter : channels_.get<decltype(buffer)>()) {
+      channelIter.second->endBatch();
+    }
+  });
+}
+
+void Pipe::write(
+    Message message,
+    write_callback_fn fn,
+    uint64_t priorityClass,
+    std::chrono::steady_clock::time_point deadline) {
+  impl_->write(std::move(message), std::move(fn), priorityClass, deadline);
 }
 
-void Pipe::Impl::write(Message message, write_callback_fn fn) {
+void Pipe::Impl::write(
+    Message message,
+    write_callback_fn fn,
+    uint64_t priorityClass,
+    std::chrono::steady_clock::time_point deadline) {
+  mapFileRangesOfMessage(message, /*forReading=*/false);
   // Messages aren't copyable and thus if a lambda captures them it cannot be
   // wrapped in a std::function. Therefore we wrap Messages in shared_ptrs.
   auto sharedMessage = std::make_shared<Message>(std::move(message));
   loop_.deferToLoop([this,
                      sharedMessage{std::move(sharedMessage)},
-                     fn{std::move(fn)}]() mutable {
-    writeFromLoop_(std::move(*sharedMessage), std::move(fn));
+                     fn{std::move(fn)},
+                     priorityClass,
+                     deadline]() mutable {
+    writeFromLoop_(
+        std::move(*sharedMessage), std::move(fn), priorityClass, deadline);
   });
 }
 
-void Pipe::Impl::writeFromLoop_(Message message, write_callback_fn fn) {
+Error Pipe::readDescriptorSync(Message& message) {
+  return impl_->readDescriptorSync(message);
+}
+
+Error Pipe::Impl::readDescriptorSync(Message& message) {
+  TP_THROW_ASSERT_IF(loop_.inLoop())
+      << "readDescriptorSync can't be called from a callback of the pipe";
+  std::atomic<bool> done{false};
+  Error result;
+  readDescriptor([&](const Error& error, Message readMessage) {
+    result = error;
+    message = std::move(readMessage);
+    done.store(true, std::memory_order_release);
+  });
+  busyWaitUntil(done);
+  return result;
+}
+
+Error Pipe::readSync(Message& message) {
+  return impl_->readSync(message);
+}
+
+Error Pipe::Impl::readSync(Message& message) {
+  TP_THROW_ASSERT_IF(loop_.inLoop())
+      << "readSync can't be called from a callback of the pipe";
+  std::atomic<bool> done{false};
+  Error result;
+  read(
+      std::move(message),
+      [&](const Error& error, Message readMessage) {
+        result = error;
+        message = std::move(readMessage);
+        done.store(true, std::memory_order_release);
+      },
+      nullptr);
+  busyWaitUntil(done);
+  return result;
+}
+
+Error Pipe::writeAndWait(Message& message, uint64_t priorityClass) {
+  return impl_->writeAndWait(message, priorityClass);
+}
+
+Error Pipe::Impl::writeAndWait(Message& message, uint64_t priorityClass) {
+  TP_THROW_ASSERT_IF(loop_.inLoop())
+      << "writeAndWait can't be called from a callback of the pipe";
+  std::atomic<bool> done{false};
+  Error result;
+  write(
+      std::move(message),
+      [&](const Error& error, Message writtenMessage) {
+        result = error;
+        message = std::move(writtenMessage);
+        done.store(true, std::memory_order_release);
+      },
+      priorityClass,
+      std::chrono::steady_clock::time_point::max());
+  busyWaitUntil(done);
+  return result;
+}
+
+void Pipe::Impl::writeFromLoop_(
+    Message message,
+    write_callback_fn fn,
+    uint64_t priorityClass,
+    std::chrono::steady_clock::time_point deadline) {
   TP_DCHECK(loop_.inLoop());
 
   writeOperations_.emplace_back();
   WriteOperation& op = writeOperations_.back();
+  accountForOperations_();
   op.sequenceNumber = nextMessageBeingWritten_++;
+  op.stateEnteredAt = std::chrono::steady_clock::now();
+  op.startedAt = op.stateEnteredAt;
+  op.priorityClass = priorityClass;
+  op.deadline = deadline;
+  if (deadline != std::chrono::steady_clock::time_point::max()) {
+    numQueuedWritesWithDeadline_++;
+  }
+
+  if (message.templateId.has_value()) {
+    TP_THROW_ASSERT_IF(message.templateId.value() >= messageTemplates_.size())
+        << "Unknown message template";
+    checkTemplateCompatibility(
+        messageTemplates_[message.templateId.value()], message);
+  }
 
   TP_VLOG(1) << "Pipe " << id_ << " received a write request (#"
              << op.sequenceNumber << ", contaning " << message.payloads.size()
              << " payloads and " << message.tensors.size() << " tensors)";
 
-  fn = [this, sequenceNumber{op.sequenceNumber}, fn{std::move(fn)}](
-           const Error& error, Message message) {
-    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
-    TP_VLOG(1) << "Pipe " << id_ << " is calling a write callback (#"
-               << sequenceNumber << ")";
-    fn(error, std::move(message));
-    TP_VLOG(1) << "Pipe " << id_ << " done calling a write callback (#"
-               << sequenceNumber << ")";
-  };
+  for (const auto& payload : message.payloads) {
+    op.numBytes += payload.length;
+  }
+  for (const auto& tensor : message.tensors) {
+    op.numBytes += getTensorLength(tensor);
+  }
 
   op.message = std::move(message);
   op.writeCallback = std::move(fn);
@@ -915,10 +2577,327 @@ void Pipe::Impl::writeFromLoop_(Message message, write_callback_fn fn) {
   advanceWriteOperation_(op);
 }
 
+void Pipe::waitForWriteCapacity(write_capacity_callback_fn fn) {
+  impl_->waitForWriteCapacity(std::move(fn));
+}
+
+void Pipe::Impl::waitForWriteCapacity(write_capacity_callback_fn fn) {
+  loop_.deferToLoop([this, fn{std::move(fn)}]() mutable {
+    waitForWriteCapacityFromLoop_(std::move(fn));
+  });
+}
+
+void Pipe::Impl::waitForWriteCapacityFromLoop_(write_capacity_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  writeCapacityCallbacks_.push_back(std::move(fn));
+  callWriteCapacityCallbacksIfReady_();
+}
+
+void Pipe::setWriteWeight(uint32_t weight) {
+  impl_->setWriteWeight(weight);
+}
+
+void Pipe::Impl::setWriteWeight(uint32_t weight) {
+  loop_.deferToLoop([this, weight]() { setWriteWeightFromLoop_(weight); });
+}
+
+void Pipe::Impl::setWriteWeightFromLoop_(uint32_t weight) {
+  TP_DCHECK(loop_.inLoop());
+  TP_THROW_ASSERT_IF(weight == 0) << "The write weight must be positive";
+  writeWeight_ = weight;
+  auto iter = connections_.begin();
+  while (iter != connections_.end()) {
+    std::shared_ptr<transport::Connection> connection = iter->lock();
+    if (connection == nullptr) {
+      iter = connections_.erase(iter);
+      continue;
+    }
+    connection->setWriteWeight(weight);
+    ++iter;
+  }
+}
+
+void Pipe::setWriteRateLimit(double bytesPerSecond, size_t burstBytes) {
+  impl_->setWriteRateLimit(bytesPerSecond, burstBytes);
+}
+
+void Pipe::Impl::setWriteRateLimit(double bytesPerSecond, size_t burstBytes) {
+  loop_.deferToLoop([this, bytesPerSecond, burstBytes]() {
+    setWriteRateLimitFromLoop_(bytesPerSecond, burstBytes);
+  });
+}
+
+void Pipe::Impl::setWriteRateLimitFromLoop_(
+    double bytesPerSecond,
+    size_t burstBytes) {
+  TP_DCHECK(loop_.inLoop());
+  writeRateLimiter_.setRate(bytesPerSecond, burstBytes);
+  // If we were waiting, it was for as long as the old rate required, hence we
+  // check again, and wait anew if needed (the old wait is then harmless).
+  isWaitingForWriteRate_ = false;
+  advanceWriteOperationsAwaitingAdmission_();
+}
+
+void Pipe::exemptFromContextWriteRateLimit(bool exempt) {
+  impl_->exemptFromContextWriteRateLimit(exempt);
+}
+
+void Pipe::Impl::exemptFromContextWriteRateLimit(bool exempt) {
+  loop_.deferToLoop(
+      [this, exempt]() { exemptFromContextWriteRateLimitFromLoop_(exempt); });
+}
+
+void Pipe::Impl::exemptFromContextWriteRateLimitFromLoop_(bool exempt) {
+  TP_DCHECK(loop_.inLoop());
+  isExemptFromContextWriteRateLimit_ = exempt;
+  isWaitingForWriteRate_ = false;
+  advanceWriteOperationsAwaitingAdmission_();
+}
+
+void Pipe::Impl::registerConnection_(
+    const std::shared_ptr<transport::Connection>& connection) {
+  connections_.push_back(connection);
+  if (writeWeight_ != 1) {
+    connection->setWriteWeight(writeWeight_);
+  }
+}
+
+void Pipe::waitForEstablishment(establishment_callback_fn fn) {
+  impl_->waitForEstablishment(std::move(fn));
+}
+
+void Pipe::Impl::waitForEstablishment(establishment_callback_fn fn) {
+  loop_.deferToLoop([this, fn{std::move(fn)}]() mutable {
+    waitForEstablishmentFromLoop_(std::move(fn));
+  });
+}
+
+void Pipe::Impl::waitForEstablishmentFromLoop_(establishment_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  establishmentCallbacks_.push_back(std::move(fn));
+  callEstablishmentCallbacksIfReady_();
+}
+
+Pipe::WriteStats Pipe::getWriteStats() {
+  return impl_->getWriteStats();
+}
+
+Pipe::WriteStats Pipe::Impl::getWriteStats() {
+  WriteStats stats;
+  loop_.runInLoop([&]() {
+    stats.numOutstandingWrites = numOutstandingWrites_;
+    stats.numOutstandingWriteBytes = numOutstandingWriteBytes_;
+    for (int64_t sequenceNumber = nextWriteToAdmit_;; ++sequenceNumber) {
+      const WriteOperation* opPtr = findWriteOperation(sequenceNumber);
+      if (opPtr == nullptr) {
+        break;
+      }
+      if (opPtr->state == WriteOperation::UNINITIALIZED) {
+        stats.numQueuedWrites++;
+        stats.numQueuedWriteBytes += opPtr->numBytes;
+      }
+    }
+  });
+  return stats;
+}
+
+void Pipe::Impl::accountForOperations_() {
+  TP_DCHECK(loop_.inLoop());
+  const uint64_t numOperationBytes =
+      readOperations_.numAllocated() * sizeof(ReadOperation) +
+      writeOperations_.numAllocated() * sizeof(WriteOperation);
+  if (numOperationBytes > numOperationBytes_) {
+    counters_->operationMemory->add(numOperationBytes - numOperationBytes_);
+    numOperationBytes_ = numOperationBytes;
+  }
+}
+
+void Pipe::Impl::dumpState(dump_state_callback_fn fn) {
+  // Unlike the calls of the user, this comes from the context, which doesn't
+  // keep the pipe alive, hence we do.
+  loop_.deferToLoop([impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+    std::string state = impl->dumpStateFromLoop_();
+    if (impl->connection_ == nullptr) {
+      fn(std::move(state));
+      return;
+    }
+    // The connection answers from its own loop, to which it's handed over.
+    impl->connection_->dumpState(
+        [state{std::move(state)}, fn{std::move(fn)}](std::string connState) {
+          if (connState.empty()) {
+            fn(std::move(state));
+          } else {
+            fn(state + "  connection: " + connState + "\n");
+          }
+        });
+  });
+}
+
+std::string Pipe::Impl::dumpStateFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+  const auto now = std::chrono::steady_clock::now();
+  auto millisecondsSince = [&](std::chrono::steady_clock::time_point then) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now - then)
+        .count();
+  };
+
+  std::ostringstream oss;
+  oss << "Pipe " << id_ << " (transport " << transport_ << ", state ";
+  switch (state_) {
+    case INITIALIZING:
+      oss << "initializing";
+      break;
+    case CLIENT_ABOUT_TO_SEND_HELLO_AND_BROCHURE:
+      oss << "client_about_to_send_hello_and_brochure";
+      break;
+    case SERVER_WAITING_FOR_BROCHURE:
+      oss << "server_waiting_for_brochure";
+      break;
+    case CLIENT_WAITING_FOR_BROCHURE_ANSWER:
+      oss << "client_waiting_for_brochure_answer";
+      break;
+    case SERVER_WAITING_FOR_CONNECTIONS:
+      oss << "server_waiting_for_connections";
+      break;
+    case ESTABLISHED:
+      oss << "established";
+      break;
+  }
+  oss << ", for " << millisecondsSince(createdAt_) << "ms";
+  if (upgradedConnection_ != nullptr) {
+    oss << ", upgrading to transport " << upgradedTransport_;
+  }
+  if (error_) {
+    oss << ", failed: " << error_.what();
+  }
+  oss << ")\n";
+
+  // The bytes of the tensors that each channel is still sending or receiving,
+  // as far as the operations that are in those states can tell.
+  std::map<std::string, size_t> channelBytesBeingSent;
+  std::map<std::string, size_t> channelBytesBeingReceived;
+
+  std::vector<size_t> numReadsByState(ReadOperation::FINISHED + 1);
+  for (size_t idx = 0; idx < readOperations_.size(); idx++) {
+    const ReadOperation& op = readOperations_[idx];
+    numReadsByState[op.state]++;
+    if (op.state != ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS ||
+        op.numTensorsBeingReceived == 0) {
+      continue;
+    }
+    for (const auto& tensor : op.tensors) {
+      if (!tensor.isInline && !tensor.isPacked && tensor.duplicateOf < 0) {
+        channelBytesBeingReceived[tensor.channelName] += tensor.length;
+      }
+    }
+    if (op.pack.length > 0) {
+      channelBytesBeingReceived[op.pack.channelName] += op.pack.length;
+    }
+  }
+  oss << "  reads: " << readOperations_.size() << " in progress";
+  for (size_t state = 0; state < numReadsByState.size(); state++) {
+    if (numReadsByState[state] > 0) {
+      oss << ", " << numReadsByState[state] << " "
+          << counters_->readStageNames[state];
+    }
+  }
+  if (!readOperations_.empty()) {
+    const ReadOperation& op = readOperations_[0];
+    oss << "; oldest #" << op.sequenceNumber << " started "
+        << millisecondsSince(op.startedAt) << "ms ago, "
+        << counters_->readStageNames[op.state] << " for "
+        << millisecondsSince(op.stateEnteredAt) << "ms";
+  }
+  oss << "\n";
+
+  std::vector<size_t> numWritesByState(WriteOperation::FINISHED + 1);
+  for (size_t idx = 0; idx < writeOperations_.size(); idx++) {
+    const WriteOperation& op = writeOperations_[idx];
+    numWritesByState[op.state]++;
+    if ((op.state !=
+             WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS &&
+         op.state != WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS) ||
+        op.numTensorsBeingSent == 0) {
+      continue;
+    }
+    for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+      const WriteOperation::Tensor& tensor = op.tensors[tensorIdx];
+      if (!tensor.isInline && !tensor.isPacked && tensor.duplicateOf < 0) {
+        channelBytesBeingSent[tensor.channelName] +=
+            getTensorLength(op.message.tensors[tensorIdx]);
+      }
+    }
+    if (op.packLength > 0) {
+      channelBytesBeingSent[op.pack.channelName] += op.packLength;
+    }
+  }
+  oss << "  writes: " << writeOperations_.size() << " in progress";
+  for (size_t state = 0; state < numWritesByState.size(); state++) {
+    if (numWritesByState[state] > 0) {
+      oss << ", " << numWritesByState[state] << " "
+          << counters_->writeStageNames[state];
+    }
+  }
+  if (!writeOperations_.empty()) {
+    const WriteOperation& op = writeOperations_[0];
+    oss << "; oldest #" << op.sequenceNumber << " started "
+        << millisecondsSince(op.startedAt) << "ms ago, "
+        << counters_->writeStageNames[op.state] << " for "
+        << millisecondsSince(op.stateEnteredAt) << "ms";
+  }
+  oss << "\n";
+
+  size_t numPostedReads = 0;
+  for (const auto& iter : postedReads_) {
+    numPostedReads += iter.second.size();
+  }
+  oss << "  queues: " << readDescriptorCallbacks_.size()
+      << " readDescriptor callbacks, " << numPostedReads << " posted reads, "
+      << numOutstandingWrites_ << " outstanding writes ("
+      << numOutstandingWriteBytes_ << " bytes), "
+      << numWritesByState[WriteOperation::UNINITIALIZED]
+      << " writes not admitted yet, " << coalescedBuffers_.size()
+      << " coalesced frames (" << numCoalescedBytes_ << " bytes), "
+      << writeCapacityCallbacks_.size() << " write capacity callbacks\n";
+
+  for (const auto& iter : channelBytesBeingSent) {
+    oss << "  channel " << iter.first << ": sending " << iter.second
+        << " bytes\n";
+  }
+  for (const auto& iter : channelBytesBeingReceived) {
+    oss << "  channel " << iter.first << ": receiving " << iter.second
+        << " bytes\n";
+  }
+  return oss.str();
+}
+
 //
 // Helpers to schedule our callbacks into user code
 //
 
+void Pipe::Impl::invokeUserCallback_(
+    Function<void(const Error&, Message)> fn,
+    Message message) {
+  invokeUserCallback_(std::move(fn), std::move(message), error_);
+}
+
+void Pipe::Impl::invokeUserCallback_(
+    Function<void(const Error&, Message)> fn,
+    Message message,
+    const Error& error) {
+  const ContextOptions::executor_fn& executor =
+      settings_.callbackExecutor;
+  if (executor) {
+    executor([fn{std::move(fn)},
+              error{error},
+              message{std::move(message)}]() mutable {
+      fn(error, std::move(message));
+    });
+  } else {
+    fn(error, std::move(message));
+  }
+}
+
 void Pipe::Impl::callReadDescriptorCallback_(ReadOperation& op) {
   TP_DCHECK(loop_.inLoop());
   // Don't check state_ == ESTABLISHED: it can be called after failed handshake
@@ -931,9 +2910,63 @@ void Pipe::Impl::callReadDescriptorCallback_(ReadOperation& op) {
   TP_DCHECK_EQ(op.sequenceNumber, nextMessageAskingForAllocation_);
   ++nextMessageAskingForAllocation_;
 
-  op.readDescriptorCallback(error_, std::move(op.message));
-  // Reset callback to release the resources it was holding.
-  op.readDescriptorCallback = nullptr;
+  // The user callbacks are stored as they are given to us, rather than wrapped
+  // in another std::function (which would cost an allocation), hence we do
+  // their bookkeeping here.
+  TP_DCHECK_EQ(op.sequenceNumber, nextReadDescriptorCallbackToCall_++);
+  if (op.isHiddenFromUser) {
+    TP_VLOG(1) << "Pipe " << id_ << " is skipping the readDescriptor callback"
+               << " of a message matched to a posted read (#"
+               << op.sequenceNumber << ")";
+  } else if (!op.isMultishot && readDescriptorCallbacks_.empty()) {
+    // An operation started for a posted read that the pipe is flushing, and
+    // that the user thus never gets to see.
+    TP_DCHECK(error_);
+    op.isHiddenFromUser = true;
+    op.doneGettingAllocation = true;
+  } else {
+    TP_VLOG(1) << "Pipe " << id_ << " is calling a readDescriptor callback (#"
+               << op.sequenceNumber << ")";
+    // If the buffers were allocated by the pipe we'll still need them to read
+    // the payloads and receive the tensors, hence we must hold on to the
+    // message.
+    Message message =
+        op.allocatedByPipe ? copyMessage(op.message) : std::move(op.message);
+    trace::Span span(
+        "read_descriptor_callback",
+        trace::isEnabled() ? getTraceScope_() : 0,
+        op.sequenceNumber);
+    if (op.isMultishot) {
+      invokeUserCallback_(
+          [fn{multishotReadDescriptorCallback_}](
+              const Error& error, Message message) {
+            (*fn)(error, std::move(message));
+          },
+          std::move(message));
+    } else {
+      read_descriptor_callback_fn fn =
+          std::move(readDescriptorCallbacks_.front());
+      readDescriptorCallbacks_.pop_front();
+      invokeUserCallback_(std::move(fn), std::move(message));
+    }
+    TP_VLOG(1) << "Pipe " << id_
+               << " done calling a readDescriptor callback (#"
+               << op.sequenceNumber << ")";
+  }
+
+  if (op.isMultishot) {
+    --numMultishotReadOperationsPending_;
+    if (!error_) {
+      // Start the replacement right away, rather than on a later iteration of
+      // the loop, so that the connection never idles between messages: it
+      // can't overtake this operation, hence it reads the next descriptor as
+      // soon as this one has queued the reads of its payloads (which, if the
+      // buffers came from the allocator, happens later in this same advance).
+      startMultishotReadOperation_();
+    } else if (numMultishotReadOperationsPending_ == 0) {
+      multishotReadDescriptorCallback_ = nullptr;
+    }
+  }
 }
 
 void Pipe::Impl::callReadCallback_(ReadOperation& op) {
@@ -944,8 +2977,50 @@ void Pipe::Impl::callReadCallback_(ReadOperation& op) {
       op.state == ReadOperation::ASKING_FOR_ALLOCATION ||
       op.state == ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS);
   op.state = ReadOperation::FINISHED;
+  if (op.allocatedByPipe) {
+    context_->releaseAllocatorBytes(op.numAllocatorBytes);
+  }
+  restoreSegmentedTensorsOfMessage(op, /*copyData=*/!error_);
+  if (!error_) {
+    fillInDuplicatesOfMessage(op);
+  }
 
-  op.readCallback(error_, std::move(op.message));
+  if (!settings_.outOfOrderCompletion) {
+    TP_DCHECK_EQ(op.sequenceNumber, nextReadCallbackToCall_);
+  }
+  ++nextReadCallbackToCall_;
+  size_t numBytes = 0;
+  for (const auto& payload : op.payloads) {
+    numBytes += payload.length;
+  }
+  for (const auto& tensor : op.tensors) {
+    numBytes += tensor.length;
+  }
+  TP_PROBE(
+      pipe_read_complete,
+      id_.c_str(),
+      op.sequenceNumber,
+      numBytes,
+      static_cast<bool>(error_));
+  if (!error_) {
+    counters_->numMessagesRead.fetch_add(1, std::memory_order_relaxed);
+    counters_->numBytesRead.fetch_add(numBytes, std::memory_order_relaxed);
+    counters_->readLatency.record(
+        std::chrono::steady_clock::now() - op.descriptorReadAt);
+  }
+  TP_VLOG(1) << "Pipe " << id_ << " is calling a read callback (#"
+             << op.sequenceNumber << ")";
+  {
+    trace::Span span(
+        "read_callback",
+        trace::isEnabled() ? getTraceScope_() : 0,
+        op.sequenceNumber);
+    if (op.readCallback) {
+      invokeUserCallback_(std::move(op.readCallback), std::move(op.message));
+    }
+  }
+  TP_VLOG(1) << "Pipe " << id_ << " done calling a read callback (#"
+             << op.sequenceNumber << ")";
   // Reset callback to release the resources it was holding.
   op.readCallback = nullptr;
 }
@@ -956,15 +3031,95 @@ void Pipe::Impl::callWriteCallback_(WriteOperation& op) {
 
   TP_DCHECK(
       op.state == WriteOperation::UNINITIALIZED ||
+      op.state == WriteOperation::ADMITTED ||
       op.state == WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS ||
       op.state == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
   op.state = WriteOperation::FINISHED;
+  releaseCapacityOfWrite_(op);
 
-  op.writeCallback(error_, std::move(op.message));
+  if (!settings_.outOfOrderCompletion) {
+    TP_DCHECK_EQ(op.sequenceNumber, nextWriteCallbackToCall_);
+  }
+  ++nextWriteCallbackToCall_;
+  TP_PROBE(
+      pipe_write_complete,
+      id_.c_str(),
+      op.sequenceNumber,
+      op.numBytes,
+      static_cast<bool>(error_));
+  if (!error_) {
+    counters_->numMessagesWritten.fetch_add(1, std::memory_order_relaxed);
+    counters_->numBytesWritten.fetch_add(
+        op.numBytes, std::memory_order_relaxed);
+  }
+  TP_VLOG(1) << "Pipe " << id_ << " is calling a write callback (#"
+             << op.sequenceNumber << ")";
+  {
+    trace::Span span(
+        "write_callback",
+        trace::isEnabled() ? getTraceScope_() : 0,
+        op.sequenceNumber);
+    invokeUserCallback_(std::move(op.writeCallback), std::move(op.message));
+  }
+  TP_VLOG(1) << "Pipe " << id_ << " done calling a write callback (#"
+             << op.sequenceNumber << ")";
   // Reset callback to release the resources it was holding.
   op.writeCallback = nullptr;
 }
 
+void Pipe::Impl::callWriteCapacityCallbacksIfReady_() {
+  TP_DCHECK(loop_.inLoop());
+  if (writeCapacityCallbacks_.empty()) {
+    return;
+  }
+  if (!error_) {
+    const size_t maxWrites = settings_.maxOutstandingWritesPerPipe;
+    const size_t maxBytes = settings_.maxOutstandingWriteBytesPerPipe;
+    const WriteOperation* nextOpPtr = findWriteOperation(nextWriteToAdmit_);
+    if ((nextOpPtr != nullptr &&
+         nextOpPtr->state == WriteOperation::UNINITIALIZED) ||
+        (maxWrites > 0 && numOutstandingWrites_ >= maxWrites) ||
+        (maxBytes > 0 && numOutstandingWriteBytes_ >= maxBytes)) {
+      return;
+    }
+  }
+
+  std::vector<write_capacity_callback_fn> callbacks;
+  std::swap(callbacks, writeCapacityCallbacks_);
+  TP_VLOG(1) << "Pipe " << id_ << " is calling " << callbacks.size()
+             << " write capacity callbacks";
+  const ContextOptions::executor_fn& executor =
+      settings_.callbackExecutor;
+  for (auto& fn : callbacks) {
+    if (executor) {
+      executor([fn{std::move(fn)}, error{error_}]() { fn(error); });
+    } else {
+      fn(error_);
+    }
+  }
+}
+
+void Pipe::Impl::callEstablishmentCallbacksIfReady_() {
+  TP_DCHECK(loop_.inLoop());
+  if (establishmentCallbacks_.empty() || (!error_ && state_ != ESTABLISHED)) {
+    return;
+  }
+
+  std::vector<establishment_callback_fn> callbacks;
+  std::swap(callbacks, establishmentCallbacks_);
+  TP_VLOG(1) << "Pipe " << id_ << " is calling " << callbacks.size()
+             << " establishment callbacks";
+  const ContextOptions::executor_fn& executor =
+      settings_.callbackExecutor;
+  for (auto& fn : callbacks) {
+    if (executor) {
+      executor([fn{std::move(fn)}, error{error_}]() { fn(error); });
+    } else {
+      fn(error_);
+    }
+  }
+}
+
 //
 // Error handling
 //
@@ -980,11 +3135,30 @@ void Pipe::Impl::setError_(Error error) {
   handleError_();
 }
 
+void Pipe::Impl::failReadOperation_(ReadOperation& op, Error error) {
+  TP_DCHECK(loop_.inLoop());
+  const int64_t sequenceNumber = op.sequenceNumber;
+  // This advances the operations, unless the error was already set, and thus
+  // the operation must be looked up again, in case it's gone.
+  setError_(std::move(error));
+  ReadOperation* opPtr = findReadOperation(sequenceNumber);
+  if (opPtr != nullptr) {
+    advanceReadOperation_(*opPtr);
+  }
+}
+
 void Pipe::Impl::handleError_() {
   TP_DCHECK(loop_.inLoop());
   TP_VLOG(2) << "Pipe " << id_ << " is handling error " << error_.what();
 
   connection_->close();
+  // While the pipe upgrades its transport, it has some more connections.
+  for (const auto& connection :
+       {readConnection_, upgradedConnection_, previousConnection_}) {
+    if (connection != nullptr) {
+      connection->close();
+    }
+  }
   forEachDeviceType([&](auto buffer) {
     for (auto& channelIter : channels_.get<decltype(buffer)>()) {
       channelIter.second->close();
@@ -1000,14 +3174,32 @@ void Pipe::Impl::handleError_() {
       listener_->unregisterConnectionRequest(iter.second);
     }
     channelRegistrationIds_.get<decltype(buffer)>().clear();
+    for (const auto& iter : speculativeChannelTags_.get<decltype(buffer)>()) {
+      listener_->unregisterSpeculativeConnection(iter.second);
+    }
+    speculativeChannelTags_.get<decltype(buffer)>().clear();
+    for (const auto& iter : speculativeConnections_.get<decltype(buffer)>()) {
+      iter.second->close();
+    }
+    speculativeConnections_.get<decltype(buffer)>().clear();
   });
 
+  for (auto& postedReadsIter : postedReads_) {
+    for (PostedRead& postedRead : postedReadsIter.second) {
+      invokeUserCallback_(
+          std::move(postedRead.callback), std::move(postedRead.message));
+    }
+  }
+  postedReads_.clear();
+
   if (!readOperations_.empty()) {
     advanceReadOperation_(readOperations_.front());
   }
   if (!writeOperations_.empty()) {
     advanceWriteOperation_(writeOperations_.front());
   }
+  callWriteCapacityCallbacksIfReady_();
+  callEstablishmentCallbacksIfReady_();
 }
 
 //
@@ -1018,6 +3210,15 @@ void Pipe::Impl::startReadingUponEstablishingPipe_() {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
+  if (trace::isEnabled()) {
+    trace::recordSpan(
+        "handshake",
+        getTraceScope_(),
+        /*sequenceNumber=*/-1,
+        createdAt_,
+        std::chrono::steady_clock::now());
+  }
+
   if (!readOperations_.empty()) {
     advanceReadOperation_(readOperations_.front());
   }
@@ -1054,18 +3255,38 @@ bool Pipe::Impl::advanceOneReadOperation_(ReadOperation& op) {
   const ReadOperation* prevOpPtr = findReadOperation(op.sequenceNumber - 1);
   const ReadOperation::State prevOpState =
       prevOpPtr != nullptr ? prevOpPtr->state : ReadOperation::FINISHED;
+  // Unless completing out of order is allowed, in which case an operation can
+  // finish ahead of the previous ones.
+  const bool canOvertakeToFinish = settings_.outOfOrderCompletion;
 
   // Use this helper to force a very specific structure on our checks, as
   // otherwise we'll be tempted to start merging `if`s, using `else`s, etc.
   // which seem good ideas but hide nasty pitfalls.
-  auto attemptTransition = [this, &op, prevOpState](
+  auto attemptTransition = [this, &op, prevOpState, canOvertakeToFinish](
                                ReadOperation::State from,
                                ReadOperation::State to,
                                bool cond,
                                void (Impl::*action)(ReadOperation&)) {
-    if (op.state == from && cond && to <= prevOpState) {
+    if (op.state == from && cond &&
+        (to <= prevOpState ||
+         (to == ReadOperation::FINISHED && canOvertakeToFinish))) {
       (this->*action)(op);
       TP_DCHECK_EQ(op.state, to);
+      auto now = std::chrono::steady_clock::now();
+      counters_->readStageNanoseconds[from].fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now - op.stateEnteredAt)
+              .count(),
+          std::memory_order_relaxed);
+      if (trace::isEnabled()) {
+        trace::recordSpan(
+            kReadStageTraceNames[from],
+            getTraceScope_(),
+            op.sequenceNumber,
+            op.stateEnteredAt,
+            now);
+      }
+      op.stateEnteredAt = now;
     }
   };
 
@@ -1095,10 +3316,15 @@ bool Pipe::Impl::advanceOneReadOperation_(ReadOperation& op) {
           prevOpState >= ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS,
       /*action=*/&Impl::readDescriptorOfMessage_);
 
+  // A message that wasn't matched to a posted read waits for a callback of
+  // readDescriptor to be handed to.
   attemptTransition(
       /*from=*/ReadOperation::READING_DESCRIPTOR,
       /*to=*/ReadOperation::ASKING_FOR_ALLOCATION,
-      /*cond=*/error_ || op.doneReadingDescriptor,
+      /*cond=*/error_ ||
+          (op.doneReadingDescriptor &&
+           (op.isHiddenFromUser || op.isMultishot ||
+            !readDescriptorCallbacks_.empty())),
       /*action=*/&Impl::callReadDescriptorCallback_);
 
   attemptTransition(
@@ -1110,21 +3336,27 @@ bool Pipe::Impl::advanceOneReadOperation_(ReadOperation& op) {
   attemptTransition(
       /*from=*/ReadOperation::ASKING_FOR_ALLOCATION,
       /*to=*/ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS,
-      /*cond=*/!error_ && op.doneGettingAllocation,
+      /*cond=*/!error_ && (op.doneGettingAllocation || op.allocatedByPipe),
       /*action=*/&Impl::readPayloadsAndReceiveTensorsOfMessage);
 
   attemptTransition(
       /*from=*/ReadOperation::READING_PAYLOADS_AND_RECEIVING_TENSORS,
       /*to=*/ReadOperation::FINISHED,
-      /*cond=*/op.numPayloadsBeingRead == 0 && op.numTensorsBeingReceived == 0,
+      /*cond=*/op.doneGettingAllocation && op.numPayloadsBeingRead == 0 &&
+          op.numTensorsBeingReceived == 0,
       /*action=*/&Impl::callReadCallback_);
 
   // Compute return value now in case we next delete the operation.
   bool hasAdvanced = op.state != initialState;
 
+  // Operations that finished out of order stay in the queue, so that the others
+  // can still be found by their sequence number, until the ones before them are
+  // done too.
   if (op.state == ReadOperation::FINISHED) {
-    TP_DCHECK_EQ(readOperations_.front().sequenceNumber, op.sequenceNumber);
-    readOperations_.pop_front();
+    while (!readOperations_.empty() &&
+           readOperations_.front().state == ReadOperation::FINISHED) {
+      readOperations_.pop_front();
+    }
   }
 
   return hasAdvanced;
@@ -1140,6 +3372,20 @@ void Pipe::Impl::advanceWriteOperation_(WriteOperation& initialOp) {
       break;
     }
   }
+
+  // Completing an operation may have given back the capacity that the next one
+  // to be admitted was waiting for, which may not have been reached above.
+  advanceWriteOperationsAwaitingAdmission_();
+}
+
+void Pipe::Impl::advanceWriteOperationsAwaitingAdmission_() {
+  for (int64_t sequenceNumber = nextWriteToAdmit_;; ++sequenceNumber) {
+    WriteOperation* opPtr = findWriteOperation(sequenceNumber);
+    if (opPtr == nullptr || !advanceOneWriteOperation_(*opPtr)) {
+      break;
+    }
+  }
+  callWriteCapacityCallbacksIfReady_();
 }
 
 bool Pipe::Impl::advanceOneWriteOperation_(WriteOperation& op) {
@@ -1152,18 +3398,43 @@ bool Pipe::Impl::advanceOneWriteOperation_(WriteOperation& op) {
   const WriteOperation* prevOpPtr = findWriteOperation(op.sequenceNumber - 1);
   const WriteOperation::State prevOpState =
       prevOpPtr != nullptr ? prevOpPtr->state : WriteOperation::FINISHED;
+  // Unless completing out of order is allowed, in which case an operation can
+  // finish ahead of the previous ones.
+  const bool canOvertakeToFinish = settings_.outOfOrderCompletion;
+  // The previous operation may have written its descriptor but not yet the ones
+  // of its tensors, which must still come before this operation's descriptor.
+  const bool prevOpIsWritingTensorDescriptors = prevOpPtr != nullptr &&
+      prevOpPtr->channelDescriptorsFollow &&
+      prevOpPtr->nextTensorDescriptorToWrite < prevOpPtr->tensors.size();
 
   // Use this helper to force a very specific structure on our checks, as
   // otherwise we'll be tempted to start merging `if`s, using `else`s, etc.
   // which seem good ideas but hide nasty pitfalls.
-  auto attemptTransition = [this, &op, prevOpState](
+  auto attemptTransition = [this, &op, prevOpState, canOvertakeToFinish](
                                WriteOperation::State from,
                                WriteOperation::State to,
                                bool cond,
                                void (Impl::*action)(WriteOperation&)) {
-    if (op.state == from && cond && to <= prevOpState) {
+    if (op.state == from && cond &&
+        (to <= prevOpState ||
+         (to == WriteOperation::FINISHED && canOvertakeToFinish))) {
       (this->*action)(op);
       TP_DCHECK_EQ(op.state, to);
+      auto now = std::chrono::steady_clock::now();
+      counters_->writeStageNanoseconds[from].fetch_add(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              now - op.stateEnteredAt)
+              .count(),
+          std::memory_order_relaxed);
+      if (trace::isEnabled()) {
+        trace::recordSpan(
+            kWriteStageTraceNames[from],
+            getTraceScope_(),
+            op.sequenceNumber,
+            op.stateEnteredAt,
+            now);
+      }
+      op.stateEnteredAt = now;
     }
   };
 
@@ -1174,6 +3445,18 @@ bool Pipe::Impl::advanceOneWriteOperation_(WriteOperation& op) {
   // the state at the end.
   const WriteOperation::State initialState = op.state;
 
+  // Reserving capacity has side effects, hence it can't be the condition of a
+  // transition, as those are evaluated even when the transition isn't done.
+  // The same goes for picking which write gets admitted next, which may also
+  // drop this one, and leave nothing to advance.
+  if (op.state == WriteOperation::UNINITIALIZED && !error_ &&
+      !op.hasReservedCapacity && prevOpState >= WriteOperation::ADMITTED) {
+    if (!scheduleNextWriteToAdmit_(op)) {
+      return false;
+    }
+    op.hasReservedCapacity = reserveCapacityForWrite_(op);
+  }
+
   // We use a series of independent checks to advance the state, rather than a
   // switch block, because we want an operation that performs one transition to
   // be considered right away for a subsequent transition. This is needed, for
@@ -1188,6 +3471,18 @@ bool Pipe::Impl::advanceOneWriteOperation_(WriteOperation& op) {
 
   attemptTransition(
       /*from=*/WriteOperation::UNINITIALIZED,
+      /*to=*/WriteOperation::ADMITTED,
+      /*cond=*/!error_ && op.hasReservedCapacity,
+      /*action=*/&Impl::admitWrite_);
+
+  attemptTransition(
+      /*from=*/WriteOperation::ADMITTED,
+      /*to=*/WriteOperation::FINISHED,
+      /*cond=*/error_,
+      /*action=*/&Impl::callWriteCallback_);
+
+  attemptTransition(
+      /*from=*/WriteOperation::ADMITTED,
       /*to=*/WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
       /*cond=*/!error_ && state_ == ESTABLISHED,
       /*action=*/&Impl::sendTensorsOfMessage_);
@@ -1202,146 +3497,842 @@ bool Pipe::Impl::advanceOneWriteOperation_(WriteOperation& op) {
   attemptTransition(
       /*from=*/WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS,
       /*to=*/WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS,
-      /*cond=*/!error_ && op.numTensorDescriptorsBeingCollected == 0,
+      /*cond=*/!error_ &&
+          (op.numTensorDescriptorsBeingCollected == 0 ||
+           op.channelDescriptorsFollow) &&
+          !prevOpIsWritingTensorDescriptors,
       /*action=*/&Impl::writeDescriptorAndPayloadsOfMessage_);
 
   attemptTransition(
       /*from=*/WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS,
       /*to=*/WriteOperation::FINISHED,
-      /*cond=*/op.numPayloadsBeingWritten == 0 && op.numTensorsBeingSent == 0,
+      /*cond=*/op.numPayloadsBeingWritten == 0 &&
+          op.numTensorDescriptorsBeingCollected == 0 &&
+          op.numTensorsBeingSent == 0,
       /*action=*/&Impl::callWriteCallback_);
 
   // Compute return value now in case we next delete the operation.
   bool hasAdvanced = op.state != initialState;
 
+  // Operations that finished out of order stay in the queue, so that the others
+  // can still be found by their sequence number, until the ones before them are
+  // done too.
   if (op.state == WriteOperation::FINISHED) {
-    TP_DCHECK_EQ(writeOperations_.front().sequenceNumber, op.sequenceNumber);
-    writeOperations_.pop_front();
+    while (!writeOperations_.empty() &&
+           writeOperations_.front().state == WriteOperation::FINISHED) {
+      writeOperations_.pop_front();
+    }
+  }
+
+  return hasAdvanced;
+}
+
+void Pipe::Impl::readDescriptorOfMessage_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  TP_DCHECK_EQ(op.state, ReadOperation::UNINITIALIZED);
+  op.state = ReadOperation::READING_DESCRIPTOR;
+
+  TP_VLOG(2) << "Pipe " << id_ << " is reading descriptor of message #"
+             << op.sequenceNumber;
+
+  TP_DCHECK_EQ(connectionState_, AWAITING_DESCRIPTOR);
+  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
+  readDescriptorFromConnection_(op);
+  connectionState_ = AWAITING_PAYLOADS;
+}
+
+void Pipe::Impl::readDescriptorFromConnection_(ReadOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(3) << "Pipe " << id_ << " is reading nop object (message descriptor #"
+             << op.sequenceNumber << ")";
+  readConnection_->read(
+      nopHolderForDescriptors_, lazyCallbackWrapper_([&op](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done reading nop object (message descriptor #"
+                   << op.sequenceNumber << ")";
+        Packet& nopPacketIn = impl.nopHolderForDescriptors_.getObject();
+        // The peer moved to the upgraded connection, on which the descriptor
+        // will come instead.
+        if (nopPacketIn.index() == nopPacketIn.index_of<TransportUpgrade>()) {
+          impl.onReadOfTransportUpgrade_();
+          impl.readDescriptorFromConnection_(op);
+          return;
+        }
+        impl.onReadOfMessageDescriptor_(op, nopPacketIn);
+      }));
+}
+
+bool Pipe::Impl::reserveCapacityForWrite_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  // A write that on its own exceeds a limit must be let through at some point,
+  // hence do so when it's alone.
+  const size_t maxWrites = settings_.maxOutstandingWritesPerPipe;
+  const size_t maxBytes = settings_.maxOutstandingWriteBytesPerPipe;
+  if (numOutstandingWrites_ > 0 &&
+      ((maxWrites > 0 && numOutstandingWrites_ + 1 > maxWrites) ||
+       (maxBytes > 0 && numOutstandingWriteBytes_ + op.numBytes > maxBytes))) {
+    return false;
+  }
+
+  // While the context holds too much memory, slow down every pipe, but don't
+  // stall any, as a write that's alone goes through.
+  if (numOutstandingWrites_ > 0 && context_->isOverMemorySoftLimit()) {
+    return false;
+  }
+
+  // This must come before reserving the bytes of the context, as we can't give
+  // those back without waking up the other pipes.
+  if (!hasWriteRateFor_(op)) {
+    return false;
+  }
+
+  if (settings_.maxOutstandingWriteBytes > 0 &&
+      !reserveContextWriteBytes_(op)) {
+    return false;
+  }
+
+  writeRateLimiter_.take(op.numBytes);
+  if (!isExemptFromContextWriteRateLimit_) {
+    context_->getWriteRateLimiter().take(op.numBytes);
+  }
+
+  numOutstandingWrites_++;
+  numOutstandingWriteBytes_ += op.numBytes;
+  return true;
+}
+
+bool Pipe::Impl::reserveContextWriteBytes_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  if (isWaitingForContextWriteBytes_) {
+    return false;
+  }
+  // The context may invoke the callback from any thread, and after the pipe is
+  // gone, hence it must come back to our loop and not keep us alive.
+  std::weak_ptr<Impl> weakImpl = shared_from_this();
+  if (!context_->reserveWriteBytes(op.numBytes, [weakImpl]() {
+        std::shared_ptr<Impl> impl = weakImpl.lock();
+        if (impl == nullptr) {
+          return;
+        }
+        impl->loop_.deferToLoop([impl]() {
+          impl->isWaitingForContextWriteBytes_ = false;
+          impl->advanceWriteOperationsAwaitingAdmission_();
+        });
+      })) {
+    TP_VLOG(2) << "Pipe " << id_ << " is waiting for the context to have "
+               << op.numBytes << " bytes available for message #"
+               << op.sequenceNumber;
+    isWaitingForContextWriteBytes_ = true;
+    return false;
+  }
+  return true;
+}
+
+bool Pipe::Impl::hasWriteRateFor_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TokenBucket::clock::duration delay = writeRateLimiter_.getDelay(op.numBytes);
+  if (!isExemptFromContextWriteRateLimit_) {
+    delay = std::max(
+        delay, context_->getWriteRateLimiter().getDelay(op.numBytes));
+  }
+  if (delay == TokenBucket::clock::duration::zero()) {
+    return true;
+  }
+  if (!isWaitingForWriteRate_) {
+    TP_VLOG(2) << "Pipe " << id_ << " is waiting for the rate limit to allow "
+               << op.numBytes << " bytes for message #" << op.sequenceNumber;
+    isWaitingForWriteRate_ = true;
+    // As above, the callback must come back to our loop and not keep us alive.
+    std::weak_ptr<Impl> weakImpl = shared_from_this();
+    context_->waitForWriteRate(delay, [weakImpl]() {
+      std::shared_ptr<Impl> impl = weakImpl.lock();
+      if (impl == nullptr) {
+        return;
+      }
+      impl->loop_.deferToLoop([impl]() {
+        impl->isWaitingForWriteRate_ = false;
+        impl->advanceWriteOperationsAwaitingAdmission_();
+      });
+    });
+  }
+  return false;
+}
+
+void Pipe::Impl::releaseCapacityOfWrite_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  if (!op.hasReservedCapacity) {
+    return;
+  }
+  op.hasReservedCapacity = false;
+  numOutstandingWrites_--;
+  numOutstandingWriteBytes_ -= op.numBytes;
+  context_->releaseWriteBytes(op.numBytes);
+}
+
+void Pipe::Impl::admitWrite_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(op.state, WriteOperation::UNINITIALIZED);
+  op.state = WriteOperation::ADMITTED;
+  nextWriteToAdmit_ = op.sequenceNumber + 1;
+  if (op.deadline != std::chrono::steady_clock::time_point::max()) {
+    numQueuedWritesWithDeadline_--;
+  }
+  // Only now are the sequence number and the order of the write final, as the
+  // ones waiting for admission may still be reordered or dropped.
+  TP_PROBE(pipe_write_enqueue, id_.c_str(), op.sequenceNumber, op.numBytes);
+  if (TrafficRecorder* recorder = settings_.trafficRecorder) {
+    recorder->recordWrite(trafficPipeIdx_, op.message, op.priorityClass);
+  }
+}
+
+bool Pipe::Impl::scheduleNextWriteToAdmit_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(op.sequenceNumber, nextWriteToAdmit_);
+  if (numQueuedWritesWithDeadline_ == 0) {
+    return true;
+  }
+
+  // The writes that weren't admitted haven't sent anything yet, and the remote
+  // side tells messages apart by the order in which they arrive, hence the
+  // expired ones can be taken out of the queue, with the following ones moving
+  // up to keep the sequence numbers contiguous.
+  const auto now = std::chrono::steady_clock::now();
+  const size_t firstIdx =
+      op.sequenceNumber - writeOperations_.front().sequenceNumber;
+  size_t nextIdx = firstIdx;
+  std::vector<std::pair<write_callback_fn, Message>> expiredWrites;
+  for (size_t idx = firstIdx; idx < writeOperations_.size(); idx++) {
+    WriteOperation& queuedOp = writeOperations_[idx];
+    TP_DCHECK_EQ(queuedOp.state, WriteOperation::UNINITIALIZED);
+    if (queuedOp.deadline <= now) {
+      numQueuedWritesWithDeadline_--;
+      expiredWrites.emplace_back(
+          std::move(queuedOp.writeCallback), std::move(queuedOp.message));
+      continue;
+    }
+    if (idx != nextIdx) {
+      moveWriteRequest(writeOperations_[nextIdx], queuedOp);
+    }
+    nextIdx++;
+  }
+  while (writeOperations_.size() > nextIdx) {
+    writeOperations_.pop_back();
+    nextMessageBeingWritten_--;
+  }
+
+  // Among the remaining ones, the earliest deadline goes first, and the others
+  // keep their order.
+  size_t earliestIdx = firstIdx;
+  for (size_t idx = firstIdx + 1; idx < nextIdx; idx++) {
+    if (writeOperations_[idx].deadline <
+        writeOperations_[earliestIdx].deadline) {
+      earliestIdx = idx;
+    }
+  }
+  if (earliestIdx != firstIdx) {
+    WriteOperation earliestOp;
+    moveWriteRequest(earliestOp, writeOperations_[earliestIdx]);
+    for (size_t idx = earliestIdx; idx > firstIdx; idx--) {
+      moveWriteRequest(writeOperations_[idx], writeOperations_[idx - 1]);
+    }
+    moveWriteRequest(writeOperations_[firstIdx], earliestOp);
+  }
+
+  for (auto& expiredWrite : expiredWrites) {
+    TP_VLOG(1) << "Pipe " << id_
+               << " is calling the write callback of an expired write";
+    invokeUserCallback_(
+        std::move(expiredWrite.first),
+        std::move(expiredWrite.second),
+        TP_CREATE_ERROR(WriteDeadlineExceededError));
+  }
+
+  return nextIdx > firstIdx;
+}
+
+void Pipe::Impl::sendTensorsOfMessage_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  TP_DCHECK_EQ(op.state, WriteOperation::ADMITTED);
+  op.state = WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS;
+
+  TP_VLOG(2) << "Pipe " << id_ << " is sending tensors of message #"
+             << op.sequenceNumber;
+
+  // Buffers are identified by their address and length, and each one maps to
+  // the first payload, or CPU tensor, that has it.
+  const bool deduplicateBuffers = settings_.deduplicateBuffers &&
+      !op.message.templateId.has_value();
+  std::map<std::pair<const void*, size_t>, int64_t> firstOfBuffer;
+  op.payloads.resize(op.message.payloads.size());
+  if (deduplicateBuffers) {
+    for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+         payloadIdx++) {
+      const Message::Payload& payload = op.message.payloads[payloadIdx];
+      if (payload.length == 0) {
+        continue;
+      }
+      auto iter = firstOfBuffer.emplace(
+          std::make_pair(payload.data, payload.length), payloadIdx);
+      if (!iter.second) {
+        op.payloads[payloadIdx].duplicateOf = iter.first->second;
+      }
+    }
+    firstOfBuffer.clear();
+  }
+
+  const size_t inlineTensorThreshold = settings_.inlineTensorThreshold;
+  size_t packingThreshold = op.message.templateId.has_value()
+      ? 0
+      : settings_.tensorPackingThreshold;
+  auto isPackable = [&](const Message::Tensor& tensor) {
+    return tensor.buffer.type == DeviceType::kCpu && tensor.channel.empty() &&
+        tensor.buffer.cpu.length > inlineTensorThreshold &&
+        tensor.buffer.cpu.length <= packingThreshold;
+  };
+  // A pack of a single tensor would only add a copy.
+  if (packingThreshold > 0 &&
+      std::count_if(
+          op.message.tensors.begin(), op.message.tensors.end(), isPackable) <
+          2) {
+    packingThreshold = 0;
+  }
+
+  op.channelDescriptorsFollow = settings_.earlyMessageDescriptors;
+  beginBatchOnChannels_();
+  for (int tensorIdx = 0; tensorIdx < op.message.tensors.size(); ++tensorIdx) {
+    auto& tensor = op.message.tensors[tensorIdx];
+
+    if (deduplicateBuffers && tensor.buffer.type == DeviceType::kCpu &&
+        !isSegmented(tensor.buffer.cpu) && tensor.buffer.cpu.length > 0) {
+      auto iter = firstOfBuffer.emplace(
+          std::make_pair(tensor.buffer.cpu.ptr, tensor.buffer.cpu.length),
+          tensorIdx);
+      if (!iter.second) {
+        TP_VLOG(3) << "Pipe " << id_ << " will not send tensor #"
+                   << op.sequenceNumber << "." << tensorIdx
+                   << ", as it's the same as tensor #" << op.sequenceNumber
+                   << "." << iter.first->second;
+        WriteOperation::Tensor t{DeviceType::kCpu};
+        t.duplicateOf = iter.first->second;
+        op.tensors.push_back(std::move(t));
+        tensor.owner.reset();
+        continue;
+      }
+    }
+
+    // Small CPU tensors are written, together with the payloads, later on.
+    if (inlineTensorThreshold > 0 && tensor.buffer.type == DeviceType::kCpu &&
+        !isSegmented(tensor.buffer.cpu) &&
+        tensor.buffer.cpu.length <= inlineTensorThreshold) {
+      TP_VLOG(3) << "Pipe " << id_ << " will send tensor #" << op.sequenceNumber
+                 << "." << tensorIdx << " inline";
+      WriteOperation::Tensor t{DeviceType::kCpu};
+      t.isInline = true;
+      op.tensors.push_back(std::move(t));
+      continue;
+    }
+
+    if (packingThreshold > 0 && isPackable(tensor)) {
+      TP_VLOG(3) << "Pipe " << id_ << " will send tensor #" << op.sequenceNumber
+                 << "." << tensorIdx << " packed";
+      WriteOperation::Tensor t{DeviceType::kCpu};
+      t.isPacked = true;
+      op.tensors.push_back(std::move(t));
+      op.packLength += tensor.buffer.cpu.length;
+      continue;
+    }
+
+    auto t = switchOnDeviceType(tensor.buffer.type, [&](auto buffer) {
+      using TBuffer = decltype(buffer);
+      auto& availableChannels = channels_.get<TBuffer>();
+      const size_t length = unwrap<TBuffer>(tensor.buffer).length;
+      bool isStridedTensor = false;
+#if TENSORPIPE_SUPPORTS_CUDA
+      isStridedTensor = tensor.buffer.type == DeviceType::kCuda &&
+          isStrided(tensor.buffer.cuda);
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      const std::string channelName = selectChannel_<TBuffer>(
+          length, tensor.channel, op.priorityClass, isStridedTensor);
+      const auto startTime = std::chrono::steady_clock::now();
+      auto& channel = *(availableChannels.at(channelName));
+      // The client only connects such a channel once it's told to receive a
+      // tensor over it, hence the descriptor can't wait for the channel's.
+      if (lazyChannels_.get<TBuffer>().count(channelName) > 0) {
+        op.channelDescriptorsFollow = true;
+      }
+
+      TP_VLOG(3) << "Pipe " << id_ << " is sending tensor #"
+                 << op.sequenceNumber << "." << tensorIdx << " (over channel "
+                 << channelName << ")";
+
+      auto descriptorCallback = eagerCallbackWrapper_(
+          [&op, tensorIdx](Impl& impl, channel::TDescriptor descriptor) {
+            TP_VLOG(3) << "Pipe " << impl.id_ << " got tensor descriptor #"
+                       << op.sequenceNumber << "." << tensorIdx;
+            impl.onDescriptorOfTensor_(op, tensorIdx, std::move(descriptor));
+          });
+      auto callback = eagerCallbackWrapper_(
+          [&op, tensorIdx, length, startTime](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_ << " done sending tensor #"
+                       << op.sequenceNumber << "." << tensorIdx;
+            const auto now = std::chrono::steady_clock::now();
+            const auto duration = now - startTime;
+            if (!impl.error_) {
+              impl.counters_->channelSendLatency.record(duration);
+            }
+            if (!impl.error_ && trace::isEnabled()) {
+              trace::recordSpan(
+                  "channel_send",
+                  impl.getTraceScope_(),
+                  op.sequenceNumber,
+                  startTime,
+                  now);
+            }
+            if (!impl.error_ && impl.settings_.channelAutoTuning) {
+              impl.channelRouters_.get<TBuffer>().record(
+                  baseChannelName(op.tensors[tensorIdx].channelName),
+                  length,
+                  duration);
+            }
+            impl.onSendOfTensor_(op);
+          });
+      // A segmented tensor is gathered into a staging buffer if its channel
+      // can't handle segments itself.
+      Buffer bufferToSend = tensor.buffer;
+      std::shared_ptr<void> owner = std::move(tensor.owner);
+      if (tensor.buffer.type == DeviceType::kCpu &&
+          isSegmented(tensor.buffer.cpu) &&
+          !getChannelContext_<TBuffer>(baseChannelName(channelName))
+               ->supportsSegmentedBuffers()) {
+        std::shared_ptr<uint8_t> stagingBuffer =
+            allocateStagingBuffer(counters_->stagingMemory, length);
+        copyFromCpuBuffer(tensor.buffer.cpu, 0, stagingBuffer.get(), length);
+        bufferToSend = CpuBuffer{stagingBuffer.get(), length};
+        owner = std::move(stagingBuffer);
+      }
+      if (owner != nullptr) {
+        channel.sendOwned(
+            unwrap<TBuffer>(bufferToSend),
+            std::move(owner),
+            std::move(descriptorCallback),
+            std::move(callback));
+      } else {
+        channel.send(
+            unwrap<TBuffer>(bufferToSend),
+            std::move(descriptorCallback),
+            std::move(callback));
+      }
+      return WriteOperation::Tensor{tensor.buffer.type, channelName};
+    });
+    op.tensors.push_back(t);
+
+    ++op.numTensorDescriptorsBeingCollected;
+    ++op.numTensorsBeingSent;
+  }
+  if (op.packLength > 0) {
+    sendPackOfMessage_(op);
+  }
+  endBatchOnChannels_();
+}
+
+void Pipe::Impl::sendPackOfMessage_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+
+  // The copies are done right away, hence the tensors could already be reused
+  // by the user, but as for the others they're only released upon completion.
+  const size_t length = op.packLength;
+  std::shared_ptr<uint8_t> packBuffer =
+      allocateStagingBuffer(counters_->stagingMemory, length);
+  size_t offset = 0;
+  for (size_t tensorIdx = 0; tensorIdx < op.tensors.size(); tensorIdx++) {
+    if (op.tensors[tensorIdx].isPacked) {
+      const CpuBuffer& buffer = op.message.tensors[tensorIdx].buffer.cpu;
+      copyFromCpuBuffer(buffer, 0, packBuffer.get() + offset, buffer.length);
+      offset += buffer.length;
+    }
+  }
+  TP_DCHECK_EQ(offset, length);
+
+  const std::string channelName = selectChannel_<CpuBuffer>(
+      length, /*requestedChannel=*/"", op.priorityClass, /*isStrided=*/false);
+  op.pack = WriteOperation::Tensor{DeviceType::kCpu, channelName};
+  auto& channel = *(channels_.get<CpuBuffer>().at(channelName));
+  if (lazyChannels_.get<CpuBuffer>().count(channelName) > 0) {
+    op.channelDescriptorsFollow = true;
+  }
+
+  TP_VLOG(3) << "Pipe " << id_ << " is sending the packed tensors of message #"
+             << op.sequenceNumber << " (over channel " << channelName << ")";
+
+  const auto startTime = std::chrono::steady_clock::now();
+  channel.sendOwned(
+      CpuBuffer{packBuffer.get(), length},
+      packBuffer,
+      eagerCallbackWrapper_(
+          [&op](Impl& impl, channel::TDescriptor descriptor) {
+            TP_VLOG(3) << "Pipe " << impl.id_ << " got pack descriptor #"
+                       << op.sequenceNumber;
+            impl.onDescriptorOfTensor_(op, kPackIdx, std::move(descriptor));
+          }),
+      eagerCallbackWrapper_([&op, length, startTime](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done sending the packed tensors of message #"
+                   << op.sequenceNumber;
+        const auto duration = std::chrono::steady_clock::now() - startTime;
+        if (!impl.error_) {
+          impl.counters_->channelSendLatency.record(duration);
+        }
+        if (!impl.error_ && impl.settings_.channelAutoTuning) {
+          impl.channelRouters_.get<CpuBuffer>().record(
+              baseChannelName(op.pack.channelName), length, duration);
+        }
+        impl.onSendOfTensor_(op);
+      }));
+
+  ++op.numTensorDescriptorsBeingCollected;
+  ++op.numTensorsBeingSent;
+}
+
+void Pipe::Impl::writeDescriptorAndPayloadsOfMessage_(WriteOperation& op) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK_EQ(state_, ESTABLISHED);
+
+  TP_DCHECK_EQ(
+      op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
+  op.state = WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS;
+
+  TP_VLOG(2) << "Pipe " << id_
+             << " is writing descriptor and payloads of message #"
+             << op.sequenceNumber;
+
+  // This is in between two messages, hence the writes may move on to another
+  // connection.
+  switchWritesToUpgradedConnectionIfReady_();
+  lastWriteWithDescriptor_ = op.sequenceNumber;
+
+  std::shared_ptr<PacketHolder> holder;
+  if (op.message.templateId.has_value()) {
+    MessageTemplate& messageTemplate =
+        messageTemplates_[op.message.templateId.value()];
+    if (messageTemplate.isDefinedOnPeer) {
+      holder = makeTemplatedDescriptorForMessage(op, messageTemplate);
+    } else {
+      // The first message of a template defines it on the peer.
+      holder = makeDescriptorForMessage(op);
+      MessageDescriptor& nopMessageDescriptor =
+          *holder->getObject().get<MessageDescriptor>();
+      nopMessageDescriptor.definesTemplate = true;
+      nopMessageDescriptor.templateId = op.message.templateId.value();
+      for (const WriteOperation::Tensor& tensor : op.tensors) {
+        messageTemplate.channelNames.push_back(tensor.channelName);
+      }
+      messageTemplate.isDefinedOnPeer = true;
+    }
+  } else {
+    holder = makeDescriptorForMessage(op);
+  }
+  if (holder->getObject().index() ==
+          holder->getObject().index_of<MessageDescriptor>() &&
+      settings_.descriptorStringInterning) {
+    internStringsOfDescriptor_(*holder->getObject().get<MessageDescriptor>());
+  }
+  holder->setUseCompactLayout(compactMessageDescriptors_);
+
+  // The inline tensors follow the payloads. All of them, together with the
+  // descriptor, are handed to the connection at once, so that it can write them
+  // more efficiently than one by one. They'll still be framed separately, which
+  // allows the receiver to read each one directly into its destination.
+  // If the pipe splits them into chunks, each chunk is a buffer of its own.
+  std::vector<transport::Connection::WriteBuffer> buffers;
+  buffers.reserve(op.message.payloads.size() + op.message.tensors.size());
+  auto appendBuffer = [&](const void* ptr, size_t length) {
+    if (payloadChunkSize_ == 0) {
+      buffers.push_back({ptr, length});
+      return;
+    }
+    for (size_t offset = 0; offset < length; offset += payloadChunkSize_) {
+      buffers.push_back(
+          {reinterpret_cast<const uint8_t*>(ptr) + offset,
+           std::min(payloadChunkSize_, length - offset)});
+    }
+  };
+  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
+       payloadIdx++) {
+    if (op.payloads[payloadIdx].duplicateOf < 0) {
+      const Message::Payload& payload = op.message.payloads[payloadIdx];
+      appendBuffer(payload.data, payload.length);
+    }
+  }
+  for (size_t tensorIdx = 0; tensorIdx < op.message.tensors.size();
+       tensorIdx++) {
+    if (op.tensors[tensorIdx].isInline) {
+      const Message::Tensor& tensor = op.message.tensors[tensorIdx];
+      appendBuffer(tensor.buffer.cpu.ptr, tensor.buffer.cpu.length);
+    }
+  }
+
+  TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (message descriptor #"
+             << op.sequenceNumber << ") and " << buffers.size()
+             << " payloads and inline tensors";
+  if (settings_.writeCoalescingLimit > 0) {
+    coalesceWrite_(op, *holder, std::move(buffers));
+  } else {
+    const auto startTime = std::chrono::steady_clock::now();
+    connection_->writev(
+        *holder,
+        std::move(buffers),
+        eagerCallbackWrapper_([&op, holder, startTime](Impl& impl) {
+          TP_VLOG(3) << "Pipe " << impl.id_
+                     << " done writing nop object (message descriptor #"
+                     << op.sequenceNumber
+                     << ") and payloads and inline tensors";
+          impl.recordTransportWrite_(startTime, op.sequenceNumber);
+          impl.onWriteOfPayload_(op);
+        }));
   }
+  ++op.numPayloadsBeingWritten;
 
-  return hasAdvanced;
+  if (op.channelDescriptorsFollow) {
+    writeTensorDescriptorsOfMessage_(op);
+  }
 }
 
-void Pipe::Impl::readDescriptorOfMessage_(ReadOperation& op) {
+void Pipe::Impl::writeTensorDescriptorsOfMessage_(WriteOperation& op) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
+  TP_DCHECK(op.channelDescriptorsFollow);
+  TP_DCHECK_EQ(op.state, WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
 
-  TP_DCHECK_EQ(op.state, ReadOperation::UNINITIALIZED);
-  op.state = ReadOperation::READING_DESCRIPTOR;
+  // The receiver matches the descriptors to the tensors by their order, hence
+  // one that is ready must wait for the ones of the tensors before it. The one
+  // of the pack, if any, comes first. The index of the pack is kPackIdx.
+  auto writeDescriptor = [&](WriteOperation::Tensor& tensor,
+                             int64_t tensorIdx) {
+    auto holder = std::make_shared<NopHolder<Packet>>();
+    Packet& nopPacketOut = holder->getObject();
+    nopPacketOut.Become(nopPacketOut.index_of<TensorChannelDescriptor>());
+    nopPacketOut.get<TensorChannelDescriptor>()->channelDescriptor =
+        std::move(tensor.descriptor);
+    TP_VLOG(3) << "Pipe " << id_
+               << " is writing nop object (tensor descriptor #"
+               << op.sequenceNumber << "." << tensorIdx << ")";
+    if (settings_.writeCoalescingLimit > 0) {
+      coalesceWrite_(op, *holder, {});
+    } else {
+      const auto startTime = std::chrono::steady_clock::now();
+      connection_->write(
+          *holder,
+          eagerCallbackWrapper_([&op, tensorIdx, holder, startTime](
+                                    Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done writing nop object (tensor descriptor #"
+                       << op.sequenceNumber << "." << tensorIdx << ")";
+            impl.recordTransportWrite_(startTime, op.sequenceNumber);
+            impl.onWriteOfPayload_(op);
+          }));
+    }
+    ++op.numPayloadsBeingWritten;
+  };
 
-  TP_VLOG(2) << "Pipe " << id_ << " is reading descriptor of message #"
-             << op.sequenceNumber;
+  if (op.packLength > 0 && !op.isPackDescriptorWritten) {
+    if (!op.pack.hasDescriptor) {
+      return;
+    }
+    writeDescriptor(op.pack, kPackIdx);
+    op.isPackDescriptorWritten = true;
+  }
+  while (op.nextTensorDescriptorToWrite < op.tensors.size()) {
+    const size_t tensorIdx = op.nextTensorDescriptorToWrite;
+    WriteOperation::Tensor& tensor = op.tensors[tensorIdx];
+    if (!tensor.isInline && !tensor.isPacked && tensor.duplicateOf < 0) {
+      if (!tensor.hasDescriptor) {
+        return;
+      }
+      writeDescriptor(tensor, tensorIdx);
+    }
+    ++op.nextTensorDescriptorToWrite;
+  }
 
-  TP_DCHECK_EQ(connectionState_, AWAITING_DESCRIPTOR);
-  TP_DCHECK_EQ(messageBeingReadFromConnection_, op.sequenceNumber);
-  auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
-  TP_VLOG(3) << "Pipe " << id_ << " is reading nop object (message descriptor #"
-             << op.sequenceNumber << ")";
-  connection_->read(
-      *nopHolderIn, lazyCallbackWrapper_([&op, nopHolderIn](Impl& impl) {
-        TP_VLOG(3) << "Pipe " << impl.id_
-                   << " done reading nop object (message descriptor #"
-                   << op.sequenceNumber << ")";
-        impl.onReadOfMessageDescriptor_(op, nopHolderIn->getObject());
-      }));
-  connectionState_ = AWAITING_PAYLOADS;
+  // The writes may have been waiting for these to move to another connection.
+  switchWritesToUpgradedConnectionIfReady_();
 }
 
-void Pipe::Impl::sendTensorsOfMessage_(WriteOperation& op) {
+void Pipe::Impl::coalesceWrite_(
+    WriteOperation& op,
+    const AbstractNopHolder& object,
+    std::vector<transport::Connection::WriteBuffer> buffers) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
 
-  TP_DCHECK_EQ(op.state, WriteOperation::UNINITIALIZED);
-  op.state = WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS;
-
-  TP_VLOG(2) << "Pipe " << id_ << " is sending tensors of message #"
-             << op.sequenceNumber;
+  // The object must be serialized right away, as the holder won't outlive this
+  // call. The peer reads it back as any other nop object, as it's framed alike.
+  std::unique_ptr<uint8_t[]> buf;
+  size_t len;
+  std::tie(buf, len) = serializeNopObject(object);
+
+  coalescedBuffers_.push_back({buf.get(), len});
+  numCoalescedBytes_ += len;
+  for (const transport::Connection::WriteBuffer& buffer : buffers) {
+    coalescedBuffers_.push_back(buffer);
+    numCoalescedBytes_ += buffer.length;
+  }
+  coalescedObjects_.push_back(std::move(buf));
+  coalescedOps_.push_back(&op);
 
-  for (int tensorIdx = 0; tensorIdx < op.message.tensors.size(); ++tensorIdx) {
-    const auto& tensor = op.message.tensors[tensorIdx];
+  if (numCoalescedWritesInFlight_ == 0 ||
+      numCoalescedBytes_ >= settings_.writeCoalescingLimit) {
+    flushCoalescedWrites_();
+  }
+}
 
-    auto t = switchOnDeviceType(tensor.buffer.type, [&](auto buffer) {
-      auto& orderedChannels = this->getOrderedChannels_<decltype(buffer)>();
-      auto& availableChannels = channels_.get<decltype(buffer)>();
-      for (const auto& channelContextIter : orderedChannels) {
-        const std::string& channelName = std::get<0>(channelContextIter.second);
-        auto channelIter = availableChannels.find(channelName);
-        if (channelIter == availableChannels.cend()) {
-          continue;
-        }
-        auto& channel = *(channelIter->second);
+void Pipe::Impl::flushCoalescedWrites_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(!coalescedOps_.empty());
+
+  TP_VLOG(3) << "Pipe " << id_ << " is writing " << coalescedBuffers_.size()
+             << " buffers of " << coalescedOps_.size() << " writes at once";
+  ++numCoalescedWritesInFlight_;
+  auto objects = std::make_shared<std::vector<std::unique_ptr<uint8_t[]>>>(
+      std::move(coalescedObjects_));
+  const auto startTime = std::chrono::steady_clock::now();
+  connection_->writev(
+      std::move(coalescedBuffers_),
+      eagerCallbackWrapper_(
+          [ops{std::move(coalescedOps_)}, objects, startTime](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_ << " done writing buffers of "
+                       << ops.size() << " writes at once";
+            // The buffers may belong to several messages.
+            impl.recordTransportWrite_(startTime, /*sequenceNumber=*/-1);
+            --impl.numCoalescedWritesInFlight_;
+            // The ones that were held back go before any that these unblock.
+            if (impl.numCoalescedWritesInFlight_ == 0 &&
+                !impl.coalescedOps_.empty()) {
+              impl.flushCoalescedWrites_();
+            }
+            for (WriteOperation* op : ops) {
+              impl.onWriteOfPayload_(*op);
+            }
+          }));
+  coalescedBuffers_.clear();
+  coalescedOps_.clear();
+  coalescedObjects_.clear();
+  numCoalescedBytes_ = 0;
+}
 
-        TP_VLOG(3) << "Pipe " << id_ << " is sending tensor #"
-                   << op.sequenceNumber << "." << tensorIdx;
+void Pipe::Impl::internStringsOfDescriptor_(
+    MessageDescriptor& nopMessageDescriptor) {
+  internString_(
+      nopMessageDescriptor.metadata, nopMessageDescriptor.metadataId);
+  for (auto& nopPayloadDescriptor : nopMessageDescriptor.payloadDescriptors) {
+    internString_(
+        nopPayloadDescriptor.metadata, nopPayloadDescriptor.metadataId);
+  }
+  for (auto& nopTensorDescriptor : nopMessageDescriptor.tensorDescriptors) {
+    internString_(nopTensorDescriptor.metadata, nopTensorDescriptor.metadataId);
+    internString_(
+        nopTensorDescriptor.channelName, nopTensorDescriptor.channelNameId);
+  }
+}
 
-        channel.send(
-            unwrap<decltype(buffer)>(tensor.buffer),
-            eagerCallbackWrapper_(
-                [&op, tensorIdx](Impl& impl, channel::TDescriptor descriptor) {
-                  TP_VLOG(3)
-                      << "Pipe " << impl.id_ << " got tensor descriptor #"
-                      << op.sequenceNumber << "." << tensorIdx;
-                  impl.onDescriptorOfTensor_(
-                      op, tensorIdx, std::move(descriptor));
-                }),
-            eagerCallbackWrapper_([&op, tensorIdx](Impl& impl) {
-              TP_VLOG(3) << "Pipe " << impl.id_ << " done sending tensor #"
-                         << op.sequenceNumber << "." << tensorIdx;
-              impl.onSendOfTensor_(op);
-            }));
-        return WriteOperation::Tensor{tensor.buffer.type, channelName};
-      }
+void Pipe::Impl::internString_(std::string& str, uint64_t& id) {
+  // Strings that are empty or long aren't worth it, and the table is bounded.
+  constexpr size_t kMaxInternedStringLength = 256;
+  constexpr size_t kMaxNumInternedStrings = 4096;
+  TP_DCHECK_EQ(id, 0);
+  if (str.empty() || str.size() > kMaxInternedStringLength) {
+    return;
+  }
+  auto iter = internedStrings_.find(str);
+  if (iter != internedStrings_.end()) {
+    id = iter->second;
+    str.clear();
+    return;
+  }
+  if (internedStrings_.size() < kMaxNumInternedStrings) {
+    // Send the string one last time, for the peer to learn its id.
+    id = internedStrings_.size() + 1;
+    internedStrings_.emplace(str, id);
+  }
+}
 
-      TP_THROW_ASSERT() << "Could not find channel.";
-      return WriteOperation::Tensor{};
-    });
-    op.tensors.push_back(t);
+void Pipe::Impl::resolveStringsOfDescriptor_(
+    MessageDescriptor& nopMessageDescriptor) {
+  resolveString_(
+      nopMessageDescriptor.metadata, nopMessageDescriptor.metadataId);
+  for (auto& nopPayloadDescriptor : nopMessageDescriptor.payloadDescriptors) {
+    resolveString_(
+        nopPayloadDescriptor.metadata, nopPayloadDescriptor.metadataId);
+  }
+  for (auto& nopTensorDescriptor : nopMessageDescriptor.tensorDescriptors) {
+    resolveString_(
+        nopTensorDescriptor.metadata, nopTensorDescriptor.metadataId);
+    resolveString_(
+        nopTensorDescriptor.channelName, nopTensorDescriptor.channelNameId);
+  }
+}
 
-    ++op.numTensorDescriptorsBeingCollected;
-    ++op.numTensorsBeingSent;
+void Pipe::Impl::resolveString_(std::string& str, uint64_t id) {
+  if (id == 0) {
+    return;
   }
+  if (!str.empty()) {
+    TP_THROW_ASSERT_IF(id != remoteInternedStrings_.size() + 1)
+        << "Unexpected id for interned string";
+    remoteInternedStrings_.push_back(str);
+    return;
+  }
+  TP_THROW_ASSERT_IF(id > remoteInternedStrings_.size())
+      << "Unknown id for interned string";
+  str = remoteInternedStrings_[id - 1];
 }
 
-void Pipe::Impl::writeDescriptorAndPayloadsOfMessage_(WriteOperation& op) {
+void Pipe::Impl::openSpeculativeConnections_() {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, ESTABLISHED);
-
-  TP_DCHECK_EQ(
-      op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
-  op.state = WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS;
-
-  TP_VLOG(2) << "Pipe " << id_
-             << " is writing descriptor and payloads of message #"
-             << op.sequenceNumber;
-
-  std::shared_ptr<NopHolder<Packet>> holder = makeDescriptorForMessage(op);
-
-  TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (message descriptor #"
-             << op.sequenceNumber << ")";
-  connection_->write(
-      *holder,
-      lazyCallbackWrapper_(
-          [sequenceNumber{op.sequenceNumber}, holder](Impl& impl) {
-            TP_VLOG(3) << "Pipe " << impl.id_
-                       << " done writing nop object (message descriptor #"
-                       << sequenceNumber << ")";
-          }));
+  TP_DCHECK_NE(speculationToken_, 0);
+  std::shared_ptr<transport::Context> transportContext =
+      context_->getTransport(transport_);
+  forEachDeviceType([&](auto buffer) {
+    for (const auto& channelContextIter :
+         this->getOrderedChannels_<decltype(buffer)>()) {
+      const std::string& channelName = std::get<0>(channelContextIter.second);
+      for (uint64_t priorityClass = 0;
+           priorityClass < settings_.numPriorityClasses;
+           ++priorityClass) {
+        std::string instanceName =
+            channelInstanceName(channelName, priorityClass);
+        TP_VLOG(3) << "Pipe " << id_
+                   << " is opening speculative connection (for channel "
+                   << instanceName << ")";
+        std::shared_ptr<transport::Connection> connection =
+            transportContext->connect(channelAddress_);
+        connection->setId(id_ + ".ch_" + instanceName);
+        registerConnection_(connection);
+
+        auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+        Packet& nopPacketOut = nopHolderOut->getObject();
+        nopPacketOut.Become(nopPacketOut.index_of<SpeculativeConnection>());
+        SpeculativeConnection& nopSpeculativeConnection =
+            *nopPacketOut.get<SpeculativeConnection>();
+        nopSpeculativeConnection.tag =
+            speculativeConnectionTag<decltype(buffer)>(
+                speculationToken_, instanceName);
+        TP_VLOG(3) << "Pipe " << id_
+                   << " is writing nop object (speculative connection)";
+        connection->write(
+            *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
+              TP_VLOG(3) << "Pipe " << impl.id_
+                         << " done writing nop object (speculative connection)";
+            }));
 
-  for (size_t payloadIdx = 0; payloadIdx < op.message.payloads.size();
-       payloadIdx++) {
-    Message::Payload& payload = op.message.payloads[payloadIdx];
-    TP_VLOG(3) << "Pipe " << id_ << " is writing payload #" << op.sequenceNumber
-               << "." << payloadIdx;
-    connection_->write(
-        payload.data,
-        payload.length,
-        eagerCallbackWrapper_([&op, payloadIdx](Impl& impl) {
-          TP_VLOG(3) << "Pipe " << impl.id_ << " done writing payload #"
-                     << op.sequenceNumber << "." << payloadIdx;
-          impl.onWriteOfPayload_(op);
-        }));
-    ++op.numPayloadsBeingWritten;
-  }
+        speculativeConnections_.get<decltype(buffer)>().emplace(
+            std::move(instanceName), std::move(connection));
+      }
+    }
+  });
 }
 
 void Pipe::Impl::onReadWhileServerWaitingForBrochure_(
@@ -1382,14 +4373,34 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure_(
         nopTransportAdvertisementIter->second;
     const std::string& domainDescriptor =
         nopTransportAdvertisement.domainDescriptor;
-    if (domainDescriptor != transportContext.domainDescriptor()) {
+    if (!transportContext.canCommunicateWithRemote(domainDescriptor)) {
       continue;
     }
 
     nopBrochureAnswer.transport = transportName;
     nopBrochureAnswer.address = address;
 
-    if (transportName != transport_) {
+    if (transportName != transport_ && context_->getTransportUpgrade() &&
+        nopBrochure.transportUpgrade) {
+      // Keep using the current connection, while the client connects to this
+      // transport in the background.
+      upgradedTransport_ = transportName;
+      TP_DCHECK(!registrationId_.has_value());
+      TP_VLOG(3) << "Pipe " << id_ << " is requesting connection (as upgrade)";
+      uint64_t token =
+          listener_->registerConnectionRequest(lazyCallbackWrapper_(
+              [](Impl& impl,
+                 std::string transport,
+                 std::shared_ptr<transport::Connection> connection) {
+                TP_VLOG(3) << "Pipe " << impl.id_
+                           << " done requesting connection (as upgrade)";
+                impl.onAcceptOfUpgradedConnection_(
+                    std::move(transport), std::move(connection));
+              }));
+      registrationId_.emplace(token);
+      nopBrochureAnswer.registrationId = token;
+      nopBrochureAnswer.transportUpgrade = true;
+    } else if (transportName != transport_) {
       transport_ = transportName;
       TP_DCHECK(!registrationId_.has_value());
       TP_VLOG(3) << "Pipe " << id_
@@ -1414,6 +4425,31 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure_(
   }
   TP_THROW_ASSERT_IF(!foundATransport);
 
+  const uint64_t numPriorityClasses = std::min<uint64_t>(
+      settings_.numPriorityClasses, nopBrochure.numPriorityClasses);
+
+  // Zero means that the side doesn't ask for chunks, rather than tiny ones.
+  if (context_->getPayloadChunkSize() == 0 ||
+      nopBrochure.payloadChunkSize == 0) {
+    payloadChunkSize_ = std::max<uint64_t>(
+        context_->getPayloadChunkSize(), nopBrochure.payloadChunkSize);
+  } else {
+    payloadChunkSize_ = std::min<uint64_t>(
+        context_->getPayloadChunkSize(), nopBrochure.payloadChunkSize);
+  }
+  nopBrochureAnswer.payloadChunkSize = payloadChunkSize_;
+  lazyChannelEstablishment_ = context_->getLazyChannelEstablishment() ||
+      nopBrochure.lazyChannelEstablishment;
+  nopBrochureAnswer.lazyChannelEstablishment = lazyChannelEstablishment_;
+  compactMessageDescriptors_ = context_->getCompactMessageDescriptors() &&
+      nopBrochure.compactMessageDescriptors;
+  nopBrochureAnswer.compactMessageDescriptors = compactMessageDescriptors_;
+
+  // The client's speculative connections are only of use if it doesn't have
+  // to switch to another transport.
+  const bool useSpeculativeConnections =
+      nopBrochure.speculationToken != 0 && !registrationId_.has_value();
+  speculationToken_ = nopBrochure.speculationToken;
   forEachDeviceType([&](auto buffer) {
     for (const auto& channelContextIter :
          this->getOrderedChannels_<decltype(buffer)>()) {
@@ -1432,31 +4468,79 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure_(
           nopChannelAdvertisementIter->second;
       const std::string& domainDescriptor =
           nopChannelAdvertisement.domainDescriptor;
-      if (domainDescriptor != channelContext.domainDescriptor()) {
+      if (!channelContext.canCommunicateWithRemote(domainDescriptor)) {
         continue;
       }
 
-      TP_VLOG(3) << "Pipe " << id_ << " is requesting connection (for channel "
-                 << channelName << ")";
-      uint64_t token =
-          listener_->registerConnectionRequest(lazyCallbackWrapper_(
-              [channelName](
-                  Impl& impl,
-                  std::string transport,
-                  std::shared_ptr<transport::Connection> connection) {
-                TP_VLOG(3) << "Pipe " << impl.id_
-                           << " done requesting connection (for channel "
-                           << channelName << ")";
-                impl.onAcceptWhileServerWaitingForChannel_<decltype(buffer)>(
-                    channelName, std::move(transport), std::move(connection));
-              }));
-      channelRegistrationIds_.get<decltype(buffer)>()[channelName] = token;
-      needToWaitForConnections = true;
-      auto& nopChannelSelectionMap =
-          getChannelSelection<decltype(buffer)>(nopBrochureAnswer);
-      ChannelSelection& nopChannelSelection =
-          nopChannelSelectionMap[channelName];
-      nopChannelSelection.registrationId = token;
+      for (uint64_t priorityClass = 0; priorityClass < numPriorityClasses;
+           ++priorityClass) {
+        std::string instanceName =
+            channelInstanceName(channelName, priorityClass);
+        TP_VLOG(3) << "Pipe " << id_
+                   << " is requesting connection (for channel "
+                   << instanceName << ")";
+        auto fn = lazyCallbackWrapper_(
+            [instanceName](
+                Impl& impl,
+                std::string transport,
+                std::shared_ptr<transport::Connection> connection) {
+              TP_VLOG(3) << "Pipe " << impl.id_
+                         << " done requesting connection (for channel "
+                         << instanceName << ")";
+              impl.onAcceptWhileServerWaitingForChannel_<decltype(buffer)>(
+                  instanceName, std::move(transport), std::move(connection));
+            });
+        auto& nopChannelSelectionMap =
+            getChannelSelection<decltype(buffer)>(nopBrochureAnswer);
+        ChannelSelection& nopChannelSelection =
+            nopChannelSelectionMap[instanceName];
+        if (useSpeculativeConnections) {
+          std::string tag = speculativeConnectionTag<decltype(buffer)>(
+              speculationToken_, instanceName);
+          listener_->registerSpeculativeConnection(tag, std::move(fn));
+          speculativeChannelTags_.get<decltype(buffer)>()[instanceName] =
+              std::move(tag);
+          nopChannelSelection.registrationId = 0;
+          nopChannelSelection.useSpeculativeConnection = true;
+        } else {
+          uint64_t token = listener_->registerConnectionRequest(std::move(fn));
+          channelRegistrationIds_.get<decltype(buffer)>()[instanceName] =
+              token;
+          nopChannelSelection.registrationId = token;
+        }
+        if (lazyChannelEstablishment_) {
+          auto channel = std::make_shared<LazyChannel<decltype(buffer)>>();
+          channel->setId(id_ + ".ch_" + instanceName);
+          channels_.get<decltype(buffer)>().emplace(instanceName, channel);
+          lazyChannels_.get<decltype(buffer)>().emplace(
+              instanceName, std::move(channel));
+        } else {
+          needToWaitForConnections = true;
+        }
+      }
+    }
+
+    // Close the speculative connections of the channels that weren't picked.
+    if (nopBrochure.speculationToken == 0) {
+      return;
+    }
+    const auto& nopChannelSelectionMap =
+        getChannelSelection<decltype(buffer)>(nopBrochureAnswer);
+    for (const auto& nopChannelAdvertisementIter :
+         getChannelAdvertisement<decltype(buffer)>(nopBrochure)) {
+      for (uint64_t priorityClass = 0;
+           priorityClass < nopBrochure.numPriorityClasses;
+           ++priorityClass) {
+        std::string instanceName = channelInstanceName(
+            nopChannelAdvertisementIter.first, priorityClass);
+        auto iter = nopChannelSelectionMap.find(instanceName);
+        if (iter == nopChannelSelectionMap.end() ||
+            !iter->second.useSpeculativeConnection) {
+          listener_->unregisterSpeculativeConnection(
+              speculativeConnectionTag<decltype(buffer)>(
+                  nopBrochure.speculationToken, instanceName));
+        }
+      }
     }
   });
 
@@ -1471,25 +4555,12 @@ void Pipe::Impl::onReadWhileServerWaitingForBrochure_(
     state_ = ESTABLISHED;
     startReadingUponEstablishingPipe_();
     startWritingUponEstablishingPipe_();
+    callEstablishmentCallbacksIfReady_();
   } else {
     state_ = SERVER_WAITING_FOR_CONNECTIONS;
   }
 }
 
-template <>
-std::shared_ptr<channel::Context<CpuBuffer>> Pipe::Impl::getChannelContext_(
-    const std::string& channelName) {
-  return context_->getCpuChannel(channelName);
-}
-
-#if TENSORPIPE_SUPPORTS_CUDA
-template <>
-std::shared_ptr<channel::Context<CudaBuffer>> Pipe::Impl::getChannelContext_(
-    const std::string& channelName) {
-  return context_->getCudaChannel(channelName);
-}
-#endif // TENSORPIPE_SUPPORTS_CUDA
-
 void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer_(
     const Packet& nopPacketIn) {
   TP_DCHECK(loop_.inLoop());
@@ -1497,16 +4568,21 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer_(
   TP_DCHECK_EQ(nopPacketIn.index(), nopPacketIn.index_of<BrochureAnswer>());
 
   const BrochureAnswer& nopBrochureAnswer = *nopPacketIn.get<BrochureAnswer>();
+  payloadChunkSize_ = nopBrochureAnswer.payloadChunkSize;
+  compactMessageDescriptors_ = nopBrochureAnswer.compactMessageDescriptors;
   const std::string& transport = nopBrochureAnswer.transport;
   std::string address = nopBrochureAnswer.address;
   std::shared_ptr<transport::Context> transportContext =
       context_->getTransport(transport);
 
   if (transport != transport_) {
-    TP_VLOG(3) << "Pipe " << id_ << " is opening connection (as replacement)";
+    const bool isUpgrade = nopBrochureAnswer.transportUpgrade;
+    TP_VLOG(3) << "Pipe " << id_ << " is opening connection (as "
+               << (isUpgrade ? "upgrade" : "replacement") << ")";
     std::shared_ptr<transport::Connection> connection =
         transportContext->connect(address);
     connection->setId(id_ + ".tr_" + transport);
+    registerConnection_(connection);
     auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
     Packet& nopPacketOut = nopHolderOut->getObject();
     nopPacketOut.Become(nopPacketOut.index_of<RequestedConnection>());
@@ -1522,53 +4598,124 @@ void Pipe::Impl::onReadWhileClientWaitingForBrochureAnswer_(
                      << " done writing nop object (requested connection)";
         }));
 
-    transport_ = transport;
-    connection_ = std::move(connection);
+    if (isUpgrade) {
+      // The server tells us when it has accepted the connection, which is the
+      // first thing it writes to it.
+      auto nopHolderIn = std::make_shared<NopHolder<Packet>>();
+      TP_VLOG(3) << "Pipe " << id_
+                 << " is reading nop object (transport upgrade)";
+      connection->read(
+          *nopHolderIn, lazyCallbackWrapper_([nopHolderIn](Impl& impl) {
+            TP_VLOG(3) << "Pipe " << impl.id_
+                       << " done reading nop object (transport upgrade)";
+            const Packet& nopPacketIn = nopHolderIn->getObject();
+            TP_THROW_ASSERT_IF(
+                nopPacketIn.index() != nopPacketIn.index_of<TransportUpgrade>())
+                << "Expected the server to accept the upgraded connection";
+            impl.isUpgradedConnectionReady_ = true;
+            impl.switchWritesToUpgradedConnectionIfReady_();
+          }));
+      upgradedTransport_ = transport;
+      upgradedConnection_ = std::move(connection);
+    } else {
+      transport_ = transport;
+      connection_ = std::move(connection);
+      readConnection_ = connection_;
+    }
   }
+  channelTransport_ = transport;
 
+  lazyChannelEstablishment_ = nopBrochureAnswer.lazyChannelEstablishment;
+  channelAddress_ = std::move(address);
   forEachDeviceType([&](auto buffer) {
     for (const auto& nopChannelSelectionIter :
          getChannelSelection<decltype(buffer)>(nopBrochureAnswer)) {
       const std::string& channelName = nopChannelSelectionIter.first;
-      const ChannelSelection& nopChannelSelection =
-          nopChannelSelectionIter.second;
-
-      std::shared_ptr<channel::Context<decltype(buffer)>> channelContext =
-          this->getChannelContext_<decltype(buffer)>(channelName);
-
-      TP_VLOG(3) << "Pipe " << id_ << " is opening connection (for channel "
-                 << channelName << ")";
-      std::shared_ptr<transport::Connection> connection =
-          transportContext->connect(address);
-      connection->setId(id_ + ".ch_" + channelName);
-
-      auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
-      Packet& nopPacketOut = nopHolderOut->getObject();
-      nopPacketOut.Become(nopPacketOut.index_of<RequestedConnection>());
-      RequestedConnection& nopRequestedConnection =
-          *nopPacketOut.get<RequestedConnection>();
-      uint64_t token = nopChannelSelection.registrationId;
-      nopRequestedConnection.registrationId = token;
-      TP_VLOG(3) << "Pipe " << id_
-                 << " is writing nop object (requested connection)";
-      connection->write(
-          *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
-            TP_VLOG(3) << "Pipe " << impl.id_
-                       << " done writing nop object (requested connection)";
-          }));
-
-      std::shared_ptr<channel::Channel<decltype(buffer)>> channel =
-          channelContext->createChannel(
-              std::move(connection), channel::Endpoint::kConnect);
-      channel->setId(id_ + ".ch_" + channelName);
+      const uint64_t token = nopChannelSelectionIter.second.registrationId;
+      auto& speculativeConnections =
+          speculativeConnections_.get<decltype(buffer)>();
+
+      std::shared_ptr<channel::Channel<decltype(buffer)>> channel;
+      if (nopChannelSelectionIter.second.useSpeculativeConnection) {
+        auto connectionIter = speculativeConnections.find(channelName);
+        TP_THROW_ASSERT_IF(connectionIter == speculativeConnections.end())
+            << "No speculative connection for channel " << channelName;
+        TP_VLOG(3) << "Pipe " << id_
+                   << " is using speculative connection (for channel "
+                   << channelName << ")";
+        channel = this->getChannelContext_<decltype(buffer)>(
+                          baseChannelName(channelName))
+                      ->createChannel(
+                          std::move(connectionIter->second),
+                          channel::Endpoint::kConnect);
+        channel->setId(id_ + ".ch_" + channelName);
+        speculativeConnections.erase(connectionIter);
+      } else if (lazyChannelEstablishment_) {
+        // The channel is owned by this pipe, which thus outlives it.
+        channel = std::make_shared<LazyChannel<decltype(buffer)>>(
+            [this, channelName, token]() {
+              return this->connectChannel_<decltype(buffer)>(
+                  channelName, token);
+            });
+        channel->setId(id_ + ".ch_" + channelName);
+      } else {
+        channel = connectChannel_<decltype(buffer)>(channelName, token);
+      }
       channels_.get<decltype(buffer)>().emplace(
           channelName, std::move(channel));
     }
+
+    for (const auto& iter : speculativeConnections_.get<decltype(buffer)>()) {
+      TP_VLOG(3) << "Pipe " << id_
+                 << " is closing unused speculative connection (for channel "
+                 << iter.first << ")";
+      iter.second->close();
+    }
+    speculativeConnections_.get<decltype(buffer)>().clear();
   });
 
   state_ = ESTABLISHED;
   startReadingUponEstablishingPipe_();
   startWritingUponEstablishingPipe_();
+  callEstablishmentCallbacksIfReady_();
+}
+
+template <typename TBuffer>
+std::shared_ptr<channel::Channel<TBuffer>> Pipe::Impl::connectChannel_(
+    const std::string& channelName,
+    uint64_t registrationId) {
+  TP_DCHECK(loop_.inLoop());
+  std::shared_ptr<transport::Context> transportContext =
+      context_->getTransport(channelTransport_);
+  std::shared_ptr<channel::Context<TBuffer>> channelContext =
+      getChannelContext_<TBuffer>(baseChannelName(channelName));
+
+  TP_VLOG(3) << "Pipe " << id_ << " is opening connection (for channel "
+             << channelName << ")";
+  std::shared_ptr<transport::Connection> connection =
+      transportContext->connect(channelAddress_);
+  connection->setId(id_ + ".ch_" + channelName);
+  registerConnection_(connection);
+
+  auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+  Packet& nopPacketOut = nopHolderOut->getObject();
+  nopPacketOut.Become(nopPacketOut.index_of<RequestedConnection>());
+  RequestedConnection& nopRequestedConnection =
+      *nopPacketOut.get<RequestedConnection>();
+  nopRequestedConnection.registrationId = registrationId;
+  TP_VLOG(3) << "Pipe " << id_
+             << " is writing nop object (requested connection)";
+  connection->write(
+      *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done writing nop object (requested connection)";
+      }));
+
+  std::shared_ptr<channel::Channel<TBuffer>> channel =
+      channelContext->createChannel(
+          std::move(connection), channel::Endpoint::kConnect);
+  channel->setId(id_ + ".ch_" + channelName);
+  return channel;
 }
 
 void Pipe::Impl::onAcceptWhileServerWaitingForConnection_(
@@ -1580,14 +4727,106 @@ void Pipe::Impl::onAcceptWhileServerWaitingForConnection_(
   listener_->unregisterConnectionRequest(registrationId_.value());
   registrationId_.reset();
   receivedConnection->setId(id_ + ".tr_" + receivedTransport);
+  registerConnection_(receivedConnection);
   TP_DCHECK_EQ(transport_, receivedTransport);
   connection_.reset();
   connection_ = std::move(receivedConnection);
+  readConnection_ = connection_;
 
   if (!pendingRegistrations_()) {
     state_ = ESTABLISHED;
     startReadingUponEstablishingPipe_();
     startWritingUponEstablishingPipe_();
+    callEstablishmentCallbacksIfReady_();
+  }
+}
+
+void Pipe::Impl::onAcceptOfUpgradedConnection_(
+    std::string receivedTransport,
+    std::shared_ptr<transport::Connection> receivedConnection) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(registrationId_.has_value());
+  listener_->unregisterConnectionRequest(registrationId_.value());
+  registrationId_.reset();
+  receivedConnection->setId(id_ + ".tr_" + receivedTransport);
+  registerConnection_(receivedConnection);
+  TP_DCHECK_EQ(upgradedTransport_, receivedTransport);
+
+  auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+  Packet& nopPacketOut = nopHolderOut->getObject();
+  nopPacketOut.Become(nopPacketOut.index_of<TransportUpgrade>());
+  nopPacketOut.get<TransportUpgrade>()->transport = upgradedTransport_;
+  TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (transport upgrade)";
+  receivedConnection->write(
+      *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done writing nop object (transport upgrade)";
+      }));
+
+  upgradedConnection_ = std::move(receivedConnection);
+  isUpgradedConnectionReady_ = true;
+  switchWritesToUpgradedConnectionIfReady_();
+}
+
+void Pipe::Impl::switchWritesToUpgradedConnectionIfReady_() {
+  TP_DCHECK(loop_.inLoop());
+  if (error_ || upgradedConnection_ == nullptr || !isUpgradedConnectionReady_ ||
+      connection_ == upgradedConnection_) {
+    return;
+  }
+
+  // The peer reads the descriptors of the tensors of the last message from the
+  // same connection as the message's own descriptor.
+  const WriteOperation* lastOpPtr =
+      findWriteOperation(lastWriteWithDescriptor_);
+  if (lastOpPtr != nullptr && lastOpPtr->channelDescriptorsFollow &&
+      lastOpPtr->nextTensorDescriptorToWrite < lastOpPtr->tensors.size()) {
+    return;
+  }
+  if (!coalescedOps_.empty()) {
+    flushCoalescedWrites_();
+  }
+
+  // This takes the place of the next message descriptor, and tells the peer to
+  // read that one, and all that follows, from the upgraded connection.
+  auto nopHolderOut = std::make_shared<NopHolder<Packet>>();
+  Packet& nopPacketOut = nopHolderOut->getObject();
+  nopPacketOut.Become(nopPacketOut.index_of<TransportUpgrade>());
+  nopPacketOut.get<TransportUpgrade>()->transport = upgradedTransport_;
+  TP_VLOG(3) << "Pipe " << id_ << " is writing nop object (transport upgrade)";
+  connection_->write(
+      *nopHolderOut, lazyCallbackWrapper_([nopHolderOut](Impl& impl) {
+        TP_VLOG(3) << "Pipe " << impl.id_
+                   << " done writing nop object (transport upgrade)";
+      }));
+
+  TP_VLOG(1) << "Pipe " << id_ << " is switching its writes from transport "
+             << transport_ << " to transport " << upgradedTransport_;
+  previousConnection_ = std::move(connection_);
+  connection_ = upgradedConnection_;
+  transport_ = upgradedTransport_;
+  if (readConnection_ == connection_) {
+    TP_VLOG(1) << "Pipe " << id_ << " is done upgrading its transport";
+    upgradedConnection_.reset();
+  }
+}
+
+void Pipe::Impl::onReadOfTransportUpgrade_() {
+  TP_DCHECK(loop_.inLoop());
+  TP_THROW_ASSERT_IF(
+      upgradedConnection_ == nullptr || readConnection_ == upgradedConnection_)
+      << "Unexpected transport upgrade";
+
+  TP_VLOG(1) << "Pipe " << id_ << " is switching its reads to transport "
+             << upgradedTransport_;
+  readConnection_ = upgradedConnection_;
+
+  // The peer only moves once it has the connection, which thus works.
+  isUpgradedConnectionReady_ = true;
+  switchWritesToUpgradedConnectionIfReady_();
+  if (connection_ == readConnection_ && upgradedConnection_ != nullptr) {
+    TP_VLOG(1) << "Pipe " << id_ << " is done upgrading its transport";
+    upgradedConnection_.reset();
   }
 }
 
@@ -1597,43 +4836,123 @@ void Pipe::Impl::onAcceptWhileServerWaitingForChannel_(
     std::string receivedTransport,
     std::shared_ptr<transport::Connection> receivedConnection) {
   TP_DCHECK(loop_.inLoop());
-  TP_DCHECK_EQ(state_, SERVER_WAITING_FOR_CONNECTIONS);
+  TP_DCHECK(
+      state_ == SERVER_WAITING_FOR_CONNECTIONS || lazyChannelEstablishment_);
   auto& channelRegistrationIds = channelRegistrationIds_.get<TBuffer>();
   auto channelRegistrationIdIter = channelRegistrationIds.find(channelName);
-  TP_DCHECK(channelRegistrationIdIter != channelRegistrationIds.end());
-  listener_->unregisterConnectionRequest(channelRegistrationIdIter->second);
-  channelRegistrationIds.erase(channelRegistrationIdIter);
+  if (channelRegistrationIdIter != channelRegistrationIds.end()) {
+    listener_->unregisterConnectionRequest(channelRegistrationIdIter->second);
+    channelRegistrationIds.erase(channelRegistrationIdIter);
+  } else {
+    // The listener already dropped the registration of a speculative one.
+    auto& speculativeChannelTags = speculativeChannelTags_.get<TBuffer>();
+    TP_DCHECK_EQ(speculativeChannelTags.count(channelName), 1);
+    speculativeChannelTags.erase(channelName);
+  }
   receivedConnection->setId(id_ + ".ch_" + channelName);
+  registerConnection_(receivedConnection);
 
   TP_DCHECK_EQ(transport_, receivedTransport);
-  auto& channels = channels_.get<TBuffer>();
-  TP_DCHECK(channels.find(channelName) == channels.end());
-
   std::shared_ptr<channel::Context<TBuffer>> channelContext =
-      getChannelContext_<TBuffer>(channelName);
+      getChannelContext_<TBuffer>(baseChannelName(channelName));
 
   std::shared_ptr<channel::Channel<TBuffer>> channel =
       channelContext->createChannel(
           std::move(receivedConnection), channel::Endpoint::kListen);
   channel->setId(id_ + ".ch_" + channelName);
-  channels.emplace(channelName, std::move(channel));
+  if (lazyChannelEstablishment_) {
+    auto& lazyChannels = lazyChannels_.get<TBuffer>();
+    auto lazyChannelIter = lazyChannels.find(channelName);
+    TP_DCHECK(lazyChannelIter != lazyChannels.end());
+    TP_VLOG(3) << "Pipe " << id_ << " got lazily connected channel "
+               << channelName;
+    lazyChannelIter->second->setChannel(std::move(channel));
+    lazyChannels.erase(lazyChannelIter);
+  } else {
+    auto& channels = channels_.get<TBuffer>();
+    TP_DCHECK(channels.find(channelName) == channels.end());
+    channels.emplace(channelName, std::move(channel));
+  }
 
-  if (!pendingRegistrations_()) {
+  if (state_ == SERVER_WAITING_FOR_CONNECTIONS && !pendingRegistrations_()) {
     state_ = ESTABLISHED;
     startReadingUponEstablishingPipe_();
     startWritingUponEstablishingPipe_();
+    callEstablishmentCallbacksIfReady_();
   }
 }
 
 void Pipe::Impl::onReadOfMessageDescriptor_(
     ReadOperation& op,
-    const Packet& nopPacketIn) {
+    Packet& nopPacketIn) {
   TP_DCHECK(loop_.inLoop());
   TP_DCHECK_EQ(state_, ESTABLISHED);
 
   TP_DCHECK_EQ(op.state, ReadOperation::READING_DESCRIPTOR);
-  parseDescriptorOfMessage(op, nopPacketIn);
+  if (nopPacketIn.index() ==
+      nopPacketIn.index_of<TemplatedMessageDescriptor>()) {
+    TemplatedMessageDescriptor& nopTemplatedMessageDescriptor =
+        *nopPacketIn.get<TemplatedMessageDescriptor>();
+    auto templateIter = remoteMessageTemplates_.find(
+        nopTemplatedMessageDescriptor.templateId);
+    TP_THROW_ASSERT_IF(templateIter == remoteMessageTemplates_.end())
+        << "Unknown message template";
+    parseTemplatedDescriptorOfMessage(
+        op, templateIter->second, nopTemplatedMessageDescriptor);
+  } else {
+    TP_DCHECK_EQ(
+        nopPacketIn.index(), nopPacketIn.index_of<MessageDescriptor>());
+    MessageDescriptor& nopMessageDescriptor =
+        *nopPacketIn.get<MessageDescriptor>();
+    resolveStringsOfDescriptor_(nopMessageDescriptor);
+    if (nopMessageDescriptor.definesTemplate) {
+      MessageDescriptor& nopTemplate =
+          remoteMessageTemplates_[nopMessageDescriptor.templateId];
+      nopTemplate = nopMessageDescriptor;
+      // These are specific to the message that defined the template.
+      for (auto& nopTensorDescriptor : nopTemplate.tensorDescriptors) {
+        nopTensorDescriptor.channelDescriptor.clear();
+      }
+    }
+    parseDescriptorOfMessage(op, nopMessageDescriptor);
+  }
   op.doneReadingDescriptor = true;
+  op.descriptorReadAt = std::chrono::steady_clock::now();
+
+  const bool isMatchedToPostedRead = matchPostedRead_(op);
+  const ContextOptions::allocator_fn& allocator = settings_.allocator;
+  if (allocator && !isMatchedToPostedRead) {
+    size_t numBytes = 0;
+    for (const auto& payload : op.payloads) {
+      numBytes += payload.length;
+    }
+    for (const auto& tensor : op.tensors) {
+      numBytes += tensor.length;
+    }
+    // Over budget, leave it to the user to decide when to pull the message.
+    if (!context_->reserveAllocatorBytes(numBytes)) {
+      TP_VLOG(2) << "Pipe " << id_ << " is leaving the allocation of message #"
+                 << op.sequenceNumber << " to the user, as the "
+                 << numBytes << " bytes would exceed the allocator's budget";
+    } else if (allocator(op.message)) {
+      TP_VLOG(2) << "Pipe " << id_ << " got allocation of message #"
+                 << op.sequenceNumber << " from the context's allocator";
+      checkAllocationCompatibility(op, op.message);
+      op.allocatedByPipe = true;
+      op.numAllocatorBytes = numBytes;
+    } else {
+      context_->releaseAllocatorBytes(numBytes);
+    }
+  }
+
+  // The buffers of a posted read, or of the allocator, are already known.
+  if (op.doneGettingAllocation || op.allocatedByPipe) {
+    Error error = checkDevicesOfTensorsWithoutChannel(op, op.message);
+    if (error) {
+      failReadOperation_(op, std::move(error));
+      return;
+    }
+  }
 
   advanceReadOperation_(op);
 }
@@ -1644,12 +4963,27 @@ void Pipe::Impl::onDescriptorOfTensor_(
     channel::TDescriptor descriptor) {
   TP_DCHECK(loop_.inLoop());
 
-  TP_DCHECK_EQ(
-      op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
-  TP_DCHECK_LT(tensorIdx, op.tensors.size());
-  op.tensors[tensorIdx].descriptor = std::move(descriptor);
+  TP_DCHECK_LT(tensorIdx, static_cast<int64_t>(op.tensors.size()));
+  WriteOperation::Tensor& tensor =
+      tensorIdx == kPackIdx ? op.pack : op.tensors[tensorIdx];
+  tensor.descriptor = std::move(descriptor);
+  tensor.hasDescriptor = true;
   --op.numTensorDescriptorsBeingCollected;
 
+  if (op.channelDescriptorsFollow) {
+    TP_DCHECK_GE(
+        op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
+    TP_DCHECK_LE(
+        op.state, WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS);
+    if (!error_ &&
+        op.state == WriteOperation::WRITING_PAYLOADS_AND_SENDING_TENSORS) {
+      writeTensorDescriptorsOfMessage_(op);
+    }
+  } else {
+    TP_DCHECK_EQ(
+        op.state, WriteOperation::SENDING_TENSORS_AND_COLLECTING_DESCRIPTORS);
+  }
+
   advanceWriteOperation_(op);
 }
 
@@ -1671,6 +5005,29 @@ void Pipe::Impl::onRecvOfTensor_(ReadOperation& op) {
   advanceReadOperation_(op);
 }
 
+void Pipe::Impl::recordTransportWrite_(
+    std::chrono::steady_clock::time_point startTime,
+    int64_t sequenceNumber) {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  counters_->transportWriteLatency.record(now - startTime);
+  if (trace::isEnabled()) {
+    trace::recordSpan(
+        "transport_write", getTraceScope_(), sequenceNumber, startTime, now);
+  }
+}
+
+uint32_t Pipe::Impl::getTraceScope_() {
+  TP_DCHECK(loop_.inLoop());
+  if (!traceScope_.has_value()) {
+    traceScope_ = trace::internScope(id_);
+  }
+  return traceScope_.value();
+}
+
 void Pipe::Impl::onWriteOfPayload_(WriteOperation& op) {
   TP_DCHECK(loop_.inLoop());
 
@@ -1718,13 +5075,20 @@ WriteOperation* Pipe::Impl::findWriteOperation(int64_t sequenceNumber) {
 }
 
 bool Pipe::Impl::pendingRegistrations_() {
-  if (registrationId_.has_value()) {
+  // The connection of an upgraded transport isn't waited for.
+  if (registrationId_.has_value() && upgradedTransport_.empty()) {
     return true;
   }
 
+  // The channels that are connected lazily aren't waited for.
+  if (lazyChannelEstablishment_) {
+    return false;
+  }
+
   bool ret = false;
   forEachDeviceType([&](auto buffer) {
-    if (!channelRegistrationIds_.get<decltype(buffer)>().empty()) {
+    if (!channelRegistrationIds_.get<decltype(buffer)>().empty() ||
+        !speculativeChannelTags_.get<decltype(buffer)>().empty()) {
       ret = true;
     }
   });
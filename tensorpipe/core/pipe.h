@@ -8,11 +8,15 @@
 
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
 
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/message.h>
@@ -65,23 +69,160 @@ class Pipe final {
   //
 
   using read_descriptor_callback_fn =
-      std::function<void(const Error&, Message)>;
+      Function<void(const Error&, Message)>;
 
   void readDescriptor(read_descriptor_callback_fn);
 
-  using read_callback_fn = std::function<void(const Error&, Message)>;
+  // Have the pipe keep reading descriptors on its own, invoking the callback
+  // for each incoming message as if readDescriptor had been called for it,
+  // until an error occurs. Up to prefetchDepth descriptors are requested at a
+  // time, hence, with an allocator set on the context, as many messages may be
+  // read ahead of the user, and the descriptor of each message is read while
+  // the payloads and tensors of the one before are still coming in. Each
+  // message must still be passed to read, in the order in which they were
+  // given. After calling this, readDescriptor can't be called anymore.
+  void readDescriptors(read_descriptor_callback_fn, size_t prefetchDepth = 1);
 
-  void read(Message, read_callback_fn);
+  using read_callback_fn = Function<void(const Error&, Message)>;
 
-  using write_callback_fn = std::function<void(const Error&, Message)>;
+  void read(Message, read_callback_fn);
 
-  void write(Message, write_callback_fn);
+  struct ReadProgress {
+    enum Kind { kPayload, kTensor };
+    Kind kind;
+    // The index of the payload or of the tensor within the message.
+    size_t index;
+    // The length of the prefix of its buffer that has already been filled.
+    size_t numBytesAvailable;
+  };
+
+  using read_progress_callback_fn = Function<void(const ReadProgress&)>;
+
+  // Like the above, but the progress callback is also invoked each time that
+  // part of a payload or tensor arrives, with a prefix that grows each time.
+  // Payloads and inline tensors are reported chunk by chunk if the contexts
+  // were given a chunk size, and the other tensors as each of them completes.
+  // This lets the user start processing the message while the rest of it is
+  // still in flight. The callback is invoked from the pipe's internal thread,
+  // even when the context was given an executor, hence it must be quick and
+  // not block. Parts that arrived before read was called aren't reported.
+  void read(Message, read_callback_fn, read_progress_callback_fn);
+
+  // Post a read for the next message that the remote side writes with the given
+  // tag, providing the buffers for it upfront (the message must thus have the
+  // layout of the one that will arrive). Once its descriptor comes in, the
+  // message is read right away into these buffers, without going through
+  // readDescriptor, and the callback is then invoked with it, as for read.
+  // Messages without a tag, or whose tag has no read posted for it, are handed
+  // to readDescriptor as usual. Posting a read also has the pipe read one more
+  // descriptor, hence the pipe doesn't wait for readDescriptor to be called to
+  // find a message for a posted read, but it can't go past a message that it
+  // found and that is waiting for readDescriptor, as they arrive in order.
+  void postRead(uint64_t tag, Message, read_callback_fn);
+
+  using write_callback_fn = Function<void(const Error&, Message)>;
+
+  // The priority class picks, if the contexts were given more than one, which
+  // instances of the channels the tensors are sent over, with higher classes
+  // being meant for messages whose latency matters most.
+  //
+  // A write may be given a deadline, past which it's no use sending it. While
+  // writes are waiting to be admitted (see the limits in the context's
+  // options), the one with the earliest deadline goes first, with those that
+  // have none going last and otherwise in order, and those whose deadline has
+  // passed are dropped: their callback is invoked right away with a
+  // WriteDeadlineExceededError, possibly ahead of the ones of earlier writes,
+  // and nothing of them is sent. Once admitted, a write is always carried out.
+  void write(
+      Message,
+      write_callback_fn,
+      uint64_t priorityClass = 0,
+      std::chrono::steady_clock::time_point deadline =
+          std::chrono::steady_clock::time_point::max());
+
+  using write_capacity_callback_fn = Function<void(const Error&)>;
+
+  // Invoke the callback as soon as none of the writes issued so far is waiting
+  // to be admitted because of the limits set in the context's options and the
+  // pipe is below its own limits, so that producers can apply backpressure
+  // rather than queue up writes indefinitely. Only the limits of the pipe are
+  // considered, not the one shared by all the pipes of the context.
+  void waitForWriteCapacity(write_capacity_callback_fn);
+
+  struct WriteStats {
+    // The writes that were admitted and are still in progress.
+    size_t numOutstandingWrites{0};
+    size_t numOutstandingWriteBytes{0};
+    // The writes that are waiting for earlier ones to complete.
+    size_t numQueuedWrites{0};
+    size_t numQueuedWriteBytes{0};
+  };
+
+  // Retrieve how many writes, and how many bytes of payloads and tensors, are
+  // in the pipe at the moment. This is meant for monitoring, as they may have
+  // changed by the time this returns.
+  WriteStats getWriteStats();
+
+  // Set the share of the time that the loop of the transport spends writing
+  // that the pipe gets, relative to the other pipes over the same transport
+  // context, which all start with a weight of one. The loop takes turns among
+  // the pipes that have data to write, and each turn writes up to an amount
+  // of data proportional to the weight, hence pipes with small messages don't
+  // have to wait behind the bulk transfers of other pipes. This applies to the
+  // connections of the pipe and of its channels, including those set up later,
+  // but only matters for the transports that copy the data themselves (shm).
+  void setWriteWeight(uint32_t weight);
+
+  // Bound the rate, in bytes per second, at which the pipe writes the payloads
+  // and tensors of its messages, with a token bucket that lets bursts of up to
+  // the given amount of bytes through (by default, a tenth of a second's
+  // worth). This applies on top of the limit of the context, in the same way
+  // (see Context::setWriteRateLimit). It can be changed at any time, and a rate
+  // of zero removes it.
+  void setWriteRateLimit(double bytesPerSecond, size_t burstBytes = 0);
+
+  // Have the pipe ignore, or again abide by, the rate limit of the context, so
+  // that latency-critical pipes aren't held back by the bulk traffic of others.
+  void exemptFromContextWriteRateLimit(bool exempt);
+
+  using establishment_callback_fn = Function<void(const Error&)>;
+
+  // Invoke the callback once the handshake with the remote end is complete, so
+  // that messages can be transferred without any further setup, or once the
+  // pipe has failed, whichever comes first. Operations can be issued before
+  // then anyways: they're just held back until that point.
+  void waitForEstablishment(establishment_callback_fn);
+
+  // Blocking versions of readDescriptor, read and write, which busy-wait on the
+  // calling thread for the operation to complete, rather than going to sleep,
+  // in order to cut the latency of waking back up. The message is taken from,
+  // and handed back through, the given argument. Since the pipe is driven by
+  // the threads that call into it, the calling thread also carries out right
+  // away whatever work of the pipe there is to do. They tie up the thread and
+  // are thus meant for pipes that are used from a single dedicated thread, and
+  // they must not be called from within callbacks.
+  Error readDescriptorSync(Message& message);
+  Error readSync(Message& message);
+  Error writeAndWait(Message& message, uint64_t priorityClass = 0);
 
   // Retrieve the user-defined name that was given to the constructor of the
   // context on the remote side, if any (if not, this will be the empty string).
   // This is intended to help in logging and debugging only.
   const std::string& getRemoteName();
 
+  // Retrieve, if channel auto-tuning is enabled, which channel the pipe is
+  // currently sending tensors of the given device type over, for each range of
+  // lengths, keyed by the maximum length of the range. This is intended to help
+  // in inspecting and debugging the performance of the pipe.
+  std::map<size_t, std::string> getChannelRoutingTable(DeviceType type);
+
+  // Register the layout of the given message (its metadata, and the number,
+  // lengths and metadata of its payloads and tensors) as a template, returning
+  // its id. Later messages with this same layout can refer to it through their
+  // templateId field, which lets the pipe and its peer skip most of the work of
+  // serializing and parsing their descriptors.
+  uint64_t registerMessageTemplate(const Message& message);
+
   // Put the pipe in a terminal state, aborting its pending operations and
   // rejecting future ones, and release its resrouces. This may be carried out
   // asynchronously, in background.
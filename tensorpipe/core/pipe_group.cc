@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/pipe_group.h>
+
+#include <atomic>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+
+namespace {
+
+size_t getTensorLength(const Message::Tensor& tensor) {
+  switch (tensor.buffer.type) {
+    case DeviceType::kCpu:
+      return tensor.buffer.cpu.length;
+#if TENSORPIPE_SUPPORTS_CUDA
+    case DeviceType::kCuda:
+      return tensor.buffer.cuda.length;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+    default:
+      TP_THROW_ASSERT() << "Unexpected device type.";
+  }
+}
+
+// A copy of the message that refers to the same buffers. The owners of the
+// tensors are shared too, hence each receiver that is handed the memory of a
+// tensor (rather than a copy of it) gets the same memory.
+Message copyMessage(const Message& message) {
+  Message copy;
+  copy.metadata = message.metadata;
+  copy.payloads = message.payloads;
+  copy.tensors = message.tensors;
+  return copy;
+}
+
+// What the writes to all the pipes share, which the last one to complete hands
+// back to the user.
+struct Broadcast {
+  Message message;
+  PipeGroup::broadcast_callback_fn fn;
+  std::atomic<size_t> numPendingWrites{0};
+  std::mutex mutex;
+  Error error;
+};
+
+} // namespace
+
+PipeGroup::PipeGroup(
+    std::vector<std::shared_ptr<Pipe>> pipes,
+    size_t maxNumTemplates)
+    : pipes_(std::move(pipes)), maxNumTemplates_(maxNumTemplates) {
+  TP_THROW_ASSERT_IF(pipes_.empty()) << "A pipe group can't be empty";
+}
+
+const std::vector<uint64_t>* PipeGroup::getTemplateIds_(
+    const Message& message) {
+  std::vector<size_t> layout;
+  layout.reserve(message.payloads.size() + message.tensors.size() + 1);
+  layout.push_back(message.payloads.size());
+  for (const Message::Payload& payload : message.payloads) {
+    layout.push_back(payload.length);
+  }
+  for (const Message::Tensor& tensor : message.tensors) {
+    layout.push_back(getTensorLength(tensor));
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto iter = templateIds_.find(layout);
+  if (iter != templateIds_.end()) {
+    return &iter->second;
+  }
+  if (templateIds_.size() >= maxNumTemplates_) {
+    return nullptr;
+  }
+  std::vector<uint64_t> templateIds;
+  templateIds.reserve(pipes_.size());
+  for (const std::shared_ptr<Pipe>& pipe : pipes_) {
+    templateIds.push_back(pipe->registerMessageTemplate(message));
+  }
+  // References to the elements of a map remain valid when it grows.
+  return &templateIds_.emplace(std::move(layout), std::move(templateIds))
+              .first->second;
+}
+
+void PipeGroup::broadcast(
+    Message message,
+    broadcast_callback_fn fn,
+    uint64_t priorityClass) {
+  TP_THROW_ASSERT_IF(message.templateId.has_value())
+      << "The messages of a pipe group can't have a template id";
+  const std::vector<uint64_t>* templateIds = getTemplateIds_(message);
+
+  auto broadcast = std::make_shared<Broadcast>();
+  broadcast->message = std::move(message);
+  broadcast->fn = std::move(fn);
+  broadcast->numPendingWrites = pipes_.size();
+
+  for (size_t pipeIdx = 0; pipeIdx < pipes_.size(); pipeIdx++) {
+    Message copy = copyMessage(broadcast->message);
+    if (templateIds != nullptr) {
+      copy.templateId = (*templateIds)[pipeIdx];
+    }
+    pipes_[pipeIdx]->write(
+        std::move(copy),
+        [broadcast](const Error& error, Message /* unused */) {
+          if (error) {
+            std::unique_lock<std::mutex> lock(broadcast->mutex);
+            if (!broadcast->error) {
+              broadcast->error = error;
+            }
+          }
+          if (broadcast->numPendingWrites.fetch_sub(1) == 1) {
+            // All the others are done, hence no need to lock.
+            broadcast->fn(broadcast->error, std::move(broadcast->message));
+          }
+        },
+        priorityClass);
+  }
+}
+
+} // namespace tensorpipe
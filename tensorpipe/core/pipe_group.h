@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+
+// A set of pipes to which the same messages are sent, e.g., by a parameter
+// server pushing the weights to all of its workers. A broadcast issues the
+// writes to all the pipes at once, each with its own shallow copy of the
+// message (which refers to the same buffers). The layouts of the messages that
+// are broadcast are registered as templates on each pipe, so that the pipes
+// (and their peers) only serialize (and parse) a full descriptor for the
+// first message of each layout. Up to maxNumTemplates layouts are registered,
+// and the messages of the other ones are sent with a full descriptor.
+class PipeGroup final {
+ public:
+  static constexpr size_t kDefaultMaxNumTemplates = 64;
+
+  explicit PipeGroup(
+      std::vector<std::shared_ptr<Pipe>> pipes,
+      size_t maxNumTemplates = kDefaultMaxNumTemplates);
+
+  PipeGroup(const PipeGroup&) = delete;
+  PipeGroup& operator=(const PipeGroup&) = delete;
+
+  using broadcast_callback_fn = Function<void(const Error&, Message)>;
+
+  // Write the message to all the pipes. The callback is invoked once all the
+  // writes have completed, with the error of the first one that failed if any,
+  // and is given the message back. The message must not have a template id,
+  // as the group assigns them itself. The buffers must remain valid until the
+  // callback is invoked.
+  void broadcast(
+      Message message,
+      broadcast_callback_fn fn,
+      uint64_t priorityClass = 0);
+
+  const std::vector<std::shared_ptr<Pipe>>& getPipes() const {
+    return pipes_;
+  }
+
+ private:
+  const std::vector<std::shared_ptr<Pipe>> pipes_;
+  const size_t maxNumTemplates_;
+
+  std::mutex mutex_;
+  // For each layout (the lengths of the payloads, followed by those of the
+  // tensors), the ids of its template on each of the pipes.
+  std::map<std::vector<size_t>, std::vector<uint64_t>> templateIds_;
+
+  const std::vector<uint64_t>* getTemplateIds_(const Message& message);
+};
+
+} // namespace tensorpipe
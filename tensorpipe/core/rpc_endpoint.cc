@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/rpc_endpoint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+
+namespace tensorpipe {
+
+namespace {
+
+// Set in the tags of the responses, to tell them apart from the requests.
+constexpr uint64_t kResponseBit = 1ULL << 63;
+
+struct PendingCall {
+  enum State {
+    QUEUED,
+    WRITING,
+    AWAITING_RESPONSE,
+  };
+
+  State state{QUEUED};
+  RpcEndpoint::response_callback_fn fn;
+
+  // The outcome of the call may be known before its request has been written,
+  // in which case it's held here until then, as the user's buffers are still
+  // in use until that point.
+  bool isOutcomeKnown{false};
+  Error error;
+  Message response;
+};
+
+struct Shard {
+  std::mutex mutex;
+  std::unordered_map<uint64_t, PendingCall> calls;
+};
+
+struct QueuedRequest {
+  uint64_t callId;
+  Message request;
+};
+
+} // namespace
+
+class RpcEndpoint::Impl : public std::enable_shared_from_this<Impl> {
+ public:
+  Impl(
+      std::shared_ptr<Pipe> pipe,
+      request_handler_fn handler,
+      allocate_fn allocator,
+      size_t maxWritesInFlight,
+      size_t numShards);
+
+  void init();
+
+  uint64_t call(
+      Message request,
+      response_callback_fn fn,
+      optional<clock::time_point> deadline);
+
+  bool cancel(uint64_t callId);
+
+  void respond(uint64_t callId, Message response, write_callback_fn fn);
+
+  void close();
+
+  ~Impl();
+
+ private:
+  const std::shared_ptr<Pipe> pipe_;
+  const request_handler_fn handler_;
+  const allocate_fn allocator_;
+  const size_t maxWritesInFlight_;
+
+  std::atomic<uint64_t> nextCallId_{0};
+  std::vector<Shard> shards_;
+
+  // Guards the queue of requests and the error, which is set when the pipe
+  // fails, after which no call is queued anymore.
+  std::mutex sendMutex_;
+  std::deque<QueuedRequest> sendQueue_;
+  size_t numWritesInFlight_{0};
+  Error error_;
+
+  // The deadlines are enforced by a thread of our own, only started once a
+  // call has one. Its entries aren't removed when their call completes, and
+  // are just found to be stale when they're due.
+  std::mutex timerMutex_;
+  std::condition_variable timerCv_;
+  std::multimap<clock::time_point, uint64_t> deadlines_;
+  std::thread timerThread_;
+  bool closed_{false};
+
+  Shard& getShard_(uint64_t callId);
+
+  void addDeadline_(uint64_t callId, clock::time_point deadline);
+  void runTimer_();
+
+  void writeQueuedRequests_();
+  void onRequestWritten_(uint64_t callId, const Error& error);
+
+  void onDescriptor_(const Error& error, Message message);
+  void onMessage_(const Error& error, optional<uint64_t> tag, Message message);
+  void onResponse_(uint64_t callId, Message response);
+
+  // Complete the call with the given outcome, unless it already completed.
+  // Returns whether it did.
+  bool completeCall_(uint64_t callId, const Error& error, Message response);
+
+  void handleError_(const Error& error);
+};
+
+RpcEndpoint::Impl::Impl(
+    std::shared_ptr<Pipe> pipe,
+    request_handler_fn handler,
+    allocate_fn allocator,
+    size_t maxWritesInFlight,
+    size_t numShards)
+    : pipe_(std::move(pipe)),
+      handler_(std::move(handler)),
+      allocator_(std::move(allocator)),
+      maxWritesInFlight_(maxWritesInFlight),
+      shards_(numShards) {
+  TP_THROW_ASSERT_IF(maxWritesInFlight_ == 0)
+      << "An RPC endpoint must allow at least one write in flight";
+  TP_THROW_ASSERT_IF(shards_.empty())
+      << "An RPC endpoint must have at least one shard";
+}
+
+void RpcEndpoint::Impl::init() {
+  pipe_->readDescriptors(
+      [impl{shared_from_this()}](const Error& error, Message message) {
+        impl->onDescriptor_(error, std::move(message));
+      });
+}
+
+Shard& RpcEndpoint::Impl::getShard_(uint64_t callId) {
+  return shards_[callId % shards_.size()];
+}
+
+uint64_t RpcEndpoint::Impl::call(
+    Message request,
+    response_callback_fn fn,
+    optional<clock::time_point> deadline) {
+  TP_THROW_ASSERT_IF(request.tag.has_value())
+      << "The requests of an RPC endpoint can't have a tag";
+  const uint64_t callId = nextCallId_++ & ~kResponseBit;
+  request.tag = callId;
+
+  {
+    std::unique_lock<std::mutex> lock(sendMutex_);
+    if (error_) {
+      Error error = error_;
+      lock.unlock();
+      fn(error, Message());
+      return callId;
+    }
+    Shard& shard = getShard_(callId);
+    {
+      std::unique_lock<std::mutex> shardLock(shard.mutex);
+      PendingCall& pendingCall = shard.calls[callId];
+      pendingCall.fn = std::move(fn);
+    }
+    sendQueue_.push_back(QueuedRequest{callId, std::move(request)});
+  }
+
+  if (deadline.has_value()) {
+    addDeadline_(callId, deadline.value());
+  }
+  writeQueuedRequests_();
+  return callId;
+}
+
+bool RpcEndpoint::Impl::cancel(uint64_t callId) {
+  return completeCall_(callId, TP_CREATE_ERROR(RpcCancelledError), Message());
+}
+
+void RpcEndpoint::Impl::respond(
+    uint64_t callId,
+    Message response,
+    write_callback_fn fn) {
+  TP_THROW_ASSERT_IF(response.tag.has_value())
+      << "The responses of an RPC endpoint can't have a tag";
+  response.tag = callId | kResponseBit;
+  pipe_->write(std::move(response), std::move(fn));
+}
+
+void RpcEndpoint::Impl::close() {
+  {
+    std::unique_lock<std::mutex> lock(timerMutex_);
+    closed_ = true;
+    timerCv_.notify_all();
+  }
+  // The pending calls are failed once the pipe reports that it closed.
+  pipe_->close();
+}
+
+RpcEndpoint::Impl::~Impl() {
+  // The timer thread keeps the implementation alive while it runs, hence this
+  // may be invoked from it, when it releases its reference.
+  if (timerThread_.joinable()) {
+    if (timerThread_.get_id() == std::this_thread::get_id()) {
+      timerThread_.detach();
+    } else {
+      timerThread_.join();
+    }
+  }
+}
+
+void RpcEndpoint::Impl::addDeadline_(
+    uint64_t callId,
+    clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(timerMutex_);
+  if (closed_) {
+    return;
+  }
+  if (!timerThread_.joinable()) {
+    timerThread_ = std::thread(
+        [impl{shared_from_this()}]() { impl->runTimer_(); });
+  }
+  const bool isEarliest =
+      deadlines_.empty() || deadline < deadlines_.begin()->first;
+  deadlines_.emplace(deadline, callId);
+  if (isEarliest) {
+    timerCv_.notify_all();
+  }
+}
+
+void RpcEndpoint::Impl::runTimer_() {
+  std::unique_lock<std::mutex> lock(timerMutex_);
+  while (!closed_) {
+    if (deadlines_.empty()) {
+      timerCv_.wait(lock);
+      continue;
+    }
+    const clock::time_point earliest = deadlines_.begin()->first;
+    if (clock::now() < earliest) {
+      timerCv_.wait_until(lock, earliest);
+      continue;
+    }
+    std::vector<uint64_t> expiredCallIds;
+    while (!deadlines_.empty() &&
+           deadlines_.begin()->first <= clock::now()) {
+      expiredCallIds.push_back(deadlines_.begin()->second);
+      deadlines_.erase(deadlines_.begin());
+    }
+    lock.unlock();
+    for (uint64_t callId : expiredCallIds) {
+      completeCall_(callId, TP_CREATE_ERROR(RpcTimeoutError), Message());
+    }
+    lock.lock();
+  }
+}
+
+void RpcEndpoint::Impl::writeQueuedRequests_() {
+  // The requests are handed to the pipe outside of the lock, as the pipe may
+  // invoke the callback of a write from within the write itself if it failed.
+  std::vector<QueuedRequest> requestsToWrite;
+  {
+    std::unique_lock<std::mutex> lock(sendMutex_);
+    while (numWritesInFlight_ < maxWritesInFlight_ && !sendQueue_.empty()) {
+      QueuedRequest queuedRequest = std::move(sendQueue_.front());
+      sendQueue_.pop_front();
+      Shard& shard = getShard_(queuedRequest.callId);
+      std::unique_lock<std::mutex> shardLock(shard.mutex);
+      auto iter = shard.calls.find(queuedRequest.callId);
+      if (iter == shard.calls.end()) {
+        // The call was cancelled, or timed out, before its turn came.
+        continue;
+      }
+      TP_DCHECK_EQ(iter->second.state, PendingCall::QUEUED);
+      iter->second.state = PendingCall::WRITING;
+      ++numWritesInFlight_;
+      requestsToWrite.push_back(std::move(queuedRequest));
+    }
+  }
+
+  for (QueuedRequest& queuedRequest : requestsToWrite) {
+    pipe_->write(
+        std::move(queuedRequest.request),
+        [impl{shared_from_this()}, callId{queuedRequest.callId}](
+            const Error& error, Message /* unused */) {
+          impl->onRequestWritten_(callId, error);
+        });
+  }
+}
+
+void RpcEndpoint::Impl::onRequestWritten_(uint64_t callId, const Error& error) {
+  {
+    std::unique_lock<std::mutex> lock(sendMutex_);
+    --numWritesInFlight_;
+  }
+
+  Shard& shard = getShard_(callId);
+  std::unique_lock<std::mutex> shardLock(shard.mutex);
+  auto iter = shard.calls.find(callId);
+  TP_DCHECK(iter != shard.calls.end());
+  PendingCall& pendingCall = iter->second;
+  TP_DCHECK_EQ(pendingCall.state, PendingCall::WRITING);
+  if (error || pendingCall.isOutcomeKnown) {
+    PendingCall completedCall = std::move(pendingCall);
+    shard.calls.erase(iter);
+    shardLock.unlock();
+    if (error) {
+      completedCall.fn(error, Message());
+    } else {
+      completedCall.fn(
+          completedCall.error, std::move(completedCall.response));
+    }
+  } else {
+    pendingCall.state = PendingCall::AWAITING_RESPONSE;
+    shardLock.unlock();
+  }
+
+  writeQueuedRequests_();
+}
+
+void RpcEndpoint::Impl::onDescriptor_(const Error& error, Message message) {
+  if (error) {
+    handleError_(error);
+    return;
+  }
+  if (allocator_) {
+    allocator_(message);
+  }
+  const optional<uint64_t> tag = message.tag;
+  pipe_->read(
+      std::move(message),
+      [impl{shared_from_this()}, tag](const Error& error, Message message) {
+        impl->onMessage_(error, tag, std::move(message));
+      });
+}
+
+void RpcEndpoint::Impl::onMessage_(
+    const Error& error,
+    optional<uint64_t> tag,
+    Message message) {
+  if (error) {
+    handleError_(error);
+    return;
+  }
+  // Messages without a tag weren't sent by an endpoint, and are dropped.
+  if (!tag.has_value()) {
+    TP_VLOG(1) << "RPC endpoint is dropping a message without a tag";
+    return;
+  }
+  if (tag.value() & kResponseBit) {
+    onResponse_(tag.value() & ~kResponseBit, std::move(message));
+  } else {
+    handler_(tag.value(), std::move(message));
+  }
+}
+
+void RpcEndpoint::Impl::onResponse_(uint64_t callId, Message response) {
+  if (!completeCall_(callId, Error::kSuccess, std::move(response))) {
+    TP_VLOG(1) << "RPC endpoint is dropping the response to call " << callId
+               << ", which already completed";
+  }
+}
+
+bool RpcEndpoint::Impl::completeCall_(
+    uint64_t callId,
+    const Error& error,
+    Message response) {
+  Shard& shard = getShard_(callId);
+  std::unique_lock<std::mutex> shardLock(shard.mutex);
+  auto iter = shard.calls.find(callId);
+  if (iter == shard.calls.end()) {
+    return false;
+  }
+  PendingCall& pendingCall = iter->second;
+  if (pendingCall.state == PendingCall::WRITING) {
+    if (pendingCall.isOutcomeKnown) {
+      return false;
+    }
+    pendingCall.isOutcomeKnown = true;
+    pendingCall.error = error;
+    pendingCall.response = std::move(response);
+    return true;
+  }
+  // A queued call that is completed here (i.e., cancelled) stays in the queue,
+  // from which it's then dropped.
+  PendingCall completedCall = std::move(pendingCall);
+  shard.calls.erase(iter);
+  shardLock.unlock();
+  completedCall.fn(error, std::move(response));
+  return true;
+}
+
+void RpcEndpoint::Impl::handleError_(const Error& error) {
+  {
+    std::unique_lock<std::mutex> lock(sendMutex_);
+    if (error_) {
+      return;
+    }
+    error_ = error;
+    sendQueue_.clear();
+  }
+
+  // No call can be added from now on, as the error was set.
+  for (Shard& shard : shards_) {
+    std::vector<uint64_t> callIds;
+    {
+      std::unique_lock<std::mutex> shardLock(shard.mutex);
+      for (const auto& iter : shard.calls) {
+        callIds.push_back(iter.first);
+      }
+    }
+    for (uint64_t callId : callIds) {
+      completeCall_(callId, error, Message());
+    }
+  }
+}
+
+RpcEndpoint::RpcEndpoint(
+    std::shared_ptr<Pipe> pipe,
+    request_handler_fn handler,
+    allocate_fn allocator,
+    size_t maxWritesInFlight,
+    size_t numShards)
+    : impl_(std::make_shared<Impl>(
+          std::move(pipe),
+          std::move(handler),
+          std::move(allocator),
+          maxWritesInFlight,
+          numShards)) {
+  impl_->init();
+}
+
+uint64_t RpcEndpoint::call(
+    Message request,
+    response_callback_fn fn,
+    optional<clock::time_point> deadline) {
+  return impl_->call(std::move(request), std::move(fn), deadline);
+}
+
+bool RpcEndpoint::cancel(uint64_t callId) {
+  return impl_->cancel(callId);
+}
+
+void RpcEndpoint::respond(
+    uint64_t callId,
+    Message response,
+    write_callback_fn fn) {
+  impl_->respond(callId, std::move(response), std::move(fn));
+}
+
+void RpcEndpoint::close() {
+  impl_->close();
+}
+
+RpcEndpoint::~RpcEndpoint() {
+  close();
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/core/message.h>
+#include <tensorpipe/core/pipe.h>
+
+namespace tensorpipe {
+
+// Requests and responses over a pipe, matched by a correlation id that travels
+// as the tag of the messages (see Message::tag), hence in the descriptor. Both
+// sides of the pipe may issue calls and answer those of their peer. The
+// endpoint takes the pipe over: it reads all the incoming messages itself,
+// hence nothing else may read from the pipe, and closing the endpoint closes
+// the pipe.
+//
+// The calls that are pending a response are kept in a table split in shards,
+// so that calls issued and answered from different threads seldom contend.
+// Only up to maxWritesInFlight requests are handed to the pipe at a time, and
+// the others wait in a queue, from which those that are cancelled or that
+// time out before their turn are dropped without ever being sent.
+class RpcEndpoint final {
+ public:
+  static constexpr size_t kDefaultMaxWritesInFlight = 16;
+  static constexpr size_t kDefaultNumShards = 16;
+
+  using clock = std::chrono::steady_clock;
+
+  // Invoked for each incoming request, with the id to pass to respond.
+  using request_handler_fn = Function<void(uint64_t, Message)>;
+
+  // Invoked for each incoming message before it's read, to fill in the buffers
+  // of its payloads and tensors. Those left with a null pointer are allocated
+  // by the pipe, which only works for CPU memory, hence this is needed for
+  // messages with CUDA tensors.
+  using allocate_fn = Function<void(Message&)>;
+
+  RpcEndpoint(
+      std::shared_ptr<Pipe> pipe,
+      request_handler_fn handler,
+      allocate_fn allocator = nullptr,
+      size_t maxWritesInFlight = kDefaultMaxWritesInFlight,
+      size_t numShards = kDefaultNumShards);
+
+  RpcEndpoint(const RpcEndpoint&) = delete;
+  RpcEndpoint& operator=(const RpcEndpoint&) = delete;
+
+  using response_callback_fn = Function<void(const Error&, Message)>;
+
+  // Send a request, and invoke the callback with the response, or with an
+  // error if the call failed, was cancelled or didn't get a response by the
+  // deadline. The buffers of the request must remain valid until the callback
+  // is invoked. The request must not have a tag, as the endpoint sets it.
+  // Returns the id of the call, which can be passed to cancel.
+  uint64_t call(
+      Message request,
+      response_callback_fn fn,
+      optional<clock::time_point> deadline = nullopt);
+
+  // Give up on a call, whose callback is then invoked with an RpcCancelledError
+  // (once its request has been written, if it's being written). Its response,
+  // if it arrives, is discarded. Returns false if the call already completed.
+  bool cancel(uint64_t callId);
+
+  using write_callback_fn = Function<void(const Error&, Message)>;
+
+  // Send the response to the request with the given id. The callback is
+  // invoked, as for Pipe::write, once the response has been written.
+  void respond(uint64_t callId, Message response, write_callback_fn fn);
+
+  // Fail all the pending calls and close the pipe.
+  void close();
+
+  ~RpcEndpoint();
+
+ private:
+  class Impl;
+
+  // Using a shared_ptr allows the callbacks to keep the implementation alive
+  // after the public object is destroyed.
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace tensorpipe
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/traffic_recorder.h>
+
+#include <cstring>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/nop.h>
+
+namespace tensorpipe {
+
+namespace {
+
+constexpr char kMagic[] = "TPTRAFF1";
+constexpr size_t kMagicLength = sizeof(kMagic) - 1;
+
+} // namespace
+
+TrafficRecorder::TrafficRecorder(const std::string& path)
+    : file_(std::fopen(path.c_str(), "wb")) {
+  TP_THROW_SYSTEM_IF(file_ == nullptr, errno) << "Cannot open " << path;
+  TP_THROW_SYSTEM_IF(
+      std::fwrite(kMagic, 1, kMagicLength, file_) != kMagicLength, errno);
+}
+
+uint64_t TrafficRecorder::registerPipe() {
+  return nextPipeIdx_++;
+}
+
+void TrafficRecorder::recordWrite(
+    uint64_t pipeIdx,
+    const Message& message,
+    uint64_t priorityClass) {
+  NopHolder<TrafficRecord> nopHolder;
+  TrafficRecord& record = nopHolder.getObject();
+  record.timestampNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count();
+  record.pipeIdx = pipeIdx;
+  record.priorityClass = priorityClass;
+  record.metadataLength = message.metadata.size();
+  for (const Message::Payload& payload : message.payloads) {
+    record.payloadLengths.push_back(payload.length);
+  }
+  for (const Message::Tensor& tensor : message.tensors) {
+    TrafficRecord::Tensor recordTensor;
+    recordTensor.deviceType = tensor.buffer.type;
+    switch (tensor.buffer.type) {
+      case DeviceType::kCpu:
+        recordTensor.length = tensor.buffer.cpu.length;
+        break;
+#if TENSORPIPE_SUPPORTS_CUDA
+      case DeviceType::kCuda:
+        recordTensor.length = tensor.buffer.cuda.length;
+        break;
+#endif // TENSORPIPE_SUPPORTS_CUDA
+      default:
+        TP_THROW_ASSERT() << "Unexpected device type.";
+    }
+    record.tensors.push_back(std::move(recordTensor));
+  }
+
+  const uint32_t length = nopHolder.getSize();
+  std::vector<uint8_t> buffer(sizeof(length) + length);
+  std::memcpy(buffer.data(), &length, sizeof(length));
+  NopWriter writer(buffer.data() + sizeof(length), length);
+  nop::Status<void> status = nopHolder.write(writer);
+  TP_THROW_ASSERT_IF(status.has_error())
+      << "Error serializing traffic record: " << status.GetErrorMessage();
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  TP_THROW_SYSTEM_IF(
+      std::fwrite(buffer.data(), 1, buffer.size(), file_) != buffer.size(),
+      errno);
+}
+
+TrafficRecorder::~TrafficRecorder() {
+  std::fclose(file_);
+}
+
+TrafficTraceReader::TrafficTraceReader(const std::string& path)
+    : file_(std::fopen(path.c_str(), "rb")) {
+  TP_THROW_SYSTEM_IF(file_ == nullptr, errno) << "Cannot open " << path;
+  char magic[kMagicLength];
+  TP_THROW_ASSERT_IF(
+      std::fread(magic, 1, kMagicLength, file_) != kMagicLength ||
+      std::memcmp(magic, kMagic, kMagicLength) != 0)
+      << path << " is not a traffic trace";
+}
+
+bool TrafficTraceReader::next(TrafficRecord& record) {
+  uint32_t length;
+  if (std::fread(&length, 1, sizeof(length), file_) != sizeof(length)) {
+    return false;
+  }
+  buffer_.resize(length);
+  TP_THROW_ASSERT_IF(std::fread(buffer_.data(), 1, length, file_) != length)
+      << "Truncated traffic trace";
+
+  NopHolder<TrafficRecord> nopHolder;
+  NopReader reader(buffer_.data(), length);
+  nop::Status<void> status = nopHolder.read(reader);
+  TP_THROW_ASSERT_IF(status.has_error())
+      << "Error parsing traffic record: " << status.GetErrorMessage();
+  record = std::move(nopHolder.getObject());
+  return true;
+}
+
+TrafficTraceReader::~TrafficTraceReader() {
+  std::fclose(file_);
+}
+
+} // namespace tensorpipe
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+#include <tensorpipe/core/buffer.h>
+#include <tensorpipe/core/message.h>
+
+namespace tensorpipe {
+
+// The shape of a message written by a pipe, without any of its data, as it is
+// stored in a traffic trace.
+struct TrafficRecord {
+  struct Tensor {
+    // This pointless constructor is needed to work around a bug in GCC 5.5 (and
+    // possibly other versions). It appears to be needed in the nop types that
+    // are used inside std::vectors.
+    Tensor(){};
+
+    uint64_t length;
+    DeviceType deviceType;
+    NOP_STRUCTURE(Tensor, length, deviceType);
+  };
+
+  // Since the recording started.
+  uint64_t timestampNs;
+  // Pipes are numbered in the order in which they were created.
+  uint64_t pipeIdx;
+  uint64_t priorityClass;
+  uint64_t metadataLength;
+  std::vector<uint64_t> payloadLengths;
+  std::vector<Tensor> tensors;
+  NOP_STRUCTURE(
+      TrafficRecord,
+      timestampNs,
+      pipeIdx,
+      priorityClass,
+      metadataLength,
+      payloadLengths,
+      tensors);
+};
+
+// Records the shapes of all the messages that the pipes of a context write, and
+// when they write them, to a file, so that a realistic mix of traffic can then
+// be replayed against other transports and channels. The file starts with a
+// magic string, followed by the records, each serialized with nop and preceded
+// by its length. Writes go through a buffered stream under a lock, hence this
+// is meant for capturing a workload and not to be left on in production.
+class TrafficRecorder final {
+ public:
+  explicit TrafficRecorder(const std::string& path);
+
+  TrafficRecorder(const TrafficRecorder&) = delete;
+  TrafficRecorder& operator=(const TrafficRecorder&) = delete;
+
+  // Return the index that identifies a new pipe in the records.
+  uint64_t registerPipe();
+
+  void recordWrite(
+      uint64_t pipeIdx,
+      const Message& message,
+      uint64_t priorityClass);
+
+  ~TrafficRecorder();
+
+ private:
+  std::mutex mutex_;
+  std::FILE* file_;
+  const std::chrono::steady_clock::time_point start_{
+      std::chrono::steady_clock::now()};
+  std::atomic<uint64_t> nextPipeIdx_{0};
+};
+
+// Reads back the records of a file written by a TrafficRecorder, in order.
+class TrafficTraceReader final {
+ public:
+  explicit TrafficTraceReader(const std::string& path);
+
+  TrafficTraceReader(const TrafficTraceReader&) = delete;
+  TrafficTraceReader& operator=(const TrafficTraceReader&) = delete;
+
+  // Return false once there are no more records.
+  bool next(TrafficRecord& record);
+
+  ~TrafficTraceReader();
+
+ private:
+  std::FILE* file_;
+  std::vector<uint8_t> buffer_;
+};
+
+} // namespace tensorpipe
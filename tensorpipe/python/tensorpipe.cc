@@ -6,15 +6,24 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <deque>
+#include <future>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include <pybind11/chrono.h>
 #include <pybind11/functional.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <tensorpipe/common/cpu_budget.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/tensorpipe.h>
 
@@ -24,6 +33,69 @@ namespace {
 
 using tensorpipe::optional;
 
+// Runs the tasks that need the GIL, which the internal threads hand to it as
+// their operations complete. Whichever thread finds that no other one is at it
+// acquires the GIL and runs all the tasks that are queued, including the ones
+// that are handed over in the meantime, so that a burst of completions takes
+// the GIL only once, and all the other threads go on without waiting for it.
+class GilBatcher {
+ public:
+  void run(tensorpipe::Function<void()> task) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+      if (isDraining_) {
+        return;
+      }
+      isDraining_ = true;
+    }
+    py::gil_scoped_acquire acquire;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!tasks_.empty()) {
+      std::deque<tensorpipe::Function<void()>> tasks;
+      std::swap(tasks, tasks_);
+      lock.unlock();
+      for (auto& task : tasks) {
+        task();
+      }
+      // The tasks hold Python objects, hence they're destroyed with the GIL.
+      tasks.clear();
+      lock.lock();
+    }
+    isDraining_ = false;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<tensorpipe::Function<void()>> tasks_;
+  bool isDraining_{false};
+};
+
+GilBatcher& getGilBatcher() {
+  // Leaked, as it may still be used by the internal threads at exit.
+  static GilBatcher* batcher = new GilBatcher();
+  return *batcher;
+}
+
+// Have fn invoke the callback with the GIL, in a batch, and then drop the
+// callback there too, as releasing the last reference to it needs the GIL. No
+// exception may escape, as it would stop the batch (and the batcher) halfway,
+// hence those of the callback, and those of fn (e.g., when an allocator
+// returns a buffer of the wrong length), are logged.
+void callWithGil(
+    py::object callback,
+    tensorpipe::Function<void(py::object&)> fn) {
+  getGilBatcher().run(
+      [callback{std::move(callback)}, fn{std::move(fn)}]() mutable {
+        try {
+          fn(callback);
+        } catch (const std::exception& err) {
+          TP_LOG_ERROR() << "Callback raised exception: " << err.what();
+        }
+        callback = py::object();
+      });
+}
+
 // RAII wrapper to reliably release every buffer we get.
 class BufferWrapper {
  public:
@@ -197,6 +269,26 @@ std::shared_ptr<IncomingMessage> prepareToAllocate(
   return pyMessage;
 }
 
+// Give the message buffers obtained from the allocator (e.g., numpy.empty, or a
+// function returning the storage of a torch tensor), which is passed the
+// length of each payload and tensor, or bytearrays if it's None, so that the
+// data lands straight into them. Must be called with the GIL.
+void allocate(IncomingMessage& pyMessage, const py::object& allocator) {
+  auto allocateOne = [&](size_t length) -> py::buffer {
+    if (allocator.is_none()) {
+      return py::reinterpret_steal<py::buffer>(
+          PyByteArray_FromStringAndSize(nullptr, length));
+    }
+    return allocator(length).cast<py::buffer>();
+  };
+  for (const auto& pyPayload : pyMessage.payloads) {
+    pyPayload->set_buffer(allocateOne(pyPayload->length));
+  }
+  for (const auto& pyTensor : pyMessage.tensors) {
+    pyTensor->set_buffer(allocateOne(pyTensor->length));
+  }
+}
+
 tensorpipe::Message prepareToRead(std::shared_ptr<IncomingMessage> pyMessage) {
   tensorpipe::Message tpMessage;
   tpMessage.payloads.reserve(pyMessage->payloads.size());
@@ -216,6 +308,116 @@ tensorpipe::Message prepareToRead(std::shared_ptr<IncomingMessage> pyMessage) {
   return tpMessage;
 }
 
+// Delivers the completions of the operations started through it to an asyncio
+// event loop, as the results of the futures it returns for them. The pipes
+// append the completions to a CompletionQueue, whose eventfd the loop watches,
+// and the loop then resolves all of those that arrived meanwhile in one go, on
+// its own thread, hence the internal threads never take the GIL. It must only
+// be used from the loop's thread, and must outlive the operations.
+class AsyncioQueue : public std::enable_shared_from_this<AsyncioQueue> {
+ public:
+  explicit AsyncioQueue(py::object loop) : loop_(std::move(loop)) {}
+
+  void start() {
+    std::weak_ptr<AsyncioQueue> weakSelf = shared_from_this();
+    loop_.attr("add_reader")(
+        queue_.getEventFd(), py::cpp_function([weakSelf]() {
+          std::shared_ptr<AsyncioQueue> self = weakSelf.lock();
+          if (self != nullptr) {
+            self->drain();
+          }
+        }));
+  }
+
+  py::object write(
+      std::shared_ptr<tensorpipe::Pipe> pipe,
+      std::shared_ptr<OutgoingMessage> pyMessage) {
+    const uint64_t tag = nextTag_++;
+    Operation& op = operations_[tag];
+    op.future = loop_.attr("create_future")();
+    // The buffers must be kept until the write completes.
+    op.outgoingMessage = pyMessage;
+    pipe->write(prepareToWrite(std::move(pyMessage)), queue_.makeCallback(tag));
+    return op.future;
+  }
+
+  // See allocate for the allocator.
+  py::object readMessage(
+      std::shared_ptr<tensorpipe::Pipe> pipe,
+      py::object allocator) {
+    const uint64_t tag = nextTag_++;
+    Operation& op = operations_[tag];
+    op.future = loop_.attr("create_future")();
+    op.pipe = pipe;
+    op.allocator = std::move(allocator);
+    pipe->readDescriptor(queue_.makeCallback(tag));
+    return op.future;
+  }
+
+  void drain() {
+    std::vector<tensorpipe::CompletionQueue::Completion> completions;
+    queue_.poll(completions, std::numeric_limits<size_t>::max());
+    for (auto& completion : completions) {
+      auto iter = operations_.find(completion.tag);
+      TP_DCHECK(iter != operations_.end());
+      Operation& op = iter->second;
+      py::object error = py::none();
+      if (completion.error) {
+        error = py::module::import("builtins")
+                    .attr("RuntimeError")(completion.error.what());
+      } else if (op.pipe != nullptr && op.incomingMessage == nullptr) {
+        // The descriptor of a read is in, hence its data can be read, with the
+        // same tag, into the buffers obtained from the allocator.
+        try {
+          op.incomingMessage = prepareToAllocate(completion.message);
+          allocate(*op.incomingMessage, op.allocator);
+          op.pipe->read(
+              prepareToRead(op.incomingMessage),
+              queue_.makeCallback(completion.tag));
+          continue;
+        } catch (const py::error_already_set& err) {
+          error = err.value();
+        } catch (const std::exception& err) {
+          // E.g., the allocator returned a buffer of the wrong length. This
+          // must not escape, as the other completions would then be lost.
+          error =
+              py::module::import("builtins").attr("RuntimeError")(err.what());
+        }
+      }
+      if (!op.future.attr("done")().cast<bool>()) {
+        if (!error.is_none()) {
+          op.future.attr("set_exception")(error);
+        } else if (op.incomingMessage != nullptr) {
+          op.future.attr("set_result")(op.incomingMessage);
+        } else {
+          op.future.attr("set_result")(py::none());
+        }
+      }
+      // The allocator may have started operations, which invalidates iter.
+      operations_.erase(completion.tag);
+    }
+  }
+
+  void close() {
+    loop_.attr("remove_reader")(queue_.getEventFd());
+  }
+
+ private:
+  struct Operation {
+    py::object future;
+    std::shared_ptr<OutgoingMessage> outgoingMessage;
+    // Only for reads.
+    std::shared_ptr<tensorpipe::Pipe> pipe;
+    py::object allocator;
+    std::shared_ptr<IncomingMessage> incomingMessage;
+  };
+
+  py::object loop_;
+  tensorpipe::CompletionQueue queue_;
+  uint64_t nextTag_{0};
+  std::unordered_map<uint64_t, Operation> operations_;
+};
+
 template <typename T>
 using shared_ptr_class_ = py::class_<T, std::shared_ptr<T>>;
 
@@ -288,7 +490,67 @@ PYBIND11_MODULE(pytensorpipe, module) {
 
   // Creators.
 
-  context.def(py::init<>());
+  // The callback executor and the allocator can't be given from Python, as
+  // they'd be invoked from the internal threads.
+  py::class_<tensorpipe::ContextOptions> contextOptions(
+      module, "ContextOptions");
+  contextOptions.def(py::init<>());
+  contextOptions.def_readwrite("name", &tensorpipe::ContextOptions::name_);
+  contextOptions.def_readwrite(
+      "inline_tensor_threshold",
+      &tensorpipe::ContextOptions::inlineTensorThreshold_);
+  contextOptions.def_readwrite(
+      "tensor_packing_threshold",
+      &tensorpipe::ContextOptions::tensorPackingThreshold_);
+  contextOptions.def_readwrite(
+      "early_message_descriptors",
+      &tensorpipe::ContextOptions::earlyMessageDescriptors_);
+  contextOptions.def_readwrite(
+      "out_of_order_completion",
+      &tensorpipe::ContextOptions::outOfOrderCompletion_);
+  contextOptions.def_readwrite(
+      "num_priority_classes", &tensorpipe::ContextOptions::numPriorityClasses_);
+  contextOptions.def_readwrite(
+      "write_coalescing_limit",
+      &tensorpipe::ContextOptions::writeCoalescingLimit_);
+  contextOptions.def_readwrite(
+      "descriptor_string_interning",
+      &tensorpipe::ContextOptions::descriptorStringInterning_);
+  contextOptions.def_readwrite(
+      "compact_message_descriptors",
+      &tensorpipe::ContextOptions::compactMessageDescriptors_);
+  contextOptions.def_readwrite(
+      "deduplicate_buffers", &tensorpipe::ContextOptions::deduplicateBuffers_);
+  contextOptions.def_readwrite(
+      "channel_auto_tuning", &tensorpipe::ContextOptions::channelAutoTuning_);
+  contextOptions.def_readwrite(
+      "payload_chunk_size", &tensorpipe::ContextOptions::payloadChunkSize_);
+  contextOptions.def_readwrite(
+      "lazy_channel_establishment",
+      &tensorpipe::ContextOptions::lazyChannelEstablishment_);
+  contextOptions.def_readwrite(
+      "speculative_channel_connections",
+      &tensorpipe::ContextOptions::speculativeChannelConnections_);
+  contextOptions.def_readwrite(
+      "transport_upgrade", &tensorpipe::ContextOptions::transportUpgrade_);
+  contextOptions.def_readwrite(
+      "max_outstanding_writes_per_pipe",
+      &tensorpipe::ContextOptions::maxOutstandingWritesPerPipe_);
+  contextOptions.def_readwrite(
+      "max_outstanding_write_bytes_per_pipe",
+      &tensorpipe::ContextOptions::maxOutstandingWriteBytesPerPipe_);
+  contextOptions.def_readwrite(
+      "max_outstanding_write_bytes",
+      &tensorpipe::ContextOptions::maxOutstandingWriteBytes_);
+  contextOptions.def_readwrite(
+      "allocator_memory_budget",
+      &tensorpipe::ContextOptions::allocatorMemoryBudget_);
+  contextOptions.def_readwrite(
+      "traffic_trace_path", &tensorpipe::ContextOptions::trafficTracePath_);
+
+  context.def(
+      py::init<tensorpipe::ContextOptions>(),
+      py::arg("options") = tensorpipe::ContextOptions());
   context.def(
       "listen",
       [](std::shared_ptr<tensorpipe::Context> context,
@@ -318,20 +580,15 @@ PYBIND11_MODULE(pytensorpipe, module) {
                              std::shared_ptr<tensorpipe::Pipe> pipe) mutable {
           if (error) {
             TP_LOG_ERROR() << error.what();
+            callWithGil(std::move(callback), [](py::object& /* unused */) {});
             return;
           }
           TP_THROW_ASSERT_IF(!pipe) << "No pipe";
-          py::gil_scoped_acquire acquire;
-          try {
-            callback(std::move(pipe));
-          } catch (const py::error_already_set& err) {
-            TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-          }
-          // Leaving the scope will decrease the refcount of callback which
-          // may cause it to get destructed, which might segfault since we
-          // won't be holding the GIL anymore. So we reset callback now,
-          // while we're still holding the GIL.
-          callback = py::object();
+          callWithGil(
+              std::move(callback),
+              [pipe{std::move(pipe)}](py::object& callback) mutable {
+                callback(std::move(pipe));
+              });
         });
       });
 
@@ -343,22 +600,72 @@ PYBIND11_MODULE(pytensorpipe, module) {
                                  tensorpipe::Message message) mutable {
           if (error) {
             TP_LOG_ERROR() << error.what();
+            callWithGil(std::move(callback), [](py::object& /* unused */) {});
             return;
           }
-          py::gil_scoped_acquire acquire;
-          try {
-            callback(prepareToAllocate(std::move(message)));
-          } catch (const py::error_already_set& err) {
-            TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-          }
-          // Leaving the scope will decrease the refcount of callback which
-          // may cause it to get destructed, which might segfault since we
-          // won't be holding the GIL anymore. So we reset callback now,
-          // while we're still holding the GIL.
-          callback = py::object();
+          callWithGil(
+              std::move(callback),
+              [message{std::move(message)}](py::object& callback) {
+                callback(prepareToAllocate(message));
+              });
         });
       });
 
+  // Reads the next message into the buffers that the allocator returns (see
+  // allocate), in one go, without a Python round trip between the descriptor
+  // and the data, and then passes the message to the callback.
+  pipe.def(
+      "read_message",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         py::object allocator,
+         py::object callback) {
+        pipe->readDescriptor([pipe,
+                              allocator{std::move(allocator)},
+                              callback{std::move(callback)}](
+                                 const tensorpipe::Error& error,
+                                 tensorpipe::Message message) mutable {
+          if (error) {
+            TP_LOG_ERROR() << error.what();
+            callWithGil(
+                std::move(callback),
+                [allocator{std::move(allocator)}](py::object& /* unused */) {});
+            return;
+          }
+          callWithGil(
+              std::move(callback),
+              [pipe{std::move(pipe)},
+               allocator{std::move(allocator)},
+               message{std::move(message)}](py::object& callback) mutable {
+                std::shared_ptr<IncomingMessage> pyMessage =
+                    prepareToAllocate(message);
+                allocate(*pyMessage, allocator);
+                allocator = py::object();
+                pipe->read(
+                    prepareToRead(pyMessage),
+                    [pyMessage, callback{std::move(callback)}](
+                        const tensorpipe::Error& error,
+                        tensorpipe::Message /* unused */) mutable {
+                      if (error) {
+                        TP_LOG_ERROR() << error.what();
+                        callWithGil(
+                            std::move(callback),
+                            [pyMessage{std::move(pyMessage)}](
+                                py::object& /* unused */) {});
+                        return;
+                      }
+                      callWithGil(
+                          std::move(callback),
+                          [pyMessage{std::move(pyMessage)}](
+                              py::object& callback) {
+                            callback(pyMessage);
+                          });
+                    });
+              });
+        });
+      },
+      py::arg("allocator"),
+      py::arg("callback"));
+
   pipe.def(
       "read",
       [](std::shared_ptr<tensorpipe::Pipe> pipe,
@@ -369,22 +676,16 @@ PYBIND11_MODULE(pytensorpipe, module) {
             std::move(tpMessage),
             [callback{std::move(callback)}](
                 const tensorpipe::Error& error,
-                tensorpipe::Message tpMessage) mutable {
+                tensorpipe::Message /* unused */) mutable {
               if (error) {
                 TP_LOG_ERROR() << error.what();
+                callWithGil(
+                    std::move(callback), [](py::object& /* unused */) {});
                 return;
               }
-              py::gil_scoped_acquire acquire;
-              try {
+              callWithGil(std::move(callback), [](py::object& callback) {
                 callback();
-              } catch (const py::error_already_set& err) {
-                TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-              }
-              // Leaving the scope will decrease the refcount of callback which
-              // may cause it to get destructed, which might segfault since we
-              // won't be holding the GIL anymore. So we reset callback now,
-              // while we're still holding the GIL.
-              callback = py::object();
+              });
             });
       });
 
@@ -398,40 +699,462 @@ PYBIND11_MODULE(pytensorpipe, module) {
             std::move(tpMessage),
             [callback{std::move(callback)}](
                 const tensorpipe::Error& error,
-                tensorpipe::Message tpMessage) mutable {
+                tensorpipe::Message /* unused */) mutable {
               if (error) {
                 TP_LOG_ERROR() << error.what();
+                callWithGil(
+                    std::move(callback), [](py::object& /* unused */) {});
                 return;
               }
-              py::gil_scoped_acquire acquire;
-              try {
+              callWithGil(std::move(callback), [](py::object& callback) {
                 callback();
-              } catch (const py::error_already_set& err) {
-                TP_LOG_ERROR() << "Callback raised exception: " << err.what();
-              }
-              // Leaving the scope will decrease the refcount of callback which
-              // may cause it to get destructed, which might segfault since we
-              // won't be holding the GIL anymore. So we reset callback now,
-              // while we're still holding the GIL.
-              callback = py::object();
+              });
             });
       });
 
-  // Transports and channels
+  // Operations whose completions are delivered to an asyncio loop, which
+  // return futures, as in:
+  //
+  //   queue = AsyncioQueue(asyncio.get_running_loop())
+  //   await pipe.write_async(message, queue)
+  //   message = await pipe.read_message_async(numpy.empty, queue)
+
+  shared_ptr_class_<AsyncioQueue> asyncioQueue(module, "AsyncioQueue");
+  asyncioQueue.def(
+      py::init([](py::object loop) {
+        auto queue = std::make_shared<AsyncioQueue>(std::move(loop));
+        queue->start();
+        return queue;
+      }),
+      py::arg("loop"));
+  asyncioQueue.def("close", &AsyncioQueue::close);
+
+  pipe.def(
+      "write_async",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         std::shared_ptr<OutgoingMessage> pyMessage,
+         AsyncioQueue& queue) {
+        return queue.write(std::move(pipe), std::move(pyMessage));
+      },
+      py::arg("message"),
+      py::arg("queue"));
+
+  pipe.def(
+      "read_message_async",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         py::object allocator,
+         AsyncioQueue& queue) {
+        return queue.readMessage(std::move(pipe), std::move(allocator));
+      },
+      py::arg("allocator"),
+      py::arg("queue"));
+
+  // Blocking operations, which release the GIL while they wait, and raise a
+  // RuntimeError if they fail.
+
+  listener.def(
+      "accept_sync",
+      [](std::shared_ptr<tensorpipe::Listener> listener) {
+        py::gil_scoped_release release;
+        std::promise<std::shared_ptr<tensorpipe::Pipe>> promise;
+        listener->accept([&](const tensorpipe::Error& error,
+                             std::shared_ptr<tensorpipe::Pipe> pipe) {
+          if (error) {
+            promise.set_exception(
+                std::make_exception_ptr(std::runtime_error(error.what())));
+          } else {
+            promise.set_value(std::move(pipe));
+          }
+        });
+        return promise.get_future().get();
+      });
+
+  pipe.def(
+      "write_sync",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe,
+         std::shared_ptr<OutgoingMessage> pyMessage) {
+        tensorpipe::Message tpMessage = prepareToWrite(pyMessage);
+        py::gil_scoped_release release;
+        std::promise<void> promise;
+        pipe->write(
+            std::move(tpMessage),
+            [&](const tensorpipe::Error& error,
+                tensorpipe::Message /* unused */) {
+              if (error) {
+                promise.set_exception(
+                    std::make_exception_ptr(std::runtime_error(error.what())));
+              } else {
+                promise.set_value();
+              }
+            });
+        promise.get_future().get();
+      },
+      py::arg("message"));
+
+  // The allocator, if any, is called from this thread (see read_message).
+  pipe.def(
+      "read_message_sync",
+      [](std::shared_ptr<tensorpipe::Pipe> pipe, py::object allocator) {
+        tensorpipe::Message message;
+        {
+          py::gil_scoped_release release;
+          std::promise<tensorpipe::Message> promise;
+          pipe->readDescriptor([&](const tensorpipe::Error& error,
+                                   tensorpipe::Message message) {
+            if (error) {
+              promise.set_exception(
+                  std::make_exception_ptr(std::runtime_error(error.what())));
+            } else {
+              promise.set_value(std::move(message));
+            }
+          });
+          message = promise.get_future().get();
+        }
+        std::shared_ptr<IncomingMessage> pyMessage = prepareToAllocate(message);
+        allocate(*pyMessage, allocator);
+        tensorpipe::Message tpMessage = prepareToRead(pyMessage);
+        {
+          py::gil_scoped_release release;
+          std::promise<void> promise;
+          pipe->read(
+              std::move(tpMessage),
+              [&](const tensorpipe::Error& error,
+                  tensorpipe::Message /* unused */) {
+                if (error) {
+                  promise.set_exception(std::make_exception_ptr(
+                      std::runtime_error(error.what())));
+                } else {
+                  promise.set_value();
+                }
+              });
+          promise.get_future().get();
+        }
+        return pyMessage;
+      },
+      py::arg("allocator") = py::none());
+
+  context.def(
+      "close",
+      &tensorpipe::Context::close,
+      py::call_guard<py::gil_scoped_release>());
+
+  // Transports and channels, with their tuning options, for those that the
+  // build supports.
+
+  py::class_<tensorpipe::BusyPollingPolicy> busyPollingPolicy(
+      module, "BusyPollingPolicy");
+  busyPollingPolicy.def(py::init<>());
+  busyPollingPolicy.def_readwrite(
+      "spin_for", &tensorpipe::BusyPollingPolicy::spinFor);
+  busyPollingPolicy.def_readwrite(
+      "yield_for", &tensorpipe::BusyPollingPolicy::yieldFor);
+  busyPollingPolicy.def_readwrite(
+      "sleep_for", &tensorpipe::BusyPollingPolicy::sleepFor);
+  busyPollingPolicy.def_static(
+      "adaptive", &tensorpipe::BusyPollingPolicy::adaptive);
+
+  // The CPU budget of the process, in CPUs, with zero meaning none. It only
+  // affects the contexts created afterwards.
+  module.def(
+      "set_cpu_budget",
+      [](double numCpus) {
+        tensorpipe::setCpuBudget(
+            numCpus > 0 ? tensorpipe::optional<double>(numCpus)
+                        : tensorpipe::nullopt);
+      },
+      py::arg("num_cpus"));
+  module.def("get_cpu_budget", []() {
+    return tensorpipe::getCpuBudget().value_or(0);
+  });
+
+  py::class_<tensorpipe::IbvDeviceOptions> ibvDeviceOptions(
+      module, "IbvDeviceOptions");
+  ibvDeviceOptions.def(py::init<>());
+  ibvDeviceOptions.def_readwrite(
+      "device_name", &tensorpipe::IbvDeviceOptions::deviceName);
+  ibvDeviceOptions.def_readwrite(
+      "numa_node", &tensorpipe::IbvDeviceOptions::numaNode);
+  ibvDeviceOptions.def_readwrite(
+      "port_num", &tensorpipe::IbvDeviceOptions::portNum);
+  ibvDeviceOptions.def_readwrite(
+      "global_identifier_index",
+      &tensorpipe::IbvDeviceOptions::globalIdentifierIndex);
+  ibvDeviceOptions.def_readwrite(
+      "on_demand_paging", &tensorpipe::IbvDeviceOptions::onDemandPaging);
 
   shared_ptr_class_<tensorpipe::transport::Context> abstractTransport(
       module, "AbstractTransport");
 
+  py::class_<tensorpipe::transport::uv::LowLatencyOptions> lowLatencyOptions(
+      module, "UvLowLatencyOptions");
+  lowLatencyOptions.def(py::init<>());
+  lowLatencyOptions.def_readwrite(
+      "socket_busy_poll",
+      &tensorpipe::transport::uv::LowLatencyOptions::socketBusyPoll);
+  lowLatencyOptions.def_readwrite(
+      "prefer_busy_poll",
+      &tensorpipe::transport::uv::LowLatencyOptions::preferBusyPoll);
+  lowLatencyOptions.def_readwrite(
+      "quick_ack", &tensorpipe::transport::uv::LowLatencyOptions::quickAck);
+  lowLatencyOptions.def_readwrite(
+      "busy_poll_loops",
+      &tensorpipe::transport::uv::LowLatencyOptions::busyPollLoops);
+  lowLatencyOptions.def_static(
+      "aggressive", &tensorpipe::transport::uv::LowLatencyOptions::aggressive);
+
+  // The TLS handshake and the socket buffers can't be given from Python.
+  using UvContextOptions = tensorpipe::transport::uv::ContextOptions;
+  py::class_<UvContextOptions> uvContextOptions(module, "UvContextOptions");
+  uvContextOptions.def(py::init<>());
+  uvContextOptions.def_readwrite("num_loops", &UvContextOptions::numLoops);
+  uvContextOptions.def_readwrite("loop_cpus", &UvContextOptions::loopCpus);
+  uvContextOptions.def_readwrite(
+      "read_ahead_size", &UvContextOptions::readAheadSize);
+  uvContextOptions.def_readwrite("low_latency", &UvContextOptions::lowLatency);
+  uvContextOptions.def_readwrite(
+      "unix_sockets", &UvContextOptions::unixSockets);
+  uvContextOptions.def_readwrite(
+      "shard_listeners", &UvContextOptions::shardListeners);
+  uvContextOptions.def_readwrite(
+      "zero_copy_receive_threshold",
+      &UvContextOptions::zeroCopyReceiveThreshold);
+  uvContextOptions.def_readwrite(
+      "listen_backlog", &UvContextOptions::listenBacklog);
+  uvContextOptions.def("validate", &UvContextOptions::validate);
+  uvContextOptions.def("__repr__", &UvContextOptions::str);
+  uvContextOptions.def_static(
+      "from_environment",
+      py::overload_cast<UvContextOptions>(&UvContextOptions::fromEnvironment),
+      py::arg("options") = UvContextOptions());
+
   transport_class_<tensorpipe::transport::uv::Context> uvTransport(
       module, "UvTransport");
-  uvTransport.def(py::init<>());
+  uvTransport.def(py::init<UvContextOptions>(), py::arg("options"));
+  uvTransport.def(
+      "get_options",
+      &tensorpipe::transport::uv::Context::getOptions,
+      py::return_value_policy::copy);
+  uvTransport.def(
+      py::init([](size_t numLoops,
+                  std::vector<std::vector<int>> loopCpus,
+                  size_t readAheadSize,
+                  tensorpipe::transport::uv::LowLatencyOptions lowLatency,
+                  bool unixSockets,
+                  bool shardListeners) {
+        return std::make_shared<tensorpipe::transport::uv::Context>(
+            numLoops,
+            std::move(loopCpus),
+            readAheadSize,
+            lowLatency,
+            unixSockets,
+            /*tlsHandshake=*/nullptr,
+            shardListeners);
+      }),
+      py::arg("num_loops") = 1,
+      py::arg("loop_cpus") = std::vector<std::vector<int>>(),
+      py::arg("read_ahead_size") = 0,
+      py::arg("low_latency") = tensorpipe::transport::uv::LowLatencyOptions(),
+      py::arg("unix_sockets") = false,
+      py::arg("shard_listeners") = false);
 
 #if TENSORPIPE_HAS_SHM_TRANSPORT
+  using ShmContextOptions = tensorpipe::transport::shm::ContextOptions;
+  py::class_<ShmContextOptions> shmContextOptions(module, "ShmContextOptions");
+  shmContextOptions.def(py::init<>());
+  shmContextOptions.def_readwrite("policy", &ShmContextOptions::policy);
+  shmContextOptions.def_readwrite("inbox_size", &ShmContextOptions::inboxSize);
+  shmContextOptions.def_readwrite(
+      "reactor_size", &ShmContextOptions::reactorSize);
+  shmContextOptions.def_readwrite(
+      "use_huge_pages", &ShmContextOptions::useHugePages);
+  shmContextOptions.def_readwrite("numa_node", &ShmContextOptions::numaNode);
+  shmContextOptions.def_readwrite(
+      "poll_epoll_from_reactor", &ShmContextOptions::pollEpollFromReactor);
+  shmContextOptions.def_readwrite(
+      "share_threads", &ShmContextOptions::shareThreads);
+  shmContextOptions.def_readwrite(
+      "sleep_on_event_fd", &ShmContextOptions::sleepOnEventFd);
+  shmContextOptions.def_readwrite(
+      "num_spare_inboxes", &ShmContextOptions::numSpareInboxes);
+  shmContextOptions.def_readwrite(
+      "prefault_rings", &ShmContextOptions::prefaultRings);
+  shmContextOptions.def_readwrite("lock_rings", &ShmContextOptions::lockRings);
+  shmContextOptions.def_readwrite(
+      "copy_offload", &ShmContextOptions::copyOffload);
+  shmContextOptions.def_readwrite(
+      "coalesce_writes", &ShmContextOptions::coalesceWrites);
+  shmContextOptions.def_readwrite(
+      "listen_backlog", &ShmContextOptions::listenBacklog);
+  shmContextOptions.def("validate", &ShmContextOptions::validate);
+  shmContextOptions.def("__repr__", &ShmContextOptions::str);
+  shmContextOptions.def_static(
+      "from_environment",
+      py::overload_cast<ShmContextOptions>(&ShmContextOptions::fromEnvironment),
+      py::arg("options") = ShmContextOptions());
+
   transport_class_<tensorpipe::transport::shm::Context> shmTransport(
       module, "ShmTransport");
-  shmTransport.def(py::init<>());
+  shmTransport.def(py::init<ShmContextOptions>(), py::arg("options"));
+  shmTransport.def(
+      "get_options",
+      &tensorpipe::transport::shm::Context::getOptions,
+      py::return_value_policy::copy);
+  shmTransport.def(
+      py::init<
+          tensorpipe::BusyPollingPolicy,
+          size_t,
+          bool,
+          int,
+          bool,
+          bool,
+          bool,
+          size_t,
+          bool,
+          bool,
+          bool,
+          bool>(),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy(),
+      py::arg("inbox_size") = static_cast<size_t>(
+          tensorpipe::transport::shm::Context::kDefaultInboxSize),
+      py::arg("use_huge_pages") = false,
+      py::arg("numa_node") =
+          static_cast<int>(tensorpipe::transport::shm::Context::kNoNumaNode),
+      py::arg("poll_epoll_from_reactor") = false,
+      py::arg("share_threads") = false,
+      py::arg("sleep_on_event_fd") = false,
+      py::arg("num_spare_inboxes") = 0,
+      py::arg("prefault_rings") = false,
+      py::arg("lock_rings") = false,
+      py::arg("copy_offload") = false,
+      py::arg("coalesce_writes") = false);
 #endif // TENSORPIPE_HAS_SHM_TRANSPORT
 
+#if TENSORPIPE_HAS_IBV_TRANSPORT
+  py::class_<tensorpipe::transport::ibv::QueueLimits> queueLimits(
+      module, "IbvQueueLimits");
+  queueLimits.def(py::init<>());
+  queueLimits.def_readwrite(
+      "num_pending_recv_reqs",
+      &tensorpipe::transport::ibv::QueueLimits::numPendingRecvReqs);
+  queueLimits.def_readwrite(
+      "num_pending_write_reqs",
+      &tensorpipe::transport::ibv::QueueLimits::numPendingWriteReqs);
+  queueLimits.def_readwrite(
+      "num_pending_ack_reqs",
+      &tensorpipe::transport::ibv::QueueLimits::numPendingAckReqs);
+
+  transport_class_<tensorpipe::transport::ibv::Context> ibvTransport(
+      module, "IbvTransport");
+  ibvTransport.def(
+      py::init<
+          tensorpipe::BusyPollingPolicy,
+          size_t,
+          tensorpipe::IbvDeviceOptions,
+          tensorpipe::transport::ibv::QueueLimits,
+          size_t,
+          size_t,
+          bool,
+          size_t>(),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy(),
+      py::arg("inbox_size") = static_cast<size_t>(
+          tensorpipe::transport::ibv::Context::kDefaultInboxSize),
+      py::arg("device_options") = tensorpipe::IbvDeviceOptions(),
+      py::arg("queue_limits") = tensorpipe::transport::ibv::QueueLimits(),
+      py::arg("ring_slab_size") = 0,
+      py::arg("rendezvous_threshold") = 0,
+      py::arg("use_huge_pages") = false,
+      py::arg("num_queue_pairs") = 1);
+#endif // TENSORPIPE_HAS_IBV_TRANSPORT
+
+#if TENSORPIPE_HAS_URING_TRANSPORT
+  transport_class_<tensorpipe::transport::uring::Context> uringTransport(
+      module, "UringTransport");
+  uringTransport.def(
+      py::init<bool, size_t>(),
+      py::arg("use_sq_poll") = false,
+      py::arg("zero_copy_threshold") = 0);
+#endif // TENSORPIPE_HAS_URING_TRANSPORT
+
+#if TENSORPIPE_HAS_XDP_TRANSPORT
+  transport_class_<tensorpipe::transport::xdp::Context> xdpTransport(
+      module, "XdpTransport");
+  xdpTransport.def(
+      py::init<
+          std::string,
+          uint32_t,
+          uint16_t,
+          tensorpipe::BusyPollingPolicy,
+          size_t,
+          size_t>(),
+      py::arg("interface_name"),
+      py::arg("queue_id") = 0,
+      py::arg("udp_port") = static_cast<uint16_t>(
+          tensorpipe::transport::xdp::Context::kDefaultUdpPort),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy(),
+      py::arg("num_frames") = static_cast<size_t>(
+          tensorpipe::transport::xdp::Context::kDefaultNumFrames),
+      py::arg("inbox_size") = static_cast<size_t>(
+          tensorpipe::transport::xdp::Context::kDefaultInboxSize));
+#endif // TENSORPIPE_HAS_XDP_TRANSPORT
+
+#if TENSORPIPE_HAS_FABRIC_TRANSPORT
+  transport_class_<tensorpipe::transport::fabric::Context> fabricTransport(
+      module, "FabricTransport");
+  fabricTransport.def(
+      py::init<tensorpipe::BusyPollingPolicy, size_t, std::string>(),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy(),
+      py::arg("inbox_size") = static_cast<size_t>(
+          tensorpipe::transport::fabric::Context::kDefaultInboxSize),
+      py::arg("provider") = "efa");
+#endif // TENSORPIPE_HAS_FABRIC_TRANSPORT
+
+#if TENSORPIPE_HAS_CXL_TRANSPORT
+  transport_class_<tensorpipe::transport::cxl::Context> cxlTransport(
+      module, "CxlTransport");
+  cxlTransport.def(
+      py::init<
+          std::string,
+          size_t,
+          uint64_t,
+          uint64_t,
+          tensorpipe::BusyPollingPolicy,
+          size_t,
+          bool>(),
+      py::arg("region_path"),
+      py::arg("region_size"),
+      py::arg("partition_offset"),
+      py::arg("partition_size"),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy(),
+      py::arg("inbox_size") = static_cast<size_t>(
+          tensorpipe::transport::cxl::Context::kDefaultInboxSize),
+      py::arg("coherent") = false);
+#endif // TENSORPIPE_HAS_CXL_TRANSPORT
+
+#if TENSORPIPE_HAS_UCX_TRANSPORT
+  transport_class_<tensorpipe::transport::ucx::Context> ucxTransport(
+      module, "UcxTransport");
+  ucxTransport.def(
+      py::init<tensorpipe::BusyPollingPolicy>(),
+      py::arg("policy") = tensorpipe::BusyPollingPolicy());
+#endif // TENSORPIPE_HAS_UCX_TRANSPORT
+
+  transport_class_<tensorpipe::transport::mux::Context> muxTransport(
+      module, "MuxTransport");
+  muxTransport.def(
+      py::init<std::shared_ptr<tensorpipe::transport::Context>, size_t>(),
+      py::arg("transport"),
+      py::arg("num_connections_per_peer") = 1);
+
+  transport_class_<tensorpipe::transport::bond::Context> bondTransport(
+      module, "BondTransport");
+  bondTransport.def(
+      py::init<
+          std::vector<std::shared_ptr<tensorpipe::transport::Context>>,
+          size_t>(),
+      py::arg("lanes"),
+      py::arg("large_write_threshold") = static_cast<size_t>(
+          tensorpipe::transport::bond::Context::kDefaultLargeWriteThreshold));
+
   context.def(
       "register_transport",
       &tensorpipe::Context::registerTransport,
@@ -439,25 +1162,188 @@ PYBIND11_MODULE(pytensorpipe, module) {
       py::arg("name"),
       py::arg("transport"));
 
+  py::enum_<tensorpipe::CompressionCodec>(module, "CompressionCodec")
+      .value("NONE", tensorpipe::CompressionCodec::kNone)
+      .value("LZ4", tensorpipe::CompressionCodec::kLz4)
+      .value("ZSTD", tensorpipe::CompressionCodec::kZstd);
+
+  py::class_<tensorpipe::CompressionOptions> compressionOptions(
+      module, "CompressionOptions");
+  compressionOptions.def(py::init<>());
+  compressionOptions.def_readwrite(
+      "codec", &tensorpipe::CompressionOptions::codec);
+  compressionOptions.def_readwrite(
+      "level", &tensorpipe::CompressionOptions::level);
+  compressionOptions.def_readwrite(
+      "threshold", &tensorpipe::CompressionOptions::threshold);
+  compressionOptions.def_readwrite(
+      "num_threads", &tensorpipe::CompressionOptions::numThreads);
+
+  py::enum_<tensorpipe::QuantizationFormat>(module, "QuantizationFormat")
+      .value("BF16", tensorpipe::QuantizationFormat::kBf16)
+      .value("FP16", tensorpipe::QuantizationFormat::kFp16)
+      .value("INT8", tensorpipe::QuantizationFormat::kInt8);
+
   shared_ptr_class_<tensorpipe::channel::CpuContext> abstractChannel(
       module, "AbstractChannel");
 
   channel_class_<tensorpipe::channel::basic::Context> basicChannel(
       module, "BasicChannel");
-  basicChannel.def(py::init<>());
+  basicChannel.def(
+      py::init<size_t, size_t, tensorpipe::CompressionOptions>(),
+      py::arg("chunk_size") = 1024 * 1024,
+      py::arg("max_chunks_in_flight") = 4,
+      py::arg("compression") = tensorpipe::CompressionOptions());
+
+  channel_class_<tensorpipe::channel::xth::Context> xthChannel(
+      module, "XthChannel");
+  xthChannel.def(
+      py::init<size_t, size_t, bool, bool>(),
+      py::arg("num_threads") = 1,
+      py::arg("min_chunk_size") = 1024 * 1024,
+      py::arg("non_temporal_stores") = false,
+      py::arg("copy_offload") = false);
 
 #if TENSORPIPE_HAS_CMA_CHANNEL
   channel_class_<tensorpipe::channel::cma::Context> cmaChannel(
       module, "CmaChannel");
-  cmaChannel.def(py::init<>());
+  cmaChannel.def(
+      py::init<size_t, size_t, bool>(),
+      py::arg("num_threads") = 1,
+      py::arg("min_chunk_size") = 1024 * 1024,
+      py::arg("receive_by_push") = false);
 #endif // TENSORPIPE_HAS_CMA_CHANNEL
 
+  // Each lane is a transport, listening on the corresponding address, or, in
+  // the simpler form, a uv transport listening on the given address.
+  channel_class_<tensorpipe::channel::mpt::Context> mptChannel(
+      module, "MptChannel");
+  mptChannel.def(
+      py::init(
+          [](std::vector<std::shared_ptr<tensorpipe::transport::Context>> lanes,
+             const std::vector<std::string>& addresses,
+             uint64_t chunkSize,
+             std::vector<double> laneWeights) {
+            TP_THROW_ASSERT_IF(lanes.size() != addresses.size())
+                << "Each lane needs an address";
+            std::vector<std::shared_ptr<tensorpipe::transport::Listener>>
+                listeners;
+            for (size_t laneIdx = 0; laneIdx < lanes.size(); laneIdx++) {
+              listeners.push_back(lanes[laneIdx]->listen(addresses[laneIdx]));
+            }
+            return std::make_shared<tensorpipe::channel::mpt::Context>(
+                std::move(lanes),
+                std::move(listeners),
+                chunkSize,
+                std::move(laneWeights));
+          }),
+      py::arg("lanes"),
+      py::arg("addresses"),
+      py::arg("chunk_size") = 0,
+      py::arg("lane_weights") = std::vector<double>());
+  mptChannel.def(
+      py::init([](size_t numLanes,
+                  const std::string& address,
+                  uint64_t chunkSize) {
+        std::vector<std::shared_ptr<tensorpipe::transport::Context>> lanes;
+        std::vector<std::shared_ptr<tensorpipe::transport::Listener>>
+            listeners;
+        for (size_t laneIdx = 0; laneIdx < numLanes; laneIdx++) {
+          lanes.push_back(
+              std::make_shared<tensorpipe::transport::uv::Context>());
+          listeners.push_back(lanes.back()->listen(address));
+        }
+        return std::make_shared<tensorpipe::channel::mpt::Context>(
+            std::move(lanes), std::move(listeners), chunkSize);
+      }),
+      py::arg("num_lanes"),
+      py::arg("address"),
+      py::arg("chunk_size") = 0);
+
+#if TENSORPIPE_HAS_SHM_POOL_CHANNEL
+  channel_class_<tensorpipe::channel::shm_pool::Context> shmPoolChannel(
+      module, "ShmPoolChannel");
+  shmPoolChannel.def(
+      py::init<size_t, size_t, size_t>(),
+      py::arg("arena_size") = 256 * 1024 * 1024,
+      py::arg("staging_chunk_size") = 1024 * 1024,
+      py::arg("num_staging_slots") = 4);
+#endif // TENSORPIPE_HAS_SHM_POOL_CHANNEL
+
+#if TENSORPIPE_HAS_IBV_CHANNEL
+  channel_class_<tensorpipe::channel::ibv::Context> ibvChannel(
+      module, "IbvChannel");
+  ibvChannel.def(
+      py::init<size_t, tensorpipe::IbvDeviceOptions>(),
+      py::arg("registration_cache_capacity") = 0,
+      py::arg("device_options") = tensorpipe::IbvDeviceOptions());
+#endif // TENSORPIPE_HAS_IBV_CHANNEL
+
+  channel_class_<tensorpipe::channel::quantize::Context> quantizeChannel(
+      module, "QuantizeChannel");
+  quantizeChannel.def(
+      py::init<
+          std::shared_ptr<tensorpipe::channel::CpuContext>,
+          tensorpipe::QuantizationFormat,
+          size_t>(),
+      py::arg("inner"),
+      py::arg("format"),
+      py::arg("block_size") = static_cast<size_t>(
+          tensorpipe::channel::quantize::Context::kDefaultBlockSize));
+
+  channel_class_<tensorpipe::channel::sparse::Context> sparseChannel(
+      module, "SparseChannel");
+  sparseChannel.def(
+      py::init<std::shared_ptr<tensorpipe::channel::CpuContext>, size_t>(),
+      py::arg("inner"),
+      py::arg("threshold") = static_cast<size_t>(
+          tensorpipe::channel::sparse::Context::kDefaultThreshold));
+
   context.def(
       "register_channel",
-      &tensorpipe::Context::registerChannel,
+      [](tensorpipe::Context& context,
+         int64_t priority,
+         std::string name,
+         std::shared_ptr<tensorpipe::channel::CpuContext> channel,
+         size_t maxTensorLength) {
+        context.registerChannel(
+            priority, std::move(name), std::move(channel), maxTensorLength);
+      },
+      py::arg("priority"),
+      py::arg("name"),
+      py::arg("channel"),
+      py::arg("max_tensor_length") = std::numeric_limits<size_t>::max());
+
+#if TENSORPIPE_SUPPORTS_CUDA
+  // The messages built from Python only hold CPU tensors, but the contexts can
+  // still be set up with these, e.g., for the benchmarks of the tooling.
+  shared_ptr_class_<tensorpipe::channel::CudaContext> abstractCudaChannel(
+      module, "AbstractCudaChannel");
+
+#if TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+  py::class_<
+      tensorpipe::channel::cuda_ipc::Context,
+      tensorpipe::channel::CudaContext,
+      std::shared_ptr<tensorpipe::channel::cuda_ipc::Context>>
+      cudaIpcChannel(module, "CudaIpcChannel");
+  cudaIpcChannel.def(py::init<>());
+#endif // TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+
+  context.def(
+      "register_channel",
+      [](tensorpipe::Context& context,
+         int64_t priority,
+         std::string name,
+         std::shared_ptr<tensorpipe::channel::CudaContext> channel,
+         size_t maxTensorLength) {
+        context.registerChannel(
+            priority, std::move(name), std::move(channel), maxTensorLength);
+      },
       py::arg("priority"),
       py::arg("name"),
-      py::arg("channel"));
+      py::arg("channel"),
+      py::arg("max_tensor_length") = std::numeric_limits<size_t>::max());
+#endif // TENSORPIPE_SUPPORTS_CUDA
 
   // Helpers
 
@@ -13,11 +13,16 @@
 // High-level API
 
 #include <tensorpipe/core/buffer.h>
+#include <tensorpipe/core/buffer_pool.h>
+#include <tensorpipe/core/collectives.h>
+#include <tensorpipe/core/completion_queue.h>
 #include <tensorpipe/core/context.h>
 #include <tensorpipe/core/error.h>
 #include <tensorpipe/core/listener.h>
 #include <tensorpipe/core/message.h>
 #include <tensorpipe/core/pipe.h>
+#include <tensorpipe/core/pipe_group.h>
+#include <tensorpipe/core/rpc_endpoint.h>
 
 // Transports
 
@@ -27,6 +32,10 @@
 #include <tensorpipe/transport/uv/context.h>
 #include <tensorpipe/transport/uv/error.h>
 
+#include <tensorpipe/transport/mux/context.h>
+
+#include <tensorpipe/transport/bond/context.h>
+
 #if TENSORPIPE_HAS_SHM_TRANSPORT
 #include <tensorpipe/transport/shm/context.h>
 #endif // TENSORPIPE_HAS_SHM_TRANSPORT
@@ -36,6 +45,31 @@
 #include <tensorpipe/transport/ibv/error.h>
 #endif // TENSORPIPE_HAS_IBV_TRANSPORT
 
+#if TENSORPIPE_HAS_URING_TRANSPORT
+#include <tensorpipe/transport/uring/context.h>
+#include <tensorpipe/transport/uring/error.h>
+#endif // TENSORPIPE_HAS_URING_TRANSPORT
+
+#if TENSORPIPE_HAS_XDP_TRANSPORT
+#include <tensorpipe/transport/xdp/context.h>
+#include <tensorpipe/transport/xdp/error.h>
+#endif // TENSORPIPE_HAS_XDP_TRANSPORT
+
+#if TENSORPIPE_HAS_FABRIC_TRANSPORT
+#include <tensorpipe/transport/fabric/context.h>
+#include <tensorpipe/transport/fabric/error.h>
+#endif // TENSORPIPE_HAS_FABRIC_TRANSPORT
+
+#if TENSORPIPE_HAS_CXL_TRANSPORT
+#include <tensorpipe/transport/cxl/context.h>
+#include <tensorpipe/transport/cxl/error.h>
+#endif // TENSORPIPE_HAS_CXL_TRANSPORT
+
+#if TENSORPIPE_HAS_UCX_TRANSPORT
+#include <tensorpipe/transport/ucx/context.h>
+#include <tensorpipe/transport/ucx/error.h>
+#endif // TENSORPIPE_HAS_UCX_TRANSPORT
+
 // Channels
 
 #include <tensorpipe/channel/cpu_context.h>
@@ -47,12 +81,31 @@
 
 #include <tensorpipe/channel/basic/context.h>
 #include <tensorpipe/channel/mpt/context.h>
+#include <tensorpipe/channel/quantize/context.h>
+#include <tensorpipe/channel/sparse/context.h>
 #include <tensorpipe/channel/xth/context.h>
 
 #if TENSORPIPE_HAS_CMA_CHANNEL
 #include <tensorpipe/channel/cma/context.h>
 #endif // TENSORPIPE_HAS_CMA_CHANNEL
 
+#if TENSORPIPE_HAS_SHM_POOL_CHANNEL
+#include <tensorpipe/channel/shm_pool/context.h>
+#endif // TENSORPIPE_HAS_SHM_POOL_CHANNEL
+
+#if TENSORPIPE_HAS_IBV_CHANNEL
+#include <tensorpipe/channel/ibv/context.h>
+#include <tensorpipe/channel/ibv/error.h>
+#endif // TENSORPIPE_HAS_IBV_CHANNEL
+
+#if TENSORPIPE_SUPPORTS_CUDA
+#include <tensorpipe/channel/cuda_basic/context.h>
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
 #if TENSORPIPE_HAS_CUDA_IPC_CHANNEL
 #include <tensorpipe/channel/cuda_ipc/context.h>
 #endif // TENSORPIPE_HAS_CUDA_IPC_CHANNEL
+
+#if TENSORPIPE_HAS_CUDA_GDR_CHANNEL
+#include <tensorpipe/channel/cuda_gdr/context.h>
+#endif // TENSORPIPE_HAS_CUDA_GDR_CHANNEL
@@ -7,6 +7,7 @@
  */
 
 #include <tensorpipe/channel/basic/context.h>
+#include <tensorpipe/config.h>
 #include <tensorpipe/test/channel/channel_test.h>
 
 namespace {
@@ -23,6 +24,62 @@ class BasicChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
 
 BasicChannelTestHelper helper;
 
+// Use tiny chunks, with few of them in flight, so that the larger tensors of
+// the test suite are split into many writes which are queued behind each other.
+class ChunkedBasicChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::basic::Context>(
+        /*chunkSize=*/1024, /*maxChunksInFlight=*/2);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+ChunkedBasicChannelTestHelper chunkedHelper;
+
+#if TENSORPIPE_HAS_LZ4 || TENSORPIPE_HAS_ZSTD
+
+// Compress all tensors, in small chunks, so that several of them are being
+// compressed (and decompressed) by the threads at the same time.
+class CompressedBasicChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    tensorpipe::CompressionOptions compression;
+    compression.codec = TENSORPIPE_HAS_LZ4
+        ? tensorpipe::CompressionCodec::kLz4
+        : tensorpipe::CompressionCodec::kZstd;
+    compression.threshold = 1;
+    compression.numThreads = 2;
+    auto context = std::make_shared<tensorpipe::channel::basic::Context>(
+        /*chunkSize=*/1024, /*maxChunksInFlight=*/4, compression);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+CompressedBasicChannelTestHelper compressedHelper;
+
+#endif // TENSORPIPE_HAS_LZ4 || TENSORPIPE_HAS_ZSTD
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Basic, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    ChunkedBasic,
+    CpuChannelTestSuite,
+    ::testing::Values(&chunkedHelper));
+
+#if TENSORPIPE_HAS_LZ4 || TENSORPIPE_HAS_ZSTD
+
+INSTANTIATE_TEST_CASE_P(
+    CompressedBasic,
+    CpuChannelTestSuite,
+    ::testing::Values(&compressedHelper));
+
+#endif // TENSORPIPE_HAS_LZ4 || TENSORPIPE_HAS_ZSTD
@@ -22,6 +22,8 @@ class DomainDescriptorTest : public ChannelTestCase<TBuffer> {
     EXPECT_FALSE(context1->domainDescriptor().empty());
     EXPECT_FALSE(context2->domainDescriptor().empty());
     EXPECT_EQ(context1->domainDescriptor(), context2->domainDescriptor());
+    EXPECT_TRUE(
+        context1->canCommunicateWithRemote(context2->domainDescriptor()));
   }
 };
 
@@ -23,6 +23,47 @@ class CmaChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
 
 CmaChannelTestHelper helper;
 
+// Use tiny chunks so that the larger tensors of the test suite are split
+// across multiple threads.
+class MultiThreadedCmaChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cma::Context>(
+        /*numThreads=*/4, /*minChunkSize=*/1024);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+MultiThreadedCmaChannelTestHelper multiThreadedHelper;
+
+// Have the senders write the tensors into the receivers' memory.
+class PushCmaChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cma::Context>(
+        /*numThreads=*/1, /*minChunkSize=*/1024 * 1024, /*receiveByPush=*/true);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+PushCmaChannelTestHelper pushHelper;
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Cma, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    MultiThreadedCma,
+    CpuChannelTestSuite,
+    ::testing::Values(&multiThreadedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    PushCma,
+    CpuChannelTestSuite,
+    ::testing::Values(&pushHelper));
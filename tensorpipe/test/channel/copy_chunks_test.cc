@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/copy_chunks.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel;
+
+TEST(CopyChunks, LengthNotDivisibleByNumChunks) {
+  // Chunks of 2 bytes would leave the fourth one past the end of the copy.
+  CopyChunks chunks =
+      cutCopyInChunks(/*length=*/5, /*maxNumChunks=*/4, /*minChunkSize=*/1);
+  EXPECT_EQ(chunks.numChunks, 3);
+  EXPECT_EQ(chunks.chunkSize, 2);
+}
+
+TEST(CopyChunks, SmallCopyIsSingleChunk) {
+  CopyChunks chunks =
+      cutCopyInChunks(/*length=*/5, /*maxNumChunks=*/4, /*minChunkSize=*/8);
+  EXPECT_EQ(chunks.numChunks, 1);
+  EXPECT_EQ(chunks.chunkSize, 5);
+
+  chunks =
+      cutCopyInChunks(/*length=*/0, /*maxNumChunks=*/4, /*minChunkSize=*/1);
+  EXPECT_EQ(chunks.numChunks, 1);
+  EXPECT_EQ(chunks.chunkSize, 0);
+}
+
+TEST(CopyChunks, ChunksCoverCopyAndNoneIsEmpty) {
+  for (size_t length = 1; length < 100; length++) {
+    for (size_t maxNumChunks = 1; maxNumChunks < 10; maxNumChunks++) {
+      for (size_t minChunkSize = 1; minChunkSize < 10; minChunkSize++) {
+        CopyChunks chunks = cutCopyInChunks(length, maxNumChunks, minChunkSize);
+        ASSERT_GE(chunks.numChunks, 1);
+        ASSERT_LE(chunks.numChunks, maxNumChunks);
+        // The last chunk starts within the copy and reaches its end.
+        ASSERT_LT((chunks.numChunks - 1) * chunks.chunkSize, length);
+        ASSERT_GE(chunks.numChunks * chunks.chunkSize, length);
+        if (chunks.numChunks > 1) {
+          ASSERT_GE(chunks.chunkSize, minChunkSize);
+        }
+      }
+    }
+  }
+}
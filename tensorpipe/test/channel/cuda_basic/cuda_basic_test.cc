@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/basic/context.h>
+#include <tensorpipe/channel/cuda_basic/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+namespace {
+
+class CudaBasicChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ public:
+  // Small chunks, and few of them, so that tensors are cut into several pieces
+  // and that some of them have to wait for chunks to be returned to the pool.
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_basic::Context>(
+        std::make_shared<tensorpipe::channel::basic::Context>(),
+        /*chunkLength=*/1024,
+        /*numChunks=*/4);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+CudaBasicChannelTestHelper helper;
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(
+    CudaBasic,
+    CudaChannelTestSuite,
+    ::testing::Values(&helper));
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/cuda_gdr/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+namespace {
+
+class CudaGdrChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CudaBuffer> {
+ public:
+  explicit CudaGdrChannelTestHelper(bool forceStaging)
+      : forceStaging_(forceStaging) {}
+
+  std::shared_ptr<tensorpipe::channel::CudaContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::cuda_gdr::Context>(
+        tensorpipe::IbvDeviceOptions(), forceStaging_);
+    context->setId(std::move(id));
+    return context;
+  }
+
+ private:
+  const bool forceStaging_;
+};
+
+CudaGdrChannelTestHelper helper(/*forceStaging=*/false);
+CudaGdrChannelTestHelper stagingHelper(/*forceStaging=*/true);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(
+    CudaGdr,
+    CudaChannelTestSuite,
+    ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    CudaGdrStaging,
+    CudaChannelTestSuite,
+    ::testing::Values(&stagingHelper));
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/ibv/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+namespace {
+
+class IbvChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::ibv::Context>();
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+IbvChannelTestHelper helper;
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Ibv, CpuChannelTestSuite, ::testing::Values(&helper));
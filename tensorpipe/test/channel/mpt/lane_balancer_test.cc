@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <vector>
+
+#include <tensorpipe/channel/mpt/lane_balancer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::channel::mpt;
+
+namespace {
+
+constexpr uint64_t kChunkSize = 1000;
+
+const LaneBalancer::TTimePoint kStart;
+
+// Have the lane write a chunk in the given time, which sets its throughput if
+// it wasn't measured yet. This must be done with no chunks in flight.
+void measureLane(
+    LaneBalancer& balancer,
+    uint64_t laneIdx,
+    std::chrono::microseconds duration,
+    bool measure = true) {
+  // Chunks can only be written by the lane they were assigned to, hence they
+  // are assigned until one goes to the desired lane, and the others are given
+  // back (which, as they weren't started, doesn't measure anything).
+  std::vector<uint64_t> otherLaneIdxs;
+  while (true) {
+    uint64_t assignedLaneIdx = balancer.assignChunk(kChunkSize, kStart);
+    if (assignedLaneIdx == laneIdx) {
+      break;
+    }
+    otherLaneIdxs.push_back(assignedLaneIdx);
+  }
+  for (uint64_t otherLaneIdx : otherLaneIdxs) {
+    balancer.onChunkDone(otherLaneIdx, kChunkSize, kStart, /*measure=*/false);
+  }
+  balancer.onChunkStarted(laneIdx, kChunkSize, kStart);
+  balancer.onChunkDone(laneIdx, kChunkSize, kStart + duration, measure);
+}
+
+// Assign the given number of chunks at once, and return how many each lane
+// got.
+std::vector<uint64_t> split(
+    LaneBalancer& balancer,
+    uint64_t numLanes,
+    uint64_t numChunks,
+    LaneBalancer::TTimePoint now) {
+  std::vector<uint64_t> numChunksPerLane(numLanes, 0);
+  for (uint64_t chunkIdx = 0; chunkIdx < numChunks; chunkIdx++) {
+    numChunksPerLane[balancer.assignChunk(kChunkSize, now)]++;
+  }
+  return numChunksPerLane;
+}
+
+} // namespace
+
+TEST(LaneBalancer, SplitByBytesInFlightWithoutMeasurements) {
+  LaneBalancer balancer(/*numLanes=*/3, /*laneWeights=*/{});
+  EXPECT_EQ(split(balancer, 3, 9, kStart), std::vector<uint64_t>({3, 3, 3}));
+  EXPECT_EQ(balancer.getBytesInFlight(0), 3 * kChunkSize);
+
+  LaneBalancer weightedBalancer(/*numLanes=*/2, /*laneWeights=*/{2, 1});
+  EXPECT_EQ(
+      split(weightedBalancer, 2, 9, kStart), std::vector<uint64_t>({6, 3}));
+}
+
+TEST(LaneBalancer, SplitByMeasuredThroughput) {
+  LaneBalancer balancer(/*numLanes=*/2, /*laneWeights=*/{});
+  measureLane(balancer, 0, std::chrono::milliseconds(1));
+  measureLane(balancer, 1, std::chrono::milliseconds(4));
+  EXPECT_DOUBLE_EQ(balancer.getBytesPerSecond(0), 1000000);
+  EXPECT_DOUBLE_EQ(balancer.getBytesPerSecond(1), 250000);
+
+  // The first lane is four times as fast, hence it gets four times as many
+  // chunks.
+  EXPECT_EQ(split(balancer, 2, 10, kStart), std::vector<uint64_t>({8, 2}));
+}
+
+TEST(LaneBalancer, UnmeasuredLanesAreAsFastAsFastestOne) {
+  LaneBalancer balancer(/*numLanes=*/3, /*laneWeights=*/{});
+  measureLane(balancer, 0, std::chrono::milliseconds(1));
+  measureLane(balancer, 1, std::chrono::milliseconds(4));
+  EXPECT_EQ(balancer.getBytesPerSecond(2), 0);
+
+  EXPECT_EQ(split(balancer, 3, 9, kStart), std::vector<uint64_t>({4, 1, 4}));
+}
+
+TEST(LaneBalancer, UnmeasuredLanesFollowTheirWeight) {
+  LaneBalancer balancer(/*numLanes=*/2, /*laneWeights=*/{2, 1});
+  measureLane(balancer, 0, std::chrono::milliseconds(1));
+
+  // The second lane is assumed to be half as fast as the first one.
+  EXPECT_EQ(split(balancer, 2, 9, kStart), std::vector<uint64_t>({6, 3}));
+}
+
+TEST(LaneBalancer, ChunksThatMeasureNothingAreIgnored) {
+  LaneBalancer balancer(/*numLanes=*/2, /*laneWeights=*/{});
+  measureLane(balancer, 0, std::chrono::milliseconds(1));
+
+  // Chunks that took no time, and those of failed writes, don't give any
+  // measurement, hence the lane is still considered unmeasured (rather than
+  // infinitely fast, or infinitely slow).
+  measureLane(balancer, 1, std::chrono::milliseconds(0));
+  measureLane(balancer, 1, std::chrono::milliseconds(10), /*measure=*/false);
+  EXPECT_EQ(balancer.getBytesPerSecond(1), 0);
+  EXPECT_EQ(balancer.getBytesInFlight(0), 0);
+  EXPECT_EQ(balancer.getBytesInFlight(1), 0);
+
+  EXPECT_EQ(split(balancer, 2, 10, kStart), std::vector<uint64_t>({5, 5}));
+}
+
+TEST(LaneBalancer, AvoidStalledLane) {
+  LaneBalancer balancer(/*numLanes=*/2, /*laneWeights=*/{});
+  measureLane(balancer, 0, std::chrono::milliseconds(1));
+  measureLane(balancer, 1, std::chrono::milliseconds(1));
+
+  // The first lane has been stuck on a chunk for much longer than it should.
+  uint64_t laneIdx = balancer.assignChunk(kChunkSize, kStart);
+  ASSERT_EQ(laneIdx, 0);
+  balancer.onChunkStarted(laneIdx, kChunkSize, kStart);
+  EXPECT_EQ(
+      split(balancer, 2, 10, kStart + std::chrono::milliseconds(100)),
+      std::vector<uint64_t>({0, 10}));
+
+  // Once the chunk is done, the lane is found to be slower, but not stalled.
+  balancer.onChunkDone(
+      0, kChunkSize, kStart + std::chrono::milliseconds(100), /*measure=*/true);
+  EXPECT_LT(balancer.getBytesPerSecond(0), balancer.getBytesPerSecond(1));
+  EXPECT_GT(balancer.getBytesPerSecond(0), 0);
+}
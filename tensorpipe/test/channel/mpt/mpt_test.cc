@@ -13,6 +13,11 @@ namespace {
 
 class MptChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
  public:
+  explicit MptChannelTestHelper(
+      uint64_t chunkSize = 0,
+      std::vector<double> laneWeights = {})
+      : chunkSize_(chunkSize), laneWeights_(std::move(laneWeights)) {}
+
   std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
       std::string id) override {
     std::vector<std::shared_ptr<tensorpipe::transport::Context>> contexts = {
@@ -24,14 +29,41 @@ class MptChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
         contexts[1]->listen("127.0.0.1"),
         contexts[2]->listen("127.0.0.1")};
     auto context = std::make_shared<tensorpipe::channel::mpt::Context>(
-        std::move(contexts), std::move(listeners));
+        std::move(contexts), std::move(listeners), chunkSize_, laneWeights_);
     context->setId(std::move(id));
     return context;
   }
+
+ private:
+  const uint64_t chunkSize_;
+  const std::vector<double> laneWeights_;
 };
 
 MptChannelTestHelper helper;
 
+// Use tiny chunks so that the larger tensors of the test suite are striped
+// across all lanes, and the smaller ones end up on a single lane.
+MptChannelTestHelper chunkedHelper(/*chunkSize=*/1024);
+
+// As if the first lane were a faster link than the other two.
+MptChannelTestHelper weightedHelper(/*chunkSize=*/0, {4.0, 1.0, 1.0});
+MptChannelTestHelper weightedChunkedHelper(/*chunkSize=*/1024, {4.0, 1.0, 1.0});
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Mpt, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    ChunkedMpt,
+    CpuChannelTestSuite,
+    ::testing::Values(&chunkedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    WeightedMpt,
+    CpuChannelTestSuite,
+    ::testing::Values(&weightedHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    WeightedChunkedMpt,
+    CpuChannelTestSuite,
+    ::testing::Values(&weightedChunkedHelper));
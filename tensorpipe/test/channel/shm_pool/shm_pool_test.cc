@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/shm_pool/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+namespace {
+
+class ShmPoolChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::shm_pool::Context>();
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+ShmPoolChannelTestHelper helper;
+
+// Use tiny staging slots so that the larger tensors of the test suite are
+// split in many chunks, which have to wait for slots to be freed.
+class SmallSlotsShmPoolChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::shm_pool::Context>(
+        /*arenaSize=*/1024 * 1024,
+        /*stagingChunkSize=*/1024,
+        /*numStagingSlots=*/2);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+SmallSlotsShmPoolChannelTestHelper smallSlotsHelper;
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(
+    ShmPool,
+    CpuChannelTestSuite,
+    ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    SmallSlotsShmPool,
+    CpuChannelTestSuite,
+    ::testing::Values(&smallSlotsHelper));
+
+TEST(ShmPool, Allocator) {
+  tensorpipe::channel::shm_pool::Context context(/*arenaSize=*/4096);
+
+  void* a = context.allocate(1000);
+  void* b = context.allocate(1000);
+  void* c = context.allocate(1000);
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(b) % 64, 0);
+  EXPECT_EQ(context.allocate(2000), nullptr);
+
+  // Freeing the two first regions merges them, which makes room again.
+  context.deallocate(b);
+  context.deallocate(a);
+  void* d = context.allocate(2000);
+  EXPECT_EQ(d, a);
+
+  context.deallocate(c);
+  context.deallocate(d);
+  EXPECT_NE(context.allocate(4096), nullptr);
+
+  context.join();
+}
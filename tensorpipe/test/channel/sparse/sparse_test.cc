@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/channel/basic/context.h>
+#include <tensorpipe/channel/sparse/context.h>
+#include <tensorpipe/test/channel/channel_test.h>
+
+namespace {
+
+// Consider all tensors, however small, for the sparse encodings.
+class SparseChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::sparse::Context>(
+        std::make_shared<tensorpipe::channel::basic::Context>(),
+        /*threshold=*/0);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+SparseChannelTestHelper helper;
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(
+    Sparse,
+    CpuChannelTestSuite,
+    ::testing::Values(&helper));
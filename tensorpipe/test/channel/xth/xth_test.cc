@@ -6,6 +6,11 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <tensorpipe/channel/xth/context.h>
 #include <tensorpipe/test/channel/channel_test.h>
 
@@ -23,6 +28,188 @@ class XthChannelTestHelper : public ChannelTestHelper<tensorpipe::CpuBuffer> {
 
 XthChannelTestHelper helper;
 
+// Use tiny chunks so that the larger tensors of the test suite are split
+// across multiple threads, and overtaken by the smaller ones.
+class MultiThreadedXthChannelTestHelper
+    : public ChannelTestHelper<tensorpipe::CpuBuffer> {
+ public:
+  std::shared_ptr<tensorpipe::channel::CpuContext> makeContext(
+      std::string id) override {
+    auto context = std::make_shared<tensorpipe::channel::xth::Context>(
+        /*numThreads=*/4, /*minChunkSize=*/1024, /*nonTemporalStores=*/true);
+    context->setId(std::move(id));
+    return context;
+  }
+};
+
+MultiThreadedXthChannelTestHelper multiThreadedHelper;
+
+// Copy a tensor that's smaller than the number of threads, and whose length
+// isn't a multiple of the number of chunks it's split in, so that the last
+// chunk is shorter than the others.
+class UnevenChunksTest
+    : public ClientServerChannelTestCase<tensorpipe::CpuBuffer> {
+  static constexpr size_t kLength = 5;
+
+  void server(std::shared_ptr<tensorpipe::transport::Connection> conn)
+      override {
+    auto ctx = std::make_shared<tensorpipe::channel::xth::Context>(
+        /*numThreads=*/4, /*minChunkSize=*/1, /*nonTemporalStores=*/false);
+    ctx->setId("server");
+    auto channel = ctx->createChannel(
+        std::move(conn), tensorpipe::channel::Endpoint::kListen);
+
+    DataWrapper<tensorpipe::CpuBuffer> wrappedData(
+        std::vector<uint8_t>({1, 2, 3, 4, 5}));
+    std::future<std::tuple<tensorpipe::Error, std::string>> descriptorFuture;
+    std::future<tensorpipe::Error> sendFuture;
+    std::tie(descriptorFuture, sendFuture) =
+        sendWithFuture(channel, wrappedData.buffer());
+    tensorpipe::Error descriptorError;
+    std::string descriptor;
+    std::tie(descriptorError, descriptor) = descriptorFuture.get();
+    EXPECT_FALSE(descriptorError) << descriptorError.what();
+    this->peers_->send(PeerGroup::kClient, descriptor);
+    tensorpipe::Error sendError = sendFuture.get();
+    EXPECT_FALSE(sendError) << sendError.what();
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<tensorpipe::transport::Connection> conn)
+      override {
+    auto ctx = std::make_shared<tensorpipe::channel::xth::Context>(
+        /*numThreads=*/4, /*minChunkSize=*/1, /*nonTemporalStores=*/false);
+    ctx->setId("client");
+    auto channel = ctx->createChannel(
+        std::move(conn), tensorpipe::channel::Endpoint::kConnect);
+
+    // Leave room past the end of the tensor to catch chunks that overflow it.
+    std::vector<uint8_t> data(2 * kLength, 0);
+    auto descriptor = this->peers_->recv(PeerGroup::kClient);
+    std::future<tensorpipe::Error> recvFuture = recvWithFuture(
+        channel, descriptor, tensorpipe::CpuBuffer{data.data(), kLength});
+    tensorpipe::Error recvError = recvFuture.get();
+    EXPECT_FALSE(recvError) << recvError.what();
+    EXPECT_EQ(data, std::vector<uint8_t>({1, 2, 3, 4, 5, 0, 0, 0, 0, 0}));
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    ctx->join();
+  }
+};
+
+// Have the sender hand its buffer over, and check that the receiver gets that
+// very memory, which stays alive once the sender has let go of it.
+class HandOverTest
+    : public ClientServerChannelTestCase<tensorpipe::CpuBuffer> {
+  static constexpr size_t kLength = 1024;
+
+  void server(std::shared_ptr<tensorpipe::transport::Connection> conn)
+      override {
+    std::shared_ptr<tensorpipe::channel::CpuContext> ctx =
+        this->helper_->makeContext("server");
+    auto channel = ctx->createChannel(
+        std::move(conn), tensorpipe::channel::Endpoint::kListen);
+
+    std::shared_ptr<uint8_t> data(
+        new uint8_t[kLength], std::default_delete<uint8_t[]>());
+    for (size_t idx = 0; idx < kLength; idx++) {
+      data.get()[idx] = idx % 256;
+    }
+    tensorpipe::CpuBuffer buffer{data.get(), kLength};
+    this->peers_->send(
+        PeerGroup::kClient,
+        std::to_string(reinterpret_cast<uintptr_t>(data.get())));
+
+    auto descriptorPromise = std::make_shared<std::promise<std::string>>();
+    auto sendPromise = std::make_shared<std::promise<tensorpipe::Error>>();
+    channel->sendOwned(
+        buffer,
+        std::move(data),
+        [descriptorPromise](
+            const tensorpipe::Error& error, std::string descriptor) {
+          EXPECT_FALSE(error) << error.what();
+          descriptorPromise->set_value(std::move(descriptor));
+        },
+        [sendPromise](const tensorpipe::Error& error) {
+          sendPromise->set_value(error);
+        });
+    this->peers_->send(
+        PeerGroup::kClient, descriptorPromise->get_future().get());
+    tensorpipe::Error sendError = sendPromise->get_future().get();
+    EXPECT_FALSE(sendError) << sendError.what();
+
+    this->peers_->done(PeerGroup::kServer);
+    this->peers_->join(PeerGroup::kServer);
+
+    ctx->join();
+  }
+
+  void client(std::shared_ptr<tensorpipe::transport::Connection> conn)
+      override {
+    std::shared_ptr<tensorpipe::channel::CpuContext> ctx =
+        this->helper_->makeContext("client");
+    auto channel = ctx->createChannel(
+        std::move(conn), tensorpipe::channel::Endpoint::kConnect);
+
+    const std::string senderPtr = this->peers_->recv(PeerGroup::kClient);
+    auto descriptor = this->peers_->recv(PeerGroup::kClient);
+    std::promise<std::tuple<
+        tensorpipe::Error,
+        tensorpipe::CpuBuffer,
+        std::shared_ptr<void>>>
+        recvPromise;
+    channel->recvOwned(
+        std::move(descriptor),
+        tensorpipe::CpuBuffer{nullptr, kLength},
+        [&recvPromise](
+            const tensorpipe::Error& error,
+            tensorpipe::CpuBuffer buffer,
+            std::shared_ptr<void> owner) {
+          recvPromise.set_value(
+              std::make_tuple(error, buffer, std::move(owner)));
+        });
+    tensorpipe::Error recvError;
+    tensorpipe::CpuBuffer buffer;
+    std::shared_ptr<void> owner;
+    std::tie(recvError, buffer, owner) = recvPromise.get_future().get();
+    EXPECT_FALSE(recvError) << recvError.what();
+    EXPECT_EQ(
+        std::to_string(reinterpret_cast<uintptr_t>(buffer.ptr)), senderPtr);
+    EXPECT_EQ(owner.get(), buffer.ptr);
+
+    this->peers_->done(PeerGroup::kClient);
+    this->peers_->join(PeerGroup::kClient);
+
+    // The sender is done with it by now.
+    for (size_t idx = 0; idx < kLength; idx++) {
+      EXPECT_EQ(reinterpret_cast<uint8_t*>(buffer.ptr)[idx], idx % 256);
+    }
+
+    ctx->join();
+  }
+};
+
 } // namespace
 
+TEST(Xth, HandOver) {
+  HandOverTest t;
+  t.run(&helper);
+}
+
+TEST(Xth, UnevenChunks) {
+  UnevenChunksTest t;
+  t.run(&helper);
+}
+
 INSTANTIATE_TEST_CASE_P(Xth, CpuChannelTestSuite, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    MultiThreadedXth,
+    CpuChannelTestSuite,
+    ::testing::Values(&multiThreadedHelper));
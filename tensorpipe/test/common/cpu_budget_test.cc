@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/cpu_budget.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// Restores the budget found in the environment once the test is done.
+class CpuBudgetGuard {
+ public:
+  CpuBudgetGuard() : numCpus_(getCpuBudget()) {}
+
+  ~CpuBudgetGuard() {
+    setCpuBudget(numCpus_);
+  }
+
+ private:
+  const optional<double> numCpus_;
+};
+
+} // namespace
+
+TEST(CpuBudget, NoBudget) {
+  CpuBudgetGuard guard;
+  setCpuBudget(nullopt);
+
+  SpinningPermit permit1;
+  SpinningPermit permit2;
+  EXPECT_FALSE(applyCpuBudget(BusyPollingPolicy(), permit1).sleeps());
+  EXPECT_FALSE(applyCpuBudget(BusyPollingPolicy(), permit2).sleeps());
+  EXPECT_TRUE(permit1);
+  EXPECT_TRUE(permit2);
+  EXPECT_EQ(getNumSpinningThreads(), 0);
+}
+
+TEST(CpuBudget, CapsSpinningThreads) {
+  CpuBudgetGuard guard;
+  setCpuBudget(4);
+
+  {
+    SpinningPermit permit1;
+    SpinningPermit permit2;
+    EXPECT_FALSE(applyCpuBudget(BusyPollingPolicy(), permit1).sleeps());
+    EXPECT_TRUE(permit1);
+    EXPECT_EQ(getNumSpinningThreads(), 1);
+
+    BusyPollingPolicy policy = applyCpuBudget(BusyPollingPolicy(), permit2);
+    EXPECT_FALSE(permit2);
+    EXPECT_TRUE(policy.sleeps());
+    EXPECT_GT(policy.yieldFor.count(), 0);
+
+    // A policy that sleeps already doesn't need a permit.
+    SpinningPermit permit3;
+    BusyPollingPolicy adaptive = BusyPollingPolicy::adaptive();
+    EXPECT_EQ(
+        applyCpuBudget(adaptive, permit3).spinFor.count(),
+        adaptive.spinFor.count());
+    EXPECT_FALSE(permit3);
+  }
+
+  // The permit went back to the budget.
+  EXPECT_EQ(getNumSpinningThreads(), 0);
+  SpinningPermit permit;
+  EXPECT_FALSE(applyCpuBudget(BusyPollingPolicy(), permit).sleeps());
+  EXPECT_TRUE(permit);
+}
+
+TEST(CpuBudget, SleepsRightAwayOnTinyBudget) {
+  CpuBudgetGuard guard;
+  setCpuBudget(1.5);
+
+  SpinningPermit permit;
+  BusyPollingPolicy policy = applyCpuBudget(BusyPollingPolicy(), permit);
+  EXPECT_FALSE(permit);
+  EXPECT_TRUE(policy.sleeps());
+  EXPECT_EQ(policy.spinFor.count(), 0);
+  EXPECT_EQ(policy.yieldFor.count(), 0);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <numeric>
+#include <vector>
+
+#include <tensorpipe/common/cpu_buffer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(CpuBuffer, ContiguousRange) {
+  std::vector<uint8_t> data(10);
+  const CpuSegment segments[] = {
+      {data.data(), 4}, {data.data() + 4, 0}, {data.data() + 4, 6}};
+  CpuBuffer buffer;
+  buffer.length = 10;
+  buffer.segments = segments;
+  buffer.numSegments = 3;
+
+  EXPECT_EQ(contiguousRangeOfCpuBuffer(buffer, 0, 4), data.data());
+  EXPECT_EQ(contiguousRangeOfCpuBuffer(buffer, 5, 5), data.data() + 5);
+  EXPECT_EQ(contiguousRangeOfCpuBuffer(buffer, 3, 2), nullptr);
+
+  const CpuBuffer contiguous{data.data(), 10};
+  EXPECT_EQ(contiguousRangeOfCpuBuffer(contiguous, 3, 2), data.data() + 3);
+  EXPECT_EQ(segmentsOfCpuBuffer(contiguous).size(), 1);
+  EXPECT_EQ(segmentsOfCpuBuffer(buffer).size(), 3);
+}
+
+TEST(CpuBuffer, Copy) {
+  std::vector<uint8_t> src(10);
+  std::iota(src.begin(), src.end(), 0);
+  std::vector<uint8_t> first(3);
+  std::vector<uint8_t> second(7);
+  const CpuSegment segments[] = {
+      {first.data(), first.size()}, {second.data(), second.size()}};
+  CpuBuffer buffer;
+  buffer.length = 10;
+  buffer.segments = segments;
+  buffer.numSegments = 2;
+
+  copyToCpuBuffer(buffer, 1, src.data(), 5);
+  EXPECT_EQ(first, std::vector<uint8_t>({0, 0, 1}));
+  EXPECT_EQ(second, std::vector<uint8_t>({2, 3, 4, 0, 0, 0, 0}));
+
+  copyCpuBuffer(buffer, CpuBuffer{src.data(), src.size()});
+  std::vector<uint8_t> dst(10);
+  copyFromCpuBuffer(buffer, 0, dst.data(), 10);
+  EXPECT_EQ(dst, src);
+
+  // From segments to differently split segments.
+  std::vector<uint8_t> other(10);
+  const CpuSegment otherSegments[] = {
+      {other.data(), 6}, {other.data() + 6, 4}};
+  CpuBuffer otherBuffer;
+  otherBuffer.length = 10;
+  otherBuffer.segments = otherSegments;
+  otherBuffer.numSegments = 2;
+  copyCpuBuffer(otherBuffer, buffer);
+  EXPECT_EQ(other, src);
+}
@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/deferred_executor.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+class TestLoop final : public EventLoopDeferredExecutor {
+ public:
+  // The hooks are called at the start of each wakeup, and once the event loop
+  // returns, respectively.
+  explicit TestLoop(
+      std::function<void()> wakeupHook = nullptr,
+      std::function<void()> eventLoopDoneHook = nullptr)
+      : wakeupHook_(std::move(wakeupHook)),
+        eventLoopDoneHook_(std::move(eventLoopDoneHook)) {
+    startThread("TP_test_loop");
+  }
+
+  void close() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      closed_ = true;
+    }
+    cv_.notify_all();
+  }
+
+  void join() {
+    close();
+    joinThread();
+  }
+
+  uint64_t getTotalNumWakeups() {
+    return totalNumWakeups_.load();
+  }
+
+ protected:
+  void eventLoop() override {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&]() { return closed_ || numWakeups_ > 0; });
+        if (numWakeups_ == 0) {
+          break;
+        }
+        numWakeups_ = 0;
+      }
+      runDeferredFunctionsFromEventLoop();
+    }
+    if (eventLoopDoneHook_) {
+      eventLoopDoneHook_();
+    }
+  }
+
+  void wakeupEventLoopToDeferFunction() override {
+    if (wakeupHook_) {
+      wakeupHook_();
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      numWakeups_++;
+    }
+    totalNumWakeups_++;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool closed_{false};
+  uint64_t numWakeups_{0};
+  std::atomic<uint64_t> totalNumWakeups_{0};
+  const std::function<void()> wakeupHook_;
+  const std::function<void()> eventLoopDoneHook_;
+};
+
+} // namespace
+
+TEST(EventLoopDeferredExecutor, PreservesOrderPerThread) {
+  constexpr int kNumThreads = 8;
+  constexpr int kNumTasks = 10000;
+
+  TestLoop loop;
+  std::vector<int> lastSeen(kNumThreads, -1);
+  bool outOfOrder = false;
+
+  std::vector<std::thread> threads;
+  for (int threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    threads.emplace_back([&, threadIdx]() {
+      for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+        loop.deferToLoop([&, threadIdx, taskIdx]() {
+          EXPECT_TRUE(loop.inLoop());
+          if (lastSeen[threadIdx] != taskIdx - 1) {
+            outOfOrder = true;
+          }
+          lastSeen[threadIdx] = taskIdx;
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  loop.runInLoop([]() {});
+  EXPECT_FALSE(loop.inLoop());
+  loop.join();
+
+  EXPECT_FALSE(outOfOrder);
+  for (int threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    EXPECT_EQ(lastSeen[threadIdx], kNumTasks - 1);
+  }
+}
+
+TEST(EventLoopDeferredExecutor, MoveOnlyTask) {
+  TestLoop loop;
+
+  std::promise<int> promise;
+  std::future<int> future = promise.get_future();
+  auto value = std::make_unique<int>(42);
+  loop.deferToLoop(
+      [promise{std::move(promise)}, value{std::move(value)}]() mutable {
+        promise.set_value(*value);
+      });
+  EXPECT_EQ(future.get(), 42);
+
+  loop.join();
+}
+
+TEST(EventLoopDeferredExecutor, DeferAfterJoin) {
+  TestLoop loop;
+  loop.join();
+
+  // Once the loop's thread is gone, tasks are run inline by the caller.
+  bool done = false;
+  loop.deferToLoop([&]() {
+    EXPECT_TRUE(loop.inLoop());
+    done = true;
+  });
+  EXPECT_TRUE(done);
+}
+
+TEST(EventLoopDeferredExecutor, DeferInBatch) {
+  constexpr int kNumTasks = 10;
+
+  TestLoop loop;
+  std::vector<int> seen;
+
+  beginDeferredBatch();
+  for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+    loop.deferToLoop([&, taskIdx]() { seen.push_back(taskIdx); });
+  }
+  // Nothing was handed over yet.
+  EXPECT_EQ(loop.getTotalNumWakeups(), 0);
+  endDeferredBatch();
+
+  loop.runInLoop([]() {});
+  EXPECT_EQ(loop.getTotalNumWakeups(), 2);
+  ASSERT_EQ(seen.size(), kNumTasks);
+  for (int taskIdx = 0; taskIdx < kNumTasks; taskIdx++) {
+    EXPECT_EQ(seen[taskIdx], taskIdx);
+  }
+
+  loop.join();
+}
+
+TEST(EventLoopDeferredExecutor, DeferInBatchBeyondMaxSize) {
+  TestLoop loop;
+  std::atomic<size_t> numTasksRun{0};
+
+  beginDeferredBatch();
+  for (size_t taskIdx = 0; taskIdx < kMaxDeferredBatchSize; taskIdx++) {
+    loop.deferToLoop([&]() { numTasksRun++; });
+  }
+  // A full batch is handed over without waiting for the end.
+  EXPECT_EQ(loop.getTotalNumWakeups(), 1);
+  loop.deferToLoop([&]() { numTasksRun++; });
+  // Waiting for a task flushes the batch rather than deadlocking.
+  loop.runInLoop([]() {});
+  EXPECT_EQ(numTasksRun.load(), kMaxDeferredBatchSize + 1);
+  endDeferredBatch();
+
+  loop.join();
+}
+
+TEST(EventLoopDeferredExecutor, DeferInBatchAfterJoin) {
+  TestLoop loop;
+  loop.join();
+
+  std::vector<int> seen;
+  beginDeferredBatch();
+  loop.deferToLoop([&]() { seen.push_back(0); });
+  loop.deferToLoop([&]() { seen.push_back(1); });
+  endDeferredBatch();
+  EXPECT_EQ(seen, std::vector<int>({0, 1}));
+}
+
+TEST(EventLoopDeferredExecutor, DeferInBatchOfOtherThreadAcrossJoin) {
+  auto loop = std::make_unique<TestLoop>();
+  std::atomic<bool> done{false};
+  std::promise<void> deferredPromise;
+  std::promise<void> destroyedPromise;
+
+  std::thread thread([&]() {
+    beginDeferredBatch();
+    loop->deferToLoop([&]() { done = true; });
+    deferredPromise.set_value();
+    destroyedPromise.get_future().get();
+    // The loop took the task, hence this mustn't touch it anymore.
+    endDeferredBatch();
+  });
+
+  deferredPromise.get_future().get();
+  EXPECT_EQ(loop->getTotalNumWakeups(), 0);
+  loop->join();
+  EXPECT_TRUE(done);
+  loop.reset();
+  destroyedPromise.set_value();
+  thread.join();
+}
+
+TEST(EventLoopDeferredExecutor, DeferInBatchWhileClosing) {
+  // A thread whose batch is being flushed to a loop with a blocking wakeup
+  // holds the lock of its batch, which stalls the other loop right after it
+  // starts closing, as it goes through the batches to take its tasks.
+  std::promise<void> wakeupStartedPromise;
+  std::promise<void> unblockWakeupPromise;
+  std::shared_future<void> unblockWakeupFuture =
+      unblockWakeupPromise.get_future().share();
+  std::atomic<bool> blocked{false};
+  TestLoop blockingLoop([&]() {
+    if (!blocked.exchange(true)) {
+      wakeupStartedPromise.set_value();
+      unblockWakeupFuture.wait();
+    }
+  });
+  std::thread blockingThread([&]() {
+    beginDeferredBatch();
+    blockingLoop.deferToLoop([]() {});
+    endDeferredBatch();
+  });
+  wakeupStartedPromise.get_future().get();
+
+  std::promise<void> eventLoopDonePromise;
+  auto loop = std::make_unique<TestLoop>(
+      nullptr, [&]() { eventLoopDonePromise.set_value(); });
+  std::vector<int> seen;
+  std::promise<void> firstDeferredPromise;
+  std::promise<void> closingPromise;
+  std::promise<void> secondDeferredPromise;
+  std::thread thread([&]() {
+    beginDeferredBatch();
+    loop->deferToLoop([&]() { seen.push_back(0); });
+    firstDeferredPromise.set_value();
+    closingPromise.get_future().get();
+    // The loop is closing, but hasn't taken the first task yet, which must
+    // still run before this one.
+    loop->deferToLoop([&]() { seen.push_back(1); });
+    endDeferredBatch();
+    secondDeferredPromise.set_value();
+  });
+  firstDeferredPromise.get_future().get();
+
+  std::thread closingThread([&]() { loop->join(); });
+  eventLoopDonePromise.get_future().get();
+  // Give the loop time to start closing, and to get stuck.
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  closingPromise.set_value();
+  secondDeferredPromise.get_future().get();
+
+  unblockWakeupPromise.set_value();
+  thread.join();
+  blockingThread.join();
+  closingThread.join();
+  EXPECT_EQ(seen, std::vector<int>({0, 1}));
+
+  blockingLoop.join();
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/dsa.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(DsaCopyEngine, Copy) {
+  std::shared_ptr<DsaCopyEngine> engine = DsaCopyEngine::create();
+  if (engine == nullptr) {
+    // There's nothing to test on hosts without a work queue for user space.
+    return;
+  }
+
+  // One copy small enough for the CPU, and two that go to the device in a
+  // batch, one of which has pages that haven't been touched yet.
+  const std::vector<size_t> lengths = {
+      100, 4 * DsaCopyEngine::kMinOffloadLength, 8 * 1024 * 1024 + 1};
+  std::vector<std::vector<uint8_t>> srcs;
+  std::vector<std::unique_ptr<uint8_t[]>> dsts;
+  std::vector<DsaCopyEngine::Copy> copies;
+  for (size_t length : lengths) {
+    std::vector<uint8_t> src(length);
+    for (size_t idx = 0; idx < length; idx++) {
+      src[idx] = static_cast<uint8_t>(idx * 7 + length);
+    }
+    srcs.push_back(std::move(src));
+    dsts.emplace_back(new uint8_t[length]);
+    copies.push_back(
+        DsaCopyEngine::Copy{dsts.back().get(), srcs.back().data(), length});
+  }
+  engine->copy(copies.data(), copies.size());
+
+  for (size_t copyIdx = 0; copyIdx < lengths.size(); copyIdx++) {
+    EXPECT_EQ(
+        std::vector<uint8_t>(
+            dsts[copyIdx].get(), dsts[copyIdx].get() + lengths[copyIdx]),
+        srcs[copyIdx]);
+  }
+}
@@ -250,3 +250,30 @@ TEST(ShmLoop, Defer) {
   future.wait();
   ASSERT_TRUE(future.valid());
 }
+
+TEST(ShmLoop, PollFromLoop) {
+  OnDemandDeferredExecutor deferredExecutor;
+  EpollLoop loop{
+      deferredExecutor, /*cpus=*/{}, /*batchSize=*/1, /*pollFromLoop=*/true};
+  auto handler = std::make_shared<Handler>();
+  auto efd = Fd(eventfd(0, EFD_NONBLOCK));
+
+  deferredExecutor.runInLoop([&]() {
+    loop.registerDescriptor(efd.fd(), EPOLLIN, handler);
+    EXPECT_FALSE(loop.pollFromLoop());
+  });
+
+  efd.writeOrThrow<uint64_t>(1337);
+  deferredExecutor.runInLoop([&]() { EXPECT_TRUE(loop.pollFromLoop()); });
+  ASSERT_EQ(handler->nextEvents(), EPOLLIN);
+  ASSERT_EQ(efd.readOrThrow<uint64_t>(), 1337);
+
+  // Once unregistered, the handler isn't called, even for pending events.
+  efd.writeOrThrow<uint64_t>(1337);
+  deferredExecutor.runInLoop([&]() {
+    loop.unregisterDescriptor(efd.fd());
+    EXPECT_FALSE(loop.pollFromLoop());
+  });
+
+  loop.join();
+}
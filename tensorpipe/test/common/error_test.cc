@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/error_macros.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+class CountedError final : public BaseError {
+ public:
+  explicit CountedError(int& numAlive) : numAlive_(numAlive) {
+    numAlive_++;
+  }
+
+  ~CountedError() override {
+    numAlive_--;
+  }
+
+  std::string what() const override {
+    return "counted";
+  }
+
+ private:
+  int& numAlive_;
+};
+
+} // namespace
+
+TEST(Error, Success) {
+  // A success is a bare null pointer.
+  EXPECT_EQ(sizeof(Error), sizeof(void*));
+  Error error;
+  EXPECT_FALSE(error);
+  Error copy = Error::kSuccess;
+  EXPECT_FALSE(copy);
+  EXPECT_FALSE(copy.isOfType<EOFError>());
+}
+
+TEST(Error, CopyAndMove) {
+  int numAlive = 0;
+  {
+    Error error = TP_CREATE_ERROR(CountedError, numAlive);
+    EXPECT_EQ(numAlive, 1);
+    EXPECT_TRUE(error);
+    EXPECT_EQ(error.what(), "counted");
+    EXPECT_TRUE(error.isOfType<CountedError>());
+    EXPECT_FALSE(error.isOfType<EOFError>());
+
+    Error copy = error;
+    Error moved = std::move(error);
+    EXPECT_FALSE(error);
+    EXPECT_EQ(copy.what(), "counted");
+    EXPECT_EQ(moved.what(), "counted");
+    EXPECT_EQ(numAlive, 1);
+
+    copy = Error::kSuccess;
+    EXPECT_FALSE(copy);
+    EXPECT_EQ(numAlive, 1);
+    copy = moved;
+    EXPECT_EQ(copy.what(), "counted");
+  }
+  EXPECT_EQ(numAlive, 0);
+}
+
+TEST(Error, Overwrite) {
+  int numAlive = 0;
+  Error error = TP_CREATE_ERROR(CountedError, numAlive);
+  error = TP_CREATE_ERROR(EOFError);
+  EXPECT_EQ(numAlive, 0);
+  EXPECT_TRUE(error.isOfType<EOFError>());
+  EXPECT_EQ(error.what(), "eof");
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/function.h>
+
+#include <array>
+#include <memory>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(Function, Empty) {
+  Function<void()> fn;
+  EXPECT_FALSE(fn);
+  EXPECT_THROW(fn(), std::bad_function_call);
+
+  std::function<void()> stdFn;
+  Function<void()> fromStdFn = stdFn;
+  EXPECT_FALSE(fromStdFn);
+}
+
+TEST(Function, MoveOnlyCapture) {
+  auto value = std::make_unique<int>(42);
+  Function<int(int)> fn = [value{std::move(value)}](int x) {
+    return *value + x;
+  };
+  EXPECT_EQ(fn(1), 43);
+
+  Function<int(int)> other = std::move(fn);
+  EXPECT_FALSE(fn);
+  EXPECT_TRUE(other);
+  EXPECT_EQ(other(2), 44);
+}
+
+TEST(Function, LargeCapture) {
+  std::array<char, 1024> buffer;
+  buffer.fill('x');
+  Function<size_t(const std::string&)> fn = [buffer](const std::string& str) {
+    return buffer.size() + str.size();
+  };
+  Function<size_t(const std::string&)> other;
+  other = std::move(fn);
+  EXPECT_EQ(other("abc"), 1027);
+}
+
+TEST(Function, DestroysCallable) {
+  auto value = std::make_shared<int>(0);
+  {
+    Function<void()> fn = [value]() {};
+    EXPECT_EQ(value.use_count(), 2);
+    Function<void()> other = std::move(fn);
+    EXPECT_EQ(value.use_count(), 2);
+    other = nullptr;
+    EXPECT_EQ(value.use_count(), 1);
+  }
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(Function, MutableState) {
+  Function<int()> fn = [count{0}]() mutable { return ++count; };
+  EXPECT_EQ(fn(), 1);
+  EXPECT_EQ(fn(), 2);
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include <tensorpipe/common/ibv.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// The regions that are registered with the fake library, from their address
+// to their length, and how many registrations there were in total.
+std::map<void*, size_t> registeredRegions;
+size_t numRegistrations = 0;
+
+IbvLib::mr* fakeRegMr(
+    IbvLib::pd* /* unused */,
+    void* addr,
+    size_t length,
+    int /* unused */) {
+  numRegistrations++;
+  registeredRegions[addr] = length;
+  IbvLib::mr* mr = new IbvLib::mr();
+  mr->addr = addr;
+  mr->length = length;
+  return mr;
+}
+
+int fakeDeregMr(IbvLib::mr* mr) {
+  registeredRegions.erase(mr->addr);
+  delete mr;
+  return 0;
+}
+
+class IbvRegistrationCacheTest : public ::testing::Test {
+ protected:
+  static constexpr size_t kRegionSize = 100;
+
+  IbvRegistrationCacheTest() : buffer_(10 * kRegionSize) {
+    registeredRegions.clear();
+    numRegistrations = 0;
+    ibvLib_.override_reg_mr(&fakeRegMr);
+    ibvLib_.override_dereg_mr(&fakeDeregMr);
+  }
+
+  // The address of the region with the given index within the buffer, which
+  // leaves a gap between regions so that they don't get merged.
+  void* region(size_t idx) {
+    return buffer_.data() + 2 * idx * kRegionSize;
+  }
+
+  bool isRegistered(size_t idx) {
+    return registeredRegions.count(region(idx)) > 0;
+  }
+
+  IbvLib ibvLib_;
+  IbvProtectionDomain pd_;
+
+ private:
+  std::vector<uint8_t> buffer_;
+};
+
+constexpr size_t IbvRegistrationCacheTest::kRegionSize;
+
+} // namespace
+
+TEST_F(IbvRegistrationCacheTest, Hit) {
+  IbvRegistrationCache cache(
+      ibvLib_, pd_, /*accessFlags=*/0, /*capacity=*/10 * kRegionSize);
+
+  IbvRegistrationCache::Handle mr =
+      cache.registerRegion(region(0), kRegionSize);
+  EXPECT_EQ(numRegistrations, 1);
+  EXPECT_EQ(mr->addr, region(0));
+  EXPECT_EQ(mr->length, kRegionSize);
+  EXPECT_EQ(cache.cachedBytes(), kRegionSize);
+  mr.reset();
+  // The region stays registered once nothing refers to it.
+  EXPECT_TRUE(isRegistered(0));
+
+  // Looking up the same range, or one that's covered by it, is served by the
+  // cached region.
+  mr = cache.registerRegion(region(0), kRegionSize);
+  EXPECT_EQ(mr->addr, region(0));
+  mr = cache.registerRegion(
+      static_cast<uint8_t*>(region(0)) + 10, kRegionSize - 20);
+  EXPECT_EQ(mr->addr, region(0));
+  EXPECT_EQ(numRegistrations, 1);
+
+  // Another range gets a region of its own.
+  mr = cache.registerRegion(region(1), kRegionSize);
+  EXPECT_EQ(mr->addr, region(1));
+  EXPECT_EQ(numRegistrations, 2);
+  EXPECT_EQ(cache.cachedBytes(), 2 * kRegionSize);
+}
+
+TEST_F(IbvRegistrationCacheTest, EvictLeastRecentlyUsed) {
+  IbvRegistrationCache cache(
+      ibvLib_, pd_, /*accessFlags=*/0, /*capacity=*/3 * kRegionSize);
+
+  cache.registerRegion(region(0), kRegionSize);
+  cache.registerRegion(region(1), kRegionSize);
+  cache.registerRegion(region(2), kRegionSize);
+  EXPECT_EQ(cache.cachedBytes(), 3 * kRegionSize);
+  // This makes the second region the least recently used one.
+  cache.registerRegion(region(0), kRegionSize);
+  EXPECT_EQ(numRegistrations, 3);
+
+  cache.registerRegion(region(3), kRegionSize);
+  EXPECT_EQ(numRegistrations, 4);
+  EXPECT_EQ(cache.cachedBytes(), 3 * kRegionSize);
+  EXPECT_TRUE(isRegistered(0));
+  EXPECT_FALSE(isRegistered(1));
+  EXPECT_TRUE(isRegistered(2));
+  EXPECT_TRUE(isRegistered(3));
+
+  cache.registerRegion(region(4), kRegionSize);
+  EXPECT_TRUE(isRegistered(0));
+  EXPECT_FALSE(isRegistered(2));
+  EXPECT_TRUE(isRegistered(3));
+  EXPECT_TRUE(isRegistered(4));
+
+  // The regions that are still cached are hits.
+  cache.registerRegion(region(0), kRegionSize);
+  cache.registerRegion(region(3), kRegionSize);
+  cache.registerRegion(region(4), kRegionSize);
+  EXPECT_EQ(numRegistrations, 5);
+}
+
+TEST_F(IbvRegistrationCacheTest, DontEvictRegionsInUse) {
+  IbvRegistrationCache cache(
+      ibvLib_, pd_, /*accessFlags=*/0, /*capacity=*/2 * kRegionSize);
+
+  IbvRegistrationCache::Handle mr =
+      cache.registerRegion(region(0), kRegionSize);
+  cache.registerRegion(region(1), kRegionSize);
+
+  // The first region is the least recently used one, but it's in use.
+  cache.registerRegion(region(2), kRegionSize);
+  EXPECT_TRUE(isRegistered(0));
+  EXPECT_FALSE(isRegistered(1));
+  EXPECT_TRUE(isRegistered(2));
+
+  // When all of them are in use, the new region isn't cached, and is
+  // deregistered as soon as it's released.
+  IbvRegistrationCache::Handle other =
+      cache.registerRegion(region(2), kRegionSize);
+  IbvRegistrationCache::Handle uncached =
+      cache.registerRegion(region(3), kRegionSize);
+  EXPECT_TRUE(isRegistered(3));
+  EXPECT_EQ(cache.cachedBytes(), 2 * kRegionSize);
+  uncached.reset();
+  EXPECT_FALSE(isRegistered(3));
+
+  // A region that's evicted while in use stays registered until released.
+  cache.invalidate(region(0), kRegionSize);
+  EXPECT_EQ(cache.cachedBytes(), kRegionSize);
+  EXPECT_TRUE(isRegistered(0));
+  mr.reset();
+  EXPECT_FALSE(isRegistered(0));
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/latency_histogram.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(LatencyHistogram, BucketBounds) {
+  for (uint64_t ns : {0ull, 1ull, 7ull, 8ull, 9ull, 100ull, 12345ull}) {
+    size_t idx = LatencyHistogram::bucketIdx(ns);
+    EXPECT_LE(ns, LatencyHistogram::bucketUpperBound(idx));
+    if (idx > 0) {
+      EXPECT_GT(ns, LatencyHistogram::bucketUpperBound(idx - 1));
+    }
+  }
+  // The relative error stays the same as latencies grow.
+  uint64_t ns = 1000000007;
+  uint64_t upperBound =
+      LatencyHistogram::bucketUpperBound(LatencyHistogram::bucketIdx(ns));
+  EXPECT_LE(upperBound - ns, ns / LatencyHistogram::kNumSubBuckets);
+  EXPECT_EQ(
+      LatencyHistogram::bucketIdx(UINT64_MAX),
+      LatencyHistogram::kNumBuckets - 1);
+}
+
+TEST(LatencyHistogram, Percentiles) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.snapshot().percentileNanoseconds(0.99), 0);
+
+  for (int i = 0; i < 990; i++) {
+    histogram.record(std::chrono::microseconds(1));
+  }
+  for (int i = 0; i < 10; i++) {
+    histogram.record(std::chrono::milliseconds(1));
+  }
+
+  LatencyStats stats = histogram.snapshot();
+  EXPECT_EQ(stats.count, 1000);
+  EXPECT_EQ(stats.sumNanoseconds, 990 * 1000 + 10 * 1000000);
+  EXPECT_GE(stats.percentileNanoseconds(0.5), 1000);
+  EXPECT_LT(stats.percentileNanoseconds(0.5), 1200);
+  EXPECT_LT(stats.percentileNanoseconds(0.99), 1200);
+  EXPECT_GE(stats.percentileNanoseconds(0.999), 1000000);
+  EXPECT_LT(stats.percentileNanoseconds(0.999), 1200000);
+}
+
+TEST(LatencyHistogram, Merge) {
+  LatencyHistogram histogram1;
+  LatencyHistogram histogram2;
+  histogram1.record(std::chrono::nanoseconds(10));
+  histogram2.record(std::chrono::nanoseconds(1000));
+
+  LatencyStats stats;
+  stats.merge(histogram1.snapshot());
+  stats.merge(histogram2.snapshot());
+  stats.merge(LatencyHistogram().snapshot());
+  EXPECT_EQ(stats.count, 2);
+  EXPECT_EQ(stats.sumNanoseconds, 1010);
+  EXPECT_LT(stats.percentileNanoseconds(0.5), 1000);
+  EXPECT_GE(stats.percentileNanoseconds(1), 1000);
+}
+
+TEST(LatencyHistogram, ConcurrentRecords) {
+  LatencyHistogram histogram;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < 10000; i++) {
+        histogram.record(std::chrono::nanoseconds(i));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(histogram.snapshot().count, 40000);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/mpmc_queue.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(MpmcQueue, Fifo) {
+  MpmcQueue<int> queue(3);
+
+  // The capacity was rounded up to 4.
+  for (int i = 0; i < 4; i++) {
+    int item = i;
+    EXPECT_TRUE(queue.tryPush(item));
+  }
+  int item = 4;
+  EXPECT_FALSE(queue.tryPush(item));
+
+  for (int i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.tryPop(item));
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_FALSE(queue.tryPop(item));
+}
+
+TEST(MpmcQueue, DestroysRemainingItems) {
+  auto counter = std::make_shared<int>(0);
+  {
+    MpmcQueue<std::shared_ptr<int>> queue(4);
+    queue.push(counter);
+    queue.push(counter);
+    EXPECT_EQ(counter.use_count(), 3);
+  }
+  EXPECT_EQ(counter.use_count(), 1);
+}
+
+TEST(MpmcQueue, ManyProducersAndConsumers) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumItemsPerThread = 100000;
+  // A small capacity makes both sides wait on each other.
+  MpmcQueue<int> queue(16);
+
+  std::vector<std::thread> producers;
+  for (int threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    producers.emplace_back([&queue, threadIdx]() {
+      for (int i = 0; i < kNumItemsPerThread; i++) {
+        queue.push(threadIdx * kNumItemsPerThread + i);
+      }
+    });
+  }
+
+  std::vector<std::vector<int>> popped(kNumThreads);
+  std::vector<std::thread> consumers;
+  for (int threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    consumers.emplace_back([&queue, &popped, threadIdx]() {
+      for (int i = 0; i < kNumItemsPerThread; i++) {
+        popped[threadIdx].push_back(queue.pop());
+      }
+    });
+  }
+
+  for (auto& thread : producers) {
+    thread.join();
+  }
+  for (auto& thread : consumers) {
+    thread.join();
+  }
+
+  // Each item was popped exactly once, and each consumer saw the items of any
+  // given producer in the order in which they were pushed.
+  std::vector<bool> seen(kNumThreads * kNumItemsPerThread, false);
+  for (const auto& items : popped) {
+    std::vector<int> lastOfProducer(kNumThreads, -1);
+    for (int item : items) {
+      EXPECT_FALSE(seen[item]);
+      seen[item] = true;
+      const int producerIdx = item / kNumItemsPerThread;
+      EXPECT_GT(item, lastOfProducer[producerIdx]);
+      lastOfProducer[producerIdx] = item;
+    }
+  }
+}
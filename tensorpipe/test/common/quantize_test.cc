@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <tensorpipe/common/quantize.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// An odd number of values, so that the vector kernels leave a tail.
+std::vector<float> makeValues(size_t numValues) {
+  std::vector<float> values(numValues);
+  for (size_t idx = 0; idx < numValues; idx++) {
+    values[idx] = std::sin(static_cast<float>(idx)) * (1 + idx % 7);
+  }
+  return values;
+}
+
+std::vector<float> roundTrip(
+    QuantizationFormat format,
+    const std::vector<float>& values,
+    size_t blockSize = 0) {
+  std::vector<uint8_t> quantized(
+      quantizedLength(format, values.size(), blockSize));
+  quantize(format, values.data(), values.size(), quantized.data(), blockSize);
+  std::vector<float> result(values.size());
+  dequantize(
+      format, quantized.data(), values.size(), result.data(), blockSize);
+  return result;
+}
+
+} // namespace
+
+TEST(Quantize, Lengths) {
+  EXPECT_EQ(quantizedLength(QuantizationFormat::kBf16, 10, 0), 20);
+  EXPECT_EQ(quantizedLength(QuantizationFormat::kFp16, 10, 0), 20);
+  // Three blocks, the last one partial, each with its scale.
+  EXPECT_EQ(quantizedLength(QuantizationFormat::kInt8, 10, 4), 10 + 3 * 4);
+}
+
+TEST(Quantize, Bf16) {
+  const std::vector<float> values = makeValues(1001);
+  const std::vector<float> result =
+      roundTrip(QuantizationFormat::kBf16, values);
+  for (size_t idx = 0; idx < values.size(); idx++) {
+    // 8 bits of mantissa, rounded to nearest.
+    EXPECT_NEAR(result[idx], values[idx], std::fabs(values[idx]) / 256)
+        << "at " << idx;
+  }
+
+  const std::vector<float> special = {
+      0.0f,
+      -0.0f,
+      1.0f,
+      std::numeric_limits<float>::infinity(),
+      -std::numeric_limits<float>::infinity(),
+      // Exactly halfway between two bf16 values, which rounds to the even one.
+      1.0f + 1.0f / 256,
+      1.0f + 3.0f / 256,
+      std::numeric_limits<float>::quiet_NaN(),
+      std::numeric_limits<float>::signaling_NaN()};
+  const std::vector<float> specialResult =
+      roundTrip(QuantizationFormat::kBf16, special);
+  for (size_t idx = 0; idx < 7; idx++) {
+    EXPECT_EQ(std::signbit(specialResult[idx]), std::signbit(special[idx]));
+  }
+  EXPECT_EQ(specialResult[0], 0.0f);
+  EXPECT_EQ(specialResult[2], 1.0f);
+  EXPECT_EQ(specialResult[3], std::numeric_limits<float>::infinity());
+  EXPECT_EQ(specialResult[4], -std::numeric_limits<float>::infinity());
+  EXPECT_EQ(specialResult[5], 1.0f);
+  EXPECT_EQ(specialResult[6], 1.0f + 4.0f / 256);
+  EXPECT_TRUE(std::isnan(specialResult[7]));
+  EXPECT_TRUE(std::isnan(specialResult[8]));
+}
+
+TEST(Quantize, Fp16) {
+  const std::vector<float> values = makeValues(1001);
+  const std::vector<float> result =
+      roundTrip(QuantizationFormat::kFp16, values);
+  for (size_t idx = 0; idx < values.size(); idx++) {
+    // 11 bits of mantissa, rounded to nearest, above the subnormals.
+    EXPECT_NEAR(
+        result[idx], values[idx], std::fabs(values[idx]) / 2048 + 1e-7f)
+        << "at " << idx;
+  }
+
+  // Enough values for the vector kernel to see them too.
+  std::vector<float> special = {
+      1.0f,
+      65504.0f,
+      65536.0f,
+      -std::numeric_limits<float>::infinity(),
+      std::ldexp(1.0f, -24),
+      std::ldexp(1.0f, -26),
+      std::numeric_limits<float>::quiet_NaN(),
+      -2.0f};
+  special.insert(special.end(), special.begin(), special.end());
+  special.push_back(65504.0f);
+  const std::vector<float> specialResult =
+      roundTrip(QuantizationFormat::kFp16, special);
+  for (size_t offset : {0, 8}) {
+    EXPECT_EQ(specialResult[offset + 0], 1.0f);
+    EXPECT_EQ(specialResult[offset + 1], 65504.0f);
+    EXPECT_EQ(
+        specialResult[offset + 2], std::numeric_limits<float>::infinity());
+    EXPECT_EQ(
+        specialResult[offset + 3], -std::numeric_limits<float>::infinity());
+    // The smallest subnormal, and something that rounds to zero.
+    EXPECT_EQ(specialResult[offset + 4], std::ldexp(1.0f, -24));
+    EXPECT_EQ(specialResult[offset + 5], 0.0f);
+    EXPECT_TRUE(std::isnan(specialResult[offset + 6]));
+    EXPECT_EQ(specialResult[offset + 7], -2.0f);
+  }
+  EXPECT_EQ(specialResult[16], 65504.0f);
+}
+
+TEST(Quantize, Int8) {
+  constexpr size_t kBlockSize = 100;
+  const std::vector<float> values = makeValues(1001);
+  const std::vector<float> result =
+      roundTrip(QuantizationFormat::kInt8, values, kBlockSize);
+  for (size_t offset = 0; offset < values.size(); offset += kBlockSize) {
+    const size_t end = std::min(offset + kBlockSize, values.size());
+    float maxAbs = 0;
+    for (size_t idx = offset; idx < end; idx++) {
+      maxAbs = std::max(maxAbs, std::fabs(values[idx]));
+    }
+    // Off by at most half a step, plus some leeway for the float arithmetic.
+    const float step = maxAbs / 127;
+    for (size_t idx = offset; idx < end; idx++) {
+      EXPECT_NEAR(result[idx], values[idx], step * 0.501f) << "at " << idx;
+    }
+  }
+
+  // A block of zeros has a scale of zero, which mustn't be divided by.
+  const std::vector<float> zeros(20, 0.0f);
+  for (float value : roundTrip(QuantizationFormat::kInt8, zeros, 8)) {
+    EXPECT_EQ(value, 0.0f);
+  }
+}
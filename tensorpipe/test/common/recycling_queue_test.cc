@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/recycling_queue.h>
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+struct Item {
+  int value{-1};
+  std::vector<int> values;
+};
+
+void recycleItem(Item& item) {
+  std::vector<int> values = std::move(item.values);
+  values.clear();
+  item = Item();
+  item.values = std::move(values);
+}
+
+} // namespace
+
+TEST(RecyclingQueue, Fifo) {
+  RecyclingQueue<Item> queue(recycleItem);
+  EXPECT_TRUE(queue.empty());
+
+  for (int i = 0; i < 10; i++) {
+    queue.emplace_back().value = i;
+  }
+  EXPECT_EQ(queue.size(), 10);
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(queue[i].value, i);
+  }
+
+  for (int i = 0; i < 10; i++) {
+    EXPECT_EQ(queue.front().value, i);
+    queue.pop_front();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(RecyclingQueue, PopBack) {
+  RecyclingQueue<Item> queue(recycleItem);
+
+  for (int i = 0; i < 10; i++) {
+    queue.emplace_back().value = i;
+  }
+  queue.pop_front();
+  queue.pop_back();
+  EXPECT_EQ(queue.size(), 8);
+  EXPECT_EQ(queue.front().value, 1);
+  EXPECT_EQ(queue.back().value, 8);
+
+  // The slot that was taken off the back is the first to be reused.
+  Item& item = queue.emplace_back();
+  EXPECT_EQ(item.value, -1);
+  EXPECT_EQ(queue.size(), 9);
+}
+
+TEST(RecyclingQueue, ReferencesSurviveGrowth) {
+  RecyclingQueue<Item> queue(recycleItem);
+
+  // Make the head wrap around before the queue needs to grow.
+  queue.emplace_back();
+  queue.emplace_back();
+  queue.pop_front();
+  Item& item = queue.emplace_back();
+  item.value = 42;
+  for (int i = 0; i < 100; i++) {
+    queue.emplace_back().value = i;
+  }
+  EXPECT_EQ(&item, &queue[1]);
+  EXPECT_EQ(item.value, 42);
+}
+
+TEST(RecyclingQueue, ElementsAreReused) {
+  RecyclingQueue<Item> queue(recycleItem);
+
+  Item& item = queue.emplace_back();
+  item.value = 42;
+  item.values.resize(1000);
+  const int* data = item.values.data();
+  queue.pop_front();
+
+  Item& newItem = queue.emplace_back();
+  EXPECT_EQ(&item, &newItem);
+  EXPECT_EQ(newItem.value, -1);
+  EXPECT_TRUE(newItem.values.empty());
+  EXPECT_GE(newItem.values.capacity(), 1000);
+  newItem.values.resize(1000);
+  EXPECT_EQ(newItem.values.data(), data);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cmath>
+#include <vector>
+
+#include <tensorpipe/common/reduce.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// An odd number of values, so that the vector kernels leave a tail.
+template <typename T>
+void checkReduce(ReduceOp op, ReduceDataType dataType) {
+  constexpr size_t kNumValues = 1001;
+  std::vector<T> dst(kNumValues);
+  std::vector<T> src(kNumValues);
+  for (size_t idx = 0; idx < kNumValues; idx++) {
+    dst[idx] = std::sin(static_cast<T>(idx));
+    src[idx] = std::cos(static_cast<T>(idx));
+  }
+  std::vector<T> expected(kNumValues);
+  for (size_t idx = 0; idx < kNumValues; idx++) {
+    switch (op) {
+      case ReduceOp::kSum:
+        expected[idx] = dst[idx] + src[idx];
+        break;
+      case ReduceOp::kProduct:
+        expected[idx] = dst[idx] * src[idx];
+        break;
+      case ReduceOp::kMin:
+        expected[idx] = std::min(dst[idx], src[idx]);
+        break;
+      case ReduceOp::kMax:
+        expected[idx] = std::max(dst[idx], src[idx]);
+        break;
+    }
+  }
+  reduce(op, dataType, dst.data(), src.data(), kNumValues);
+  for (size_t idx = 0; idx < kNumValues; idx++) {
+    EXPECT_EQ(dst[idx], expected[idx]) << "at " << idx;
+  }
+}
+
+} // namespace
+
+TEST(Reduce, Float32) {
+  for (ReduceOp op :
+       {ReduceOp::kSum, ReduceOp::kProduct, ReduceOp::kMin, ReduceOp::kMax}) {
+    checkReduce<float>(op, ReduceDataType::kFloat32);
+  }
+}
+
+TEST(Reduce, Float64) {
+  for (ReduceOp op :
+       {ReduceOp::kSum, ReduceOp::kProduct, ReduceOp::kMin, ReduceOp::kMax}) {
+    checkReduce<double>(op, ReduceDataType::kFloat64);
+  }
+}
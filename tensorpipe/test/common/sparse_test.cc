@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <tensorpipe/common/sparse.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// Encode with the chosen format, check that, and decode back over garbage.
+void roundTrip(
+    const std::vector<uint8_t>& data,
+    SparseFormat expectedFormat,
+    size_t expectedLength) {
+  const SparseEncoding encoding =
+      chooseSparseEncoding(data.data(), data.size());
+  EXPECT_EQ(encoding.format, expectedFormat);
+  EXPECT_EQ(encoding.length, expectedLength);
+  std::vector<uint8_t> encoded(encoding.length);
+  sparseEncode(encoding.format, data.data(), data.size(), encoded.data());
+  std::vector<uint8_t> decoded(data.size(), 0xff);
+  EXPECT_TRUE(sparseDecode(
+      encoding.format,
+      encoded.data(),
+      encoded.size(),
+      decoded.data(),
+      decoded.size()));
+  EXPECT_EQ(decoded, data);
+}
+
+} // namespace
+
+TEST(Sparse, Dense) {
+  std::vector<uint8_t> data(1000);
+  for (size_t idx = 0; idx < data.size(); idx++) {
+    data[idx] = idx % 255 + 1;
+  }
+  roundTrip(data, SparseFormat::kDense, data.size());
+}
+
+TEST(Sparse, Blocks) {
+  // Two runs of non-zero bytes, one of them in the last (partial) block.
+  std::vector<uint8_t> data(100 * kSparseBlockSize + 10, 0);
+  std::memset(data.data() + 3 * kSparseBlockSize, 1, 2 * kSparseBlockSize);
+  data.back() = 1;
+  roundTrip(data, SparseFormat::kBlocks, 13 + 2 * kSparseBlockSize + 10);
+}
+
+TEST(Sparse, Pairs) {
+  // A few scattered words, including the very last one.
+  std::vector<uint8_t> data(4096, 0);
+  for (size_t offset : {4, 400, 1000, 4092}) {
+    data[offset] = 1;
+  }
+  roundTrip(data, SparseFormat::kPairs, 4 * 8);
+}
+
+TEST(Sparse, Zeros) {
+  std::vector<uint8_t> data(1024, 0);
+  roundTrip(data, SparseFormat::kPairs, 0);
+  // Pairs need whole words.
+  data.resize(1023);
+  roundTrip(data, SparseFormat::kBlocks, 2);
+}
+
+TEST(Sparse, Malformed) {
+  std::vector<uint8_t> dst(64);
+  // An index past the end.
+  const uint32_t pair[] = {16, 1};
+  EXPECT_FALSE(sparseDecode(
+      SparseFormat::kPairs, pair, sizeof(pair), dst.data(), dst.size()));
+  // A bitmap announcing a block that isn't there.
+  const uint8_t bitmap[] = {1};
+  EXPECT_FALSE(sparseDecode(
+      SparseFormat::kBlocks, bitmap, sizeof(bitmap), dst.data(), dst.size()));
+}
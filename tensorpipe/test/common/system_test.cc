@@ -8,6 +8,13 @@
 
 #include <tensorpipe/common/system.h>
 
+#include <atomic>
+#include <functional>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 using namespace tensorpipe;
@@ -36,3 +43,43 @@ TEST(Pow2, nextPow2) {
     EXPECT_EQ(nextPow2(p2 + 1), next_p2);
   }
 }
+
+TEST(ThreadStartHook, RunsOnInitializedThreads) {
+  std::promise<std::string> namePromise;
+  setThreadStartHook([&](const std::string& name) {
+    namePromise.set_value(name);
+    EXPECT_TRUE(applyThreadSettings(ThreadSettings()));
+  });
+  std::thread([]() { initCurrentThread("TP_test_thread"); }).join();
+  setThreadStartHook(nullptr);
+  EXPECT_EQ(namePromise.get_future().get(), "TP_test_thread");
+
+  // Once removed, the hook doesn't run anymore.
+  std::thread([]() { initCurrentThread("TP_test_thread"); }).join();
+}
+
+TEST(RunInParallel, RunsAllFunctions) {
+  std::vector<int> results(100, 0);
+  std::vector<std::function<void()>> fns;
+  for (size_t idx = 0; idx < results.size(); idx++) {
+    fns.emplace_back([&results, idx]() { results[idx] = idx + 1; });
+  }
+  runInParallel(std::move(fns), 8);
+  for (size_t idx = 0; idx < results.size(); idx++) {
+    EXPECT_EQ(results[idx], idx + 1);
+  }
+
+  // The first exception is rethrown, once all the functions ran.
+  std::atomic<int> numRun{0};
+  fns.clear();
+  for (size_t idx = 0; idx < 10; idx++) {
+    fns.emplace_back([&numRun, idx]() {
+      numRun++;
+      if (idx == 3) {
+        throw std::runtime_error("boom");
+      }
+    });
+  }
+  EXPECT_THROW(runInParallel(std::move(fns), 4), std::runtime_error);
+  EXPECT_EQ(numRun, 10);
+}
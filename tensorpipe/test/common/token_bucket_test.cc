@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+
+#include <tensorpipe/common/token_bucket.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(TokenBucket, Unlimited) {
+  TokenBucket bucket;
+  EXPECT_FALSE(bucket.isLimited());
+  bucket.take(1 << 30);
+  EXPECT_EQ(bucket.getDelay(1 << 30), TokenBucket::clock::duration::zero());
+}
+
+TEST(TokenBucket, Limited) {
+  TokenBucket bucket;
+  // A thousand bytes per millisecond, in bursts of up to ten milliseconds.
+  bucket.setRate(1e6, 10000);
+  EXPECT_TRUE(bucket.isLimited());
+
+  // It starts full, hence the burst goes through right away.
+  EXPECT_EQ(bucket.getDelay(10000), TokenBucket::clock::duration::zero());
+  bucket.take(10000);
+
+  // Then it takes a while to fill up again.
+  const TokenBucket::clock::duration delay = bucket.getDelay(10000);
+  EXPECT_GT(delay, std::chrono::milliseconds(5));
+  EXPECT_LE(delay, std::chrono::milliseconds(10));
+
+  // A transfer larger than the burst only waits for the bucket to be full, but
+  // it then leaves it in debt.
+  bucket.setRate(0, 0);
+  bucket.setRate(1e6, 10000);
+  EXPECT_EQ(bucket.getDelay(50000), TokenBucket::clock::duration::zero());
+  bucket.take(50000);
+  EXPECT_GT(bucket.getDelay(1), std::chrono::milliseconds(35));
+
+  // Removing the limit lets everything through.
+  bucket.setRate(0, 0);
+  EXPECT_FALSE(bucket.isLimited());
+  EXPECT_EQ(bucket.getDelay(50000), TokenBucket::clock::duration::zero());
+}
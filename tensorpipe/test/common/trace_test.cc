@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/common/trace.h>
+
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+size_t countOccurrences(
+    const std::string& haystack,
+    const std::string& needle) {
+  size_t count = 0;
+  for (size_t pos = haystack.find(needle); pos != std::string::npos;
+       pos = haystack.find(needle, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+std::string dump() {
+  std::ostringstream oss;
+  trace::dumpChromeTrace(oss);
+  return oss.str();
+}
+
+} // namespace
+
+TEST(Trace, RecordsOnlyWhenEnabled) {
+  const uint32_t scope = trace::internScope("test.pipe");
+  EXPECT_EQ(trace::internScope("test.pipe"), scope);
+
+  trace::enable();
+  auto begin = trace::TClock::now();
+  trace::recordSpan("stage", scope, 42, begin, trace::TClock::now());
+  { trace::Span span("callback", scope, 42); }
+  trace::disable();
+  trace::recordSpan("ignored", scope, 43, begin, trace::TClock::now());
+
+  std::string json = dump();
+  EXPECT_EQ(json.find("{\"displayTimeUnit\""), 0);
+  // An asynchronous stage has a beginning and an end, a synchronous one is a
+  // single complete event.
+  EXPECT_EQ(countOccurrences(json, "\"name\":\"stage\""), 2);
+  EXPECT_EQ(countOccurrences(json, "\"ph\":\"b\""), 1);
+  EXPECT_EQ(countOccurrences(json, "\"ph\":\"e\""), 1);
+  EXPECT_EQ(countOccurrences(json, "\"ph\":\"X\""), 1);
+  EXPECT_EQ(countOccurrences(json, "\"sequence_number\":42"), 2);
+  EXPECT_EQ(countOccurrences(json, "test.pipe#42"), 2);
+  EXPECT_EQ(countOccurrences(json, "ignored"), 0);
+}
+
+TEST(Trace, KeepsMostRecentEventsOfEachThread) {
+  const uint32_t scope = trace::internScope("test.ring");
+  trace::enable(/*numEventsPerThread=*/4);
+  auto record = [&]() {
+    for (int64_t seq = 0; seq < 10; seq++) {
+      auto now = trace::TClock::now();
+      trace::recordSpan("stage", scope, seq, now, now);
+    }
+  };
+  record();
+  std::thread(record).join();
+  trace::disable();
+
+  std::string json = dump();
+  EXPECT_EQ(countOccurrences(json, "\"ph\":\"b\""), 8);
+  EXPECT_EQ(countOccurrences(json, "\"sequence_number\":5"), 0);
+  EXPECT_EQ(countOccurrences(json, "\"sequence_number\":6"), 2);
+  EXPECT_EQ(countOccurrences(json, "\"sequence_number\":9"), 2);
+
+  // Enabling again starts afresh.
+  trace::enable();
+  trace::disable();
+  EXPECT_EQ(countOccurrences(dump(), "\"ph\":"), 0);
+}
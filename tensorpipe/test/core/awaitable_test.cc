@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/awaitable.h>
+
+#include <tensorpipe/tensorpipe.h>
+
+#if TENSORPIPE_HAS_COROUTINES
+
+#include <cstring>
+#include <exception>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// A coroutine that starts eagerly and whose frame is freed when it completes.
+struct FireAndForget {
+  struct promise_type {
+    FireAndForget get_return_object() {
+      return {};
+    }
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() {
+      std::terminate();
+    }
+  };
+};
+
+const std::string kPayloadData = "I'm a payload";
+const std::string kTensorData = "And I'm a tensor";
+
+Message makeMessage() {
+  Message message;
+  Message::Payload payload;
+  payload.data = const_cast<char*>(kPayloadData.data());
+  payload.length = kPayloadData.length();
+  message.payloads.push_back(std::move(payload));
+  Message::Tensor tensor{CpuBuffer{
+      const_cast<char*>(kTensorData.data()), kTensorData.length()}};
+  message.tensors.push_back(std::move(tensor));
+  return message;
+}
+
+FireAndForget writeMessage(Pipe& pipe, std::promise<void>& prom) {
+  PipeResult result = co_await asyncWrite(pipe, makeMessage());
+  EXPECT_FALSE(result.error) << result.error.what();
+  prom.set_value();
+}
+
+FireAndForget readMessage(
+    Pipe& pipe,
+    std::vector<std::unique_ptr<uint8_t[]>>& buffers,
+    std::promise<void>& prom) {
+  PipeResult result = co_await asyncReadDescriptor(pipe);
+  EXPECT_FALSE(result.error) << result.error.what();
+  Message& message = result.message;
+  for (auto& payload : message.payloads) {
+    buffers.push_back(std::make_unique<uint8_t[]>(payload.length));
+    payload.data = buffers.back().get();
+  }
+  for (auto& tensor : message.tensors) {
+    buffers.push_back(std::make_unique<uint8_t[]>(tensor.buffer.cpu.length));
+    tensor.buffer.cpu.ptr = buffers.back().get();
+  }
+
+  result = co_await asyncRead(pipe, std::move(message));
+  EXPECT_FALSE(result.error) << result.error.what();
+  // The ASSERT macros can't be used in coroutines, as they return.
+  if (result.message.payloads.size() == 1 &&
+      result.message.tensors.size() == 1) {
+    const Message::Payload& payload = result.message.payloads[0];
+    const CpuBuffer& tensor = result.message.tensors[0].buffer.cpu;
+    EXPECT_EQ(
+        std::string(static_cast<char*>(payload.data), payload.length),
+        kPayloadData);
+    EXPECT_EQ(
+        std::string(static_cast<char*>(tensor.ptr), tensor.length),
+        kTensorData);
+  } else {
+    ADD_FAILURE() << "Unexpected number of payloads or tensors";
+  }
+  prom.set_value();
+}
+
+} // namespace
+
+TEST(Awaitable, ClientPing) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  writeMessage(*clientPipe, writeCompletedProm);
+  readMessage(*serverPipe, buffers, readCompletedProm);
+
+  writeCompletedProm.get_future().get();
+  readCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+#endif // TENSORPIPE_HAS_COROUTINES
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <memory>
+
+#include <tensorpipe/core/buffer_pool.h>
+#include <tensorpipe/core/message.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+TEST(BufferPool, ReusesBlocksOfSameClass) {
+  BufferPool pool;
+  std::shared_ptr<void> block = pool.allocate(1000);
+  ASSERT_NE(block, nullptr);
+  void* ptr = block.get();
+  std::memset(ptr, 0x42, 1024);
+  block.reset();
+
+  // Lengths are rounded up to a power of two, and the block was kept by this
+  // thread.
+  block = pool.allocate(1024);
+  EXPECT_EQ(block.get(), ptr);
+
+  std::shared_ptr<void> other = pool.allocate(1024);
+  ASSERT_NE(other, nullptr);
+  EXPECT_NE(other.get(), ptr);
+}
+
+TEST(BufferPool, DeclinesTooLongBlocks) {
+  BufferPool::Options options;
+  options.maxBlockLength = 64 * 1024;
+  BufferPool pool(options);
+  EXPECT_EQ(pool.allocate(0), nullptr);
+  EXPECT_NE(pool.allocate(64 * 1024), nullptr);
+  EXPECT_EQ(pool.allocate(64 * 1024 + 1), nullptr);
+}
+
+TEST(BufferPool, BlocksOutliveThePool) {
+  std::shared_ptr<void> block;
+  {
+    BufferPool pool;
+    block = pool.allocate(4 * 1024 * 1024);
+    ASSERT_NE(block, nullptr);
+  }
+  std::memset(block.get(), 0x42, 4 * 1024 * 1024);
+}
+
+TEST(BufferPool, Allocator) {
+  BufferPool pool;
+  ContextOptions::allocator_fn allocator = pool.allocator();
+
+  Message message;
+  message.payloads.resize(2);
+  message.payloads[0].length = 100;
+  message.payloads[1].length = 100;
+  message.payloads[1].duplicateOf = 0;
+  message.tensors.resize(1);
+  message.tensors[0].buffer = CpuBuffer{nullptr, 5000};
+  ASSERT_TRUE(allocator(message));
+
+  EXPECT_NE(message.payloads[0].data, nullptr);
+  EXPECT_EQ(message.payloads[0].owner.get(), message.payloads[0].data);
+  // Duplicates are left to the pipe.
+  EXPECT_EQ(message.payloads[1].data, nullptr);
+  ASSERT_EQ(message.tensors[0].buffer.type, DeviceType::kCpu);
+  EXPECT_NE(message.tensors[0].buffer.cpu.ptr, nullptr);
+  EXPECT_EQ(message.tensors[0].buffer.cpu.length, 5000);
+  EXPECT_EQ(message.tensors[0].owner.get(), message.tensors[0].buffer.cpu.ptr);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/channel_router.h>
+
+#include <chrono>
+#include <string>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+// Send this many tensors, each taking as long as the given channel dictates.
+template <typename TDurationFn>
+void sendTensors(
+    ChannelRouter& router,
+    size_t length,
+    const std::string& fixedChoice,
+    int numTensors,
+    TDurationFn durationFn) {
+  for (int idx = 0; idx < numTensors; idx++) {
+    std::string name = router.select(length, fixedChoice);
+    router.record(name, length, durationFn(name));
+  }
+}
+
+} // namespace
+
+TEST(ChannelRouter, SwitchesToFasterChannel) {
+  ChannelRouter router;
+  router.addChannel("slow");
+  router.addChannel("fast");
+
+  sendTensors(router, 1000, "slow", 100, [](const std::string& name) {
+    return std::chrono::microseconds(name == "fast" ? 10 : 100);
+  });
+
+  auto table = router.getRoutingTable();
+  ASSERT_EQ(table.size(), 1);
+  EXPECT_EQ(table.begin()->first, 1024);
+  EXPECT_EQ(table.begin()->second, "fast");
+  EXPECT_EQ(router.select(1000, "slow"), "fast");
+}
+
+TEST(ChannelRouter, RoutesEachLengthRangeSeparately) {
+  ChannelRouter router;
+  router.addChannel("lowLatency");
+  router.addChannel("highBandwidth");
+
+  auto durationFn = [](size_t length) {
+    return [length](const std::string& name) {
+      return name == "lowLatency"
+          ? std::chrono::microseconds(1 + length / 100)
+          : std::chrono::microseconds(50 + length / 1000);
+    };
+  };
+  sendTensors(router, 10, "lowLatency", 100, durationFn(10));
+  sendTensors(router, 1000000, "lowLatency", 100, durationFn(1000000));
+
+  auto table = router.getRoutingTable();
+  ASSERT_EQ(table.size(), 2);
+  EXPECT_EQ(table.at(16), "lowLatency");
+  EXPECT_EQ(table.at(1 << 20), "highBandwidth");
+}
+
+TEST(ChannelRouter, KeepsChannelWhenSimilarlyFast) {
+  ChannelRouter router;
+  router.addChannel("first");
+  router.addChannel("second");
+
+  sendTensors(router, 1000, "first", 1000, [](const std::string& name) {
+    return std::chrono::microseconds(name == "second" ? 95 : 100);
+  });
+
+  EXPECT_EQ(router.getRoutingTable().at(1024), "first");
+}
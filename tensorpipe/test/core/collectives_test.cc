@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+constexpr size_t kWorldSize = 3;
+// Small enough for the buffers to be split in several chunks.
+constexpr size_t kChunkLength = 64;
+
+std::shared_ptr<Context> makeContext() {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  return context;
+}
+
+// Connect all the ranks to each other, and run the function on each of them,
+// in a thread of its own, with its communicator.
+void runOnAllRanks(std::function<void(Communicator&)> fn) {
+  std::vector<std::shared_ptr<Context>> contexts;
+  std::vector<std::shared_ptr<Listener>> listeners;
+  for (size_t rank = 0; rank < kWorldSize; rank++) {
+    contexts.push_back(makeContext());
+    listeners.push_back(contexts[rank]->listen({"uv://127.0.0.1"}));
+  }
+
+  std::vector<std::vector<std::shared_ptr<Pipe>>> pipes(
+      kWorldSize, std::vector<std::shared_ptr<Pipe>>(kWorldSize));
+  for (size_t rank = 0; rank < kWorldSize; rank++) {
+    for (size_t peer = rank + 1; peer < kWorldSize; peer++) {
+      pipes[rank][peer] = contexts[rank]->connect(listeners[peer]->url("uv"));
+      std::promise<std::shared_ptr<Pipe>> pipePromise;
+      listeners[peer]->accept(
+          [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+            ASSERT_FALSE(error) << error.what();
+            pipePromise.set_value(std::move(pipe));
+          });
+      pipes[peer][rank] = pipePromise.get_future().get();
+    }
+  }
+
+  // The communicators are only destroyed, which closes their pipes, once all
+  // ranks are done.
+  std::vector<std::unique_ptr<Communicator>> communicators;
+  for (size_t rank = 0; rank < kWorldSize; rank++) {
+    communicators.push_back(
+        std::make_unique<Communicator>(rank, pipes[rank], kChunkLength));
+  }
+  std::vector<std::thread> threads;
+  for (size_t rank = 0; rank < kWorldSize; rank++) {
+    threads.emplace_back([&, rank]() { fn(*communicators[rank]); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  communicators.clear();
+
+  for (auto& context : contexts) {
+    context->join();
+  }
+}
+
+} // namespace
+
+TEST(Collectives, AllReduce) {
+  // Not a multiple of the number of ranks nor of the chunk length.
+  constexpr size_t kNumValues = 1001;
+  runOnAllRanks([&](Communicator& communicator) {
+    for (CollectiveAlgorithm algorithm :
+         {CollectiveAlgorithm::kRing, CollectiveAlgorithm::kTree}) {
+      std::vector<float> values(kNumValues);
+      for (size_t idx = 0; idx < kNumValues; idx++) {
+        values[idx] = communicator.getRank() * 1000 + idx;
+      }
+      Error error = communicator.allReduce(
+          CpuBuffer{values.data(), values.size() * sizeof(float)},
+          ReduceDataType::kFloat32,
+          ReduceOp::kSum,
+          algorithm);
+      ASSERT_FALSE(error) << error.what();
+      for (size_t idx = 0; idx < kNumValues; idx++) {
+        // The sum of rank * 1000 + idx over all ranks.
+        EXPECT_EQ(values[idx], 3000 + 3 * idx) << "at " << idx;
+      }
+    }
+  });
+}
+
+TEST(Collectives, AllGather) {
+  constexpr size_t kBlockLength = 150;
+  runOnAllRanks([&](Communicator& communicator) {
+    std::vector<uint8_t> input(kBlockLength, communicator.getRank() + 1);
+    std::vector<uint8_t> output(kBlockLength * kWorldSize);
+    Error error = communicator.allGather(
+        CpuBuffer{input.data(), input.size()},
+        CpuBuffer{output.data(), output.size()});
+    ASSERT_FALSE(error) << error.what();
+    for (size_t idx = 0; idx < output.size(); idx++) {
+      EXPECT_EQ(output[idx], idx / kBlockLength + 1) << "at " << idx;
+    }
+  });
+}
+
+TEST(Collectives, Broadcast) {
+  constexpr size_t kLength = 200;
+  constexpr size_t kRoot = 1;
+  runOnAllRanks([&](Communicator& communicator) {
+    std::vector<uint8_t> buffer(kLength, communicator.getRank());
+    Error error =
+        communicator.broadcast(CpuBuffer{buffer.data(), buffer.size()}, kRoot);
+    ASSERT_FALSE(error) << error.what();
+    for (size_t idx = 0; idx < kLength; idx++) {
+      EXPECT_EQ(buffer[idx], kRoot) << "at " << idx;
+    }
+  });
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/core/completion_queue.h>
+
+#include <poll.h>
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/core/error.h>
+
+using namespace tensorpipe;
+
+TEST(CompletionQueue, PollInOrder) {
+  CompletionQueue queue;
+  std::vector<CompletionQueue::Completion> completions;
+  EXPECT_EQ(queue.poll(completions, 10), 0);
+
+  CompletionQueue::callback_fn fn1 = queue.makeCallback(1);
+  CompletionQueue::callback_fn fn2 = queue.makeCallback(2);
+  CompletionQueue::callback_fn fn3 = queue.makeCallback(3);
+  Message message;
+  message.metadata = "foo";
+  fn2(Error::kSuccess, std::move(message));
+  fn1(TP_CREATE_ERROR(PipeClosedError), Message());
+  fn3(Error::kSuccess, Message());
+
+  EXPECT_EQ(queue.poll(completions, 2), 2);
+  ASSERT_EQ(completions.size(), 2);
+  EXPECT_EQ(completions[0].tag, 2);
+  EXPECT_FALSE(completions[0].error);
+  EXPECT_EQ(completions[0].message.metadata, "foo");
+  EXPECT_EQ(completions[1].tag, 1);
+  EXPECT_TRUE(completions[1].error);
+
+  EXPECT_EQ(queue.poll(completions, 2), 1);
+  ASSERT_EQ(completions.size(), 3);
+  EXPECT_EQ(completions[2].tag, 3);
+  EXPECT_EQ(queue.poll(completions, 2), 0);
+}
+
+TEST(CompletionQueue, WaitForOtherThread) {
+  CompletionQueue queue;
+  CompletionQueue::callback_fn fn = queue.makeCallback(42);
+  std::thread thread(
+      [fn{std::move(fn)}]() { fn(Error::kSuccess, Message()); });
+
+  std::vector<CompletionQueue::Completion> completions;
+  EXPECT_EQ(queue.wait(completions, 10), 1);
+  ASSERT_EQ(completions.size(), 1);
+  EXPECT_EQ(completions[0].tag, 42);
+  thread.join();
+}
+
+TEST(CompletionQueue, OutlivedByCallback) {
+  CompletionQueue::callback_fn fn;
+  {
+    CompletionQueue queue;
+    fn = queue.makeCallback(0);
+  }
+  fn(Error::kSuccess, Message());
+}
+
+TEST(CompletionQueue, EventFdReadableWhileNotEmpty) {
+  CompletionQueue queue;
+  CompletionQueue::callback_fn fn1 = queue.makeCallback(1);
+  CompletionQueue::callback_fn fn2 = queue.makeCallback(2);
+  fn1(Error::kSuccess, Message());
+
+  // Created after the first completion, hence already readable.
+  const int fd = queue.getEventFd();
+  auto isReadable = [fd]() {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return ::poll(&pfd, 1, 0) == 1;
+  };
+  EXPECT_TRUE(isReadable());
+
+  fn2(Error::kSuccess, Message());
+  std::vector<CompletionQueue::Completion> completions;
+  EXPECT_EQ(queue.poll(completions, 1), 1);
+  EXPECT_TRUE(isReadable());
+  EXPECT_EQ(queue.poll(completions, 1), 1);
+  EXPECT_FALSE(isReadable());
+}
@@ -8,11 +8,21 @@
 
 #include <tensorpipe/tensorpipe.h>
 
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
 #include <exception>
+#include <functional>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -107,6 +117,21 @@ Message makeMessage(int numPayloads, int numTensors) {
   return message;
 }
 
+// A message whose metadata and contents are given by its index, so that tests
+// can check in which order messages arrive. The data must outlive the message.
+Message makeNumberedMessage(int messageIdx, const std::string& data) {
+  Message message;
+  message.metadata = std::to_string(messageIdx);
+  Message::Payload payload;
+  payload.data = reinterpret_cast<void*>(const_cast<char*>(data.data()));
+  payload.length = data.length();
+  message.payloads.push_back(std::move(payload));
+  Message::Tensor tensor{CpuBuffer{
+      reinterpret_cast<void*>(const_cast<char*>(data.data())), data.length()}};
+  message.tensors.push_back(std::move(tensor));
+  return message;
+}
+
 std::string createUniqueShmAddr() {
   const ::testing::TestInfo* const test_info =
       ::testing::UnitTest::GetInstance()->current_test_info();
@@ -539,3 +564,2082 @@ TEST(Context, MixedTensorMessage) {
   clientPipe.reset();
   context->join();
 }
+
+TEST(Context, ClientPingWithAllocator) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::mutex buffersMutex;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().allocator([&](Message& message) {
+        std::unique_lock<std::mutex> lock(buffersMutex);
+        for (auto& payload : message.payloads) {
+          auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+          payload.data = payloadData.get();
+          buffers.push_back(std::move(payloadData));
+        }
+        for (auto& tensor : message.tensors) {
+          auto tensorData =
+              std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+          tensor.buffer.cpu.ptr = tensorData.get();
+          buffers.push_back(std::move(tensorData));
+        }
+        return true;
+      }));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerTransport(
+      1, "shm", std::make_shared<transport::shm::Context>());
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+#if TENSORPIPE_HAS_CMA_CHANNEL
+  context->registerChannel(1, "cma", std::make_shared<channel::cma::Context>());
+#endif // TENSORPIPE_HAS_CMA_CHANNEL
+
+  auto listener = context->listen(genUrls());
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&serverPipe, &readCompletedProm](
+                       const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    serverPipe->readDescriptor(
+        [&serverPipe, &readCompletedProm](const Error& error, Message message) {
+          ASSERT_FALSE(error);
+          // The buffers have already been provided by the allocator.
+          ASSERT_EQ(message.payloads.size(), 1);
+          EXPECT_NE(message.payloads[0].data, nullptr);
+          ASSERT_EQ(message.tensors.size(), 1);
+          EXPECT_NE(message.tensors[0].buffer.cpu.ptr, nullptr);
+          serverPipe->read(
+              std::move(message),
+              [&readCompletedProm](const Error& error, Message message) {
+                ASSERT_FALSE(error);
+                EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+                readCompletedProm.set_value();
+              });
+        });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithInlineTensors) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // Only the first of the two tensors is small enough to be sent inline.
+  Message::Tensor largeTensor;
+  std::vector<uint8_t> largeTensorData(1024 * 1024, 42);
+  largeTensor.buffer =
+      CpuBuffer{largeTensorData.data(), largeTensorData.size()};
+  auto makeMixedMessage = [&]() {
+    Message message = makeMessage(1, 1);
+    message.tensors.push_back(largeTensor);
+    return message;
+  };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().inlineTensorThreshold(kTensorData.length()));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerTransport(
+      1, "shm", std::make_shared<transport::shm::Context>());
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+#if TENSORPIPE_HAS_CMA_CHANNEL
+  context->registerChannel(1, "cma", std::make_shared<channel::cma::Context>());
+#endif // TENSORPIPE_HAS_CMA_CHANNEL
+
+  auto listener = context->listen(genUrls());
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(message, makeMixedMessage()));
+      readCompletedProm.set_value();
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMixedMessage(), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+#if TENSORPIPE_SUPPORTS_CUDA
+TEST(Context, ClientPingWithInlineTensorIntoCudaBuffer) {
+  std::promise<Error> readErrorProm;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().inlineTensorThreshold(kTensorData.length()));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // The tensor is sent inline, hence it can't go into a CUDA buffer, which
+  // fails the read rather than throwing (and it's never written to, thus any
+  // pointer will do).
+  std::vector<uint8_t> payloadData(kPayloadData.length());
+  std::vector<uint8_t> fakeDeviceMemory(kTensorData.length());
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    serverPipe->readDescriptor([&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      ASSERT_EQ(message.payloads.size(), 1);
+      ASSERT_EQ(message.tensors.size(), 1);
+      message.payloads[0].data = payloadData.data();
+      message.tensors[0].buffer =
+          CudaBuffer{fakeDeviceMemory.data(), fakeDeviceMemory.size()};
+      serverPipe->read(
+          std::move(message), [&](const Error& error, Message /* unused */) {
+            readErrorProm.set_value(error);
+          });
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(1, 1),
+      [](const Error& /* unused */, Message /* unused */) {});
+
+  Error readError = readErrorProm.get_future().get();
+  ASSERT_TRUE(readError);
+  EXPECT_TRUE(readError.isOfType<LogicError>()) << readError.what();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+#endif // TENSORPIPE_SUPPORTS_CUDA
+
+TEST(Context, ClientPingRoutedByTensorLength) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // The small tensor goes over the channel with the highest priority, whereas
+  // the large one exceeds its maximum tensor length and goes over the other.
+  Message::Tensor largeTensor;
+  std::vector<uint8_t> largeTensorData(1024 * 1024, 42);
+  largeTensor.buffer =
+      CpuBuffer{largeTensorData.data(), largeTensorData.size()};
+  auto makeMixedMessage = [&]() {
+    Message message = makeMessage(1, 1);
+    message.tensors.push_back(largeTensor);
+    return message;
+  };
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      1,
+      "small_basic",
+      std::make_shared<channel::basic::Context>(),
+      kTensorData.length());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(message, makeMixedMessage()));
+      readCompletedProm.set_value();
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMixedMessage(), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithEarlyMessageDescriptors) {
+  constexpr int kNumMessages = 2;
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // The first tensor is sent inline and the other two through channels, whose
+  // descriptors follow the one of the message.
+  Message::Tensor largeTensor;
+  std::vector<uint8_t> largeTensorData(1024 * 1024, 42);
+  largeTensor.buffer =
+      CpuBuffer{largeTensorData.data(), largeTensorData.size()};
+  auto makeMixedMessage = [&]() {
+    Message message = makeMessage(1, 1);
+    message.tensors.push_back(largeTensor);
+    message.tensors.push_back(largeTensor);
+    return message;
+  };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions()
+          .inlineTensorThreshold(kTensorData.length())
+          .earlyMessageDescriptors(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+  std::function<void(const Error&, Message)> onRead =
+      [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        EXPECT_TRUE(messagesAreEqual(message, makeMixedMessage()));
+        if (++numMessagesRead == kNumMessages) {
+          readCompletedProm.set_value();
+        } else {
+          pipeRead(serverPipe, buffers, onRead);
+        }
+      };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, onRead);
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int idx = 0; idx < kNumMessages; idx++) {
+    clientPipe->write(
+        makeMixedMessage(), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithOutOfOrderCompletion) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // The small message has no tensors, hence it's done as soon as its payload
+  // went over the pipe's connection, whereas the large one ahead of it waits
+  // for its tensor to go over the channel. It must thus complete first.
+  std::vector<uint8_t> largeTensorData(16 * 1024 * 1024, 42);
+  auto makeLargeMessage = [&]() {
+    Message message = makeMessage(1, 0);
+    Message::Tensor tensor;
+    tensor.buffer = CpuBuffer{largeTensorData.data(), largeTensorData.size()};
+    message.tensors.push_back(std::move(tensor));
+    return message;
+  };
+  auto makeSmallMessage = []() { return makeMessage(1, 0); };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().outOfOrderCompletion(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // The callbacks of a pipe are all invoked from the context's loop, one at a
+  // time, hence these need no lock.
+  std::shared_ptr<Pipe> serverPipe;
+  std::vector<std::string> readOrder;
+  auto onRead = [&](const Error& error, std::string name) {
+    ASSERT_FALSE(error);
+    readOrder.push_back(std::move(name));
+    if (readOrder.size() == 2) {
+      readCompletedProm.set_value();
+    }
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(
+        serverPipe, buffers, [&](const Error& error, Message message) {
+          EXPECT_TRUE(messagesAreEqual(message, makeLargeMessage()));
+          onRead(error, "large");
+        });
+    pipeRead(
+        serverPipe, buffers, [&](const Error& error, Message message) {
+          EXPECT_TRUE(messagesAreEqual(message, makeSmallMessage()));
+          onRead(error, "small");
+        });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::vector<std::string> writeOrder;
+  auto onWrite = [&](const Error& error, std::string name) {
+    ASSERT_FALSE(error);
+    writeOrder.push_back(std::move(name));
+    if (writeOrder.size() == 2) {
+      writeCompletedProm.set_value();
+    }
+  };
+  clientPipe->write(makeLargeMessage(), [&](const Error& error, Message) {
+    onWrite(error, "large");
+  });
+  clientPipe->write(makeSmallMessage(), [&](const Error& error, Message) {
+    onWrite(error, "small");
+  });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  EXPECT_EQ(readOrder, std::vector<std::string>({"small", "large"}));
+  EXPECT_EQ(writeOrder, std::vector<std::string>({"small", "large"}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithPriorityClasses) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // The small messages go over their own instances of the channel, rather than
+  // behind the large one. They must thus complete first.
+  std::vector<uint8_t> largeTensorData(16 * 1024 * 1024, 42);
+  auto makeLargeMessage = [&]() {
+    Message message = makeMessage(1, 0);
+    Message::Tensor tensor;
+    tensor.buffer = CpuBuffer{largeTensorData.data(), largeTensorData.size()};
+    message.tensors.push_back(std::move(tensor));
+    return message;
+  };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().outOfOrderCompletion(true).numPriorityClasses(2));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // The callbacks of a pipe are all invoked from the context's loop, one at a
+  // time, hence these need no lock.
+  std::shared_ptr<Pipe> serverPipe;
+  std::vector<std::string> readOrder;
+  auto onRead = [&](const Error& error, std::string name) {
+    ASSERT_FALSE(error);
+    readOrder.push_back(std::move(name));
+    if (readOrder.size() == 3) {
+      readCompletedProm.set_value();
+    }
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(
+        serverPipe, buffers, [&](const Error& error, Message message) {
+          EXPECT_TRUE(messagesAreEqual(message, makeLargeMessage()));
+          onRead(error, "large");
+        });
+    pipeRead(
+        serverPipe, buffers, [&](const Error& error, Message message) {
+          EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+          onRead(error, "small");
+        });
+    pipeRead(
+        serverPipe, buffers, [&](const Error& error, Message message) {
+          EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 2)));
+          onRead(error, "small");
+        });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::vector<std::string> writeOrder;
+  auto onWrite = [&](const Error& error, std::string name) {
+    ASSERT_FALSE(error);
+    writeOrder.push_back(std::move(name));
+    if (writeOrder.size() == 3) {
+      writeCompletedProm.set_value();
+    }
+  };
+  clientPipe->write(makeLargeMessage(), [&](const Error& error, Message) {
+    onWrite(error, "large");
+  });
+  clientPipe->write(
+      makeMessage(1, 1),
+      [&](const Error& error, Message) { onWrite(error, "small"); },
+      /*priorityClass=*/1);
+  // A class above the ones the pipe has is treated as its top one.
+  clientPipe->write(
+      makeMessage(1, 2),
+      [&](const Error& error, Message) { onWrite(error, "small"); },
+      /*priorityClass=*/5);
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  // The two small messages may complete in either order among themselves.
+  EXPECT_EQ(readOrder, std::vector<std::string>({"small", "small", "large"}));
+  EXPECT_EQ(writeOrder, std::vector<std::string>({"small", "small", "large"}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithWriteCoalescing) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 100;
+
+  // Also have the descriptors of the tensors be written separately, so that
+  // they too are coalesced with the ones of the other messages.
+  auto context = std::make_shared<Context>(ContextOptions()
+                                               .earlyMessageDescriptors(true)
+                                               .writeCoalescingLimit(4096));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+      pipeRead(
+          serverPipe, buffers, [&](const Error& error, Message message) {
+            ASSERT_FALSE(error);
+            EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+            if (++numMessagesRead == kNumMessages) {
+              readCompletedProm.set_value();
+            }
+          });
+    }
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  // Each message has two objects to write on the connection (its descriptor
+  // and the one of its tensor), which would take as many transport writes if
+  // they weren't coalesced. Only the client's pipe writes any.
+  ContextStats stats = context->getStats();
+  EXPECT_GE(stats.transportWriteLatency["uv"].count, 1);
+  EXPECT_LT(stats.transportWriteLatency["uv"].count, uint64_t{kNumMessages});
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithMessageTemplate) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 3;
+
+  auto makeTemplatedMessage = []() {
+    Message message = makeMessage(2, 2);
+    message.metadata = "templated";
+    return message;
+  };
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+      pipeRead(
+          serverPipe, buffers, [&](const Error& error, Message message) {
+            ASSERT_FALSE(error);
+            EXPECT_TRUE(messagesAreEqual(message, makeTemplatedMessage()));
+            EXPECT_EQ(message.metadata, "templated");
+            if (++numMessagesRead == kNumMessages) {
+              readCompletedProm.set_value();
+            }
+          });
+    }
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  uint64_t templateId =
+      clientPipe->registerMessageTemplate(makeTemplatedMessage());
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    Message message = makeTemplatedMessage();
+    message.templateId = templateId;
+    clientPipe->write(
+        std::move(message), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithDescriptorStringInterning) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 3;
+
+  // The later messages refer to the strings sent with the first one.
+  auto makeMessageWithMetadata = []() {
+    Message message = makeMessage(2, 2);
+    message.metadata = "message metadata";
+    for (Message::Payload& payload : message.payloads) {
+      payload.metadata = "payload metadata";
+    }
+    for (Message::Tensor& tensor : message.tensors) {
+      tensor.metadata = "tensor metadata";
+    }
+    return message;
+  };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().descriptorStringInterning(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+      pipeRead(
+          serverPipe, buffers, [&](const Error& error, Message message) {
+            ASSERT_FALSE(error);
+            EXPECT_TRUE(messagesAreEqual(message, makeMessageWithMetadata()));
+            EXPECT_EQ(message.metadata, "message metadata");
+            for (const Message::Payload& payload : message.payloads) {
+              EXPECT_EQ(payload.metadata, "payload metadata");
+            }
+            for (const Message::Tensor& tensor : message.tensors) {
+              EXPECT_EQ(tensor.metadata, "tensor metadata");
+            }
+            if (++numMessagesRead == kNumMessages) {
+              readCompletedProm.set_value();
+            }
+          });
+    }
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeMessageWithMetadata(),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithPostedReads) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 3;
+
+  auto makeMessageWithTag = [](optional<uint64_t> tag) {
+    Message message = makeMessage(2, 2);
+    message.tag = tag;
+    return message;
+  };
+
+  // With the layout of the above, and buffers to read into.
+  auto makeMessageToPost = [&]() {
+    Message message;
+    for (int payloadIdx = 0; payloadIdx < 2; payloadIdx++) {
+      buffers.push_back(std::make_unique<uint8_t[]>(kPayloadData.length()));
+      Message::Payload payload;
+      payload.data = buffers.back().get();
+      payload.length = kPayloadData.length();
+      message.payloads.push_back(std::move(payload));
+    }
+    for (int tensorIdx = 0; tensorIdx < 2; tensorIdx++) {
+      buffers.push_back(std::make_unique<uint8_t[]>(kTensorData.length()));
+      Message::Tensor tensor{
+          CpuBuffer{buffers.back().get(), kTensorData.length()}};
+      message.tensors.push_back(std::move(tensor));
+    }
+    return message;
+  };
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  std::atomic<int> numMessagesRead{0};
+  auto onRead = [&](optional<uint64_t> expectedTag) {
+    return [&, expectedTag](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+      EXPECT_EQ(message.tag, expectedTag);
+      if (++numMessagesRead == kNumMessages) {
+        readCompletedProm.set_value();
+      }
+    };
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    // The tagged messages go to the posted reads, whatever their order, and
+    // the other one goes through readDescriptor.
+    serverPipe->postRead(1, makeMessageToPost(), onRead(1));
+    serverPipe->postRead(2, makeMessageToPost(), onRead(2));
+    pipeRead(serverPipe, buffers, onRead(nullopt));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (optional<uint64_t> tag : {optional<uint64_t>(2),
+                                 optional<uint64_t>(),
+                                 optional<uint64_t>(1)}) {
+    clientPipe->write(
+        makeMessageWithTag(tag),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithCompactMessageDescriptors) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 4;
+
+  // The messages without metadata fit the compact layout, the others don't,
+  // and the two kinds of descriptors are interleaved on the connection.
+  auto makeMessageOfIndex = [](int messageIdx) {
+    Message message = makeMessage(2, 2);
+    if (messageIdx % 2 == 1) {
+      message.metadata = "message metadata";
+    }
+    return message;
+  };
+
+  auto context = std::make_shared<Context>(
+      ContextOptions()
+          .compactMessageDescriptors(true)
+          .inlineTensorThreshold(kTensorData.length()));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numMessagesRead = 0;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+      pipeRead(
+          serverPipe,
+          buffers,
+          [&, messageIdx](const Error& error, Message message) {
+            ASSERT_FALSE(error);
+            const Message expected = makeMessageOfIndex(messageIdx);
+            EXPECT_TRUE(messagesAreEqual(message, expected));
+            EXPECT_EQ(message.metadata, expected.metadata);
+            if (++numMessagesRead == kNumMessages) {
+              readCompletedProm.set_value();
+            }
+          });
+    }
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeMessageOfIndex(messageIdx),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithDeduplicatedBuffers) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().deduplicateBuffers(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // All the payloads, and all the tensors, of the message share their buffer.
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(3, 3)));
+      EXPECT_FALSE(message.payloads[0].duplicateOf.has_value());
+      EXPECT_EQ(message.payloads[2].duplicateOf.value(), 0);
+      EXPECT_FALSE(message.tensors[0].duplicateOf.has_value());
+      EXPECT_EQ(message.tensors[2].duplicateOf.value(), 0);
+      // Each got its own copy, as the buffers were provided.
+      EXPECT_NE(
+          message.tensors[0].buffer.cpu.ptr, message.tensors[2].buffer.cpu.ptr);
+      readCompletedProm.set_value();
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(3, 3), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithTensorPacking) {
+  // With the descriptors of the channels both within the one of the message and
+  // following it, as the one of the pack then comes before the others.
+  for (bool earlyMessageDescriptors : {false, true}) {
+    std::vector<std::unique_ptr<uint8_t[]>> buffers;
+    std::promise<void> writeCompletedProm;
+    std::promise<void> readCompletedProm;
+
+    auto context = std::make_shared<Context>(
+        ContextOptions()
+            .tensorPackingThreshold(kTensorData.length() - 1)
+            .earlyMessageDescriptors(earlyMessageDescriptors));
+
+    context->registerTransport(
+        0, "uv", std::make_shared<transport::uv::Context>());
+    context->registerChannel(
+        0, "basic", std::make_shared<channel::basic::Context>());
+
+    auto listener = context->listen({"uv://127.0.0.1"});
+
+    // The tensors are all packed, except the one that is left at full length.
+    auto makeMessageWithLargeTensor = []() {
+      Message message = makeMessage(2, 4);
+      for (size_t idx : {0, 2, 3}) {
+        message.tensors[idx].buffer.cpu.length = kTensorData.length() / 2;
+      }
+      return message;
+    };
+
+    std::shared_ptr<Pipe> serverPipe;
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error);
+      serverPipe = std::move(pipe);
+      pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+        ASSERT_FALSE(error);
+        EXPECT_TRUE(messagesAreEqual(message, makeMessageWithLargeTensor()));
+        readCompletedProm.set_value();
+      });
+    });
+
+    auto clientPipe = context->connect(listener->url("uv"));
+    clientPipe->write(
+        makeMessageWithLargeTensor(),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          writeCompletedProm.set_value();
+        });
+
+    readCompletedProm.get_future().get();
+    writeCompletedProm.get_future().get();
+
+    serverPipe.reset();
+    listener.reset();
+    clientPipe.reset();
+    context->join();
+  }
+}
+
+TEST(Context, ClientPingWithReadDescriptors) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::mutex buffersMutex;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 10;
+  std::vector<std::string> data;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    data.push_back("I'm message #" + std::to_string(messageIdx));
+  }
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().allocator([&](Message& message) {
+        std::unique_lock<std::mutex> lock(buffersMutex);
+        for (auto& payload : message.payloads) {
+          auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+          payload.data = payloadData.get();
+          buffers.push_back(std::move(payloadData));
+        }
+        for (auto& tensor : message.tensors) {
+          auto tensorData =
+              std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+          tensor.buffer.cpu.ptr = tensorData.get();
+          buffers.push_back(std::move(tensorData));
+        }
+        return true;
+      }));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numDescriptorsRead = 0;
+  int numMessagesRead = 0;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    // The descriptors keep coming without calling readDescriptor again, and
+    // the next one is read while the payloads of the one before are still
+    // coming in, yet the messages must arrive in order.
+    serverPipe->readDescriptors(
+        [&](const Error& error, Message message) {
+          if (error) {
+            // The pending operations are aborted once the pipe is closed.
+            return;
+          }
+          EXPECT_EQ(message.metadata, std::to_string(numDescriptorsRead++));
+          serverPipe->read(
+              std::move(message), [&](const Error& error, Message message) {
+                ASSERT_FALSE(error);
+                const int messageIdx = numMessagesRead++;
+                EXPECT_EQ(message.metadata, std::to_string(messageIdx));
+                EXPECT_TRUE(messagesAreEqual(
+                    message,
+                    makeNumberedMessage(messageIdx, data[messageIdx])));
+                if (numMessagesRead == kNumMessages) {
+                  readCompletedProm.set_value();
+                }
+              });
+        },
+        /*prefetchDepth=*/4);
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeNumberedMessage(messageIdx, data[messageIdx]),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithReadDescriptorFromCallback) {
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  constexpr int kNumMessages = 10;
+  std::vector<std::string> data;
+  std::vector<std::string> receivedData;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    data.push_back("I'm message #" + std::to_string(messageIdx));
+    receivedData.push_back(std::string(2 * data.back().length(), '\0'));
+  }
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  int numDescriptorsRead = 0;
+  int numMessagesRead = 0;
+  // Each descriptor callback asks for the next descriptor before reading the
+  // message it got, hence while the payloads of that message are pending.
+  std::function<void()> readNextDescriptor = [&]() {
+    serverPipe->readDescriptor([&](const Error& error, Message message) {
+      if (error) {
+        // The pending operation is aborted once the pipe is closed.
+        return;
+      }
+      const int messageIdx = numDescriptorsRead++;
+      EXPECT_EQ(message.metadata, std::to_string(messageIdx));
+      if (numDescriptorsRead < kNumMessages) {
+        readNextDescriptor();
+      }
+      std::string& buffer = receivedData[messageIdx];
+      ASSERT_EQ(message.payloads.size(), 1);
+      ASSERT_EQ(message.tensors.size(), 1);
+      // Both the payload and the tensor go to the same buffer, one per half.
+      message.payloads[0].data = &buffer[0];
+      message.tensors[0].buffer.cpu.ptr = &buffer[buffer.length() / 2];
+      serverPipe->read(
+          std::move(message), [&](const Error& error, Message message) {
+            ASSERT_FALSE(error);
+            const int messageIdx = numMessagesRead++;
+            EXPECT_EQ(message.metadata, std::to_string(messageIdx));
+            EXPECT_TRUE(messagesAreEqual(
+                message, makeNumberedMessage(messageIdx, data[messageIdx])));
+            if (numMessagesRead == kNumMessages) {
+              readCompletedProm.set_value();
+            }
+          });
+    });
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    serverPipe = std::move(pipe);
+    readNextDescriptor();
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeNumberedMessage(messageIdx, data[messageIdx]),
+        [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error);
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithCallbackExecutor) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::mutex queueMutex;
+  std::condition_variable queueCondVar;
+  std::deque<Function<void()>> queue;
+  const std::thread::id testThreadId = std::this_thread::get_id();
+  bool writeCompleted = false;
+  bool readCompleted = false;
+
+  // Have all callbacks be run by the test thread.
+  auto context = std::make_shared<Context>(
+      ContextOptions().callbackExecutor([&](Function<void()> fn) {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        queue.push_back(std::move(fn));
+        queueCondVar.notify_all();
+      }));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error);
+    EXPECT_EQ(std::this_thread::get_id(), testThreadId);
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error);
+      EXPECT_EQ(std::this_thread::get_id(), testThreadId);
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+      readCompleted = true;
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(2, 2), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error);
+        EXPECT_EQ(std::this_thread::get_id(), testThreadId);
+        writeCompleted = true;
+      });
+
+  while (!writeCompleted || !readCompleted) {
+    Function<void()> fn;
+    {
+      std::unique_lock<std::mutex> lock(queueMutex);
+      queueCondVar.wait(lock, [&]() { return !queue.empty(); });
+      fn = std::move(queue.front());
+      queue.pop_front();
+    }
+    fn();
+  }
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingSync) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  constexpr int kNumMessages = 10;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  std::thread writer([&]() {
+    for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+      Message message = makeMessage(1, 1);
+      Error error = clientPipe->writeAndWait(message);
+      EXPECT_FALSE(error) << error.what();
+    }
+  });
+
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    Message message;
+    Error error = serverPipe->readDescriptorSync(message);
+    EXPECT_FALSE(error) << error.what();
+    for (auto& payload : message.payloads) {
+      auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+      payload.data = payloadData.get();
+      buffers.push_back(std::move(payloadData));
+    }
+    for (auto& tensor : message.tensors) {
+      auto tensorData = std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+      tensor.buffer.cpu.ptr = tensorData.get();
+      buffers.push_back(std::move(tensorData));
+    }
+    error = serverPipe->readSync(message);
+    EXPECT_FALSE(error) << error.what();
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+  }
+
+  writer.join();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithWriteLimits) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  std::promise<void> writeCapacityProm;
+  constexpr int kNumMessages = 10;
+  constexpr size_t kMaxOutstandingWrites = 2;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions()
+          .maxOutstandingWritesPerPipe(kMaxOutstandingWrites)
+          .maxOutstandingWriteBytesPerPipe(1024)
+          .maxOutstandingWriteBytes(1024));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  std::atomic<int> numMessagesWritten(0);
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    clientPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error) << error.what();
+          if (++numMessagesWritten == kNumMessages) {
+            writeCompletedProm.set_value();
+          }
+        });
+    Pipe::WriteStats stats = clientPipe->getWriteStats();
+    EXPECT_LE(stats.numOutstandingWrites, kMaxOutstandingWrites);
+    EXPECT_LE(stats.numOutstandingWrites + stats.numQueuedWrites, kNumMessages);
+  }
+  clientPipe->waitForWriteCapacity([&](const Error& error) {
+    ASSERT_FALSE(error) << error.what();
+    writeCapacityProm.set_value();
+  });
+
+  int numMessagesRead = 0;
+  for (int messageIdx = 0; messageIdx < kNumMessages; messageIdx++) {
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error) << error.what();
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+      if (++numMessagesRead == kNumMessages) {
+        readCompletedProm.set_value();
+      }
+    });
+  }
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+  writeCapacityProm.get_future().get();
+
+  Pipe::WriteStats stats = clientPipe->getWriteStats();
+  EXPECT_EQ(stats.numOutstandingWrites, 0);
+  EXPECT_EQ(stats.numQueuedWrites, 0);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithWriteDeadlines) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> readCompletedProm;
+  std::promise<void> expiredWriteProm;
+
+  // Only one write is in flight at a time, and the first one is larger than
+  // what the socket buffers can hold, hence it stays in flight until the server
+  // reads it and the others queue up behind it.
+  auto context = std::make_shared<Context>(
+      ContextOptions().maxOutstandingWritesPerPipe(1));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  // The messages are told apart by the length of their payload.
+  std::vector<uint8_t> data(64 * 1024 * 1024);
+  auto makeMessageOfLength = [&](size_t length) {
+    Message message;
+    Message::Payload payload;
+    payload.data = data.data();
+    payload.length = length;
+    message.payloads.push_back(std::move(payload));
+    return message;
+  };
+  auto expectSuccess = [](const Error& error, Message /* unused */) {
+    EXPECT_FALSE(error) << error.what();
+  };
+  const auto now = std::chrono::steady_clock::now();
+
+  clientPipe->write(makeMessageOfLength(data.size()), expectSuccess);
+  clientPipe->write(makeMessageOfLength(1), expectSuccess);
+  clientPipe->write(
+      makeMessageOfLength(2),
+      [&](const Error& error, Message /* unused */) {
+        EXPECT_TRUE(error.isOfType<WriteDeadlineExceededError>());
+        expiredWriteProm.set_value();
+      },
+      /*priorityClass=*/0,
+      /*deadline=*/now - std::chrono::milliseconds(1));
+  clientPipe->write(
+      makeMessageOfLength(3),
+      expectSuccess,
+      /*priorityClass=*/0,
+      /*deadline=*/now + std::chrono::hours(1));
+  expiredWriteProm.get_future().get();
+
+  std::vector<size_t> lengths;
+  for (int messageIdx = 0; messageIdx < 3; messageIdx++) {
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      ASSERT_FALSE(error) << error.what();
+      lengths.push_back(message.payloads[0].length);
+      if (lengths.size() == 3) {
+        readCompletedProm.set_value();
+      }
+    });
+  }
+  readCompletedProm.get_future().get();
+
+  // The write with a deadline overtook the one without, which was issued
+  // earlier, and the expired one was never sent.
+  EXPECT_EQ(lengths, std::vector<size_t>({data.size(), 3, 1}));
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithAllocatorMemoryBudget) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::mutex buffersMutex;
+  std::promise<void> writeCompletedProm;
+  std::promise<Message> firstDescriptorProm;
+  std::promise<Message> secondDescriptorProm;
+  std::promise<void> firstReadCompletedProm;
+  std::promise<void> secondReadCompletedProm;
+
+  auto allocate = [&](Message& message) {
+    std::unique_lock<std::mutex> lock(buffersMutex);
+    for (auto& payload : message.payloads) {
+      auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+      payload.data = payloadData.get();
+      buffers.push_back(std::move(payloadData));
+    }
+    for (auto& tensor : message.tensors) {
+      auto tensorData = std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+      tensor.buffer.cpu.ptr = tensorData.get();
+      buffers.push_back(std::move(tensorData));
+    }
+    return true;
+  };
+
+  // Only leave room for one message at a time.
+  auto context = std::make_shared<Context>(
+      ContextOptions().allocator(allocate).allocatorMemoryBudget(
+          kPayloadData.length() + kTensorData.length()));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  int numMessagesWritten = 0;
+  for (int messageIdx = 0; messageIdx < 2; messageIdx++) {
+    clientPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          ASSERT_FALSE(error) << error.what();
+          if (++numMessagesWritten == 2) {
+            writeCompletedProm.set_value();
+          }
+        });
+  }
+
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error) << error.what();
+    firstDescriptorProm.set_value(std::move(message));
+  });
+  serverPipe->readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error) << error.what();
+    secondDescriptorProm.set_value(std::move(message));
+  });
+
+  // The first message fits in the budget, and it holds on to it until it's
+  // read, hence the second one is left to the user to allocate.
+  Message firstMessage = firstDescriptorProm.get_future().get();
+  ASSERT_EQ(firstMessage.payloads.size(), 1);
+  EXPECT_NE(firstMessage.payloads[0].data, nullptr);
+  Message secondMessage = secondDescriptorProm.get_future().get();
+  ASSERT_EQ(secondMessage.payloads.size(), 1);
+  EXPECT_EQ(secondMessage.payloads[0].data, nullptr);
+  ASSERT_EQ(secondMessage.tensors.size(), 1);
+  EXPECT_EQ(secondMessage.tensors[0].buffer.cpu.ptr, nullptr);
+  allocate(secondMessage);
+
+  serverPipe->read(
+      std::move(firstMessage), [&](const Error& error, Message message) {
+        ASSERT_FALSE(error) << error.what();
+        EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+        firstReadCompletedProm.set_value();
+      });
+  serverPipe->read(
+      std::move(secondMessage), [&](const Error& error, Message message) {
+        ASSERT_FALSE(error) << error.what();
+        EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+        secondReadCompletedProm.set_value();
+      });
+
+  firstReadCompletedProm.get_future().get();
+  secondReadCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithReadProgress) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  std::vector<size_t> payloadProgress;
+  std::vector<size_t> tensorProgress;
+  constexpr size_t kChunkSize = 4;
+
+  auto context =
+      std::make_shared<Context>(ContextOptions().payloadChunkSize(kChunkSize));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    serverPipe->readDescriptor([&](const Error& error, Message message) {
+      ASSERT_FALSE(error) << error.what();
+      for (auto& payload : message.payloads) {
+        auto payloadData = std::make_unique<uint8_t[]>(payload.length);
+        payload.data = payloadData.get();
+        buffers.push_back(std::move(payloadData));
+      }
+      for (auto& tensor : message.tensors) {
+        auto tensorData =
+            std::make_unique<uint8_t[]>(tensor.buffer.cpu.length);
+        tensor.buffer.cpu.ptr = tensorData.get();
+        buffers.push_back(std::move(tensorData));
+      }
+      serverPipe->read(
+          std::move(message),
+          [&](const Error& error, Message message) {
+            ASSERT_FALSE(error) << error.what();
+            EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+            readCompletedProm.set_value();
+          },
+          [&](const Pipe::ReadProgress& progress) {
+            EXPECT_EQ(progress.index, 0);
+            if (progress.kind == Pipe::ReadProgress::kPayload) {
+              payloadProgress.push_back(progress.numBytesAvailable);
+            } else {
+              tensorProgress.push_back(progress.numBytesAvailable);
+            }
+          });
+    });
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+        ASSERT_FALSE(error) << error.what();
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  // The payload arrives chunk by chunk, the tensor all at once.
+  std::vector<size_t> expectedPayloadProgress;
+  for (size_t end = kChunkSize; end < kPayloadData.length();
+       end += kChunkSize) {
+    expectedPayloadProgress.push_back(end);
+  }
+  expectedPayloadProgress.push_back(kPayloadData.length());
+  EXPECT_EQ(payloadProgress, expectedPayloadProgress);
+  EXPECT_EQ(tensorProgress, std::vector<size_t>{kTensorData.length()});
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithPrewarmedPipe) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::mutex mutex;
+  std::condition_variable condVar;
+  std::vector<std::shared_ptr<Pipe>> serverPipes;
+
+  auto context = std::make_shared<Context>();
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::function<void(const Error&, std::shared_ptr<Pipe>)> acceptFn;
+  acceptFn = [&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    if (error) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    serverPipes.push_back(std::move(pipe));
+    condVar.notify_all();
+    listener->accept(acceptFn);
+  };
+  listener->accept(acceptFn);
+
+  // The pipe is opened, and accepted, before anyone asks for it.
+  context->prewarm(listener->url("uv"), 1);
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condVar.wait(lock, [&]() { return serverPipes.size() == 1; });
+  }
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  std::promise<void> establishedProm;
+  clientPipe->waitForEstablishment([&](const Error& error) {
+    EXPECT_FALSE(error) << error.what();
+    establishedProm.set_value();
+  });
+  establishedProm.get_future().get();
+
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+  clientPipe->write(
+      makeMessage(2, 2), [&](const Error& error, Message /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        writeCompletedProm.set_value();
+      });
+  std::shared_ptr<Pipe> serverPipe;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    serverPipe = serverPipes[0];
+  }
+  pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+    EXPECT_FALSE(error) << error.what();
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+    readCompletedProm.set_value();
+  });
+  writeCompletedProm.get_future().get();
+  readCompletedProm.get_future().get();
+
+  // The pipe that was taken from the pool is replaced.
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    condVar.wait(lock, [&]() { return serverPipes.size() == 2; });
+  }
+
+  context->prewarm(listener->url("uv"), 0);
+  serverPipe.reset();
+  clientPipe.reset();
+  listener.reset();
+  context->join();
+  serverPipes.clear();
+}
+
+TEST(Context, ServerPingPongWithLazyChannelEstablishment) {
+  std::vector<std::unique_ptr<uint8_t[]>> serverBuffers;
+  std::vector<std::unique_ptr<uint8_t[]>> clientBuffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>(
+      ContextOptions().lazyChannelEstablishment(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  // The server is the first to use the channel, which the client connects.
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    serverPipe->write(
+        makeMessage(1, 0), [&](const Error& error, Message /* unused */) {
+          EXPECT_FALSE(error) << error.what();
+        });
+    serverPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          EXPECT_FALSE(error) << error.what();
+        });
+    pipeRead(
+        serverPipe, serverBuffers, [&](const Error& error, Message message) {
+          EXPECT_FALSE(error) << error.what();
+          EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+          readCompletedProm.set_value();
+        });
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  pipeRead(clientPipe, clientBuffers, [&](const Error& error, Message message) {
+    EXPECT_FALSE(error) << error.what();
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 0)));
+  });
+  pipeRead(clientPipe, clientBuffers, [&](const Error& error, Message message) {
+    EXPECT_FALSE(error) << error.what();
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+    clientPipe->write(
+        makeMessage(1, 1), [&](const Error& error, Message /* unused */) {
+          EXPECT_FALSE(error) << error.what();
+          writeCompletedProm.set_value();
+        });
+  });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithSpeculativeChannelConnections) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  // The client opens connections for two instances of the channel, of which
+  // the server, having a single priority class, only takes one.
+  auto serverContext = std::make_shared<Context>();
+  auto clientContext = std::make_shared<Context>(
+      ContextOptions().speculativeChannelConnections(true).numPriorityClasses(
+          2));
+
+  for (auto& context : {serverContext, clientContext}) {
+    context->registerTransport(
+        0, "uv", std::make_shared<transport::uv::Context>());
+    context->registerChannel(
+        0, "basic", std::make_shared<channel::basic::Context>());
+  }
+
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      EXPECT_FALSE(error) << error.what();
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+      readCompletedProm.set_value();
+    });
+  });
+
+  std::shared_ptr<Pipe> clientPipe =
+      clientContext->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(2, 2), [&](const Error& error, Message /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  serverContext->join();
+  clientContext->join();
+}
+
+TEST(Context, ClientPingPongWithTransportUpgrade) {
+  constexpr int kNumRoundTrips = 20;
+  std::vector<std::unique_ptr<uint8_t[]>> serverBuffers;
+  std::vector<std::unique_ptr<uint8_t[]>> clientBuffers;
+  std::promise<void> doneProm;
+
+  // The pipe starts on uv and, if there's shm, moves to it at some point in
+  // the middle of the exchange, which must go on undisturbed.
+  auto context = std::make_shared<Context>(
+      ContextOptions().transportUpgrade(true).lazyChannelEstablishment(true));
+
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+#if TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerTransport(
+      1, "shm", std::make_shared<transport::shm::Context>());
+#endif // TENSORPIPE_HAS_SHM_TRANSPORT
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen(genUrls());
+
+  // The server echoes each message back.
+  std::shared_ptr<Pipe> serverPipe;
+  std::function<void(int)> serve = [&](int roundTrip) {
+    pipeRead(
+        serverPipe,
+        serverBuffers,
+        [&, roundTrip](const Error& error, Message message) {
+          ASSERT_FALSE(error) << error.what();
+          EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+          serverPipe->write(
+              makeMessage(2, 2), [](const Error& error, Message /* unused */) {
+                EXPECT_FALSE(error) << error.what();
+              });
+          if (roundTrip + 1 < kNumRoundTrips) {
+            serve(roundTrip + 1);
+          }
+        });
+  };
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    serve(0);
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  std::function<void(int)> ping = [&](int roundTrip) {
+    clientPipe->write(
+        makeMessage(2, 2), [](const Error& error, Message /* unused */) {
+          EXPECT_FALSE(error) << error.what();
+        });
+    pipeRead(
+        clientPipe,
+        clientBuffers,
+        [&, roundTrip](const Error& error, Message message) {
+          ASSERT_FALSE(error) << error.what();
+          EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+          if (roundTrip + 1 < kNumRoundTrips) {
+            ping(roundTrip + 1);
+          } else {
+            doneProm.set_value();
+          }
+        });
+  };
+  ping(0);
+
+  doneProm.get_future().get();
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithStats) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      EXPECT_FALSE(error) << error.what();
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+      readCompletedProm.set_value();
+    });
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(2, 2), [&](const Error& error, Message /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  ContextStats stats = context->getStats();
+  ASSERT_EQ(stats.pipes.size(), 2);
+  uint64_t numMessagesWritten = 0;
+  uint64_t numBytesWritten = 0;
+  uint64_t numMessagesRead = 0;
+  uint64_t numBytesRead = 0;
+  for (const PipeStats& pipeStats : stats.pipes) {
+    numMessagesWritten += pipeStats.numMessagesWritten;
+    numBytesWritten += pipeStats.numBytesWritten;
+    numMessagesRead += pipeStats.numMessagesRead;
+    numBytesRead += pipeStats.numBytesRead;
+    EXPECT_EQ(pipeStats.writeStageNanoseconds.count("admitted"), 1);
+    EXPECT_EQ(pipeStats.readStageNanoseconds.count("reading_descriptor"), 1);
+    EXPECT_GT(pipeStats.memoryBytes.at("operations"), 0);
+  }
+  EXPECT_EQ(numMessagesWritten, 1);
+  EXPECT_EQ(numMessagesRead, 1);
+  EXPECT_GT(numBytesWritten, 0);
+  EXPECT_EQ(numBytesRead, numBytesWritten);
+  EXPECT_EQ(stats.transports.count("uv"), 1);
+  EXPECT_EQ(stats.readLatency.count, 1);
+  EXPECT_EQ(stats.channelSendLatency.count, 2);
+  EXPECT_GE(stats.transportWriteLatency["uv"].count, 1);
+  EXPECT_EQ(stats.memoryBytes.count("pipes.staging"), 1);
+  EXPECT_GT(stats.memoryBytes.at("pipes.operations"), 0);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, DumpState) {
+  std::promise<void> establishedProm;
+
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    establishedProm.set_value();
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  establishedProm.get_future().get();
+
+  // Leave a read waiting for a message that never comes.
+  serverPipe->readDescriptor(
+      [](const Error& error, Message /* unused */) { EXPECT_TRUE(error); });
+
+  std::string state = context->dumpState();
+  EXPECT_NE(state.find("has 2 pipes"), std::string::npos) << state;
+  EXPECT_NE(state.find("(transport uv, state established"), std::string::npos)
+      << state;
+  EXPECT_NE(state.find("1 reading_descriptor"), std::string::npos) << state;
+  EXPECT_EQ(state.find("didn't answer"), std::string::npos) << state;
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithRegisteredBuffer) {
+  std::vector<std::unique_ptr<uint8_t[]>> buffers;
+  std::promise<void> writeCompletedProm;
+  std::promise<void> readCompletedProm;
+
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  // The tensors of the message all lie within this buffer.
+  std::shared_ptr<void> registration = context->registerBuffer(
+      CpuBuffer{const_cast<char*>(kTensorData.data()), kTensorData.length()});
+  EXPECT_NE(registration, nullptr);
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::shared_ptr<Pipe> serverPipe;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipe = std::move(pipe);
+    pipeRead(serverPipe, buffers, [&](const Error& error, Message message) {
+      EXPECT_FALSE(error) << error.what();
+      EXPECT_TRUE(messagesAreEqual(message, makeMessage(2, 2)));
+      readCompletedProm.set_value();
+    });
+  });
+
+  std::shared_ptr<Pipe> clientPipe = context->connect(listener->url("uv"));
+  clientPipe->write(
+      makeMessage(2, 2), [&](const Error& error, Message /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        writeCompletedProm.set_value();
+      });
+
+  readCompletedProm.get_future().get();
+  writeCompletedProm.get_future().get();
+
+  registration.reset();
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
+
+TEST(Context, ClientPingWithFileRanges) {
+  char srcPath[] = "/tmp/tensorpipe_test_src_XXXXXX";
+  char dstPath[] = "/tmp/tensorpipe_test_dst_XXXXXX";
+  const int srcFd = ::mkstemp(srcPath);
+  ASSERT_GE(srcFd, 0);
+  const int dstFd = ::mkstemp(dstPath);
+  ASSERT_GE(dstFd, 0);
+  ::unlink(srcPath);
+  ::unlink(dstPath);
+
+  // Neither range starts on a page boundary.
+  constexpr uint64_t kPayloadOffset = 10;
+  constexpr uint64_t kTensorOffset = 5000;
+  ASSERT_EQ(
+      ::pwrite(
+          srcFd, kPayloadData.data(), kPayloadData.length(), kPayloadOffset),
+      kPayloadData.length());
+  ASSERT_EQ(
+      ::pwrite(srcFd, kTensorData.data(), kTensorData.length(), kTensorOffset),
+      kTensorData.length());
+
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+
+  auto listener = context->listen({"uv://127.0.0.1"});
+
+  std::promise<std::shared_ptr<Pipe>> serverPipeProm;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipeProm.set_value(std::move(pipe));
+  });
+
+  auto clientPipe = context->connect(listener->url("uv"));
+  std::shared_ptr<Pipe> serverPipe = serverPipeProm.get_future().get();
+
+  std::thread writer([&]() {
+    Message message;
+    message.payloads.resize(1);
+    message.payloads[0].length = kPayloadData.length();
+    message.payloads[0].file = Message::FileRange{srcFd, kPayloadOffset};
+    message.tensors.resize(1);
+    message.tensors[0].buffer = CpuBuffer{nullptr, kTensorData.length()};
+    message.tensors[0].file = Message::FileRange{srcFd, kTensorOffset};
+    Error error = clientPipe->writeAndWait(message);
+    EXPECT_FALSE(error) << error.what();
+  });
+
+  {
+    Message message;
+    Error error = serverPipe->readDescriptorSync(message);
+    ASSERT_FALSE(error) << error.what();
+    message.payloads[0].file = Message::FileRange{dstFd, kPayloadOffset};
+    message.tensors[0].file = Message::FileRange{dstFd, kTensorOffset};
+    error = serverPipe->readSync(message);
+    ASSERT_FALSE(error) << error.what();
+    EXPECT_TRUE(messagesAreEqual(message, makeMessage(1, 1)));
+  }
+
+  writer.join();
+
+  // The data went into the file, which was extended to hold it.
+  std::string data(kTensorData.length(), '\0');
+  ASSERT_EQ(
+      ::pread(dstFd, &data[0], kTensorData.length(), kTensorOffset),
+      kTensorData.length());
+  EXPECT_EQ(data, kTensorData);
+  data.resize(kPayloadData.length());
+  ASSERT_EQ(
+      ::pread(dstFd, &data[0], kPayloadData.length(), kPayloadOffset),
+      kPayloadData.length());
+  EXPECT_EQ(data, kPayloadData);
+
+  ::close(srcFd);
+  ::close(dstFd);
+
+  serverPipe.reset();
+  listener.reset();
+  clientPipe.reset();
+  context->join();
+}
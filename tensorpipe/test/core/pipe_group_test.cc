@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::string kPayloadData = "I'm a payload";
+std::string kTensorData = "And I'm a tensor";
+
+Message makeMessage() {
+  Message message;
+  message.metadata = "metadata";
+  Message::Payload payload;
+  payload.data =
+      reinterpret_cast<void*>(const_cast<char*>(kPayloadData.data()));
+  payload.length = kPayloadData.length();
+  message.payloads.push_back(std::move(payload));
+  Message::Tensor tensor{CpuBuffer{
+      reinterpret_cast<void*>(const_cast<char*>(kTensorData.data())),
+      kTensorData.length()}};
+  message.tensors.push_back(std::move(tensor));
+  return message;
+}
+
+std::shared_ptr<Context> makeContext() {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  return context;
+}
+
+// Read a message from the pipe and check that it's the one of makeMessage.
+void readAndCheckMessage(Pipe& pipe) {
+  std::promise<Message> descriptorPromise;
+  pipe.readDescriptor([&](const Error& error, Message message) {
+    ASSERT_FALSE(error) << error.what();
+    descriptorPromise.set_value(std::move(message));
+  });
+  Message message = descriptorPromise.get_future().get();
+  EXPECT_EQ(message.metadata, "metadata");
+  ASSERT_EQ(message.payloads.size(), 1);
+  ASSERT_EQ(message.tensors.size(), 1);
+
+  std::vector<uint8_t> payloadData(message.payloads[0].length);
+  std::vector<uint8_t> tensorData(message.tensors[0].buffer.cpu.length);
+  message.payloads[0].data = payloadData.data();
+  message.tensors[0].buffer.cpu.ptr = tensorData.data();
+
+  std::promise<void> readPromise;
+  pipe.read(std::move(message), [&](const Error& error, Message /* unused */) {
+    EXPECT_FALSE(error) << error.what();
+    readPromise.set_value();
+  });
+  readPromise.get_future().get();
+  EXPECT_EQ(
+      std::string(payloadData.begin(), payloadData.end()), kPayloadData);
+  EXPECT_EQ(std::string(tensorData.begin(), tensorData.end()), kTensorData);
+}
+
+} // namespace
+
+TEST(PipeGroup, Broadcast) {
+  constexpr size_t kNumPipes = 3;
+  constexpr int kNumBroadcasts = 2;
+
+  auto serverContext = makeContext();
+  auto clientContext = makeContext();
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+
+  std::vector<std::shared_ptr<Pipe>> clientPipes;
+  std::vector<std::shared_ptr<Pipe>> serverPipes;
+  for (size_t pipeIdx = 0; pipeIdx < kNumPipes; pipeIdx++) {
+    clientPipes.push_back(clientContext->connect(listener->url("uv")));
+    std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+    listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+      ASSERT_FALSE(error) << error.what();
+      serverPipePromise.set_value(std::move(pipe));
+    });
+    serverPipes.push_back(serverPipePromise.get_future().get());
+  }
+
+  PipeGroup group(clientPipes);
+  // The second broadcast uses the templates registered by the first one.
+  for (int broadcastIdx = 0; broadcastIdx < kNumBroadcasts; broadcastIdx++) {
+    std::promise<Message> broadcastPromise;
+    group.broadcast(makeMessage(), [&](const Error& error, Message message) {
+      EXPECT_FALSE(error) << error.what();
+      broadcastPromise.set_value(std::move(message));
+    });
+    for (auto& serverPipe : serverPipes) {
+      readAndCheckMessage(*serverPipe);
+    }
+    Message message = broadcastPromise.get_future().get();
+    EXPECT_EQ(message.metadata, "metadata");
+    EXPECT_FALSE(message.templateId.has_value());
+  }
+
+  serverContext->join();
+  clientContext->join();
+}
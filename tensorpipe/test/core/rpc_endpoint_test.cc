@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/tensorpipe.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+
+namespace {
+
+std::shared_ptr<Context> makeContext() {
+  auto context = std::make_shared<Context>();
+  context->registerTransport(
+      0, "uv", std::make_shared<transport::uv::Context>());
+  context->registerChannel(
+      0, "basic", std::make_shared<channel::basic::Context>());
+  return context;
+}
+
+Message makeMessage(const std::string& data) {
+  Message message;
+  message.metadata = data;
+  Message::Payload payload;
+  payload.data = reinterpret_cast<void*>(const_cast<char*>(data.data()));
+  payload.length = data.length();
+  message.payloads.push_back(std::move(payload));
+  return message;
+}
+
+std::string getPayload(const Message& message) {
+  const Message::Payload& payload = message.payloads.at(0);
+  return std::string(
+      reinterpret_cast<const char*>(payload.data), payload.length);
+}
+
+} // namespace
+
+TEST(RpcEndpoint, CallAndRespond) {
+  constexpr int kNumCalls = 50;
+
+  auto serverContext = makeContext();
+  auto clientContext = makeContext();
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+  auto clientPipe = clientContext->connect(listener->url("uv"));
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  // The server echoes the payload of each request back, reversed. The string
+  // is kept alive by the write callback.
+  std::unique_ptr<RpcEndpoint> server;
+  server = std::make_unique<RpcEndpoint>(
+      serverPipePromise.get_future().get(),
+      [&](uint64_t callId, Message request) {
+        std::string payload = getPayload(request);
+        auto data = std::make_shared<std::string>(
+            payload.rbegin(), payload.rend());
+        server->respond(
+            callId,
+            makeMessage(*data),
+            [data](const Error& error, Message /* unused */) {
+              EXPECT_FALSE(error) << error.what();
+            });
+      });
+  RpcEndpoint client(clientPipe, [](uint64_t, Message) {
+    ADD_FAILURE() << "The client got a request";
+  });
+
+  // Issue more calls than the window of writes, so that some are queued.
+  std::vector<std::string> requests;
+  for (int callIdx = 0; callIdx < kNumCalls; callIdx++) {
+    requests.push_back("request #" + std::to_string(callIdx));
+  }
+  std::vector<std::promise<std::string>> responsePromises(kNumCalls);
+  for (int callIdx = 0; callIdx < kNumCalls; callIdx++) {
+    client.call(
+        makeMessage(requests[callIdx]),
+        [&, callIdx](const Error& error, Message response) {
+          ASSERT_FALSE(error) << error.what();
+          responsePromises[callIdx].set_value(getPayload(response));
+        });
+  }
+  for (int callIdx = 0; callIdx < kNumCalls; callIdx++) {
+    const std::string& request = requests[callIdx];
+    EXPECT_EQ(
+        responsePromises[callIdx].get_future().get(),
+        std::string(request.rbegin(), request.rend()));
+  }
+
+  client.close();
+  server->close();
+  serverContext->join();
+  clientContext->join();
+}
+
+TEST(RpcEndpoint, CancelAndTimeout) {
+  auto serverContext = makeContext();
+  auto clientContext = makeContext();
+  auto listener = serverContext->listen({"uv://127.0.0.1"});
+  auto clientPipe = clientContext->connect(listener->url("uv"));
+  std::promise<std::shared_ptr<Pipe>> serverPipePromise;
+  listener->accept([&](const Error& error, std::shared_ptr<Pipe> pipe) {
+    ASSERT_FALSE(error) << error.what();
+    serverPipePromise.set_value(std::move(pipe));
+  });
+
+  // The server never responds.
+  RpcEndpoint server(
+      serverPipePromise.get_future().get(), [](uint64_t, Message) {});
+  RpcEndpoint client(clientPipe, [](uint64_t, Message) {});
+
+  const std::string data = "request";
+  std::promise<void> cancelledPromise;
+  const uint64_t callId =
+      client.call(makeMessage(data), [&](const Error& error, Message) {
+        EXPECT_TRUE(error.isOfType<RpcCancelledError>()) << error.what();
+        cancelledPromise.set_value();
+      });
+  EXPECT_TRUE(client.cancel(callId));
+  cancelledPromise.get_future().get();
+  EXPECT_FALSE(client.cancel(callId));
+
+  std::promise<void> timedOutPromise;
+  client.call(
+      makeMessage(data),
+      [&](const Error& error, Message) {
+        EXPECT_TRUE(error.isOfType<RpcTimeoutError>()) << error.what();
+        timedOutPromise.set_value();
+      },
+      RpcEndpoint::clock::now() + std::chrono::milliseconds(50));
+  timedOutPromise.get_future().get();
+
+  // Closing fails the calls that are still pending.
+  std::promise<void> closedPromise;
+  client.call(makeMessage(data), [&](const Error& error, Message) {
+    EXPECT_TRUE(error.isOfType<PipeClosedError>()) << error.what();
+    closedPromise.set_value();
+  });
+  client.close();
+  closedPromise.get_future().get();
+
+  server.close();
+  serverContext->join();
+  clientContext->join();
+}
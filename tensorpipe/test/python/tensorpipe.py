@@ -5,6 +5,7 @@
 # This source code is licensed under the BSD-style license found in the
 # LICENSE file in the root directory of this source tree.
 
+import asyncio
 import threading
 import unittest
 
@@ -82,6 +83,171 @@ class TestTensorpipe(unittest.TestCase):
         # See https://github.com/pybind/pybind11/issues/1446.
         context.join()
 
+    def test_read_message_and_sync_operations(self):
+        context = tp.Context()
+        context.register_transport(0, "tcp", tp.UvTransport())
+        context.register_channel(0, "basic", tp.BasicChannel())
+
+        listener: tp.Listener = context.listen(["tcp://127.0.0.1"])
+        client_pipe: tp.Pipe = context.connect(listener.get_url("tcp"))
+        server_pipe: tp.Pipe = listener.accept_sync()
+
+        def make_message(greeting: bytes) -> tp.OutgoingMessage:
+            payload = tp.OutgoingPayload(greeting, b"a greeting")
+            tensor = tp.OutgoingTensor(b"World!", b"a place")
+            return tp.OutgoingMessage(b"metadata", [payload], [tensor])
+
+        write_completed = threading.Event()
+        client_pipe.write(make_message(b"Hello "), write_completed.set)
+
+        buffers = []
+
+        def allocator(length: int) -> bytearray:
+            buffers.append(bytearray(length))
+            return buffers[-1]
+
+        message = server_pipe.read_message_sync(allocator)
+        write_completed.wait()
+        self.assertEqual(message.metadata, b"metadata")
+        self.assertEqual(buffers, [bytearray(b"Hello "), bytearray(b"World!")])
+
+        # Now the other way around, with bytearrays allocated by the bindings.
+        read_completed = threading.Event()
+
+        def on_read(message: tp.IncomingMessage) -> None:
+            self.assertEqual(message.payloads[0].length, 4)
+            read_completed.set()
+
+        server_pipe.read_message(None, on_read)
+        client_pipe.write_sync(make_message(b"Hi! "))
+        read_completed.wait()
+
+        context.join()
+
+    def test_failing_allocator(self):
+        context = tp.Context()
+        context.register_transport(0, "tcp", tp.UvTransport())
+        context.register_channel(0, "basic", tp.BasicChannel())
+
+        listener: tp.Listener = context.listen(["tcp://127.0.0.1"])
+        client_pipe: tp.Pipe = context.connect(listener.get_url("tcp"))
+        server_pipe: tp.Pipe = listener.accept_sync()
+
+        def make_message() -> tp.OutgoingMessage:
+            payload = tp.OutgoingPayload(b"Hello ", b"a greeting")
+            return tp.OutgoingMessage(b"metadata", [payload], [])
+
+        # The buffer is of the wrong length, hence the read is never issued,
+        # and its callback is never called, but that's only logged.
+        def bad_allocator(length: int) -> bytearray:
+            return bytearray(length + 1)
+
+        def on_bad_read(message: tp.IncomingMessage) -> None:
+            self.fail("The read shouldn't have completed")
+
+        server_pipe.read_message(bad_allocator, on_bad_read)
+        client_pipe.write_sync(make_message())
+
+        # The callbacks of the other operations are still called.
+        write_completed = threading.Event()
+        server_pipe.write(make_message(), write_completed.set)
+        self.assertTrue(write_completed.wait(timeout=10))
+
+        context.join()
+
+    def test_asyncio(self):
+        context = tp.Context()
+        context.register_transport(0, "tcp", tp.UvTransport())
+        context.register_channel(0, "basic", tp.BasicChannel())
+
+        listener: tp.Listener = context.listen(["tcp://127.0.0.1"])
+        client_pipe: tp.Pipe = context.connect(listener.get_url("tcp"))
+        server_pipe: tp.Pipe = listener.accept_sync()
+
+        async def ping_pong() -> None:
+            queue = tp.AsyncioQueue(asyncio.get_running_loop())
+            payload = tp.OutgoingPayload(b"Hello ", b"a greeting")
+            tensor = tp.OutgoingTensor(b"World!", b"a place")
+            message = tp.OutgoingMessage(b"metadata", [payload], [tensor])
+            received, _ = await asyncio.gather(
+                server_pipe.read_message_async(None, queue),
+                client_pipe.write_async(message, queue),
+            )
+            self.assertEqual(received.metadata, b"metadata")
+            self.assertEqual(received.payloads[0].length, 6)
+            self.assertEqual(received.tensors[0].length, 6)
+
+            # A failure to allocate fails the read, but not the other
+            # operations that complete at the same time.
+            def bad_allocator(length: int) -> bytearray:
+                return bytearray(length + 1)
+
+            bad_read, written = await asyncio.gather(
+                server_pipe.read_message_async(bad_allocator, queue),
+                client_pipe.write_async(message, queue),
+                return_exceptions=True,
+            )
+            self.assertIsInstance(bad_read, RuntimeError)
+            self.assertIsNone(written)
+            queue.close()
+
+        asyncio.run(ping_pong())
+
+        context.join()
+
+    def test_options(self):
+        options = tp.ContextOptions()
+        options.name = "tuned"
+        options.payload_chunk_size = 1024 * 1024
+        options.write_coalescing_limit = 4096
+        self.assertEqual(options.name, "tuned")
+        self.assertEqual(options.write_coalescing_limit, 4096)
+        context = tp.Context(options)
+        uv_options = tp.UvContextOptions()
+        uv_options.low_latency = tp.UvLowLatencyOptions()
+        uv_options.listen_backlog = 1024
+        self.assertIn("listen_backlog=1024", repr(uv_options))
+        uv_transport = tp.UvTransport(uv_options)
+        self.assertEqual(uv_transport.get_options().listen_backlog, 1024)
+        context.register_transport(0, "tcp", uv_transport)
+        context.register_transport(
+            -1, "mux", tp.MuxTransport(tp.UvTransport(), 2)
+        )
+        context.register_channel(
+            0, "mpt", tp.MptChannel(2, "127.0.0.1", 64 * 1024)
+        )
+        context.register_channel(
+            -1, "xth", tp.XthChannel(num_threads=2, min_chunk_size=1024)
+        )
+
+        listener: tp.Listener = context.listen(["tcp://127.0.0.1"])
+        client_pipe: tp.Pipe = context.connect(listener.get_url("tcp"))
+        server_pipe: tp.Pipe = listener.accept_sync()
+
+        # Large enough to be split in chunks across the lanes of the channel.
+        data = bytes(range(256)) * 1024
+        payload = tp.OutgoingPayload(b"Hello ", b"a greeting")
+        tensor = tp.OutgoingTensor(data, b"a tensor")
+        write_completed = threading.Event()
+        client_pipe.write(
+            tp.OutgoingMessage(b"metadata", [payload], [tensor]),
+            write_completed.set,
+        )
+
+        buffers = []
+
+        def allocator(length: int) -> bytearray:
+            buffers.append(bytearray(length))
+            return buffers[-1]
+
+        message = server_pipe.read_message_sync(allocator)
+        write_completed.wait()
+        self.assertEqual(message.metadata, b"metadata")
+        self.assertEqual(buffers, [bytearray(b"Hello "), bytearray(data)])
+
+        context.close()
+        context.join()
+
 
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/bond/context.h>
+#include <tensorpipe/transport/uv/context.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+// Small enough that the tests' larger writes get spread across the lanes.
+constexpr size_t kLargeWriteThreshold = 1024;
+
+class BondTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit BondTransportTestHelper(size_t numLanes) : numLanes_(numLanes) {}
+
+  std::shared_ptr<Context> getContext() override {
+    std::vector<std::shared_ptr<Context>> lanes;
+    for (size_t laneIdx = 0; laneIdx < numLanes_; laneIdx++) {
+      lanes.push_back(std::make_shared<uv::Context>());
+    }
+    return std::make_shared<bond::Context>(
+        std::move(lanes), kLargeWriteThreshold);
+  }
+
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+ private:
+  const size_t numLanes_;
+};
+
+BondTransportTestHelper helper(/*numLanes=*/2);
+BondTransportTestHelper singleLaneHelper(/*numLanes=*/1);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Bond, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    BondSingleLane,
+    TransportTest,
+    ::testing::Values(&singleLaneHelper));
+
+// Interleave small writes, which go over the first lane, with large ones, which
+// go over the least loaded one, and check that they're read back in order, both
+// into buffers and not.
+TEST(BondTransport, WritesOfMixedSizesArriveInOrder) {
+  constexpr size_t kNumWrites = 32;
+  auto serverContext = helper.getContext();
+  auto clientContext = helper.getContext();
+
+  auto listener = serverContext->listen(helper.defaultAddr());
+  auto clientConnection = clientContext->connect(listener->addr());
+  std::promise<std::shared_ptr<Connection>> connectionProm;
+  listener->accept(
+      [&](const Error& error, std::shared_ptr<Connection> connection) {
+        EXPECT_FALSE(error) << error.what();
+        connectionProm.set_value(std::move(connection));
+      });
+  auto serverConnection = connectionProm.get_future().get();
+
+  std::vector<std::vector<uint8_t>> buffers(kNumWrites);
+  std::vector<std::promise<void>> writeProms(kNumWrites);
+  for (size_t idx = 0; idx < kNumWrites; idx++) {
+    const size_t length = idx % 2 == 0 ? 8 : 16 * kLargeWriteThreshold;
+    buffers[idx].assign(length, static_cast<uint8_t>(idx));
+    clientConnection->write(
+        buffers[idx].data(), length, [&, idx](const Error& error) {
+          EXPECT_FALSE(error) << error.what();
+          writeProms[idx].set_value();
+        });
+  }
+
+  std::vector<std::vector<uint8_t>> readBuffers(kNumWrites);
+  std::vector<std::promise<void>> readProms(kNumWrites);
+  size_t numReadsDone = 0;
+  for (size_t idx = 0; idx < kNumWrites; idx++) {
+    auto callback = [&, idx](
+                        const Error& error, const void* ptr, size_t length) {
+      EXPECT_FALSE(error) << error.what();
+      EXPECT_EQ(numReadsDone++, idx);
+      if (!error && ptr != readBuffers[idx].data()) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
+        readBuffers[idx].assign(data, data + length);
+      }
+      readProms[idx].set_value();
+    };
+    if (idx % 4 < 2) {
+      readBuffers[idx].resize(buffers[idx].size());
+      serverConnection->read(
+          readBuffers[idx].data(), readBuffers[idx].size(), callback);
+    } else {
+      serverConnection->read(callback);
+    }
+  }
+
+  for (size_t idx = 0; idx < kNumWrites; idx++) {
+    writeProms[idx].get_future().get();
+    readProms[idx].get_future().get();
+    EXPECT_EQ(readBuffers[idx], buffers[idx]);
+  }
+
+  serverConnection.reset();
+  clientConnection.reset();
+  listener.reset();
+  serverContext->join();
+  clientContext->join();
+}
+
+TEST(BondTransport, DomainDescriptor) {
+  auto context = helper.getContext();
+  const std::string& descriptor = context->domainDescriptor();
+  const std::string laneDescriptor = uv::Context().domainDescriptor();
+  EXPECT_EQ(descriptor, "bond:" + laneDescriptor + "|" + laneDescriptor);
+  EXPECT_TRUE(context->canCommunicateWithRemote(descriptor));
+  EXPECT_FALSE(context->canCommunicateWithRemote("bond:" + laneDescriptor));
+  EXPECT_FALSE(context->canCommunicateWithRemote(laneDescriptor));
+  context->join();
+}
@@ -9,6 +9,8 @@
 #include <tensorpipe/test/transport/transport_test.h>
 
 #include <array>
+#include <string>
+#include <vector>
 
 #include <nop/serializer.h>
 #include <nop/structure.h>
@@ -97,6 +99,11 @@ struct MyNopType {
   NOP_STRUCTURE(MyNopType, myIntField);
 };
 
+struct MyVariableNopType {
+  std::vector<uint8_t> myVectorField;
+  NOP_STRUCTURE(MyVariableNopType, myVectorField);
+};
+
 } // namespace
 
 TEST_P(TransportTest, Connection_NopWrite) {
@@ -125,6 +132,47 @@ TEST_P(TransportTest, Connection_NopWrite) {
       });
 }
 
+// The objects are serialized into buffers sized after the previous ones, hence
+// growing ones need these buffers to be resized.
+TEST_P(TransportTest, Connection_NopWritesOfVaryingSize) {
+  // All small enough to fit in the smallest inboxes used in the tests.
+  const std::vector<size_t> kSizes = {10, 1000, 3000, 100};
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (size_t idx = 0; idx < kSizes.size(); idx++) {
+          auto holder = std::make_shared<NopHolder<MyVariableNopType>>();
+          conn->read(*holder, [&, conn, holder, idx](const Error& error) {
+            ASSERT_FALSE(error) << error.what();
+            const std::vector<uint8_t>& vector =
+                holder->getObject().myVectorField;
+            ASSERT_EQ(vector.size(), kSizes[idx]);
+            for (uint8_t value : vector) {
+              ASSERT_EQ(value, static_cast<uint8_t>(idx));
+            }
+            if (idx == kSizes.size() - 1) {
+              peers_->done(PeerGroup::kServer);
+            }
+          });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        for (size_t idx = 0; idx < kSizes.size(); idx++) {
+          auto holder = std::make_shared<NopHolder<MyVariableNopType>>();
+          holder->getObject().myVectorField.assign(
+              kSizes[idx], static_cast<uint8_t>(idx));
+          conn->write(*holder, [&, conn, holder, idx](const Error& error) {
+            ASSERT_FALSE(error) << error.what();
+            if (idx == kSizes.size() - 1) {
+              peers_->done(PeerGroup::kClient);
+            }
+          });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
 TEST_P(TransportTest, Connection_QueueWritesBeforeReads) {
   constexpr int kMsgSize = 16 * 1024;
   constexpr int numMsg = 10;
@@ -175,6 +223,52 @@ TEST_P(TransportTest, Connection_QueueWritesBeforeReads) {
       });
 }
 
+TEST_P(TransportTest, Connection_VectoredWriteAndRead) {
+  constexpr int kNumBuffers = 5;
+  std::string msg[kNumBuffers];
+
+  for (int i = 0; i < kNumBuffers; i++) {
+    msg[i] = std::string(1024 * (i + 1), static_cast<char>(i));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        auto holder = std::make_shared<NopHolder<MyNopType>>();
+        holder->getObject().myIntField = kNumBuffers;
+        std::vector<Connection::WriteBuffer> buffers;
+        for (int i = 0; i < kNumBuffers; i++) {
+          buffers.push_back({msg[i].c_str(), msg[i].length()});
+        }
+        conn->writev(
+            *holder, std::move(buffers), [&, conn, holder](const Error& error) {
+              ASSERT_FALSE(error) << error.what();
+              peers_->done(PeerGroup::kServer);
+            });
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        auto holder = std::make_shared<NopHolder<MyNopType>>();
+        std::string data[kNumBuffers];
+        std::vector<Connection::ReadBuffer> buffers;
+        for (int i = 0; i < kNumBuffers; i++) {
+          data[i] = std::string(msg[i].length(), '\0');
+          buffers.push_back({&data[i][0], data[i].length()});
+        }
+        conn->read(*holder, [&, conn, holder](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+          ASSERT_EQ(holder->getObject().myIntField, kNumBuffers);
+        });
+        conn->readv(std::move(buffers), [&, conn](const Error& error) {
+          ASSERT_FALSE(error) << error.what();
+          for (int i = 0; i < kNumBuffers; i++) {
+            ASSERT_EQ(data[i], msg[i]);
+          }
+          peers_->done(PeerGroup::kClient);
+        });
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
 // TODO: Enable this test when uv transport could handle
 TEST_P(TransportTest, DISABLED_Connection_EmptyBuffer) {
   constexpr size_t numBytes = 13;
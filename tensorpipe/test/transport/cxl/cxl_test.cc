@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/cxl/cxl_test.h>
+
+namespace {
+
+CxlTransportTestHelper helper;
+
+// Much smaller than the default, so that most buffers need to be chunked and
+// the outbox fills up.
+CxlTransportTestHelper smallInboxHelper(4 * 1024);
+
+// Skips the flushes.
+CxlTransportTestHelper coherentHelper(1024 * 1024, /*coherent=*/true);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Cxl, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    CxlSmallInbox,
+    TransportTest,
+    ::testing::Values(&smallInboxHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    CxlCoherent,
+    TransportTest,
+    ::testing::Values(&coherentHelper));
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/cxl/context.h>
+
+// Stands in for a region shared by several hosts with a file in /dev/shm,
+// which is sparse, hence only takes up the memory that the inboxes touch. Each
+// context gets the next partition of it, which can be reused once the contexts
+// that came that many contexts earlier went away.
+class CxlTransportTestHelper : public TransportTestHelper {
+ public:
+  static constexpr size_t kNumPartitions = 16;
+  static constexpr size_t kPartitionSize = 16 * 1024 * 1024;
+
+  explicit CxlTransportTestHelper(
+      size_t inboxSize = 1024 * 1024,
+      bool coherent = false)
+      : inboxSize_(inboxSize),
+        coherent_(coherent),
+        path_(
+            "/dev/shm/tensorpipe_cxl_test_" + std::to_string(::getpid()) +
+            "_" + std::to_string(inboxSize) + (coherent ? "_coherent" : "")) {
+    tensorpipe::Fd fd(::open(path_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600));
+    TP_THROW_SYSTEM_IF(!fd.hasValue(), errno);
+    int rv = ::ftruncate(fd.fd(), kNumPartitions * kPartitionSize);
+    TP_THROW_SYSTEM_IF(rv < 0, errno);
+  }
+
+  std::shared_ptr<tensorpipe::transport::Context> getContext() override {
+    const size_t partitionIdx = nextPartitionIdx_++ % kNumPartitions;
+    return std::make_shared<tensorpipe::transport::cxl::Context>(
+        path_,
+        kNumPartitions * kPartitionSize,
+        partitionIdx * kPartitionSize,
+        kPartitionSize,
+        tensorpipe::BusyPollingPolicy(),
+        inboxSize_,
+        coherent_);
+  }
+
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+  ~CxlTransportTestHelper() override {
+    ::unlink(path_.c_str());
+  }
+
+ private:
+  const size_t inboxSize_;
+  const bool coherent_;
+  const std::string path_;
+  std::atomic<size_t> nextPartitionIdx_{0};
+};
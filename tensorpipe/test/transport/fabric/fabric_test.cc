@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/fabric/fabric_test.h>
+
+namespace {
+
+FabricTransportTestHelper helper;
+
+// Much smaller than the default, so that most buffers need to be chunked and
+// the outbox fills up.
+FabricTransportTestHelper smallInboxHelper(4 * 1024);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Fabric, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    FabricSmallInbox,
+    TransportTest,
+    ::testing::Values(&smallInboxHelper));
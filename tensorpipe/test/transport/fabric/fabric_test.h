@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/fabric/context.h>
+
+class FabricTransportTestHelper : public TransportTestHelper {
+ public:
+  // Any provider will do, so that the tests also run on hosts without EFA
+  // through the software ones (e.g., tcp or sockets).
+  explicit FabricTransportTestHelper(
+      size_t inboxSize =
+          tensorpipe::transport::fabric::Context::kDefaultInboxSize,
+      std::string provider = "")
+      : inboxSize_(inboxSize), provider_(std::move(provider)) {}
+
+  std::shared_ptr<tensorpipe::transport::Context> getContext() override {
+    return std::make_shared<tensorpipe::transport::fabric::Context>(
+        tensorpipe::BusyPollingPolicy(), inboxSize_, provider_);
+  }
+
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+ private:
+  const size_t inboxSize_;
+  const std::string provider_;
+};
@@ -21,8 +21,7 @@ class IbvTransportTest : public TransportTest {};
 
 IbvTransportTestHelper helper;
 
-// This value is defined in tensorpipe/transport/ibv/connection.h
-static constexpr auto kBufferSize = 2 * 1024 * 1024;
+static constexpr size_t kBufferSize = ibv::Context::kDefaultInboxSize;
 
 } // namespace
 
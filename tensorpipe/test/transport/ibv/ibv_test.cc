@@ -12,6 +12,76 @@ namespace {
 
 IbvTransportTestHelper helper;
 
+// Much smaller than the default, so that most buffers need to be chunked.
+IbvTransportTestHelper smallInboxHelper(4 * 1024);
+
+// Slabs that fit a few small inboxes each, so that connections share them.
+IbvTransportTestHelper pooledRingsHelper(
+    /*inboxSize=*/4 * 1024,
+    /*ringSlabSize=*/16 * 1024);
+
+// Low enough for most of the buffers of the tests to be read by the receiver.
+IbvTransportTestHelper rendezvousHelper(
+    tensorpipe::transport::ibv::Context::kDefaultInboxSize,
+    /*ringSlabSize=*/0,
+    /*rendezvousThreshold=*/1024);
+
+// The same, registering the buffers with On-Demand Paging where supported.
+IbvTransportTestHelper onDemandPagingHelper(
+    tensorpipe::transport::ibv::Context::kDefaultInboxSize,
+    /*ringSlabSize=*/0,
+    /*rendezvousThreshold=*/1024,
+    /*onDemandPaging=*/true);
+
+// Rings carved out of huge-page slabs, which fall back to regular pages on
+// hosts that have none to spare.
+IbvTransportTestHelper hugePagesHelper(
+    /*inboxSize=*/64 * 1024,
+    /*ringSlabSize=*/2 * 1024 * 1024,
+    /*rendezvousThreshold=*/0,
+    /*onDemandPaging=*/false,
+    /*useHugePages=*/true);
+
+// Several queue pairs per connection, with the writes and the reads striped
+// over them, which may thus complete out of order.
+IbvTransportTestHelper multipleQueuePairsHelper(
+    tensorpipe::transport::ibv::Context::kDefaultInboxSize,
+    /*ringSlabSize=*/0,
+    /*rendezvousThreshold=*/64 * 1024,
+    /*onDemandPaging=*/false,
+    /*useHugePages=*/false,
+    /*numQueuePairs=*/4);
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Ibv, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvSmallInbox,
+    TransportTest,
+    ::testing::Values(&smallInboxHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvPooledRings,
+    TransportTest,
+    ::testing::Values(&pooledRingsHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvRendezvous,
+    TransportTest,
+    ::testing::Values(&rendezvousHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvOnDemandPaging,
+    TransportTest,
+    ::testing::Values(&onDemandPagingHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvHugePages,
+    TransportTest,
+    ::testing::Values(&hugePagesHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    IbvMultipleQueuePairs,
+    TransportTest,
+    ::testing::Values(&multipleQueuePairsHelper));
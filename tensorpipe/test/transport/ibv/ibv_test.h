@@ -13,11 +13,42 @@
 
 class IbvTransportTestHelper : public TransportTestHelper {
  public:
+  explicit IbvTransportTestHelper(
+      size_t inboxSize = tensorpipe::transport::ibv::Context::kDefaultInboxSize,
+      size_t ringSlabSize = 0,
+      size_t rendezvousThreshold = 0,
+      bool onDemandPaging = false,
+      bool useHugePages = false,
+      size_t numQueuePairs = 1)
+      : inboxSize_(inboxSize),
+        ringSlabSize_(ringSlabSize),
+        rendezvousThreshold_(rendezvousThreshold),
+        useHugePages_(useHugePages),
+        numQueuePairs_(numQueuePairs) {
+    deviceOptions_.onDemandPaging = onDemandPaging;
+  }
+
   std::shared_ptr<tensorpipe::transport::Context> getContext() override {
-    return std::make_shared<tensorpipe::transport::ibv::Context>();
+    return std::make_shared<tensorpipe::transport::ibv::Context>(
+        tensorpipe::BusyPollingPolicy(),
+        inboxSize_,
+        deviceOptions_,
+        tensorpipe::transport::ibv::QueueLimits(),
+        ringSlabSize_,
+        rendezvousThreshold_,
+        useHugePages_,
+        numQueuePairs_);
   }
 
   std::string defaultAddr() override {
     return "127.0.0.1";
   }
+
+ private:
+  const size_t inboxSize_;
+  const size_t ringSlabSize_;
+  const size_t rendezvousThreshold_;
+  const bool useHugePages_;
+  const size_t numQueuePairs_;
+  tensorpipe::IbvDeviceOptions deviceOptions_;
 };
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/mux/context.h>
+#include <tensorpipe/transport/uv/context.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+namespace {
+
+class MuxTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit MuxTransportTestHelper(size_t numConnectionsPerPeer = 1)
+      : numConnectionsPerPeer_(numConnectionsPerPeer) {}
+
+  std::shared_ptr<Context> getContext() override {
+    return std::make_shared<mux::Context>(
+        std::make_shared<uv::Context>(), numConnectionsPerPeer_);
+  }
+
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+ private:
+  const size_t numConnectionsPerPeer_;
+};
+
+MuxTransportTestHelper helper;
+MuxTransportTestHelper poolHelper(/*numConnectionsPerPeer=*/2);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Mux, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(MuxPool, TransportTest, ::testing::Values(&poolHelper));
+
+// Open many connections to the same listener, which all share the same
+// underlying one, and check that the data written to each of them only reaches
+// the corresponding one on the other side, even when written before the reads
+// are queued.
+TEST(MuxTransport, ConnectionsAreSeparate) {
+  constexpr size_t kNumConnections = 16;
+  auto serverContext = helper.getContext();
+  auto clientContext = helper.getContext();
+
+  auto listener = serverContext->listen(helper.defaultAddr());
+  std::vector<std::shared_ptr<Connection>> clientConnections;
+  for (size_t idx = 0; idx < kNumConnections; idx++) {
+    clientConnections.push_back(clientContext->connect(listener->addr()));
+  }
+
+  // The sub-streams are opened in order over a single connection, hence they
+  // are accepted in that same order.
+  std::vector<std::shared_ptr<Connection>> serverConnections;
+  for (size_t idx = 0; idx < kNumConnections; idx++) {
+    std::promise<std::shared_ptr<Connection>> connectionProm;
+    listener->accept(
+        [&](const Error& error, std::shared_ptr<Connection> connection) {
+          EXPECT_FALSE(error) << error.what();
+          connectionProm.set_value(std::move(connection));
+        });
+    serverConnections.push_back(connectionProm.get_future().get());
+  }
+
+  std::vector<uint64_t> values(kNumConnections);
+  std::vector<std::promise<void>> writeProms(kNumConnections);
+  for (size_t idx = 0; idx < kNumConnections; idx++) {
+    values[idx] = idx;
+    clientConnections[idx]->write(
+        &values[idx], sizeof(uint64_t), [&, idx](const Error& error) {
+          EXPECT_FALSE(error) << error.what();
+          writeProms[idx].set_value();
+        });
+  }
+
+  // Read in reverse order, half of them into a buffer and half of them not.
+  std::vector<uint64_t> readValues(kNumConnections);
+  std::vector<std::promise<void>> readProms(kNumConnections);
+  for (size_t idx = kNumConnections; idx-- > 0;) {
+    auto callback = [&, idx](
+                        const Error& error, const void* ptr, size_t length) {
+      EXPECT_FALSE(error) << error.what();
+      EXPECT_EQ(length, sizeof(uint64_t));
+      if (!error && ptr != &readValues[idx]) {
+        readValues[idx] = *reinterpret_cast<const uint64_t*>(ptr);
+      }
+      readProms[idx].set_value();
+    };
+    if (idx % 2 == 0) {
+      serverConnections[idx]->read(
+          &readValues[idx], sizeof(uint64_t), std::move(callback));
+    } else {
+      serverConnections[idx]->read(std::move(callback));
+    }
+  }
+
+  for (size_t idx = 0; idx < kNumConnections; idx++) {
+    writeProms[idx].get_future().get();
+    readProms[idx].get_future().get();
+    EXPECT_EQ(readValues[idx], idx);
+  }
+
+  // Closing one connection only affects its peer, and not the other ones.
+  clientConnections[0]->close();
+  std::promise<void> eofProm;
+  serverConnections[0]->read(
+      [&](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_TRUE(error);
+        eofProm.set_value();
+      });
+  eofProm.get_future().get();
+
+  std::promise<void> pingProm;
+  uint64_t ping = 42;
+  uint64_t pong = 0;
+  serverConnections[1]->read(
+      &pong,
+      sizeof(uint64_t),
+      [&](const Error& error, const void* /* unused */, size_t /* unused */) {
+        EXPECT_FALSE(error) << error.what();
+        pingProm.set_value();
+      });
+  clientConnections[1]->write(
+      &ping, sizeof(uint64_t), [](const Error& error) {
+        EXPECT_FALSE(error) << error.what();
+      });
+  pingProm.get_future().get();
+  EXPECT_EQ(pong, ping);
+
+  serverConnections.clear();
+  clientConnections.clear();
+  listener.reset();
+  serverContext->join();
+  clientContext->join();
+}
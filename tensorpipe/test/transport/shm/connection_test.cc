@@ -8,6 +8,8 @@
 
 #include <tensorpipe/test/transport/shm/shm_test.h>
 
+#include <cstring>
+
 #include <gtest/gtest.h>
 #include <nop/serializer.h>
 #include <nop/structure.h>
@@ -21,8 +23,7 @@ class ShmTransportTest : public TransportTest {};
 
 SHMTransportTestHelper helper;
 
-// This value is defined in tensorpipe/transport/shm/connection.h
-static constexpr auto kBufferSize = 2 * 1024 * 1024;
+static constexpr size_t kBufferSize = shm::Context::kDefaultInboxSize;
 
 } // namespace
 
@@ -133,6 +134,54 @@ TEST_P(ShmTransportTest, QueueWrites) {
       });
 }
 
+TEST_P(ShmTransportTest, WriteWeight) {
+  // This takes several turns of the reactor to write, even with the weight,
+  // and the small message that follows it must wait for all of them.
+  const size_t kLargeSize = 3 * kBufferSize;
+  const std::string kSmallMsg = "small";
+  std::string largeMsg(kLargeSize, 0);
+  for (size_t idx = 0; idx < kLargeSize; idx++) {
+    largeMsg[idx] = static_cast<char>(idx % 251);
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        doRead(
+            conn, [&, conn](const Error& error, const void* ptr, size_t len) {
+              ASSERT_FALSE(error) << error.what();
+              ASSERT_EQ(len, kLargeSize);
+              EXPECT_EQ(std::memcmp(ptr, largeMsg.data(), len), 0);
+            });
+        doRead(
+            conn, [&, conn](const Error& error, const void* ptr, size_t len) {
+              ASSERT_FALSE(error) << error.what();
+              EXPECT_EQ(
+                  std::string(static_cast<const char*>(ptr), len), kSmallMsg);
+              peers_->done(PeerGroup::kServer);
+            });
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        conn->setWriteWeight(2);
+        doWrite(
+            conn,
+            largeMsg.data(),
+            largeMsg.length(),
+            [&, conn](const Error& error) {
+              ASSERT_FALSE(error) << error.what();
+            });
+        doWrite(
+            conn,
+            kSmallMsg.data(),
+            kSmallMsg.length(),
+            [&, conn](const Error& error) {
+              ASSERT_FALSE(error) << error.what();
+              peers_->done(PeerGroup::kClient);
+            });
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
 namespace {
 
 struct MyNopType {
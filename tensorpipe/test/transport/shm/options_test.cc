@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/shm/options.h>
+
+#include <cstdlib>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::transport;
+
+TEST(ShmContextOptions, Defaults) {
+  shm::ContextOptions options;
+  EXPECT_NO_THROW(options.validate());
+  EXPECT_EQ(options.inboxSize, 2 * 1024 * 1024);
+  EXPECT_EQ(options.reactorSize, 4 * 1024 * 1024);
+  EXPECT_NE(
+      options.str().find("inbox_size=2097152,reactor_size=4194304"),
+      std::string::npos);
+  EXPECT_NE(options.str().find("share_threads=false"), std::string::npos);
+  EXPECT_EQ(options.listenBacklog, 128);
+}
+
+TEST(ShmContextOptions, Validate) {
+  shm::ContextOptions options;
+  options.inboxSize = 0;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = shm::ContextOptions();
+  options.reactorSize = 1;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = shm::ContextOptions();
+  options.numaNode = -3;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = shm::ContextOptions();
+  options.listenBacklog = 0;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+}
+
+TEST(ShmContextOptions, FromEnvironment) {
+  ::setenv("TP_SHM_INBOX_SIZE", "1M", /*overwrite=*/1);
+  ::setenv("TP_SHM_SHARE_THREADS", "true", /*overwrite=*/1);
+  ::setenv("TP_SHM_BUSY_POLLING", "adaptive", /*overwrite=*/1);
+  ::setenv("TP_SHM_SLEEP_FOR_US", "20", /*overwrite=*/1);
+
+  shm::ContextOptions base;
+  base.lockRings = true;
+  shm::ContextOptions options = shm::ContextOptions::fromEnvironment(base);
+  EXPECT_EQ(options.inboxSize, 1024 * 1024);
+  EXPECT_TRUE(options.shareThreads);
+  EXPECT_TRUE(options.policy.sleeps());
+  EXPECT_EQ(options.policy.sleepFor.count(), 20);
+  // What isn't in the environment is left alone.
+  EXPECT_TRUE(options.lockRings);
+  EXPECT_EQ(options.reactorSize, base.reactorSize);
+
+  ::setenv("TP_SHM_COALESCE_WRITES", "maybe", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+
+  ::unsetenv("TP_SHM_INBOX_SIZE");
+  ::unsetenv("TP_SHM_SHARE_THREADS");
+  ::unsetenv("TP_SHM_BUSY_POLLING");
+  ::unsetenv("TP_SHM_SLEEP_FOR_US");
+  ::unsetenv("TP_SHM_COALESCE_WRITES");
+}
+
+TEST(ShmContextOptions, FromEnvironmentOutOfRange) {
+  // The suffix would make it wrap around.
+  ::setenv("TP_SHM_INBOX_SIZE", "99999999999G", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+  // Too large even without a suffix.
+  ::setenv("TP_SHM_INBOX_SIZE", "99999999999999999999999", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+  // The largest value that fits is still accepted.
+  ::setenv("TP_SHM_INBOX_SIZE", "16777215G", /*overwrite=*/1);
+  EXPECT_EQ(
+      shm::ContextOptions::fromEnvironment().inboxSize,
+      16777215ull * 1024 * 1024 * 1024);
+  ::unsetenv("TP_SHM_INBOX_SIZE");
+
+  // The NUMA node is an int, which this doesn't fit in.
+  ::setenv("TP_SHM_NUMA_NODE", "9999999999", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+  ::setenv("TP_SHM_NUMA_NODE", "-9999999999", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+  ::setenv("TP_SHM_NUMA_NODE", "1", /*overwrite=*/1);
+  EXPECT_EQ(shm::ContextOptions::fromEnvironment().numaNode, 1);
+  ::unsetenv("TP_SHM_NUMA_NODE");
+
+  ::setenv("TP_SHM_SPIN_FOR_US", "99999999999999999999", /*overwrite=*/1);
+  EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error);
+  ::unsetenv("TP_SHM_SPIN_FOR_US");
+}
+
+TEST(ShmContextOptions, FromEnvironmentNegativeSize) {
+  // Sizes can't be negative, however they are spelled, rather than wrapping
+  // around to a huge value.
+  for (const char* value : {"-5", " -5", "\t-5", "+-5", " 5"}) {
+    ::setenv("TP_SHM_INBOX_SIZE", value, /*overwrite=*/1);
+    EXPECT_THROW(shm::ContextOptions::fromEnvironment(), std::runtime_error)
+        << "Accepted \"" << value << "\"";
+  }
+  ::setenv("TP_SHM_INBOX_SIZE", "0x10K", /*overwrite=*/1);
+  EXPECT_EQ(shm::ContextOptions::fromEnvironment().inboxSize, 16 * 1024);
+  ::unsetenv("TP_SHM_INBOX_SIZE");
+}
@@ -9,6 +9,9 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <thread>
+
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/queue.h>
 #include <tensorpipe/common/socket.h>
@@ -63,7 +66,12 @@ TEST(ShmReactor, Basic) {
           auto socket = Socket(fd);
           auto fds = reactor->fds();
           auto error = socket.sendPayloadAndFds(
-              token1, token2, std::get<0>(fds), std::get<1>(fds));
+              token1,
+              token2,
+              std::get<0>(fds),
+              std::get<1>(fds),
+              std::get<2>(fds),
+              std::get<3>(fds));
           ASSERT_FALSE(error) << error.what();
         }
 
@@ -79,22 +87,107 @@ TEST(ShmReactor, Basic) {
         Reactor::TToken token2;
         Fd header;
         Fd data;
+        Fd sleepWord;
+        Fd eventFd;
 
         // Wait for other process to share reactor fds and token.
         {
           auto socket = Socket(fd);
-          auto error = socket.recvPayloadAndFds(token1, token2, header, data);
+          auto error = socket.recvPayloadAndFds(
+              token1, token2, header, data, sleepWord, eventFd);
           ASSERT_FALSE(error) << error.what();
         }
 
         // Create and run trigger. This should wake up the other
         // process and run the registered function.
-        Reactor::Trigger trigger(std::move(header), std::move(data));
+        Reactor::Trigger trigger(
+            std::move(header),
+            std::move(data),
+            std::move(sleepWord),
+            std::move(eventFd));
         trigger.run(token1);
         trigger.run(token2);
       });
 }
 
+namespace {
+
+void testWakeUpFromSleep(bool sleepOnEventFd) {
+  // Go to sleep as soon as there's nothing to do, and for longer than the test
+  // could reasonably take, so that a missed wakeup would make it hang.
+  BusyPollingPolicy policy;
+  policy.spinFor = std::chrono::microseconds(0);
+  policy.yieldFor = std::chrono::microseconds(0);
+  policy.sleepFor = std::chrono::seconds(60);
+
+  run(
+      [policy, sleepOnEventFd](int fd) {
+        tensorpipe::Queue<int> queue;
+        auto reactor = std::make_shared<Reactor>(
+            policy, /*useHugePages=*/false, nullopt, sleepOnEventFd);
+        auto token = reactor->add([&] { queue.push(1); });
+
+        // Give the reactor a chance to fall asleep, and then check that it's
+        // woken up by deferred functions.
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        reactor->deferToLoop([&] { queue.push(0); });
+        ASSERT_EQ(queue.pop(), 0);
+
+        {
+          auto socket = Socket(fd);
+          auto fds = reactor->fds();
+          auto error = socket.sendPayloadAndFds(
+              token,
+              token,
+              std::get<0>(fds),
+              std::get<1>(fds),
+              std::get<2>(fds),
+              std::get<3>(fds));
+          ASSERT_FALSE(error) << error.what();
+        }
+
+        // Wait for other process to run trigger.
+        ASSERT_EQ(queue.pop(), 1);
+        ASSERT_EQ(queue.pop(), 1);
+
+        reactor->remove(token);
+      },
+      [](int fd) {
+        Reactor::TToken token;
+        Fd header;
+        Fd data;
+        Fd sleepWord;
+        Fd eventFd;
+
+        {
+          auto socket = Socket(fd);
+          auto error = socket.recvPayloadAndFds(
+              token, token, header, data, sleepWord, eventFd);
+          ASSERT_FALSE(error) << error.what();
+        }
+
+        Reactor::Trigger trigger(
+            std::move(header),
+            std::move(data),
+            std::move(sleepWord),
+            std::move(eventFd));
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        trigger.run(token);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        trigger.run(token);
+      });
+}
+
+} // namespace
+
+TEST(ShmReactor, WakeUpFromSleep) {
+  testWakeUpFromSleep(/*sleepOnEventFd=*/false);
+}
+
+TEST(ShmReactor, WakeUpFromSleepOnEventFd) {
+  testWakeUpFromSleep(/*sleepOnEventFd=*/true);
+}
+
 TEST(ShmReactor, TokenReuse) {
   tensorpipe::Queue<int> queue(3);
   auto reactor = std::make_shared<Reactor>();
@@ -123,3 +216,38 @@ TEST(ShmReactor, TokenReuse) {
   reactor->remove(t5);
   reactor->remove(t6);
 }
+
+TEST(ShmReactor, DeduplicateTriggers) {
+  tensorpipe::Queue<int> queue;
+  auto reactor = std::make_shared<Reactor>();
+  auto t1 = reactor->add([&] { queue.push(1); });
+  auto t2 = reactor->add([&] { queue.push(2); });
+
+  auto fds = reactor->fds();
+  Reactor::Trigger trigger(
+      Fd(::dup(std::get<0>(fds))),
+      Fd(::dup(std::get<1>(fds))),
+      Fd(::dup(std::get<2>(fds))),
+      Fd(::dup(std::get<3>(fds))));
+
+  // Triggering from the reactor thread makes sure that all tokens are in the
+  // ring buffer before it polls them, hence they're handled in one batch.
+  reactor->deferToLoop([&] {
+    trigger.run(t1);
+    trigger.run(t2);
+    trigger.run(t1);
+    trigger.run(t1);
+  });
+  ASSERT_EQ(queue.pop(), 1);
+  ASSERT_EQ(queue.pop(), 2);
+
+  // A token that already ran in a previous batch runs again.
+  reactor->deferToLoop([&] { trigger.run(t1); });
+  ASSERT_EQ(queue.pop(), 1);
+
+  reactor->deferToLoop([&] { trigger.run(t2); });
+  ASSERT_EQ(queue.pop(), 2);
+
+  reactor->remove(t1);
+  reactor->remove(t2);
+}
@@ -8,10 +8,172 @@
 
 #include <tensorpipe/test/transport/shm/shm_test.h>
 
+#include <chrono>
+#include <future>
+#include <thread>
+
 namespace {
 
 SHMTransportTestHelper helper;
 
+// Much smaller than the default, so that most buffers need to be chunked.
+SHMTransportTestHelper smallInboxHelper(4 * 1024);
+
+// Bound to whatever node the test runs on, so that it works on any machine.
+SHMTransportTestHelper numaHelper(
+    tensorpipe::transport::shm::Context::kDefaultInboxSize,
+    tensorpipe::transport::shm::Context::kNumaNodeOfCaller);
+
+// With a policy that sleeps, so that the reactor needs to be woken up.
+SHMTransportTestHelper pollEpollHelper(
+    tensorpipe::transport::shm::Context::kDefaultInboxSize,
+    tensorpipe::transport::shm::Context::kNoNumaNode,
+    tensorpipe::BusyPollingPolicy::adaptive(),
+    /*pollEpollFromReactor=*/true);
+
+// Where the contexts of the two sides run on the same threads.
+SHMTransportTestHelper sharedThreadsHelper(
+    tensorpipe::transport::shm::Context::kDefaultInboxSize,
+    tensorpipe::transport::shm::Context::kNoNumaNode,
+    tensorpipe::BusyPollingPolicy(),
+    /*pollEpollFromReactor=*/false,
+    /*shareThreads=*/true);
+
+// With a reactor that sleeps on its eventfd, and that is woken up by the
+// sockets' events directly.
+SHMTransportTestHelper eventFdHelper(
+    tensorpipe::transport::shm::Context::kDefaultInboxSize,
+    tensorpipe::transport::shm::Context::kNoNumaNode,
+    tensorpipe::BusyPollingPolicy::adaptive(),
+    /*pollEpollFromReactor=*/true,
+    /*shareThreads=*/false,
+    /*sleepOnEventFd=*/true);
+
+// Where the connections take their inboxes from those created in advance.
+SHMTransportTestHelper spareInboxesHelper(
+    tensorpipe::transport::shm::Context::kDefaultInboxSize,
+    tensorpipe::transport::shm::Context::kNoNumaNode,
+    tensorpipe::BusyPollingPolicy(),
+    /*pollEpollFromReactor=*/false,
+    /*shareThreads=*/false,
+    /*sleepOnEventFd=*/false,
+    /*numSpareInboxes=*/2);
+
+// Where the writes are framed together at the end of each iteration, with an
+// inbox small enough that a batch often doesn't fit all at once.
+SHMTransportTestHelper coalesceWritesHelper(
+    4 * 1024,
+    tensorpipe::transport::shm::Context::kNoNumaNode,
+    tensorpipe::BusyPollingPolicy(),
+    /*pollEpollFromReactor=*/false,
+    /*shareThreads=*/false,
+    /*sleepOnEventFd=*/false,
+    /*numSpareInboxes=*/0,
+    /*coalesceWrites=*/true);
+
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Shm, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmSmallInbox,
+    TransportTest,
+    ::testing::Values(&smallInboxHelper));
+
+INSTANTIATE_TEST_CASE_P(ShmNuma, TransportTest, ::testing::Values(&numaHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmPollEpoll,
+    TransportTest,
+    ::testing::Values(&pollEpollHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmSharedThreads,
+    TransportTest,
+    ::testing::Values(&sharedThreadsHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmEventFd,
+    TransportTest,
+    ::testing::Values(&eventFdHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmSpareInboxes,
+    TransportTest,
+    ::testing::Values(&spareInboxesHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    ShmCoalesceWrites,
+    TransportTest,
+    ::testing::Values(&coalesceWritesHelper));
+
+TEST(ShmContext, NumaNodeInDomainDescriptor) {
+  using tensorpipe::transport::shm::Context;
+  Context unboundContext;
+  Context boundContext(
+      tensorpipe::BusyPollingPolicy(),
+      Context::kDefaultInboxSize,
+      /*useHugePages=*/false,
+      /*numaNode=*/0);
+
+  const std::string& unbound = unboundContext.domainDescriptor();
+  const std::string& bound = boundContext.domainDescriptor();
+  EXPECT_EQ(bound, unbound + ":numa0");
+
+  // The node doesn't prevent processes on the same machine from connecting.
+  EXPECT_TRUE(boundContext.canCommunicateWithRemote(unbound));
+  EXPECT_TRUE(unboundContext.canCommunicateWithRemote(bound));
+  EXPECT_TRUE(boundContext.canCommunicateWithRemote(unbound + ":numa1"));
+  EXPECT_FALSE(boundContext.canCommunicateWithRemote("shm:other-machine"));
+
+  unboundContext.join();
+  boundContext.join();
+}
+
+TEST(ShmContext, SpareInboxes) {
+  using tensorpipe::transport::shm::Context;
+  auto context = std::make_shared<Context>(
+      tensorpipe::BusyPollingPolicy(),
+      Context::kDefaultInboxSize,
+      /*useHugePages=*/false,
+      Context::kNoNumaNode,
+      /*pollEpollFromReactor=*/false,
+      /*shareThreads=*/false,
+      /*sleepOnEventFd=*/false,
+      /*numSpareInboxes=*/1);
+  // Give the background thread the time to create the spare inbox.
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto listener = context->listen(
+      "tensorpipe_test_spare_inboxes_" + std::to_string(getpid()));
+  std::promise<std::shared_ptr<tensorpipe::transport::Connection>> accepted;
+  listener->accept(
+      [&](const tensorpipe::Error& error,
+          std::shared_ptr<tensorpipe::transport::Connection> connection) {
+        EXPECT_FALSE(error) << error.what();
+        accepted.set_value(std::move(connection));
+      });
+  auto clientConnection = context->connect(listener->addr());
+  auto serverConnection = accepted.get_future().get();
+
+  // Once a byte went through, both sides have taken their inboxes.
+  const uint8_t byte = 42;
+  std::promise<void> read;
+  clientConnection->write(&byte, 1, [](const tensorpipe::Error& error) {
+    EXPECT_FALSE(error) << error.what();
+  });
+  serverConnection->read([&](const tensorpipe::Error& error,
+                              const void* /* unused */,
+                              size_t len) {
+    EXPECT_FALSE(error) << error.what();
+    EXPECT_EQ(len, sizeof(byte));
+    read.set_value();
+  });
+  read.get_future().get();
+  EXPECT_GE(context->getStats().at("spare_inboxes_taken"), 1);
+
+  clientConnection.reset();
+  serverConnection.reset();
+  listener.reset();
+  context->join();
+}
@@ -15,8 +15,38 @@
 
 class SHMTransportTestHelper : public TransportTestHelper {
  public:
+  explicit SHMTransportTestHelper(
+      size_t inboxSize = tensorpipe::transport::shm::Context::kDefaultInboxSize,
+      int numaNode = tensorpipe::transport::shm::Context::kNoNumaNode,
+      tensorpipe::BusyPollingPolicy policy = tensorpipe::BusyPollingPolicy(),
+      bool pollEpollFromReactor = false,
+      bool shareThreads = false,
+      bool sleepOnEventFd = false,
+      size_t numSpareInboxes = 0,
+      bool coalesceWrites = false)
+      : inboxSize_(inboxSize),
+        numaNode_(numaNode),
+        policy_(std::move(policy)),
+        pollEpollFromReactor_(pollEpollFromReactor),
+        shareThreads_(shareThreads),
+        sleepOnEventFd_(sleepOnEventFd),
+        numSpareInboxes_(numSpareInboxes),
+        coalesceWrites_(coalesceWrites) {}
+
   std::shared_ptr<tensorpipe::transport::Context> getContext() override {
-    return std::make_shared<tensorpipe::transport::shm::Context>();
+    return std::make_shared<tensorpipe::transport::shm::Context>(
+        policy_,
+        inboxSize_,
+        /*useHugePages=*/false,
+        numaNode_,
+        pollEpollFromReactor_,
+        shareThreads_,
+        sleepOnEventFd_,
+        numSpareInboxes_,
+        /*prefaultRings=*/false,
+        /*lockRings=*/false,
+        /*copyOffload=*/false,
+        coalesceWrites_);
   }
 
   std::string defaultAddr() override {
@@ -27,4 +57,14 @@ class SHMTransportTestHelper : public TransportTestHelper {
     ss << "tensorpipe_test_" << test_info->name() << "_" << getpid();
     return ss.str();
   }
+
+ private:
+  const size_t inboxSize_;
+  const int numaNode_;
+  const tensorpipe::BusyPollingPolicy policy_;
+  const bool pollEpollFromReactor_;
+  const bool shareThreads_;
+  const bool sleepOnEventFd_;
+  const size_t numSpareInboxes_;
+  const bool coalesceWrites_;
 };
@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/test/transport/uring/uring_test.h>
+
+namespace {
+
+UringTransportTestHelper helper;
+
+// Have all the writes (even the tiniest ones) go through the zero-copy path.
+UringTransportTestHelper zeroCopyHelper(/*zeroCopyThreshold=*/1);
+
+} // namespace
+
+INSTANTIATE_TEST_CASE_P(Uring, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UringZeroCopy,
+    TransportTest,
+    ::testing::Values(&zeroCopyHelper));
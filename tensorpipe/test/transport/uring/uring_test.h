@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <tensorpipe/test/transport/transport_test.h>
+#include <tensorpipe/transport/uring/context.h>
+
+class UringTransportTestHelper : public TransportTestHelper {
+ public:
+  explicit UringTransportTestHelper(size_t zeroCopyThreshold = 0)
+      : zeroCopyThreshold_(zeroCopyThreshold) {}
+
+  std::shared_ptr<tensorpipe::transport::Context> getContext() override {
+    return std::make_shared<tensorpipe::transport::uring::Context>(
+        /*useSqPoll=*/false, zeroCopyThreshold_);
+  }
+
+  std::string defaultAddr() override {
+    return "127.0.0.1";
+  }
+
+ private:
+  const size_t zeroCopyThreshold_;
+};
@@ -15,6 +15,18 @@ namespace {
 class UVTransportConnectionTest : public TransportTest {};
 
 UVTransportTestHelper helper;
+UVTransportTestHelper readAheadHelper(
+    /*numLoops=*/1,
+    /*readAheadSize=*/64 * 1024);
+// Over loopback, the kernel can seldom map the data, hence this mostly checks
+// the copies around the mappings, including those from the read-ahead buffer.
+UVTransportTestHelper zeroCopyReceiveHelper(
+    /*numLoops=*/1,
+    /*readAheadSize=*/64 * 1024,
+    tensorpipe::transport::uv::LowLatencyOptions(),
+    /*unixSockets=*/false,
+    /*shardListeners=*/false,
+    /*zeroCopyReceiveThreshold=*/8 * 1024);
 
 } // namespace
 
@@ -50,7 +62,63 @@ TEST_P(UVTransportConnectionTest, LargeWrite) {
       });
 }
 
+// Many small frames, written before they're read, so that they pile up in the
+// socket and get read ahead in bulk (and large ones, which bypass read-ahead).
+TEST_P(UVTransportConnectionTest, ManySmallFrames) {
+  constexpr int kNumMsgs = 1000;
+  const std::string kReady = "ready";
+  std::vector<std::string> msgs;
+  for (int i = 0; i < kNumMsgs; i++) {
+    const size_t size = i % 100 == 99 ? 16 * 1024 : i % 17;
+    msgs.emplace_back(size, static_cast<char>(i));
+  }
+
+  testConnection(
+      [&](std::shared_ptr<Connection> conn) {
+        for (int i = 0; i < kNumMsgs; i++) {
+          doWrite(
+              conn,
+              msgs[i].c_str(),
+              msgs[i].length(),
+              [&, conn, i](const Error& error) {
+                ASSERT_FALSE(error) << error.what();
+                if (i == kNumMsgs - 1) {
+                  peers_->send(PeerGroup::kClient, kReady);
+                  peers_->done(PeerGroup::kServer);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kServer);
+      },
+      [&](std::shared_ptr<Connection> conn) {
+        ASSERT_EQ(kReady, peers_->recv(PeerGroup::kClient));
+        for (int i = 0; i < kNumMsgs; i++) {
+          doRead(
+              conn,
+              [&, conn, i](const Error& error, const void* data, size_t len) {
+                ASSERT_FALSE(error) << error.what();
+                ASSERT_EQ(
+                    std::string(static_cast<const char*>(data), len), msgs[i]);
+                if (i == kNumMsgs - 1) {
+                  peers_->done(PeerGroup::kClient);
+                }
+              });
+        }
+        peers_->join(PeerGroup::kClient);
+      });
+}
+
 INSTANTIATE_TEST_CASE_P(
     Uv,
     UVTransportConnectionTest,
     ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvReadAhead,
+    UVTransportConnectionTest,
+    ::testing::Values(&readAheadHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvZeroCopyReceive,
+    UVTransportConnectionTest,
+    ::testing::Values(&zeroCopyReceiveHelper));
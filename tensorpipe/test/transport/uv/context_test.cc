@@ -8,8 +8,12 @@
 
 #include <tensorpipe/test/transport/uv/uv_test.h>
 
+#include <unistd.h>
+
 #include <gtest/gtest.h>
 
+#include <tensorpipe/common/error_macros.h>
+
 namespace {
 
 class UVTransportContextTest : public TransportTest {};
@@ -57,4 +61,69 @@ TEST_P(UVTransportContextTest, LookupInterfaceAddress) {
 }
 #endif
 
+TEST(UVTransportContext, UnixSocketsDomainDescriptor) {
+  transport::uv::Context tcpContext;
+  transport::uv::Context unixContext(
+      /*numLoops=*/1,
+      /*loopCpus=*/{},
+      /*readAheadSize=*/0,
+      transport::uv::LowLatencyOptions(),
+      /*unixSockets=*/true);
+  EXPECT_NE(tcpContext.domainDescriptor(), unixContext.domainDescriptor());
+  EXPECT_EQ(unixContext.domainDescriptor().rfind("uv:unix:", 0), 0);
+  tcpContext.join();
+  unixContext.join();
+}
+
+// A handshake that does a round trip on the socket, which must thus be in
+// blocking mode, and then fails, before any key reaches the kernel.
+TEST(UVTransportContext, FailedTlsHandshake) {
+  auto handshake = [](int fd,
+                      bool isClient,
+                      transport::uv::KernelTlsKeys& /* unused */) {
+    char byte = isClient ? 'c' : 's';
+    EXPECT_EQ(::write(fd, &byte, 1), 1);
+    EXPECT_EQ(::read(fd, &byte, 1), 1);
+    EXPECT_EQ(byte, isClient ? 's' : 'c');
+    return TP_CREATE_ERROR(SystemError, "handshake", EPROTO);
+  };
+  transport::uv::Context context(
+      /*numLoops=*/1,
+      /*loopCpus=*/{},
+      /*readAheadSize=*/0,
+      transport::uv::LowLatencyOptions(),
+      /*unixSockets=*/false,
+      handshake);
+  transport::uv::Context plainContext;
+  EXPECT_NE(context.domainDescriptor(), plainContext.domainDescriptor());
+  plainContext.join();
+
+  auto listener = context.listen("127.0.0.1");
+  std::promise<Error> serverReadProm;
+  listener->accept(
+      [&](const Error& error, std::shared_ptr<transport::Connection> conn) {
+        ASSERT_FALSE(error) << error.what();
+        conn->read([&serverReadProm, conn](
+                       const Error& error,
+                       const void* /* unused */,
+                       size_t /* unused */) {
+          serverReadProm.set_value(error);
+        });
+      });
+
+  std::promise<Error> clientWriteProm;
+  auto conn = context.connect(listener->addr());
+  const char msg = 42;
+  conn->write(&msg, sizeof(msg), [&](const Error& error) {
+    clientWriteProm.set_value(error);
+  });
+
+  Error error = clientWriteProm.get_future().get();
+  EXPECT_TRUE(error);
+  EXPECT_NE(error.what().find("handshake"), std::string::npos);
+  EXPECT_TRUE(serverReadProm.get_future().get());
+
+  context.join();
+}
+
 INSTANTIATE_TEST_CASE_P(Uv, UVTransportContextTest, ::testing::Values(&helper));
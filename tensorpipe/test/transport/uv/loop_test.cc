@@ -29,6 +29,18 @@ TEST(UvLoop, Defer) {
   loop.join();
 }
 
+TEST(UvLoop, DeferWhileBusyPolling) {
+  Loop loop(/*cpus=*/{}, /*busyPoll=*/true);
+
+  {
+    std::promise<std::thread::id> prom;
+    loop.deferToLoop([&] { prom.set_value(std::this_thread::get_id()); });
+    ASSERT_NE(std::this_thread::get_id(), prom.get_future().get());
+  }
+
+  loop.join();
+}
+
 } // namespace uv
 } // namespace transport
 } // namespace test
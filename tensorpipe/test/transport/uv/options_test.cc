@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/options.h>
+
+#include <cstdlib>
+#include <stdexcept>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe;
+using namespace tensorpipe::transport;
+
+TEST(UvContextOptions, Defaults) {
+  uv::ContextOptions options;
+  EXPECT_NO_THROW(options.validate());
+  EXPECT_EQ(options.numLoops, 1);
+  EXPECT_EQ(options.listenBacklog, 128);
+  EXPECT_NE(
+      options.str().find("num_loops=1,read_ahead_size=0"), std::string::npos);
+  EXPECT_NE(options.str().find("listen_backlog=128"), std::string::npos);
+}
+
+TEST(UvContextOptions, Validate) {
+  uv::ContextOptions options;
+  options.numLoops = 0;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = uv::ContextOptions();
+  options.numLoops = 2;
+  options.loopCpus = {{0}};
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = uv::ContextOptions();
+  options.listenBacklog = 0;
+  EXPECT_THROW(options.validate(), std::runtime_error);
+
+  options = uv::ContextOptions();
+  options.unixSockets = true;
+  options.tlsHandshake = [](int, bool, uv::KernelTlsKeys&) { return Error(); };
+  EXPECT_THROW(options.validate(), std::runtime_error);
+}
+
+TEST(UvContextOptions, FromEnvironment) {
+  ::setenv("TP_UV_NUM_LOOPS", "4", /*overwrite=*/1);
+  ::setenv("TP_UV_LISTEN_BACKLOG", "4096", /*overwrite=*/1);
+  ::setenv("TP_UV_QUICK_ACK", "1", /*overwrite=*/1);
+  ::setenv("TP_UV_MAX_SOCKET_BUFFER_SIZE", "64M", /*overwrite=*/1);
+
+  uv::ContextOptions base;
+  base.readAheadSize = 1024;
+  uv::ContextOptions options = uv::ContextOptions::fromEnvironment(base);
+  EXPECT_EQ(options.numLoops, 4);
+  EXPECT_EQ(options.listenBacklog, 4096);
+  EXPECT_TRUE(options.lowLatency.quickAck);
+  EXPECT_EQ(options.socketBuffers.maxBufferSize, 64 * 1024 * 1024);
+  // What isn't in the environment is left alone.
+  EXPECT_EQ(options.readAheadSize, 1024);
+  EXPECT_FALSE(options.unixSockets);
+
+  // The backlog is an int, which this doesn't fit in.
+  ::setenv("TP_UV_LISTEN_BACKLOG", "9999999999", /*overwrite=*/1);
+  EXPECT_THROW(uv::ContextOptions::fromEnvironment(), std::runtime_error);
+  ::setenv("TP_UV_LISTEN_BACKLOG", "4096", /*overwrite=*/1);
+
+  ::setenv("TP_UV_NUM_LOOPS", "-1", /*overwrite=*/1);
+  EXPECT_THROW(uv::ContextOptions::fromEnvironment(), std::runtime_error);
+
+  ::unsetenv("TP_UV_NUM_LOOPS");
+  ::unsetenv("TP_UV_LISTEN_BACKLOG");
+  ::unsetenv("TP_UV_QUICK_ACK");
+  ::unsetenv("TP_UV_MAX_SOCKET_BUFFER_SIZE");
+}
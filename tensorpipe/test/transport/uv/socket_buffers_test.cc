@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <limits>
+
+#include <tensorpipe/transport/uv/socket_buffers.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::transport::uv;
+
+namespace {
+
+constexpr size_t kMaxBufferSize = 16 * 1024 * 1024;
+
+} // namespace
+
+TEST(UvSocketBuffers, EstimateBandwidthDelayProduct) {
+  // 1MB/s with a round-trip time of 1ms.
+  EXPECT_EQ(
+      estimateBandwidthDelayProduct(1000000, std::chrono::seconds(1), 1000),
+      1000);
+  // 10GB/s with a round-trip time of 50ms.
+  EXPECT_EQ(
+      estimateBandwidthDelayProduct(
+          1000000000, std::chrono::milliseconds(100), 50000),
+      500000000);
+}
+
+TEST(UvSocketBuffers, EstimateBandwidthDelayProductOfZero) {
+  // No bandwidth.
+  EXPECT_EQ(estimateBandwidthDelayProduct(0, std::chrono::seconds(1), 1000), 0);
+  // No round-trip time yet.
+  EXPECT_EQ(
+      estimateBandwidthDelayProduct(1000000, std::chrono::seconds(1), 0), 0);
+  // No time elapsed, which mustn't divide by zero.
+  EXPECT_EQ(
+      estimateBandwidthDelayProduct(1000000, std::chrono::seconds(0), 1000), 0);
+}
+
+TEST(UvSocketBuffers, EstimateBandwidthDelayProductSaturates) {
+  EXPECT_EQ(
+      estimateBandwidthDelayProduct(
+          std::numeric_limits<uint64_t>::max(),
+          std::chrono::nanoseconds(1),
+          std::numeric_limits<uint32_t>::max()),
+      std::numeric_limits<uint64_t>::max());
+}
+
+TEST(UvSocketBuffers, BufferSize) {
+  // Small products get buffers of twice their size.
+  EXPECT_EQ(socketBufferSizeForBandwidthDelayProduct(0, kMaxBufferSize), 0);
+  EXPECT_EQ(
+      socketBufferSizeForBandwidthDelayProduct(1000, kMaxBufferSize), 2000);
+  EXPECT_EQ(
+      socketBufferSizeForBandwidthDelayProduct(
+          kMaxBufferSize / 2, kMaxBufferSize),
+      kMaxBufferSize);
+
+  // Large ones are capped, including those that doubling would overflow.
+  EXPECT_EQ(
+      socketBufferSizeForBandwidthDelayProduct(
+          kMaxBufferSize / 2 + 1, kMaxBufferSize),
+      kMaxBufferSize);
+  EXPECT_EQ(
+      socketBufferSizeForBandwidthDelayProduct(500000000, kMaxBufferSize),
+      kMaxBufferSize);
+  EXPECT_EQ(
+      socketBufferSizeForBandwidthDelayProduct(
+          std::numeric_limits<uint64_t>::max(), kMaxBufferSize),
+      kMaxBufferSize);
+
+  // Without room for any buffer, there's no buffer.
+  EXPECT_EQ(socketBufferSizeForBandwidthDelayProduct(1000, 0), 0);
+}
@@ -11,7 +11,58 @@
 namespace {
 
 UVTransportTestHelper helper;
+UVTransportTestHelper multiLoopHelper(/*numLoops=*/4);
+UVTransportTestHelper readAheadHelper(
+    /*numLoops=*/1,
+    /*readAheadSize=*/64 * 1024);
+
+// All but the busy-polling loops, which would be too costly for the test suite.
+tensorpipe::transport::uv::LowLatencyOptions getLowLatencyOptions() {
+  auto options = tensorpipe::transport::uv::LowLatencyOptions::aggressive();
+  options.busyPollLoops = false;
+  return options;
+}
+
+UVTransportTestHelper lowLatencyHelper(
+    /*numLoops=*/1,
+    /*readAheadSize=*/0,
+    getLowLatencyOptions());
+
+UVTransportTestHelper unixHelper(
+    /*numLoops=*/1,
+    /*readAheadSize=*/0,
+    tensorpipe::transport::uv::LowLatencyOptions(),
+    /*unixSockets=*/true);
+
+UVTransportTestHelper shardedListenersHelper(
+    /*numLoops=*/4,
+    /*readAheadSize=*/0,
+    tensorpipe::transport::uv::LowLatencyOptions(),
+    /*unixSockets=*/false,
+    /*shardListeners=*/true);
 
 } // namespace
 
 INSTANTIATE_TEST_CASE_P(Uv, TransportTest, ::testing::Values(&helper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvMultiLoop,
+    TransportTest,
+    ::testing::Values(&multiLoopHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvReadAhead,
+    TransportTest,
+    ::testing::Values(&readAheadHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvLowLatency,
+    TransportTest,
+    ::testing::Values(&lowLatencyHelper));
+
+INSTANTIATE_TEST_CASE_P(UvUnix, TransportTest, ::testing::Values(&unixHelper));
+
+INSTANTIATE_TEST_CASE_P(
+    UvShardedListeners,
+    TransportTest,
+    ::testing::Values(&shardedListenersHelper));
@@ -8,16 +8,58 @@
 
 #pragma once
 
+#include <unistd.h>
+
+#include <sstream>
+
 #include <tensorpipe/test/transport/transport_test.h>
 #include <tensorpipe/transport/uv/context.h>
 
 class UVTransportTestHelper : public TransportTestHelper {
  public:
+  explicit UVTransportTestHelper(
+      size_t numLoops = 1,
+      size_t readAheadSize = 0,
+      tensorpipe::transport::uv::LowLatencyOptions lowLatency =
+          tensorpipe::transport::uv::LowLatencyOptions(),
+      bool unixSockets = false,
+      bool shardListeners = false,
+      size_t zeroCopyReceiveThreshold = 0)
+      : numLoops_(numLoops),
+        readAheadSize_(readAheadSize),
+        lowLatency_(std::move(lowLatency)),
+        unixSockets_(unixSockets),
+        shardListeners_(shardListeners),
+        zeroCopyReceiveThreshold_(zeroCopyReceiveThreshold) {}
+
   std::shared_ptr<tensorpipe::transport::Context> getContext() override {
-    return std::make_shared<tensorpipe::transport::uv::Context>();
+    return std::make_shared<tensorpipe::transport::uv::Context>(
+        numLoops_,
+        std::vector<std::vector<int>>(),
+        readAheadSize_,
+        lowLatency_,
+        unixSockets_,
+        /*tlsHandshake=*/nullptr,
+        shardListeners_,
+        zeroCopyReceiveThreshold_);
   }
 
   std::string defaultAddr() override {
-    return "127.0.0.1";
+    if (!unixSockets_) {
+      return "127.0.0.1";
+    }
+    const ::testing::TestInfo* const test_info =
+        ::testing::UnitTest::GetInstance()->current_test_info();
+    std::ostringstream ss;
+    ss << "/tmp/tensorpipe_test_" << test_info->name() << "_" << getpid();
+    return ss.str();
   }
+
+ private:
+  const size_t numLoops_;
+  const size_t readAheadSize_;
+  const tensorpipe::transport::uv::LowLatencyOptions lowLatency_;
+  const bool unixSockets_;
+  const bool shardListeners_;
+  const size_t zeroCopyReceiveThreshold_;
 };
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/xdp/frame.h>
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::transport::xdp;
+
+namespace {
+
+Endpoint makeEndpoint(uint8_t lastByte) {
+  Endpoint endpoint;
+  const uint8_t mac[6] = {0x02, 0x00, 0x00, 0x00, 0x00, lastByte};
+  std::memcpy(endpoint.mac, mac, sizeof(mac));
+  endpoint.ipv4 = htonl(0x0a000000 | lastByte);
+  endpoint.udpPort = htons(47474);
+  return endpoint;
+}
+
+std::vector<uint8_t> makeFrame(
+    const Endpoint& source,
+    const Endpoint& destination,
+    const std::string& payload) {
+  SegmentHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.connectionId = 42;
+  header.flags = kProbeFlag;
+  header.length = payload.size();
+  header.offset = 1234567890123;
+  header.ackOffset = 9876543210;
+  header.window = 65536;
+  std::vector<uint8_t> frame(kFrameHeadersLength + payload.size());
+  writeFrameHeaders(frame.data(), source, destination, header);
+  std::memcpy(
+      frame.data() + kFrameHeadersLength, payload.data(), payload.size());
+  return frame;
+}
+
+} // namespace
+
+TEST(XdpFrame, RoundTrip) {
+  const Endpoint source = makeEndpoint(1);
+  const Endpoint destination = makeEndpoint(2);
+  const std::string data = "hello, world";
+  std::vector<uint8_t> frame = makeFrame(source, destination, data);
+
+  SegmentHeader header;
+  const uint8_t* payload;
+  ASSERT_TRUE(
+      parseFrame(frame.data(), frame.size(), destination, header, payload));
+  EXPECT_EQ(header.connectionId, 42);
+  EXPECT_EQ(header.flags, kProbeFlag);
+  EXPECT_EQ(header.length, data.size());
+  EXPECT_EQ(header.offset, 1234567890123);
+  EXPECT_EQ(header.ackOffset, 9876543210);
+  EXPECT_EQ(header.window, 65536);
+  EXPECT_EQ(payload, frame.data() + kFrameHeadersLength);
+  EXPECT_EQ(
+      std::string(reinterpret_cast<const char*>(payload), data.size()), data);
+}
+
+TEST(XdpFrame, RejectsOtherDestinations) {
+  const Endpoint source = makeEndpoint(1);
+  const Endpoint destination = makeEndpoint(2);
+  std::vector<uint8_t> frame = makeFrame(source, destination, "foo");
+
+  SegmentHeader header;
+  const uint8_t* payload;
+  Endpoint otherAddress = destination;
+  otherAddress.ipv4 = htonl(0x0a000003);
+  EXPECT_FALSE(
+      parseFrame(frame.data(), frame.size(), otherAddress, header, payload));
+  Endpoint otherPort = destination;
+  otherPort.udpPort = htons(47475);
+  EXPECT_FALSE(
+      parseFrame(frame.data(), frame.size(), otherPort, header, payload));
+}
+
+TEST(XdpFrame, RejectsTruncatedFrames) {
+  const Endpoint source = makeEndpoint(1);
+  const Endpoint destination = makeEndpoint(2);
+  std::vector<uint8_t> frame = makeFrame(source, destination, "foobar");
+
+  SegmentHeader header;
+  const uint8_t* payload;
+  // Cut into the payload, and then into the headers.
+  EXPECT_FALSE(
+      parseFrame(frame.data(), frame.size() - 1, destination, header, payload));
+  EXPECT_FALSE(parseFrame(
+      frame.data(), kFrameHeadersLength - 1, destination, header, payload));
+}
+
+TEST(XdpFrame, RejectsOtherProtocols) {
+  const Endpoint source = makeEndpoint(1);
+  const Endpoint destination = makeEndpoint(2);
+  std::vector<uint8_t> frame = makeFrame(source, destination, "foo");
+
+  SegmentHeader header;
+  const uint8_t* payload;
+  // Turn the IPv4 packet into a TCP one.
+  frame[14 + 9] = IPPROTO_TCP;
+  EXPECT_FALSE(
+      parseFrame(frame.data(), frame.size(), destination, header, payload));
+}
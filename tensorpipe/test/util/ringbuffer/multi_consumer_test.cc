@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/util/ringbuffer/multi_consumer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::util::ringbuffer;
+
+namespace {
+
+// Holds and owns the memory for the ringbuffer's header and data.
+class MultiConsumerStorage {
+ public:
+  MultiConsumerStorage(size_t size, size_t numConsumers)
+      : header_(size, numConsumers) {}
+
+  MultiConsumerRingBuffer getRb() {
+    return {&header_, reinterpret_cast<uint8_t*>(data_.get())};
+  }
+
+ private:
+  MultiConsumerHeader header_;
+  // Records are 8-byte aligned.
+  std::unique_ptr<uint64_t[]> data_ = std::make_unique<uint64_t[]>(
+      header_.kDataPoolByteSize / sizeof(uint64_t));
+};
+
+} // namespace
+
+TEST(MultiConsumer, WriteAndRead) {
+  // 32 bytes: two records of up to 8 bytes, or one of up to 24.
+  MultiConsumerStorage storage(32, 2);
+  MultiConsumerRingBuffer rb = storage.getRb();
+  BroadcastProducer p{rb};
+  BroadcastConsumer c0{rb, 0};
+  BroadcastConsumer c1{rb, 1};
+
+  std::array<uint8_t, 24> out;
+  EXPECT_EQ(c0.read(out.data(), out.size()), -ENODATA);
+
+  const std::array<uint8_t, 5> first = {1, 2, 3, 4, 5};
+  const std::array<uint8_t, 8> second = {6, 7, 8, 9, 10, 11, 12, 13};
+  EXPECT_EQ(p.write(first.data(), first.size()), first.size());
+  EXPECT_EQ(p.write(second.data(), second.size()), second.size());
+  EXPECT_EQ(p.write(first.data(), 1), -ENOSPC);
+  EXPECT_EQ(p.write(out.data(), 25), -EINVAL);
+
+  // A buffer that is too small leaves the record in place.
+  EXPECT_EQ(c0.read(out.data(), 4), -ENOSPC);
+  EXPECT_EQ(c0.read(out.data(), out.size()), first.size());
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), out.begin()));
+  EXPECT_EQ(c0.read(out.data(), out.size()), second.size());
+  EXPECT_TRUE(std::equal(second.begin(), second.end(), out.begin()));
+  EXPECT_EQ(c0.read(out.data(), out.size()), -ENODATA);
+
+  // The second consumer hasn't read anything, hence no space was freed.
+  EXPECT_EQ(p.write(first.data(), 1), -ENOSPC);
+
+  auto result = c1.peek();
+  ASSERT_EQ(result.first, first.size());
+  EXPECT_EQ(result.second[0].len, first.size());
+  EXPECT_EQ(result.second[1].len, 0);
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), result.second[0].ptr));
+  EXPECT_EQ(c1.release(), first.size());
+  EXPECT_EQ(c1.read(out.data(), out.size()), second.size());
+  EXPECT_TRUE(std::equal(second.begin(), second.end(), out.begin()));
+
+  // This one wraps around the end of the buffer.
+  std::array<uint8_t, 20> third;
+  for (size_t idx = 0; idx < third.size(); idx++) {
+    third[idx] = 100 + idx;
+  }
+  EXPECT_EQ(p.write(third.data(), third.size()), third.size());
+  for (BroadcastConsumer* c : {&c0, &c1}) {
+    EXPECT_EQ(c->read(out.data(), out.size()), third.size());
+    EXPECT_TRUE(std::equal(third.begin(), third.end(), out.begin()));
+  }
+}
+
+TEST(MultiConsumer, ManyThreads) {
+  constexpr size_t kNumConsumers = 4;
+  constexpr uint32_t kNumRecords = 10000;
+  MultiConsumerStorage storage(256, kNumConsumers);
+  MultiConsumerRingBuffer rb = storage.getRb();
+
+  std::vector<std::thread> threads;
+  for (size_t consumerIdx = 0; consumerIdx < kNumConsumers; consumerIdx++) {
+    threads.emplace_back([&rb, consumerIdx]() {
+      BroadcastConsumer c{rb, consumerIdx};
+      // Every consumer sees every record, whole and in order.
+      for (uint32_t seq = 0; seq < kNumRecords; seq++) {
+        std::array<uint32_t, 3> record;
+        ssize_t ret;
+        while ((ret = c.read(record.data(), sizeof(record))) == -ENODATA) {
+          std::this_thread::yield();
+        }
+        ASSERT_EQ(ret, sizeof(uint32_t) * (2 + seq % 2));
+        EXPECT_EQ(record[0], seq);
+        EXPECT_EQ(record[1], ~seq);
+      }
+    });
+  }
+
+  BroadcastProducer p{rb};
+  for (uint32_t seq = 0; seq < kNumRecords; seq++) {
+    // Vary the length so that records straddle the end of the buffer.
+    std::array<uint32_t, 3> record = {seq, ~seq, seq};
+    const size_t size = sizeof(uint32_t) * (2 + seq % 2);
+    while (p.write(record.data(), size) == -ENOSPC) {
+      std::this_thread::yield();
+    }
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <array>
+#include <thread>
+#include <vector>
+
+#include <tensorpipe/util/ringbuffer/multi_producer.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::util::ringbuffer;
+
+namespace {
+
+// Holds and owns the memory for the ringbuffer's header and data.
+class RingBufferStorage {
+ public:
+  explicit RingBufferStorage(size_t size) : header_(size) {}
+
+  RingBuffer getRb() {
+    return {&header_, data_.get()};
+  }
+
+ private:
+  RingBufferHeader header_;
+  std::unique_ptr<uint8_t[]> data_ =
+      std::make_unique<uint8_t[]>(header_.kDataPoolByteSize);
+};
+
+} // namespace
+
+TEST(MultiProducer, WriteAndRead) {
+  // 32 bytes: two records of up to 8 bytes, or one of up to 24.
+  RingBufferStorage storage(32);
+  RingBuffer rb = storage.getRb();
+  MultiProducer p{rb};
+  RecordConsumer c{rb};
+
+  std::array<uint8_t, 24> out;
+  EXPECT_EQ(c.read(out.data(), out.size()), -ENODATA);
+
+  const std::array<uint8_t, 5> first = {1, 2, 3, 4, 5};
+  const std::array<uint8_t, 8> second = {6, 7, 8, 9, 10, 11, 12, 13};
+  EXPECT_EQ(p.write(first.data(), first.size()), first.size());
+  EXPECT_EQ(p.write(second.data(), second.size()), second.size());
+  EXPECT_EQ(p.write(first.data(), 1), -ENOSPC);
+  EXPECT_EQ(p.write(out.data(), 25), -EINVAL);
+
+  // A buffer that is too small leaves the record in place.
+  EXPECT_EQ(c.read(out.data(), 4), -ENOSPC);
+  EXPECT_EQ(c.read(out.data(), out.size()), first.size());
+  EXPECT_TRUE(std::equal(first.begin(), first.end(), out.begin()));
+  EXPECT_EQ(c.read(out.data(), out.size()), second.size());
+  EXPECT_TRUE(std::equal(second.begin(), second.end(), out.begin()));
+  EXPECT_EQ(c.read(out.data(), out.size()), -ENODATA);
+
+  // This one wraps around the end of the buffer.
+  std::array<uint8_t, 20> third;
+  for (size_t idx = 0; idx < third.size(); idx++) {
+    third[idx] = 100 + idx;
+  }
+  EXPECT_EQ(p.write(third.data(), third.size()), third.size());
+  EXPECT_EQ(c.read(out.data(), out.size()), third.size());
+  EXPECT_TRUE(std::equal(third.begin(), third.end(), out.begin()));
+}
+
+TEST(MultiProducer, ManyThreads) {
+  constexpr int kNumThreads = 4;
+  constexpr uint32_t kNumRecordsPerThread = 10000;
+  RingBufferStorage storage(256);
+  RingBuffer rb = storage.getRb();
+  MultiProducer p{rb};
+  RecordConsumer c{rb};
+
+  std::vector<std::thread> threads;
+  for (uint32_t threadIdx = 0; threadIdx < kNumThreads; threadIdx++) {
+    threads.emplace_back([&p, threadIdx]() {
+      for (uint32_t seq = 0; seq < kNumRecordsPerThread; seq++) {
+        // Vary the length so that records straddle the end of the buffer.
+        std::array<uint32_t, 3> record = {threadIdx, seq, seq};
+        const size_t size = sizeof(uint32_t) * (2 + seq % 2);
+        while (p.write(record.data(), size) == -ENOSPC) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Each thread's records arrive whole and in order.
+  std::vector<uint32_t> nextSeq(kNumThreads, 0);
+  for (uint32_t idx = 0; idx < kNumThreads * kNumRecordsPerThread; idx++) {
+    std::array<uint32_t, 3> record;
+    ssize_t ret;
+    while ((ret = c.read(record.data(), sizeof(record))) == -ENODATA) {
+      std::this_thread::yield();
+    }
+    ASSERT_EQ(ret, sizeof(uint32_t) * (2 + record[1] % 2));
+    ASSERT_LT(record[0], kNumThreads);
+    EXPECT_EQ(record[1], nextSeq[record[0]]);
+    if (ret == sizeof(record)) {
+      EXPECT_EQ(record[2], record[1]);
+    }
+    nextSeq[record[0]] = record[1] + 1;
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <cstring>
+#include <vector>
+
+#include <tensorpipe/util/ringbuffer/record_ring.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+#include <gtest/gtest.h>
+
+using namespace tensorpipe::util::ringbuffer;
+
+namespace {
+
+constexpr size_t kSize = 256;
+
+// Holds and owns the memory for the ringbuffer's header and data, the latter
+// being aligned to cache lines. It has room for four records of up to 56 bytes
+// each.
+class RingBufferStorage {
+ public:
+  RingBuffer getRb() {
+    return {&header_, data_};
+  }
+
+ private:
+  RingBufferHeader header_{kSize};
+  alignas(kCacheLineSize) uint8_t data_[kSize];
+};
+
+size_t usedSize(RingBuffer& rb) {
+  return rb.getHeader().readHead() - rb.getHeader().readTail();
+}
+
+} // namespace
+
+TEST(RecordRing, WriteAndConsumeBatch) {
+  RingBufferStorage storage;
+  RingBuffer rb = storage.getRb();
+  RecordWriter w{rb};
+  RecordReader r{rb};
+
+  for (uint8_t value = 0; value < 4; value++) {
+    const std::vector<uint8_t> record(value + 1, value);
+    EXPECT_EQ(w.write(record.data(), record.size()), record.size());
+  }
+  EXPECT_EQ(usedSize(rb), 256);
+  const uint8_t byte = 0;
+  EXPECT_EQ(w.write(&byte, 1), -ENOSPC);
+  EXPECT_EQ(w.write(nullptr, 121), -EINVAL);
+
+  // Records are handed over in order, at most as many as asked for.
+  std::vector<std::vector<uint8_t>> records;
+  auto collect = [&](RecordReader::RecordId /* unused */,
+                     const uint8_t* ptr,
+                     size_t length) {
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(ptr) % kCacheLineSize, 8);
+    records.emplace_back(ptr, ptr + length);
+    return true;
+  };
+  EXPECT_EQ(r.consumeBatch(collect, 3), 3);
+  EXPECT_EQ(usedSize(rb), 64);
+  EXPECT_EQ(r.consumeBatch(collect, 3), 1);
+  EXPECT_EQ(r.consumeBatch(collect, 3), 0);
+  EXPECT_EQ(usedSize(rb), 0);
+  ASSERT_EQ(records.size(), 4);
+  for (uint8_t value = 0; value < 4; value++) {
+    EXPECT_EQ(records[value], std::vector<uint8_t>(value + 1, value));
+  }
+}
+
+TEST(RecordRing, PaddingAtTheEnd) {
+  RingBufferStorage storage;
+  RingBuffer rb = storage.getRb();
+  RecordWriter w{rb};
+  RecordReader r{rb};
+  auto discard = [](RecordReader::RecordId, const uint8_t*, size_t) {
+    return true;
+  };
+
+  // Move to the last 64 bytes of the data.
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(w.write(&i, sizeof(i)), sizeof(i));
+  }
+  EXPECT_EQ(r.consumeBatch(discard, 3), 3);
+
+  // A record that doesn't fit in them starts over at the beginning.
+  std::vector<uint8_t> record(100, 0x42);
+  EXPECT_EQ(w.write(record.data(), record.size()), record.size());
+  EXPECT_EQ(usedSize(rb), 64 + 128);
+  EXPECT_EQ(
+      r.consumeBatch(
+          [&](RecordReader::RecordId, const uint8_t* ptr, size_t length) {
+            EXPECT_EQ(ptr, rb.getData() + 8);
+            EXPECT_EQ(std::vector<uint8_t>(ptr, ptr + length), record);
+            return true;
+          },
+          1),
+      1);
+  EXPECT_EQ(usedSize(rb), 0);
+}
+
+TEST(RecordRing, ReleaseOutOfOrder) {
+  RingBufferStorage storage;
+  RingBuffer rb = storage.getRb();
+  RecordWriter w{rb};
+  RecordReader r{rb};
+
+  for (int i = 0; i < 4; i++) {
+    EXPECT_EQ(w.write(&i, sizeof(i)), sizeof(i));
+  }
+
+  // Keep all of them but the third.
+  std::vector<RecordReader::RecordId> kept;
+  EXPECT_EQ(
+      r.consumeBatch(
+          [&](RecordReader::RecordId id, const uint8_t* ptr, size_t length) {
+            int value;
+            EXPECT_EQ(length, sizeof(value));
+            std::memcpy(&value, ptr, sizeof(value));
+            if (value == 2) {
+              return true;
+            }
+            kept.push_back(id);
+            return false;
+          },
+          4),
+      4);
+  ASSERT_EQ(kept.size(), 3);
+  EXPECT_EQ(usedSize(rb), 256);
+
+  // Space is only given back once the records before are released too.
+  r.release(kept[1]);
+  EXPECT_EQ(usedSize(rb), 256);
+  r.release(kept[0]);
+  EXPECT_EQ(usedSize(rb), 64);
+  const int value = 4;
+  EXPECT_EQ(w.write(&value, sizeof(value)), sizeof(value));
+  r.release(kept[2]);
+  EXPECT_EQ(usedSize(rb), 64);
+
+  EXPECT_EQ(
+      r.consumeBatch(
+          [&](RecordReader::RecordId, const uint8_t* ptr, size_t) {
+            int read;
+            std::memcpy(&read, ptr, sizeof(read));
+            EXPECT_EQ(read, value);
+            return true;
+          },
+          4),
+      1);
+  EXPECT_EQ(usedSize(rb), 0);
+}
+
+TEST(RecordRing, ReserveAndCommit) {
+  RingBufferStorage storage;
+  RingBuffer rb = storage.getRb();
+  RecordWriter w{rb};
+  RecordReader r{rb};
+
+  ssize_t ret;
+  uint8_t* ptr;
+  std::tie(ret, ptr) = w.reserve(16);
+  EXPECT_EQ(ret, 16);
+  std::memset(ptr, 0xAB, 16);
+  // Nothing is visible until committed.
+  EXPECT_EQ(std::get<0>(w.reserve(16)), -EBUSY);
+  EXPECT_EQ(usedSize(rb), 0);
+  EXPECT_EQ(w.commit(), 0);
+  EXPECT_EQ(w.commit(), -EINVAL);
+
+  std::tie(ret, ptr) = w.reserve(16);
+  EXPECT_EQ(ret, 16);
+  EXPECT_EQ(w.cancel(), 0);
+  EXPECT_EQ(usedSize(rb), 64);
+
+  EXPECT_EQ(
+      r.consumeBatch(
+          [&](RecordReader::RecordId, const uint8_t* ptr, size_t length) {
+            EXPECT_EQ(std::vector<uint8_t>(ptr, ptr + length),
+                      std::vector<uint8_t>(16, 0xAB));
+            return true;
+          },
+          4),
+      1);
+}
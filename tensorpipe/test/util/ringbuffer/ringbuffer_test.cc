@@ -6,6 +6,8 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <sys/mman.h>
+
 #include <array>
 
 #include <tensorpipe/util/ringbuffer/consumer.h>
@@ -705,3 +707,259 @@ TEST(RingBuffer, accessContiguousInTx) {
     EXPECT_EQ(usedSize(rb), 0);
   }
 }
+
+TEST(RingBuffer, HeaderLayout) {
+  // Producer-owned and consumer-owned fields must not share a cache line.
+  EXPECT_EQ(alignof(RingBufferHeader), kCacheLineSize);
+  EXPECT_GE(sizeof(RingBufferHeader), 3 * kCacheLineSize);
+  EXPECT_EQ(sizeof(RingBufferHeader) % kCacheLineSize, 0);
+}
+
+TEST(RingBuffer, StaleCachedIndices) {
+  // 8 bytes buffer. Fits two uint32_t.
+  size_t size = 1u << 3;
+
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  // Keep the same producer and consumer alive throughout, so that they need to
+  // refresh their cached copies of each other's index.
+  Producer p{rb};
+  Consumer c{rb};
+
+  for (uint32_t i = 0; i < 100; ++i) {
+    uint32_t value1 = 2 * i;
+    uint32_t value2 = 2 * i + 1;
+    ssize_t ret;
+    ret = p.write(&value1, sizeof(value1));
+    EXPECT_EQ(ret, sizeof(value1));
+    ret = p.write(&value2, sizeof(value2));
+    EXPECT_EQ(ret, sizeof(value2));
+    // It's full now.
+    ret = p.write(&value1, sizeof(value1));
+    EXPECT_EQ(ret, -ENOSPC);
+
+    uint32_t readValue;
+    ret = c.read(&readValue, sizeof(readValue));
+    EXPECT_EQ(ret, sizeof(readValue));
+    EXPECT_EQ(readValue, value1);
+    ret = c.read(&readValue, sizeof(readValue));
+    EXPECT_EQ(ret, sizeof(readValue));
+    EXPECT_EQ(readValue, value2);
+    // It's empty now.
+    ret = c.read(&readValue, sizeof(readValue));
+    EXPECT_EQ(ret, -ENODATA);
+  }
+}
+
+TEST(RingBuffer, ReserveAndPeek) {
+  // 16 bytes buffer.
+  size_t size = 1u << 4;
+
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  Producer p{rb};
+  Consumer c{rb};
+
+  // Move head and tail forward so that the next reservation wraps around.
+  {
+    std::array<uint8_t, 12> value;
+    ssize_t ret = p.write(value.data(), value.size());
+    EXPECT_EQ(ret, value.size());
+    ret = c.read(value.data(), value.size());
+    EXPECT_EQ(ret, value.size());
+  }
+
+  {
+    ssize_t ret;
+    std::array<Producer::Buffer, 2> buffers;
+    std::tie(ret, buffers) = p.reserve(10);
+    EXPECT_EQ(ret, 2);
+    EXPECT_EQ(buffers[0].len, 4);
+    EXPECT_EQ(buffers[1].len, 6);
+    EXPECT_TRUE(p.inTx());
+    // Nothing is visible until it's committed.
+    EXPECT_EQ(usedSize(rb), 0);
+    std::memset(buffers[0].ptr, 0xAB, buffers[0].len);
+    std::memset(buffers[1].ptr, 0xAB, buffers[1].len);
+    ret = p.commit();
+    EXPECT_EQ(ret, 0);
+    EXPECT_FALSE(p.inTx());
+    EXPECT_EQ(usedSize(rb), 10);
+  }
+
+  {
+    // There's not enough space left, and a failed reserve closes the
+    // transaction.
+    ssize_t ret;
+    std::array<Producer::Buffer, 2> buffers;
+    std::tie(ret, buffers) = p.reserve(7);
+    EXPECT_EQ(ret, -ENOSPC);
+    EXPECT_FALSE(p.inTx());
+  }
+
+  {
+    ssize_t ret;
+    std::array<Consumer::Buffer, 2> buffers;
+    std::tie(ret, buffers) = c.peek(11);
+    EXPECT_EQ(ret, -ENODATA);
+    EXPECT_FALSE(c.inTx());
+
+    std::tie(ret, buffers) = c.peek(10);
+    EXPECT_EQ(ret, 2);
+    EXPECT_EQ(buffers[0].len, 4);
+    EXPECT_EQ(buffers[1].len, 6);
+    for (int i = 0; i < 4; ++i) {
+      EXPECT_EQ(buffers[0].ptr[i], 0xAB);
+    }
+    for (int i = 0; i < 6; ++i) {
+      EXPECT_EQ(buffers[1].ptr[i], 0xAB);
+    }
+    // The data is still there until it's released.
+    EXPECT_EQ(usedSize(rb), 10);
+    ret = c.release();
+    EXPECT_EQ(ret, 0);
+    EXPECT_FALSE(c.inTx());
+    EXPECT_EQ(usedSize(rb), 0);
+  }
+}
+
+TEST(RingBuffer, ReleaseInTx) {
+  // 16 bytes buffer.
+  size_t size = 1u << 4;
+
+  RingBufferStorage storage(size);
+  RingBuffer rb = storage.getRb();
+  Producer p{rb};
+  Consumer c{rb};
+
+  ssize_t ret = p.startTx();
+  EXPECT_EQ(ret, 0);
+  ssize_t numBuffers;
+  std::array<Producer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      p.accessContiguousInTx</*allowPartial=*/false>(12);
+  EXPECT_EQ(numBuffers, 1);
+  std::memset(buffers[0].ptr, 0xAB, 5);
+  // Only the first five bytes end up being used.
+  ret = p.releaseInTx(7);
+  EXPECT_EQ(ret, 0);
+  // One can't give back more than was accessed.
+  ret = p.releaseInTx(6);
+  EXPECT_EQ(ret, -EINVAL);
+  ret = p.commitTx();
+  EXPECT_EQ(ret, 0);
+  EXPECT_EQ(usedSize(rb), 5);
+
+  // The next write starts right after the used bytes.
+  uint8_t value = 0xCD;
+  ret = p.write(&value, sizeof(value));
+  EXPECT_EQ(ret, sizeof(value));
+  std::array<uint8_t, 6> result;
+  ret = c.read(result.data(), result.size());
+  EXPECT_EQ(ret, result.size());
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(result[i], 0xAB);
+  }
+  EXPECT_EQ(result[5], 0xCD);
+
+  ret = p.releaseInTx(0);
+  EXPECT_EQ(ret, -EINVAL);
+}
+
+TEST(RingBuffer, TriggerRequests) {
+  RingBufferStorage storage(1u << 4);
+  RingBuffer rb = storage.getRb();
+  RingBufferHeader& header = rb.getHeader();
+
+  // Nobody is waiting at first.
+  EXPECT_FALSE(header.takeConsumerTrigger());
+  EXPECT_FALSE(header.takeProducerTrigger());
+
+  // A request is taken only once, however many times it's checked.
+  header.armConsumerTrigger();
+  EXPECT_FALSE(header.takeProducerTrigger());
+  EXPECT_TRUE(header.takeConsumerTrigger());
+  EXPECT_FALSE(header.takeConsumerTrigger());
+
+  header.armProducerTrigger();
+  header.armProducerTrigger();
+  EXPECT_FALSE(header.takeConsumerTrigger());
+  EXPECT_TRUE(header.takeProducerTrigger());
+  EXPECT_FALSE(header.takeProducerTrigger());
+}
+
+TEST(RingBuffer, LargerThan4GB) {
+  // The data is mapped without reserving memory for it, and only the pages
+  // that are written to are ever backed.
+  constexpr size_t kGB = 1ull << 30;
+  constexpr size_t kSize = 8 * kGB;
+  void* ptr = ::mmap(
+      nullptr,
+      kSize,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+      -1,
+      0);
+  ASSERT_NE(ptr, MAP_FAILED);
+  uint8_t* data = reinterpret_cast<uint8_t*>(ptr);
+
+  RingBufferHeader header(kSize);
+  EXPECT_EQ(header.kDataPoolByteSize, kSize);
+  RingBuffer rb(&header, data);
+  Producer p{rb};
+  Consumer c{rb};
+
+  // A single transaction can span more than 4GB.
+  ssize_t ret = p.startTx();
+  EXPECT_EQ(ret, 0);
+  ssize_t numBuffers;
+  std::array<Producer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      p.accessContiguousInTx</*allowPartial=*/false>(3 * kGB);
+  EXPECT_EQ(numBuffers, 1);
+  EXPECT_EQ(buffers[0].ptr, data);
+  EXPECT_EQ(buffers[0].len, 3 * kGB);
+  std::tie(numBuffers, buffers) =
+      p.accessContiguousInTx</*allowPartial=*/false>(3 * kGB);
+  EXPECT_EQ(numBuffers, 1);
+  EXPECT_EQ(buffers[0].ptr, data + 3 * kGB);
+  buffers[0].ptr[3 * kGB - 1] = 0x42;
+  ret = p.commitTx();
+  EXPECT_EQ(ret, 0);
+  EXPECT_EQ(usedSize(rb), 6 * kGB);
+
+  // Only 2GB are left, hence a partial access gets those.
+  ret = p.startTx();
+  EXPECT_EQ(ret, 0);
+  std::tie(numBuffers, buffers) =
+      p.accessContiguousInTx</*allowPartial=*/false>(3 * kGB);
+  EXPECT_EQ(numBuffers, -ENOSPC);
+  std::tie(numBuffers, buffers) =
+      p.accessContiguousInTx</*allowPartial=*/true>(3 * kGB);
+  EXPECT_EQ(numBuffers, 1);
+  EXPECT_EQ(buffers[0].len, 2 * kGB);
+  ret = p.cancelTx();
+  EXPECT_EQ(ret, 0);
+
+  std::array<Consumer::Buffer, 2> cBuffers;
+  std::tie(numBuffers, cBuffers) = c.peek(6 * kGB);
+  EXPECT_EQ(numBuffers, 1);
+  EXPECT_EQ(cBuffers[0].len, 6 * kGB);
+  EXPECT_EQ(cBuffers[0].ptr[6 * kGB - 1], 0x42);
+  ret = c.release();
+  EXPECT_EQ(ret, 0);
+  EXPECT_EQ(usedSize(rb), 0);
+
+  // Now a large reservation wraps around the end of the data.
+  std::tie(numBuffers, buffers) = p.reserve(5 * kGB);
+  EXPECT_EQ(numBuffers, 2);
+  EXPECT_EQ(buffers[0].ptr, data + 6 * kGB);
+  EXPECT_EQ(buffers[0].len, 2 * kGB);
+  EXPECT_EQ(buffers[1].ptr, data);
+  EXPECT_EQ(buffers[1].len, 3 * kGB);
+  ret = p.commit();
+  EXPECT_EQ(ret, 0);
+  EXPECT_EQ(usedSize(rb), 5 * kGB);
+
+  ::munmap(ptr, kSize);
+}
@@ -10,7 +10,9 @@
 #include <tensorpipe/util/shm/segment.h>
 
 #include <sys/eventfd.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <unistd.h>
 
 #include <thread>
 
@@ -135,3 +137,63 @@ TEST(SegmentManager, SingleProducer_SingleConsumer_Array) {
   // Wait for child to make gtest happy.
   ::wait(nullptr);
 };
+
+// Huge pages are only a hint: when they can't be used (here, because the size
+// isn't a multiple of the huge page size, and possibly because none are
+// available on the machine) the segment must silently use regular pages.
+TEST(Segment, HugePagesFallBack) {
+  for (size_t numBytes : {size_t(4096), size_t(2 * 1024 * 1024)}) {
+    Segment segment;
+    uint8_t* ptr;
+    std::tie(segment, ptr) =
+        Segment::create<uint8_t[]>(numBytes, true, PageType::HugeTLB_2MB);
+    EXPECT_EQ(segment.getSize(), numBytes);
+    ptr[0] = 42;
+    ptr[numBytes - 1] = 42;
+
+    Segment otherSegment;
+    uint8_t* otherPtr;
+    std::tie(otherSegment, otherPtr) = Segment::load<uint8_t[]>(
+        Fd(::dup(segment.getFd())), false, PageType::Default);
+    EXPECT_EQ(otherSegment.getSize(), numBytes);
+    EXPECT_EQ(otherPtr[0], 42);
+    EXPECT_EQ(otherPtr[numBytes - 1], 42);
+  }
+}
+
+namespace {
+
+uint64_t getNumMinorFaults() {
+  struct rusage usage;
+  EXPECT_EQ(::getrusage(RUSAGE_THREAD, &usage), 0);
+  return usage.ru_minflt;
+}
+
+} // namespace
+
+// Each process has its own mapping of a segment, whose pages it faults in on
+// first touch (a few at a time, as the kernel maps the neighboring ones too),
+// unless it faults them all in at once.
+TEST(Segment, Prefault) {
+  const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  const size_t numPages = 256;
+  Segment segment;
+  uint8_t* ptr;
+  std::tie(segment, ptr) =
+      Segment::create<uint8_t[]>(numPages * pageSize, true, PageType::Default);
+  ptr[0] = 42;
+
+  Segment otherSegment;
+  uint8_t* otherPtr;
+  std::tie(otherSegment, otherPtr) = Segment::load<uint8_t[]>(
+      Fd(::dup(segment.getFd())), false, PageType::Default);
+  EXPECT_TRUE(otherSegment.prefault(/*lock=*/false));
+
+  const uint64_t numFaultsBefore = getNumMinorFaults();
+  uint64_t sum = 0;
+  for (size_t pageIdx = 0; pageIdx < numPages; pageIdx++) {
+    sum += *reinterpret_cast<volatile uint8_t*>(otherPtr + pageIdx * pageSize);
+  }
+  EXPECT_EQ(getNumMinorFaults() - numFaultsBefore, 0);
+  EXPECT_EQ(sum, 42);
+}
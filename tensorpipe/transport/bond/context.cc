@@ -0,0 +1,1081 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/bond/context.h>
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/transport/bond/nop_types.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/layered/connection.h>
+#include <tensorpipe/transport/layered/context_impl.h>
+#include <tensorpipe/transport/layered/listener.h>
+#include <tensorpipe/transport/layered/loop.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace bond {
+
+namespace {
+
+// Prepended to the descriptors of the lanes.
+const std::string kDomainDescriptorPrefix{"bond:"};
+
+// Between the addresses, and the descriptors, of the lanes.
+constexpr char kLaneSeparator = '|';
+
+std::vector<std::string> splitLanes(const std::string& str) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  while (true) {
+    const size_t end = str.find(kLaneSeparator, start);
+    if (end == std::string::npos) {
+      parts.push_back(str.substr(start));
+      return parts;
+    }
+    parts.push_back(str.substr(start, end - start));
+    start = end + 1;
+  }
+}
+
+std::string joinLanes(const std::vector<std::string>& parts) {
+  std::string str;
+  for (size_t idx = 0; idx < parts.size(); idx++) {
+    if (idx > 0) {
+      str += kLaneSeparator;
+    }
+    str += parts[idx];
+  }
+  return str;
+}
+
+std::string generateDomainDescriptor(
+    const std::vector<std::shared_ptr<transport::Context>>& lanes) {
+  std::vector<std::string> descriptors;
+  for (const auto& lane : lanes) {
+    descriptors.push_back(lane->domainDescriptor());
+  }
+  return kDomainDescriptorPrefix + joinLanes(descriptors);
+}
+
+uint64_t generateNonce() {
+  std::random_device rd;
+  return (static_cast<uint64_t>(rd()) << 32) | static_cast<uint64_t>(rd());
+}
+
+} // namespace
+
+class Context::Impl : public layered::ContextImplIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(
+      std::vector<std::shared_ptr<transport::Context>> lanes,
+      size_t largeWriteThreshold);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr);
+
+  std::shared_ptr<transport::Listener> listen(std::string addr);
+
+  bool isViable() const;
+
+  const std::string& domainDescriptor() const;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  void readFromConnection(
+      uint64_t bondKey,
+      transport::Connection::read_callback_fn fn) override;
+
+  void readFromConnection(
+      uint64_t bondKey,
+      void* ptr,
+      size_t length,
+      transport::Connection::read_callback_fn fn) override;
+
+  void writeToConnection(
+      uint64_t bondKey,
+      const void* ptr,
+      size_t length,
+      transport::Connection::write_callback_fn fn) override;
+
+  void setConnectionId(uint64_t bondKey, std::string id) override;
+
+  void closeConnection(uint64_t bondKey) override;
+
+  void acceptFromListener(
+      uint64_t listenerKey,
+      transport::Listener::accept_callback_fn fn) override;
+
+  void setListenerId(uint64_t listenerKey, std::string id) override;
+
+  void closeListener(uint64_t listenerKey) override;
+
+  ~Impl() override = default;
+
+ private:
+  struct PendingRead {
+    // Whether the read comes with a buffer to fill, or whether it must instead
+    // be handed a pointer to the data.
+    bool hasBuffer;
+    void* ptr;
+    size_t length;
+    transport::Connection::read_callback_fn fn;
+    // Set once the payload arrived, which, if the read has no buffer, is kept
+    // here until the reads that precede it are done too.
+    bool done{false};
+    std::vector<uint8_t> payload;
+  };
+
+  struct PendingWrite {
+    transport::Connection::write_callback_fn fn;
+    // The writes to the lanes (the header, and the payload if it went over
+    // another lane) that haven't completed yet.
+    size_t numLaneWrites;
+  };
+
+  struct Bond {
+    std::vector<std::shared_ptr<transport::Connection>> lanes;
+    std::string id;
+    // Reads and writes complete in the order in which they were issued, hence
+    // each is kept until the ones before it are done. They are identified in
+    // the callbacks of the lanes by their sequence number, counting from the
+    // one at the front. Only the first numHeadersRead reads know on which lane
+    // their payload is, and the header of the next one is read only once the
+    // payload of the previous one was asked for, since it may be on the first
+    // lane too.
+    std::deque<PendingRead> pendingReads;
+    uint64_t firstReadSeq{0};
+    size_t numHeadersRead{0};
+    bool readingHeader{false};
+    std::deque<PendingWrite> pendingWrites;
+    uint64_t firstWriteSeq{0};
+    // The bytes written to each lane that haven't completed yet.
+    std::vector<size_t> bytesInFlight;
+    Error error{Error::kSuccess};
+  };
+
+  // The lanes accepted for a connection of the peer, until all of them are.
+  struct PartialBond {
+    std::vector<std::shared_ptr<transport::Connection>> lanes;
+    size_t numLanes{0};
+  };
+
+  struct ListenerState {
+    std::vector<std::shared_ptr<transport::Listener>> lanes;
+    std::string id;
+    std::deque<transport::Listener::accept_callback_fn> pendingAccepts;
+    std::deque<std::shared_ptr<transport::Connection>> pendingConnections;
+    // Keyed by the nonce of the peer's context and the identifier it chose.
+    std::map<std::pair<uint64_t, uint64_t>, PartialBond> partialBonds;
+    Error error{Error::kSuccess};
+  };
+
+  std::vector<std::string> splitAddr_(const std::string& addr) const;
+
+  void connectFromLoop_(
+      uint64_t bondKey,
+      std::vector<std::string> addrs,
+      std::string id);
+
+  void listenFromLoop_(
+      uint64_t listenerKey,
+      std::vector<std::shared_ptr<transport::Listener>> lanes,
+      std::string id);
+
+  void readFromBondFromLoop_(uint64_t bondKey, PendingRead read);
+
+  void writeToBondFromLoop_(
+      uint64_t bondKey,
+      const void* ptr,
+      size_t length,
+      transport::Connection::write_callback_fn fn);
+
+  void closeBondFromLoop_(uint64_t bondKey);
+
+  void acceptFromListenerFromLoop_(
+      uint64_t listenerKey,
+      transport::Listener::accept_callback_fn fn);
+
+  void closeListenerFromLoop_(uint64_t listenerKey);
+
+  void closeFromLoop_();
+
+  void acceptLane_(uint64_t listenerKey, size_t laneIdx);
+
+  void onLaneAccepted_(
+      uint64_t listenerKey,
+      size_t laneIdx,
+      const Error& error,
+      std::shared_ptr<transport::Connection> connection);
+
+  void onHello_(
+      uint64_t listenerKey,
+      size_t laneIdx,
+      const Error& error,
+      std::shared_ptr<transport::Connection> connection,
+      const Hello& hello);
+
+  void readNextHeader_(uint64_t bondKey, Bond& bond);
+
+  void onHeader_(
+      uint64_t bondKey,
+      uint64_t seq,
+      const Error& error,
+      const MessageHeader& header);
+
+  void onPayload_(
+      uint64_t bondKey,
+      uint64_t seq,
+      const Error& error,
+      std::vector<uint8_t> payload);
+
+  void onLaneWritten_(
+      uint64_t bondKey,
+      uint64_t seq,
+      size_t laneIdx,
+      size_t length,
+      const Error& error);
+
+  void failBond_(uint64_t bondKey, const Error& error);
+
+  // Complete the reads and writes at the front of the queue that are done, or
+  // all of them once the bond has an error.
+  static void completeReads_(Bond& bond);
+  static void completeWrites_(Bond& bond);
+
+  const std::vector<std::shared_ptr<transport::Context>> lanes_;
+  const size_t largeWriteThreshold_;
+  const std::string domainDescriptor_;
+  const uint64_t nonce_;
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Keys for the bonded connections and listeners, which are handed out to the
+  // public objects before these are registered on the loop.
+  std::atomic<uint64_t> nextBondKey_{0};
+  std::atomic<uint64_t> nextListenerKey_{0};
+
+  // The following are only accessed from within the loop.
+  std::unordered_map<uint64_t, Bond> bonds_;
+  std::unordered_map<uint64_t, ListenerState> listeners_;
+
+  // Declared last so that it's the first to be destroyed, while the state that
+  // the functions it may still be running refer to is still alive.
+  layered::Loop loop_{"TP_BOND_loop"};
+};
+
+Context::Context(
+    std::vector<std::shared_ptr<transport::Context>> lanes,
+    size_t largeWriteThreshold)
+    : impl_(std::make_shared<Impl>(std::move(lanes), largeWriteThreshold)) {}
+
+Context::Impl::Impl(
+    std::vector<std::shared_ptr<transport::Context>> lanes,
+    size_t largeWriteThreshold)
+    : lanes_(std::move(lanes)),
+      largeWriteThreshold_(largeWriteThreshold),
+      domainDescriptor_(generateDomainDescriptor(lanes_)),
+      nonce_(generateNonce()) {
+  TP_THROW_ASSERT_IF(lanes_.empty()) << "At least one lane is needed";
+}
+
+std::vector<std::string> Context::Impl::splitAddr_(
+    const std::string& addr) const {
+  std::vector<std::string> addrs = splitLanes(addr);
+  if (addrs.size() == 1) {
+    return std::vector<std::string>(lanes_.size(), addrs[0]);
+  }
+  TP_THROW_ASSERT_IF(addrs.size() != lanes_.size())
+      << "Address " << addr << " has " << addrs.size() << " lanes instead of "
+      << lanes_.size();
+  return addrs;
+}
+
+std::shared_ptr<transport::Connection> Context::connect(std::string addr) {
+  return impl_->connect(std::move(addr));
+}
+
+std::shared_ptr<transport::Connection> Context::Impl::connect(
+    std::string addr) {
+  std::vector<std::string> addrs = splitAddr_(addr);
+  const uint64_t bondKey = nextBondKey_++;
+  std::string id = id_ + ".c" + std::to_string(bondKey);
+  TP_VLOG(7) << "Transport context " << id_ << " is opening connection " << id
+             << " to address " << addr;
+  loop_.deferToLoop([this,
+                     bondKey,
+                     addrs{std::move(addrs)},
+                     id{std::move(id)}]() mutable {
+    connectFromLoop_(bondKey, std::move(addrs), std::move(id));
+  });
+  return std::make_shared<layered::Connection>(shared_from_this(), bondKey);
+}
+
+void Context::Impl::connectFromLoop_(
+    uint64_t bondKey,
+    std::vector<std::string> addrs,
+    std::string id) {
+  TP_DCHECK(loop_.inLoop());
+
+  Bond& bond = bonds_[bondKey];
+  bond.id = std::move(id);
+  if (closed_) {
+    bond.error = TP_CREATE_ERROR(ConnectionClosedError);
+    return;
+  }
+
+  for (size_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
+    std::shared_ptr<transport::Connection> lane =
+        lanes_[laneIdx]->connect(addrs[laneIdx]);
+    lane->setId(bond.id + ".lane" + std::to_string(laneIdx));
+    auto hello = std::make_shared<NopHolder<Hello>>();
+    hello->getObject().nonce = nonce_;
+    hello->getObject().bondId = bondKey;
+    hello->getObject().laneIdx = laneIdx;
+    hello->getObject().numLanes = lanes_.size();
+    // Errors are detected, and handled, by the reads and writes that follow.
+    lane->write(
+        *hello, [hello](const Error& /* unused */) mutable { hello.reset(); });
+    bond.lanes.push_back(std::move(lane));
+  }
+  bond.bytesInFlight.assign(lanes_.size(), 0);
+}
+
+std::shared_ptr<transport::Listener> Context::listen(std::string addr) {
+  return impl_->listen(std::move(addr));
+}
+
+std::shared_ptr<transport::Listener> Context::Impl::listen(std::string addr) {
+  std::vector<std::string> addrs = splitAddr_(addr);
+  const uint64_t listenerKey = nextListenerKey_++;
+  std::string id = id_ + ".l" + std::to_string(listenerKey);
+  TP_VLOG(7) << "Transport context " << id_ << " is opening listener " << id;
+  std::vector<std::shared_ptr<transport::Listener>> listeners;
+  std::vector<std::string> listenerAddrs;
+  for (size_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
+    std::shared_ptr<transport::Listener> listener =
+        lanes_[laneIdx]->listen(addrs[laneIdx]);
+    listener->setId(id + ".lane" + std::to_string(laneIdx));
+    listenerAddrs.push_back(listener->addr());
+    listeners.push_back(std::move(listener));
+  }
+  loop_.deferToLoop([this,
+                     listenerKey,
+                     listeners{std::move(listeners)},
+                     id{std::move(id)}]() mutable {
+    listenFromLoop_(listenerKey, std::move(listeners), std::move(id));
+  });
+  return std::make_shared<layered::Listener>(
+      shared_from_this(), listenerKey, joinLanes(listenerAddrs));
+}
+
+void Context::Impl::listenFromLoop_(
+    uint64_t listenerKey,
+    std::vector<std::shared_ptr<transport::Listener>> lanes,
+    std::string id) {
+  TP_DCHECK(loop_.inLoop());
+
+  ListenerState& state = listeners_[listenerKey];
+  state.lanes = std::move(lanes);
+  state.id = std::move(id);
+  if (closed_) {
+    state.error = TP_CREATE_ERROR(ListenerClosedError);
+    for (const auto& lane : state.lanes) {
+      lane->close();
+    }
+    return;
+  }
+
+  for (size_t laneIdx = 0; laneIdx < state.lanes.size(); laneIdx++) {
+    acceptLane_(listenerKey, laneIdx);
+  }
+}
+
+void Context::Impl::acceptLane_(uint64_t listenerKey, size_t laneIdx) {
+  TP_DCHECK(loop_.inLoop());
+
+  listeners_.at(listenerKey)
+      .lanes[laneIdx]
+      ->accept([impl{shared_from_this()}, listenerKey, laneIdx](
+                   const Error& error,
+                   std::shared_ptr<transport::Connection> connection) {
+        impl->loop_.deferToLoop([impl,
+                                 listenerKey,
+                                 laneIdx,
+                                 error,
+                                 connection{std::move(connection)}]() {
+          impl->onLaneAccepted_(listenerKey, laneIdx, error, connection);
+        });
+      });
+}
+
+void Context::Impl::onLaneAccepted_(
+    uint64_t listenerKey,
+    size_t laneIdx,
+    const Error& error,
+    std::shared_ptr<transport::Connection> connection) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    if (connection != nullptr) {
+      connection->close();
+    }
+    return;
+  }
+  ListenerState& state = iter->second;
+
+  if (error) {
+    if (!state.error) {
+      state.error = error;
+    }
+    while (!state.pendingAccepts.empty()) {
+      transport::Listener::accept_callback_fn fn =
+          std::move(state.pendingAccepts.front());
+      state.pendingAccepts.pop_front();
+      fn(state.error, std::shared_ptr<transport::Connection>());
+    }
+    return;
+  }
+
+  // The connection is kept alive by its own callback until the hello arrives.
+  auto hello = std::make_shared<NopHolder<Hello>>();
+  connection->read(
+      *hello,
+      [impl{shared_from_this()}, listenerKey, laneIdx, connection, hello](
+          const Error& error) {
+        impl->loop_.deferToLoop(
+            [impl, listenerKey, laneIdx, error, connection, hello]() {
+              impl->onHello_(
+                  listenerKey, laneIdx, error, connection, hello->getObject());
+            });
+      });
+  acceptLane_(listenerKey, laneIdx);
+}
+
+void Context::Impl::onHello_(
+    uint64_t listenerKey,
+    size_t laneIdx,
+    const Error& error,
+    std::shared_ptr<transport::Connection> connection,
+    const Hello& hello) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end() || error) {
+    connection->close();
+    return;
+  }
+  ListenerState& state = iter->second;
+
+  if (hello.numLanes != lanes_.size() || hello.laneIdx != laneIdx) {
+    TP_VLOG(7) << "Transport listener " << state.id << " got lane "
+               << hello.laneIdx << " of " << hello.numLanes << " on lane "
+               << laneIdx << " of " << lanes_.size() << ", dropping it";
+    connection->close();
+    return;
+  }
+
+  const auto partialKey = std::make_pair(hello.nonce, hello.bondId);
+  PartialBond& partial = state.partialBonds[partialKey];
+  if (partial.lanes.empty()) {
+    partial.lanes.resize(lanes_.size());
+  }
+  if (partial.lanes[laneIdx] != nullptr) {
+    connection->close();
+    return;
+  }
+  partial.lanes[laneIdx] = std::move(connection);
+  partial.numLanes++;
+  if (partial.numLanes < lanes_.size()) {
+    return;
+  }
+
+  const uint64_t bondKey = nextBondKey_++;
+  Bond& bond = bonds_[bondKey];
+  bond.id = id_ + ".c" + std::to_string(bondKey);
+  bond.lanes = std::move(partial.lanes);
+  bond.bytesInFlight.assign(lanes_.size(), 0);
+  state.partialBonds.erase(partialKey);
+  for (size_t idx = 0; idx < bond.lanes.size(); idx++) {
+    bond.lanes[idx]->setId(bond.id + ".lane" + std::to_string(idx));
+  }
+
+  auto bondConnection = std::make_shared<layered::Connection>(
+      shared_from_this(), bondKey);
+
+  TP_VLOG(7) << "Transport listener " << state.id << " got connection "
+             << bond.id;
+  if (!state.pendingAccepts.empty()) {
+    transport::Listener::accept_callback_fn fn =
+        std::move(state.pendingAccepts.front());
+    state.pendingAccepts.pop_front();
+    fn(Error::kSuccess, std::move(bondConnection));
+  } else {
+    state.pendingConnections.push_back(std::move(bondConnection));
+  }
+}
+
+void Context::Impl::readFromConnection(
+    uint64_t bondKey,
+    transport::Connection::read_callback_fn fn) {
+  loop_.deferToLoop([this, bondKey, fn{std::move(fn)}]() mutable {
+    readFromBondFromLoop_(
+        bondKey, PendingRead{/*hasBuffer=*/false, nullptr, 0, std::move(fn)});
+  });
+}
+
+void Context::Impl::readFromConnection(
+    uint64_t bondKey,
+    void* ptr,
+    size_t length,
+    transport::Connection::read_callback_fn fn) {
+  loop_.deferToLoop([this, bondKey, ptr, length, fn{std::move(fn)}]() mutable {
+    readFromBondFromLoop_(
+        bondKey, PendingRead{/*hasBuffer=*/true, ptr, length, std::move(fn)});
+  });
+}
+
+void Context::Impl::readFromBondFromLoop_(uint64_t bondKey, PendingRead read) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end()) {
+    read.fn(TP_CREATE_ERROR(ConnectionClosedError), nullptr, 0);
+    return;
+  }
+  Bond& bond = iter->second;
+  if (bond.error) {
+    read.fn(bond.error, nullptr, 0);
+    return;
+  }
+
+  bond.pendingReads.push_back(std::move(read));
+  readNextHeader_(bondKey, bond);
+}
+
+void Context::Impl::readNextHeader_(uint64_t bondKey, Bond& bond) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (bond.readingHeader || bond.numHeadersRead == bond.pendingReads.size()) {
+    return;
+  }
+  bond.readingHeader = true;
+  const uint64_t seq = bond.firstReadSeq + bond.numHeadersRead;
+  auto header = std::make_shared<NopHolder<MessageHeader>>();
+  bond.lanes[0]->read(
+      *header,
+      [impl{shared_from_this()}, bondKey, seq, header](const Error& error) {
+        impl->loop_.deferToLoop([impl, bondKey, seq, error, header]() {
+          impl->onHeader_(bondKey, seq, error, header->getObject());
+        });
+      });
+}
+
+void Context::Impl::onHeader_(
+    uint64_t bondKey,
+    uint64_t seq,
+    const Error& error,
+    const MessageHeader& header) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end() || iter->second.error) {
+    return;
+  }
+  Bond& bond = iter->second;
+  if (error) {
+    failBond_(bondKey, error);
+    return;
+  }
+
+  TP_THROW_ASSERT_IF(header.laneIdx >= bond.lanes.size())
+      << "Payload is on lane " << header.laneIdx << " out of "
+      << bond.lanes.size();
+  bond.readingHeader = false;
+  bond.numHeadersRead++;
+  PendingRead& read = bond.pendingReads[seq - bond.firstReadSeq];
+  transport::Connection& lane = *bond.lanes[header.laneIdx];
+  if (read.hasBuffer) {
+    TP_THROW_ASSERT_IF(read.length != header.length)
+        << "Read of " << read.length << " bytes doesn't match the write of "
+        << header.length << " bytes";
+    lane.read(
+        read.ptr,
+        read.length,
+        [impl{shared_from_this()}, bondKey, seq](
+            const Error& error,
+            const void* /* unused */,
+            size_t /* unused */) {
+          impl->loop_.deferToLoop([impl, bondKey, seq, error]() {
+            impl->onPayload_(bondKey, seq, error, std::vector<uint8_t>());
+          });
+        });
+  } else {
+    // The data is only valid within the callback, hence it must be copied out
+    // before deferring to the loop.
+    lane.read([impl{shared_from_this()}, bondKey, seq](
+                  const Error& error, const void* ptr, size_t length) {
+      std::vector<uint8_t> payload;
+      if (!error) {
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
+        payload.assign(data, data + length);
+      }
+      impl->loop_.deferToLoop(
+          [impl, bondKey, seq, error, payload{std::move(payload)}]() mutable {
+            impl->onPayload_(bondKey, seq, error, std::move(payload));
+          });
+    });
+  }
+
+  readNextHeader_(bondKey, bond);
+}
+
+void Context::Impl::onPayload_(
+    uint64_t bondKey,
+    uint64_t seq,
+    const Error& error,
+    std::vector<uint8_t> payload) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end() || iter->second.error) {
+    return;
+  }
+  Bond& bond = iter->second;
+  if (error) {
+    failBond_(bondKey, error);
+    return;
+  }
+
+  PendingRead& read = bond.pendingReads[seq - bond.firstReadSeq];
+  read.done = true;
+  read.payload = std::move(payload);
+  completeReads_(bond);
+}
+
+void Context::Impl::completeReads_(Bond& bond) {
+  while (!bond.pendingReads.empty()) {
+    if (!bond.pendingReads.front().done && !bond.error) {
+      return;
+    }
+    PendingRead read = std::move(bond.pendingReads.front());
+    bond.pendingReads.pop_front();
+    bond.firstReadSeq++;
+    if (bond.numHeadersRead > 0) {
+      bond.numHeadersRead--;
+    }
+    if (!read.done) {
+      read.fn(bond.error, nullptr, 0);
+    } else if (read.hasBuffer) {
+      read.fn(Error::kSuccess, read.ptr, read.length);
+    } else {
+      read.fn(Error::kSuccess, read.payload.data(), read.payload.size());
+    }
+  }
+}
+
+void Context::Impl::writeToConnection(
+    uint64_t bondKey,
+    const void* ptr,
+    size_t length,
+    transport::Connection::write_callback_fn fn) {
+  loop_.deferToLoop([this, bondKey, ptr, length, fn{std::move(fn)}]() mutable {
+    writeToBondFromLoop_(bondKey, ptr, length, std::move(fn));
+  });
+}
+
+void Context::Impl::writeToBondFromLoop_(
+    uint64_t bondKey,
+    const void* ptr,
+    size_t length,
+    transport::Connection::write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end()) {
+    fn(TP_CREATE_ERROR(ConnectionClosedError));
+    return;
+  }
+  Bond& bond = iter->second;
+  if (bond.error) {
+    fn(bond.error);
+    return;
+  }
+
+  // Small writes stay on the first lane, which saves them a trip over another
+  // lane, and large ones go to the least loaded one.
+  size_t laneIdx = 0;
+  if (length >= largeWriteThreshold_) {
+    for (size_t idx = 1; idx < bond.lanes.size(); idx++) {
+      if (bond.bytesInFlight[idx] < bond.bytesInFlight[laneIdx]) {
+        laneIdx = idx;
+      }
+    }
+  }
+  bond.bytesInFlight[laneIdx] += length;
+
+  const uint64_t seq = bond.firstWriteSeq + bond.pendingWrites.size();
+  auto header = std::make_shared<NopHolder<MessageHeader>>();
+  header->getObject().laneIdx = laneIdx;
+  header->getObject().length = length;
+  auto makeCallback = [&](size_t writtenLaneIdx, size_t writtenLength) {
+    return [impl{shared_from_this()},
+            bondKey,
+            seq,
+            writtenLaneIdx,
+            writtenLength,
+            header](const Error& error) {
+      impl->loop_.deferToLoop(
+          [impl, bondKey, seq, writtenLaneIdx, writtenLength, error]() {
+            impl->onLaneWritten_(
+                bondKey, seq, writtenLaneIdx, writtenLength, error);
+          });
+    };
+  };
+  if (laneIdx == 0) {
+    bond.pendingWrites.push_back(PendingWrite{std::move(fn), 1});
+    bond.lanes[0]->writev(
+        *header,
+        {transport::Connection::WriteBuffer{ptr, length}},
+        makeCallback(0, length));
+  } else {
+    bond.pendingWrites.push_back(PendingWrite{std::move(fn), 2});
+    bond.lanes[0]->write(*header, makeCallback(0, 0));
+    bond.lanes[laneIdx]->write(ptr, length, makeCallback(laneIdx, length));
+  }
+}
+
+void Context::Impl::onLaneWritten_(
+    uint64_t bondKey,
+    uint64_t seq,
+    size_t laneIdx,
+    size_t length,
+    const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end()) {
+    return;
+  }
+  Bond& bond = iter->second;
+  bond.bytesInFlight[laneIdx] -= length;
+  if (seq < bond.firstWriteSeq) {
+    return;
+  }
+  if (error) {
+    failBond_(bondKey, error);
+    return;
+  }
+
+  bond.pendingWrites[seq - bond.firstWriteSeq].numLaneWrites--;
+  completeWrites_(bond);
+}
+
+void Context::Impl::completeWrites_(Bond& bond) {
+  while (!bond.pendingWrites.empty()) {
+    if (bond.pendingWrites.front().numLaneWrites > 0 && !bond.error) {
+      return;
+    }
+    PendingWrite write = std::move(bond.pendingWrites.front());
+    bond.pendingWrites.pop_front();
+    bond.firstWriteSeq++;
+    write.fn(write.numLaneWrites > 0 ? bond.error : Error::kSuccess);
+  }
+}
+
+void Context::Impl::failBond_(uint64_t bondKey, const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+
+  Bond& bond = bonds_.at(bondKey);
+  if (!bond.error) {
+    TP_VLOG(7) << "Transport connection " << bond.id
+               << " lost a lane: " << error.what();
+    bond.error = error;
+    // The peer sees the other lanes fail too.
+    for (const auto& lane : bond.lanes) {
+      lane->close();
+    }
+  }
+  completeReads_(bond);
+  completeWrites_(bond);
+}
+
+void Context::Impl::setConnectionId(uint64_t bondKey, std::string id) {
+  loop_.deferToLoop([this, bondKey, id{std::move(id)}]() mutable {
+    auto iter = bonds_.find(bondKey);
+    if (iter != bonds_.end()) {
+      Bond& bond = iter->second;
+      TP_VLOG(7) << "Transport connection " << bond.id << " was renamed to "
+                 << id;
+      for (size_t laneIdx = 0; laneIdx < bond.lanes.size(); laneIdx++) {
+        bond.lanes[laneIdx]->setId(id + ".lane" + std::to_string(laneIdx));
+      }
+      bond.id = std::move(id);
+    }
+  });
+}
+
+void Context::Impl::closeConnection(uint64_t bondKey) {
+  loop_.deferToLoop([this, bondKey]() { closeBondFromLoop_(bondKey); });
+}
+
+void Context::Impl::closeBondFromLoop_(uint64_t bondKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = bonds_.find(bondKey);
+  if (iter == bonds_.end()) {
+    return;
+  }
+  Bond bond = std::move(iter->second);
+  bonds_.erase(iter);
+  TP_VLOG(7) << "Transport connection " << bond.id << " is closing";
+
+  for (const auto& lane : bond.lanes) {
+    lane->close();
+  }
+  if (!bond.error) {
+    bond.error = TP_CREATE_ERROR(ConnectionClosedError);
+  }
+  completeReads_(bond);
+  completeWrites_(bond);
+}
+
+void Context::Impl::acceptFromListener(
+    uint64_t listenerKey,
+    transport::Listener::accept_callback_fn fn) {
+  loop_.deferToLoop([this, listenerKey, fn{std::move(fn)}]() mutable {
+    acceptFromListenerFromLoop_(listenerKey, std::move(fn));
+  });
+}
+
+void Context::Impl::acceptFromListenerFromLoop_(
+    uint64_t listenerKey,
+    transport::Listener::accept_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    fn(TP_CREATE_ERROR(ListenerClosedError),
+       std::shared_ptr<transport::Connection>());
+    return;
+  }
+  ListenerState& state = iter->second;
+
+  if (!state.pendingConnections.empty()) {
+    std::shared_ptr<transport::Connection> connection =
+        std::move(state.pendingConnections.front());
+    state.pendingConnections.pop_front();
+    fn(Error::kSuccess, std::move(connection));
+  } else if (state.error) {
+    fn(state.error, std::shared_ptr<transport::Connection>());
+  } else {
+    state.pendingAccepts.push_back(std::move(fn));
+  }
+}
+
+void Context::Impl::setListenerId(uint64_t listenerKey, std::string id) {
+  loop_.deferToLoop([this, listenerKey, id{std::move(id)}]() mutable {
+    auto iter = listeners_.find(listenerKey);
+    if (iter != listeners_.end()) {
+      ListenerState& state = iter->second;
+      TP_VLOG(7) << "Transport listener " << state.id << " was renamed to "
+                 << id;
+      for (size_t laneIdx = 0; laneIdx < state.lanes.size(); laneIdx++) {
+        state.lanes[laneIdx]->setId(id + ".lane" + std::to_string(laneIdx));
+      }
+      state.id = std::move(id);
+    }
+  });
+}
+
+void Context::Impl::closeListener(uint64_t listenerKey) {
+  loop_.deferToLoop(
+      [this, listenerKey]() { closeListenerFromLoop_(listenerKey); });
+}
+
+void Context::Impl::closeListenerFromLoop_(uint64_t listenerKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    return;
+  }
+  ListenerState state = std::move(iter->second);
+  listeners_.erase(iter);
+  TP_VLOG(7) << "Transport listener " << state.id << " is closing";
+
+  // The connections it already accepted remain open, but not the ones that
+  // are still missing some lanes.
+  for (const auto& lane : state.lanes) {
+    lane->close();
+  }
+  for (const auto& partialIter : state.partialBonds) {
+    for (const auto& lane : partialIter.second.lanes) {
+      if (lane != nullptr) {
+        lane->close();
+      }
+    }
+  }
+  while (!state.pendingAccepts.empty()) {
+    transport::Listener::accept_callback_fn fn =
+        std::move(state.pendingAccepts.front());
+    state.pendingAccepts.pop_front();
+    fn(TP_CREATE_ERROR(ListenerClosedError),
+       std::shared_ptr<transport::Connection>());
+  }
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+bool Context::Impl::isViable() const {
+  for (const auto& lane : lanes_) {
+    if (!lane->isViable()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  return impl_->canCommunicateWithRemote(remoteDomainDescriptor);
+}
+
+bool Context::Impl::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  // Let the transport of each lane judge its part of what follows our prefix.
+  if (remoteDomainDescriptor.compare(
+          0, kDomainDescriptorPrefix.size(), kDomainDescriptorPrefix) != 0) {
+    return false;
+  }
+  std::vector<std::string> remoteDescriptors = splitLanes(
+      remoteDomainDescriptor.substr(kDomainDescriptorPrefix.size()));
+  if (remoteDescriptors.size() != lanes_.size()) {
+    return false;
+  }
+  for (size_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
+    if (!lanes_[laneIdx]->canCommunicateWithRemote(
+            remoteDescriptors[laneIdx])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(7) << "Transport context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  for (size_t laneIdx = 0; laneIdx < lanes_.size(); laneIdx++) {
+    lanes_[laneIdx]->setId(id_ + ".lane" + std::to_string(laneIdx));
+  }
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(7) << "Transport context " << id_ << " is closing";
+
+    loop_.runInLoop([this]() { closeFromLoop_(); });
+
+    TP_VLOG(7) << "Transport context " << id_ << " done closing";
+  }
+}
+
+void Context::Impl::closeFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+
+  std::vector<uint64_t> listenerKeys;
+  for (const auto& iter : listeners_) {
+    listenerKeys.push_back(iter.first);
+  }
+  for (uint64_t listenerKey : listenerKeys) {
+    closeListenerFromLoop_(listenerKey);
+  }
+
+  std::vector<uint64_t> bondKeys;
+  for (const auto& iter : bonds_) {
+    bondKeys.push_back(iter.first);
+  }
+  for (uint64_t bondKey : bondKeys) {
+    failBond_(bondKey, TP_CREATE_ERROR(ConnectionClosedError));
+  }
+
+  for (const auto& lane : lanes_) {
+    lane->close();
+  }
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(7) << "Transport context " << id_ << " is joining";
+
+    // The transports of the lanes only return once they have fired all
+    // callbacks, all of which defer to the loop, which is then left to run
+    // them.
+    for (const auto& lane : lanes_) {
+      lane->join();
+    }
+    loop_.join();
+
+    TP_VLOG(7) << "Transport context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace bond
+} // namespace transport
+} // namespace tensorpipe
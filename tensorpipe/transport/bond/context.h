@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace bond {
+
+// A transport that bonds several other ones together (e.g., InfiniBand and
+// TCP, or two rails of different kinds), so that each of its connections is
+// carried by one connection of each of them, its lanes, whose bandwidth thus
+// adds up. Writes smaller than the threshold go over the first lane, which
+// should hence have the lowest latency, whereas larger ones go over the lane
+// with the fewest bytes in flight. Reads and writes still complete in order, as
+// the first lane also carries a small header for each write that tells the peer
+// on which lane to find its payload.
+//
+// The address of each lane is given as part of a single address, in which they
+// are separated by a '|' (e.g., "10.0.0.1|192.168.0.1"), or else one address
+// without separator is used for all the lanes. The peer must also use this
+// transport, with lanes of the same transports in the same order.
+class Context final : public transport::Context {
+ public:
+  static constexpr size_t kDefaultLargeWriteThreshold = 256 * 1024;
+
+  explicit Context(
+      std::vector<std::shared_ptr<transport::Context>> lanes,
+      size_t largeWriteThreshold = kDefaultLargeWriteThreshold);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the
+  // interface that layered::Connection and layered::Listener go through).
+  // However, its lifetime is tied to the one of this public object, since when
+  // the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace bond
+} // namespace transport
+} // namespace tensorpipe
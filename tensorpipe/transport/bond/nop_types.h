@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace bond {
+
+// The first thing the connecting side sends on each lane, which allows the
+// listening side to tell which lanes belong together. Bonded connections are
+// identified by a number chosen by the connecting side, which is unique within
+// its context, combined with a random one that tells contexts apart.
+struct Hello {
+  uint64_t nonce;
+  uint64_t bondId;
+  uint64_t laneIdx;
+  uint64_t numLanes;
+  NOP_STRUCTURE(Hello, nonce, bondId, laneIdx, numLanes);
+};
+
+// Sent over the first lane for every write, to tell the peer on which lane to
+// find its payload, which follows on that lane.
+struct MessageHeader {
+  uint64_t laneIdx;
+  uint64_t length;
+  NOP_STRUCTURE(MessageHeader, laneIdx, length);
+};
+
+} // namespace bond
+} // namespace transport
+} // namespace tensorpipe
@@ -8,6 +8,9 @@
 
 #include <tensorpipe/transport/connection.h>
 
+#include <memory>
+#include <tuple>
+
 #include <tensorpipe/common/defs.h>
 
 namespace tensorpipe {
@@ -27,24 +30,21 @@ void Connection::read(AbstractNopHolder& object, read_nop_callback_fn fn) {
 }
 
 void Connection::write(const AbstractNopHolder& object, write_callback_fn fn) {
-  const size_t len = object.getSize();
+  std::unique_ptr<uint8_t[]> serialized;
+  size_t len;
+  std::tie(serialized, len) = serializeNopObject(object);
 
   // Using a shared_ptr instead of unique_ptr because if the lambda captures a
   // unique_ptr then it becomes non-copyable, which prevents it from being
-  // converted to a function. In C++20 use std::make_shared<uint8_t[]>(len).
+  // converted to a function.
   //
   // Note: this is a std::shared_ptr<uint8_t[]> semantically. A shared_ptr
   // with array type is supported in C++17 and higher.
   //
   auto buf = std::shared_ptr<uint8_t>(
-      new uint8_t[len], std::default_delete<uint8_t[]>());
+      serialized.release(), std::default_delete<uint8_t[]>());
   auto ptr = buf.get();
 
-  NopWriter writer(ptr, len);
-  nop::Status<void> status = object.write(writer);
-  TP_THROW_ASSERT_IF(status.has_error())
-      << "Error writing nop object: " << status.GetErrorMessage();
-
   // Perform write and forward callback.
   write(
       ptr,
@@ -56,5 +56,93 @@ void Connection::write(const AbstractNopHolder& object, write_callback_fn fn) {
       });
 }
 
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(!buffers.empty());
+
+  // Only invoke the callback once the last write has completed, as writes
+  // complete in order, but report the first error, if any.
+  struct State {
+    Error error{Error::kSuccess};
+    write_callback_fn fn;
+  };
+  auto state = std::make_shared<State>();
+  state->fn = std::move(fn);
+
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const bool isLast = bufferIdx == buffers.size() - 1;
+    write(
+        buffers[bufferIdx].ptr,
+        buffers[bufferIdx].length,
+        [state, isLast](const Error& error) {
+          if (error && !state->error) {
+            state->error = error;
+          }
+          if (isLast) {
+            state->fn(state->error);
+          }
+        });
+  }
+}
+
+void Connection::writev(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  std::unique_ptr<uint8_t[]> serialized;
+  size_t len;
+  std::tie(serialized, len) = serializeNopObject(object);
+
+  // See the nop overload of write for why we use a shared_ptr.
+  auto buf = std::shared_ptr<uint8_t>(
+      serialized.release(), std::default_delete<uint8_t[]>());
+  auto ptr = buf.get();
+
+  buffers.insert(buffers.begin(), WriteBuffer{ptr, len});
+  writev(
+      std::move(buffers),
+      [buf{std::move(buf)}, fn{std::move(fn)}](const Error& error) mutable {
+        // The write has completed; destroy write buffer.
+        buf.reset();
+        fn(error);
+      });
+}
+
+void Connection::setWriteWeight(uint32_t /* unused */) {}
+
+void Connection::dumpState(dump_state_callback_fn fn) {
+  fn(std::string());
+}
+
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  TP_DCHECK(!buffers.empty());
+
+  // Only invoke the callback once the last read has completed, as reads
+  // complete in order, but report the first error, if any.
+  struct State {
+    Error error{Error::kSuccess};
+    readv_callback_fn fn;
+  };
+  auto state = std::make_shared<State>();
+  state->fn = std::move(fn);
+
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const bool isLast = bufferIdx == buffers.size() - 1;
+    read(
+        buffers[bufferIdx].ptr,
+        buffers[bufferIdx].length,
+        [state, isLast](
+            const Error& error, const void* /* unused */, size_t /* unused */) {
+          if (error && !state->error) {
+            state->error = error;
+          }
+          if (isLast) {
+            state->fn(state->error);
+          }
+        });
+  }
+}
+
 } // namespace transport
 } // namespace tensorpipe
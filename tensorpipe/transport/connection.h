@@ -8,10 +8,13 @@
 
 #pragma once
 
+#include <cstdint>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/function.h>
 #include <tensorpipe/common/nop.h>
 #include <tensorpipe/transport/context.h>
 
@@ -21,13 +24,13 @@ namespace transport {
 class Connection {
  public:
   using read_callback_fn =
-      std::function<void(const Error& error, const void* ptr, size_t len)>;
+      Function<void(const Error& error, const void* ptr, size_t len)>;
 
   virtual void read(read_callback_fn fn) = 0;
 
   virtual void read(void* ptr, size_t length, read_callback_fn fn) = 0;
 
-  using write_callback_fn = std::function<void(const Error& error)>;
+  using write_callback_fn = Function<void(const Error& error)>;
 
   virtual void write(const void* ptr, size_t length, write_callback_fn fn) = 0;
 
@@ -43,7 +46,7 @@ class Connection {
   // temporary buffer and instead instead read directly from its peer's
   // ring buffer. This saves an allocation and a memory copy.
   //
-  using read_nop_callback_fn = std::function<void(const Error& error)>;
+  using read_nop_callback_fn = Function<void(const Error& error)>;
 
   virtual void read(AbstractNopHolder& object, read_nop_callback_fn fn);
 
@@ -57,12 +60,100 @@ class Connection {
   //
   virtual void write(const AbstractNopHolder& object, write_callback_fn fn);
 
+  //
+  // Helper functions for vectored writes.
+  //
+
+  struct WriteBuffer {
+    const void* ptr;
+    size_t length;
+  };
+
+  // Write multiple buffers, in order, with the same effect as if each of them
+  // had been written with its own call to write (hence the peer must still read
+  // them one by one), but invoking a single callback once all of them have been
+  // written. There must be at least one buffer.
+  //
+  // This function may be overridden by a subclass.
+  //
+  // For example, the uv transport may hand all buffers to a single write system
+  // call, and the shm and ibv transports may notify their peer only once for
+  // all of them. This saves system calls and trips through the event loop.
+  //
+  virtual void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
+  // Serialize and write a nop object, followed by multiple buffers, with the
+  // same effect as writing each of them individually (see above).
+  //
+  // This function may be overridden by a subclass.
+  //
+  // By default the nop object is serialized into a temporary buffer which is
+  // then written together with the other ones, thus subclasses that can write
+  // nop objects more efficiently should also override this function.
+  //
+  virtual void writev(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
+  //
+  // Helper functions for vectored reads.
+  //
+
+  struct ReadBuffer {
+    void* ptr;
+    size_t length;
+  };
+
+  using readv_callback_fn = Function<void(const Error& error)>;
+
+  // Read multiple buffers, in order, each of which must have been written by
+  // the peer as a single buffer of the same length (either on its own or as
+  // part of a vectored write), invoking a single callback once all of them have
+  // been read. There must be at least one buffer.
+  //
+  // This function may be overridden by a subclass.
+  //
+  // For example, the shm and ibv transports may notify their peer only once
+  // about the space they freed up, after having served all the buffers, and all
+  // the transports can enqueue all the reads in a single trip through the event
+  // loop.
+  //
+  virtual void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Tell the connection what its identifier is.
   //
   // This is only supposed to be called from the high-level pipe or from
   // channels. It will only used for logging and debugging purposes.
   virtual void setId(std::string id) = 0;
 
+  // Tell the connection how large a share of the time that its context's loop
+  // spends writing it should get, relative to the other connections of the
+  // same context (which all start with a weight of one), so that connections
+  // with small messages keep a low latency next to those with bulk transfers.
+  //
+  // This function may be overridden by a subclass.
+  //
+  // By default it's ignored, as most transports hand the data to the kernel or
+  // to the NIC, which interleave the connections on their own. The shm
+  // transport, whose loop copies the data itself, honors it.
+  //
+  virtual void setWriteWeight(uint32_t weight);
+
+  using dump_state_callback_fn = Function<void(std::string)>;
+
+  // Describe, in a single line of text, what the connection is waiting on
+  // (e.g., its pending reads and writes, and how full its buffers are), for
+  // debugging hangs. The callback is called from the connection's loop, hence
+  // it may not come if the loop is stuck.
+  //
+  // This function may be overridden by a subclass.
+  //
+  // By default it reports nothing. The shm and ibv transports, whose rings can
+  // fill up and stall the peer, report their occupancy.
+  //
+  virtual void dumpState(dump_state_callback_fn fn);
+
   virtual void close() = 0;
 
   virtual ~Connection() = default;
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -47,6 +49,30 @@ class Context {
   //
   virtual const std::string& domainDescriptor() const = 0;
 
+  // Return whether this context can connect to a remote one advertising the
+  // given domain descriptor.
+  //
+  // By default the two descriptors must be identical, but transports whose
+  // descriptors carry extra information (e.g., where their resources live)
+  // can override this to ignore it.
+  //
+  virtual bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const {
+    return domainDescriptor() == remoteDomainDescriptor;
+  }
+
+  // Return the current values of the counters that the context keeps about
+  // its activity, by name, for monitoring purposes. Those whose name starts
+  // with "memory." give how many bytes of memory the context holds for a given
+  // purpose (e.g., the rings of its connections).
+  //
+  // They must be cheap to maintain, as they're always on, and they may be read
+  // from any thread. Contexts that don't keep any return none.
+  //
+  virtual std::map<std::string, uint64_t> getStats() const {
+    return {};
+  }
+
   // Tell the context what its identifier is.
   //
   // This is only supposed to be called from the high-level context or from
@@ -0,0 +1,1054 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/cxl/connection.h>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/ringbuffer_read_write_ops.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/cxl/constants.h>
+#include <tensorpipe/transport/cxl/context_impl.h>
+#include <tensorpipe/transport/cxl/error.h>
+#include <tensorpipe/transport/cxl/reactor.h>
+#include <tensorpipe/transport/cxl/region.h>
+#include <tensorpipe/transport/cxl/sockaddr.h>
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+namespace {
+
+// The data that each side of a connection needs to send to the other one in
+// order to write into its inbox and to update it. This data is transferred
+// over a TCP connection.
+struct Exchange {
+  // Where the inbox starts within the region, with its control words.
+  uint64_t inboxOffset;
+  uint64_t inboxSize;
+};
+
+// Flush the part of a ringbuffer's data between two offsets of its stream,
+// which may wrap around.
+void flushRing(
+    const Region& region,
+    const util::ringbuffer::RingBufferHeader& header,
+    const uint8_t* data,
+    uint64_t start,
+    uint64_t end) {
+  if (region.isCoherent() || start == end) {
+    return;
+  }
+  const uint64_t startIdx = start & header.kDataModMask;
+  const uint64_t length = end - start;
+  const uint64_t firstLength =
+      std::min<uint64_t>(length, header.kDataPoolByteSize - startIdx);
+  region.flush(data + startIdx, firstLength);
+  if (firstLength < length) {
+    region.flush(data, length - firstLength);
+  }
+}
+
+} // namespace
+
+class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
+                         public EpollLoop::EventHandler,
+                         public CxlEventHandler {
+  enum State {
+    INITIALIZING = 1,
+    SEND_INBOX,
+    RECV_INBOX,
+    ESTABLISHED,
+  };
+
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  Impl(
+      std::shared_ptr<Context::PrivateIface> context,
+      Socket socket,
+      std::string id);
+
+  // Create a connection that connects to the specified address.
+  Impl(
+      std::shared_ptr<Context::PrivateIface> context,
+      std::string addr,
+      std::string id);
+
+  // Initialize member fields that need `shared_from_this`.
+  void init();
+
+  // Queue a read operation.
+  void read(read_callback_fn fn);
+  void read(AbstractNopHolder& object, read_nop_callback_fn fn);
+  void read(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void write(const void* ptr, size_t length, write_callback_fn fn);
+  void write(const AbstractNopHolder& object, write_callback_fn fn);
+
+  // Perform multiple write operations at once, optionally starting with a nop
+  // object (if not null).
+  void writev(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
+  // Tell the connection what its identifier is.
+  void setId(std::string id);
+
+  // Shut down the connection and its resources.
+  void close();
+
+  // Implementation of EventHandler.
+  void handleEventsFromLoop(int events) override;
+
+  // Implementation of CxlEventHandler.
+  bool pollFromLoop() override;
+
+ private:
+  // Initialize member fields that need `shared_from_this`.
+  void initFromLoop();
+
+  // Queue a read operation.
+  void readFromLoop(read_callback_fn fn);
+  void readFromLoop(AbstractNopHolder& object, read_nop_callback_fn fn);
+  void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
+  void writeFromLoop(const AbstractNopHolder& object, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writevFromLoop(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
+  void setIdFromLoop_(std::string id);
+
+  // Shut down the connection and its resources.
+  void closeFromLoop();
+
+  // Handle events of type EPOLLIN on the TCP socket.
+  //
+  // The only data that is expected on that socket is the location of the other
+  // side's inbox.
+  void handleEventInFromLoop();
+
+  // Handle events of type EPOLLOUT on the TCP socket.
+  //
+  // Once the socket is writable we send the location of this side's inbox.
+  void handleEventOutFromLoop();
+
+  State state_{INITIALIZING};
+  Error error_{Error::kSuccess};
+  std::shared_ptr<Context::PrivateIface> context_;
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+  ClosingReceiver closingReceiver_;
+
+  // The identifier that the reactor assigned to the connection.
+  optional<uint32_t> connectionId_;
+
+  // Inbox. Its data is in the region, but its header is a private copy, whose
+  // head follows the one that the peer writes to the control words, and whose
+  // tail we write there in turn. Keeping the ringbuffer's state out of the
+  // region means it doesn't have to be flushed at each access.
+  // Initialize header during construction because it isn't assignable. This
+  // relies on the context having been initialized first.
+  util::ringbuffer::RingBufferHeader inboxHeader_{context_->getInboxSize()};
+  optional<uint64_t> inboxOffset_;
+  InboxControl* inboxControl_{nullptr};
+  util::ringbuffer::RingBuffer inboxRb_;
+  // The tail of the inbox that we last told the peer about.
+  uint64_t publishedInboxTail_{0};
+
+  // Outbox. Its data is the peer's inbox, into which we write directly, and
+  // its header is likewise a private copy of the peer's one.
+  // It mirrors the peer's inbox, hence it can only be created once we know the
+  // latter's size, and since the header isn't assignable we emplace it then.
+  optional<util::ringbuffer::RingBufferHeader> outboxHeader_;
+  InboxControl* outboxControl_{nullptr};
+  util::ringbuffer::RingBuffer outboxRb_;
+  // The head of the outbox that we last told the peer about.
+  uint64_t publishedOutboxHead_{0};
+
+  // Pending read operations.
+  std::deque<RingbufferReadOperation> readOperations_;
+
+  // Pending write operations.
+  std::deque<RingbufferWriteOperation> writeOperations_;
+
+  // A sequence number for the calls to read.
+  uint64_t nextBufferBeingRead_{0};
+
+  // A sequence number for the calls to write.
+  uint64_t nextBufferBeingWritten_{0};
+
+  // A sequence number for the invocations of the callbacks of read.
+  uint64_t nextReadCallbackToCall_{0};
+
+  // A sequence number for the invocations of the callbacks of write.
+  uint64_t nextWriteCallbackToCall_{0};
+
+  // An identifier for the connection, composed of the identifier for the
+  // context or listener, combined with an increasing sequence number. It will
+  // only be used for logging and debugging purposes.
+  std::string id_;
+
+  // Process pending read operations if in an operational state.
+  //
+  // This is triggered when the reactor finds that the peer wrote new data to
+  // the inbox. It is also called by this connection when it moves into an
+  // established state or when a new read operation is queued, in case data was
+  // already available before this connection was ready to consume it.
+  void processReadOperationsFromLoop();
+
+  // Process pending write operations if in an operational state.
+  //
+  // This is triggered when the reactor finds that the peer consumed some data,
+  // which frees up space in the outbox. This is important when some of this
+  // side's writes couldn't complete because the outbox was full. This method is
+  // also called by this connection when it moves into an established state, in
+  // case some writes were queued before the connection was ready to process
+  // them, or when a new write operation is queued.
+  void processWriteOperationsFromLoop();
+
+  void setError_(Error error);
+
+  // Deal with an error.
+  void handleError();
+
+  void cleanup_();
+};
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(socket),
+          std::move(id))) {
+  impl_->init();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(addr),
+          std::move(id))) {
+  impl_->init();
+}
+
+void Connection::Impl::init() {
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+}
+
+void Connection::close() {
+  impl_->close();
+}
+
+void Connection::Impl::close() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->closeFromLoop(); });
+}
+
+Connection::~Connection() {
+  close();
+}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : context_(std::move(context)),
+      socket_(std::move(socket)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+
+void Connection::Impl::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  closingReceiver_.activate(*this);
+
+  Error error;
+  // The connection either got a socket or an address, but not both.
+  TP_DCHECK(socket_.hasValue() ^ sockaddr_.has_value());
+  if (!socket_.hasValue()) {
+    std::tie(error, socket_) =
+        Socket::createForFamily(sockaddr_->addr()->sa_family);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.reuseAddr(true);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.connect(sockaddr_.value());
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+  }
+  // Ensure underlying control socket is non-blocking such that it
+  // works well with event driven I/O.
+  error = socket_.block(false);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+
+  // Take an inbox from our partition of the region. It may have been used by
+  // an earlier connection, hence we start its stream over.
+  inboxOffset_ = context_->getReactor().allocateInbox();
+  if (!inboxOffset_.has_value()) {
+    setError_(TP_CREATE_ERROR(NoFreeInboxError));
+    return;
+  }
+  Region& region = context_->getReactor().getRegion();
+  uint8_t* inboxPtr = region.ptr() + inboxOffset_.value();
+  inboxControl_ = reinterpret_cast<InboxControl*>(inboxPtr);
+  region.store(inboxControl_->head, 0);
+  region.store(inboxControl_->tail, 0);
+  inboxRb_ = util::ringbuffer::RingBuffer(
+      &inboxHeader_, inboxPtr + sizeof(InboxControl));
+
+  // Have the reactor poll the inbox and the outbox.
+  connectionId_ = context_->getReactor().registerConnection(shared_from_this());
+
+  // We're sending the inbox first, so wait for writability.
+  state_ = SEND_INBOX;
+  context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+}
+
+void Connection::read(read_callback_fn fn) {
+  impl_->read(std::move(fn));
+}
+
+void Connection::Impl::read(read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received an unsized read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling an unsized read callback (#" << sequenceNumber
+               << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling an unsized read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_, nullptr, 0);
+    return;
+  }
+
+  readOperations_.emplace_back(std::move(fn));
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::read(AbstractNopHolder& object, read_nop_callback_fn fn) {
+  impl_->read(object, std::move(fn));
+}
+
+void Connection::Impl::read(
+    AbstractNopHolder& object,
+    read_nop_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, &object, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(object, std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(
+    AbstractNopHolder& object,
+    read_nop_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a nop object read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a nop object read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a nop object read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  readOperations_.emplace_back(
+      &object,
+      [fn{std::move(fn)}](
+          const Error& error, const void* /* unused */, size_t /* unused */) {
+        fn(error);
+      });
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
+  impl_->read(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::read(void* ptr, size_t length, read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a sized read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a sized read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a sized read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_, ptr, length);
+    return;
+  }
+
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  // If the inbox already contains some data, we may be able to process these
+  // operations right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
+  impl_->write(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::Impl::writeFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a write callback (#"
+               << sequenceNumber << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::write(const AbstractNopHolder& object, write_callback_fn fn) {
+  impl_->write(object, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const AbstractNopHolder& object,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, &object, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(object, std::move(fn));
+      });
+}
+
+void Connection::Impl::writeFromLoop(
+    const AbstractNopHolder& object,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_
+             << " received a nop object write request (#" << sequenceNumber
+             << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a nop object write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a nop object write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(&object, std::move(fn));
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(nullptr, std::move(buffers), std::move(fn));
+}
+
+void Connection::writev(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(&object, std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         object,
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(object, std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::writevFromLoop(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(object != nullptr || !buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing "
+             << (object != nullptr ? "a nop object and " : "")
+             << buffers.size() << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  if (object != nullptr) {
+    if (buffers.empty()) {
+      writeOperations_.emplace_back(object, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(object, [](const Error& /* unused */) {});
+    }
+  }
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  // If the outbox has some free space, we may be able to process these
+  // operations right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Connection::Impl::setId(std::string id) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, id{std::move(id)}]() mutable {
+        impl->setIdFromLoop_(std::move(id));
+      });
+}
+
+void Connection::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Connection::Impl::handleEventsFromLoop(int events) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
+             << EpollLoop::formatEpollEvents(events) << ")";
+
+  // Handle only one of the events in the mask. Events on the control
+  // file descriptor are rare enough for the cost of having epoll call
+  // into this function multiple times to not matter. The benefit is
+  // that every handler can close and unregister the control file
+  // descriptor from the event loop, without worrying about the next
+  // handler trying to do so as well.
+  // In some cases the socket could be in a state where it's both in an error
+  // state and readable/writable. If we checked for EPOLLIN or EPOLLOUT first
+  // and then returned after handling them, we would keep doing so forever and
+  // never reach the error handling. So we should keep the error check first.
+  if (events & EPOLLERR) {
+    int error;
+    socklen_t errorlen = sizeof(error);
+    int rv = getsockopt(
+        socket_.fd(),
+        SOL_SOCKET,
+        SO_ERROR,
+        reinterpret_cast<void*>(&error),
+        &errorlen);
+    if (rv == -1) {
+      setError_(TP_CREATE_ERROR(SystemError, "getsockopt", rv));
+    } else {
+      setError_(TP_CREATE_ERROR(SystemError, "async error on socket", error));
+    }
+    return;
+  }
+  if (events & EPOLLIN) {
+    handleEventInFromLoop();
+    return;
+  }
+  if (events & EPOLLOUT) {
+    handleEventOutFromLoop();
+    return;
+  }
+  // Check for hangup last, as there could be cases where we get EPOLLHUP but
+  // there's still data to be read from the socket, so we want to deal with that
+  // before dealing with the hangup.
+  if (events & EPOLLHUP) {
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+}
+
+
+void Connection::Impl::handleEventInFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == RECV_INBOX) {
+    struct Exchange ex;
+
+    auto err = socket_.read(&ex, sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be read in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortReadError, sizeof(ex), err));
+      return;
+    }
+
+    Region& region = context_->getReactor().getRegion();
+    if (ex.inboxSize < util::ringbuffer::kCacheLineSize ||
+        !isPow2(ex.inboxSize) ||
+        ex.inboxOffset % util::ringbuffer::kCacheLineSize != 0 ||
+        ex.inboxOffset > region.getSize() ||
+        region.getSize() - ex.inboxOffset <
+            sizeof(InboxControl) + ex.inboxSize) {
+      setError_(TP_CREATE_ERROR(
+          BadInboxOffsetError, ex.inboxOffset, ex.inboxSize));
+      return;
+    }
+
+    // Create ringbuffer for outbox, over the peer's inbox.
+    uint8_t* peerInboxPtr = region.ptr() + ex.inboxOffset;
+    outboxControl_ = reinterpret_cast<InboxControl*>(peerInboxPtr);
+    outboxHeader_.emplace(ex.inboxSize);
+    outboxRb_ = util::ringbuffer::RingBuffer(
+        &outboxHeader_.value(), peerInboxPtr + sizeof(InboxControl));
+
+    // The connection is usable now.
+    state_ = ESTABLISHED;
+    processWriteOperationsFromLoop();
+    // Trigger read operations in case a pair of local read() and remote
+    // write() happened before connection is established. Otherwise read()
+    // callback would lose if it's the only read() request.
+    processReadOperationsFromLoop();
+    return;
+  }
+
+  if (state_ == ESTABLISHED) {
+    // We don't expect to read anything on this socket once the
+    // connection has been established. If we do, assume it's a
+    // zero-byte read indicating EOF.
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLIN event not handled in state " << state_;
+}
+
+void Connection::Impl::handleEventOutFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == SEND_INBOX) {
+    Exchange ex;
+    std::memset(&ex, 0, sizeof(ex));
+    ex.inboxOffset = inboxOffset_.value();
+    ex.inboxSize = inboxHeader_.kDataPoolByteSize;
+
+    auto err = socket_.write(reinterpret_cast<void*>(&ex), sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be written in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortWriteError, sizeof(ex), err));
+      return;
+    }
+
+    // Sent our inbox. Wait for inbox from peer.
+    state_ = RECV_INBOX;
+    context_->registerDescriptor(socket_.fd(), EPOLLIN, shared_from_this());
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLOUT event not handled in state " << state_;
+}
+
+void Connection::Impl::processReadOperationsFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  // Process all read read operations that we can immediately serve, only
+  // when connection is established.
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+  // Serve read operations
+  util::ringbuffer::Consumer inboxConsumer(inboxRb_);
+  while (!readOperations_.empty()) {
+    RingbufferReadOperation& readOperation = readOperations_.front();
+    readOperation.handleRead(inboxConsumer);
+    if (readOperation.completed()) {
+      readOperations_.pop_front();
+    } else {
+      break;
+    }
+  }
+  // The callbacks may have closed the connection.
+  if (error_) {
+    return;
+  }
+  const uint64_t tail = inboxHeader_.readTail();
+  if (tail != publishedInboxTail_) {
+    TP_VLOG(9) << "Connection " << id_
+               << " is telling its peer that it consumed its inbox up to "
+               << tail;
+    context_->getReactor().getRegion().store(inboxControl_->tail, tail);
+    publishedInboxTail_ = tail;
+  }
+}
+
+void Connection::Impl::processWriteOperationsFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+
+  util::ringbuffer::Producer outboxProducer(outboxRb_);
+  while (!writeOperations_.empty()) {
+    RingbufferWriteOperation& writeOperation = writeOperations_.front();
+    writeOperation.handleWrite(outboxProducer);
+    if (writeOperation.completed()) {
+      writeOperations_.pop_front();
+    } else {
+      context_->countRingFullStall();
+      break;
+    }
+  }
+  // The callbacks may have closed the connection.
+  if (error_) {
+    return;
+  }
+
+  // The data must reach the memory before the head that covers it does.
+  const uint64_t head = outboxHeader_->readHead();
+  if (head != publishedOutboxHead_) {
+    Region& region = context_->getReactor().getRegion();
+    flushRing(
+        region,
+        outboxHeader_.value(),
+        outboxRb_.getData(),
+        publishedOutboxHead_,
+        head);
+    TP_VLOG(9) << "Connection " << id_
+               << " is telling its peer that it wrote its inbox up to "
+               << head;
+    region.store(outboxControl_->head, head);
+    publishedOutboxHead_ = head;
+  }
+}
+
+bool Connection::Impl::pollFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ != ESTABLISHED || error_) {
+    return false;
+  }
+  Region& region = context_->getReactor().getRegion();
+  bool foundWork = false;
+
+  // We could start a transaction and use the proper methods for this, but as
+  // this method is the only producer for the inbox ringbuffer we can cut it
+  // short and directly increase the head. The new data may be in stale cache
+  // lines from when we last went through that part of the inbox, which we must
+  // evict before reading it.
+  const uint64_t head = region.load(inboxControl_->head);
+  const uint64_t currentHead = inboxHeader_.readHead();
+  if (head != currentHead) {
+    TP_VLOG(9) << "Connection " << id_
+               << " found that its inbox was written up to " << head;
+    flushRing(region, inboxHeader_, inboxRb_.getData(), currentHead, head);
+    inboxHeader_.incHead(head - currentHead);
+    processReadOperationsFromLoop();
+    foundWork = true;
+  }
+
+  // Likewise, this method is the only consumer for the outbox ringbuffer.
+  if (!error_) {
+    const uint64_t tail = region.load(outboxControl_->tail);
+    const uint64_t currentTail = outboxHeader_->readTail();
+    if (tail != currentTail) {
+      TP_VLOG(9) << "Connection " << id_
+                 << " found that its outbox was read up to " << tail;
+      outboxHeader_->incTail(tail - currentTail);
+      processWriteOperationsFromLoop();
+      foundWork = true;
+    }
+  }
+
+  return foundWork;
+}
+
+void Connection::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError();
+}
+
+void Connection::Impl::handleError() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
+
+  for (auto& readOperation : readOperations_) {
+    readOperation.handleError(error_);
+  }
+  readOperations_.clear();
+  for (auto& writeOperation : writeOperations_) {
+    writeOperation.handleError(error_);
+  }
+  writeOperations_.clear();
+
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->cleanup_(); });
+
+  if (socket_.hasValue()) {
+    if (state_ > INITIALIZING) {
+      context_->unregisterDescriptor(socket_.fd());
+    }
+    socket_.reset();
+  }
+}
+
+void Connection::Impl::cleanup_() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Connection " << id_ << " is cleaning up";
+
+  if (connectionId_.has_value()) {
+    context_->getReactor().unregisterConnection(connectionId_.value());
+    connectionId_.reset();
+  }
+
+  if (inboxOffset_.has_value()) {
+    context_->getReactor().releaseInbox(inboxOffset_.value());
+    inboxOffset_.reset();
+  }
+}
+
+void Connection::Impl::closeFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ConnectionClosedError));
+}
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
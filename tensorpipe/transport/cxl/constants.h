@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+// The words through which the two sides of a connection tell each other how
+// far they wrote into, and consumed from, an inbox. They live in the region,
+// right before the data of the inbox, each on its own cache line as they're
+// written by different hosts: the head by the peer, the tail by the owner.
+// They are offsets in the stream, which never wrap around.
+struct InboxControl {
+  alignas(util::ringbuffer::kCacheLineSize) std::atomic<uint64_t> head;
+  alignas(util::ringbuffer::kCacheLineSize) std::atomic<uint64_t> tail;
+};
+
+static_assert(
+    sizeof(InboxControl) == 2 * util::ringbuffer::kCacheLineSize,
+    "The inbox control words must each fill one cache line");
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+class Connection;
+class Listener;
+
+class Context final : public transport::Context {
+ public:
+  static constexpr size_t kDefaultInboxSize = 2 * 1024 * 1024;
+
+  // The connections work like those of the shm transport, with ringbuffers in
+  // memory that the two sides share, except that this memory is a region that
+  // several hosts map (e.g., a device-DAX of a CXL memory pool), given by its
+  // path and size, which must be the same on all hosts. Each connection takes
+  // an inbox of inboxSize bytes (rounded up to a power of two) from this
+  // context's partition of the region, which no other context may use, and
+  // writes directly into its peer's inbox. They are set up, and their peers'
+  // hangups are detected, through a TCP connection, on the addresses given to
+  // listen and connect, over which the two sides exchange the offsets of their
+  // inboxes.
+  //
+  // Unless the region is coherent, the connections write back the cache lines
+  // they wrote to, and evict those they're about to read, which is only
+  // supported on x86-64. As the hosts can't wake each other up, the reactor
+  // polls the inboxes, hence if the busy-polling policy ever lets it go to
+  // sleep it wakes up every sleepFor to poll them.
+  Context(
+      std::string regionPath,
+      size_t regionSize,
+      uint64_t partitionOffset,
+      uint64_t partitionSize,
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      size_t inboxSize = kDefaultInboxSize,
+      bool coherent = false);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow listener to see the private interface.
+  friend class Listener;
+  // Allow connection to see the private interface.
+  friend class Connection;
+};
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
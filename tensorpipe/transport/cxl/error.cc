@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/cxl/error.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <sstream>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+std::string NoFreeInboxError::what() const {
+  return "no free inbox left in the partition of the region";
+}
+
+std::string BadInboxOffsetError::what() const {
+  std::ostringstream ss;
+  ss << "the peer's inbox (at offset " << offset_ << ", of size " << size_
+     << ") isn't within the region";
+  return ss.str();
+}
+
+std::string GetaddrinfoError::what() const {
+  std::ostringstream ss;
+  ss << "getaddrinfo: " << gai_strerror(error_);
+  return ss.str();
+}
+
+std::string NoAddrFoundError::what() const {
+  return "no address found";
+}
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <tensorpipe/transport/error.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+class NoFreeInboxError final : public BaseError {
+ public:
+  NoFreeInboxError() {}
+
+  std::string what() const override;
+};
+
+class BadInboxOffsetError final : public BaseError {
+ public:
+  BadInboxOffsetError(uint64_t offset, uint64_t size)
+      : offset_(offset), size_(size) {}
+
+  std::string what() const override;
+
+ private:
+  uint64_t offset_;
+  uint64_t size_;
+};
+
+class GetaddrinfoError final : public BaseError {
+ public:
+  GetaddrinfoError(int error) : error_(error) {}
+
+  std::string what() const override;
+
+ private:
+  int error_;
+};
+
+class NoAddrFoundError final : public BaseError {
+ public:
+  NoAddrFoundError() {}
+
+  std::string what() const override;
+};
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
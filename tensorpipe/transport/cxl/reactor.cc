@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/cxl/reactor.h>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+#include <tensorpipe/transport/cxl/constants.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+Reactor::Reactor(
+    BusyPollingPolicy policy,
+    std::string regionPath,
+    size_t regionSize,
+    uint64_t partitionOffset,
+    uint64_t partitionSize,
+    size_t inboxSize,
+    bool coherent)
+    : BusyPollingLoop(std::move(policy)) {
+  TP_THROW_ASSERT_IF(partitionOffset % util::ringbuffer::kCacheLineSize != 0)
+      << "The partition must start on a cache line";
+  TP_THROW_ASSERT_IF(partitionOffset + partitionSize > regionSize)
+      << "The partition must be within the region";
+  // FIXME Instead of throwing away the error and setting a bool, we should have
+  // a way to set the reactor in an error state, and use that for viability.
+#if !defined(__x86_64__)
+  if (!coherent) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " can't flush the caches on this architecture";
+    return;
+  }
+#endif // __x86_64__
+  Error error;
+  std::tie(error, region_) = Region::create(regionPath, regionSize, coherent);
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_ << " couldn't map region "
+               << regionPath << ": " << error.what();
+    return;
+  }
+  viable_ = true;
+
+  const uint64_t slotSize = sizeof(InboxControl) + nextPow2(inboxSize);
+  for (uint64_t offset = partitionOffset;
+       offset + slotSize <= partitionOffset + partitionSize;
+       offset += slotSize) {
+    freeInboxes_.push_back(offset);
+  }
+
+  startThread("TP_CXL_reactor");
+}
+
+bool Reactor::isViable() const {
+  return viable_;
+}
+
+void Reactor::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  bool foundWork = false;
+  for (auto& iter : connections_) {
+    foundWork |= iter.second->pollFromLoop();
+  }
+  return foundWork;
+}
+
+bool Reactor::readyToClose() {
+  return connections_.empty();
+}
+
+optional<uint64_t> Reactor::allocateInbox() {
+  TP_DCHECK(inLoop());
+  if (freeInboxes_.empty()) {
+    return nullopt;
+  }
+  const uint64_t offset = freeInboxes_.front();
+  freeInboxes_.pop_front();
+  return offset;
+}
+
+void Reactor::releaseInbox(uint64_t offset) {
+  TP_DCHECK(inLoop());
+  freeInboxes_.push_back(offset);
+}
+
+uint32_t Reactor::registerConnection(
+    std::shared_ptr<CxlEventHandler> eventHandler) {
+  TP_DCHECK(inLoop());
+  const uint32_t connectionId = nextConnectionId_++;
+  connections_.emplace(connectionId, std::move(eventHandler));
+  return connectionId;
+}
+
+void Reactor::unregisterConnection(uint32_t connectionId) {
+  TP_DCHECK(inLoop());
+  deferToLoop([this, connectionId]() {
+    auto iter = connections_.find(connectionId);
+    TP_DCHECK(iter != connections_.end());
+    connections_.erase(iter);
+  });
+}
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/cxl/region.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+class CxlEventHandler {
+ public:
+  // Check whether the peer wrote into the inbox, or consumed from the outbox,
+  // since the last time, and act upon it. Return whether it did.
+  virtual bool pollFromLoop() = 0;
+
+  virtual ~CxlEventHandler() = default;
+};
+
+// Reactor loop.
+//
+// It maps the region, and hands out the inboxes of the connections from this
+// context's partition of it. As the hosts can't wake each other up through
+// shared memory, it polls all of the connections at each iteration.
+//
+class Reactor final : public BusyPollingLoop {
+ public:
+  Reactor(
+      BusyPollingPolicy policy,
+      std::string regionPath,
+      size_t regionSize,
+      uint64_t partitionOffset,
+      uint64_t partitionSize,
+      size_t inboxSize,
+      bool coherent);
+
+  Region& getRegion() {
+    return region_;
+  }
+
+  // Return the offset within the region of an unused inbox, which starts with
+  // its control words, or nothing if they're all taken.
+  optional<uint64_t> allocateInbox();
+
+  // The peer may still be writing to the inbox if it didn't notice the hangup
+  // yet, hence the inboxes are handed out again in the order they were
+  // released, so that it takes as long as possible for one to be reused.
+  void releaseInbox(uint64_t offset);
+
+  uint32_t registerConnection(std::shared_ptr<CxlEventHandler> eventHandler);
+
+  void unregisterConnection(uint32_t connectionId);
+
+  bool isViable() const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  Region region_;
+  bool viable_{false};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  std::deque<uint64_t> freeInboxes_;
+
+  // The registered connections. They're removed from a deferred function, so
+  // that they may unregister themselves while being polled.
+  std::unordered_map<uint32_t, std::shared_ptr<CxlEventHandler>> connections_;
+  uint32_t nextConnectionId_{0};
+};
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/cxl/region.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif // __x86_64__
+
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+std::tuple<Error, Region> Region::create(
+    const std::string& path,
+    size_t size,
+    bool coherent) {
+  Region region;
+  region.coherent_ = coherent;
+  int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "open", errno), Region());
+  }
+  region.fd_ = Fd(fd);
+  region.ptr_ = MmappedPtr::tryCreate(
+      size, PROT_READ | PROT_WRITE, MAP_SHARED, region.fd_.fd());
+  if (region.ptr_.ptr() == nullptr) {
+    return std::make_tuple(
+        TP_CREATE_ERROR(SystemError, "mmap", errno), Region());
+  }
+  return std::make_tuple(Error::kSuccess, std::move(region));
+}
+
+void Region::flush(const void* ptr, size_t length) const {
+  if (coherent_ || length == 0) {
+    return;
+  }
+#if defined(__x86_64__)
+  constexpr uintptr_t kLineMask = util::ringbuffer::kCacheLineSize - 1;
+  const uintptr_t end = reinterpret_cast<uintptr_t>(ptr) + length;
+  for (uintptr_t line = reinterpret_cast<uintptr_t>(ptr) & ~kLineMask;
+       line < end;
+       line += util::ringbuffer::kCacheLineSize) {
+    _mm_clflush(reinterpret_cast<const void*>(line));
+  }
+  // The flushes aren't ordered with the loads that follow them, nor with the
+  // stores to other lines, hence without this a load could still be served by
+  // a stale line, or the peer could see a new head before the data.
+  _mm_mfence();
+#else // __x86_64__
+  // The reactor refuses non-coherent regions on other architectures.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+#endif // __x86_64__
+}
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/memory.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace cxl {
+
+// A memory region that several hosts map, such as a device-DAX (/dev/daxX.Y)
+// of a CXL memory pool. It's mapped in full, and shared, as the inboxes of the
+// peers may be anywhere in it.
+//
+// The hosts may not keep their caches coherent for such memory, in which case
+// whoever writes to it must write the cache lines back to memory for the others
+// to see the data, and whoever reads from it must evict the lines first, so as
+// not to read stale copies. All of this is skipped for coherent regions.
+class Region {
+ public:
+  Region() = default;
+
+  // Open and map the file or device at the given path, which must be at least
+  // of the given size.
+  static std::tuple<Error, Region> create(
+      const std::string& path,
+      size_t size,
+      bool coherent);
+
+  uint8_t* ptr() {
+    return ptr_.ptr();
+  }
+
+  size_t getSize() const {
+    return ptr_.getLength();
+  }
+
+  bool isCoherent() const {
+    return coherent_;
+  }
+
+  // Write back the cache lines that cover the given range, and evict them, so
+  // that the other hosts see what this one wrote there, and so that this one
+  // sees what the others wrote there when it next reads it.
+  void flush(const void* ptr, size_t length) const;
+
+  // Read a word that another host writes to.
+  uint64_t load(const std::atomic<uint64_t>& word) const {
+    flush(&word, sizeof(word));
+    return word.load(std::memory_order_acquire);
+  }
+
+  // Write a word that another host reads. Any data written before it must have
+  // been flushed already.
+  void store(std::atomic<uint64_t>& word, uint64_t value) const {
+    word.store(value, std::memory_order_release);
+    flush(&word, sizeof(word));
+  }
+
+ private:
+  Fd fd_;
+  MmappedPtr ptr_;
+  bool coherent_{true};
+};
+
+} // namespace cxl
+} // namespace transport
+} // namespace tensorpipe
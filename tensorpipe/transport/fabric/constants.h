@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace {
+
+// The tagged messages through which the two sides of a connection tell each
+// other how far they wrote into, and consumed from, the inbox carry the kind of
+// update in the upper half of the tag, and the receiver's identifier for the
+// connection in the lower half. Their payload is the new head or tail (i.e., an
+// offset in the stream, which never wraps around), hence they may be delivered
+// in any order, as only the largest one matters.
+constexpr uint64_t kProducedTag = 1ULL << 32;
+constexpr uint64_t kConsumedTag = 2ULL << 32;
+constexpr uint64_t kTagKindMask = 0xffffffff00000000ULL;
+constexpr uint64_t kTagConnectionIdMask = 0x00000000ffffffffULL;
+
+// How many receive buffers (of one update each) the reactor keeps posted for
+// the above messages, shared by all connections. The provider buffers the
+// messages that arrive when none is posted (which is why the tail updates are
+// coalesced, see below), hence this only needs to cover the bursts.
+constexpr uint32_t kNumPendingRecvs = 1024;
+
+// The size of the completion queue, and how many completions the reactor reads
+// from it at each iteration, at most.
+constexpr size_t kCompletionQueueSize = 8 * 1024;
+constexpr size_t kNumCompletionsPerPoll = 64;
+
+// The receiver tells the sender how far it consumed its inbox only once the
+// data it consumed since the last update amounts to the size of its inbox
+// divided by this value. The updates only give space back to the sender, which
+// can keep writing in the rest of the inbox meanwhile, hence this never stalls
+// it, as long as the value is larger than one.
+constexpr uint64_t kInboxSizeToAckThresholdRatio = 4;
+
+} // namespace
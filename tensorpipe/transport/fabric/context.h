@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace fabric {
+
+class Connection;
+class Listener;
+
+class Context final : public transport::Context {
+ public:
+  static constexpr size_t kDefaultInboxSize = 2 * 1024 * 1024;
+
+  // The connections go through an endpoint of libfabric for reliable
+  // unconnected messaging (FI_EP_RDM), of the given provider (or of the first
+  // suitable one, if empty), and otherwise work like those of the ibv
+  // transport: each one registers an inbox of inboxSize bytes (rounded up to a
+  // power of two), into which its peer performs RDMA writes, and an outbox of
+  // the same size as its peer's inbox. They are set up, and their peers'
+  // hangups are detected, through a TCP connection, on the addresses given to
+  // listen and connect.
+  //
+  // Since the endpoint is shared by all connections, and the RDMA writes don't
+  // tell the target how much they wrote, the two sides tell each other how far
+  // they wrote into, and consumed from, the inbox with tagged messages. The
+  // provider must support tagged messages and RDMA writes that complete once
+  // the data reached the target's memory (e.g., EFA on the instances that can
+  // perform RDMA writes).
+  //
+  // The completion queue has no wait object, hence if the busy-polling policy
+  // ever lets the reactor go to sleep it wakes up every sleepFor to poll it.
+  explicit Context(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      size_t inboxSize = kDefaultInboxSize,
+      std::string provider = "efa");
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow listener to see the private interface.
+  friend class Listener;
+  // Allow connection to see the private interface.
+  friend class Connection;
+};
+
+} // namespace fabric
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/fabric/reactor.h>
+
+#include <array>
+#include <cstring>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/fabric/constants.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace fabric {
+
+Reactor::Reactor(BusyPollingPolicy policy, std::string provider)
+    : BusyPollingLoop(std::move(policy)) {
+  Error error;
+  std::tie(error, fabricLib_) = FabricLib::create();
+  // FIXME Instead of throwing away the error and setting a bool, we should have
+  // a way to set the reactor in an error state, and use that for viability.
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't open libfabric: " << error.what();
+    return;
+  }
+  foundFabricLib_ = true;
+  int rv;
+  std::tie(rv, info_) = getFabricInfo(fabricLib_, provider);
+  if (rv < 0) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't look up the providers: "
+               << fabricLib_.strerror(-rv);
+    return;
+  }
+  if (info_ == nullptr) {
+    TP_VLOG(9) << "Transport context " << id_ << " couldn't find a suitable "
+               << (provider.empty() ? "provider" : provider + " endpoint");
+    return;
+  }
+  if (info_->tx_attr->inject_size < sizeof(uint64_t)) {
+    TP_VLOG(9) << "Transport context " << id_ << " can't use provider "
+               << info_->fabric_attr->prov_name
+               << " as it can't inject the updates";
+    info_.reset();
+    return;
+  }
+  TP_VLOG(9) << "Transport context " << id_ << " is using domain "
+             << info_->domain_attr->name << " of provider "
+             << info_->fabric_attr->prov_name;
+  usesVirtualAddresses_ = (info_->domain_attr->mr_mode & FI_MR_VIRT_ADDR) != 0;
+  maxWriteSize_ = info_->ep_attr->max_msg_size;
+
+  fabric_ = createFabricFabric(fabricLib_, info_.get());
+  domain_ = createFabricDomain(fabric_, info_.get());
+  cq_ = createFabricCompletionQueue(domain_, kCompletionQueueSize);
+  av_ = createFabricAddressVector(domain_);
+  ep_ = createFabricEndpoint(domain_, info_.get(), av_, cq_);
+  addr_ = ::tensorpipe::getFabricAddress(ep_);
+
+  recvBufs_.resize(kNumPendingRecvs);
+  recvMr_ = createFabricMemoryRegion(
+      domain_,
+      recvBufs_.data(),
+      recvBufs_.size() * sizeof(uint64_t),
+      FI_RECV);
+  recvOperations_.resize(kNumPendingRecvs);
+  for (uint32_t recvIdx = 0; recvIdx < kNumPendingRecvs; recvIdx++) {
+    Operation& op = recvOperations_[recvIdx];
+    std::memset(&op, 0, sizeof(op));
+    op.isWrite = false;
+    op.recvIdx = recvIdx;
+    if (!tryPostRecv_(recvIdx)) {
+      pendingRecvs_.push_back(recvIdx);
+    }
+  }
+
+  startThread("TP_FABRIC_reactor");
+}
+
+bool Reactor::isViable() const {
+  return foundFabricLib_ && info_ != nullptr;
+}
+
+void Reactor::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  // The provider only makes progress (including on the operations it couldn't
+  // take earlier) when its completion queue is read.
+  bool postedOperations = postPendingOperations_();
+
+  std::array<struct fi_cq_tagged_entry, kNumCompletionsPerPoll> entries;
+  ssize_t rv = fi_cq_read(cq_.get(), entries.data(), entries.size());
+  if (rv == -FI_EAGAIN) {
+    return postedOperations;
+  }
+  if (rv == -FI_EAVAIL) {
+    struct fi_cq_err_entry errEntry;
+    std::memset(&errEntry, 0, sizeof(errEntry));
+    rv = fi_cq_readerr(cq_.get(), &errEntry, /*flags=*/0);
+    TP_THROW_SYSTEM_IF(rv < 0, -rv);
+    handleError_(errEntry);
+    return true;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, -rv);
+
+  TP_VLOG(9) << "Transport context " << id_ << " got " << rv
+             << " completions";
+  for (ssize_t entryIdx = 0; entryIdx < rv; entryIdx++) {
+    handleCompletion_(entries[entryIdx]);
+  }
+  return true;
+}
+
+void Reactor::handleCompletion_(const struct fi_cq_tagged_entry& entry) {
+  Operation& op = *reinterpret_cast<Operation*>(entry.op_context);
+  if (op.isWrite) {
+    auto iter = connections_.find(op.connectionId);
+    TP_THROW_ASSERT_IF(iter == connections_.end())
+        << "Got an RDMA write completion for unknown connection "
+        << op.connectionId;
+    // Keep the handler alive, in case it unregisters itself.
+    std::shared_ptr<FabricEventHandler> eventHandler = iter->second;
+    const uint64_t sequenceNumber = op.sequenceNumber;
+    freeWriteOperations_.emplace_back(&op);
+    eventHandler->onWriteCompleted(sequenceNumber);
+    return;
+  }
+
+  const uint32_t recvIdx = op.recvIdx;
+  const uint64_t offset = recvBufs_[recvIdx];
+  if (!tryPostRecv_(recvIdx)) {
+    pendingRecvs_.push_back(recvIdx);
+  }
+  const uint32_t connectionId = entry.tag & kTagConnectionIdMask;
+  auto iter = connections_.find(connectionId);
+  if (iter == connections_.end()) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " got an update for unknown connection " << connectionId;
+    return;
+  }
+  // Keep the handler alive, in case it unregisters itself.
+  std::shared_ptr<FabricEventHandler> eventHandler = iter->second;
+  switch (entry.tag & kTagKindMask) {
+    case kProducedTag:
+      eventHandler->onRemoteProducedData(offset);
+      break;
+    case kConsumedTag:
+      eventHandler->onRemoteConsumedData(offset);
+      break;
+    default:
+      TP_THROW_ASSERT() << "Got an update of unknown kind " << std::hex
+                        << entry.tag;
+  }
+}
+
+void Reactor::handleError_(const struct fi_cq_err_entry& entry) {
+  Operation& op = *reinterpret_cast<Operation*>(entry.op_context);
+  if (!op.isWrite) {
+    // The receives only fail when they're cancelled, as the endpoint closes, or
+    // when a message doesn't fit, which can only come from a faulty peer.
+    TP_VLOG(9) << "Transport context " << id_ << " got a failed receive ("
+               << fabricLib_.strerror(entry.err) << ")";
+    if (entry.err != FI_ECANCELED && !tryPostRecv_(op.recvIdx)) {
+      pendingRecvs_.push_back(op.recvIdx);
+    }
+    return;
+  }
+
+  auto iter = connections_.find(op.connectionId);
+  TP_THROW_ASSERT_IF(iter == connections_.end())
+      << "Got an RDMA write completion for unknown connection "
+      << op.connectionId;
+  // Keep the handler alive, in case it unregisters itself.
+  std::shared_ptr<FabricEventHandler> eventHandler = iter->second;
+  const uint64_t sequenceNumber = op.sequenceNumber;
+  freeWriteOperations_.emplace_back(&op);
+  std::array<char, 256> buf;
+  const char* providerError = fi_cq_strerror(
+      cq_.get(), entry.prov_errno, entry.err_data, buf.data(), buf.size());
+  eventHandler->onError(
+      std::string(fabricLib_.strerror(entry.err)) + " (" + providerError + ")");
+  eventHandler->onWriteCompleted(sequenceNumber);
+}
+
+bool Reactor::readyToClose() {
+  return connections_.empty();
+}
+
+fi_addr_t Reactor::insertPeer(const FabricAddress& addr) {
+  std::string key(reinterpret_cast<const char*>(addr.bytes), addr.length);
+  auto iter = peers_.find(key);
+  if (iter != peers_.end()) {
+    return iter->second;
+  }
+  fi_addr_t peer;
+  int rv = fi_av_insert(
+      av_.get(), addr.bytes, /*count=*/1, &peer, /*flags=*/0, nullptr);
+  TP_THROW_ASSERT_IF(rv != 1) << "Couldn't insert a peer in the address vector";
+  peers_.emplace(std::move(key), peer);
+  return peer;
+}
+
+uint32_t Reactor::registerConnection(
+    std::shared_ptr<FabricEventHandler> eventHandler) {
+  const uint32_t connectionId = nextConnectionId_++;
+  connections_.emplace(connectionId, std::move(eventHandler));
+  return connectionId;
+}
+
+void Reactor::unregisterConnection(uint32_t connectionId) {
+  auto iter = connections_.find(connectionId);
+  TP_DCHECK(iter != connections_.end());
+  connections_.erase(iter);
+}
+
+void Reactor::postWrite(
+    uint32_t connectionId,
+    uint64_t sequenceNumber,
+    const void* ptr,
+    size_t length,
+    void* desc,
+    fi_addr_t peer,
+    uint64_t remoteAddr,
+    uint64_t remoteKey) {
+  PendingWrite write;
+  if (freeWriteOperations_.empty()) {
+    write.operation = std::make_unique<Operation>();
+    std::memset(write.operation.get(), 0, sizeof(Operation));
+  } else {
+    write.operation = std::move(freeWriteOperations_.back());
+    freeWriteOperations_.pop_back();
+  }
+  write.operation->isWrite = true;
+  write.operation->connectionId = connectionId;
+  write.operation->sequenceNumber = sequenceNumber;
+  write.ptr = ptr;
+  write.length = length;
+  write.desc = desc;
+  write.peer = peer;
+  write.remoteAddr = remoteAddr;
+  write.remoteKey = remoteKey;
+  // Don't overtake the writes that are already waiting.
+  if (!pendingWrites_.empty() || !tryPostWrite_(write)) {
+    pendingWrites_.push_back(std::move(write));
+  }
+}
+
+void Reactor::postUpdate(
+    fi_addr_t peer,
+    uint32_t peerConnectionId,
+    uint64_t tagKind,
+    uint64_t offset) {
+  PendingUpdate update;
+  update.peer = peer;
+  update.tag = tagKind | peerConnectionId;
+  update.offset = offset;
+  if (!pendingUpdates_.empty() || !tryPostUpdate_(update)) {
+    pendingUpdates_.push_back(update);
+  }
+}
+
+bool Reactor::tryPostWrite_(PendingWrite& write) {
+  ssize_t rv = fi_write(
+      ep_.get(),
+      write.ptr,
+      write.length,
+      write.desc,
+      write.peer,
+      write.remoteAddr,
+      write.remoteKey,
+      &write.operation->fiContext);
+  if (rv == -FI_EAGAIN) {
+    return false;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, -rv);
+  // The completion will hand it back.
+  write.operation.release();
+  return true;
+}
+
+bool Reactor::tryPostUpdate_(PendingUpdate& update) {
+  ssize_t rv = fi_tinject(
+      ep_.get(),
+      &update.offset,
+      sizeof(update.offset),
+      update.peer,
+      update.tag);
+  if (rv == -FI_EAGAIN) {
+    return false;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, -rv);
+  return true;
+}
+
+bool Reactor::tryPostRecv_(uint32_t recvIdx) {
+  ssize_t rv = fi_trecv(
+      ep_.get(),
+      &recvBufs_[recvIdx],
+      sizeof(uint64_t),
+      fi_mr_desc(recvMr_.get()),
+      FI_ADDR_UNSPEC,
+      /*tag=*/0,
+      /*ignore=*/~0ULL,
+      &recvOperations_[recvIdx].fiContext);
+  if (rv == -FI_EAGAIN) {
+    return false;
+  }
+  TP_THROW_SYSTEM_IF(rv < 0, -rv);
+  return true;
+}
+
+bool Reactor::postPendingOperations_() {
+  bool postedOperations = false;
+  while (!pendingRecvs_.empty() && tryPostRecv_(pendingRecvs_.front())) {
+    pendingRecvs_.pop_front();
+    postedOperations = true;
+  }
+  while (!pendingWrites_.empty() && tryPostWrite_(pendingWrites_.front())) {
+    pendingWrites_.pop_front();
+    postedOperations = true;
+  }
+  while (!pendingUpdates_.empty() && tryPostUpdate_(pendingUpdates_.front())) {
+    pendingUpdates_.pop_front();
+    postedOperations = true;
+  }
+  return postedOperations;
+}
+
+} // namespace fabric
+} // namespace transport
+} // namespace tensorpipe
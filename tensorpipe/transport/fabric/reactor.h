@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/fabric.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace fabric {
+
+class FabricEventHandler {
+ public:
+  // The peer wrote into the inbox up to this offset of its stream, and all the
+  // data before it landed.
+  virtual void onRemoteProducedData(uint64_t head) = 0;
+
+  // The peer consumed its inbox up to this offset of this side's stream.
+  virtual void onRemoteConsumedData(uint64_t tail) = 0;
+
+  // Called once for each RDMA write, with the sequence number it was posted
+  // with, even if it failed.
+  virtual void onWriteCompleted(uint64_t sequenceNumber) = 0;
+
+  // Called for each failed RDMA write, before the above callback.
+  virtual void onError(std::string error) = 0;
+
+  virtual ~FabricEventHandler() = default;
+};
+
+// Reactor loop.
+//
+// It owns the endpoint that all the connections of the context share, along
+// with its completion queue and its address vector, into which it inserts each
+// peer once. It keeps a pool of receive buffers posted for the tagged messages
+// through which the peers update the heads and tails of the inboxes, and hands
+// these updates to the connections by the identifier it assigned to them.
+//
+// The operations that the provider can't take right away are queued, and
+// posted again at the next iterations, in order.
+//
+class Reactor final : public BusyPollingLoop {
+ public:
+  Reactor(BusyPollingPolicy policy, std::string provider);
+
+  FabricDomain& getFabricDomain() {
+    return domain_;
+  }
+
+  // Where the peers have to send their messages to.
+  const FabricAddress& getFabricAddress() const {
+    return addr_;
+  }
+
+  // Whether the RDMA writes target virtual addresses, rather than offsets
+  // within the memory regions.
+  bool usesVirtualAddresses() const {
+    return usesVirtualAddresses_;
+  }
+
+  // The largest RDMA write the provider supports.
+  size_t getMaxWriteSize() const {
+    return maxWriteSize_;
+  }
+
+  fi_addr_t insertPeer(const FabricAddress& addr);
+
+  // Return the identifier that the peer must put in the messages it sends to
+  // this connection.
+  uint32_t registerConnection(std::shared_ptr<FabricEventHandler> eventHandler);
+
+  void unregisterConnection(uint32_t connectionId);
+
+  void postWrite(
+      uint32_t connectionId,
+      uint64_t sequenceNumber,
+      const void* ptr,
+      size_t length,
+      void* desc,
+      fi_addr_t peer,
+      uint64_t remoteAddr,
+      uint64_t remoteKey);
+
+  // Tell the peer's connection about the new head or tail. The message is
+  // injected, hence it needs no buffer and generates no completion.
+  void postUpdate(
+      fi_addr_t peer,
+      uint32_t peerConnectionId,
+      uint64_t tagKind,
+      uint64_t offset);
+
+  bool isViable() const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  // The objects are closed in the reverse order, hence the endpoint goes first,
+  // which cancels the receive requests before their buffers are deregistered.
+  bool foundFabricLib_{false};
+  FabricLib fabricLib_;
+  FabricInfo info_;
+  FabricFabric fabric_;
+  FabricDomain domain_;
+  FabricCompletionQueue cq_;
+  FabricAddressVector av_;
+  std::vector<uint64_t> recvBufs_;
+  FabricMemoryRegion recvMr_;
+  FabricEndpoint ep_;
+  FabricAddress addr_;
+  bool usesVirtualAddresses_{false};
+  size_t maxWriteSize_{0};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // The peers, by their address, as there's no point in inserting them more
+  // than once. They stay in the address vector until the reactor goes away.
+  std::unordered_map<std::string, fi_addr_t> peers_;
+
+  // The registered connections. Their identifiers are never reused, so that
+  // the updates that were in flight when a connection went away can't be
+  // mistaken for ones of a later connection.
+  std::unordered_map<uint32_t, std::shared_ptr<FabricEventHandler>>
+      connections_;
+  uint32_t nextConnectionId_{0};
+
+  // The context given to each operation, from which the reactor finds out what
+  // completed. The provider may use the fi_context2 as scratch space until
+  // then, hence it must come first.
+  struct Operation {
+    struct fi_context2 fiContext;
+    bool isWrite;
+    // For RDMA writes.
+    uint32_t connectionId;
+    uint64_t sequenceNumber;
+    // For receives.
+    uint32_t recvIdx;
+  };
+
+  std::vector<Operation> recvOperations_;
+  // Owned by the pending writes and by those that were posted, and recycled.
+  std::vector<std::unique_ptr<Operation>> freeWriteOperations_;
+
+  struct PendingWrite {
+    std::unique_ptr<Operation> operation;
+    const void* ptr;
+    size_t length;
+    void* desc;
+    fi_addr_t peer;
+    uint64_t remoteAddr;
+    uint64_t remoteKey;
+  };
+
+  struct PendingUpdate {
+    fi_addr_t peer;
+    uint64_t tag;
+    uint64_t offset;
+  };
+
+  std::deque<PendingWrite> pendingWrites_;
+  std::deque<PendingUpdate> pendingUpdates_;
+  std::deque<uint32_t> pendingRecvs_;
+
+  // Return whether the provider took the operation.
+  bool tryPostWrite_(PendingWrite& write);
+  bool tryPostUpdate_(PendingUpdate& update);
+  bool tryPostRecv_(uint32_t recvIdx);
+
+  // Return whether any operation was posted.
+  bool postPendingOperations_();
+
+  void handleCompletion_(const struct fi_cq_tagged_entry& entry);
+  void handleError_(const struct fi_cq_err_entry& entry);
+};
+
+} // namespace fabric
+} // namespace transport
+} // namespace tensorpipe
@@ -10,7 +10,12 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <deque>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <tensorpipe/common/callback.h>
@@ -18,10 +23,10 @@
 #include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/error_macros.h>
 #include <tensorpipe/common/ibv.h>
-#include <tensorpipe/common/memory.h>
 #include <tensorpipe/common/ringbuffer_read_write_ops.h>
 #include <tensorpipe/common/socket.h>
 #include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/ibv/constants.h>
 #include <tensorpipe/transport/ibv/context_impl.h>
 #include <tensorpipe/transport/ibv/error.h>
 #include <tensorpipe/transport/ibv/reactor.h>
@@ -35,24 +40,134 @@ namespace ibv {
 
 namespace {
 
-constexpr auto kBufferSize = 2 * 1024 * 1024;
-
-// When the connection gets closed, to avoid leaks, it needs to "reclaim" all
-// the work requests that it had posted, by waiting for their completion. They
-// may however complete with error, which makes it harder to identify and
-// distinguish them from failing incoming requests because, in principle, we
-// cannot access the opcode field of a failed work completion. Therefore, we
-// assign a special ID to those types of requests, to match them later on.
-constexpr uint64_t kWriteRequestId = 1;
-constexpr uint64_t kAckRequestId = 2;
-
 // The data that each queue pair endpoint needs to send to the other endpoint in
 // order to set up the queue pair itself. This data is transferred over a TCP
 // connection.
 struct Exchange {
-  IbvSetupInformation setupInfo;
+  // Only the first numQueuePairs are set.
+  IbvSetupInformation setupInfos[kMaxNumQueuePairs];
+  uint32_t numQueuePairs;
   uint64_t memoryRegionPtr;
   uint32_t memoryRegionKey;
+  uint64_t memoryRegionSize;
+  // Where the peer writes the tail of its inbox.
+  uint64_t creditWordPtr;
+  uint32_t creditWordKey;
+  // Whether this side may send buffers with the rendezvous protocol.
+  bool usesRendezvous;
+};
+
+// The words through which the two sides of a connection tell each other how
+// far they consumed their inboxes: each side writes the tail of its inbox from
+// the second one into the first one of its peer, with an RDMA write that the
+// peer only reads when it needs space in its outbox.
+struct CreditWords {
+  std::atomic<uint64_t> peerInboxTail{0};
+  uint64_t inboxTail{0};
+};
+
+// Where the peer can read a buffer from, in the rendezvous protocol. It follows
+// the marker in the ringbuffer, in place of the payload.
+struct RendezvousDescriptor {
+  uint64_t ptr;
+  uint64_t length;
+  uint32_t key;
+};
+
+// The size of the stripes in which to split a transfer over the queue pairs.
+uint64_t getStripeSize(uint64_t length, size_t numQueuePairs) {
+  return std::max<uint64_t>(
+      (length + numQueuePairs - 1) / numQueuePairs, kMinStripeSize);
+}
+
+// A read whose payload either comes through the inbox, or is fetched from the
+// peer's memory, which we only know once its framing reaches the inbox.
+struct ReadOperation {
+  using read_callback_fn = RingbufferReadOperation::read_callback_fn;
+
+  ReadOperation(void* ptr, size_t length, read_callback_fn fn)
+      : ptr(ptr), length(length), ptrProvided(true), fn(std::move(fn)) {}
+
+  explicit ReadOperation(read_callback_fn fn) : fn(std::move(fn)) {}
+
+  ReadOperation(AbstractNopHolder* nopObject, read_callback_fn fn)
+      : nopObject(nopObject), fn(std::move(fn)) {}
+
+  void startThroughInbox() {
+    if (nopObject != nullptr) {
+      ringOp.emplace(nopObject, std::move(fn));
+    } else if (ptrProvided) {
+      ringOp.emplace(ptr, length, std::move(fn));
+    } else {
+      ringOp.emplace(std::move(fn));
+    }
+  }
+
+  void handleError(const Error& error) {
+    if (ringOp.has_value()) {
+      ringOp->handleError(error);
+    } else {
+      fn(error, nullptr, 0);
+    }
+  }
+
+  void* ptr{nullptr};
+  size_t length{0};
+  bool ptrProvided{false};
+  AbstractNopHolder* nopObject{nullptr};
+  read_callback_fn fn;
+  optional<RingbufferReadOperation> ringOp;
+  // Only set while the payload is being fetched with RDMA reads, in which case
+  // buf holds it if the user didn't provide a buffer.
+  IbvRegistrationCache::Handle mr;
+  std::unique_ptr<uint8_t[]> buf;
+};
+
+// A write whose payload either goes through the outbox, or is left for the
+// peer to read, which we decide once it reaches the front of the queue.
+struct WriteOperation {
+  using write_callback_fn = RingbufferWriteOperation::write_callback_fn;
+
+  WriteOperation(const void* ptr, size_t length, write_callback_fn fn)
+      : ptr(ptr), length(length), fn(std::move(fn)) {}
+
+  WriteOperation(const AbstractNopHolder* nopObject, write_callback_fn fn)
+      : nopObject(nopObject), fn(std::move(fn)) {}
+
+  void startThroughOutbox(write_callback_fn wrappedFn) {
+    if (nopObject != nullptr) {
+      ringOp.emplace(nopObject, std::move(wrappedFn));
+    } else {
+      ringOp.emplace(ptr, length, std::move(wrappedFn));
+    }
+  }
+
+  void handleError(const Error& error) {
+    if (ringOp.has_value()) {
+      ringOp->handleError(error);
+    } else {
+      fn(error);
+    }
+  }
+
+  const void* ptr{nullptr};
+  size_t length{0};
+  const AbstractNopHolder* nopObject{nullptr};
+  write_callback_fn fn;
+  optional<RingbufferWriteOperation> ringOp;
+  // Kept if the descriptor didn't fit in the outbox at the first attempt.
+  IbvRegistrationCache::Handle mr;
+};
+
+// A buffer that the peer was told to read, which must stay registered (and
+// whose callback must wait) until it says it's done.
+struct RendezvousWrite {
+  WriteOperation::write_callback_fn fn;
+  IbvRegistrationCache::Handle mr;
+  // The callbacks of the writes that completed through the outbox after this
+  // one was sent, which can't be called before its own.
+  std::deque<std::pair<WriteOperation::write_callback_fn, Error>>
+      followingCallbacks;
 };
 
 } // namespace
@@ -88,13 +203,25 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   void read(AbstractNopHolder& object, read_nop_callback_fn fn);
   void read(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn);
   void write(const AbstractNopHolder& object, write_callback_fn fn);
 
+  // Perform multiple write operations at once, optionally starting with a nop
+  // object (if not null).
+  void writev(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
   // Tell the connection what its identifier is.
   void setId(std::string id);
 
+  void dumpState(dump_state_callback_fn fn);
+
   // Shut down the connection and its resources.
   void close();
 
@@ -102,9 +229,12 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   void handleEventsFromLoop(int events) override;
 
   // Implementation of IbvEventHandler.
-  void onRemoteProducedData(uint32_t length) override;
-  void onRemoteConsumedData(uint32_t length) override;
+  void onRemoteProducedData(uint32_t length, uint32_t sequenceNumber)
+      override;
+  void onRemoteDoneReading() override;
+  void onPolledForSpace() override;
   void onWriteCompleted() override;
+  void onReadCompleted() override;
   void onAckCompleted() override;
   void onError(IbvLib::wc_status status, uint64_t wr_id) override;
 
@@ -117,12 +247,23 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   void readFromLoop(AbstractNopHolder& object, read_nop_callback_fn fn);
   void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
   void writeFromLoop(const AbstractNopHolder& object, write_callback_fn fn);
 
+  // Perform multiple write operations at once.
+  void writevFromLoop(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
   void setIdFromLoop_(std::string id);
 
+  std::string dumpStateFromLoop_();
+
   // Shut down the connection and its resources.
   void closeFromLoop();
 
@@ -145,30 +286,59 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   optional<Sockaddr> sockaddr_;
   ClosingReceiver closingReceiver_;
 
-  IbvQueuePair qp_;
-  IbvSetupInformation ibvSelfInfo_;
+  // The RDMA writes into the peer's inbox and the RDMA reads are spread over
+  // all the queue pairs, whereas the first one alone carries the updates of
+  // the inbox's tail and the acks, which thus arrive in order.
+  std::vector<IbvQueuePair> qps_;
+  std::vector<IbvSetupInformation> ibvSelfInfos_;
+  // The queue pair of the next stripe of an RDMA write or read.
+  size_t nextQpIdx_{0};
+  // RDMA writes of up to this size are inlined in the work request.
+  uint32_t maxInlineDataSize_{0};
+
+  // The buffers of at least this size are read by the peer, if it's non-zero.
+  const size_t rendezvousThreshold_{context_->getRendezvousThreshold()};
+  // Whether the peer may tell us to read its buffers.
+  bool peerUsesRendezvous_{false};
 
   // Inbox.
-  // Initialize header during construction because it isn't assignable.
-  util::ringbuffer::RingBufferHeader inboxHeader_{kBufferSize};
-  // Use mmapped memory so it's page-aligned (and, one day, to use huge pages).
-  MmappedPtr inboxBuf_;
+  // Initialize header during construction because it isn't assignable. This
+  // relies on the context having been initialized first.
+  util::ringbuffer::RingBufferHeader inboxHeader_{context_->getInboxSize()};
+  // Registered memory from the reactor's pool, given back once cleaning up.
+  optional<RingPool::Ring> inboxBuf_;
   util::ringbuffer::RingBuffer inboxRb_;
-  IbvMemoryRegion inboxMr_;
 
   // Outbox.
-  // Initialize header during construction because it isn't assignable.
-  util::ringbuffer::RingBufferHeader outboxHeader_{kBufferSize};
-  // Use mmapped memory so it's page-aligned (and, one day, to use huge pages).
-  MmappedPtr outboxBuf_;
+  // It mirrors the peer's inbox, hence it can only be created once we know the
+  // latter's size, and since the header isn't assignable we emplace it then.
+  optional<util::ringbuffer::RingBufferHeader> outboxHeader_;
+  // Registered memory from the reactor's pool, given back once cleaning up.
+  optional<RingPool::Ring> outboxBuf_;
   util::ringbuffer::RingBuffer outboxRb_;
-  IbvMemoryRegion outboxMr_;
 
   // Peer inbox key, pointer and head.
   uint32_t peerInboxKey_{0};
   uint64_t peerInboxPtr_{0};
   uint64_t peerInboxHead_{0};
 
+  // Our credit words, registered on their own, and the location of the peer's.
+  std::unique_ptr<CreditWords> creditWords_;
+  IbvMemoryRegion creditWordsMr_;
+  uint32_t peerCreditWordKey_{0};
+  uint64_t peerCreditWordPtr_{0};
+  // The tail of the peer's inbox that we last applied to our outbox.
+  uint64_t peerInboxTail_{0};
+
+  // The RDMA writes into the peer's inbox carry an increasing sequence number,
+  // so that it can apply those that arrive out of order (over different queue
+  // pairs) once the ones before them have arrived too. These are the number
+  // of our next write, the one of the peer's next write that we expect, and
+  // the lengths of those that came too early.
+  uint32_t nextOutboxSequenceNumber_{0};
+  uint32_t nextInboxSequenceNumber_{0};
+  std::unordered_map<uint32_t, uint32_t> earlyInboxWrites_;
+
   // The ringbuffer API is synchronous (it expects data to be consumed/produced
   // immediately "inline" when the buffer is accessed) but InfiniBand is
   // asynchronous, thus we need to abuse the ringbuffer API a bit. When new data
@@ -179,20 +349,30 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   // track of how much data to skip with this field.
   uint32_t numBytesInFlight_{0};
 
-  // The connection performs two types of send requests: writing to the remote
-  // inbox, or acknowledging a write into its own inbox. These send operations
+  // The data we consumed from the inbox but haven't told the peer about yet.
+  uint32_t numBytesToAck_{0};
+
+  // The connection performs two types of send requests: RDMA writes, to the
+  // remote inbox or to the peer's credit word, or acks, which tell the peer it
+  // is done reading one of its buffers. These send operations
   // could be delayed and stalled by the reactor as only a limited number of
   // work requests can be outstanding at the same time globally. Thus we keep
   // count of how many we have pending to make sure they have all completed or
   // flushed when we close, and that none is stuck in the pipeline.
   uint32_t numWritesInFlight_{0};
   uint32_t numAcksInFlight_{0};
+  // The RDMA reads of the rendezvous protocol. Those of one buffer must all
+  // complete before those of the next one are posted.
+  uint32_t numReadsInFlight_{0};
 
   // Pending read operations.
-  std::deque<RingbufferReadOperation> readOperations_;
+  std::deque<ReadOperation> readOperations_;
 
   // Pending write operations.
-  std::deque<RingbufferWriteOperation> writeOperations_;
+  std::deque<WriteOperation> writeOperations_;
+
+  // The buffers that the peer is reading, from the oldest one.
+  std::deque<RendezvousWrite> rendezvousWrites_;
 
   // A sequence number for the calls to read.
   uint64_t nextBufferBeingRead_{0};
@@ -233,11 +413,50 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   // a new write operation is queued.
   void processWriteOperationsFromLoop();
 
+  // If the inbox starts with the marker of the rendezvous protocol, consume it
+  // along with the descriptor that follows it and return how many bytes that
+  // is. Return zero if it holds a regular payload instead, and -ENODATA if it
+  // doesn't hold enough data to tell.
+  ssize_t readRendezvousDescriptor_(
+      util::ringbuffer::Consumer& inboxConsumer,
+      RendezvousDescriptor& descriptor);
+
+  // Register the buffer of the write operation and tell the peer where to read
+  // it from. Return how many bytes this took in the outbox, or -ENOSPC if it's
+  // full.
+  ssize_t writeRendezvousDescriptor_(
+      util::ringbuffer::Producer& outboxProducer,
+      WriteOperation& writeOperation);
+
+  // Return the next queue pair over which to stripe an RDMA write or read.
+  IbvQueuePair& nextQp_();
+
+  // Post the RDMA reads that fetch the payload of the read operation.
+  void startRendezvousRead_(
+      ReadOperation& readOperation,
+      const RendezvousDescriptor& descriptor);
+
+  // Call the callback of the oldest buffer the peer was reading, and of the
+  // writes that completed after it.
+  void completeRendezvousWrite_(const Error& error);
+
+  // Write the tail of our inbox into the peer's credit word.
+  void postCreditUpdate_();
+
+  // Tell the peer we're done reading its oldest buffer.
+  void postRendezvousDone_();
+
+  // Apply what the peer wrote into our credit word to the outbox. Return
+  // whether it freed up any space.
+  bool applyCreditUpdate_();
+
   void setError_(Error error);
 
   // Deal with an error.
   void handleError();
 
+  void failReadOperations_();
+
   void tryCleanup_();
   void cleanup_();
 };
@@ -336,51 +555,58 @@ void Connection::Impl::initFromLoop() {
   }
 
   // Create ringbuffer for inbox.
-  inboxBuf_ = MmappedPtr(
-      kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
-  inboxRb_ = util::ringbuffer::RingBuffer(&inboxHeader_, inboxBuf_.ptr());
-  inboxMr_ = createIbvMemoryRegion(
+  inboxBuf_ = context_->getReactor().getInboxPool().allocate(
+      inboxHeader_.kDataPoolByteSize);
+  inboxRb_ = util::ringbuffer::RingBuffer(&inboxHeader_, inboxBuf_->ptr);
+
+  creditWords_ = std::make_unique<CreditWords>();
+  creditWordsMr_ = createIbvMemoryRegion(
       context_->getReactor().getIbvLib(),
       context_->getReactor().getIbvPd(),
-      inboxBuf_.ptr(),
-      kBufferSize,
+      creditWords_.get(),
+      sizeof(CreditWords),
       IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE);
 
-  // Create ringbuffer for outbox.
-  outboxBuf_ = MmappedPtr(
-      kBufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
-  outboxRb_ = util::ringbuffer::RingBuffer(&outboxHeader_, outboxBuf_.ptr());
-  outboxMr_ = createIbvMemoryRegion(
-      context_->getReactor().getIbvLib(),
-      context_->getReactor().getIbvPd(),
-      outboxBuf_.ptr(),
-      kBufferSize,
-      0);
+  // The peer only reads from our memory if we use the rendezvous protocol.
+  int accessFlags = IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE;
+  if (rendezvousThreshold_ > 0) {
+    accessFlags |= IbvLib::ACCESS_REMOTE_READ;
+  }
 
-  // Create and init queue pair.
-  {
+  // Create and init queue pairs.
+  maxInlineDataSize_ = kMaxInlineDataSize;
+  for (size_t qpIdx = 0; qpIdx < context_->getNumQueuePairs(); qpIdx++) {
     IbvLib::qp_init_attr initAttr;
     std::memset(&initAttr, 0, sizeof(initAttr));
     initAttr.qp_type = IbvLib::QPT_RC;
     initAttr.send_cq = context_->getReactor().getIbvCq().get();
     initAttr.recv_cq = context_->getReactor().getIbvCq().get();
-    initAttr.cap.max_send_wr = kNumPendingWriteReqs;
+    const QueueLimits& queueLimits = context_->getReactor().getQueueLimits();
+    initAttr.cap.max_send_wr =
+        queueLimits.numPendingWriteReqs + queueLimits.numPendingAckReqs;
     initAttr.cap.max_send_sge = 1;
+    initAttr.cap.max_inline_data = kMaxInlineDataSize;
     initAttr.srq = context_->getReactor().getIbvSrq().get();
-    initAttr.sq_sig_all = 1;
-    qp_ = createIbvQueuePair(
+    // The reactor decides which send requests to signal.
+    initAttr.sq_sig_all = 0;
+    IbvQueuePair qp = createIbvQueuePair(
         context_->getReactor().getIbvLib(),
         context_->getReactor().getIbvPd(),
         initAttr);
-  }
-  transitionIbvQueuePairToInit(
-      context_->getReactor().getIbvLib(),
-      qp_,
-      context_->getReactor().getIbvAddress());
+    // The device reports back how much it actually allows.
+    maxInlineDataSize_ =
+        std::min(maxInlineDataSize_, initAttr.cap.max_inline_data);
+    transitionIbvQueuePairToInit(
+        context_->getReactor().getIbvLib(),
+        qp,
+        context_->getReactor().getIbvAddress(),
+        accessFlags);
 
-  // Register methods to be called when our peer writes to our inbox and reads
-  // from our outbox.
-  context_->getReactor().registerQp(qp_->qp_num, shared_from_this());
+    // Register methods to be called when our peer writes to our inbox and
+    // reads from our outbox.
+    context_->getReactor().registerQp(qp->qp_num, shared_from_this());
+    qps_.push_back(std::move(qp));
+  }
 
   // We're sending address first, so wait for writability.
   state_ = SEND_ADDR;
@@ -417,7 +643,8 @@ void Connection::Impl::readFromLoop(read_callback_fn fn) {
                << ")";
   };
 
-  if (error_) {
+  // Earlier operations may be waiting for their RDMA reads to be flushed.
+  if (error_ && readOperations_.empty()) {
     fn(error_, nullptr, 0);
     return;
   }
@@ -462,7 +689,8 @@ void Connection::Impl::readFromLoop(
                << sequenceNumber << ")";
   };
 
-  if (error_) {
+  // Earlier operations may be waiting for their RDMA reads to be flushed.
+  if (error_ && readOperations_.empty()) {
     fn(error_);
     return;
   }
@@ -511,7 +739,8 @@ void Connection::Impl::readFromLoop(
                << ")";
   };
 
-  if (error_) {
+  // Earlier operations may be waiting for their RDMA reads to be flushed.
+  if (error_ && readOperations_.empty()) {
     fn(error_, ptr, length);
     return;
   }
@@ -523,6 +752,75 @@ void Connection::Impl::readFromLoop(
   processReadOperationsFromLoop();
 }
 
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  // Earlier operations may be waiting for their RDMA reads to be flushed.
+  if (error_ && readOperations_.empty()) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  // If the inbox already contains some data, we may be able to process these
+  // operations right away.
+  processReadOperationsFromLoop();
+}
+
 void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
   impl_->write(ptr, length, std::move(fn));
 }
@@ -614,6 +912,84 @@ void Connection::Impl::writeFromLoop(
   processWriteOperationsFromLoop();
 }
 
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(nullptr, std::move(buffers), std::move(fn));
+}
+
+void Connection::writev(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(&object, std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         object,
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(object, std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::writevFromLoop(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(object != nullptr || !buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing "
+             << (object != nullptr ? "a nop object and " : "")
+             << buffers.size() << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  if (object != nullptr) {
+    if (buffers.empty()) {
+      writeOperations_.emplace_back(object, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(object, [](const Error& /* unused */) {});
+    }
+  }
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  // If the outbox has some free space, we may be able to process these
+  // operations right away.
+  processWriteOperationsFromLoop();
+}
+
 void Connection::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -631,6 +1007,39 @@ void Connection::Impl::setIdFromLoop_(std::string id) {
   id_ = std::move(id);
 }
 
+void Connection::dumpState(dump_state_callback_fn fn) {
+  impl_->dumpState(std::move(fn));
+}
+
+void Connection::Impl::dumpState(dump_state_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        fn(impl->dumpStateFromLoop_());
+      });
+}
+
+std::string Connection::Impl::dumpStateFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  std::ostringstream oss;
+  oss << "pending_reads=" << readOperations_.size()
+      << " pending_writes=" << writeOperations_.size();
+  if (error_) {
+    oss << " failed";
+  } else if (state_ != ESTABLISHED) {
+    oss << " connecting";
+  } else {
+    oss << " inbox=" << inboxHeader_.getUsedSize() << "/"
+        << inboxHeader_.kDataPoolByteSize
+        << " outbox=" << outboxHeader_->getUsedSize() << "/"
+        << outboxHeader_->kDataPoolByteSize
+        << " bytes_in_flight=" << numBytesInFlight_
+        << " bytes_to_ack=" << numBytesToAck_
+        << " writes_in_flight=" << numWritesInFlight_
+        << " reads_in_flight=" << numReadsInFlight_;
+  }
+  return oss.str();
+}
+
 void Connection::Impl::handleEventsFromLoop(int events) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
@@ -692,16 +1101,39 @@ void Connection::Impl::handleEventInFromLoop() {
       return;
     }
 
-    transitionIbvQueuePairToReadyToReceive(
-        context_->getReactor().getIbvLib(),
-        qp_,
-        context_->getReactor().getIbvAddress(),
-        ex.setupInfo);
-    transitionIbvQueuePairToReadyToSend(
-        context_->getReactor().getIbvLib(), qp_, ibvSelfInfo_);
+    // Both sides keep as many queue pairs as the one that has fewer. The other
+    // ones were never used, hence they can go right away.
+    size_t numQueuePairs = std::min<size_t>(ex.numQueuePairs, qps_.size());
+    TP_THROW_ASSERT_IF(numQueuePairs == 0) << "The peer has no queue pairs";
+    while (qps_.size() > numQueuePairs) {
+      context_->getReactor().unregisterQp(qps_.back()->qp_num);
+      qps_.pop_back();
+    }
+    for (size_t qpIdx = 0; qpIdx < numQueuePairs; qpIdx++) {
+      transitionIbvQueuePairToReadyToReceive(
+          context_->getReactor().getIbvLib(),
+          qps_[qpIdx],
+          context_->getReactor().getIbvAddress(),
+          ex.setupInfos[qpIdx]);
+      transitionIbvQueuePairToReadyToSend(
+          context_->getReactor().getIbvLib(),
+          qps_[qpIdx],
+          ibvSelfInfos_[qpIdx]);
+    }
 
     peerInboxKey_ = ex.memoryRegionKey;
     peerInboxPtr_ = ex.memoryRegionPtr;
+    peerCreditWordKey_ = ex.creditWordKey;
+    peerCreditWordPtr_ = ex.creditWordPtr;
+    peerUsesRendezvous_ = ex.usesRendezvous;
+
+    // Create ringbuffer for outbox, matching the size of the peer's inbox.
+    outboxHeader_.emplace(ex.memoryRegionSize);
+    TP_DCHECK_EQ(outboxHeader_->kDataPoolByteSize, ex.memoryRegionSize);
+    outboxBuf_ = context_->getReactor().getOutboxPool().allocate(
+        outboxHeader_->kDataPoolByteSize);
+    outboxRb_ =
+        util::ringbuffer::RingBuffer(&outboxHeader_.value(), outboxBuf_->ptr);
 
     // The connection is usable now.
     state_ = ESTABLISHED;
@@ -728,11 +1160,19 @@ void Connection::Impl::handleEventOutFromLoop() {
   TP_DCHECK(context_->inLoop());
   if (state_ == SEND_ADDR) {
     Exchange ex;
-    ibvSelfInfo_ =
-        makeIbvSetupInformation(context_->getReactor().getIbvAddress(), qp_);
-    ex.setupInfo = ibvSelfInfo_;
-    ex.memoryRegionPtr = reinterpret_cast<uint64_t>(inboxBuf_.ptr());
-    ex.memoryRegionKey = inboxMr_->rkey;
+    std::memset(&ex, 0, sizeof(ex));
+    for (size_t qpIdx = 0; qpIdx < qps_.size(); qpIdx++) {
+      ibvSelfInfos_.push_back(makeIbvSetupInformation(
+          context_->getReactor().getIbvAddress(), qps_[qpIdx]));
+      ex.setupInfos[qpIdx] = ibvSelfInfos_[qpIdx];
+    }
+    ex.numQueuePairs = qps_.size();
+    ex.memoryRegionPtr = reinterpret_cast<uint64_t>(inboxBuf_->ptr);
+    ex.memoryRegionKey = inboxBuf_->rkey;
+    ex.memoryRegionSize = inboxHeader_.kDataPoolByteSize;
+    ex.creditWordPtr = reinterpret_cast<uint64_t>(&creditWords_->peerInboxTail);
+    ex.creditWordKey = creditWordsMr_->rkey;
+    ex.usesRendezvous = rendezvousThreshold_ > 0;
 
     auto err = socket_.write(reinterpret_cast<void*>(&ex), sizeof(ex));
     // Crossing our fingers that the exchange information is small enough that
@@ -756,33 +1196,193 @@ void Connection::Impl::processReadOperationsFromLoop() {
 
   // Process all read read operations that we can immediately serve, only
   // when connection is established.
-  if (state_ != ESTABLISHED) {
+  if (state_ != ESTABLISHED || error_) {
     return;
   }
   // Serve read operations
   util::ringbuffer::Consumer inboxConsumer(inboxRb_);
+  ssize_t len = 0;
   while (!readOperations_.empty()) {
-    RingbufferReadOperation& readOperation = readOperations_.front();
-    ssize_t len = readOperation.handleRead(inboxConsumer);
-    if (len > 0) {
-      IbvLib::send_wr wr;
-      std::memset(&wr, 0, sizeof(wr));
-      wr.wr_id = kAckRequestId;
-      wr.opcode = IbvLib::WR_SEND_WITH_IMM;
-      wr.imm_data = len;
-
-      TP_VLOG(9) << "Connection " << id_
-                 << " is posting a send request (acknowledging " << wr.imm_data
-                 << " bytes) on QP " << qp_->qp_num;
-      context_->getReactor().postAck(qp_, wr);
-      numAcksInFlight_++;
+    ReadOperation& readOperation = readOperations_.front();
+    if (readOperation.mr != nullptr) {
+      // Its payload is being fetched from the peer.
+      break;
+    }
+    if (!readOperation.ringOp.has_value()) {
+      if (peerUsesRendezvous_) {
+        RendezvousDescriptor descriptor;
+        ssize_t ret = readRendezvousDescriptor_(inboxConsumer, descriptor);
+        if (ret == -ENODATA) {
+          break;
+        }
+        if (ret > 0) {
+          len += ret;
+          startRendezvousRead_(readOperation, descriptor);
+          break;
+        }
+      }
+      readOperation.startThroughInbox();
+    }
+    ssize_t ret = readOperation.ringOp->handleRead(inboxConsumer);
+    if (ret > 0) {
+      len += ret;
     }
-    if (readOperation.completed()) {
+    if (readOperation.ringOp->completed()) {
       readOperations_.pop_front();
     } else {
       break;
     }
   }
+  // Tell the peer about all the bytes we consumed with a single RDMA write,
+  // once there are enough of them.
+  numBytesToAck_ += len;
+  if (numBytesToAck_ >=
+      inboxHeader_.kDataPoolByteSize / kInboxSizeToAckThresholdRatio) {
+    postCreditUpdate_();
+  }
+}
+
+ssize_t Connection::Impl::readRendezvousDescriptor_(
+    util::ringbuffer::Consumer& inboxConsumer,
+    RendezvousDescriptor& descriptor) {
+  ssize_t ret = inboxConsumer.startTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+  // The marker and the descriptor may be split over two RDMA writes, in which
+  // case we leave them in the inbox until the second one arrives.
+  uint32_t length;
+  ret = inboxConsumer.readInTx</*allowPartial=*/false>(&length, sizeof(length));
+  if (ret >= 0 && length == kRendezvousMarker) {
+    ret = inboxConsumer.readInTx</*allowPartial=*/false>(
+        &descriptor, sizeof(descriptor));
+    if (ret >= 0) {
+      ret = inboxConsumer.commitTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+      return sizeof(length) + sizeof(descriptor);
+    }
+  }
+  TP_THROW_SYSTEM_IF(ret < 0 && ret != -ENODATA, -ret);
+  ssize_t result = ret < 0 ? ret : 0;
+
+  ret = inboxConsumer.cancelTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  return result;
+}
+
+void Connection::Impl::startRendezvousRead_(
+    ReadOperation& readOperation,
+    const RendezvousDescriptor& descriptor) {
+  TP_THROW_ASSERT_IF(readOperation.nopObject != nullptr)
+      << "Nop objects are never sent with the rendezvous protocol";
+  if (readOperation.ptrProvided) {
+    TP_DCHECK_EQ(descriptor.length, readOperation.length);
+  } else {
+    readOperation.buf = std::make_unique<uint8_t[]>(descriptor.length);
+    readOperation.ptr = readOperation.buf.get();
+    readOperation.length = descriptor.length;
+  }
+  readOperation.mr =
+      context_->getReactor().getDestinationRegistrations().registerRegion(
+          readOperation.ptr, readOperation.length);
+
+  uint64_t stripeSize = std::min<uint64_t>(
+      getStripeSize(readOperation.length, qps_.size()),
+      kMaxRendezvousReadSize);
+  uint64_t numStripes = (readOperation.length + stripeSize - 1) / stripeSize;
+  for (uint64_t stripeIdx = 0; stripeIdx < numStripes; stripeIdx++) {
+    uint64_t offset = stripeIdx * stripeSize;
+    IbvLib::sge list;
+    list.addr = reinterpret_cast<uint64_t>(readOperation.ptr) + offset;
+    list.length =
+        std::min<uint64_t>(readOperation.length - offset, stripeSize);
+    list.lkey = readOperation.mr->lkey;
+
+    IbvLib::send_wr wr;
+    std::memset(&wr, 0, sizeof(wr));
+    wr.sg_list = &list;
+    wr.num_sge = 1;
+    wr.opcode = IbvLib::WR_RDMA_READ;
+    // We need to find out right away when the last one completes, hence
+    // when the last one of each queue pair does.
+    if (stripeIdx + qps_.size() >= numStripes) {
+      wr.send_flags |= IbvLib::SEND_SIGNALED;
+    }
+    wr.wr.rdma.remote_addr = descriptor.ptr + offset;
+    wr.wr.rdma.rkey = descriptor.key;
+
+    IbvQueuePair& qp = nextQp_();
+    TP_VLOG(9) << "Connection " << id_
+               << " is posting a RDMA read request (transmitting "
+               << list.length << " bytes) on QP " << qp->qp_num;
+    context_->getReactor().postRead(qp, wr);
+    numReadsInFlight_++;
+  }
+}
+
+IbvQueuePair& Connection::Impl::nextQp_() {
+  IbvQueuePair& qp = qps_[nextQpIdx_];
+  nextQpIdx_ = (nextQpIdx_ + 1) % qps_.size();
+  return qp;
+}
+
+void Connection::Impl::postCreditUpdate_() {
+  // The device may read the source of the write after we update it again, if
+  // the write is queued up, which is fine as the tail only moves forward.
+  creditWords_->inboxTail = inboxHeader_.readTail();
+  numBytesToAck_ = 0;
+
+  IbvLib::sge list;
+  list.addr = reinterpret_cast<uint64_t>(&creditWords_->inboxTail);
+  list.length = sizeof(creditWords_->inboxTail);
+  list.lkey = creditWordsMr_->lkey;
+
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.sg_list = &list;
+  wr.num_sge = 1;
+  wr.opcode = IbvLib::WR_RDMA_WRITE;
+  if (list.length <= maxInlineDataSize_) {
+    wr.send_flags |= IbvLib::SEND_INLINE;
+  }
+  wr.wr.rdma.remote_addr = peerCreditWordPtr_;
+  wr.wr.rdma.rkey = peerCreditWordKey_;
+
+  TP_VLOG(9) << "Connection " << id_
+             << " is posting a RDMA write request (updating the tail to "
+             << creditWords_->inboxTail << ") on QP " << qps_[0]->qp_num;
+  context_->getReactor().postWrite(qps_[0], wr);
+  numWritesInFlight_++;
+}
+
+void Connection::Impl::postRendezvousDone_() {
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.opcode = IbvLib::WR_SEND_WITH_IMM;
+  wr.imm_data = kRendezvousDoneFlag;
+
+  TP_VLOG(9) << "Connection " << id_
+             << " is posting a send request (done reading) on QP "
+             << qps_[0]->qp_num;
+  context_->getReactor().postAck(qps_[0], wr);
+  numAcksInFlight_++;
+}
+
+bool Connection::Impl::applyCreditUpdate_() {
+  // We could start a transaction and use the proper methods for this, but as
+  // this method is the only consumer for the outbox ringbuffer we can cut it
+  // short and directly increase the tail.
+  uint64_t peerInboxTail =
+      creditWords_->peerInboxTail.load(std::memory_order_acquire);
+  if (peerInboxTail == peerInboxTail_) {
+    return false;
+  }
+  uint64_t length = peerInboxTail - peerInboxTail_;
+  TP_VLOG(9) << "Connection " << id_ << " found out that " << length
+             << " bytes were read from its outbox";
+  peerInboxTail_ = peerInboxTail;
+  outboxHeader_->incTail(length);
+  numBytesInFlight_ -= length;
+  return true;
 }
 
 void Connection::Impl::processWriteOperationsFromLoop() {
@@ -792,121 +1392,279 @@ void Connection::Impl::processWriteOperationsFromLoop() {
     return;
   }
 
+  applyCreditUpdate_();
+
+  // Write as many operations as possible to the outbox, and only then post the
+  // RDMA writes for all of them at once, which results in fewer (and larger)
+  // work requests than doing so for each operation.
+  ssize_t len = 0;
   util::ringbuffer::Producer outboxProducer(outboxRb_);
   while (!writeOperations_.empty()) {
-    RingbufferWriteOperation& writeOperation = writeOperations_.front();
-    ssize_t len = writeOperation.handleWrite(outboxProducer);
-    if (len > 0) {
-      ssize_t ret;
-      util::ringbuffer::Consumer outboxConsumer(outboxRb_);
-
-      // In order to get the pointers and lengths to the data that was just
-      // written to the ringbuffer we pretend to start a consumer transaction so
-      // we can use accessContiguous, which we'll however later abort. The data
-      // will only be really consumed once we receive the ACK from the remote.
-
-      ret = outboxConsumer.startTx();
-      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+    WriteOperation& writeOperation = writeOperations_.front();
+    if (!writeOperation.ringOp.has_value()) {
+      if (rendezvousThreshold_ > 0 && writeOperation.nopObject == nullptr &&
+          writeOperation.length >= rendezvousThreshold_) {
+        ssize_t ret =
+            writeRendezvousDescriptor_(outboxProducer, writeOperation);
+        if (ret < 0) {
+          context_->countRingFullStall();
+          break;
+        }
+        len += ret;
+        writeOperations_.pop_front();
+        continue;
+      }
+      WriteOperation::write_callback_fn fn = std::move(writeOperation.fn);
+      if (rendezvousThreshold_ > 0) {
+        // This write may complete while the peer is still reading an earlier
+        // buffer, in which case its callback has to wait.
+        fn = [this, fn{std::move(fn)}](const Error& error) mutable {
+          if (rendezvousWrites_.empty()) {
+            fn(error);
+          } else {
+            rendezvousWrites_.back().followingCallbacks.emplace_back(
+                std::move(fn), error);
+          }
+        };
+      }
+      writeOperation.startThroughOutbox(std::move(fn));
+    }
+    len += writeOperation.ringOp->handleWrite(outboxProducer);
+    if (writeOperation.ringOp->completed()) {
+      writeOperations_.pop_front();
+    } else {
+      context_->countRingFullStall();
+      break;
+    }
+  }
+  // The peer won't tell us when it frees up space, we have to look for it.
+  if (!writeOperations_.empty()) {
+    context_->getReactor().waitForSpace(qps_[0]->qp_num);
+  }
+
+  if (len > 0) {
+    ssize_t ret;
+    util::ringbuffer::Consumer outboxConsumer(outboxRb_);
 
-      ssize_t numBuffers;
-      std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+    // In order to get the pointers and lengths to the data that was just
+    // written to the ringbuffer we pretend to start a consumer transaction so
+    // we can use accessContiguous, which we'll however later abort. The data
+    // will only be really consumed once we receive the ACK from the remote.
 
-      // Skip over the data that was already sent but is still in flight.
-      std::tie(numBuffers, buffers) =
-          outboxConsumer.accessContiguousInTx</*allowPartial=*/false>(
-              numBytesInFlight_);
+    ret = outboxConsumer.startTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-      std::tie(numBuffers, buffers) =
-          outboxConsumer.accessContiguousInTx</*allowPartial=*/false>(len);
-      TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
+    ssize_t numBuffers;
+    std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
 
-      for (int bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
+    // Skip over the data that was already sent but is still in flight.
+    std::tie(numBuffers, buffers) =
+        outboxConsumer.accessContiguousInTx</*allowPartial=*/false>(
+            numBytesInFlight_);
+
+    std::tie(numBuffers, buffers) =
+        outboxConsumer.accessContiguousInTx</*allowPartial=*/false>(len);
+    TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
+
+    for (int bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
+      // Spread the buffer over the queue pairs.
+      const util::ringbuffer::Consumer::Buffer& buffer = buffers[bufferIdx];
+      uint64_t stripeSize = getStripeSize(buffer.len, qps_.size());
+      for (uint64_t offset = 0; offset < buffer.len; offset += stripeSize) {
         IbvLib::sge list;
-        list.addr = reinterpret_cast<uint64_t>(buffers[bufferIdx].ptr);
-        list.length = buffers[bufferIdx].len;
-        list.lkey = outboxMr_->lkey;
+        list.addr = reinterpret_cast<uint64_t>(buffer.ptr) + offset;
+        list.length = std::min<uint64_t>(buffer.len - offset, stripeSize);
+        list.lkey = outboxBuf_->lkey;
 
-        uint64_t peerInboxOffset = peerInboxHead_ & (kBufferSize - 1);
-        peerInboxHead_ += buffers[bufferIdx].len;
+        uint64_t peerInboxOffset =
+            peerInboxHead_ & outboxHeader_->kDataModMask;
+        peerInboxHead_ += list.length;
 
         IbvLib::send_wr wr;
         std::memset(&wr, 0, sizeof(wr));
-        wr.wr_id = kWriteRequestId;
         wr.sg_list = &list;
         wr.num_sge = 1;
         wr.opcode = IbvLib::WR_RDMA_WRITE_WITH_IMM;
-        wr.imm_data = buffers[bufferIdx].len;
+        if (list.length <= maxInlineDataSize_) {
+          wr.send_flags |= IbvLib::SEND_INLINE;
+        }
+        // The peer learns the length of the data from the work completion, and
+        // where it goes in the sequence from the immediate data.
+        wr.imm_data = nextOutboxSequenceNumber_++;
         wr.wr.rdma.remote_addr = peerInboxPtr_ + peerInboxOffset;
         wr.wr.rdma.rkey = peerInboxKey_;
 
+        IbvQueuePair& qp = nextQp_();
         TP_VLOG(9) << "Connection " << id_
                    << " is posting a RDMA write request (transmitting "
-                   << wr.imm_data << " bytes) on QP " << qp_->qp_num;
-        context_->getReactor().postWrite(qp_, wr);
+                   << list.length << " bytes) on QP " << qp->qp_num;
+        context_->getReactor().postWrite(qp, wr);
         numWritesInFlight_++;
       }
+    }
 
-      ret = outboxConsumer.cancelTx();
-      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+    ret = outboxConsumer.cancelTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-      numBytesInFlight_ += len;
-    }
-    if (writeOperation.completed()) {
-      writeOperations_.pop_front();
-    } else {
-      break;
-    }
+    numBytesInFlight_ += len;
   }
 }
 
-void Connection::Impl::onRemoteProducedData(uint32_t length) {
+ssize_t Connection::Impl::writeRendezvousDescriptor_(
+    util::ringbuffer::Producer& outboxProducer,
+    WriteOperation& writeOperation) {
+  // The peer only reads from the buffer, which may thus be read-only.
+  if (writeOperation.mr == nullptr) {
+    writeOperation.mr =
+        context_->getReactor().getSourceRegistrations().registerRegion(
+            const_cast<void*>(writeOperation.ptr), writeOperation.length);
+  }
+
+  uint32_t marker = kRendezvousMarker;
+  RendezvousDescriptor descriptor;
+  descriptor.ptr = reinterpret_cast<uint64_t>(writeOperation.ptr);
+  descriptor.length = writeOperation.length;
+  descriptor.key = writeOperation.mr->rkey;
+
+  ssize_t ret = outboxProducer.startTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  ret = outboxProducer.writeInTx</*allowPartial=*/false>(
+      &marker, sizeof(marker));
+  if (ret >= 0) {
+    ret = outboxProducer.writeInTx</*allowPartial=*/false>(
+        &descriptor, sizeof(descriptor));
+  }
+  if (ret < 0) {
+    TP_THROW_SYSTEM_IF(ret != -ENOSPC, -ret);
+    ret = outboxProducer.cancelTx();
+    TP_THROW_SYSTEM_IF(ret < 0, -ret);
+    return -ENOSPC;
+  }
+  ret = outboxProducer.commitTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+
+  TP_VLOG(9) << "Connection " << id_ << " is letting its peer read "
+             << writeOperation.length << " bytes";
+  rendezvousWrites_.push_back(RendezvousWrite{
+      std::move(writeOperation.fn), std::move(writeOperation.mr), {}});
+  return sizeof(marker) + sizeof(descriptor);
+}
+
+void Connection::Impl::completeRendezvousWrite_(const Error& error) {
+  RendezvousWrite rendezvousWrite = std::move(rendezvousWrites_.front());
+  rendezvousWrites_.pop_front();
+  rendezvousWrite.mr.reset();
+  rendezvousWrite.fn(error);
+  for (auto& callback : rendezvousWrite.followingCallbacks) {
+    callback.first(callback.second);
+  }
+}
+
+void Connection::Impl::onRemoteProducedData(
+    uint32_t length,
+    uint32_t sequenceNumber) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " was signalled that " << length
-             << " bytes were written to its inbox on QP " << qp_->qp_num;
+             << " bytes were written to its inbox (write #" << sequenceNumber
+             << ")";
+  // The data can only be consumed once all that comes before it has arrived.
+  if (sequenceNumber != nextInboxSequenceNumber_) {
+    earlyInboxWrites_.emplace(sequenceNumber, length);
+    return;
+  }
   // We could start a transaction and use the proper methods for this, but as
   // this method is the only producer for the inbox ringbuffer we can cut it
   // short and directly increase the head.
   inboxHeader_.incHead(length);
+  nextInboxSequenceNumber_++;
+  while (!earlyInboxWrites_.empty()) {
+    auto iter = earlyInboxWrites_.find(nextInboxSequenceNumber_);
+    if (iter == earlyInboxWrites_.end()) {
+      break;
+    }
+    inboxHeader_.incHead(iter->second);
+    nextInboxSequenceNumber_++;
+    earlyInboxWrites_.erase(iter);
+  }
   processReadOperationsFromLoop();
 }
 
-void Connection::Impl::onRemoteConsumedData(uint32_t length) {
+void Connection::Impl::onRemoteDoneReading() {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_ << " was signalled that " << length
-             << " bytes were read from its outbox on QP " << qp_->qp_num;
-  // We could start a transaction and use the proper methods for this, but as
-  // this method is the only consumer for the outbox ringbuffer we can cut it
-  // short and directly increase the tail.
-  outboxHeader_.incTail(length);
-  numBytesInFlight_ -= length;
+  // Once we failed, the pending buffers have already been given back.
+  if (error_) {
+    return;
+  }
+  TP_VLOG(9) << "Connection " << id_
+             << " was signalled that its peer is done reading a buffer";
+  completeRendezvousWrite_(Error::kSuccess);
   processWriteOperationsFromLoop();
 }
 
+void Connection::Impl::onPolledForSpace() {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+  if (applyCreditUpdate_()) {
+    processWriteOperationsFromLoop();
+  } else {
+    context_->getReactor().waitForSpace(qps_[0]->qp_num);
+  }
+}
+
 void Connection::Impl::onWriteCompleted() {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_
-             << " done posting a RDMA write request on QP " << qp_->qp_num;
+  TP_VLOG(9) << "Connection " << id_ << " done posting a RDMA write request";
   numWritesInFlight_--;
   tryCleanup_();
 }
 
+void Connection::Impl::onReadCompleted() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " done posting a RDMA read request";
+  numReadsInFlight_--;
+  if (error_) {
+    if (numReadsInFlight_ == 0) {
+      failReadOperations_();
+    }
+    tryCleanup_();
+    return;
+  }
+  if (numReadsInFlight_ > 0) {
+    return;
+  }
+
+  ReadOperation readOperation = std::move(readOperations_.front());
+  readOperations_.pop_front();
+  readOperation.mr.reset();
+  readOperation.fn(Error::kSuccess, readOperation.ptr, readOperation.length);
+  if (error_) {
+    return;
+  }
+  // Tell the peer it can reuse its buffer, along with what we consumed from the
+  // inbox in the meantime (which arrives first, as both go over the first QP).
+  if (numBytesToAck_ > 0) {
+    postCreditUpdate_();
+  }
+  postRendezvousDone_();
+  processReadOperationsFromLoop();
+}
+
 void Connection::Impl::onAckCompleted() {
   TP_DCHECK(context_->inLoop());
-  TP_VLOG(9) << "Connection " << id_ << " done posting a send request on QP "
-             << qp_->qp_num;
+  TP_VLOG(9) << "Connection " << id_ << " done posting a send request";
   numAcksInFlight_--;
   tryCleanup_();
 }
 
-void Connection::Impl::onError(IbvLib::wc_status status, uint64_t wr_id) {
+void Connection::Impl::onError(
+    IbvLib::wc_status status,
+    uint64_t /* unused */) {
   TP_DCHECK(context_->inLoop());
+  // The reactor will separately tell us which send requests have completed.
   setError_(TP_CREATE_ERROR(
       IbvError, context_->getReactor().getIbvLib().wc_status_str(status)));
-  if (wr_id == kWriteRequestId) {
-    onWriteCompleted();
-  } else if (wr_id == kAckRequestId) {
-    onAckCompleted();
-  }
 }
 
 void Connection::Impl::setError_(Error error) {
@@ -924,16 +1682,25 @@ void Connection::Impl::handleError() {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
 
-  for (auto& readOperation : readOperations_) {
-    readOperation.handleError(error_);
+  // The pending RDMA reads may still write into the buffer of the first read
+  // operation, which must thus wait for them to be flushed.
+  if (numReadsInFlight_ == 0) {
+    failReadOperations_();
+  }
+  while (!rendezvousWrites_.empty()) {
+    completeRendezvousWrite_(error_);
   }
-  readOperations_.clear();
   for (auto& writeOperation : writeOperations_) {
     writeOperation.handleError(error_);
   }
   writeOperations_.clear();
 
-  transitionIbvQueuePairToError(context_->getReactor().getIbvLib(), qp_);
+  for (IbvQueuePair& qp : qps_) {
+    transitionIbvQueuePairToError(context_->getReactor().getIbvLib(), qp);
+    // Unsignaled send requests that have already completed won't ever tell us.
+    context_->getReactor().postDrain(qp);
+    numAcksInFlight_++;
+  }
 
   tryCleanup_();
 
@@ -945,6 +1712,13 @@ void Connection::Impl::handleError() {
   }
 }
 
+void Connection::Impl::failReadOperations_() {
+  for (auto& readOperation : readOperations_) {
+    readOperation.handleError(error_);
+  }
+  readOperations_.clear();
+}
+
 void Connection::Impl::tryCleanup_() {
   TP_DCHECK(context_->inLoop());
   // Setting the queue pair to an error state will cause all its work requests
@@ -954,19 +1728,20 @@ void Connection::Impl::tryCleanup_() {
   // queue before we can destroy the queue pair. We can do so by deferring the
   // destruction to the loop, since the reactor will only proceed to invoke
   // deferred functions once it doesn't have any completion events to handle.
-  // However the RDMA writes and the sends may be queued up inside the reactor
-  // and thus may not have even been scheduled yet, so we explicitly wait for
-  // them to complete.
+  // However the RDMA writes and reads and the sends may be queued up inside the
+  // reactor and thus may not have even been scheduled yet, so we explicitly
+  // wait for them to complete.
   if (error_) {
-    if (numWritesInFlight_ == 0 && numAcksInFlight_ == 0) {
+    if (numWritesInFlight_ == 0 && numAcksInFlight_ == 0 &&
+        numReadsInFlight_ == 0) {
       TP_VLOG(8) << "Connection " << id_ << " is ready to clean up";
       context_->deferToLoop([impl{shared_from_this()}]() { impl->cleanup_(); });
     } else {
       TP_VLOG(9) << "Connection " << id_
                  << " cannot proceed to cleanup because it has "
-                 << numWritesInFlight_ << " pending RDMA write requests and "
-                 << numAcksInFlight_ << " pending send requests on QP "
-                 << qp_->qp_num;
+                 << numWritesInFlight_ << " pending RDMA write requests, "
+                 << numReadsInFlight_ << " pending RDMA read requests and "
+                 << numAcksInFlight_ << " pending send requests";
     }
   }
 }
@@ -975,13 +1750,26 @@ void Connection::Impl::cleanup_() {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(8) << "Connection " << id_ << " is cleaning up";
 
-  context_->getReactor().unregisterQp(qp_->qp_num);
+  for (IbvQueuePair& qp : qps_) {
+    context_->getReactor().unregisterQp(qp->qp_num);
+  }
 
-  qp_.reset();
-  inboxMr_.reset();
-  inboxBuf_.reset();
-  outboxMr_.reset();
-  outboxBuf_.reset();
+  // When the whole context is going away, the reactor destroys these together
+  // with those of all the other connections.
+  context_->getReactor().releaseResources(
+      std::move(qps_), std::move(creditWordsMr_));
+  qps_.clear();
+  creditWordsMr_.reset();
+  // The queue pair is gone, hence the peer can't write to the inbox anymore,
+  // and the rings can be handed to other connections.
+  if (inboxBuf_.has_value()) {
+    context_->getReactor().getInboxPool().release(inboxBuf_.value());
+    inboxBuf_.reset();
+  }
+  if (outboxBuf_.has_value()) {
+    context_->getReactor().getOutboxPool().release(outboxBuf_.value());
+    outboxBuf_.reset();
+  }
 }
 
 void Connection::Impl::closeFromLoop() {
@@ -12,45 +12,85 @@
 
 namespace {
 
-// We should probably allow these to be user-configured. But, for now, we'll set
-// them to the lowest value they can have, the rationale being that this way
-// they will always be valid.
-constexpr uint8_t kPortNum = 1;
-constexpr uint8_t kGlobalIdentifierIndex = 0;
-
-// FIXME Instead of hardcoding the next three values, we could use
-// ibv_query_device to obtain max_cqe, max_qp_wr and max_srq_wr and deduce from
-// them the maximum allowed values for these parameters.
-
-// How many simultaneous receive requests to keep queued on the shared receive
-// queue. Incoming RDMA writes and sends will consume one such request. The
-// reactor loop will fill the SRQ back up to this value once some requests
-// complete. So this number should just be large enough to accommodate all the
-// requests that could finish between two reactor loop iterations. And, even if
-// this number ends up being too low, the excess incoming requests will just
-// retry, causing a performance penalty but not a failure.
-constexpr uint32_t kNumPendingRecvReqs = 1024;
-
-// How many RDMA write requests can be pending at the same time across all
-// connections. We need to put a limit on them because they all use the same
-// global completion queue which has a fixed capacity and if it overruns it will
-// enter an unrecoverable error state. This value is also set as the capacity of
-// the send queue of each queue pair.
-constexpr uint32_t kNumPendingWriteReqs = 1024;
-
-// How many send requests (used by the receiver to acknowledge the RDMA writes
-// from the sender) can be pending at the same time across all connections.
-constexpr uint32_t kNumPendingAckReqs = 1024;
-
-// How many elements the completion queue should be able to hold. These elements
-// will be either the completed receive requests of the SRQ, or the completed
-// send requests from a connection's queue pair. We can bound the former value
-// but not the latter, so we try to add some margin.
-constexpr int kCompletionQueueSize =
-    kNumPendingRecvReqs + kNumPendingWriteReqs + kNumPendingAckReqs;
+// The values used for the QueueLimits that are left unspecified, unless the
+// device doesn't support that many. Receive requests carry no buffer, hence
+// there's little reason not to keep a lot of them queued, as running out of
+// them under heavy fan-in makes the incoming requests retry. Acks are only sent
+// at the end of the rendezvous protocol (as the updates of the inboxes' tails
+// are RDMA writes), hence they need fewer of them.
+constexpr uint32_t kDefaultNumPendingRecvReqs = 16 * 1024;
+constexpr uint32_t kDefaultNumPendingWriteReqs = 1024;
+constexpr uint32_t kDefaultNumPendingAckReqs = 256;
+
+// The receive requests that completed are given back to the shared receive
+// queue in batches of (at least) this many, or when the reactor runs out of
+// work, to amortize the cost of posting them.
+constexpr uint32_t kNumRecvReqsPerRepost = 64;
+
+// Send requests (RDMA writes and acks) are posted unsignaled, except for one
+// every this many on each queue pair, as the completion of a signaled request
+// implies the one of all the requests that were posted before it. This spares
+// most of the work completions, but the requests that are not followed by a
+// signaled one hold on to their slots in the above budgets for longer.
+constexpr uint32_t kNumSendReqsPerSignal = 16;
+
+// How many unsignaled send requests can be awaiting a signaled one across all
+// connections, after which all requests are signaled. It bounds how much of the
+// budgets the queue pairs that went idle after an unsignaled request can hold,
+// so that the others don't starve. It's further capped to a fraction of the
+// budgets, in case they are small.
+constexpr uint32_t kMaxNumUnsignaledSendReqs = 256;
+constexpr uint32_t kSendReqBudgetToMaxNumUnsignaledRatio = 4;
+
+// How much data we ask the queue pairs to be able to inline in the send
+// requests, in which case the device doesn't need to fetch it from memory. The
+// device may end up allowing for more. All devices we know of support this.
+constexpr uint32_t kMaxInlineDataSize = 64;
+
+// The receiver of the RDMA writes tells the sender how far it consumed its
+// inbox by writing the tail into the sender's memory, with an RDMA write of its
+// own, which only shows up on the sender's side when it looks for space in its
+// outbox. It holds back these writes until the data it consumed since the last
+// one amounts to the size of its inbox divided by this value. They only give
+// space back to the sender, which can keep writing in the rest of the inbox
+// meanwhile, hence this never stalls it, as long as the value is larger than
+// one.
+constexpr uint64_t kInboxSizeToAckThresholdRatio = 4;
+
+// In the rendezvous protocol, the sender writes this value where the receiver
+// expects the length of the next payload, followed by the location of the
+// buffer. It can't be a real length, as those payloads would be too large for
+// the inbox anyway, and it's only interpreted as such if the sender said, when
+// setting up the connection, that it might use the protocol.
+constexpr uint32_t kRendezvousMarker = UINT32_MAX;
+
+// The receiver tells the sender it's done reading a buffer with an ack whose
+// immediate data is this value.
+constexpr uint32_t kRendezvousDoneFlag = 1U << 31;
+
+// The largest RDMA read that the receiver posts. Larger buffers are split.
+constexpr uint32_t kMaxRendezvousReadSize = 1U << 30;
+
+// The most queue pairs that a connection can spread its transfers over.
+constexpr size_t kMaxNumQueuePairs = 16;
+
+// When a connection has several queue pairs, the RDMA writes and reads are
+// split into stripes for each of them, but none smaller than this (except for
+// the last one), as the gain in parallelism wouldn't make up for the cost of
+// the extra work requests.
+constexpr uint32_t kMinStripeSize = 32 * 1024;
 
 // How many work completions to poll from the completion queue at each reactor
-// iteration.
-constexpr int kNumPolledWorkCompletions = 32;
+// iteration. It starts from the middle value and doubles when a poll fills it
+// up, or halves when a poll returns less than a quarter of it, staying within
+// the bounds.
+constexpr int kMinNumPolledWorkCompletions = 8;
+constexpr int kInitialNumPolledWorkCompletions = 32;
+constexpr int kMaxNumPolledWorkCompletions = 256;
+
+// The queue pairs and memory regions that the connections leave behind when
+// the context is closing are destroyed by up to this many threads at once, as
+// each destruction blocks in the kernel (and in the device's firmware).
+constexpr size_t kNumTeardownThreads = 8;
 
 } // namespace
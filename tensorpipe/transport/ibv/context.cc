@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <climits>
 
 #include <tensorpipe/common/epoll_loop.h>
@@ -23,6 +24,7 @@
 #include <tensorpipe/common/socket.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/ibv/connection.h>
+#include <tensorpipe/transport/ibv/constants.h>
 #include <tensorpipe/transport/ibv/context_impl.h>
 #include <tensorpipe/transport/ibv/error.h>
 #include <tensorpipe/transport/ibv/listener.h>
@@ -103,17 +105,39 @@ std::tuple<Error, AddressInfo> createAddressInfo(std::string host) {
   return std::make_tuple(Error::kSuccess, AddressInfo(result));
 }
 
+class CompletionChannelHandler : public EpollLoop::EventHandler {
+ public:
+  explicit CompletionChannelHandler(Reactor& reactor) : reactor_(reactor) {}
+
+  void handleEventsFromLoop(int /* unused */) override {
+    reactor_.handleCompletionChannelEventsFromLoop();
+  }
+
+ private:
+  Reactor& reactor_;
+};
+
 } // namespace
 
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  Impl(
+      BusyPollingPolicy policy,
+      size_t inboxSize,
+      IbvDeviceOptions deviceOptions,
+      QueueLimits queueLimits,
+      size_t ringSlabSize,
+      size_t rendezvousThreshold,
+      bool useHugePages,
+      size_t numQueuePairs);
 
   bool isViable() const;
 
   const std::string& domainDescriptor() const;
 
+  std::map<std::string, uint64_t> getStats() const;
+
   std::shared_ptr<transport::Connection> connect(std::string addr);
 
   std::shared_ptr<transport::Listener> listen(std::string addr);
@@ -128,7 +152,7 @@ class Context::Impl : public Context::PrivateIface,
 
   bool inLoop() override;
 
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
   void registerDescriptor(
       int fd,
@@ -139,6 +163,14 @@ class Context::Impl : public Context::PrivateIface,
 
   Reactor& getReactor() override;
 
+  size_t getInboxSize() override;
+
+  size_t getRendezvousThreshold() override;
+
+  size_t getNumQueuePairs() override;
+
+  void countRingFullStall() override;
+
   void close();
 
   void join();
@@ -154,6 +186,14 @@ class Context::Impl : public Context::PrivateIface,
 
   std::string domainDescriptor_;
 
+  const size_t inboxSize_;
+  const size_t rendezvousThreshold_;
+  const size_t numQueuePairs_;
+
+  // Only set if the reactor has a completion channel, which the epoll loop
+  // monitors on its behalf.
+  std::shared_ptr<CompletionChannelHandler> completionChannelHandler_;
+
   // An identifier for the context, composed of the identifier for the context,
   // combined with the transport's name. It will only be used for logging and
   // debugging purposes.
@@ -164,11 +204,63 @@ class Context::Impl : public Context::PrivateIface,
   // will only be used for logging and debugging.
   std::atomic<uint64_t> listenerCounter_{0};
   std::atomic<uint64_t> connectionCounter_{0};
-};
 
-Context::Context() : impl_(std::make_shared<Impl>()) {}
+  std::atomic<uint64_t> numRingFullStalls_{0};
+};
 
-Context::Impl::Impl() : domainDescriptor_(generateDomainDescriptor()) {}
+Context::Context(
+    BusyPollingPolicy policy,
+    size_t inboxSize,
+    IbvDeviceOptions deviceOptions,
+    QueueLimits queueLimits,
+    size_t ringSlabSize,
+    size_t rendezvousThreshold,
+    bool useHugePages,
+    size_t numQueuePairs)
+    : impl_(std::make_shared<Impl>(
+          std::move(policy),
+          inboxSize,
+          std::move(deviceOptions),
+          queueLimits,
+          ringSlabSize,
+          rendezvousThreshold,
+          useHugePages,
+          numQueuePairs)) {}
+
+Context::Impl::Impl(
+    BusyPollingPolicy policy,
+    size_t inboxSize,
+    IbvDeviceOptions deviceOptions,
+    QueueLimits queueLimits,
+    size_t ringSlabSize,
+    size_t rendezvousThreshold,
+    bool useHugePages,
+    size_t numQueuePairs)
+    : reactor_(
+          std::move(policy),
+          std::move(deviceOptions),
+          queueLimits,
+          ringSlabSize,
+          useHugePages),
+      domainDescriptor_(generateDomainDescriptor()),
+      inboxSize_(inboxSize),
+      rendezvousThreshold_(rendezvousThreshold),
+      numQueuePairs_(numQueuePairs) {
+  TP_THROW_ASSERT_IF(inboxSize_ == 0) << "The inbox size must be positive";
+  TP_THROW_ASSERT_IF(numQueuePairs_ == 0 || numQueuePairs_ > kMaxNumQueuePairs)
+      << "The number of queue pairs must be between 1 and "
+      << kMaxNumQueuePairs;
+  if (reactor_.isViable() && reactor_.getIbvCompletionChannel() != nullptr) {
+    completionChannelHandler_ =
+        std::make_shared<CompletionChannelHandler>(reactor_);
+    reactor_.runInLoop([&]() {
+      loop_.registerDescriptor(
+          reactor_.getIbvCompletionChannel()->fd,
+          EPOLLIN,
+          completionChannelHandler_);
+    });
+  }
+}
 
 void Context::close() {
   impl_->close();
@@ -179,6 +271,11 @@ void Context::Impl::close() {
     TP_VLOG(7) << "Transport context " << id_ << " is closing";
 
     closingEmitter_.close();
+    if (completionChannelHandler_ != nullptr) {
+      reactor_.runInLoop([&]() {
+        loop_.unregisterDescriptor(reactor_.getIbvCompletionChannel()->fd);
+      });
+    }
     loop_.close();
     reactor_.close();
 
@@ -254,6 +351,22 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() const {
+  return {
+      {"polls", reactor_.getNumPolls()},
+      {"empty_polls", reactor_.getNumEmptyPolls()},
+      {"deferred_functions",
+       static_cast<uint64_t>(
+           std::max<int64_t>(reactor_.getNumDeferredFunctions(), 0))},
+      {"ring_full_stalls", numRingFullStalls_.load(std::memory_order_relaxed)},
+      {"memory.rings", reactor_.getNumRingBytes()},
+  };
+}
+
 std::tuple<Error, std::string> Context::lookupAddrForIface(std::string iface) {
   return impl_->lookupAddrForIface(std::move(iface));
 }
@@ -363,7 +476,7 @@ bool Context::Impl::inLoop() {
   return reactor_.inLoop();
 };
 
-void Context::Impl::deferToLoop(std::function<void()> fn) {
+void Context::Impl::deferToLoop(TTask fn) {
   reactor_.deferToLoop(std::move(fn));
 };
 
@@ -382,6 +495,22 @@ Reactor& Context::Impl::getReactor() {
   return reactor_;
 }
 
+size_t Context::Impl::getInboxSize() {
+  return inboxSize_;
+}
+
+size_t Context::Impl::getRendezvousThreshold() {
+  return rendezvousThreshold_;
+}
+
+size_t Context::Impl::getNumQueuePairs() {
+  return numQueuePairs_;
+}
+
+void Context::Impl::countRingFullStall() {
+  numRingFullStalls_.fetch_add(1, std::memory_order_relaxed);
+}
+
 } // namespace ibv
 } // namespace transport
 } // namespace tensorpipe
@@ -12,8 +12,11 @@
 #include <string>
 #include <tuple>
 
+#include <tensorpipe/common/busy_polling_policy.h>
 #include <tensorpipe/common/error.h>
+#include <tensorpipe/common/ibv_device_options.h>
 #include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/ibv/queue_limits.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -22,9 +25,58 @@ namespace ibv {
 class Connection;
 class Listener;
 
-class Context : public transport::Context {
+class Context final : public transport::Context {
  public:
-  Context();
+  static constexpr size_t kDefaultInboxSize = 2 * 1024 * 1024;
+
+  // Each connection registers an inbox of inboxSize bytes (rounded up to a
+  // power of two), into which its peer performs RDMA writes, and an outbox of
+  // the same size as its peer's inbox, which the two sides agree upon when
+  // setting up the connection. Larger inboxes let more data be in flight,
+  // whereas smaller ones lower the memory each connection pins. The inbox must
+  // be large enough to hold any nop object (e.g., a message descriptor). On
+  // hosts with several devices, create the context from a thread that runs on
+  // the NUMA node it will serve, or pick the device explicitly. A pipe can be
+  // spread over several devices by registering one context per device, under
+  // different names, in its tensorpipe::Context. The queue limits default to
+  // values derived from the device's capabilities.
+  //
+  // With a non-zero ring slab size, the inboxes and outboxes are carved out of
+  // slabs of that many bytes, each registered once, and are reused by later
+  // connections, rather than each being registered on its own. This keeps the
+  // number of memory regions, which compete for the device's translation
+  // cache, from growing with the number of connections (at the cost of all
+  // rings of a slab sharing a remote key). With many peers, the queue pairs can
+  // be cut down to one per peer by wrapping this transport in the mux one, and
+  // the memory by using smaller inboxes.
+  //
+  // With a non-zero rendezvous threshold, the buffers of at least that many
+  // bytes (but not the nop objects) don't go through the rings: the sender
+  // registers them and only writes their address and remote key in the outbox,
+  // and the receiver fetches them with an RDMA read straight into the
+  // destination, telling the sender when it's done. This saves copying them
+  // twice, and doesn't hold up the other writes while waiting for space in the
+  // inbox, at the cost of registering each buffer (and of one more round trip).
+  // The write callback is only called once the peer has read the buffer.
+  //
+  // If useHugePages is set, the rings are allocated on huge pages when
+  // possible (which, combined with a large ring slab size, lets many of them
+  // share a few translation entries of the device), and on regular pages
+  // otherwise.
+  //
+  // A single queue pair often can't saturate the fastest links, hence each
+  // connection can open several of them (numQueuePairs, up to 16), over which
+  // it stripes its RDMA writes and reads, the receiver putting the writes back
+  // in order. The two sides use as many as the one that asks for fewer.
+  explicit Context(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      size_t inboxSize = kDefaultInboxSize,
+      IbvDeviceOptions deviceOptions = IbvDeviceOptions(),
+      QueueLimits queueLimits = QueueLimits(),
+      size_t ringSlabSize = 0,
+      size_t rendezvousThreshold = 0,
+      bool useHugePages = false,
+      size_t numQueuePairs = 1);
 
   std::shared_ptr<transport::Connection> connect(std::string addr) override;
 
@@ -34,6 +86,8 @@ class Context : public transport::Context {
 
   const std::string& domainDescriptor() const override;
 
+  std::map<std::string, uint64_t> getStats() const override;
+
   std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
 
   std::tuple<Error, std::string> lookupAddrForHostname();
@@ -34,6 +34,18 @@ class Context::PrivateIface : public DeferredExecutor {
 
   virtual Reactor& getReactor() = 0;
 
+  virtual size_t getInboxSize() = 0;
+
+  // Zero if the rendezvous protocol is disabled.
+  virtual size_t getRendezvousThreshold() = 0;
+
+  // How many queue pairs each connection asks for.
+  virtual size_t getNumQueuePairs() = 0;
+
+  // To be called by the connections whenever a write can't proceed because
+  // the outbox is full, for monitoring purposes.
+  virtual void countRingFullStall() = 0;
+
   virtual ~PrivateIface() = default;
 };
 
@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+namespace tensorpipe {
+namespace transport {
+namespace ibv {
+
+// How much work the reactor keeps outstanding on the device, across all the
+// connections of a context. The zero values are replaced with a default that
+// fits within the device's capabilities (as reported by ibv_query_device), and
+// the non-zero ones must fit within them.
+struct QueueLimits {
+  // How many receive requests to keep queued on the shared receive queue. Each
+  // incoming RDMA write and send consumes one, and the reactor replenishes them
+  // as they complete. If it runs out, the excess incoming requests just retry,
+  // causing a performance penalty but not a failure.
+  uint32_t numPendingRecvReqs{0};
+  // How many RDMA writes can be pending at the same time. Beyond that, they're
+  // queued up by the reactor, since they all use the same completion queue,
+  // which enters an unrecoverable error state if it overruns. This includes
+  // the ones that tell the peer how much of its writes were consumed.
+  uint32_t numPendingWriteReqs{0};
+  // Same as above, for the sends that tell the peer that its buffers of the
+  // rendezvous protocol were read.
+  uint32_t numPendingAckReqs{0};
+};
+
+} // namespace ibv
+} // namespace transport
+} // namespace tensorpipe
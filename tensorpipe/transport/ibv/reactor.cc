@@ -8,6 +8,9 @@
 
 #include <tensorpipe/transport/ibv/reactor.h>
 
+#include <fcntl.h>
+
+#include <tensorpipe/common/probes.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/ibv/constants.h>
 
@@ -15,7 +18,86 @@ namespace tensorpipe {
 namespace transport {
 namespace ibv {
 
-Reactor::Reactor() {
+namespace {
+
+uint32_t resolveQueueLimit(
+    uint32_t value,
+    uint32_t defaultValue,
+    uint32_t maxValue,
+    const char* name) {
+  if (value == 0) {
+    return std::min(defaultValue, maxValue);
+  }
+  TP_THROW_ASSERT_IF(value > maxValue)
+      << "The " << name << " (" << value
+      << ") exceeds what the device supports (" << maxValue << ")";
+  return value;
+}
+
+QueueLimits resolveQueueLimits(
+    const QueueLimits& limits,
+    const IbvLib::device_attr& deviceAttr) {
+  QueueLimits resolvedLimits;
+  // The send queue of each queue pair must fit all RDMA writes and all acks.
+  resolvedLimits.numPendingWriteReqs = resolveQueueLimit(
+      limits.numPendingWriteReqs,
+      kDefaultNumPendingWriteReqs,
+      deviceAttr.max_qp_wr / 2,
+      "number of pending RDMA writes");
+  resolvedLimits.numPendingAckReqs = resolveQueueLimit(
+      limits.numPendingAckReqs,
+      kDefaultNumPendingAckReqs,
+      deviceAttr.max_qp_wr - resolvedLimits.numPendingWriteReqs,
+      "number of pending acks");
+  uint32_t numPendingSendReqs =
+      resolvedLimits.numPendingWriteReqs + resolvedLimits.numPendingAckReqs;
+  // The completion queue must fit all of them plus all the receive requests.
+  TP_THROW_ASSERT_IF(
+      numPendingSendReqs >= static_cast<uint32_t>(deviceAttr.max_cqe))
+      << "The completion queue can't hold all the pending requests";
+  resolvedLimits.numPendingRecvReqs = resolveQueueLimit(
+      limits.numPendingRecvReqs,
+      kDefaultNumPendingRecvReqs,
+      std::min<uint32_t>(
+          deviceAttr.max_srq_wr,
+          static_cast<uint32_t>(deviceAttr.max_cqe) - numPendingSendReqs),
+      "number of pending receive requests");
+  return resolvedLimits;
+}
+
+} // namespace
+
+Reactor::Reactor(
+    BusyPollingPolicy policy,
+    IbvDeviceOptions deviceOptions,
+    QueueLimits queueLimits,
+    size_t ringSlabSize,
+    bool useHugePages)
+    : BusyPollingLoop(std::move(policy)),
+      inboxPool_(
+          ibvLib_,
+          pd_,
+          IbvLib::ACCESS_LOCAL_WRITE | IbvLib::ACCESS_REMOTE_WRITE,
+          ringSlabSize,
+          useHugePages),
+      outboxPool_(
+          ibvLib_,
+          pd_,
+          /*accessFlags=*/0,
+          ringSlabSize,
+          useHugePages),
+      sourceRegistrations_(
+          ibvLib_,
+          pd_,
+          IbvLib::ACCESS_REMOTE_READ,
+          /*capacity=*/0,
+          deviceOptions.onDemandPaging),
+      destinationRegistrations_(
+          ibvLib_,
+          pd_,
+          IbvLib::ACCESS_LOCAL_WRITE,
+          /*capacity=*/0,
+          deviceOptions.onDemandPaging) {
   Error error;
   std::tie(error, ibvLib_) = IbvLib::create();
   // FIXME Instead of throwing away the error and setting a bool, we should have
@@ -27,27 +109,69 @@ Reactor::Reactor() {
   }
   foundIbvLib_ = true;
   IbvDeviceList deviceList(getIbvLib());
-  if (deviceList.size() == 0) {
+  int deviceIdx = selectIbvDevice(deviceList, deviceOptions);
+  if (deviceIdx < 0) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't find a suitable device";
+    return;
+  }
+  IbvContext ctx = createIbvContext(getIbvLib(), deviceList[deviceIdx]);
+  uint8_t portNum = selectIbvPort(getIbvLib(), ctx, deviceOptions);
+  if (portNum == 0) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't find an active port on "
+               << deviceList[deviceIdx].name;
     return;
   }
-  ctx_ = createIbvContext(getIbvLib(), deviceList[0]);
+  TP_VLOG(9) << "Transport context " << id_ << " is using port "
+             << static_cast<int>(portNum) << " of device "
+             << deviceList[deviceIdx].name;
+  ctx_ = std::move(ctx);
+
+  IbvLib::device_attr deviceAttr;
+  std::memset(&deviceAttr, 0, sizeof(deviceAttr));
+  TP_CHECK_IBV_INT(getIbvLib().query_device(ctx_.get(), &deviceAttr));
+  queueLimits_ = resolveQueueLimits(queueLimits, deviceAttr);
+  TP_VLOG(9) << "Transport context " << id_ << " will keep up to "
+             << queueLimits_.numPendingRecvReqs << " receive requests, "
+             << queueLimits_.numPendingWriteReqs << " RDMA writes and "
+             << queueLimits_.numPendingAckReqs << " acks pending";
+  numAvailableWrites_ = queueLimits_.numPendingWriteReqs;
+  numAvailableAcks_ = queueLimits_.numPendingAckReqs;
+  maxNumUnsignaledSendReqs_ = std::min(
+      kMaxNumUnsignaledSendReqs,
+      (queueLimits_.numPendingWriteReqs + queueLimits_.numPendingAckReqs) /
+          kSendReqBudgetToMaxNumUnsignaledRatio);
+
   pd_ = createIbvProtectionDomain(getIbvLib(), ctx_);
+  if (getPolicy().sleeps()) {
+    compChannel_ = createIbvCompletionChannel(getIbvLib(), ctx_);
+    // The events are drained until there are none left, which requires the
+    // file descriptor not to block.
+    int flags = ::fcntl(compChannel_->fd, F_GETFL);
+    TP_THROW_SYSTEM_IF(flags < 0, errno);
+    int rv = ::fcntl(compChannel_->fd, F_SETFL, flags | O_NONBLOCK);
+    TP_THROW_SYSTEM_IF(rv < 0, errno);
+  TP_PROBE(ibv_poll, rv);
+  }
   cq_ = createIbvCompletionQueue(
       getIbvLib(),
       ctx_,
-      kCompletionQueueSize,
+      queueLimits_.numPendingRecvReqs + queueLimits_.numPendingWriteReqs +
+          queueLimits_.numPendingAckReqs,
       /*cq_context=*/nullptr,
-      /*channel=*/nullptr,
+      /*channel=*/compChannel_.get(),
       /*comp_vector=*/0);
 
   IbvLib::srq_init_attr srqInitAttr;
   std::memset(&srqInitAttr, 0, sizeof(srqInitAttr));
-  srqInitAttr.attr.max_wr = kNumPendingRecvReqs;
+  srqInitAttr.attr.max_wr = queueLimits_.numPendingRecvReqs;
   srq_ = createIbvSharedReceiveQueue(getIbvLib(), pd_, srqInitAttr);
 
-  addr_ = makeIbvAddress(getIbvLib(), ctx_, kPortNum, kGlobalIdentifierIndex);
+  addr_ = makeIbvAddress(
+      getIbvLib(), ctx_, portNum, deviceOptions.globalIdentifierIndex);
 
-  postRecvRequestsOnSRQ_(kNumPendingRecvReqs);
+  postRecvRequestsOnSRQ_(queueLimits_.numPendingRecvReqs);
 
   startThread("TP_IBV_reactor");
 }
@@ -56,18 +180,52 @@ bool Reactor::isViable() const {
   return foundIbvLib_ && const_cast<IbvContext&>(ctx_).get() != nullptr;
 }
 
-void Reactor::postRecvRequestsOnSRQ_(int num) {
+void Reactor::postRecvRequestsOnSRQ_(uint32_t num) {
   while (num > 0) {
     IbvLib::recv_wr* badRecvWr = nullptr;
-    std::array<IbvLib::recv_wr, kNumPolledWorkCompletions> wrs;
+    std::array<IbvLib::recv_wr, kNumRecvReqsPerRepost> wrs;
     std::memset(wrs.data(), 0, sizeof(wrs));
-    for (int i = 0; i < std::min(num, kNumPolledWorkCompletions) - 1; i++) {
+    uint32_t numInBatch = std::min(num, kNumRecvReqsPerRepost);
+    for (uint32_t i = 0; i < numInBatch - 1; i++) {
       wrs[i].next = &wrs[i + 1];
     }
     int rv = getIbvLib().post_srq_recv(srq_.get(), wrs.data(), &badRecvWr);
     TP_THROW_SYSTEM_IF(rv != 0, errno);
     TP_THROW_ASSERT_IF(badRecvWr != nullptr);
-    num -= std::min(num, kNumPolledWorkCompletions);
+    num -= numInBatch;
+  }
+}
+
+void Reactor::prepareToSleep() {
+  if (compChannel_ == nullptr) {
+    return;
+  }
+  // Any completion that arrives from now on will generate an event. The ones
+  // that arrived before are caught by the poll that follows this call.
+  int rv = getIbvLib().req_notify_cq(cq_.get(), /*solicited_only=*/0);
+  TP_THROW_SYSTEM_IF(rv != 0, rv);
+}
+
+void Reactor::handleCompletionChannelEventsFromLoop() {
+  TP_DCHECK(inLoop());
+  TP_DCHECK(compChannel_ != nullptr);
+  // There's nothing to do with the events themselves: the deferred function
+  // that got us here has already woken up the loop, which will now poll the
+  // completion queue. They must however be consumed and acknowledged.
+  unsigned int numEvents = 0;
+  while (true) {
+    IbvLib::cq* cq;
+    void* cqContext;
+    int rv = getIbvLib().get_cq_event(compChannel_.get(), &cq, &cqContext);
+    if (rv != 0) {
+      TP_THROW_SYSTEM_IF(errno != EAGAIN, errno);
+      break;
+    }
+    TP_DCHECK_EQ(cq, cq_.get());
+    numEvents++;
+  }
+  if (numEvents > 0) {
+    getIbvLib().ack_cq_events(cq_.get(), numEvents);
   }
 }
 
@@ -86,25 +244,81 @@ void Reactor::join() {
 
   if (!joined_.exchange(true)) {
     joinThread();
+    destroyReleasedResources_();
+  }
+}
+
+void Reactor::releaseResources(
+    std::vector<IbvQueuePair> qps,
+    IbvMemoryRegion mr) {
+  if (!closed_) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(resourcesToDestroyMutex_);
+  for (IbvQueuePair& qp : qps) {
+    qpsToDestroy_.push_back(std::move(qp));
+  }
+  if (mr != nullptr) {
+    mrsToDestroy_.push_back(std::move(mr));
   }
 }
 
+void Reactor::destroyReleasedResources_() {
+  std::vector<IbvQueuePair> qps;
+  std::vector<IbvMemoryRegion> mrs;
+  {
+    std::unique_lock<std::mutex> lock(resourcesToDestroyMutex_);
+    std::swap(qps, qpsToDestroy_);
+    std::swap(mrs, mrsToDestroy_);
+  }
+  if (qps.empty() && mrs.empty()) {
+    return;
+  }
+  TP_VLOG(7) << "Transport context " << id_ << " is destroying " << qps.size()
+             << " queue pairs and " << mrs.size() << " memory regions";
+  std::vector<std::function<void()>> fns;
+  fns.reserve(qps.size() + mrs.size());
+  for (IbvQueuePair& qp : qps) {
+    fns.emplace_back([&qp]() { qp.reset(); });
+  }
+  for (IbvMemoryRegion& mr : mrs) {
+    fns.emplace_back([&mr]() { mr.reset(); });
+  }
+  runInParallel(std::move(fns), kNumTeardownThreads);
+}
+
 Reactor::~Reactor() {
   join();
 }
 
 bool Reactor::pollOnce() {
-  std::array<IbvLib::wc, kNumPolledWorkCompletions> wcs;
-  auto rv = getIbvLib().poll_cq(cq_.get(), wcs.size(), wcs.data());
+  // Space can free up in the outboxes without any work completion, hence the
+  // reactor must not consider itself idle while anyone is waiting for it.
+  bool polledForSpace = pollForSpace_();
+
+  std::array<IbvLib::wc, kMaxNumPolledWorkCompletions> wcs;
+  auto rv =
+      getIbvLib().poll_cq(cq_.get(), numPolledWorkCompletions_, wcs.data());
 
   if (rv == 0) {
-    return false;
+    // Nothing else to do, hence give back the stragglers.
+    if (numRecvReqsToRepost_ > 0) {
+      postRecvRequestsOnSRQ_(numRecvReqsToRepost_);
+      numRecvReqsToRepost_ = 0;
+    }
+    return polledForSpace;
   }
   TP_THROW_SYSTEM_IF(rv < 0, errno);
 
-  int numRecvs = 0;
-  int numWrites = 0;
-  int numAcks = 0;
+  if (rv == numPolledWorkCompletions_) {
+    numPolledWorkCompletions_ =
+        std::min(numPolledWorkCompletions_ * 2, kMaxNumPolledWorkCompletions);
+  } else if (rv < numPolledWorkCompletions_ / 4) {
+    numPolledWorkCompletions_ =
+        std::max(numPolledWorkCompletions_ / 2, kMinNumPolledWorkCompletions);
+  }
+
+  uint32_t numRecvs = 0;
   for (int wcIdx = 0; wcIdx < rv; wcIdx++) {
     IbvLib::wc& wc = wcs[wcIdx];
 
@@ -116,102 +330,239 @@ bool Reactor::pollOnce() {
                << " (byte length: " << wc.byte_len
                << ", immediate data: " << wc.imm_data << ")";
 
-    auto iter = queuePairEventHandler_.find(wc.qp_num);
-    TP_THROW_ASSERT_IF(iter == queuePairEventHandler_.end())
+    // The opcode of failed work completions is undefined, hence we tell the
+    // send requests apart by their ID.
+    if (wc.wr_id != 0) {
+      onSendCompleted_(wc);
+      continue;
+    }
+
+    auto iter = queuePairs_.find(wc.qp_num);
+    TP_THROW_ASSERT_IF(iter == queuePairs_.end())
         << "Got work completion for unknown queue pair " << wc.qp_num;
+    IbvEventHandler& eventHandler = *iter->second.eventHandler;
 
     if (wc.status != IbvLib::WC_SUCCESS) {
-      iter->second->onError(wc.status, wc.wr_id);
+      eventHandler.onError(wc.status, wc.wr_id);
       continue;
     }
 
     switch (wc.opcode) {
       case IbvLib::WC_RECV_RDMA_WITH_IMM:
         TP_THROW_ASSERT_IF(!(wc.wc_flags & IbvLib::WC_WITH_IMM));
-        iter->second->onRemoteProducedData(wc.imm_data);
+        eventHandler.onRemoteProducedData(wc.byte_len, wc.imm_data);
         numRecvs++;
         break;
       case IbvLib::WC_RECV:
         TP_THROW_ASSERT_IF(!(wc.wc_flags & IbvLib::WC_WITH_IMM));
-        iter->second->onRemoteConsumedData(wc.imm_data);
+        TP_THROW_ASSERT_IF(wc.imm_data != kRendezvousDoneFlag)
+            << "Unknown immediate data: " << wc.imm_data;
+        eventHandler.onRemoteDoneReading();
         numRecvs++;
         break;
-      case IbvLib::WC_RDMA_WRITE:
-        iter->second->onWriteCompleted();
-        numWrites++;
-        break;
-      case IbvLib::WC_SEND:
-        iter->second->onAckCompleted();
-        numAcks++;
-        break;
       default:
         TP_THROW_ASSERT() << "Unknown opcode: " << wc.opcode;
     }
   }
 
-  postRecvRequestsOnSRQ_(numRecvs);
+  numRecvReqsToRepost_ += numRecvs;
+  if (numRecvReqsToRepost_ >= kNumRecvReqsPerRepost) {
+    postRecvRequestsOnSRQ_(numRecvReqsToRepost_);
+    numRecvReqsToRepost_ = 0;
+  }
 
-  numAvailableWrites_ += numWrites;
   while (!pendingQpWrites_.empty() && numAvailableWrites_ > 0) {
-    postWrite(
-        std::get<0>(pendingQpWrites_.front()),
-        std::get<1>(pendingQpWrites_.front()));
+    PendingSendReq& pendingReq = pendingQpWrites_.front();
+    pendingReq.wr.sg_list =
+        pendingReq.wr.num_sge > 0 ? &pendingReq.sge : nullptr;
+    postWriteOrRead_(pendingReq.qp, pendingReq.wr, pendingReq.kind);
     pendingQpWrites_.pop_front();
   }
 
-  numAvailableAcks_ += numAcks;
   while (!pendingQpAcks_.empty() && numAvailableAcks_ > 0) {
-    postAck(
-        std::get<0>(pendingQpAcks_.front()),
-        std::get<1>(pendingQpAcks_.front()));
+    PendingSendReq& pendingReq = pendingQpAcks_.front();
+    pendingReq.wr.sg_list =
+        pendingReq.wr.num_sge > 0 ? &pendingReq.sge : nullptr;
+    postAck(pendingReq.qp, pendingReq.wr);
     pendingQpAcks_.pop_front();
   }
 
   return true;
 }
 
+bool Reactor::pollForSpace_() {
+  if (qpsWaitingForSpace_.empty()) {
+    return false;
+  }
+  // The handlers may start waiting again, hence we swap the list out first.
+  std::vector<uint32_t> qpns;
+  std::swap(qpns, qpsWaitingForSpace_);
+  for (uint32_t qpn : qpns) {
+    auto iter = queuePairs_.find(qpn);
+    // It may have been unregistered in the meantime.
+    if (iter == queuePairs_.end() || !iter->second.waitingForSpace) {
+      continue;
+    }
+    iter->second.waitingForSpace = false;
+    // Keep the handler alive, in case it unregisters itself.
+    std::shared_ptr<IbvEventHandler> eventHandler = iter->second.eventHandler;
+    eventHandler->onPolledForSpace();
+  }
+  return true;
+}
+
+void Reactor::onSendCompleted_(IbvLib::wc& wc) {
+  auto iter = queuePairs_.find(wc.qp_num);
+  TP_THROW_ASSERT_IF(iter == queuePairs_.end())
+      << "Got work completion for unknown queue pair " << wc.qp_num;
+  QueuePairInfo& info = iter->second;
+  // Keep the handler alive, in case it unregisters itself.
+  std::shared_ptr<IbvEventHandler> eventHandler = info.eventHandler;
+
+  uint64_t oldestSendReqId = info.nextSendReqId - info.postedSendReqs.size();
+  TP_THROW_ASSERT_IF(
+      wc.wr_id < oldestSendReqId || wc.wr_id >= info.nextSendReqId)
+      << "Got work completion for unknown send request " << wc.wr_id
+      << " for QP " << wc.qp_num;
+
+  if (wc.status != IbvLib::WC_SUCCESS) {
+    eventHandler->onError(wc.status, wc.wr_id);
+  }
+
+  // Requests complete in order, hence this one accounts for all the unsignaled
+  // ones that came before it. (Failed requests always have a work completion,
+  // but by then the previous ones have completed too.)
+  for (uint64_t sendReqId = oldestSendReqId; sendReqId <= wc.wr_id;
+       sendReqId++) {
+    PostedSendReq sendReq = info.postedSendReqs.front();
+    info.postedSendReqs.pop_front();
+    if (!sendReq.signaled) {
+      numUnsignaledSendReqs_--;
+    }
+    if (sendReq.kind == SendReqKind::kWrite) {
+      numAvailableWrites_++;
+      eventHandler->onWriteCompleted();
+    } else if (sendReq.kind == SendReqKind::kRead) {
+      numAvailableWrites_++;
+      eventHandler->onReadCompleted();
+    } else {
+      numAvailableAcks_++;
+      eventHandler->onAckCompleted();
+    }
+  }
+}
+
 bool Reactor::readyToClose() {
-  return queuePairEventHandler_.size() == 0;
+  return queuePairs_.size() == 0;
 }
 
 void Reactor::registerQp(
     uint32_t qpn,
     std::shared_ptr<IbvEventHandler> eventHandler) {
-  queuePairEventHandler_.emplace(qpn, std::move(eventHandler));
+  QueuePairInfo info;
+  info.eventHandler = std::move(eventHandler);
+  queuePairs_.emplace(qpn, std::move(info));
 }
 
 void Reactor::unregisterQp(uint32_t qpn) {
-  queuePairEventHandler_.erase(qpn);
+  auto iter = queuePairs_.find(qpn);
+  TP_DCHECK(iter != queuePairs_.end());
+  TP_DCHECK(iter->second.postedSendReqs.empty());
+  queuePairs_.erase(iter);
+}
+
+void Reactor::waitForSpace(uint32_t qpn) {
+  auto iter = queuePairs_.find(qpn);
+  TP_DCHECK(iter != queuePairs_.end());
+  if (!iter->second.waitingForSpace) {
+    iter->second.waitingForSpace = true;
+    qpsWaitingForSpace_.push_back(qpn);
+  }
 }
 
 void Reactor::postWrite(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  postWriteOrRead_(qp, wr, SendReqKind::kWrite);
+}
+
+void Reactor::postRead(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  postWriteOrRead_(qp, wr, SendReqKind::kRead);
+}
+
+void Reactor::postWriteOrRead_(
+    IbvQueuePair& qp,
+    IbvLib::send_wr& wr,
+    SendReqKind kind) {
+  TP_DCHECK_LE(wr.num_sge, 1);
+  const char* what = kind == SendReqKind::kWrite ? "RDMA write" : "RDMA read";
   if (numAvailableWrites_ > 0) {
-    IbvLib::send_wr* badWr = nullptr;
-    TP_VLOG(9) << "Transport context " << id_ << " posting RDMA write for QP "
-               << qp->qp_num;
-    TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
+    TP_VLOG(9) << "Transport context " << id_ << " posting " << what
+               << " for QP " << qp->qp_num;
+    postSend_(qp, wr, kind);
     numAvailableWrites_--;
   } else {
-    TP_VLOG(9) << "Transport context " << id_
-               << " queueing up RDMA write for QP " << qp->qp_num;
-    pendingQpWrites_.emplace_back(qp, wr);
+    TP_VLOG(9) << "Transport context " << id_ << " queueing up " << what
+               << " for QP " << qp->qp_num;
+    pendingQpWrites_.push_back(PendingSendReq{
+        kind, qp, wr, wr.num_sge > 0 ? *wr.sg_list : IbvLib::sge{}});
   }
 }
 
 void Reactor::postAck(IbvQueuePair& qp, IbvLib::send_wr& wr) {
+  TP_DCHECK_LE(wr.num_sge, 1);
   if (numAvailableAcks_ > 0) {
-    IbvLib::send_wr* badWr = nullptr;
     TP_VLOG(9) << "Transport context " << id_ << " posting send for QP "
                << qp->qp_num;
-    TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
-    TP_THROW_ASSERT_IF(badWr != nullptr);
+    postSend_(qp, wr, SendReqKind::kAck);
     numAvailableAcks_--;
   } else {
     TP_VLOG(9) << "Transport context " << id_ << " queueing send for QP "
                << qp->qp_num;
-    pendingQpAcks_.emplace_back(qp, wr);
+    pendingQpAcks_.push_back(PendingSendReq{
+        SendReqKind::kAck,
+        qp,
+        wr,
+        wr.num_sge > 0 ? *wr.sg_list : IbvLib::sge{}});
+  }
+}
+
+void Reactor::postDrain(IbvQueuePair& qp) {
+  auto iter = queuePairs_.find(qp->qp_num);
+  TP_DCHECK(iter != queuePairs_.end());
+  iter->second.draining = true;
+
+  IbvLib::send_wr wr;
+  std::memset(&wr, 0, sizeof(wr));
+  wr.opcode = IbvLib::WR_SEND;
+  wr.send_flags = IbvLib::SEND_SIGNALED;
+  postAck(qp, wr);
+}
+
+void Reactor::postSend_(
+    IbvQueuePair& qp,
+    IbvLib::send_wr& wr,
+    SendReqKind kind) {
+  auto iter = queuePairs_.find(qp->qp_num);
+  TP_DCHECK(iter != queuePairs_.end());
+  QueuePairInfo& info = iter->second;
+
+  bool signaled = (wr.send_flags & IbvLib::SEND_SIGNALED) || info.draining ||
+      info.numUnsignaledSinceLastSignaled + 1 >= kNumSendReqsPerSignal ||
+      numUnsignaledSendReqs_ >= maxNumUnsignaledSendReqs_;
+  if (signaled) {
+    wr.send_flags |= IbvLib::SEND_SIGNALED;
+    info.numUnsignaledSinceLastSignaled = 0;
+  } else {
+    info.numUnsignaledSinceLastSignaled++;
+    numUnsignaledSendReqs_++;
   }
+  wr.wr_id = info.nextSendReqId++;
+  info.postedSendReqs.push_back(PostedSendReq{kind, signaled});
+
+  TP_PROBE(
+      ibv_post_send, qp->qp_num, static_cast<uint8_t>(kind), signaled);
+  IbvLib::send_wr* badWr = nullptr;
+  TP_CHECK_IBV_INT(getIbvLib().post_send(qp.get(), &wr, &badWr));
+  TP_THROW_ASSERT_IF(badWr != nullptr);
 }
 
 } // namespace ibv
@@ -9,20 +9,25 @@
 #pragma once
 
 #include <atomic>
+#include <deque>
 #include <functional>
 #include <future>
 #include <list>
 #include <mutex>
 #include <set>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/ibv.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/ibv/constants.h>
+#include <tensorpipe/transport/ibv/queue_limits.h>
+#include <tensorpipe/transport/ibv/ring_pool.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
 
@@ -32,14 +37,28 @@ namespace ibv {
 
 class IbvEventHandler {
  public:
-  virtual void onRemoteProducedData(uint32_t length) = 0;
+  // The sequence number is the immediate data of the RDMA write, with which
+  // the peer numbers its writes, as those it spreads over several queue pairs
+  // may complete out of order.
+  virtual void onRemoteProducedData(
+      uint32_t length,
+      uint32_t sequenceNumber) = 0;
 
-  virtual void onRemoteConsumedData(uint32_t length) = 0;
+  // The peer is done reading a buffer of the rendezvous protocol.
+  virtual void onRemoteDoneReading() = 0;
 
+  // Called at the next iteration of the reactor after waitForSpace.
+  virtual void onPolledForSpace() = 0;
+
+  // Called once for each RDMA write, RDMA read and ack, even if they failed.
   virtual void onWriteCompleted() = 0;
 
+  virtual void onReadCompleted() = 0;
+
   virtual void onAckCompleted() = 0;
 
+  // Called for each failed work completion. For send requests, it's called
+  // before the above callbacks for the requests it accounts for.
   virtual void onError(IbvLib::wc_status status, uint64_t wr_id) = 0;
 
   virtual ~IbvEventHandler() = default;
@@ -53,9 +72,20 @@ class IbvEventHandler {
 // machine. It uses extra data in the ring buffer header to store a
 // mutex and condition variable to avoid a busy loop.
 //
+// If its busy-polling policy ever lets it go to sleep, the completion
+// queue is attached to a completion channel, which is armed right before
+// sleeping. The channel's file descriptor is to be monitored (by the
+// context's epoll loop) and any event on it must be handed back to the
+// reactor, which wakes it up.
+//
 class Reactor final : public BusyPollingLoop {
  public:
-  Reactor();
+  explicit Reactor(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      IbvDeviceOptions deviceOptions = IbvDeviceOptions(),
+      QueueLimits queueLimits = QueueLimits(),
+      size_t ringSlabSize = 0,
+      bool useHugePages = false);
 
   IbvLib& getIbvLib() {
     return ibvLib_;
@@ -73,6 +103,15 @@ class Reactor final : public BusyPollingLoop {
     return cq_;
   }
 
+  // Null if the reactor never sleeps.
+  IbvCompletionChannel& getIbvCompletionChannel() {
+    return compChannel_;
+  }
+
+  // To be called, from within the loop, whenever the completion channel's
+  // file descriptor becomes readable.
+  void handleCompletionChannelEventsFromLoop();
+
   IbvSharedReceiveQueue& getIbvSrq() {
     return srq_;
   }
@@ -81,14 +120,67 @@ class Reactor final : public BusyPollingLoop {
     return addr_;
   }
 
+  // With all the values resolved.
+  const QueueLimits& getQueueLimits() {
+    return queueLimits_;
+  }
+
+  // Where the connections get the memory of their inboxes and outboxes from.
+  RingPool& getInboxPool() {
+    return inboxPool_;
+  }
+
+  RingPool& getOutboxPool() {
+    return outboxPool_;
+  }
+
+  // The registered memory of the inboxes and outboxes of all connections.
+  size_t getNumRingBytes() const {
+    return inboxPool_.getNumBytes() + outboxPool_.getNumBytes();
+  }
+
+  // Where the connections register the buffers of the rendezvous protocol:
+  // those that the peer reads from, and those that they read into.
+  IbvRegistrationCache& getSourceRegistrations() {
+    return sourceRegistrations_;
+  }
+
+  IbvRegistrationCache& getDestinationRegistrations() {
+    return destinationRegistrations_;
+  }
+
   void registerQp(uint32_t qpn, std::shared_ptr<IbvEventHandler> eventHandler);
 
   void unregisterQp(uint32_t qpn);
 
+  // The peers tell each other how much of their inboxes they consumed by RDMA
+  // writes that don't generate any work completion on this side, hence those
+  // waiting for space in their outbox need to be polled. The reactor never
+  // sleeps while any of them are.
+  void waitForSpace(uint32_t qpn);
+
+  // The work requests must have at most one scatter/gather element, which is
+  // copied, hence the caller doesn't need to keep it alive. Their IDs are
+  // assigned by the reactor, and they are signaled as the reactor sees fit.
   void postWrite(IbvQueuePair& qp, IbvLib::send_wr& wr);
 
+  // RDMA reads share the budget of the RDMA writes.
+  void postRead(IbvQueuePair& qp, IbvLib::send_wr& wr);
+
   void postAck(IbvQueuePair& qp, IbvLib::send_wr& wr);
 
+  // Once a queue pair has been put in an error state, post a (signaled) request
+  // that will be flushed after all the ones that were posted before it, which
+  // is the only way to find out that the unsignaled ones have completed. It's
+  // accounted as an ack. All requests posted after it will be signaled.
+  void postDrain(IbvQueuePair& qp);
+
+  // Once the reactor is closing, the connections hand their queue pairs and
+  // memory regions over to it instead of destroying them one by one, and it
+  // destroys them all at once, in parallel, when joined. Before then, they're
+  // destroyed right away.
+  void releaseResources(std::vector<IbvQueuePair> qps, IbvMemoryRegion mr);
+
   bool isViable() const;
 
   void setId(std::string id);
@@ -104,17 +196,42 @@ class Reactor final : public BusyPollingLoop {
 
   bool readyToClose() override;
 
+  void prepareToSleep() override;
+
  private:
   // InfiniBand stuff
   bool foundIbvLib_{false};
   IbvLib ibvLib_;
   IbvContext ctx_;
   IbvProtectionDomain pd_;
+  // Must be destroyed before the protection domain. Only the inboxes are
+  // written to by the peers.
+  RingPool inboxPool_;
+  RingPool outboxPool_;
+  // They don't cache anything, as the buffers may be freed and reused at any
+  // time without us knowing, but they may use On-Demand Paging.
+  IbvRegistrationCache sourceRegistrations_;
+  IbvRegistrationCache destinationRegistrations_;
+  // Must outlive the completion queue.
+  IbvCompletionChannel compChannel_;
   IbvCompletionQueue cq_;
   IbvSharedReceiveQueue srq_;
   IbvAddress addr_;
+  QueueLimits queueLimits_;
+
+  // The receive requests that completed and haven't been given back yet.
+  uint32_t numRecvReqsToRepost_{0};
+  int numPolledWorkCompletions_{kInitialNumPolledWorkCompletions};
 
-  void postRecvRequestsOnSRQ_(int num);
+  void postRecvRequestsOnSRQ_(uint32_t num);
+
+  // The resources handed over by releaseResources. Destroyed before the
+  // completion queue and the protection domain they belong to.
+  std::vector<IbvQueuePair> qpsToDestroy_;
+  std::vector<IbvMemoryRegion> mrsToDestroy_;
+  std::mutex resourcesToDestroyMutex_;
+
+  void destroyReleasedResources_();
 
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
@@ -123,14 +240,55 @@ class Reactor final : public BusyPollingLoop {
   // debugging purposes.
   std::string id_{"N/A"};
 
-  // The registered event handlers for each queue pair.
-  std::unordered_map<uint32_t, std::shared_ptr<IbvEventHandler>>
-      queuePairEventHandler_;
-
-  uint32_t numAvailableWrites_{kNumPendingWriteReqs};
-  uint32_t numAvailableAcks_{kNumPendingAckReqs};
-  std::deque<std::tuple<IbvQueuePair&, IbvLib::send_wr>> pendingQpWrites_;
-  std::deque<std::tuple<IbvQueuePair&, IbvLib::send_wr>> pendingQpAcks_;
+  enum class SendReqKind : uint8_t { kWrite, kAck, kRead };
+
+  struct PostedSendReq {
+    SendReqKind kind;
+    bool signaled;
+  };
+
+  struct QueuePairInfo {
+    std::shared_ptr<IbvEventHandler> eventHandler;
+    // The send requests that were posted and whose completion we haven't yet
+    // learned about, from the oldest one. The ID of the newest one is the one
+    // before nextSendReqId.
+    std::deque<PostedSendReq> postedSendReqs;
+    // Start from one, as receive requests have ID zero.
+    uint64_t nextSendReqId{1};
+    uint32_t numUnsignaledSinceLastSignaled{0};
+    bool draining{false};
+    bool waitingForSpace{false};
+  };
+
+  // The registered queue pairs. References to elements remain valid when the
+  // map is modified, which may happen from within the event handlers.
+  std::unordered_map<uint32_t, QueuePairInfo> queuePairs_;
+
+  std::vector<uint32_t> qpsWaitingForSpace_;
+
+  // Return whether any queue pair was waiting.
+  bool pollForSpace_();
+
+  struct PendingSendReq {
+    SendReqKind kind;
+    IbvQueuePair& qp;
+    IbvLib::send_wr wr;
+    IbvLib::sge sge;
+  };
+
+  uint32_t numAvailableWrites_{0};
+  uint32_t numAvailableAcks_{0};
+  uint32_t maxNumUnsignaledSendReqs_{0};
+  uint32_t numUnsignaledSendReqs_{0};
+  std::deque<PendingSendReq> pendingQpWrites_;
+  std::deque<PendingSendReq> pendingQpAcks_;
+
+  void postWriteOrRead_(
+      IbvQueuePair& qp,
+      IbvLib::send_wr& wr,
+      SendReqKind kind);
+  void postSend_(IbvQueuePair& qp, IbvLib::send_wr& wr, SendReqKind kind);
+  void onSendCompleted_(IbvLib::wc& wc);
 };
 
 } // namespace ibv
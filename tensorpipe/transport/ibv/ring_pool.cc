@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/ibv/ring_pool.h>
+
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ibv {
+
+namespace {
+
+// The default size of huge pages on x86 and on most ARM configurations.
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+MmappedPtr mapSlab(size_t length, bool useHugePages) {
+  if (!useHugePages) {
+    return MmappedPtr(
+        length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+  }
+  length = (length + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  MmappedPtr buf = MmappedPtr::tryCreate(
+      length,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+      -1);
+  if (buf.ptr() != nullptr) {
+    return buf;
+  }
+  TP_VLOG(9) << "Couldn't map " << length
+             << " bytes on reserved huge pages (" << std::strerror(errno)
+             << "), falling back to transparent ones";
+  buf = MmappedPtr(
+      length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+  // It's only a hint, which the kernel may not be able to honor.
+  ::madvise(buf.ptr(), length, MADV_HUGEPAGE);
+  return buf;
+}
+
+} // namespace
+
+RingPool::RingPool(
+    IbvLib& ibvLib,
+    IbvProtectionDomain& pd,
+    int accessFlags,
+    size_t slabSize,
+    bool useHugePages)
+    : ibvLib_(ibvLib),
+      pd_(pd),
+      accessFlags_(accessFlags),
+      slabSize_(slabSize),
+      useHugePages_(useHugePages) {}
+
+size_t RingPool::createSlab_(size_t length, bool dedicated) {
+  size_t slabIdx;
+  if (!freeSlabIdxs_.empty()) {
+    slabIdx = freeSlabIdxs_.back();
+    freeSlabIdxs_.pop_back();
+  } else {
+    slabIdx = slabs_.size();
+    slabs_.emplace_back();
+  }
+  Slab& slab = slabs_[slabIdx];
+  // Use mmapped memory so it's page-aligned.
+  slab.buf = mapSlab(length, useHugePages_);
+  slab.mr =
+      createIbvMemoryRegion(ibvLib_, pd_, slab.buf.ptr(), length, accessFlags_);
+  slab.dedicated = dedicated;
+  numBytes_.fetch_add(length, std::memory_order_relaxed);
+  return slabIdx;
+}
+
+RingPool::Ring RingPool::allocate(size_t length) {
+  TP_DCHECK(isPow2(length));
+
+  if (slabSize_ < length) {
+    const size_t slabIdx = createSlab_(length, /*dedicated=*/true);
+    Slab& slab = slabs_[slabIdx];
+    return Ring{slab.buf.ptr(), length, slab.mr->lkey, slab.mr->rkey, slabIdx};
+  }
+
+  std::vector<Ring>& freeRings = freeRings_[length];
+  if (freeRings.empty()) {
+    // Carve a whole new slab into rings of this length, which keeps them
+    // aligned to their length as the slab is page-aligned.
+    const size_t slabIdx = createSlab_(slabSize_, /*dedicated=*/false);
+    Slab& slab = slabs_[slabIdx];
+    for (size_t offset = slabSize_ - slabSize_ % length; offset > 0;) {
+      offset -= length;
+      freeRings.push_back(Ring{
+          slab.buf.ptr() + offset,
+          length,
+          slab.mr->lkey,
+          slab.mr->rkey,
+          slabIdx});
+    }
+  }
+  Ring ring = freeRings.back();
+  freeRings.pop_back();
+  return ring;
+}
+
+void RingPool::release(Ring ring) {
+  Slab& slab = slabs_[ring.slabIdx];
+  if (slab.dedicated) {
+    slab.mr.reset();
+    slab.buf.reset();
+    numBytes_.fetch_sub(ring.length, std::memory_order_relaxed);
+    freeSlabIdxs_.push_back(ring.slabIdx);
+    return;
+  }
+  freeRings_[ring.length].push_back(ring);
+}
+
+} // namespace ibv
+} // namespace transport
+} // namespace tensorpipe
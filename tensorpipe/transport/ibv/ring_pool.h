@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/ibv.h>
+#include <tensorpipe/common/memory.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ibv {
+
+// Provides the memory of the inboxes (or of the outboxes) of the connections,
+// already registered with the device. With a slab size of zero each ring gets
+// its own mapping and memory region, which are released with it. Otherwise the
+// rings are carved out of slabs of that size, each registered once, and are
+// recycled for later connections, so that the number of memory regions stays
+// small however many connections there are. Each memory region uses entries in
+// the device's translation tables, and once there are too many of them to fit
+// in its cache all RDMA accesses slow down. The downside is that all the rings
+// of a slab share the same remote key, hence a peer could write into the
+// inboxes of the other peers if it were to get the offsets wrong.
+//
+// If useHugePages is set, the slabs are backed by huge pages, which need fewer
+// translation entries, both in the device and in the CPU. Reserved ones are
+// used if there are any left, otherwise transparent ones are asked for. The
+// slabs are then rounded up to the size of a huge page.
+//
+// It must be used from the reactor's loop only, except for getNumBytes.
+class RingPool {
+ public:
+  struct Ring {
+    uint8_t* ptr{nullptr};
+    size_t length{0};
+    uint32_t lkey{0};
+    uint32_t rkey{0};
+    size_t slabIdx{0};
+  };
+
+  RingPool(
+      IbvLib& ibvLib,
+      IbvProtectionDomain& pd,
+      int accessFlags,
+      size_t slabSize,
+      bool useHugePages = false);
+
+  RingPool(const RingPool&) = delete;
+  RingPool& operator=(const RingPool&) = delete;
+
+  // The length must be a power of two, as it is for ring buffers.
+  Ring allocate(size_t length);
+
+  void release(Ring ring);
+
+  size_t getNumSlabs() const {
+    return slabs_.size() - freeSlabIdxs_.size();
+  }
+
+  // The memory of the slabs, which is all registered with the device, whether
+  // its rings are in use or not. It may be read from any thread.
+  size_t getNumBytes() const {
+    return numBytes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct Slab {
+    MmappedPtr buf;
+    IbvMemoryRegion mr;
+    // Whether the slab holds a single ring, and goes away with it.
+    bool dedicated;
+  };
+
+  IbvLib& ibvLib_;
+  IbvProtectionDomain& pd_;
+  const int accessFlags_;
+  const size_t slabSize_;
+  const bool useHugePages_;
+
+  std::vector<Slab> slabs_;
+  // The entries of the above that were released, to be reused.
+  std::vector<size_t> freeSlabIdxs_;
+  // The rings that aren't in use, by length.
+  std::unordered_map<size_t, std::vector<Ring>> freeRings_;
+  std::atomic<size_t> numBytes_{0};
+
+  size_t createSlab_(size_t length, bool dedicated);
+};
+
+} // namespace ibv
+} // namespace transport
+} // namespace tensorpipe
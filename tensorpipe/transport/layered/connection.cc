@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/layered/connection.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+Connection::Connection(
+    std::shared_ptr<ContextImplIface> context,
+    uint64_t connectionKey)
+    : context_(std::move(context)), connectionKey_(connectionKey) {}
+
+void Connection::read(read_callback_fn fn) {
+  context_->readFromConnection(connectionKey_, std::move(fn));
+}
+
+void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
+  context_->readFromConnection(connectionKey_, ptr, length, std::move(fn));
+}
+
+void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
+  context_->writeToConnection(connectionKey_, ptr, length, std::move(fn));
+}
+
+void Connection::setId(std::string id) {
+  context_->setConnectionId(connectionKey_, std::move(id));
+}
+
+void Connection::close() {
+  context_->closeConnection(connectionKey_);
+}
+
+Connection::~Connection() {
+  close();
+}
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/layered/context_impl.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+// A handle to a connection whose state lives in the context. It's only meant
+// to be created by the context, which hands out the key.
+class Connection final : public transport::Connection {
+ public:
+  Connection(std::shared_ptr<ContextImplIface> context, uint64_t connectionKey);
+
+  // Queue a read operation.
+  void read(read_callback_fn fn) override;
+  void read(void* ptr, size_t length, read_callback_fn fn) override;
+
+  // Perform a write operation.
+  void write(const void* ptr, size_t length, write_callback_fn fn) override;
+
+  // Tell the connection what its identifier is.
+  void setId(std::string id) override;
+
+  // Shut down the connection.
+  void close() override;
+
+  ~Connection() override;
+
+ private:
+  const std::shared_ptr<ContextImplIface> context_;
+  const uint64_t connectionKey_;
+};
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
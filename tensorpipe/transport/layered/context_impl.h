@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <tensorpipe/transport/connection.h>
+#include <tensorpipe/transport/listener.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+// The transports that are layered on top of other ones (i.e., mux and bond)
+// keep all the state of their connections and listeners in the context, on its
+// loop, and connections and listeners are merely handles into it, which are
+// identified by a number that is unique within the context.
+class ContextImplIface {
+ public:
+  virtual void readFromConnection(
+      uint64_t connectionKey,
+      transport::Connection::read_callback_fn fn) = 0;
+
+  virtual void readFromConnection(
+      uint64_t connectionKey,
+      void* ptr,
+      size_t length,
+      transport::Connection::read_callback_fn fn) = 0;
+
+  virtual void writeToConnection(
+      uint64_t connectionKey,
+      const void* ptr,
+      size_t length,
+      transport::Connection::write_callback_fn fn) = 0;
+
+  virtual void setConnectionId(uint64_t connectionKey, std::string id) = 0;
+
+  virtual void closeConnection(uint64_t connectionKey) = 0;
+
+  virtual void acceptFromListener(
+      uint64_t listenerKey,
+      transport::Listener::accept_callback_fn fn) = 0;
+
+  virtual void setListenerId(uint64_t listenerKey, std::string id) = 0;
+
+  virtual void closeListener(uint64_t listenerKey) = 0;
+
+  virtual ~ContextImplIface() = default;
+};
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
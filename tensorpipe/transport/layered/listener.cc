@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/layered/listener.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+Listener::Listener(
+    std::shared_ptr<ContextImplIface> context,
+    uint64_t listenerKey,
+    std::string addr)
+    : context_(std::move(context)),
+      listenerKey_(listenerKey),
+      addr_(std::move(addr)) {}
+
+void Listener::accept(accept_callback_fn fn) {
+  context_->acceptFromListener(listenerKey_, std::move(fn));
+}
+
+std::string Listener::addr() const {
+  return addr_;
+}
+
+void Listener::setId(std::string id) {
+  context_->setListenerId(listenerKey_, std::move(id));
+}
+
+void Listener::close() {
+  context_->closeListener(listenerKey_);
+}
+
+Listener::~Listener() {
+  close();
+}
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <tensorpipe/transport/layered/context_impl.h>
+#include <tensorpipe/transport/listener.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+// A handle to a listener whose state lives in the context. It's only meant to
+// be created by the context, which hands out the key.
+class Listener final : public transport::Listener {
+ public:
+  Listener(
+      std::shared_ptr<ContextImplIface> context,
+      uint64_t listenerKey,
+      std::string addr);
+
+  // Queue a callback to be called when a connection comes in.
+  void accept(accept_callback_fn fn) override;
+
+  // Obtain the listener's address.
+  std::string addr() const override;
+
+  // Tell the listener what its identifier is.
+  void setId(std::string id) override;
+
+  // Shut down the listener.
+  void close() override;
+
+  ~Listener() override;
+
+ private:
+  const std::shared_ptr<ContextImplIface> context_;
+  const uint64_t listenerKey_;
+  const std::string addr_;
+};
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/layered/loop.h>
+
+#include <utility>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+Loop::Loop(std::string threadName) {
+  startThread(std::move(threadName));
+}
+
+void Loop::close() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  cv_.notify_all();
+}
+
+void Loop::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Loop::~Loop() {
+  join();
+}
+
+void Loop::eventLoop() {
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [&]() { return closed_ || numWakeups_ > 0; });
+      if (numWakeups_ == 0) {
+        return;
+      }
+      numWakeups_ = 0;
+    }
+    runDeferredFunctionsFromEventLoop();
+  }
+}
+
+void Loop::wakeupEventLoopToDeferFunction() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    numWakeups_++;
+  }
+  cv_.notify_all();
+}
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
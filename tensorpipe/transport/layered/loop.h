@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <tensorpipe/common/deferred_executor.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace layered {
+
+// The thread on which all the state of a context of a transport that is layered
+// on top of other ones (i.e., mux and bond) lives. It does no I/O of its own:
+// it just runs the functions deferred to it, which mainly come from the
+// callbacks of the transports underneath.
+class Loop final : public EventLoopDeferredExecutor {
+ public:
+  explicit Loop(std::string threadName);
+
+  void close();
+
+  void join();
+
+  ~Loop() override;
+
+ protected:
+  void eventLoop() override;
+
+  void wakeupEventLoopToDeferFunction() override;
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool closed_{false};
+  uint64_t numWakeups_{0};
+
+  std::atomic<bool> joined_{false};
+};
+
+} // namespace layered
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,969 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/mux/context.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/nop.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/layered/connection.h>
+#include <tensorpipe/transport/layered/context_impl.h>
+#include <tensorpipe/transport/layered/listener.h>
+#include <tensorpipe/transport/layered/loop.h>
+#include <tensorpipe/transport/mux/nop_types.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace mux {
+
+namespace {
+
+// Prepended to the descriptor of the underlying transport.
+const std::string kDomainDescriptorPrefix{"mux:"};
+
+} // namespace
+
+class Context::Impl : public layered::ContextImplIface,
+                      public std::enable_shared_from_this<Context::Impl> {
+ public:
+  Impl(
+      std::shared_ptr<transport::Context> context,
+      size_t numConnectionsPerPeer);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr);
+
+  std::shared_ptr<transport::Listener> listen(std::string addr);
+
+  bool isViable() const;
+
+  const std::string& domainDescriptor() const;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  void readFromConnection(
+      uint64_t streamKey,
+      transport::Connection::read_callback_fn fn) override;
+
+  void readFromConnection(
+      uint64_t streamKey,
+      void* ptr,
+      size_t length,
+      transport::Connection::read_callback_fn fn) override;
+
+  void writeToConnection(
+      uint64_t streamKey,
+      const void* ptr,
+      size_t length,
+      transport::Connection::write_callback_fn fn) override;
+
+  void setConnectionId(uint64_t streamKey, std::string id) override;
+
+  void closeConnection(uint64_t streamKey) override;
+
+  void acceptFromListener(
+      uint64_t listenerKey,
+      transport::Listener::accept_callback_fn fn) override;
+
+  void setListenerId(uint64_t listenerKey, std::string id) override;
+
+  void closeListener(uint64_t listenerKey) override;
+
+  ~Impl() override = default;
+
+ private:
+  struct PendingRead {
+    // Whether the read comes with a buffer to fill, or whether it must instead
+    // be handed a pointer to the data.
+    bool hasBuffer;
+    void* ptr;
+    size_t length;
+    transport::Connection::read_callback_fn fn;
+  };
+
+  static constexpr uint64_t kNoCarrier = std::numeric_limits<uint64_t>::max();
+
+  struct Stream {
+    // Sub-streams opened after the context was closed have no carrier.
+    uint64_t carrierKey{kNoCarrier};
+    // The identifier of the sub-stream within its carrier.
+    uint64_t streamId;
+    std::string id;
+    std::deque<PendingRead> pendingReads;
+    // Payloads that arrived before a read was queued for them, and the number
+    // of those that are still being read from the carrier. Payloads that are
+    // read while there's a read with a buffer waiting for them go directly
+    // into that buffer instead.
+    std::deque<std::vector<uint8_t>> unreadPayloads;
+    size_t numPayloadsBeingRead{0};
+    Error error{Error::kSuccess};
+  };
+
+  // A connection of the underlying transport, carrying sub-streams.
+  struct Carrier {
+    std::shared_ptr<transport::Connection> connection;
+    // The address it connects to, if it was opened by this side, or else
+    // empty, in which case it was accepted by the given listener.
+    std::string addr;
+    uint64_t listenerKey;
+    // Map from the identifiers of its sub-streams to their keys.
+    std::unordered_map<uint64_t, uint64_t> streamKeys;
+  };
+
+  struct ListenerState {
+    std::shared_ptr<transport::Listener> listener;
+    std::string id;
+    std::deque<transport::Listener::accept_callback_fn> pendingAccepts;
+    std::deque<std::shared_ptr<transport::Connection>> pendingConnections;
+    Error error{Error::kSuccess};
+  };
+
+  // The carriers opened towards an address, used in a round-robin fashion.
+  struct Peer {
+    std::vector<uint64_t> carrierKeys;
+    size_t nextCarrierIdx{0};
+  };
+
+  void connectFromLoop_(uint64_t streamKey, std::string addr, std::string id);
+
+  void listenFromLoop_(
+      uint64_t listenerKey,
+      std::shared_ptr<transport::Listener> listener,
+      std::string id);
+
+  void readFromStreamFromLoop_(uint64_t streamKey, PendingRead read);
+
+  void writeToStreamFromLoop_(
+      uint64_t streamKey,
+      const void* ptr,
+      size_t length,
+      transport::Connection::write_callback_fn fn);
+
+  void closeStreamFromLoop_(uint64_t streamKey);
+
+  void acceptFromListenerFromLoop_(
+      uint64_t listenerKey,
+      transport::Listener::accept_callback_fn fn);
+
+  void closeListenerFromLoop_(uint64_t listenerKey);
+
+  void closeFromLoop_();
+
+  uint64_t addCarrier_(
+      std::shared_ptr<transport::Connection> connection,
+      std::string addr,
+      uint64_t listenerKey);
+
+  void writeFrame_(Carrier& carrier, uint64_t streamId, FrameType type);
+
+  void acceptCarrier_(uint64_t listenerKey);
+
+  void onCarrierAccepted_(
+      uint64_t listenerKey,
+      const Error& error,
+      std::shared_ptr<transport::Connection> connection);
+
+  void readNextFrame_(uint64_t carrierKey);
+
+  void onFrameHeader_(
+      uint64_t carrierKey,
+      const Error& error,
+      const FrameHeader& header);
+
+  void onOpenStream_(uint64_t carrierKey, uint64_t streamId);
+
+  void readPayload_(uint64_t carrierKey, uint64_t streamId);
+
+  void onPayload_(
+      uint64_t streamKey,
+      const Error& error,
+      std::vector<uint8_t> payload);
+
+  void onCloseStream_(uint64_t carrierKey, uint64_t streamId);
+
+  void failCarrier_(uint64_t carrierKey, const Error& error);
+
+  static void deliverPayload_(PendingRead& read, std::vector<uint8_t> payload);
+
+  // Once a stream has an error, fail its queued reads, but only after it ran
+  // out of the payloads that arrived before the error did.
+  static void failPendingReadsIfErrored_(Stream& stream);
+
+  const std::shared_ptr<transport::Context> context_;
+  const size_t numConnectionsPerPeer_;
+  const std::string domainDescriptor_;
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  // Keys for the sub-streams and listeners, which are handed out to the public
+  // objects before these are registered on the loop.
+  std::atomic<uint64_t> nextStreamKey_{0};
+  std::atomic<uint64_t> nextListenerKey_{0};
+
+  // The following are only accessed from within the loop.
+  uint64_t nextCarrierKey_{0};
+  std::unordered_map<uint64_t, Stream> streams_;
+  std::unordered_map<uint64_t, Carrier> carriers_;
+  std::unordered_map<uint64_t, ListenerState> listeners_;
+  std::unordered_map<std::string, Peer> peers_;
+
+  // Declared last so that it's the first to be destroyed, while the state that
+  // the functions it may still be running refer to is still alive.
+  layered::Loop loop_{"TP_MUX_loop"};
+};
+
+Context::Context(
+    std::shared_ptr<transport::Context> context,
+    size_t numConnectionsPerPeer)
+    : impl_(std::make_shared<Impl>(std::move(context), numConnectionsPerPeer)) {
+}
+
+Context::Impl::Impl(
+    std::shared_ptr<transport::Context> context,
+    size_t numConnectionsPerPeer)
+    : context_(std::move(context)),
+      numConnectionsPerPeer_(numConnectionsPerPeer),
+      domainDescriptor_(
+          kDomainDescriptorPrefix + context_->domainDescriptor()) {
+  TP_THROW_ASSERT_IF(numConnectionsPerPeer == 0)
+      << "At least one connection per peer is needed";
+}
+
+std::shared_ptr<transport::Connection> Context::connect(std::string addr) {
+  return impl_->connect(std::move(addr));
+}
+
+std::shared_ptr<transport::Connection> Context::Impl::connect(
+    std::string addr) {
+  const uint64_t streamKey = nextStreamKey_++;
+  std::string id = id_ + ".c" + std::to_string(streamKey);
+  TP_VLOG(7) << "Transport context " << id_ << " is opening connection " << id
+             << " to address " << addr;
+  loop_.deferToLoop([this,
+                     streamKey,
+                     addr{std::move(addr)},
+                     id{std::move(id)}]() mutable {
+    connectFromLoop_(streamKey, std::move(addr), std::move(id));
+  });
+  return std::make_shared<layered::Connection>(shared_from_this(), streamKey);
+}
+
+void Context::Impl::connectFromLoop_(
+    uint64_t streamKey,
+    std::string addr,
+    std::string id) {
+  TP_DCHECK(loop_.inLoop());
+
+  Stream& stream = streams_[streamKey];
+  stream.id = std::move(id);
+  if (closed_) {
+    stream.error = TP_CREATE_ERROR(ConnectionClosedError);
+    return;
+  }
+
+  // Open a new carrier until the pool for this address is full, and then
+  // spread the sub-streams evenly across the ones it contains.
+  Peer& peer = peers_[addr];
+  uint64_t carrierKey;
+  if (peer.carrierKeys.size() < numConnectionsPerPeer_) {
+    carrierKey = addCarrier_(context_->connect(addr), addr, /*listenerKey=*/0);
+    peer.carrierKeys.push_back(carrierKey);
+  } else {
+    carrierKey = peer.carrierKeys[peer.nextCarrierIdx];
+    peer.nextCarrierIdx = (peer.nextCarrierIdx + 1) % peer.carrierKeys.size();
+  }
+
+  // The keys of the sub-streams opened by this side are unique within the
+  // context, hence within the carrier too, and are thus used as identifiers.
+  Carrier& carrier = carriers_.at(carrierKey);
+  stream.carrierKey = carrierKey;
+  stream.streamId = streamKey;
+  carrier.streamKeys[streamKey] = streamKey;
+  TP_VLOG(7) << "Transport context " << id_ << " is carrying connection "
+             << stream.id << " over connection " << carrierKey;
+  writeFrame_(carrier, streamKey, kOpenStream);
+}
+
+std::shared_ptr<transport::Listener> Context::listen(std::string addr) {
+  return impl_->listen(std::move(addr));
+}
+
+std::shared_ptr<transport::Listener> Context::Impl::listen(std::string addr) {
+  std::shared_ptr<transport::Listener> listener =
+      context_->listen(std::move(addr));
+  const uint64_t listenerKey = nextListenerKey_++;
+  std::string id = id_ + ".l" + std::to_string(listenerKey);
+  TP_VLOG(7) << "Transport context " << id_ << " is opening listener " << id;
+  std::string listenerAddr = listener->addr();
+  listener->setId(id + ".inner");
+  loop_.deferToLoop([this,
+                     listenerKey,
+                     listener{std::move(listener)},
+                     id{std::move(id)}]() mutable {
+    listenFromLoop_(listenerKey, std::move(listener), std::move(id));
+  });
+  return std::make_shared<layered::Listener>(
+      shared_from_this(), listenerKey, std::move(listenerAddr));
+}
+
+void Context::Impl::listenFromLoop_(
+    uint64_t listenerKey,
+    std::shared_ptr<transport::Listener> listener,
+    std::string id) {
+  TP_DCHECK(loop_.inLoop());
+
+  ListenerState& state = listeners_[listenerKey];
+  state.listener = std::move(listener);
+  state.id = std::move(id);
+  if (closed_) {
+    state.error = TP_CREATE_ERROR(ListenerClosedError);
+    state.listener->close();
+    return;
+  }
+
+  acceptCarrier_(listenerKey);
+}
+
+void Context::Impl::acceptCarrier_(uint64_t listenerKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  listeners_.at(listenerKey)
+      .listener->accept([impl{shared_from_this()}, listenerKey](
+                            const Error& error,
+                            std::shared_ptr<transport::Connection> connection) {
+        impl->loop_.deferToLoop(
+            [impl, listenerKey, error, connection{std::move(connection)}]() {
+              impl->onCarrierAccepted_(listenerKey, error, connection);
+            });
+      });
+}
+
+void Context::Impl::onCarrierAccepted_(
+    uint64_t listenerKey,
+    const Error& error,
+    std::shared_ptr<transport::Connection> connection) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    if (connection != nullptr) {
+      connection->close();
+    }
+    return;
+  }
+  ListenerState& state = iter->second;
+
+  if (error) {
+    if (!state.error) {
+      state.error = error;
+    }
+    while (!state.pendingAccepts.empty()) {
+      transport::Listener::accept_callback_fn fn =
+          std::move(state.pendingAccepts.front());
+      state.pendingAccepts.pop_front();
+      fn(state.error, std::shared_ptr<transport::Connection>());
+    }
+    return;
+  }
+
+  TP_VLOG(7) << "Transport listener " << state.id
+             << " accepted a connection carrying sub-streams";
+  addCarrier_(std::move(connection), /*addr=*/"", listenerKey);
+  acceptCarrier_(listenerKey);
+}
+
+uint64_t Context::Impl::addCarrier_(
+    std::shared_ptr<transport::Connection> connection,
+    std::string addr,
+    uint64_t listenerKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  const uint64_t carrierKey = nextCarrierKey_++;
+  connection->setId(id_ + ".k" + std::to_string(carrierKey));
+  Carrier& carrier = carriers_[carrierKey];
+  carrier.connection = std::move(connection);
+  carrier.addr = std::move(addr);
+  carrier.listenerKey = listenerKey;
+  readNextFrame_(carrierKey);
+  return carrierKey;
+}
+
+void Context::Impl::writeFrame_(
+    Carrier& carrier,
+    uint64_t streamId,
+    FrameType type) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto header = std::make_shared<NopHolder<FrameHeader>>();
+  header->getObject().streamId = streamId;
+  header->getObject().type = type;
+  // Errors are detected, and handled, by the reads of the carrier.
+  carrier.connection->write(
+      *header, [header](const Error& /* unused */) mutable { header.reset(); });
+}
+
+void Context::Impl::readNextFrame_(uint64_t carrierKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto header = std::make_shared<NopHolder<FrameHeader>>();
+  carriers_.at(carrierKey)
+      .connection->read(
+          *header,
+          [impl{shared_from_this()}, carrierKey, header](const Error& error) {
+            impl->loop_.deferToLoop([impl, carrierKey, error, header]() {
+              impl->onFrameHeader_(carrierKey, error, header->getObject());
+            });
+          });
+}
+
+void Context::Impl::onFrameHeader_(
+    uint64_t carrierKey,
+    const Error& error,
+    const FrameHeader& header) {
+  TP_DCHECK(loop_.inLoop());
+
+  if (carriers_.count(carrierKey) == 0) {
+    return;
+  }
+  if (error) {
+    failCarrier_(carrierKey, error);
+    return;
+  }
+
+  switch (header.type) {
+    case kOpenStream:
+      onOpenStream_(carrierKey, header.streamId);
+      break;
+    case kData:
+      readPayload_(carrierKey, header.streamId);
+      break;
+    case kCloseStream:
+      onCloseStream_(carrierKey, header.streamId);
+      break;
+    default:
+      TP_THROW_ASSERT() << "Unknown frame type: "
+                        << static_cast<int>(header.type);
+  }
+
+  // The reads of a connection are served in order, hence the header of the
+  // next frame can be read right away, even if the payload of this one hasn't
+  // arrived yet.
+  readNextFrame_(carrierKey);
+}
+
+void Context::Impl::onOpenStream_(uint64_t carrierKey, uint64_t streamId) {
+  TP_DCHECK(loop_.inLoop());
+
+  Carrier& carrier = carriers_.at(carrierKey);
+  const uint64_t streamKey = nextStreamKey_++;
+  Stream& stream = streams_[streamKey];
+  stream.carrierKey = carrierKey;
+  stream.streamId = streamId;
+  stream.id = id_ + ".c" + std::to_string(streamKey);
+  carrier.streamKeys[streamId] = streamKey;
+
+  auto connection = std::make_shared<layered::Connection>(
+      shared_from_this(), streamKey);
+
+  // If the listener is gone the connection is dropped, which closes it and
+  // thus tells the peer.
+  auto iter = listeners_.find(carrier.listenerKey);
+  if (carrier.addr.empty() && iter != listeners_.end() && !iter->second.error) {
+    ListenerState& state = iter->second;
+    TP_VLOG(7) << "Transport listener " << state.id << " got connection "
+               << stream.id;
+    if (!state.pendingAccepts.empty()) {
+      transport::Listener::accept_callback_fn fn =
+          std::move(state.pendingAccepts.front());
+      state.pendingAccepts.pop_front();
+      fn(Error::kSuccess, std::move(connection));
+    } else {
+      state.pendingConnections.push_back(std::move(connection));
+    }
+  }
+}
+
+void Context::Impl::readPayload_(uint64_t carrierKey, uint64_t streamId) {
+  TP_DCHECK(loop_.inLoop());
+
+  Carrier& carrier = carriers_.at(carrierKey);
+  auto keyIter = carrier.streamKeys.find(streamId);
+  if (keyIter == carrier.streamKeys.end()) {
+    // The stream was closed on this side, hence its data is discarded.
+    carrier.connection->read(
+        [](const Error& /* unused */,
+           const void* /* unused */,
+           size_t /* unused */) {});
+    return;
+  }
+  const uint64_t streamKey = keyIter->second;
+  Stream& stream = streams_.at(streamKey);
+
+  if (!stream.pendingReads.empty() && stream.pendingReads.front().hasBuffer &&
+      stream.unreadPayloads.empty() && stream.numPayloadsBeingRead == 0) {
+    PendingRead read = std::move(stream.pendingReads.front());
+    stream.pendingReads.pop_front();
+    carrier.connection->read(
+        read.ptr,
+        read.length,
+        [impl{shared_from_this()}, fn{std::move(read.fn)}](
+            const Error& error, const void* ptr, size_t length) mutable {
+          impl->loop_.deferToLoop(
+              [fn{std::move(fn)}, error, ptr, length]() mutable {
+                fn(error, ptr, length);
+              });
+        });
+    return;
+  }
+
+  // The data is only valid within the callback, hence it must be copied out
+  // before deferring to the loop.
+  stream.numPayloadsBeingRead++;
+  carrier.connection->read([impl{shared_from_this()}, streamKey](
+                               const Error& error,
+                               const void* ptr,
+                               size_t length) {
+    std::vector<uint8_t> payload;
+    if (!error) {
+      const uint8_t* data = reinterpret_cast<const uint8_t*>(ptr);
+      payload.assign(data, data + length);
+    }
+    impl->loop_.deferToLoop(
+        [impl, streamKey, error, payload{std::move(payload)}]() mutable {
+          impl->onPayload_(streamKey, error, std::move(payload));
+        });
+  });
+}
+
+void Context::Impl::onPayload_(
+    uint64_t streamKey,
+    const Error& error,
+    std::vector<uint8_t> payload) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = streams_.find(streamKey);
+  if (iter == streams_.end()) {
+    return;
+  }
+  Stream& stream = iter->second;
+  stream.numPayloadsBeingRead--;
+
+  // An error is also seen by the read of the next frame header, which takes
+  // care of it.
+  if (!error) {
+    if (!stream.pendingReads.empty() && stream.unreadPayloads.empty()) {
+      PendingRead read = std::move(stream.pendingReads.front());
+      stream.pendingReads.pop_front();
+      deliverPayload_(read, std::move(payload));
+    } else {
+      stream.unreadPayloads.push_back(std::move(payload));
+    }
+  }
+  failPendingReadsIfErrored_(stream);
+}
+
+void Context::Impl::onCloseStream_(uint64_t carrierKey, uint64_t streamId) {
+  TP_DCHECK(loop_.inLoop());
+
+  Carrier& carrier = carriers_.at(carrierKey);
+  auto keyIter = carrier.streamKeys.find(streamId);
+  if (keyIter == carrier.streamKeys.end()) {
+    return;
+  }
+  Stream& stream = streams_.at(keyIter->second);
+  TP_VLOG(7) << "Transport connection " << stream.id
+             << " was closed by its peer";
+  if (!stream.error) {
+    stream.error = TP_CREATE_ERROR(EOFError);
+  }
+  failPendingReadsIfErrored_(stream);
+}
+
+void Context::Impl::failCarrier_(uint64_t carrierKey, const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = carriers_.find(carrierKey);
+  Carrier carrier = std::move(iter->second);
+  carriers_.erase(iter);
+  TP_VLOG(7) << "Transport context " << id_ << " lost connection "
+             << carrierKey << ": " << error.what();
+  carrier.connection->close();
+
+  // Further connections to the same address will open a new carrier.
+  if (!carrier.addr.empty()) {
+    Peer& peer = peers_.at(carrier.addr);
+    peer.carrierKeys.erase(std::remove(
+        peer.carrierKeys.begin(), peer.carrierKeys.end(), carrierKey));
+    if (peer.carrierKeys.empty()) {
+      peers_.erase(carrier.addr);
+    } else {
+      peer.nextCarrierIdx %= peer.carrierKeys.size();
+    }
+  }
+
+  for (const auto& keyIter : carrier.streamKeys) {
+    Stream& stream = streams_.at(keyIter.second);
+    if (!stream.error) {
+      stream.error = error;
+    }
+    failPendingReadsIfErrored_(stream);
+  }
+}
+
+void Context::Impl::deliverPayload_(
+    PendingRead& read,
+    std::vector<uint8_t> payload) {
+  if (read.hasBuffer) {
+    TP_THROW_ASSERT_IF(read.length != payload.size())
+        << "Read of " << read.length << " bytes doesn't match the write of "
+        << payload.size() << " bytes";
+    if (!payload.empty()) {
+      std::memcpy(read.ptr, payload.data(), payload.size());
+    }
+    read.fn(Error::kSuccess, read.ptr, read.length);
+  } else {
+    read.fn(Error::kSuccess, payload.data(), payload.size());
+  }
+}
+
+void Context::Impl::failPendingReadsIfErrored_(Stream& stream) {
+  if (!stream.error || !stream.unreadPayloads.empty() ||
+      stream.numPayloadsBeingRead > 0) {
+    return;
+  }
+  while (!stream.pendingReads.empty()) {
+    PendingRead read = std::move(stream.pendingReads.front());
+    stream.pendingReads.pop_front();
+    read.fn(stream.error, nullptr, 0);
+  }
+}
+
+void Context::Impl::readFromConnection(
+    uint64_t streamKey,
+    transport::Connection::read_callback_fn fn) {
+  loop_.deferToLoop([this, streamKey, fn{std::move(fn)}]() mutable {
+    readFromStreamFromLoop_(
+        streamKey, PendingRead{/*hasBuffer=*/false, nullptr, 0, std::move(fn)});
+  });
+}
+
+void Context::Impl::readFromConnection(
+    uint64_t streamKey,
+    void* ptr,
+    size_t length,
+    transport::Connection::read_callback_fn fn) {
+  loop_.deferToLoop(
+      [this, streamKey, ptr, length, fn{std::move(fn)}]() mutable {
+        readFromStreamFromLoop_(
+            streamKey,
+            PendingRead{/*hasBuffer=*/true, ptr, length, std::move(fn)});
+      });
+}
+
+void Context::Impl::readFromStreamFromLoop_(
+    uint64_t streamKey,
+    PendingRead read) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = streams_.find(streamKey);
+  if (iter == streams_.end()) {
+    read.fn(TP_CREATE_ERROR(ConnectionClosedError), nullptr, 0);
+    return;
+  }
+  Stream& stream = iter->second;
+
+  if (!stream.unreadPayloads.empty()) {
+    std::vector<uint8_t> payload = std::move(stream.unreadPayloads.front());
+    stream.unreadPayloads.pop_front();
+    deliverPayload_(read, std::move(payload));
+    failPendingReadsIfErrored_(stream);
+    return;
+  }
+
+  stream.pendingReads.push_back(std::move(read));
+  failPendingReadsIfErrored_(stream);
+}
+
+void Context::Impl::writeToConnection(
+    uint64_t streamKey,
+    const void* ptr,
+    size_t length,
+    transport::Connection::write_callback_fn fn) {
+  loop_.deferToLoop(
+      [this, streamKey, ptr, length, fn{std::move(fn)}]() mutable {
+        writeToStreamFromLoop_(streamKey, ptr, length, std::move(fn));
+      });
+}
+
+void Context::Impl::writeToStreamFromLoop_(
+    uint64_t streamKey,
+    const void* ptr,
+    size_t length,
+    transport::Connection::write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = streams_.find(streamKey);
+  if (iter == streams_.end()) {
+    fn(TP_CREATE_ERROR(ConnectionClosedError));
+    return;
+  }
+  Stream& stream = iter->second;
+  if (stream.error) {
+    fn(stream.error);
+    return;
+  }
+
+  auto header = std::make_shared<NopHolder<FrameHeader>>();
+  header->getObject().streamId = stream.streamId;
+  header->getObject().type = kData;
+  carriers_.at(stream.carrierKey)
+      .connection->writev(
+          *header,
+          {transport::Connection::WriteBuffer{ptr, length}},
+          [impl{shared_from_this()}, header, fn{std::move(fn)}](
+              const Error& error) mutable {
+            impl->loop_.deferToLoop([fn{std::move(fn)}, error]() mutable {
+              fn(error);
+            });
+          });
+}
+
+void Context::Impl::setConnectionId(uint64_t streamKey, std::string id) {
+  loop_.deferToLoop([this, streamKey, id{std::move(id)}]() mutable {
+    auto iter = streams_.find(streamKey);
+    if (iter != streams_.end()) {
+      TP_VLOG(7) << "Transport connection " << iter->second.id
+                 << " was renamed to " << id;
+      iter->second.id = std::move(id);
+    }
+  });
+}
+
+void Context::Impl::closeConnection(uint64_t streamKey) {
+  loop_.deferToLoop([this, streamKey]() { closeStreamFromLoop_(streamKey); });
+}
+
+void Context::Impl::closeStreamFromLoop_(uint64_t streamKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = streams_.find(streamKey);
+  if (iter == streams_.end()) {
+    return;
+  }
+  Stream stream = std::move(iter->second);
+  streams_.erase(iter);
+  TP_VLOG(7) << "Transport connection " << stream.id << " is closing";
+
+  // Tell the peer, unless the carrier is gone. Any data of the stream that is
+  // still in flight will be discarded on arrival.
+  auto carrierIter = carriers_.find(stream.carrierKey);
+  if (carrierIter != carriers_.end() &&
+      carrierIter->second.streamKeys.erase(stream.streamId) > 0) {
+    writeFrame_(carrierIter->second, stream.streamId, kCloseStream);
+  }
+
+  stream.error = TP_CREATE_ERROR(ConnectionClosedError);
+  stream.unreadPayloads.clear();
+  stream.numPayloadsBeingRead = 0;
+  failPendingReadsIfErrored_(stream);
+}
+
+void Context::Impl::acceptFromListener(
+    uint64_t listenerKey,
+    transport::Listener::accept_callback_fn fn) {
+  loop_.deferToLoop([this, listenerKey, fn{std::move(fn)}]() mutable {
+    acceptFromListenerFromLoop_(listenerKey, std::move(fn));
+  });
+}
+
+void Context::Impl::acceptFromListenerFromLoop_(
+    uint64_t listenerKey,
+    transport::Listener::accept_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    fn(TP_CREATE_ERROR(ListenerClosedError),
+       std::shared_ptr<transport::Connection>());
+    return;
+  }
+  ListenerState& state = iter->second;
+
+  if (!state.pendingConnections.empty()) {
+    std::shared_ptr<transport::Connection> connection =
+        std::move(state.pendingConnections.front());
+    state.pendingConnections.pop_front();
+    fn(Error::kSuccess, std::move(connection));
+  } else if (state.error) {
+    fn(state.error, std::shared_ptr<transport::Connection>());
+  } else {
+    state.pendingAccepts.push_back(std::move(fn));
+  }
+}
+
+void Context::Impl::setListenerId(uint64_t listenerKey, std::string id) {
+  loop_.deferToLoop([this, listenerKey, id{std::move(id)}]() mutable {
+    auto iter = listeners_.find(listenerKey);
+    if (iter != listeners_.end()) {
+      TP_VLOG(7) << "Transport listener " << iter->second.id
+                 << " was renamed to " << id;
+      iter->second.listener->setId(id + ".inner");
+      iter->second.id = std::move(id);
+    }
+  });
+}
+
+void Context::Impl::closeListener(uint64_t listenerKey) {
+  loop_.deferToLoop(
+      [this, listenerKey]() { closeListenerFromLoop_(listenerKey); });
+}
+
+void Context::Impl::closeListenerFromLoop_(uint64_t listenerKey) {
+  TP_DCHECK(loop_.inLoop());
+
+  auto iter = listeners_.find(listenerKey);
+  if (iter == listeners_.end()) {
+    return;
+  }
+  ListenerState state = std::move(iter->second);
+  listeners_.erase(iter);
+  TP_VLOG(7) << "Transport listener " << state.id << " is closing";
+
+  // The connections it already accepted, and their sub-streams, remain open.
+  state.listener->close();
+  while (!state.pendingAccepts.empty()) {
+    transport::Listener::accept_callback_fn fn =
+        std::move(state.pendingAccepts.front());
+    state.pendingAccepts.pop_front();
+    fn(TP_CREATE_ERROR(ListenerClosedError),
+       std::shared_ptr<transport::Connection>());
+  }
+}
+
+bool Context::isViable() const {
+  return impl_->isViable();
+}
+
+bool Context::Impl::isViable() const {
+  return context_->isViable();
+}
+
+const std::string& Context::domainDescriptor() const {
+  return impl_->domainDescriptor();
+}
+
+const std::string& Context::Impl::domainDescriptor() const {
+  return domainDescriptor_;
+}
+
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  return impl_->canCommunicateWithRemote(remoteDomainDescriptor);
+}
+
+bool Context::Impl::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  // Let the underlying transport judge what comes after our prefix.
+  if (remoteDomainDescriptor.compare(
+          0, kDomainDescriptorPrefix.size(), kDomainDescriptorPrefix) != 0) {
+    return false;
+  }
+  return context_->canCommunicateWithRemote(
+      remoteDomainDescriptor.substr(kDomainDescriptorPrefix.size()));
+}
+
+void Context::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Context::Impl::setId(std::string id) {
+  TP_VLOG(7) << "Transport context " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+  context_->setId(id_ + ".inner");
+}
+
+void Context::close() {
+  impl_->close();
+}
+
+void Context::Impl::close() {
+  if (!closed_.exchange(true)) {
+    TP_VLOG(7) << "Transport context " << id_ << " is closing";
+
+    loop_.runInLoop([this]() { closeFromLoop_(); });
+
+    TP_VLOG(7) << "Transport context " << id_ << " done closing";
+  }
+}
+
+void Context::Impl::closeFromLoop_() {
+  TP_DCHECK(loop_.inLoop());
+
+  std::vector<uint64_t> listenerKeys;
+  for (const auto& iter : listeners_) {
+    listenerKeys.push_back(iter.first);
+  }
+  for (uint64_t listenerKey : listenerKeys) {
+    closeListenerFromLoop_(listenerKey);
+  }
+
+  // This causes all the pending reads of the carriers to fail, which in turn
+  // fails the sub-streams.
+  for (auto& iter : carriers_) {
+    iter.second.connection->close();
+  }
+
+  context_->close();
+}
+
+void Context::join() {
+  impl_->join();
+}
+
+void Context::Impl::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    TP_VLOG(7) << "Transport context " << id_ << " is joining";
+
+    // The underlying transport only returns once it has fired all callbacks,
+    // all of which defer to the loop, which is then left to run them.
+    context_->join();
+    loop_.join();
+
+    TP_VLOG(7) << "Transport context " << id_ << " done joining";
+  }
+}
+
+Context::~Context() {
+  join();
+}
+
+} // namespace mux
+} // namespace transport
+} // namespace tensorpipe
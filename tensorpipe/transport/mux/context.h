@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace mux {
+
+// A transport that wraps another one, so that all the connections opened by
+// this context to the same address (e.g., those of all the pipes, and of their
+// channels, towards the same remote listener) are carried as framed sub-streams
+// over a pool of at most numConnectionsPerPeer connections of the underlying
+// transport, rather than each getting one of its own. This saves the sockets,
+// rings and registrations that each of them would otherwise use, and opening a
+// connection to a peer that is already connected to costs a single message.
+//
+// The peer must also use this transport, on top of the same underlying one.
+// Sub-streams share the bandwidth and the ordering of their connection, hence
+// a large write on one of them delays the ones that follow on the others.
+class Context final : public transport::Context {
+ public:
+  explicit Context(
+      std::shared_ptr<transport::Context> context,
+      size_t numConnectionsPerPeer = 1);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the
+  // interface that layered::Connection and layered::Listener go through).
+  // However, its lifetime is tied to the one of this public object, since when
+  // the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace mux
+} // namespace transport
+} // namespace tensorpipe
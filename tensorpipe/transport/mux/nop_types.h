@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include <nop/serializer.h>
+#include <nop/structure.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace mux {
+
+enum FrameType : uint8_t {
+  // Sent by the connecting side to open a sub-stream, which the listening side
+  // then hands out as a new connection.
+  kOpenStream = 0,
+  // Followed by one payload, which is what was written to the sub-stream.
+  kData = 1,
+  // Sent by either side once it closed its end of the sub-stream.
+  kCloseStream = 2,
+};
+
+// The header of every frame sent over an underlying connection. Sub-streams are
+// identified by a number chosen by the connecting side, which is unique within
+// the underlying connection.
+struct FrameHeader {
+  uint64_t streamId;
+  uint8_t type;
+  NOP_STRUCTURE(FrameHeader, streamId, type);
+};
+
+} // namespace mux
+} // namespace transport
+} // namespace tensorpipe
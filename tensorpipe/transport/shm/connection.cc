@@ -11,6 +11,7 @@
 #include <string.h>
 
 #include <deque>
+#include <sstream>
 #include <vector>
 
 #include <tensorpipe/common/callback.h>
@@ -24,7 +25,6 @@
 #include <tensorpipe/transport/shm/sockaddr.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
-#include <tensorpipe/util/ringbuffer/shm.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -32,7 +32,9 @@ namespace shm {
 
 namespace {
 
-constexpr auto kBufferSize = 2 * 1024 * 1024;
+// How many bytes a connection with a weight of one may write to its outbox
+// each time its turn comes.
+constexpr size_t kWriteQuantum = 256 * 1024;
 
 } // namespace
 
@@ -66,19 +68,35 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   void read(AbstractNopHolder& object, read_nop_callback_fn fn);
   void read(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn);
   void write(const AbstractNopHolder& object, write_callback_fn fn);
 
+  // Perform multiple write operations at once, optionally starting with a nop
+  // object (if not null).
+  void writev(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
   // Tell the connection what its identifier is.
   void setId(std::string id);
 
+  void setWriteWeight(uint32_t weight);
+
+  void dumpState(dump_state_callback_fn fn);
+
   // Shut down the connection and its resources.
   void close();
 
   // Implementation of EventHandler.
   void handleEventsFromLoop(int events) override;
 
+  ~Impl() override;
+
  private:
   // Initialize member fields that need `shared_from_this`.
   void initFromLoop();
@@ -88,12 +106,25 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   void readFromLoop(AbstractNopHolder& object, read_nop_callback_fn fn);
   void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
   void writeFromLoop(const AbstractNopHolder& object, write_callback_fn fn);
 
+  // Perform multiple write operations at once.
+  void writevFromLoop(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
   void setIdFromLoop_(std::string id);
 
+  void setWriteWeightFromLoop_(uint32_t weight);
+
+  std::string dumpStateFromLoop_();
+
   // Shut down the connection and its resources.
   void closeFromLoop();
 
@@ -141,6 +172,22 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   // Pending write operations.
   std::deque<RingbufferWriteOperation> writeOperations_;
 
+  // The writes of all the connections of the context are copied by the same
+  // reactor, which is shared among them by deficit round-robin: each turn, a
+  // connection may write up to its weight times the quantum, and if it still
+  // has data to write it then defers the rest to its next turn, which comes
+  // after the other connections had theirs, rather than holding on to the
+  // reactor until it's done. New writes that come in meanwhile wait for it.
+  uint32_t writeWeight_{1};
+  int64_t writeDeficit_{0};
+  bool isWaitingForWriteTurn_{false};
+
+  // Whether the writes are processed together at the end of the iteration of
+  // the loop in which they came in, rather than each one as soon as it does.
+  // If so, whether that's already scheduled.
+  bool coalesceWrites_{false};
+  bool isWaitingForEndOfIteration_{false};
+
   // A sequence number for the calls to read.
   uint64_t nextBufferBeingRead_{0};
 
@@ -180,6 +227,10 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
   // a new write operation is queued.
   void processWriteOperationsFromLoop();
 
+  // Called when new write operations are queued, to process them right away or,
+  // when coalescing writes, once all those of this iteration are in.
+  void scheduleWriteOperationsFromLoop_();
+
   void setError_(Error error);
 
   // Deal with an error.
@@ -245,10 +296,18 @@ Connection::Impl::Impl(
       closingReceiver_(context_, context_->getClosingEmitter()),
       id_(std::move(id)) {}
 
+Connection::Impl::~Impl() {
+  // The inbox is only unmapped after this, but it can't be used anymore.
+  if (inboxRb_.getData() != nullptr) {
+    context_->countInboxReleased();
+  }
+}
+
 void Connection::Impl::initFromLoop() {
   TP_DCHECK(context_->inLoop());
 
   closingReceiver_.activate(*this);
+  coalesceWrites_ = context_->coalescesWrites();
 
   Error error;
   // The connection either got a socket or an address, but not both.
@@ -275,7 +334,7 @@ void Connection::Impl::initFromLoop() {
 
   // Create ringbuffer for inbox.
   std::tie(inboxHeaderSegment_, inboxDataSegment_, inboxRb_) =
-      util::ringbuffer::shm::create(kBufferSize);
+      context_->takeInbox();
 
   // Register method to be called when our peer writes to our inbox.
   inboxReactorToken_ = context_->addReaction(runIfAlive(*this, [](Impl& impl) {
@@ -432,6 +491,74 @@ void Connection::Impl::readFromLoop(
   processReadOperationsFromLoop();
 }
 
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  // If the inbox already contains some data, we may be able to process these
+  // operations right away.
+  processReadOperationsFromLoop();
+}
+
 void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
   impl_->write(ptr, length, std::move(fn));
 }
@@ -474,7 +601,7 @@ void Connection::Impl::writeFromLoop(
 
   // If the outbox has some free space, we may be able to process this operation
   // right away.
-  processWriteOperationsFromLoop();
+  scheduleWriteOperationsFromLoop_();
 }
 
 void Connection::write(const AbstractNopHolder& object, write_callback_fn fn) {
@@ -520,7 +647,85 @@ void Connection::Impl::writeFromLoop(
 
   // If the outbox has some free space, we may be able to process this operation
   // right away.
-  processWriteOperationsFromLoop();
+  scheduleWriteOperationsFromLoop_();
+}
+
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(nullptr, std::move(buffers), std::move(fn));
+}
+
+void Connection::writev(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(&object, std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         object,
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(object, std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::writevFromLoop(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(object != nullptr || !buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing "
+             << (object != nullptr ? "a nop object and " : "")
+             << buffers.size() << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  if (object != nullptr) {
+    if (buffers.empty()) {
+      writeOperations_.emplace_back(object, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(object, [](const Error& /* unused */) {});
+    }
+  }
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  // If the outbox has some free space, we may be able to process these
+  // operations right away.
+  scheduleWriteOperationsFromLoop_();
 }
 
 void Connection::setId(std::string id) {
@@ -540,6 +745,53 @@ void Connection::Impl::setIdFromLoop_(std::string id) {
   id_ = std::move(id);
 }
 
+void Connection::setWriteWeight(uint32_t weight) {
+  impl_->setWriteWeight(weight);
+}
+
+void Connection::Impl::setWriteWeight(uint32_t weight) {
+  context_->deferToLoop([impl{shared_from_this()}, weight]() {
+    impl->setWriteWeightFromLoop_(weight);
+  });
+}
+
+void Connection::Impl::setWriteWeightFromLoop_(uint32_t weight) {
+  TP_DCHECK(context_->inLoop());
+  TP_THROW_ASSERT_IF(weight == 0) << "The write weight must be positive";
+  writeWeight_ = weight;
+}
+
+void Connection::dumpState(dump_state_callback_fn fn) {
+  impl_->dumpState(std::move(fn));
+}
+
+void Connection::Impl::dumpState(dump_state_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        fn(impl->dumpStateFromLoop_());
+      });
+}
+
+std::string Connection::Impl::dumpStateFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  std::ostringstream oss;
+  oss << "pending_reads=" << readOperations_.size()
+      << " pending_writes=" << writeOperations_.size();
+  if (error_) {
+    oss << " failed";
+  } else if (state_ != ESTABLISHED) {
+    oss << " connecting";
+  } else {
+    const util::ringbuffer::RingBufferHeader& inbox = inboxRb_.getHeader();
+    const util::ringbuffer::RingBufferHeader& outbox = outboxRb_.getHeader();
+    oss << " inbox=" << inbox.getUsedSize() << "/" << inbox.kDataPoolByteSize
+        << " outbox=" << outbox.getUsedSize() << "/"
+        << outbox.kDataPoolByteSize
+        << " waiting_for_write_turn=" << isWaitingForWriteTurn_;
+  }
+  return oss.str();
+}
+
 void Connection::Impl::handleEventsFromLoop(int events) {
   TP_DCHECK(context_->inLoop());
   TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
@@ -593,6 +845,8 @@ void Connection::Impl::handleEventInFromLoop() {
   if (state_ == RECV_FDS) {
     Fd reactorHeaderFd;
     Fd reactorDataFd;
+    Fd reactorSleepWordFd;
+    Fd reactorEventFd;
     Fd outboxHeaderFd;
     Fd outboxDataFd;
     Reactor::TToken peerInboxReactorToken;
@@ -604,6 +858,8 @@ void Connection::Impl::handleEventInFromLoop() {
         peerOutboxReactorToken,
         reactorHeaderFd,
         reactorDataFd,
+        reactorSleepWordFd,
+        reactorEventFd,
         outboxHeaderFd,
         outboxDataFd);
     if (err) {
@@ -613,12 +869,15 @@ void Connection::Impl::handleEventInFromLoop() {
 
     // Load ringbuffer for outbox.
     std::tie(outboxHeaderSegment_, outboxDataSegment_, outboxRb_) =
-        util::ringbuffer::shm::load(
+        context_->loadOutbox(
             std::move(outboxHeaderFd), std::move(outboxDataFd));
 
     // Initialize remote reactor trigger.
     peerReactorTrigger_.emplace(
-        std::move(reactorHeaderFd), std::move(reactorDataFd));
+        std::move(reactorHeaderFd),
+        std::move(reactorDataFd),
+        std::move(reactorSleepWordFd),
+        std::move(reactorEventFd));
 
     peerInboxReactorToken_ = peerInboxReactorToken;
     peerOutboxReactorToken_ = peerOutboxReactorToken;
@@ -649,7 +908,11 @@ void Connection::Impl::handleEventOutFromLoop() {
   if (state_ == SEND_FDS) {
     int reactorHeaderFd;
     int reactorDataFd;
-    std::tie(reactorHeaderFd, reactorDataFd) = context_->reactorFds();
+    int reactorSleepWordFd;
+    int reactorEventFd;
+    std::tie(
+        reactorHeaderFd, reactorDataFd, reactorSleepWordFd, reactorEventFd) =
+        context_->reactorFds();
 
     // Send our reactor token, reactor fds, and inbox fds.
     auto err = socket_.sendPayloadAndFds(
@@ -657,6 +920,8 @@ void Connection::Impl::handleEventOutFromLoop() {
         outboxReactorToken_.value(),
         reactorHeaderFd,
         reactorDataFd,
+        reactorSleepWordFd,
+        reactorEventFd,
         inboxHeaderSegment_.getFd(),
         inboxDataSegment_.getFd());
     if (err) {
@@ -683,37 +948,130 @@ void Connection::Impl::processReadOperationsFromLoop() {
   }
   // Serve read operations
   util::ringbuffer::Consumer inboxConsumer(inboxRb_);
-  while (!readOperations_.empty()) {
-    RingbufferReadOperation& readOperation = readOperations_.front();
-    if (readOperation.handleRead(inboxConsumer) > 0) {
-      peerReactorTrigger_->run(peerOutboxReactorToken_.value());
+  bool readSomething = false;
+  bool armed = false;
+  for (;;) {
+    bool progress = false;
+    while (!readOperations_.empty()) {
+      RingbufferReadOperation& readOperation = readOperations_.front();
+      if (readOperation.handleRead(
+              inboxConsumer, context_->getCopyEngine()) > 0) {
+        progress = true;
+      }
+      if (readOperation.completed()) {
+        readOperations_.pop_front();
+      } else {
+        break;
+      }
     }
-    if (readOperation.completed()) {
-      readOperations_.pop_front();
-    } else {
+    readSomething = readSomething || progress;
+    if (readOperations_.empty() || (armed && !progress)) {
       break;
     }
+    // We ran out of data: ask the peer to trigger us when it writes more, and
+    // go through the inbox once more in case it did so before seeing that.
+    inboxRb_.getHeader().armConsumerTrigger();
+    armed = true;
+  }
+  // Let the peer know about all the space we freed up at once, if it's waiting
+  // for it.
+  if (readSomething && inboxRb_.getHeader().takeProducerTrigger()) {
+    peerReactorTrigger_->run(peerOutboxReactorToken_.value());
   }
 }
 
 void Connection::Impl::processWriteOperationsFromLoop() {
   TP_DCHECK(context_->inLoop());
 
-  if (state_ != ESTABLISHED) {
+  if (state_ != ESTABLISHED || isWaitingForWriteTurn_) {
     return;
   }
 
+  // The deficit left over from an earlier turn that was cut short because the
+  // outbox was full doesn't add up over more than one quantum.
+  const int64_t quantum = static_cast<int64_t>(kWriteQuantum) * writeWeight_;
+  writeDeficit_ = std::min(writeDeficit_ + quantum, quantum);
+
+  // Notify the peer only once, after all the operations that can be processed
+  // now have been written, rather than once per operation, and only if it's
+  // waiting for data (i.e., on its transition from idle to active), as
+  // otherwise it will find the data on its own.
+  bool wroteSomething = false;
+  bool armed = false;
+  bool yielded = false;
   util::ringbuffer::Producer outboxProducer(outboxRb_);
-  while (!writeOperations_.empty()) {
-    RingbufferWriteOperation& writeOperation = writeOperations_.front();
-    if (writeOperation.handleWrite(outboxProducer) > 0) {
-      peerReactorTrigger_->run(peerInboxReactorToken_.value());
+  for (;;) {
+    bool progress = false;
+    // When coalescing, the frames are all published in a single transaction,
+    // hence the peer sees them at once, and only its head moves once. This is
+    // safe because the write callbacks can't start new writes synchronously.
+    if (coalesceWrites_) {
+      ssize_t ret = outboxProducer.startTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
     }
-    if (writeOperation.completed()) {
-      writeOperations_.pop_front();
-    } else {
+    while (!writeOperations_.empty() && writeDeficit_ > 0) {
+      RingbufferWriteOperation& writeOperation = writeOperations_.front();
+      const size_t numBytesWritten = coalesceWrites_
+          ? writeOperation.handleWriteInTx(outboxProducer, writeDeficit_)
+          : writeOperation.handleWrite(outboxProducer, writeDeficit_);
+      if (numBytesWritten > 0) {
+        progress = true;
+      }
+      writeDeficit_ -= numBytesWritten;
+      if (writeOperation.completed()) {
+        writeOperations_.pop_front();
+      } else {
+        break;
+      }
+    }
+    if (coalesceWrites_) {
+      ssize_t ret = outboxProducer.commitTx();
+      TP_THROW_SYSTEM_IF(ret < 0, -ret);
+    }
+    wroteSomething = wroteSomething || progress;
+    if (writeOperations_.empty() || (armed && !progress)) {
+      break;
+    }
+    if (writeDeficit_ <= 0) {
+      yielded = true;
       break;
     }
+    // The outbox is full: ask the peer to trigger us when it reads from it,
+    // and go through it once more in case it did so before seeing that.
+    context_->countRingFullStall();
+    outboxRb_.getHeader().armProducerTrigger();
+    armed = true;
+  }
+  if (wroteSomething && outboxRb_.getHeader().takeConsumerTrigger()) {
+    peerReactorTrigger_->run(peerInboxReactorToken_.value());
+  }
+  if (writeOperations_.empty()) {
+    writeDeficit_ = 0;
+  }
+  if (yielded) {
+    isWaitingForWriteTurn_ = true;
+    context_->deferToLoop([impl{shared_from_this()}]() {
+      impl->isWaitingForWriteTurn_ = false;
+      impl->processWriteOperationsFromLoop();
+    });
+  }
+}
+
+void Connection::Impl::scheduleWriteOperationsFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+
+  if (!coalesceWrites_) {
+    processWriteOperationsFromLoop();
+    return;
+  }
+  // The deferred functions that are already queued, which include the other
+  // writes of this iteration, run before this one.
+  if (!isWaitingForEndOfIteration_) {
+    isWaitingForEndOfIteration_ = true;
+    context_->deferToLoop([impl{shared_from_this()}]() {
+      impl->isWaitingForEndOfIteration_ = false;
+      impl->processWriteOperationsFromLoop();
+    });
   }
 }
 
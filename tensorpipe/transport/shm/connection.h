@@ -10,6 +10,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <tensorpipe/transport/connection.h>
 #include <tensorpipe/transport/shm/context.h>
@@ -48,13 +49,29 @@ class Connection final : public transport::Connection {
   void read(AbstractNopHolder& object, read_nop_callback_fn fn) override;
   void read(void* ptr, size_t length, read_callback_fn fn) override;
 
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) override;
+
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn) override;
   void write(const AbstractNopHolder& object, write_callback_fn fn) override;
 
+  // Perform multiple write operations at once.
+  void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn) override;
+  void writev(
+      const AbstractNopHolder& object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn) override;
+
   // Tell the connection what its identifier is.
   void setId(std::string id) override;
 
+  // Tell the connection how large a share of the reactor's time it gets.
+  void setWriteWeight(uint32_t weight) override;
+
+  // Report the occupancy of the inbox and outbox rings.
+  void dumpState(dump_state_callback_fn fn) override;
+
   // Shut down the connection and its resources.
   void close() override;
 
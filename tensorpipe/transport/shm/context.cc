@@ -8,12 +8,21 @@
 
 #include <tensorpipe/transport/shm/context.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include <tensorpipe/common/cpu_budget.h>
 #include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/shm/connection.h>
 #include <tensorpipe/transport/shm/context_impl.h>
 #include <tensorpipe/transport/shm/listener.h>
 #include <tensorpipe/transport/shm/reactor.h>
+#include <tensorpipe/util/ringbuffer/shm.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -25,10 +34,133 @@ namespace {
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"shm:"};
 
-std::string generateDomainDescriptor() {
+// Appended to the domain descriptor when the context is bound to a NUMA node.
+// What comes before it identifies the machine, and must match for two contexts
+// to be able to connect.
+const std::string kNumaNodeInfix{":numa"};
+
+std::string generateDomainDescriptor(optional<int> numaNode) {
   auto bootID = getBootID();
   TP_THROW_ASSERT_IF(!bootID) << "Unable to read boot_id";
-  return kDomainDescriptorPrefix + bootID.value();
+  std::string domainDescriptor = kDomainDescriptorPrefix + bootID.value();
+  if (numaNode.has_value()) {
+    domainDescriptor += kNumaNodeInfix + std::to_string(numaNode.value());
+  }
+  return domainDescriptor;
+}
+
+std::string stripNumaNode(const std::string& domainDescriptor) {
+  return domainDescriptor.substr(0, domainDescriptor.find(kNumaNodeInfix));
+}
+
+ContextOptions resolveOptions(ContextOptions options) {
+  options.validate();
+  // Under a CPU budget, all the contexts use the same reactor, so that their
+  // number doesn't multiply the threads that poll.
+  if (getCpuBudget().has_value()) {
+    options.shareThreads = true;
+  }
+  return options;
+}
+
+optional<int> resolveNumaNode(int numaNode) {
+  if (numaNode == Context::kNoNumaNode) {
+    return nullopt;
+  }
+  if (numaNode == Context::kNumaNodeOfCaller) {
+    return getNumaNodeOfCurrentCpu();
+  }
+  TP_THROW_ASSERT_IF(numaNode < 0) << "Invalid NUMA node " << numaNode;
+  return numaNode;
+}
+
+// The threads that do a context's work: the reactor, and the loop that waits
+// for events on the sockets. Either a single context owns them, or all those
+// of the process that share threads do.
+struct Threads {
+  Threads(
+      BusyPollingPolicy policy,
+      size_t reactorSize,
+      bool useHugePages,
+      optional<int> numaNode,
+      bool pollEpollFromReactor,
+      bool sleepOnEventFd)
+      : reactor(
+            std::move(policy),
+            useHugePages,
+            numaNode,
+            sleepOnEventFd,
+            reactorSize),
+        loop(
+            reactor,
+            numaNode.has_value() ? getCpusOfNumaNode(numaNode.value())
+                                 : std::vector<int>(),
+            EpollLoop::kDefaultBatchSize,
+            pollEpollFromReactor) {
+    if (pollEpollFromReactor) {
+      reactor.pollEpollLoop(loop);
+    }
+  }
+
+  ~Threads() {
+    loop.join();
+    reactor.join();
+  }
+
+  Reactor reactor;
+  EpollLoop loop;
+};
+
+std::shared_ptr<Threads> createThreads(
+    BusyPollingPolicy policy,
+    size_t reactorSize,
+    bool useHugePages,
+    optional<int> numaNode,
+    bool pollEpollFromReactor,
+    bool sleepOnEventFd) {
+  return std::shared_ptr<Threads>(
+      new Threads(
+          std::move(policy),
+          reactorSize,
+          useHugePages,
+          numaNode,
+          pollEpollFromReactor,
+          sleepOnEventFd),
+      [](Threads* threads) {
+        // The last reference may be dropped by the reactor itself (e.g., when
+        // it destroys a connection) and a thread can't join itself.
+        if (threads->reactor.inLoop()) {
+          std::thread([threads]() { delete threads; }).detach();
+        } else {
+          delete threads;
+        }
+      });
+}
+
+// The threads shared by the contexts of the process, which are created by the
+// first one that needs them, and live until the last one lets go of them.
+std::shared_ptr<Threads> getSharedThreads(
+    BusyPollingPolicy policy,
+    size_t reactorSize,
+    bool useHugePages,
+    optional<int> numaNode,
+    bool pollEpollFromReactor,
+    bool sleepOnEventFd) {
+  static std::mutex mutex;
+  static std::weak_ptr<Threads> weakThreads;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::shared_ptr<Threads> threads = weakThreads.lock();
+  if (threads == nullptr) {
+    threads = createThreads(
+        std::move(policy),
+        reactorSize,
+        useHugePages,
+        numaNode,
+        pollEpollFromReactor,
+        sleepOnEventFd);
+    weakThreads = threads;
+  }
+  return threads;
 }
 
 } // namespace
@@ -36,10 +168,17 @@ std::string generateDomainDescriptor() {
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  explicit Impl(ContextOptions options);
 
   const std::string& domainDescriptor() const;
 
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const;
+
+  std::map<std::string, uint64_t> getStats() const;
+
+  const ContextOptions& getOptions() const;
+
   std::shared_ptr<transport::Connection> connect(std::string addr);
 
   std::shared_ptr<transport::Listener> listen(std::string addr);
@@ -50,7 +189,7 @@ class Context::Impl : public Context::PrivateIface,
 
   bool inLoop() override;
 
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
 
   void registerDescriptor(
       int fd,
@@ -63,7 +202,21 @@ class Context::Impl : public Context::PrivateIface,
 
   void removeReaction(TToken token) override;
 
-  std::tuple<int, int> reactorFds() override;
+  std::tuple<int, int, int, int> reactorFds() override;
+
+  Ring takeInbox() override;
+
+  Ring loadOutbox(Fd headerFd, Fd dataFd) override;
+
+  void countInboxReleased() override;
+
+  void countRingFullStall() override;
+
+  DsaCopyEngine* getCopyEngine() override;
+
+  bool coalescesWrites() const override;
+
+  int getListenBacklog() const override;
 
   void close();
 
@@ -72,14 +225,50 @@ class Context::Impl : public Context::PrivateIface,
   ~Impl() override = default;
 
  private:
-  Reactor reactor_;
-  EpollLoop loop_{this->reactor_};
+  const ContextOptions options_;
+
+  // Resolved before the reactor is constructed, as the latter depends on it.
+  const optional<int> numaNode_;
+
+  const bool sharesThreads_;
+  const std::shared_ptr<Threads> threads_;
+  Reactor& reactor_;
+  EpollLoop& loop_;
+
+  // The reactions and descriptors that this context's connections and
+  // listeners currently have, which a context that shares its threads must
+  // wait for them to remove before it's done joining.
+  std::mutex ownWorkMutex_;
+  std::condition_variable ownWorkCv_;
+  uint64_t numOwnReactions_{0};
+  std::unordered_set<int> ownDescriptors_;
+
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   ClosingEmitter closingEmitter_;
 
   std::string domainDescriptor_;
 
+  const size_t inboxSize_;
+  const bool useHugePages_;
+  const bool prefaultRings_;
+  const bool lockRings_;
+  std::atomic<bool> warnedAboutLocking_{false};
+
+  // Only set if offloading was requested and a copy engine is available.
+  const std::shared_ptr<DsaCopyEngine> copyEngine_;
+
+  const bool coalesceWrites_;
+
+  // Inboxes created ahead of time, by a thread of their own, so that new
+  // connections don't have to. Guarded by the mutex.
+  const size_t numSpareInboxes_;
+  std::mutex spareInboxesMutex_;
+  std::condition_variable spareInboxesCv_;
+  std::deque<Ring> spareInboxes_;
+  std::thread spareInboxesThread_;
+  std::atomic<uint64_t> numSpareInboxesTaken_{0};
+
   // An identifier for the context, composed of the identifier for the context,
   // combined with the transport's name. It will only be used for logging and
   // debugging purposes.
@@ -90,11 +279,83 @@ class Context::Impl : public Context::PrivateIface,
   // will only be used for logging and debugging.
   std::atomic<uint64_t> listenerCounter_{0};
   std::atomic<uint64_t> connectionCounter_{0};
-};
 
-Context::Context() : impl_(std::make_shared<Impl>()) {}
+  std::atomic<uint64_t> numRingFullStalls_{0};
+
+  // The inboxes that were created, spare ones included, and not destroyed yet.
+  std::atomic<uint64_t> numInboxes_{0};
 
-Context::Impl::Impl() : domainDescriptor_(generateDomainDescriptor()) {}
+  Ring createInbox_();
+  void prefaultRing_(Ring& ring);
+  void replenishSpareInboxes_();
+};
+
+Context::Context(ContextOptions options)
+    : impl_(std::make_shared<Impl>(std::move(options))) {}
+
+Context::Context(
+    BusyPollingPolicy policy,
+    size_t inboxSize,
+    bool useHugePages,
+    int numaNode,
+    bool pollEpollFromReactor,
+    bool shareThreads,
+    bool sleepOnEventFd,
+    size_t numSpareInboxes,
+    bool prefaultRings,
+    bool lockRings,
+    bool copyOffload,
+    bool coalesceWrites)
+    : impl_(std::make_shared<Impl>([&]() {
+        ContextOptions options;
+        options.policy = std::move(policy);
+        options.inboxSize = inboxSize;
+        options.useHugePages = useHugePages;
+        options.numaNode = numaNode;
+        options.pollEpollFromReactor = pollEpollFromReactor;
+        options.shareThreads = shareThreads;
+        options.sleepOnEventFd = sleepOnEventFd;
+        options.numSpareInboxes = numSpareInboxes;
+        options.prefaultRings = prefaultRings;
+        options.lockRings = lockRings;
+        options.copyOffload = copyOffload;
+        options.coalesceWrites = coalesceWrites;
+        return options;
+      }())) {}
+
+Context::Impl::Impl(ContextOptions options)
+    : options_(resolveOptions(std::move(options))),
+      numaNode_(resolveNumaNode(options_.numaNode)),
+      sharesThreads_(options_.shareThreads),
+      threads_(
+          options_.shareThreads ? getSharedThreads(
+                                      options_.policy,
+                                      options_.reactorSize,
+                                      options_.useHugePages,
+                                      numaNode_,
+                                      options_.pollEpollFromReactor,
+                                      options_.sleepOnEventFd)
+                                : createThreads(
+                                      options_.policy,
+                                      options_.reactorSize,
+                                      options_.useHugePages,
+                                      numaNode_,
+                                      options_.pollEpollFromReactor,
+                                      options_.sleepOnEventFd)),
+      reactor_(threads_->reactor),
+      loop_(threads_->loop),
+      domainDescriptor_(generateDomainDescriptor(numaNode_)),
+      inboxSize_(options_.inboxSize),
+      useHugePages_(options_.useHugePages),
+      prefaultRings_(options_.prefaultRings),
+      lockRings_(options_.lockRings),
+      copyEngine_(options_.copyOffload ? DsaCopyEngine::create() : nullptr),
+      coalesceWrites_(options_.coalesceWrites),
+      numSpareInboxes_(options_.numSpareInboxes) {
+  if (numSpareInboxes_ > 0) {
+    spareInboxesThread_ = std::thread(&Impl::replenishSpareInboxes_, this);
+  }
+}
 
 void Context::close() {
   impl_->close();
@@ -105,8 +366,14 @@ void Context::Impl::close() {
     TP_VLOG(7) << "Transport context " << id_ << " is closing";
 
     closingEmitter_.close();
-    loop_.close();
-    reactor_.close();
+    if (!sharesThreads_) {
+      loop_.close();
+      reactor_.close();
+    }
+    {
+      std::unique_lock<std::mutex> lock(spareInboxesMutex_);
+      spareInboxesCv_.notify_all();
+    }
 
     TP_VLOG(7) << "Transport context " << id_ << " done closing";
   }
@@ -122,8 +389,21 @@ void Context::Impl::join() {
   if (!joined_.exchange(true)) {
     TP_VLOG(7) << "Transport context " << id_ << " is joining";
 
-    loop_.join();
-    reactor_.join();
+    if (sharesThreads_) {
+      // The threads keep running for the other contexts, hence just wait for
+      // this one's connections and listeners to be gone from them.
+      std::unique_lock<std::mutex> lock(ownWorkMutex_);
+      ownWorkCv_.wait(lock, [&]() {
+        return numOwnReactions_ == 0 && ownDescriptors_.empty();
+      });
+    } else {
+      loop_.join();
+      reactor_.join();
+    }
+    if (spareInboxesThread_.joinable()) {
+      spareInboxesThread_.join();
+    }
+    spareInboxes_.clear();
 
     TP_VLOG(7) << "Transport context " << id_ << " done joining";
   }
@@ -172,6 +452,46 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+bool Context::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  return impl_->canCommunicateWithRemote(remoteDomainDescriptor);
+}
+
+bool Context::Impl::canCommunicateWithRemote(
+    const std::string& remoteDomainDescriptor) const {
+  // The NUMA node only tells where the rings live, any two processes on the
+  // same machine can connect.
+  return stripNumaNode(domainDescriptor_) ==
+      stripNumaNode(remoteDomainDescriptor);
+}
+
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() const {
+  return {
+      {"polls", reactor_.getNumPolls()},
+      {"empty_polls", reactor_.getNumEmptyPolls()},
+      {"deferred_functions",
+       static_cast<uint64_t>(
+           std::max<int64_t>(reactor_.getNumDeferredFunctions(), 0))},
+      {"ring_full_stalls", numRingFullStalls_.load(std::memory_order_relaxed)},
+      {"spare_inboxes_taken",
+       numSpareInboxesTaken_.load(std::memory_order_relaxed)},
+      {"memory.inboxes",
+       numInboxes_.load(std::memory_order_relaxed) * inboxSize_},
+  };
+}
+
+const ContextOptions& Context::getOptions() const {
+  return impl_->getOptions();
+}
+
+const ContextOptions& Context::Impl::getOptions() const {
+  return options_;
+}
+
 void Context::setId(std::string id) {
   impl_->setId(std::move(id));
 }
@@ -189,7 +509,7 @@ bool Context::Impl::inLoop() {
   return reactor_.inLoop();
 };
 
-void Context::Impl::deferToLoop(std::function<void()> fn) {
+void Context::Impl::deferToLoop(TTask fn) {
   reactor_.deferToLoop(std::move(fn));
 };
 
@@ -197,25 +517,134 @@ void Context::Impl::registerDescriptor(
     int fd,
     int events,
     std::shared_ptr<EpollLoop::EventHandler> h) {
+  {
+    std::unique_lock<std::mutex> lock(ownWorkMutex_);
+    ownDescriptors_.insert(fd);
+  }
   loop_.registerDescriptor(fd, events, std::move(h));
 }
 
 void Context::Impl::unregisterDescriptor(int fd) {
   loop_.unregisterDescriptor(fd);
+  std::unique_lock<std::mutex> lock(ownWorkMutex_);
+  ownDescriptors_.erase(fd);
+  ownWorkCv_.notify_all();
 }
 
 Context::Impl::TToken Context::Impl::addReaction(TFunction fn) {
+  {
+    std::unique_lock<std::mutex> lock(ownWorkMutex_);
+    numOwnReactions_++;
+  }
   return reactor_.add(std::move(fn));
 }
 
 void Context::Impl::removeReaction(TToken token) {
   reactor_.remove(token);
+  std::unique_lock<std::mutex> lock(ownWorkMutex_);
+  numOwnReactions_--;
+  ownWorkCv_.notify_all();
 }
 
-std::tuple<int, int> Context::Impl::reactorFds() {
+std::tuple<int, int, int, int> Context::Impl::reactorFds() {
   return reactor_.fds();
 }
 
+Context::Impl::Ring Context::Impl::takeInbox() {
+  {
+    std::unique_lock<std::mutex> lock(spareInboxesMutex_);
+    if (!spareInboxes_.empty()) {
+      Ring inbox = std::move(spareInboxes_.front());
+      spareInboxes_.pop_front();
+      numSpareInboxesTaken_.fetch_add(1, std::memory_order_relaxed);
+      spareInboxesCv_.notify_all();
+      return inbox;
+    }
+  }
+  return createInbox_();
+}
+
+Context::Impl::Ring Context::Impl::loadOutbox(Fd headerFd, Fd dataFd) {
+  Ring ring =
+      util::ringbuffer::shm::load(std::move(headerFd), std::move(dataFd));
+  prefaultRing_(ring);
+  return ring;
+}
+
+Context::Impl::Ring Context::Impl::createInbox_() {
+  // Creating the data segment zeroes it, hence its pages are already faulted in
+  // by the time it's handed to a connection, but they may still need locking.
+  Ring ring = util::ringbuffer::shm::create(
+      inboxSize_,
+      useHugePages_
+          ? optional<util::shm::PageType>(util::shm::PageType::HugeTLB_2MB)
+          : nullopt,
+      /*perm_write=*/true,
+      numaNode_);
+  numInboxes_.fetch_add(1, std::memory_order_relaxed);
+  prefaultRing_(ring);
+  return ring;
+}
+
+void Context::Impl::prefaultRing_(Ring& ring) {
+  if (!prefaultRings_ && !lockRings_) {
+    return;
+  }
+  bool locked = std::get<0>(ring).prefault(lockRings_);
+  locked = std::get<1>(ring).prefault(lockRings_) && locked;
+  if (!locked && !warnedAboutLocking_.exchange(true)) {
+    TP_LOG_WARNING() << "Transport context " << id_
+                     << " couldn't lock its rings in memory (the limit on "
+                     << "locked memory, see ulimit -l, may be too low)";
+  }
+}
+
+void Context::Impl::replenishSpareInboxes_() {
+  setThreadName("TP_SHM_inboxes");
+  std::unique_lock<std::mutex> lock(spareInboxesMutex_);
+  while (true) {
+    spareInboxesCv_.wait(lock, [&]() {
+      return closed_ || spareInboxes_.size() < numSpareInboxes_;
+    });
+    if (closed_) {
+      return;
+    }
+    lock.unlock();
+    Ring inbox;
+    try {
+      inbox = createInbox_();
+    } catch (const std::exception& e) {
+      // E.g., /dev/shm is full. The connections will then create their inboxes
+      // themselves, and fail in turn, which is where the error belongs.
+      TP_LOG_WARNING() << "Transport context " << id_
+                       << " stopped creating spare inboxes: " << e.what();
+      return;
+    }
+    lock.lock();
+    spareInboxes_.push_back(std::move(inbox));
+  }
+}
+
+void Context::Impl::countInboxReleased() {
+  numInboxes_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Context::Impl::countRingFullStall() {
+  numRingFullStalls_.fetch_add(1, std::memory_order_relaxed);
+}
+
+DsaCopyEngine* Context::Impl::getCopyEngine() {
+  return copyEngine_.get();
+}
+
+bool Context::Impl::coalescesWrites() const {
+  return coalesceWrites_;
+}
+
+int Context::Impl::getListenBacklog() const {
+  return options_.listenBacklog;
+}
+
 } // namespace shm
 } // namespace transport
 } // namespace tensorpipe
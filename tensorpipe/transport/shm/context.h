@@ -11,7 +11,9 @@
 #include <memory>
 #include <string>
 
+#include <tensorpipe/common/busy_polling_policy.h>
 #include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/shm/options.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -20,9 +22,34 @@ namespace shm {
 class Connection;
 class Listener;
 
-class Context : public transport::Context {
+class Context final : public transport::Context {
  public:
-  Context();
+  static constexpr size_t kDefaultInboxSize =
+      ContextOptions::kDefaultInboxSize;
+
+  // Values for numaNode that don't designate a specific node.
+  static constexpr int kNoNumaNode = ContextOptions::kNoNumaNode;
+  static constexpr int kNumaNodeOfCaller = ContextOptions::kNumaNodeOfCaller;
+
+  // See ContextOptions for the meaning and the defaults of the settings. They
+  // are validated here, and throw if they are out of range.
+  explicit Context(ContextOptions options);
+
+  // Same as above, with the settings given one by one, except for reactorSize
+  // and listenBacklog, which keep their defaults.
+  explicit Context(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      size_t inboxSize = kDefaultInboxSize,
+      bool useHugePages = false,
+      int numaNode = kNoNumaNode,
+      bool pollEpollFromReactor = false,
+      bool shareThreads = false,
+      bool sleepOnEventFd = false,
+      size_t numSpareInboxes = 0,
+      bool prefaultRings = false,
+      bool lockRings = false,
+      bool copyOffload = false,
+      bool coalesceWrites = false);
 
   std::shared_ptr<transport::Connection> connect(std::string addr) override;
 
@@ -30,6 +57,14 @@ class Context : public transport::Context {
 
   const std::string& domainDescriptor() const override;
 
+  bool canCommunicateWithRemote(
+      const std::string& remoteDomainDescriptor) const override;
+
+  std::map<std::string, uint64_t> getStats() const override;
+
+  // The settings the context was created with.
+  const ContextOptions& getOptions() const;
+
   void setId(std::string id) override;
 
   void close() override;
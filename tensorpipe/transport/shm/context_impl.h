@@ -13,8 +13,13 @@
 #include <tuple>
 
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/dsa.h>
 #include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/shm/context.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+#include <tensorpipe/util/shm/segment.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -38,7 +43,38 @@ class Context::PrivateIface : public DeferredExecutor {
 
   virtual void removeReaction(TToken token) = 0;
 
-  virtual std::tuple<int, int> reactorFds() = 0;
+  virtual std::tuple<int, int, int, int> reactorFds() = 0;
+
+  // The header and data segments of a ringbuffer, and the ringbuffer itself.
+  using Ring = std::tuple<
+      util::shm::Segment,
+      util::shm::Segment,
+      util::ringbuffer::RingBuffer>;
+
+  // Returns a new inbox, with the context's size, page type and NUMA node,
+  // taken from the spare ones when there are any.
+  virtual Ring takeInbox() = 0;
+
+  // To be called by the connections when they destroy the inbox they took, so
+  // that the context can account for the memory of the inboxes that exist.
+  virtual void countInboxReleased() = 0;
+
+  // Maps the peer's inbox, which is this side's outbox.
+  virtual Ring loadOutbox(Fd headerFd, Fd dataFd) = 0;
+
+  // To be called by the connections whenever a write can't proceed because
+  // the outbox is full, for monitoring purposes.
+  virtual void countRingFullStall() = 0;
+
+  // The engine to copy large payloads out of the inboxes with, if any.
+  virtual DsaCopyEngine* getCopyEngine() = 0;
+
+  // Whether the connections should frame the writes they get during the same
+  // iteration of the loop together.
+  virtual bool coalescesWrites() const = 0;
+
+  // What the listening sockets give to listen().
+  virtual int getListenBacklog() const = 0;
 
   virtual ~PrivateIface() = default;
 };
@@ -129,7 +129,7 @@ void Listener::Impl::initFromLoop() {
     setError_(std::move(error));
     return;
   }
-  error = socket_.listen(128);
+  error = socket_.listen(context_->getListenBacklog());
   if (error) {
     setError_(std::move(error));
     return;
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/shm/options.h>
+
+#include <cstdint>
+#include <sstream>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/environment.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace shm {
+
+namespace {
+
+const EnvironmentReader kEnvironment{"TP_SHM_"};
+
+} // namespace
+
+void ContextOptions::validate() const {
+  TP_THROW_ASSERT_IF(inboxSize == 0) << "The inbox size must be positive";
+  TP_THROW_ASSERT_IF(reactorSize < sizeof(uint32_t))
+      << "The reactor size must fit at least one token, got " << reactorSize;
+  TP_THROW_ASSERT_IF(numaNode < kNumaNodeOfCaller)
+      << "Invalid NUMA node " << numaNode;
+  TP_THROW_ASSERT_IF(
+      policy.spinFor.count() < 0 || policy.yieldFor.count() < 0 ||
+      policy.sleepFor.count() < 0)
+      << "The durations of the busy-polling policy must be non-negative";
+  TP_THROW_ASSERT_IF(listenBacklog <= 0)
+      << "The listen backlog must be positive, got " << listenBacklog;
+}
+
+std::string ContextOptions::str() const {
+  std::ostringstream oss;
+  oss << std::boolalpha << "spin_for_us=" << policy.spinFor.count()
+      << ",yield_for_us=" << policy.yieldFor.count()
+      << ",sleep_for_us=" << policy.sleepFor.count()
+      << ",inbox_size=" << inboxSize << ",reactor_size=" << reactorSize
+      << ",use_huge_pages=" << useHugePages << ",numa_node=" << numaNode
+      << ",poll_epoll_from_reactor=" << pollEpollFromReactor
+      << ",share_threads=" << shareThreads
+      << ",sleep_on_event_fd=" << sleepOnEventFd
+      << ",num_spare_inboxes=" << numSpareInboxes
+      << ",prefault_rings=" << prefaultRings << ",lock_rings=" << lockRings
+      << ",copy_offload=" << copyOffload
+      << ",coalesce_writes=" << coalesceWrites
+      << ",listen_backlog=" << listenBacklog;
+  return oss.str();
+}
+
+ContextOptions ContextOptions::fromEnvironment(ContextOptions options) {
+  const char* busyPolling = kEnvironment.get("busy_polling");
+  if (busyPolling != nullptr) {
+    std::string base(busyPolling);
+    if (base == "adaptive") {
+      options.policy = BusyPollingPolicy::adaptive();
+    } else if (base == "default") {
+      options.policy = BusyPollingPolicy();
+    } else {
+      TP_THROW_ASSERT() << "Invalid value for "
+                        << kEnvironment.getName("busy_polling") << ": " << base;
+    }
+  }
+  kEnvironment.setMicroseconds("spin_for_us", options.policy.spinFor);
+  kEnvironment.setMicroseconds("yield_for_us", options.policy.yieldFor);
+  kEnvironment.setMicroseconds("sleep_for_us", options.policy.sleepFor);
+  kEnvironment.setSize("inbox_size", options.inboxSize);
+  kEnvironment.setSize("reactor_size", options.reactorSize);
+  kEnvironment.setBool("use_huge_pages", options.useHugePages);
+  kEnvironment.setInt("numa_node", options.numaNode);
+  kEnvironment.setBool("poll_epoll_from_reactor", options.pollEpollFromReactor);
+  kEnvironment.setBool("share_threads", options.shareThreads);
+  kEnvironment.setBool("sleep_on_event_fd", options.sleepOnEventFd);
+  kEnvironment.setSize("num_spare_inboxes", options.numSpareInboxes);
+  kEnvironment.setBool("prefault_rings", options.prefaultRings);
+  kEnvironment.setBool("lock_rings", options.lockRings);
+  kEnvironment.setBool("copy_offload", options.copyOffload);
+  kEnvironment.setBool("coalesce_writes", options.coalesceWrites);
+  kEnvironment.setInt("listen_backlog", options.listenBacklog);
+  return options;
+}
+
+ContextOptions ContextOptions::fromEnvironment() {
+  return fromEnvironment(ContextOptions());
+}
+
+} // namespace shm
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace shm {
+
+// All the settings of a context, with their defaults. Each one also has a
+// snake_case name (the one of the field), which is used for the environment
+// variables, in str(), and by the Python bindings and the benchmarks.
+struct ContextOptions {
+  static constexpr size_t kDefaultInboxSize = 2 * 1024 * 1024;
+  // This allows for buffering 1M triggers (at 4 bytes a piece).
+  static constexpr size_t kDefaultReactorSize = 4 * 1024 * 1024;
+
+  // Values for numaNode that don't designate a specific node.
+  static constexpr int kNoNumaNode = -1;
+  static constexpr int kNumaNodeOfCaller = -2;
+
+  static constexpr int kDefaultListenBacklog = 128;
+
+  // How the reactor behaves when it runs out of work. In the environment, it
+  // is given by busy_polling (default or adaptive, as a base) and then by
+  // spin_for_us, yield_for_us and sleep_for_us.
+  BusyPollingPolicy policy;
+
+  // Each connection allocates its own inbox, a ringbuffer of inboxSize bytes
+  // (rounded up to a power of two) in shared memory, into which its peer
+  // writes. Reducing it lowers the memory used by each connection, which
+  // matters when there are many of them, at the cost of splitting large
+  // buffers into more chunks. It must still be large enough to hold any nop
+  // object (e.g., a message descriptor) in its entirety.
+  size_t inboxSize{kDefaultInboxSize};
+
+  // The size of the reactor's ringbuffer (rounded up to a power of two), into
+  // which the peers write the tokens of the functions to trigger. Writers spin
+  // when it's full, hence it should hold at least a token for each function
+  // that could be triggered at the same time, i.e., a few per connection.
+  size_t reactorSize{kDefaultReactorSize};
+
+  // If set, the inboxes and the reactor's ringbuffer are allocated on 2MB huge
+  // pages, which reduces TLB misses when copying data through them. This falls
+  // back to regular pages for the segments whose size isn't a multiple of 2MB,
+  // or if no huge pages are available (they usually need to be reserved in
+  // advance, e.g., through /proc/sys/vm/nr_hugepages).
+  bool useHugePages{false};
+
+  // If set, the inboxes and the reactor's ringbuffer are bound to that NUMA
+  // node, and the context's threads only run on the CPUs of that node. With
+  // kNumaNodeOfCaller, the node is the one of the CPU running the thread that
+  // constructs the context (which should thus be the one that will use the
+  // connections). The node is then advertised in the domain descriptor, for
+  // information, as peers on other nodes can still connect.
+  int numaNode{kNoNumaNode};
+
+  // If set, the reactor also polls for the events of the sockets (e.g., new
+  // connections, or peers going away) and handles them right away, rather than
+  // having a separate thread wait for them and then hand them over. This costs
+  // a system call per poll, in exchange for lower and steadier latencies when
+  // there are many connections.
+  bool pollEpollFromReactor{false};
+
+  // If set, the context doesn't start a reactor and an epoll loop of its own,
+  // but uses the ones shared by all the contexts of the process that set it,
+  // so that the number of threads (and of cores spent polling) doesn't grow
+  // with the number of contexts. The shared threads are created by the first
+  // such context, with its policy, reactor size, huge pages, NUMA node and
+  // epoll settings (which thus apply to all), and they stop once the last such
+  // context is destroyed. This is forced under a CPU budget (see cpu_budget.h).
+  bool shareThreads{false};
+
+  // If set, the reactor, once its policy makes it go to sleep, blocks in epoll
+  // on an eventfd that is handed to the peers when they connect, and which they
+  // write to in order to wake it up, rather than on a futex. This suits
+  // services that are mostly idle but latency-sensitive, and with
+  // pollEpollFromReactor it lets the sockets' events wake the reactor up
+  // directly. It doesn't matter if the policy never sleeps.
+  bool sleepOnEventFd{false};
+
+  // If positive, the context keeps that many inboxes ready to be used, which a
+  // background thread replenishes as connections take them, so that setting a
+  // connection up doesn't involve allocating and zeroing shared memory. This
+  // speeds up bursts of new connections (e.g., when a job rescales), at the
+  // cost of keeping that much memory around.
+  size_t numSpareInboxes{0};
+
+  // If set, each side maps all the pages of the inboxes and outboxes when the
+  // connection is set up, rather than on first touch, which keeps page faults
+  // off the first messages.
+  bool prefaultRings{false};
+
+  // If set, the pages of the inboxes and outboxes are also locked in memory, so
+  // that they can't be swapped out (this is subject to the limit on locked
+  // memory, and only warns if it's exceeded).
+  bool lockRings{false};
+
+  // If set, the reactor hands the copies of large payloads out of the inboxes
+  // to a hardware copy engine (see DsaCopyEngine), if the host has one, and
+  // polls for their completion, rather than doing them itself.
+  bool copyOffload{false};
+
+  // If set, the writes that a connection gets during the same iteration of the
+  // loop are framed into its outbox together, when that iteration is done, and
+  // published to the peer in a single transaction, rather than one by one as
+  // they come. This raises the rate of small messages, at the cost of some
+  // latency for the first writes of a burst.
+  bool coalesceWrites{false};
+
+  // How many incoming connections each listening socket lets the kernel queue
+  // up before they are accepted (which the kernel caps at net.core.somaxconn).
+  // Connections beyond it are refused, hence it should cover the largest burst
+  // of peers connecting at once.
+  int listenBacklog{kDefaultListenBacklog};
+
+  // Throw if any setting is out of range.
+  void validate() const;
+
+  // All the settings, as comma-separated key=value pairs.
+  std::string str() const;
+
+  // Override the settings of the given options (or the defaults) with the
+  // environment variables named after them, in uppercase and prefixed by
+  // TP_SHM_ (e.g., TP_SHM_INBOX_SIZE=1M or TP_SHM_SHARE_THREADS=1), so that
+  // they can be tuned without changing the code. Sizes accept a K, M or G
+  // suffix, and booleans are given as true, false, 1 or 0. Throws if a value
+  // is malformed.
+  static ContextOptions fromEnvironment(ContextOptions options);
+  static ContextOptions fromEnvironment();
+};
+
+} // namespace shm
+} // namespace transport
+} // namespace tensorpipe
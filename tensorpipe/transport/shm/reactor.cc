@@ -8,6 +8,12 @@
 
 #include <tensorpipe/transport/shm/reactor.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <cstring>
+
+#include <tensorpipe/common/probes.h>
 #include <tensorpipe/common/system.h>
 #include <tensorpipe/util/ringbuffer/shm.h>
 
@@ -42,9 +48,47 @@ void writeToken(util::ringbuffer::Producer& producer, Reactor::TToken token) {
 
 } // namespace
 
-Reactor::Reactor() {
-  std::tie(headerSegment_, dataSegment_, rb_) =
-      util::ringbuffer::shm::create(kSize);
+Reactor::Reactor(
+    BusyPollingPolicy policy,
+    bool useHugePages,
+    optional<int> numaNode,
+    bool sleepOnEventFd,
+    size_t size)
+    : BusyPollingLoop(std::move(policy)) {
+  std::tie(headerSegment_, dataSegment_, rb_) = util::ringbuffer::shm::create(
+      size,
+      useHugePages ? optional<util::shm::PageType>(
+                         util::shm::PageType::HugeTLB_2MB)
+                   : nullopt,
+      /*perm_write=*/true,
+      numaNode);
+  if (numaNode.has_value()) {
+    cpus_ = getCpusOfNumaNode(numaNode.value());
+  }
+
+  BusyPollingSleepWord* sleepWord;
+  std::tie(sleepWordSegment_, sleepWord) =
+      util::shm::Segment::create<BusyPollingSleepWord>(
+          /*perm_write=*/true, util::shm::PageType::Default);
+  setSleepWord(*sleepWord);
+
+  {
+    auto rv = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    eventFd_ = Fd(rv);
+  }
+  if (sleepOnEventFd) {
+    auto rv = ::epoll_create1(EPOLL_CLOEXEC);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    epollFd_ = Fd(rv);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;
+    rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, eventFd_.fd(), &ev);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    setWakeupEventFd(eventFd_.fd(), epollFd_.fd());
+  }
 
   startThread("TP_SHM_reactor");
 }
@@ -90,6 +134,7 @@ Reactor::TToken Reactor::add(TFunction fn) {
   functions_[token] = std::move(fn);
 
   functionCount_++;
+  functionsVersion_++;
 
   return token;
 }
@@ -99,33 +144,102 @@ void Reactor::remove(TToken token) {
   functions_[token] = nullptr;
   reusableTokens_.insert(token);
   functionCount_--;
+  functionsVersion_++;
+}
+
+std::tuple<int, int, int, int> Reactor::fds() const {
+  return std::make_tuple(
+      headerSegment_.getFd(),
+      dataSegment_.getFd(),
+      sleepWordSegment_.getFd(),
+      eventFd_.fd());
 }
 
-std::tuple<int, int> Reactor::fds() const {
-  return std::make_tuple(headerSegment_.getFd(), dataSegment_.getFd());
+void Reactor::refreshLoopFunctions() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  loopFunctions_ = functions_;
+  loopFunctionsVersion_ = functionsVersion_.load();
+  if (lastPollOfToken_.size() < loopFunctions_.size()) {
+    lastPollOfToken_.resize(loopFunctions_.size(), 0);
+  }
+}
+
+void Reactor::eventLoop() {
+  if (!cpus_.empty()) {
+    setThreadAffinity(cpus_);
+  }
+  BusyPollingLoop::eventLoop();
+}
+
+void Reactor::pollEpollLoop(EpollLoop& loop) {
+  if (sleepsOnEventFd()) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.u64 = 1;
+    auto rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, loop.getPollFd(), &ev);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+  }
+  epollLoop_.store(&loop, std::memory_order_release);
+}
+
+void Reactor::prepareToSleep() {
+  // When sleeping on the eventfd, the epoll loop's events wake us up already.
+  EpollLoop* epollLoop = epollLoop_.load(std::memory_order_acquire);
+  if (epollLoop != nullptr && !sleepsOnEventFd()) {
+    epollLoop->armWakeupFromLoop();
+  }
 }
 
 bool Reactor::pollOnce() {
+  EpollLoop* epollLoop = epollLoop_.load(std::memory_order_acquire);
+  const bool foundEvents = epollLoop != nullptr && epollLoop->pollFromLoop();
+
+  // Take all the tokens in a single transaction, and release their space
+  // before running any function, as these could trigger this same reactor.
   util::ringbuffer::Consumer reactorConsumer(rb_);
-  uint32_t token;
-  auto ret = reactorConsumer.read(&token, sizeof(token));
-  if (ret == -ENODATA) {
-    return false;
+  auto ret = reactorConsumer.startTx();
+  TP_THROW_SYSTEM_IF(ret < 0, -ret);
+  ssize_t numBuffers;
+  std::array<util::ringbuffer::Consumer::Buffer, 2> buffers;
+  std::tie(numBuffers, buffers) =
+      reactorConsumer.accessContiguousInTx</*allowPartial=*/true>(
+          rb_.getHeader().kDataPoolByteSize);
+  TP_THROW_SYSTEM_IF(numBuffers < 0, -numBuffers);
+  // Tokens are written whole, and the size of the ring buffer is a multiple of
+  // theirs, hence they never straddle the two buffers.
+  batch_.clear();
+  for (ssize_t bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
+    TP_DCHECK_EQ(buffers[bufferIdx].len % sizeof(TToken), 0);
+    const size_t numTokens = buffers[bufferIdx].len / sizeof(TToken);
+    const size_t offset = batch_.size();
+    batch_.resize(offset + numTokens);
+    std::memcpy(
+        &batch_[offset], buffers[bufferIdx].ptr, buffers[bufferIdx].len);
   }
+  ret = reactorConsumer.commitTx();
   TP_THROW_SYSTEM_IF(ret < 0, -ret);
 
-  TFunction fn;
-
-  // Make copy of std::function so we don't need
-  // to hold the lock while executing it.
-  {
-    std::unique_lock<std::mutex> lock(mutex_);
-    TP_DCHECK_LT(token, functions_.size());
-    fn = functions_[token];
+  if (batch_.empty()) {
+    return foundEvents;
   }
 
-  if (fn) {
-    fn();
+  pollIdx_++;
+  for (TToken token : batch_) {
+    // Functions may add or remove tokens (including the ones still to run in
+    // this batch) hence check for changes before each of them.
+    if (functionsVersion_.load(std::memory_order_acquire) !=
+        loopFunctionsVersion_) {
+      refreshLoopFunctions();
+    }
+    TP_DCHECK_LT(token, loopFunctions_.size());
+    if (lastPollOfToken_[token] == pollIdx_) {
+      continue;
+    }
+    lastPollOfToken_[token] = pollIdx_;
+    if (loopFunctions_[token]) {
+      TP_PROBE(shm_reactor_dispatch, token);
+      loopFunctions_[token]();
+    }
   }
 
   return true;
@@ -135,16 +249,28 @@ bool Reactor::readyToClose() {
   return functionCount_ == 0;
 }
 
-Reactor::Trigger::Trigger(Fd headerFd, Fd dataFd) {
+Reactor::Trigger::Trigger(
+    Fd headerFd,
+    Fd dataFd,
+    Fd sleepWordFd,
+    Fd eventFd)
+    : eventFd_(std::move(eventFd)) {
   // The header and data segment objects take over ownership
   // of file descriptors. Release them to avoid double close.
   std::tie(headerSegment_, dataSegment_, rb_) =
       util::ringbuffer::shm::load(std::move(headerFd), std::move(dataFd));
+  std::tie(sleepWordSegment_, sleepWord_) =
+      util::shm::Segment::load<BusyPollingSleepWord>(
+          std::move(sleepWordFd),
+          /*perm_write=*/true,
+          util::shm::PageType::Default);
 }
 
 void Reactor::Trigger::run(TToken token) {
+  TP_PROBE(shm_reactor_trigger, token);
   util::ringbuffer::Producer producer(rb_);
   writeToken(producer, token);
+  sleepWord_->wakeUpIfAsleep(eventFd_.fd());
 }
 
 } // namespace shm
@@ -18,9 +18,12 @@
 #include <vector>
 
 #include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
 #include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/epoll_loop.h>
 #include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/transport/shm/options.h>
 #include <tensorpipe/util/ringbuffer/consumer.h>
 #include <tensorpipe/util/ringbuffer/producer.h>
 #include <tensorpipe/util/shm/segment.h>
@@ -34,18 +37,40 @@ namespace shm {
 // Companion class to the event loop in `loop.h` that executes
 // functions on triggers. The triggers are posted to a shared memory
 // ring buffer, so this can be done by other processes on the same
-// machine. It uses extra data in the ring buffer header to store a
-// mutex and condition variable to avoid a busy loop.
+// machine. When it runs out of work it backs off according to its
+// busy-polling policy, and it may end up going to sleep, in which case
+// it advertises so through a word in a separate shared memory segment,
+// which the triggers check in order to know whether to wake it up.
+//
+// By default it sleeps on that word, as a futex. It can instead sleep in
+// epoll, on an eventfd that is shared with the triggers, which then wake it
+// up by writing to it. This also lets the events of the epoll loop it polls
+// (if any) wake it up directly, without going through the loop's thread.
+//
+// Each poll drains all the tokens that are in the ring buffer at once and
+// runs the function of each token only once, however many times it was
+// triggered, as all functions process whatever work is pending at the time
+// they run, hence repeated triggers that queued up are redundant.
 //
 class Reactor final : public BusyPollingLoop {
-  // This allows for buffering 1M triggers (at 4 bytes a piece).
-  static constexpr auto kSize = 4 * 1024 * 1024;
-
  public:
+  static constexpr size_t kDefaultSize = ContextOptions::kDefaultReactorSize;
+
   using TFunction = std::function<void()>;
   using TToken = uint32_t;
 
-  Reactor();
+  // If useHugePages is set, the ringbuffer is allocated on huge pages when
+  // possible, and on regular pages otherwise. If numaNode is set, the
+  // ringbuffer is bound to that NUMA node and the reactor's thread only runs on
+  // the CPUs of that node. If sleepOnEventFd is set, the reactor sleeps in
+  // epoll rather than on a futex (see above). The ringbuffer is of the given
+  // size, rounded up to a power of two.
+  explicit Reactor(
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      bool useHugePages = false,
+      optional<int> numaNode = nullopt,
+      bool sleepOnEventFd = false,
+      size_t size = kDefaultSize);
 
   // Add function to the reactor.
   // Returns token that can be used to trigger it.
@@ -54,8 +79,14 @@ class Reactor final : public BusyPollingLoop {
   // Removes function associated with token from reactor.
   void remove(TToken token);
 
-  // Returns the file descriptors for the underlying ring buffer.
-  std::tuple<int, int> fds() const;
+  // Have each poll also handle the events of the given epoll loop, which must
+  // have been constructed to be polled from this reactor, and must outlive it.
+  void pollEpollLoop(EpollLoop& loop);
+
+  // Returns the file descriptors for the underlying ring buffer, for the
+  // segment holding the sleep word, and for the eventfd. The latter is always
+  // there, as the triggers can't know in advance how the reactor sleeps.
+  std::tuple<int, int, int, int> fds() const;
 
   void close();
 
@@ -64,14 +95,24 @@ class Reactor final : public BusyPollingLoop {
   ~Reactor();
 
  protected:
+  void eventLoop() override;
+
   bool pollOnce() override;
 
   bool readyToClose() override;
 
+  void prepareToSleep() override;
+
  private:
   util::shm::Segment headerSegment_;
   util::shm::Segment dataSegment_;
   util::ringbuffer::RingBuffer rb_;
+  util::shm::Segment sleepWordSegment_;
+  Fd eventFd_;
+  // Only when sleeping on the eventfd. It contains it, and the epoll loop's fd.
+  Fd epollFd_;
+
+  std::vector<int> cpus_;
 
   std::mutex mutex_;
   std::atomic<bool> closed_{false};
@@ -90,10 +131,30 @@ class Reactor final : public BusyPollingLoop {
   // Count how many functions are registered.
   std::atomic<uint64_t> functionCount_{0};
 
+  // Incremented whenever the functions change, so that the reactor thread can
+  // tell when its copy of them is stale.
+  std::atomic<uint64_t> functionsVersion_{0};
+
+  // The reactor thread's copy of the functions, which it uses to dispatch
+  // tokens without taking the mutex. It's refreshed (under the mutex) only
+  // after tokens were added or removed, which is rare.
+  std::vector<TFunction> loopFunctions_;
+  uint64_t loopFunctionsVersion_{0};
+
+  // The tokens of the current poll, and for each token the last poll that ran
+  // it, used to deduplicate them. Only accessed by the reactor thread.
+  std::vector<TToken> batch_;
+  std::vector<uint64_t> lastPollOfToken_;
+  uint64_t pollIdx_{0};
+
+  std::atomic<EpollLoop*> epollLoop_{nullptr};
+
+  void refreshLoopFunctions();
+
  public:
   class Trigger {
    public:
-    Trigger(Fd header, Fd data);
+    Trigger(Fd header, Fd data, Fd sleepWord, Fd eventFd);
 
     void run(TToken token);
 
@@ -101,6 +162,9 @@ class Reactor final : public BusyPollingLoop {
     util::shm::Segment headerSegment_;
     util::shm::Segment dataSegment_;
     util::ringbuffer::RingBuffer rb_;
+    util::shm::Segment sleepWordSegment_;
+    BusyPollingSleepWord* sleepWord_{nullptr};
+    Fd eventFd_;
   };
 };
 
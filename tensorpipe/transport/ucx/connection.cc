@@ -0,0 +1,1043 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/ucx/connection.h>
+
+#include <array>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/common/ucx.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/ucx/context_impl.h>
+#include <tensorpipe/transport/ucx/error.h>
+#include <tensorpipe/transport/ucx/reactor.h>
+#include <tensorpipe/transport/ucx/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ucx {
+
+namespace {
+
+// The address of a worker holds those of all the transports it could be
+// reached through, which usually takes a few hundred bytes.
+constexpr size_t kMaxWorkerAddressLength = 4096;
+
+// The data that each side of a connection needs to send to the other one in
+// order to create an endpoint to it. This data is transferred over a TCP
+// connection.
+struct Exchange {
+  uint32_t workerAddressLength;
+  uint8_t workerAddress[kMaxWorkerAddressLength];
+};
+
+} // namespace
+
+class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
+                         public EpollLoop::EventHandler {
+  enum State {
+    INITIALIZING = 1,
+    SEND_ADDR,
+    RECV_ADDR,
+    ESTABLISHED,
+  };
+
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  Impl(std::shared_ptr<Context::PrivateIface>, Socket, std::string);
+
+  // Create a connection that connects to the specified address.
+  Impl(std::shared_ptr<Context::PrivateIface>, std::string, std::string);
+
+  // Initialize member fields that need `shared_from_this`.
+  void init();
+
+  // Queue a read operation.
+  void read(read_callback_fn fn);
+  void read(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void write(const void* ptr, size_t length, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
+  // Tell the connection what its identifier is.
+  void setId(std::string id);
+
+  // Shut down the connection and its resources.
+  void close();
+
+  // Implementation of EventHandler.
+  void handleEventsFromLoop(int events) override;
+
+ private:
+  // Initialize member fields that need `shared_from_this`.
+  void initFromLoop();
+
+  // Queue a read operation.
+  void readFromLoop(read_callback_fn fn);
+  void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writevFromLoop(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
+  void setIdFromLoop_(std::string id);
+
+  // Shut down the connection and its resources.
+  void closeFromLoop();
+
+  // Handle events of type EPOLLIN on the TCP socket.
+  //
+  // The only data that is expected on that socket is the address of the
+  // other side's worker.
+  void handleEventInFromLoop();
+
+  // Handle events of type EPOLLOUT on the TCP socket.
+  //
+  // Once the socket is writable we send the address of this side's worker.
+  void handleEventOutFromLoop();
+
+  // Post a send request for each write operation that doesn't have one yet.
+  void sendFromLoop_();
+
+  // Post a receive request for the front read operation, if none is in flight,
+  // and keep doing so while they complete right away.
+  void recvFromLoop_();
+
+  // Fire the callbacks of the write operations whose data was sent, in order.
+  void completeWriteOperationsFromLoop_();
+
+  // Called by UCX, from within the progress of the worker, with the connection
+  // as user data or argument.
+  static void sendCallback_(void* request, ucs_status_t status, void* userData);
+  static void recvCallback_(
+      void* request,
+      ucs_status_t status,
+      size_t length,
+      void* userData);
+  static void closeCallback_(
+      void* request,
+      ucs_status_t status,
+      void* userData);
+  static void endpointErrorCallback_(
+      void* arg,
+      ucp_ep_h ep,
+      ucs_status_t status);
+
+  void sendCallbackFromLoop_(ucs_status_t status);
+  void recvCallbackFromLoop_(ucs_status_t status, size_t length);
+  void closeCallbackFromLoop_(ucs_status_t status);
+
+  // Wrap a status of UCX in an error, mentioning the operation that failed.
+  Error makeUcxError_(const char* operation, ucs_status_t status);
+
+  void setError_(Error error);
+
+  // Deal with an error.
+  void handleError_();
+
+  // Fire the callbacks of all read or write operations with the error.
+  void failReadOperations_();
+  void failWriteOperations_();
+
+  // Once all the requests have completed, have the reactor let go of us.
+  void releaseResourcesIfIdle_();
+
+  State state_{INITIALIZING};
+  std::shared_ptr<Context::PrivateIface> context_;
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+  Error error_{Error::kSuccess};
+  ClosingReceiver closingReceiver_;
+
+  // Whether the reactor is keeping us alive, for the sake of UCX's callbacks.
+  bool registered_{false};
+
+  ucp_ep_h ep_{nullptr};
+
+  // The requests that are in flight.
+  void* recvRequest_{nullptr};
+  size_t numSendRequestsInFlight_{0};
+  bool closeRequestInFlight_{false};
+
+  std::deque<StreamReadOperation> readOperations_;
+
+  // A write operation, along with the buffers handed to UCX, which must stay
+  // valid until its send request completes (as does the operation itself,
+  // which holds its header). The deque keeps the references to its elements
+  // valid as they're added and removed at the ends.
+  struct WriteOperation {
+    WriteOperation(const void* ptr, size_t length, write_callback_fn fn)
+        : op(ptr, length, std::move(fn)) {}
+
+    StreamWriteOperation op;
+    std::array<ucp_dt_iov_t, 2> iov;
+    Impl* impl{nullptr};
+    bool posted{false};
+    bool completed{false};
+  };
+  std::deque<WriteOperation> writeOperations_;
+
+  // A sequence number for the calls to read and write.
+  uint64_t nextBufferBeingRead_{0};
+  uint64_t nextBufferBeingWritten_{0};
+
+  // A sequence number for the invocations of the callbacks of read and write.
+  uint64_t nextReadCallbackToCall_{0};
+  uint64_t nextWriteCallbackToCall_{0};
+
+  // An identifier for the connection, composed of the identifier for the
+  // context or listener, combined with an increasing sequence number. It will
+  // only be used for logging and debugging purposes.
+  std::string id_;
+};
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : context_(std::move(context)),
+      socket_(std::move(socket)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Connection::Impl::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  closingReceiver_.activate(*this);
+
+  Error error;
+  // The connection either got a socket or an address, but not both.
+  TP_DCHECK(socket_.hasValue() ^ sockaddr_.has_value());
+  if (!socket_.hasValue()) {
+    std::tie(error, socket_) =
+        Socket::createForFamily(sockaddr_->addr()->sa_family);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.reuseAddr(true);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.connect(sockaddr_.value());
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+  }
+  // Ensure underlying control socket is non-blocking such that it
+  // works well with event driven I/O.
+  error = socket_.block(false);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+
+  context_->getReactor().registerConnection(shared_from_this());
+  registered_ = true;
+
+  // We're sending address first, so wait for writability.
+  state_ = SEND_ADDR;
+  context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+}
+
+void Connection::Impl::handleEventsFromLoop(int events) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
+             << EpollLoop::formatEpollEvents(events) << ")";
+
+  // Handle only one of the events in the mask. Events on the control
+  // file descriptor are rare enough for the cost of having epoll call
+  // into this function multiple times to not matter. The benefit is
+  // that every handler can close and unregister the control file
+  // descriptor from the event loop, without worrying about the next
+  // handler trying to do so as well.
+  // In some cases the socket could be in a state where it's both in an error
+  // state and readable/writable. If we checked for EPOLLIN or EPOLLOUT first
+  // and then returned after handling them, we would keep doing so forever and
+  // never reach the error handling. So we should keep the error check first.
+  if (events & EPOLLERR) {
+    int error;
+    socklen_t errorlen = sizeof(error);
+    int rv = getsockopt(
+        socket_.fd(),
+        SOL_SOCKET,
+        SO_ERROR,
+        reinterpret_cast<void*>(&error),
+        &errorlen);
+    if (rv == -1) {
+      setError_(TP_CREATE_ERROR(SystemError, "getsockopt", rv));
+    } else {
+      setError_(TP_CREATE_ERROR(SystemError, "async error on socket", error));
+    }
+    return;
+  }
+  if (events & EPOLLIN) {
+    handleEventInFromLoop();
+    return;
+  }
+  if (events & EPOLLOUT) {
+    handleEventOutFromLoop();
+    return;
+  }
+  // Check for hangup last, as there could be cases where we get EPOLLHUP but
+  // there's still data to be read from the socket, so we want to deal with that
+  // before dealing with the hangup.
+  if (events & EPOLLHUP) {
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+}
+
+
+
+void Connection::Impl::handleEventInFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == RECV_ADDR) {
+    struct Exchange ex;
+
+    auto err = socket_.read(&ex, sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be read in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortReadError, sizeof(ex), err));
+      return;
+    }
+
+    UcxLib& ucxLib = context_->getReactor().getUcxLib();
+    ucp_ep_params_t params;
+    std::memset(&params, 0, sizeof(params));
+    params.field_mask = UCP_EP_PARAM_FIELD_REMOTE_ADDRESS |
+        UCP_EP_PARAM_FIELD_ERR_HANDLING_MODE | UCP_EP_PARAM_FIELD_ERR_HANDLER;
+    params.address = reinterpret_cast<const ucp_address_t*>(ex.workerAddress);
+    // Have UCX tell us if the peer goes away, rather than hang.
+    params.err_mode = UCP_ERR_HANDLING_MODE_PEER;
+    params.err_handler.cb = endpointErrorCallback_;
+    params.err_handler.arg = this;
+    ucs_status_t status = ucxLib.ucp_ep_create(
+        context_->getReactor().getUcxWorker().get(), &params, &ep_);
+    if (status != UCS_OK) {
+      setError_(makeUcxError_("ucp_ep_create", status));
+      return;
+    }
+
+    // The connection is usable now.
+    state_ = ESTABLISHED;
+    sendFromLoop_();
+    // Trigger read operations in case a pair of local read() and remote
+    // write() happened before connection is established. Otherwise read()
+    // callback would lose if it's the only read() request.
+    recvFromLoop_();
+    return;
+  }
+
+  if (state_ == ESTABLISHED) {
+    // We don't expect to read anything on this socket once the
+    // connection has been established. If we do, assume it's a
+    // zero-byte read indicating EOF.
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLIN event not handled in state " << state_;
+}
+
+void Connection::Impl::handleEventOutFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == SEND_ADDR) {
+    const std::string& workerAddress =
+        context_->getReactor().getUcxWorkerAddress();
+    if (workerAddress.size() > kMaxWorkerAddressLength) {
+      setError_(TP_CREATE_ERROR(
+          UcxError,
+          "the address of the worker is " +
+              std::to_string(workerAddress.size()) + " bytes long"));
+      return;
+    }
+    Exchange ex;
+    std::memset(&ex, 0, sizeof(ex));
+    ex.workerAddressLength = workerAddress.size();
+    std::memcpy(ex.workerAddress, workerAddress.data(), workerAddress.size());
+
+    auto err = socket_.write(reinterpret_cast<void*>(&ex), sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be written in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortWriteError, sizeof(ex), err));
+      return;
+    }
+
+    // Sent our address. Wait for address from peer.
+    state_ = RECV_ADDR;
+    context_->registerDescriptor(socket_.fd(), EPOLLIN, shared_from_this());
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLOUT event not handled in state " << state_;
+}
+
+void Connection::Impl::sendFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  if (error_ || state_ != ESTABLISHED) {
+    return;
+  }
+
+  UcxLib& ucxLib = context_->getReactor().getUcxLib();
+  // The sends on an endpoint are delivered in order, hence they can all be in
+  // flight at once.
+  for (auto& writeOperation : writeOperations_) {
+    if (writeOperation.posted) {
+      continue;
+    }
+    StreamWriteOperation::Buf* bufsPtr;
+    size_t bufsLen;
+    std::tie(bufsPtr, bufsLen) = writeOperation.op.getBufs();
+    for (size_t bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+      writeOperation.iov[bufIdx].buffer = bufsPtr[bufIdx].base;
+      writeOperation.iov[bufIdx].length = bufsPtr[bufIdx].len;
+    }
+    writeOperation.impl = this;
+
+    ucp_request_param_t param;
+    std::memset(&param, 0, sizeof(param));
+    param.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK |
+        UCP_OP_ATTR_FIELD_USER_DATA | UCP_OP_ATTR_FIELD_DATATYPE;
+    param.cb.send = sendCallback_;
+    param.user_data = &writeOperation;
+    param.datatype = ucp_dt_make_iov();
+
+    TP_VLOG(9) << "Connection " << id_ << " is posting a send request";
+    ucs_status_ptr_t request = ucxLib.ucp_stream_send_nbx(
+        ep_, writeOperation.iov.data(), bufsLen, &param);
+    writeOperation.posted = true;
+    if (UCS_PTR_IS_ERR(request)) {
+      writeOperation.completed = true;
+      setError_(makeUcxError_("ucp_stream_send_nbx", UCS_PTR_STATUS(request)));
+      return;
+    }
+    if (request == nullptr) {
+      // It completed right away, and the callback won't be invoked.
+      writeOperation.completed = true;
+    } else {
+      numSendRequestsInFlight_++;
+    }
+  }
+
+  completeWriteOperationsFromLoop_();
+}
+
+void Connection::Impl::completeWriteOperationsFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    return;
+  }
+
+  // Set aside the write operations that are done before calling any callback,
+  // as those may queue more writes.
+  std::deque<WriteOperation> completedWriteOperations;
+  while (!writeOperations_.empty() && writeOperations_.front().completed) {
+    completedWriteOperations.push_back(std::move(writeOperations_.front()));
+    writeOperations_.pop_front();
+  }
+  for (auto& writeOperation : completedWriteOperations) {
+    writeOperation.op.callbackFromLoop(Error::kSuccess);
+  }
+}
+
+void Connection::Impl::recvFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+
+  UcxLib& ucxLib = context_->getReactor().getUcxLib();
+  while (!error_ && state_ == ESTABLISHED && recvRequest_ == nullptr &&
+         !readOperations_.empty()) {
+    char* ptr;
+    size_t length;
+    readOperations_.front().allocFromLoop(&ptr, &length);
+
+    ucp_request_param_t param;
+    std::memset(&param, 0, sizeof(param));
+    param.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK |
+        UCP_OP_ATTR_FIELD_USER_DATA | UCP_OP_ATTR_FIELD_FLAGS;
+    param.cb.recv_stream = recvCallback_;
+    param.user_data = this;
+    // Only complete once the whole header, or payload, has arrived.
+    param.flags = UCP_STREAM_RECV_FLAG_WAITALL;
+
+    size_t receivedLength = 0;
+    ucs_status_ptr_t request = ucxLib.ucp_stream_recv_nbx(
+        ep_, ptr, length, &receivedLength, &param);
+    if (UCS_PTR_IS_ERR(request)) {
+      setError_(makeUcxError_("ucp_stream_recv_nbx", UCS_PTR_STATUS(request)));
+      return;
+    }
+    if (request != nullptr) {
+      recvRequest_ = request;
+      return;
+    }
+    // It completed right away, and the callback won't be invoked.
+    recvCallbackFromLoop_(UCS_OK, receivedLength);
+  }
+}
+
+void Connection::Impl::sendCallback_(
+    void* request,
+    ucs_status_t status,
+    void* userData) {
+  WriteOperation& writeOperation = *reinterpret_cast<WriteOperation*>(userData);
+  Impl& impl = *writeOperation.impl;
+  impl.context_->getReactor().getUcxLib().ucp_request_free(request);
+  writeOperation.completed = true;
+  impl.sendCallbackFromLoop_(status);
+}
+
+void Connection::Impl::recvCallback_(
+    void* request,
+    ucs_status_t status,
+    size_t length,
+    void* userData) {
+  Impl& impl = *reinterpret_cast<Impl*>(userData);
+  impl.context_->getReactor().getUcxLib().ucp_request_free(request);
+  TP_DCHECK_EQ(impl.recvRequest_, request);
+  impl.recvRequest_ = nullptr;
+  impl.recvCallbackFromLoop_(status, length);
+  impl.recvFromLoop_();
+  impl.releaseResourcesIfIdle_();
+}
+
+void Connection::Impl::closeCallback_(
+    void* request,
+    ucs_status_t status,
+    void* userData) {
+  Impl& impl = *reinterpret_cast<Impl*>(userData);
+  impl.context_->getReactor().getUcxLib().ucp_request_free(request);
+  impl.closeCallbackFromLoop_(status);
+}
+
+void Connection::Impl::endpointErrorCallback_(
+    void* arg,
+    ucp_ep_h /* unused */,
+    ucs_status_t status) {
+  Impl& impl = *reinterpret_cast<Impl*>(arg);
+  impl.setError_(impl.makeUcxError_("endpoint", status));
+}
+
+void Connection::Impl::sendCallbackFromLoop_(ucs_status_t status) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has completed a send request ("
+             << context_->getReactor().getUcxLib().ucs_status_string(status)
+             << ")";
+
+  TP_DCHECK_GT(numSendRequestsInFlight_, 0);
+  numSendRequestsInFlight_--;
+
+  if (status != UCS_OK) {
+    setError_(makeUcxError_("ucp_stream_send_nbx", status));
+  }
+  if (error_) {
+    // We could only fire the callbacks of the write operations once UCX is done
+    // with their buffers.
+    if (numSendRequestsInFlight_ == 0) {
+      failWriteOperations_();
+    }
+    releaseResourcesIfIdle_();
+    return;
+  }
+
+  completeWriteOperationsFromLoop_();
+}
+
+void Connection::Impl::recvCallbackFromLoop_(
+    ucs_status_t status,
+    size_t length) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has completed a receive request ("
+             << (status == UCS_OK
+                     ? std::to_string(length) + " bytes"
+                     : context_->getReactor().getUcxLib().ucs_status_string(
+                           status))
+             << ")";
+
+  if (status != UCS_OK) {
+    setError_(makeUcxError_("ucp_stream_recv_nbx", status));
+  }
+  if (error_) {
+    // We could only fire the callback of the front read operation once UCX was
+    // done with its buffer.
+    failReadOperations_();
+    return;
+  }
+
+  StreamReadOperation& readOperation = readOperations_.front();
+  readOperation.readFromLoop(length);
+  if (readOperation.completeFromLoop()) {
+    // Remove the operation before calling its callback, which may queue more
+    // read operations (and thus process them).
+    StreamReadOperation completedReadOperation = std::move(readOperation);
+    readOperations_.pop_front();
+    completedReadOperation.callbackFromLoop(Error::kSuccess);
+  }
+}
+
+void Connection::Impl::closeCallbackFromLoop_(ucs_status_t status) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has closed its endpoint ("
+             << context_->getReactor().getUcxLib().ucs_status_string(status)
+             << ")";
+
+  closeRequestInFlight_ = false;
+  releaseResourcesIfIdle_();
+}
+
+Error Connection::Impl::makeUcxError_(
+    const char* operation,
+    ucs_status_t status) {
+  return TP_CREATE_ERROR(
+      UcxError,
+      std::string(operation) + ": " +
+          context_->getReactor().getUcxLib().ucs_status_string(status));
+}
+
+void Connection::Impl::readFromLoop(read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_, nullptr, 0);
+    return;
+  }
+
+  readOperations_.emplace_back(std::move(fn));
+
+  recvFromLoop_();
+}
+
+void Connection::Impl::readFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_, ptr, length);
+    return;
+  }
+
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+
+  recvFromLoop_();
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  recvFromLoop_();
+}
+
+void Connection::Impl::writeFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a write callback (#"
+               << sequenceNumber << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+
+  sendFromLoop_();
+}
+
+void Connection::Impl::writevFromLoop(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  sendFromLoop_();
+}
+
+void Connection::Impl::setId(std::string id) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, id{std::move(id)}]() mutable {
+        impl->setIdFromLoop_(std::move(id));
+      });
+}
+
+void Connection::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Connection::Impl::close() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->closeFromLoop(); });
+}
+
+void Connection::Impl::closeFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ConnectionClosedError));
+}
+
+void Connection::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError_();
+}
+
+void Connection::Impl::handleError_() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
+
+  UcxLib& ucxLib = context_->getReactor().getUcxLib();
+  // UCX may still be writing into the buffer of the front read operation, and
+  // reading from those of the write operations, in which case we must wait for
+  // its requests to complete before firing their callbacks (or else the user
+  // may deallocate them). Closing the endpoint forcefully cancels them.
+  if (recvRequest_ != nullptr) {
+    ucxLib.ucp_request_cancel(
+        context_->getReactor().getUcxWorker().get(), recvRequest_);
+  } else {
+    failReadOperations_();
+  }
+  if (numSendRequestsInFlight_ == 0) {
+    failWriteOperations_();
+  }
+
+  if (ep_ != nullptr) {
+    ucp_request_param_t param;
+    std::memset(&param, 0, sizeof(param));
+    param.op_attr_mask = UCP_OP_ATTR_FIELD_CALLBACK |
+        UCP_OP_ATTR_FIELD_USER_DATA | UCP_OP_ATTR_FIELD_FLAGS;
+    param.cb.send = closeCallback_;
+    param.user_data = this;
+    param.flags = UCP_EP_CLOSE_FLAG_FORCE;
+    ucs_status_ptr_t request = ucxLib.ucp_ep_close_nbx(ep_, &param);
+    ep_ = nullptr;
+    // If it failed there's nothing left to wait for.
+    if (UCS_PTR_IS_PTR(request)) {
+      closeRequestInFlight_ = true;
+    }
+  }
+
+  if (socket_.hasValue()) {
+    if (state_ > INITIALIZING) {
+      context_->unregisterDescriptor(socket_.fd());
+    }
+    socket_.reset();
+  }
+
+  releaseResourcesIfIdle_();
+}
+
+void Connection::Impl::failReadOperations_() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(error_);
+
+  // Callbacks may queue more read operations, which fail immediately.
+  std::deque<StreamReadOperation> readOperations;
+  std::swap(readOperations, readOperations_);
+  for (auto& readOperation : readOperations) {
+    readOperation.callbackFromLoop(error_);
+  }
+}
+
+void Connection::Impl::failWriteOperations_() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(error_);
+
+  // Callbacks may queue more write operations, which fail immediately.
+  std::deque<WriteOperation> writeOperations;
+  std::swap(writeOperations, writeOperations_);
+  for (auto& writeOperation : writeOperations) {
+    writeOperation.op.callbackFromLoop(error_);
+  }
+}
+
+void Connection::Impl::releaseResourcesIfIdle_() {
+  TP_DCHECK(context_->inLoop());
+  if (!error_ || !registered_ || recvRequest_ != nullptr ||
+      numSendRequestsInFlight_ > 0 || closeRequestInFlight_) {
+    return;
+  }
+
+  TP_VLOG(9) << "Connection " << id_
+             << " has no more requests in flight, releasing its resources";
+  // This may drop the last reference to us, hence we defer it until we're done.
+  registered_ = false;
+  context_->deferToLoop([impl{shared_from_this()}]() {
+    impl->context_->getReactor().unregisterConnection(impl);
+  });
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(socket),
+          std::move(id))) {
+  impl_->init();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(addr),
+          std::move(id))) {
+  impl_->init();
+}
+
+void Connection::Impl::init() {
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+}
+
+void Connection::read(read_callback_fn fn) {
+  impl_->read(std::move(fn));
+}
+
+void Connection::Impl::read(read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(std::move(fn));
+      });
+}
+
+void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
+  impl_->read(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::read(void* ptr, size_t length, read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
+  impl_->write(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Connection::close() {
+  impl_->close();
+}
+
+Connection::~Connection() {
+  close();
+}
+
+} // namespace ucx
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ucx {
+
+class Connection;
+class Listener;
+
+class Context final : public transport::Context {
+ public:
+  // The connections go through UCX's stream API, on endpoints of a worker
+  // owned by the context, and thus over whichever transport UCX picks for each
+  // peer (e.g., RC or DC for InfiniBand, shared memory or TCP). These can be
+  // restricted through UCX's own environment variables (e.g., UCX_TLS). The
+  // connections are set up, and their peers' hangups are detected, through a
+  // TCP connection, on the addresses given to listen and connect.
+  //
+  // The worker is only progressed by polling, hence if the busy-polling policy
+  // ever lets the reactor go to sleep it wakes up every sleepFor to do so.
+  explicit Context(BusyPollingPolicy policy = BusyPollingPolicy());
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow listener to see the private interface.
+  friend class Listener;
+  // Allow connection to see the private interface.
+  friend class Connection;
+};
+
+} // namespace ucx
+} // namespace transport
+} // namespace tensorpipe
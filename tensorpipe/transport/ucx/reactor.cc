@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/ucx/reactor.h>
+
+#include <tensorpipe/common/defs.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ucx {
+
+Reactor::Reactor(BusyPollingPolicy policy)
+    : BusyPollingLoop(std::move(policy)) {
+  Error error;
+  std::tie(error, ucxLib_) = UcxLib::create();
+  // FIXME Instead of throwing away the error and setting a bool, we should have
+  // a way to set the reactor in an error state, and use that for viability.
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't open libucp: " << error.what();
+    return;
+  }
+  foundUcxLib_ = true;
+  ucs_status_t status;
+  std::tie(status, context_) = createUcxContext(ucxLib_);
+  if (status != UCS_OK) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't initialize UCX: "
+               << ucxLib_.ucs_status_string(status);
+    return;
+  }
+  worker_ = createUcxWorker(ucxLib_, context_);
+  workerAddress_ = ::tensorpipe::getUcxWorkerAddress(ucxLib_, worker_);
+  TP_VLOG(9) << "Transport context " << id_ << " has a worker whose address is "
+             << workerAddress_.size() << " bytes long";
+
+  startThread("TP_UCX_reactor");
+}
+
+bool Reactor::isViable() const {
+  return foundUcxLib_ && worker_ != nullptr;
+}
+
+void Reactor::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  return ucxLib_.ucp_worker_progress(worker_.get()) > 0;
+}
+
+bool Reactor::readyToClose() {
+  return connections_.empty();
+}
+
+void Reactor::registerConnection(std::shared_ptr<void> connection) {
+  connections_.insert(std::move(connection));
+}
+
+void Reactor::unregisterConnection(const std::shared_ptr<void>& connection) {
+  auto iter = connections_.find(connection);
+  TP_DCHECK(iter != connections_.end());
+  connections_.erase(iter);
+}
+
+} // namespace ucx
+} // namespace transport
+} // namespace tensorpipe
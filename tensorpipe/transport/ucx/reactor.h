@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/ucx.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace ucx {
+
+// Reactor loop.
+//
+// It owns the worker on which all the connections of the context create their
+// endpoints, and progresses it, which is when UCX invokes the callbacks of the
+// requests that completed. Since those callbacks get raw pointers to the
+// connections, the reactor keeps the connections alive until they unregister
+// themselves, which they do once they have no requests left in flight, and it
+// doesn't shut down before they all did, as their endpoints must be closed
+// before the worker is destroyed.
+//
+class Reactor final : public BusyPollingLoop {
+ public:
+  explicit Reactor(BusyPollingPolicy policy);
+
+  UcxLib& getUcxLib() {
+    return ucxLib_;
+  }
+
+  UcxWorker& getUcxWorker() {
+    return worker_;
+  }
+
+  // Where the peers have to create their endpoints to.
+  const std::string& getUcxWorkerAddress() const {
+    return workerAddress_;
+  }
+
+  void registerConnection(std::shared_ptr<void> connection);
+
+  void unregisterConnection(const std::shared_ptr<void>& connection);
+
+  bool isViable() const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+ private:
+  // The worker must be destroyed before the context it was created from.
+  bool foundUcxLib_{false};
+  UcxLib ucxLib_;
+  UcxContext context_;
+  UcxWorker worker_;
+  std::string workerAddress_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  std::unordered_set<std::shared_ptr<void>> connections_;
+};
+
+} // namespace ucx
+} // namespace transport
+} // namespace tensorpipe
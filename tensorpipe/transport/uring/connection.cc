@@ -0,0 +1,911 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/connection.h>
+
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/memory.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/common/stream_read_write_ops.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/uring/context_impl.h>
+#include <tensorpipe/transport/uring/loop.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+namespace {
+
+// The buffers the kernel copies incoming data into, before we copy it to the
+// memory of the read operations. Their total size bounds how much data can be
+// received ahead of the reads asking for it.
+constexpr uint32_t kNumBuffers = 8;
+constexpr size_t kBufferSize = 64 * 1024;
+
+// The most buffers that can be handed to a single sendmsg.
+constexpr size_t kMaxIovecs = 1024;
+
+} // namespace
+
+class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  Impl(std::shared_ptr<Context::PrivateIface>, Socket, std::string);
+
+  // Create a connection that connects to the specified address.
+  Impl(std::shared_ptr<Context::PrivateIface>, std::string, std::string);
+
+  // Initialize member fields that need `shared_from_this`.
+  void init();
+
+  // Queue a read operation.
+  void read(read_callback_fn fn);
+  void read(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void write(const void* ptr, size_t length, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
+  // Tell the connection what its identifier is.
+  void setId(std::string id);
+
+  // Shut down the connection and its resources.
+  void close();
+
+ private:
+  // Initialize member fields that need `shared_from_this`.
+  void initFromLoop();
+
+  // Queue a read operation.
+  void readFromLoop(read_callback_fn fn);
+  void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writevFromLoop(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
+  void setIdFromLoop_(std::string id);
+
+  // Shut down the connection and its resources.
+  void closeFromLoop();
+
+  // Set up the buffer ring and start receiving and sending data.
+  void startFromLoop_();
+
+  // Submit a (multishot) receive request, if none is in flight and there are
+  // buffers for the kernel to receive into.
+  void armRecvFromLoop_();
+
+  // Submit a send request with all the write operations that are queued, if
+  // none is in flight.
+  void sendFromLoop_();
+
+  // Copy the data that was received so far into the pending read operations.
+  void processReadOperationsFromLoop_();
+
+  // Give a buffer whose data was consumed back to the kernel.
+  void recycleBufferFromLoop_(uint16_t bufferId);
+
+  // Called when the request with the corresponding name completes.
+  void connectCallbackFromLoop_(int res);
+  void recvCallbackFromLoop_(int res, uint32_t flags);
+  void sendCallbackFromLoop_(int res);
+
+  void setError_(Error error);
+
+  // Deal with an error.
+  void handleError_();
+
+  // Fire the callbacks of all write operations with the error.
+  void failWriteOperations_();
+
+  // Once all the requests have completed, release the resources they used.
+  void releaseResourcesIfIdle_();
+
+  std::shared_ptr<Context::PrivateIface> context_;
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+  Error error_{Error::kSuccess};
+  ClosingReceiver closingReceiver_;
+
+  // Whether the socket is connected, and thus whether data can be sent on it.
+  bool connected_{false};
+
+  // The ring through which we provide buffers to the kernel (in the first page)
+  // followed by the buffers themselves.
+  MmappedPtr bufferRing_;
+  optional<uint16_t> bufferGroupId_;
+  uint16_t bufferRingTail_{0};
+  uint32_t numBuffersInRing_{0};
+
+  // Data that was received into some buffer but that hasn't been copied out to
+  // a read operation yet.
+  struct ReceivedChunk {
+    uint16_t bufferId;
+    size_t offset;
+    size_t length;
+  };
+  std::deque<ReceivedChunk> receivedChunks_;
+
+  // The requests that are in flight, if any.
+  optional<Loop::TRequestId> connectRequestId_;
+  optional<Loop::TRequestId> recvRequestId_;
+  optional<Loop::TRequestId> sendRequestId_;
+
+  std::deque<StreamReadOperation> readOperations_;
+  std::deque<StreamWriteOperation> writeOperations_;
+
+  // How many bytes of the first write operation have already been sent.
+  size_t bytesSentOfFirstWriteOperation_{0};
+
+  // The arguments of the send request in flight, which must stay valid until
+  // it completes.
+  std::vector<struct iovec> sendIovecs_;
+  struct msghdr sendMsg_;
+
+  // A sequence number for the calls to read and write.
+  uint64_t nextBufferBeingRead_{0};
+  uint64_t nextBufferBeingWritten_{0};
+
+  // A sequence number for the invocations of the callbacks of read and write.
+  uint64_t nextReadCallbackToCall_{0};
+  uint64_t nextWriteCallbackToCall_{0};
+
+  // An identifier for the connection, composed of the identifier for the
+  // context or listener, combined with an increasing sequence number. It will
+  // only be used for logging and debugging purposes.
+  std::string id_;
+
+  uint8_t* bufferPtr_(uint16_t bufferId) {
+    return bufferRing_.ptr() + ::sysconf(_SC_PAGESIZE) + bufferId * kBufferSize;
+  }
+};
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : context_(std::move(context)),
+      socket_(std::move(socket)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Connection::Impl::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  closingReceiver_.activate(*this);
+
+  Error error;
+  if (sockaddr_.has_value()) {
+    TP_DCHECK(!socket_.hasValue());
+    std::tie(error, socket_) =
+        Socket::createForFamily(sockaddr_->addr()->sa_family);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+  }
+  // The kernel takes care of waiting for the socket to become ready, whereas
+  // non-blocking sockets would have our requests fail with EAGAIN.
+  error = socket_.block(true);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+  int flag = 1;
+  int rv = ::setsockopt(
+      socket_.fd(), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+  if (rv < 0) {
+    setError_(TP_CREATE_ERROR(SystemError, "setsockopt", errno));
+    return;
+  }
+
+  if (!sockaddr_.has_value()) {
+    connected_ = true;
+    startFromLoop_();
+    return;
+  }
+
+  TP_VLOG(9) << "Connection " << id_ << " is connecting to "
+             << sockaddr_->str();
+  connectRequestId_ = context_->getLoop().submitFromLoop(
+      [this](struct io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = socket_.fd();
+        sqe.addr = reinterpret_cast<uint64_t>(sockaddr_->addr());
+        sqe.off = sockaddr_->addrlen();
+      },
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->connectCallbackFromLoop_(res);
+      });
+}
+
+void Connection::Impl::startFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+
+  const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  TP_DCHECK_LE(kNumBuffers * sizeof(struct io_uring_buf), pageSize);
+  bufferRing_ = MmappedPtr(
+      pageSize + kNumBuffers * kBufferSize,
+      PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS,
+      -1);
+  bufferGroupId_ = context_->getLoop().registerBufferRingFromLoop(
+      bufferRing_.ptr(), kNumBuffers);
+  for (uint16_t bufferId = 0; bufferId < kNumBuffers; bufferId++) {
+    recycleBufferFromLoop_(bufferId);
+  }
+
+  armRecvFromLoop_();
+  sendFromLoop_();
+}
+
+void Connection::Impl::recycleBufferFromLoop_(uint16_t bufferId) {
+  struct io_uring_buf& buf = getBufferRingEntry(
+      bufferRing_.ptr(), bufferRingTail_ & (kNumBuffers - 1));
+  buf.addr = reinterpret_cast<uint64_t>(bufferPtr_(bufferId));
+  buf.len = kBufferSize;
+  buf.bid = bufferId;
+  bufferRingTail_++;
+  // Publish the entry to the kernel, which reads the tail without locking.
+  getBufferRingTail(bufferRing_.ptr())
+      .store(bufferRingTail_, std::memory_order_release);
+  numBuffersInRing_++;
+}
+
+void Connection::Impl::armRecvFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  if (error_ || recvRequestId_.has_value() || numBuffersInRing_ == 0) {
+    return;
+  }
+
+  TP_VLOG(9) << "Connection " << id_ << " is arming a multishot receive";
+  recvRequestId_ = context_->getLoop().submitFromLoop(
+      [this](struct io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_RECV;
+        sqe.fd = socket_.fd();
+        sqe.flags = IOSQE_BUFFER_SELECT;
+        sqe.buf_group = bufferGroupId_.value();
+        sqe.ioprio = IORING_RECV_MULTISHOT;
+      },
+      [impl{shared_from_this()}](int res, uint32_t flags) {
+        impl->recvCallbackFromLoop_(res, flags);
+      });
+}
+
+void Connection::Impl::sendFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  if (error_ || !connected_ || sendRequestId_.has_value() ||
+      writeOperations_.empty()) {
+    return;
+  }
+
+  // All the write operations that are queued go out in a single request.
+  sendIovecs_.clear();
+  size_t bytesToSkip = bytesSentOfFirstWriteOperation_;
+  size_t bytesToSend = 0;
+  for (auto& writeOperation : writeOperations_) {
+    StreamWriteOperation::Buf* bufsPtr;
+    size_t bufsLen;
+    std::tie(bufsPtr, bufsLen) = writeOperation.getBufs();
+    for (size_t bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+      const StreamWriteOperation::Buf& buf = bufsPtr[bufIdx];
+      if (bytesToSkip >= buf.len) {
+        bytesToSkip -= buf.len;
+        continue;
+      }
+      if (sendIovecs_.size() == kMaxIovecs) {
+        break;
+      }
+      sendIovecs_.push_back(
+          iovec{buf.base + bytesToSkip, buf.len - bytesToSkip});
+      bytesToSend += buf.len - bytesToSkip;
+      bytesToSkip = 0;
+    }
+    if (sendIovecs_.size() == kMaxIovecs) {
+      break;
+    }
+  }
+
+  std::memset(&sendMsg_, 0, sizeof(sendMsg_));
+  sendMsg_.msg_iov = sendIovecs_.data();
+  sendMsg_.msg_iovlen = sendIovecs_.size();
+
+  const size_t zeroCopyThreshold = context_->getZeroCopyThreshold();
+  const bool zeroCopy =
+      zeroCopyThreshold > 0 && bytesToSend >= zeroCopyThreshold;
+
+  TP_VLOG(9) << "Connection " << id_ << " is sending " << bytesToSend
+             << " bytes in " << sendIovecs_.size() << " buffers"
+             << (zeroCopy ? " without copying them" : "");
+  sendRequestId_ = context_->getLoop().submitFromLoop(
+      [this, zeroCopy](struct io_uring_sqe& sqe) {
+        sqe.opcode = zeroCopy ? IORING_OP_SENDMSG_ZC : IORING_OP_SENDMSG;
+        sqe.fd = socket_.fd();
+        sqe.addr = reinterpret_cast<uint64_t>(&sendMsg_);
+        sqe.msg_flags = MSG_NOSIGNAL;
+        if (zeroCopy) {
+          sqe.ioprio = IORING_SEND_ZC_REPORT_USAGE;
+        }
+      },
+      [impl{shared_from_this()}, sendResult{0}](
+          int res, uint32_t flags) mutable {
+        // A zero-copy send completes twice: first with its result, and then,
+        // once the kernel no longer needs the buffers, with a notification. We
+        // can only consider it done (and fire the callbacks) after that.
+        if (flags & IORING_CQE_F_MORE) {
+          sendResult = res;
+          return;
+        }
+        if (flags & IORING_CQE_F_NOTIF) {
+          TP_VLOG(9) << "Connection " << impl->id_
+                     << " was notified that its zero-copy send is done"
+                     << ((res & IORING_NOTIF_USAGE_ZC_COPIED)
+                             ? " (but the data was copied nonetheless)"
+                             : "");
+          res = sendResult;
+        }
+        impl->sendCallbackFromLoop_(res);
+      });
+}
+
+void Connection::Impl::connectCallbackFromLoop_(int res) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has completed connecting ("
+             << (res < 0 ? std::strerror(-res) : "success") << ")";
+
+  connectRequestId_.reset();
+  if (res < 0) {
+    setError_(TP_CREATE_ERROR(SystemError, "connect", -res));
+  } else if (!error_) {
+    connected_ = true;
+    startFromLoop_();
+  }
+  releaseResourcesIfIdle_();
+}
+
+void Connection::Impl::recvCallbackFromLoop_(int res, uint32_t flags) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has completed receiving some data ("
+             << (res >= 0 ? std::to_string(res) + " bytes"
+                          : std::strerror(-res))
+             << ")";
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    recvRequestId_.reset();
+  }
+
+  if (res > 0) {
+    TP_DCHECK(flags & IORING_CQE_F_BUFFER);
+    TP_DCHECK_GT(numBuffersInRing_, 0);
+    numBuffersInRing_--;
+    if (!error_) {
+      const uint16_t bufferId = flags >> IORING_CQE_BUFFER_SHIFT;
+      receivedChunks_.push_back(
+          ReceivedChunk{bufferId, 0, static_cast<size_t>(res)});
+      processReadOperationsFromLoop_();
+    }
+  } else if (res == 0) {
+    setError_(TP_CREATE_ERROR(EOFError));
+  } else if (res == -ENOBUFS) {
+    // All buffers are full of data that no read operation has asked for yet.
+    // The receive will be re-armed once some of them have been consumed.
+  } else {
+    setError_(TP_CREATE_ERROR(SystemError, "recv", -res));
+  }
+
+  // The request may also have terminated because the kernel ran out of buffers
+  // (some of which we may have recycled since) or for some other reason (e.g.,
+  // some internal limit of the kernel), in which case we start a new one.
+  armRecvFromLoop_();
+  releaseResourcesIfIdle_();
+}
+
+void Connection::Impl::sendCallbackFromLoop_(int res) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " has completed a send request ("
+             << (res >= 0 ? std::to_string(res) + " bytes"
+                          : std::strerror(-res))
+             << ")";
+
+  sendRequestId_.reset();
+
+  if (res < 0) {
+    setError_(TP_CREATE_ERROR(SystemError, "sendmsg", -res));
+  }
+  if (error_) {
+    // We could only fire the callbacks of the write operations now that the
+    // kernel is done with their buffers.
+    failWriteOperations_();
+    releaseResourcesIfIdle_();
+    return;
+  }
+
+  // Set aside the write operations that are fully sent, and resume sending the
+  // others, before calling any callback, as those may queue more writes.
+  std::deque<StreamWriteOperation> completedWriteOperations;
+  size_t bytesSent = bytesSentOfFirstWriteOperation_ + res;
+  while (!writeOperations_.empty()) {
+    auto& writeOperation = writeOperations_.front();
+    StreamWriteOperation::Buf* bufsPtr;
+    size_t bufsLen;
+    std::tie(bufsPtr, bufsLen) = writeOperation.getBufs();
+    size_t length = 0;
+    for (size_t bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+      length += bufsPtr[bufIdx].len;
+    }
+    if (bytesSent < length) {
+      break;
+    }
+    bytesSent -= length;
+    completedWriteOperations.push_back(std::move(writeOperation));
+    writeOperations_.pop_front();
+  }
+  bytesSentOfFirstWriteOperation_ = bytesSent;
+
+  sendFromLoop_();
+
+  for (auto& writeOperation : completedWriteOperations) {
+    writeOperation.callbackFromLoop(Error::kSuccess);
+  }
+}
+
+void Connection::Impl::processReadOperationsFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+
+  while (!readOperations_.empty() && !receivedChunks_.empty()) {
+    auto& readOperation = readOperations_.front();
+    ReceivedChunk& chunk = receivedChunks_.front();
+    char* ptr;
+    size_t length;
+    readOperation.allocFromLoop(&ptr, &length);
+    length = std::min(length, chunk.length);
+    std::memcpy(ptr, bufferPtr_(chunk.bufferId) + chunk.offset, length);
+    readOperation.readFromLoop(length);
+    chunk.offset += length;
+    chunk.length -= length;
+    if (chunk.length == 0) {
+      recycleBufferFromLoop_(chunk.bufferId);
+      receivedChunks_.pop_front();
+    }
+    if (readOperation.completeFromLoop()) {
+      // Remove the operation before calling its callback, which may queue more
+      // read operations (and thus process them).
+      StreamReadOperation completedReadOperation = std::move(readOperation);
+      readOperations_.pop_front();
+      completedReadOperation.callbackFromLoop(Error::kSuccess);
+    }
+  }
+
+  // Consuming data may have freed up the buffers that the kernel was lacking.
+  armRecvFromLoop_();
+}
+
+void Connection::Impl::readFromLoop(read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_, nullptr, 0);
+    return;
+  }
+
+  readOperations_.emplace_back(std::move(fn));
+
+  processReadOperationsFromLoop_();
+}
+
+void Connection::Impl::readFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_, ptr, length);
+    return;
+  }
+
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+
+  processReadOperationsFromLoop_();
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  processReadOperationsFromLoop_();
+}
+
+void Connection::Impl::writeFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a write callback (#"
+               << sequenceNumber << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+
+  sendFromLoop_();
+}
+
+void Connection::Impl::writevFromLoop(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  sendFromLoop_();
+}
+
+void Connection::Impl::setId(std::string id) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, id{std::move(id)}]() mutable {
+        impl->setIdFromLoop_(std::move(id));
+      });
+}
+
+void Connection::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Connection::Impl::close() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->closeFromLoop(); });
+}
+
+void Connection::Impl::closeFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ConnectionClosedError));
+}
+
+void Connection::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError_();
+}
+
+void Connection::Impl::handleError_() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
+
+  for (auto& readOperation : readOperations_) {
+    readOperation.callbackFromLoop(error_);
+  }
+  readOperations_.clear();
+  receivedChunks_.clear();
+
+  // The kernel may still be accessing the buffers of the write operations that
+  // are part of a send in flight, in which case we must wait for it to complete
+  // before firing their callbacks (or else the user may deallocate them).
+  if (!sendRequestId_.has_value()) {
+    failWriteOperations_();
+  }
+
+  Loop& loop = context_->getLoop();
+  if (connectRequestId_.has_value()) {
+    loop.cancelFromLoop(connectRequestId_.value());
+  }
+  if (recvRequestId_.has_value()) {
+    loop.cancelFromLoop(recvRequestId_.value());
+  }
+  if (sendRequestId_.has_value()) {
+    loop.cancelFromLoop(sendRequestId_.value());
+  }
+
+  releaseResourcesIfIdle_();
+}
+
+void Connection::Impl::failWriteOperations_() {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(error_);
+
+  // Callbacks may queue more write operations, which fail immediately.
+  std::deque<StreamWriteOperation> writeOperations;
+  std::swap(writeOperations, writeOperations_);
+  for (auto& writeOperation : writeOperations) {
+    writeOperation.callbackFromLoop(error_);
+  }
+}
+
+void Connection::Impl::releaseResourcesIfIdle_() {
+  TP_DCHECK(context_->inLoop());
+  if (!error_ || connectRequestId_.has_value() || recvRequestId_.has_value() ||
+      sendRequestId_.has_value()) {
+    return;
+  }
+
+  TP_VLOG(9)
+      << "Connection " << id_
+      << " has no more requests in flight and is releasing its resources";
+  if (bufferGroupId_.has_value()) {
+    context_->getLoop().unregisterBufferRingFromLoop(bufferGroupId_.value());
+    bufferGroupId_.reset();
+    bufferRing_.reset();
+  }
+  socket_.reset();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(socket),
+          std::move(id))) {
+  impl_->init();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(addr),
+          std::move(id))) {
+  impl_->init();
+}
+
+void Connection::Impl::init() {
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+}
+
+void Connection::read(read_callback_fn fn) {
+  impl_->read(std::move(fn));
+}
+
+void Connection::Impl::read(read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(std::move(fn));
+      });
+}
+
+void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
+  impl_->read(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::read(void* ptr, size_t length, read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
+  impl_->write(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Connection::close() {
+  impl_->close();
+}
+
+Connection::~Connection() {
+  close();
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/transport/uring/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class Loop;
+
+class Context::PrivateIface : public DeferredExecutor {
+ public:
+  virtual ClosingEmitter& getClosingEmitter() = 0;
+
+  virtual Loop& getLoop() = 0;
+
+  virtual size_t getZeroCopyThreshold() = 0;
+
+  virtual ~PrivateIface() = default;
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/error.h>
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <sstream>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+std::string GetaddrinfoError::what() const {
+  std::ostringstream ss;
+  ss << "getaddrinfo: " << gai_strerror(error_);
+  return ss.str();
+}
+
+std::string NoAddrFoundError::what() const {
+  return "no address found";
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/listener.h>
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/uring/connection.h>
+#include <tensorpipe/transport/uring/context_impl.h>
+#include <tensorpipe/transport/uring/loop.h>
+#include <tensorpipe/transport/uring/sockaddr.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+class Listener::Impl : public std::enable_shared_from_this<Listener::Impl> {
+ public:
+  // Create a listener that listens on the specified address.
+  Impl(
+      std::shared_ptr<Context::PrivateIface> context,
+      std::string addr,
+      std::string id);
+
+  // Initialize member fields that need `shared_from_this`.
+  void init();
+
+  // Queue a callback to be called when a connection comes in.
+  void accept(accept_callback_fn fn);
+
+  // Obtain the listener's address.
+  std::string addr() const;
+
+  // Tell the listener what its identifier is.
+  void setId(std::string id);
+
+  // Shut down the connection and its resources.
+  void close();
+
+ private:
+  // Initialize member fields that need `shared_from_this`.
+  void initFromLoop();
+
+  // Queue a callback to be called when a connection comes in.
+  void acceptFromLoop(accept_callback_fn fn);
+
+  // Obtain the listener's address.
+  std::string addrFromLoop() const;
+
+  void setIdFromLoop_(std::string id);
+
+  // Shut down the connection and its resources.
+  void closeFromLoop();
+
+  // Submit an accept request, if there are callbacks waiting for connections
+  // and no request is in flight already.
+  void armAcceptFromLoop_();
+
+  // Called when the accept request completes.
+  void acceptCallbackFromLoop_(int res);
+
+  void setError_(Error error);
+
+  // Deal with an error.
+  void handleError();
+
+  std::shared_ptr<Context::PrivateIface> context_;
+  Socket socket_;
+  Sockaddr sockaddr_;
+  Error error_{Error::kSuccess};
+  std::deque<accept_callback_fn> fns_;
+  optional<Loop::TRequestId> acceptRequestId_;
+  ClosingReceiver closingReceiver_;
+
+  // A sequence number for the calls to accept.
+  uint64_t nextConnectionBeingAccepted_{0};
+
+  // A sequence number for the invocations of the callbacks of accept.
+  uint64_t nextAcceptCallbackToCall_{0};
+
+  // An identifier for the listener, composed of the identifier for the context,
+  // combined with an increasing sequence number. It will be used as a prefix
+  // for the identifiers of connections. All of them will only be used for
+  // logging and debugging purposes.
+  std::string id_;
+
+  // Sequence numbers for the connections created by this listener, used to
+  // create their identifiers based off this listener's identifier. They will
+  // only be used for logging and debugging.
+  std::atomic<uint64_t> connectionCounter_{0};
+};
+
+Listener::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Listener::Impl::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  closingReceiver_.activate(*this);
+
+  Error error;
+  TP_DCHECK(!socket_.hasValue());
+  std::tie(error, socket_) =
+      Socket::createForFamily(sockaddr_.addr()->sa_family);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+  error = socket_.reuseAddr(true);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+  error = socket_.bind(sockaddr_);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+  // The kernel takes care of waiting for connections to come in.
+  error = socket_.block(true);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+  error = socket_.listen(128);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+}
+
+Listener::Listener(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(addr),
+          std::move(id))) {
+  impl_->init();
+}
+
+void Listener::Impl::init() {
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+}
+
+void Listener::Impl::closeFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Listener " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ListenerClosedError));
+}
+
+void Listener::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError();
+}
+
+void Listener::Impl::handleError() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Listener " << id_ << " is handling error " << error_.what();
+
+  if (acceptRequestId_.has_value()) {
+    context_->getLoop().cancelFromLoop(acceptRequestId_.value());
+  } else {
+    socket_.reset();
+  }
+  for (auto& fn : fns_) {
+    fn(error_, std::shared_ptr<Connection>());
+  }
+  fns_.clear();
+}
+
+void Listener::close() {
+  impl_->close();
+}
+
+void Listener::Impl::close() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->closeFromLoop(); });
+}
+
+Listener::~Listener() {
+  close();
+}
+
+void Listener::accept(accept_callback_fn fn) {
+  impl_->accept(std::move(fn));
+}
+
+void Listener::Impl::accept(accept_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        impl->acceptFromLoop(std::move(fn));
+      });
+}
+
+void Listener::Impl::acceptFromLoop(accept_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextConnectionBeingAccepted_++;
+  TP_VLOG(7) << "Listener " << id_ << " received an accept request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error,
+           std::shared_ptr<transport::Connection> connection) {
+    TP_DCHECK_EQ(sequenceNumber, nextAcceptCallbackToCall_++);
+    TP_VLOG(7) << "Listener " << id_ << " is calling an accept callback (#"
+               << sequenceNumber << ")";
+    fn(error, std::move(connection));
+    TP_VLOG(7) << "Listener " << id_ << " done calling an accept callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_, std::shared_ptr<Connection>());
+    return;
+  }
+
+  fns_.push_back(std::move(fn));
+
+  armAcceptFromLoop_();
+}
+
+void Listener::Impl::armAcceptFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  if (error_ || fns_.empty() || acceptRequestId_.has_value()) {
+    return;
+  }
+
+  acceptRequestId_ = context_->getLoop().submitFromLoop(
+      [this](struct io_uring_sqe& sqe) {
+        sqe.opcode = IORING_OP_ACCEPT;
+        sqe.fd = socket_.fd();
+        sqe.accept_flags = SOCK_CLOEXEC;
+      },
+      [impl{shared_from_this()}](int res, uint32_t /* unused */) {
+        impl->acceptCallbackFromLoop_(res);
+      });
+}
+
+std::string Listener::addr() const {
+  return impl_->addr();
+}
+
+std::string Listener::Impl::addr() const {
+  std::string addr;
+  context_->runInLoop([this, &addr]() { addr = addrFromLoop(); });
+  return addr;
+}
+
+std::string Listener::Impl::addrFromLoop() const {
+  TP_DCHECK(context_->inLoop());
+  struct sockaddr_storage ss;
+  struct sockaddr* addr = reinterpret_cast<struct sockaddr*>(&ss);
+  socklen_t addrlen = sizeof(ss);
+  int rv = getsockname(socket_.fd(), addr, &addrlen);
+  TP_THROW_SYSTEM_IF(rv < 0, errno);
+  return Sockaddr(addr, addrlen).str();
+}
+
+void Listener::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Listener::Impl::setId(std::string id) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, id{std::move(id)}]() mutable {
+        impl->setIdFromLoop_(std::move(id));
+      });
+}
+
+void Listener::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Listener " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Listener::Impl::acceptCallbackFromLoop_(int res) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Listener " << id_ << " has completed an accept request ("
+             << (res >= 0 ? "success" : std::strerror(-res)) << ")";
+
+  acceptRequestId_.reset();
+
+  if (error_) {
+    // The request was cancelled (or completed while being so), and the
+    // callbacks were already fired: we can now let go of the socket, and of
+    // the connection that may have come in nonetheless.
+    if (res >= 0) {
+      Socket(res).reset();
+    }
+    socket_.reset();
+    return;
+  }
+  if (res < 0) {
+    setError_(TP_CREATE_ERROR(SystemError, "accept", -res));
+    return;
+  }
+
+  TP_DCHECK(!fns_.empty())
+      << "accept requests are only submitted when there are callbacks waiting";
+  auto fn = std::move(fns_.front());
+  fns_.pop_front();
+  armAcceptFromLoop_();
+  std::string connectionId = id_ + ".c" + std::to_string(connectionCounter_++);
+  TP_VLOG(7) << "Listener " << id_ << " is opening connection " << connectionId;
+  fn(Error::kSuccess,
+     std::make_shared<Connection>(
+         Connection::ConstructorToken(),
+         context_,
+         Socket(res),
+         std::move(connectionId)));
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,498 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uring/loop.h>
+
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstring>
+#include <thread>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/system.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+namespace {
+
+// This bounds the number of requests that can be queued between two trips to
+// the kernel, not the number of requests that can be in flight (there is no
+// such limit, as the kernel never drops completions, see IORING_FEAT_NODROP).
+constexpr uint32_t kNumEntries = 256;
+
+// How long the kernel thread polling the submission queue (if any) keeps doing
+// so after it last found something, before going to sleep.
+constexpr uint32_t kSqPollIdleMs = 100;
+
+int ioUringSetup(uint32_t entries, struct io_uring_params* params) {
+  return ::syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ioUringEnter(
+    int fd,
+    uint32_t toSubmit,
+    uint32_t minComplete,
+    uint32_t flags) {
+  return ::syscall(
+      __NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+int ioUringRegister(int fd, uint32_t opcode, void* arg, uint32_t numArgs) {
+  return ::syscall(__NR_io_uring_register, fd, opcode, arg, numArgs);
+}
+
+} // namespace
+
+struct io_uring_buf& getBufferRingEntry(void* ring, uint32_t idx) {
+  return reinterpret_cast<struct io_uring_buf*>(ring)[idx];
+}
+
+std::atomic<uint16_t>& getBufferRingTail(void* ring) {
+  // The tail overlays the reserved field of the first entry.
+  static_assert(
+      offsetof(struct io_uring_buf, resv) == sizeof(struct io_uring_buf) - 2,
+      "");
+  return *reinterpret_cast<std::atomic<uint16_t>*>(
+      reinterpret_cast<uint8_t*>(ring) + offsetof(struct io_uring_buf, resv));
+}
+
+Loop::Loop(bool useSqPoll) : useSqPoll_(useSqPoll) {
+  int fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  TP_THROW_SYSTEM_IF(fd < 0, errno);
+  eventFd_ = Fd(fd);
+
+  // FIXME Instead of setting a bool, we should have a way to set the loop in an
+  // error state, and use that for viability.
+  viable_ = setUpRing_() && probeBufferRings_();
+  supportsZeroCopySend_ = viable_ && probeOpcode_(IORING_OP_SENDMSG_ZC);
+
+  startThread("TP_URING_loop");
+}
+
+bool Loop::setUpRing_() {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  if (useSqPoll_) {
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = kSqPollIdleMs;
+  }
+  int fd = ioUringSetup(kNumEntries, &params);
+  if (fd < 0) {
+    TP_VLOG(7) << "Transport context " << id_
+               << " couldn't set up an io_uring instance: "
+               << std::strerror(errno);
+    return false;
+  }
+  ringFd_ = Fd(fd);
+  if (!(params.features & IORING_FEAT_NODROP)) {
+    TP_VLOG(7) << "Transport context " << id_
+               << " found that io_uring may drop completions";
+    return false;
+  }
+
+  sqRing_ = MmappedPtr(
+      params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ringFd_.fd(),
+      IORING_OFF_SQ_RING);
+  cqRing_ = MmappedPtr(
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe),
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ringFd_.fd(),
+      IORING_OFF_CQ_RING);
+  sqes_ = MmappedPtr(
+      params.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      ringFd_.fd(),
+      IORING_OFF_SQES);
+
+  uint8_t* sq = sqRing_.ptr();
+  sqHead_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.head);
+  sqTail_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.tail);
+  sqFlags_ = reinterpret_cast<std::atomic<uint32_t>*>(sq + params.sq_off.flags);
+  sqMask_ = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+  sqEntries_ = params.sq_entries;
+  sqArray_ = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+  uint8_t* cq = cqRing_.ptr();
+  cqHead_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.head);
+  cqTail_ = reinterpret_cast<std::atomic<uint32_t>*>(cq + params.cq_off.tail);
+  cqMask_ = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+  sqeArray_ = reinterpret_cast<struct io_uring_sqe*>(sqes_.ptr());
+
+  sqLocalTail_ = sqTail_->load(std::memory_order_relaxed);
+
+  return true;
+}
+
+bool Loop::probeBufferRings_() {
+  // Connections receive through multishot requests drawing from provided
+  // buffer rings, which only recent kernels support (and older ones may accept
+  // the former and then fail it, hence we check that a receive really works).
+  // This runs before the thread is started, hence it's as if it was in loop.
+  Fd sockets[2];
+  {
+    int fds[2];
+    int ret = ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds);
+    TP_THROW_SYSTEM_IF(ret < 0, errno);
+    sockets[0] = Fd(fds[0]);
+    sockets[1] = Fd(fds[1]);
+  }
+
+  const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  MmappedPtr ring(
+      2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1);
+  uint8_t* buffer = ring.ptr() + pageSize;
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring.ptr());
+  reg.ring_entries = 1;
+  reg.bgid = 0;
+  int ret = ioUringRegister(ringFd_.fd(), IORING_REGISTER_PBUF_RING, &reg, 1);
+  if (ret < 0) {
+    TP_VLOG(7) << "Transport context " << id_
+               << " couldn't register a provided buffer ring: "
+               << std::strerror(errno);
+    return false;
+  }
+  struct io_uring_buf& buf = getBufferRingEntry(ring.ptr(), 0);
+  buf.addr = reinterpret_cast<uint64_t>(buffer);
+  buf.len = pageSize;
+  buf.bid = 0;
+  getBufferRingTail(ring.ptr()).store(1, std::memory_order_release);
+
+  // Send one byte and then close the sending end, which should produce two
+  // completions: one (with more to come) for the byte, and a final one for the
+  // EOF. If multishot isn't supported, we'll instead get a single error one.
+  char byte = 42;
+  ssize_t written = ::write(sockets[1].fd(), &byte, sizeof(byte));
+  TP_THROW_SYSTEM_IF(written != sizeof(byte), errno);
+  sockets[1].reset();
+  {
+    struct io_uring_sqe& sqe = getSqe_();
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = sockets[0].fd();
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = 0;
+    sqe.ioprio = IORING_RECV_MULTISHOT;
+    sqe.user_data = kCancelRequestId;
+  }
+  bool success = false;
+  bool over = false;
+  while (!over) {
+    submitAndWait_();
+    uint32_t head = cqHead_->load(std::memory_order_relaxed);
+    while (head != cqTail_->load(std::memory_order_acquire)) {
+      const struct io_uring_cqe& cqe = cqes_[head & cqMask_];
+      if (cqe.flags & IORING_CQE_F_MORE) {
+        success = cqe.res == sizeof(byte) &&
+            (cqe.flags & IORING_CQE_F_BUFFER) && buffer[0] == byte;
+      } else {
+        over = true;
+      }
+      head++;
+      cqHead_->store(head, std::memory_order_release);
+    }
+  }
+
+  ret = ioUringRegister(ringFd_.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  TP_THROW_SYSTEM_IF(ret < 0, errno);
+
+  if (!success) {
+    TP_VLOG(7) << "Transport context " << id_
+               << " found that multishot receives aren't supported";
+  }
+  return success;
+}
+
+bool Loop::probeOpcode_(uint8_t opcode) {
+  constexpr size_t kMaxOps = 256;
+  std::vector<uint8_t> buffer(
+      sizeof(struct io_uring_probe) +
+      kMaxOps * sizeof(struct io_uring_probe_op));
+  auto probe = reinterpret_cast<struct io_uring_probe*>(buffer.data());
+  int ret =
+      ioUringRegister(ringFd_.fd(), IORING_REGISTER_PROBE, probe, kMaxOps);
+  if (ret < 0) {
+    TP_VLOG(7) << "Transport context " << id_
+               << " couldn't probe the supported opcodes: "
+               << std::strerror(errno);
+    return false;
+  }
+  return opcode < probe->ops_len &&
+      (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+}
+
+bool Loop::isViable() const {
+  return viable_;
+}
+
+bool Loop::supportsZeroCopySend() const {
+  return supportsZeroCopySend_;
+}
+
+struct io_uring_sqe& Loop::getSqe_() {
+  while (sqLocalTail_ - sqHead_->load(std::memory_order_acquire) >=
+         sqEntries_) {
+    // The submission queue is full, hence we must hand its entries over.
+    flushSubmissions_();
+    if (useSqPoll_) {
+      std::this_thread::yield();
+    }
+  }
+  uint32_t idx = sqLocalTail_ & sqMask_;
+  sqArray_[idx] = idx;
+  struct io_uring_sqe& sqe = sqeArray_[idx];
+  std::memset(&sqe, 0, sizeof(sqe));
+  sqLocalTail_++;
+  return sqe;
+}
+
+void Loop::flushSubmissions_() {
+  uint32_t publishedTail = sqTail_->load(std::memory_order_relaxed);
+  if (sqLocalTail_ != publishedTail) {
+    numUnsubmitted_ += sqLocalTail_ - publishedTail;
+    sqTail_->store(sqLocalTail_, std::memory_order_release);
+  }
+  if (useSqPoll_) {
+    // Pairs with a barrier in the kernel thread, to make sure that either we
+    // see that it went to sleep or it sees the entries we just published.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sqFlags_->load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+      ioUringEnter(ringFd_.fd(), 0, 0, IORING_ENTER_SQ_WAKEUP);
+    }
+    numUnsubmitted_ = 0;
+  } else if (numUnsubmitted_ > 0) {
+    int ret = ioUringEnter(ringFd_.fd(), numUnsubmitted_, 0, 0);
+    if (ret < 0) {
+      TP_THROW_SYSTEM_IF(
+          errno != EINTR && errno != EAGAIN && errno != EBUSY, errno);
+      return;
+    }
+    numUnsubmitted_ -= ret;
+  }
+}
+
+void Loop::submitAndWait_() {
+  uint32_t publishedTail = sqTail_->load(std::memory_order_relaxed);
+  if (sqLocalTail_ != publishedTail) {
+    numUnsubmitted_ += sqLocalTail_ - publishedTail;
+    sqTail_->store(sqLocalTail_, std::memory_order_release);
+  }
+
+  uint32_t flags = IORING_ENTER_GETEVENTS;
+  uint32_t toSubmit = 0;
+  if (useSqPoll_) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sqFlags_->load(std::memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    numUnsubmitted_ = 0;
+  } else {
+    toSubmit = numUnsubmitted_;
+  }
+
+  // Submit all the requests queued since the last time and, in the same system
+  // call, wait for at least one completion (unless some are already there).
+  const bool haveCompletions = cqHead_->load(std::memory_order_relaxed) !=
+      cqTail_->load(std::memory_order_acquire);
+  int ret =
+      ioUringEnter(ringFd_.fd(), toSubmit, haveCompletions ? 0 : 1, flags);
+  if (ret < 0) {
+    // These are transient: we were interrupted by a signal, or the kernel
+    // wants us to reap completions before it accepts new submissions.
+    TP_THROW_SYSTEM_IF(
+        errno != EINTR && errno != EAGAIN && errno != EBUSY, errno);
+    return;
+  }
+  if (!useSqPoll_) {
+    numUnsubmitted_ -= ret;
+  }
+}
+
+void Loop::reapCompletions_() {
+  uint32_t head = cqHead_->load(std::memory_order_relaxed);
+  while (head != cqTail_->load(std::memory_order_acquire)) {
+    const struct io_uring_cqe& cqe = cqes_[head & cqMask_];
+    const TRequestId requestId = cqe.user_data;
+    const int res = cqe.res;
+    const uint32_t flags = cqe.flags;
+    // Release the slot before processing the completion, as the latter may
+    // lead to more requests, and thus eventually to more completions.
+    head++;
+    cqHead_->store(head, std::memory_order_release);
+
+    if (requestId == kWakeupRequestId) {
+      handleWakeup_();
+      continue;
+    }
+    if (requestId == kCancelRequestId) {
+      continue;
+    }
+    auto iter = pendingRequests_.find(requestId);
+    TP_DCHECK(iter != pendingRequests_.end());
+    if (flags & IORING_CQE_F_MORE) {
+      // References to the elements of an unordered_map stay valid as others are
+      // added and removed, hence this is safe even if the callback does so.
+      iter->second(res, flags);
+    } else {
+      completion_fn fn = std::move(iter->second);
+      pendingRequests_.erase(iter);
+      fn(res, flags);
+    }
+  }
+}
+
+Loop::TRequestId Loop::submitFromLoop(
+    const prepare_fn& prepare,
+    completion_fn fn) {
+  TP_DCHECK(inLoop());
+  if (!viable_ || done_) {
+    // The latter happens if some object that was already closed tries to do
+    // some I/O after the loop terminated: there is no one to reap the result.
+    fn(-ECANCELED, 0);
+    return kCancelRequestId;
+  }
+  TRequestId requestId = nextRequestId_++;
+  struct io_uring_sqe& sqe = getSqe_();
+  prepare(sqe);
+  sqe.user_data = requestId;
+  pendingRequests_.emplace(requestId, std::move(fn));
+  return requestId;
+}
+
+void Loop::cancelFromLoop(TRequestId requestId) {
+  if (!viable_ || done_) {
+    return;
+  }
+  struct io_uring_sqe& sqe = getSqe_();
+  sqe.opcode = IORING_OP_ASYNC_CANCEL;
+  sqe.addr = requestId;
+  sqe.user_data = kCancelRequestId;
+}
+
+uint16_t Loop::registerBufferRingFromLoop(void* ring, uint32_t numEntries) {
+  uint16_t bufferGroupId;
+  if (!freeBufferGroupIds_.empty()) {
+    bufferGroupId = freeBufferGroupIds_.back();
+    freeBufferGroupIds_.pop_back();
+  } else {
+    TP_THROW_ASSERT_IF(nextBufferGroupId_ == UINT16_MAX)
+        << "Too many buffer groups";
+    bufferGroupId = nextBufferGroupId_++;
+  }
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+  reg.ring_entries = numEntries;
+  reg.bgid = bufferGroupId;
+  int ret = ioUringRegister(ringFd_.fd(), IORING_REGISTER_PBUF_RING, &reg, 1);
+  TP_THROW_SYSTEM_IF(ret < 0, errno);
+  return bufferGroupId;
+}
+
+void Loop::unregisterBufferRingFromLoop(uint16_t bufferGroupId) {
+  struct io_uring_buf_reg reg;
+  std::memset(&reg, 0, sizeof(reg));
+  reg.bgid = bufferGroupId;
+  int ret = ioUringRegister(ringFd_.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  TP_THROW_SYSTEM_IF(ret < 0, errno);
+  freeBufferGroupIds_.push_back(bufferGroupId);
+}
+
+void Loop::armWakeup_() {
+  struct io_uring_sqe& sqe = getSqe_();
+  sqe.opcode = IORING_OP_POLL_ADD;
+  sqe.fd = eventFd_.fd();
+  sqe.poll32_events = POLLIN;
+  sqe.user_data = kWakeupRequestId;
+}
+
+void Loop::handleWakeup_() {
+  uint64_t count;
+  // The eventfd is non-blocking, and it's fine if it was already drained.
+  ssize_t ret = ::read(eventFd_.fd(), &count, sizeof(count));
+  TP_THROW_SYSTEM_IF(ret < 0 && errno != EAGAIN, errno);
+  runDeferredFunctionsFromEventLoop();
+  armWakeup_();
+}
+
+void Loop::eventLoop() {
+  if (!viable_) {
+    // We still need to act as a deferred executor, if only to close cleanly.
+    while (!closing_) {
+      struct pollfd pfd;
+      pfd.fd = eventFd_.fd();
+      pfd.events = POLLIN;
+      ::poll(&pfd, 1, -1);
+      uint64_t count;
+      ::read(eventFd_.fd(), &count, sizeof(count));
+      runDeferredFunctionsFromEventLoop();
+    }
+    done_ = true;
+    return;
+  }
+
+  armWakeup_();
+  while (true) {
+    submitAndWait_();
+    reapCompletions_();
+    // We can only stop once all the objects have finished their I/O, as their
+    // completions (which may still come) would otherwise never be delivered.
+    if (closing_ && pendingRequests_.empty()) {
+      break;
+    }
+  }
+  done_ = true;
+}
+
+void Loop::wakeupEventLoopToDeferFunction() {
+  uint64_t one = 1;
+  ssize_t ret = ::write(eventFd_.fd(), &one, sizeof(one));
+  TP_THROW_SYSTEM_IF(ret != sizeof(one), errno);
+}
+
+void Loop::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Loop::close() {
+  if (!closed_.exchange(true)) {
+    // Go through the loop so that this happens after the objects that were
+    // closed before it have started winding down (e.g., cancelled requests).
+    deferToLoop([this]() { closing_ = true; });
+  }
+}
+
+void Loop::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Loop::~Loop() noexcept {
+  join();
+}
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
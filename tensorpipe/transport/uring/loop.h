@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/deferred_executor.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/function.h>
+#include <tensorpipe/common/memory.h>
+
+struct io_uring_buf;
+struct io_uring_cqe;
+struct io_uring_sqe;
+
+namespace tensorpipe {
+namespace transport {
+namespace uring {
+
+// Access the entries and the tail of a ring of provided buffers. The kernel's
+// struct io_uring_buf_ring can't be used for that from C++, as its flexible
+// array member gets laid out at a different offset than in C.
+struct io_uring_buf& getBufferRingEntry(void* ring, uint32_t idx);
+std::atomic<uint16_t>& getBufferRingTail(void* ring);
+
+// Event loop built on an io_uring instance.
+//
+// Objects running on this loop queue their I/O requests as submission queue
+// entries, and are called back when the corresponding completions come in.
+// Requests aren't submitted to the kernel one by one: they are accumulated and
+// handed over all at once when the loop is about to wait for completions, so
+// that the work done in response to a series of events costs a single system
+// call. Optionally, the submission queue can be polled by a kernel thread
+// (SQPOLL), in which case in steady state no system call is needed at all to
+// submit new requests.
+//
+// Everything must be done from within the loop (see DeferredExecutor).
+class Loop final : public EventLoopDeferredExecutor {
+ public:
+  // Called for each completion of a request, with its result and flags. For
+  // multishot requests, it may be called multiple times, and the last time
+  // will be the one whose flags don't contain IORING_CQE_F_MORE.
+  using completion_fn = Function<void(int res, uint32_t flags)>;
+
+  using prepare_fn = Function<void(struct io_uring_sqe& sqe)>;
+
+  using TRequestId = uint64_t;
+
+  explicit Loop(bool useSqPoll = false);
+
+  // Whether io_uring, and all the parts of it this transport depends on (e.g.,
+  // provided buffer rings and multishot receives), are supported and usable.
+  bool isViable() const;
+
+  // Whether the kernel supports sending data without copying it to the socket
+  // buffers (IORING_OP_SENDMSG_ZC).
+  bool supportsZeroCopySend() const;
+
+  // Obtain a submission queue entry, have the given function fill it in with
+  // the details of the request, and queue it for submission.
+  TRequestId submitFromLoop(const prepare_fn& prepare, completion_fn fn);
+
+  // Ask the kernel to cancel a request. This is asynchronous: the request's
+  // completion will still be delivered (most likely with -ECANCELED).
+  void cancelFromLoop(TRequestId requestId);
+
+  // Register a ring of buffers that the kernel will pick from when receiving
+  // data, and return the identifier of its buffer group. The ring must be
+  // page-aligned and remain valid until it's unregistered.
+  uint16_t registerBufferRingFromLoop(void* ring, uint32_t numEntries);
+
+  void unregisterBufferRingFromLoop(uint16_t bufferGroupId);
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Loop() noexcept;
+
+ protected:
+  // Event loop thread entry function.
+  void eventLoop() override;
+
+  // Wake up the event loop.
+  void wakeupEventLoopToDeferFunction() override;
+
+ private:
+  static constexpr TRequestId kWakeupRequestId = 0;
+  static constexpr TRequestId kCancelRequestId = UINT64_MAX;
+
+  bool viable_{false};
+  bool supportsZeroCopySend_{false};
+  const bool useSqPoll_;
+
+  Fd ringFd_;
+  Fd eventFd_;
+
+  // The memory shared with the kernel.
+  MmappedPtr sqRing_;
+  MmappedPtr cqRing_;
+  MmappedPtr sqes_;
+
+  // Pointers into the shared memory.
+  std::atomic<uint32_t>* sqHead_{nullptr};
+  std::atomic<uint32_t>* sqTail_{nullptr};
+  std::atomic<uint32_t>* sqFlags_{nullptr};
+  uint32_t sqMask_{0};
+  uint32_t sqEntries_{0};
+  uint32_t* sqArray_{nullptr};
+  std::atomic<uint32_t>* cqHead_{nullptr};
+  std::atomic<uint32_t>* cqTail_{nullptr};
+  uint32_t cqMask_{0};
+  struct io_uring_cqe* cqes_{nullptr};
+  struct io_uring_sqe* sqeArray_{nullptr};
+
+  // The tail of the submission queue including the entries that have been
+  // filled in but not published to the kernel yet.
+  uint32_t sqLocalTail_{0};
+  // How many of the published entries haven't been submitted yet (only used
+  // when the kernel isn't polling the submission queue).
+  uint32_t numUnsubmitted_{0};
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  bool closing_{false};
+  bool done_{false};
+
+  TRequestId nextRequestId_{1};
+  std::unordered_map<TRequestId, completion_fn> pendingRequests_;
+
+  std::vector<uint16_t> freeBufferGroupIds_;
+  uint16_t nextBufferGroupId_{0};
+
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  bool setUpRing_();
+
+  bool probeBufferRings_();
+
+  bool probeOpcode_(uint8_t opcode);
+
+  struct io_uring_sqe& getSqe_();
+
+  void flushSubmissions_();
+
+  void submitAndWait_();
+
+  void reapCompletions_();
+
+  void armWakeup_();
+
+  void handleWakeup_();
+};
+
+} // namespace uring
+} // namespace transport
+} // namespace tensorpipe
@@ -8,34 +8,98 @@
 
 #include <tensorpipe/transport/uv/connection.h>
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <array>
+#include <chrono>
+#include <cstring>
 #include <deque>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
 #include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/socket.h>
 #include <tensorpipe/common/stream_read_write_ops.h>
 #include <tensorpipe/transport/uv/context_impl.h>
 #include <tensorpipe/transport/uv/error.h>
 #include <tensorpipe/transport/uv/loop.h>
 #include <tensorpipe/transport/uv/sockaddr.h>
+#include <tensorpipe/transport/uv/socket_buffers.h>
 #include <tensorpipe/transport/uv/uv.h>
 
 namespace tensorpipe {
 namespace transport {
 namespace uv {
 
+namespace {
+
+// The size the read-ahead buffer starts at, and never shrinks below.
+constexpr size_t kMinReadAheadSize = 4 * 1024;
+
+// How many reads in a row must use less than a quarter of the read-ahead buffer
+// before it's halved.
+constexpr size_t kNumSparseReadsBeforeShrinking = 16;
+
+// How often, at most, a connection estimates the bandwidth-delay product of its
+// path in order to size its socket buffers, both in time and in round trips,
+// so that the throughput is measured over enough data to be meaningful.
+constexpr std::chrono::milliseconds kSocketBufferSizingInterval{100};
+constexpr uint32_t kSocketBufferSizingRoundTrips = 4;
+
+size_t getPageSize() {
+  static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+  return pageSize;
+}
+
+size_t roundUpToPage(size_t length) {
+  return (length + getPageSize() - 1) / getPageSize() * getPageSize();
+}
+
+// Run on a thread of its own, as the handshake blocks.
+Error runTlsHandshake(
+    const KernelTlsHandshake& handshake,
+    Socket socket,
+    bool isClient) {
+  // This duplicate shares the non-blocking flag with the handle's socket, which
+  // libuv doesn't touch in the meantime.
+  Error error = socket.block(true);
+  if (error) {
+    return error;
+  }
+  KernelTlsKeys keys;
+  error = handshake(socket.fd(), isClient, keys);
+  if (!error) {
+    error = setSocketKernelTls(
+        socket.fd(), keys.txCryptoInfo, keys.rxCryptoInfo);
+  }
+  Error blockError = socket.block(false);
+  return error ? error : blockError;
+}
+
+} // namespace
+
 class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
  public:
   // Create a connection that is already connected (e.g. from a listener).
   Impl(
       std::shared_ptr<Context::PrivateIface>,
-      std::shared_ptr<TCPHandle>,
+      Loop&,
+      std::shared_ptr<SocketHandle>,
       std::string);
 
+  // Create a connection that is already connected (e.g. from a listener), by
+  // taking over a socket.
+  Impl(std::shared_ptr<Context::PrivateIface>, Loop&, Fd, std::string);
+
   // Create a connection that connects to the specified address.
-  Impl(std::shared_ptr<Context::PrivateIface>, std::string, std::string);
+  Impl(std::shared_ptr<Context::PrivateIface>, Loop&, std::string, std::string);
 
   // Initialize member fields that need `shared_from_this`.
   void init();
@@ -44,9 +108,15 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
   void read(read_callback_fn fn);
   void read(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn);
 
+  // Perform multiple writes with a single system call.
+  void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
   // Tell the connection what its identifier is.
   void setId(std::string id);
 
@@ -61,9 +131,15 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
   void readFromLoop(read_callback_fn fn);
   void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
 
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
   // Perform a write operation.
   void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
 
+  // Perform multiple writes with a single system call.
+  void writevFromLoop(std::vector<WriteBuffer> buffers, write_callback_fn fn);
+
   void setIdFromLoop_(std::string id);
 
   // Shut down the connection and its resources.
@@ -75,26 +151,132 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
   // Called when libuv has read data from connection.
   void readCallbackFromLoop_(ssize_t nread, const uv_buf_t* buf);
 
-  // Called when libuv has written data to connection.
-  void writeCallbackFromLoop_(int status);
+  // Account for data that was read into the front read operation, and fire its
+  // callback if that completes it.
+  void advanceReadOperationFromLoop_(size_t nread);
+
+  // Map the socket for the payload of a read operation that receives with
+  // TCP_ZEROCOPY_RECEIVE, or return null if it shouldn't or couldn't.
+  std::shared_ptr<char> allocateZeroCopyBufferFromLoop_(size_t length);
+
+  // Map the socket's data into the front read operation's buffer, or otherwise
+  // adjust how much of it libuv should copy, if that buffer is such a mapping.
+  // Return whether the data was mapped, in which case libuv must read nothing.
+  bool receiveZeroCopyFromLoop_(uv_buf_t* buf);
+
+  // Put anonymous memory over the pages of the mapping of the socket that the
+  // given range touches, if it's in one, in order to copy data into it.
+  void makeZeroCopyBufferWritableFromLoop_(char* base, size_t len);
+
+  // Hand the data that was read ahead over to the pending read operations, for
+  // as long as there are both.
+  void consumeReadAheadFromLoop_();
+
+  // Grow or shrink the read-ahead buffer based on how much of it a read used.
+  void adaptReadAheadSizeFromLoop_(size_t nread);
+
+  // Have libuv read from the socket exactly when there are read operations
+  // that the data read ahead couldn't satisfy.
+  void updateReadingFromLoop_();
+
+  // Hand buffers to libuv in a single request, which completes the given
+  // number of write operations, or hold them back during the TLS handshake.
+  void issueWriteFromLoop_(
+      const uv_buf_t* bufs,
+      size_t numBufs,
+      size_t numOperations);
+
+  // Called when libuv has written data to connection, for the given number of
+  // write operations (which were all handed to libuv in a single request).
+  void writeCallbackFromLoop_(int status, size_t numOperations);
+
+  // Run the context's TLS handshake on the socket, on a thread of its own.
+  void startTlsHandshakeFromLoop_(bool isClient);
+
+  // Called once the handshake is over and, if it succeeded, the kernel has the
+  // keys, in order to let the held back reads and writes through.
+  void tlsHandshakeCallbackFromLoop_(const Error& error);
 
   // Called when libuv has closed the handle.
   void closeCallbackFromLoop_();
 
+  // Set the options of the socket requested by the context's low-latency mode.
+  void applyLowLatencyOptionsFromLoop_();
+
+  // Account for data that was read or written, and grow the socket buffers if
+  // it's time for a new estimate of the bandwidth-delay product and it calls
+  // for larger ones.
+  void sizeSocketBuffersFromLoop_(size_t numBytes);
+
   void setError_(Error error);
 
   // Deal with an error.
   void handleError_();
 
   std::shared_ptr<Context::PrivateIface> context_;
-  std::shared_ptr<TCPHandle> handle_;
+  // The loop this connection runs on, which may not be the context's one.
+  Loop& loop_;
+  std::shared_ptr<SocketHandle> handle_;
+  // The socket that the handle must take over, if any.
+  Fd fd_;
+  // The address to connect to, if any, which is a path for Unix sockets.
   optional<Sockaddr> sockaddr_;
+  optional<std::string> path_;
   Error error_{Error::kSuccess};
   ClosingReceiver closingReceiver_;
 
   std::deque<StreamReadOperation> readOperations_;
   std::deque<StreamWriteOperation> writeOperations_;
 
+  // Whether libuv is currently reading from the socket for us.
+  bool reading_{false};
+
+  // Whether reads and writes are held back until the TLS handshake is over,
+  // and whether the handshake is running (during which the handle must stay
+  // open, as its thread uses the socket). The held back writes each come with
+  // the number of write operations they complete.
+  bool awaitingTls_{false};
+  bool handshakingTls_{false};
+  std::deque<std::pair<std::vector<uv_buf_t>, size_t>> heldBackWrites_;
+
+  // The buffer that small reads are done into, when read-ahead is enabled, and
+  // the range of it that holds data that no read operation has consumed yet.
+  // Its size adapts between kMinReadAheadSize and the context's read-ahead
+  // size, and it's only reallocated when empty.
+  size_t maxReadAheadSize_{0};
+  size_t readAheadSize_{0};
+  std::vector<char> readAheadBuffer_;
+  size_t readAheadBegin_{0};
+  size_t readAheadEnd_{0};
+  size_t numSparseReadAheads_{0};
+
+  // Whether each read re-enables quick acknowledgements, as fetched from the
+  // context once rather than on every read.
+  bool quickAck_{false};
+
+  // The read-only mapping of the socket (of a whole number of pages) that the
+  // front read operation's payload is received into, if any, and where the
+  // anonymous memory put over it ends (past which it has only whole pages of
+  // the socket). Also, how much the kernel mapped in the last alloc callback,
+  // whose buffer was empty so that libuv doesn't read.
+  struct ZeroCopyBuffer {
+    char* base;
+    size_t length;
+    size_t writableEnd;
+  };
+  size_t zeroCopyReceiveThreshold_{0};
+  optional<ZeroCopyBuffer> zeroCopyBuffer_;
+  size_t zeroCopyMappedLength_{0};
+
+  // How much was read and written since the last estimate of the
+  // bandwidth-delay product, and when that was, along with the round-trip time
+  // it used. Also, the size last given to the socket buffers, if any.
+  bool sizeSocketBuffers_{false};
+  uint64_t bytesSinceEstimate_{0};
+  std::chrono::steady_clock::time_point lastEstimate_;
+  uint32_t lastRttUs_{0};
+  size_t socketBufferSize_{0};
+
   // A sequence number for the calls to read and write.
   uint64_t nextBufferBeingRead_{0};
   uint64_t nextBufferBeingWritten_{0};
@@ -110,41 +292,93 @@ class Connection::Impl : public std::enable_shared_from_this<Connection::Impl> {
 
   // By having the instance store a shared_ptr to itself we create a reference
   // cycle which will "leak" the instance. This allows us to detach its
-  // lifetime from the connection and sync it with the TCPHandle's life cycle.
+  // lifetime from the connection and sync it with the handle's life cycle.
   std::shared_ptr<Impl> leak_;
 };
 
 Connection::Impl::Impl(
     std::shared_ptr<Context::PrivateIface> context,
-    std::shared_ptr<TCPHandle> handle,
+    Loop& loop,
+    std::shared_ptr<SocketHandle> handle,
     std::string id)
     : context_(std::move(context)),
+      loop_(loop),
       handle_(std::move(handle)),
       closingReceiver_(context_, context_->getClosingEmitter()),
       id_(std::move(id)) {}
 
 Connection::Impl::Impl(
     std::shared_ptr<Context::PrivateIface> context,
-    std::string addr,
+    Loop& loop,
+    Fd fd,
     std::string id)
     : context_(std::move(context)),
-      handle_(context_->createHandle()),
-      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      loop_(loop),
+      handle_(SocketHandle::create(loop_, context_->usesUnixSockets())),
+      fd_(std::move(fd)),
       closingReceiver_(context_, context_->getClosingEmitter()),
       id_(std::move(id)) {}
 
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    Loop& loop,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      loop_(loop),
+      handle_(SocketHandle::create(loop_, context_->usesUnixSockets())),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {
+  if (handle_->isUnixDomain()) {
+    path_ = std::move(addr);
+  } else {
+    sockaddr_ = Sockaddr::createInetSockAddr(addr);
+  }
+}
+
 void Connection::Impl::initFromLoop() {
   leak_ = shared_from_this();
 
+  maxReadAheadSize_ = context_->getReadAheadSize();
+  readAheadSize_ = std::min(kMinReadAheadSize, maxReadAheadSize_);
+  zeroCopyReceiveThreshold_ = context_->getZeroCopyReceiveThreshold();
+  quickAck_ = context_->getLowLatencyOptions().quickAck;
+  sizeSocketBuffers_ = !handle_->isUnixDomain() &&
+      context_->getSocketBufferOptions().maxBufferSize > 0;
+  lastEstimate_ = std::chrono::steady_clock::now();
+
   closingReceiver_.activate(*this);
 
-  if (sockaddr_.has_value()) {
+  awaitingTls_ = context_->getTlsHandshake() != nullptr;
+
+  auto connectCallback = [this](int status) {
+    if (status < 0) {
+      setError_(TP_CREATE_ERROR(UVError, status));
+    } else if (awaitingTls_) {
+      startTlsHandshakeFromLoop_(/*isClient=*/true);
+    }
+  };
+  if (fd_.hasValue()) {
+    handle_->openFromLoop(std::move(fd_));
+  } else if (sockaddr_.has_value()) {
+    handle_->initFromLoop();
+    handle_->connectFromLoop(sockaddr_.value(), std::move(connectCallback));
+  } else if (path_.has_value()) {
     handle_->initFromLoop();
-    handle_->connectFromLoop(sockaddr_.value(), [this](int status) {
-      if (status < 0) {
-        setError_(TP_CREATE_ERROR(UVError, status));
+    handle_->connectFromLoop(path_.value(), std::move(connectCallback));
+  }
+  // These options are all about TCP and the NIC.
+  if (!handle_->isUnixDomain()) {
+    applyLowLatencyOptionsFromLoop_();
+    const size_t notSentLowat = context_->getSocketBufferOptions().notSentLowat;
+    if (notSentLowat > 0) {
+      Error error =
+          setSocketNotSentLowat(handle_->filenoFromLoop(), notSentLowat);
+      if (error) {
+        TP_VLOG(9) << "Connection " << id_
+                   << " couldn't limit its unsent data: " << error.what();
       }
-    });
+    }
   }
   handle_->armCloseCallbackFromLoop(
       [this]() { this->closeCallbackFromLoop_(); });
@@ -153,10 +387,14 @@ void Connection::Impl::initFromLoop() {
   handle_->armReadCallbackFromLoop([this](ssize_t nread, const uv_buf_t* buf) {
     this->readCallbackFromLoop_(nread, buf);
   });
+  // Connections that didn't connect were accepted, and are the server side.
+  if (awaitingTls_ && !sockaddr_.has_value()) {
+    startTlsHandshakeFromLoop_(/*isClient=*/false);
+  }
 }
 
 void Connection::Impl::readFromLoop(read_callback_fn fn) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
 
   uint64_t sequenceNumber = nextBufferBeingRead_++;
   TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
@@ -178,18 +416,21 @@ void Connection::Impl::readFromLoop(read_callback_fn fn) {
   }
 
   readOperations_.emplace_back(std::move(fn));
-
-  // Start reading if this is the first read operation.
-  if (readOperations_.size() == 1) {
-    handle_->readStartFromLoop();
+  if (zeroCopyReceiveThreshold_ > 0) {
+    readOperations_.back().setAllocatorFromLoop([this](size_t length) {
+      return allocateZeroCopyBufferFromLoop_(length);
+    });
   }
+
+  consumeReadAheadFromLoop_();
+  updateReadingFromLoop_();
 }
 
 void Connection::Impl::readFromLoop(
     void* ptr,
     size_t length,
     read_callback_fn fn) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
 
   uint64_t sequenceNumber = nextBufferBeingRead_++;
   TP_VLOG(7) << "Connection " << id_ << " received a read request (#"
@@ -212,17 +453,15 @@ void Connection::Impl::readFromLoop(
 
   readOperations_.emplace_back(ptr, length, std::move(fn));
 
-  // Start reading if this is the first read operation.
-  if (readOperations_.size() == 1) {
-    handle_->readStartFromLoop();
-  }
+  consumeReadAheadFromLoop_();
+  updateReadingFromLoop_();
 }
 
 void Connection::Impl::writeFromLoop(
     const void* ptr,
     size_t length,
     write_callback_fn fn) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
 
   uint64_t sequenceNumber = nextBufferBeingWritten_++;
   TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
@@ -251,47 +490,123 @@ void Connection::Impl::writeFromLoop(
   const std::array<uv_buf_t, 2> uvBufs = {
       uv_buf_t{bufsPtr[0].base, bufsPtr[0].len},
       uv_buf_t{bufsPtr[1].base, bufsPtr[1].len}};
-  handle_->writeFromLoop(uvBufs.data(), bufsLen, [this](int status) {
-    this->writeCallbackFromLoop_(status);
-  });
+  issueWriteFromLoop_(uvBufs.data(), bufsLen, /*numOperations=*/1);
+}
+
+void Connection::Impl::writevFromLoop(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  std::vector<uv_buf_t> uvBufs;
+  uvBufs.reserve(2 * buffers.size());
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+    auto& writeOperation = writeOperations_.back();
+    StreamWriteOperation::Buf* bufsPtr;
+    unsigned int bufsLen;
+    std::tie(bufsPtr, bufsLen) = writeOperation.getBufs();
+    for (unsigned int bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+      uvBufs.push_back(uv_buf_t{bufsPtr[bufIdx].base, bufsPtr[bufIdx].len});
+    }
+  }
+  issueWriteFromLoop_(uvBufs.data(), uvBufs.size(), buffers.size());
 }
 
 void Connection::Impl::setId(std::string id) {
-  context_->deferToLoop(
+  loop_.deferToLoop(
       [impl{shared_from_this()}, id{std::move(id)}]() mutable {
         impl->setIdFromLoop_(std::move(id));
       });
 }
 
 void Connection::Impl::setIdFromLoop_(std::string id) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
   TP_VLOG(7) << "Connection " << id_ << " was renamed to " << id;
   id_ = std::move(id);
 }
 
 void Connection::Impl::close() {
-  context_->deferToLoop(
+  loop_.deferToLoop(
       [impl{shared_from_this()}]() { impl->closeFromLoop(); });
 }
 
 void Connection::Impl::closeFromLoop() {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
   TP_VLOG(7) << "Connection " << id_ << " is closing";
   setError_(TP_CREATE_ERROR(ConnectionClosedError));
 }
 
 void Connection::Impl::allocCallbackFromLoop_(uv_buf_t* buf) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
   TP_THROW_ASSERT_IF(readOperations_.empty());
   TP_VLOG(9) << "Connection " << id_
              << " has incoming data for which it needs to provide a buffer";
   readOperations_.front().allocFromLoop(&buf->base, &buf->len);
+
+  // An empty buffer makes libuv report UV_ENOBUFS, rather than read.
+  if (receiveZeroCopyFromLoop_(buf)) {
+    buf->len = 0;
+    return;
+  }
+  // Reads into a mapping of the socket are exact, to keep it page-aligned.
+  if (zeroCopyBuffer_.has_value() && buf->base >= zeroCopyBuffer_->base &&
+      buf->base < zeroCopyBuffer_->base + zeroCopyBuffer_->length) {
+    makeZeroCopyBufferWritableFromLoop_(buf->base, buf->len);
+    return;
+  }
+
+  // Reads that are smaller than the read-ahead buffer go through it, in order
+  // to pick up whatever follows them too. Larger ones land in user memory.
+  if (buf->len < readAheadSize_) {
+    // We only read from the socket once the data read ahead was all consumed.
+    TP_DCHECK_EQ(readAheadBegin_, readAheadEnd_);
+    if (readAheadBuffer_.size() != readAheadSize_) {
+      readAheadBuffer_ = std::vector<char>(readAheadSize_);
+    }
+    buf->base = readAheadBuffer_.data();
+    buf->len = readAheadBuffer_.size();
+  }
 }
 
 void Connection::Impl::readCallbackFromLoop_(
     ssize_t nread,
     const uv_buf_t* buf) {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
+  if (nread == UV_ENOBUFS && zeroCopyMappedLength_ > 0) {
+    nread = zeroCopyMappedLength_;
+    zeroCopyMappedLength_ = 0;
+  }
   TP_VLOG(9) << "Connection " << id_ << " has completed reading some data ("
              << (nread >= 0 ? std::to_string(nread) + " bytes"
                             : formatUvError(nread))
@@ -302,23 +617,204 @@ void Connection::Impl::readCallbackFromLoop_(
     return;
   }
 
-  TP_THROW_ASSERT_IF(readOperations_.empty());
+  // The kernel may have gone back to delaying acknowledgements.
+  if (nread > 0 && quickAck_) {
+    Error error = setSocketQuickAck(handle_->filenoFromLoop(), true);
+    if (error) {
+      TP_VLOG(9) << "Connection " << id_
+                 << " couldn't re-enable quick acknowledgements: "
+                 << error.what();
+    }
+  }
+
+  if (sizeSocketBuffers_) {
+    sizeSocketBuffersFromLoop_(nread);
+  }
+
+  if (!readAheadBuffer_.empty() && buf->base == readAheadBuffer_.data()) {
+    readAheadBegin_ = 0;
+    readAheadEnd_ = nread;
+    adaptReadAheadSizeFromLoop_(nread);
+    consumeReadAheadFromLoop_();
+  } else {
+    TP_THROW_ASSERT_IF(readOperations_.empty());
+    advanceReadOperationFromLoop_(nread);
+  }
+
+  // If this was the final pending operation, this instance should no longer
+  // receive allocation and read callbacks.
+  updateReadingFromLoop_();
+}
+
+void Connection::Impl::advanceReadOperationFromLoop_(size_t nread) {
   auto& readOperation = readOperations_.front();
   readOperation.readFromLoop(nread);
   if (readOperation.completeFromLoop()) {
+    // Its buffer unmaps itself once the operation is destroyed.
+    zeroCopyBuffer_.reset();
     readOperation.callbackFromLoop(Error::kSuccess);
-    // Remove the completed operation.
-    // If this was the final pending operation, this instance should
-    // no longer receive allocation and read callbacks.
     readOperations_.pop_front();
-    if (readOperations_.empty()) {
-      handle_->readStopFromLoop();
+  }
+}
+
+void Connection::Impl::consumeReadAheadFromLoop_() {
+  while (readAheadBegin_ < readAheadEnd_ && !readOperations_.empty()) {
+    char* base;
+    size_t len;
+    readOperations_.front().allocFromLoop(&base, &len);
+    len = std::min(len, readAheadEnd_ - readAheadBegin_);
+    makeZeroCopyBufferWritableFromLoop_(base, len);
+    std::memcpy(base, readAheadBuffer_.data() + readAheadBegin_, len);
+    readAheadBegin_ += len;
+    advanceReadOperationFromLoop_(len);
+  }
+}
+
+std::shared_ptr<char> Connection::Impl::allocateZeroCopyBufferFromLoop_(
+    size_t length) {
+  if (length < zeroCopyReceiveThreshold_) {
+    return nullptr;
+  }
+  TP_DCHECK(!zeroCopyBuffer_.has_value());
+  const size_t mappedLength = roundUpToPage(length);
+  void* ptr = ::mmap(
+      nullptr,
+      mappedLength,
+      PROT_READ,
+      MAP_SHARED,
+      handle_->filenoFromLoop(),
+      /*offset=*/0);
+  if (ptr == MAP_FAILED) {
+    TP_VLOG(9) << "Connection " << id_
+               << " couldn't map its socket, hence it stops receiving with "
+               << "TCP_ZEROCOPY_RECEIVE: " << strerror(errno);
+    zeroCopyReceiveThreshold_ = 0;
+    return nullptr;
+  }
+  zeroCopyBuffer_ = ZeroCopyBuffer{static_cast<char*>(ptr), mappedLength, 0};
+  return std::shared_ptr<char>(
+      static_cast<char*>(ptr),
+      [mappedLength](char* ptr) { ::munmap(ptr, mappedLength); });
+}
+
+bool Connection::Impl::receiveZeroCopyFromLoop_(uv_buf_t* buf) {
+  if (!zeroCopyBuffer_.has_value() || buf->base < zeroCopyBuffer_->base ||
+      buf->base >= zeroCopyBuffer_->base + zeroCopyBuffer_->length) {
+    return false;
+  }
+  ZeroCopyBuffer& zc = zeroCopyBuffer_.value();
+  const size_t pageSize = getPageSize();
+  const size_t offset = buf->base - zc.base;
+  if (offset % pageSize != 0) {
+    // Copy up to the next page, from which mapping may resume.
+    buf->len = std::min<size_t>(buf->len, pageSize - offset % pageSize);
+    return false;
+  }
+  const size_t length = buf->len - buf->len % pageSize;
+  if (length == 0 || offset < zc.writableEnd ||
+      zeroCopyReceiveThreshold_ == 0) {
+    // Copy the tail that doesn't fill a page.
+    return false;
+  }
+  size_t mappedLength;
+  size_t skipLength;
+  Error error = receiveTcpZeroCopy(
+      handle_->filenoFromLoop(), buf->base, length, mappedLength, skipLength);
+  if (error) {
+    TP_VLOG(9) << "Connection " << id_
+               << " stops receiving with TCP_ZEROCOPY_RECEIVE: "
+               << error.what();
+    zeroCopyReceiveThreshold_ = 0;
+    return false;
+  }
+  if (mappedLength > 0) {
+    zeroCopyMappedLength_ = mappedLength;
+    return true;
+  }
+  if (skipLength > 0) {
+    buf->len = std::min<size_t>(buf->len, skipLength);
+  }
+  return false;
+}
+
+void Connection::Impl::makeZeroCopyBufferWritableFromLoop_(
+    char* base,
+    size_t len) {
+  if (!zeroCopyBuffer_.has_value() || base < zeroCopyBuffer_->base ||
+      base >= zeroCopyBuffer_->base + zeroCopyBuffer_->length) {
+    return;
+  }
+  ZeroCopyBuffer& zc = zeroCopyBuffer_.value();
+  const size_t offset = base - zc.base;
+  // Data only ever starts within a page if it was copied into that page.
+  const size_t begin = std::max(roundUpToPage(offset), zc.writableEnd);
+  const size_t end = roundUpToPage(offset + len);
+  if (begin < end) {
+    void* ptr = ::mmap(
+        zc.base + begin,
+        end - begin,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+        /*fd=*/-1,
+        /*offset=*/0);
+    TP_THROW_SYSTEM_IF(ptr == MAP_FAILED, errno);
+    zc.writableEnd = end;
+  }
+}
+
+void Connection::Impl::adaptReadAheadSizeFromLoop_(size_t nread) {
+  // Reads that found nothing say nothing about the size of the bursts.
+  if (nread == 0) {
+    return;
+  }
+  if (nread == readAheadSize_) {
+    // There may have been more, try to fit it all the next time.
+    readAheadSize_ = std::min(2 * readAheadSize_, maxReadAheadSize_);
+    numSparseReadAheads_ = 0;
+  } else if (nread < readAheadSize_ / 4) {
+    if (++numSparseReadAheads_ == kNumSparseReadsBeforeShrinking) {
+      readAheadSize_ = std::max(
+          readAheadSize_ / 2, std::min(kMinReadAheadSize, maxReadAheadSize_));
+      numSparseReadAheads_ = 0;
     }
+  } else {
+    numSparseReadAheads_ = 0;
   }
 }
 
-void Connection::Impl::writeCallbackFromLoop_(int status) {
-  TP_DCHECK(context_->inLoop());
+void Connection::Impl::updateReadingFromLoop_() {
+  if (error_ || awaitingTls_) {
+    return;
+  }
+  const bool shouldRead = !readOperations_.empty();
+  if (shouldRead && !reading_) {
+    handle_->readStartFromLoop();
+    reading_ = true;
+  } else if (!shouldRead && reading_) {
+    handle_->readStopFromLoop();
+    reading_ = false;
+  }
+}
+
+void Connection::Impl::issueWriteFromLoop_(
+    const uv_buf_t* bufs,
+    size_t numBufs,
+    size_t numOperations) {
+  if (awaitingTls_) {
+    heldBackWrites_.emplace_back(
+        std::vector<uv_buf_t>(bufs, bufs + numBufs), numOperations);
+    return;
+  }
+  // libuv copies the array of buffers, hence it's fine for it to be temporary.
+  handle_->writeFromLoop(bufs, numBufs, [this, numOperations](int status) {
+    this->writeCallbackFromLoop_(status, numOperations);
+  });
+}
+
+void Connection::Impl::writeCallbackFromLoop_(
+    int status,
+    size_t numOperations) {
+  TP_DCHECK(loop_.inLoop());
   TP_VLOG(9) << "Connection " << id_ << " has completed a write request ("
              << formatUvError(status) << ")";
 
@@ -332,16 +828,163 @@ void Connection::Impl::writeCallbackFromLoop_(int status) {
     // this method, both in case of success and of error.
   }
 
-  TP_THROW_ASSERT_IF(writeOperations_.empty());
-  auto& writeOperation = writeOperations_.front();
-  writeOperation.callbackFromLoop(error_);
-  writeOperations_.pop_front();
+  size_t numBytes = 0;
+  for (size_t operationIdx = 0; operationIdx < numOperations; operationIdx++) {
+    TP_THROW_ASSERT_IF(writeOperations_.empty());
+    auto& writeOperation = writeOperations_.front();
+    if (sizeSocketBuffers_) {
+      StreamWriteOperation::Buf* bufsPtr;
+      unsigned int bufsLen;
+      std::tie(bufsPtr, bufsLen) = writeOperation.getBufs();
+      for (unsigned int bufIdx = 0; bufIdx < bufsLen; bufIdx++) {
+        numBytes += bufsPtr[bufIdx].len;
+      }
+    }
+    writeOperation.callbackFromLoop(error_);
+    writeOperations_.pop_front();
+  }
+
+  if (sizeSocketBuffers_ && !error_) {
+    sizeSocketBuffersFromLoop_(numBytes);
+  }
+}
+
+void Connection::Impl::startTlsHandshakeFromLoop_(bool isClient) {
+  TP_DCHECK(loop_.inLoop());
+  if (error_) {
+    return;
+  }
+  TP_VLOG(9) << "Connection " << id_ << " is starting its TLS handshake";
+  handshakingTls_ = true;
+  Socket socket(handle_->dupFromLoop().release());
+  std::thread([impl{shared_from_this()},
+               socket{std::move(socket)},
+               isClient]() mutable {
+    Error error = runTlsHandshake(
+        impl->context_->getTlsHandshake(), std::move(socket), isClient);
+    impl->loop_.deferToLoop([impl, error{std::move(error)}]() {
+      impl->tlsHandshakeCallbackFromLoop_(error);
+    });
+  }).detach();
+}
+
+void Connection::Impl::tlsHandshakeCallbackFromLoop_(const Error& error) {
+  TP_DCHECK(loop_.inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " is done with its TLS handshake ("
+             << (error ? error.what() : "success") << ")";
+  handshakingTls_ = false;
+  if (error_) {
+    // The connection was closed in the meantime, and was waiting for this.
+    handle_->closeFromLoop();
+    return;
+  }
+  if (error) {
+    setError_(error);
+    return;
+  }
+  awaitingTls_ = false;
+  for (const auto& write : heldBackWrites_) {
+    const size_t numOperations = write.second;
+    handle_->writeFromLoop(
+        write.first.data(),
+        write.first.size(),
+        [this, numOperations](int status) {
+          this->writeCallbackFromLoop_(status, numOperations);
+        });
+  }
+  heldBackWrites_.clear();
+  updateReadingFromLoop_();
+}
+
+void Connection::Impl::applyLowLatencyOptionsFromLoop_() {
+  const LowLatencyOptions& options = context_->getLowLatencyOptions();
+  if (options.socketBusyPoll.count() == 0 && !options.quickAck) {
+    return;
+  }
+  // These are mere optimizations, hence the connection works without them.
+  const int fd = handle_->filenoFromLoop();
+  if (options.socketBusyPoll.count() > 0) {
+    Error error =
+        setSocketBusyPoll(fd, options.socketBusyPoll, options.preferBusyPoll);
+    if (error) {
+      static std::atomic<bool> warned{false};
+      TP_LOG_WARNING_IF(!warned.exchange(true))
+          << "Couldn't enable busy polling on the sockets of the uv transport"
+          << " (which may require CAP_NET_ADMIN): " << error.what();
+    }
+  }
+  if (options.quickAck) {
+    Error error = setSocketQuickAck(fd, true);
+    if (error) {
+      TP_VLOG(9) << "Connection " << id_
+                 << " couldn't enable quick acknowledgements: " << error.what();
+    }
+  }
+}
+
+void Connection::Impl::sizeSocketBuffersFromLoop_(size_t numBytes) {
+  bytesSinceEstimate_ += numBytes;
+  const auto now = std::chrono::steady_clock::now();
+  const auto elapsed = now - lastEstimate_;
+  if (elapsed < kSocketBufferSizingInterval ||
+      elapsed < std::chrono::microseconds(
+                    kSocketBufferSizingRoundTrips * lastRttUs_)) {
+    return;
+  }
+
+  // The sender's estimate is the more accurate one, but a connection that only
+  // receives may only have the receiver's one.
+  const int fd = handle_->filenoFromLoop();
+  uint32_t rttUs;
+  uint32_t rcvRttUs;
+  Error error = getSocketRoundTripTimes(fd, rttUs, rcvRttUs);
+  if (error) {
+    TP_VLOG(9) << "Connection " << id_
+               << " couldn't get its round-trip time: " << error.what();
+    sizeSocketBuffers_ = false;
+    return;
+  }
+  lastRttUs_ = rttUs > 0 ? rttUs : rcvRttUs;
+  const uint64_t bandwidthDelayProduct =
+      estimateBandwidthDelayProduct(bytesSinceEstimate_, elapsed, lastRttUs_);
+  bytesSinceEstimate_ = 0;
+  lastEstimate_ = now;
+
+  const size_t targetSize = socketBufferSizeForBandwidthDelayProduct(
+      bandwidthDelayProduct, context_->getSocketBufferOptions().maxBufferSize);
+  if (targetSize <= socketBufferSize_) {
+    return;
+  }
+  // The kernel reports the sizes doubled, and they must not go below what its
+  // autotuning reached.
+  size_t sendSize;
+  size_t recvSize;
+  error = getSocketBufferSizes(fd, sendSize, recvSize);
+  if (!error && targetSize > std::min(sendSize, recvSize) / 2) {
+    error = setSocketBufferSizes(
+        fd,
+        std::max(targetSize, sendSize / 2),
+        std::max(targetSize, recvSize / 2));
+  }
+  if (error) {
+    TP_VLOG(9) << "Connection " << id_
+               << " couldn't resize its socket buffers: " << error.what();
+    sizeSocketBuffers_ = false;
+    return;
+  }
+  TP_VLOG(9) << "Connection " << id_ << " estimated a bandwidth-delay product"
+             << " of " << bandwidthDelayProduct << " bytes (with a round-trip"
+             << " time of " << lastRttUs_ << "us), and resized its socket"
+             << " buffers to " << targetSize << " bytes";
+  socketBufferSize_ = targetSize;
+  context_->countSocketBufferResize(bandwidthDelayProduct);
 }
 
 void Connection::Impl::closeCallbackFromLoop_() {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
   TP_VLOG(9) << "Connection " << id_ << " has finished closing its handle";
   TP_DCHECK(writeOperations_.empty());
+  context_->releaseLoop(loop_);
   leak_.reset();
 }
 
@@ -357,26 +1000,39 @@ void Connection::Impl::setError_(Error error) {
 }
 
 void Connection::Impl::handleError_() {
-  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(loop_.inLoop());
   TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
 
   for (auto& readOperation : readOperations_) {
     readOperation.callbackFromLoop(error_);
   }
   readOperations_.clear();
+  zeroCopyBuffer_.reset();
+  // The writes held back for the TLS handshake never reached libuv.
+  for (const auto& write : heldBackWrites_) {
+    writeCallbackFromLoop_(UV_ECANCELED, write.second);
+  }
+  heldBackWrites_.clear();
   // Do NOT fire the callbacks of the write operations, because we must wait for
   // their corresponding UV write requests to complete (or else the user may
   // deallocate the buffers while the loop is still processing them).
+  if (handshakingTls_) {
+    // Wake up the handshake, which closes the handle once it's done.
+    ::shutdown(handle_->filenoFromLoop(), SHUT_RDWR);
+    return;
+  }
   handle_->closeFromLoop();
 }
 
 Connection::Connection(
     ConstructorToken /* unused */,
     std::shared_ptr<Context::PrivateIface> context,
-    std::shared_ptr<TCPHandle> handle,
+    Loop& loop,
+    std::shared_ptr<SocketHandle> handle,
     std::string id)
     : impl_(std::make_shared<Impl>(
           std::move(context),
+          loop,
           std::move(handle),
           std::move(id))) {
   impl_->init();
@@ -385,17 +1041,33 @@ Connection::Connection(
 Connection::Connection(
     ConstructorToken /* unused */,
     std::shared_ptr<Context::PrivateIface> context,
+    Loop& loop,
+    Fd fd,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          loop,
+          std::move(fd),
+          std::move(id))) {
+  impl_->init();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    Loop& loop,
     std::string addr,
     std::string id)
     : impl_(std::make_shared<Impl>(
           std::move(context),
+          loop,
           std::move(addr),
           std::move(id))) {
   impl_->init();
 }
 
 void Connection::Impl::init() {
-  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+  loop_.deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
 }
 
 void Connection::read(read_callback_fn fn) {
@@ -403,7 +1075,7 @@ void Connection::read(read_callback_fn fn) {
 }
 
 void Connection::Impl::read(read_callback_fn fn) {
-  context_->deferToLoop(
+  loop_.deferToLoop(
       [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
         impl->readFromLoop(std::move(fn));
       });
@@ -414,12 +1086,79 @@ void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
 }
 
 void Connection::Impl::read(void* ptr, size_t length, read_callback_fn fn) {
-  context_->deferToLoop(
+  loop_.deferToLoop(
       [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
         impl->readFromLoop(ptr, length, std::move(fn));
       });
 }
 
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  loop_.deferToLoop([impl{shared_from_this()},
+                     buffers{std::move(buffers)},
+                     fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(loop_.inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  consumeReadAheadFromLoop_();
+  updateReadingFromLoop_();
+}
+
 void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
   impl_->write(ptr, length, std::move(fn));
 }
@@ -428,12 +1167,28 @@ void Connection::Impl::write(
     const void* ptr,
     size_t length,
     write_callback_fn fn) {
-  context_->deferToLoop(
+  loop_.deferToLoop(
       [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
         impl->writeFromLoop(ptr, length, std::move(fn));
       });
 }
 
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  loop_.deferToLoop([impl{shared_from_this()},
+                     buffers{std::move(buffers)},
+                     fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
 void Connection::setId(std::string id) {
   impl_->setId(std::move(id));
 }
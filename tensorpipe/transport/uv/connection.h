@@ -10,7 +10,9 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
+#include <tensorpipe/common/fd.h>
 #include <tensorpipe/transport/connection.h>
 #include <tensorpipe/transport/uv/context.h>
 
@@ -21,25 +23,37 @@ namespace uv {
 class Listener;
 class Loop;
 class Sockaddr;
-class TCPHandle;
+class SocketHandle;
 
-class Connection : public transport::Connection {
+class Connection final : public transport::Connection {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
 
  public:
-  // Create a connection that is already connected (e.g. from a listener).
+  // Create a connection that is already connected (e.g. from a listener), and
+  // whose handle is already on the given loop.
   Connection(
       ConstructorToken,
       std::shared_ptr<Context::PrivateIface> context,
-      std::shared_ptr<TCPHandle> handle,
+      Loop& loop,
+      std::shared_ptr<SocketHandle> handle,
+      std::string id);
+
+  // Create a connection that is already connected (e.g. from a listener), and
+  // that will take over the given socket on the given loop.
+  Connection(
+      ConstructorToken,
+      std::shared_ptr<Context::PrivateIface> context,
+      Loop& loop,
+      Fd fd,
       std::string id);
 
   // Create a connection that connects to the specified address.
   Connection(
       ConstructorToken,
       std::shared_ptr<Context::PrivateIface> context,
+      Loop& loop,
       std::string addr,
       std::string id);
 
@@ -47,9 +61,15 @@ class Connection : public transport::Connection {
   void read(read_callback_fn fn) override;
   void read(void* ptr, size_t length, read_callback_fn fn) override;
 
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) override;
+
   // Perform a write operation.
   void write(const void* ptr, size_t length, write_callback_fn fn) override;
 
+  // Perform multiple writes with a single system call.
+  void writev(std::vector<WriteBuffer> buffers, write_callback_fn fn) override;
+
   // Tell the connection what its identifier is.
   void setId(std::string id) override;
 
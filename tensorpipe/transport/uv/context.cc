@@ -8,7 +8,15 @@
 
 #include <tensorpipe/transport/uv/context.h>
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
+#include <tensorpipe/common/system.h>
 #include <tensorpipe/transport/uv/connection.h>
 #include <tensorpipe/transport/uv/context_impl.h>
 #include <tensorpipe/transport/uv/error.h>
@@ -27,8 +35,44 @@ namespace {
 // disambiguate descriptors when debugging.
 const std::string kDomainDescriptorPrefix{"uv:"};
 
-std::string generateDomainDescriptor() {
-  return kDomainDescriptorPrefix + "*";
+std::string generateDomainDescriptor(bool unixSockets, bool tls) {
+  std::string domainDescriptor = kDomainDescriptorPrefix;
+  if (unixSockets) {
+    // Unix domain sockets only work within a machine.
+    auto bootID = getBootID();
+    TP_THROW_ASSERT_IF(!bootID) << "Unable to read boot_id";
+    domainDescriptor += "unix:" + bootID.value();
+  } else {
+    domainDescriptor += "*";
+  }
+  if (tls) {
+    domainDescriptor += ":tls";
+  }
+  return domainDescriptor;
+}
+
+// Read a sysctl holding a single number, or return nothing if it can't.
+optional<uint64_t> readSysctl(const std::string& path) {
+  std::ifstream file(path);
+  uint64_t value;
+  if (!(file >> value)) {
+    return nullopt;
+  }
+  return value;
+}
+
+SocketBufferOptions capSocketBufferOptions(SocketBufferOptions options) {
+  // Sizes above these would be silently capped by the kernel, possibly below
+  // what its autotuning would have reached, hence it's better not to go there.
+  for (const char* path :
+       {"/proc/sys/net/core/wmem_max", "/proc/sys/net/core/rmem_max"}) {
+    optional<uint64_t> maxSize = readSysctl(path);
+    if (maxSize.has_value()) {
+      options.maxBufferSize =
+          std::min<uint64_t>(options.maxBufferSize, maxSize.value());
+    }
+  }
+  return options;
 }
 
 } // namespace
@@ -36,10 +80,14 @@ std::string generateDomainDescriptor() {
 class Context::Impl : public Context::PrivateIface,
                       public std::enable_shared_from_this<Context::Impl> {
  public:
-  Impl();
+  explicit Impl(ContextOptions options);
 
   const std::string& domainDescriptor() const;
 
+  const ContextOptions& getOptions() const;
+
+  std::map<std::string, uint64_t> getStats() const;
+
   std::shared_ptr<transport::Connection> connect(std::string addr);
 
   std::shared_ptr<transport::Listener> listen(std::string addr);
@@ -54,9 +102,33 @@ class Context::Impl : public Context::PrivateIface,
 
   bool inLoop() override;
 
-  void deferToLoop(std::function<void()> fn) override;
+  void deferToLoop(TTask fn) override;
+
+  std::shared_ptr<SocketHandle> createHandle() override;
+
+  bool usesUnixSockets() override;
+
+  Loop& acquireLoop() override;
+
+  void acquireLoop(Loop& loop) override;
+
+  std::vector<Loop*> getListenerShardLoops() override;
+
+  void releaseLoop(Loop& loop) override;
+
+  size_t getReadAheadSize() override;
 
-  std::shared_ptr<TCPHandle> createHandle() override;
+  size_t getZeroCopyReceiveThreshold() override;
+
+  const LowLatencyOptions& getLowLatencyOptions() override;
+
+  const SocketBufferOptions& getSocketBufferOptions() override;
+
+  void countSocketBufferResize(uint64_t bandwidthDelayProduct) override;
+
+  const KernelTlsHandshake& getTlsHandshake() override;
+
+  int getListenBacklog() override;
 
   void close();
 
@@ -65,13 +137,24 @@ class Context::Impl : public Context::PrivateIface,
   ~Impl() override = default;
 
  private:
-  Loop loop_;
+  const ContextOptions options_;
+
+  // The first loop is also the one of the context and the listeners.
+  std::vector<std::unique_ptr<Loop>> loops_;
+  Loop& loop_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
   ClosingEmitter closingEmitter_;
 
   std::string domainDescriptor_;
 
+  std::atomic<uint64_t> numSocketBufferResizes_{0};
+  std::atomic<uint64_t> maxBandwidthDelayProduct_{0};
+
+  // How many connections are currently running on each loop.
+  std::mutex numConnectionsMutex_;
+  std::vector<uint64_t> numConnectionsPerLoop_;
+
   // An identifier for the context, composed of the identifier for the context,
   // combined with the transport's name. It will only be used for logging and
   // debugging purposes.
@@ -86,9 +169,65 @@ class Context::Impl : public Context::PrivateIface,
   std::tuple<Error, std::string> lookupAddrForHostnameFromLoop_();
 };
 
-Context::Context() : impl_(std::make_shared<Impl>()) {}
+namespace {
 
-Context::Impl::Impl() : domainDescriptor_(generateDomainDescriptor()) {}
+ContextOptions resolveOptions(ContextOptions options) {
+  options.validate();
+  if (options.unixSockets || options.tlsHandshake) {
+    options.zeroCopyReceiveThreshold = 0;
+  }
+  options.socketBuffers =
+      capSocketBufferOptions(std::move(options.socketBuffers));
+  return options;
+}
+
+std::vector<std::unique_ptr<Loop>> createLoops(const ContextOptions& options) {
+  std::vector<std::unique_ptr<Loop>> loops;
+  for (size_t loopIdx = 0; loopIdx < options.numLoops; loopIdx++) {
+    loops.push_back(std::make_unique<Loop>(
+        options.loopCpus.empty() ? std::vector<int>()
+                                 : options.loopCpus[loopIdx],
+        options.lowLatency.busyPollLoops));
+  }
+  return loops;
+}
+
+} // namespace
+
+Context::Context(ContextOptions options)
+    : impl_(std::make_shared<Impl>(std::move(options))) {}
+
+Context::Context(
+    size_t numLoops,
+    std::vector<std::vector<int>> loopCpus,
+    size_t readAheadSize,
+    LowLatencyOptions lowLatency,
+    bool unixSockets,
+    KernelTlsHandshake tlsHandshake,
+    bool shardListeners,
+    size_t zeroCopyReceiveThreshold,
+    SocketBufferOptions socketBuffers)
+    : impl_(std::make_shared<Impl>([&]() {
+        ContextOptions options;
+        options.numLoops = numLoops;
+        options.loopCpus = std::move(loopCpus);
+        options.readAheadSize = readAheadSize;
+        options.lowLatency = std::move(lowLatency);
+        options.unixSockets = unixSockets;
+        options.tlsHandshake = std::move(tlsHandshake);
+        options.shardListeners = shardListeners;
+        options.zeroCopyReceiveThreshold = zeroCopyReceiveThreshold;
+        options.socketBuffers = std::move(socketBuffers);
+        return options;
+      }())) {}
+
+Context::Impl::Impl(ContextOptions options)
+    : options_(resolveOptions(std::move(options))),
+      loops_(createLoops(options_)),
+      loop_(*loops_[0]),
+      domainDescriptor_(generateDomainDescriptor(
+          options_.unixSockets, options_.tlsHandshake != nullptr)),
+      numConnectionsPerLoop_(options_.numLoops, 0) {}
 
 void Context::close() {
   impl_->close();
@@ -99,6 +238,8 @@ void Context::Impl::close() {
     TP_VLOG(7) << "Transport context " << id_ << " is closing";
 
     closingEmitter_.close();
+    // The other loops are only closed once the first one is done, since until
+    // then its listeners could still be handing connections over to them.
     loop_.close();
 
     TP_VLOG(7) << "Transport context " << id_ << " done closing";
@@ -116,6 +257,9 @@ void Context::Impl::join() {
     TP_VLOG(7) << "Transport context " << id_ << " is joining";
 
     loop_.join();
+    for (auto& loop : loops_) {
+      loop->join();
+    }
 
     TP_VLOG(7) << "Transport context " << id_ << " done joining";
   }
@@ -137,6 +281,7 @@ std::shared_ptr<transport::Connection> Context::Impl::connect(
   return std::make_shared<Connection>(
       Connection::ConstructorToken(),
       std::static_pointer_cast<PrivateIface>(shared_from_this()),
+      acquireLoop(),
       std::move(addr),
       std::move(connectionId));
 }
@@ -164,6 +309,27 @@ const std::string& Context::Impl::domainDescriptor() const {
   return domainDescriptor_;
 }
 
+std::map<std::string, uint64_t> Context::getStats() const {
+  return impl_->getStats();
+}
+
+std::map<std::string, uint64_t> Context::Impl::getStats() const {
+  return {
+      {"socket_buffer_resizes",
+       numSocketBufferResizes_.load(std::memory_order_relaxed)},
+      {"max_bandwidth_delay_product",
+       maxBandwidthDelayProduct_.load(std::memory_order_relaxed)},
+  };
+}
+
+const ContextOptions& Context::getOptions() const {
+  return impl_->getOptions();
+}
+
+const ContextOptions& Context::Impl::getOptions() const {
+  return options_;
+}
+
 std::tuple<Error, std::string> Context::lookupAddrForIface(std::string iface) {
   return impl_->lookupAddrForIface(std::move(iface));
 }
@@ -237,7 +403,8 @@ std::tuple<Error, std::string> Context::Impl::lookupAddrForHostnameFromLoop_() {
 
     Sockaddr addr = Sockaddr(rp->ai_addr, rp->ai_addrlen);
 
-    std::shared_ptr<TCPHandle> handle = createHandle();
+    // This probes TCP addresses, even when the context uses Unix sockets.
+    std::shared_ptr<SocketHandle> handle = SocketHandle::create(loop_);
     handle->initFromLoop();
     rv = handle->bindFromLoop(addr);
     handle->closeFromLoop();
@@ -278,14 +445,92 @@ bool Context::Impl::inLoop() {
   return loop_.inLoop();
 };
 
-void Context::Impl::deferToLoop(std::function<void()> fn) {
+void Context::Impl::deferToLoop(TTask fn) {
   loop_.deferToLoop(std::move(fn));
 };
 
-std::shared_ptr<TCPHandle> Context::Impl::createHandle() {
-  return TCPHandle::create(loop_);
+std::shared_ptr<SocketHandle> Context::Impl::createHandle() {
+  return SocketHandle::create(loop_, options_.unixSockets);
 };
 
+bool Context::Impl::usesUnixSockets() {
+  return options_.unixSockets;
+};
+
+Loop& Context::Impl::acquireLoop() {
+  std::unique_lock<std::mutex> lock(numConnectionsMutex_);
+  auto iter = std::min_element(
+      numConnectionsPerLoop_.begin(), numConnectionsPerLoop_.end());
+  (*iter)++;
+  return *loops_[iter - numConnectionsPerLoop_.begin()];
+}
+
+void Context::Impl::acquireLoop(Loop& loop) {
+  std::unique_lock<std::mutex> lock(numConnectionsMutex_);
+  for (size_t loopIdx = 0; loopIdx < loops_.size(); loopIdx++) {
+    if (loops_[loopIdx].get() == &loop) {
+      numConnectionsPerLoop_[loopIdx]++;
+      return;
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown loop";
+}
+
+std::vector<Loop*> Context::Impl::getListenerShardLoops() {
+  std::vector<Loop*> loops;
+  if (options_.shardListeners && !options_.unixSockets) {
+    for (size_t loopIdx = 1; loopIdx < loops_.size(); loopIdx++) {
+      loops.push_back(loops_[loopIdx].get());
+    }
+  }
+  return loops;
+}
+
+void Context::Impl::releaseLoop(Loop& loop) {
+  std::unique_lock<std::mutex> lock(numConnectionsMutex_);
+  for (size_t loopIdx = 0; loopIdx < loops_.size(); loopIdx++) {
+    if (loops_[loopIdx].get() == &loop) {
+      TP_DCHECK_GT(numConnectionsPerLoop_[loopIdx], 0);
+      numConnectionsPerLoop_[loopIdx]--;
+      return;
+    }
+  }
+  TP_THROW_ASSERT() << "Unknown loop";
+}
+
+size_t Context::Impl::getReadAheadSize() {
+  return options_.readAheadSize;
+}
+
+size_t Context::Impl::getZeroCopyReceiveThreshold() {
+  return options_.zeroCopyReceiveThreshold;
+}
+
+const LowLatencyOptions& Context::Impl::getLowLatencyOptions() {
+  return options_.lowLatency;
+}
+
+const KernelTlsHandshake& Context::Impl::getTlsHandshake() {
+  return options_.tlsHandshake;
+}
+
+int Context::Impl::getListenBacklog() {
+  return options_.listenBacklog;
+}
+
+const SocketBufferOptions& Context::Impl::getSocketBufferOptions() {
+  return options_.socketBuffers;
+}
+
+void Context::Impl::countSocketBufferResize(uint64_t bandwidthDelayProduct) {
+  numSocketBufferResizes_.fetch_add(1, std::memory_order_relaxed);
+  uint64_t currentMax = maxBandwidthDelayProduct_.load();
+  while (bandwidthDelayProduct > currentMax &&
+         !maxBandwidthDelayProduct_.compare_exchange_weak(
+             currentMax, bandwidthDelayProduct)) {
+  }
+}
+
 } // namespace uv
 } // namespace transport
 } // namespace tensorpipe
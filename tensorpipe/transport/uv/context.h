@@ -8,12 +8,15 @@
 
 #pragma once
 
+#include <map>
 #include <memory>
 #include <string>
 #include <tuple>
+#include <vector>
 
 #include <tensorpipe/common/error.h>
 #include <tensorpipe/transport/context.h>
+#include <tensorpipe/transport/uv/options.h>
 
 namespace tensorpipe {
 namespace transport {
@@ -22,9 +25,24 @@ namespace uv {
 class Connection;
 class Listener;
 
-class Context : public transport::Context {
+class Context final : public transport::Context {
  public:
-  Context();
+  // See ContextOptions for the meaning and the defaults of the settings. They
+  // are validated here, and throw if they are out of range.
+  explicit Context(ContextOptions options);
+
+  // Same as above, with the settings given one by one, except for
+  // listenBacklog, which keeps its default.
+  explicit Context(
+      size_t numLoops = 1,
+      std::vector<std::vector<int>> loopCpus = {},
+      size_t readAheadSize = 0,
+      LowLatencyOptions lowLatency = LowLatencyOptions(),
+      bool unixSockets = false,
+      KernelTlsHandshake tlsHandshake = nullptr,
+      bool shardListeners = false,
+      size_t zeroCopyReceiveThreshold = 0,
+      SocketBufferOptions socketBuffers = SocketBufferOptions());
 
   std::shared_ptr<transport::Connection> connect(std::string addr) override;
 
@@ -32,6 +50,17 @@ class Context : public transport::Context {
 
   const std::string& domainDescriptor() const override;
 
+  // The stats report how many times the connections grew their socket buffers,
+  // and the largest bandwidth-delay product that any of them estimated, which,
+  // divided by the largest buffers the kernel allows, also tells how many lanes
+  // the mpt channel needs to fill the path.
+  std::map<std::string, uint64_t> getStats() const override;
+
+  // The settings the context was created with, once adjusted to one another
+  // and to the host (e.g., zero-copy receive is off with Unix sockets, and the
+  // socket buffers are capped at what the kernel allows).
+  const ContextOptions& getOptions() const;
+
   std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
 
   std::tuple<Error, std::string> lookupAddrForHostname();
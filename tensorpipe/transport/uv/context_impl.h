@@ -10,6 +10,7 @@
 
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/transport/uv/context.h>
@@ -18,13 +19,52 @@ namespace tensorpipe {
 namespace transport {
 namespace uv {
 
-class TCPHandle;
+class Loop;
+class SocketHandle;
 
 class Context::PrivateIface : public DeferredExecutor {
  public:
   virtual ClosingEmitter& getClosingEmitter() = 0;
 
-  virtual std::shared_ptr<TCPHandle> createHandle() = 0;
+  // Create a handle on the loop the context and the listeners run on.
+  virtual std::shared_ptr<SocketHandle> createHandle() = 0;
+
+  // Whether addresses are paths of Unix domain sockets rather than TCP ones.
+  virtual bool usesUnixSockets() = 0;
+
+  // Pick the loop a new connection will run on, and count it as running there
+  // until it calls releaseLoop (which it must do once it's done).
+  virtual Loop& acquireLoop() = 0;
+
+  // Count a new connection as running on the given loop, which it must release
+  // in the same way.
+  virtual void acquireLoop(Loop& loop) = 0;
+
+  // The loops, other than the context's one, on which each listener opens one
+  // more socket for the same address. Empty if listeners aren't sharded.
+  virtual std::vector<Loop*> getListenerShardLoops() = 0;
+
+  virtual void releaseLoop(Loop& loop) = 0;
+
+  virtual size_t getReadAheadSize() = 0;
+
+  // Zero if receiving doesn't map the pages of the socket.
+  virtual size_t getZeroCopyReceiveThreshold() = 0;
+
+  virtual const LowLatencyOptions& getLowLatencyOptions() = 0;
+
+  // With the maximum buffer size capped at what the kernel allows.
+  virtual const SocketBufferOptions& getSocketBufferOptions() = 0;
+
+  // To be called by the connections whenever they grow their socket buffers,
+  // with the bandwidth-delay product they estimated, for monitoring purposes.
+  virtual void countSocketBufferResize(uint64_t bandwidthDelayProduct) = 0;
+
+  // Empty if the connections aren't encrypted.
+  virtual const KernelTlsHandshake& getTlsHandshake() = 0;
+
+  // What the listening sockets give to listen().
+  virtual int getListenBacklog() = 0;
 
   virtual ~PrivateIface() = default;
 };
@@ -8,8 +8,12 @@
 
 #include <tensorpipe/transport/uv/listener.h>
 
+#include <utility>
+#include <vector>
+
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/uv/connection.h>
 #include <tensorpipe/transport/uv/context_impl.h>
 #include <tensorpipe/transport/uv/error.h>
@@ -64,14 +68,43 @@ class Listener::Impl : public std::enable_shared_from_this<Listener::Impl> {
   // Called when libuv has closed the handle.
   void closeCallbackFromLoop_();
 
+  // Open a socket on each of the context's other loops, if it shards listeners,
+  // for the address that the handle is bound to.
+  void startShardsFromLoop_();
+
+  // Bind and listen with an initialized socket on another loop. Called from
+  // that loop.
+  void initShardFromLoop_(
+      Loop& loop,
+      SocketHandle& shard,
+      const Sockaddr& addr);
+
+  // Accept a connection on a socket on another loop. Called from that loop.
+  void shardConnectionCallbackFromLoop_(
+      Loop& loop,
+      SocketHandle& shard,
+      int status);
+
+  // Hand over a connection accepted on another loop, where it then runs.
+  void shardConnectionAcceptedFromLoop_(
+      Loop& loop,
+      std::shared_ptr<SocketHandle> connection);
+
   void setError_(Error error);
 
   // Deal with an error.
   void handleError_();
 
   std::shared_ptr<Context::PrivateIface> context_;
-  std::shared_ptr<TCPHandle> handle_;
-  Sockaddr sockaddr_;
+  std::shared_ptr<SocketHandle> handle_;
+  // The address to listen on, which is a path for Unix sockets.
+  optional<Sockaddr> sockaddr_;
+  std::string path_;
+  // The sockets on the other loops, which listen on the same address as the
+  // handle, when the context shards listeners. Each must only be used from its
+  // loop, and they hold weak references to this instance, as they may outlive
+  // it while they close.
+  std::vector<std::pair<Loop*, std::shared_ptr<SocketHandle>>> shards_;
   Error error_{Error::kSuccess};
   ClosingReceiver closingReceiver_;
 
@@ -103,7 +136,7 @@ class Listener::Impl : public std::enable_shared_from_this<Listener::Impl> {
 
   // By having the instance store a shared_ptr to itself we create a reference
   // cycle which will "leak" the instance. This allows us to detach its
-  // lifetime from the connection and sync it with the TCPHandle's life cycle.
+  // lifetime from the connection and sync it with the handle's life cycle.
   std::shared_ptr<Impl> leak_;
 };
 
@@ -113,22 +146,125 @@ Listener::Impl::Impl(
     std::string id)
     : context_(std::move(context)),
       handle_(context_->createHandle()),
-      sockaddr_(Sockaddr::createInetSockAddr(addr)),
       closingReceiver_(context_, context_->getClosingEmitter()),
-      id_(std::move(id)) {}
+      id_(std::move(id)) {
+  if (handle_->isUnixDomain()) {
+    path_ = std::move(addr);
+  } else {
+    sockaddr_ = Sockaddr::createInetSockAddr(addr);
+  }
+}
 
 void Listener::Impl::initFromLoop() {
   leak_ = shared_from_this();
 
   closingReceiver_.activate(*this);
 
-  handle_->initFromLoop();
-  auto rv = handle_->bindFromLoop(sockaddr_);
+  const bool sharded = !context_->getListenerShardLoops().empty();
+  if (sharded) {
+    handle_->initWithReusePortFromLoop(sockaddr_.value().addr()->sa_family);
+  } else {
+    handle_->initFromLoop();
+  }
+  auto rv = handle_->isUnixDomain() ? handle_->bindFromLoop(path_)
+                                    : handle_->bindFromLoop(sockaddr_.value());
   TP_THROW_UV_IF(rv < 0, rv);
   handle_->armCloseCallbackFromLoop(
       [this]() { this->closeCallbackFromLoop_(); });
-  handle_->listenFromLoop(
-      [this](int status) { this->connectionCallbackFromLoop_(status); });
+  handle_->listenFromLoop(context_->getListenBacklog(), [this](int status) {
+    this->connectionCallbackFromLoop_(status);
+  });
+  if (sharded) {
+    startShardsFromLoop_();
+  }
+}
+
+void Listener::Impl::startShardsFromLoop_() {
+  TP_DCHECK(context_->inLoop());
+  // This resolves the port, in case the address left it to the kernel.
+  const Sockaddr addr = handle_->sockNameFromLoop();
+  for (Loop* loop : context_->getListenerShardLoops()) {
+    auto shard = SocketHandle::create(*loop);
+    shards_.emplace_back(loop, shard);
+    loop->deferToLoop([weakImpl{std::weak_ptr<Impl>(shared_from_this())},
+                       loop,
+                       shard{std::move(shard)},
+                       addr]() {
+      // Always initialize it, as it will be closed in any case.
+      shard->initWithReusePortFromLoop(addr.addr()->sa_family);
+      if (auto impl = weakImpl.lock()) {
+        impl->initShardFromLoop_(*loop, *shard, addr);
+      }
+    });
+  }
+}
+
+void Listener::Impl::initShardFromLoop_(
+    Loop& loop,
+    SocketHandle& shard,
+    const Sockaddr& addr) {
+  TP_DCHECK(loop.inLoop());
+  auto rv = shard.bindFromLoop(addr);
+  if (rv < 0) {
+    context_->deferToLoop([impl{shared_from_this()}, rv]() {
+      impl->setError_(TP_CREATE_ERROR(UVError, rv));
+    });
+    return;
+  }
+  // Capturing the shard would create a reference cycle.
+  shard.listenFromLoop(
+      context_->getListenBacklog(),
+      [weakImpl{std::weak_ptr<Impl>(shared_from_this())},
+       &loop,
+       shardPtr{&shard}](int status) {
+        if (auto impl = weakImpl.lock()) {
+          impl->shardConnectionCallbackFromLoop_(loop, *shardPtr, status);
+        }
+      });
+}
+
+void Listener::Impl::shardConnectionCallbackFromLoop_(
+    Loop& loop,
+    SocketHandle& shard,
+    int status) {
+  TP_DCHECK(loop.inLoop());
+  if (status != 0) {
+    context_->deferToLoop([impl{shared_from_this()}, status]() {
+      impl->setError_(TP_CREATE_ERROR(UVError, status));
+    });
+    return;
+  }
+  auto connection = SocketHandle::create(loop);
+  connection->initFromLoop();
+  shard.acceptFromLoop(connection);
+  context_->deferToLoop(
+      [impl{shared_from_this()}, &loop, connection{std::move(connection)}]() {
+        impl->shardConnectionAcceptedFromLoop_(loop, std::move(connection));
+      });
+}
+
+void Listener::Impl::shardConnectionAcceptedFromLoop_(
+    Loop& loop,
+    std::shared_ptr<SocketHandle> connection) {
+  TP_DCHECK(context_->inLoop());
+  if (error_) {
+    loop.deferToLoop([connection{std::move(connection)}]() {
+      connection->closeFromLoop();
+    });
+    return;
+  }
+  std::string connectionId = id_ + ".c" + std::to_string(connectionCounter_++);
+  TP_VLOG(7) << "Listener " << id_ << " is opening connection " << connectionId
+             << " (accepted on another loop)";
+  context_->acquireLoop(loop);
+  callback_.trigger(
+      Error::kSuccess,
+      std::make_shared<Connection>(
+          Connection::ConstructorToken(),
+          context_,
+          loop,
+          std::move(connection),
+          std::move(connectionId)));
 }
 
 void Listener::Impl::acceptFromLoop(accept_callback_fn fn) {
@@ -159,6 +295,9 @@ void Listener::Impl::acceptFromLoop(accept_callback_fn fn) {
 
 std::string Listener::Impl::addrFromLoop() const {
   TP_DCHECK(context_->inLoop());
+  if (handle_->isUnixDomain()) {
+    return handle_->pathFromLoop();
+  }
   return handle_->sockNameFromLoop().str();
 }
 
@@ -202,13 +341,30 @@ void Listener::Impl::connectionCallbackFromLoop_(int status) {
   handle_->acceptFromLoop(connection);
   std::string connectionId = id_ + ".c" + std::to_string(connectionCounter_++);
   TP_VLOG(7) << "Listener " << id_ << " is opening connection " << connectionId;
-  callback_.trigger(
-      Error::kSuccess,
-      std::make_shared<Connection>(
-          Connection::ConstructorToken(),
-          context_,
-          std::move(connection),
-          std::move(connectionId)));
+  Loop& loop = context_->acquireLoop();
+  if (loop.inLoop()) {
+    callback_.trigger(
+        Error::kSuccess,
+        std::make_shared<Connection>(
+            Connection::ConstructorToken(),
+            context_,
+            loop,
+            std::move(connection),
+            std::move(connectionId)));
+  } else {
+    // A handle can't be moved to another loop, hence hand over a duplicate of
+    // its socket to a new handle on the connection's loop.
+    Fd fd = connection->dupFromLoop();
+    connection->closeFromLoop();
+    callback_.trigger(
+        Error::kSuccess,
+        std::make_shared<Connection>(
+            Connection::ConstructorToken(),
+            context_,
+            loop,
+            std::move(fd),
+            std::move(connectionId)));
+  }
 }
 
 void Listener::Impl::closeCallbackFromLoop_() {
@@ -234,6 +390,11 @@ void Listener::Impl::handleError_() {
     return std::make_tuple(std::cref(error_), std::shared_ptr<Connection>());
   });
   handle_->closeFromLoop();
+  for (auto& shard : shards_) {
+    shard.first->deferToLoop(
+        [handle{std::move(shard.second)}]() { handle->closeFromLoop(); });
+  }
+  shards_.clear();
 }
 
 Listener::Listener(
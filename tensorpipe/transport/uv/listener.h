@@ -20,9 +20,9 @@ namespace uv {
 
 class Loop;
 class Sockaddr;
-class TCPHandle;
+class SocketHandle;
 
-class Listener : public transport::Listener {
+class Listener final : public transport::Listener {
   // Use the passkey idiom to allow make_shared to call what should be a private
   // constructor. See https://abseil.io/tips/134 for more information.
   struct ConstructorToken {};
@@ -16,9 +16,11 @@ namespace tensorpipe {
 namespace transport {
 namespace uv {
 
-Loop::Loop()
+Loop::Loop(std::vector<int> cpus, bool busyPoll)
     : loop_(std::make_unique<uv_loop_t>()),
-      async_(std::make_unique<uv_async_t>()) {
+      async_(std::make_unique<uv_async_t>()),
+      cpus_(std::move(cpus)),
+      busyPoll_(busyPoll) {
   int rv;
   rv = uv_loop_init(loop_.get());
   TP_THROW_UV_IF(rv < 0, rv);
@@ -58,9 +60,20 @@ void Loop::wakeupEventLoopToDeferFunction() {
 void Loop::eventLoop() {
   int rv;
 
-  rv = uv_run(loop_.get(), UV_RUN_DEFAULT);
-  TP_THROW_ASSERT_IF(rv > 0)
-      << ": uv_run returned with active handles or requests";
+  if (!cpus_.empty()) {
+    setThreadAffinity(cpus_);
+  }
+
+  if (busyPoll_) {
+    // This stops under the same condition as UV_RUN_DEFAULT, i.e., once the
+    // loop has no more active handles or requests.
+    while (uv_run(loop_.get(), UV_RUN_NOWAIT) != 0) {
+    }
+  } else {
+    rv = uv_run(loop_.get(), UV_RUN_DEFAULT);
+    TP_THROW_ASSERT_IF(rv > 0)
+        << ": uv_run returned with active handles or requests";
+  }
 
   uv_ref(reinterpret_cast<uv_handle_t*>(async_.get()));
   uv_close(reinterpret_cast<uv_handle_t*>(async_.get()), nullptr);
@@ -26,7 +26,10 @@ namespace uv {
 
 class Loop final : public EventLoopDeferredExecutor {
  public:
-  Loop();
+  // If cpus isn't empty, the loop's thread will only run on those CPUs. If
+  // busyPoll is set, the loop keeps polling for events rather than blocking
+  // when there are none, which reduces the latency of reacting to them.
+  explicit Loop(std::vector<int> cpus = {}, bool busyPoll = false);
 
   uv_loop_t* ptr() {
     return loop_.get();
@@ -50,6 +53,8 @@ class Loop final : public EventLoopDeferredExecutor {
   std::unique_ptr<uv_async_t> async_;
   std::atomic<bool> closed_{false};
   std::atomic<bool> joined_{false};
+  const std::vector<int> cpus_;
+  const bool busyPoll_;
 
   // This function is called by the event loop thread whenever
   // we have to run a number of deferred functions.
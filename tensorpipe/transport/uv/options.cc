@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/options.h>
+
+#include <sstream>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/environment.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+namespace {
+
+const EnvironmentReader kEnvironment{"TP_UV_"};
+
+} // namespace
+
+void ContextOptions::validate() const {
+  TP_THROW_ASSERT_IF(numLoops == 0) << "There must be at least one loop";
+  TP_THROW_ASSERT_IF(!loopCpus.empty() && loopCpus.size() != numLoops)
+      << "Got CPUs for " << loopCpus.size() << " loops, instead of "
+      << numLoops;
+  TP_THROW_ASSERT_IF(unixSockets && tlsHandshake)
+      << "The kernel's TLS is only available for TCP sockets";
+  TP_THROW_ASSERT_IF(lowLatency.socketBusyPoll.count() < 0)
+      << "The busy-polling duration must be non-negative";
+  TP_THROW_ASSERT_IF(listenBacklog <= 0)
+      << "The listen backlog must be positive, got " << listenBacklog;
+}
+
+std::string ContextOptions::str() const {
+  std::ostringstream oss;
+  oss << std::boolalpha << "num_loops=" << numLoops
+      << ",read_ahead_size=" << readAheadSize
+      << ",socket_busy_poll_us=" << lowLatency.socketBusyPoll.count()
+      << ",prefer_busy_poll=" << lowLatency.preferBusyPoll
+      << ",quick_ack=" << lowLatency.quickAck
+      << ",busy_poll_loops=" << lowLatency.busyPollLoops
+      << ",unix_sockets=" << unixSockets
+      << ",shard_listeners=" << shardListeners
+      << ",zero_copy_receive_threshold=" << zeroCopyReceiveThreshold
+      << ",max_socket_buffer_size=" << socketBuffers.maxBufferSize
+      << ",not_sent_lowat=" << socketBuffers.notSentLowat
+      << ",listen_backlog=" << listenBacklog;
+  return oss.str();
+}
+
+ContextOptions ContextOptions::fromEnvironment(ContextOptions options) {
+  kEnvironment.setSize("num_loops", options.numLoops);
+  kEnvironment.setSize("read_ahead_size", options.readAheadSize);
+  kEnvironment.setMicroseconds(
+      "socket_busy_poll_us", options.lowLatency.socketBusyPoll);
+  kEnvironment.setBool("prefer_busy_poll", options.lowLatency.preferBusyPoll);
+  kEnvironment.setBool("quick_ack", options.lowLatency.quickAck);
+  kEnvironment.setBool("busy_poll_loops", options.lowLatency.busyPollLoops);
+  kEnvironment.setBool("unix_sockets", options.unixSockets);
+  kEnvironment.setBool("shard_listeners", options.shardListeners);
+  kEnvironment.setSize(
+      "zero_copy_receive_threshold", options.zeroCopyReceiveThreshold);
+  kEnvironment.setSize(
+      "max_socket_buffer_size", options.socketBuffers.maxBufferSize);
+  kEnvironment.setSize("not_sent_lowat", options.socketBuffers.notSentLowat);
+  kEnvironment.setInt("listen_backlog", options.listenBacklog);
+  return options;
+}
+
+ContextOptions ContextOptions::fromEnvironment() {
+  return fromEnvironment(ContextOptions());
+}
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
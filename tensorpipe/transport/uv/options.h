@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <tensorpipe/common/error.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+// Settings that lower the latency of the connections at the expense of CPU
+// usage. They all default to off, as they only pay off for latency-sensitive
+// traffic (e.g., small RPCs) on a fast network.
+struct LowLatencyOptions {
+  // How long reads that find no data busy-poll the NIC's receive queue, rather
+  // than waiting for an interrupt (SO_BUSY_POLL). Enabling this above the
+  // system default (net.core.busy_read) requires CAP_NET_ADMIN.
+  std::chrono::microseconds socketBusyPoll{0};
+
+  // Whether, while busy-polling, the NIC's interrupts should be deferred in
+  // favor of it (SO_PREFER_BUSY_POLL), on kernels that support it.
+  bool preferBusyPoll{false};
+
+  // Whether incoming data is acknowledged right away (TCP_QUICKACK). It costs
+  // an extra system call per read, as the kernel keeps resetting it.
+  bool quickAck{false};
+
+  // Whether the loops poll for events without ever blocking in epoll_wait,
+  // hence keeping one core each fully busy, even when idle.
+  bool busyPollLoops{false};
+
+  // All of the above.
+  static LowLatencyOptions aggressive() {
+    LowLatencyOptions options;
+    options.socketBusyPoll = std::chrono::microseconds(50);
+    options.preferBusyPoll = true;
+    options.quickAck = true;
+    options.busyPollLoops = true;
+    return options;
+  }
+};
+
+// Settings that let a single connection fill a path with a large
+// bandwidth-delay product (e.g., across regions), for which the socket buffers
+// that the kernel picks on its own are too small. They default to off.
+struct SocketBufferOptions {
+  // If positive, each connection estimates the bandwidth-delay product of its
+  // path every few round trips, from the round-trip times that the kernel
+  // measured (TCP_INFO) and from the throughput of its reads and writes, and
+  // grows its send and receive buffers (SO_SNDBUF and SO_RCVBUF) to twice that,
+  // up to this size. Hence a connection whose throughput is bound by its
+  // buffers doubles them at each estimate, until it's bound by something else.
+  // The buffers are never shrunk below what the kernel's autotuning, which this
+  // turns off, had reached. The kernel caps them at net.core.wmem_max and
+  // net.core.rmem_max, which must thus be raised too, as the connections don't
+  // go past them.
+  size_t maxBufferSize{0};
+
+  // If positive, how many bytes the send buffer may hold that weren't sent yet
+  // (TCP_NOTSENT_LOWAT), so that large buffers hold data in flight rather than
+  // a backlog that delays whatever is written after it.
+  size_t notSentLowat{0};
+};
+
+// The keys that a TLS handshake agreed on, in the format the kernel expects:
+// each is the raw bytes of one of the tls12_crypto_info_* structs of
+// <linux/tls.h>, which also carries the sequence number of the next record.
+struct KernelTlsKeys {
+  std::string txCryptoInfo;
+  std::string rxCryptoInfo;
+};
+
+// Performs a TLS handshake (e.g., with OpenSSL) as either the client or the
+// server, over a connected socket in blocking mode, and extracts the keys of
+// the session. It's called on a thread of its own, and must leave nothing
+// buffered in userspace, as the socket is handed to the kernel's TLS right
+// after.
+using KernelTlsHandshake =
+    std::function<Error(int fd, bool isClient, KernelTlsKeys& keys)>;
+
+// All the settings of a context, with their defaults. Each one also has a
+// snake_case name (the one of the field, or of the field of the nested
+// options), which is used for the environment variables and in str().
+struct ContextOptions {
+  // What listen() is given by default, which is also the kernel's default cap
+  // (net.core.somaxconn) on older kernels.
+  static constexpr int kDefaultListenBacklog = 128;
+
+  // The connections are spread over numLoops event loops, each running in its
+  // own thread: each new connection (incoming or outgoing) is assigned to the
+  // loop that currently has the fewest. Listeners all run on the first loop.
+  size_t numLoops{1};
+
+  // If not empty, it must contain an entry for each loop, with the CPUs its
+  // thread is restricted to (where an empty entry means all of them). It can't
+  // be set from the environment.
+  std::vector<std::vector<int>> loopCpus;
+
+  // If positive, each connection reads as much as is available (up to that
+  // many bytes) whenever its next read is a small one, such as a length prefix
+  // or a descriptor, into a buffer from which it then satisfies the reads that
+  // follow. A burst of small frames thus costs one system call rather than two
+  // per frame. The buffer starts smaller and grows and shrinks with the
+  // bursts, and large reads still bypass it.
+  size_t readAheadSize{0};
+
+  // When using them, consider also restricting the loops to the CPUs close to
+  // the NIC, as given by getCpusOfNetworkInterface, through loopCpus. In the
+  // environment, they are given by socket_busy_poll_us, prefer_busy_poll,
+  // quick_ack and busy_poll_loops.
+  LowLatencyOptions lowLatency;
+
+  // If set, the context uses Unix domain sockets instead of TCP, and its
+  // addresses are paths in the filesystem (whose socket files are removed when
+  // the listeners close). It can then only reach peers on the same machine,
+  // which its domain descriptor reflects, but it skips the whole TCP/IP stack.
+  // The intended use is to register such a context alongside a TCP one, under
+  // another name (e.g., "unix") and at a higher priority, so that pipes pick it
+  // for local peers and fall back to TCP for remote ones.
+  bool unixSockets{false};
+
+  // If set, the connections are encrypted, by the kernel's TLS (kTLS) or a NIC
+  // it offloads to, with keys obtained through a handshake in userspace. Hence
+  // the loops never spend any time on cryptography, and the data is still
+  // written straight from the user's buffers into the socket. The connections
+  // hold back their reads and writes until the handshake (and its round trips)
+  // is over. Such contexts only talk to one another. It can't be set from the
+  // environment, nor together with unixSockets.
+  KernelTlsHandshake tlsHandshake;
+
+  // If set, each listener opens one socket per loop, all bound to the same
+  // address with SO_REUSEPORT, and the kernel spreads the incoming connections
+  // over them. Each loop thus accepts (and sets up) its own share of a burst of
+  // connections, which then stay on it, instead of the first loop accepting
+  // them all. It has no effect with Unix sockets.
+  bool shardListeners{false};
+
+  // If positive, the reads of at least that many bytes for which the
+  // connection provides the buffer (i.e., those without a destination) have
+  // the kernel map the received pages into it, where it can, rather than copy
+  // them (TCP_ZEROCOPY_RECEIVE), and copy only what it can't, such as the
+  // unaligned ends. Such buffers are read-only. It's only worth it for large
+  // payloads, as mapping has costs of its own, and it requires the NIC to place
+  // the payloads in whole pages (e.g., with header splitting and a large MTU).
+  // It has no effect with Unix sockets or with kTLS.
+  size_t zeroCopyReceiveThreshold{0};
+
+  // They have no effect with Unix sockets. In the environment, they are given
+  // by max_socket_buffer_size and not_sent_lowat.
+  SocketBufferOptions socketBuffers;
+
+  // How many incoming connections each listening socket lets the kernel queue
+  // up before they are accepted. Bursts of more connections than that (e.g.,
+  // all the workers of a job connecting to the same server at once) get some
+  // of theirs dropped, and retried by the peers after a timeout. The kernel
+  // caps it at net.core.somaxconn.
+  int listenBacklog{kDefaultListenBacklog};
+
+  // Throw if any setting is out of range.
+  void validate() const;
+
+  // All the settings that can be given in the environment, as comma-separated
+  // key=value pairs.
+  std::string str() const;
+
+  // Override the settings of the given options (or the defaults) with the
+  // environment variables named after them, in uppercase and prefixed by
+  // TP_UV_ (e.g., TP_UV_NUM_LOOPS=4 or TP_UV_LISTEN_BACKLOG=1024), so that
+  // they can be tuned without changing the code. Sizes accept a K, M or G
+  // suffix, and booleans are given as true, false, 1 or 0. Throws if a value
+  // is malformed.
+  static ContextOptions fromEnvironment(ContextOptions options);
+  static ContextOptions fromEnvironment();
+};
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
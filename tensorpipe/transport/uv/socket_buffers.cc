@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/uv/socket_buffers.h>
+
+#include <limits>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+uint64_t estimateBandwidthDelayProduct(
+    uint64_t numBytes,
+    std::chrono::duration<double> elapsed,
+    uint32_t rttUs) {
+  if (!(elapsed.count() > 0)) {
+    return 0;
+  }
+  const double bandwidthDelayProduct = numBytes / elapsed.count() * rttUs / 1e6;
+  // Converting a double that's out of range to an integer is undefined.
+  if (bandwidthDelayProduct >=
+      static_cast<double>(std::numeric_limits<uint64_t>::max())) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+  return static_cast<uint64_t>(bandwidthDelayProduct);
+}
+
+size_t socketBufferSizeForBandwidthDelayProduct(
+    uint64_t bandwidthDelayProduct,
+    size_t maxBufferSize) {
+  // A connection that's bound by its buffers moves about one buffer's worth of
+  // data per round trip, hence this doubles them until it isn't anymore.
+  if (bandwidthDelayProduct > maxBufferSize / 2) {
+    return maxBufferSize;
+  }
+  return 2 * bandwidthDelayProduct;
+}
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
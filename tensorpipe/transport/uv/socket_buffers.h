@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+namespace transport {
+namespace uv {
+
+// Estimate the bandwidth-delay product of the path of a connection, in bytes,
+// from the number of bytes it moved in the given time and from its round-trip
+// time. It's zero if no time elapsed, and saturates rather than overflows.
+uint64_t estimateBandwidthDelayProduct(
+    uint64_t numBytes,
+    std::chrono::duration<double> elapsed,
+    uint32_t rttUs);
+
+// The size that the socket buffers of a connection should have, given its
+// bandwidth-delay product, i.e., twice that, capped at the maximum size.
+size_t socketBufferSizeForBandwidthDelayProduct(
+    uint64_t bandwidthDelayProduct,
+    size_t maxBufferSize);
+
+} // namespace uv
+} // namespace transport
+} // namespace tensorpipe
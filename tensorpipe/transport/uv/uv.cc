@@ -8,55 +8,136 @@
 
 #include <tensorpipe/transport/uv/uv.h>
 
+#include <sys/un.h>
+#include <unistd.h>
+
 #include <array>
 #include <sstream>
 
 #include <tensorpipe/common/defs.h>
 #include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/socket.h>
 #include <tensorpipe/transport/uv/macros.h>
 
 namespace tensorpipe {
 namespace transport {
 namespace uv {
 
-void TCPHandle::initFromLoop() {
+void SocketHandle::initFromLoop() {
   TP_DCHECK(this->loop_.inLoop());
   leak();
   int rv;
-  rv = uv_tcp_init(loop_.ptr(), this->ptr());
-  TP_THROW_UV_IF(rv < 0, rv);
-  rv = uv_tcp_nodelay(this->ptr(), 1);
+  if (unixDomain_) {
+    rv = uv_pipe_init(loop_.ptr(), &ptr()->pipe, /*ipc=*/0);
+    TP_THROW_UV_IF(rv < 0, rv);
+  } else {
+    rv = uv_tcp_init(loop_.ptr(), &ptr()->tcp);
+    TP_THROW_UV_IF(rv < 0, rv);
+    rv = uv_tcp_nodelay(&ptr()->tcp, 1);
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+}
+
+void SocketHandle::openFromLoop(Fd fd) {
+  TP_DCHECK(this->loop_.inLoop());
+  initFromLoop();
+  int rv;
+  if (unixDomain_) {
+    rv = uv_pipe_open(&ptr()->pipe, fd.release());
+    TP_THROW_UV_IF(rv < 0, rv);
+  } else {
+    rv = uv_tcp_open(&ptr()->tcp, fd.release());
+    TP_THROW_UV_IF(rv < 0, rv);
+    rv = uv_tcp_nodelay(&ptr()->tcp, 1);
+    TP_THROW_UV_IF(rv < 0, rv);
+  }
+}
+
+void SocketHandle::initWithReusePortFromLoop(sa_family_t family) {
+  TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(!unixDomain_);
+  Error error;
+  Socket socket;
+  std::tie(error, socket) = Socket::createForFamily(family);
+  TP_THROW_ASSERT_IF(error) << error.what();
+  error = socket.reusePort(true);
+  TP_THROW_ASSERT_IF(error) << error.what();
+  openFromLoop(std::move(socket));
+}
+
+Fd SocketHandle::dupFromLoop() {
+  TP_DCHECK(this->loop_.inLoop());
+  int newFd = ::dup(filenoFromLoop());
+  TP_THROW_SYSTEM_IF(newFd < 0, errno);
+  return Fd(newFd);
+}
+
+int SocketHandle::filenoFromLoop() {
+  TP_DCHECK(this->loop_.inLoop());
+  uv_os_fd_t fd;
+  auto rv = uv_fileno(reinterpret_cast<uv_handle_t*>(this->ptr()), &fd);
   TP_THROW_UV_IF(rv < 0, rv);
+  return fd;
 }
 
-int TCPHandle::bindFromLoop(const Sockaddr& addr) {
+int SocketHandle::bindFromLoop(const Sockaddr& addr) {
   TP_DCHECK(this->loop_.inLoop());
-  auto rv = uv_tcp_bind(ptr(), addr.addr(), 0);
+  TP_DCHECK(!unixDomain_);
+  auto rv = uv_tcp_bind(&ptr()->tcp, addr.addr(), 0);
   // We don't throw in case of errors here because sometimes we bind in order to
   // try if an address works and want to handle errors gracefully.
   return rv;
 }
 
-Sockaddr TCPHandle::sockNameFromLoop() {
+Sockaddr SocketHandle::sockNameFromLoop() {
   TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(!unixDomain_);
   struct sockaddr_storage ss;
   struct sockaddr* addr = reinterpret_cast<struct sockaddr*>(&ss);
   int addrlen = sizeof(ss);
-  auto rv = uv_tcp_getsockname(ptr(), addr, &addrlen);
+  auto rv = uv_tcp_getsockname(&ptr()->tcp, addr, &addrlen);
   TP_THROW_UV_IF(rv < 0, rv);
   return Sockaddr(addr, addrlen);
 }
 
-void TCPHandle::connectFromLoop(
+void SocketHandle::connectFromLoop(
     const Sockaddr& addr,
     ConnectRequest::TConnectCallback fn) {
   TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(!unixDomain_);
   auto request = ConnectRequest::create(loop_, std::move(fn));
-  auto rv =
-      uv_tcp_connect(request->ptr(), ptr(), addr.addr(), request->callback());
+  auto rv = uv_tcp_connect(
+      request->ptr(), &ptr()->tcp, addr.addr(), request->callback());
   TP_THROW_UV_IF(rv < 0, rv);
 }
 
+int SocketHandle::bindFromLoop(const std::string& path) {
+  TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(unixDomain_);
+  return uv_pipe_bind(&ptr()->pipe, path.c_str());
+}
+
+std::string SocketHandle::pathFromLoop() {
+  TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(unixDomain_);
+  std::array<char, sizeof(sockaddr_un::sun_path) + 1> buf;
+  size_t len = buf.size();
+  auto rv = uv_pipe_getsockname(&ptr()->pipe, buf.data(), &len);
+  TP_THROW_UV_IF(rv < 0, rv);
+  return std::string(buf.data(), len);
+}
+
+void SocketHandle::connectFromLoop(
+    const std::string& path,
+    ConnectRequest::TConnectCallback fn) {
+  TP_DCHECK(this->loop_.inLoop());
+  TP_DCHECK(unixDomain_);
+  auto request = ConnectRequest::create(loop_, std::move(fn));
+  // Errors, even immediate ones, are reported through the callback.
+  uv_pipe_connect(
+      request->ptr(), &ptr()->pipe, path.c_str(), request->callback());
+}
+
 std::tuple<int, Addrinfo> getAddrinfoFromLoop(
     Loop& loop,
     std::string hostname) {
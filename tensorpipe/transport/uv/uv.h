@@ -9,11 +9,13 @@
 #pragma once
 
 #include <memory>
+#include <string>
 
 #include <uv.h>
 
 #include <tensorpipe/common/callback.h>
 #include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/fd.h>
 #include <tensorpipe/common/optional.h>
 #include <tensorpipe/transport/uv/loop.h>
 #include <tensorpipe/transport/uv/macros.h>
@@ -90,7 +92,8 @@ class BaseHandle : public BaseResource<T, U> {
       : BaseResource<T, U>::BaseResource(
             typename BaseResource<T, U>::ConstructorToken(),
             loop) {
-    handle_.data = this;
+    // This also works when U is the union of all handle types.
+    reinterpret_cast<uv_handle_t*>(&handle_)->data = this;
   }
 
   virtual ~BaseHandle() = default;
@@ -191,8 +194,6 @@ class StreamHandle : public BaseHandle<T, U> {
     ref.readCallback_.value()(nread, buf);
   }
 
-  static constexpr int kBacklog = 128;
-
  public:
   using TConnectionCallback = std::function<void(int status)>;
   using TAcceptCallback = std::function<void(int status)>;
@@ -205,13 +206,13 @@ class StreamHandle : public BaseHandle<T, U> {
 
   // TODO Split this into a armConnectionCallback, a listenStart and a
   // listenStop method, to propagate the backpressure to the clients.
-  void listenFromLoop(TConnectionCallback connectionCallback) {
+  void listenFromLoop(int backlog, TConnectionCallback connectionCallback) {
     TP_DCHECK(this->loop_.inLoop());
     TP_THROW_ASSERT_IF(connectionCallback_.has_value());
     connectionCallback_ = std::move(connectionCallback);
     auto rv = uv_listen(
         reinterpret_cast<uv_stream_t*>(this->ptr()),
-        kBacklog,
+        backlog,
         uv__connection_cb);
     TP_THROW_UV_IF(rv < 0, rv);
   }
@@ -304,12 +305,40 @@ class ConnectRequest : public BaseRequest<ConnectRequest, uv_connect_t> {
   TConnectCallback fn_;
 };
 
-class TCPHandle : public StreamHandle<TCPHandle, uv_tcp_t> {
+// A stream socket, which is either a TCP one or a Unix domain one (which libuv
+// calls a pipe), as chosen when it's created. The methods that deal with
+// addresses come in two flavors, of which only one applies to each kind.
+class SocketHandle : public StreamHandle<SocketHandle, uv_any_handle> {
  public:
-  using StreamHandle<TCPHandle, uv_tcp_t>::StreamHandle;
+  SocketHandle(
+      ConstructorToken /* unused */,
+      Loop& loop,
+      bool unixDomain = false)
+      : StreamHandle<SocketHandle, uv_any_handle>(ConstructorToken(), loop),
+        unixDomain_(unixDomain) {}
+
+  bool isUnixDomain() const {
+    return unixDomain_;
+  }
 
   void initFromLoop();
 
+  // Initialize the handle and have it take over an already connected socket.
+  void openFromLoop(Fd fd);
+
+  // Initialize the handle with a new TCP socket of the given family, which can
+  // bind to the same address as other such ones (SO_REUSEPORT).
+  void initWithReusePortFromLoop(sa_family_t family);
+
+  // Return a duplicate of the handle's socket, which can be used to move the
+  // connection to a handle on another loop.
+  Fd dupFromLoop();
+
+  // Return the handle's socket, which remains owned by the handle.
+  int filenoFromLoop();
+
+  // For TCP sockets.
+
   [[nodiscard]] int bindFromLoop(const Sockaddr& addr);
 
   Sockaddr sockNameFromLoop();
@@ -317,6 +346,19 @@ class TCPHandle : public StreamHandle<TCPHandle, uv_tcp_t> {
   void connectFromLoop(
       const Sockaddr& addr,
       ConnectRequest::TConnectCallback fn);
+
+  // For Unix domain sockets, whose addresses are paths in the filesystem.
+
+  [[nodiscard]] int bindFromLoop(const std::string& path);
+
+  std::string pathFromLoop();
+
+  void connectFromLoop(
+      const std::string& path,
+      ConnectRequest::TConnectCallback fn);
+
+ private:
+  const bool unixDomain_;
 };
 
 struct AddrinfoDeleter {
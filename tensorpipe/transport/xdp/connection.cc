@@ -0,0 +1,1181 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/xdp/connection.h>
+
+#include <cstring>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <tensorpipe/common/callback.h>
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/common/epoll_loop.h>
+#include <tensorpipe/common/error_macros.h>
+#include <tensorpipe/common/ringbuffer_read_write_ops.h>
+#include <tensorpipe/common/socket.h>
+#include <tensorpipe/transport/error.h>
+#include <tensorpipe/transport/xdp/constants.h>
+#include <tensorpipe/transport/xdp/context_impl.h>
+#include <tensorpipe/transport/xdp/error.h>
+#include <tensorpipe/transport/xdp/frame.h>
+#include <tensorpipe/transport/xdp/reactor.h>
+#include <tensorpipe/transport/xdp/sockaddr.h>
+#include <tensorpipe/util/ringbuffer/consumer.h>
+#include <tensorpipe/util/ringbuffer/producer.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+namespace {
+
+// The data that each side of a connection needs to send to the other one in
+// order to send it segments. This data is transferred over a TCP connection.
+struct Exchange {
+  Endpoint endpoint;
+  // The identifier that the sender's reactor assigned to the connection.
+  uint32_t connectionId;
+  // The largest payload that the sender's interface can receive in a segment.
+  uint32_t maxSegmentLength;
+  // How much data the sender can take before telling how much more it has room
+  // for.
+  uint64_t inboxSize;
+};
+
+// Copy data between a linear buffer and a ringbuffer's data, starting at the
+// given offset in the stream, which wraps around the ringbuffer.
+void copyFromRing(
+    const uint8_t* ring,
+    uint64_t ringSize,
+    uint64_t offset,
+    uint8_t* ptr,
+    size_t length) {
+  const uint64_t start = offset & (ringSize - 1);
+  const size_t firstLength = std::min<uint64_t>(length, ringSize - start);
+  std::memcpy(ptr, ring + start, firstLength);
+  std::memcpy(ptr + firstLength, ring, length - firstLength);
+}
+
+void copyToRing(
+    uint8_t* ring,
+    uint64_t ringSize,
+    uint64_t offset,
+    const uint8_t* ptr,
+    size_t length) {
+  const uint64_t start = offset & (ringSize - 1);
+  const size_t firstLength = std::min<uint64_t>(length, ringSize - start);
+  std::memcpy(ring + start, ptr, firstLength);
+  std::memcpy(ring, ptr + firstLength, length - firstLength);
+}
+
+} // namespace
+
+class Connection::Impl : public std::enable_shared_from_this<Connection::Impl>,
+                         public EpollLoop::EventHandler,
+                         public XdpEventHandler {
+  enum State {
+    INITIALIZING = 1,
+    SEND_ADDR,
+    RECV_ADDR,
+    ESTABLISHED,
+  };
+
+ public:
+  // Create a connection that is already connected (e.g. from a listener).
+  Impl(
+      std::shared_ptr<Context::PrivateIface> context,
+      Socket socket,
+      std::string id);
+
+  // Create a connection that connects to the specified address.
+  Impl(
+      std::shared_ptr<Context::PrivateIface> context,
+      std::string addr,
+      std::string id);
+
+  // Initialize member fields that need `shared_from_this`.
+  void init();
+
+  // Queue a read operation.
+  void read(read_callback_fn fn);
+  void read(AbstractNopHolder& object, read_nop_callback_fn fn);
+  void read(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void write(const void* ptr, size_t length, write_callback_fn fn);
+  void write(const AbstractNopHolder& object, write_callback_fn fn);
+
+  // Perform multiple write operations at once, optionally starting with a nop
+  // object (if not null).
+  void writev(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
+  // Tell the connection what its identifier is.
+  void setId(std::string id);
+
+  // Shut down the connection and its resources.
+  void close();
+
+  // Implementation of EventHandler.
+  void handleEventsFromLoop(int events) override;
+
+  // Implementation of XdpEventHandler.
+  void onSegment(const SegmentHeader& header, const uint8_t* payload) override;
+  void onPolled(std::chrono::steady_clock::time_point now) override;
+
+ private:
+  // Initialize member fields that need `shared_from_this`.
+  void initFromLoop();
+
+  // Queue a read operation.
+  void readFromLoop(read_callback_fn fn);
+  void readFromLoop(AbstractNopHolder& object, read_nop_callback_fn fn);
+  void readFromLoop(void* ptr, size_t length, read_callback_fn fn);
+
+  // Queue multiple read operations at once.
+  void readvFromLoop(std::vector<ReadBuffer> buffers, readv_callback_fn fn);
+
+  // Perform a write operation.
+  void writeFromLoop(const void* ptr, size_t length, write_callback_fn fn);
+  void writeFromLoop(const AbstractNopHolder& object, write_callback_fn fn);
+
+  // Perform multiple write operations at once.
+  void writevFromLoop(
+      const AbstractNopHolder* object,
+      std::vector<WriteBuffer> buffers,
+      write_callback_fn fn);
+
+  void setIdFromLoop_(std::string id);
+
+  // Shut down the connection and its resources.
+  void closeFromLoop();
+
+  // Handle events of type EPOLLIN on the TCP socket.
+  //
+  // The only data that is expected on that socket is the endpoint and other
+  // setup information of the other side.
+  void handleEventInFromLoop();
+
+  // Handle events of type EPOLLOUT on the TCP socket.
+  //
+  // Once the socket is writable we send the endpoint and other setup
+  // information of this side.
+  void handleEventOutFromLoop();
+
+  State state_{INITIALIZING};
+  Error error_{Error::kSuccess};
+  std::shared_ptr<Context::PrivateIface> context_;
+  Socket socket_;
+  optional<Sockaddr> sockaddr_;
+  ClosingReceiver closingReceiver_;
+
+  // The identifiers that the two reactors assigned to the connection, which
+  // the segments for each side carry.
+  optional<uint32_t> connectionId_;
+  uint32_t peerConnectionId_{0};
+  Endpoint peerEndpoint_;
+  // The largest payload that both sides can fit in a segment.
+  size_t maxSegmentLength_{0};
+
+  // Inbox, into which the payloads of the segments are copied, in order. Its
+  // head is how much of the peer's stream we received, and its tail how much of
+  // it we consumed.
+  // Initialize header during construction because it isn't assignable. This
+  // relies on the context having been initialized first.
+  util::ringbuffer::RingBufferHeader inboxHeader_{context_->getInboxSize()};
+  std::unique_ptr<uint8_t[]> inboxData_;
+  util::ringbuffer::RingBuffer inboxRb_;
+
+  // Outbox, into which the write operations copy their data, which is then
+  // sent in segments. Its head is how much of our stream was written, and its
+  // tail how much of it the peer acknowledged, as the data must be kept around
+  // until then in case it has to be sent again.
+  util::ringbuffer::RingBufferHeader outboxHeader_{context_->getInboxSize()};
+  std::unique_ptr<uint8_t[]> outboxData_;
+  util::ringbuffer::RingBuffer outboxRb_;
+
+  // Where in our stream the next segment starts (it goes back to the tail of
+  // the outbox when retransmitting), the furthest any segment reached, and how
+  // far the peer has room for.
+  uint64_t nextOffsetToSend_{0};
+  uint64_t highestOffsetSent_{0};
+  uint64_t peerWindowEnd_{0};
+
+  // How far we last told the peer it could send, and whether we owe it an
+  // acknowledgement, which goes out with the next segment we send or, if there
+  // are none, on its own at the next iteration of the reactor.
+  uint64_t windowEnd_{0};
+  bool needsAck_{false};
+
+  // The retransmission timer, which runs while the outbox holds any data that
+  // the peer hasn't acknowledged. It restarts, with the initial timeout, when
+  // the peer acknowledges some of it, whereas the timeout doubles at each
+  // retransmission. The connection fails after too many retransmissions in a
+  // row without hearing from the peer.
+  bool retransmitTimerArmed_{false};
+  std::chrono::steady_clock::time_point retransmitDeadline_;
+  std::chrono::microseconds retransmitTimeout_{kInitialRetransmitTimeout};
+  bool gotAckSinceLastPoll_{false};
+  int numRetransmits_{0};
+
+  // Pending read operations.
+  std::deque<RingbufferReadOperation> readOperations_;
+
+  // Pending write operations.
+  std::deque<RingbufferWriteOperation> writeOperations_;
+
+  // A sequence number for the calls to read.
+  uint64_t nextBufferBeingRead_{0};
+
+  // A sequence number for the calls to write.
+  uint64_t nextBufferBeingWritten_{0};
+
+  // A sequence number for the invocations of the callbacks of read.
+  uint64_t nextReadCallbackToCall_{0};
+
+  // A sequence number for the invocations of the callbacks of write.
+  uint64_t nextWriteCallbackToCall_{0};
+
+  // An identifier for the connection, composed of the identifier for the
+  // context or listener, combined with an increasing sequence number. It will
+  // only be used for logging and debugging purposes.
+  std::string id_;
+
+  // Process pending read operations if in an operational state.
+  //
+  // This is triggered when segments from the peer bring new data to the inbox.
+  // It is also called by this connection when it moves into an established
+  // state or when a new read operation is queued, in case data was already
+  // available before this connection was ready to consume it.
+  void processReadOperationsFromLoop();
+
+  // Process pending write operations if in an operational state.
+  //
+  // This is triggered when the peer acknowledges some data, which frees up
+  // space in the outbox. This is important when some of this side's writes
+  // couldn't complete because the outbox was full. This method is also called
+  // by this connection when it moves into an established state, in case some
+  // writes were queued before the connection was ready to process them, or when
+  // a new write operation is queued.
+  void processWriteOperationsFromLoop();
+
+  // Send as much of the outbox as the peer has room for, and an acknowledgement
+  // if we owe one and it didn't go out with that data, and have the reactor
+  // poll us if anything is left to do.
+  void transmitFromLoop_();
+
+  // Send a segment with the given part of the outbox and with the latest
+  // acknowledgement. Return false if the reactor ran out of frames.
+  bool sendSegment_(uint64_t offset, size_t length, uint16_t flags);
+
+  void setError_(Error error);
+
+  // Deal with an error.
+  void handleError();
+};
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(socket),
+          std::move(id))) {
+  impl_->init();
+}
+
+Connection::Connection(
+    ConstructorToken /* unused */,
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : impl_(std::make_shared<Impl>(
+          std::move(context),
+          std::move(addr),
+          std::move(id))) {
+  impl_->init();
+}
+
+void Connection::Impl::init() {
+  context_->deferToLoop([impl{shared_from_this()}]() { impl->initFromLoop(); });
+}
+
+void Connection::close() {
+  impl_->close();
+}
+
+void Connection::Impl::close() {
+  context_->deferToLoop(
+      [impl{shared_from_this()}]() { impl->closeFromLoop(); });
+}
+
+Connection::~Connection() {
+  close();
+}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    Socket socket,
+    std::string id)
+    : context_(std::move(context)),
+      socket_(std::move(socket)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+Connection::Impl::Impl(
+    std::shared_ptr<Context::PrivateIface> context,
+    std::string addr,
+    std::string id)
+    : context_(std::move(context)),
+      sockaddr_(Sockaddr::createInetSockAddr(addr)),
+      closingReceiver_(context_, context_->getClosingEmitter()),
+      id_(std::move(id)) {}
+
+void Connection::Impl::initFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  closingReceiver_.activate(*this);
+
+  Error error;
+  // The connection either got a socket or an address, but not both.
+  TP_DCHECK(socket_.hasValue() ^ sockaddr_.has_value());
+  if (!socket_.hasValue()) {
+    std::tie(error, socket_) =
+        Socket::createForFamily(sockaddr_->addr()->sa_family);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.reuseAddr(true);
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+    error = socket_.connect(sockaddr_.value());
+    if (error) {
+      setError_(std::move(error));
+      return;
+    }
+  }
+  // Ensure underlying control socket is non-blocking such that it
+  // works well with event driven I/O.
+  error = socket_.block(false);
+  if (error) {
+    setError_(std::move(error));
+    return;
+  }
+
+  inboxData_ = std::make_unique<uint8_t[]>(inboxHeader_.kDataPoolByteSize);
+  inboxRb_ = util::ringbuffer::RingBuffer(&inboxHeader_, inboxData_.get());
+  outboxData_ = std::make_unique<uint8_t[]>(outboxHeader_.kDataPoolByteSize);
+  outboxRb_ = util::ringbuffer::RingBuffer(&outboxHeader_, outboxData_.get());
+  windowEnd_ = inboxHeader_.kDataPoolByteSize;
+
+  // Have the reactor hand us the segments that the peer sends us.
+  connectionId_ = context_->getReactor().registerConnection(shared_from_this());
+
+  // We're sending address first, so wait for writability.
+  state_ = SEND_ADDR;
+  context_->registerDescriptor(socket_.fd(), EPOLLOUT, shared_from_this());
+}
+
+void Connection::read(read_callback_fn fn) {
+  impl_->read(std::move(fn));
+}
+
+void Connection::Impl::read(read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received an unsized read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling an unsized read callback (#" << sequenceNumber
+               << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling an unsized read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_, nullptr, 0);
+    return;
+  }
+
+  readOperations_.emplace_back(std::move(fn));
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::read(AbstractNopHolder& object, read_nop_callback_fn fn) {
+  impl_->read(object, std::move(fn));
+}
+
+void Connection::Impl::read(
+    AbstractNopHolder& object,
+    read_nop_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, &object, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(object, std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(
+    AbstractNopHolder& object,
+    read_nop_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a nop object read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a nop object read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a nop object read callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  readOperations_.emplace_back(
+      &object,
+      [fn{std::move(fn)}](
+          const Error& error, const void* /* unused */, size_t /* unused */) {
+        fn(error);
+      });
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::read(void* ptr, size_t length, read_callback_fn fn) {
+  impl_->read(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::read(void* ptr, size_t length, read_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->readFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::Impl::readFromLoop(
+    void* ptr,
+    size_t length,
+    read_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a sized read request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](
+           const Error& error, const void* ptr, size_t length) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a sized read callback (#"
+               << sequenceNumber << ")";
+    fn(error, ptr, length);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a sized read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_, ptr, length);
+    return;
+  }
+
+  readOperations_.emplace_back(ptr, length, std::move(fn));
+
+  // If the inbox already contains some data, we may be able to process this
+  // operation right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::readv(std::vector<ReadBuffer> buffers, readv_callback_fn fn) {
+  impl_->readv(std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::readv(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->readvFromLoop(std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::readvFromLoop(
+    std::vector<ReadBuffer> buffers,
+    readv_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(!buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingRead_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored read request (#"
+             << sequenceNumber << ", containing " << buffers.size()
+             << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextReadCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored read callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored read callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, as each of them was framed separately,
+  // but only the last one carries the callback.
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const ReadBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [fn{std::move(fn)}](
+              const Error& error,
+              const void* /* unused */,
+              size_t /* unused */) { fn(error); });
+    } else {
+      readOperations_.emplace_back(
+          buffer.ptr,
+          buffer.length,
+          [](const Error& /* unused */,
+             const void* /* unused */,
+             size_t /* unused */) {});
+    }
+  }
+
+  // If the inbox already contains some data, we may be able to process these
+  // operations right away.
+  processReadOperationsFromLoop();
+}
+
+void Connection::write(const void* ptr, size_t length, write_callback_fn fn) {
+  impl_->write(ptr, length, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, ptr, length, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(ptr, length, std::move(fn));
+      });
+}
+
+void Connection::Impl::writeFromLoop(
+    const void* ptr,
+    size_t length,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a write request (#"
+             << sequenceNumber << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_ << " is calling a write callback (#"
+               << sequenceNumber << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_ << " done calling a write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(ptr, length, std::move(fn));
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::write(const AbstractNopHolder& object, write_callback_fn fn) {
+  impl_->write(object, std::move(fn));
+}
+
+void Connection::Impl::write(
+    const AbstractNopHolder& object,
+    write_callback_fn fn) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, &object, fn{std::move(fn)}]() mutable {
+        impl->writeFromLoop(object, std::move(fn));
+      });
+}
+
+void Connection::Impl::writeFromLoop(
+    const AbstractNopHolder& object,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_
+             << " received a nop object write request (#" << sequenceNumber
+             << ")";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a nop object write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a nop object write callback (#"
+               << sequenceNumber << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  writeOperations_.emplace_back(&object, std::move(fn));
+
+  // If the outbox has some free space, we may be able to process this operation
+  // right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::writev(
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(nullptr, std::move(buffers), std::move(fn));
+}
+
+void Connection::writev(
+    const AbstractNopHolder& object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  impl_->writev(&object, std::move(buffers), std::move(fn));
+}
+
+void Connection::Impl::writev(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  context_->deferToLoop([impl{shared_from_this()},
+                         object,
+                         buffers{std::move(buffers)},
+                         fn{std::move(fn)}]() mutable {
+    impl->writevFromLoop(object, std::move(buffers), std::move(fn));
+  });
+}
+
+void Connection::Impl::writevFromLoop(
+    const AbstractNopHolder* object,
+    std::vector<WriteBuffer> buffers,
+    write_callback_fn fn) {
+  TP_DCHECK(context_->inLoop());
+  TP_DCHECK(object != nullptr || !buffers.empty());
+
+  uint64_t sequenceNumber = nextBufferBeingWritten_++;
+  TP_VLOG(7) << "Connection " << id_ << " received a vectored write request (#"
+             << sequenceNumber << ", containing "
+             << (object != nullptr ? "a nop object and " : "")
+             << buffers.size() << " buffers)";
+
+  fn = [this, sequenceNumber, fn{std::move(fn)}](const Error& error) {
+    TP_DCHECK_EQ(sequenceNumber, nextWriteCallbackToCall_++);
+    TP_VLOG(7) << "Connection " << id_
+               << " is calling a vectored write callback (#" << sequenceNumber
+               << ")";
+    fn(error);
+    TP_VLOG(7) << "Connection " << id_
+               << " done calling a vectored write callback (#" << sequenceNumber
+               << ")";
+  };
+
+  if (error_) {
+    fn(error_);
+    return;
+  }
+
+  // Each buffer gets its own operation, in order to be framed as if it had been
+  // written on its own, but only the last one carries the callback.
+  if (object != nullptr) {
+    if (buffers.empty()) {
+      writeOperations_.emplace_back(object, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(object, [](const Error& /* unused */) {});
+    }
+  }
+  for (size_t bufferIdx = 0; bufferIdx < buffers.size(); bufferIdx++) {
+    const WriteBuffer& buffer = buffers[bufferIdx];
+    if (bufferIdx == buffers.size() - 1) {
+      writeOperations_.emplace_back(buffer.ptr, buffer.length, std::move(fn));
+    } else {
+      writeOperations_.emplace_back(
+          buffer.ptr, buffer.length, [](const Error& /* unused */) {});
+    }
+  }
+
+  // If the outbox has some free space, we may be able to process these
+  // operations right away.
+  processWriteOperationsFromLoop();
+}
+
+void Connection::setId(std::string id) {
+  impl_->setId(std::move(id));
+}
+
+void Connection::Impl::setId(std::string id) {
+  context_->deferToLoop(
+      [impl{shared_from_this()}, id{std::move(id)}]() mutable {
+        impl->setIdFromLoop_(std::move(id));
+      });
+}
+
+void Connection::Impl::setIdFromLoop_(std::string id) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " was renamed to " << id;
+  id_ = std::move(id);
+}
+
+void Connection::Impl::handleEventsFromLoop(int events) {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(9) << "Connection " << id_ << " is handling an event on its socket ("
+             << EpollLoop::formatEpollEvents(events) << ")";
+
+  // Handle only one of the events in the mask. Events on the control
+  // file descriptor are rare enough for the cost of having epoll call
+  // into this function multiple times to not matter. The benefit is
+  // that every handler can close and unregister the control file
+  // descriptor from the event loop, without worrying about the next
+  // handler trying to do so as well.
+  // In some cases the socket could be in a state where it's both in an error
+  // state and readable/writable. If we checked for EPOLLIN or EPOLLOUT first
+  // and then returned after handling them, we would keep doing so forever and
+  // never reach the error handling. So we should keep the error check first.
+  if (events & EPOLLERR) {
+    int error;
+    socklen_t errorlen = sizeof(error);
+    int rv = getsockopt(
+        socket_.fd(),
+        SOL_SOCKET,
+        SO_ERROR,
+        reinterpret_cast<void*>(&error),
+        &errorlen);
+    if (rv == -1) {
+      setError_(TP_CREATE_ERROR(SystemError, "getsockopt", rv));
+    } else {
+      setError_(TP_CREATE_ERROR(SystemError, "async error on socket", error));
+    }
+    return;
+  }
+  if (events & EPOLLIN) {
+    handleEventInFromLoop();
+    return;
+  }
+  if (events & EPOLLOUT) {
+    handleEventOutFromLoop();
+    return;
+  }
+  // Check for hangup last, as there could be cases where we get EPOLLHUP but
+  // there's still data to be read from the socket, so we want to deal with that
+  // before dealing with the hangup.
+  if (events & EPOLLHUP) {
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+}
+
+void Connection::Impl::handleEventInFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == RECV_ADDR) {
+    struct Exchange ex;
+
+    auto err = socket_.read(&ex, sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be read in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortReadError, sizeof(ex), err));
+      return;
+    }
+
+    peerEndpoint_ = ex.endpoint;
+    peerConnectionId_ = ex.connectionId;
+    peerWindowEnd_ = ex.inboxSize;
+    maxSegmentLength_ = std::min<size_t>(
+        context_->getReactor().getMaxSegmentLength(), ex.maxSegmentLength);
+
+    // The connection is usable now.
+    state_ = ESTABLISHED;
+    processWriteOperationsFromLoop();
+    // Trigger read operations in case a pair of local read() and remote
+    // write() happened before connection is established. Otherwise read()
+    // callback would lose if it's the only read() request.
+    processReadOperationsFromLoop();
+    return;
+  }
+
+  if (state_ == ESTABLISHED) {
+    // We don't expect to read anything on this socket once the
+    // connection has been established. If we do, assume it's a
+    // zero-byte read indicating EOF.
+    setError_(TP_CREATE_ERROR(EOFError));
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLIN event not handled in state " << state_;
+}
+
+void Connection::Impl::handleEventOutFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  if (state_ == SEND_ADDR) {
+    Exchange ex;
+    std::memset(&ex, 0, sizeof(ex));
+    ex.endpoint = context_->getReactor().getEndpoint();
+    ex.connectionId = connectionId_.value();
+    ex.maxSegmentLength = context_->getReactor().getMaxSegmentLength();
+    ex.inboxSize = inboxHeader_.kDataPoolByteSize;
+
+    auto err = socket_.write(reinterpret_cast<void*>(&ex), sizeof(ex));
+    // Crossing our fingers that the exchange information is small enough that
+    // it can be written in a single chunk.
+    if (err != sizeof(ex)) {
+      setError_(TP_CREATE_ERROR(ShortWriteError, sizeof(ex), err));
+      return;
+    }
+
+    // Sent our address. Wait for address from peer.
+    state_ = RECV_ADDR;
+    context_->registerDescriptor(socket_.fd(), EPOLLIN, shared_from_this());
+    return;
+  }
+
+  TP_THROW_ASSERT() << "EPOLLOUT event not handled in state " << state_;
+}
+
+void Connection::Impl::processReadOperationsFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  // Process all read read operations that we can immediately serve, only
+  // when connection is established.
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+  // Serve read operations
+  util::ringbuffer::Consumer inboxConsumer(inboxRb_);
+  while (!readOperations_.empty()) {
+    RingbufferReadOperation& readOperation = readOperations_.front();
+    readOperation.handleRead(inboxConsumer);
+    if (readOperation.completed()) {
+      readOperations_.pop_front();
+    } else {
+      break;
+    }
+  }
+  // The callbacks may have closed the connection.
+  if (error_) {
+    return;
+  }
+  // The acknowledgements tell the peer how much room is left in the inbox, but
+  // it may have stopped sending because it ran out of it, hence we tell it
+  // explicitly once enough frees up.
+  const uint64_t windowEnd =
+      inboxHeader_.readTail() + inboxHeader_.kDataPoolByteSize;
+  if (windowEnd - windowEnd_ >=
+      inboxHeader_.kDataPoolByteSize / kInboxSizeToWindowUpdateRatio) {
+    needsAck_ = true;
+    context_->getReactor().requestPolling(connectionId_.value());
+  }
+}
+
+void Connection::Impl::processWriteOperationsFromLoop() {
+  TP_DCHECK(context_->inLoop());
+
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+
+  util::ringbuffer::Producer outboxProducer(outboxRb_);
+  while (!writeOperations_.empty()) {
+    RingbufferWriteOperation& writeOperation = writeOperations_.front();
+    writeOperation.handleWrite(outboxProducer);
+    if (writeOperation.completed()) {
+      writeOperations_.pop_front();
+    } else {
+      break;
+    }
+  }
+  // The callbacks may have closed the connection.
+  if (error_) {
+    return;
+  }
+
+  transmitFromLoop_();
+}
+
+void Connection::Impl::transmitFromLoop_() {
+  const uint64_t end =
+      std::min<uint64_t>(outboxHeader_.readHead(), peerWindowEnd_);
+  while (nextOffsetToSend_ < end) {
+    const size_t length =
+        std::min<uint64_t>(end - nextOffsetToSend_, maxSegmentLength_);
+    if (!sendSegment_(nextOffsetToSend_, length, /*flags=*/0)) {
+      break;
+    }
+    nextOffsetToSend_ += length;
+  }
+  if (needsAck_) {
+    sendSegment_(nextOffsetToSend_, /*length=*/0, /*flags=*/0);
+  }
+  // Keep an eye on the data that hasn't been acknowledged yet.
+  if (needsAck_ || outboxHeader_.readTail() < outboxHeader_.readHead()) {
+    context_->getReactor().requestPolling(connectionId_.value());
+  }
+}
+
+bool Connection::Impl::sendSegment_(
+    uint64_t offset,
+    size_t length,
+    uint16_t flags) {
+  uint8_t* frame = context_->getReactor().allocateTxFrame();
+  if (frame == nullptr) {
+    return false;
+  }
+
+  SegmentHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.connectionId = peerConnectionId_;
+  header.flags = flags;
+  header.length = length;
+  header.offset = offset;
+  header.ackOffset = inboxHeader_.readHead();
+  header.window = inboxHeader_.kDataPoolByteSize -
+      (header.ackOffset - inboxHeader_.readTail());
+  writeFrameHeaders(
+      frame, context_->getReactor().getEndpoint(), peerEndpoint_, header);
+  copyFromRing(
+      outboxData_.get(),
+      outboxHeader_.kDataPoolByteSize,
+      offset,
+      frame + kFrameHeadersLength,
+      length);
+  context_->getReactor().transmit(frame, kFrameHeadersLength + length);
+
+  TP_VLOG(9) << "Connection " << id_ << " sent a segment of " << length
+             << " bytes at offset " << offset << " (acknowledging up to "
+             << header.ackOffset << ", with room for " << header.window
+             << " more bytes)";
+
+  highestOffsetSent_ = std::max<uint64_t>(highestOffsetSent_, offset + length);
+  windowEnd_ = header.ackOffset + header.window;
+  needsAck_ = false;
+  return true;
+}
+
+void Connection::Impl::onSegment(
+    const SegmentHeader& header,
+    const uint8_t* payload) {
+  TP_DCHECK(context_->inLoop());
+  // Segments may arrive before we got the peer's endpoint, in which case it
+  // will send them again.
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+  numRetransmits_ = 0;
+
+  // The acknowledgement may come from a segment that was overtaken by others,
+  // or be for data that we sent before going back to retransmit.
+  const uint64_t ackOffset = header.ackOffset;
+  const uint64_t outboxTail = outboxHeader_.readTail();
+  if (ackOffset > outboxTail && ackOffset <= highestOffsetSent_) {
+    // We could start a transaction and use the proper methods for this, but as
+    // this method is the only consumer for the outbox ringbuffer we can cut it
+    // short and directly increase the tail.
+    outboxHeader_.incTail(ackOffset - outboxTail);
+    nextOffsetToSend_ = std::max<uint64_t>(nextOffsetToSend_, ackOffset);
+    gotAckSinceLastPoll_ = true;
+  }
+  if (ackOffset >= outboxHeader_.readTail()) {
+    peerWindowEnd_ =
+        std::max<uint64_t>(peerWindowEnd_, ackOffset + header.window);
+  }
+
+  if (header.length > 0) {
+    // Only the data that comes right after what we already have is kept, as
+    // long as there is room for it.
+    const uint64_t inboxHead = inboxHeader_.readHead();
+    const uint64_t inboxTail = inboxHeader_.readTail();
+    if (header.offset <= inboxHead &&
+        inboxHead < header.offset + header.length) {
+      const uint64_t skip = inboxHead - header.offset;
+      const size_t length = std::min<uint64_t>(
+          header.length - skip,
+          inboxHeader_.kDataPoolByteSize - (inboxHead - inboxTail));
+      copyToRing(
+          inboxData_.get(),
+          inboxHeader_.kDataPoolByteSize,
+          inboxHead,
+          payload + skip,
+          length);
+      // We could start a transaction and use the proper methods for this, but
+      // as this method is the only producer for the inbox ringbuffer we can
+      // cut it short and directly increase the head.
+      inboxHeader_.incHead(length);
+    }
+    needsAck_ = true;
+  }
+  if (header.flags & kProbeFlag) {
+    needsAck_ = true;
+  }
+
+  // Everything that follows from this segment (sending more data, acking it)
+  // is done once the reactor handed out all the segments it received, so that
+  // a single acknowledgement covers all of them.
+  context_->getReactor().requestPolling(connectionId_.value());
+
+  if (header.length > 0) {
+    processReadOperationsFromLoop();
+  }
+  if (gotAckSinceLastPoll_ && !writeOperations_.empty() && !error_) {
+    processWriteOperationsFromLoop();
+  }
+}
+
+void Connection::Impl::onPolled(std::chrono::steady_clock::time_point now) {
+  TP_DCHECK(context_->inLoop());
+  if (state_ != ESTABLISHED || error_) {
+    return;
+  }
+
+  const uint64_t outboxTail = outboxHeader_.readTail();
+  if (gotAckSinceLastPoll_) {
+    gotAckSinceLastPoll_ = false;
+    retransmitTimeout_ = kInitialRetransmitTimeout;
+    retransmitTimerArmed_ = false;
+  }
+  if (outboxTail == outboxHeader_.readHead()) {
+    retransmitTimerArmed_ = false;
+  } else if (!retransmitTimerArmed_) {
+    retransmitTimerArmed_ = true;
+    retransmitDeadline_ = now + retransmitTimeout_;
+  } else if (now >= retransmitDeadline_) {
+    if (++numRetransmits_ > kMaxNumRetransmits) {
+      setError_(TP_CREATE_ERROR(
+          XdpError, "the peer stopped acknowledging the data sent to it"));
+      return;
+    }
+    context_->countRetransmit();
+    if (nextOffsetToSend_ > outboxTail) {
+      TP_VLOG(9) << "Connection " << id_ << " is going back to offset "
+                 << outboxTail << " after a timeout";
+      nextOffsetToSend_ = outboxTail;
+    } else {
+      // Nothing is in flight, hence the peer's window must be closed, and the
+      // acknowledgement that would reopen it may have been lost.
+      TP_VLOG(9) << "Connection " << id_ << " is probing its peer's window";
+      sendSegment_(nextOffsetToSend_, /*length=*/0, kProbeFlag);
+    }
+    retransmitTimeout_ =
+        std::min<std::chrono::microseconds>(
+            retransmitTimeout_ * 2, kMaxRetransmitTimeout);
+    retransmitDeadline_ = now + retransmitTimeout_;
+  }
+
+  transmitFromLoop_();
+}
+
+void Connection::Impl::setError_(Error error) {
+  // Don't overwrite an error that's already set.
+  if (error_ || !error) {
+    return;
+  }
+
+  error_ = std::move(error);
+
+  handleError();
+}
+
+void Connection::Impl::handleError() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(8) << "Connection " << id_ << " is handling error " << error_.what();
+
+  for (auto& readOperation : readOperations_) {
+    readOperation.handleError(error_);
+  }
+  readOperations_.clear();
+  for (auto& writeOperation : writeOperations_) {
+    writeOperation.handleError(error_);
+  }
+  writeOperations_.clear();
+
+  // The segments that are still in flight will be dropped by the reactor, as
+  // their identifier isn't reused.
+  if (connectionId_.has_value()) {
+    context_->getReactor().unregisterConnection(connectionId_.value());
+    connectionId_.reset();
+  }
+
+  if (socket_.hasValue()) {
+    if (state_ > INITIALIZING) {
+      context_->unregisterDescriptor(socket_.fd());
+    }
+    socket_.reset();
+  }
+}
+
+void Connection::Impl::closeFromLoop() {
+  TP_DCHECK(context_->inLoop());
+  TP_VLOG(7) << "Connection " << id_ << " is closing";
+  setError_(TP_CREATE_ERROR(ConnectionClosedError));
+}
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
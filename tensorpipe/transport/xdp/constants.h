@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+namespace {
+
+// The size of the frames of the UMEM, each of which holds one packet. It also
+// caps the size of the packets, regardless of the interface's MTU.
+constexpr uint32_t kFrameSize = 4096;
+
+// The largest number of queues an interface can have, which sizes the map
+// through which the XDP program finds the socket for each queue.
+constexpr uint32_t kMaxNumQueues = 256;
+
+// How many packets the reactor receives, and how many completed transmissions
+// it reaps, at each iteration, at most.
+constexpr uint32_t kMaxNumPacketsPerPoll = 64;
+
+// The first retransmission happens when this much time passed since the oldest
+// segment still waiting for an acknowledgement (or since the last probe) was
+// sent, and each following one waits twice as long as the previous one, up to
+// the maximum. The peers are on the same network segment, hence the round trip
+// is expected to take far less than the initial timeout, unless the reactor of
+// the peer is asleep.
+constexpr std::chrono::microseconds kInitialRetransmitTimeout{1000};
+constexpr std::chrono::microseconds kMaxRetransmitTimeout{100000};
+
+// The connection fails after this many consecutive retransmissions without
+// hearing anything from the peer, which amounts to a few seconds.
+constexpr int kMaxNumRetransmits = 40;
+
+// The receiver tells the sender about the room that freed up in its inbox (in
+// addition to what it acknowledges) once it amounts to the size of its inbox
+// divided by this value.
+constexpr uint64_t kInboxSizeToWindowUpdateRatio = 4;
+
+} // namespace
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/error.h>
+#include <tensorpipe/transport/context.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+class Connection;
+class Listener;
+
+class Context final : public transport::Context {
+ public:
+  static constexpr uint16_t kDefaultUdpPort = 47474;
+  static constexpr size_t kDefaultNumFrames = 8192;
+  static constexpr size_t kDefaultInboxSize = 4 * 1024 * 1024;
+
+  // The connections send their data as UDP packets straight from and into an
+  // AF_XDP socket, bypassing the kernel's network stack: the context's reactor
+  // binds the socket to the given queue of the interface, and attaches an XDP
+  // program to the latter that hands it the packets for the given UDP port.
+  // The connections retransmit the packets that weren't acknowledged in time,
+  // and each one's peer tells it how much room is left in its inbox (of
+  // inboxSize bytes, rounded up to a power of two), which bounds how much data
+  // can be in flight. They are set up, and their peers' hangups are detected,
+  // through a TCP connection, on the addresses given to listen and connect.
+  //
+  // Only one context per interface can exist on each host, as an interface can
+  // only have one XDP program, and the packets for the UDP port must reach the
+  // queue the socket is bound to, e.g., by being steered there by the NIC (with
+  // ethtool's ntuple filters) or by the interface having a single queue. The
+  // peers must be on the same network segment, as the packets go straight to
+  // the MAC address of the peer's interface. The UMEM has numFrames frames (a
+  // power of two) of 4KB, half of which are used for receiving and half for
+  // transmitting. This requires Linux 5.9 or later, and the capabilities to
+  // load BPF programs and to create raw sockets (e.g., CAP_BPF, CAP_NET_ADMIN
+  // and CAP_NET_RAW), without which the context isn't viable.
+  explicit Context(
+      std::string interfaceName,
+      uint32_t queueId = 0,
+      uint16_t udpPort = kDefaultUdpPort,
+      BusyPollingPolicy policy = BusyPollingPolicy(),
+      size_t numFrames = kDefaultNumFrames,
+      size_t inboxSize = kDefaultInboxSize);
+
+  std::shared_ptr<transport::Connection> connect(std::string addr) override;
+
+  std::shared_ptr<transport::Listener> listen(std::string addr) override;
+
+  bool isViable() const override;
+
+  const std::string& domainDescriptor() const override;
+
+  std::map<std::string, uint64_t> getStats() const override;
+
+  std::tuple<Error, std::string> lookupAddrForIface(std::string iface);
+
+  std::tuple<Error, std::string> lookupAddrForHostname();
+
+  void setId(std::string id) override;
+
+  void close() override;
+
+  void join() override;
+
+  ~Context() override;
+
+ private:
+  class PrivateIface;
+
+  class Impl;
+
+  // The implementation is managed by a shared_ptr because each child object
+  // will also hold a shared_ptr to it (downcast as a shared_ptr to the private
+  // interface). However, its lifetime is tied to the one of this public object,
+  // since when the latter is destroyed the implementation is closed and joined.
+  std::shared_ptr<Impl> impl_;
+
+  // Allow listener to see the private interface.
+  friend class Listener;
+  // Allow connection to see the private interface.
+  friend class Connection;
+};
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/xdp/frame.h>
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+
+#include <cstring>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+namespace {
+
+constexpr size_t kEthernetHeaderLength = 14;
+constexpr size_t kIpHeaderLength = 20;
+constexpr size_t kUdpHeaderLength = 8;
+
+// The checksum of the IPv4 header. The UDP one is optional over IPv4, and left
+// out, as Ethernet's frame check sequence already covers the whole packet.
+uint16_t computeIpChecksum(const uint8_t* header) {
+  uint32_t sum = 0;
+  for (size_t idx = 0; idx < kIpHeaderLength; idx += 2) {
+    uint16_t word;
+    std::memcpy(&word, header + idx, sizeof(word));
+    sum += word;
+  }
+  while (sum >> 16 != 0) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return static_cast<uint16_t>(~sum);
+}
+
+} // namespace
+
+void writeFrameHeaders(
+    uint8_t* frame,
+    const Endpoint& source,
+    const Endpoint& destination,
+    const SegmentHeader& header) {
+  struct ether_header eth;
+  std::memcpy(eth.ether_dhost, destination.mac, sizeof(eth.ether_dhost));
+  std::memcpy(eth.ether_shost, source.mac, sizeof(eth.ether_shost));
+  eth.ether_type = htons(ETHERTYPE_IP);
+  std::memcpy(frame, &eth, kEthernetHeaderLength);
+
+  const size_t udpLength =
+      kUdpHeaderLength + sizeof(SegmentHeader) + header.length;
+  struct iphdr ip;
+  std::memset(&ip, 0, sizeof(ip));
+  ip.version = 4;
+  ip.ihl = kIpHeaderLength / 4;
+  ip.tot_len = htons(kIpHeaderLength + udpLength);
+  // The segments never get fragmented, hence they need no identification.
+  ip.frag_off = htons(IP_DF);
+  ip.ttl = 64;
+  ip.protocol = IPPROTO_UDP;
+  ip.saddr = source.ipv4;
+  ip.daddr = destination.ipv4;
+  uint8_t* ipHeader = frame + kEthernetHeaderLength;
+  std::memcpy(ipHeader, &ip, kIpHeaderLength);
+  ip.check = computeIpChecksum(ipHeader);
+  std::memcpy(ipHeader, &ip, kIpHeaderLength);
+
+  struct udphdr udp;
+  udp.source = source.udpPort;
+  udp.dest = destination.udpPort;
+  udp.len = htons(udpLength);
+  udp.check = 0;
+  uint8_t* udpHeader = ipHeader + kIpHeaderLength;
+  std::memcpy(udpHeader, &udp, kUdpHeaderLength);
+
+  std::memcpy(udpHeader + kUdpHeaderLength, &header, sizeof(header));
+}
+
+bool parseFrame(
+    const uint8_t* frame,
+    size_t length,
+    const Endpoint& destination,
+    SegmentHeader& header,
+    const uint8_t*& payload) {
+  if (length < kFrameHeadersLength) {
+    return false;
+  }
+  struct ether_header eth;
+  std::memcpy(&eth, frame, kEthernetHeaderLength);
+  if (eth.ether_type != htons(ETHERTYPE_IP)) {
+    return false;
+  }
+  const uint8_t* ipHeader = frame + kEthernetHeaderLength;
+  struct iphdr ip;
+  std::memcpy(&ip, ipHeader, kIpHeaderLength);
+  if (ip.version != 4 || ip.ihl != kIpHeaderLength / 4 ||
+      ip.protocol != IPPROTO_UDP || ip.daddr != destination.ipv4 ||
+      computeIpChecksum(ipHeader) != 0) {
+    return false;
+  }
+  const uint8_t* udpHeader = ipHeader + kIpHeaderLength;
+  struct udphdr udp;
+  std::memcpy(&udp, udpHeader, kUdpHeaderLength);
+  if (udp.dest != destination.udpPort) {
+    return false;
+  }
+  std::memcpy(&header, udpHeader + kUdpHeaderLength, sizeof(header));
+  // The packet may have been padded to Ethernet's minimum length.
+  if (ntohs(ip.tot_len) != kIpHeaderLength + ntohs(udp.len) ||
+      ntohs(udp.len) != kUdpHeaderLength + sizeof(header) + header.length ||
+      kFrameHeadersLength + header.length > length) {
+    return false;
+  }
+  payload = frame + kFrameHeadersLength;
+  return true;
+}
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
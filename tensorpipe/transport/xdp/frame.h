@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+// Where the packets for one side of a connection go: the MAC address of its
+// interface, and the IPv4 address and UDP port (both in network byte order)
+// that its reactor's XDP program picks up.
+struct Endpoint {
+  uint8_t mac[6];
+  uint32_t ipv4;
+  uint16_t udpPort;
+};
+
+// The header that follows the UDP one in each packet. The offsets count the
+// bytes of the stream that each side writes, from the start of the connection,
+// hence they never wrap around. Both sides use the same byte order.
+struct SegmentHeader {
+  // The receiver's identifier for the connection, assigned by its reactor.
+  uint32_t connectionId;
+  uint16_t flags;
+  // Of the payload that follows.
+  uint16_t length;
+  // Where the payload starts in the sender's stream.
+  uint64_t offset;
+  // How much of the receiver's stream the sender got so far, in order, and how
+  // much more of it the sender has room for.
+  uint64_t ackOffset;
+  uint32_t window;
+  uint32_t reserved;
+};
+
+// Set on segments without payload that ask for an acknowledgement anyway, in
+// order to find out whether the window reopened.
+constexpr uint16_t kProbeFlag = 1;
+
+// The Ethernet (without VLAN tag), IPv4 (without options), UDP and segment
+// headers, which the payload follows.
+constexpr size_t kFrameHeadersLength = 14 + 20 + 8 + sizeof(SegmentHeader);
+
+// Write the headers of a packet carrying the given segment, whose payload the
+// caller then writes right after them.
+void writeFrameHeaders(
+    uint8_t* frame,
+    const Endpoint& source,
+    const Endpoint& destination,
+    const SegmentHeader& header);
+
+// Check that the packet holds a well-formed segment for the given endpoint
+// (its IPv4 address and UDP port, as the NIC already looked at the MAC one),
+// and extract its header and payload (which points into the packet).
+bool parseFrame(
+    const uint8_t* frame,
+    size_t length,
+    const Endpoint& destination,
+    SegmentHeader& header,
+    const uint8_t*& payload);
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
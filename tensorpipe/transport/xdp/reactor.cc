@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <tensorpipe/transport/xdp/reactor.h>
+
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/transport/xdp/constants.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+Reactor::Reactor(
+    std::string interfaceName,
+    uint32_t queueId,
+    uint16_t udpPort,
+    BusyPollingPolicy policy,
+    uint32_t numFrames)
+    : BusyPollingLoop(std::move(policy)) {
+  TP_THROW_ASSERT_IF(queueId >= kMaxNumQueues)
+      << "The queue ID must be less than " << kMaxNumQueues;
+  Error error;
+  XdpInterface iface;
+  std::tie(error, iface) = lookUpXdpInterface(interfaceName);
+  // FIXME Instead of throwing away the error and setting a bool, we should have
+  // a way to set the reactor in an error state, and use that for viability.
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_ << " couldn't look up interface "
+               << interfaceName << ": " << error.what();
+    return;
+  }
+  std::tie(error, program_) =
+      XdpProgram::attach(iface.index, udpPort, kMaxNumQueues);
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't attach an XDP program to " << interfaceName
+               << ": " << error.what();
+    return;
+  }
+  std::tie(error, socket_) =
+      XdpSocket::create(iface.index, queueId, numFrames, kFrameSize);
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't create an AF_XDP socket on queue " << queueId
+               << " of " << interfaceName << ": " << error.what();
+    return;
+  }
+  error = program_.registerSocket(queueId, socket_);
+  if (error) {
+    TP_VLOG(9) << "Transport context " << id_
+               << " couldn't register its AF_XDP socket: " << error.what();
+    return;
+  }
+  TP_VLOG(9) << "Transport context " << id_ << " is using queue " << queueId
+             << " of " << interfaceName << " in "
+             << (socket_.isZeroCopy() ? "zero-copy" : "copy") << " mode";
+
+  std::memcpy(endpoint_.mac, iface.mac, sizeof(endpoint_.mac));
+  endpoint_.ipv4 = iface.ipv4;
+  endpoint_.udpPort = htons(udpPort);
+  // The kernel receives the packets past some headroom in the frame.
+  const size_t maxFrameLength = std::min<size_t>(
+      iface.mtu + ETH_HLEN, kFrameSize - XDP_PACKET_HEADROOM);
+  TP_THROW_ASSERT_IF(maxFrameLength <= kFrameHeadersLength)
+      << "The MTU of " << interfaceName << " is too small";
+  maxSegmentLength_ = std::min<size_t>(
+      maxFrameLength - kFrameHeadersLength,
+      std::numeric_limits<uint16_t>::max());
+
+  // Hand all the frames for receiving to the kernel. The fill ring has room
+  // for all of them, hence it never runs out of space when they come back.
+  const uint32_t numRxFrames = numFrames / 2;
+  XdpRing& fillRing = socket_.getFillRing();
+  for (uint32_t frameIdx = 0; frameIdx < numRxFrames; frameIdx++) {
+    fillRing.addrAt(fillRing.producerIndex() + frameIdx) =
+        static_cast<uint64_t>(frameIdx) * kFrameSize;
+  }
+  fillRing.submit(numRxFrames);
+  socket_.wakeUpForFill();
+  for (uint32_t frameIdx = numRxFrames; frameIdx < numFrames; frameIdx++) {
+    freeTxFrames_.push_back(static_cast<uint64_t>(frameIdx) * kFrameSize);
+  }
+
+  if (getPolicy().sleeps()) {
+    auto rv = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    eventFd_ = Fd(rv);
+    rv = ::epoll_create1(EPOLL_CLOEXEC);
+    TP_THROW_SYSTEM_IF(rv == -1, errno);
+    epollFd_ = Fd(rv);
+
+    for (int fd : {eventFd_.fd(), socket_.fd()}) {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.u64 = 0;
+      rv = ::epoll_ctl(epollFd_.fd(), EPOLL_CTL_ADD, fd, &ev);
+      TP_THROW_SYSTEM_IF(rv == -1, errno);
+    }
+    setWakeupEventFd(eventFd_.fd(), epollFd_.fd());
+  }
+
+  viable_ = true;
+  startThread("TP_XDP_reactor");
+}
+
+bool Reactor::isViable() const {
+  return viable_;
+}
+
+void Reactor::setId(std::string id) {
+  id_ = std::move(id);
+}
+
+void Reactor::close() {
+  if (!closed_.exchange(true)) {
+    stopBusyPolling();
+  }
+}
+
+void Reactor::join() {
+  close();
+
+  if (!joined_.exchange(true)) {
+    joinThread();
+  }
+}
+
+Reactor::~Reactor() {
+  join();
+}
+
+bool Reactor::pollOnce() {
+  // Send what the deferred functions transmitted since the last iteration.
+  if (numUnkickedTxPackets_ > 0) {
+    kickTx_();
+  }
+
+  const uint32_t numCompletions = reapCompletions_();
+  const uint32_t numReceived = receive_();
+  // The connections that are waiting for acknowledgements must not let the
+  // reactor consider itself idle, as they may have to retransmit.
+  const bool polledConnections = pollConnections_();
+
+  // In copy mode, the kernel only sends a batch of packets each time it's
+  // told to, hence it must be told again while some are left.
+  if (numUnkickedTxPackets_ > 0 ||
+      (numCompletions == 0 &&
+       freeTxFrames_.size() < socket_.getNumFrames() / 2)) {
+    kickTx_();
+  }
+
+  return numCompletions > 0 || numReceived > 0 || polledConnections;
+}
+
+uint32_t Reactor::reapCompletions_() {
+  XdpRing& completionRing = socket_.getCompletionRing();
+  const uint32_t num = completionRing.numAvailable();
+  for (uint32_t idx = 0; idx < num; idx++) {
+    freeTxFrames_.push_back(
+        completionRing.addrAt(completionRing.consumerIndex() + idx));
+  }
+  completionRing.release(num);
+  return num;
+}
+
+uint32_t Reactor::receive_() {
+  XdpRing& rxRing = socket_.getRxRing();
+  const uint32_t num = std::min(rxRing.numAvailable(), kMaxNumPacketsPerPoll);
+  if (num == 0) {
+    return 0;
+  }
+
+  XdpRing& fillRing = socket_.getFillRing();
+  for (uint32_t idx = 0; idx < num; idx++) {
+    const struct xdp_desc& desc = rxRing.descAt(rxRing.consumerIndex() + idx);
+    SegmentHeader header;
+    const uint8_t* payload;
+    if (parseFrame(
+            socket_.frameAt(desc.addr),
+            desc.len,
+            endpoint_,
+            header,
+            payload)) {
+      auto iter = connections_.find(header.connectionId);
+      if (iter != connections_.end()) {
+        // Keep the handler alive, in case it unregisters itself.
+        std::shared_ptr<XdpEventHandler> eventHandler =
+            iter->second.eventHandler;
+        eventHandler->onSegment(header, payload);
+      } else {
+        TP_VLOG(9) << "Transport context " << id_
+                   << " got a segment for unknown connection "
+                   << header.connectionId;
+      }
+    }
+    // The address points past the headroom, within the frame.
+    fillRing.addrAt(fillRing.producerIndex() + idx) =
+        desc.addr & ~static_cast<uint64_t>(kFrameSize - 1);
+  }
+  rxRing.release(num);
+  fillRing.submit(num);
+  socket_.wakeUpForFill();
+  return num;
+}
+
+bool Reactor::pollConnections_() {
+  if (polledConnections_.empty()) {
+    return false;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  // The handlers may ask to be polled again, hence we swap the list out first.
+  std::vector<uint32_t> connectionIds;
+  std::swap(connectionIds, polledConnections_);
+  for (uint32_t connectionId : connectionIds) {
+    auto iter = connections_.find(connectionId);
+    // It may have been unregistered in the meantime.
+    if (iter == connections_.end() || !iter->second.polled) {
+      continue;
+    }
+    iter->second.polled = false;
+    // Keep the handler alive, in case it unregisters itself.
+    std::shared_ptr<XdpEventHandler> eventHandler = iter->second.eventHandler;
+    eventHandler->onPolled(now);
+  }
+  return true;
+}
+
+void Reactor::kickTx_() {
+  socket_.wakeUpForTx();
+  numUnkickedTxPackets_ = 0;
+}
+
+void Reactor::prepareToSleep() {
+  if (numUnkickedTxPackets_ > 0) {
+    kickTx_();
+  }
+  socket_.wakeUpForFill();
+}
+
+bool Reactor::readyToClose() {
+  return connections_.empty();
+}
+
+uint32_t Reactor::registerConnection(
+    std::shared_ptr<XdpEventHandler> eventHandler) {
+  const uint32_t connectionId = nextConnectionId_++;
+  ConnectionInfo info;
+  info.eventHandler = std::move(eventHandler);
+  connections_.emplace(connectionId, std::move(info));
+  return connectionId;
+}
+
+void Reactor::unregisterConnection(uint32_t connectionId) {
+  auto iter = connections_.find(connectionId);
+  TP_DCHECK(iter != connections_.end());
+  connections_.erase(iter);
+}
+
+void Reactor::requestPolling(uint32_t connectionId) {
+  auto iter = connections_.find(connectionId);
+  TP_DCHECK(iter != connections_.end());
+  if (!iter->second.polled) {
+    iter->second.polled = true;
+    polledConnections_.push_back(connectionId);
+  }
+}
+
+uint8_t* Reactor::allocateTxFrame() {
+  if (freeTxFrames_.empty()) {
+    return nullptr;
+  }
+  const uint64_t addr = freeTxFrames_.back();
+  freeTxFrames_.pop_back();
+  return socket_.frameAt(addr);
+}
+
+void Reactor::transmit(uint8_t* frame, size_t length) {
+  TP_DCHECK_LE(length, kFrameSize);
+  // The transmit ring has room for all the frames for transmitting, hence it
+  // never runs out of space.
+  XdpRing& txRing = socket_.getTxRing();
+  struct xdp_desc& desc = txRing.descAt(txRing.producerIndex());
+  desc.addr = frame - socket_.frameAt(0);
+  desc.len = length;
+  desc.options = 0;
+  txRing.submit(1);
+  numUnkickedTxPackets_++;
+}
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <tensorpipe/common/busy_polling_loop.h>
+#include <tensorpipe/common/busy_polling_policy.h>
+#include <tensorpipe/common/fd.h>
+#include <tensorpipe/common/xdp.h>
+#include <tensorpipe/transport/xdp/frame.h>
+
+namespace tensorpipe {
+namespace transport {
+namespace xdp {
+
+class XdpEventHandler {
+ public:
+  // A segment for this connection arrived. The payload lives in the frame it
+  // was received into, which is given back to the kernel after the call.
+  virtual void onSegment(
+      const SegmentHeader& header,
+      const uint8_t* payload) = 0;
+
+  // Called at the next iteration of the reactor after requestPolling, once the
+  // segments received in that iteration have been handed out.
+  virtual void onPolled(std::chrono::steady_clock::time_point now) = 0;
+
+  virtual ~XdpEventHandler() = default;
+};
+
+// Reactor loop.
+//
+// It owns the AF_XDP socket, which is bound to one queue of the interface,
+// and the XDP program, which hands it the packets for the context's UDP port.
+// The first half of the frames of the UMEM is used to receive packets, which
+// are handed to the connection they are addressed to (by the identifier that
+// the reactor assigned to it), and the second half to transmit them.
+//
+// The connections have to retransmit the segments that weren't acknowledged
+// in time, hence they ask to be polled while they have any, and the reactor
+// doesn't consider itself idle meanwhile. If its busy-polling policy ever
+// lets it go to sleep, it does so in epoll, on the socket's file descriptor
+// (which becomes readable when packets arrive) along with an eventfd.
+//
+class Reactor final : public BusyPollingLoop {
+ public:
+  Reactor(
+      std::string interfaceName,
+      uint32_t queueId,
+      uint16_t udpPort,
+      BusyPollingPolicy policy,
+      uint32_t numFrames);
+
+  // Where the peers have to send the segments for this reactor's connections.
+  const Endpoint& getEndpoint() const {
+    return endpoint_;
+  }
+
+  // The largest payload that a segment can carry, given the interface's MTU.
+  size_t getMaxSegmentLength() const {
+    return maxSegmentLength_;
+  }
+
+  // Return the identifier that the peer must put in the segments it sends to
+  // this connection.
+  uint32_t registerConnection(std::shared_ptr<XdpEventHandler> eventHandler);
+
+  void unregisterConnection(uint32_t connectionId);
+
+  void requestPolling(uint32_t connectionId);
+
+  // Return a frame to write a packet into, or null if all the frames for
+  // transmitting are in use, in which case some will be available again at
+  // a later iteration.
+  uint8_t* allocateTxFrame();
+
+  // Queue up the packet in the frame for transmission. The frame is given back
+  // once it has been sent.
+  void transmit(uint8_t* frame, size_t length);
+
+  bool isViable() const;
+
+  void setId(std::string id);
+
+  void close();
+
+  void join();
+
+  ~Reactor();
+
+ protected:
+  bool pollOnce() override;
+
+  bool readyToClose() override;
+
+  void prepareToSleep() override;
+
+ private:
+  XdpProgram program_;
+  XdpSocket socket_;
+  Endpoint endpoint_;
+  size_t maxSegmentLength_{0};
+  bool viable_{false};
+
+  Fd eventFd_;
+  Fd epollFd_;
+
+  std::atomic<bool> closed_{false};
+  std::atomic<bool> joined_{false};
+  // An identifier for the context, composed of the identifier for the context,
+  // combined with the transport's name. It will only be used for logging and
+  // debugging purposes.
+  std::string id_{"N/A"};
+
+  struct ConnectionInfo {
+    std::shared_ptr<XdpEventHandler> eventHandler;
+    bool polled{false};
+  };
+
+  // The registered connections. Their identifiers are never reused, so that
+  // the segments that were in flight when a connection went away can't be
+  // mistaken for ones of a later connection.
+  std::unordered_map<uint32_t, ConnectionInfo> connections_;
+  uint32_t nextConnectionId_{0};
+
+  std::vector<uint32_t> polledConnections_;
+
+  // Return whether any connection was polled.
+  bool pollConnections_();
+
+  // The frames for transmitting that are neither in the transmit ring nor in
+  // the completion ring.
+  std::vector<uint64_t> freeTxFrames_;
+  // The packets submitted to the transmit ring since the kernel was last told
+  // to process it.
+  uint32_t numUnkickedTxPackets_{0};
+
+  // Return how many frames the kernel gave back.
+  uint32_t reapCompletions_();
+
+  // Return how many packets were received.
+  uint32_t receive_();
+
+  void kickTx_();
+};
+
+} // namespace xdp
+} // namespace transport
+} // namespace tensorpipe
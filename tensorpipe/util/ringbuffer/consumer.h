@@ -8,6 +8,12 @@
 
 #pragma once
 
+#include <array>
+#include <utility>
+
+#include <tensorpipe/common/copy.h>
+#include <tensorpipe/common/dsa.h>
+#include <tensorpipe/common/probes.h>
 #include <tensorpipe/util/ringbuffer/ringbuffer.h>
 
 namespace tensorpipe {
@@ -67,6 +73,7 @@ class Consumer {
     if (unlikely(!inTx())) {
       return -EINVAL;
     }
+    TP_PROBE(ring_consume, tx_size_);
     header_.incTail(tx_size_);
     tx_size_ = 0;
     inTx_ = false;
@@ -109,8 +116,17 @@ class Consumer {
       return {0, result};
     }
 
-    const uint64_t head = header_.readHead();
     const uint64_t tail = header_.readTail();
+    // The head is written by the producers, hence reading it requires fetching
+    // a cache line that they're likely to own. Our cached copy can only lag
+    // behind the real head, which means it can only underestimate the amount
+    // of data, thus it's safe to use it as long as it covers what we need. (It
+    // could even be behind the tail, if another consumer moved it.)
+    if (cachedHead_ < tail + tx_size_ + size) {
+      cachedHead_ = header_.readHead();
+    }
+    const uint64_t head = cachedHead_;
+    TP_DCHECK_LE(tail, head);
     TP_DCHECK_LE(head - tail, header_.kDataPoolByteSize);
 
     const size_t avail = head - tail - tx_size_;
@@ -145,9 +161,16 @@ class Consumer {
   }
 
   // Copy data from the ringbuffer into the provided buffer, up to the given
-  // size (only copy less data if allowPartial is set to true).
+  // size (only copy less data if allowPartial is set to true). If nonTemporal
+  // is set, the copy bypasses the cache, for destinations that won't be read
+  // soon (e.g., because they're larger than the cache). If a copy engine is
+  // given, the copy is handed to it instead (if it's large enough).
   template <bool allowPartial>
-  [[nodiscard]] ssize_t readInTx(void* buffer, const size_t size) noexcept {
+  [[nodiscard]] ssize_t readInTx(
+      void* buffer,
+      const size_t size,
+      bool nonTemporal = false,
+      DsaCopyEngine* copyEngine = nullptr) noexcept {
     ssize_t numBuffers;
     std::array<Buffer, 2> buffers;
     std::tie(numBuffers, buffers) = accessContiguousInTx<allowPartial>(size);
@@ -156,18 +179,34 @@ class Consumer {
       return numBuffers;
     }
 
+    if (copyEngine != nullptr && numBuffers > 0) {
+      // Both halves go in one batch.
+      std::array<DsaCopyEngine::Copy, 2> copies;
+      size_t offset = 0;
+      for (ssize_t bufferIdx = 0; bufferIdx < numBuffers; bufferIdx++) {
+        copies[bufferIdx] = DsaCopyEngine::Copy{
+            reinterpret_cast<uint8_t*>(buffer) + offset,
+            buffers[bufferIdx].ptr,
+            buffers[bufferIdx].len};
+        offset += buffers[bufferIdx].len;
+      }
+      copyEngine->copy(copies.data(), numBuffers);
+      return offset;
+    }
+
     if (unlikely(numBuffers == 0)) {
       // Nothing to do.
       return 0;
     } else if (likely(numBuffers == 1)) {
-      std::memcpy(buffer, buffers[0].ptr, buffers[0].len);
+      copy_(buffer, buffers[0].ptr, buffers[0].len, nonTemporal);
       return buffers[0].len;
     } else if (likely(numBuffers == 2)) {
-      std::memcpy(buffer, buffers[0].ptr, buffers[0].len);
-      std::memcpy(
+      copy_(buffer, buffers[0].ptr, buffers[0].len, nonTemporal);
+      copy_(
           reinterpret_cast<uint8_t*>(buffer) + buffers[0].len,
           buffers[1].ptr,
-          buffers[1].len);
+          buffers[1].len,
+          nonTemporal);
       return buffers[0].len + buffers[1].len;
     } else {
       TP_THROW_ASSERT() << "Bad number of buffers: " << numBuffers;
@@ -202,11 +241,53 @@ class Consumer {
     return size;
   }
 
+  // Give access to exactly the given size of data in the ringbuffer, so that
+  // the caller can consume it directly from there (e.g., by deserializing an
+  // object in place) rather than having it copied out to a temporary buffer.
+  // The returned buffers (as in accessContiguousInTx) are only valid until the
+  // data is freed by calling release, or left in the ringbuffer by calling
+  // cancelTx. Take care of opening the transaction, and of closing it in case
+  // of failure.
+  [[nodiscard]] std::pair<ssize_t, std::array<Buffer, 2>> peek(
+      size_t size) noexcept {
+    ssize_t ret = startTx();
+    if (0 > ret) {
+      return {ret, std::array<Buffer, 2>()};
+    }
+
+    auto result = accessContiguousInTx</*allowPartial=*/false>(size);
+    if (0 > result.first) {
+      auto r = cancelTx();
+      TP_DCHECK_EQ(r, 0);
+    }
+
+    return result;
+  }
+
+  // Free the space of the data that was obtained from peek.
+  [[nodiscard]] ssize_t release() noexcept {
+    return commitTx();
+  }
+
  private:
   RingBufferHeader& header_;
   const uint8_t* const data_;
-  unsigned tx_size_ = 0;
+  uint64_t tx_size_ = 0;
   bool inTx_{false};
+  // Last value of the head we've read. It's never ahead of the real one.
+  uint64_t cachedHead_{0};
+
+  static void copy_(
+      void* dst,
+      const void* src,
+      size_t length,
+      bool nonTemporal) noexcept {
+    if (nonTemporal) {
+      copyNonTemporal(dst, src, length);
+    } else {
+      std::memcpy(dst, src, length);
+    }
+  }
 };
 
 } // namespace ringbuffer
@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+namespace tensorpipe {
+namespace util {
+namespace ringbuffer {
+
+///
+/// Single-producer multi-consumer variant of a RingBuffer, which carries
+/// records, and where every record is delivered to every consumer.
+///
+/// This is meant for same-host broadcast: the producer writes a payload once
+/// and each of the consumers (typically in other processes) reads it from the
+/// shared data section, rather than having one copy of it per receiver. Each
+/// consumer has its own tail, on its own cache line, and the producer can only
+/// reuse the space that all of them have released, i.e., up to the minimum of
+/// the tails. Hence a slow consumer holds back the producer, but not the other
+/// consumers.
+///
+/// Each record starts with an 8-byte word that holds its length, followed by
+/// its data, and is padded to a multiple of 8 bytes. Since there's a single
+/// producer, moving the head is what publishes the record.
+///
+
+// The number of tails that the header has room for. It's fixed as the header
+// must have the same layout in all processes that map it.
+constexpr size_t kMaxNumConsumers = 16;
+
+namespace broadcast {
+
+constexpr size_t kHeaderSize = sizeof(uint64_t);
+
+inline size_t spanOf(size_t size) {
+  return (kHeaderSize + size + kHeaderSize - 1) & ~(kHeaderSize - 1);
+}
+
+} // namespace broadcast
+
+class MultiConsumerHeader {
+ public:
+  const uint64_t kDataPoolByteSize;
+  const uint64_t kDataModMask;
+  const uint64_t kNumConsumers;
+
+  MultiConsumerHeader(const MultiConsumerHeader&) = delete;
+  MultiConsumerHeader(MultiConsumerHeader&&) = delete;
+
+  MultiConsumerHeader(uint64_t min_data_byte_size, size_t num_consumers)
+      : kDataPoolByteSize{nextPow2(min_data_byte_size)},
+        kDataModMask{kDataPoolByteSize - 1},
+        kNumConsumers{num_consumers} {
+    TP_THROW_ASSERT_IF(kDataPoolByteSize < broadcast::kHeaderSize);
+    TP_THROW_ASSERT_IF(num_consumers == 0 || num_consumers > kMaxNumConsumers)
+        << "Unsupported number of consumers: " << num_consumers;
+  }
+
+  // See RingBufferHeader for the reasoning behind the memory orders. The head
+  // is only written by the producer, and each tail only by its consumer, hence
+  // there is no need for transactions.
+
+  uint64_t readHead() const {
+    return atomicHead_.load(std::memory_order_acquire);
+  }
+
+  void incHead(uint64_t inc) {
+    atomicHead_.fetch_add(inc, std::memory_order_release);
+  }
+
+  uint64_t readTail(size_t idx) const {
+    return tails_[idx].value.load(std::memory_order_acquire);
+  }
+
+  void incTail(size_t idx, uint64_t inc) {
+    tails_[idx].value.fetch_add(inc, std::memory_order_release);
+  }
+
+  // Tails only move forward and never overtake the head, hence the distance
+  // from the head tells which tail lags the most, even across wrap-arounds.
+  uint64_t readMinTail() const {
+    const uint64_t head = readHead();
+    uint64_t minTail = head;
+    for (size_t idx = 0; idx < kNumConsumers; idx++) {
+      const uint64_t tail = readTail(idx);
+      if (head - tail > head - minTail) {
+        minTail = tail;
+      }
+    }
+    return minTail;
+  }
+
+ private:
+  struct alignas(kCacheLineSize) Tail {
+    std::atomic<uint64_t> value{0};
+  };
+
+  // Written by the producer.
+  alignas(kCacheLineSize) std::atomic<uint64_t> atomicHead_{0};
+  // Each written by one consumer.
+  std::array<Tail, kMaxNumConsumers> tails_;
+};
+
+///
+/// Process' view of a multi-consumer ring buffer, as RingBuffer is for the
+/// regular one.
+///
+class MultiConsumerRingBuffer final {
+ public:
+  MultiConsumerRingBuffer() = default;
+
+  MultiConsumerRingBuffer(MultiConsumerHeader* header, uint8_t* data)
+      : header_(header), data_(data) {
+    TP_THROW_IF_NULLPTR(header_) << "Header cannot be nullptr";
+    TP_THROW_IF_NULLPTR(data_) << "Data cannot be nullptr";
+  }
+
+  MultiConsumerHeader& getHeader() {
+    return *header_;
+  }
+
+  uint8_t* getData() {
+    return data_;
+  }
+
+ private:
+  MultiConsumerHeader* header_ = nullptr;
+  uint8_t* data_ = nullptr;
+};
+
+class BroadcastProducer {
+ public:
+  BroadcastProducer() = delete;
+
+  BroadcastProducer(MultiConsumerRingBuffer& rb)
+      : header_{rb.getHeader()}, data_{rb.getData()} {
+    TP_THROW_IF_NULLPTR(data_);
+    TP_THROW_ASSERT_IF(
+        reinterpret_cast<uintptr_t>(data_) % broadcast::kHeaderSize != 0);
+  }
+
+  BroadcastProducer(const BroadcastProducer&) = delete;
+  BroadcastProducer& operator=(const BroadcastProducer&) = delete;
+
+  size_t getSize() const {
+    return header_.kDataPoolByteSize;
+  }
+
+  // Copy the given data into the ringbuffer as one record, which all consumers
+  // will see. Returns the size, or -ENOSPC if the slowest consumer hasn't freed
+  // enough space yet, or -EINVAL if the record could never fit.
+  [[nodiscard]] ssize_t write(const void* buffer, size_t size) noexcept {
+    const size_t span = broadcast::spanOf(size);
+    if (unlikely(span > header_.kDataPoolByteSize)) {
+      return -EINVAL;
+    }
+
+    const uint64_t head = header_.readHead();
+    // Scanning all the tails touches one cache line per consumer, hence only
+    // do it when our cached minimum doesn't leave enough room. As the minimum
+    // can only grow, the cached one can only underestimate the free space.
+    if (head - cachedMinTail_ + span > header_.kDataPoolByteSize) {
+      cachedMinTail_ = header_.readMinTail();
+      if (head - cachedMinTail_ + span > header_.kDataPoolByteSize) {
+        return -ENOSPC;
+      }
+    }
+
+    const uint64_t start = head & header_.kDataModMask;
+    const uint64_t offset = (start + broadcast::kHeaderSize) &
+        header_.kDataModMask;
+    const size_t firstLen =
+        std::min<size_t>(size, header_.kDataPoolByteSize - offset);
+    std::memcpy(data_ + offset, buffer, firstLen);
+    std::memcpy(
+        data_,
+        reinterpret_cast<const uint8_t*>(buffer) + firstLen,
+        size - firstLen);
+    *reinterpret_cast<uint64_t*>(data_ + start) = size;
+
+    header_.incHead(span);
+    return size;
+  }
+
+ private:
+  MultiConsumerHeader& header_;
+  uint8_t* const data_;
+  // Last value of the minimum tail we've computed. It's never ahead of the
+  // real one.
+  uint64_t cachedMinTail_{0};
+};
+
+class BroadcastConsumer {
+ public:
+  struct Buffer {
+    const uint8_t* ptr{nullptr};
+    size_t len{0};
+  };
+
+  BroadcastConsumer() = delete;
+
+  // Each consumer must use a different index, below the number of consumers
+  // the header was created for.
+  BroadcastConsumer(MultiConsumerRingBuffer& rb, size_t idx)
+      : header_{rb.getHeader()}, data_{rb.getData()}, idx_{idx} {
+    TP_THROW_IF_NULLPTR(data_);
+    TP_THROW_ASSERT_IF(idx_ >= header_.kNumConsumers)
+        << "Consumer index " << idx_ << " is out of range";
+  }
+
+  BroadcastConsumer(const BroadcastConsumer&) = delete;
+  BroadcastConsumer& operator=(const BroadcastConsumer&) = delete;
+
+  size_t getIndex() const {
+    return idx_;
+  }
+
+  // Copy the next record out of the ringbuffer, and return its size. Returns
+  // -ENODATA if there's no record, or -ENOSPC (leaving the record in place) if
+  // the buffer is too small for it.
+  [[nodiscard]] ssize_t read(void* buffer, size_t size) noexcept {
+    std::pair<ssize_t, std::array<Buffer, 2>> result = peek();
+    if (result.first < 0) {
+      return result.first;
+    }
+    if (static_cast<size_t>(result.first) > size) {
+      return -ENOSPC;
+    }
+    uint8_t* dst = reinterpret_cast<uint8_t*>(buffer);
+    std::memcpy(dst, result.second[0].ptr, result.second[0].len);
+    std::memcpy(
+        dst + result.second[0].len, result.second[1].ptr, result.second[1].len);
+    return release();
+  }
+
+  // Give access to the next record in place, without copying it out. The first
+  // item is its size, or -ENODATA, and the two buffers, chained together, hold
+  // its data. They remain valid until release is called, as the producer can't
+  // reuse the space before this consumer moves its tail past it.
+  [[nodiscard]] std::pair<ssize_t, std::array<Buffer, 2>> peek() noexcept {
+    const uint64_t tail = header_.readTail(idx_);
+    if (header_.readHead() == tail) {
+      return {-ENODATA, std::array<Buffer, 2>()};
+    }
+    const uint64_t start = tail & header_.kDataModMask;
+    const size_t length = *reinterpret_cast<const uint64_t*>(data_ + start);
+    const uint64_t offset = (start + broadcast::kHeaderSize) &
+        header_.kDataModMask;
+    const size_t firstLen =
+        std::min<size_t>(length, header_.kDataPoolByteSize - offset);
+    peekedLength_ = length;
+    return {
+        static_cast<ssize_t>(length),
+        {Buffer{data_ + offset, firstLen},
+         Buffer{data_, length - firstLen}}};
+  }
+
+  // Free this consumer's claim on the record obtained from peek, and return
+  // its size.
+  [[nodiscard]] ssize_t release() noexcept {
+    TP_DCHECK_NE(peekedLength_, -1);
+    const ssize_t length = peekedLength_;
+    header_.incTail(idx_, broadcast::spanOf(length));
+    peekedLength_ = -1;
+    return length;
+  }
+
+ private:
+  MultiConsumerHeader& header_;
+  const uint8_t* const data_;
+  const size_t idx_;
+  ssize_t peekedLength_{-1};
+};
+
+} // namespace ringbuffer
+} // namespace util
+} // namespace tensorpipe
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+namespace tensorpipe {
+namespace util {
+namespace ringbuffer {
+
+///
+/// Multi-producer variant of a RingBuffer, which carries records.
+///
+/// Any number of threads (or processes) can write records at the same time,
+/// without taking the write transaction, and a RecordConsumer reads them back
+/// in the order in which their space was reserved. A ringbuffer used this way
+/// must not be accessed with a regular Producer or Consumer.
+///
+/// Each record starts with an 8-byte word that holds its length and a commit
+/// flag, followed by its data, and is padded to a multiple of 8 bytes. Writers
+/// take a ticket, i.e., they reserve the record's space by moving the head with
+/// a compare-and-swap, then fill it in, and finally set the commit flag. The
+/// consumer stops at the first record that isn't committed yet, even if later
+/// ones are. Once it has read a record it zeroes its space before giving it
+/// back, so that stale data is never mistaken for a commit flag. The data of
+/// the ringbuffer must thus be zeroed (and 8-byte aligned) to begin with.
+///
+
+namespace record {
+
+constexpr size_t kHeaderSize = sizeof(uint64_t);
+constexpr uint64_t kCommitted = 1ull << 63;
+
+inline size_t spanOf(size_t size) {
+  return (kHeaderSize + size + kHeaderSize - 1) & ~(kHeaderSize - 1);
+}
+
+inline std::atomic<uint64_t>& headerAt(uint8_t* data, uint64_t offset) {
+  return *reinterpret_cast<std::atomic<uint64_t>*>(data + offset);
+}
+
+} // namespace record
+
+class MultiProducer {
+ public:
+  MultiProducer() = delete;
+
+  MultiProducer(RingBuffer& rb) : header_{rb.getHeader()}, data_{rb.getData()} {
+    TP_THROW_IF_NULLPTR(data_);
+    TP_THROW_ASSERT_IF(header_.kDataPoolByteSize < record::kHeaderSize);
+    TP_THROW_ASSERT_IF(
+        reinterpret_cast<uintptr_t>(data_) % record::kHeaderSize != 0);
+  }
+
+  MultiProducer(const MultiProducer&) = delete;
+  MultiProducer& operator=(const MultiProducer&) = delete;
+
+  size_t getSize() const {
+    return header_.kDataPoolByteSize;
+  }
+
+  // Copy the given data into the ringbuffer as one record. This can be called
+  // concurrently from any thread. Returns the size, or -ENOSPC if there isn't
+  // enough free space right now, or -EINVAL if the record could never fit.
+  [[nodiscard]] ssize_t write(const void* buffer, size_t size) noexcept {
+    const size_t span = record::spanOf(size);
+    if (unlikely(span > header_.kDataPoolByteSize)) {
+      return -EINVAL;
+    }
+
+    uint64_t head = header_.readHead();
+    while (true) {
+      // The tail can only lag behind, hence only underestimate the free space.
+      const uint64_t tail = header_.readTail();
+      if (head - tail + span > header_.kDataPoolByteSize) {
+        return -ENOSPC;
+      }
+      if (header_.tryIncHead(head, span)) {
+        break;
+      }
+    }
+
+    const uint64_t start = head & header_.kDataModMask;
+    copyIn_(
+        (start + record::kHeaderSize) & header_.kDataModMask,
+        reinterpret_cast<const uint8_t*>(buffer),
+        size);
+    record::headerAt(data_, start)
+        .store(record::kCommitted | size, std::memory_order_release);
+    return size;
+  }
+
+ private:
+  RingBufferHeader& header_;
+  uint8_t* const data_;
+
+  void copyIn_(uint64_t offset, const uint8_t* buffer, size_t size) {
+    const size_t firstLen =
+        std::min<size_t>(size, header_.kDataPoolByteSize - offset);
+    std::memcpy(data_ + offset, buffer, firstLen);
+    std::memcpy(data_, buffer + firstLen, size - firstLen);
+  }
+};
+
+class RecordConsumer {
+ public:
+  RecordConsumer() = delete;
+
+  RecordConsumer(RingBuffer& rb)
+      : header_{rb.getHeader()}, data_{rb.getData()} {
+    TP_THROW_IF_NULLPTR(data_);
+  }
+
+  RecordConsumer(const RecordConsumer&) = delete;
+  RecordConsumer& operator=(const RecordConsumer&) = delete;
+
+  // Copy the next record out of the ringbuffer, and return its size. Returns
+  // -ENODATA if there's no committed record at the front, -ENOSPC (leaving the
+  // record in place) if the buffer is too small for it, or -EAGAIN if another
+  // consumer is reading.
+  [[nodiscard]] ssize_t read(void* buffer, size_t size) noexcept {
+    if (header_.beginReadTransaction()) {
+      return -EAGAIN;
+    }
+    ssize_t ret = readInTx_(reinterpret_cast<uint8_t*>(buffer), size);
+    header_.endReadTransaction();
+    return ret;
+  }
+
+ private:
+  RingBufferHeader& header_;
+  uint8_t* const data_;
+
+  ssize_t readInTx_(uint8_t* buffer, size_t size) {
+    const uint64_t tail = header_.readTail();
+    if (header_.readHead() == tail) {
+      return -ENODATA;
+    }
+    const uint64_t start = tail & header_.kDataModMask;
+    std::atomic<uint64_t>& recordHeader = record::headerAt(data_, start);
+    const uint64_t word = recordHeader.load(std::memory_order_acquire);
+    if ((word & record::kCommitted) == 0) {
+      // Reserved, but still being written.
+      return -ENODATA;
+    }
+    const size_t length = word & ~record::kCommitted;
+    if (length > size) {
+      return -ENOSPC;
+    }
+
+    const uint64_t offset =
+        (start + record::kHeaderSize) & header_.kDataModMask;
+    const size_t firstLen =
+        std::min<size_t>(length, header_.kDataPoolByteSize - offset);
+    std::memcpy(buffer, data_ + offset, firstLen);
+    std::memcpy(buffer + firstLen, data_, length - firstLen);
+
+    // Records start at any multiple of 8, hence the whole span must be cleared
+    // for the writers of the next laps to find no commit flag set.
+    const size_t span = record::spanOf(length);
+    recordHeader.store(0, std::memory_order_relaxed);
+    const size_t restLen = span - record::kHeaderSize;
+    const size_t firstRestLen =
+        std::min<size_t>(restLen, header_.kDataPoolByteSize - offset);
+    std::memset(data_ + offset, 0, firstRestLen);
+    std::memset(data_, 0, restLen - firstRestLen);
+
+    header_.incTail(span);
+    return length;
+  }
+};
+
+} // namespace ringbuffer
+} // namespace util
+} // namespace tensorpipe
@@ -8,6 +8,10 @@
 
 #pragma once
 
+#include <array>
+#include <utility>
+
+#include <tensorpipe/common/probes.h>
 #include <tensorpipe/util/ringbuffer/ringbuffer.h>
 
 namespace tensorpipe {
@@ -67,6 +71,7 @@ class Producer {
     if (unlikely(!inTx())) {
       return -EINVAL;
     }
+    TP_PROBE(ring_commit, tx_size_);
     header_.incHead(tx_size_);
     tx_size_ = 0;
     // <in_write_tx> flags that we are in a transaction,
@@ -112,7 +117,14 @@ class Producer {
     }
 
     const uint64_t head = header_.readHead();
-    const uint64_t tail = header_.readTail();
+    // The tail is written by the consumers, hence reading it requires fetching
+    // a cache line that they're likely to own. Our cached copy can only lag
+    // behind the real tail, which means it can only underestimate the free
+    // space, thus it's safe to use it as long as it leaves enough room.
+    if (head - cachedTail_ + tx_size_ + size > header_.kDataPoolByteSize) {
+      cachedTail_ = header_.readTail();
+    }
+    const uint64_t tail = cachedTail_;
     TP_DCHECK_LE(head - tail, header_.kDataPoolByteSize);
 
     const size_t avail = header_.kDataPoolByteSize - (head - tail) - tx_size_;
@@ -146,6 +158,16 @@ class Producer {
     }
   }
 
+  // Give back the given number of bytes at the end of those accessed so far in
+  // this transaction, e.g., because fewer than were reserved ended up needed.
+  [[nodiscard]] ssize_t releaseInTx(size_t size) noexcept {
+    if (unlikely(!inTx() || size > tx_size_)) {
+      return -EINVAL;
+    }
+    tx_size_ -= size;
+    return 0;
+  }
+
   // Copy data from the provided buffer into the ringbuffer, up to the given
   // size (only copy less data if allowPartial is set to true).
   template <bool allowPartial>
@@ -206,11 +228,41 @@ class Producer {
     return size;
   }
 
+  // Reserve exactly the given size in the ringbuffer, so that the caller can
+  // produce the data directly into it (e.g., by serializing an object in place)
+  // rather than into a temporary buffer which then needs to be copied over.
+  // The returned buffers (as in accessContiguousInTx) are only valid until the
+  // data is published by calling commit, or discarded by calling cancelTx. Take
+  // care of opening the transaction, and of closing it in case of failure.
+  [[nodiscard]] std::pair<ssize_t, std::array<Buffer, 2>> reserve(
+      size_t size) noexcept {
+    ssize_t ret = startTx();
+    if (0 > ret) {
+      return {ret, std::array<Buffer, 2>()};
+    }
+
+    auto result = accessContiguousInTx</*allowPartial=*/false>(size);
+    TP_PROBE(ring_reserve, size, result.first);
+    if (0 > result.first) {
+      auto r = cancelTx();
+      TP_DCHECK_EQ(r, 0);
+    }
+
+    return result;
+  }
+
+  // Publish the data that was produced into the buffers obtained from reserve.
+  [[nodiscard]] ssize_t commit() noexcept {
+    return commitTx();
+  }
+
  private:
   RingBufferHeader& header_;
   uint8_t* const data_;
-  unsigned tx_size_ = 0;
+  uint64_t tx_size_ = 0;
   bool inTx_{false};
+  // Last value of the tail we've read. It's never ahead of the real one.
+  uint64_t cachedTail_{0};
 };
 
 } // namespace ringbuffer
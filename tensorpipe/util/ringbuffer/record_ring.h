@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include <tensorpipe/common/defs.h>
+#include <tensorpipe/util/ringbuffer/ringbuffer.h>
+
+namespace tensorpipe {
+namespace util {
+namespace ringbuffer {
+
+///
+/// Record-oriented variant of a RingBuffer, with a single writer and a single
+/// reader, which hands the records over in place and in batches.
+///
+/// Each record starts at a multiple of the cache line size (hence, if the data
+/// is cache-line aligned, as shared memory segments are, the header of each
+/// record sits at the start of a cache line, and the writer filling in one
+/// record doesn't steal the line from the reader of the previous one). It has
+/// an 8-byte header holding its length, followed by its data. Records are
+/// always contiguous: one that wouldn't fit before the end of the data is
+/// preceded by a padding record that fills the rest of it.
+///
+/// The reader goes through many records in a single read transaction, and can
+/// keep some of them (i.e., leave their data in place) after that, releasing
+/// them later and in any order. The space of the records only goes back to the
+/// writer once all of the records before them were released too. A ringbuffer
+/// used this way must not be accessed with any other producer or consumer.
+///
+
+namespace aligned_record {
+
+constexpr size_t kAlignment = kCacheLineSize;
+constexpr size_t kHeaderSize = sizeof(uint64_t);
+// Set on the records that pad the end of the data.
+constexpr uint64_t kPadding = 1ull << 63;
+// Set by the reader on the records it released, until the tail moves past them.
+constexpr uint64_t kReleased = 1ull << 62;
+constexpr uint64_t kLengthMask = kReleased - 1;
+
+inline size_t spanOf(size_t size) {
+  return (kHeaderSize + size + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+inline uint64_t& headerAt(uint8_t* data, uint64_t offset) {
+  return *reinterpret_cast<uint64_t*>(data + offset);
+}
+
+} // namespace aligned_record
+
+class RecordWriter {
+ public:
+  RecordWriter() = delete;
+
+  RecordWriter(RingBuffer& rb) : header_{rb.getHeader()}, data_{rb.getData()} {
+    TP_THROW_IF_NULLPTR(data_);
+    TP_THROW_ASSERT_IF(header_.kDataPoolByteSize < aligned_record::kAlignment);
+    TP_THROW_ASSERT_IF(
+        reinterpret_cast<uintptr_t>(data_) % aligned_record::kHeaderSize != 0);
+  }
+
+  RecordWriter(const RecordWriter&) = delete;
+  RecordWriter& operator=(const RecordWriter&) = delete;
+
+  ~RecordWriter() noexcept {
+    TP_THROW_ASSERT_IF(inTx_);
+  }
+
+  // Reserve a contiguous record of the given size, so that the caller can fill
+  // it in place, and then publish it by calling commit (or drop it by calling
+  // cancel). The first item is the size, or -ENOSPC if there isn't enough free
+  // space right now, -EAGAIN if another writer is in a transaction, -EBUSY if
+  // this one already is, or -EINVAL if the record is larger than half of the
+  // data (which is what guarantees that it fits, padding included, once the
+  // ringbuffer is empty).
+  [[nodiscard]] std::pair<ssize_t, uint8_t*> reserve(size_t size) noexcept {
+    const uint64_t poolSize = header_.kDataPoolByteSize;
+    const size_t span = aligned_record::spanOf(size);
+    if (unlikely(span > poolSize / 2)) {
+      return {-EINVAL, nullptr};
+    }
+    if (unlikely(inTx_)) {
+      return {-EBUSY, nullptr};
+    }
+    if (header_.beginWriteTransaction()) {
+      return {-EAGAIN, nullptr};
+    }
+
+    const uint64_t head = header_.readHead();
+    const uint64_t tail = header_.readTail();
+    const uint64_t start = head & header_.kDataModMask;
+    const uint64_t padding = span > poolSize - start ? poolSize - start : 0;
+    if (head - tail + padding + span > poolSize) {
+      header_.endWriteTransaction();
+      return {-ENOSPC, nullptr};
+    }
+
+    // Starts are multiples of the alignment, which divides the size of the
+    // data, hence there's always room for the header of the padding record.
+    if (padding > 0) {
+      aligned_record::headerAt(data_, start) = aligned_record::kPadding;
+    }
+    const uint64_t recordStart = padding > 0 ? 0 : start;
+    aligned_record::headerAt(data_, recordStart) = size;
+    txSpan_ = padding + span;
+    inTx_ = true;
+    return {size, data_ + recordStart + aligned_record::kHeaderSize};
+  }
+
+  // Publish the record obtained from reserve.
+  [[nodiscard]] ssize_t commit() noexcept {
+    if (unlikely(!inTx_)) {
+      return -EINVAL;
+    }
+    header_.incHead(txSpan_);
+    txSpan_ = 0;
+    inTx_ = false;
+    header_.endWriteTransaction();
+    return 0;
+  }
+
+  [[nodiscard]] ssize_t cancel() noexcept {
+    if (unlikely(!inTx_)) {
+      return -EINVAL;
+    }
+    txSpan_ = 0;
+    inTx_ = false;
+    header_.endWriteTransaction();
+    return 0;
+  }
+
+  // Copy the given data into the ringbuffer as one record. Returns the size, or
+  // an error as reserve does.
+  [[nodiscard]] ssize_t write(const void* buffer, size_t size) noexcept {
+    ssize_t ret;
+    uint8_t* ptr;
+    std::tie(ret, ptr) = reserve(size);
+    if (ret < 0) {
+      return ret;
+    }
+    std::memcpy(ptr, buffer, size);
+    ret = commit();
+    TP_DCHECK_EQ(ret, 0);
+    return size;
+  }
+
+ private:
+  RingBufferHeader& header_;
+  uint8_t* const data_;
+  uint64_t txSpan_{0};
+  bool inTx_{false};
+};
+
+class RecordReader {
+ public:
+  // Designates a record that the reader kept, in order to release it later.
+  struct RecordId {
+    uint64_t position;
+  };
+
+  RecordReader() = delete;
+
+  RecordReader(RingBuffer& rb)
+      : header_{rb.getHeader()},
+        data_{rb.getData()},
+        readPosition_{header_.readTail()} {
+    TP_THROW_IF_NULLPTR(data_);
+  }
+
+  RecordReader(const RecordReader&) = delete;
+  RecordReader& operator=(const RecordReader&) = delete;
+
+  // Hand the records that were published and not read yet, up to maxRecords of
+  // them, to the given function, in order and in a single read transaction.
+  // It's called as fn(RecordId, const uint8_t* ptr, size_t length) and returns
+  // whether it's done with the record, whose space is then released. Otherwise
+  // its data stays in place until the record is passed to release. Returns how
+  // many records were handed over, or -EAGAIN if another reader is reading.
+  template <typename TFn>
+  [[nodiscard]] ssize_t consumeBatch(TFn&& fn, size_t maxRecords) {
+    if (header_.beginReadTransaction()) {
+      return -EAGAIN;
+    }
+    const uint64_t head = header_.readHead();
+    size_t numRecords = 0;
+    while (numRecords < maxRecords && readPosition_ != head) {
+      const uint64_t start = readPosition_ & header_.kDataModMask;
+      uint64_t& recordHeader = aligned_record::headerAt(data_, start);
+      if (recordHeader & aligned_record::kPadding) {
+        readPosition_ += header_.kDataPoolByteSize - start;
+        continue;
+      }
+      const size_t length = recordHeader & aligned_record::kLengthMask;
+      const RecordId id{readPosition_};
+      readPosition_ += aligned_record::spanOf(length);
+      numRecords++;
+      if (fn(id, data_ + start + aligned_record::kHeaderSize, length)) {
+        recordHeader |= aligned_record::kReleased;
+      }
+    }
+    advanceTail_();
+    header_.endReadTransaction();
+    return numRecords;
+  }
+
+  // Release a record that was kept by the function given to consumeBatch. This
+  // must be called by the same thread that uses the reader (which can be from
+  // within that function).
+  void release(RecordId id) {
+    uint64_t& recordHeader =
+        aligned_record::headerAt(data_, id.position & header_.kDataModMask);
+    TP_DCHECK_EQ(recordHeader & aligned_record::kReleased, 0);
+    recordHeader |= aligned_record::kReleased;
+    advanceTail_();
+  }
+
+ private:
+  RingBufferHeader& header_;
+  uint8_t* const data_;
+  // How far the records were read, which is ahead of the tail by the records
+  // that are kept (and by those released after them).
+  uint64_t readPosition_;
+
+  // Move the tail past the leading records that were released.
+  void advanceTail_() {
+    const uint64_t tail = header_.readTail();
+    uint64_t newTail = tail;
+    while (newTail != readPosition_) {
+      const uint64_t start = newTail & header_.kDataModMask;
+      const uint64_t recordHeader = aligned_record::headerAt(data_, start);
+      if (recordHeader & aligned_record::kPadding) {
+        newTail += header_.kDataPoolByteSize - start;
+      } else if (recordHeader & aligned_record::kReleased) {
+        newTail +=
+            aligned_record::spanOf(recordHeader & aligned_record::kLengthMask);
+      } else {
+        break;
+      }
+    }
+    if (newTail != tail) {
+      header_.incTail(newTail - tail);
+    }
+  }
+};
+
+} // namespace ringbuffer
+} // namespace util
+} // namespace tensorpipe
@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <cstring>
+#include <limits>
 #include <memory>
 #include <type_traits>
 
@@ -44,6 +45,12 @@ namespace tensorpipe {
 namespace util {
 namespace ringbuffer {
 
+// The size of a cache line on the architectures we care about. It's used to
+// place the fields owned by producers and those owned by consumers on distinct
+// cache lines, so that they don't keep stealing them from each other when they
+// run on different cores (or, with shared memory, in different processes).
+constexpr size_t kCacheLineSize = 64;
+
 ///
 /// RingBufferHeader contains the head, tail and other control information
 /// of the RingBuffer.
@@ -71,9 +78,12 @@ class RingBufferHeader {
         << "Minimum supported ringbuffer data size is 2 bytes";
     TP_DCHECK(isPow2(kDataPoolByteSize))
         << kDataPoolByteSize << " is not a power of 2";
-    TP_DCHECK_LE(kDataPoolByteSize, std::numeric_limits<int>::max())
-        << "Logic piggy-backs read/write size on ints, to be safe forbid"
-           " buffer to ever be larger than what an int can hold";
+    // Rings can be larger than 4GB, but the sizes that the producers and
+    // consumers return are signed (negative values being errors).
+    TP_DCHECK_LE(
+        kDataPoolByteSize,
+        static_cast<uint64_t>(std::numeric_limits<ssize_t>::max()))
+        << "Buffer is larger than what a ssize_t can hold";
   }
 
   // Being in a transaction (either a read or a write one) gives a user of the
@@ -124,6 +134,15 @@ class RingBufferHeader {
     return atomicTail_.load(std::memory_order_acquire);
   }
 
+  // How many bytes were produced and not consumed yet. This is only meant for
+  // monitoring, as it's read outside of a transaction, and may thus be stale.
+  // The tail is read first, so that the head can't appear to be behind it.
+  uint64_t getUsedSize() const {
+    uint64_t tail = readTail();
+    uint64_t head = readHead();
+    return head - tail;
+  }
+
   void incHead(uint64_t inc) {
     atomicHead_.fetch_add(inc, std::memory_order_release);
   }
@@ -132,16 +151,78 @@ class RingBufferHeader {
     atomicTail_.fetch_add(inc, std::memory_order_release);
   }
 
+  // Multiple producers (see MultiProducer) don't take the write transaction,
+  // and rather claim space by moving the head forward with a compare-and-swap,
+  // which thus marks how far space was reserved rather than how far data was
+  // published. On failure, expected is updated to the current head.
+  [[nodiscard]] bool tryIncHead(uint64_t& expected, uint64_t inc) {
+    return atomicHead_.compare_exchange_weak(
+        expected,
+        expected + inc,
+        std::memory_order_acq_rel,
+        std::memory_order_acquire);
+  }
+
+  // When producer and consumer live in different threads (or processes) each
+  // one needs to notify the other when it makes progress (new data, or freed
+  // up space) but only if the other one is waiting for it: while it's actively
+  // polling the ringbuffer the notification is redundant. Hence a user that ran
+  // out of data (or space) arms a request for a trigger, and the other side
+  // takes it (clearing it) after progressing, and notifies only if it got it.
+  // This means that only the transition from idle to active is signaled. After
+  // arming, the waiting side must check the ringbuffer once more, as the other
+  // side might have progressed before the request became visible to it. The
+  // sequentially consistent fences make sure that at least one of them sees
+  // the other one's update (either the request or the head/tail).
+
+  void armConsumerTrigger() {
+    consumerWantsTrigger_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void armProducerTrigger() {
+    producerWantsTrigger_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Check the flag before exchanging it, so that when no request is pending
+  // (the common case while streaming) we don't take ownership of the cache
+  // line of the other side.
+
+  [[nodiscard]] bool takeConsumerTrigger() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return consumerWantsTrigger_.load(std::memory_order_relaxed) &&
+        consumerWantsTrigger_.exchange(false, std::memory_order_relaxed);
+  }
+
+  [[nodiscard]] bool takeProducerTrigger() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return producerWantsTrigger_.load(std::memory_order_relaxed) &&
+        producerWantsTrigger_.exchange(false, std::memory_order_relaxed);
+  }
+
  protected:
-  // Acquired by producers.
-  std::atomic_flag in_write_tx = ATOMIC_FLAG_INIT;
-  // Acquired by consumers.
-  std::atomic_flag in_read_tx = ATOMIC_FLAG_INIT;
+  // The fields are grouped by who writes to them: the producer-owned ones and
+  // the consumer-owned ones each start on their own cache line, and the
+  // constants above sit on yet another one, as they are read by both sides.
+  // Without this every incHead/incTail would invalidate the line that the
+  // other side is polling. The padding is part of the layout (and thus of the
+  // size of the header) hence both sides of a shared-memory ringbuffer must
+  // agree on it, which is checked when loading the header segment.
 
+  // Acquired by producers.
+  alignas(kCacheLineSize) std::atomic_flag in_write_tx = ATOMIC_FLAG_INIT;
   // Written by producers.
   std::atomic<uint64_t> atomicHead_{0};
+  // Armed by producers waiting for space, taken by consumers.
+  std::atomic<bool> producerWantsTrigger_{false};
+
+  // Acquired by consumers.
+  alignas(kCacheLineSize) std::atomic_flag in_read_tx = ATOMIC_FLAG_INIT;
   // Written by consumers.
   std::atomic<uint64_t> atomicTail_{0};
+  // Armed by consumers waiting for data, taken by producers.
+  std::atomic<bool> consumerWantsTrigger_{false};
 
   // http://www.open-std.org/jtc1/sc22/wg21/docs/papers/2007/n2427.html#atomics.lockfree
   // static_assert(
@@ -16,7 +16,8 @@ namespace shm {
 std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> create(
     size_t min_rb_byte_size,
     optional<util::shm::PageType> data_page_type,
-    bool perm_write) {
+    bool perm_write,
+    optional<int> numa_node) {
   util::shm::Segment header_segment;
   RingBufferHeader* header;
   std::tie(header_segment, header) =
@@ -26,7 +27,7 @@ std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> create(
   util::shm::Segment data_segment;
   uint8_t* data;
   std::tie(data_segment, data) = util::shm::Segment::create<uint8_t[]>(
-      header->kDataPoolByteSize, perm_write, data_page_type);
+      header->kDataPoolByteSize, perm_write, data_page_type, numa_node);
 
   // Note: cannot use implicit construction from initializer list on GCC 5.5:
   // "converting to XYZ from initializer list would use explicit constructor".
@@ -64,6 +65,63 @@ std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> load(
       RingBuffer(header, data));
 }
 
+std::tuple<util::shm::Segment, util::shm::Segment, MultiConsumerRingBuffer>
+createMultiConsumer(
+    size_t min_rb_byte_size,
+    size_t num_consumers,
+    optional<util::shm::PageType> data_page_type,
+    bool perm_write,
+    optional<int> numa_node) {
+  util::shm::Segment header_segment;
+  MultiConsumerHeader* header;
+  std::tie(header_segment, header) =
+      util::shm::Segment::create<MultiConsumerHeader>(
+          perm_write,
+          util::shm::PageType::Default,
+          min_rb_byte_size,
+          num_consumers);
+
+  util::shm::Segment data_segment;
+  uint8_t* data;
+  std::tie(data_segment, data) = util::shm::Segment::create<uint8_t[]>(
+      header->kDataPoolByteSize, perm_write, data_page_type, numa_node);
+
+  return std::make_tuple(
+      std::move(header_segment),
+      std::move(data_segment),
+      MultiConsumerRingBuffer(header, data));
+}
+
+std::tuple<util::shm::Segment, util::shm::Segment, MultiConsumerRingBuffer>
+loadMultiConsumer(
+    Fd header_fd,
+    Fd data_fd,
+    optional<util::shm::PageType> data_page_type,
+    bool perm_write) {
+  util::shm::Segment header_segment;
+  MultiConsumerHeader* header;
+  std::tie(header_segment, header) =
+      util::shm::Segment::load<MultiConsumerHeader>(
+          std::move(header_fd), perm_write, util::shm::PageType::Default);
+  constexpr auto kHeaderSize = sizeof(MultiConsumerHeader);
+  if (unlikely(kHeaderSize != header_segment.getSize())) {
+    TP_THROW_SYSTEM(EPERM) << "Header segment of unexpected size";
+  }
+
+  util::shm::Segment data_segment;
+  uint8_t* data;
+  std::tie(data_segment, data) = util::shm::Segment::load<uint8_t[]>(
+      std::move(data_fd), perm_write, data_page_type);
+  if (unlikely(header->kDataPoolByteSize != data_segment.getSize())) {
+    TP_THROW_SYSTEM(EPERM) << "Data segment of unexpected size";
+  }
+
+  return std::make_tuple(
+      std::move(header_segment),
+      std::move(data_segment),
+      MultiConsumerRingBuffer(header, data));
+}
+
 } // namespace shm
 } // namespace ringbuffer
 } // namespace util
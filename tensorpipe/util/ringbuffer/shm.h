@@ -9,6 +9,7 @@
 #pragma once
 
 #include <tensorpipe/common/fd.h>
+#include <tensorpipe/util/ringbuffer/multi_consumer.h>
 #include <tensorpipe/util/ringbuffer/ringbuffer.h>
 #include <tensorpipe/util/shm/segment.h>
 
@@ -30,10 +31,13 @@ namespace shm {
 /// <min_rb_byte_size> is the minimum size of the data section
 /// of a RingBuffer (or each CPU's RingBuffer).
 ///
+/// If <numa_node> is provided, the data section is bound to that NUMA node.
+///
 std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> create(
     size_t min_rb_byte_size,
     optional<util::shm::PageType> data_page_type = nullopt,
-    bool perm_write = true);
+    bool perm_write = true,
+    optional<int> numa_node = nullopt);
 
 std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> load(
     Fd header_fd,
@@ -41,6 +45,22 @@ std::tuple<util::shm::Segment, util::shm::Segment, RingBuffer> load(
     optional<util::shm::PageType> data_page_type = nullopt,
     bool perm_write = true);
 
+/// Same as above, for a ringbuffer that broadcasts to <num_consumers> readers.
+std::tuple<util::shm::Segment, util::shm::Segment, MultiConsumerRingBuffer>
+createMultiConsumer(
+    size_t min_rb_byte_size,
+    size_t num_consumers,
+    optional<util::shm::PageType> data_page_type = nullopt,
+    bool perm_write = true,
+    optional<int> numa_node = nullopt);
+
+std::tuple<util::shm::Segment, util::shm::Segment, MultiConsumerRingBuffer>
+loadMultiConsumer(
+    Fd header_fd,
+    Fd data_fd,
+    optional<util::shm::PageType> data_page_type = nullopt,
+    bool perm_write = true);
+
 } // namespace shm
 } // namespace ringbuffer
 } // namespace util
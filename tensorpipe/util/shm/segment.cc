@@ -9,10 +9,12 @@
 #include <tensorpipe/util/shm/segment.h>
 
 #include <fcntl.h>
+#include <linux/memfd.h>
 #include <linux/mman.h>
 #include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -22,6 +24,8 @@
 #include <thread>
 #include <tuple>
 
+#include <tensorpipe/common/system.h>
+
 namespace tensorpipe {
 namespace util {
 namespace shm {
@@ -39,6 +43,51 @@ Fd createShmFd() {
   return Fd(fd);
 }
 
+/// Try to create an anonymous file backed by huge pages of the given type,
+/// with all the pages needed to hold byte_size bytes already reserved. Return
+/// an empty Fd if that isn't possible, for example because the size isn't a
+/// multiple of the page size, because the kernel lacks support for it, or
+/// because there aren't enough free huge pages (they must often be reserved by
+/// the administrator). The caller is then expected to fall back to regular
+/// pages, since huge pages are only an optimization (they reduce TLB misses).
+Fd createHugeTlbShmFd(PageType page_type, size_t byte_size) {
+#if defined(MFD_HUGETLB) && defined(MFD_HUGE_2MB) && defined(MFD_HUGE_1GB)
+  constexpr size_t kMB = 1024 * 1024;
+  unsigned int flags = MFD_CLOEXEC | MFD_HUGETLB;
+  size_t page_size;
+  switch (page_type) {
+    case PageType::HugeTLB_2MB:
+      flags |= MFD_HUGE_2MB;
+      page_size = 2 * kMB;
+      break;
+    case PageType::HugeTLB_1GB:
+      flags |= MFD_HUGE_1GB;
+      page_size = 1024 * kMB;
+      break;
+    default:
+      return Fd();
+  }
+  if (byte_size == 0 || byte_size % page_size != 0) {
+    return Fd();
+  }
+
+  int fd = ::syscall(SYS_memfd_create, "tensorpipe_shm", flags);
+  if (fd == -1) {
+    return Fd();
+  }
+  Fd hugeTlbFd(fd);
+  // This fails with ENOSPC if there aren't enough free huge pages, which is
+  // better found out now than through a SIGBUS when touching the memory.
+  int ret = ::fallocate(hugeTlbFd.fd(), 0, 0, static_cast<off_t>(byte_size));
+  if (ret == -1) {
+    return Fd();
+  }
+  return hugeTlbFd;
+#else
+  return Fd();
+#endif
+}
+
 /// Choose a reasonable page size for a given size.
 /// This very opinionated choice of "reasonable" aims to
 /// keep wasted memory low.
@@ -83,38 +132,53 @@ update to obtain the latest correctness checks."
     prot |= PROT_WRITE;
   }
 
-  // FIXME mmap seems to fail with EINVAL if it cannot use hugepages when asked
-  // to do so. We could try with hugepages and, if it fails, try again without.
-  // But this adds complexity and I first want to know how much performance we
-  // gain through hugepages but so far I haven't been able to get them to work.
-  // switch (page_type.value_or(getDefaultPageType(byte_size))) {
-  //   case PageType::Default:
-  //     break;
-  //   case PageType::HugeTLB_2MB:
-  //     flags |= MAP_HUGETLB | MAP_HUGE_2MB;
-  //     break;
-  //   case PageType::HugeTLB_1GB:
-  //     flags |= MAP_HUGETLB | MAP_HUGE_1GB;
-  //     break;
-  // }
+  // No flag is needed for huge pages: if the file was created on hugetlbfs (see
+  // createHugeTlbShmFd) then its mappings automatically use them.
 
   return MmappedPtr(byte_size, prot, flags, fd);
 }
 
+void populatePages(uint8_t* ptr, size_t byte_size) {
+#ifdef MADV_POPULATE_READ
+  if (::madvise(ptr, byte_size, MADV_POPULATE_READ) == 0) {
+    return;
+  }
+#endif
+  // Kernels before 5.14 don't support the above. Reading a byte of each page
+  // is enough to map it, and works with read-only mappings too.
+  const size_t page_size = ::sysconf(_SC_PAGESIZE);
+  for (size_t offset = 0; offset < byte_size; offset += page_size) {
+    (void)*reinterpret_cast<volatile uint8_t*>(ptr + offset);
+  }
+}
+
 } // namespace
 
 Segment::Segment(
     size_t byte_size,
     bool perm_write,
-    optional<PageType> page_type)
-    : fd_(createShmFd()) {
-  // grow size to contain byte_size bytes.
-  off_t len = static_cast<off_t>(byte_size);
-  int ret = ::fallocate(fd_.fd(), 0, 0, len);
-  TP_THROW_SYSTEM_IF(ret == -1, errno)
-      << "Error while allocating " << byte_size << " bytes in shared memory";
+    optional<PageType> page_type,
+    optional<int> numa_node) {
+  if (page_type.has_value()) {
+    fd_ = createHugeTlbShmFd(page_type.value(), byte_size);
+  }
+  if (!fd_.hasValue()) {
+    fd_ = createShmFd();
+    // grow size to contain byte_size bytes.
+    off_t len = static_cast<off_t>(byte_size);
+    int ret = ::fallocate(fd_.fd(), 0, 0, len);
+    TP_THROW_SYSTEM_IF(ret == -1, errno)
+        << "Error while allocating " << byte_size << " bytes in shared memory";
+  }
 
   ptr_ = mmapShmFd(fd_.fd(), byte_size, perm_write, page_type);
+
+  // The pages were allocated by fallocate, according to the policy of the
+  // calling thread, hence they may need to be moved. As with huge pages, this
+  // is only an optimization, thus failing to do so is fine.
+  if (numa_node.has_value() && byte_size > 0) {
+    bindMemoryToNumaNode(ptr_.ptr(), byte_size, numa_node.value());
+  }
 }
 
 Segment::Segment(Fd fd, bool perm_write, optional<PageType> page_type)
@@ -129,6 +193,20 @@ Segment::Segment(Fd fd, bool perm_write, optional<PageType> page_type)
   ptr_ = mmapShmFd(fd_.fd(), byte_size, perm_write, page_type);
 }
 
+bool Segment::prefault(bool lock) {
+  uint8_t* ptr = ptr_.ptr();
+  const size_t byte_size = getSize();
+  if (byte_size == 0) {
+    return true;
+  }
+  // Locking the pages also faults them in.
+  if (lock && ::mlock(ptr, byte_size) == 0) {
+    return true;
+  }
+  populatePages(ptr, byte_size);
+  return !lock;
+}
+
 } // namespace shm
 } // namespace util
 } // namespace tensorpipe
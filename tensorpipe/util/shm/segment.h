@@ -41,7 +41,13 @@ class Segment {
  public:
   Segment() = default;
 
-  Segment(size_t byte_size, bool perm_write, optional<PageType> page_type);
+  /// If numa_node is given, the memory is bound to that NUMA node (when the
+  /// system allows it) before it's first touched.
+  Segment(
+      size_t byte_size,
+      bool perm_write,
+      optional<PageType> page_type,
+      optional<int> numa_node = nullopt);
 
   Segment(Fd fd, bool perm_write, optional<PageType> page_type);
 
@@ -85,7 +91,8 @@ class Segment {
   static std::pair<Segment, TScalar*> create(
       size_t num_elements,
       bool perm_write,
-      optional<PageType> page_type) {
+      optional<PageType> page_type,
+      optional<int> numa_node = nullopt) {
     static_assert(
         std::is_same<TScalar[], T>::value,
         "Only one-dimensional unbounded arrays are supported");
@@ -95,7 +102,7 @@ class Segment {
         "are trivially copyable (i.e. no pointers and no heap allocation");
 
     size_t byte_size = sizeof(TScalar) * num_elements;
-    Segment segment(byte_size, perm_write, page_type);
+    Segment segment(byte_size, perm_write, page_type, numa_node);
     TP_DCHECK_EQ(segment.getSize(), byte_size);
 
     // Initialize in place.
@@ -173,6 +180,13 @@ class Segment {
     return ptr_.getLength();
   }
 
+  /// Fault all the pages of this mapping in now, rather than on first touch,
+  /// and, if lock is set, lock them in memory so that they can't be swapped
+  /// out. Each process has its own mapping, hence it needs to do this on its
+  /// own. Returns false if the locking failed (e.g., because of
+  /// RLIMIT_MEMLOCK), in which case the pages are still faulted in.
+  bool prefault(bool lock);
+
  private:
   // The file descriptor of the shared memory file.
   Fd fd_;